@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Runs the tests labeled 'perf' in a build directory, collects the results
+# they record with RecordPerfResult() into a JSON file, and compares them
+# against a baseline file. Exits non-zero if a test fails or a result is
+# worse than its baseline by more than the tolerance of its rule.
+#
+# The baselines are specific to the host they were recorded on, so record
+# them on the host which runs the suite:
+#
+#   build-support/run_perf_suite.py --build-dir build/release \
+#       --update-baseline
+#
+# The tests of this script run with, from build-support:
+#
+#   python3 -m unittest run_perf_suite
+
+import argparse
+import fnmatch
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import unittest
+
+DEFAULT_BASELINE = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), "perf_baselines.json")
+
+
+def load_results(path):
+    """Reads the lines of JSON written by RecordPerfResult(). A result
+    recorded more than once keeps its last value."""
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line:
+                result = json.loads(line)
+                results[result["name"]] = result["value"]
+    return results
+
+
+def find_rule(rules, name):
+    for rule in rules:
+        if fnmatch.fnmatchcase(name, rule["pattern"]):
+            return rule
+    return None
+
+
+def compare(baseline, results):
+    """Compares 'results' against 'baseline'. Returns a list of
+    (name, baseline value, value, change in percent, status) tuples, sorted
+    by name, where status is 'ok', 'regressed', 'new' or 'missing'."""
+    rows = []
+    baselines = baseline.get("baselines", {})
+    rules = baseline.get("rules", [])
+    for name in sorted(set(baselines) | set(results)):
+        base = baselines.get(name)
+        value = results.get(name)
+        if base is None:
+            rows.append((name, None, value, None, "new"))
+            continue
+        if value is None:
+            rows.append((name, base, None, None, "missing"))
+            continue
+        change_pct = (value - base) * 100.0 / base if base else 0.0
+        status = "ok"
+        rule = find_rule(rules, name)
+        if rule is not None:
+            tolerance = rule["tolerance_pct"]
+            if rule["better"] == "higher" and change_pct < -tolerance:
+                status = "regressed"
+            elif rule["better"] == "lower" and change_pct > tolerance:
+                status = "regressed"
+        rows.append((name, base, value, change_pct, status))
+    return rows
+
+
+def format_value(v):
+    return "-" if v is None else "%.6g" % v
+
+
+def print_report(rows, out):
+    for name, base, value, change_pct, status in rows:
+        change = "-" if change_pct is None else "%+.1f%%" % change_pct
+        out.write("%-9s %12s -> %12s %8s  %s\n" % (
+            status, format_value(base), format_value(value), change, name))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run the perf regression suite and compare the results "
+                    "against a baseline.")
+    parser.add_argument(
+        "--build-dir", default=".",
+        help="Build directory to run the tests labeled 'perf' in")
+    parser.add_argument(
+        "--baseline", default=DEFAULT_BASELINE,
+        help="Baseline file to compare against")
+    parser.add_argument(
+        "--results",
+        help="File to write the results to, as JSON. Defaults to "
+             "perf-results.json in the build directory")
+    parser.add_argument(
+        "--update-baseline", action="store_true",
+        help="Replace the baselines in the baseline file with the results, "
+             "rather than comparing against them")
+    parser.add_argument(
+        "ctest_args", nargs="*",
+        help="More arguments for ctest, e.g. -R log-bench, after '--'")
+    args = parser.parse_args()
+
+    results_path = args.results or os.path.join(
+        args.build_dir, "perf-results.json")
+    fd, lines_path = tempfile.mkstemp(prefix="perf-results-")
+    os.close(fd)
+    try:
+        env = dict(os.environ)
+        env["KUDU_PERF_RESULTS"] = lines_path
+        ret = subprocess.call(
+            ["ctest", "-L", "perf", "--output-on-failure"] + args.ctest_args,
+            cwd=args.build_dir, env=env)
+        results = load_results(lines_path)
+    finally:
+        os.unlink(lines_path)
+    with open(results_path, "w") as f:
+        json.dump({"results": results}, f, indent=2, sort_keys=True)
+        f.write("\n")
+    if ret != 0:
+        print("perf tests failed; results so far are in %s" % results_path)
+        return ret
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if args.update_baseline:
+        baseline["baselines"] = results
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("recorded %d baselines in %s" % (len(results), args.baseline))
+        return 0
+
+    rows = compare(baseline, results)
+    print_report(rows, sys.stdout)
+    regressed = [r for r in rows if r[4] == "regressed"]
+    if regressed:
+        print("%d of %d results regressed" % (len(regressed), len(rows)))
+        return 1
+    return 0
+
+
+class Test(unittest.TestCase):
+    BASELINE = {
+        "rules": [
+            {"pattern": "*_us", "better": "lower", "tolerance_pct": 15},
+            {"pattern": "*", "better": "higher", "tolerance_pct": 15},
+        ],
+        "baselines": {
+            "raft.commit_p99_us": 1000,
+            "raft.ops_per_sec": 5000,
+            "gone.ops_per_sec": 1,
+        },
+    }
+
+    def test_compare(self):
+        rows = compare(self.BASELINE, {
+            "raft.commit_p99_us": 1200,
+            "raft.ops_per_sec": 4500,
+            "new.ops_per_sec": 1,
+        })
+        self.assertEqual(
+            [(r[0], r[4]) for r in rows],
+            [("gone.ops_per_sec", "missing"),
+             ("new.ops_per_sec", "new"),
+             ("raft.commit_p99_us", "regressed"),
+             ("raft.ops_per_sec", "ok")])
+
+    def test_improvements_pass(self):
+        rows = compare(self.BASELINE, {
+            "raft.commit_p99_us": 500,
+            "raft.ops_per_sec": 10000,
+        })
+        self.assertFalse([r for r in rows if r[4] == "regressed"])
+
+
+if __name__ == "__main__":
+    sys.exit(main())
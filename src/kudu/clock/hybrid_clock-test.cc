@@ -43,6 +43,7 @@
 #include "kudu/util/thread.h"
 
 DECLARE_bool(inject_unsync_time_errors);
+DECLARE_int32(ntp_error_refresh_ms);
 DECLARE_string(time_source);
 
 using std::string;
@@ -310,6 +311,42 @@ TEST_F(HybridClockTest, TestClockDoesntGoBackwardsWithUpdates) {
   }
 }
 
+// Concurrent readers of the clock must each get distinct, increasing
+// timestamps.
+TEST_F(HybridClockTest, TestConcurrentNowIsUnique) {
+  const int kNumThreads = 8;
+  const int kReadsPerThread = 10000;
+  vector<vector<uint64_t>> reads(kNumThreads);
+  vector<scoped_refptr<Thread>> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    scoped_refptr<Thread> thread;
+    vector<uint64_t>* thread_reads = &reads[i];
+    ASSERT_OK(Thread::Create(
+        "test",
+        "reader",
+        [this, thread_reads]() {
+          for (int j = 0; j < kReadsPerThread; j++) {
+            thread_reads->push_back(clock_->Now().value());
+          }
+        },
+        &thread));
+    threads.push_back(thread);
+  }
+  for (const auto& t : threads) {
+    t->Join();
+  }
+
+  vector<uint64_t> all;
+  for (const auto& thread_reads : reads) {
+    for (int j = 1; j < thread_reads.size(); j++) {
+      ASSERT_LT(thread_reads[j - 1], thread_reads[j]);
+    }
+    all.insert(all.end(), thread_reads.begin(), thread_reads.end());
+  }
+  std::sort(all.begin(), all.end());
+  ASSERT_TRUE(std::adjacent_find(all.begin(), all.end()) == all.end());
+}
+
 TEST_F(HybridClockTest, TestGetPhysicalComponentDifference) {
   Timestamp now1 =
       HybridClock::TimestampFromMicrosecondsAndLogicalValue(100, 100);
@@ -360,6 +397,27 @@ TEST_F(HybridClockTest, TestRideOverNtpInterruption) {
 }
 
 #ifndef __APPLE__
+// With --ntp_error_refresh_ms, reads between refreshes extrapolate the error
+// bound of the last one.
+TEST_F(HybridClockTest, TestNtpErrorRefresh) {
+  FLAGS_ntp_error_refresh_ms = 60 * 1000;
+  Timestamp timestamps[2];
+  uint64_t max_error_usec[2];
+  clock_->NowWithError(&timestamps[0], &max_error_usec[0]);
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  clock_->NowWithError(&timestamps[1], &max_error_usec[1]);
+
+  ASSERT_LT(timestamps[0].ToUint64(), timestamps[1].ToUint64());
+  ASSERT_GE(
+      clock_->GetPhysicalComponentDifference(timestamps[1], timestamps[0])
+          .ToMilliseconds(),
+      100);
+  // Grown by the skew over about 100 ms, give or take the rounding.
+  const int64_t skew_ppm = clock_->time_service()->skew_ppm();
+  ASSERT_GE(max_error_usec[1], max_error_usec[0] + 100 * skew_ppm / 1000);
+  ASSERT_LE(max_error_usec[1], max_error_usec[0] + 1000 * skew_ppm / 1000);
+}
+
 TEST_F(HybridClockTest, TestNtpDiagnostics) {
   vector<string> log;
   clock_->time_service()->DumpDiagnostics(&log);
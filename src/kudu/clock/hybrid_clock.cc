@@ -145,8 +145,6 @@ Status HybridClock::Init() {
 Timestamp HybridClock::Now() {
   Timestamp now;
   uint64_t error;
-
-  std::lock_guard<simple_spinlock> lock(lock_);
   NowWithError(&now, &error);
   return now;
 }
@@ -154,11 +152,7 @@ Timestamp HybridClock::Now() {
 Timestamp HybridClock::NowLatest() {
   Timestamp now;
   uint64_t error;
-
-  {
-    std::lock_guard<simple_spinlock> lock(lock_);
-    NowWithError(&now, &error);
-  }
+  NowWithError(&now, &error);
 
   uint64_t now_latest = GetPhysicalValueMicros(now) + error;
   uint64_t now_logical = GetLogicalValue(now);
@@ -184,11 +178,19 @@ void HybridClock::NowWithError(Timestamp* timestamp, uint64_t* max_error_usec) {
   WalltimeWithErrorOrDie(&now_usec, &error_usec);
 
   // If the physical time from the system clock is higher than our last-returned
-  // time, we should use the physical timestamp.
-  uint64_t candidate_phys_timestamp = now_usec << kBitsToShift;
-  if (PREDICT_TRUE(candidate_phys_timestamp > next_timestamp_)) {
-    next_timestamp_ = candidate_phys_timestamp;
-    *timestamp = Timestamp(next_timestamp_++);
+  // time, we should use the physical timestamp. Otherwise the next timestamp
+  // is issued, and the one after it becomes next. Either way, the timestamp
+  // is claimed with a CAS, so that concurrent callers never get the same one.
+  const uint64_t candidate_phys_timestamp = now_usec << kBitsToShift;
+  uint64_t next = next_timestamp_.load(std::memory_order_relaxed);
+  uint64_t issued;
+  do {
+    issued = std::max(candidate_phys_timestamp, next);
+  } while (!next_timestamp_.compare_exchange_weak(
+      next, issued + 1, std::memory_order_relaxed));
+  *timestamp = Timestamp(issued);
+
+  if (PREDICT_TRUE(issued == candidate_phys_timestamp)) {
     *max_error_usec = error_usec;
     if (PREDICT_FALSE(VLOG_IS_ON(2))) {
       VLOG(2)
@@ -217,8 +219,7 @@ void HybridClock::NowWithError(Timestamp* timestamp, uint64_t* max_error_usec) {
   // This broadens the error interval for both cases but always returns
   // a correct error interval.
 
-  *max_error_usec = (next_timestamp_ >> kBitsToShift) - (now_usec - error_usec);
-  *timestamp = Timestamp(next_timestamp_++);
+  *max_error_usec = (issued >> kBitsToShift) - (now_usec - error_usec);
   if (PREDICT_FALSE(VLOG_IS_ON(2))) {
     VLOG(2)
         << "Current clock is lower than the last one. Returning last read and incrementing"
@@ -229,7 +230,6 @@ void HybridClock::NowWithError(Timestamp* timestamp, uint64_t* max_error_usec) {
 }
 
 Status HybridClock::Update(const Timestamp& to_update) {
-  std::lock_guard<simple_spinlock> lock(lock_);
   Timestamp now;
   uint64_t error_ignored;
   NowWithError(&now, &error_ignored);
@@ -253,8 +253,12 @@ Status HybridClock::Update(const Timestamp& to_update) {
   }
 
   // Our next timestamp must be higher than the one that we are updating
-  // from.
-  next_timestamp_ = to_update.value() + 1;
+  // from. Concurrent calls may have moved it further already.
+  uint64_t next = next_timestamp_.load(std::memory_order_relaxed);
+  while (next <= to_update.value() &&
+         !next_timestamp_.compare_exchange_weak(
+             next, to_update.value() + 1, std::memory_order_relaxed)) {
+  }
   return Status::OK();
 }
 
@@ -281,10 +285,7 @@ Status HybridClock::WaitUntilAfter(
   TRACE_EVENT0("clock", "HybridClock::WaitUntilAfter");
   Timestamp now;
   uint64_t error;
-  {
-    std::lock_guard<simple_spinlock> lock(lock_);
-    NowWithError(&now, &error);
-  }
+  NowWithError(&now, &error);
 
   // "unshift" the timestamps so that we can measure actual time
   uint64_t now_usec = GetPhysicalValueMicros(now);
@@ -323,10 +324,7 @@ Status HybridClock::WaitUntilAfterLocally(
     const MonoTime& deadline) {
   Timestamp now;
   uint64_t error;
-  {
-    std::lock_guard<simple_spinlock> lock(lock_);
-    NowWithError(&now, &error);
-  }
+  NowWithError(&now, &error);
   if (now > then) {
     return Status::OK();
   }
@@ -348,11 +346,9 @@ bool HybridClock::IsAfter(Timestamp t) {
   uint64_t error_usec;
   WalltimeWithErrorOrDie(&now_usec, &error_usec);
 
-  Timestamp now;
-  {
-    std::lock_guard<simple_spinlock> lock(lock_);
-    now = Timestamp(std::max(next_timestamp_, now_usec << kBitsToShift));
-  }
+  const Timestamp now(std::max(
+      next_timestamp_.load(std::memory_order_relaxed),
+      now_usec << kBitsToShift));
   return t.value() < now.value();
 }
 
@@ -400,9 +396,15 @@ Status HybridClock::WalltimeWithError(
     MonoTime read_time_max_likelihood =
         read_time_before + MonoDelta::FromMicroseconds(read_time_error_us);
 
-    std::unique_lock<simple_spinlock> l(last_clock_read_lock_);
-    if (!last_clock_read_time_.Initialized() ||
-        last_clock_read_time_ < read_time_max_likelihood) {
+    //
+    // If another thread is recording its read, which is about as recent as
+    // this one, this one is skipped rather than waited for, so that reading
+    // the clock isn't serialized.
+    std::unique_lock<simple_spinlock> l(
+        last_clock_read_lock_, std::try_to_lock);
+    if (l.owns_lock() &&
+        (!last_clock_read_time_.Initialized() ||
+         last_clock_read_time_ < read_time_max_likelihood)) {
       last_clock_read_time_ = read_time_max_likelihood;
       last_clock_read_physical_ = *now_usec;
       last_clock_read_error_ = *error_usec + read_time_error_us;
@@ -448,8 +450,6 @@ uint64_t HybridClock::NowForMetrics() {
 uint64_t HybridClock::ErrorForMetrics() {
   Timestamp now;
   uint64_t error;
-
-  std::lock_guard<simple_spinlock> lock(lock_);
   NowWithError(&now, &error);
   return error;
 }
@@ -16,6 +16,7 @@
 // under the License.
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -128,6 +129,9 @@ class HybridClock : public Clock {
   // error in micros. This may fail if the clock is unsynchronized or
   // synchronized but the error is too high and, since we can't do anything
   // about it, LOG(FATAL)'s in that case.
+  //
+  // Thread-safe, and lock-free: concurrent callers claim their timestamps
+  // with a CAS on the next one.
   void NowWithError(Timestamp* timestamp, uint64_t* max_error_usec);
 
   virtual std::string Stringify(Timestamp timestamp) override;
@@ -185,11 +189,9 @@ class HybridClock : public Clock {
   // service.
   std::unique_ptr<clock::TimeService> time_service_;
 
-  mutable simple_spinlock lock_;
-
   // The next timestamp to be generated from this clock, assuming that
   // the physical clock hasn't advanced beyond the value stored here.
-  uint64_t next_timestamp_;
+  std::atomic<uint64_t> next_timestamp_;
 
   // The last valid clock reading we got from the time source, along
   // with the monotime that we took that reading.
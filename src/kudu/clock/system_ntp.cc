@@ -19,6 +19,7 @@
 
 #include <sys/time.h>
 #include <sys/timex.h>
+#include <time.h>
 
 #include <cerrno>
 #include <ostream>
@@ -51,6 +52,19 @@ DEFINE_int32(
 TAG_FLAG(ntp_initial_sync_wait_secs, evolving);
 TAG_FLAG(ntp_initial_sync_wait_secs, advanced);
 
+DEFINE_int32(
+    ntp_error_refresh_ms,
+    0,
+    "If positive, the clock error bound is read from the kernel at most this "
+    "often, and extrapolated in between by the clock's maximum skew, rather "
+    "than read on every clock read. A clock which becomes unsynchronized is "
+    "noticed up to this much later.");
+TAG_FLAG(ntp_error_refresh_ms, experimental);
+TAG_FLAG(ntp_error_refresh_ms, runtime);
+DEFINE_validator(
+    ntp_error_refresh_ms,
+    [](const char* /* flag_name */, int32_t value) { return value >= 0; });
+
 using std::string;
 using std::vector;
 using strings::Substitute;
@@ -60,6 +74,8 @@ namespace clock {
 
 const double SystemNtp::kAdjtimexScalingFactor = 65536;
 const uint64_t SystemNtp::kMicrosPerSec = 1000000;
+// Up to about 16 seconds, beyond --kudu_max_clock_sync_error_usec's default.
+const int SystemNtp::kCachedErrorBits = 24;
 
 namespace {
 
@@ -217,6 +233,7 @@ Status SystemNtp::Init() {
   // clock. Tolerance comes in parts per million but needs to be applied a
   // scaling factor.
   skew_ppm_ = timex.tolerance / kAdjtimexScalingFactor;
+  init_time_ = MonoTime::Now();
 
   LOG(INFO) << "NTP initialized."
             << " Skew: " << skew_ppm_ << "ppm"
@@ -226,6 +243,26 @@ Status SystemNtp::Init() {
 }
 
 Status SystemNtp::WalltimeWithError(uint64_t* now_usec, uint64_t* error_usec) {
+  const int32_t refresh_ms = FLAGS_ntp_error_refresh_ms;
+  // Rounded down, so that the time since a read is never underestimated.
+  const int64_t now_ms = (MonoTime::Now() - init_time_).ToMilliseconds();
+  if (refresh_ms > 0 && PREDICT_TRUE(!FLAGS_inject_unsync_time_errors)) {
+    const uint64_t cached = cached_read_.load(std::memory_order_acquire);
+    const int64_t read_ms =
+        static_cast<int64_t>(cached >> kCachedErrorBits) - 1;
+    if (cached != 0 && now_ms - read_ms < refresh_ms) {
+      timespec ts;
+      PCHECK(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+      *now_usec = ts.tv_sec * kMicrosPerSec + ts.tv_nsec / 1000;
+      // The kernel grows the error bound by the skew as time passes. The
+      // extra millisecond covers the rounding of the times.
+      const uint64_t cached_error = cached & ((1ULL << kCachedErrorBits) - 1);
+      *error_usec =
+          cached_error + (now_ms - read_ms + 1) * 1000 * skew_ppm_ / 1000000;
+      return Status::OK();
+    }
+  }
+
   // Read the time. This will return an error if the clock is not synchronized.
   timex tx;
   RETURN_NOT_OK(CallAdjTime(&tx));
@@ -237,6 +274,12 @@ Status SystemNtp::WalltimeWithError(uint64_t* now_usec, uint64_t* error_usec) {
 
   *now_usec = tx.time.tv_sec * kMicrosPerSec + tx.time.tv_usec;
   *error_usec = tx.maxerror;
+  if (refresh_ms > 0 && tx.maxerror >= 0 &&
+      tx.maxerror < (1LL << kCachedErrorBits)) {
+    cached_read_.store(
+        (static_cast<uint64_t>(now_ms + 1) << kCachedErrorBits) | tx.maxerror,
+        std::memory_order_release);
+  }
   return Status::OK();
 }
 
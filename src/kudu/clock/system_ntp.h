@@ -16,12 +16,14 @@
 // under the License.
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <vector>
 
 #include "kudu/clock/time_service.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -33,6 +35,10 @@ namespace clock {
 //
 // This implementation relies on the ntpd service running on the local host
 // to keep the kernel's timekeeping up to date and in sync.
+//
+// With --ntp_error_refresh_ms, the error bound is read at most that often,
+// and the time in between comes from clock_gettime(), which doesn't enter
+// the kernel.
 class SystemNtp : public TimeService {
  public:
   SystemNtp() = default;
@@ -57,9 +63,20 @@ class SystemNtp : public TimeService {
 
   static const uint64_t kMicrosPerSec;
 
+  // Bits of 'cached_read_' holding the error bound.
+  static const int kCachedErrorBits;
+
   // The skew rate in PPM reported by the kernel.
   uint64_t skew_ppm_ = 0;
 
+  MonoTime init_time_;
+
+  // The last ntp_adjtime() read, while --ntp_error_refresh_ms is set: when it
+  // was taken, in milliseconds since Init() plus one, above its error bound
+  // in microseconds, which takes the low kCachedErrorBits. 0 if there is
+  // none.
+  std::atomic<uint64_t> cached_read_{0};
+
   DISALLOW_COPY_AND_ASSIGN(SystemNtp);
 };
 
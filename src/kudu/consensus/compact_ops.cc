@@ -0,0 +1,236 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/compact_ops.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <glog/logging.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/group_varint-inl.h"
+#include "kudu/util/slice.h"
+
+using google::protobuf::RepeatedPtrField;
+using google::protobuf::internal::WireFormatLite;
+using std::string;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+uint64_t ZigZagEncode(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t ZigZagDecode(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+void AppendVarint64(string* out, uint64_t v) {
+  uint8_t buf[10];
+  const uint8_t* end = EncodeVarint64(buf, v);
+  out->append(reinterpret_cast<const char*>(buf), end - buf);
+}
+
+// Like coding::AppendGroupVarInt32(), for a string.
+void AppendGroupVarInt32(
+    string* out,
+    uint32_t a,
+    uint32_t b,
+    uint32_t c,
+    uint32_t d) {
+  const uint32_t values[] = {a, b, c, d};
+  uint8_t buf[17];
+  uint8_t* ptr = buf + 1;
+  uint8_t selectors = 0;
+  for (uint32_t v : values) {
+    const size_t len = coding::CalcRequiredBytes32(v);
+    selectors = (selectors << 2) | (len - 1);
+    memcpy(ptr, &v, sizeof(v)); // Little endian: the low bytes come first.
+    ptr += len;
+  }
+  buf[0] = selectors;
+  out->append(reinterpret_cast<const char*>(buf), ptr - buf);
+}
+
+bool GetGroupVarInt32(
+    Slice* data,
+    uint32_t* a,
+    uint32_t* b,
+    uint32_t* c,
+    uint32_t* d) {
+  if (PREDICT_FALSE(data->empty())) {
+    return false;
+  }
+  const uint8_t selectors = (*data)[0];
+  size_t size = 1;
+  for (int shift = 0; shift < 8; shift += 2) {
+    size += ((selectors >> shift) & 3) + 1;
+  }
+  if (PREDICT_FALSE(data->size() < size)) {
+    return false;
+  }
+  // DecodeGroupVarInt32() reads up to 3 bytes past the group.
+  if (PREDICT_TRUE(data->size() >= size + 3)) {
+    coding::DecodeGroupVarInt32(data->data(), a, b, c, d);
+  } else {
+    uint8_t buf[17] = {0};
+    memcpy(buf, data->data(), size);
+    coding::DecodeGroupVarInt32(buf, a, b, c, d);
+  }
+  data->remove_prefix(size);
+  return true;
+}
+
+// The encoded size of the fields which the compact encoding packs. These
+// have the lowest field numbers, so they come first in the serialized op.
+size_t PackedFieldsSize(const ReplicateMsg& op) {
+  return WireFormatLite::TagSize(
+             ReplicateMsg::kIdFieldNumber, WireFormatLite::TYPE_MESSAGE) +
+      WireFormatLite::LengthDelimitedSize(op.id().ByteSizeLong()) +
+      WireFormatLite::TagSize(
+             ReplicateMsg::kTimestampFieldNumber,
+             WireFormatLite::TYPE_FIXED64) +
+      WireFormatLite::kFixed64Size +
+      WireFormatLite::TagSize(
+             ReplicateMsg::kOpTypeFieldNumber, WireFormatLite::TYPE_ENUM) +
+      WireFormatLite::EnumSize(op.op_type());
+}
+
+} // anonymous namespace
+
+bool EncodeCompactOps(
+    const RepeatedPtrField<ReplicateMsg>& ops,
+    string* out) {
+  if (ops.empty()) {
+    return false;
+  }
+  const ReplicateMsg& first = ops.Get(0);
+  if (!first.has_id() || !first.has_timestamp()) {
+    return false;
+  }
+  const int64_t base_timestamp = first.timestamp();
+  int64_t prev_term = first.id().term();
+  int64_t prev_index = first.id().index() - 1;
+  AppendVarint64(out, ops.size());
+  AppendVarint64(out, prev_term);
+  AppendVarint64(out, first.id().index());
+  AppendVarint64(out, base_timestamp);
+
+  for (const ReplicateMsg& op : ops) {
+    if (PREDICT_FALSE(
+            !op.has_id() || !op.has_timestamp() || !op.has_op_type())) {
+      return false;
+    }
+    const int64_t term_delta = op.id().term() - prev_term;
+    const int64_t index_delta = op.id().index() - prev_index;
+    const size_t op_size = op.ByteSizeLong(); // Caches the sizes.
+    const size_t packed_size = PackedFieldsSize(op);
+    const size_t rest_size = op_size - packed_size;
+    if (PREDICT_FALSE(
+            term_delta < 0 ||
+            term_delta > std::numeric_limits<uint32_t>::max() ||
+            index_delta < 0 ||
+            index_delta > std::numeric_limits<uint32_t>::max() ||
+            rest_size > std::numeric_limits<uint32_t>::max())) {
+      return false;
+    }
+    AppendGroupVarInt32(out, op.op_type(), term_delta, index_delta, rest_size);
+    AppendVarint64(out, ZigZagEncode(op.timestamp() - base_timestamp));
+
+    // Serialize the op in place and slide the rest over the packed fields.
+    const size_t start = out->size();
+    out->resize(start + op_size);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(&(*out)[start]);
+    op.SerializeWithCachedSizesToArray(dst);
+    memmove(dst, dst + packed_size, rest_size);
+    out->resize(start + rest_size);
+
+    prev_term = op.id().term();
+    prev_index = op.id().index();
+  }
+  return true;
+}
+
+Status DecodeCompactOps(Slice data, RepeatedPtrField<ReplicateMsg>* ops) {
+  uint64_t header[4];
+  const uint8_t* body = GetVarint64Batch(
+      data.data(), data.data() + data.size(), header, arraysize(header));
+  if (PREDICT_FALSE(body == nullptr)) {
+    return Status::Corruption("Truncated header of compact ops");
+  }
+  data.remove_prefix(body - data.data());
+  const uint64_t num_ops = header[0];
+  uint64_t term = header[1];
+  uint64_t index = header[2];
+  const uint64_t base_timestamp = header[3];
+  // Every op takes at least 6 bytes.
+  if (PREDICT_FALSE(num_ops > data.size() / 6)) {
+    return Status::Corruption(
+        Substitute("Bad number of compact ops: $0", num_ops));
+  }
+  index--;
+  ops->Reserve(ops->size() + num_ops);
+  for (uint64_t i = 0; i < num_ops; i++) {
+    uint32_t op_type;
+    uint32_t term_delta;
+    uint32_t index_delta;
+    uint32_t rest_size;
+    uint64_t timestamp_delta;
+    if (PREDICT_FALSE(
+            !GetGroupVarInt32(
+                &data, &op_type, &term_delta, &index_delta, &rest_size) ||
+            !GetVarint64(&data, &timestamp_delta) ||
+            data.size() < rest_size)) {
+      return Status::Corruption(Substitute("Truncated compact op $0", i));
+    }
+    if (PREDICT_FALSE(!OperationType_IsValid(op_type))) {
+      return Status::Corruption(
+          Substitute("Bad type of compact op $0: $1", i, op_type));
+    }
+    ReplicateMsg* op = ops->Add();
+    if (PREDICT_FALSE(!op->ParsePartialFromArray(data.data(), rest_size))) {
+      return Status::Corruption(Substitute("Unable to parse compact op $0", i));
+    }
+    data.remove_prefix(rest_size);
+    term += term_delta;
+    index += index_delta;
+    op->mutable_id()->set_term(term);
+    op->mutable_id()->set_index(index);
+    op->set_timestamp(base_timestamp + ZigZagDecode(timestamp_delta));
+    op->set_op_type(static_cast<OperationType>(op_type));
+  }
+  if (PREDICT_FALSE(!data.empty())) {
+    return Status::Corruption(
+        Substitute("$0 bytes past the compact ops", data.size()));
+  }
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,422 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measures the compression codecs on ReplicateMsg write payloads: compress and
+// uncompress throughput, compression ratio and p99 latency, per codec, level
+// and thread count. Payloads come from a WAL directory, from a directory of
+// captured payloads (one per file), or are generated if neither is given.
+//
+// Example:
+//   compression-bench --compression_bench_wal_dir=/data/wals/<tablet> \
+//       --compression_bench_levels=1,3,6 --num_threads=16
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/compression/compression_dict_trainer.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/random.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_string(
+    compression_bench_wal_dir,
+    "",
+    "Directory of WAL segments whose write payloads are benchmarked.");
+DEFINE_string(
+    compression_bench_corpus_dir,
+    "",
+    "Directory of captured payloads, one per file, to benchmark. Used if "
+    "--compression_bench_wal_dir is not set.");
+DEFINE_string(
+    compression_bench_dict_file,
+    "",
+    "Dictionary for ZSTD_DICT and LZ4_DICT, and for reading WAL payloads "
+    "compressed with one. If not set, one is trained from the payloads.");
+DEFINE_string(
+    compression_bench_levels,
+    "1,3,9",
+    "Comma-separated compression levels to run the codecs that have levels "
+    "at.");
+DEFINE_int32(
+    compression_bench_max_payloads,
+    100000,
+    "The maximum number of payloads to benchmark.");
+DEFINE_int32(
+    num_threads,
+    8,
+    "The number of threads of the multi-threaded runs.");
+DEFINE_int32(
+    compression_bench_passes,
+    3,
+    "How many times each thread compresses and uncompresses every payload.");
+
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// The longest compression or uncompression that is recorded, in nanos.
+constexpr uint64_t kMaxLatencyNanos = 10LL * 1000 * 1000 * 1000;
+
+// Appends to 'payloads' the write payloads of the WAL segments in 'dir',
+// uncompressed.
+Status ReadWalPayloads(
+    const string& dir,
+    const string& dict,
+    vector<string>* payloads) {
+  Env* env = Env::Default();
+  vector<string> children;
+  RETURN_NOT_OK(env->GetChildren(dir, &children));
+  faststring buffer;
+  for (const string& child : children) {
+    if (!log::IsLogFileName(child)) {
+      continue;
+    }
+    scoped_refptr<log::ReadableLogSegment> segment;
+    RETURN_NOT_OK(log::ReadableLogSegment::Open(
+        env, JoinPathSegments(dir, child), &segment));
+    log::LogEntries entries;
+    // Segments still being written end early; keep what could be read.
+    WARN_NOT_OK(segment->ReadEntries(&entries), "Unable to read all entries");
+    for (const auto& entry : entries) {
+      if (!entry->has_replicate() ||
+          entry->replicate().op_type() != WRITE_OP_EXT) {
+        continue;
+      }
+      const WritePayloadPB& payload = entry->replicate().write_payload();
+      if (payload.compression_codec() == NO_COMPRESSION) {
+        payloads->push_back(payload.payload());
+      } else {
+        shared_ptr<CompressionCodec> codec;
+        RETURN_NOT_OK(CompressionCodecManager::GetCodec(
+            payload.compression_codec(), &codec));
+        RETURN_NOT_OK(codec->SetDictionary(dict));
+        buffer.resize(payload.uncompressed_size());
+        RETURN_NOT_OK(codec->Uncompress(
+            Slice(payload.payload()), buffer.data(), buffer.size()));
+        payloads->push_back(buffer.ToString());
+      }
+      if (payloads->size() >=
+          static_cast<size_t>(FLAGS_compression_bench_max_payloads)) {
+        return Status::OK();
+      }
+    }
+  }
+  return Status::OK();
+}
+
+// Appends to 'payloads' the contents of the files in 'dir'.
+Status ReadCorpus(const string& dir, vector<string>* payloads) {
+  Env* env = Env::Default();
+  vector<string> children;
+  RETURN_NOT_OK(env->GetChildren(dir, &children));
+  for (const string& child : children) {
+    if (child == "." || child == "..") {
+      continue;
+    }
+    faststring data;
+    RETURN_NOT_OK(ReadFileToString(env, JoinPathSegments(dir, child), &data));
+    payloads->push_back(data.ToString());
+    if (payloads->size() >=
+        static_cast<size_t>(FLAGS_compression_bench_max_payloads)) {
+      break;
+    }
+  }
+  return Status::OK();
+}
+
+// Generates small JSON rows, similar to binlog row events.
+void GeneratePayloads(vector<string>* payloads) {
+  Random rng(SeedRandom());
+  for (int i = 0; i < 20000; i++) {
+    payloads->push_back(Substitute(
+        "{\"table\":\"users\",\"op\":\"update\",\"id\":$0,"
+        "\"name\":\"user_$1\",\"email\":\"user_$1@example.com\","
+        "\"score\":$2,\"updated_at\":$3}",
+        i,
+        rng.Uniform(1000000),
+        rng.Uniform(1000),
+        1600000000 + rng.Uniform(100000000)));
+  }
+}
+
+} // anonymous namespace
+
+struct BenchSetup {
+  CompressionType type;
+  // Runs on --num_threads threads if set, on one otherwise.
+  bool multi_threaded;
+
+  int num_threads() const {
+    return multi_threaded ? FLAGS_num_threads : 1;
+  }
+
+  string ToString() const {
+    return Substitute(
+        "$0 threads=$1",
+        CompressionCodecManager::GetCodecName(type),
+        num_threads());
+  }
+};
+
+class CompressionBench : public KuduTest,
+                         public testing::WithParamInterface<BenchSetup> {
+ public:
+  static void SetUpTestCase() {
+    payloads_ = new vector<string>();
+    dict_ = new string();
+    Env* env = Env::Default();
+    if (!FLAGS_compression_bench_dict_file.empty()) {
+      faststring data;
+      CHECK_OK(
+          ReadFileToString(env, FLAGS_compression_bench_dict_file, &data));
+      *dict_ = data.ToString();
+    }
+
+    if (!FLAGS_compression_bench_wal_dir.empty()) {
+      CHECK_OK(
+          ReadWalPayloads(FLAGS_compression_bench_wal_dir, *dict_, payloads_));
+    } else if (!FLAGS_compression_bench_corpus_dir.empty()) {
+      CHECK_OK(ReadCorpus(FLAGS_compression_bench_corpus_dir, payloads_));
+    } else {
+      GeneratePayloads(payloads_);
+    }
+    CHECK(!payloads_->empty()) << "No payloads to benchmark";
+
+    if (dict_->empty()) {
+      CompressionDictTrainer::Options opts;
+      opts.sample_every = 1;
+      opts.min_samples = 100;
+      CompressionDictTrainer trainer(opts);
+      for (const string& payload : *payloads_) {
+        trainer.AddSample(Slice(payload));
+      }
+      WARN_NOT_OK(
+          trainer.Train(dict_), "Unable to train a dictionary, using none");
+    }
+
+    int64_t total_bytes = 0;
+    for (const string& payload : *payloads_) {
+      total_bytes += payload.size();
+    }
+    LOG(INFO) << Substitute(
+        "Benchmarking $0 payloads, $1 bytes on average, $2 byte dictionary",
+        payloads_->size(),
+        total_bytes / payloads_->size(),
+        dict_->size());
+  }
+
+  static void TearDownTestCase() {
+    delete payloads_;
+    delete dict_;
+  }
+
+ protected:
+  // Compresses and uncompresses every payload --compression_bench_passes
+  // times with 'codec' from each of 'num_threads' threads, and logs the
+  // results.
+  void RunBench(
+      const shared_ptr<CompressionCodec>& codec,
+      int num_threads,
+      const string& name) {
+    HdrHistogram compress_hist(kMaxLatencyNanos, 2);
+    HdrHistogram uncompress_hist(kMaxLatencyNanos, 2);
+    atomic<int64_t> compress_nanos(0);
+    atomic<int64_t> uncompress_nanos(0);
+    atomic<int64_t> bytes_before(0);
+    atomic<int64_t> bytes_after(0);
+    atomic<bool> failed(false);
+
+    vector<thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&]() {
+        faststring compressed;
+        faststring uncompressed;
+        int64_t local_compress_nanos = 0;
+        int64_t local_uncompress_nanos = 0;
+        int64_t local_before = 0;
+        int64_t local_after = 0;
+        for (int pass = 0; pass < FLAGS_compression_bench_passes; pass++) {
+          for (const string& payload : *payloads_) {
+            compressed.resize(codec->MaxCompressedLength(payload.size()));
+            size_t compressed_len;
+            MonoTime start = MonoTime::Now();
+            Status s = codec->Compress(
+                Slice(payload), compressed.data(), &compressed_len);
+            const int64_t c_nanos = (MonoTime::Now() - start).ToNanoseconds();
+            if (PREDICT_FALSE(!s.ok())) {
+              LOG(ERROR) << name << ": " << s.ToString();
+              failed = true;
+              return;
+            }
+
+            uncompressed.resize(payload.size());
+            start = MonoTime::Now();
+            s = codec->Uncompress(
+                Slice(compressed.data(), compressed_len),
+                uncompressed.data(),
+                uncompressed.size());
+            const int64_t u_nanos = (MonoTime::Now() - start).ToNanoseconds();
+            if (PREDICT_FALSE(!s.ok())) {
+              LOG(ERROR) << name << ": " << s.ToString();
+              failed = true;
+              return;
+            }
+
+            compress_hist.Increment(c_nanos);
+            uncompress_hist.Increment(u_nanos);
+            local_compress_nanos += c_nanos;
+            local_uncompress_nanos += u_nanos;
+            local_before += payload.size();
+            local_after += compressed_len;
+          }
+        }
+        compress_nanos += local_compress_nanos;
+        uncompress_nanos += local_uncompress_nanos;
+        bytes_before += local_before;
+        bytes_after += local_after;
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    ASSERT_FALSE(failed);
+
+    // Throughput per thread, summed over the threads.
+    const double mb = static_cast<double>(bytes_before) / (1024 * 1024);
+    const double compress_mbps = mb * num_threads / (compress_nanos / 1e9);
+    const double uncompress_mbps = mb * num_threads / (uncompress_nanos / 1e9);
+    LOG(INFO) << StringPrintf(
+        "%s: ratio %.2f, compress %.1f MB/s (p99 %" PRIu64
+        " ns), uncompress %.1f MB/s (p99 %" PRIu64 " ns)",
+        name.c_str(),
+        static_cast<double>(bytes_before) / bytes_after,
+        compress_mbps,
+        compress_hist.ValueAtPercentile(99),
+        uncompress_mbps,
+        uncompress_hist.ValueAtPercentile(99));
+    const string key = Substitute("compression-bench[$0]", name);
+    RecordPerfResult(
+        key + ".ratio", static_cast<double>(bytes_before) / bytes_after);
+    RecordPerfResult(key + ".compress_mb_per_sec", compress_mbps);
+    RecordPerfResult(key + ".uncompress_mb_per_sec", uncompress_mbps);
+  }
+
+  static vector<string>* payloads_;
+  static string* dict_;
+};
+
+vector<string>* CompressionBench::payloads_ = nullptr;
+string* CompressionBench::dict_ = nullptr;
+
+// Every codec of compression.proto, single and multi-threaded.
+INSTANTIATE_TEST_CASE_P(
+    Codecs,
+    CompressionBench,
+    testing::ValuesIn(std::vector<BenchSetup>{
+        {SNAPPY, false},
+        {SNAPPY, true},
+        {LZ4, false},
+        {LZ4, true},
+        {LZ4_DICT, false},
+        {LZ4_DICT, true},
+        {ZLIB, false},
+        {ZLIB, true},
+        {ZSTD, false},
+        {ZSTD, true},
+        {ZSTD_DICT, false},
+        {ZSTD_DICT, true}}));
+
+TEST_P(CompressionBench, RunBench) {
+  const BenchSetup& setup = GetParam();
+  const bool has_dict = setup.type == LZ4_DICT || setup.type == ZSTD_DICT;
+  if (has_dict && dict_->empty()) {
+    LOG(INFO) << setup.ToString() << ": skipped, no dictionary";
+    return;
+  }
+
+  vector<int> levels;
+  if (setup.type == SNAPPY) {
+    // Snappy has no levels.
+    levels.push_back(0);
+  } else {
+    const vector<string> values = strings::Split(
+        FLAGS_compression_bench_levels, ",", strings::SkipEmpty());
+    for (const string& level : values) {
+      int32_t value;
+      ASSERT_TRUE(safe_strto32(level, &value)) << "Bad level: " << level;
+      levels.push_back(value);
+    }
+  }
+
+  for (int level : levels) {
+    shared_ptr<CompressionCodec> codec;
+    ASSERT_OK(CompressionCodecManager::GetCodec(setup.type, &codec));
+    if (has_dict) {
+      ASSERT_OK(codec->SetDictionary(*dict_));
+    }
+    if (setup.type != SNAPPY) {
+      Status s = codec->SetCompressionLevel(level);
+      if (!s.ok()) {
+        LOG(INFO) << setup.ToString() << " level=" << level
+                  << ": skipped, " << s.ToString();
+        continue;
+      }
+    }
+    NO_FATALS(RunBench(
+        codec,
+        setup.num_threads(),
+        Substitute("$0 level=$1", setup.ToString(), level)));
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -21,6 +21,7 @@
 // out of Kudu into a fork known as kuduraft.
 // ********************************************************************
 
+#include <algorithm>
 #include <functional>
 #include <map>
 #include <memory>
@@ -46,7 +47,10 @@
 #include "kudu/rpc/messenger.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/threadpool.h"
 
@@ -555,18 +559,91 @@ class TestPeerMapManager {
   mutable simple_spinlock lock_;
 };
 
+// The characteristics of a link between two peers of a SimulatedNetwork.
+struct SimulatedLink {
+  // One-way propagation delay.
+  MonoDelta latency = MonoDelta::FromMilliseconds(0);
+  // Bandwidth of the link; messages on it are serialized. 0 is unlimited.
+  int64_t bytes_per_sec = 0;
+  // Probability that a message on the link is lost.
+  double loss = 0;
+};
+
+// A model of the network between LocalTestPeerProxy instances, so that
+// replication can be measured in-process over e.g. a WAN. Links are
+// directional; those not set explicitly use the default link.
+//
+// Thread-safe.
+class SimulatedNetwork {
+ public:
+  explicit SimulatedNetwork(SimulatedLink default_link = SimulatedLink())
+      : default_link_(default_link), rng_(GetRandomSeed32()) {}
+
+  void SetLink(
+      const std::string& from,
+      const std::string& to,
+      const SimulatedLink& link) {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    links_[std::make_pair(from, to)] = link;
+  }
+
+  // Sends a message of 'bytes' from 'from' to 'to' now. Sets 'delay' to how
+  // long it takes to arrive: the time spent queued behind earlier messages
+  // on the link, its transmission time and the link latency. Returns false
+  // if the message is lost.
+  bool Send(
+      const std::string& from,
+      const std::string& to,
+      int64_t bytes,
+      MonoDelta* delay) {
+    const MonoTime now = MonoTime::Now();
+    std::lock_guard<simple_spinlock> lock(lock_);
+    const auto key = std::make_pair(from, to);
+    const SimulatedLink* link = FindOrNull(links_, key);
+    if (!link) {
+      link = &default_link_;
+    }
+    MonoTime sent = now;
+    if (link->bytes_per_sec > 0) {
+      MonoTime& busy_until = busy_until_[key];
+      sent = std::max(now, busy_until) +
+          MonoDelta::FromMicroseconds(bytes * 1000000 / link->bytes_per_sec);
+      busy_until = sent;
+    }
+    *delay = MonoDelta::FromMicroseconds(
+        (sent - now).ToMicroseconds() + link->latency.ToMicroseconds());
+    return link->loss <= 0 || rng_.NextDoubleFraction() >= link->loss;
+  }
+
+ private:
+  simple_spinlock lock_;
+  const SimulatedLink default_link_;
+  std::map<std::pair<std::string, std::string>, SimulatedLink> links_;
+  // When each link is done transmitting the messages queued on it.
+  std::map<std::pair<std::string, std::string>, MonoTime> busy_until_;
+  Random rng_;
+};
+
 // Allows to test remote peers by emulating an RPC.
 // Both the "remote" peer's RPC call and the caller peer's response are executed
 // asynchronously in a ThreadPool.
+//
+// If 'network' is set, updates and vote requests sent from 'local_uuid' to the
+// peer, and their responses, are delayed, or lost, as the network says. The
+// delays are spent on the pool's threads.
 class LocalTestPeerProxy : public TestPeerProxy {
  public:
   LocalTestPeerProxy(
       std::string peer_uuid,
       ThreadPool* pool,
-      TestPeerMapManager* peers)
+      TestPeerMapManager* peers,
+      SimulatedNetwork* network = nullptr,
+      std::string local_uuid = "")
       : TestPeerProxy(pool),
         peer_uuid_(std::move(peer_uuid)),
         peers_(peers),
+        network_(network),
+        local_uuid_(std::move(local_uuid)),
         miss_comm_(false) {}
 
   virtual void UpdateAsync(
@@ -639,7 +716,10 @@ class LocalTestPeerProxy : public TestPeerProxy {
     // Give the other peer a clean response object to write to.
     ConsensusResponsePB other_peer_resp;
     std::shared_ptr<RaftConsensus> peer;
-    Status s = peers_->GetPeerByUuid(peer_uuid_, &peer);
+    Status s = Transmit(local_uuid_, peer_uuid_, other_peer_req.ByteSizeLong());
+    if (s.ok()) {
+      s = peers_->GetPeerByUuid(peer_uuid_, &peer);
+    }
 
     if (s.ok()) {
       s = peer->Update(&other_peer_req, &other_peer_resp);
@@ -648,6 +728,9 @@ class LocalTestPeerProxy : public TestPeerProxy {
         CHECK(other_peer_resp.status().IsInitialized());
       }
     }
+    if (s.ok()) {
+      s = Transmit(peer_uuid_, local_uuid_, other_peer_resp.ByteSizeLong());
+    }
     if (!s.ok()) {
       LOG(WARNING) << "Could not Update replica with request: "
                    << pb_util::SecureShortDebugString(other_peer_req)
@@ -668,7 +751,10 @@ class LocalTestPeerProxy : public TestPeerProxy {
     other_peer_resp.CopyFrom(*response);
 
     std::shared_ptr<RaftConsensus> peer;
-    Status s = peers_->GetPeerByUuid(peer_uuid_, &peer);
+    Status s = Transmit(local_uuid_, peer_uuid_, other_peer_req.ByteSizeLong());
+    if (s.ok()) {
+      s = peers_->GetPeerByUuid(peer_uuid_, &peer);
+    }
 
     if (s.ok()) {
       s = peer->RequestVote(
@@ -678,6 +764,9 @@ class LocalTestPeerProxy : public TestPeerProxy {
           // TabletVotingState(boost::none, tablet::TABLET_DATA_READY),
           &other_peer_resp);
     }
+    if (s.ok()) {
+      s = Transmit(peer_uuid_, local_uuid_, other_peer_resp.ByteSizeLong());
+    }
     if (!s.ok()) {
       LOG(WARNING) << "Could not RequestVote from replica with request: "
                    << pb_util::SecureShortDebugString(other_peer_req)
@@ -700,25 +789,54 @@ class LocalTestPeerProxy : public TestPeerProxy {
   }
 
  private:
+  // Waits for a message of 'bytes' to cross the simulated network from
+  // 'from' to 'to', if there is one.
+  Status Transmit(
+      const std::string& from,
+      const std::string& to,
+      int64_t bytes) {
+    if (!network_) {
+      return Status::OK();
+    }
+    MonoDelta delay;
+    const bool delivered = network_->Send(from, to, bytes, &delay);
+    SleepFor(delay);
+    if (!delivered) {
+      return Status::NetworkError(
+          strings::Substitute("simulated loss from $0 to $1", from, to));
+    }
+    return Status::OK();
+  }
+
   const std::string peer_uuid_;
   TestPeerMapManager* const peers_;
+  SimulatedNetwork* const network_;
+  const std::string local_uuid_;
   bool miss_comm_;
 };
 
+// Makes LocalTestPeerProxy instances for the peer 'local_uuid', sending over
+// 'network' if it is set.
 class LocalTestPeerProxyFactory : public PeerProxyFactory {
  public:
-  explicit LocalTestPeerProxyFactory(TestPeerMapManager* peers)
-      : peers_(peers) {
-    CHECK_OK(
-        ThreadPoolBuilder("test-peer-pool").set_max_threads(3).Build(&pool_));
+  explicit LocalTestPeerProxyFactory(
+      TestPeerMapManager* peers,
+      SimulatedNetwork* network = nullptr,
+      std::string local_uuid = "")
+      : peers_(peers), network_(network), local_uuid_(std::move(local_uuid)) {
+    // Simulated network delays are spent on the pool's threads, so that each
+    // proxy needs one of its own for the sends to overlap.
+    CHECK_OK(ThreadPoolBuilder("test-peer-pool")
+                 .set_max_threads(network ? 16 : 3)
+                 .Build(&pool_));
     CHECK_OK(rpc::MessengerBuilder("test").Build(&messenger_));
   }
 
   Status NewProxy(
       const consensus::RaftPeerPB& peer_pb,
       std::shared_ptr<PeerProxy>* proxy) override {
-    LocalTestPeerProxy* new_proxy =
-        new LocalTestPeerProxy(peer_pb.permanent_uuid(), pool_.get(), peers_);
+    LocalTestPeerProxy* new_proxy = new LocalTestPeerProxy(
+        peer_pb.permanent_uuid(), pool_.get(), peers_, network_, local_uuid_);
     proxy->reset(new_proxy);
     proxies_.push_back(new_proxy);
     return Status::OK();
@@ -736,6 +854,8 @@ class LocalTestPeerProxyFactory : public PeerProxyFactory {
   std::unique_ptr<ThreadPool> pool_;
   std::shared_ptr<rpc::Messenger> messenger_;
   TestPeerMapManager* const peers_;
+  SimulatedNetwork* const network_;
+  const std::string local_uuid_;
   // NOTE: There is no need to delete this on the dctor because proxies are
   // externally managed
   std::vector<LocalTestPeerProxy*> proxies_;
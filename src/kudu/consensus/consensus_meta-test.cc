@@ -282,6 +282,50 @@ TEST_F(ConsensusMetadataTest, TestActiveRole) {
   ASSERT_EQ(RaftPeerPB::NON_PARTICIPANT, cmeta->active_role());
 }
 
+// Ensure that every change to the term, leader or configs publishes a new
+// snapshot, and that snapshots already handed out do not change.
+TEST_F(ConsensusMetadataTest, TestStateSnapshot) {
+  vector<string> uuids = {"a", "b", "c"};
+  string peer_uuid = "c";
+  RaftConfigPB config = BuildConfig(uuids);
+  config.set_opid_index(1);
+
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(
+      &fs_manager_,
+      kTabletId,
+      peer_uuid,
+      config,
+      kInitialTerm,
+      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+      &cmeta));
+
+  auto initial = cmeta->snapshot();
+  ASSERT_EQ(kInitialTerm, initial->cstate.current_term());
+  ASSERT_EQ(RaftPeerPB::FOLLOWER, initial->active_role);
+  ASSERT_FALSE(initial->cstate.has_leader_uuid());
+  ASSERT_EQ(1, initial->active_config().opid_index());
+
+  cmeta->set_current_term(kInitialTerm + 1);
+  cmeta->set_leader_uuid(peer_uuid);
+  auto leader = cmeta->snapshot();
+  ASSERT_EQ(kInitialTerm + 1, leader->cstate.current_term());
+  ASSERT_EQ(peer_uuid, leader->cstate.leader_uuid());
+  ASSERT_EQ(RaftPeerPB::LEADER, leader->active_role);
+
+  RaftConfigPB pending = BuildConfig({"a", "b"});
+  cmeta->set_pending_config(pending);
+  auto removed = cmeta->snapshot();
+  ASSERT_EQ(RaftPeerPB::NON_PARTICIPANT, removed->active_role);
+  ASSERT_EQ(2, removed->active_config().peers_size());
+  ASSERT_EQ(3, removed->cstate.committed_config().peers_size());
+
+  // Older snapshots are unchanged.
+  ASSERT_EQ(kInitialTerm, initial->cstate.current_term());
+  ASSERT_EQ(RaftPeerPB::FOLLOWER, initial->active_role);
+  ASSERT_EQ(RaftPeerPB::LEADER, leader->active_role);
+}
+
 // Ensure that invocations of ToConsensusStatePB() return the expected state
 // in the returned object.
 TEST_F(ConsensusMetadataTest, TestToConsensusStatePB) {
@@ -16,6 +16,7 @@
 // under the License.
 #include "kudu/consensus/consensus_meta.h"
 
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <utility>
@@ -28,12 +29,14 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/fs/metadata_journal.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/io_scheduler.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
@@ -63,6 +66,7 @@ void ConsensusMetadata::set_current_term(int64_t term) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   DCHECK_GE(term, kMinimumTerm);
   pb_.set_current_term(term);
+  PublishSnapshot();
 }
 
 bool ConsensusMetadata::has_voted_for() const {
@@ -193,13 +197,20 @@ void ConsensusMetadata::set_committed_config(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   *pb_.mutable_committed_config() = config;
   if (!has_pending_config_) {
+    active_config_snapshot_.reset();
     UpdateActiveRole();
+  } else {
+    PublishSnapshot();
   }
 }
 
 void ConsensusMetadata::set_committed_config_raw(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   *pb_.mutable_committed_config() = config;
+  if (!has_pending_config_) {
+    active_config_snapshot_.reset();
+  }
+  PublishSnapshot();
 }
 
 kudu::Status ConsensusMetadata::voter_distribution(
@@ -230,6 +241,7 @@ void ConsensusMetadata::clear_pending_config() {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   has_pending_config_ = false;
   pending_config_.Clear();
+  active_config_snapshot_.reset();
   UpdateActiveRole();
 }
 
@@ -237,6 +249,7 @@ void ConsensusMetadata::set_pending_config(const RaftConfigPB& config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   has_pending_config_ = true;
   pending_config_ = config;
+  active_config_snapshot_.reset();
   UpdateActiveRole();
 }
 
@@ -254,6 +267,16 @@ const RaftConfigPB& ConsensusMetadata::ActiveConfig() const {
   return GetConfig(ACTIVE_CONFIG);
 }
 
+const std::shared_ptr<const RaftConfigSnapshot>&
+ConsensusMetadata::ActiveConfigSnapshot() const {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  if (!active_config_snapshot_) {
+    active_config_snapshot_ =
+        RaftConfigSnapshot::Create(GetConfig(ACTIVE_CONFIG));
+  }
+  return active_config_snapshot_;
+}
+
 const string& ConsensusMetadata::leader_uuid() const {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   return leader_uuid_;
@@ -370,6 +393,7 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
   MAYBE_FAULT(FLAGS_fault_crash_before_cmeta_flush);
   SCOPED_LOG_SLOW_EXECUTION_PREFIX(
       WARNING, 500, LogPrefix(), "flushing consensus metadata");
+  ScopedIOClass io_class(IOClass::kMetadata);
 
   flush_count_for_tests_++;
   // Sanity test to ensure we never write out a bad configuration.
@@ -392,13 +416,19 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
   }
 
   string meta_file_path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
+  // Overwrites may share their fsync with those of other rings.
+  fs::MetadataJournal* journal = fs_manager_->metadata_journal();
+  Status s = journal != nullptr && flush_mode == OVERWRITE
+      ? journal->Write(meta_file_path, pb_)
+      : pb_util::WritePBContainerToPath(
+            fs_manager_->env(),
+            meta_file_path,
+            pb_,
+            flush_mode == OVERWRITE ? pb_util::OVERWRITE
+                                    : pb_util::NO_OVERWRITE,
+            pb_util::SYNC);
   RETURN_NOT_OK_PREPEND(
-      pb_util::WritePBContainerToPath(
-          fs_manager_->env(),
-          meta_file_path,
-          pb_,
-          flush_mode == OVERWRITE ? pb_util::OVERWRITE : pb_util::NO_OVERWRITE,
-          pb_util::SYNC),
+      s,
       Substitute(
           "Unable to write consensus meta file for tablet $0 to path $1",
           tablet_id_,
@@ -490,12 +520,25 @@ std::string ConsensusMetadata::LogPrefix() const {
 void ConsensusMetadata::UpdateActiveRole() {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   active_role_ = GetConsensusRole(peer_uuid_, leader_uuid_, ActiveConfig());
+  PublishSnapshot();
   VLOG_WITH_PREFIX(1) << "Updating active role to "
                       << RaftPeerPB::Role_Name(active_role_)
                       << ". Consensus state: "
                       << pb_util::SecureShortDebugString(ToConsensusStatePB());
 }
 
+void ConsensusMetadata::PublishSnapshot() {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  auto snapshot = std::make_shared<StateSnapshot>();
+  snapshot->cstate = ToConsensusStatePB();
+  snapshot->active_role = active_role_;
+  snapshot->leader_hostport = leader_hostport();
+  std::atomic_store_explicit(
+      &snapshot_,
+      std::shared_ptr<const StateSnapshot>(std::move(snapshot)),
+      std::memory_order_release);
+}
+
 Status ConsensusMetadata::UpdateOnDiskSize() {
   string path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
   uint64_t on_disk_size;
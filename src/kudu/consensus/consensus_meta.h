@@ -19,7 +19,9 @@
 #include <atomic>
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include <gtest/gtest_prod.h>
 
@@ -72,6 +74,26 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Specify whether we are allowed to overwrite an existing file when flushing.
   enum FlushMode { OVERWRITE, NO_OVERWRITE };
 
+  // The read-mostly state: term, leader, role and configs. A new snapshot is
+  // published whenever any of it changes.
+  struct StateSnapshot {
+    ConsensusStatePB cstate;
+    RaftPeerPB::Role active_role;
+    std::pair<std::string, unsigned int> leader_hostport;
+
+    // The pending config if one is set, otherwise the committed config.
+    const RaftConfigPB& active_config() const {
+      return cstate.has_pending_config() ? cstate.pending_config()
+                                         : cstate.committed_config();
+    }
+  };
+
+  // Returns the latest published state. Unlike the rest of this class, this
+  // is thread-safe and needs no external synchronization.
+  std::shared_ptr<const StateSnapshot> snapshot() const {
+    return std::atomic_load_explicit(&snapshot_, std::memory_order_acquire);
+  }
+
   // Accessors for current term.
   int64_t current_term() const;
   void set_current_term(int64_t term);
@@ -132,6 +154,12 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Otherwise, return the committed configuration.
   const RaftConfigPB& ActiveConfig() const;
 
+  // ActiveConfig() as a shared, immutable snapshot with lookup indexes.
+  // Built on first use after each change of the active config; callers may
+  // keep it after the config changes again.
+  const std::shared_ptr<const RaftConfigSnapshot>& ActiveConfigSnapshot()
+      const;
+
   // Accessors for setting the active leader.
   const std::string& leader_uuid() const;
   void set_leader_uuid(std::string uuid);
@@ -223,6 +251,7 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   FRIEND_TEST(ConsensusMetadataTest, TestFailedLoad);
   FRIEND_TEST(ConsensusMetadataTest, TestFlush);
   FRIEND_TEST(ConsensusMetadataTest, TestActiveRole);
+  FRIEND_TEST(ConsensusMetadataTest, TestStateSnapshot);
   FRIEND_TEST(ConsensusMetadataTest, TestToConsensusStatePB);
   FRIEND_TEST(ConsensusMetadataTest, TestMergeCommittedConsensusStatePB);
 
@@ -274,6 +303,9 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Updates the cached active role.
   void UpdateActiveRole();
 
+  // Publishes the current state for snapshot().
+  void PublishSnapshot();
+
   // Updates the cached on-disk size of the consensus metadata.
   Status UpdateOnDiskSize();
 
@@ -297,6 +329,12 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Cached role of the peer_uuid_ within the active configuration.
   RaftPeerPB::Role active_role_;
 
+  // Read with atomic loads, see snapshot().
+  std::shared_ptr<const StateSnapshot> snapshot_;
+
+  // Cache for ActiveConfigSnapshot(), reset when the active config changes.
+  mutable std::shared_ptr<const RaftConfigSnapshot> active_config_snapshot_;
+
   // The number of times the metadata has been flushed to disk.
   int64_t flush_count_for_tests_;
 
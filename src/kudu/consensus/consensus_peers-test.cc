@@ -27,7 +27,9 @@
 #include <type_traits>
 #include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 
 #include "kudu/clock/clock.h"
@@ -55,18 +57,26 @@
 #include "kudu/util/metrics.h"
 // METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
+#include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(raft_coalesce_proxied_updates);
+DECLARE_bool(raft_compact_heartbeats);
+DECLARE_int32(raft_coalesce_max_request_bytes);
+
 METRIC_DECLARE_entity(tablet);
 
 namespace kudu {
 namespace consensus {
 
+using google::protobuf::util::MessageDifferencer;
 using log::Log;
 using log::LogOptions;
+using pb_util::SecureShortDebugString;
 using rpc::Messenger;
 using rpc::MessengerBuilder;
 using std::make_shared;
@@ -400,5 +410,194 @@ TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
   ASSERT_LT(mock_proxy->update_count(), 5);
 }
 
+// Answers compact heartbeats as it answers updates, if it handles them.
+class CompactHeartbeatPeerProxy : public MockedPeerProxy {
+ public:
+  explicit CompactHeartbeatPeerProxy(ThreadPool* pool)
+      : MockedPeerProxy(pool) {}
+
+  void HeartbeatAsync(
+      const HeartbeatRequestPB* /*request*/,
+      HeartbeatResponsePB* response,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) override {
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      heartbeat_count_++;
+      const ConsensusStatusPB& status = update_response_.status();
+      response->set_responder_uuid(update_response_.responder_uuid());
+      response->set_handled(handle_heartbeats_);
+      response->set_responder_term(update_response_.responder_term());
+      response->set_last_received_term(status.last_received().term());
+      response->set_last_received_index(status.last_received().index());
+      response->set_last_received_current_leader_term(
+          status.last_received_current_leader().term());
+      response->set_last_received_current_leader_index(
+          status.last_received_current_leader().index());
+      response->set_last_committed_idx(status.last_committed_idx());
+    }
+    return RegisterCallbackAndRespond(kUpdate, callback);
+  }
+
+  void set_handle_heartbeats(bool handle) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    handle_heartbeats_ = handle;
+  }
+
+  int heartbeat_count() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return heartbeat_count_;
+  }
+
+ private:
+  bool handle_heartbeats_ = true;
+  int heartbeat_count_ = 0;
+};
+
+// Once a caught-up peer has answered a request without ops, heartbeats go
+// out as compact ones, and are resent as updates if the peer doesn't handle
+// them.
+TEST_F(ConsensusPeersTest, TestCompactHeartbeats) {
+  google::FlagSaver saver;
+  FLAGS_raft_compact_heartbeats = true;
+  message_queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+
+  auto mock_proxy = make_shared<CompactHeartbeatPeerProxy>(raft_pool_.get());
+  peer_proxy_pool_.Put(kFollowerUuid, mock_proxy);
+  shared_ptr<Peer> peer;
+  ASSERT_OK(Peer::NewRemotePeer(
+      FakeRaftPeerPB(kFollowerUuid),
+      kTabletId,
+      kLeaderUuid,
+      message_queue_.get(),
+      &peer_proxy_pool_,
+      raft_pool_token_.get(),
+      mock_proxy,
+      messenger_,
+      &peer));
+
+  ConsensusResponsePB resp;
+  resp.set_responder_uuid(kFollowerUuid);
+  resp.set_responder_term(0);
+  resp.mutable_status()->mutable_last_received()->CopyFrom(MakeOpId(1, 1));
+  resp.mutable_status()->mutable_last_received_current_leader()->CopyFrom(
+      MakeOpId(1, 1));
+  resp.mutable_status()->set_last_committed_idx(1);
+  mock_proxy->set_update_response(resp);
+
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 1, 1);
+  peer->SignalRequest(true);
+  NO_FATALS(WaitForCommitIndex(1));
+
+  ASSERT_EVENTUALLY([&]() {
+    ignore_result(peer->SignalRequest(true));
+    ASSERT_GT(mock_proxy->heartbeat_count(), 0);
+  });
+
+  // Heartbeats the peer doesn't handle are resent as updates.
+  mock_proxy->set_handle_heartbeats(false);
+  const int heartbeats = mock_proxy->heartbeat_count();
+  const int updates = mock_proxy->update_count();
+  ASSERT_EVENTUALLY([&]() {
+    ignore_result(peer->SignalRequest(true));
+    ASSERT_GT(mock_proxy->heartbeat_count(), heartbeats);
+    ASSERT_GT(mock_proxy->update_count(), updates);
+  });
+  peer->Close();
+}
+
+// Only plain, direct requests are bundled, and by default only heartbeats.
+TEST(UpdateCoalescerTest, TestCanCoalesce) {
+  ConsensusRequestPB heartbeat;
+  heartbeat.set_tablet_id(kTabletId);
+  ASSERT_TRUE(UpdateCoalescer::CanCoalesce(heartbeat));
+
+  ConsensusRequestPB proxied(heartbeat);
+  proxied.set_proxy_dest_uuid("other");
+  ASSERT_FALSE(UpdateCoalescer::CanCoalesce(proxied));
+
+  ConsensusRequestPB update(heartbeat);
+  ReplicateMsg* op = update.add_ops();
+  op->set_op_type(NO_OP);
+  op->mutable_id()->CopyFrom(MakeOpId(1, 1));
+  ASSERT_FALSE(UpdateCoalescer::CanCoalesce(update));
+  {
+    google::FlagSaver saver;
+    FLAGS_raft_coalesce_max_request_bytes = 1024;
+    ASSERT_TRUE(UpdateCoalescer::CanCoalesce(update));
+    update.set_ops_sidecar_idx(0);
+    ASSERT_FALSE(UpdateCoalescer::CanCoalesce(update));
+  }
+}
+
+TEST(UpdateCoalescerTest, TestCanCoalesceWithOps) {
+  google::FlagSaver saver;
+  ConsensusRequestPB proxied;
+  proxied.set_tablet_id(kTabletId);
+  proxied.set_proxy_dest_uuid("proxy");
+  proxied.set_ops_sidecar_idx(0);
+  FLAGS_raft_coalesce_proxied_updates = false;
+  ASSERT_FALSE(UpdateCoalescer::CanCoalesceWithOps(proxied));
+
+  FLAGS_raft_coalesce_proxied_updates = true;
+  ASSERT_TRUE(UpdateCoalescer::CanCoalesceWithOps(proxied));
+
+  // Direct requests with sidecars go on their own.
+  ConsensusRequestPB direct(proxied);
+  direct.clear_proxy_dest_uuid();
+  ASSERT_FALSE(UpdateCoalescer::CanCoalesceWithOps(direct));
+}
+
+// An op sent with its payload in a sidecar arrives with every one of its
+// fields.
+TEST(PayloadSidecarTest, TestRoundTrip) {
+  ReplicateMsg op;
+  op.mutable_id()->CopyFrom(MakeOpId(3, 7));
+  op.set_timestamp(12345);
+  op.set_op_type(WRITE_OP_EXT);
+  ChangeConfigRecordPB* config_record = op.mutable_change_config_record();
+  config_record->set_tablet_id(kTabletId);
+  config_record->mutable_old_config()->set_opid_index(1);
+  config_record->mutable_new_config()->set_opid_index(2);
+  op.mutable_proxy_record()->set_dest_server(kFollowerUuid);
+  rpc::RequestIdPB* request_id = op.mutable_request_id();
+  request_id->set_client_id("client");
+  request_id->set_seq_no(1);
+  request_id->set_first_incomplete_seq_no(1);
+  request_id->set_attempt_no(2);
+  op.mutable_noop_request()->set_timestamp_in_opid_order(true);
+  WritePayloadPB* payload = op.mutable_write_payload();
+  payload->set_payload(string(4096, 'x'));
+  payload->set_compression_codec(LZ4);
+  payload->set_uncompressed_size(8192);
+  payload->set_crc32(42);
+  payload->mutable_fragment()->set_payload_id(5);
+  payload->mutable_fragment()->set_seq(1);
+  payload->mutable_fragment()->set_last(true);
+
+  ReplicateRefPtr stub = MakePayloadSidecarStub(op, 0);
+  ASSERT_FALSE(stub->get()->write_payload().has_payload());
+  ASSERT_EQ(0, stub->get()->write_payload().payload_sidecar_idx());
+
+  ConsensusRequestPB request;
+  request.add_ops()->CopyFrom(*stub->get());
+  ASSERT_OK(MergePayloadSidecars(&request, [&](int idx, Slice* data) {
+    if (idx != 0) {
+      return Status::NotFound("no such sidecar");
+    }
+    *data = Slice(op.write_payload().payload());
+    return Status::OK();
+  }));
+  ASSERT_TRUE(MessageDifferencer::Equals(op, request.ops(0)))
+      << SecureShortDebugString(request.ops(0));
+
+  // A missing sidecar fails the request.
+  request.mutable_ops(0)->CopyFrom(*MakePayloadSidecarStub(op, 1)->get());
+  ASSERT_TRUE(MergePayloadSidecars(&request, [](int, Slice*) {
+                return Status::NotFound("no such sidecar");
+              }).IsNotFound());
+}
+
 } // namespace consensus
 } // namespace kudu
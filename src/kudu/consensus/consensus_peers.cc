@@ -24,12 +24,14 @@
 #include "kudu/consensus/consensus_peers.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -44,7 +46,10 @@
 #include "kudu/consensus/consensus_queue.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_resource_accounting.h"
+#include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
@@ -52,19 +57,27 @@
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
+#include "kudu/rpc/transfer.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/tserver/tserver.pb.h" // @manual
 #endif
+#include "kudu/util/crc.h"
+#include "kudu/util/debug/trace_event.h"
+#include "kudu/util/env.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/net/dns_resolver.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 
 DEFINE_int32(
     raft_get_node_instance_timeout_ms,
@@ -107,6 +120,135 @@ DEFINE_int32(
     0,
     "Time (in ms) to wait before reading ops for proxy requests");
 
+DEFINE_bool(
+    raft_send_ops_in_sidecar,
+    false,
+    "Whether the leader sends the ops of an UpdateConsensus request in an RPC "
+    "sidecar, encoding each batch once for all the peers it is sent to "
+    "instead of once per peer. Only enable this once every replica of the "
+    "tablet understands the sidecar.");
+TAG_FLAG(raft_send_ops_in_sidecar, experimental);
+
+DEFINE_bool(
+    raft_send_payloads_in_sidecars,
+    false,
+    "Whether the leader sends the largest write payloads of an UpdateConsensus "
+    "request as RPC sidecars that point straight into the log cache, instead "
+    "of copying them into the serialized request. Has no effect on requests "
+    "whose ops already go in a sidecar (see --raft_send_ops_in_sidecar). "
+    "Only enable this once every replica of the tablet understands payload "
+    "sidecars.");
+TAG_FLAG(raft_send_payloads_in_sidecars, experimental);
+
+DEFINE_int32(
+    raft_payload_sidecar_min_bytes,
+    64 * 1024,
+    "Write payloads smaller than this are always sent inline when "
+    "--raft_send_payloads_in_sidecars is enabled.");
+TAG_FLAG(raft_payload_sidecar_min_bytes, experimental);
+
+DEFINE_bool(
+    raft_coalesce_updates,
+    false,
+    "Whether UpdateConsensus requests that the tablets on this server send to "
+    "the same destination are bundled into MultiUpdateConsensus RPCs. Only "
+    "enable this once every server understands MultiUpdateConsensus.");
+TAG_FLAG(raft_coalesce_updates, experimental);
+
+DEFINE_int32(
+    raft_coalesce_window_us,
+    500,
+    "How long a request waits for others to bundle with when "
+    "--raft_coalesce_updates is enabled.");
+TAG_FLAG(raft_coalesce_window_us, experimental);
+
+DEFINE_uint32(
+    raft_coalesce_max_batch_size,
+    64,
+    "A bundle is sent without waiting once it has this many requests.");
+TAG_FLAG(raft_coalesce_max_batch_size, experimental);
+
+DEFINE_int32(
+    raft_coalesce_max_request_bytes,
+    0,
+    "Requests carrying ops are bundled only if they are at most this large. "
+    "With the default of 0, only heartbeats are bundled, so that updates "
+    "aren't delayed by the bundling window.");
+TAG_FLAG(raft_coalesce_max_request_bytes, experimental);
+
+DEFINE_bool(
+    raft_coalesce_proxied_updates,
+    false,
+    "Whether proxied requests whose ops go in a sidecar (see "
+    "--raft_proxy_relay_ops) are bundled with the others to the same proxy, "
+    "so that ops sent to several peers behind the proxy cross the network "
+    "once. Has no effect unless --raft_coalesce_updates is enabled.");
+TAG_FLAG(raft_coalesce_proxied_updates, experimental);
+
+DEFINE_int32(
+    raft_quiescent_heartbeat_periods,
+    0,
+    "If greater than 1, the leader sends only one in this many heartbeats to "
+    "a follower that is fully caught up, and the follower waits that much "
+    "longer before suspecting the leader has failed. Saves CPU on servers "
+    "with many idle tablets, at the cost of slower detection of a leader "
+    "failure while idle. Capped so that leader leases and the bounded data "
+    "loss window still get renewed at least twice per interval. Only enable "
+    "this once every replica understands quiescent heartbeats.");
+TAG_FLAG(raft_quiescent_heartbeat_periods, experimental);
+
+DEFINE_bool(
+    raft_separate_connection_classes,
+    false,
+    "Whether requests to peers are split over separate connections by the "
+    "kind of traffic: heartbeats and elections on one, requests with ops on "
+    "another, and requests of at least --raft_bulk_request_min_bytes of ops, "
+    "which are sent when catching up a peer, on bulk connections striped "
+    "--rpc_bulk_connection_stripes ways. Keeps heartbeats from queueing "
+    "behind catch-up traffic.");
+TAG_FLAG(raft_separate_connection_classes, experimental);
+
+DEFINE_int32(
+    raft_bulk_request_min_bytes,
+    1024 * 1024,
+    "Requests to peers with at least this many bytes of ops are sent on bulk "
+    "connections. Has no effect unless --raft_separate_connection_classes is "
+    "enabled.");
+TAG_FLAG(raft_bulk_request_min_bytes, experimental);
+TAG_FLAG(raft_bulk_request_min_bytes, runtime);
+
+DEFINE_int32(
+    consensus_heartbeat_rpc_timeout_ms,
+    0,
+    "Timeout used for UpdateConsensus requests that carry no ops. Tighter "
+    "than --consensus_rpc_timeout_ms, it lets a loaded follower's service "
+    "queue drop heartbeats the next one will replace anyway. If 0, "
+    "--consensus_rpc_timeout_ms is used.");
+TAG_FLAG(consensus_heartbeat_rpc_timeout_ms, experimental);
+TAG_FLAG(consensus_heartbeat_rpc_timeout_ms, runtime);
+
+DEFINE_bool(
+    raft_compact_heartbeats,
+    false,
+    "Whether the leader sends heartbeats to a caught-up follower as compact "
+    "Heartbeat RPCs, which the follower handles on the reactor thread "
+    "without taking its consensus lock, instead of as UpdateConsensus "
+    "requests. A follower that can't handle one has the leader resend it as "
+    "an UpdateConsensus. Must be enabled on followers for them to handle "
+    "any. Only enable this once every server understands Heartbeat RPCs.");
+TAG_FLAG(raft_compact_heartbeats, experimental);
+TAG_FLAG(raft_compact_heartbeats, runtime);
+
+DEFINE_bool(
+    raft_drop_superseded_requests,
+    false,
+    "Whether the leader numbers its requests to peers so that a follower "
+    "drops, before handling them, queued requests the leader already gave up "
+    "on and replaced with newer ones. Only applies while "
+    "--raft_max_inflight_requests_per_peer is 1.");
+TAG_FLAG(raft_drop_superseded_requests, experimental);
+TAG_FLAG(raft_drop_superseded_requests, runtime);
+
 DEFINE_bool(
     raft_enforce_rpc_token,
     false,
@@ -133,9 +275,108 @@ using std::vector;
 using std::weak_ptr;
 using strings::Substitute;
 
+DECLARE_int32(bounded_dataloss_window_interval_ms);
+DECLARE_int32(rpc_max_outbound_sidecars);
+DECLARE_bool(raft_adaptive_batch_size);
+
 namespace kudu {
 namespace consensus {
 
+namespace {
+
+// The number of heartbeat periods the leader may stay silent for when a
+// follower is caught up, or 1 if heartbeats shouldn't pause.
+int32_t QuiescentHeartbeatPeriods() {
+  int32_t periods = FLAGS_raft_quiescent_heartbeat_periods;
+  const int32_t interval_ms = std::max(FLAGS_raft_heartbeat_interval_ms, 1);
+  if (FLAGS_enable_raft_leader_lease) {
+    periods = std::min(periods, FLAGS_raft_leader_lease_interval_ms /
+                           (2 * interval_ms));
+  }
+  if (FLAGS_enable_bounded_dataloss_window) {
+    periods = std::min(periods, FLAGS_bounded_dataloss_window_interval_ms /
+                           (2 * interval_ms));
+  }
+  return std::max(periods, 1);
+}
+
+// The class of connection to send 'request' on.
+rpc::ConnectionClass ConnectionClassForRequest(
+    const ConsensusRequestPB& request) {
+  if (request.ops_size() == 0) {
+    return rpc::ConnectionClass::CONTROL;
+  }
+  int64_t ops_bytes = 0;
+  for (const ReplicateMsg& op : request.ops()) {
+    ops_bytes += op.ByteSizeLong();
+    if (ops_bytes >= FLAGS_raft_bulk_request_min_bytes) {
+      return rpc::ConnectionClass::BULK;
+    }
+  }
+  return rpc::ConnectionClass::REPLICATION;
+}
+
+// Fills 'hb' with the compact form of 'request', which carries no ops.
+void ToHeartbeatRequest(
+    const ConsensusRequestPB& request,
+    HeartbeatRequestPB* hb) {
+  hb->Clear();
+  hb->set_dest_uuid(request.dest_uuid());
+  hb->set_tablet_id(request.tablet_id());
+  hb->set_caller_uuid(request.caller_uuid());
+  hb->set_caller_term(request.caller_term());
+  hb->set_preceding_term(request.preceding_id().term());
+  hb->set_preceding_index(request.preceding_id().index());
+  hb->set_committed_index(request.committed_index());
+  hb->set_all_replicated_index(request.all_replicated_index());
+  hb->set_region_durable_index(request.region_durable_index());
+  hb->set_last_idx_appended_to_leader(request.last_idx_appended_to_leader());
+  if (request.has_safe_timestamp()) {
+    hb->set_safe_timestamp(request.safe_timestamp());
+  }
+  if (request.has_requested_lease_duration()) {
+    hb->set_requested_lease_duration(request.requested_lease_duration());
+  }
+  if (request.has_quiescent_heartbeat_interval_ms()) {
+    hb->set_quiescent_heartbeat_interval_ms(
+        request.quiescent_heartbeat_interval_ms());
+  }
+  if (request.has_raft_rpc_token()) {
+    hb->set_raft_rpc_token(request.raft_rpc_token());
+  }
+}
+
+// Fills 'response' with what 'hb', a handled or failed heartbeat, stands for.
+void FromHeartbeatResponse(
+    const HeartbeatResponsePB& hb,
+    ConsensusResponsePB* response) {
+  response->Clear();
+  response->set_responder_uuid(hb.responder_uuid());
+  if (hb.has_raft_rpc_token()) {
+    response->set_raft_rpc_token(hb.raft_rpc_token());
+  }
+  if (hb.has_error()) {
+    *response->mutable_error() = hb.error();
+    return;
+  }
+  response->set_responder_term(hb.responder_term());
+  ConsensusStatusPB* status = response->mutable_status();
+  *status->mutable_last_received() =
+      MakeOpId(hb.last_received_term(), hb.last_received_index());
+  *status->mutable_last_received_current_leader() = MakeOpId(
+      hb.last_received_current_leader_term(),
+      hb.last_received_current_leader_index());
+  status->set_last_committed_idx(hb.last_committed_idx());
+  if (hb.has_lease_granted()) {
+    response->set_lease_granted(hb.lease_granted());
+  }
+  if (hb.has_load_percent()) {
+    response->set_load_percent(hb.load_percent());
+  }
+}
+
+} // anonymous namespace
+
 Status Peer::NewRemotePeer(
     RaftPeerPB peer_pb,
     string tablet_id,
@@ -172,15 +413,24 @@ Peer::Peer(
     : tablet_id_(std::move(tablet_id)),
       leader_uuid_(std::move(leader_uuid)),
       peer_pb_(std::move(peer_pb)),
+      peer_id_(InternPeerUuid(peer_pb_.permanent_uuid())),
       proxy_(std::move(proxy)),
       queue_(queue),
       peer_proxy_pool_(peer_proxy_pool),
       failed_attempts_(0),
       last_request_time_(MonoTime::Now()),
+      max_inflight_requests_(
+          FLAGS_buffer_messages_between_rpcs
+              ? 1
+              : std::max(1, FLAGS_raft_max_inflight_requests_per_peer)),
+      last_sent_committed_index_(kMinimumOpIdIndex),
       messenger_(std::move(messenger)),
-      raft_pool_token_(raft_pool_token),
-      rpc_start_(MonoTime::Min()) {
-  request_pending_ = false;
+      raft_pool_token_(raft_pool_token) {
+  num_inflight_requests_ = 0;
+  for (int i = 0; i < max_inflight_requests_; i++) {
+    requests_.emplace_back(new InflightRequest);
+    idle_requests_.push_back(requests_.back().get());
+  }
 }
 
 Status Peer::Init() {
@@ -208,14 +458,15 @@ Status Peer::SignalRequest(
     bool even_if_queue_empty,
     bool from_heartbeater,
     bool is_leader_lease_revoke) {
-  // Only allow one request at a time. No sense waking up the
+  // Only allow max_inflight_requests_ at a time. No sense waking up the
   // raft thread pool if the task will just abort anyway.
   //
-  // "request_pending_" is an atomic, hence no need to take peer_lock_ here.
-  // This allows to return early without blocking on "peer_lock_". Note that
-  // "peer_lock_" is also held during Peer::SendNextRequest(...) which could
-  // take some time for a lagging peer as it involves multiple disk IO
-  if (request_pending_ && !FLAGS_buffer_messages_between_rpcs) {
+  // "num_inflight_requests_" is an atomic, hence no need to take peer_lock_
+  // here. This allows to return early without blocking on "peer_lock_". Note
+  // that "peer_lock_" is also held during Peer::SendNextRequest(...) which
+  // could take some time for a lagging peer as it involves multiple disk IO
+  if (num_inflight_requests_ >= max_inflight_requests_ &&
+      !FLAGS_buffer_messages_between_rpcs) {
     return Status::OK();
   }
 
@@ -246,6 +497,26 @@ Status Peer::SignalRequest(
   return Status::OK();
 }
 
+void Peer::ScheduleThrottledRetryUnlocked() {
+  DCHECK(peer_lock_.is_locked());
+  if (throttled_retry_scheduled_) {
+    return;
+  }
+  throttled_retry_scheduled_ = true;
+  weak_ptr<Peer> w_this = shared_from_this();
+  messenger_->ScheduleOnReactor(
+      [w_this](const Status& /* status */) {
+        if (auto p = w_this.lock()) {
+          {
+            std::lock_guard<simple_spinlock> l(p->peer_lock_);
+            p->throttled_retry_scheduled_ = false;
+          }
+          p->SignalRequest(true);
+        }
+      },
+      MonoDelta::FromMicroseconds(Throttler::kRefillPeriodMicros));
+}
+
 bool Peer::ProxyBatchDurationHasPassed() {
   if (FLAGS_proxy_batch_duration_ms == 0) {
     return true;
@@ -279,14 +550,21 @@ void Peer::SendNextRequest(
     return;
   }
 
-  // Only allow one request at a time.
-  if (request_pending_) {
+  // Only allow max_inflight_requests_ at a time.
+  if (num_inflight_requests_ >= max_inflight_requests_) {
     if (FLAGS_buffer_messages_between_rpcs) {
       queue_->FillBufferForPeer(peer_pb_.permanent_uuid());
     }
     return;
   }
 
+  // The requests already in flight serve as heartbeats, and while the peer
+  // is failing there's no sense in sending it more than one at a time.
+  const int num_others_inflight = num_inflight_requests_;
+  if (num_others_inflight > 0 && (from_heartbeater || failed_attempts_ > 0)) {
+    return;
+  }
+
   // For the first request sent by the peer, we send it even if the queue is
   // empty, which it will always appear to be for the first request, since this
   // is the negotiation round.
@@ -309,11 +587,31 @@ void Peer::SendNextRequest(
     return;
   }
 
+  // Once the peer knows heartbeats may pause, skip all but one in
+  // 'quiet_periods' of them for as long as it stays caught up.
+  const int32_t quiet_periods = QuiescentHeartbeatPeriods();
+  const bool caught_up = quiet_periods > 1 && failed_attempts_ == 0 &&
+      queue_->IsPeerCaughtUp(peer_pb_.permanent_uuid());
+  if (from_heartbeater && caught_up && last_request_quiescent_ &&
+      quiescent_heartbeats_skipped_ < quiet_periods - 1) {
+    quiescent_heartbeats_skipped_++;
+    return;
+  }
+
   if (!from_heartbeater && !ProxyBatchDurationHasPassed()) {
     return;
   }
 
   // The peer has no pending request nor is sending: send the request.
+  TRACE_EVENT2(
+      "consensus",
+      "Peer::SendNextRequest",
+      "tablet",
+      tablet_id_,
+      "peer",
+      peer_pb_.permanent_uuid());
+  ScopedRaftResourceAccounting accounting(
+      queue_->resource_account(), RaftActivity::kSend);
   bool needs_tablet_copy = false;
 
   // If this peer is not healthy (as indicated by failed_attempts_), then
@@ -324,26 +622,32 @@ void Peer::SendNextRequest(
   // reachable.
   bool read_ops = (failed_attempts_ <= 0);
 
-  request_pending_ = true;
+  DCHECK(!idle_requests_.empty());
+  InflightRequest* req = idle_requests_.back();
+  idle_requests_.pop_back();
+  num_inflight_requests_++;
 
   last_request_time_ = MonoTime::Now();
 
   // The next hop to route to to ship messages to this peer. This could be
   // different than the peer_uuid when proxy is enabled
   string next_hop_uuid;
-  int64_t commit_index_before = request_.has_committed_index()
-      ? request_.committed_index()
-      : kMinimumOpIdIndex;
+  int64_t commit_index_before = last_sent_committed_index_;
+  bool catchup_throttled = false;
   Status s = queue_->RequestForPeer(
-      peer_pb_.permanent_uuid(),
+      peer_id_,
       read_ops,
-      &request_,
-      &replicate_msg_refs_,
+      &req->request,
+      &req->replicate_msg_refs,
       &needs_tablet_copy,
-      &next_hop_uuid);
-  int64_t commit_index_after = request_.has_committed_index()
-      ? request_.committed_index()
+      &next_hop_uuid,
+      &req->seq,
+      &catchup_throttled,
+      &req->replicate_batch);
+  int64_t commit_index_after = req->request.has_committed_index()
+      ? req->request.committed_index()
       : kMinimumOpIdIndex;
+  last_sent_committed_index_ = commit_index_after;
 
   if (PREDICT_FALSE(!s.ok())) {
     // Incrementing failed_attempts_ prevents a RequestForPeer error to
@@ -357,79 +661,135 @@ void Peer::SendNextRequest(
     // cluster.
     failed_attempts_++;
     VLOG_WITH_PREFIX_UNLOCKED(1) << s.ToString();
-    request_pending_ = false;
+    ReleaseRequestUnlocked(req);
     return;
   }
 
 #ifdef FB_DO_NOT_REMOVE
   if (PREDICT_FALSE(needs_tablet_copy)) {
+    ReleaseRequestUnlocked(req);
+    if (num_others_inflight > 0) {
+      // Wait for the other requests to finish first.
+      return;
+    }
     Status s = PrepareTabletCopyRequest();
     if (s.ok()) {
-      controller_.Reset();
-      request_pending_ = true;
+      tc_controller_.Reset();
+      num_inflight_requests_ = max_inflight_requests_;
       l.unlock();
       // Capture a shared_ptr reference into the RPC callback so that we're
       // guaranteed that this object outlives the RPC.
       shared_ptr<Peer> s_this = shared_from_this();
       proxy_->StartTabletCopyAsync(
-          &tc_request_, &tc_response_, &controller_, [s_this]() {
+          &tc_request_, &tc_response_, &tc_controller_, [s_this]() {
             s_this->ProcessTabletCopyResponse();
           });
     } else {
       LOG_WITH_PREFIX_UNLOCKED(WARNING)
           << "Unable to generate Tablet Copy request for peer: "
           << s.ToString();
-      request_pending_ = false;
     }
     return;
   }
 #endif
 
-  request_.set_tablet_id(tablet_id_);
-  request_.set_caller_uuid(leader_uuid_);
-  request_.set_dest_uuid(peer_pb_.permanent_uuid());
+  if (PREDICT_FALSE(catchup_throttled && !from_heartbeater)) {
+    // Rather than send a status-only request, whose response would just ask
+    // for more, try again once the throttle has had time to refill.
+    last_sent_committed_index_ = commit_index_before;
+    ReleaseRequestUnlocked(req);
+    ScheduleThrottledRetryUnlocked();
+    return;
+  }
+
+  ConsensusRequestPB& request = req->request;
+  request.clear_ops_sidecar_idx();
+  request.clear_ops_sidecar_compression();
+  request.clear_ops_sidecar_uncompressed_size();
+  request.clear_ops_sidecar_encoding();
+  req->ops_sidecar.reset();
+  request.clear_quiescent_heartbeat_interval_ms();
+  request.clear_request_generation();
+  if (FLAGS_raft_drop_superseded_requests && max_inflight_requests_ == 1) {
+    // Shared by all peers, so that it keeps increasing across Peer instances
+    // for the same peer.
+    static std::atomic<int64_t> next_request_generation(0);
+    request.set_request_generation(next_request_generation++);
+  }
+  request.set_tablet_id(tablet_id_);
+  request.set_caller_uuid(leader_uuid_);
+  request.set_dest_uuid(peer_pb_.permanent_uuid());
 
   if (FLAGS_enable_raft_leader_lease) {
     bool is_noop_request =
-        request_.ops_size() == 1 && request_.ops(0).op_type() == NO_OP;
+        request.ops_size() == 1 && request.ops(0).op_type() == NO_OP;
     int32_t lease_duration = is_leader_lease_revoke && !is_noop_request
         ? 0 /* For Lease revoke by old leader */
         : FLAGS_raft_leader_lease_interval_ms;
-    request_.set_requested_lease_duration(lease_duration);
+    request.set_requested_lease_duration(lease_duration);
   }
 
   bool req_has_ops =
-      request_.ops_size() > 0 || (commit_index_after > commit_index_before);
+      request.ops_size() > 0 || (commit_index_after > commit_index_before);
   // If the queue is empty, check if we were told to send a status-only
-  // message, if not just return.
-  if (PREDICT_FALSE(!req_has_ops && !even_if_queue_empty)) {
-    request_pending_ = false;
+  // message, if not just return. A status-only message isn't needed if there
+  // are other requests in flight.
+  if (PREDICT_FALSE(
+          !req_has_ops && (!even_if_queue_empty || num_others_inflight > 0))) {
+    ReleaseRequestUnlocked(req);
     return;
   }
 
   if (req_has_ops) {
     // If we're actually sending ops there's no need to heartbeat for a while.
     heartbeater_->Snooze();
+    compact_heartbeats_armed_ = false;
+  } else if (caught_up && next_hop_uuid == peer_pb_.permanent_uuid()) {
+    request.set_quiescent_heartbeat_interval_ms(
+        quiet_periods * FLAGS_raft_heartbeat_interval_ms);
   }
+  last_request_quiescent_ = request.has_quiescent_heartbeat_interval_ms();
+  quiescent_heartbeats_skipped_ = 0;
+  req->compact_heartbeat = FLAGS_raft_compact_heartbeats &&
+      compact_heartbeats_armed_ && !req_has_ops &&
+      next_hop_uuid == peer_pb_.permanent_uuid() &&
+      !request.has_compression_dictionary();
 
   MAYBE_FAULT(FLAGS_fault_crash_on_leader_request_fraction);
 
   VLOG_WITH_PREFIX_UNLOCKED(2)
       << "Sending to peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(request_);
-  controller_.Reset();
+      << SecureShortDebugString(request);
+  req->controller.Reset();
+
+  // With room for more requests in flight, see if there's more to send
+  // without waiting for a response.
+  const bool pipeline_more = request.ops_size() > 0 &&
+      num_inflight_requests_ < max_inflight_requests_;
+
+  req->ops_bytes = 0;
+  if (request.ops_size() > 0 &&
+      (RaftResourceAccountingEnabled() || FLAGS_raft_adaptive_batch_size)) {
+    // As in the log cache, the payload stands in for the size of an op.
+    for (const ReplicateMsg& op : request.ops()) {
+      req->ops_bytes += op.write_payload().payload().size();
+    }
+    if (RaftResourceAccountingEnabled()) {
+      queue_->resource_account()->AddBytesSent(req->ops_bytes);
+    }
+  }
 
   l.unlock();
   // Capture a shared_ptr reference into the RPC callback so that we're
   // guaranteed that this object outlives the RPC.
   shared_ptr<Peer> s_this = shared_from_this();
 
-  // TODO: Refactor this code. Ideally all fields in 'request_' related to
+  // TODO: Refactor this code. Ideally all fields in 'request' related to
   // proxying should be set inside PeerMessageQueue::RequestForPeer(). Move the
   // setting of 'proxy_hops_remaining' to PeerMessageQueue::RequestForPeer()
   if (next_hop_uuid != peer_pb().permanent_uuid()) {
     // If this is a proxy request, set the hops remaining value.
-    request_.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
+    request.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
   }
 
   shared_ptr<PeerProxy> next_hop_proxy = peer_proxy_pool_->Get(next_hop_uuid);
@@ -438,12 +798,179 @@ void Peer::SendNextRequest(
                                     << " not found in peer proxy pool";
   }
 
-  if (FLAGS_enable_raft_leader_lease || FLAGS_enable_bounded_dataloss_window) {
-    s_this->SetUpdateConsensusRpcStart(MonoTime::Now());
+  if (FLAGS_raft_separate_connection_classes) {
+    req->controller.set_connection_class(ConnectionClassForRequest(request));
   }
-  next_hop_proxy->UpdateAsync(&request_, &response_, &controller_, [s_this]() {
-    s_this->ProcessResponse();
-  });
+
+  // Proxied requests carry stripped-down PROXY_OP ops, which aren't worth
+  // sharing, unless the proxy relays the full ops.
+  if (FLAGS_raft_send_ops_in_sidecar && request.ops_size() > 0 &&
+      request.ops(0).op_type() != PROXY_OP) {
+    MoveOpsToSidecar(req);
+  }
+  if (FLAGS_raft_send_payloads_in_sidecars && request.ops_size() > 0 &&
+      next_hop_uuid == peer_pb().permanent_uuid()) {
+    MovePayloadsToSidecars(req);
+  }
+
+  req->rpc_start = MonoTime::Now();
+  if (req->compact_heartbeat) {
+    ToHeartbeatRequest(request, &req->heartbeat_request);
+    next_hop_proxy->HeartbeatAsync(
+        &req->heartbeat_request,
+        &req->heartbeat_response,
+        &req->controller,
+        [s_this, req]() { s_this->ProcessHeartbeatResponse(req); });
+    return;
+  }
+  auto done = [s_this, req]() { s_this->ProcessResponse(req); };
+  if (req->ops_sidecar) {
+    next_hop_proxy->UpdateAsyncWithOpsSidecar(
+        &request, req->ops_sidecar, &req->response, &req->controller, done);
+  } else {
+    next_hop_proxy->UpdateAsync(
+        &request, &req->response, &req->controller, done);
+  }
+
+  if (pipeline_more) {
+    // Best effort: otherwise the next response or heartbeat sends more.
+    ignore_result(SignalRequest());
+  }
+}
+
+void Peer::MoveOpsToSidecar(InflightRequest* req) {
+  ConsensusRequestPB& request = req->request;
+  ConsensusRequestPB::OpsSidecarEncoding encoding;
+  CompressionType compression;
+  int64_t uncompressed_size;
+  shared_ptr<const string> ops = queue_->GetSerializedOps(
+      request.ops(), &encoding, &compression, &uncompressed_size);
+  int idx;
+  Status s = req->controller.AddOutboundSidecar(
+      rpc::RpcSidecar::FromSharedString(ops), &idx);
+  if (PREDICT_FALSE(!s.ok())) {
+    // Send the ops inline instead.
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << LogPrefixUnlocked()
+        << "Unable to attach ops as a sidecar: " << s.ToString();
+    return;
+  }
+
+  // The ops are still referenced by 'replicate_msg_refs' or
+  // 'replicate_batch'.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  request.set_ops_sidecar_idx(idx);
+  if (encoding != ConsensusRequestPB::REQUEST_OPS_FIELDS) {
+    request.set_ops_sidecar_encoding(encoding);
+  }
+  if (compression != NO_COMPRESSION) {
+    request.set_ops_sidecar_compression(compression);
+    request.set_ops_sidecar_uncompressed_size(uncompressed_size);
+  }
+  req->ops_sidecar = std::move(ops);
+}
+
+void Peer::MovePayloadsToSidecars(InflightRequest* req) {
+  ConsensusRequestPB& request = req->request;
+
+  // Only as many payloads as there are sidecars can go, so pick the largest.
+  std::vector<int> candidates;
+  for (int i = 0; i < request.ops_size(); i++) {
+    const ReplicateMsg& op = request.ops(i);
+    if (op.has_write_payload() &&
+        op.write_payload().payload().size() >=
+            FLAGS_raft_payload_sidecar_min_bytes) {
+      candidates.push_back(i);
+    }
+  }
+  const auto payload_size = [&request](int i) {
+    return request.ops(i).write_payload().payload().size();
+  };
+  const size_t max_sidecars = FLAGS_rpc_max_outbound_sidecars;
+  if (candidates.size() > max_sidecars) {
+    std::nth_element(
+        candidates.begin(),
+        candidates.begin() + max_sidecars - 1,
+        candidates.end(),
+        [&payload_size](int a, int b) {
+          return payload_size(a) > payload_size(b);
+        });
+    candidates.resize(max_sidecars);
+  }
+
+  for (int i : candidates) {
+    const ReplicateMsg& op = request.ops(i);
+    int idx;
+    // The sidecar points into 'op', which 'replicate_msg_refs' or
+    // 'replicate_batch' keeps alive until the RPC is done.
+    Status s = req->controller.AddOutboundSidecar(
+        rpc::RpcSidecar::FromSlice(Slice(op.write_payload().payload())), &idx);
+    if (PREDICT_FALSE(!s.ok())) {
+      // Send the rest inline.
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << LogPrefixUnlocked()
+          << "Unable to attach payload as a sidecar: " << s.ToString();
+      return;
+    }
+
+    // 'op' may be shared with other peers' requests, so send a copy of
+    // everything but its payload in its place.
+    ReplicateRefPtr stub_ref = MakePayloadSidecarStub(op, idx);
+    ReplicateMsg* stub = stub_ref->get();
+
+    // Put 'stub' in slot 'i' without deleting 'op', which the request doesn't
+    // own.
+    request.mutable_ops()->AddAllocated(stub);
+    request.mutable_ops()->SwapElements(i, request.ops_size() - 1);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        request.ops_size() - 1, 1, nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(request.ops_size() - 1, 1, nullptr);
+#endif
+    req->replicate_msg_refs.emplace_back(std::move(stub_ref));
+  }
+}
+
+ReplicateRefPtr MakePayloadSidecarStub(
+    const ReplicateMsg& op,
+    int sidecar_idx) {
+  ReplicateRefPtr stub = make_scoped_refptr_replicate(new ReplicateMsg);
+  CopyReplicateMsgWithoutPayload(op, stub->get());
+  stub->get()->mutable_write_payload()->set_payload_sidecar_idx(sidecar_idx);
+  return stub;
+}
+
+Status MergePayloadSidecars(
+    ConsensusRequestPB* req,
+    const std::function<Status(int, Slice*)>& get_sidecar) {
+  for (ReplicateMsg& op : *req->mutable_ops()) {
+    if (PREDICT_TRUE(
+            !op.has_write_payload() ||
+            !op.write_payload().has_payload_sidecar_idx())) {
+      continue;
+    }
+    WritePayloadPB* payload = op.mutable_write_payload();
+    Slice data;
+    RETURN_NOT_OK_PREPEND(
+        get_sidecar(payload->payload_sidecar_idx(), &data),
+        Substitute(
+            "Unable to read payload sidecar of op $0", OpIdToString(op.id())));
+    payload->set_payload(data.data(), data.size());
+    payload->clear_payload_sidecar_idx();
+  }
+  return Status::OK();
+}
+
+void Peer::ReleaseRequestUnlocked(InflightRequest* req) {
+  DCHECK(peer_lock_.is_locked());
+  idle_requests_.push_back(req);
+  num_inflight_requests_--;
 }
 
 Status Peer::StartElection(
@@ -460,47 +987,51 @@ Status Peer::StartElection(
   return Status::OK();
 }
 
-void Peer::ProcessResponse() {
+void Peer::ProcessResponse(InflightRequest* req) {
   // Note: This method runs on the reactor thread.
   std::unique_lock<simple_spinlock> lock(peer_lock_);
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
+  CHECK_GT(num_inflight_requests_, 0);
+  ScopedRaftResourceAccounting accounting(
+      queue_->resource_account(), RaftActivity::kSend);
 
   MAYBE_FAULT(FLAGS_fault_crash_after_leader_request_fraction);
 
+  const ConsensusResponsePB& response = req->response;
+
   // Process RpcController errors.
-  const auto controller_status = controller_.status();
+  const auto controller_status = req->controller.status();
   if (!controller_status.ok()) {
     auto ps = controller_status.IsRemoteError() ? PeerStatus::REMOTE_ERROR
                                                 : PeerStatus::RPC_LAYER_ERROR;
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, controller_status);
-    ProcessResponseError(controller_status);
+    ProcessResponseError(req, controller_status);
     return;
   }
 
   // Process CANNOT_PREPARE.
   // TODO(todd): there is no integration test coverage of this code path. Likely
   // a bug in this path is responsible for KUDU-1779.
-  if (response_.status().has_error() &&
-      response_.status().error().code() ==
+  if (response.status().has_error() &&
+      response.status().error().code() ==
           consensus::ConsensusErrorPB::CANNOT_PREPARE) {
-    Status response_status = StatusFromPB(response_.status().error().status());
+    Status response_status = StatusFromPB(response.status().error().status());
     queue_->UpdatePeerStatus(
         peer_pb_.permanent_uuid(), PeerStatus::CANNOT_PREPARE, response_status);
-    ProcessResponseError(response_status);
+    ProcessResponseError(req, response_status);
     return;
   }
 
   // Process tserver-level errors.
-  if (response_.has_error()) {
-    Status response_status = StatusFromPB(response_.error().status());
+  if (response.has_error()) {
+    Status response_status = StatusFromPB(response.error().status());
     PeerStatus ps;
     ps = PeerStatus::REMOTE_ERROR;
 
-    ServerErrorPB resp_error = response_.error();
-    switch (response_.error().code()) {
+    ServerErrorPB resp_error = response.error();
+    switch (response.error().code()) {
       // We treat WRONG_SERVER_UUID as failed.
       case ServerErrorPB::WRONG_SERVER_UUID:
         FALLTHROUGH_INTENDED;
@@ -517,7 +1048,7 @@ void Peer::ProcessResponse() {
         ps = PeerStatus::REMOTE_ERROR;
     }
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, response_status);
-    ProcessResponseError(response_status);
+    ProcessResponseError(req, response_status);
     return;
   }
 
@@ -529,35 +1060,82 @@ void Peer::ProcessResponse() {
   // Capture a weak_ptr reference into the submitted functor so that we can
   // safely handle the functor outliving its peer.
   weak_ptr<Peer> w_this = shared_from_this();
-  Status s = raft_pool_token_->SubmitFunc([w_this]() {
+  Status s = raft_pool_token_->SubmitFunc([w_this, req]() {
     if (auto p = w_this.lock()) {
-      p->DoProcessResponse();
+      p->DoProcessResponse(req);
     }
   });
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX_UNLOCKED(WARNING)
         << "Unable to process peer response: " << s.ToString() << ": "
-        << SecureShortDebugString(response_);
-    request_pending_ = false;
+        << SecureShortDebugString(response);
+    ReleaseRequestUnlocked(req);
   }
 }
 
-void Peer::DoProcessResponse() {
+void Peer::ProcessHeartbeatResponse(InflightRequest* req) {
+  // Note: This method runs on the reactor thread.
+  const HeartbeatResponsePB& hb = req->heartbeat_response;
+  if (req->controller.status().ok() && !hb.has_error() && !hb.handled()) {
+    {
+      std::lock_guard<simple_spinlock> l(peer_lock_);
+      if (closed_) {
+        return;
+      }
+      compact_heartbeats_armed_ = false;
+    }
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Peer " << peer_pb().permanent_uuid()
+        << " didn't handle a compact heartbeat, resending it";
+    req->compact_heartbeat = false;
+    req->controller.Reset();
+    if (FLAGS_raft_separate_connection_classes) {
+      req->controller.set_connection_class(
+          ConnectionClassForRequest(req->request));
+    }
+    req->rpc_start = MonoTime::Now();
+    shared_ptr<Peer> s_this = shared_from_this();
+    proxy_->UpdateAsync(
+        &req->request, &req->response, &req->controller, [s_this, req]() {
+          s_this->ProcessResponse(req);
+        });
+    return;
+  }
+  FromHeartbeatResponse(hb, &req->response);
+  ProcessResponse(req);
+}
+
+void Peer::DoProcessResponse(InflightRequest* req) {
   VLOG_WITH_PREFIX_UNLOCKED(2)
       << "Response from peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(response_);
+      << SecureShortDebugString(req->response);
 
-  if (FLAGS_enable_raft_leader_lease || FLAGS_enable_bounded_dataloss_window) {
-    queue_->SetPeerRpcStartTime(peer_pb().permanent_uuid(), rpc_start_);
+  if (FLAGS_enable_raft_leader_lease || FLAGS_enable_bounded_dataloss_window ||
+      queue_->HasLeadershipWaiters()) {
+    queue_->SetPeerRpcStartTime(peer_pb().permanent_uuid(), req->rpc_start);
+  }
+  // Only direct requests measure the network to the peer itself.
+  if (req->controller.status().ok() && !req->response.has_error() &&
+      !req->request.has_proxy_dest_uuid()) {
+    queue_->RecordPeerRoundTrip(
+        peer_pb().permanent_uuid(),
+        MonoTime::Now() - req->rpc_start,
+        req->ops_bytes);
   }
   bool send_more_immediately =
-      queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response_);
+      queue_->ResponseFromPeer(peer_id_, req->response, req->seq);
 
   {
     std::unique_lock<simple_spinlock> lock(peer_lock_);
-    CHECK(request_pending_);
+    CHECK_GT(num_inflight_requests_, 0);
     failed_attempts_ = 0;
-    request_pending_ = false;
+    // The peer handled a request without ops, so it can handle the next
+    // heartbeat as a compact one.
+    compact_heartbeats_armed_ = req->request.ops_size() == 0 &&
+        !req->request.has_ops_sidecar_idx() &&
+        !req->request.has_proxy_dest_uuid() && !req->response.has_error() &&
+        !req->response.status().has_error();
+    ReleaseRequestUnlocked(req);
   }
   // We're OK to read the state_ without a lock here -- if we get a race,
   // the worst thing that could happen is that we'll make one more request
@@ -586,12 +1164,12 @@ void Peer::ProcessTabletCopyResponse() {
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
-  request_pending_ = false;
+  CHECK_EQ(max_inflight_requests_, num_inflight_requests_);
+  num_inflight_requests_ = 0;
 
   // If the response is OK, or ALREADY_INPROGRESS, then consider the RPC
   // successful.
-  const auto controller_status = controller_.status();
+  const auto controller_status = tc_controller_.status();
   bool success = controller_status.ok() &&
       (!tc_response_.has_error() ||
        tc_response_.error().code() ==
@@ -615,19 +1193,19 @@ void Peer::ProcessTabletCopyResponse() {
 }
 #endif
 
-void Peer::ProcessResponseError(const Status& status) {
+void Peer::ProcessResponseError(InflightRequest* req, const Status& status) {
   string resp_err_info;
 
 #ifdef FB_DO_NOT_REMOVE
-  if (response_.has_error()) {
+  if (req->response.has_error()) {
     resp_err_info = Substitute(
         " Error code: $0 ($1).",
-        TabletServerErrorPB::Code_Name(response_.error().code()),
-        response_.error().code());
+        TabletServerErrorPB::Code_Name(req->response.error().code()),
+        req->response.error().code());
   }
 #endif
 
-  request_pending_ = false;
+  ReleaseRequestUnlocked(req);
 
   if (status.IsIllegalState() &&
       status.ToString().find("Previous Rotate Event with") !=
@@ -678,12 +1256,15 @@ Peer::~Peer() {
   }
 
   // We don't own the ops (the queue does).
+  for (const auto& req : requests_) {
 #if GOOGLE_PROTOBUF_VERSION >= 3017003
-  request_.mutable_ops()->UnsafeArenaExtractSubrange(
-      0, request_.ops_size(), nullptr);
+    req->request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, req->request.ops_size(), nullptr);
 #else
-  request_.mutable_ops()->ExtractSubrange(0, request_.ops_size(), nullptr);
+    req->request.mutable_ops()->ExtractSubrange(
+        0, req->request.ops_size(), nullptr);
 #endif
+  }
 }
 
 shared_ptr<PeerProxy> PeerProxyPool::Get(const string& uuid) const {
@@ -745,30 +1326,261 @@ void CheckAndEnforceResponseToken(
   error->set_code(ServerErrorPB::RING_TOKEN_MISMATCH);
 }
 
+shared_ptr<UpdateCoalescer> UpdateCoalescer::ForHost(
+    const shared_ptr<Messenger>& messenger,
+    const HostPort& hostport,
+    shared_ptr<ConsensusServiceProxy> proxy) {
+  static simple_spinlock registry_lock;
+  static auto* registry =
+      new std::unordered_map<string, weak_ptr<UpdateCoalescer>>();
+
+  const string key = Substitute("$0/$1", messenger.get(), hostport.ToString());
+  std::lock_guard<simple_spinlock> l(registry_lock);
+  weak_ptr<UpdateCoalescer>& slot = (*registry)[key];
+  shared_ptr<UpdateCoalescer> coalescer = slot.lock();
+  if (!coalescer) {
+    coalescer.reset(new UpdateCoalescer(messenger, std::move(proxy)));
+    slot = coalescer;
+  }
+  return coalescer;
+}
+
+UpdateCoalescer::UpdateCoalescer(
+    weak_ptr<Messenger> messenger,
+    shared_ptr<ConsensusServiceProxy> proxy)
+    : messenger_(std::move(messenger)), proxy_(std::move(proxy)) {}
+
+bool UpdateCoalescer::CanCoalesce(const ConsensusRequestPB& request) {
+  if (request.has_ops_sidecar_idx() || request.has_proxy_dest_uuid() ||
+      request.has_proxy_hops_remaining()) {
+    return false;
+  }
+  if (request.ops_size() == 0) {
+    return true;
+  }
+  for (const ReplicateMsg& op : request.ops()) {
+    if (op.has_write_payload() &&
+        op.write_payload().has_payload_sidecar_idx()) {
+      return false;
+    }
+  }
+  return request.ByteSizeLong() <=
+      static_cast<size_t>(FLAGS_raft_coalesce_max_request_bytes);
+}
+
+bool UpdateCoalescer::CanCoalesceWithOps(const ConsensusRequestPB& request) {
+  return FLAGS_raft_coalesce_proxied_updates &&
+      request.has_proxy_dest_uuid() && request.has_ops_sidecar_idx();
+}
+
+void UpdateCoalescer::UpdateAsync(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    rpc::ResponseCallback callback,
+    shared_ptr<const string> ops) {
+  std::vector<PendingUpdate> full;
+  bool flush_now = false;
+  bool schedule_flush = false;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    bool new_sidecar = ops &&
+        std::none_of(pending_.begin(),
+                     pending_.end(),
+                     [&](const PendingUpdate& u) { return u.ops == ops; });
+    if (new_sidecar &&
+        pending_sidecars_ >= FLAGS_rpc_max_outbound_sidecars) {
+      // The bundle can't carry another sidecar, so send it as it is.
+      full.swap(pending_);
+      pending_sidecars_ = 0;
+    }
+    pending_.push_back({request, response, std::move(callback), ops});
+    if (new_sidecar) {
+      pending_sidecars_++;
+    }
+    if (pending_.size() >= FLAGS_raft_coalesce_max_batch_size) {
+      flush_now = true;
+    } else if (!flush_scheduled_) {
+      flush_scheduled_ = true;
+      schedule_flush = true;
+    }
+  }
+
+  if (!full.empty()) {
+    Send(std::move(full));
+  }
+  if (flush_now) {
+    Flush();
+    return;
+  }
+  if (schedule_flush) {
+    shared_ptr<Messenger> messenger = messenger_.lock();
+    if (PREDICT_FALSE(!messenger)) {
+      Flush();
+      return;
+    }
+    // Whether or not the timer fires normally, the bundle must go out so
+    // that its callbacks run.
+    shared_ptr<UpdateCoalescer> s_this = shared_from_this();
+    messenger->ScheduleOnReactor(
+        [s_this](const Status& /* status */) { s_this->Flush(); },
+        MonoDelta::FromMicroseconds(FLAGS_raft_coalesce_window_us));
+  }
+}
+
+void UpdateCoalescer::Flush() {
+  std::vector<PendingUpdate> updates;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    updates.swap(pending_);
+    pending_sidecars_ = 0;
+    flush_scheduled_ = false;
+  }
+  if (!updates.empty()) {
+    Send(std::move(updates));
+  }
+}
+
+void UpdateCoalescer::Send(std::vector<PendingUpdate> updates) {
+  struct Bundle {
+    std::vector<PendingUpdate> updates;
+    MultiConsensusRequestPB request;
+    MultiConsensusResponsePB response;
+    RpcController controller;
+  };
+  auto bundle = std::make_shared<Bundle>();
+  bundle->updates = std::move(updates);
+
+  // Requests that share ops share the bundle's sidecar for them.
+  std::unordered_map<const string*, int> sidecar_idxs;
+  for (const PendingUpdate& update : bundle->updates) {
+    ConsensusRequestPB* request = bundle->request.add_requests();
+    *request = *update.request;
+    if (!update.ops) {
+      continue;
+    }
+    auto it = sidecar_idxs.find(update.ops.get());
+    if (it == sidecar_idxs.end()) {
+      int idx;
+      // UpdateAsync() keeps the number of sidecars within the limit.
+      CHECK_OK(bundle->controller.AddOutboundSidecar(
+          rpc::RpcSidecar::FromSharedString(update.ops), &idx));
+      it = sidecar_idxs.emplace(update.ops.get(), idx).first;
+    }
+    request->set_ops_sidecar_idx(it->second);
+  }
+  bundle->controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  proxy_->MultiUpdateConsensusAsync(
+      bundle->request, &bundle->response, &bundle->controller, [bundle]() {
+        const Status& s = bundle->controller.status();
+        for (int i = 0; i < static_cast<int>(bundle->updates.size()); i++) {
+          ConsensusResponsePB* response = bundle->updates[i].response;
+          if (PREDICT_TRUE(s.ok() && i < bundle->response.responses_size())) {
+            response->Swap(bundle->response.mutable_responses(i));
+          } else {
+            response->Clear();
+            StatusToPB(
+                s.ok() ? Status::RemoteError("Missing response in bundle") : s,
+                response->mutable_error()->mutable_status());
+            response->mutable_error()->set_code(ServerErrorPB::UNKNOWN_ERROR);
+          }
+          bundle->updates[i].callback();
+        }
+      });
+}
+
 RpcPeerProxy::RpcPeerProxy(
     unique_ptr<HostPort> hostport,
     shared_ptr<ConsensusServiceProxy> consensus_proxy,
-    scoped_refptr<Counter> num_rpc_token_mismatches)
+    scoped_refptr<Counter> num_rpc_token_mismatches,
+    shared_ptr<UpdateCoalescer> coalescer)
     : hostport_(std::move(hostport)),
       consensus_proxy_(std::move(consensus_proxy)),
-      num_rpc_token_mismatches_(std::move(num_rpc_token_mismatches)) {
+      num_rpc_token_mismatches_(std::move(num_rpc_token_mismatches)),
+      coalescer_(std::move(coalescer)) {
   DCHECK(hostport_ != NULL);
   DCHECK(consensus_proxy_ != NULL);
   DCHECK(num_rpc_token_mismatches_ != nullptr);
 }
 
+rpc::ResponseCallback RpcPeerProxy::CheckTokenThen(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) const {
+  boost::optional<std::string> rpc_token = request->has_raft_rpc_token()
+      ? request->raft_rpc_token()
+      : boost::optional<std::string>();
+  return [callback,
+          response,
+          controller,
+          request_token = std::move(rpc_token),
+          mismatch_counter = num_rpc_token_mismatches_]() {
+    // Should not need to lock here since only one request can happen at any
+    // time
+    if (controller->status().ok()) {
+      CheckAndEnforceResponseToken(
+          "UpdateAsync", response, request_token, mismatch_counter);
+    }
+    callback();
+  };
+}
+
 void RpcPeerProxy::UpdateAsync(
     const ConsensusRequestPB* request,
     ConsensusResponsePB* response,
     rpc::RpcController* controller,
     const rpc::ResponseCallback& callback) {
-  controller->set_timeout(
-      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  int32_t timeout_ms = FLAGS_consensus_rpc_timeout_ms;
+  if (FLAGS_consensus_heartbeat_rpc_timeout_ms > 0 &&
+      request->ops_size() == 0 && !request->has_ops_sidecar_idx()) {
+    timeout_ms = FLAGS_consensus_heartbeat_rpc_timeout_ms;
+  }
+  controller->set_timeout(MonoDelta::FromMilliseconds(timeout_ms));
+  auto done = CheckTokenThen(request, response, controller, callback);
 
+  // A bundled request never uses 'controller', which therefore stays OK;
+  // failures come back in the response instead.
+  if (coalescer_ && UpdateCoalescer::CanCoalesce(*request)) {
+    coalescer_->UpdateAsync(request, response, std::move(done));
+    return;
+  }
+  consensus_proxy_->UpdateConsensusAsync(
+      *request, response, controller, std::move(done));
+}
+
+void RpcPeerProxy::UpdateAsyncWithOpsSidecar(
+    const ConsensusRequestPB* request,
+    const shared_ptr<const string>& ops,
+    ConsensusResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) {
+  // A bundled request carries 'ops' in the bundle's sidecar, not in the one
+  // already in 'controller'.
+  if (coalescer_ && UpdateCoalescer::CanCoalesceWithOps(*request)) {
+    coalescer_->UpdateAsync(
+        request,
+        response,
+        CheckTokenThen(request, response, controller, callback),
+        ops);
+    return;
+  }
+  UpdateAsync(request, response, controller, callback);
+}
+
+void RpcPeerProxy::HeartbeatAsync(
+    const HeartbeatRequestPB* request,
+    HeartbeatResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) {
+  const int32_t timeout_ms = FLAGS_consensus_heartbeat_rpc_timeout_ms > 0
+      ? FLAGS_consensus_heartbeat_rpc_timeout_ms
+      : FLAGS_consensus_rpc_timeout_ms;
+  controller->set_timeout(MonoDelta::FromMilliseconds(timeout_ms));
   boost::optional<std::string> rpc_token = request->has_raft_rpc_token()
       ? request->raft_rpc_token()
       : boost::optional<std::string>();
-  consensus_proxy_->UpdateConsensusAsync(
+  consensus_proxy_->HeartbeatAsync(
       *request,
       response,
       controller,
@@ -777,11 +1589,9 @@ void RpcPeerProxy::UpdateAsync(
        controller,
        request_token = std::move(rpc_token),
        mismatch_counter = num_rpc_token_mismatches_]() {
-        // Should not need to lock here since only one request can happen at any
-        // time
         if (controller->status().ok()) {
           CheckAndEnforceResponseToken(
-              "UpdateAsync", response, request_token, mismatch_counter);
+              "HeartbeatAsync", response, request_token, mismatch_counter);
         }
         callback();
       });
@@ -824,6 +1634,14 @@ void RpcPeerProxy::RequestConsensusVoteAsync(
       });
 }
 
+void RpcPeerProxy::ReadIndexAsync(
+    const ReadIndexRequestPB* request,
+    ReadIndexResponsePB* response,
+    rpc::RpcController* controller,
+    const rpc::ResponseCallback& callback) {
+  consensus_proxy_->ReadIndexAsync(*request, response, controller, callback);
+}
+
 #ifdef FB_DO_NOT_REMOVE
 void RpcPeerProxy::StartTabletCopyAsync(
     const StartTabletCopyRequestPB* request,
@@ -848,7 +1666,8 @@ Status CreateConsensusServiceProxyForHost(
     const HostPort& hostport,
     shared_ptr<ConsensusServiceProxy>* new_proxy) {
   vector<Sockaddr> addrs;
-  RETURN_NOT_OK(hostport.ResolveAddresses(&addrs));
+  RETURN_NOT_OK(
+      messenger->dns_resolver()->ResolveAddressesCached(hostport, &addrs));
   if (addrs.size() > 1) {
     LOG(WARNING) << "Peer address '" << hostport.ToString() << "' "
                  << "resolves to " << addrs.size()
@@ -876,8 +1695,15 @@ Status RpcPeerProxyFactory::NewProxy(
   shared_ptr<ConsensusServiceProxy> new_proxy;
   RETURN_NOT_OK(
       CreateConsensusServiceProxyForHost(messenger_, *hostport, &new_proxy));
+  shared_ptr<UpdateCoalescer> coalescer;
+  if (FLAGS_raft_coalesce_updates) {
+    coalescer = UpdateCoalescer::ForHost(messenger_, *hostport, new_proxy);
+  }
   proxy->reset(new RpcPeerProxy(
-      std::move(hostport), std::move(new_proxy), num_rpc_token_mismatches_));
+      std::move(hostport),
+      std::move(new_proxy),
+      num_rpc_token_mismatches_,
+      std::move(coalescer)));
   return Status::OK();
 }
 
@@ -946,5 +1772,97 @@ Status SetPermanentUuidForRemotePeer(
   return Status::OK();
 }
 
+Status FetchLogSegment(
+    const shared_ptr<Messenger>& messenger,
+    const HostPort& source,
+    const string& tablet_id,
+    int64_t seqno,
+    Env* env,
+    const string& dest_path,
+    const MonoDelta& timeout) {
+  const MonoTime deadline = MonoTime::Now() + timeout;
+  shared_ptr<ConsensusServiceProxy> proxy;
+  RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger, source, &proxy));
+
+  RWFileOptions opts;
+  opts.mode = env->FileExists(dest_path) ? Env::OPEN_EXISTING
+                                         : Env::CREATE_NON_EXISTING;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK(env->NewRWFile(opts, dest_path, &file));
+  uint64_t offset;
+  RETURN_NOT_OK(file->Size(&offset));
+  if (offset > 0) {
+    LOG(INFO) << Substitute(
+        "Resuming the copy of segment $0 of $1 from $2 at offset $3",
+        seqno,
+        tablet_id,
+        source.ToString(),
+        offset);
+  }
+
+  FetchLogSegmentChunkRequestPB req;
+  req.set_tablet_id(tablet_id);
+  req.set_segment_seqno(seqno);
+  FetchLogSegmentChunkResponsePB resp;
+  RpcController controller;
+  int attempt = 0;
+  while (true) {
+    req.set_offset(offset);
+    resp.Clear();
+    controller.Reset();
+    controller.set_deadline(deadline);
+    Status s = proxy->FetchLogSegmentChunk(req, &resp, &controller);
+    if (s.ok() && resp.has_error()) {
+      s = StatusFromPB(resp.error().status());
+    }
+    if (s.IsServiceUnavailable() && MonoTime::Now() < deadline) {
+      // Throttled by the source; back off and retry.
+      const int64_t delay_ms = std::min<int64_t>(
+          (1LL << std::min(attempt++, 10)) + rand() % 50,
+          (deadline - MonoTime::Now()).ToMilliseconds());
+      SleepFor(MonoDelta::FromMilliseconds(std::max<int64_t>(delay_ms, 1)));
+      continue;
+    }
+    RETURN_NOT_OK_PREPEND(
+        s,
+        Substitute(
+            "could not fetch segment $0 of $1 from $2 at offset $3",
+            seqno,
+            tablet_id,
+            source.ToString(),
+            offset));
+    attempt = 0;
+
+    Slice chunk;
+    RETURN_NOT_OK(
+        controller.GetInboundSidecar(resp.data_sidecar_idx(), &chunk));
+    if (crc::Crc32c(chunk.data(), chunk.size()) != resp.data_crc32c()) {
+      return Status::Corruption(Substitute(
+          "bad CRC of the chunk of segment $0 of $1 at offset $2 from $3",
+          seqno,
+          tablet_id,
+          offset,
+          source.ToString()));
+    }
+    const uint64_t segment_size = resp.segment_size();
+    if (offset + chunk.size() > segment_size ||
+        (chunk.empty() && offset < segment_size)) {
+      return Status::Corruption(Substitute(
+          "chunk of $0 bytes at offset $1 doesn't fit segment $2 of $3 bytes",
+          chunk.size(),
+          offset,
+          seqno,
+          segment_size));
+    }
+    RETURN_NOT_OK(file->Write(offset, chunk));
+    offset += chunk.size();
+    if (offset == segment_size) {
+      break;
+    }
+  }
+  RETURN_NOT_OK(file->Sync());
+  return file->Close();
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -25,6 +25,7 @@
 
 #include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -35,17 +36,21 @@
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus.proxy.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/peer_ids.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/net/net_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 DECLARE_bool(raft_enforce_rpc_token);
 
 namespace kudu {
+class Env;
+class MonoDelta;
 class ThreadPoolToken;
 
 namespace rpc {
@@ -93,7 +98,7 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // Synchronously starts a leader election on this peer.
   // This method is ad hoc, using this instance's PeerProxy to send the
   // StartElection request.
-  // The StartElection RPC does not count as the single outstanding request
+  // The StartElection RPC does not count as one of the outstanding requests
   // that this class tracks.
   Status StartElection(
       RunLeaderElectionResponsePB* resp,
@@ -103,10 +108,6 @@ class Peer : public std::enable_shared_from_this<Peer> {
     return peer_pb_;
   }
 
-  void SetUpdateConsensusRpcStart(MonoTime starttime) {
-    rpc_start_ = starttime;
-  }
-
   // Stop sending requests and periodic heartbeats.
   //
   // This does not block waiting on any current outstanding requests to finish.
@@ -148,6 +149,45 @@ class Peer : public std::enable_shared_from_this<Peer> {
       std::shared_ptr<PeerProxy> proxy,
       std::shared_ptr<rpc::Messenger> messenger);
 
+  // An UpdateConsensus request to the peer, and everything it needs while it
+  // is in flight. Up to --raft_max_inflight_requests_per_peer of these are in
+  // flight at once.
+  struct InflightRequest {
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+
+    // Reference-counted pointers to the ReplicateMsgs in 'request'. We may
+    // have loaded these messages from the LogCache, in which case we are
+    // potentially sharing the same object as other peers. Since the PB
+    // request itself can't hold reference counts, this holds them.
+    std::vector<ReplicateRefPtr> replicate_msg_refs;
+
+    // With --raft_share_op_batches, a batch of ops shared with other peers'
+    // requests, which holds the ops in 'request' in place of
+    // 'replicate_msg_refs'.
+    std::shared_ptr<const std::vector<ReplicateRefPtr>> replicate_batch;
+
+    rpc::RpcController controller;
+
+    // The encoded ops in the sidecar of 'controller', if any.
+    std::shared_ptr<const std::string> ops_sidecar;
+
+    // The queue's sequence number for the request.
+    int64_t seq = -1;
+
+    // When the RPC was sent.
+    MonoTime rpc_start = MonoTime::Min();
+
+    // The payload bytes of the ops in 'request', if they were counted.
+    int64_t ops_bytes = 0;
+
+    // Set if 'request' is a heartbeat sent as 'heartbeat_request' instead
+    // (see --raft_compact_heartbeats).
+    bool compact_heartbeat = false;
+    HeartbeatRequestPB heartbeat_request;
+    HeartbeatResponsePB heartbeat_response;
+  };
+
   void SendNextRequest(
       bool even_if_queue_empty,
       bool from_heartbeater = false,
@@ -158,11 +198,30 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // This method is called from the reactor thread and calls
   // DoProcessResponse() on raft_pool_token_ to do any work that requires IO or
   // lock-taking.
-  void ProcessResponse();
+  void ProcessResponse(InflightRequest* req);
+
+  // Like ProcessResponse(), for a compact heartbeat. Fills 'req->response'
+  // from 'req->heartbeat_response', or resends 'req->request' as an
+  // UpdateConsensus if the peer didn't handle the heartbeat.
+  void ProcessHeartbeatResponse(InflightRequest* req);
 
   // Run on 'raft_pool_token'. Does response handling that requires IO or may
   // block.
-  void DoProcessResponse();
+  void DoProcessResponse(InflightRequest* req);
+
+  // Replaces the ops in 'req' with a shared sidecar holding their encoding
+  // (see --raft_send_ops_in_sidecar). Leaves 'req' alone if the sidecar
+  // can't be attached.
+  void MoveOpsToSidecar(InflightRequest* req);
+
+  // Sends the largest write payloads in 'req' as sidecars pointing into the
+  // log cache (see --raft_send_payloads_in_sidecars). Each op whose payload
+  // moves is replaced by a payload-less copy owned by 'req'.
+  void MovePayloadsToSidecars(InflightRequest* req);
+
+  // Returns 'req' to 'idle_requests_' once its RPC is done with. Requires
+  // peer_lock_.
+  void ReleaseRequestUnlocked(InflightRequest* req);
 
 #ifndef FB_DO_NOT_REMOVE
   // Fetch the desired tablet copy request from the queue and set up
@@ -177,7 +236,11 @@ class Peer : public std::enable_shared_from_this<Peer> {
 #endif
 
   // Signals there was an error sending the request to the peer.
-  void ProcessResponseError(const Status& status);
+  void ProcessResponseError(InflightRequest* req, const Status& status);
+
+  // Signals another request once the catch-up throttle has refilled, unless
+  // that's already scheduled.
+  void ScheduleThrottledRetryUnlocked();
 
   // Has FLAGS_proxy_batch_duration_ms passed since the last request was sent?
   // Only relavant for proxied peers
@@ -195,6 +258,9 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
   RaftPeerPB peer_pb_;
 
+  // The interned id of the peer's UUID, by which the queue finds it.
+  const PeerId peer_id_;
+
   std::shared_ptr<PeerProxy> proxy_;
 
   PeerMessageQueue* queue_;
@@ -204,24 +270,35 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // Time when the last request was sent
   MonoTime last_request_time_;
 
-  // The latest consensus update request and response.
-  ConsensusRequestPB request_;
-  ConsensusResponsePB response_;
+  // All the consensus update requests, of which those in 'idle_requests_'
+  // are not in flight. Both are protected by peer_lock_.
+  const int max_inflight_requests_;
+  std::vector<std::unique_ptr<InflightRequest>> requests_;
+  std::vector<InflightRequest*> idle_requests_;
+
+  // The committed index sent in the last request built.
+  int64_t last_sent_committed_index_;
+
+  // Whether the last request sent told the peer that heartbeats may pause
+  // (see --raft_quiescent_heartbeat_periods), and how many heartbeats have
+  // been skipped since.
+  bool last_request_quiescent_ = false;
+  int32_t quiescent_heartbeats_skipped_ = 0;
+
+  // Whether a retry is pending after the catch-up throttle held back ops.
+  bool throttled_retry_scheduled_ = false;
+
+  // Whether the peer answered the last request, which carried no ops, so
+  // that it can handle the next heartbeat as a compact one.
+  bool compact_heartbeats_armed_ = false;
 
 #ifdef FB_DO_NOT_REMOVE
   // The latest tablet copy request and response.
   StartTabletCopyRequestPB tc_request_;
   StartTabletCopyResponsePB tc_response_;
+  rpc::RpcController tc_controller_;
 #endif
 
-  // Reference-counted pointers to any ReplicateMsgs which are in-flight to the
-  // peer. We may have loaded these messages from the LogCache, in which case we
-  // are potentially sharing the same object as other peers. Since the PB
-  // request_ itself can't hold reference counts, this holds them.
-  std::vector<ReplicateRefPtr> replicate_msg_refs_;
-
-  rpc::RpcController controller_;
-
   std::shared_ptr<rpc::Messenger> messenger_;
 
   // Thread pool token used to construct requests to this peer.
@@ -234,15 +311,15 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
   // lock that protects Peer state changes, initialization, etc.
   mutable simple_spinlock peer_lock_;
-  std::atomic<bool> request_pending_;
+  // The number of requests in flight. Set to max_inflight_requests_ while a
+  // tablet copy request is.
+  std::atomic<int> num_inflight_requests_;
   bool closed_ = false;
   bool has_sent_first_request_ = false;
   // Cached state of whether this peer is proxied thru another peer. This info
   // can be stale, consult the PeerMessageQueue to get the upto date info
   // -1 means we've not inited the variable, 0 means false, 1 means true
   std::atomic<int> cached_is_peer_proxied_{-1};
-  // Leader Leases: captures UpdateConsensus rpc start time for each peer
-  MonoTime rpc_start_;
 };
 
 // A proxy to another peer. Usually a thin wrapper around an rpc proxy but can
@@ -258,6 +335,31 @@ class PeerProxy {
       rpc::RpcController* controller,
       const rpc::ResponseCallback& callback) = 0;
 
+  // Like UpdateAsync(), for a request whose ops have been moved into the
+  // 'controller' sidecar at 'request->ops_sidecar_idx()', encoded as 'ops'.
+  // Proxies that bundle requests may send 'ops' once for all the requests
+  // that carry it.
+  virtual void UpdateAsyncWithOpsSidecar(
+      const ConsensusRequestPB* request,
+      const std::shared_ptr<const std::string>& ops,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) {
+    UpdateAsync(request, response, controller, callback);
+  }
+
+  // Sends a compact heartbeat to a remote peer. A proxy that can't leaves
+  // 'response->handled()' false, for the caller to send an UpdateConsensus
+  // instead.
+  virtual void HeartbeatAsync(
+      const HeartbeatRequestPB* /*request*/,
+      HeartbeatResponsePB* response,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& callback) {
+    response->set_handled(false);
+    callback();
+  }
+
   // Sends a RequestConsensusVote to a remote peer.
   virtual void RequestConsensusVoteAsync(
       const VoteRequestPB* request,
@@ -270,6 +372,15 @@ class PeerProxy {
       RunLeaderElectionResponsePB* response,
       rpc::RpcController* controller) = 0;
 
+  // Asks the leader for a read index.
+  virtual void ReadIndexAsync(
+      const ReadIndexRequestPB* /*request*/,
+      ReadIndexResponsePB* /*response*/,
+      rpc::RpcController* /*controller*/,
+      const rpc::ResponseCallback& /*callback*/) {
+    LOG(DFATAL) << "Not implemented";
+  }
+
 #ifdef FB_DO_NOT_REMOVE
   // Instructs a peer to begin a tablet copy session.
   virtual void StartTabletCopyAsync(
@@ -319,12 +430,75 @@ class PeerProxyPool {
 };
 
 // PeerProxy implementation that does RPC calls
+// Bundles UpdateConsensus requests that the tablets on this server send to
+// the same destination into MultiUpdateConsensus RPCs (see
+// --raft_coalesce_updates). One is shared by every RpcPeerProxy to a host.
+class UpdateCoalescer : public std::enable_shared_from_this<UpdateCoalescer> {
+ public:
+  // Returns the coalescer for 'hostport' on 'messenger', creating it with
+  // 'proxy' if there is none yet.
+  static std::shared_ptr<UpdateCoalescer> ForHost(
+      const std::shared_ptr<rpc::Messenger>& messenger,
+      const HostPort& hostport,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+
+  // Whether 'request' may be bundled: it has no sidecars, needs no
+  // proxying, and is a heartbeat or no larger than
+  // --raft_coalesce_max_request_bytes.
+  static bool CanCoalesce(const ConsensusRequestPB& request);
+
+  // Whether the proxied 'request', whose ops are in a sidecar, may be bundled
+  // with the other requests to the same proxy that carry the same ops (see
+  // --raft_coalesce_proxied_updates).
+  static bool CanCoalesceWithOps(const ConsensusRequestPB& request);
+
+  // Sends 'request' with the next bundle, and runs 'callback' once
+  // 'response' is filled in. A failure of the bundle's RPC is reported as a
+  // server error in 'response'. 'request' and 'response' must stay valid
+  // until then. If 'ops' is set, it's sent as the ops sidecar of 'request',
+  // once for all the requests in the bundle that share it.
+  void UpdateAsync(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::ResponseCallback callback,
+      std::shared_ptr<const std::string> ops = nullptr);
+
+ private:
+  struct PendingUpdate {
+    const ConsensusRequestPB* request;
+    ConsensusResponsePB* response;
+    rpc::ResponseCallback callback;
+    std::shared_ptr<const std::string> ops;
+  };
+
+  UpdateCoalescer(
+      std::weak_ptr<rpc::Messenger> messenger,
+      std::shared_ptr<ConsensusServiceProxy> proxy);
+
+  // Sends everything in 'pending_' as one RPC.
+  void Flush();
+
+  // Sends 'updates' as one RPC.
+  void Send(std::vector<PendingUpdate> updates);
+
+  const std::weak_ptr<rpc::Messenger> messenger_;
+  const std::shared_ptr<ConsensusServiceProxy> proxy_;
+
+  simple_spinlock lock_;
+  std::vector<PendingUpdate> pending_;
+  // The number of distinct ops sidecars in 'pending_'.
+  int pending_sidecars_ = 0;
+  bool flush_scheduled_ = false;
+};
+
 class RpcPeerProxy : public PeerProxy {
  public:
+  // If 'coalescer' is set, requests it accepts are bundled through it.
   RpcPeerProxy(
       std::unique_ptr<HostPort> hostport,
       std::shared_ptr<ConsensusServiceProxy> consensus_proxy,
-      scoped_refptr<Counter> num_rpc_token_mismatches);
+      scoped_refptr<Counter> num_rpc_token_mismatches,
+      std::shared_ptr<UpdateCoalescer> coalescer = nullptr);
 
   void UpdateAsync(
       const ConsensusRequestPB* request,
@@ -332,6 +506,19 @@ class RpcPeerProxy : public PeerProxy {
       rpc::RpcController* controller,
       const rpc::ResponseCallback& callback) override;
 
+  void UpdateAsyncWithOpsSidecar(
+      const ConsensusRequestPB* request,
+      const std::shared_ptr<const std::string>& ops,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override;
+
+  void HeartbeatAsync(
+      const HeartbeatRequestPB* request,
+      HeartbeatResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override;
+
   void RequestConsensusVoteAsync(
       const VoteRequestPB* request,
       VoteResponsePB* response,
@@ -343,6 +530,12 @@ class RpcPeerProxy : public PeerProxy {
       RunLeaderElectionResponsePB* response,
       rpc::RpcController* controller) override;
 
+  void ReadIndexAsync(
+      const ReadIndexRequestPB* request,
+      ReadIndexResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) override;
+
 #ifdef FB_DO_NOT_REMOVE
   void StartTabletCopyAsync(
       const StartTabletCopyRequestPB* request,
@@ -354,10 +547,19 @@ class RpcPeerProxy : public PeerProxy {
   std::string PeerName() const override;
 
  private:
+  // Wraps 'callback' to check the response's raft RPC token first.
+  rpc::ResponseCallback CheckTokenThen(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcController* controller,
+      const rpc::ResponseCallback& callback) const;
+
   std::unique_ptr<HostPort> hostport_;
   std::shared_ptr<ConsensusServiceProxy> consensus_proxy_;
 
   scoped_refptr<Counter> num_rpc_token_mismatches_;
+
+  std::shared_ptr<UpdateCoalescer> coalescer_;
 };
 
 // PeerProxyFactory implementation that generates RPCPeerProxies
@@ -389,5 +591,32 @@ Status SetPermanentUuidForRemotePeer(
     const std::shared_ptr<rpc::Messenger>& messenger,
     RaftPeerPB* remote_peer);
 
+// Returns a copy of 'op' without the payload of its write payload, which is
+// sent instead as the RPC sidecar with index 'sidecar_idx' (see
+// --raft_send_payloads_in_sidecars).
+ReplicateRefPtr MakePayloadSidecarStub(const ReplicateMsg& op, int sidecar_idx);
+
+// The receiving end of MakePayloadSidecarStub(): restores the payloads of the
+// ops of 'req' which were sent as sidecars, reading sidecar 'idx' with
+// 'get_sidecar'.
+Status MergePayloadSidecars(
+    ConsensusRequestPB* req,
+    const std::function<Status(int idx, Slice* data)>& get_sidecar);
+
+// Copies the closed WAL segment 'seqno' of ring 'tablet_id' from the server
+// at 'source', which may be any replica of the ring, to 'dest_path', chunk by
+// chunk. Each chunk's CRC is checked. If 'dest_path' already holds the start
+// of the segment, e.g. from an interrupted copy, the copy resumes after it.
+// Chunks the source throttles are retried with backoff until 'timeout' has
+// passed since the start.
+Status FetchLogSegment(
+    const std::shared_ptr<rpc::Messenger>& messenger,
+    const HostPort& source,
+    const std::string& tablet_id,
+    int64_t seqno,
+    Env* env,
+    const std::string& dest_path,
+    const MonoDelta& timeout);
+
 } // namespace consensus
 } // namespace kudu
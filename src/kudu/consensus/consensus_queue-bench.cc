@@ -0,0 +1,315 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measures how the leader's PeerMessageQueue and LogCache scale with the
+// number of followers: one thread appends ops with AppendOperations() while
+// a thread per simulated follower loops over RequestForPeer() and
+// ResponseFromPeer(), acknowledging whatever it was sent at once. Reports
+// the ops appended and committed per second, the requests served per
+// second, and the time spent waiting for the queue lock, for each number of
+// followers, with and without --buffer_messages_between_rpcs.
+//
+// Example:
+//   consensus_queue-bench --consensus_queue_bench_followers=2,8,32 \
+//       --consensus_queue_bench_payload_bytes=4096
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/hybrid_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus_queue.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/routing.h"
+#include "kudu/consensus/time_manager.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_string(
+    consensus_queue_bench_followers,
+    "2,4,8,16,32",
+    "Comma-separated numbers of simulated followers to run with.");
+DEFINE_int32(
+    consensus_queue_bench_batch_size,
+    8,
+    "Number of ops appended by each AppendOperations() call.");
+DEFINE_int32(
+    consensus_queue_bench_payload_bytes,
+    256,
+    "Size of the payload of each op.");
+DEFINE_int32(
+    consensus_queue_bench_duration_ms,
+    1000,
+    "How long each number of followers runs for.");
+
+DECLARE_bool(buffer_messages_between_rpcs);
+DECLARE_bool(lock_profiling);
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_histogram(consensus_queue_lock_wait_time);
+
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+constexpr char kBenchTablet[] = "queue-bench-tablet";
+constexpr char kLeaderUuid[] = "peer-0";
+constexpr int64_t kTerm = 1;
+
+} // anonymous namespace
+
+class ConsensusQueueBench : public KuduTest,
+                            public testing::WithParamInterface<bool> {
+ protected:
+  // Runs a leader's queue with 'num_followers' simulated followers for
+  // --consensus_queue_bench_duration_ms, and logs the results.
+  void RunBench(int num_followers) {
+    const string name = Substitute(
+        "followers=$0 buffer_messages_between_rpcs=$1",
+        num_followers,
+        FLAGS_buffer_messages_between_rpcs);
+    FsManager fs_manager(
+        env_, GetTestPath(Substitute("fs_root-$0", num_followers)));
+    ASSERT_OK(fs_manager.CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager.Open());
+    MetricRegistry registry;
+    scoped_refptr<MetricEntity> entity = METRIC_ENTITY_server.Instantiate(
+        &registry, Substitute("queue-bench-$0", num_followers));
+    scoped_refptr<log::Log> log;
+    ASSERT_OK(log::Log::Open(
+        log::LogOptions(), &fs_manager, kBenchTablet, nullptr, &log));
+
+    shared_ptr<DurableRoutingTable> routing_table;
+    ASSERT_OK(DurableRoutingTable::Create(
+        &fs_manager, kBenchTablet, {}, {}, &routing_table));
+    const RaftConfigPB config = BuildRaftConfigPBForTests(num_followers + 1);
+    auto routing_table_container = std::make_shared<RoutingTableContainer>(
+        ProxyPolicy::DISABLE_PROXY,
+        FakeRaftPeerPB(kLeaderUuid),
+        config,
+        routing_table);
+    scoped_refptr<clock::Clock> clock(new clock::HybridClock());
+    ASSERT_OK(clock->Init());
+    scoped_refptr<TimeManager> time_manager(
+        new TimeManager(clock, Timestamp::kMin));
+    scoped_refptr<PersistentVarsManager> persistent_vars_manager(
+        new PersistentVarsManager(&fs_manager));
+    unique_ptr<ThreadPool> raft_pool;
+    ASSERT_OK(ThreadPoolBuilder("raft").Build(&raft_pool));
+
+    unique_ptr<PeerMessageQueue> queue(new PeerMessageQueue(
+        entity,
+        log,
+        time_manager,
+        persistent_vars_manager,
+        FakeRaftPeerPB(kLeaderUuid),
+        routing_table_container,
+        kBenchTablet,
+        raft_pool->NewToken(ThreadPool::ExecutionMode::SERIAL),
+        MinimumOpId(),
+        MinimumOpId()));
+    queue->SetLeaderMode(kMinimumOpIdIndex, kTerm, config);
+    for (int i = 1; i <= num_followers; i++) {
+      queue->TrackPeer(config.peers(i));
+    }
+
+    atomic<bool> stop(false);
+    atomic<int64_t> num_requests(0);
+    atomic<bool> failed(false);
+    const MonoTime start = MonoTime::Now();
+
+    // The leader, appending as fast as the queue takes ops.
+    int64_t num_appended = 0;
+    thread appender([&]() {
+      int64_t index = 1;
+      while (!stop) {
+        vector<ReplicateRefPtr> msgs;
+        for (int i = 0; i < FLAGS_consensus_queue_bench_batch_size; i++) {
+          msgs.push_back(make_scoped_refptr_replicate(
+              CreateDummyReplicate(
+                  kTerm,
+                  index++,
+                  clock->Now(),
+                  FLAGS_consensus_queue_bench_payload_bytes)
+                  .release()));
+        }
+        Status s =
+            queue->AppendOperations(msgs, Bind(&DoNothingStatusCB));
+        if (PREDICT_FALSE(!s.ok())) {
+          LOG(ERROR) << name << ": " << s.ToString();
+          failed = true;
+          return;
+        }
+        num_appended += msgs.size();
+      }
+    });
+
+    // The followers, each acknowledging everything it's sent.
+    vector<thread> followers;
+    for (int i = 1; i <= num_followers; i++) {
+      const string uuid = config.peers(i).permanent_uuid();
+      followers.emplace_back([&, uuid]() {
+        OpId last_received = MinimumOpId();
+        ConsensusRequestPB request;
+        ConsensusResponsePB response;
+        while (!stop) {
+          vector<ReplicateRefPtr> msg_refs;
+          bool needs_tablet_copy;
+          string next_hop_uuid;
+          Status s = queue->RequestForPeer(
+              uuid,
+              true,
+              &request,
+              &msg_refs,
+              &needs_tablet_copy,
+              &next_hop_uuid);
+          if (PREDICT_FALSE(!s.ok())) {
+            LOG(ERROR) << name << ": " << s.ToString();
+            failed = true;
+            return;
+          }
+          if (request.ops_size() > 0) {
+            last_received = request.ops(request.ops_size() - 1).id();
+          }
+          const bool idle = request.ops_size() == 0;
+          // The ops are still referenced by 'msg_refs'.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+          request.mutable_ops()->UnsafeArenaExtractSubrange(
+              0, request.ops_size(), nullptr);
+#else
+          request.mutable_ops()->ExtractSubrange(
+              0, request.ops_size(), nullptr);
+#endif
+          if (FLAGS_buffer_messages_between_rpcs) {
+            // What Peer does while its request is in flight.
+            queue->FillBufferForPeer(uuid);
+          }
+
+          response.Clear();
+          response.set_responder_uuid(uuid);
+          response.set_responder_term(request.caller_term());
+          ConsensusStatusPB* status = response.mutable_status();
+          *status->mutable_last_received() = last_received;
+          *status->mutable_last_received_current_leader() = last_received;
+          status->set_last_committed_idx(request.committed_index());
+          queue->ResponseFromPeer(uuid, response);
+          num_requests++;
+          if (idle) {
+            // Caught up; let the appender get ahead.
+            SleepFor(MonoDelta::FromMicroseconds(50));
+          }
+        }
+      });
+    }
+
+    SleepFor(
+        MonoDelta::FromMilliseconds(FLAGS_consensus_queue_bench_duration_ms));
+    stop = true;
+    appender.join();
+    for (auto& t : followers) {
+      t.join();
+    }
+    const double secs = (MonoTime::Now() - start).ToSeconds();
+    ASSERT_FALSE(failed);
+    const int64_t num_committed = queue->GetCommittedIndex();
+    ASSERT_OK(log->WaitUntilAllFlushed());
+    queue->Close();
+
+    unique_ptr<HdrHistogram> lock_wait =
+        METRIC_consensus_queue_lock_wait_time.Instantiate(entity)->Snapshot();
+    LOG(INFO) << StringPrintf(
+        "%s: %.0f ops appended/s, %.0f ops committed/s, %.0f requests/s, "
+        "queue lock wait %.1f ms total, p99 %" PRIu64 " us, max %" PRIu64
+        " us",
+        name.c_str(),
+        num_appended / secs,
+        num_committed / secs,
+        num_requests / secs,
+        lock_wait->TotalSum() / 1000.0,
+        lock_wait->ValueAtPercentile(99),
+        lock_wait->MaxValue());
+    const string key = Substitute("consensus_queue-bench[$0]", name);
+    RecordPerfResult(key + ".ops_committed_per_sec", num_committed / secs);
+    RecordPerfResult(key + ".requests_per_sec", num_requests / secs);
+    RecordPerfResult(
+        key + ".lock_wait_p99_us", lock_wait->ValueAtPercentile(99));
+  }
+};
+
+// With and without --buffer_messages_between_rpcs.
+INSTANTIATE_TEST_CASE_P(BufferMessages, ConsensusQueueBench, testing::Bool());
+
+TEST_P(ConsensusQueueBench, RunBench) {
+  FLAGS_buffer_messages_between_rpcs = GetParam();
+  // The queue only records its lock's wait times with lock profiling.
+  FLAGS_lock_profiling = true;
+
+  vector<int> num_followers;
+  const vector<string> values = strings::Split(
+      FLAGS_consensus_queue_bench_followers, ",", strings::SkipEmpty());
+  for (const string& value : values) {
+    int32_t v;
+    ASSERT_TRUE(safe_strto32(value, &v) && v > 0) << "Bad value: " << value;
+    num_followers.push_back(v);
+  }
+  for (int n : num_followers) {
+    NO_FATALS(RunBench(n));
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
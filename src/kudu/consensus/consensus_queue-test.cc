@@ -41,6 +41,7 @@
 #include "kudu/consensus/log-test-base.h"
 #endif
 #include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/compact_ops.h"
 #include "kudu/consensus/consensus-test-util.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_queue.h"
@@ -50,24 +51,41 @@
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/peer_ids.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/metrics.h"
 // METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 
 DECLARE_int32(consensus_max_batch_size_bytes);
 DECLARE_int32(follower_unavailable_considered_failed_sec);
+DECLARE_int32(raft_max_inflight_requests_per_peer);
+DECLARE_int64(raft_catchup_throttle_batches_per_sec);
+DECLARE_int64(raft_catchup_throttle_min_lag_ops);
+DECLARE_bool(raft_active_leadership_transfer);
+DECLARE_bool(raft_adaptive_batch_size);
+DECLARE_int32(raft_adaptive_batch_max_bytes);
+DECLARE_int32(raft_adaptive_batch_min_bytes);
+DECLARE_bool(raft_catchup_throttle_voters);
+DECLARE_bool(raft_ops_sidecar_compact_encoding);
+DECLARE_int32(raft_peer_health_evaluation_interval_ms);
+DECLARE_string(raft_ops_sidecar_compression_codec);
 
 using kudu::consensus::HealthReportPB;
 using std::atomic;
@@ -352,6 +370,197 @@ TEST_F(ConsensusQueueTest, TestStartTrackingAfterStart) {
 #endif
 }
 
+// Tests that with several requests in flight each one carries on after the
+// last, that overtaken responses are dropped, and that an LMP mismatch rewinds
+// the peer past the requests still in flight.
+TEST_F(ConsensusQueueTest, TestPipelinedRequests) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_max_inflight_requests_per_peer = 2;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+
+  ConsensusRequestPB page_size_estimator;
+  page_size_estimator.set_caller_term(14);
+  page_size_estimator.set_committed_index(0);
+  page_size_estimator.set_all_replicated_index(0);
+  page_size_estimator.set_last_idx_appended_to_leader(0);
+  page_size_estimator.mutable_preceding_id()->CopyFrom(MinimumOpId());
+  const int kOpsPerRequest = 10;
+  for (int i = 0; i < kOpsPerRequest; i++) {
+    page_size_estimator.mutable_ops()->AddAllocated(
+        CreateDummyReplicate(0, 0, clock_->Now(), 0).release());
+  }
+  FLAGS_consensus_max_batch_size_bytes = page_size_estimator.ByteSize();
+
+  ConsensusRequestPB requests[2];
+  vector<ReplicateRefPtr> refs[2];
+  int64_t seqs[2];
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(
+      &requests[0],
+      &response,
+      MinimumOpId(),
+      MinimumOpId(),
+      &send_more_immediately);
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
+
+  auto send_two = [&]() {
+    for (int i = 0; i < 2; i++) {
+      bool needs_tablet_copy;
+      std::string next_hop_uuid;
+      ASSERT_OK(queue_->RequestForPeer(
+          kPeerUuid,
+          /*read_ops=*/true,
+          &requests[i],
+          &refs[i],
+          &needs_tablet_copy,
+          &next_hop_uuid,
+          &seqs[i]));
+      ASSERT_EQ(kOpsPerRequest, requests[i].ops_size());
+    }
+  };
+
+  // The second request follows on from the first.
+  send_two();
+  ASSERT_EQ(1, requests[0].ops(0).id().index());
+  ASSERT_EQ(kOpsPerRequest + 1, requests[1].ops(0).id().index());
+
+  // The second response overtakes the first, which is then dropped.
+  SetLastReceivedAndLastCommitted(
+      &response, requests[1].ops(kOpsPerRequest - 1).id());
+  ASSERT_TRUE(queue_->ResponseFromPeer(kPeerUuid, response, seqs[1]));
+  SetLastReceivedAndLastCommitted(
+      &response, requests[0].ops(kOpsPerRequest - 1).id());
+  ASSERT_FALSE(queue_->ResponseFromPeer(kPeerUuid, response, seqs[0]));
+  ASSERT_EQ(
+      2 * kOpsPerRequest,
+      queue_->GetTrackedPeerForTests(kPeerUuid).last_received.index());
+
+  // An LMP mismatch on the first of the next two requests rewinds the peer
+  // to where it actually is, and the response to the second is dropped.
+  send_two();
+  ASSERT_EQ(2 * kOpsPerRequest + 1, requests[0].ops(0).id().index());
+  ASSERT_EQ(3 * kOpsPerRequest + 1, requests[1].ops(0).id().index());
+  RefuseWithLogPropertyMismatch(
+      &response, MakeOpId(2, 15), MakeOpId(2, 15));
+  ASSERT_TRUE(queue_->ResponseFromPeer(kPeerUuid, response, seqs[0]));
+  response.mutable_status()->Clear();
+  SetLastReceivedAndLastCommitted(
+      &response, requests[1].ops(kOpsPerRequest - 1).id());
+  ASSERT_FALSE(queue_->ResponseFromPeer(kPeerUuid, response, seqs[1]));
+
+  send_two();
+  ASSERT_EQ(16, requests[0].ops(0).id().index());
+  ASSERT_EQ(16 + kOpsPerRequest, requests[1].ops(0).id().index());
+
+  for (auto& request : requests) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops_size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  }
+}
+
+// Tests that peers are found by the interned ids of their UUIDs.
+TEST_F(ConsensusQueueTest, TestRequestsByPeerId) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MinimumOpId(),
+      MinimumOpId(),
+      &send_more_immediately);
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+
+  // Tracking the peer interned its UUID.
+  const PeerId peer_id = FindPeerId(kPeerUuid);
+  ASSERT_NE(kInvalidPeerId, peer_id);
+  ASSERT_EQ(peer_id, InternPeerUuid(kPeerUuid));
+  ASSERT_EQ(kPeerUuid, PeerUuid(peer_id));
+  ASSERT_EQ(kInvalidPeerId, FindPeerId("never-interned"));
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      peer_id,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_EQ(10, request.ops_size());
+  ASSERT_EQ(kPeerUuid, next_hop_uuid);
+  SetLastReceivedAndLastCommitted(&response, request.ops(9).id());
+  queue_->ResponseFromPeer(peer_id, response);
+  ASSERT_EQ(
+      10, queue_->GetTrackedPeerForTests(kPeerUuid).last_received.index());
+
+  // An id which is interned but not tracked isn't found.
+  Status s = queue_->RequestForPeer(
+      InternPeerUuid("not-tracked"),
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid);
+  ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// With --raft_peer_health_evaluation_interval_ms, requests leave the health
+// of peers to EvaluatePeerHealth().
+TEST_F(ConsensusQueueTest, TestPeerHealthEvaluatedInBackground) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_peer_health_evaluation_interval_ms = 1000;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(
+      &request,
+      &response,
+      MinimumOpId(),
+      MinimumOpId(),
+      &send_more_immediately);
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(
+      kPeerUuid,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid));
+  ASSERT_EQ(
+      HealthReportPB::UNKNOWN,
+      queue_->GetTrackedPeerForTests(kPeerUuid).last_overall_health_status);
+
+  queue_->EvaluatePeerHealth();
+  ASSERT_EQ(
+      HealthReportPB::HEALTHY,
+      queue_->GetTrackedPeerForTests(kPeerUuid).last_overall_health_status);
+}
+
 // Tests that the peers gets the messages pages, with the size of a page
 // being 'consensus_max_batch_size_bytes'
 TEST_F(ConsensusQueueTest, TestGetPagedMessages) {
@@ -623,6 +832,439 @@ TEST_F(ConsensusQueueTest, TestQueueAdvancesCommittedIndex) {
   ASSERT_EQ(queue_->GetAllReplicatedIndex(), 5);
 }
 
+// Any response granting the leader lease renews it, so that heartbeats alone
+// keep the lease of an idle leader alive.
+TEST_F(ConsensusQueueTest, TestLeaderLeaseRenewedByHeartbeats) {
+  FLAGS_enable_raft_leader_lease = true;
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  queue_->TrackPeer(MakePeer("peer-1", RaftPeerPB::VOTER));
+  queue_->TrackPeer(MakePeer("peer-2", RaftPeerPB::VOTER));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 5);
+  WaitForLocalPeerToAckIndex(5);
+  ASSERT_EQ(queue_->GetLeaderLeaseUntil(), MonoTime::Min());
+
+  ConsensusResponsePB response;
+  response.set_responder_term(0);
+  response.set_responder_uuid("peer-1");
+  response.set_lease_granted(true);
+  SetLastReceivedAndLastCommitted(
+      &response, MakeOpId(0, 5), MinimumOpId().index());
+
+  // The ack that commits the ops takes the lease.
+  const MonoTime first_start = MonoTime::Now();
+  queue_->SetPeerRpcStartTime("peer-1", first_start);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(queue_->GetCommittedIndex(), 5);
+  ASSERT_EQ(
+      queue_->GetLeaderLeaseUntil(),
+      first_start + PeerMessageQueue::LeaderLeaseTimeout());
+
+  // A heartbeat, which commits nothing, extends it.
+  const MonoTime second_start = first_start + MonoDelta::FromMilliseconds(100);
+  queue_->SetPeerRpcStartTime("peer-1", second_start);
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(0, 5));
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(queue_->GetCommittedIndex(), 5);
+  ASSERT_EQ(
+      queue_->GetLeaderLeaseUntil(),
+      second_start + PeerMessageQueue::LeaderLeaseTimeout());
+
+  // A request the peer didn't grant the lease on doesn't count, even though
+  // it moves the peer's rpc start time forward.
+  queue_->SetPeerRpcStartTime(
+      "peer-1", second_start + MonoDelta::FromMilliseconds(100));
+  response.set_lease_granted(false);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(
+      queue_->GetLeaderLeaseUntil(),
+      second_start + PeerMessageQueue::LeaderLeaseTimeout());
+}
+
+// A response that doesn't change its peer's last-received index skips the
+// watermark computation. Untracking a lagging peer must still let the next
+// such response advance the all-replicated index.
+TEST_F(ConsensusQueueTest, TestWatermarksRecomputedAfterPeerSetChange) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  queue_->TrackPeer(MakePeer("peer-1", RaftPeerPB::VOTER));
+  queue_->TrackPeer(MakePeer("peer-2", RaftPeerPB::VOTER));
+
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  ConsensusResponsePB response;
+  response.set_responder_term(1);
+  response.set_responder_uuid("peer-1");
+  SetLastReceivedAndLastCommitted(
+      &response, MakeOpId(1, 10), MinimumOpId().index());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+
+  response.set_responder_uuid("peer-2");
+  SetLastReceivedAndLastCommitted(
+      &response, MakeOpId(0, 5), MinimumOpId().index());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(5, queue_->GetAllReplicatedIndex());
+
+  // Repeating peer-1's response changes nothing.
+  response.set_responder_uuid("peer-1");
+  SetLastReceivedAndLastCommitted(
+      &response, MakeOpId(1, 10), MinimumOpId().index());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(5, queue_->GetAllReplicatedIndex());
+
+  // Without the lagging peer, the same response completes replication.
+  queue_->UntrackPeer("peer-2");
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(10, queue_->GetAllReplicatedIndex());
+  ASSERT_EQ(10, queue_->GetCommittedIndex());
+}
+
+// A peer is caught up only once it has acked the last op and learned of the
+// latest committed index.
+TEST_F(ConsensusQueueTest, TestIsPeerCaughtUp) {
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  queue_->TrackPeer(MakePeer("peer-1", RaftPeerPB::VOTER));
+  ASSERT_FALSE(queue_->IsPeerCaughtUp("peer-1"));
+  ASSERT_FALSE(queue_->IsPeerCaughtUp("no-such-peer"));
+
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+
+  ConsensusResponsePB response;
+  response.set_responder_term(1);
+  response.set_responder_uuid("peer-1");
+  SetLastReceivedAndLastCommitted(
+      &response, MakeOpId(1, 10), MinimumOpId().index());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(10, queue_->GetCommittedIndex());
+  ASSERT_FALSE(queue_->IsPeerCaughtUp("peer-1"));
+
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(1, 10), 10);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_TRUE(queue_->IsPeerCaughtUp("peer-1"));
+
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 11, 1);
+  ASSERT_FALSE(queue_->IsPeerCaughtUp("peer-1"));
+}
+
+// A lagging non-voter gets no more batches than the catch-up throttle allows,
+// while voters are left alone.
+TEST_F(ConsensusQueueTest, TestCatchupThrottle) {
+  FLAGS_raft_catchup_throttle_batches_per_sec = 10;
+  FLAGS_raft_catchup_throttle_min_lag_ops = 10;
+  const auto kOtherVoterPeer = "peer-1";
+  const auto kNonVoterPeer = "non-voter-peer-0";
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex,
+      kMinimumTerm,
+      BuildRaftConfigPBForTests(/*num_voters=*/2, /*num_non_voters=*/1));
+  queue_->TrackPeer(MakePeer(kOtherVoterPeer, RaftPeerPB::VOTER));
+  queue_->TrackPeer(MakePeer(kNonVoterPeer, RaftPeerPB::NON_VOTER));
+
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
+  WaitForLocalPeerToAckIndex(100);
+
+  ConsensusResponsePB response;
+  response.set_responder_term(1);
+  response.set_responder_uuid(kOtherVoterPeer);
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(1, 100), 0);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(100, queue_->GetCommittedIndex());
+
+  ConsensusRequestPB request;
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  int64_t seq;
+  bool throttled;
+  ASSERT_OK(queue_->RequestForPeer(
+      kNonVoterPeer,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid,
+      &seq,
+      &throttled));
+  ASSERT_EQ(0, request.ops_size());
+
+  // The non-voter turns out to have none of the ops.
+  response.set_responder_uuid(kNonVoterPeer);
+  RefuseWithLogPropertyMismatch(&response, MinimumOpId(), MinimumOpId());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+
+  ASSERT_OK(queue_->RequestForPeer(
+      kNonVoterPeer,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid,
+      &seq,
+      &throttled));
+  ASSERT_FALSE(throttled);
+  ASSERT_GT(request.ops_size(), 0);
+
+  // The throttle allows one batch per tenth of a second.
+  ASSERT_OK(queue_->RequestForPeer(
+      kNonVoterPeer,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid,
+      &seq,
+      &throttled));
+  ASSERT_TRUE(throttled);
+  ASSERT_EQ(0, request.ops_size());
+
+  SleepFor(MonoDelta::FromMicroseconds(Throttler::kRefillPeriodMicros));
+  ASSERT_OK(queue_->RequestForPeer(
+      kNonVoterPeer,
+      /*read_ops=*/true,
+      &request,
+      &refs,
+      &needs_tablet_copy,
+      &next_hop_uuid,
+      &seq,
+      &throttled));
+  ASSERT_FALSE(throttled);
+  ASSERT_GT(request.ops_size(), 0);
+
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// The successor of an active leadership transfer gets the rest of the log as
+// fast as it takes it, ignoring the catch-up throttle, until the transfer ends.
+TEST_F(ConsensusQueueTest, TestActiveTransferSuccessorSkipsCatchupThrottle) {
+  FLAGS_raft_catchup_throttle_batches_per_sec = 10;
+  FLAGS_raft_catchup_throttle_min_lag_ops = 10;
+  FLAGS_raft_catchup_throttle_voters = true;
+  FLAGS_raft_active_leadership_transfer = true;
+  const auto kCaughtUpPeer = "peer-1";
+  const auto kSuccessorPeer = "peer-2";
+  queue_->SetLeaderMode(
+      kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  queue_->TrackPeer(MakePeer(kCaughtUpPeer, RaftPeerPB::VOTER));
+  queue_->TrackPeer(MakePeer(kSuccessorPeer, RaftPeerPB::VOTER));
+
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
+  WaitForLocalPeerToAckIndex(100);
+
+  ConsensusResponsePB response;
+  response.set_responder_term(1);
+  response.set_responder_uuid(kCaughtUpPeer);
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(1, 100), 0);
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(100, queue_->GetCommittedIndex());
+
+  // The successor turns out to have none of the ops.
+  response.set_responder_uuid(kSuccessorPeer);
+  RefuseWithLogPropertyMismatch(&response, MinimumOpId(), MinimumOpId());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+
+  ConsensusRequestPB request;
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  int64_t seq;
+  bool throttled;
+  auto request_for_successor = [&]() {
+    ASSERT_OK(queue_->RequestForPeer(
+        kSuccessorPeer,
+        /*read_ops=*/true,
+        &request,
+        &refs,
+        &needs_tablet_copy,
+        &next_hop_uuid,
+        &seq,
+        &throttled));
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops_size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  };
+
+  queue_->BeginWatchForSuccessor(
+      string(kSuccessorPeer),
+      /*filter_fn=*/nullptr,
+      PeerMessageQueue::TransferContext{});
+  for (int i = 0; i < 3; i++) {
+    NO_FATALS(request_for_successor());
+    ASSERT_FALSE(throttled);
+    ASSERT_EQ(kSuccessorPeer, next_hop_uuid);
+  }
+
+  // Once the transfer is over, the successor is just a lagging voter again.
+  queue_->EndWatchForSuccessor();
+  NO_FATALS(request_for_successor());
+  NO_FATALS(request_for_successor());
+  ASSERT_TRUE(throttled);
+}
+
+// A batch sent to several peers is encoded once, and the encoding parses back
+// into the same ops.
+TEST_F(ConsensusQueueTest, TestSerializedOpsSharedAcrossPeers) {
+  ConsensusRequestPB batch;
+  for (int i = 1; i <= 3; i++) {
+    ReplicateMsg* op = batch.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_timestamp(i);
+    op->set_op_type(NO_OP);
+  }
+
+  ConsensusRequestPB::OpsSidecarEncoding encoding;
+  CompressionType compression;
+  int64_t uncompressed_size;
+  std::shared_ptr<const std::string> bytes = queue_->GetSerializedOps(
+      batch.ops(), &encoding, &compression, &uncompressed_size);
+  ASSERT_EQ(
+      bytes,
+      queue_->GetSerializedOps(
+          batch.ops(), &encoding, &compression, &uncompressed_size));
+  ASSERT_EQ(ConsensusRequestPB::REQUEST_OPS_FIELDS, encoding);
+  ASSERT_EQ(NO_COMPRESSION, compression);
+  ASSERT_EQ(bytes->size(), uncompressed_size);
+
+  ConsensusRequestPB parsed;
+  ASSERT_TRUE(parsed.ParsePartialFromString(*bytes));
+  ASSERT_EQ(batch.ops_size(), parsed.ops_size());
+  for (int i = 0; i < batch.ops_size(); i++) {
+    ASSERT_EQ(
+        batch.ops(i).SerializeAsString(), parsed.ops(i).SerializeAsString());
+  }
+
+  // A different range of ops gets its own encoding.
+  batch.mutable_ops()->RemoveLast();
+  std::shared_ptr<const std::string> shorter = queue_->GetSerializedOps(
+      batch.ops(), &encoding, &compression, &uncompressed_size);
+  ASSERT_NE(bytes, shorter);
+  ASSERT_LT(shorter->size(), bytes->size());
+}
+
+// A batch of small write ops is compressed as a whole, and uncompresses back
+// into the same ops.
+TEST_F(ConsensusQueueTest, TestSerializedOpsCompressedAsBatch) {
+  FLAGS_raft_ops_sidecar_compression_codec = "LZ4";
+  ConsensusRequestPB batch;
+  for (int i = 1; i <= 100; i++) {
+    ReplicateMsg* op = batch.add_ops();
+    *op->mutable_id() = MakeOpId(1, i);
+    op->set_timestamp(i);
+    op->set_op_type(WRITE_OP_EXT);
+    op->mutable_write_payload()->set_payload(
+        strings::Substitute("{\"table\":\"users\",\"id\":$0}", i));
+  }
+
+  ConsensusRequestPB::OpsSidecarEncoding encoding;
+  CompressionType compression;
+  int64_t uncompressed_size;
+  std::shared_ptr<const std::string> bytes = queue_->GetSerializedOps(
+      batch.ops(), &encoding, &compression, &uncompressed_size);
+  ASSERT_EQ(LZ4, compression);
+  ASSERT_LT(bytes->size(), uncompressed_size);
+
+  std::shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(CompressionCodecManager::GetCodec(compression, &codec));
+  std::string uncompressed(uncompressed_size, '\0');
+  ASSERT_OK(codec->Uncompress(
+      Slice(*bytes),
+      reinterpret_cast<uint8_t*>(&uncompressed[0]),
+      uncompressed.size()));
+  ConsensusRequestPB parsed;
+  ASSERT_TRUE(parsed.ParsePartialFromString(uncompressed));
+  ASSERT_EQ(batch.ops_size(), parsed.ops_size());
+  for (int i = 0; i < batch.ops_size(); i++) {
+    ASSERT_EQ(
+        batch.ops(i).SerializeAsString(), parsed.ops(i).SerializeAsString());
+  }
+}
+
+// With --raft_ops_sidecar_compact_encoding, a batch is encoded compactly,
+// in less space than as 'ops' fields, and decodes back into the same ops.
+TEST_F(ConsensusQueueTest, TestSerializedOpsCompactEncoding) {
+  FLAGS_raft_ops_sidecar_compact_encoding = true;
+  ConsensusRequestPB batch;
+  for (int i = 1; i <= 20; i++) {
+    ReplicateMsg* op = batch.add_ops();
+    // The term changes mid-batch, and timestamps don't always increase.
+    *op->mutable_id() = MakeOpId(i <= 10 ? 1 : 3, i);
+    op->set_timestamp((100000 + i * 7919 % 13) << 12);
+    op->set_op_type(WRITE_OP_EXT);
+    op->mutable_write_payload()->set_payload(strings::Substitute("row-$0", i));
+  }
+  batch.mutable_ops(0)->set_op_type(NO_OP);
+  batch.mutable_ops(0)->clear_write_payload();
+
+  ConsensusRequestPB::OpsSidecarEncoding encoding;
+  CompressionType compression;
+  int64_t uncompressed_size;
+  std::shared_ptr<const std::string> bytes = queue_->GetSerializedOps(
+      batch.ops(), &encoding, &compression, &uncompressed_size);
+  ASSERT_EQ(ConsensusRequestPB::COMPACT_OPS, encoding);
+  ASSERT_EQ(NO_COMPRESSION, compression);
+  ASSERT_LT(bytes->size(), batch.ByteSizeLong());
+
+  ConsensusRequestPB decoded;
+  ASSERT_OK(DecodeCompactOps(Slice(*bytes), decoded.mutable_ops()));
+  ASSERT_EQ(batch.ops_size(), decoded.ops_size());
+  for (int i = 0; i < batch.ops_size(); i++) {
+    ASSERT_EQ(
+        batch.ops(i).SerializeAsString(), decoded.ops(i).SerializeAsString());
+  }
+
+  // A truncated batch is rejected, rather than decoded into fewer ops.
+  decoded.clear_ops();
+  Status s = DecodeCompactOps(
+      Slice(bytes->data(), bytes->size() - 1), decoded.mutable_ops());
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+
+  // Ops whose indexes go backwards can't be encoded compactly.
+  batch.mutable_ops()->SwapElements(18, 19);
+  bytes = queue_->GetSerializedOps(
+      batch.ops(), &encoding, &compression, &uncompressed_size);
+  ASSERT_EQ(ConsensusRequestPB::REQUEST_OPS_FIELDS, encoding);
+  ASSERT_EQ(batch.ByteSizeLong(), bytes->size());
+}
+
+// The watermark getters read lock-free copies of the queue state; make sure
+// those are republished whenever a follower learns new watermarks or a new
+// term starts.
+TEST_F(ConsensusQueueTest, TestWatermarkGettersFollowQueueState) {
+  // This adds messages 0.1 -> 0.7, 1.8 -> 1.10, so the current term starts at
+  // index 8.
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+  ASSERT_FALSE(queue_->IsCommittedIndexInCurrentTerm());
+
+  queue_->UpdateFollowerWatermarks(5, 3, 2);
+  ASSERT_EQ(5, queue_->GetCommittedIndex());
+  ASSERT_EQ(3, queue_->GetAllReplicatedIndex());
+  ASSERT_EQ(2, queue_->GetRegionDurableIndex());
+  ASSERT_FALSE(queue_->IsCommittedIndexInCurrentTerm());
+
+  // The region-durable index never moves backwards.
+  queue_->UpdateFollowerWatermarks(9, 7, 1);
+  ASSERT_EQ(9, queue_->GetCommittedIndex());
+  ASSERT_EQ(7, queue_->GetAllReplicatedIndex());
+  ASSERT_EQ(2, queue_->GetRegionDurableIndex());
+  ASSERT_TRUE(queue_->IsCommittedIndexInCurrentTerm());
+
+  // Becoming leader in a new term resets the start of the current term.
+  queue_->SetLeaderMode(9, 2, BuildRaftConfigPBForTests(3));
+  ASSERT_EQ(9, queue_->GetCommittedIndex());
+  ASSERT_FALSE(queue_->IsCommittedIndexInCurrentTerm());
+}
+
 // Ensure that the acks for a non-voter don't count toward the majority.
 TEST_F(ConsensusQueueTest, TestNonVoterAcksDontCountTowardMajority) {
   const auto kOtherVoterPeer = "peer-1";
@@ -1208,6 +1850,32 @@ TEST_F(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics) {
   ASSERT_EQ(5, queue_->metrics_.num_ops_behind_leader->value());
 }
 
+// With --raft_adaptive_batch_size, a peer's batches follow its
+// bandwidth-delay product, within bounds.
+TEST_F(ConsensusQueueTest, TestAdaptiveBatchSize) {
+  FLAGS_raft_max_inflight_requests_per_peer = 2;
+  PeerMessageQueue::TrackedPeer peer;
+  peer.rtt_us = 80 * 1000;
+  peer.delivery_rate_bytes_per_sec = 50 * 1024 * 1024;
+  EXPECT_EQ(FLAGS_consensus_max_batch_size_bytes, peer.MaxBatchBytes());
+
+  FLAGS_raft_adaptive_batch_size = true;
+  // Twice the 4MB bandwidth-delay product, over two requests in flight.
+  EXPECT_EQ(4 * 1024 * 1024, peer.MaxBatchBytes());
+
+  // A distant peer is capped...
+  peer.rtt_us = 800 * 1000;
+  EXPECT_EQ(FLAGS_raft_adaptive_batch_max_bytes, peer.MaxBatchBytes());
+
+  // ...and a nearby one gets the smallest batch.
+  peer.rtt_us = 200;
+  EXPECT_EQ(FLAGS_raft_adaptive_batch_min_bytes, peer.MaxBatchBytes());
+
+  // Until the rate is known, the global batch size applies.
+  peer.delivery_rate_bytes_per_sec = -1;
+  EXPECT_EQ(FLAGS_consensus_max_batch_size_bytes, peer.MaxBatchBytes());
+}
+
 // Unit test for the PeerMessageQueue::PeerHealthStatus() method.
 TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   static constexpr PeerStatus kPeerStatusesForUnknown[] = {
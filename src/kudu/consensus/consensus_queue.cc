@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -38,13 +39,19 @@
 #include <boost/optional/optional_io.hpp>
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/common/common.pb.h"
 #include "kudu/common/timestamp.h"
+#include "kudu/consensus/compact_ops.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/op_latency_tracker.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/peer_replication_stats.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/consensus/routing.h"
@@ -52,19 +59,25 @@
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/dynamic_annotations.h"
+#include "kudu/gutil/fixedarray.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/binary_log.h"
+#include "kudu/util/debug/trace_event.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 #include "kudu/util/url-coding.h"
 
 DEFINE_bool(
@@ -77,6 +90,44 @@ DEFINE_bool(
     "they're equivalent)");
 TAG_FLAG(buffer_messages_between_rpcs, advanced);
 
+DEFINE_int32(
+    raft_max_inflight_requests_per_peer,
+    1,
+    "Maximum number of UpdateConsensus requests the leader keeps in flight to "
+    "each peer. With more than one, the requests after the first are sent "
+    "optimistically, assuming the earlier ones will succeed, which lets a "
+    "distant peer receive more than one batch per round trip. Ignored if "
+    "--buffer_messages_between_rpcs is set.");
+TAG_FLAG(raft_max_inflight_requests_per_peer, experimental);
+
+DEFINE_bool(
+    raft_adaptive_batch_size,
+    false,
+    "Whether the leader sizes each peer's batches from the peer's "
+    "bandwidth-delay product, estimated from the round-trip time and the "
+    "rate at which ops are delivered to it, instead of using "
+    "--consensus_max_batch_size_bytes for every peer. A batch is twice the "
+    "bandwidth-delay product divided among the requests in flight (see "
+    "--raft_max_inflight_requests_per_peer), so that the rate can double "
+    "every round trip until the network or the write rate limits it. Has no "
+    "effect with --buffer_messages_between_rpcs.");
+TAG_FLAG(raft_adaptive_batch_size, runtime);
+TAG_FLAG(raft_adaptive_batch_size, experimental);
+
+DEFINE_int32(
+    raft_adaptive_batch_min_bytes,
+    64 * 1024,
+    "The smallest batch --raft_adaptive_batch_size sends a peer.");
+TAG_FLAG(raft_adaptive_batch_min_bytes, runtime);
+TAG_FLAG(raft_adaptive_batch_min_bytes, experimental);
+
+DEFINE_int32(
+    raft_adaptive_batch_max_bytes,
+    8 * 1024 * 1024,
+    "The largest batch --raft_adaptive_batch_size sends a peer.");
+TAG_FLAG(raft_adaptive_batch_max_bytes, runtime);
+TAG_FLAG(raft_adaptive_batch_max_bytes, experimental);
+
 DEFINE_int32(
     follower_unavailable_considered_failed_sec,
     300,
@@ -145,6 +196,15 @@ DEFINE_HANDLER(
     "After every request for peer, maintain the health status of the peer "
     " This can be used to evict an irrecovarable peer");
 
+DEFINE_int32(
+    raft_peer_health_evaluation_interval_ms,
+    0,
+    "If positive, and --update_peer_health_status is set, the leader "
+    "evaluates the health of its peers every this many milliseconds instead "
+    "of after every request and failed response. Requests then only take the "
+    "queue lock again when whether a peer can catch up from the WAL changes.");
+TAG_FLAG(raft_peer_health_evaluation_interval_ms, experimental);
+
 DEFINE_HANDLER(
     bool,
     async_local_vote_count,
@@ -156,8 +216,29 @@ DEFINE_bool(
     true,
     "Should the commit index notification be done async?");
 
+DEFINE_bool(
+    consensus_coalesce_observer_notifications,
+    false,
+    "Whether asynchronous commit index, term and peer health notifications "
+    "to the queue observers are coalesced, so that at most one of each is "
+    "pending at a time and it delivers the latest value when it runs.");
+TAG_FLAG(consensus_coalesce_observer_notifications, experimental);
+TAG_FLAG(consensus_coalesce_observer_notifications, runtime);
+
 TAG_FLAG(synchronous_transfer_leadership, advanced);
 
+DEFINE_bool(
+    raft_active_leadership_transfer,
+    false,
+    "When leadership is transferred to a designated successor, push the rest "
+    "of the log to it rather than waiting on its normal replication: it is "
+    "sent a request at once, exempt from the catch-up throttle and not "
+    "proxied, and then told to start an election as soon as it has the "
+    "leader's last op. Implies --synchronous_transfer_leadership for such "
+    "transfers.");
+TAG_FLAG(raft_active_leadership_transfer, experimental);
+TAG_FLAG(raft_active_leadership_transfer, runtime);
+
 DEFINE_bool(
     enable_flexi_raft,
     false,
@@ -205,6 +286,116 @@ DEFINE_int32(
     "the Window to be renewed for all updates until the Leader is active.");
 TAG_FLAG(bounded_dataloss_window_interval_ms, experimental);
 
+DEFINE_int32(
+    bounded_dataloss_window_renewal_interval_ms,
+    0,
+    "If positive, the leader renews the Bounded DataLoss window from any "
+    "successful response, heartbeats included, rather than only when the "
+    "commit index advances, and checks the quorum of ACKs at most once per "
+    "this many milliseconds after a renewal. Should be well below "
+    "--bounded_dataloss_window_interval_ms.");
+TAG_FLAG(bounded_dataloss_window_renewal_interval_ms, experimental);
+
+DEFINE_bool(
+    raft_proxy_relay_ops,
+    false,
+    "Whether requests routed through a proxy carry the full ops, for the "
+    "proxy to relay without decoding them (in a sidecar with "
+    "--raft_send_ops_in_sidecar), rather than PROXY_OP placeholders that the "
+    "proxy fills in from its own log. Costs bandwidth to the proxy, but "
+    "saves it a log read and a re-encode per hop. Only enable this once "
+    "every server supports relaying.");
+TAG_FLAG(raft_proxy_relay_ops, experimental);
+
+DEFINE_int64(
+    raft_catchup_throttle_bytes_per_sec,
+    0,
+    "Limits the rate at which the leader sends ops to each peer that lags more "
+    "than --raft_catchup_throttle_min_lag_ops behind the committed index, so "
+    "that rebuilding a replica doesn't starve the peers the quorum needs. "
+    "Every batch is charged --consensus_max_batch_size_bytes, as a lagging "
+    "peer gets full batches. Voters are only throttled with "
+    "--raft_catchup_throttle_voters. 0 disables the limit.");
+TAG_FLAG(raft_catchup_throttle_bytes_per_sec, runtime);
+TAG_FLAG(raft_catchup_throttle_bytes_per_sec, experimental);
+
+DEFINE_int64(
+    raft_catchup_throttle_batches_per_sec,
+    0,
+    "Limits the number of batches per second the leader sends to each "
+    "lagging peer; see --raft_catchup_throttle_bytes_per_sec. Values below "
+    "10 are treated as 10. 0 disables the limit.");
+TAG_FLAG(raft_catchup_throttle_batches_per_sec, runtime);
+TAG_FLAG(raft_catchup_throttle_batches_per_sec, experimental);
+
+DEFINE_int64(
+    raft_catchup_throttle_min_lag_ops,
+    1000,
+    "How many ops a peer must lag behind the committed index before the "
+    "catch-up throttle applies to it.");
+TAG_FLAG(raft_catchup_throttle_min_lag_ops, runtime);
+TAG_FLAG(raft_catchup_throttle_min_lag_ops, experimental);
+
+DEFINE_bool(
+    raft_catchup_throttle_voters,
+    false,
+    "Whether the catch-up throttle also applies to lagging voters, rather "
+    "than only to non-voters.");
+TAG_FLAG(raft_catchup_throttle_voters, runtime);
+TAG_FLAG(raft_catchup_throttle_voters, experimental);
+
+DEFINE_string(
+    raft_ops_sidecar_compression_codec,
+    "NO_COMPRESSION",
+    "Codec the leader compresses each ops sidecar (see "
+    "--raft_send_ops_in_sidecar) with as a single frame: LZ4, ZSTD, SNAPPY "
+    "or ZLIB. Compressing a batch as a whole helps workloads of small ops, "
+    "whose write payloads compress poorly one by one. Only enable this once "
+    "every replica of the tablet understands compressed sidecars.");
+TAG_FLAG(raft_ops_sidecar_compression_codec, runtime);
+TAG_FLAG(raft_ops_sidecar_compression_codec, experimental);
+
+DEFINE_int32(
+    raft_ops_sidecar_compression_min_bytes,
+    1024,
+    "Ops sidecars smaller than this are not compressed.");
+TAG_FLAG(raft_ops_sidecar_compression_min_bytes, runtime);
+TAG_FLAG(raft_ops_sidecar_compression_min_bytes, experimental);
+
+DEFINE_bool(
+    raft_ops_sidecar_compact_encoding,
+    false,
+    "Whether the leader encodes the ops of each ops sidecar (see "
+    "--raft_send_ops_in_sidecar) compactly, packing the OpId, timestamp and "
+    "op type of each op into a few bytes relative to the rest of the batch, "
+    "rather than as protobuf fields. Saves bandwidth and parsing for small "
+    "ops. Only enable this once every replica of the tablet understands "
+    "compact sidecars.");
+TAG_FLAG(raft_ops_sidecar_compact_encoding, runtime);
+TAG_FLAG(raft_ops_sidecar_compact_encoding, experimental);
+
+DEFINE_int32(
+    raft_snapshot_catchup_notify_interval_ms,
+    10000,
+    "How often, at most, the leader notifies RaftConsensus, and through it "
+    "the application's snapshot catch-up callback, that a peer needs ops "
+    "which were already GCed.");
+TAG_FLAG(raft_snapshot_catchup_notify_interval_ms, experimental);
+TAG_FLAG(raft_snapshot_catchup_notify_interval_ms, runtime);
+
+DEFINE_bool(
+    raft_share_op_batches,
+    false,
+    "Whether peers which ask for the same range of ops in step with each "
+    "other are handed a single batch shared between their requests, so that "
+    "each request holds one reference to the batch rather than one per op. "
+    "Has no effect with --buffer_messages_between_rpcs.");
+TAG_FLAG(raft_share_op_batches, runtime);
+TAG_FLAG(raft_share_op_batches, experimental);
+
+DECLARE_int32(raft_latency_routing_min_rebuild_interval_ms);
+DECLARE_bool(raft_lightweight_witness);
+
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
@@ -216,6 +407,41 @@ using strings::Substitute;
 namespace kudu {
 namespace consensus {
 
+METRIC_DEFINE_histogram(
+    server,
+    consensus_queue_lock_wait_time,
+    "Consensus Queue Lock Wait Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent waiting to acquire the consensus queue lock. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    consensus_queue_lock_hold_time,
+    "Consensus Queue Lock Hold Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the consensus queue lock was held for. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
+namespace {
+
+// Marks the traced ops durable, then runs 'callback'.
+void MarkLocalDurable(
+    const vector<std::shared_ptr<OpLatencyTrace>>& traces,
+    const StatusCallback& callback,
+    const Status& status) {
+  for (const auto& trace : traces) {
+    trace->Mark(OpStage::kLocalDurable);
+  }
+  callback.Run(status);
+}
+
+} // anonymous namespace
+
 METRIC_DEFINE_gauge_int64(
     server,
     majority_done_ops,
@@ -297,14 +523,17 @@ const char* PeerStatusToString(PeerStatus p) {
 PeerMessageQueue::TrackedPeer::TrackedPeer(
     RaftPeerPB peer_pb,
     const PeerMessageQueue* queue)
-    : peer_pb(std::move(peer_pb)),
-      next_index(kInvalidOpIdIndex),
+    : next_index(kInvalidOpIdIndex),
       last_received(MinimumOpId()),
       last_known_committed_index(MinimumOpId().index()),
       last_exchange_status(PeerStatus::NEW),
       lease_granted(MinimumOpId()),
       bounded_dataloss_window_acked(MinimumOpId()),
       rpc_start_(MonoTime::Min()),
+      peer_pb(std::move(peer_pb)),
+      peer_id(InternPeerUuid(this->peer_pb.permanent_uuid())),
+      lease_granted_rpc_start(MonoTime::Min()),
+      accepted_rpc_start(MonoTime::Min()),
       wal_catchup_possible(true),
       last_overall_health_status(HealthReportPB::UNKNOWN),
       status_log_throttler(std::make_shared<logging::LogThrottler>()),
@@ -409,6 +638,48 @@ std::string PeerMessageQueue::TrackedPeer::ToString() const {
       (MonoTime::Now() - last_communication_time).ToString());
 }
 
+int64_t PeerMessageQueue::TrackedPeer::MaxBatchBytes() const {
+  if (!FLAGS_raft_adaptive_batch_size || rtt_us < 0 ||
+      delivery_rate_bytes_per_sec < 0) {
+    return FLAGS_consensus_max_batch_size_bytes;
+  }
+  const int64_t bdp_bytes = static_cast<int64_t>(
+      static_cast<double>(delivery_rate_bytes_per_sec) * rtt_us /
+      MonoTime::kMicrosecondsPerSecond);
+  const int64_t in_flight =
+      std::max(1, FLAGS_raft_max_inflight_requests_per_peer);
+  const int64_t min_bytes = FLAGS_raft_adaptive_batch_min_bytes;
+  const int64_t max_bytes =
+      std::max<int64_t>(FLAGS_raft_adaptive_batch_max_bytes, min_bytes);
+  return std::min(std::max(2 * bdp_bytes / in_flight, min_bytes), max_bytes);
+}
+
+void PeerMessageQueue::PeerRequestState::CopyFrom(
+    const TrackedPeer& peer,
+    const std::string* peer_uuid) {
+  uuid = peer_uuid;
+  host = peer.peer_pb.last_known_addr().host();
+  port = peer.peer_pb.last_known_addr().port();
+  next_index = peer.next_index;
+  max_batch_bytes = peer.MaxBatchBytes();
+  load_percent = peer.load_percent;
+  last_exchange_status = peer.last_exchange_status;
+  wal_catchup_possible = peer.wal_catchup_possible;
+  if (FLAGS_buffer_messages_between_rpcs) {
+    peer_msg_buffer = peer.peer_msg_buffer;
+  }
+}
+
+std::string PeerMessageQueue::PeerRequestState::ToString() const {
+  return Substitute(
+      "Peer: $0 ($1:$2), Status: $3, Next index: $4",
+      *uuid,
+      host,
+      port,
+      PeerStatusToString(last_exchange_status),
+      next_index);
+}
+
 #define INSTANTIATE_METRIC(x) x.Instantiate(metric_entity, 0)
 PeerMessageQueue::Metrics::Metrics(
     const scoped_refptr<MetricEntity>& metric_entity)
@@ -443,24 +714,44 @@ PeerMessageQueue::PeerMessageQueue(
     const OpId& last_locally_committed)
     : raft_pool_observers_token_(std::move(raft_pool_observers_token)),
       local_peer_pb_(std::move(local_peer_pb)),
+      local_peer_id_(InternPeerUuid(local_peer_pb_.permanent_uuid())),
       routing_table_container_(std::move(routing_table_container)),
       tablet_id_(std::move(tablet_id)),
+      metric_registry_(metric_entity ? metric_entity->registry() : nullptr),
+      resource_account_(metric_registry_, tablet_id_),
+      binary_log_prefix_(std::make_shared<const string>(Substitute(
+          "T $0 P $1: ",
+          tablet_id_,
+          local_peer_pb_.permanent_uuid()))),
       adjust_voter_distribution_(true),
       successor_watch_in_progress_(false),
       log_cache_(
           metric_entity,
           std::move(log),
           local_peer_pb_.permanent_uuid(),
-          tablet_id_),
+          tablet_id_,
+          FLAGS_raft_lightweight_witness &&
+              !local_peer_pb_.attrs().backing_db_present()),
       metrics_(metric_entity),
       time_manager_(std::move(time_manager)),
       leader_lease_until_(MonoTime::Min()),
       bounded_dataloss_window_until_(MonoTime::Min()),
+      next_bounded_dataloss_window_renewal_(MonoTime::Min()),
       time_provider_(TimeProvider::getInstance()) {
   DCHECK(local_peer_pb_.has_permanent_uuid());
   DCHECK(local_peer_pb_.has_last_known_addr());
   DCHECK(last_locally_replicated.IsInitialized());
   DCHECK(last_locally_committed.IsInitialized());
+  if (LockProfilingEnabled()) {
+    queue_lock_profile_.reset(new LockProfile(
+        Substitute(
+            "T $0 P $1: PeerMessageQueue::queue_lock_",
+            tablet_id_,
+            local_peer_pb_.permanent_uuid()),
+        METRIC_consensus_queue_lock_wait_time.Instantiate(metric_entity),
+        METRIC_consensus_queue_lock_hold_time.Instantiate(metric_entity)));
+    queue_lock_.set_profile(queue_lock_profile_.get());
+  }
   queue_state_.current_term = 0;
   queue_state_.first_index_in_current_term = boost::none;
   queue_state_.committed_index = 0;
@@ -470,9 +761,14 @@ PeerMessageQueue::PeerMessageQueue(
   queue_state_.last_idx_appended_to_leader = 0;
   queue_state_.mode = NON_LEADER;
   queue_state_.majority_size_ = -1;
+  queue_state_.quorum_engine = QuorumEngineFor(nullptr);
   queue_state_.last_appended = std::move(last_locally_replicated);
   queue_state_.committed_index = last_locally_committed.index();
   queue_state_.state = kQueueOpen;
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    PublishWatermarksUnlocked();
+  }
   // TODO(mpercy): Merge LogCache::Init() with its constructor.
   log_cache_.Init(queue_state_.last_appended);
 
@@ -492,6 +788,63 @@ void PeerMessageQueue::SetProxyFailureThresholdLag(
   proxy_failure_threshold_lag_ = proxy_failure_threshold_lag;
 }
 
+bool PeerMessageQueue::SubjectToCatchupThrottleUnlocked(
+    const TrackedPeer& peer) const {
+  DCHECK(queue_lock_.is_locked());
+  if (FLAGS_raft_catchup_throttle_bytes_per_sec <= 0 &&
+      FLAGS_raft_catchup_throttle_batches_per_sec <= 0) {
+    return false;
+  }
+  if (peer.peer_pb.member_type() == RaftPeerPB::VOTER &&
+      !FLAGS_raft_catchup_throttle_voters) {
+    return false;
+  }
+  if (IsActiveTransferSuccessorUnlocked(peer.uuid())) {
+    return false;
+  }
+  return queue_state_.committed_index - peer.next_index >=
+      FLAGS_raft_catchup_throttle_min_lag_ops;
+}
+
+bool PeerMessageQueue::IsActiveTransferSuccessorUnlocked(
+    const string& uuid) const {
+  DCHECK(queue_lock_.is_locked());
+  return active_transfer_successor_ && *active_transfer_successor_ == uuid;
+}
+
+bool PeerMessageQueue::CatchupThrottledUnlocked(TrackedPeer* peer) {
+  if (!SubjectToCatchupThrottleUnlocked(*peer)) {
+    return false;
+  }
+  const int64_t bytes_per_sec = FLAGS_raft_catchup_throttle_bytes_per_sec;
+  // The throttler refills in tenths of a second, so it can't count fewer
+  // than ten batches per second.
+  int64_t batches_per_sec = FLAGS_raft_catchup_throttle_batches_per_sec;
+  if (batches_per_sec > 0) {
+    batches_per_sec = std::max<int64_t>(batches_per_sec, 10);
+  }
+  const int64_t batch_bytes = FLAGS_consensus_max_batch_size_bytes;
+  if (!peer->catchup_throttler ||
+      peer->catchup_throttler_bytes_per_sec != bytes_per_sec ||
+      peer->catchup_throttler_batches_per_sec != batches_per_sec) {
+    // Allow a burst of at least one full batch, or none would ever pass.
+    double burst = 1.0;
+    if (bytes_per_sec > 0) {
+      const double refill_bytes = static_cast<double>(bytes_per_sec) *
+          Throttler::kRefillPeriodMicros / MonoTime::kMicrosecondsPerSecond;
+      burst = std::max(burst, batch_bytes / std::max(refill_bytes, 1.0));
+    }
+    peer->catchup_throttler = std::make_shared<Throttler>(
+        MonoTime::Now(),
+        batches_per_sec,
+        std::max<int64_t>(bytes_per_sec, 0),
+        burst);
+    peer->catchup_throttler_bytes_per_sec = bytes_per_sec;
+    peer->catchup_throttler_batches_per_sec = batches_per_sec;
+  }
+  return !peer->catchup_throttler->Take(MonoTime::Now(), 1, batch_bytes);
+}
+
 bool PeerMessageQueue::HasProxyPeerFailedUnlocked(
     const TrackedPeer* proxy_peer,
     const TrackedPeer* dest_peer) {
@@ -527,7 +880,7 @@ bool PeerMessageQueue::HasProxyPeerFailedUnlocked(
 Status PeerMessageQueue::SetCompressionDictionary(const std::string& dict) {
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
   RETURN_NOT_OK(log_cache()->Clear());
-  RETURN_NOT_OK(CompressionCodecManager::SetDictionary(dict));
+  RETURN_NOT_OK(codec_manager()->SetDictionary(dict));
   for (const PeersMap::value_type& entry : peers_map_) {
     entry.second->should_send_compression_dict = true;
   }
@@ -538,24 +891,50 @@ void PeerMessageQueue::SetLeaderMode(
     int64_t committed_index,
     int64_t current_term,
     const RaftConfigPB& active_config) {
+  SetLeaderMode(
+      committed_index,
+      current_term,
+      RaftConfigSnapshot::Create(active_config));
+}
+
+void PeerMessageQueue::SetLeaderMode(
+    int64_t committed_index,
+    int64_t current_term,
+    std::shared_ptr<const RaftConfigSnapshot> active_config) {
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
   if (current_term != queue_state_.current_term) {
     CHECK_GT(current_term, queue_state_.current_term)
         << "Terms should only increase";
     queue_state_.first_index_in_current_term = boost::none;
     queue_state_.current_term = current_term;
+    // What is left here is the lease this peer granted the previous leader,
+    // which isn't one it may serve reads under.
+    leader_lease_until_ = MonoTime::Min();
+    next_bounded_dataloss_window_renewal_ = MonoTime::Min();
   }
 
   queue_state_.committed_index = committed_index;
   queue_state_.majority_replicated_index = committed_index;
-  queue_state_.active_config.reset(new RaftConfigPB(active_config));
+  queue_state_.active_config = std::move(active_config);
   queue_state_.majority_size_ =
-      MajoritySize(CountVoters(*queue_state_.active_config));
+      MajoritySize(queue_state_.active_config->num_voters());
+  queue_state_.quorum_engine =
+      QuorumEngineFor(queue_state_.active_config.get());
   queue_state_.mode = LEADER;
+  watermark_inputs_changed_ = true;
+  PublishWatermarksUnlocked();
 
   TrackLocalPeerUnlocked();
   CheckPeersInActiveConfigIfLeaderUnlocked();
 
+  // Lagging peers are about to catch up from the lowest index the previous
+  // leader reported as replicated everywhere, or, after a restart, from
+  // around the committed index.
+  log_cache_.WarmUp(
+      queue_state_.all_replicated_index > 0
+          ? queue_state_.all_replicated_index + 1
+          : committed_index + 1);
+
   LOG_WITH_PREFIX_UNLOCKED(INFO)
       << "Queue going to LEADER mode. State: " << queue_state_.ToString();
 
@@ -563,10 +942,19 @@ void PeerMessageQueue::SetLeaderMode(
 }
 
 void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
+  SetNonLeaderMode(RaftConfigSnapshot::Create(active_config));
+}
+
+void PeerMessageQueue::SetNonLeaderMode(
+    std::shared_ptr<const RaftConfigSnapshot> active_config) {
+  SCOPED_CLEANUP({ MaybeNotifyLeadershipWaiters(); });
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  queue_state_.active_config.reset(new RaftConfigPB(active_config));
+  queue_state_.active_config = std::move(active_config);
   queue_state_.mode = NON_LEADER;
   queue_state_.majority_size_ = -1;
+  queue_state_.quorum_engine =
+      QuorumEngineFor(queue_state_.active_config.get());
+  watermark_inputs_changed_ = true;
 
   // Update this when stepping down, since it doesn't get tracked as LEADER.
   queue_state_.last_idx_appended_to_leader = queue_state_.last_appended.index();
@@ -576,6 +964,8 @@ void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
   LOG_WITH_PREFIX_UNLOCKED(INFO)
       << "Queue going to NON_LEADER mode. State: " << queue_state_.ToString();
 
+  // Only the leader reads ahead for peers.
+  log_cache_.DropAllReadahead();
   time_manager_->SetNonLeaderMode();
 }
 
@@ -608,12 +998,18 @@ void PeerMessageQueue::TrackPeerUnlocked(
   }
 
   InsertOrDie(&peers_map_, tracked_peer->uuid(), tracked_peer);
+  if (peers_by_id_.size() <= tracked_peer->peer_id) {
+    peers_by_id_.resize(tracked_peer->peer_id + 1, nullptr);
+  }
+  peers_by_id_[tracked_peer->peer_id] = tracked_peer;
 
   CheckPeersInActiveConfigIfLeaderUnlocked();
 
   // We don't know how far back this peer is, so set the all replicated
   // watermark to 0. We'll advance it when we know how far along the peer is.
   queue_state_.all_replicated_index = 0;
+  watermark_inputs_changed_ = true;
+  PublishWatermarksUnlocked();
 }
 
 void PeerMessageQueue::UntrackPeer(const string& uuid) {
@@ -624,18 +1020,20 @@ void PeerMessageQueue::UntrackPeer(const string& uuid) {
 void PeerMessageQueue::UntrackPeerUnlocked(const string& uuid) {
   DCHECK(queue_lock_.is_locked());
   TrackedPeer* peer = EraseKeyReturnValuePtr(&peers_map_, uuid);
+  if (peer != nullptr) {
+    peers_by_id_[peer->peer_id] = nullptr;
+    watermark_inputs_changed_ = true;
+  }
   delete peer; // Deleting a nullptr is safe.
+  log_cache_.DropReadahead(uuid);
 }
 
 void PeerMessageQueue::TrackLocalPeerUnlocked() {
   DCHECK(queue_lock_.is_locked());
-  RaftPeerPB* local_peer_in_config;
-  Status s = GetRaftConfigMember(
-      queue_state_.active_config.get(),
-      local_peer_pb_.permanent_uuid(),
-      &local_peer_in_config);
+  const RaftPeerPB* local_peer_in_config =
+      queue_state_.active_config->FindPeer(local_peer_pb_.permanent_uuid());
   auto local_copy = local_peer_pb_;
-  if (!s.ok()) {
+  if (local_peer_in_config == nullptr) {
     // The local peer is not a member of the config. The queue requires the
     // 'member_type' field to be set for any tracked peer, so we explicitly
     // mark the local peer as a NON_VOTER. This case is only possible when the
@@ -670,6 +1068,10 @@ unordered_map<string, HealthReportPB> PeerMessageQueue::ReportHealthOfPeers()
       overall_health = HealthReportPB::HEALTHY;
     }
     report.set_overall_health(overall_health);
+    if (peer->replication_stats) {
+      peer->replication_stats->ToPB(
+          time_provider_->Now(), report.mutable_replication_stats());
+    }
     reports.emplace(peer_uuid, std::move(report));
   }
   return reports;
@@ -679,12 +1081,8 @@ void PeerMessageQueue::CheckPeersInActiveConfigIfLeaderUnlocked() const {
   DCHECK(queue_lock_.is_locked());
   if (queue_state_.mode != LEADER)
     return;
-  std::unordered_set<string> config_peer_uuids;
-  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
-    InsertOrDie(&config_peer_uuids, peer_pb.permanent_uuid());
-  }
   for (const PeersMap::value_type& entry : peers_map_) {
-    if (!ContainsKey(config_peer_uuids, entry.first)) {
+    if (queue_state_.active_config->FindPeer(entry.first) == nullptr) {
       LOG_WITH_PREFIX_UNLOCKED(FATAL) << Substitute(
           "Peer $0 is not in the active config. "
           "Queue state: $1",
@@ -712,8 +1110,7 @@ void PeerMessageQueue::DoLocalPeerAppendFinished(
   }
 
   boost::optional<int64_t> updated_commit_index;
-  DoResponseFromPeer(
-      local_peer_pb_.permanent_uuid(), fake_response, updated_commit_index);
+  DoResponseFromPeer(local_peer_id_, fake_response, updated_commit_index);
 
   if (updated_commit_index != boost::none) {
     NotifyObserversOfCommitIndexChange(*updated_commit_index, need_lock);
@@ -779,6 +1176,7 @@ Status PeerMessageQueue::AppendOperations(
       queue_state_.first_index_in_current_term = id.index();
     }
   }
+  PublishWatermarksUnlocked();
 
   // Update safe time in the TimeManager if we're leader.
   // This will 'unpin' safe time advancement, which had stopped since we
@@ -825,6 +1223,9 @@ Status PeerMessageQueue::AppendOperations(
 
   OpId last_id = msg_wrappers.back().GetOrigMsg()->get()->id();
 
+  // Ops traced by OpLatencyTracker, to mark once durable.
+  vector<std::shared_ptr<OpLatencyTrace>> traces;
+
   // "Snoop" on the appended operations to watch for term changes (as follower)
   // and to determine the first index in our term (as leader).
   //
@@ -833,7 +1234,11 @@ Status PeerMessageQueue::AppendOperations(
   // using that method to handle refreshing the peer list during configuration
   // changes, so the refactor isn't trivial.
   for (const auto& msg_wrapper : msg_wrappers) {
-    const auto& id = msg_wrapper.GetOrigMsg()->get()->id();
+    const ReplicateRefPtr orig_msg = msg_wrapper.GetOrigMsg();
+    if (PREDICT_FALSE(orig_msg->latency_trace() != nullptr)) {
+      traces.push_back(orig_msg->shared_latency_trace());
+    }
+    const auto& id = orig_msg->get()->id();
     if (id.term() > queue_state_.current_term) {
       queue_state_.current_term = id.term();
       queue_state_.first_index_in_current_term = id.index();
@@ -843,6 +1248,7 @@ Status PeerMessageQueue::AppendOperations(
       queue_state_.first_index_in_current_term = id.index();
     }
   }
+  PublishWatermarksUnlocked();
 
   // Update safe time in the TimeManager if we're leader.
   // This will 'unpin' safe time advancement, which had stopped since we
@@ -858,13 +1264,15 @@ Status PeerMessageQueue::AppendOperations(
   // However, for the log buffer to empty, it may need to call
   // LocalPeerAppendFinished() which also needs queue_lock_.
   lock.unlock();
-  RETURN_NOT_OK(log_cache_.AppendOperations(
-      msg_wrappers,
-      Bind(
-          &PeerMessageQueue::LocalPeerAppendFinished,
-          Unretained(this),
-          last_id,
-          log_append_callback)));
+  StatusCallback append_callback = Bind(
+      &PeerMessageQueue::LocalPeerAppendFinished,
+      Unretained(this),
+      last_id,
+      log_append_callback);
+  if (PREDICT_FALSE(!traces.empty())) {
+    append_callback = Bind(&MarkLocalDurable, traces, append_callback);
+  }
+  RETURN_NOT_OK(log_cache_.AppendOperations(msg_wrappers, append_callback));
   lock.lock();
   DCHECK(last_id.IsInitialized());
   queue_state_.last_appended = last_id;
@@ -931,7 +1339,7 @@ bool PeerMessageQueue::SafeToEvictUnlocked(const string& evict_uuid) const {
     if (uuid == evict_uuid) {
       continue;
     }
-    if (!IsRaftConfigVoter(uuid, *queue_state_.active_config)) {
+    if (!queue_state_.active_config->IsVoter(uuid)) {
       continue;
     }
     remaining_voters++;
@@ -1042,6 +1450,28 @@ void PeerMessageQueue::UpdatePeerHealthUnlocked(TrackedPeer* peer) {
   }
 }
 
+bool PeerMessageQueue::PeerHealthEvaluatedInBackground() {
+  return FLAGS_raft_peer_health_evaluation_interval_ms > 0;
+}
+
+void PeerMessageQueue::EvaluatePeerHealth() {
+  if (!FLAGS_HANDLER(FLAGS_update_peer_health_status)) {
+    return;
+  }
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  if (queue_state_.mode != LEADER) {
+    return;
+  }
+  for (const auto& entry : peers_map_) {
+    TrackedPeer* peer = entry.second;
+    // Requests are never made for the local peer, which is thus never
+    // evaluated in the per-request mode either.
+    if (peer->peer_id != local_peer_id_) {
+      UpdatePeerHealthUnlocked(peer);
+    }
+  }
+}
+
 // While reporting on the replica health status, it's important to report on
 // the 'definitive' health statuses once they surface. That allows the system
 // to expedite decisions on replica replacement because the more 'definitive'
@@ -1110,31 +1540,120 @@ Status PeerMessageQueue::FindPeer(const std::string& uuid, TrackedPeer* peer) {
   return Status::OK();
 }
 
+bool PeerMessageQueue::IsPeerCaughtUp(const string& uuid) const {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  const TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  return peer != nullptr && peer->last_exchange_status == PeerStatus::OK &&
+      peer->last_received.index() == queue_state_.last_appended.index() &&
+      peer->last_known_committed_index == queue_state_.committed_index;
+}
+
 Status PeerMessageQueue::RequestForPeer(
     const string& uuid,
     bool read_ops,
     ConsensusRequestPB* request,
     vector<ReplicateRefPtr>* msg_refs,
     bool* needs_tablet_copy,
-    std::string* next_hop_uuid) {
+    std::string* next_hop_uuid,
+    int64_t* request_seq,
+    bool* catchup_throttled,
+    LogCache::SharedOps* msg_batch) {
+  return DoRequestForPeer(
+      FindPeerId(uuid),
+      uuid,
+      read_ops,
+      request,
+      msg_refs,
+      needs_tablet_copy,
+      next_hop_uuid,
+      request_seq,
+      catchup_throttled,
+      msg_batch);
+}
+
+Status PeerMessageQueue::RequestForPeer(
+    PeerId peer_id,
+    bool read_ops,
+    ConsensusRequestPB* request,
+    vector<ReplicateRefPtr>* msg_refs,
+    bool* needs_tablet_copy,
+    std::string* next_hop_uuid,
+    int64_t* request_seq,
+    bool* catchup_throttled,
+    LogCache::SharedOps* msg_batch) {
+  return DoRequestForPeer(
+      peer_id,
+      PeerUuid(peer_id),
+      read_ops,
+      request,
+      msg_refs,
+      needs_tablet_copy,
+      next_hop_uuid,
+      request_seq,
+      catchup_throttled,
+      msg_batch);
+}
+
+Status PeerMessageQueue::DoRequestForPeer(
+    PeerId peer_id,
+    const string& uuid,
+    bool read_ops,
+    ConsensusRequestPB* request,
+    vector<ReplicateRefPtr>* msg_refs,
+    bool* needs_tablet_copy,
+    std::string* next_hop_uuid,
+    int64_t* request_seq,
+    bool* catchup_throttled,
+    LogCache::SharedOps* msg_batch) {
+  TRACE_EVENT2(
+      "consensus",
+      "PeerMessageQueue::RequestForPeer",
+      "tablet",
+      tablet_id_,
+      "peer",
+      uuid);
+  if (catchup_throttled != nullptr) {
+    *catchup_throttled = false;
+  }
   // Maintain a thread-safe copy of necessary members.
   OpId preceding_id;
   int64_t current_term;
-  TrackedPeer peer_copy;
+  PeerRequestState peer_copy;
   MonoDelta unreachable_time;
+  const bool pipelined = request_seq != nullptr &&
+      FLAGS_raft_max_inflight_requests_per_peer > 1 &&
+      !FLAGS_buffer_messages_between_rpcs;
   {
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
     DCHECK_EQ(queue_state_.state, kQueueOpen);
     DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
 
-    TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+    TrackedPeer* peer = FindPeerUnlocked(peer_id);
     if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
       return Status::NotFound(Substitute(
           "peer $0 is no longer tracked or "
           "queue is not in leader mode",
           uuid));
     }
-    peer_copy = *peer;
+    if (read_ops && CatchupThrottledUnlocked(peer)) {
+      // The peer still gets a status-only request, so it keeps hearing from
+      // the leader; its ops wait for the throttle.
+      VLOG_WITH_PREFIX_UNLOCKED(2)
+          << "Throttling catch-up of peer " << uuid << THROTTLE_MSG;
+      read_ops = false;
+      if (catchup_throttled != nullptr) {
+        *catchup_throttled = true;
+      }
+    }
+    peer_copy.CopyFrom(*peer, &uuid);
+    if (request_seq != nullptr) {
+      *request_seq = peer->next_request_seq++;
+    }
+    if (pipelined) {
+      // Carry on after the requests already in flight.
+      peer_copy.next_index =
+          std::max(peer->next_index, peer->pipeline_next_index);
+    }
 
     // Clear the requests without deleting the entries, as they may be in use by
     // other peers.
@@ -1164,15 +1683,18 @@ Status PeerMessageQueue::RequestForPeer(
     if (peer->should_send_compression_dict) {
       KLOG_EVERY_N_SECS(INFO, 180)
           << "Setting compression dictionary in request to: " << peer->uuid()
-          << " as " << CompressionCodecManager::GetCurrentDictionaryID();
-      request->set_compression_dictionary(
-          CompressionCodecManager::GetDictionary());
+          << " as " << codec_manager()->GetCurrentDictionaryID();
+      request->set_compression_dictionary(codec_manager()->GetDictionary());
     }
-    unreachable_time =
-        time_provider_->Now() - peer_copy.last_communication_time;
+    unreachable_time = time_provider_->Now() - peer->last_communication_time;
 
-    RETURN_NOT_OK(routing_table_container_->NextHop(
-        local_peer_pb_.permanent_uuid(), uuid, next_hop_uuid));
+    if (IsActiveTransferSuccessorUnlocked(uuid)) {
+      // A proxy would add a hop to the transfer.
+      *next_hop_uuid = uuid;
+    } else {
+      RETURN_NOT_OK(routing_table_container_->NextHop(
+          local_peer_pb_.permanent_uuid(), uuid, next_hop_uuid));
+    }
 
     if (*next_hop_uuid != uuid) {
       // If proxy_peer is not healthy, then route directly to the destination
@@ -1215,8 +1737,15 @@ Status PeerMessageQueue::RequestForPeer(
     if (!FLAGS_HANDLER(FLAGS_update_peer_health_status)) {
       return;
     }
+    // In the background mode there is nothing to do unless the request
+    // changed whether the peer can catch up from the WAL.
+    if (PeerHealthEvaluatedInBackground() &&
+        !(wal_catchup_progress && !peer_copy.wal_catchup_possible) &&
+        !(wal_catchup_failure && peer_copy.wal_catchup_possible)) {
+      return;
+    }
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
-    TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+    TrackedPeer* peer = FindPeerUnlocked(peer_id);
     if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
       VLOG(1) << LogPrefixUnlocked() << "peer " << uuid
               << " is no longer tracked or queue is not in leader mode";
@@ -1226,7 +1755,9 @@ Status PeerMessageQueue::RequestForPeer(
       peer->wal_catchup_possible = true;
     if (wal_catchup_failure)
       peer->wal_catchup_possible = false;
-    UpdatePeerHealthUnlocked(peer);
+    if (!PeerHealthEvaluatedInBackground()) {
+      UpdatePeerHealthUnlocked(peer);
+    }
   });
 
   if (peer_copy.last_exchange_status == PeerStatus::TABLET_NOT_FOUND) {
@@ -1248,6 +1779,12 @@ Status PeerMessageQueue::RequestForPeer(
     // destination
     request->clear_proxy_dest_uuid();
   }
+  // Unless the proxy is to relay the ops as they are, it gets PROXY_OP
+  // placeholders, which it fills in from its own log.
+  const bool send_proxy_ops = route_via_proxy && !FLAGS_raft_proxy_relay_ops;
+  // Only known when the ops are read for this request, not when they come
+  // from a buffer filled ahead of it (--buffer_messages_between_rpcs).
+  int64_t disk_bytes_read = 0;
 
   // If we've never communicated with the peer, we don't know what messages to
   // send, so we'll send a status-only request. Otherwise, we grab requests
@@ -1257,28 +1794,49 @@ Status PeerMessageQueue::RequestForPeer(
   // ususally does this when the leader detects that a peer is unhealthy and
   // hence needs to be degraded to a 'status-only' request
   if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops) {
-    // The batch of messages to send to the peer.
+    // The batch of messages to send to the peer, either read for this request
+    // or, with --raft_share_op_batches, shared with other peers' requests.
     vector<ReplicateRefPtr> messages;
+    LogCache::SharedOps batch;
+    if (msg_batch != nullptr) {
+      msg_batch->reset();
+    }
+    const bool share_batch = msg_batch != nullptr &&
+        FLAGS_raft_share_op_batches && !FLAGS_buffer_messages_between_rpcs &&
+        !send_proxy_ops;
     Status s = FLAGS_buffer_messages_between_rpcs
-        ? ExtractBuffer(peer_copy, route_via_proxy, &messages, &preceding_id)
+        ? ExtractBuffer(peer_copy, send_proxy_ops, &messages, &preceding_id)
         : ReadMessagesForRequest(
-              peer_copy, route_via_proxy, &messages, &preceding_id);
+              peer_copy,
+              send_proxy_ops,
+              &messages,
+              &preceding_id,
+              &disk_bytes_read,
+              share_batch ? &batch : nullptr);
+    const vector<ReplicateRefPtr>& ops = batch ? *batch : messages;
 
     if (PREDICT_FALSE(!s.ok())) {
       // It's normal to have a NotFound() here if a follower falls behind where
       // the leader has GCed its logs. The follower replica will hang around
       // for a while until it's evicted.
       if (PREDICT_TRUE(s.IsNotFound())) {
-        KLOG_EVERY_N_SECS_THROTTLER(
-            INFO, 60, *peer_copy.status_log_throttler, "logs_gced")
-            << LogPrefixUnlocked()
-            << Substitute(
-                   "The logs necessary to catch up peer $0 have been "
-                   "garbage collected. The follower will never be able "
-                   "to catch up ($1)",
-                   uuid,
-                   s.ToString());
+        {
+          std::lock_guard<simple_mutexlock> lock(queue_lock_);
+          TrackedPeer* peer = FindPeerUnlocked(peer_id);
+          if (peer != nullptr) {
+            KLOG_EVERY_N_SECS_THROTTLER(
+                INFO, 60, *peer->status_log_throttler, "logs_gced")
+                << LogPrefixUnlocked()
+                << Substitute(
+                       "The logs necessary to catch up peer $0 have been "
+                       "garbage collected. The follower will never be able "
+                       "to catch up ($1)",
+                       uuid,
+                       s.ToString());
+          }
+        }
         wal_catchup_failure = true;
+        MaybeNotifyPeerNeedsSnapshot(uuid, peer_copy.next_index);
         return s;
       }
       if (s.IsIncomplete()) {
@@ -1303,11 +1861,26 @@ Status PeerMessageQueue::RequestForPeer(
     // "all replicated" point. At some point we may want to allow partially
     // loading (and not pinning) earlier messages. At that point we'll need to
     // do something smarter here, like copy or ref-count.
-    if (!route_via_proxy) {
-      for (const ReplicateRefPtr& msg : messages) {
-        request->mutable_ops()->AddAllocated(msg->get());
+    //
+    // The unsafe variant is used because ops read from the log may live on
+    // an arena (see --log_cache_read_arenas), which AddAllocated() would copy
+    // out of. They are extracted again before 'msg_refs' drops them.
+    for (const ReplicateRefPtr& msg : ops) {
+      if (PREDICT_FALSE(msg->latency_trace() != nullptr)) {
+        msg->latency_trace()->Mark(OpStage::kFirstSent);
+      }
+    }
+    if (!send_proxy_ops) {
+      for (const ReplicateRefPtr& msg : ops) {
+        request->mutable_ops()->UnsafeArenaAddAllocated(msg->get());
+      }
+      if (batch) {
+        // The reference to the batch keeps all of its ops alive.
+        msg_refs->clear();
+        *msg_batch = std::move(batch);
+      } else {
+        msg_refs->swap(messages);
       }
-      msg_refs->swap(messages);
     } else {
       vector<ReplicateRefPtr> proxy_ops;
       for (const ReplicateRefPtr& msg : messages) {
@@ -1325,6 +1898,22 @@ Status PeerMessageQueue::RequestForPeer(
 
   DCHECK(preceding_id.IsInitialized());
   request->mutable_preceding_id()->CopyFrom(preceding_id);
+  TraceOpFlowSteps(tablet_id_, request->ops(), "sent");
+
+  if (PeerReplicationStatsEnabled()) {
+    RecordRequestStats(uuid, *request, disk_bytes_read);
+  }
+
+  if (pipelined && request->ops_size() > 0) {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    TrackedPeer* peer = FindPeerUnlocked(peer_id);
+    // Unless the peer was rewound while the ops were read, the next request
+    // follows on from this one.
+    if (peer != nullptr && *request_seq >= peer->min_valid_response_seq) {
+      peer->pipeline_next_index =
+          request->ops(request->ops_size() - 1).id().index() + 1;
+    }
+  }
 
   // If we are sending ops to the follower, but the batch doesn't reach the
   // current committed index, we can consider the follower lagging, and it's
@@ -1373,37 +1962,73 @@ Status PeerMessageQueue::RequestForPeer(
 }
 
 Status PeerMessageQueue::ReadMessagesForRequest(
-    const TrackedPeer& peer_copy,
+    const PeerRequestState& peer_copy,
     bool route_via_proxy,
     std::vector<ReplicateRefPtr>* messages,
-    OpId* preceding_id) {
+    OpId* preceding_id,
+    int64_t* disk_bytes_read,
+    LogCache::SharedOps* batch) {
   ReadContext read_context;
-  read_context.for_peer_uuid = &peer_copy.uuid();
-  read_context.for_peer_host = &peer_copy.peer_pb.last_known_addr().host();
-  read_context.for_peer_port = peer_copy.peer_pb.last_known_addr().port();
+  read_context.for_peer_uuid = peer_copy.uuid;
+  read_context.for_peer_host = &peer_copy.host;
+  read_context.for_peer_port = peer_copy.port;
   read_context.route_via_proxy = route_via_proxy;
 
-  // We try to get the follower's next_index from our log.
-  LogCache::ReadOpsStatus s = log_cache_.ReadOps(
-      peer_copy.next_index - 1,
-      FLAGS_consensus_max_batch_size_bytes,
-      read_context,
-      messages);
+  // We try to get the follower's next_index from our log. A loaded follower
+  // gets a smaller batch, down to a single op.
+  int64_t max_batch_bytes = peer_copy.max_batch_bytes;
+  if (PREDICT_FALSE(peer_copy.load_percent > 0)) {
+    max_batch_bytes = max_batch_bytes * (100 - peer_copy.load_percent) / 100;
+  }
+  LogCache::ReadOpsStatus s = batch != nullptr
+      ? log_cache_.ReadSharedOps(
+            peer_copy.next_index - 1, max_batch_bytes, read_context, batch)
+      : log_cache_.ReadOps(
+            peer_copy.next_index - 1, max_batch_bytes, read_context, messages);
   if (s.status.ok()) {
     *preceding_id = std::move(s.preceding_op);
+    if (disk_bytes_read != nullptr) {
+      *disk_bytes_read = s.disk_bytes_read;
+    }
   }
   return std::move(s.status);
 }
 
+void PeerMessageQueue::RecordRequestStats(
+    const string& uuid,
+    const ConsensusRequestPB& request,
+    int64_t disk_bytes_read) {
+  // As in the log cache, the payload stands in for the size of an op.
+  int64_t bytes = 0;
+  for (const ReplicateMsg& op : request.ops()) {
+    bytes += op.write_payload().payload().size();
+  }
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  if (peer == nullptr) {
+    return;
+  }
+  const MonoTime now = time_provider_->Now();
+  if (!peer->replication_stats) {
+    peer->replication_stats = std::make_shared<PeerReplicationStats>(
+        metric_registry_,
+        tablet_id_,
+        uuid,
+        peer->peer_pb.attrs().region(),
+        now);
+  }
+  peer->replication_stats->RecordRequest(
+      now, request.ops_size(), bytes, disk_bytes_read);
+}
+
 Status PeerMessageQueue::ExtractBuffer(
-    const TrackedPeer& peer_copy,
+    const PeerRequestState& peer_copy,
     bool route_via_proxy,
     std::vector<ReplicateRefPtr>* messages,
     OpId* preceding_id) {
   VLOG_WITH_PREFIX_UNLOCKED(3)
-      << "Extracting buffer for peer: " << peer_copy.uuid() << "["
-      << peer_copy.peer_pb.last_known_addr().host() << ":"
-      << peer_copy.peer_pb.last_known_addr().port()
+      << "Extracting buffer for peer: " << *peer_copy.uuid << "["
+      << peer_copy.host << ":" << peer_copy.port
       << "] starting at index: " << peer_copy.next_index
       << ", route_via_proxy: " << route_via_proxy;
 
@@ -1420,11 +2045,10 @@ Status PeerMessageQueue::ExtractBuffer(
     // (but not both) will populate the future.
     if (handle) {
       ReadContext read_context;
-      read_context.for_peer_uuid = &peer_copy.uuid();
-      read_context.for_peer_host = &peer_copy.peer_pb.last_known_addr().host();
-      read_context.for_peer_port = peer_copy.peer_pb.last_known_addr().port();
+      read_context.for_peer_uuid = peer_copy.uuid;
+      read_context.for_peer_host = &peer_copy.host;
+      read_context.for_peer_port = peer_copy.port;
       read_context.route_via_proxy = route_via_proxy;
-      auto peer_msg_buffer_ptr = peer_copy.peer_msg_buffer;
       FillBuffer(read_context, std::move(handle));
     }
   }
@@ -1437,7 +2061,7 @@ Status PeerMessageQueue::ExtractBuffer(
 }
 
 void PeerMessageQueue::FillBufferForPeer(const std::string& uuid) {
-  TrackedPeer peer_copy;
+  PeerRequestState peer_copy;
   bool route_via_proxy = false;
   {
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
@@ -1453,25 +2077,31 @@ void PeerMessageQueue::FillBufferForPeer(const std::string& uuid) {
           << peer->peer_pb.last_known_addr().host() << ":"
           << peer->peer_pb.last_known_addr().port() << "]";
       return;
+    } else if (SubjectToCatchupThrottleUnlocked(*peer)) {
+      // Reading ahead would bypass the throttle; the peer's requests read
+      // their ops when the throttle lets them through.
+      return;
+    }
+    std::string next_hop_uuid = uuid;
+    if (!IsActiveTransferSuccessorUnlocked(uuid)) {
+      routing_table_container_->NextHop(
+          local_peer_pb_.permanent_uuid(), uuid, &next_hop_uuid);
     }
-    std::string next_hop_uuid;
-    routing_table_container_->NextHop(
-        local_peer_pb_.permanent_uuid(), uuid, &next_hop_uuid);
 
     if (next_hop_uuid != uuid) {
       TrackedPeer* proxy_peer = FindPtrOrNull(peers_map_, next_hop_uuid);
       if (proxy_peer != nullptr &&
           !HasProxyPeerFailedUnlocked(proxy_peer, peer)) {
-        route_via_proxy = true;
+        route_via_proxy = !FLAGS_raft_proxy_relay_ops;
       }
     }
 
-    peer_copy = *peer;
+    peer_copy.CopyFrom(*peer, &uuid);
   }
   ReadContext read_context;
   read_context.for_peer_uuid = &uuid;
-  read_context.for_peer_host = &peer_copy.peer_pb.last_known_addr().host();
-  read_context.for_peer_port = peer_copy.peer_pb.last_known_addr().port();
+  read_context.for_peer_host = &peer_copy.host;
+  read_context.for_peer_port = peer_copy.port;
   read_context.route_via_proxy = route_via_proxy;
   FillBuffer(read_context, peer_copy.peer_msg_buffer);
 }
@@ -1649,36 +2279,27 @@ void PeerMessageQueue::AdvanceQueueRegionDurableIndex() {
       std::max(queue_state_.region_durable_index, max_region_durable_index);
 }
 
-void PeerMessageQueue::AdvanceQueueWatermark(
-    const char* type,
-    int64_t* watermark,
-    const OpId& replicated_before,
-    const OpId& replicated_after,
-    int num_peers_required,
-    ReplicaTypes replica_types,
-    const TrackedPeer* who_caused) {
-  if (VLOG_IS_ON(2)) {
-    VLOG_WITH_PREFIX_UNLOCKED(2)
-        << "Updating " << type << " watermark: "
-        << "Peer (" << who_caused->ToString() << ") changed from "
-        << replicated_before << " to " << replicated_after << ". "
-        << "Current value: " << *watermark;
+PeerMessageQueue::QuorumEngine PeerMessageQueue::QuorumEngineFor(
+    const RaftConfigSnapshot* config) {
+  if (!FLAGS_enable_flexi_raft) {
+    return VANILLA_MAJORITY;
+  }
+  if (config && config->config().commit_rule().mode() ==
+          QuorumMode::SINGLE_REGION_DYNAMIC) {
+    return FLEXI_DYNAMIC;
   }
+  return FLEXI_STATIC;
+}
 
-  // Go through the peer's watermarks, we want the highest watermark that
-  // 'num_peers_required' of peers has replicated. To find this we do the
-  // following:
-  // - Store all the peer's 'last_received' in a vector
-  // - Sort the vector
-  // - Find the vector.size() - 'num_peers_required' position, this
-  //   will be the new 'watermark'.
-  std::vector<int64_t> watermarks;
-  watermarks.reserve(peers_map_.size());
-  for (const PeersMap::value_type& peer : peers_map_) {
-    if (replica_types == VOTER_REPLICAS &&
-        peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
+template <PeerMessageQueue::ReplicaTypes kReplicaTypes>
+size_t PeerMessageQueue::CollectWatermarks(
+    const PeersMap& peers,
+    int64_t* out) {
+  // Every peer's index is written, and only kept by advancing past it if the
+  // peer counts, so the loop has no data-dependent branches.
+  size_t n = 0;
+  for (const PeersMap::value_type& peer : peers) {
+    const TrackedPeer* tracked = peer.second;
     // TODO(todd): The fact that we only consider peers whose last exchange was
     // successful can cause the "all_replicated" watermark to lag behind
     // farther than necessary. For example:
@@ -1701,22 +2322,59 @@ void PeerMessageQueue::AdvanceQueueWatermark(
     // 'last_received' is _not_ usable for watermark calculation. This could be
     // fixed by separately storing the 'match_index' on a per-peer basis and
     // using that for watermark calculation.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      watermarks.push_back(peer.second->last_received.index());
+    bool counts = tracked->last_exchange_status == PeerStatus::OK;
+    if (kReplicaTypes == VOTER_REPLICAS) {
+      counts &= tracked->peer_pb.member_type() == RaftPeerPB::VOTER;
     }
+    out[n] = tracked->last_received.index();
+    n += counts;
   }
+  return n;
+}
+
+void PeerMessageQueue::AdvanceQueueWatermark(
+    const char* type,
+    int64_t* watermark,
+    const OpId& replicated_before,
+    const OpId& replicated_after,
+    int num_peers_required,
+    ReplicaTypes replica_types,
+    const TrackedPeer* who_caused) {
+  if (VLOG_IS_ON(2)) {
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Updating " << type << " watermark: "
+        << "Peer (" << who_caused->ToString() << ") changed from "
+        << replicated_before << " to " << replicated_after << ". "
+        << "Current value: " << *watermark;
+  }
+
+  // Go through the peer's watermarks, we want the highest watermark that
+  // 'num_peers_required' of peers has replicated. To find this we do the
+  // following:
+  // - Store all the peer's 'last_received' in an array, on the stack for
+  //   all but very large configs
+  // - Partially sort the array so that the size - 'num_peers_required'
+  //   position holds the value it would hold if the array were sorted; this
+  //   will be the new 'watermark'.
+  FixedArray<int64_t> watermarks_buf(peers_map_.size());
+  const size_t num_watermarks = replica_types == VOTER_REPLICAS
+      ? CollectWatermarks<VOTER_REPLICAS>(peers_map_, watermarks_buf.begin())
+      : CollectWatermarks<ALL_REPLICAS>(peers_map_, watermarks_buf.begin());
+  int64_t* const watermarks_begin = watermarks_buf.begin();
+  int64_t* const watermarks_end = watermarks_begin + num_watermarks;
 
   // If we haven't enough peers to calculate the watermark return.
-  if (watermarks.size() < num_peers_required) {
+  if (num_watermarks < num_peers_required) {
     VLOG_WITH_PREFIX_UNLOCKED(3)
-        << "Watermarks size: " << watermarks.size() << ", "
+        << "Watermarks size: " << num_watermarks << ", "
         << "Num peers required: " << num_peers_required;
     return;
   }
 
-  std::sort(watermarks.begin(), watermarks.end());
+  const auto nth = watermarks_begin + (num_watermarks - num_peers_required);
+  std::nth_element(watermarks_begin, nth, watermarks_end);
 
-  int64_t new_watermark = watermarks[watermarks.size() - num_peers_required];
+  int64_t new_watermark = *nth;
   int64_t old_watermark = *watermark;
   *watermark = new_watermark;
 
@@ -1728,9 +2386,10 @@ void PeerMessageQueue::AdvanceQueueWatermark(
     for (const PeersMap::value_type& peer : peers_map_) {
       VLOG_WITH_PREFIX_UNLOCKED(3) << "Peer: " << peer.second->ToString();
     }
+    std::sort(watermarks_begin, watermarks_end);
     VLOG_WITH_PREFIX_UNLOCKED(3) << "Sorted watermarks:";
-    for (int64_t watermark : watermarks) {
-      VLOG_WITH_PREFIX_UNLOCKED(3) << "Watermark: " << watermark;
+    for (const int64_t* w = watermarks_begin; w != watermarks_end; ++w) {
+      VLOG_WITH_PREFIX_UNLOCKED(3) << "Watermark: " << *w;
     }
   }
 }
@@ -1740,10 +2399,11 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
     const std::map<std::string, std::vector<int64_t>>& watermarks_by_region,
     int64_t* watermark) {
   CHECK(watermark);
-  CHECK(queue_state_.active_config->has_commit_rule());
-  CHECK(queue_state_.active_config->commit_rule().rule_predicates_size() > 0);
+  const RaftConfigPB& active_config = queue_state_.active_config->config();
+  CHECK(active_config.has_commit_rule());
+  CHECK(active_config.commit_rule().rule_predicates_size() > 0);
 
-  const QuorumMode& mode = queue_state_.active_config->commit_rule().mode();
+  const QuorumMode& mode = active_config.commit_rule().mode();
   CHECK(
       mode == QuorumMode::STATIC_DISJUNCTION ||
       mode == QuorumMode::STATIC_CONJUNCTION);
@@ -1752,8 +2412,7 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
       << ((mode == QuorumMode::STATIC_DISJUNCTION) ? "disjunction"
                                                    : "conjunction")
       << " mode";
-  const auto& rule_predicates =
-      queue_state_.active_config->commit_rule().rule_predicates();
+  const auto& rule_predicates = active_config.commit_rule().rule_predicates();
 
   // For each individual predicate, the commit index corresponding to that
   // predicate is appeneded to the following vector. For eg. if the commit
@@ -1889,7 +2548,7 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
 PeerMessageQueue::QuorumResults PeerMessageQueue::IsQuorumSatisfiedUnlocked(
     const RaftPeerPB& peer,
     const std::function<bool(const TrackedPeer*)>& predicate) {
-  if (!FLAGS_enable_flexi_raft) {
+  if (queue_state_.quorum_engine == VANILLA_MAJORITY) {
     // For Vanilla raft mode, peer (local_peer_pb_) might not have fields
     // populated other than uuid
     int num_satisfied = 0;
@@ -1916,7 +2575,7 @@ PeerMessageQueue::QuorumResults PeerMessageQueue::IsQuorumSatisfiedUnlocked(
 
   // Compute total number of voters in each region.
   std::optional<int> total_from_vd = GetTotalVotersFromVoterDistribution(
-      *(queue_state_.active_config), peer_quorum_id);
+      queue_state_.active_config->config(), peer_quorum_id);
 
   int total_voters_from_voter_distribution = total_from_vd.value_or(0);
 
@@ -1926,22 +2585,9 @@ PeerMessageQueue::QuorumResults PeerMessageQueue::IsQuorumSatisfiedUnlocked(
   // membership changes.
   // Check for more comments in AdjustVoterDistributionWithCurrentVoters() which
   // does the same for static mode watermark calculation
-  int total_voters_from_active_config = 0;
-  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
-    if (!peer_pb.has_member_type() ||
-        peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-
-    CHECK(peer_pb.has_permanent_uuid());
-    const std::string& peer_pb_quorum_id = getQuorumIdUsingCommitRule(peer_pb);
-    if (peer_pb_quorum_id != peer_quorum_id) {
-      // In dynamic mode, only the leader region matters
-      continue;
-    }
-
-    total_voters_from_active_config++;
-  }
+  // In dynamic mode, only the leader region matters.
+  int total_voters_from_active_config =
+      queue_state_.active_config->NumVotersInQuorum(peer_quorum_id);
 
   int total_voters = std::max(
       total_voters_from_voter_distribution, total_voters_from_active_config);
@@ -2024,9 +2670,9 @@ PeerMessageQueue::IsSecondRegionDurabilitySatisfiedUnlocked(
 
 int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
   CHECK(watermark);
-  CHECK(queue_state_.active_config->has_commit_rule());
+  CHECK(queue_state_.active_config->config().has_commit_rule());
   CHECK(
-      queue_state_.active_config->commit_rule().mode() ==
+      queue_state_.active_config->config().commit_rule().mode() ==
       QuorumMode::SINGLE_REGION_DYNAMIC);
 
   // Compute the watermarks in leader quorum. As an example, at the end of this
@@ -2063,21 +2709,25 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
     return *watermark;
   }
 
-  // Sort the watermarks
-  std::sort(
-      watermarks_in_leader_quorum.begin(), watermarks_in_leader_quorum.end());
+  // Only the element at the quorum position needs to be in sorted order.
+  const auto nth = watermarks_in_leader_quorum.begin() +
+      (watermarks_in_leader_quorum.size() - results.quorum_size);
+  std::nth_element(
+      watermarks_in_leader_quorum.begin(),
+      nth,
+      watermarks_in_leader_quorum.end());
 
   int64_t old_watermark = *watermark;
-  *watermark = watermarks_in_leader_quorum
-      [watermarks_in_leader_quorum.size() - results.quorum_size];
+  *watermark = *nth;
   return old_watermark;
 }
 
 int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
   CHECK(watermark);
-  CHECK(queue_state_.active_config->has_commit_rule());
+  CHECK(queue_state_.active_config->config().has_commit_rule());
 
-  if (!IsStaticQuorumMode(queue_state_.active_config->commit_rule().mode())) {
+  if (!IsStaticQuorumMode(
+          queue_state_.active_config->config().commit_rule().mode())) {
     return *watermark;
   }
 
@@ -2120,8 +2770,8 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
 
   // Compute total number of voters in each region.
   voter_distribution.insert(
-      queue_state_.active_config->voter_distribution().begin(),
-      queue_state_.active_config->voter_distribution().end());
+      queue_state_.active_config->config().voter_distribution().begin(),
+      queue_state_.active_config->config().voter_distribution().end());
 
   // adjust_voter_distribution_ is set to false on in cases where we want to
   // perform an election forcefully i.e. unsafe config change
@@ -2131,7 +2781,7 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
     // we need to take into account the active voters as well due to
     // membership changes.
     AdjustVoterDistributionWithCurrentVoters(
-        *(queue_state_.active_config), &voter_distribution);
+        queue_state_.active_config->config(), &voter_distribution);
   }
 
   return DoComputeNewWatermarkStaticMode(
@@ -2156,8 +2806,7 @@ void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
 
   // Update the watermark based on the acknowledgements so far.
   int64_t old_watermark = -1;
-  if (queue_state_.active_config->commit_rule().mode() ==
-      QuorumMode::SINGLE_REGION_DYNAMIC) {
+  if (queue_state_.quorum_engine == FLEXI_DYNAMIC) {
     const std::string& leader_quorum =
         getQuorumIdUsingCommitRule(local_peer_pb_);
     const std::string& peer_quorum =
@@ -2186,7 +2835,8 @@ void PeerMessageQueue::BeginWatchForSuccessor(
   transfer_context_ = std::move(transfer_context);
   successor_watch_peer_notified_ = false;
 
-  if (successor_uuid && FLAGS_synchronous_transfer_leadership &&
+  const bool active = successor_uuid && FLAGS_raft_active_leadership_transfer;
+  if (successor_uuid && (FLAGS_synchronous_transfer_leadership || active) &&
       PeerTransferLeadershipImmediatelyUnlocked(successor_uuid.get())) {
     LOG_WITH_PREFIX_UNLOCKED(INFO)
         << "Leadership transfer to " << successor_uuid
@@ -2200,15 +2850,40 @@ void PeerMessageQueue::BeginWatchForSuccessor(
   successor_watch_in_progress_ = true;
   designated_successor_uuid_ = successor_uuid;
   tl_filter_fn_ = filter_fn;
+  if (active) {
+    active_transfer_successor_ = successor_uuid;
+  }
 }
 
 void PeerMessageQueue::EndWatchForSuccessor() {
   std::lock_guard<simple_mutexlock> l(queue_lock_);
   successor_watch_in_progress_ = false;
+  active_transfer_successor_ = boost::none;
   transfer_context_ = boost::none;
   tl_filter_fn_ = nullptr;
 }
 
+boost::optional<string> PeerMessageQueue::GetMostCaughtUpSuccessor() {
+  std::lock_guard<simple_mutexlock> l(queue_lock_);
+  const TrackedPeer* best = nullptr;
+  for (const auto& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    const RaftPeerPB* peer_pb = nullptr;
+    if (entry.first == local_peer_pb_.permanent_uuid() ||
+        !BasicChecksOKToTransferAndGetPeerUnlocked(*peer, &peer_pb)) {
+      continue;
+    }
+    if (best == nullptr ||
+        peer->last_received.index() > best->last_received.index()) {
+      best = peer;
+    }
+  }
+  if (best == nullptr) {
+    return boost::none;
+  }
+  return best->uuid();
+}
+
 bool PeerMessageQueue::WatchForSuccessorPeerNotified() {
   std::lock_guard<simple_mutexlock> l(queue_lock_);
   return successor_watch_peer_notified_;
@@ -2217,10 +2892,128 @@ bool PeerMessageQueue::WatchForSuccessorPeerNotified() {
 Status PeerMessageQueue::GetNextRoutingHopFromLeader(
     const string& dest_uuid,
     string* next_hop) const {
+  {
+    std::lock_guard<simple_mutexlock> l(queue_lock_);
+    if (IsActiveTransferSuccessorUnlocked(dest_uuid)) {
+      *next_hop = dest_uuid;
+      return Status::OK();
+    }
+  }
   return routing_table_container_->NextHop(
       local_peer_pb_.permanent_uuid(), dest_uuid, next_hop);
 }
 
+// Enough for a few peers to be a batch or two apart and still share.
+static const size_t kMaxSerializedOpsBatches = 8;
+
+std::shared_ptr<const std::string> PeerMessageQueue::GetSerializedOps(
+    const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+    ConsensusRequestPB::OpsSidecarEncoding* encoding,
+    CompressionType* compression,
+    int64_t* uncompressed_size) {
+  DCHECK_GT(ops.size(), 0);
+  const OpId& first_id = ops.Get(0).id();
+  const OpId& last_id = ops.Get(ops.size() - 1).id();
+  {
+    std::lock_guard<simple_spinlock> l(serialized_ops_lock_);
+    for (const SerializedOps& entry : serialized_ops_) {
+      if (entry.num_ops == ops.size() &&
+          OpIdEquals(entry.first_id, first_id) &&
+          OpIdEquals(entry.last_id, last_id)) {
+        *encoding = entry.encoding;
+        *compression = entry.compression;
+        *uncompressed_size = entry.uncompressed_size;
+        return entry.bytes;
+      }
+    }
+  }
+
+  // Encode outside the lock; if another peer races us to the same batch, one
+  // of the two encodings is simply dropped.
+  auto bytes = std::make_shared<std::string>();
+  *encoding = ConsensusRequestPB::REQUEST_OPS_FIELDS;
+  if (FLAGS_raft_ops_sidecar_compact_encoding) {
+    if (EncodeCompactOps(ops, bytes.get())) {
+      *encoding = ConsensusRequestPB::COMPACT_OPS;
+    } else {
+      bytes->clear();
+    }
+  }
+  if (*encoding == ConsensusRequestPB::REQUEST_OPS_FIELDS) {
+    google::protobuf::io::StringOutputStream string_stream(bytes.get());
+    google::protobuf::io::CodedOutputStream coded_stream(&string_stream);
+    for (const ReplicateMsg& op : ops) {
+      op.ByteSizeLong(); // Caches the size for WriteMessage().
+      google::protobuf::internal::WireFormatLite::WriteMessage(
+          ConsensusRequestPB::kOpsFieldNumber, op, &coded_stream);
+    }
+  }
+
+  *compression = NO_COMPRESSION;
+  *uncompressed_size = bytes->size();
+  if (bytes->size() >= FLAGS_raft_ops_sidecar_compression_min_bytes) {
+    auto compressed = CompressSerializedOps(*bytes, compression);
+    if (compressed) {
+      bytes = std::move(compressed);
+    }
+  }
+
+  std::lock_guard<simple_spinlock> l(serialized_ops_lock_);
+  serialized_ops_.push_back(
+      {first_id,
+       last_id,
+       ops.size(),
+       bytes,
+       *encoding,
+       *compression,
+       *uncompressed_size});
+  while (serialized_ops_.size() > kMaxSerializedOpsBatches) {
+    serialized_ops_.pop_front();
+  }
+  return bytes;
+}
+
+std::shared_ptr<std::string> PeerMessageQueue::CompressSerializedOps(
+    const std::string& bytes,
+    CompressionType* compression) {
+  const CompressionType type = CompressionCodecManager::GetCodecType(
+      FLAGS_raft_ops_sidecar_compression_codec);
+  if (type == NO_COMPRESSION) {
+    return nullptr;
+  }
+  // Not every hop has the ring's dictionary.
+  if (type == ZSTD_DICT || type == LZ4_DICT) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << LogPrefixUnlocked() << "Dictionary codecs can't compress sidecars";
+    return nullptr;
+  }
+  std::shared_ptr<CompressionCodec> codec;
+  Status s = CompressionCodecManager::GetCodec(type, &codec);
+  if (PREDICT_FALSE(!s.ok() || !codec)) {
+    return nullptr;
+  }
+
+  auto compressed = std::make_shared<std::string>();
+  compressed->resize(codec->MaxCompressedLength(bytes.size()));
+  size_t compressed_len = 0;
+  s = codec->CompressWithStats(
+      Slice(bytes),
+      reinterpret_cast<uint8_t*>(&(*compressed)[0]),
+      &compressed_len);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << LogPrefixUnlocked()
+        << "Unable to compress ops sidecar: " << s.ToString();
+    return nullptr;
+  }
+  if (compressed_len >= bytes.size()) {
+    return nullptr;
+  }
+  compressed->resize(compressed_len);
+  *compression = type;
+  return compressed;
+}
+
 void PeerMessageQueue::UpdateFollowerWatermarks(
     int64_t committed_index,
     int64_t all_replicated_index,
@@ -2233,6 +3026,7 @@ void PeerMessageQueue::UpdateFollowerWatermarks(
   if (region_durable_index > queue_state_.region_durable_index)
     queue_state_.region_durable_index = region_durable_index;
 
+  PublishWatermarksUnlocked();
   UpdateMetricsUnlocked();
 }
 
@@ -2248,6 +3042,8 @@ void PeerMessageQueue::UpdatePeerStatus(
     const string& peer_uuid,
     PeerStatus ps,
     const Status& status) {
+  // Waiters time out even if no peer responds.
+  SCOPED_CLEANUP({ MaybeNotifyLeadershipWaiters(); });
   std::unique_lock<simple_mutexlock> l(queue_lock_);
   TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
   if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
@@ -2255,7 +3051,16 @@ void PeerMessageQueue::UpdatePeerStatus(
             << " is no longer tracked or queue is not in leader mode";
     return;
   }
+  if ((peer->last_exchange_status == PeerStatus::OK) !=
+      (ps == PeerStatus::OK)) {
+    watermark_inputs_changed_ = true;
+  }
   peer->last_exchange_status = ps;
+  if (ps != PeerStatus::OK) {
+    // As in DoResponseFromPeer(), rewind past any requests still in flight.
+    peer->pipeline_next_index = peer->next_index;
+    peer->min_valid_response_seq = peer->next_request_seq;
+  }
 
   if (ps != PeerStatus::RPC_LAYER_ERROR) {
     // So long as we got _any_ response from the follower, we consider it a
@@ -2288,7 +3093,9 @@ void PeerMessageQueue::UpdatePeerStatus(
 
     case PeerStatus::TABLET_FAILED: {
       peer->incr_consecutive_failures();
-      UpdatePeerHealthUnlocked(peer);
+      if (!PeerHealthEvaluatedInBackground()) {
+        UpdatePeerHealthUnlocked(peer);
+      }
       return;
     }
 
@@ -2316,7 +3123,7 @@ void PeerMessageQueue::UpdatePeerStatus(
 
 void PeerMessageQueue::UpdateExchangeStatus(
     TrackedPeer* peer,
-    const TrackedPeer& prev_peer_state,
+    const PeerExchangeState& prev_peer_state,
     const ConsensusResponsePB& response,
     bool* lmp_mismatch) {
   DCHECK(queue_lock_.is_locked());
@@ -2329,6 +3136,9 @@ void PeerMessageQueue::UpdateExchangeStatus(
   if (PREDICT_TRUE(!status.has_error())) {
     peer->last_exchange_status = PeerStatus::OK;
     peer->last_successful_exchange = now;
+    if (peer->replication_stats) {
+      peer->replication_stats->RecordResponse(now);
+    }
     peer->reset_consecutive_failures();
     *lmp_mismatch = false;
     if (peer->should_send_compression_dict) {
@@ -2346,11 +3156,25 @@ void PeerMessageQueue::UpdateExchangeStatus(
       peer->last_exchange_status = PeerStatus::LMP_MISMATCH;
       DCHECK(status.has_last_received());
       if (prev_peer_state.last_exchange_status == PeerStatus::NEW) {
-        LOG_WITH_PREFIX_UNLOCKED(INFO)
-            << "Connected to new peer: " << peer->ToString();
+        KLOG_BINARY_WITH_PREFIX(
+            INFO,
+            "Connected to new peer: $0, Last received: $1.$2, "
+            "Next index: $3, Last known committed idx: $4",
+            peer->uuid(),
+            peer->last_received.term(),
+            peer->last_received.index(),
+            peer->next_index,
+            peer->last_known_committed_index);
       } else {
-        LOG_WITH_PREFIX_UNLOCKED(INFO)
-            << "Got LMP mismatch error from peer: " << peer->ToString();
+        KLOG_BINARY_WITH_PREFIX(
+            INFO,
+            "Got LMP mismatch error from peer: $0, Last received: $1.$2, "
+            "Next index: $3, Last known committed idx: $4",
+            peer->uuid(),
+            peer->last_received.term(),
+            peer->last_received.index(),
+            peer->next_index,
+            peer->last_known_committed_index);
       }
       *lmp_mismatch = true;
       return;
@@ -2358,8 +3182,11 @@ void PeerMessageQueue::UpdateExchangeStatus(
     case ConsensusErrorPB::INVALID_TERM:
       peer->last_exchange_status = PeerStatus::INVALID_TERM;
       CHECK(response.has_responder_term());
-      LOG_WITH_PREFIX_UNLOCKED(INFO)
-          << "Peer responded invalid term: " << peer->ToString();
+      KLOG_BINARY_WITH_PREFIX(
+          INFO,
+          "Peer responded invalid term: $0, Responder term: $1",
+          peer->uuid(),
+          response.responder_term());
       NotifyObserversOfTermChange(response.responder_term());
       *lmp_mismatch = false;
       return;
@@ -2376,7 +3203,7 @@ void PeerMessageQueue::UpdateExchangeStatus(
 
 void PeerMessageQueue::PromoteIfNeeded(
     TrackedPeer* peer,
-    const TrackedPeer& prev_peer_state,
+    const PeerExchangeState& prev_peer_state,
     const ConsensusStatusPB& status) {
   DCHECK(queue_lock_.is_locked());
   if (queue_state_.mode != PeerMessageQueue::LEADER ||
@@ -2386,10 +3213,9 @@ void PeerMessageQueue::PromoteIfNeeded(
 
   // TODO(mpercy): It would be more efficient to cache the member type in the
   // TrackedPeer data structure.
-  RaftPeerPB* peer_pb;
-  Status s = GetRaftConfigMember(
-      DCHECK_NOTNULL(queue_state_.active_config.get()), peer->uuid(), &peer_pb);
-  if (s.ok() && peer_pb->member_type() == RaftPeerPB::NON_VOTER &&
+  const RaftPeerPB* peer_pb =
+      DCHECK_NOTNULL(queue_state_.active_config.get())->FindPeer(peer->uuid());
+  if (peer_pb != nullptr && peer_pb->member_type() == RaftPeerPB::NON_VOTER &&
       peer_pb->attrs().promote()) {
     // Only promote the peer if it is within one round-trip of being fully
     // caught-up with the current commit index, as measured by recent
@@ -2418,7 +3244,7 @@ void PeerMessageQueue::PromoteIfNeeded(
 
 bool PeerMessageQueue::BasicChecksOKToTransferAndGetPeerUnlocked(
     const TrackedPeer& peer,
-    RaftPeerPB** peer_pb_ptr) {
+    const RaftPeerPB** peer_pb_ptr) {
   DCHECK(queue_lock_.is_locked());
 
   // This check is redundant for ResponseFromPeer common path
@@ -2441,13 +3267,12 @@ bool PeerMessageQueue::BasicChecksOKToTransferAndGetPeerUnlocked(
     return false;
   }
 
-  Status s = GetRaftConfigMember(
-      DCHECK_NOTNULL(queue_state_.active_config.get()),
-      peer.uuid(),
-      peer_pb_ptr);
-  if (!s.ok()) {
+  *peer_pb_ptr =
+      DCHECK_NOTNULL(queue_state_.active_config.get())->FindPeer(peer.uuid());
+  if (*peer_pb_ptr == nullptr) {
     LOG_WITH_PREFIX_UNLOCKED(WARNING)
-        << "Unable to get target peer " << peer.uuid() << ":" << s.ToString();
+        << "Unable to get target peer " << peer.uuid()
+        << ": not found in consensus config";
     return false;
   }
 
@@ -2468,7 +3293,7 @@ bool PeerMessageQueue::PeerTransferLeadershipImmediatelyUnlocked(
     return false;
   }
 
-  RaftPeerPB* peer_pb = nullptr;
+  const RaftPeerPB* peer_pb = nullptr;
   if (!BasicChecksOKToTransferAndGetPeerUnlocked(*peer, &peer_pb)) {
     return false;
   }
@@ -2511,6 +3336,81 @@ void PeerMessageQueue::SetPeerRpcStartTime(
   }
 }
 
+void PeerMessageQueue::RecordPeerDeliveryUnlocked(
+    TrackedPeer* peer,
+    MonoDelta rtt,
+    int64_t ops_bytes) {
+  DCHECK(queue_lock_.is_locked());
+  // Each sample spans at least a round trip, so that it counts all the
+  // requests in flight at once.
+  const MonoTime now = MonoTime::Now();
+  if (!peer->delivery_sample_start.Initialized()) {
+    peer->delivery_sample_start = now - rtt;
+  }
+  peer->delivered_bytes += ops_bytes;
+  const int64_t elapsed_us =
+      (now - peer->delivery_sample_start).ToMicroseconds();
+  if (elapsed_us < std::max<int64_t>(peer->rtt_us, 1)) {
+    return;
+  }
+  const int64_t sample =
+      peer->delivered_bytes * MonoTime::kMicrosecondsPerSecond / elapsed_us;
+  peer->delivery_rate_bytes_per_sec = peer->delivery_rate_bytes_per_sec < 0
+      ? sample
+      : (3 * peer->delivery_rate_bytes_per_sec + sample) / 4;
+  peer->delivered_bytes = 0;
+  peer->delivery_sample_start = now;
+}
+
+void PeerMessageQueue::RecordPeerRoundTrip(
+    const std::string& peer_uuid,
+    MonoDelta rtt,
+    int64_t ops_bytes) {
+  std::lock_guard<simple_mutexlock> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
+  if (PREDICT_FALSE(peer == nullptr)) {
+    return;
+  }
+  // Smooth as TCP does, giving the latest sample a weight of 1/8.
+  int64_t sample_us = rtt.ToMicroseconds();
+  peer->rtt_us = peer->rtt_us < 0 ? sample_us
+                                  : (7 * peer->rtt_us + sample_us) / 8;
+  if (peer->replication_stats) {
+    peer->replication_stats->RecordRoundTrip(rtt);
+  }
+  if (FLAGS_raft_adaptive_batch_size) {
+    RecordPeerDeliveryUnlocked(peer, rtt, ops_bytes);
+  }
+
+  if (routing_table_container_->GetProxyPolicy() !=
+      ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  if (last_route_stats_update_.Initialized() &&
+      now - last_route_stats_update_ <
+          MonoDelta::FromMilliseconds(
+              FLAGS_raft_latency_routing_min_rebuild_interval_ms)) {
+    return;
+  }
+  last_route_stats_update_ = now;
+
+  auto max_unreachable =
+      MonoDelta::FromMilliseconds(proxy_failure_threshold_ms_);
+  unordered_map<string, PeerRouteStats> stats;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* tracked = entry.second;
+    PeerRouteStats& s = stats[entry.first];
+    s.rtt_us = tracked->rtt_us;
+    s.lag_ops = std::max<int64_t>(
+        queue_state_.last_appended.index() - tracked->last_received.index(),
+        0);
+    s.reachable = time_provider_->Now() - tracked->last_successful_exchange <=
+        max_unreachable;
+  }
+  routing_table_container_->UpdatePeerStats(std::move(stats));
+}
+
 void PeerMessageQueue::TransferLeadershipIfNeeded(
     const TrackedPeer& peer,
     const ConsensusStatusPB& status) {
@@ -2524,7 +3424,7 @@ void PeerMessageQueue::TransferLeadershipIfNeeded(
     return;
   }
 
-  RaftPeerPB* peer_pb = nullptr;
+  const RaftPeerPB* peer_pb = nullptr;
   if (!BasicChecksOKToTransferAndGetPeerUnlocked(peer, &peer_pb)) {
     return;
   }
@@ -2559,27 +3459,44 @@ void PeerMessageQueue::TransferLeadershipIfNeeded(
           << "the leader at OpId "
           << OpIdToString(status.last_received_current_leader());
   successor_watch_in_progress_ = false;
+  active_transfer_successor_ = boost::none;
   NotifyObserversOfSuccessor(peer.uuid());
 }
 
+PeerMessageQueue::TrackedPeer* PeerMessageQueue::FindPeerUnlocked(
+    PeerId peer_id) const {
+  DCHECK(queue_lock_.is_locked());
+  return peer_id < peers_by_id_.size() ? peers_by_id_[peer_id] : nullptr;
+}
+
 bool PeerMessageQueue::ResponseFromPeer(
     const std::string& peer_uuid,
-    const ConsensusResponsePB& response) {
+    const ConsensusResponsePB& response,
+    int64_t request_seq) {
+  return ResponseFromPeer(FindPeerId(peer_uuid), response, request_seq);
+}
+
+bool PeerMessageQueue::ResponseFromPeer(
+    PeerId peer_id,
+    const ConsensusResponsePB& response,
+    int64_t request_seq) {
   boost::optional<int64_t> updated_commit_index;
-  const bool ret =
-      DoResponseFromPeer(peer_uuid, response, updated_commit_index);
+  const bool ret = DoResponseFromPeer(
+      peer_id, response, updated_commit_index, request_seq);
 
   if (updated_commit_index != boost::none) {
     NotifyObserversOfCommitIndexChange(*updated_commit_index);
   }
+  MaybeNotifyLeadershipWaiters();
 
   return ret;
 }
 
 bool PeerMessageQueue::DoResponseFromPeer(
-    const std::string& peer_uuid,
+    PeerId peer_id,
     const ConsensusResponsePB& response,
-    boost::optional<int64_t>& updated_commit_index) {
+    boost::optional<int64_t>& updated_commit_index,
+    int64_t request_seq) {
   DCHECK(response.IsInitialized())
       << "Error: Uninitialized: " << response.InitializationErrorString()
       << ". Response: " << SecureShortDebugString(response);
@@ -2587,8 +3504,17 @@ bool PeerMessageQueue::DoResponseFromPeer(
   CHECK(!response.has_error());
 #endif
 
+  // Looking the peer's last-received op up in the log may fall through to the
+  // log index on disk, so do it before taking 'queue_lock_'. The log is not
+  // truncated under 'queue_lock_' either (see TruncateOpsAfter()), so doing
+  // the lookup here sees the same log as doing it under the lock would.
+  const bool peer_has_prefix_of_log =
+      response.has_status() && response.status().has_last_received() &&
+      IsOpInLog(response.status().last_received());
+
   bool send_more_immediately = false;
   Mode mode_copy;
+  boost::optional<int64_t> evict_through_index;
   {
     std::lock_guard<simple_mutexlock> scoped_lock(queue_lock_);
 
@@ -2596,7 +3522,7 @@ bool PeerMessageQueue::DoResponseFromPeer(
     // For now, we'll try to ignore proxying here, but we may need to
     // eventually handle that here for better health status and error logging.
 
-    TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
+    TrackedPeer* peer = FindPeerUnlocked(peer_id);
     if (PREDICT_FALSE(queue_state_.state != kQueueOpen || peer == nullptr)) {
       LOG_WITH_PREFIX_UNLOCKED(WARNING)
           << "Queue is closed or peer was untracked, disregarding "
@@ -2605,6 +3531,20 @@ bool PeerMessageQueue::DoResponseFromPeer(
       return send_more_immediately;
     }
 
+    if (request_seq >= 0) {
+      // With several requests in flight, a response may overtake an earlier
+      // one. The later response reflects at least as much of the peer's log,
+      // so the earlier one is dropped. So are responses to requests sent
+      // before a rewind.
+      if (request_seq < peer->min_valid_response_seq) {
+        VLOG_WITH_PREFIX_UNLOCKED(2)
+            << "Dropping stale response " << request_seq << " from peer "
+            << peer->uuid();
+        return send_more_immediately;
+      }
+      peer->min_valid_response_seq = request_seq + 1;
+    }
+
     // Sanity checks.
     // Some of these can be eventually removed, but they are handy for now.
     DCHECK(response.status().IsInitialized())
@@ -2628,7 +3568,8 @@ bool PeerMessageQueue::DoResponseFromPeer(
     DCHECK(status.has_last_committed_idx());
 
     // Take a snapshot of the previously-recorded peer state.
-    const TrackedPeer prev_peer_state = *peer;
+    const PeerExchangeState prev_peer_state{
+        peer->last_exchange_status, peer->last_received};
 
     // Update the peer's last exchange status based on the response.
     // In this case, if there is a log matching property (LMP) mismatch, we
@@ -2636,6 +3577,7 @@ bool PeerMessageQueue::DoResponseFromPeer(
     // offset between the local leader and the remote peer.
     UpdateExchangeStatus(
         peer, prev_peer_state, response, &send_more_immediately);
+    peer->load_percent = std::min<uint32_t>(response.load_percent(), 100);
 
     // If the reported last-received op for the replica is in our local log,
     // then resume sending entries from that point onward. Otherwise, resume
@@ -2643,7 +3585,6 @@ bool PeerMessageQueue::DoResponseFromPeer(
     // sent them anything, start after the last-committed op in their log, which
     // is guaranteed by the Raft protocol to be a valid op.
 
-    bool peer_has_prefix_of_log = IsOpInLog(status.last_received());
     if (peer_has_prefix_of_log) {
       // If the latest thing in their log is in our log, we are in sync.
       peer->last_received = status.last_received();
@@ -2670,21 +3611,36 @@ bool PeerMessageQueue::DoResponseFromPeer(
       // the hope that doing so will result in a faster catch-up process.
       DCHECK_GE(peer->last_known_committed_index, 0);
       peer->next_index = peer->last_known_committed_index + 1;
-      LOG_WITH_PREFIX_UNLOCKED(INFO)
-          << "Peer " << peer_uuid << " log is divergent from this leader: "
-          << "its last log entry " << OpIdToString(status.last_received())
-          << " is not in "
-          << "this leader's log and it has not received anything from this leader yet. "
-          << "Falling back to committed index "
-          << peer->last_known_committed_index;
+      KLOG_BINARY_WITH_PREFIX(
+          INFO,
+          "Peer $0 log is divergent from this leader: its last log entry "
+          "$1.$2 is not in this leader's log and it has not received "
+          "anything from this leader yet. Falling back to committed index $3",
+          peer->uuid(),
+          status.last_received().term(),
+          status.last_received().index(),
+          peer->last_known_committed_index);
     }
 
     if (peer->last_exchange_status != PeerStatus::OK) {
+      // Any requests still in flight were built on the assumption that this
+      // one would succeed, so rewind to where the peer actually is and
+      // disregard their responses.
+      peer->pipeline_next_index = peer->next_index;
+      peer->min_valid_response_seq = peer->next_request_seq;
+
+      // The peer no longer counts towards the watermarks.
+      if (prev_peer_state.last_exchange_status == PeerStatus::OK) {
+        watermark_inputs_changed_ = true;
+      }
+
       // In this case, 'send_more_immediately' has already been set by
       // UpdateExchangeStatus() to true in the case of an LMP mismatch, false
       // otherwise.
       return send_more_immediately;
     }
+    peer->pipeline_next_index =
+        std::max(peer->pipeline_next_index, peer->next_index);
 
     if (response.has_responder_term()) {
       // The peer must have responded with a term that is greater than or equal
@@ -2706,7 +3662,9 @@ bool PeerMessageQueue::DoResponseFromPeer(
       if (FLAGS_enable_raft_leader_lease && response.has_lease_granted() &&
           response.lease_granted()) {
         peer->lease_granted = peer->last_received;
+        peer->lease_granted_rpc_start = peer->rpc_start_;
       }
+      peer->accepted_rpc_start = peer->rpc_start_;
 
       if (FLAGS_enable_bounded_dataloss_window) {
         peer->bounded_dataloss_window_acked = peer->last_received;
@@ -2723,9 +3681,22 @@ bool PeerMessageQueue::DoResponseFromPeer(
     int64_t old_all_replicated_index = 0;
     int64_t new_all_replicated_index = 0;
 
+    // The watermarks are a function of the OK peers' last-received indexes
+    // (and of config state that sets 'watermark_inputs_changed_'), so they
+    // only need recomputing when this peer's index or OK-ness changed.
+    const bool recompute_watermarks = watermark_inputs_changed_ ||
+        prev_peer_state.last_exchange_status != PeerStatus::OK ||
+        prev_peer_state.last_received.index() != peer->last_received.index();
+
+    if (mode_copy == LEADER && recompute_watermarks) {
+      watermark_inputs_changed_ = false;
+    }
+
     if (mode_copy == LEADER) {
       // Advance the majority replicated index.
-      if (!FLAGS_enable_flexi_raft) {
+      if (!recompute_watermarks) {
+        // Nothing the watermarks depend on has changed.
+      } else if (queue_state_.quorum_engine == VANILLA_MAJORITY) {
         AdvanceQueueWatermark(
             "majority_replicated",
             &queue_state_.majority_replicated_index,
@@ -2756,14 +3727,16 @@ bool PeerMessageQueue::DoResponseFromPeer(
       old_all_replicated_index = queue_state_.all_replicated_index;
 
       // Advance the all replicated index.
-      AdvanceQueueWatermark(
-          "all_replicated",
-          &queue_state_.all_replicated_index,
-          /*replicated_before=*/prev_peer_state.last_received,
-          /*replicated_after=*/peer->last_received,
-          /*num_peers_required=*/peers_map_.size(),
-          ALL_REPLICAS,
-          peer);
+      if (recompute_watermarks) {
+        AdvanceQueueWatermark(
+            "all_replicated",
+            &queue_state_.all_replicated_index,
+            /*replicated_before=*/prev_peer_state.last_received,
+            /*replicated_after=*/peer->last_received,
+            /*num_peers_required=*/peers_map_.size(),
+            ALL_REPLICAS,
+            peer);
+      }
 
       new_all_replicated_index = queue_state_.all_replicated_index;
 
@@ -2784,18 +3757,8 @@ bool PeerMessageQueue::DoResponseFromPeer(
               queue_state_.committed_index) {
         queue_state_.committed_index = queue_state_.majority_replicated_index;
 
-        if (FLAGS_enable_raft_leader_lease && response.has_lease_granted()) {
-          // Check for Quorum of lease renewal approvals from followers
-          QuorumResults qresults;
-          if (CanLeaderLeaseRenewUnlocked(qresults)) {
-            leader_lease_until_.store(std::max(
-                leader_lease_until_.load(),
-                GetQuorumMajorityOfPeerRpcStarts(qresults) +
-                    LeaderLeaseTimeout()));
-          }
-        }
-
-        if (FLAGS_enable_bounded_dataloss_window) {
+        if (FLAGS_enable_bounded_dataloss_window &&
+            FLAGS_bounded_dataloss_window_renewal_interval_ms <= 0) {
           // Check for Vote Quorum of Bounded DataLoss ACKs from followers
           QuorumResults qresults;
           if (CanBoundedDataLossWindowRenewUnlocked(qresults)) {
@@ -2815,9 +3778,53 @@ bool PeerMessageQueue::DoResponseFromPeer(
             << "current committed_index: " << queue_state_.committed_index;
       }
 
+      // Renew the leader lease on any response that grants it, heartbeats
+      // included, so that an idle ring keeps its lease without extra round
+      // trips. The lease only holds once an op of this term is committed.
+      if (FLAGS_enable_raft_leader_lease && response.has_lease_granted() &&
+          response.lease_granted() &&
+          queue_state_.first_index_in_current_term != boost::none &&
+          queue_state_.committed_index >=
+              *queue_state_.first_index_in_current_term) {
+        // Check for Quorum of lease renewal approvals from followers
+        QuorumResults qresults;
+        if (CanLeaderLeaseRenewUnlocked(qresults)) {
+          leader_lease_until_.store(std::max(
+              leader_lease_until_.load(),
+              GetQuorumMajorityOfPeerRpcStarts(
+                  qresults, &TrackedPeer::lease_granted_rpc_start) +
+                  LeaderLeaseTimeout()));
+        }
+      }
+
+      // Like the lease, renew the window on any response once the term has
+      // committed an op, so that quiescent heartbeats keep an idle ring's
+      // window open. Checking the quorum of ACKs scans the peers, so it's
+      // done only once the last renewal is old enough.
+      if (FLAGS_enable_bounded_dataloss_window &&
+          FLAGS_bounded_dataloss_window_renewal_interval_ms > 0 &&
+          peer->last_exchange_status == PeerStatus::OK &&
+          queue_state_.first_index_in_current_term != boost::none &&
+          queue_state_.committed_index >=
+              *queue_state_.first_index_in_current_term) {
+        const MonoTime now = time_provider_->Now();
+        QuorumResults qresults;
+        if (now >= next_bounded_dataloss_window_renewal_ &&
+            CanBoundedDataLossWindowRenewUnlocked(qresults)) {
+          bounded_dataloss_window_until_.store(std::max(
+              bounded_dataloss_window_until_.load(),
+              GetMaximumOfPeerRpcStarts(qresults) +
+                  BoundedDataLossDefaultWindowInMsec()));
+          next_bounded_dataloss_window_renewal_ = now +
+              MonoDelta::FromMilliseconds(
+                  FLAGS_bounded_dataloss_window_renewal_interval_ms);
+        }
+      }
+
       // Once the commit index has been updated, go ahead and update the
       // region_durable_index
       AdvanceQueueRegionDurableIndex();
+      PublishWatermarksUnlocked();
 
       // Only notify observers if the commit index actually changed.
       if (mode_copy == LEADER &&
@@ -2834,29 +3841,37 @@ bool PeerMessageQueue::DoResponseFromPeer(
     // the next request for the peer, set 'send_more_immediately' to true.
     send_more_immediately =
         peer->last_known_committed_index < queue_state_.committed_index ||
-        log_cache_.HasOpBeenWritten(peer->next_index);
+        log_cache_.HasOpBeenWritten(peer->pipeline_next_index);
 
     // Evict ops from log_cache only if:
     // 1. This is not a leader node OR
     // 2. 'all_replicated_index' has changed after processing this response
+    // The eviction itself happens once 'queue_lock_' is released: it only
+    // needs the log cache's own lock, and freeing the evicted ops can take a
+    // while.
     if (mode_copy != LEADER ||
         (old_all_replicated_index != new_all_replicated_index)) {
-      log_cache_.EvictThroughOp(queue_state_.all_replicated_index);
+      evict_through_index = queue_state_.all_replicated_index;
     }
 
     UpdateMetricsUnlocked();
   }
 
+  if (evict_through_index != boost::none) {
+    log_cache_.EvictThroughOp(*evict_through_index);
+  }
+
   return send_more_immediately;
 }
 
 MonoTime PeerMessageQueue::GetQuorumMajorityOfPeerRpcStarts(
-    QuorumResults& qresults) {
+    QuorumResults& qresults,
+    MonoTime TrackedPeer::*rpc_start) {
   MonoTime result = MonoTime::Min();
   std::vector<MonoTime> rpc_starts;
   rpc_starts.reserve(qresults.quorum_peers.size());
   for (const TrackedPeer* peer : qresults.quorum_peers) {
-    rpc_starts.emplace_back(peer->rpc_start_);
+    rpc_starts.emplace_back(peer->*rpc_start);
   }
 
   // sort rpc_start times in descending order
@@ -2866,10 +3881,12 @@ MonoTime PeerMessageQueue::GetQuorumMajorityOfPeerRpcStarts(
     result = rpc_starts
         [qresults.quorum_size - 1 - 1 /* Leader rpc_start does not exist */];
   } else {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING)
-        << "Unable to run GetQuorumMajorityOfPeerRpcStarts, "
-        << "Quorum size: " << qresults.quorum_size << ". "
-        << "Number of remote peers: " << rpc_starts.size() << ".";
+    KLOG_BINARY_WITH_PREFIX(
+        WARNING,
+        "Unable to run GetQuorumMajorityOfPeerRpcStarts, Quorum size: $0. "
+        "Number of remote peers: $1.",
+        qresults.quorum_size,
+        rpc_starts.size());
   }
   return result;
 }
@@ -2885,13 +3902,94 @@ MonoTime PeerMessageQueue::GetMaximumOfPeerRpcStarts(QuorumResults& qresults) {
   if (rpc_starts.size() > 0) {
     result = *std::max_element(rpc_starts.begin(), rpc_starts.end());
   } else {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING)
-        << "Unable to run GetMaximumOfPeerRpcStarts, "
-        << "Number of remote peers: " << rpc_starts.size() << ".";
+    KLOG_BINARY_WITH_PREFIX(
+        WARNING,
+        "Unable to run GetMaximumOfPeerRpcStarts, "
+        "Number of remote peers: $0.",
+        rpc_starts.size());
   }
   return result;
 }
 
+void PeerMessageQueue::ConfirmLeadershipAsync(
+    MonoTime since,
+    MonoTime deadline,
+    StdStatusCallback done) {
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    leadership_waiters_.push_back({since, deadline, std::move(done)});
+    has_leadership_waiters_.store(true, std::memory_order_release);
+  }
+  // Single voter configs, or a leader that was already confirmed, don't
+  // need to wait for another response.
+  MaybeNotifyLeadershipWaiters();
+}
+
+MonoTime PeerMessageQueue::LeadershipConfirmedUntilUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  const string& local_uuid = local_peer_pb_.permanent_uuid();
+  QuorumResults results = IsQuorumSatisfiedUnlocked(
+      local_peer_pb_, [](const TrackedPeer*) { return true; });
+  if (results.quorum_size <= 1) {
+    return MonoTime::Max();
+  }
+  vector<MonoTime> starts;
+  starts.reserve(results.quorum_peers.size());
+  for (const TrackedPeer* peer : results.quorum_peers) {
+    if (peer->uuid() != local_uuid) {
+      starts.emplace_back(peer->accepted_rpc_start);
+    }
+  }
+  // The leader counts towards the quorum by itself.
+  const size_t needed = results.quorum_size - 1;
+  if (starts.size() < needed) {
+    return MonoTime::Min();
+  }
+  std::nth_element(
+      starts.begin(),
+      starts.begin() + needed - 1,
+      starts.end(),
+      std::greater<>());
+  return starts[needed - 1];
+}
+
+void PeerMessageQueue::MaybeNotifyLeadershipWaiters() {
+  if (!has_leadership_waiters_.load(std::memory_order_acquire)) {
+    return;
+  }
+  vector<std::pair<StdStatusCallback, Status>> ready;
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    const bool leader =
+        queue_state_.state == kQueueOpen && queue_state_.mode == LEADER;
+    const MonoTime confirmed =
+        leader ? LeadershipConfirmedUntilUnlocked() : MonoTime::Min();
+    const MonoTime now = MonoTime::Now();
+    auto keep = leadership_waiters_.begin();
+    for (auto& waiter : leadership_waiters_) {
+      if (!leader) {
+        ready.emplace_back(
+            std::move(waiter.done),
+            Status::IllegalState("no longer the leader"));
+      } else if (waiter.since <= confirmed) {
+        ready.emplace_back(std::move(waiter.done), Status::OK());
+      } else if (now >= waiter.deadline) {
+        ready.emplace_back(
+            std::move(waiter.done),
+            Status::TimedOut("could not confirm leadership in time"));
+      } else {
+        *keep++ = std::move(waiter);
+      }
+    }
+    leadership_waiters_.erase(keep, leadership_waiters_.end());
+    has_leadership_waiters_.store(
+        !leadership_waiters_.empty(), std::memory_order_release);
+  }
+  for (auto& r : ready) {
+    r.first(r.second);
+  }
+}
+
 PeerMessageQueue::TrackedPeer PeerMessageQueue::GetTrackedPeerForTests(
     const string& uuid) {
   std::lock_guard<simple_mutexlock> scoped_lock(queue_lock_);
@@ -2921,9 +4019,11 @@ bool PeerMessageQueue::CanLeaderLeaseRenewUnlocked(QuorumResults& qresults) {
   metrics_.available_leader_lease_grantors->set_value(results.num_satisfied);
 
   if (!results.quorum_satisfied) {
-    LOG(WARNING) << "Lease granted quorum failed. " << results.quorum_size
-                 << " is required lease grant quorum. " << results.num_satisfied
-                 << " peers grants are healthy.";
+    // Checked on every lease granting response, heartbeats included.
+    KLOG_EVERY_N_SECS(WARNING, 10)
+        << "Lease granted quorum failed. " << results.quorum_size
+        << " is required lease grant quorum. " << results.num_satisfied
+        << " peers grants are healthy.";
     return false;
   }
   qresults = std::move(results);
@@ -2959,24 +4059,40 @@ bool PeerMessageQueue::CanBoundedDataLossWindowRenewUnlocked(
 }
 
 int64_t PeerMessageQueue::GetAllReplicatedIndex() const {
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  return queue_state_.all_replicated_index;
+  return all_replicated_index_mirror_.load(std::memory_order_acquire);
 }
 
 int64_t PeerMessageQueue::GetCommittedIndex() const {
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  return queue_state_.committed_index;
+  return committed_index_mirror_.load(std::memory_order_acquire);
 }
 
 int64_t PeerMessageQueue::GetRegionDurableIndex() const {
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  return queue_state_.region_durable_index;
+  return region_durable_index_mirror_.load(std::memory_order_acquire);
 }
 
 bool PeerMessageQueue::IsCommittedIndexInCurrentTerm() const {
-  std::lock_guard<simple_mutexlock> lock(queue_lock_);
-  return queue_state_.first_index_in_current_term != boost::none &&
-      queue_state_.committed_index >= *queue_state_.first_index_in_current_term;
+  // The two mirrors are read separately, so this may briefly pair a new term
+  // with an old committed index. That only ever yields a spurious 'false',
+  // which callers already have to tolerate while the leader catches up.
+  const int64_t first_index =
+      first_index_in_current_term_mirror_.load(std::memory_order_acquire);
+  return first_index >= 0 &&
+      committed_index_mirror_.load(std::memory_order_acquire) >= first_index;
+}
+
+void PeerMessageQueue::PublishWatermarksUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  first_index_in_current_term_mirror_.store(
+      queue_state_.first_index_in_current_term != boost::none
+          ? *queue_state_.first_index_in_current_term
+          : -1,
+      std::memory_order_release);
+  committed_index_mirror_.store(
+      queue_state_.committed_index, std::memory_order_release);
+  all_replicated_index_mirror_.store(
+      queue_state_.all_replicated_index, std::memory_order_release);
+  region_durable_index_mirror_.store(
+      queue_state_.region_durable_index, std::memory_order_release);
 }
 
 bool PeerMessageQueue::IsInLeaderMode() const {
@@ -3032,12 +4148,14 @@ void PeerMessageQueue::DumpToStringsUnlocked(vector<string>* lines) const {
 void PeerMessageQueue::ClearUnlocked() {
   DCHECK(queue_lock_.is_locked());
   STLDeleteValues(&peers_map_);
+  peers_by_id_.clear();
   queue_state_.state = kQueueClosed;
 }
 
 void PeerMessageQueue::Close() {
   raft_pool_observers_token_->Shutdown();
 
+  SCOPED_CLEANUP({ MaybeNotifyLeadershipWaiters(); });
   std::lock_guard<simple_mutexlock> lock(queue_lock_);
   ClearUnlocked();
   // Reset here to appease folly::Singleton's check for leaky references
@@ -3109,6 +4227,16 @@ void PeerMessageQueue::NotifyObserversOfCommitIndexChange(
   }
   // NOTE: if we're scheduling this to run async we always need to lock, so we
   // ignore the needs_lock param
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    NotifyObserversOfLatest(
+        &commit_index_notification_,
+        new_commit_index,
+        [](PeerMessageQueueObserver* observer, int64_t commit_index) {
+          observer->NotifyCommitIndex(commit_index, true);
+        },
+        "commit index change");
+    return;
+  }
   WARN_NOT_OK(
       raft_pool_observers_token_->SubmitClosure(Bind(
           &PeerMessageQueue::NotifyObserversTask,
@@ -3121,6 +4249,16 @@ void PeerMessageQueue::NotifyObserversOfCommitIndexChange(
 }
 
 void PeerMessageQueue::NotifyObserversOfTermChange(int64_t term) {
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    NotifyObserversOfLatest(
+        &term_notification_,
+        term,
+        [](PeerMessageQueueObserver* observer, int64_t latest_term) {
+          observer->NotifyTermChange(latest_term);
+        },
+        "term change");
+    return;
+  }
   WARN_NOT_OK(
       raft_pool_observers_token_->SubmitClosure(Bind(
           &PeerMessageQueue::NotifyObserversTask,
@@ -3146,6 +4284,40 @@ void PeerMessageQueue::NotifyObserversOfFailedFollower(
           "Unable to notify RaftConsensus of abandoned follower.");
 }
 
+void PeerMessageQueue::MaybeNotifyPeerNeedsSnapshot(
+    const string& uuid,
+    int64_t next_index) {
+  const MonoTime now = MonoTime::Now();
+  {
+    std::lock_guard<simple_mutexlock> lock(queue_lock_);
+    TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+    if (peer == nullptr || queue_state_.mode != LEADER) {
+      return;
+    }
+    if (peer->last_snapshot_catchup_notify.Initialized() &&
+        (now - peer->last_snapshot_catchup_notify).ToMilliseconds() <
+            FLAGS_raft_snapshot_catchup_notify_interval_ms) {
+      return;
+    }
+    peer->last_snapshot_catchup_notify = now;
+  }
+  NotifyObserversOfPeerNeedsSnapshot(uuid, next_index);
+}
+
+void PeerMessageQueue::NotifyObserversOfPeerNeedsSnapshot(
+    const string& uuid,
+    int64_t next_index) {
+  WARN_NOT_OK(
+      raft_pool_observers_token_->SubmitClosure(Bind(
+          &PeerMessageQueue::NotifyObserversTask,
+          Unretained(this),
+          [=](PeerMessageQueueObserver* observer) {
+            observer->NotifyPeerNeedsSnapshot(uuid, next_index);
+          })),
+      LogPrefixUnlocked() +
+          "Unable to notify RaftConsensus of a peer needing a snapshot.");
+}
+
 void PeerMessageQueue::NotifyObserversOfPeerToPromote(const string& peer_uuid) {
   WARN_NOT_OK(
       raft_pool_observers_token_->SubmitClosure(Bind(
@@ -3188,7 +4360,7 @@ Status PeerMessageQueue::GetSnapshotForMockElection(
     return Status::IllegalState("Target peer is not tracked.");
   }
 
-  RaftPeerPB* peer_pb = nullptr;
+  const RaftPeerPB* peer_pb = nullptr;
   if (!BasicChecksOKToTransferAndGetPeerUnlocked(*peer, &peer_pb)) {
     return Status::IllegalState("Failed basic leadership transfer checks.");
   }
@@ -3199,6 +4371,17 @@ Status PeerMessageQueue::GetSnapshotForMockElection(
 }
 
 void PeerMessageQueue::NotifyObserversOfPeerHealthChange() {
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    // The notification carries no value; any pending one covers this change.
+    NotifyObserversOfLatest(
+        &peer_health_notification_,
+        0,
+        [](PeerMessageQueueObserver* observer, int64_t /*unused*/) {
+          observer->NotifyPeerHealthChange();
+        },
+        "peer health change");
+    return;
+  }
   WARN_NOT_OK(
       raft_pool_observers_token_->SubmitClosure(Bind(
           &PeerMessageQueue::NotifyObserversTask,
@@ -3224,6 +4407,35 @@ void PeerMessageQueue::NotifyObserversTask(
   }
 }
 
+void PeerMessageQueue::NotifyObserversOfLatest(
+    LatestValueDebouncer* debouncer,
+    int64_t value,
+    const std::function<void(PeerMessageQueueObserver*, int64_t)>& func,
+    const char* what) {
+  if (!debouncer->Post(value)) {
+    return;
+  }
+  WARN_NOT_OK(
+      raft_pool_observers_token_->SubmitClosure(Bind(
+          &PeerMessageQueue::NotifyObserversOfLatestTask,
+          Unretained(this),
+          Unretained(debouncer),
+          func)),
+      LogPrefixUnlocked() + "Unable to notify RaftConsensus of " + what +
+          ".");
+}
+
+void PeerMessageQueue::NotifyObserversOfLatestTask(
+    LatestValueDebouncer* debouncer,
+    const std::function<void(PeerMessageQueueObserver*, int64_t)>& func) {
+  const int64_t value = debouncer->Take();
+  if (value == LatestValueDebouncer::kNone) {
+    return;
+  }
+  NotifyObserversTask(
+      [&](PeerMessageQueueObserver* observer) { func(observer, value); });
+}
+
 PeerMessageQueue::~PeerMessageQueue() {
   Close();
 }
@@ -3255,13 +4467,14 @@ string PeerMessageQueue::QueueState::ToString() const {
       state,
       (mode == LEADER ? "LEADER" : "NON_LEADER"),
       active_config
-          ? ", active raft config: " + SecureShortDebugString(*active_config)
+          ? ", active raft config: " +
+              SecureShortDebugString(active_config->config())
           : "");
 }
 
 const std::string& PeerMessageQueue::getQuorumIdUsingCommitRule(
     const RaftPeerPB& peer) const {
-  return GetQuorumId(peer, queue_state_.active_config->commit_rule());
+  return GetQuorumId(peer, queue_state_.active_config->config().commit_rule());
 }
 
 void PeerMessageQueue::UpdatePeerQuorumIdUnlocked(
@@ -3290,7 +4503,7 @@ bool PeerMessageQueue::CheckQuorum() {
   }
 
   // We only support check quorum for Single Region Dynamic for now.
-  if (queue_state_.active_config->commit_rule().mode() !=
+  if (queue_state_.active_config->config().commit_rule().mode() !=
       QuorumMode::SINGLE_REGION_DYNAMIC) {
     return true;
   }
@@ -3357,7 +4570,7 @@ int32_t PeerMessageQueue::GetAvailableCommitPeers() {
 
   // We only support getting available commit peers for Single Region Dynamic
   // for now.
-  if (queue_state_.active_config->commit_rule().mode() !=
+  if (queue_state_.active_config->config().commit_rule().mode() !=
       QuorumMode::SINGLE_REGION_DYNAMIC) {
     return -1;
   }
@@ -3395,7 +4608,7 @@ Status PeerMessageQueue::GetQuorumHealthForFlexiRaftUnlocked(
 
     quorum_id_health.num_vd_voters =
         GetTotalVotersFromVoterDistribution(
-            *(queue_state_.active_config), quorum_id)
+            queue_state_.active_config->config(), quorum_id)
             .value_or(0);
     quorum_id_health.quorum_size = MajoritySize(quorum_id_health.num_vd_voters);
 
@@ -23,7 +23,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iosfwd>
 #include <memory>
@@ -36,18 +38,25 @@
 #include <glog/logging.h>
 #include <gtest/gtest_prod.h>
 
+#include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/flags_layering.h"
 #include "kudu/consensus/log_cache.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/peer_ids.h"
 #include "kudu/consensus/peer_message_buffer.h"
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_resource_accounting.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/consensus/time_manager.h"
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/threading/thread_collision_warner.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/debouncer.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -60,12 +69,16 @@ DECLARE_bool(buffer_messages_between_rpcs);
 DECLARE_int32(consensus_rpc_timeout_ms);
 DECLARE_bool(enable_bounded_dataloss_window);
 DECLARE_bool(enable_flexi_raft);
+DECLARE_int32(raft_max_inflight_requests_per_peer);
 DECLARE_bool(enable_raft_leader_lease);
 DECLARE_int32(raft_leader_lease_interval_ms);
 DECLARE_bool(raft_prepare_replacement_before_eviction);
+DECLARE_bool(raft_proxy_relay_ops);
 
 namespace kudu {
+class LockProfile;
 class ThreadPoolToken;
+class Throttler;
 
 namespace log {
 class Log;
@@ -80,6 +93,7 @@ class ConsensusRequestPB;
 class ConsensusResponsePB;
 class ConsensusStatusPB;
 class PeerMessageQueueObserver;
+class PeerReplicationStats;
 class ReplicateMsgWrapper;
 #ifdef FB_DO_NOT_REMOVE
 class StartTabletCopyRequestPB;
@@ -162,12 +176,27 @@ class PeerMessageQueue {
 
     std::string ToString() const;
 
-    RaftPeerPB peer_pb;
+    // The fields up to 'rpc_start_' change on every exchange with the peer,
+    // so they come first and share as few cache lines as possible; the rest
+    // change rarely.
 
     // Next index to send to the peer.
     // This corresponds to "nextIndex" as specified in Raft.
     int64_t next_index;
 
+    // With --raft_max_inflight_requests_per_peer > 1, the index the next
+    // request starts at, which runs ahead of 'next_index' by the ops of the
+    // requests in flight. Reset to 'next_index' whenever a request fails.
+    int64_t pipeline_next_index = 0;
+
+    // Requests to the peer are numbered in the order they are built, starting
+    // from 0; this is the number of the next one. Responses to requests
+    // numbered below 'min_valid_response_seq' are disregarded, because a
+    // later response has already been handled or because they were sent
+    // before a rewind.
+    int64_t next_request_seq = 0;
+    int64_t min_valid_response_seq = 0;
+
     // The last operation that we've sent to this peer and that
     // it acked. Used for watermark movement.
     OpId last_received;
@@ -205,10 +234,28 @@ class PeerMessageQueue {
     // Leader Leases: captures UpdateConsensus rpc start time for each peer
     MonoTime rpc_start_;
 
+    RaftPeerPB peer_pb;
+
+    // The interned id of the peer's UUID.
+    PeerId peer_id = kInvalidPeerId;
+
+    // The rpc start time of the last request the peer granted the leader
+    // lease on. Unlike 'rpc_start_', not moved forward by failed requests.
+    MonoTime lease_granted_rpc_start;
+
+    // The rpc start time of the last request the peer accepted. Only kept
+    // up to date while leadership confirmations are pending, see
+    // ConfirmLeadershipAsync().
+    MonoTime accepted_rpc_start;
+
     // Set to false if it is determined that the remote peer has fallen behind
     // the local peer's WAL.
     bool wal_catchup_possible;
 
+    // When observers were last told that this peer needs a snapshot to catch
+    // up, see --raft_snapshot_catchup_notify_interval_ms.
+    MonoTime last_snapshot_catchup_notify;
+
     // Should we send compression dictionary in the next request to this peer?
     bool should_send_compression_dict = true;
 
@@ -224,6 +271,39 @@ class PeerMessageQueue {
 
     std::shared_ptr<PeerMessageBuffer> peer_msg_buffer;
 
+    // Limits how fast batches are sent while this peer catches up (see
+    // --raft_catchup_throttle_bytes_per_sec), built with the limits below
+    // and rebuilt when the flags change.
+    std::shared_ptr<Throttler> catchup_throttler;
+    int64_t catchup_throttler_bytes_per_sec = 0;
+    int64_t catchup_throttler_batches_per_sec = 0;
+
+    // Smoothed round-trip time of direct UpdateConsensus requests to this
+    // peer, or -1 if there is none yet.
+    int64_t rtt_us = -1;
+
+    // With --raft_adaptive_batch_size, the smoothed rate in bytes per second
+    // at which direct requests deliver ops to this peer, or -1 if there is
+    // none yet, and the bytes delivered since 'delivery_sample_start' towards
+    // the next sample.
+    int64_t delivery_rate_bytes_per_sec = -1;
+    int64_t delivered_bytes = 0;
+    MonoTime delivery_sample_start;
+
+    // The load the peer reported in its last response, from 0 to 100. Its
+    // batches are shrunk in proportion.
+    int32_t load_percent = 0;
+
+    // Created on the first request sent with --raft_peer_stats_window_ms.
+    // Shared by the copies of the peer so that they report to one place.
+    std::shared_ptr<PeerReplicationStats> replication_stats;
+
+    // The most op bytes to send to this peer in one request, before
+    // shrinking for its load: --consensus_max_batch_size_bytes or, with
+    // --raft_adaptive_batch_size, what keeps its bandwidth-delay product in
+    // flight.
+    int64_t MaxBatchBytes() const;
+
     void PopulateIsPeerInLocalRegion();
     void PopulateIsPeerInLocalQuorum();
 
@@ -260,6 +340,34 @@ class PeerMessageQueue {
     const PeerMessageQueue* queue = nullptr;
   };
 
+  // What building a request reads of a TrackedPeer once 'queue_lock_' is
+  // released. Copying this instead of the whole TrackedPeer saves copying
+  // its RaftPeerPB and its shared pointers on every request.
+  struct PeerRequestState {
+    // Copies the fields of 'peer'. 'peer_uuid' must outlive this.
+    void CopyFrom(const TrackedPeer& peer, const std::string* peer_uuid);
+
+    std::string ToString() const;
+
+    const std::string* uuid = nullptr;
+    std::string host;
+    uint32_t port = 0;
+    int64_t next_index = 0;
+    int64_t max_batch_bytes = 0;
+    int32_t load_percent = 0;
+    PeerStatus last_exchange_status = PeerStatus::NEW;
+    bool wal_catchup_possible = true;
+    // Only copied with --buffer_messages_between_rpcs.
+    std::shared_ptr<PeerMessageBuffer> peer_msg_buffer;
+  };
+
+  // The exchange state of a TrackedPeer from before a response, which the
+  // response handling compares against.
+  struct PeerExchangeState {
+    PeerStatus last_exchange_status;
+    OpId last_received;
+  };
+
   struct TransferContext {
     std::chrono::system_clock::time_point original_start_time;
     std::string original_uuid;
@@ -322,6 +430,10 @@ class PeerMessageQueue {
   // operation in the current term.
   // 'active_config' is the currently-active Raft config. This must always be
   // a superset of the tracked peers, and that is enforced with runtime CHECKs.
+  void SetLeaderMode(
+      int64_t committed_index,
+      int64_t current_term,
+      std::shared_ptr<const RaftConfigSnapshot> active_config);
   void SetLeaderMode(
       int64_t committed_index,
       int64_t current_term,
@@ -331,6 +443,8 @@ class PeerMessageQueue {
   // be tracked so that the cache is only evicted when the peers no longer need
   // the operations but the queue will no longer advance the majority replicated
   // index or notify observers of its advancement.
+  void SetNonLeaderMode(
+      std::shared_ptr<const RaftConfigSnapshot> active_config);
   void SetNonLeaderMode(const RaftConfigPB& active_config);
 
   // Makes the queue track this peer.
@@ -392,6 +506,10 @@ class PeerMessageQueue {
   // nullptr)
   Status FindPeer(const std::string& uuid, TrackedPeer* peer);
 
+  // Whether the peer with 'uuid' acked the last op in the log and knows the
+  // current committed index, with its last exchange having succeeded.
+  bool IsPeerCaughtUp(const std::string& uuid) const;
+
   // Assembles a request for a peer, adding entries past 'op_id' up to
   // 'consensus_max_batch_size_bytes'.
   // Returns OK if the request was assembled, or Status::NotFound() if the
@@ -407,13 +525,56 @@ class PeerMessageQueue {
   // instance of ConsensusRequestPB to RequestForPeer(): the buffer will
   // replace the old entries with new ones without de-allocating the old
   // ones if they are still required.
+  //
+  // If 'request_seq' is set, it's set to the request's sequence number, to be
+  // passed back to ResponseFromPeer(), and with
+  // --raft_max_inflight_requests_per_peer > 1 the request starts after the
+  // ops sent in any earlier requests which are still in flight.
+  //
+  // If 'catchup_throttled' is set, it's set to whether ops were left out of
+  // the request by the catch-up throttle.
+  //
+  // If 'msg_batch' is set and --raft_share_op_batches is on, the ops may
+  // instead be referenced by a batch shared with other peers' requests,
+  // which is returned in 'msg_batch' and must be kept alive along with
+  // 'msg_refs'.
+  Status RequestForPeer(
+      const std::string& uuid,
+      bool read_ops,
+      ConsensusRequestPB* request,
+      std::vector<ReplicateRefPtr>* msg_refs,
+      bool* needs_tablet_copy,
+      std::string* next_hop_uuid,
+      int64_t* request_seq = nullptr,
+      bool* catchup_throttled = nullptr,
+      LogCache::SharedOps* msg_batch = nullptr);
+
+  // As above, for the peer whose UUID was interned as 'peer_id', which the
+  // queue finds without hashing the UUID.
   Status RequestForPeer(
+      PeerId peer_id,
+      bool read_ops,
+      ConsensusRequestPB* request,
+      std::vector<ReplicateRefPtr>* msg_refs,
+      bool* needs_tablet_copy,
+      std::string* next_hop_uuid,
+      int64_t* request_seq = nullptr,
+      bool* catchup_throttled = nullptr,
+      LogCache::SharedOps* msg_batch = nullptr);
+
+  // The method that does most of the heavy lifting of RequestForPeer.
+  // 'uuid' is the UUID interned as 'peer_id'.
+  Status DoRequestForPeer(
+      PeerId peer_id,
       const std::string& uuid,
       bool read_ops,
       ConsensusRequestPB* request,
       std::vector<ReplicateRefPtr>* msg_refs,
       bool* needs_tablet_copy,
-      std::string* next_hop_uuid);
+      std::string* next_hop_uuid,
+      int64_t* request_seq,
+      bool* catchup_throttled,
+      LogCache::SharedOps* msg_batch);
 
   /**
    * Fills up the buffer for a peer.
@@ -456,15 +617,46 @@ class PeerMessageQueue {
   // Returns true iff there are more requests pending in the queue for this
   // peer and another request should be sent immediately, with no intervening
   // delay.
+  //
+  // 'request_seq' is the sequence number RequestForPeer() gave the request,
+  // or -1 if it wasn't asked for one. Responses overtaken by later ones, or
+  // to requests sent before the peer was rewound, are disregarded.
   bool ResponseFromPeer(
       const std::string& peer_uuid,
-      const ConsensusResponsePB& response);
+      const ConsensusResponsePB& response,
+      int64_t request_seq = -1);
+
+  // As above, for the peer whose UUID was interned as 'peer_id'.
+  bool ResponseFromPeer(
+      PeerId peer_id,
+      const ConsensusResponsePB& response,
+      int64_t request_seq = -1);
 
   // The method that does most of the heavy lifting of ResponseFromPeer
   bool DoResponseFromPeer(
-      const std::string& peer_uuid,
+      PeerId peer_id,
       const ConsensusResponsePB& response,
-      boost::optional<int64_t>& updated_commit_index);
+      boost::optional<int64_t>& updated_commit_index,
+      int64_t request_seq);
+
+  // Returns 'ops' encoded as the 'ops' fields of a ConsensusRequestPB, for use
+  // as an UpdateConsensus sidecar (see ConsensusRequestPB::ops_sidecar_idx).
+  // The encoding of the last few batches is kept, so that a batch sent to
+  // several peers is only encoded once. 'ops' must not be empty.
+  //
+  // If --raft_ops_sidecar_compact_encoding is set, 'ops' are encoded compactly
+  // instead where they can be (see consensus/compact_ops.h). Sets 'encoding'
+  // to the encoding used.
+  //
+  // The encoding is compressed as a whole if
+  // --raft_ops_sidecar_compression_codec is set and compression helps. Sets
+  // 'compression' to the codec used, and 'uncompressed_size' to the size of
+  // the encoding before compression.
+  std::shared_ptr<const std::string> GetSerializedOps(
+      const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+      ConsensusRequestPB::OpsSidecarEncoding* encoding,
+      CompressionType* compression,
+      int64_t* uncompressed_size);
 
   // Called by the consensus implementation to update the queue's watermarks
   // based on information provided by the leader. This is used for metrics and
@@ -481,6 +673,15 @@ class PeerMessageQueue {
   // If leader, checks whether it can successfully commit to majority of peers.
   bool CheckQuorum();
 
+  // Whether peer health is evaluated periodically by EvaluatePeerHealth()
+  // rather than after every request, per
+  // --raft_peer_health_evaluation_interval_ms.
+  static bool PeerHealthEvaluatedInBackground();
+
+  // If leader, updates the health status of every remote peer and triggers
+  // the appropriate notifications, as UpdatePeerHealthUnlocked() does.
+  void EvaluatePeerHealth();
+
   // Closes the queue. Once the queue is closed, peers are still allowed to
   // call UntrackPeer() and ResponseFromPeer(), however no additional peers may
   // be tracked and no additional messages may be enqueued.
@@ -489,6 +690,9 @@ class PeerMessageQueue {
   int64_t GetQueuedOperationsSizeBytesForTests() const;
 
   // Returns the last message replicated by all peers.
+  //
+  // This and the other watermark getters below do not take 'queue_lock_';
+  // they read the copies republished by PublishWatermarksUnlocked().
   int64_t GetAllReplicatedIndex() const;
 
   // Returns the committed index. All operations with index less than or equal
@@ -505,6 +709,22 @@ class PeerMessageQueue {
   // Whether the queue run in the leader mode.
   bool IsInLeaderMode() const;
 
+  // Calls 'done' with OK once a commit quorum has accepted requests this
+  // leader sent at or after 'since', i.e. once it's known this peer was still
+  // the leader at 'since'. Calls it with TimedOut if that's not known by
+  // 'deadline', or with IllegalState once this peer is no longer the leader.
+  // Confirmations are driven by peer responses, so the caller should have
+  // requests sent to the peers, e.g. with PeerManager::SignalRequest().
+  void ConfirmLeadershipAsync(
+      MonoTime since,
+      MonoTime deadline,
+      StdStatusCallback done);
+
+  // Whether ConfirmLeadershipAsync() calls are pending.
+  bool HasLeadershipWaiters() const {
+    return has_leadership_waiters_.load(std::memory_order_acquire);
+  }
+
   // Returns the current majority replicated index, for tests.
   int64_t GetMajorityReplicatedIndexForTests() const;
 
@@ -574,6 +794,11 @@ class PeerMessageQueue {
       const std::string& new_leader_uuid,
       OpId* snapshot_op_id);
 
+  // Returns the voter, other than the leader, which has received the most of
+  // the log and is communicating with the leader, or boost::none if there is
+  // none.
+  boost::optional<std::string> GetMostCaughtUpSuccessor();
+
   // If the previous call to BeginWatchForSuccessor had resulted in a
   // notification to a peer to start an election
   bool WatchForSuccessorPeerNotified();
@@ -591,6 +816,16 @@ class PeerMessageQueue {
     return &log_cache_;
   }
 
+  CompressionCodecManager* codec_manager() const {
+    return log_cache_.codec_manager();
+  }
+
+  // Accounts the consensus work of the queue's ring, see
+  // ScopedRaftResourceAccounting.
+  RaftResourceAccount* resource_account() {
+    return &resource_account_;
+  }
+
   Status SetCompressionDictionary(const std::string& dict);
 
   // Set the threshold (in milliseconds) that is used to determine the health of
@@ -611,6 +846,22 @@ class PeerMessageQueue {
       const TrackedPeer* proxy_peer,
       const TrackedPeer* dest_peer);
 
+  // Whether 'peer' lags far enough behind for the catch-up throttle to apply
+  // to it.
+  bool SubjectToCatchupThrottleUnlocked(const TrackedPeer& peer) const;
+
+  // Whether 'uuid' is the successor of an active leadership transfer; see
+  // --raft_active_leadership_transfer.
+  bool IsActiveTransferSuccessorUnlocked(const std::string& uuid) const;
+
+  // Returns true if the catch-up throttle applies to 'peer' and it is out of
+  // budget for another batch; otherwise charges it for one, if it applies.
+  bool CatchupThrottledUnlocked(TrackedPeer* peer);
+
+  // Returns the tracked peer whose UUID was interned as 'peer_id', or nullptr
+  // if there is none.
+  TrackedPeer* FindPeerUnlocked(PeerId peer_id) const;
+
   void SetAdjustVoterDistribution(bool val) {
     std::lock_guard<simple_mutexlock> lock(queue_lock_);
     adjust_voter_distribution_ = val;
@@ -657,6 +908,15 @@ class PeerMessageQueue {
   // Sets the UpdateConsensus rpc start time for peer
   void SetPeerRpcStartTime(const std::string& peer_uuid, MonoTime rpcStart);
 
+  // Records the round-trip time of a direct UpdateConsensus request to the
+  // peer, which carried 'ops_bytes' of op payloads, and, at most once every
+  // --raft_latency_routing_min_rebuild_interval_ms, passes the peers' latest
+  // round-trip times and lag on to the routing table.
+  void RecordPeerRoundTrip(
+      const std::string& peer_uuid,
+      MonoDelta rtt,
+      int64_t ops_bytes = 0);
+
  private:
   FRIEND_TEST(ConsensusQueueTest, TestQueueAdvancesCommittedIndex);
   FRIEND_TEST(ConsensusQueueTest, TestQueueMovesWatermarksBackward);
@@ -683,6 +943,18 @@ class PeerMessageQueue {
     VOTER_REPLICAS,
   };
 
+  // How the commit quorum is computed. Chosen once per config installation
+  // from --enable_flexi_raft and the config's commit rule, so that the
+  // per-response paths switch on it rather than re-deriving it.
+  enum QuorumEngine {
+    // A majority of the voters, as in vanilla Raft.
+    VANILLA_MAJORITY,
+    // FlexiRaft with a static commit rule.
+    FLEXI_STATIC,
+    // FlexiRaft in SINGLE_REGION_DYNAMIC mode.
+    FLEXI_DYNAMIC,
+  };
+
   struct QueueState {
     // The first operation that has been replicated to all currently
     // tracked peers.
@@ -725,13 +997,16 @@ class PeerMessageQueue {
     // The size of the majority for the queue.
     int majority_size_;
 
+    // How the commit quorum of 'active_config' is computed.
+    QuorumEngine quorum_engine;
+
     State state;
 
     // The current mode of the queue.
     Mode mode;
 
     // The currently-active raft config. Only set if in LEADER mode.
-    std::unique_ptr<RaftConfigPB> active_config;
+    std::shared_ptr<const RaftConfigSnapshot> active_config;
 
     std::string ToString() const;
   };
@@ -758,13 +1033,20 @@ class PeerMessageQueue {
   // notifications.
   void UpdatePeerHealthUnlocked(TrackedPeer* peer);
 
+  // Adds 'ops_bytes', delivered to 'peer' by a request which took 'rtt', to
+  // its delivery rate, which --raft_adaptive_batch_size sizes batches by.
+  void RecordPeerDeliveryUnlocked(
+      TrackedPeer* peer,
+      MonoDelta rtt,
+      int64_t ops_bytes);
+
   // Update the peer's last exchange status, and other fields, based on the
   // response. Sets 'lmp_mismatch' to true if the given response indicates
   // there was a log-matching property mismatch on the remote, otherwise sets
   // it to false.
   void UpdateExchangeStatus(
       TrackedPeer* peer,
-      const TrackedPeer& prev_peer_state,
+      const PeerExchangeState& prev_peer_state,
       const ConsensusResponsePB& response,
       bool* lmp_mismatch);
 
@@ -772,7 +1054,7 @@ class PeerMessageQueue {
   // trigger promotion.
   void PromoteIfNeeded(
       TrackedPeer* peer,
-      const TrackedPeer& prev_peer_state,
+      const PeerExchangeState& prev_peer_state,
       const ConsensusStatusPB& status);
 
   // If there is a graceful leadership change underway, notify queue observers
@@ -789,7 +1071,7 @@ class PeerMessageQueue {
   // Also returns a pointer to the RaftPeerPB if successful
   bool BasicChecksOKToTransferAndGetPeerUnlocked(
       const TrackedPeer& peer,
-      RaftPeerPB** peer_pb_ptr);
+      const RaftPeerPB** peer_pb_ptr);
 
   // If the peer is caught up, notify the peer to start an election
   // immediately
@@ -811,22 +1093,58 @@ class PeerMessageQueue {
   void NotifyObserversOfPeerToPromote(const std::string& peer_uuid);
   void NotifyObserversOfSuccessor(const std::string& peer_uuid);
   void NotifyObserversOfPeerHealthChange();
+  void NotifyObserversOfPeerNeedsSnapshot(
+      const std::string& uuid,
+      int64_t next_index);
+
+  // Notifies the observers that peer 'uuid' needs a snapshot to catch up from
+  // 'next_index', at most once per
+  // --raft_snapshot_catchup_notify_interval_ms. 'queue_lock_' must not be
+  // held.
+  void MaybeNotifyPeerNeedsSnapshot(
+      const std::string& uuid,
+      int64_t next_index);
 
   // Notify all PeerMessageQueueObservers using the given callback function.
   void NotifyObserversTask(
       const std::function<void(PeerMessageQueueObserver*)>& func);
 
+  // With --consensus_coalesce_observer_notifications, posts 'value' to
+  // 'debouncer' and schedules NotifyObserversOfLatestTask() unless one is
+  // already pending. 'what' names the event in the warning logged if the
+  // task cannot be scheduled.
+  void NotifyObserversOfLatest(
+      LatestValueDebouncer* debouncer,
+      int64_t value,
+      const std::function<void(PeerMessageQueueObserver*, int64_t)>& func,
+      const char* what);
+
+  // Notify all PeerMessageQueueObservers of the latest value posted to
+  // 'debouncer', if it has not already been delivered.
+  void NotifyObserversOfLatestTask(
+      LatestValueDebouncer* debouncer,
+      const std::function<void(PeerMessageQueueObserver*, int64_t)>& func);
+
   typedef std::unordered_map<std::string, TrackedPeer*> PeersMap;
 
   std::string ToStringUnlocked() const;
 
   std::string LogPrefixUnlocked() const;
 
+  // The prefix for KLOG_BINARY_WITH_PREFIX(): tablet and peer only.
+  const std::shared_ptr<const std::string>& BinaryLogPrefix() const {
+    return binary_log_prefix_;
+  }
+
   void DumpToStringsUnlocked(std::vector<std::string>* lines) const;
 
   // Updates the metrics based on index math.
   void UpdateMetricsUnlocked();
 
+  // Copies the watermarks in 'queue_state_' to their lock-free mirrors.
+  // Must be called after any of them changes.
+  void PublishWatermarksUnlocked();
+
   // Update the metric that measures how many ops behind the leader the local
   // replica believes it is (0 if leader).
   void UpdateLagMetricsUnlocked();
@@ -866,6 +1184,15 @@ class PeerMessageQueue {
   // Advances the 'region_durable_index' maintained by the queue
   void AdvanceQueueRegionDurableIndex();
 
+  // Returns the quorum engine for 'config', which may be null.
+  static QuorumEngine QuorumEngineFor(const RaftConfigSnapshot* config);
+
+  // Writes the last received index of each peer of 'kReplicaTypes' whose last
+  // exchange was successful to 'out', which must have room for all of
+  // 'peers', and returns their number.
+  template <ReplicaTypes kReplicaTypes>
+  static size_t CollectWatermarks(const PeersMap& peers, int64_t* out);
+
   // Advances 'watermark' to the smallest op that 'num_peers_required' have.
   // If 'replica_types' is set to VOTER_REPLICAS, the 'num_peers_required' is
   // interpreted as "number of voters required". If 'replica_types' is set to
@@ -926,22 +1253,45 @@ class PeerMessageQueue {
   // Checks and renews Bounded Data Loss window lease
   bool CanBoundedDataLossWindowRenewUnlocked(QuorumResults& qresults);
 
-  MonoTime GetQuorumMajorityOfPeerRpcStarts(QuorumResults& qresults);
+  // Returns the latest rpc start time that a majority of the quorum has
+  // reached, reading the start times from the 'rpc_start' field of the
+  // quorum peers.
+  MonoTime GetQuorumMajorityOfPeerRpcStarts(
+      QuorumResults& qresults,
+      MonoTime TrackedPeer::*rpc_start = &TrackedPeer::rpc_start_);
 
   MonoTime GetMaximumOfPeerRpcStarts(QuorumResults& qresults);
 
+  // Returns the latest time at which this peer is known to have been the
+  // leader, from the requests a commit quorum accepted.
+  MonoTime LeadershipConfirmedUntilUnlocked();
+
+  // Calls the pending ConfirmLeadershipAsync() callbacks that are now
+  // satisfied, have timed out, or can't be satisfied anymore. 'queue_lock_'
+  // must not be held.
+  void MaybeNotifyLeadershipWaiters();
+
   Status GetQuorumHealthForFlexiRaftUnlocked(QuorumHealth* health);
 
   Status GetQuorumHealthForVanillaRaftUnlocked(QuorumHealth* health);
 
   Status ReadMessagesForRequest(
-      const TrackedPeer& peer_copy,
+      const PeerRequestState& peer_copy,
       bool route_via_proxy,
       std::vector<ReplicateRefPtr>* messages,
-      OpId* preceding_id);
+      OpId* preceding_id,
+      int64_t* disk_bytes_read = nullptr,
+      LogCache::SharedOps* batch = nullptr);
+
+  // Records the ops in 'request' in the replication stats of peer 'uuid'.
+  // 'disk_bytes_read' are the bytes that had to be read from the log.
+  void RecordRequestStats(
+      const std::string& uuid,
+      const ConsensusRequestPB& request,
+      int64_t disk_bytes_read);
 
   Status ExtractBuffer(
-      const TrackedPeer& peer_copy,
+      const PeerRequestState& peer_copy,
       bool route_via_proxy,
       std::vector<ReplicateRefPtr>* messages,
       OpId* preceding_id);
@@ -1011,14 +1361,30 @@ class PeerMessageQueue {
   // The pool token which executes observer notifications.
   std::unique_ptr<ThreadPoolToken> raft_pool_observers_token_;
 
+  // Pending coalesced notifications, one per event type. See
+  // NotifyObserversOfLatest().
+  LatestValueDebouncer commit_index_notification_;
+  LatestValueDebouncer term_notification_;
+  LatestValueDebouncer peer_health_notification_;
+
   // PB containing identifying information about the local peer.
   RaftPeerPB local_peer_pb_;
 
+  // The interned id of the local peer's UUID.
+  const PeerId local_peer_id_;
+
   std::shared_ptr<RoutingTableContainer> routing_table_container_;
 
   // The id of the tablet.
   const std::string tablet_id_;
 
+  // Where the per-peer replication stats are published, if anywhere.
+  MetricRegistry* const metric_registry_;
+
+  RaftResourceAccount resource_account_;
+
+  const std::shared_ptr<const std::string> binary_log_prefix_;
+
   QueueState queue_state_;
 
   // Should we adjust voter distribution based on current config?
@@ -1026,12 +1392,75 @@ class PeerMessageQueue {
 
   // The currently tracked peers.
   PeersMap peers_map_;
-  mutable simple_mutexlock queue_lock_; // TODO(todd): rename
+
+  // The peers of 'peers_map_', indexed by their interned ids, with nullptr
+  // for ids which aren't tracked. Interned ids are dense and few, so this
+  // stays small.
+  std::vector<TrackedPeer*> peers_by_id_;
+  // Set with --lock_profiling. Declared before 'queue_lock_' to outlive it.
+  std::unique_ptr<LockProfile> queue_lock_profile_;
+  // 'queue_lock_' and the mirrors below each start a cache line, so that
+  // pollers of the mirrors don't bounce the line lockers write to.
+  CACHELINE_ALIGNED mutable simple_mutexlock queue_lock_; // TODO(todd): rename
+
+  // Mirrors of the 'queue_state_' watermarks, written only while holding
+  // 'queue_lock_' but readable without it. Consensus polls these on every
+  // op, and doing so under 'queue_lock_' used to serialize the pollers with
+  // peer response processing. 'first_index_in_current_term_mirror_' is -1
+  // when 'queue_state_.first_index_in_current_term' is unset.
+  CACHELINE_ALIGNED std::atomic<int64_t> committed_index_mirror_{0};
+  std::atomic<int64_t> all_replicated_index_mirror_{0};
+  std::atomic<int64_t> region_durable_index_mirror_{0};
+  std::atomic<int64_t> first_index_in_current_term_mirror_{-1};
+
+  // Pending ConfirmLeadershipAsync() calls. Protected by 'queue_lock_'.
+  struct LeadershipWaiter {
+    MonoTime since;
+    MonoTime deadline;
+    StdStatusCallback done;
+  };
+  std::vector<LeadershipWaiter> leadership_waiters_;
+  std::atomic<bool> has_leadership_waiters_{false};
+
+  // Set whenever something other than a successful response changes what the
+  // replication watermarks are computed from: the tracked peers, the config,
+  // or a peer's exchange status. A response that leaves its peer's
+  // contribution unchanged can't move the watermarks, so DoResponseFromPeer()
+  // only recomputes them when this is set or the peer's contribution changed.
+  bool watermark_inputs_changed_ = true;
+
+  // A batch of ops already encoded by GetSerializedOps(). An OpId names the
+  // same op for the lifetime of the tablet, so the first and last ids and
+  // the count identify the batch.
+  struct SerializedOps {
+    OpId first_id;
+    OpId last_id;
+    int num_ops;
+    std::shared_ptr<const std::string> bytes;
+    ConsensusRequestPB::OpsSidecarEncoding encoding;
+    CompressionType compression;
+    int64_t uncompressed_size;
+  };
+
+  // Returns 'bytes' compressed with --raft_ops_sidecar_compression_codec, and
+  // sets 'compression' to that codec. Returns nullptr if 'bytes' are better
+  // sent as they are.
+  std::shared_ptr<std::string> CompressSerializedOps(
+      const std::string& bytes,
+      CompressionType* compression);
+
+  // Protects 'serialized_ops_', which holds the most recently encoded batches,
+  // oldest first.
+  simple_spinlock serialized_ops_lock_;
+  std::deque<SerializedOps> serialized_ops_;
 
   bool successor_watch_in_progress_;
   boost::optional<std::string> designated_successor_uuid_;
   boost::optional<TransferContext> transfer_context_;
   bool successor_watch_peer_notified_ = false;
+  // Set while the designated successor is being pushed the rest of the log
+  // ahead of everything else. Cleared once it is told to start an election.
+  boost::optional<std::string> active_transfer_successor_;
 
   std::function<bool(const kudu::consensus::RaftPeerPB&)> tl_filter_fn_;
   // We assume that we never have multiple threads racing to append to the
@@ -1059,6 +1488,10 @@ class PeerMessageQueue {
   // An instance of PersistentVars with access to some persistent global vars
   scoped_refptr<PersistentVars> persistent_vars_;
 
+  // When RecordPeerRoundTrip() last passed the peers' measurements on to the
+  // routing table.
+  MonoTime last_route_stats_update_;
+
   // Leader Leases to support strong reads on primary
   std::atomic<MonoTime> leader_lease_until_;
 
@@ -1066,6 +1499,10 @@ class PeerMessageQueue {
   // using a time bound window
   std::atomic<MonoTime> bounded_dataloss_window_until_;
 
+  // With --bounded_dataloss_window_renewal_interval_ms, the earliest time at
+  // which to check for a quorum of ACKs again. Protected by 'queue_lock_'.
+  MonoTime next_bounded_dataloss_window_renewal_;
+
   std::shared_ptr<TimeProvider> time_provider_;
 };
 
@@ -1102,6 +1539,12 @@ class PeerMessageQueueObserver {
   // Notify the observer that the health of one of the peers has changed.
   virtual void NotifyPeerHealthChange() = 0;
 
+  // Notify the observer that the ops peer 'peer_uuid' needs next, from
+  // 'next_index' on, were GCed, so it can only catch up from a snapshot.
+  virtual void NotifyPeerNeedsSnapshot(
+      const std::string& /*peer_uuid*/,
+      int64_t /*next_index*/) {}
+
   virtual ~PeerMessageQueueObserver() {}
 };
 
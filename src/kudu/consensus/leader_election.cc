@@ -261,8 +261,11 @@ void FlexibleVoteCounter::FetchTopologyInfo() {
   bool use_quorum_id = IsUseQuorumId(config_.commit_rule());
   for (const RaftPeerPB& peer : config_.peers()) {
     if (peer.member_type() == RaftPeerPB::VOTER) {
-      uuid_to_quorum_id_.emplace(
-          peer.permanent_uuid(), GetQuorumId(peer, use_quorum_id));
+      const int quorum_index = InternQuorumId(GetQuorumId(peer, use_quorum_id));
+      if (uuid_to_quorum_index_.emplace(peer.permanent_uuid(), quorum_index)
+              .second) {
+        quorum_tallies_[quorum_index].num_voters++;
+      }
     }
   }
 
@@ -281,6 +284,26 @@ void FlexibleVoteCounter::FetchTopologyInfo() {
     // The reverse is not true and has been handled in
     // AdjustVoterDistributionWithCurrentVoters
   }
+
+  for (const std::pair<const std::string, int>& regional_voter_count :
+       voter_distribution_) {
+    quorum_tallies_[InternQuorumId(regional_voter_count.first)]
+        .voter_distribution = regional_voter_count.second;
+  }
+}
+
+int FlexibleVoteCounter::InternQuorumId(const std::string& quorum_id) {
+  auto result = quorum_indexes_.emplace(quorum_id, quorum_tallies_.size());
+  if (result.second) {
+    quorum_ids_.push_back(quorum_id);
+    quorum_tallies_.emplace_back();
+  }
+  return result.first->second;
+}
+
+const FlexibleVoteCounter::QuorumTally& FlexibleVoteCounter::TallyOrDie(
+    const std::string& quorum_id) const {
+  return quorum_tallies_[FindOrDie(quorum_indexes_, quorum_id)];
 }
 
 FlexibleVoteCounter::FlexibleVoteCounter(
@@ -298,33 +321,13 @@ FlexibleVoteCounter::FlexibleVoteCounter(
       creation_time_(std::chrono::system_clock::now()) {
   num_voters_ = 0;
 
-  // Computes voter distribution and uuid to region map.
+  // Computes voter distribution and interns the quorum ids of the voters
+  // and of the voter distribution.
   FetchTopologyInfo();
 
-  for (const std::pair<const std::string, int>& regional_voter_count :
-       voter_distribution_) {
-    // When instances are being removed from ring, the voter distribution
-    // can have extra regions, but we have taken them out in
-    // FetchTopology. So this should never happen
-    if (adjust_voter_distribution_ && regional_voter_count.second <= 0) {
-      continue;
-    }
-    // num_voters_ += regional_voter_count.second;
-    yes_vote_count_.emplace(regional_voter_count.first, 0);
-    no_vote_count_.emplace(regional_voter_count.first, 0);
-  }
-
   // Its critical that we count num_voters_ based on current voter list
   // as voter_distribution_ can be greater or less than current voter list
-  num_voters_ = uuid_to_quorum_id_.size();
-  for (const auto& [uuid, quorum_id] : uuid_to_quorum_id_) {
-    auto quorum_id_itr = num_voters_per_quorum_id_.find(quorum_id);
-    if (quorum_id_itr == num_voters_per_quorum_id_.end()) {
-      num_voters_per_quorum_id_.emplace(quorum_id, 1);
-    } else {
-      quorum_id_itr->second++;
-    }
-  }
+  num_voters_ = uuid_to_quorum_index_.size();
 
   CHECK_GT(num_voters_, 0);
 }
@@ -345,24 +348,20 @@ Status FlexibleVoteCounter::RegisterVote(
   }
 
   // In Flexi-Raft all voters are expected to have region tag
-  if (!ContainsKey(uuid_to_quorum_id_, voter_uuid)) {
+  auto quorum_index_it = uuid_to_quorum_index_.find(voter_uuid);
+  if (quorum_index_it == uuid_to_quorum_index_.end()) {
     // This is never expected to happen
     return Status::InvalidArgument(
         Substitute("UUID {$0} not present in config.", voter_uuid));
   }
 
-  // In Flexi-Raft we never allow voters without voter distribution
-  // to be in Ring. Hence yes_vote_count_ and no_vote_count_ will
-  // have the same number of voting regions as voter_distribution_
-  const std::string& quorum_id = uuid_to_quorum_id_.at(voter_uuid);
+  QuorumTally& tally = quorum_tallies_[quorum_index_it->second];
   switch (vote_info.vote) {
     case VOTE_GRANTED:
-      InsertIfNotPresent(&yes_vote_count_, quorum_id, 0);
-      yes_vote_count_[quorum_id]++;
+      tally.yes_votes++;
       break;
     case VOTE_DENIED:
-      InsertIfNotPresent(&no_vote_count_, quorum_id, 0);
-      no_vote_count_[quorum_id]++;
+      tally.no_votes++;
       break;
   }
 
@@ -375,15 +374,9 @@ Status FlexibleVoteCounter::RegisterVote(
 int FlexibleVoteCounter::FetchVotesRemainingInRegion(
     const std::string& region,
     bool use_vd) const {
-  // All the following must at least be initialized to zero in the
-  // constructor.
-  int regional_yes_count = FindOrDie(yes_vote_count_, region);
-  int regional_no_count = FindOrDie(no_vote_count_, region);
-  int total_region_count = use_vd
-      ? FindOrDie(voter_distribution_, region)
-      : FindOrDie(num_voters_per_quorum_id_, region);
-  return std::max(
-      0, total_region_count - regional_yes_count - regional_no_count);
+  const QuorumTally& tally = TallyOrDie(region);
+  int total_region_count = use_vd ? tally.voter_distribution : tally.num_voters;
+  return std::max(0, total_region_count - tally.yes_votes - tally.no_votes);
 }
 
 void FlexibleVoteCounter::FetchRegionalPrunedCounts(
@@ -396,7 +389,8 @@ void FlexibleVoteCounter::FetchRegionalPrunedCounts(
     const std::string& uuid = uuid_pruned_term_pair.first;
     int64_t lpt = uuid_pruned_term_pair.second;
     if (lpt > term) {
-      const std::string& region = uuid_to_quorum_id_.at(uuid);
+      const std::string& region =
+          quorum_ids_[FindOrDie(uuid_to_quorum_index_, uuid)];
       int32_t& region_count = LookupOrInsert(region_pruned_counts, region, 0);
       region_count++;
     }
@@ -413,7 +407,8 @@ void FlexibleVoteCounter::FetchRegionalUnprunedCounts(
     const std::string& uuid = uuid_pruned_term_pair.first;
     int64_t lpt = uuid_pruned_term_pair.second;
     if (lpt <= term) {
-      const std::string& region = uuid_to_quorum_id_.at(uuid);
+      const std::string& region =
+          quorum_ids_[FindOrDie(uuid_to_quorum_index_, uuid)];
       int32_t& region_count = LookupOrInsert(region_unpruned_counts, region, 0);
       region_count++;
     }
@@ -422,13 +417,11 @@ void FlexibleVoteCounter::FetchRegionalUnprunedCounts(
 
 std::string FlexibleVoteCounter::DetermineQuorumIdForUUID(
     const std::string& uuid) const {
-  std::map<std::string, std::string>::const_iterator reg_it =
-      uuid_to_quorum_id_.find(uuid);
-  if (reg_it == uuid_to_quorum_id_.end()) {
+  auto it = uuid_to_quorum_index_.find(uuid);
+  if (it == uuid_to_quorum_index_.end()) {
     return "";
-  } else {
-    return reg_it->second;
   }
+  return quorum_ids_[it->second];
 }
 
 std::vector<std::pair<bool, bool>>
@@ -449,12 +442,11 @@ FlexibleVoteCounter::IsMajoritySatisfiedInRegions(
     bool quorum_satisfied = true;
     bool quorum_satisfaction_possible = true;
 
-    // All the following must at least be initialized to zero in the
-    // constructor.
-    int regional_yes_count = FindOrDie(yes_vote_count_, region);
-    int regional_no_count = FindOrDie(no_vote_count_, region);
-    int regional_quorum_count = FindOrDie(voter_distribution_, region);
-    size_t regional_total_count = FindOrDie(num_voters_per_quorum_id_, region);
+    const QuorumTally& tally = TallyOrDie(region);
+    int regional_yes_count = tally.yes_votes;
+    int regional_no_count = tally.no_votes;
+    int regional_quorum_count = tally.voter_distribution;
+    int regional_total_count = tally.num_voters;
 
     VLOG_WITH_PREFIX(3) << "Region: " << region
                         << " Total voters: " << regional_quorum_count
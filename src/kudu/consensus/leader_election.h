@@ -25,6 +25,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_peers.h"
@@ -207,6 +208,16 @@ class FlexibleVoteCounter : public VoteCounter {
     ElectionDecisionMethod latest_decision_mechanism;
   };
 
+  // The votes and voter counts of one quorum id.
+  struct QuorumTally {
+    // Number of voters according to voter_distribution_.
+    int voter_distribution = 0;
+    // Number of voters in config_.
+    int num_voters = 0;
+    int yes_votes = 0;
+    int no_votes = 0;
+  };
+
   // A safeguard max iteration count to prevent against future bugs.
   static const int64_t QUORUM_OPTIMIZATION_ITERATION_COUNT_MAX = 10000;
 
@@ -224,6 +235,14 @@ class FlexibleVoteCounter : public VoteCounter {
   // Fetches topology information required by the flexible vote counter.
   void FetchTopologyInfo();
 
+  // Returns the index of 'quorum_id' in quorum_tallies_, adding a tally for
+  // it if there is none.
+  int InternQuorumId(const std::string& quorum_id);
+
+  // Returns the tally of 'quorum_id', which must be a quorum id of a voter
+  // or a region of voter_distribution_.
+  const QuorumTally& TallyOrDie(const std::string& quorum_id) const;
+
   // Fetches the number of votes that still haven't arrived in this election
   // cycle from the given `region`.
   // If use_vd is true, we consider total votes based on voter_distribution_
@@ -390,8 +409,6 @@ class FlexibleVoteCounter : public VoteCounter {
   // Should we adjust voter distribution based on current config?
   const bool adjust_voter_distribution_;
 
-  // Vote count per region.
-  std::map<std::string, int> yes_vote_count_, no_vote_count_;
 
   // Last known leader properties.
   const LastKnownLeaderPB last_known_leader_;
@@ -399,11 +416,15 @@ class FlexibleVoteCounter : public VoteCounter {
   // Config at the beginning of the leader election.
   const RaftConfigPB config_;
 
-  // Number of voters in each quorum
-  std::unordered_map<std::string, size_t> num_voters_per_quorum_id_;
+  // Quorum ids are interned when the counter is created, so that counting a
+  // vote or checking a quorum looks up a string once and then works on a
+  // QuorumTally. quorum_ids_ and quorum_tallies_ are indexed alike.
+  std::unordered_map<std::string, int> quorum_indexes_;
+  std::vector<std::string> quorum_ids_;
+  std::vector<QuorumTally> quorum_tallies_;
 
-  // UUID to quorum_id map derived from RaftConfigPB.
-  std::map<std::string, std::string> uuid_to_quorum_id_;
+  // UUID of each voter in config_ to the index of its quorum id.
+  std::unordered_map<std::string, int> uuid_to_quorum_index_;
 
   // UUID to last term pruned mapping.
   std::map<std::string, int64_t> uuid_to_last_term_pruned_;
@@ -0,0 +1,333 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Measures appending REPLICATE batches to the WAL with
+// Log::AsyncAppendReplicates: appends and MB per second, how many batches
+// each group commit, and so each sync, covers, and the append latency
+// percentiles. Each sync mode and preallocation setting runs every
+// combination of the entry sizes, batch sizes, producer counts and codecs
+// given. Producers are closed-loop: each waits for its batch to be durable
+// before appending the next one.
+//
+// Example:
+//   log-bench --log_bench_wal_root=/data/log-bench \
+//       --log_bench_entry_bytes=256,4096 --log_bench_producers=1,16 \
+//       --log_bench_codecs=none,LZ4,ZSTD
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/random.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_string(
+    log_bench_wal_root,
+    "",
+    "Directory to write the WALs under, e.g. on the disk to measure. "
+    "Defaults to the test directory.");
+DEFINE_string(
+    log_bench_entry_bytes,
+    "1024",
+    "Comma-separated payload sizes of the REPLICATE entries.");
+DEFINE_string(
+    log_bench_batch_sizes,
+    "1,32",
+    "Comma-separated numbers of entries per AsyncAppendReplicates() call.");
+DEFINE_string(
+    log_bench_producers,
+    "1,8",
+    "Comma-separated numbers of threads appending concurrently.");
+DEFINE_string(
+    log_bench_codecs,
+    "none,LZ4",
+    "Comma-separated values of --log_compression_codec to run with.");
+DEFINE_int32(
+    log_bench_duration_ms,
+    1000,
+    "How long each combination appends for.");
+
+DECLARE_bool(env_use_fsync);
+DECLARE_bool(never_fsync);
+DECLARE_string(log_compression_codec);
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_histogram(log_group_commit_latency);
+METRIC_DECLARE_histogram(log_sync_latency);
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+// The longest append that is recorded, in micros.
+constexpr uint64_t kMaxLatencyMicros = 60LL * 1000 * 1000;
+
+constexpr char kBenchTablet[] = "log-bench-tablet";
+
+Status ParseIntList(const string& flag, vector<int>* values) {
+  const vector<string> items =
+      strings::Split(flag, ",", strings::SkipEmpty());
+  for (const string& value : items) {
+    int32_t v;
+    if (!safe_strto32(value, &v) || v <= 0) {
+      return Status::InvalidArgument("bad value", value);
+    }
+    values->push_back(v);
+  }
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+// How the log syncs each group.
+enum class SyncMode {
+  // --log_force_fsync_all is off: groups are only written.
+  NONE,
+  FDATASYNC,
+  FSYNC,
+};
+
+struct BenchSetup {
+  SyncMode sync_mode;
+  bool preallocate;
+
+  string ToString() const {
+    const char* mode = sync_mode == SyncMode::NONE
+        ? "no-sync"
+        : (sync_mode == SyncMode::FDATASYNC ? "fdatasync" : "fsync");
+    return Substitute("$0 preallocate=$1", mode, preallocate);
+  }
+};
+
+class LogBench : public KuduTest,
+                 public testing::WithParamInterface<BenchSetup> {
+ protected:
+  // Appends batches of 'batch_size' entries of 'entry_bytes' from each of
+  // 'num_producers' threads for --log_bench_duration_ms to a new log
+  // compressed with 'codec', and logs the results.
+  void RunBench(
+      int entry_bytes,
+      int batch_size,
+      int num_producers,
+      const string& codec) {
+    const BenchSetup& setup = GetParam();
+    const string name = Substitute(
+        "$0 codec=$1 entry_bytes=$2 batch=$3 producers=$4",
+        setup.ToString(),
+        codec,
+        entry_bytes,
+        batch_size,
+        num_producers);
+    const string root = FLAGS_log_bench_wal_root.empty()
+        ? GetTestPath("wals")
+        : FLAGS_log_bench_wal_root;
+    const string run_root =
+        JoinPathSegments(root, Substitute("run-$0", run_));
+
+    FsManagerOpts fs_opts;
+    fs_opts.wal_root = run_root;
+    fs_opts.data_roots = {run_root};
+    FsManager fs_manager(env_, fs_opts);
+    ASSERT_OK(fs_manager.CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager.Open());
+
+    FLAGS_log_compression_codec = codec;
+    LogOptions options;
+    options.force_fsync_all = setup.sync_mode != SyncMode::NONE;
+    options.preallocate_segments = setup.preallocate;
+    MetricRegistry registry;
+    scoped_refptr<MetricEntity> entity = METRIC_ENTITY_server.Instantiate(
+        &registry, Substitute("log-bench-$0", run_++));
+    scoped_refptr<Log> log;
+    ASSERT_OK(
+        Log::Open(options, &fs_manager, kBenchTablet, entity, &log));
+
+    // Moderately compressible: letters from an alphabet of 16.
+    Random rng(SeedRandom());
+    string payload(entry_bytes, 'a');
+    for (char& c : payload) {
+      c = 'a' + rng.Uniform(16);
+    }
+
+    // As in RaftConsensus, ops are assigned their indexes and appended in
+    // order under a lock; only the waits overlap.
+    std::mutex append_lock;
+    int64_t next_index = 1;
+    HdrHistogram latencies_us(kMaxLatencyMicros, 2);
+    atomic<int64_t> num_batches(0);
+    atomic<bool> failed(false);
+    const MonoTime start = MonoTime::Now();
+    const MonoTime deadline =
+        start + MonoDelta::FromMilliseconds(FLAGS_log_bench_duration_ms);
+
+    vector<thread> threads;
+    for (int t = 0; t < num_producers; t++) {
+      threads.emplace_back([&]() {
+        while (MonoTime::Now() < deadline) {
+          vector<consensus::ReplicateRefPtr> replicates;
+          Synchronizer sync;
+          const MonoTime append_start = MonoTime::Now();
+          {
+            std::lock_guard<std::mutex> l(append_lock);
+            for (int i = 0; i < batch_size; i++) {
+              consensus::ReplicateRefPtr replicate =
+                  consensus::make_scoped_refptr_replicate(
+                      new consensus::ReplicateMsg());
+              consensus::ReplicateMsg* msg = replicate->get();
+              msg->mutable_id()->set_term(1);
+              msg->mutable_id()->set_index(next_index);
+              msg->set_timestamp(next_index++);
+              msg->set_op_type(consensus::NO_OP);
+              msg->mutable_noop_request()->set_payload_for_tests(payload);
+              replicates.push_back(std::move(replicate));
+            }
+            Status s =
+                log->AsyncAppendReplicates(replicates, sync.AsStatusCallback());
+            if (PREDICT_FALSE(!s.ok())) {
+              LOG(ERROR) << name << ": " << s.ToString();
+              failed = true;
+              return;
+            }
+          }
+          Status s = sync.Wait();
+          if (PREDICT_FALSE(!s.ok())) {
+            LOG(ERROR) << name << ": " << s.ToString();
+            failed = true;
+            return;
+          }
+          latencies_us.Increment(std::min<int64_t>(
+              (MonoTime::Now() - append_start).ToMicroseconds(),
+              kMaxLatencyMicros));
+          num_batches++;
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    const double secs = (MonoTime::Now() - start).ToSeconds();
+    ASSERT_FALSE(failed);
+    ASSERT_OK(log->Close());
+
+    const int64_t groups =
+        METRIC_log_group_commit_latency.Instantiate(entity)->TotalCount();
+    const int64_t syncs = setup.sync_mode == SyncMode::NONE
+        ? 0
+        : METRIC_log_sync_latency.Instantiate(entity)->TotalCount();
+    const double mb =
+        static_cast<double>(num_batches) * batch_size * entry_bytes /
+        (1024 * 1024);
+    LOG(INFO) << StringPrintf(
+        "%s: %.0f appends/s, %.0f entries/s, %.1f MB/s, %.1f batches/group, "
+        "%.1f batches/sync, latency p50 %" PRIu64 " us, p99 %" PRIu64
+        " us, p99.9 %" PRIu64 " us",
+        name.c_str(),
+        num_batches / secs,
+        num_batches * batch_size / secs,
+        mb / secs,
+        groups > 0 ? static_cast<double>(num_batches) / groups : 0,
+        syncs > 0 ? static_cast<double>(num_batches) / syncs : 0,
+        latencies_us.ValueAtPercentile(50),
+        latencies_us.ValueAtPercentile(99),
+        latencies_us.ValueAtPercentile(99.9));
+    const string key = Substitute("log-bench[$0]", name);
+    RecordPerfResult(key + ".appends_per_sec", num_batches / secs);
+    RecordPerfResult(key + ".mb_per_sec", mb / secs);
+    RecordPerfResult(
+        key + ".append_p99_us", latencies_us.ValueAtPercentile(99));
+  }
+
+  int run_ = 0;
+};
+
+// Every sync mode, with and without preallocated segments.
+INSTANTIATE_TEST_CASE_P(
+    SyncModes,
+    LogBench,
+    testing::ValuesIn(std::vector<BenchSetup>{
+        {SyncMode::NONE, false},
+        {SyncMode::NONE, true},
+        {SyncMode::FDATASYNC, false},
+        {SyncMode::FDATASYNC, true},
+        {SyncMode::FSYNC, false},
+        {SyncMode::FSYNC, true}}));
+
+TEST_P(LogBench, RunBench) {
+  const BenchSetup& setup = GetParam();
+  // Tests don't sync by default, but syncing is what's measured.
+  FLAGS_never_fsync = false;
+  FLAGS_env_use_fsync = setup.sync_mode == SyncMode::FSYNC;
+
+  vector<int> entry_sizes;
+  vector<int> batch_sizes;
+  vector<int> producers;
+  ASSERT_OK(ParseIntList(FLAGS_log_bench_entry_bytes, &entry_sizes));
+  ASSERT_OK(ParseIntList(FLAGS_log_bench_batch_sizes, &batch_sizes));
+  ASSERT_OK(ParseIntList(FLAGS_log_bench_producers, &producers));
+  const vector<string> codecs =
+      strings::Split(FLAGS_log_bench_codecs, ",", strings::SkipEmpty());
+
+  for (const string& codec : codecs) {
+    for (int entry_bytes : entry_sizes) {
+      for (int batch_size : batch_sizes) {
+        for (int num_producers : producers) {
+          NO_FATALS(RunBench(entry_bytes, batch_size, num_producers, codec));
+        }
+      }
+    }
+  }
+}
+
+} // namespace log
+} // namespace kudu
@@ -28,9 +28,11 @@
 #include <cstdint>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -46,18 +48,25 @@
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_anchor_registry.h"
 #include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_metrics.h"
 #include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/log_util.h"
+#include "kudu/consensus/log_verifier.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/env.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/random.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
@@ -75,6 +84,20 @@ DECLARE_double(log_inject_io_error_on_preallocate_fraction);
 DECLARE_int64(fs_wal_dir_reserved_bytes);
 DECLARE_int64(disk_reserved_bytes_free_for_testing);
 DECLARE_string(log_compression_codec);
+DECLARE_bool(log_adaptive_group_commit);
+DECLARE_int32(log_adaptive_group_commit_max_wait_us);
+DECLARE_int32(log_reader_open_threads);
+DECLARE_int32(log_recovery_readahead_bytes);
+DECLARE_int32(log_segment_file_cache_capacity);
+DECLARE_bool(log_cold_reads_drop_cache);
+DECLARE_bool(log_mmap_closed_segments);
+DECLARE_bool(log_background_segment_deletion);
+DECLARE_int64(log_segment_deletion_truncate_bytes);
+DECLARE_int32(log_cold_read_readahead_bytes);
+DECLARE_int32(log_segment_sparse_index_interval);
+DECLARE_bool(log_store_compressed_batches_raw);
+DECLARE_double(env_inject_eio);
+DECLARE_string(env_inject_eio_globs);
 
 namespace kudu {
 namespace log {
@@ -84,13 +107,41 @@ using consensus::MakeOpId;
 using consensus::NO_OP;
 using consensus::OpId;
 using consensus::ReplicateMsg;
+using consensus::ReplicateRefPtr;
 using consensus::WRITE_OP;
+using consensus::WRITE_OP_EXT;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
+// A codec which fails to compress, sizing its output like 'codec'.
+class FailingCodec : public CompressionCodec {
+ public:
+  explicit FailingCodec(shared_ptr<CompressionCodec> codec)
+      : codec_(std::move(codec)) {}
+
+  Status Compress(const Slice&, uint8_t*, size_t*) override {
+    return Status::RuntimeError("injected compression failure");
+  }
+  Status Compress(const vector<Slice>&, uint8_t*, size_t*) override {
+    return Status::RuntimeError("injected compression failure");
+  }
+  Status Uncompress(const Slice&, uint8_t*, size_t) override {
+    return Status::NotSupported("FailingCodec can't uncompress");
+  }
+  size_t MaxCompressedLength(size_t source_bytes) const override {
+    return codec_->MaxCompressedLength(source_bytes);
+  }
+  CompressionType type() const override {
+    return codec_->type();
+  }
+
+ private:
+  const shared_ptr<CompressionCodec> codec_;
+};
+
 struct TestLogSequenceElem {
   enum ElemType { REPLICATE, COMMIT, ROLL };
   ElemType type;
@@ -1176,6 +1227,987 @@ TEST_F(LogTest, TestDiskSpaceCheck) {
   // detect that we are past the preallocation limit.
 }
 
+static void RecordCompletedIndex(
+    vector<int64_t>* completed,
+    simple_spinlock* lock,
+    int64_t index,
+    const Status& s) {
+  CHECK_OK(s);
+  std::lock_guard<simple_spinlock> l(*lock);
+  completed->push_back(index);
+}
+
+// Test that with the append pipeline enabled, groups written while an earlier
+// group is being synced are all durable and readable, including across
+// segment rollovers, and that their callbacks run in append order.
+TEST_F(LogTest, TestPipelinedAppend) {
+  options_.force_fsync_all = true;
+  options_.pipelined_append = true;
+  ASSERT_OK(BuildLog());
+  log_->SetMaxSegmentSizeForTests(4096);
+
+  const int kNumOps = 200;
+  vector<int64_t> completed;
+  simple_spinlock completed_lock;
+  vector<ReplicateRefPtr> replicates;
+  for (int64_t i = 1; i <= kNumOps; i++) {
+    ReplicateRefPtr replicate =
+        make_scoped_refptr_replicate(new ReplicateMsg());
+    replicate->get()->mutable_id()->CopyFrom(MakeOpId(1, i));
+    replicate->get()->set_op_type(NO_OP);
+    replicate->get()->set_timestamp(clock_->Now().ToUint64());
+    replicates.push_back(replicate);
+    ASSERT_OK(log_->AsyncAppendReplicates(
+        {replicate},
+        Bind(&RecordCompletedIndex, &completed, &completed_lock, i)));
+  }
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+
+  ASSERT_EQ(kNumOps, completed.size());
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(i + 1, completed[i]);
+  }
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_GT(segments.size(), 1);
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(kNumOps, num_entries);
+}
+
+// Test that with adaptive group commit enabled, every group is accounted for
+// by exactly one of the group-close reasons, and that all appends succeed.
+TEST_F(LogTest, TestAdaptiveGroupCommit) {
+  FLAGS_log_adaptive_group_commit = true;
+  FLAGS_log_adaptive_group_commit_max_wait_us = 2000;
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+
+  ASSERT_OK(AppendReplicateBatchAndCommitEntryPairsToLog(100, APPEND_ASYNC));
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  ASSERT_OK(log_->Close());
+
+  const LogMetrics* metrics = log_->metrics_.get();
+  ASSERT_GT(metrics->entry_batches_per_group->TotalCount(), 0);
+  ASSERT_EQ(
+      metrics->entry_batches_per_group->TotalCount(),
+      metrics->groups_closed_no_wait->value() +
+          metrics->groups_closed_window_expired->value() +
+          metrics->groups_closed_size_limit->value());
+  ASSERT_EQ(
+      metrics->entry_batches_per_group->TotalCount(),
+      metrics->group_commit_window->TotalCount());
+}
+
+// Test that every group records one sample for each stage of the append path.
+TEST_F(LogTest, TestAppendStageMetrics) {
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+
+  ASSERT_OK(AppendReplicateBatchAndCommitEntryPairsToLog(20, APPEND_ASYNC));
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  ASSERT_OK(log_->Close());
+
+  const LogMetrics* metrics = log_->metrics_.get();
+  int64_t num_groups = metrics->entry_batches_per_group->TotalCount();
+  ASSERT_GT(num_groups, 0);
+  ASSERT_EQ(num_groups, metrics->group_queue_wait->TotalCount());
+  ASSERT_EQ(num_groups, metrics->group_serialize_latency->TotalCount());
+  ASSERT_EQ(num_groups, metrics->group_callback_latency->TotalCount());
+  ASSERT_EQ(num_groups, metrics->group_commit_latency->TotalCount());
+  ASSERT_GE(metrics->fsync_budget_used->value(), 0);
+  ASSERT_LE(metrics->fsync_budget_used->value(), 100);
+}
+
+// Test that with WAL striping enabled, segments are placed round-robin across
+// the stripe directories and that they are all read back in sequence.
+TEST_F(LogTest, TestStripedSegments) {
+  FsManagerOpts opts(GetTestPath("striped_fs_root"));
+  opts.wal_stripe_roots = {GetTestPath("wal_stripe_1"),
+                           GetTestPath("wal_stripe_2")};
+  fs_manager_.reset(new FsManager(env_, std::move(opts)));
+  ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+  ASSERT_OK(fs_manager_->Open());
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 5;
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 0; i < kNumSegments; i++) {
+    ASSERT_OK(AppendNoOps(&opid, 2));
+    ASSERT_OK(RollLog());
+  }
+  ASSERT_OK(log_->Close());
+
+  vector<string> stripe_dirs = fs_manager_->GetTabletWalStripeDirs(kTestTablet);
+  ASSERT_EQ(3, stripe_dirs.size());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(kNumSegments + 1, segments.size());
+  int64_t prev_seqno = -1;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    int64_t seqno = segment->header().sequence_number();
+    if (prev_seqno != -1) {
+      ASSERT_EQ(prev_seqno + 1, seqno);
+    }
+    prev_seqno = seqno;
+    ASSERT_EQ(stripe_dirs[seqno % stripe_dirs.size()], DirName(segment->path()));
+  }
+
+  ASSERT_TRUE(Log::HasOnDiskData(fs_manager_.get(), kTestTablet));
+  ASSERT_OK(Log::DeleteOnDiskData(fs_manager_.get(), kTestTablet));
+  ASSERT_FALSE(Log::HasOnDiskData(fs_manager_.get(), kTestTablet));
+}
+
+// Test that GC'd segment files are recycled, up to the pool depth, and that
+// segments reusing them read back only their own entries.
+TEST_F(LogTest, TestSegmentRecycling) {
+  FLAGS_log_min_segments_to_retain = 1;
+  options_.segment_recycle_pool_size = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(5, 5, &op_id, &anchors));
+
+  // Release all but the last anchor, so that three segments can be GC'd but
+  // only two of them fit in the pool.
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  ASSERT_EQ(2, log_->recycled_segment_paths_.size());
+  for (const string& path : log_->recycled_segment_paths_) {
+    ASSERT_TRUE(env_->FileExists(path));
+  }
+
+  // The next two segments reuse the recycled files; the third needs a new one.
+  const LogMetrics* metrics = log_->metrics_.get();
+  int64_t misses = metrics->segment_recycle_pool_misses->value();
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(AppendNoOps(&op_id, 2));
+    ASSERT_OK(RollLog());
+  }
+  ASSERT_EQ(2, metrics->segment_recycle_pool_hits->value());
+  ASSERT_EQ(misses + 1, metrics->segment_recycle_pool_misses->value());
+  ASSERT_TRUE(log_->recycled_segment_paths_.empty());
+  ASSERT_OK(log_->Close());
+
+  // No entries from the recycled files' previous lives may show up.
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  // The two retained segments hold 5 ops each, and each of the three segments
+  // written afterwards holds 2.
+  ASSERT_EQ(2 * 5 + 3 * 2, num_entries);
+}
+
+// Test that a GC'd segment which is still being read isn't recycled, and
+// that it still reads back its own entries.
+TEST_F(LogTest, TestSegmentNotRecycledWhileRead) {
+  FLAGS_log_min_segments_to_retain = 1;
+  options_.segment_recycle_pool_size = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(3, 5, &op_id, &anchors));
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  scoped_refptr<ReadableLogSegment> held = segments[0];
+  segments.clear();
+
+  for (int i = 0; i < 2; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(2, num_gced_segments);
+  ASSERT_EQ(1, log_->recycled_segment_paths_.size());
+  ASSERT_STR_NOT_CONTAINS(
+      log_->recycled_segment_paths_[0], BaseName(held->path()));
+
+  entries_.clear();
+  ASSERT_OK(held->ReadEntries(&entries_));
+  ASSERT_EQ(5, entries_.size());
+  ASSERT_EQ(1, entries_.front()->replicate().id().index());
+  ASSERT_EQ(5, entries_.back()->replicate().id().index());
+}
+
+// Test that the preallocated space of new segments is zero-filled, and that
+// closing a segment still trims it to what was written.
+TEST_F(LogTest, TestZeroPreallocatedSegments) {
+  options_.segment_size_mb = 1;
+  options_.async_preallocate_segments = false;
+  options_.zero_preallocated_segments = true;
+  ASSERT_OK(BuildLog());
+
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendNoOps(&op_id, 5));
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(log_->ActiveSegmentPathForTests(), &size));
+  ASSERT_EQ(1024 * 1024, size);
+
+  ASSERT_OK(RollLog());
+  ASSERT_OK(AppendNoOps(&op_id, 5));
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(2, segments.size());
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    ASSERT_LT(segment->file_size(), 1024 * 1024);
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(10, num_entries);
+}
+
+// Test that a batch which fails to compress, and batches whose flush fails,
+// leave nothing behind in the segment, which still reads back.
+TEST_F(LogTest, TestFailedBufferAndFlushLeaveSegmentReadable) {
+  shared_ptr<CompressionCodec> lz4;
+  ASSERT_OK(CompressionCodecManager::GetCodec(LZ4, &lz4));
+  auto failing = std::make_shared<FailingCodec>(lz4);
+
+  const string path = GetTestPath("wal-failed-appends");
+  unique_ptr<WritableFile> file;
+  ASSERT_OK(env_->NewWritableFile(path, &file));
+  WritableLogSegment segment(path, shared_ptr<WritableFile>(file.release()));
+  LogSegmentHeaderPB header;
+  header.set_sequence_number(1);
+  header.set_tablet_id(kTestTablet);
+  header.set_compression_codec(LZ4);
+  ASSERT_OK(segment.WriteHeaderAndOpen(header));
+
+  auto batch_of = [](int64_t index) {
+    LogEntryBatchPB batch;
+    LogEntryPB* entry = batch.add_entry();
+    entry->set_type(REPLICATE);
+    ReplicateMsg* replicate = entry->mutable_replicate();
+    replicate->mutable_id()->CopyFrom(MakeOpId(1, index));
+    replicate->set_timestamp(index);
+    replicate->set_op_type(NO_OP);
+    replicate->mutable_noop_request();
+    return batch;
+  };
+  ASSERT_OK(segment.BufferEntryBatch(batch_of(1), lz4));
+  const int64_t buffered_offset = segment.buffered_offset();
+  ASSERT_TRUE(segment.BufferEntryBatch(batch_of(2), failing).IsRuntimeError());
+  ASSERT_EQ(buffered_offset, segment.buffered_offset());
+  ASSERT_OK(segment.FlushBufferedEntryBatches());
+
+  ASSERT_OK(segment.BufferEntryBatch(batch_of(2), lz4));
+  FLAGS_env_inject_eio = 1.0;
+  FLAGS_env_inject_eio_globs = path;
+  ASSERT_TRUE(segment.FlushBufferedEntryBatches().IsIOError());
+  FLAGS_env_inject_eio = 0;
+  ASSERT_EQ(segment.written_offset(), segment.buffered_offset());
+
+  ASSERT_OK(segment.BufferEntryBatch(batch_of(3), lz4));
+  LogSegmentFooterPB footer;
+  footer.set_num_entries(2);
+  ASSERT_OK(segment.WriteFooterAndClose(footer));
+
+  scoped_refptr<ReadableLogSegment> readable;
+  ASSERT_OK(ReadableLogSegment::Open(env_, path, &readable));
+  LogEntries entries;
+  ASSERT_OK(readable->ReadEntries(&entries));
+  ASSERT_EQ(2, entries.size());
+  ASSERT_EQ(1, entries[0]->replicate().id().index());
+  ASSERT_EQ(3, entries[1]->replicate().id().index());
+}
+
+// Test that with a target roll interval, a segment open for too long is
+// rolled over, and the next one is sized from the append rate within bounds.
+TEST_F(LogTest, TestAdaptiveSegmentSize) {
+  options_.segment_size_mb = 4;
+  options_.async_preallocate_segments = false;
+  options_.segment_target_roll_interval_ms = 10;
+  options_.min_segment_size_mb = 1;
+  options_.max_segment_size_mb = 2;
+  ASSERT_OK(BuildLog());
+
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendNoOps(&op_id, 5));
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(log_->ActiveSegmentPathForTests(), &size));
+  ASSERT_EQ(4 * 1024 * 1024, size);
+  const string first_segment = log_->ActiveSegmentPathForTests();
+
+  // The first segment is sized by 'segment_size_mb'. Five no-ops in 30ms come
+  // to far less than a MB per 10ms, so the next one gets the minimum size.
+  SleepFor(MonoDelta::FromMilliseconds(30));
+  ASSERT_OK(AppendNoOps(&op_id, 5));
+  ASSERT_NE(first_segment, log_->ActiveSegmentPathForTests());
+  ASSERT_OK(env_->GetFileSize(log_->ActiveSegmentPathForTests(), &size));
+  ASSERT_EQ(1024 * 1024, size);
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  ASSERT_EQ(2, reader->num_segments());
+}
+
+// Test that closed segments read through the shared segment file cache, with
+// fewer descriptors than segments, and that the files of GC'd segments are
+// only deleted once their last reader is done.
+TEST_F(LogTest, TestSegmentFileCache) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_segment_file_cache_capacity = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(5, 5, &op_id, &anchors));
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(5, segments.size());
+  int num_entries = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    num_entries += entries_.size();
+  }
+  ASSERT_EQ(5 * 5, num_entries);
+
+  // GC the first segments while the snapshot still holds them.
+  for (int i = 0; i < 4; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  const string first_path = segments[0]->path();
+  ASSERT_TRUE(env_->FileExists(first_path));
+  entries_.clear();
+  ASSERT_OK(segments[0]->ReadEntries(&entries_));
+  ASSERT_EQ(5, entries_.size());
+
+  segments.clear();
+  ASSERT_FALSE(env_->FileExists(first_path));
+}
+
+// Test that segments GC'd with background deletion are renamed aside at once
+// and deleted later, and that their bytes are counted until then.
+TEST_F(LogTest, TestBackgroundSegmentDeletion) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_background_segment_deletion = true;
+  FLAGS_log_segment_deletion_truncate_bytes = 64;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, &anchors));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  const string first_path = segments[0]->path();
+  segments.clear();
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(2, num_gced_segments);
+  ASSERT_FALSE(env_->FileExists(first_path));
+
+  const LogMetrics* metrics = log_->metrics_.get();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(0, metrics->segment_pending_deletion_bytes->value());
+    vector<string> children;
+    ASSERT_OK(env_->GetChildren(log_->log_dir_, &children));
+    for (const string& child : children) {
+      ASSERT_EQ(string::npos, child.find("deleting")) << child;
+    }
+  });
+}
+
+// Test that a segment deleted in the background while it's still being read
+// is only unlinked, so that it still reads back in full.
+TEST_F(LogTest, TestBackgroundSegmentDeletionWhileRead) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_background_segment_deletion = true;
+  FLAGS_log_segment_deletion_truncate_bytes = 64;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(3, 5, &op_id, &anchors));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  scoped_refptr<ReadableLogSegment> held = segments[0];
+  segments.clear();
+
+  for (int i = 0; i < 2; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(2, num_gced_segments);
+
+  const LogMetrics* metrics = log_->metrics_.get();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(0, metrics->segment_pending_deletion_bytes->value());
+  });
+  entries_.clear();
+  ASSERT_OK(held->ReadEntries(&entries_));
+  ASSERT_EQ(5, entries_.size());
+}
+
+// Test that closed segments only retained for peers are moved to the WAL
+// archive, and that they are still read from there, also after a restart.
+TEST_F(LogTest, TestSegmentArchiving) {
+  FsManagerOpts opts(GetTestPath("archive_fs_root"));
+  opts.wal_archive_root = GetTestPath("wal_archive");
+  fs_manager_.reset(new FsManager(env_, std::move(opts)));
+  ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+  ASSERT_OK(fs_manager_->Open());
+  ASSERT_OK(BuildLog());
+  const string archive_dir = fs_manager_->GetTabletWalArchiveDir(kTestTablet);
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, &anchors));
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  // Peers still need everything, so nothing is deleted.
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(
+      &retention.for_durability));
+  retention.for_peers = 1;
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  vector<string> original_paths;
+  for (const auto& segment : segments) {
+    if (segment->HasFooter() && segment->footer().has_max_replicate_index() &&
+        segment->footer().max_replicate_index() < retention.for_durability) {
+      original_paths.emplace_back(segment->path());
+    }
+  }
+  ASSERT_FALSE(original_paths.empty());
+
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(0, num_gced_segments);
+  const LogMetrics* metrics = log_->metrics_.get();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(original_paths.size(), metrics->segments_archived->value());
+  });
+  for (const string& path : original_paths) {
+    ASSERT_FALSE(env_->FileExists(path)) << path;
+    ASSERT_TRUE(env_->FileExists(JoinPathSegments(archive_dir, BaseName(path))))
+        << path;
+  }
+
+  // Every op is still read, whichever directory its segment is in.
+  {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter replicate_deleter(&replicates);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        1, 20, LogReader::kNoSizeLimit, ReadContext(), &replicates));
+    ASSERT_EQ(20, replicates.size());
+  }
+
+  // Another GC neither archives them again nor fails.
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_OK(log_->Close());
+  ASSERT_EQ(original_paths.size(), metrics->segments_archived->value());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(archive_dir, DirName(segments[0]->path()));
+  int64_t prev_seqno = -1;
+  for (const auto& segment : segments) {
+    int64_t seqno = segment->header().sequence_number();
+    if (prev_seqno != -1) {
+      ASSERT_EQ(prev_seqno + 1, seqno);
+    }
+    prev_seqno = seqno;
+  }
+}
+
+// Test that dropping cold reads from the page cache, and reading ahead of
+// them, doesn't change what is read.
+TEST_F(LogTest, TestColdReadsDropCache) {
+  FLAGS_log_cold_reads_drop_cache = true;
+  FLAGS_log_cold_read_readahead_bytes = 1024;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+
+  // Read the closed segments twice, the second time behind where the first
+  // read ahead to.
+  for (int i = 0; i < 2; i++) {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter replicate_deleter(&replicates);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        1, 15, LogReader::kNoSizeLimit, ReadContext(), &replicates));
+    ASSERT_EQ(15, replicates.size());
+    for (int j = 0; j < replicates.size(); j++) {
+      ASSERT_EQ(j + 1, replicates[j]->id().index());
+    }
+  }
+}
+
+// Test that ops are read from mapped closed segments, whether decoded or
+// handed back still serialized, as well as from the active segment.
+TEST_F(LogTest, TestMmapClosedSegments) {
+  FLAGS_log_mmap_closed_segments = true;
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter replicate_deleter(&replicates);
+  ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+      1, 15, LogReader::kNoSizeLimit, ReadContext(), &replicates));
+  ASSERT_EQ(15, replicates.size());
+  for (int i = 0; i < replicates.size(); i++) {
+    ASSERT_EQ(i + 1, replicates[i]->id().index());
+  }
+
+  unique_ptr<LogReader::RangeIterator> iter =
+      log_->reader()->NewRangeIterator(1, 15);
+  LogReader::RangeBatch batch;
+  int64_t expected_index = 1;
+  Status s;
+  while ((s = iter->Next(&batch)).ok()) {
+    for (const Slice& data : batch.replicates) {
+      ReplicateMsg replicate;
+      ASSERT_TRUE(replicate.ParseFromArray(data.data(), data.size()));
+      ASSERT_EQ(expected_index, replicate.id().index());
+      expected_index++;
+    }
+  }
+  ASSERT_TRUE(s.IsEndOfFile()) << s.ToString();
+  ASSERT_EQ(16, expected_index);
+}
+
+// Test that reading only the headers of the entries of a segment gives the
+// same ops as parsing them, with the payloads pointing into the batches.
+TEST_F(LogTest, TestReadNextBatchHeaders) {
+  ASSERT_OK(BuildLog());
+  for (int i = 1; i <= 10; i++) {
+    ReplicateRefPtr replicate = make_scoped_refptr_replicate(new ReplicateMsg);
+    *replicate->get()->mutable_id() = MakeOpId(1, i);
+    replicate->get()->set_timestamp(clock_->Now().ToUint64());
+    if (i % 3 == 0) {
+      replicate->get()->set_op_type(NO_OP);
+    } else {
+      replicate->get()->set_op_type(WRITE_OP_EXT);
+      replicate->get()->mutable_write_payload()->set_payload(
+          string(100 * i, 'a' + i));
+    }
+    ASSERT_OK(AppendReplicateBatch(replicate));
+  }
+  ASSERT_OK(RollLog());
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  const scoped_refptr<ReadableLogSegment>& segment = segments[0];
+
+  LogEntries parsed;
+  ASSERT_OK(segment->ReadEntries(&parsed));
+  LogEntryReader reader(segment.get());
+  vector<LogEntryHeaderView> entries;
+  int64_t batch_offset;
+  int num_read = 0;
+  Status s;
+  while ((s = reader.ReadNextBatchHeaders(&entries, &batch_offset)).ok()) {
+    for (const LogEntryHeaderView& entry : entries) {
+      ASSERT_LT(num_read, parsed.size());
+      const LogEntryPB& expected = *parsed[num_read++];
+      ASSERT_EQ(expected.type(), entry.type);
+      ASSERT_EQ(expected.has_replicate(), entry.has_replicate);
+      if (!entry.has_replicate) {
+        continue;
+      }
+      const ReplicateMsg& replicate = expected.replicate();
+      ASSERT_TRUE(OpIdEquals(replicate.id(), entry.replicate.id));
+      ASSERT_EQ(replicate.timestamp(), entry.replicate.timestamp);
+      ASSERT_EQ(replicate.op_type(), entry.replicate.op_type);
+      ASSERT_EQ(
+          replicate.write_payload().payload(),
+          entry.replicate.payload.ToString());
+      ASSERT_EQ(
+          replicate.SerializeAsString(), entry.replicate_data.ToString());
+    }
+  }
+  ASSERT_TRUE(s.IsEndOfFile()) << s.ToString();
+  ASSERT_EQ(parsed.size(), num_read);
+
+  // A truncated op is rejected.
+  const string data = parsed[0]->replicate().SerializeAsString();
+  ReplicateHeaderView header;
+  ASSERT_TRUE(DecodeReplicateHeader(Slice(data), &header));
+  ASSERT_FALSE(
+      DecodeReplicateHeader(Slice(data.data(), data.size() - 1), &header));
+}
+
+// Test that closed segments can be read back chunk by chunk, as they are
+// when copied to another server, and that the active one can't.
+TEST_F(LogTest, TestReadSegmentChunks) {
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(3, 5, &op_id, nullptr));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_GE(segments.size(), 2);
+  const scoped_refptr<ReadableLogSegment>& segment = segments[0];
+  const int64_t seqno = segment->header().sequence_number();
+
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, segment->path(), &contents));
+  faststring copy;
+  int64_t offset = 0;
+  while (offset < contents.size()) {
+    faststring chunk;
+    int64_t segment_size;
+    ASSERT_OK(
+        log_->ReadSegmentChunk(seqno, offset, 100, &chunk, &segment_size));
+    ASSERT_EQ(contents.size(), segment_size);
+    ASSERT_GT(chunk.size(), 0);
+    copy.append(chunk.data(), chunk.size());
+    offset += chunk.size();
+  }
+  ASSERT_EQ(contents.ToString(), copy.ToString());
+
+  faststring chunk;
+  int64_t segment_size;
+  Status s = log_->ReadSegmentChunk(
+      segments.back()->header().sequence_number(),
+      0,
+      100,
+      &chunk,
+      &segment_size);
+  ASSERT_TRUE(s.IsIllegalState()) << s.ToString();
+  s = log_->ReadSegmentChunk(seqno + 1000, 0, 100, &chunk, &segment_size);
+  ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+}
+
+// Test that verifying the WAL passes, with its log index, and that it
+// reports a corrupt closed segment.
+TEST_F(LogTest, TestVerifyWals) {
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_OK(log_->Close());
+
+  WalVerifyReport report;
+  ASSERT_OK(VerifyWals(fs_manager_.get(), {}, 2, &report));
+  LOG(INFO) << report.ToString();
+  ASSERT_EQ(1, report.tablets.size());
+  ASSERT_EQ(kTestTablet, report.tablets[0].tablet_id);
+  ASSERT_EQ(segments.size(), report.tablets[0].segments);
+  ASSERT_EQ(20, report.tablets[0].replicates);
+  ASSERT_EQ(0, report.total_errors());
+
+  const scoped_refptr<ReadableLogSegment>& first = segments[0];
+  ASSERT_OK(CorruptLogFile(
+      env_,
+      first->path(),
+      FLIP_BYTE,
+      first->first_entry_offset() + (first->readable_up_to() -
+                                     first->first_entry_offset()) / 2));
+  ASSERT_OK(VerifyWals(fs_manager_.get(), {kTestTablet}, 2, &report));
+  LOG(INFO) << report.ToString();
+  ASSERT_GT(report.total_errors(), 0);
+}
+
+// Test that with a separate commit lane, commits never force a sync of their
+// own and are always written after the replicates they commit.
+TEST_F(LogTest, TestSeparateCommitLane) {
+  options_.force_fsync_all = true;
+  options_.separate_commit_lane = true;
+  ASSERT_OK(BuildLog());
+
+  const int kNumOps = 5;
+  for (int i = 1; i <= kNumOps; i++) {
+    ASSERT_OK(AppendReplicateBatch(MakeOpId(1, i)));
+  }
+  const LogMetrics* metrics = log_->metrics_.get();
+  int64_t num_syncs = metrics->sync_latency->TotalCount();
+  for (int i = 1; i <= kNumOps; i++) {
+    ASSERT_OK(AppendCommit(MakeOpId(1, i)));
+  }
+  ASSERT_EQ(num_syncs, metrics->sync_latency->TotalCount());
+
+  // Interleave both lanes without waiting on either.
+  for (int i = kNumOps + 1; i <= 3 * kNumOps; i++) {
+    ASSERT_OK(AppendReplicateBatch(MakeOpId(1, i), APPEND_ASYNC));
+    ASSERT_OK(AppendCommit(MakeOpId(1, i), APPEND_ASYNC));
+  }
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(
+      fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  int64_t max_replicate_index = 0;
+  int num_commits = 0;
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    entries_.clear();
+    ASSERT_OK(segment->ReadEntries(&entries_));
+    for (const auto& entry : entries_) {
+      if (entry->type() == REPLICATE) {
+        max_replicate_index =
+            std::max(max_replicate_index, entry->replicate().id().index());
+      } else if (entry->type() == COMMIT) {
+        ASSERT_LE(entry->commit().commited_op_id().index(), max_replicate_index);
+        num_commits++;
+      }
+    }
+  }
+  ASSERT_EQ(3 * kNumOps, max_replicate_index);
+  ASSERT_EQ(3 * kNumOps, num_commits);
+}
+
+// Test that segments are opened in parallel at reader startup and that the
+// in-progress segment's footer is rebuilt through the readahead buffer.
+TEST_F(LogTest, TestParallelSegmentOpen) {
+  // A tiny readahead window forces the scan to refill it repeatedly.
+  FLAGS_log_recovery_readahead_bytes = 100;
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 6;
+  const int kOpsPerSegment = 10;
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 0; i < kNumSegments; i++) {
+    ASSERT_OK(AppendNoOps(&opid, kOpsPerSegment));
+    if (i != kNumSegments - 1) {
+      ASSERT_OK(RollLog());
+    }
+  }
+  // Leave the active segment without a footer, as after a crash.
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+
+  for (int threads : {1, 4}) {
+    FLAGS_log_reader_open_threads = threads;
+    shared_ptr<LogReader> reader;
+    ASSERT_OK(LogReader::Open(
+        fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+    SegmentSequence segments;
+    ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+    ASSERT_EQ(kNumSegments, segments.size());
+    ASSERT_EQ(kOpsPerSegment, segments.back()->footer().num_entries());
+
+    int num_entries = 0;
+    for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+      entries_.clear();
+      ASSERT_OK(segment->ReadEntries(&entries_));
+      num_entries += entries_.size();
+    }
+    ASSERT_EQ(kNumSegments * kOpsPerSegment, num_entries);
+  }
+}
+
+// Test that ranges of ops in closed segments are streamed using the segments'
+// sparse indexes, and that a segment in which ops were rewritten is read
+// through the LogIndex instead.
+TEST_F(LogTest, TestReadReplicatesUsingSparseIndex) {
+  FLAGS_log_segment_sparse_index_interval = 4;
+  ASSERT_OK(BuildLog());
+
+  // Three closed segments holding ops 1-30, then ops 31-40 in the active one.
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(AppendNoOps(&opid, 10));
+    ASSERT_OK(RollLog());
+  }
+  ASSERT_OK(AppendNoOps(&opid, 10));
+
+  shared_ptr<LogReader> reader = log_->reader();
+  auto read_and_verify = [&](int64_t from, int64_t to, int64_t rewritten_at) {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(reader->ReadReplicatesInRange(
+        from, to, LogReader::kNoSizeLimit, &repls));
+    ASSERT_EQ(to - from + 1, repls.size());
+    int64_t expected_index = from;
+    for (const ReplicateMsg* repl : repls) {
+      ASSERT_EQ(expected_index, repl->id().index());
+      ASSERT_EQ(expected_index >= rewritten_at ? 2 : 1, repl->id().term());
+      expected_index++;
+    }
+  };
+
+  // Ops 3-30 are streamed, at least one batch per op; 31-35 come from the
+  // active segment through the LogIndex.
+  NO_FATALS(read_and_verify(3, 35, std::numeric_limits<int64_t>::max()));
+  int64_t streamed = reader->batches_streamed_->value();
+  ASSERT_GE(streamed, 28);
+
+  // Rewrite ops 35 onwards in the active segment and close it. The segment
+  // now holds stale copies of ops 35-40 and mustn't be streamed.
+  opid = MakeOpId(2, 35);
+  ASSERT_OK(AppendNoOps(&opid, 10));
+  ASSERT_OK(RollLog());
+  NO_FATALS(read_and_verify(31, 44, 35));
+  ASSERT_EQ(streamed, reader->batches_streamed_->value());
+
+  // Closed, sequential segments are still streamed afterwards.
+  NO_FATALS(read_and_verify(21, 25, std::numeric_limits<int64_t>::max()));
+  ASSERT_GT(reader->batches_streamed_->value(), streamed);
+}
+
+// Test that a closed segment's sparse index is kept in its footer, and that
+// batches of already compressed payloads are stored raw and read back.
+TEST_F(LogTest, TestSparseIndexInFooterAndRawBatches) {
+  FLAGS_log_segment_sparse_index_interval = 2;
+  FLAGS_log_store_compressed_batches_raw = true;
+  ASSERT_OK(BuildLog());
+
+  // Alternate batches of compressed payloads, which are stored raw, with
+  // batches of no-ops, which are compressed.
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 0; i < 5; i++) {
+    ReplicateRefPtr replicate =
+        make_scoped_refptr_replicate(new ReplicateMsg());
+    replicate->get()->set_op_type(WRITE_OP_EXT);
+    replicate->get()->mutable_id()->CopyFrom(opid);
+    replicate->get()->set_timestamp(clock_->Now().ToUint64());
+    auto* payload = replicate->get()->mutable_write_payload();
+    payload->set_payload(Substitute("compressed payload $0", opid.index()));
+    payload->set_compression_codec(LZ4);
+    ASSERT_OK(AppendReplicateBatch(replicate));
+    opid.set_index(opid.index() + 1);
+    ASSERT_OK(AppendNoOps(&opid, 1));
+  }
+  string path = log_->ActiveSegmentPathForTests();
+  ASSERT_OK(RollLog());
+
+  // Reopen the closed segment from disk, as after a restart.
+  scoped_refptr<ReadableLogSegment> segment;
+  ASSERT_OK(ReadableLogSegment::Open(env_, path, &segment));
+  ASSERT_EQ(1, segment->header().incompatible_features_size());
+  ASSERT_EQ(5, segment->footer().batch_offsets_size());
+  const auto& sparse_index = segment->sparse_index();
+  ASSERT_TRUE(sparse_index);
+  int64_t offset;
+  ASSERT_FALSE(sparse_index->FindOffset(0, &offset));
+  ASSERT_TRUE(sparse_index->FindOffset(4, &offset));
+  ASSERT_EQ(segment->footer().batch_offsets(1).offset(), offset);
+
+  LogEntries entries;
+  ASSERT_OK(segment->ReadEntries(&entries));
+  ASSERT_EQ(10, entries.size());
+  for (int i = 0; i < entries.size(); i++) {
+    const ReplicateMsg& replicate = entries[i]->replicate();
+    ASSERT_EQ(i + 1, replicate.id().index());
+    if (i % 2 == 0) {
+      ASSERT_EQ(
+          Substitute("compressed payload $0", i + 1),
+          replicate.write_payload().payload());
+    } else {
+      ASSERT_EQ(NO_OP, replicate.op_type());
+    }
+  }
+}
+
+// Test that a range iterator hands back whole batches of still-serialized
+// replicates, starting and ending mid-batch, across closed segments and the
+// active one.
+TEST_F(LogTest, TestRangeIterator) {
+  ASSERT_OK(BuildLog());
+
+  // Batches of five ops: 1-20 and 21-40 in closed segments, 41-50 active.
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(AppendNoOpsToLogSync(clock_, log_.get(), &opid, 5));
+    if (i == 3 || i == 7) {
+      ASSERT_OK(RollLog());
+    }
+  }
+
+  unique_ptr<LogReader::RangeIterator> iter =
+      log_->reader()->NewRangeIterator(3, 48);
+  LogReader::RangeBatch batch;
+  int64_t expected_index = 3;
+  int num_batches = 0;
+  Status s;
+  while ((s = iter->Next(&batch)).ok()) {
+    num_batches++;
+    ASSERT_EQ(expected_index, batch.first_index);
+    ASSERT_EQ(
+        batch.last_index - batch.first_index + 1,
+        static_cast<int64_t>(batch.replicates.size()));
+    ASSERT_EQ(batch.last_index + 1, iter->next_index());
+
+    LogEntryBatchPB batch_pb;
+    ASSERT_TRUE(batch_pb.ParseFromArray(batch.data.data(), batch.data.size()));
+    ASSERT_GE(batch_pb.entry_size(), static_cast<int>(batch.replicates.size()));
+    for (const Slice& data : batch.replicates) {
+      ReplicateMsg replicate;
+      ASSERT_TRUE(replicate.ParseFromArray(data.data(), data.size()));
+      ASSERT_EQ(expected_index, replicate.id().index());
+      expected_index++;
+    }
+  }
+  ASSERT_TRUE(s.IsEndOfFile()) << s.ToString();
+  ASSERT_EQ(49, expected_index);
+  // Ops 3-5 and 46-48 come from partial batches, the rest from whole ones.
+  ASSERT_EQ(10, num_batches);
+}
+
 // Test that the append thread shuts itself down after it's idle.
 TEST_F(LogTest, TestAutoStopIdleAppendThread) {
   ASSERT_OK(BuildLog());
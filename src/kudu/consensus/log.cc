@@ -23,11 +23,13 @@
 
 #include "kudu/consensus/log.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
 #include <memory>
 #include <mutex>
 #include <ostream>
+#include <string>
 #include <utility>
 
 #include <boost/optional/optional.hpp>
@@ -40,8 +42,12 @@
 #include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/raft_resource_accounting.h"
+#include "kudu/consensus/startup_profile.h"
+#include "kudu/fs/dir_health.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/dynamic_annotations.h"
@@ -57,7 +63,9 @@
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/io_scheduler.h"
 #include "kudu/util/kernel_stack_watchdog.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -65,12 +73,28 @@
 #include "kudu/util/pb_util.h"
 #include "kudu/util/random.h"
 #include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/semaphore.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/stopwatch.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
+DECLARE_bool(log_mmap_closed_segments);
+
 // Log retention configuration.
 // -----------------------------
+DEFINE_bool(
+    log_background_segment_deletion,
+    false,
+    "Whether garbage-collected WAL segments are deleted by a background "
+    "thread with idle I/O priority, rather than by the thread running the "
+    "GC, so that slow unlinks of large files don't stall appends. Segments "
+    "opened through --log_segment_file_cache_capacity are always deleted "
+    "inline.");
+TAG_FLAG(log_background_segment_deletion, experimental);
+TAG_FLAG(log_background_segment_deletion, runtime);
+
 DEFINE_int32(
     log_min_segments_to_retain,
     1,
@@ -97,6 +121,34 @@ DEFINE_int32(
     "Maximum size of the group commit queue in bytes");
 TAG_FLAG(group_commit_queue_size_bytes, advanced);
 
+DEFINE_bool(
+    log_adaptive_group_commit,
+    false,
+    "If true, the log append thread may wait for a short, self-tuning "
+    "interval after draining a group for more entries to arrive before "
+    "syncing it. The interval is sized from recently observed fsync "
+    "latencies and the current arrival rate, and is empty when entries "
+    "arrive too slowly for waiting to pay off.");
+TAG_FLAG(log_adaptive_group_commit, experimental);
+TAG_FLAG(log_adaptive_group_commit, runtime);
+
+DEFINE_int32(
+    log_adaptive_group_commit_max_wait_us,
+    1000,
+    "Upper bound, in microseconds, on the adaptive group commit window. "
+    "Only takes effect if --log_adaptive_group_commit is true.");
+TAG_FLAG(log_adaptive_group_commit_max_wait_us, experimental);
+TAG_FLAG(log_adaptive_group_commit_max_wait_us, runtime);
+
+DEFINE_int32(
+    log_adaptive_group_commit_sync_percentile,
+    50,
+    "Percentile of recent log sync latencies used to size the adaptive "
+    "group commit window. Only takes effect if --log_adaptive_group_commit "
+    "is true.");
+TAG_FLAG(log_adaptive_group_commit_sync_percentile, experimental);
+TAG_FLAG(log_adaptive_group_commit_sync_percentile, runtime);
+
 DEFINE_int32(
     log_thread_idle_threshold_ms,
     1000,
@@ -105,6 +157,55 @@ DEFINE_int32(
 TAG_FLAG(log_thread_idle_threshold_ms, experimental);
 TAG_FLAG(log_thread_idle_threshold_ms, hidden);
 
+DEFINE_int32(
+    log_commit_lane_max_delay_ms,
+    10,
+    "With --log_separate_commit_lane, the longest a queued COMMIT entry waits "
+    "for a group of REPLICATE entries to be written behind before it is "
+    "written on its own.");
+TAG_FLAG(log_commit_lane_max_delay_ms, experimental);
+TAG_FLAG(log_commit_lane_max_delay_ms, runtime);
+
+DEFINE_int32(
+    log_segment_sparse_index_interval,
+    16,
+    "Every this many REPLICATE batches written to a segment, the batch's "
+    "offset is kept in an in-memory sparse index of the segment. Reads of "
+    "ranges of ops from closed segments seek with it and stream the segment "
+    "sequentially, rather than looking every op up in the log index. 0 "
+    "disables the sparse index.");
+TAG_FLAG(log_segment_sparse_index_interval, advanced);
+
+// Kernel stack watchdog thresholds. A thread which stays in one of these
+// sections longer than its threshold has its kernel and user stacks logged,
+// which shows where in the kernel (e.g. a journal commit, or memory
+// compaction) the time went.
+DEFINE_int32(
+    log_sync_watch_stack_ms,
+    0,
+    "If positive, the stacks of a thread which spends longer than this many "
+    "milliseconds fsyncing a WAL segment are logged. 0 disables the check.");
+TAG_FLAG(log_sync_watch_stack_ms, experimental);
+TAG_FLAG(log_sync_watch_stack_ms, runtime);
+
+DEFINE_int32(
+    log_append_watch_stack_ms,
+    0,
+    "If positive, the stacks of a thread which spends longer than this many "
+    "milliseconds writing out a group of WAL entries, or running the "
+    "callbacks of a synced group, are logged. 0 disables the check.");
+TAG_FLAG(log_append_watch_stack_ms, experimental);
+TAG_FLAG(log_append_watch_stack_ms, runtime);
+
+DEFINE_int32(
+    log_segment_allocation_watch_stack_ms,
+    0,
+    "If positive, the stacks of a thread which spends longer than this many "
+    "milliseconds creating or preallocating a WAL segment are logged. 0 "
+    "disables the check.");
+TAG_FLAG(log_segment_allocation_watch_stack_ms, experimental);
+TAG_FLAG(log_segment_allocation_watch_stack_ms, runtime);
+
 // Compression configuration.
 // -----------------------------
 DEFINE_string(
@@ -113,6 +214,16 @@ DEFINE_string(
     "Codec to use for compressing WAL segments.");
 TAG_FLAG(log_compression_codec, experimental);
 
+DEFINE_bool(
+    log_store_compressed_batches_raw,
+    false,
+    "Whether batches of REPLICATE entries whose payloads are all compressed "
+    "already are written to WAL segments without --log_compression_codec, "
+    "so that reading them back doesn't have to decompress the whole batch. "
+    "Segments written with this enabled can't be read by versions which "
+    "predate it.");
+TAG_FLAG(log_store_compressed_batches_raw, experimental);
+
 // Fault/latency injection flags.
 // -----------------------------
 DEFINE_bool(
@@ -194,6 +305,14 @@ DEFINE_validator(fs_wal_dir_reserved_bytes, [](const char* /*n*/, int64_t v) {
 TAG_FLAG(fs_wal_dir_reserved_bytes, runtime);
 TAG_FLAG(fs_wal_dir_reserved_bytes, evolving);
 
+DEFINE_string(
+    log_append_thread_cpus,
+    "",
+    "CPUs to bind the log append and sync threads to, e.g. \"0-7\". Empty "
+    "leaves the threads unbound.");
+TAG_FLAG(log_append_thread_cpus, experimental);
+DEFINE_validator(log_append_thread_cpus, &kudu::ValidateCpuListFlag);
+
 DEFINE_bool(
     raft_derived_log_mode,
     false,
@@ -218,13 +337,20 @@ namespace log {
 
 using consensus::OpId;
 using consensus::ReplicateRefPtr;
-using env_util::OpenFileForRandom;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
+// Number of recent sync latencies kept to compute the adaptive group commit
+// window.
+constexpr int kNumSyncLatencySamples = 32;
+
+// Length of the interval over which the share of time spent in fsync is
+// measured for the fsync budget gauge.
+constexpr int64_t kFsyncBudgetIntervalUs = 1000000;
+
 // Manages the thread which drains groups of batches from the log's queue and
 // appends them to the underlying log instance.
 //
@@ -248,6 +374,16 @@ using strings::Substitute;
 //    GoIdle().
 //
 // See the implementation comments in Wake() and GoIdle() for details.
+//
+// If LogOptions::pipelined_append is set, each group is handled in two stages:
+// the append task writes the group to the active segment and then hands it off
+// to a second single-threaded pool, which syncs the segment and runs the
+// callbacks. At most one group may be waiting in or running on the sync stage
+// at a time, so group N+1 is written while group N is being synced, and the
+// callbacks are still run in the order the groups were appended.
+//
+// If --log_adaptive_group_commit is set, a drained group may wait for more
+// entries before being synced. See MaybeExtendGroup() for details.
 class Log::AppendThread {
  public:
   explicit AppendThread(Log* log);
@@ -270,11 +406,37 @@ class Log::AppendThread {
     return base::subtle::NoBarrier_Load(&worker_state_) == WORKER_ACTIVE;
   }
 
+  // Blocks until every group handed off to the sync stage has been synced
+  // and had its callbacks run. Must be called before the active segment is
+  // closed or replaced. A no-op if the append pipeline is not enabled.
+  void WaitForPendingSyncs();
+
  private:
   // The task submitted to the threadpool which collects batches from the queue
   // and appends them, until it determines that the queue is idle.
   void DoWork();
 
+  // If --log_adaptive_group_commit is set, keeps draining the queue into
+  // 'entry_batches' until the adaptive window expires or the group reaches
+  // --group_commit_queue_size_bytes. Always updates the arrival statistics.
+  void MaybeExtendGroup(vector<LogEntryBatch*>* entry_batches);
+
+  // Records that 'num_batches' batches were drained from the queue at 'now'.
+  void RecordArrivals(size_t num_batches, MonoTime now);
+
+  // Records the latency of a single call to Log::Sync().
+  void RecordSyncLatency(MonoDelta latency);
+
+  // Accounts 'sync_latency' of fsync time, possibly zero, to the current
+  // fsync budget interval, and publishes the share of the interval spent in
+  // fsync once it has elapsed.
+  void UpdateFsyncBudget(MonoDelta sync_latency);
+
+  // Returns how long a freshly drained group should wait for more entries.
+  // Returns a zero delta if not enough history has been collected or the
+  // entries are expected to arrive more slowly than the window.
+  MonoDelta AdaptiveGroupCommitWindow() const;
+
   // Tries to transition back to WORKER_STOPPED state. If successful, returns
   // true.
   //
@@ -286,6 +448,17 @@ class Log::AppendThread {
   // the LogEntryBatch* pointers.
   void HandleGroup(vector<LogEntryBatch*> entry_batches);
 
+  // Syncs the log if 'needs_sync' is true, and then runs and deletes each of
+  // the batches in 'entry_batches'. 'group_start' is the time at which
+  // HandleGroup() started working on the group. If 'write_status' is not OK,
+  // the group could not be written out: the log is not synced and every
+  // callback is run with 'write_status'.
+  void SyncAndRunCallbacks(
+      const vector<LogEntryBatch*>& entry_batches,
+      bool needs_sync,
+      MonoTime group_start,
+      const Status& write_status);
+
   string LogPrefix() const;
 
   Log* const log_;
@@ -304,13 +477,43 @@ class Log::AppendThread {
   // Pool with a single thread, which handles shutting down the thread
   // when idle.
   std::unique_ptr<ThreadPool> append_pool_;
+
+  // Pool with a single thread which runs the sync stage of the pipeline.
+  // Only created if LogOptions::pipelined_append is set.
+  std::unique_ptr<ThreadPool> sync_pool_;
+
+  // Bounds the number of groups handed off to 'sync_pool_' which have not yet
+  // run their callbacks.
+  Semaphore sync_slots_;
+
+  // Protects the adaptive group commit statistics below. Sync latencies are
+  // recorded by the sync stage, which may run on a different thread than the
+  // append task.
+  mutable simple_spinlock window_lock_;
+
+  // Ring of the most recent sync latencies, in microseconds.
+  int64_t sync_latency_samples_us_[kNumSyncLatencySamples];
+  int num_sync_latency_samples_ = 0;
+  int next_sync_latency_sample_ = 0;
+
+  // Exponentially weighted moving average of the time between the arrival of
+  // two batches, in microseconds, and the time of the last drain.
+  double mean_interarrival_us_ = 0;
+  MonoTime last_drain_time_;
+
+  // Fsync time accumulated since the start of the current fsync budget
+  // interval, also protected by 'window_lock_'.
+  int64_t fsync_budget_busy_us_ = 0;
+  MonoTime fsync_budget_window_start_;
 };
 
-Log::AppendThread::AppendThread(Log* log) : log_(log) {}
+Log::AppendThread::AppendThread(Log* log) : log_(log), sync_slots_(1) {}
 
 Status Log::AppendThread::Init() {
   DCHECK(!append_pool_) << "Already initialized";
   VLOG_WITH_PREFIX(1) << "Starting log append thread";
+  vector<int> cpus;
+  RETURN_NOT_OK(ParseCpuList(FLAGS_log_append_thread_cpus, &cpus));
   RETURN_NOT_OK(ThreadPoolBuilder("wal-append")
                     .set_min_threads(0)
                     // Only need one thread since we'll only schedule one
@@ -319,7 +522,17 @@ Status Log::AppendThread::Init() {
                     // No need for keeping idle threads, since the task itself
                     // handles waiting for work while idle.
                     .set_idle_timeout(MonoDelta::FromSeconds(0))
+                    .set_cpus(cpus)
                     .Build(&append_pool_));
+  if (log_->options_.pipelined_append) {
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-sync")
+                      .set_min_threads(0)
+                      // A single thread keeps the callbacks of successive
+                      // groups in order.
+                      .set_max_threads(1)
+                      .set_cpus(cpus)
+                      .Build(&sync_pool_));
+  }
   return Status::OK();
 }
 
@@ -352,7 +565,7 @@ bool Log::AppendThread::GoIdle() {
   auto old_state =
       base::subtle::NoBarrier_AtomicExchange(&worker_state_, WORKER_STOPPED);
   DCHECK_EQ(old_state, WORKER_ACTIVE);
-  if (log_->entry_queue()->empty()) {
+  if (log_->entry_queue()->empty() && log_->commit_queue()->empty()) {
     // Nothing got enqueued, which means there must not have been any missed
     // wakeup. We are now in WORKER_STOPPED state.
     return true;
@@ -377,37 +590,189 @@ bool Log::AppendThread::GoIdle() {
 
 void Log::AppendThread::DoWork() {
   DCHECK_EQ(KUDU_ANNONTATE_UNPROTECTED_READ(worker_state_), WORKER_ACTIVE);
+  ScopedIOClass io_class(IOClass::kWalCommit);
   VLOG_WITH_PREFIX(2) << "WAL Appender going active";
+  const bool commit_lane = log_->options_.separate_commit_lane;
+  const MonoDelta idle_threshold =
+      MonoDelta::FromMilliseconds(FLAGS_log_thread_idle_threshold_ms);
+  MonoTime idle_deadline = MonoTime::Now() + idle_threshold;
   while (true) {
     CHECK(!FLAGS_raft_derived_log_mode);
-    MonoTime deadline = MonoTime::Now() +
-        MonoDelta::FromMilliseconds(FLAGS_log_thread_idle_threshold_ms);
+    // Commits are drained before replicates: the replicate of every commit
+    // drained here was enqueued before it, and so is drained below, or was
+    // drained earlier. Writing the commits behind that group thus keeps each
+    // commit after its replicate in the log.
+    vector<LogEntryBatch*> commit_batches;
+    MonoTime deadline = idle_deadline;
+    if (commit_lane) {
+      ignore_result(log_->commit_queue()->BlockingDrainTo(
+          &commit_batches, MonoTime::Now()));
+      // Wake up regularly to pick up commits, which don't wake this task
+      // while it waits on the replicate queue.
+      deadline = std::min(
+          deadline,
+          MonoTime::Now() +
+              MonoDelta::FromMilliseconds(FLAGS_log_commit_lane_max_delay_ms));
+    }
     vector<LogEntryBatch*> entry_batches;
     Status s = log_->entry_queue()->BlockingDrainTo(&entry_batches, deadline);
     if (PREDICT_FALSE(s.IsAborted())) {
+      // Write out whatever commits were left behind when the log shut down.
+      if (commit_lane) {
+        ignore_result(log_->commit_queue()->BlockingDrainTo(
+            &commit_batches, MonoTime::Now()));
+      }
+      if (!commit_batches.empty()) {
+        HandleGroup(std::move(commit_batches));
+      }
       break;
     } else if (PREDICT_FALSE(s.IsTimedOut())) {
+      if (!commit_batches.empty()) {
+        HandleGroup(std::move(commit_batches));
+        idle_deadline = MonoTime::Now() + idle_threshold;
+        continue;
+      }
+      if (MonoTime::Now() < idle_deadline) {
+        continue;
+      }
       if (GoIdle())
         break;
+      idle_deadline = MonoTime::Now() + idle_threshold;
       continue;
     }
+    MaybeExtendGroup(&entry_batches);
+    entry_batches.insert(
+        entry_batches.end(), commit_batches.begin(), commit_batches.end());
     HandleGroup(std::move(entry_batches));
+    idle_deadline = MonoTime::Now() + idle_threshold;
   }
   VLOG_WITH_PREFIX(2) << "WAL Appender going idle";
 }
 
+void Log::AppendThread::MaybeExtendGroup(
+    vector<LogEntryBatch*>* entry_batches) {
+  MonoTime now = MonoTime::Now();
+  RecordArrivals(entry_batches->size(), now);
+  if (!FLAGS_log_adaptive_group_commit) {
+    return;
+  }
+
+  MonoDelta window = AdaptiveGroupCommitWindow();
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_window->Increment(window.ToMicroseconds());
+  }
+  if (window.ToMicroseconds() <= 0) {
+    if (log_->metrics_) {
+      log_->metrics_->groups_closed_no_wait->Increment();
+    }
+    return;
+  }
+
+  TRACE_EVENT1(
+      "log", "AdaptiveGroupCommitWait", "window_us", window.ToMicroseconds());
+  size_t group_bytes = 0;
+  for (const LogEntryBatch* entry_batch : *entry_batches) {
+    group_bytes += entry_batch->total_size_bytes();
+  }
+  const MonoTime deadline = now + window;
+  while (group_bytes <
+         static_cast<size_t>(FLAGS_group_commit_queue_size_bytes)) {
+    size_t num_before = entry_batches->size();
+    // A TimedOut() status means the window expired; an Aborted() one means the
+    // queue is shutting down, which the caller notices on its next drain. The
+    // group collected so far must be handled either way.
+    if (!log_->entry_queue()->BlockingDrainTo(entry_batches, deadline).ok()) {
+      if (log_->metrics_) {
+        log_->metrics_->groups_closed_window_expired->Increment();
+      }
+      return;
+    }
+    RecordArrivals(entry_batches->size() - num_before, MonoTime::Now());
+    for (size_t i = num_before; i < entry_batches->size(); i++) {
+      group_bytes += (*entry_batches)[i]->total_size_bytes();
+    }
+  }
+  if (log_->metrics_) {
+    log_->metrics_->groups_closed_size_limit->Increment();
+  }
+}
+
+void Log::AppendThread::RecordArrivals(size_t num_batches, MonoTime now) {
+  // Weight of the most recent observation in the moving average.
+  constexpr double kAlpha = 0.2;
+  std::lock_guard<simple_spinlock> l(window_lock_);
+  if (last_drain_time_.Initialized() && num_batches > 0) {
+    double interarrival_us =
+        static_cast<double>((now - last_drain_time_).ToMicroseconds()) /
+        num_batches;
+    mean_interarrival_us_ = mean_interarrival_us_ == 0
+        ? interarrival_us
+        : kAlpha * interarrival_us + (1 - kAlpha) * mean_interarrival_us_;
+  }
+  last_drain_time_ = now;
+}
+
+void Log::AppendThread::RecordSyncLatency(MonoDelta latency) {
+  std::lock_guard<simple_spinlock> l(window_lock_);
+  sync_latency_samples_us_[next_sync_latency_sample_] =
+      latency.ToMicroseconds();
+  next_sync_latency_sample_ =
+      (next_sync_latency_sample_ + 1) % kNumSyncLatencySamples;
+  num_sync_latency_samples_ =
+      std::min(num_sync_latency_samples_ + 1, kNumSyncLatencySamples);
+}
+
+MonoDelta Log::AppendThread::AdaptiveGroupCommitWindow() const {
+  int64_t samples[kNumSyncLatencySamples];
+  int num_samples;
+  double mean_interarrival_us;
+  {
+    std::lock_guard<simple_spinlock> l(window_lock_);
+    num_samples = num_sync_latency_samples_;
+    std::copy(
+        sync_latency_samples_us_,
+        sync_latency_samples_us_ + num_samples,
+        samples);
+    mean_interarrival_us = mean_interarrival_us_;
+  }
+  if (num_samples == 0 || mean_interarrival_us <= 0) {
+    return MonoDelta::FromMicroseconds(0);
+  }
+
+  int percentile = std::max(
+      0, std::min(100, FLAGS_log_adaptive_group_commit_sync_percentile));
+  int rank = std::min(num_samples - 1, num_samples * percentile / 100);
+  std::nth_element(samples, samples + rank, samples + num_samples);
+  int64_t window_us = std::min<int64_t>(
+      samples[rank], FLAGS_log_adaptive_group_commit_max_wait_us);
+
+  // Waiting only pays off if at least one more batch is expected to arrive
+  // within the window; otherwise light traffic would see a fixed latency
+  // floor on every commit.
+  if (mean_interarrival_us > window_us) {
+    return MonoDelta::FromMicroseconds(0);
+  }
+  return MonoDelta::FromMicroseconds(window_us);
+}
+
 void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (log_->metrics_) {
     log_->metrics_->entry_batches_per_group->Increment(entry_batches.size());
   }
   TRACE_EVENT1("log", "batch", "batch_size", entry_batches.size());
+  consensus::ScopedRaftResourceAccounting accounting(
+      log_->resource_account_.get(), consensus::RaftActivity::kWalAppend);
 
-  SCOPED_LATENCY_METRIC(log_->metrics_, group_commit_latency);
+  MonoTime group_start = MonoTime::Now();
 
   bool is_all_commits = true;
+  MonoTime oldest_enqueue_time = group_start;
   for (LogEntryBatch* entry_batch : entry_batches) {
     TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
+    if (entry_batch->enqueue_time_ < oldest_enqueue_time) {
+      oldest_enqueue_time = entry_batch->enqueue_time_;
+    }
     Status s = log_->DoAppend(entry_batch);
     if (PREDICT_FALSE(!s.ok())) {
       LOG_WITH_PREFIX(ERROR) << "Error appending to the log: " << s.ToString();
@@ -425,10 +790,61 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
     }
   }
 
-  Status s;
-  if (!is_all_commits) {
+  if (log_->metrics_) {
+    log_->metrics_->group_queue_wait->Increment(
+        (group_start - oldest_enqueue_time).ToMicroseconds());
+    log_->metrics_->group_serialize_latency->Increment(
+        (MonoTime::Now() - group_start).ToMicroseconds());
+  }
+
+  // Write out the whole group, which DoAppend() only buffered.
+  Status write_status = log_->FlushBufferedAppends();
+  if (PREDICT_FALSE(!write_status.ok())) {
+    LOG_WITH_PREFIX(ERROR) << "Error writing to the log: "
+                           << write_status.ToString();
+  }
+
+  if (!sync_pool_) {
+    SyncAndRunCallbacks(
+        entry_batches, !is_all_commits, group_start, write_status);
+    return;
+  }
+
+  // Wait for the previous group to leave the sync stage, so that we never
+  // have more than one group written but not yet synced.
+  sync_slots_.Acquire();
+  Status s = sync_pool_->SubmitFunc(
+      [this, entry_batches, is_all_commits, group_start, write_status]() {
+        SyncAndRunCallbacks(
+            entry_batches, !is_all_commits, group_start, write_status);
+        sync_slots_.Release();
+      });
+  if (PREDICT_FALSE(!s.ok())) {
+    // The sync stage is shutting down; finish the group on this thread.
+    sync_slots_.Release();
+    SyncAndRunCallbacks(
+        entry_batches, !is_all_commits, group_start, write_status);
+  }
+}
+
+void Log::AppendThread::SyncAndRunCallbacks(
+    const vector<LogEntryBatch*>& entry_batches,
+    bool needs_sync,
+    MonoTime group_start,
+    const Status& write_status) {
+  consensus::ScopedRaftResourceAccounting accounting(
+      log_->resource_account_.get(), consensus::RaftActivity::kWalAppend);
+  ScopedIOClass io_class(IOClass::kWalCommit);
+  Status s = write_status;
+  MonoDelta sync_latency = MonoDelta::FromMicroseconds(0);
+  if (s.ok() && needs_sync) {
+    MonoTime sync_start = MonoTime::Now();
     s = log_->Sync();
+    sync_latency = MonoTime::Now() - sync_start;
+    RecordSyncLatency(sync_latency);
   }
+  UpdateFsyncBudget(sync_latency);
+  MonoTime callbacks_start = MonoTime::Now();
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << s.ToString();
     for (LogEntryBatch* entry_batch : entry_batches) {
@@ -441,7 +857,7 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
     TRACE_EVENT0("log", "Callbacks");
     VLOG_WITH_PREFIX(2) << "Synchronized " << entry_batches.size()
                         << " entry batches";
-    SCOPED_WATCH_STACK(0);
+    SCOPED_WATCH_STACK(FLAGS_log_append_watch_stack_ms);
     for (LogEntryBatch* entry_batch : entry_batches) {
       if (PREDICT_TRUE(!entry_batch->callback().is_null())) {
         entry_batch->callback().Run(Status::OK());
@@ -452,14 +868,61 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
       delete entry_batch;
     }
   }
+  if (log_->metrics_) {
+    MonoTime now = MonoTime::Now();
+    log_->metrics_->group_callback_latency->Increment(
+        (now - callbacks_start).ToMicroseconds());
+    Histogram* commit_latency = log_->metrics_->group_commit_latency.get();
+    const int64_t commit_latency_us = (now - group_start).ToMicroseconds();
+    if (commit_latency->WantsExemplar(commit_latency_us)) {
+      commit_latency->IncrementWithExemplar(
+          commit_latency_us,
+          {{"tablet_id", log_->tablet_id_},
+           {"batches", std::to_string(entry_batches.size())},
+           {"sync_us", std::to_string(sync_latency.ToMicroseconds())}});
+    } else {
+      commit_latency->Increment(commit_latency_us);
+    }
+  }
+}
+
+void Log::AppendThread::UpdateFsyncBudget(MonoDelta sync_latency) {
+  if (!log_->metrics_) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  std::lock_guard<simple_spinlock> l(window_lock_);
+  if (!fsync_budget_window_start_.Initialized()) {
+    fsync_budget_window_start_ = now;
+  }
+  fsync_budget_busy_us_ += sync_latency.ToMicroseconds();
+  int64_t elapsed_us = (now - fsync_budget_window_start_).ToMicroseconds();
+  if (elapsed_us < kFsyncBudgetIntervalUs) {
+    return;
+  }
+  log_->metrics_->fsync_budget_used->set_value(
+      std::min<int64_t>(100, fsync_budget_busy_us_ * 100 / elapsed_us));
+  fsync_budget_busy_us_ = 0;
+  fsync_budget_window_start_ = now;
+}
+
+void Log::AppendThread::WaitForPendingSyncs() {
+  if (sync_pool_) {
+    sync_pool_->Wait();
+  }
 }
 
 void Log::AppendThread::Shutdown() {
   log_->entry_queue()->Shutdown();
+  log_->commit_queue()->Shutdown();
   if (append_pool_) {
     append_pool_->Wait();
     append_pool_->Shutdown();
   }
+  if (sync_pool_) {
+    sync_pool_->Wait();
+    sync_pool_->Shutdown();
+  }
 }
 
 string Log::AppendThread::LogPrefix() const {
@@ -475,6 +938,7 @@ bool Log::append_thread_active_for_tests() const {
 // asynchronously pre-allocate new log segments.
 void Log::SegmentAllocationTask() {
   CHECK(!FLAGS_raft_derived_log_mode);
+  ScopedIOClass io_class(IOClass::kMaintenance);
   allocation_status_.Set(PreAllocateNewSegment());
 }
 
@@ -495,8 +959,9 @@ Status Log::Open(
     scoped_refptr<Log>* log) {
 
   string tablet_wal_path = fs_manager->GetTabletWalDir(tablet_id);
-  RETURN_NOT_OK(
-      env_util::CreateDirIfMissing(fs_manager->env(), tablet_wal_path));
+  for (const string& dir : fs_manager->GetTabletWalStripeDirs(tablet_id)) {
+    RETURN_NOT_OK(env_util::CreateDirIfMissing(fs_manager->env(), dir));
+  }
 
   scoped_refptr<Log> new_log;
   if (options.log_factory) {
@@ -524,6 +989,19 @@ Status Log::Open(
   return Status::OK();
 }
 
+// A single thread, so that moving segments to the WAL archive takes no more
+// than one stream of I/O away from appends.
+static ThreadPool* SegmentArchivePool() {
+  static ThreadPool* pool = []() {
+    unique_ptr<ThreadPool> ret;
+    CHECK_OK(ThreadPoolBuilder("log-segment-archive")
+                 .set_max_threads(1)
+                 .Build(&ret));
+    return ret.release();
+  }();
+  return pool;
+}
+
 Log::Log(
     LogOptions options,
     FsManager* fs_manager,
@@ -545,7 +1023,9 @@ Log::Log(
       active_segment_sequence_number_(0),
       log_state_(kLogInitialized),
       max_segment_size_(options_.segment_size_mb * 1024 * 1024),
+      next_segment_size_(max_segment_size_),
       entry_batch_queue_(FLAGS_group_commit_queue_size_bytes),
+      commit_batch_queue_(FLAGS_group_commit_queue_size_bytes),
       append_thread_(new AppendThread(this)),
       force_sync_all_(options_.force_fsync_all),
       sync_disabled_(false),
@@ -557,8 +1037,21 @@ Log::Log(
   CHECK_OK(ThreadPoolBuilder("log-alloc")
                .set_max_threads(1)
                .Build(&allocation_pool_));
+  if (!fs_manager_->GetTabletWalArchiveDir(tablet_id_).empty()) {
+    archive_token_ =
+        SegmentArchivePool()->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  }
   if (metric_entity_) {
     metrics_.reset(new LogMetrics(metric_entity_));
+    resource_account_.reset(new consensus::RaftResourceAccount(
+        metric_entity_->registry(), tablet_id_));
+    if (LockProfilingEnabled()) {
+      allocation_lock_profile_.reset(new LockProfile(
+          LogPrefix() + "Log::allocation_lock_",
+          metrics_->allocation_lock_wait_time,
+          metrics_->allocation_lock_hold_time));
+      allocation_lock_.set_profile(allocation_lock_profile_.get());
+    }
   }
 }
 
@@ -592,10 +1085,22 @@ Status Log::Init() {
 
   // Init the index
   log_index_.reset(new LogIndex(log_dir_));
+  if (metric_entity_) {
+    log_index_->InitMetrics(metric_entity_);
+  }
+  // Chunk pre-creation shares the pool with segment pre-allocation, which
+  // is shut down before the index is released.
+  log_index_->SetChunkPrecreationPool(allocation_pool_.get());
 
   // Reader for previous segments.
-  RETURN_NOT_OK(LogReader::Open(
-      fs_manager_, log_index_, tablet_id_, metric_entity_.get(), &reader_));
+  {
+    consensus::ScopedStartupPhase phase(
+        options_.startup_profile,
+        consensus::StartupPhase::kLogSegmentScan,
+        tablet_id_);
+    RETURN_NOT_OK(LogReader::Open(
+        fs_manager_, log_index_, tablet_id_, metric_entity_.get(), &reader_));
+  }
 
   // The case where we are continuing an existing log.
   // We must pick up where the previous WAL left off in terms of
@@ -636,11 +1141,48 @@ Status Log::AsyncAllocateSegment() {
   CHECK_EQ(allocation_state_, kAllocationNotStarted);
   allocation_status_.Reset();
   allocation_state_ = kAllocationInProgress;
+  next_segment_size_ = NextSegmentSize();
   RETURN_NOT_OK(allocation_pool_->SubmitClosure(
       Bind(&Log::SegmentAllocationTask, Unretained(this))));
   return Status::OK();
 }
 
+uint64_t Log::NextSegmentSize() {
+  const int32_t interval_ms = options_.segment_target_roll_interval_ms;
+  if (interval_ms <= 0 || !active_segment_) {
+    return max_segment_size_;
+  }
+  const int64_t elapsed_us =
+      (MonoTime::Now() - active_segment_open_time_).ToMicroseconds();
+  if (elapsed_us > 0) {
+    const int64_t sample = active_segment_->buffered_offset() *
+        MonoTime::kMicrosecondsPerSecond / elapsed_us;
+    append_bytes_per_sec_ = append_bytes_per_sec_ < 0
+        ? sample
+        : (append_bytes_per_sec_ + sample) / 2;
+  }
+  const uint64_t kMB = 1024 * 1024;
+  const uint64_t min_size = options_.min_segment_size_mb * kMB;
+  const uint64_t max_size =
+      std::max(options_.max_segment_size_mb * kMB, min_size);
+  if (append_bytes_per_sec_ < 0) {
+    return std::max(std::min(max_segment_size_, max_size), min_size);
+  }
+  // Whole MBs, so that preallocation and recycled files stay aligned.
+  uint64_t size = append_bytes_per_sec_ * interval_ms / 1000;
+  size = (size + kMB - 1) / kMB * kMB;
+  return std::max(std::min(size, max_size), min_size);
+}
+
+bool Log::ActiveSegmentExpired() const {
+  const int32_t interval_ms = options_.segment_target_roll_interval_ms;
+  return interval_ms > 0 &&
+      active_segment_->buffered_offset() >
+      active_segment_->first_entry_offset() &&
+      MonoTime::Now() - active_segment_open_time_ >
+      MonoDelta::FromMilliseconds(2 * interval_ms);
+}
+
 Status Log::CloseCurrentSegment() {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (!footer_builder_.has_min_replicate_index()) {
@@ -652,6 +1194,10 @@ Status Log::CloseCurrentSegment() {
                       << ": "
                       << pb_util::SecureShortDebugString(footer_builder_);
 
+  // Keep the sparse index in the footer, so that it survives a restart.
+  if (sparse_index_) {
+    sparse_index_->ToFooter(&footer_builder_);
+  }
   footer_builder_.set_close_timestamp_micros(GetCurrentTimeMicros());
   RETURN_NOT_OK(active_segment_->WriteFooterAndClose(footer_builder_));
 
@@ -667,6 +1213,10 @@ Status Log::RollOver() {
 
   DCHECK_EQ(allocation_state(), kAllocationFinished);
 
+  // The sync stage of the append pipeline refers to the active segment, so it
+  // must be drained before the segment is closed.
+  append_thread_->WaitForPendingSyncs();
+  RETURN_NOT_OK(FlushBufferedAppends());
   RETURN_NOT_OK(Sync());
   RETURN_NOT_OK(CloseCurrentSegment());
 
@@ -685,8 +1235,7 @@ Status Log::CreateBatchFromPB(
   int num_ops = entry_batch_pb->entry_size();
   unique_ptr<LogEntryBatch> new_entry_batch(
       new LogEntryBatch(type, std::move(entry_batch_pb), num_ops));
-  new_entry_batch->Serialize();
-  TRACE("Serialized $0 byte log entry", new_entry_batch->total_size_bytes());
+  TRACE("Created $0 byte log entry", new_entry_batch->total_size_bytes());
 
   *entry_batch = std::move(new_entry_batch);
   return Status::OK();
@@ -699,8 +1248,13 @@ Status Log::AsyncAppend(
   TRACE_EVENT0("log", "Log::AsyncAppend");
 
   entry_batch->set_callback(callback);
+  LogEntryBatchQueue* queue =
+      options_.separate_commit_lane && entry_batch->type_ == COMMIT
+      ? &commit_batch_queue_
+      : &entry_batch_queue_;
   TRACE_EVENT_FLOW_BEGIN0("log", "Batch", entry_batch.get());
-  if (PREDICT_FALSE(!entry_batch_queue_.BlockingPut(entry_batch.get()))) {
+  entry_batch->enqueue_time_ = MonoTime::Now();
+  if (PREDICT_FALSE(!queue->BlockingPut(entry_batch.get()))) {
     TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch.get());
     return kLogShutdownStatus;
   }
@@ -752,7 +1306,6 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
       FLAGS_log_inject_io_error_on_append_fraction,
       Status::IOError("Injected IOError in Log::DoAppend()"));
 
-  Slice entry_batch_data = entry_batch->data();
   uint32_t entry_batch_bytes = entry_batch->total_size_bytes();
   // If there is no data to write return OK.
   if (PREDICT_FALSE(entry_batch_bytes == 0)) {
@@ -761,9 +1314,12 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
 
   // if the size of this entry overflows the current segment, get a new one
   if (allocation_state() == kAllocationNotStarted) {
-    if ((active_segment_->Size() + entry_batch_bytes + 4) > max_segment_size_) {
+    const bool full = (active_segment_->buffered_offset() +
+                       entry_batch_bytes + 4) > max_segment_size_;
+    if (full || PREDICT_FALSE(ActiveSegmentExpired())) {
       LOG_WITH_PREFIX(INFO)
-          << "Max segment size reached. Starting new segment allocation";
+          << (full ? "Max segment size" : "Segment roll interval")
+          << " reached. Starting new segment allocation";
       RETURN_NOT_OK(AsyncAllocateSegment());
       if (!options_.async_preallocate_segments) {
         LOG_SLOW_EXECUTION(
@@ -783,16 +1339,47 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
     VLOG_WITH_PREFIX(1) << "Segment allocation already in progress...";
   }
 
-  int64_t start_offset = active_segment_->written_offset();
+  int64_t start_offset = active_segment_->buffered_offset();
+
+  // The batch is serialized straight into the segment's write buffer; it is
+  // written out, together with the rest of its group, by
+  // FlushBufferedAppends().
+  RETURN_NOT_OK(active_segment_->BufferEntryBatch(
+      *entry_batch->entry_batch_pb_, codec_));
+
+  if (metrics_) {
+    metrics_->bytes_logged->IncrementBy(entry_batch_bytes);
+  }
+  if (resource_account_ && consensus::RaftResourceAccountingEnabled()) {
+    resource_account_->AddWalBytesWritten(entry_batch_bytes);
+  }
 
+  CHECK_OK(UpdateIndexForBatch(*entry_batch, start_offset));
+  UpdateFooterForBatch(entry_batch);
+
+  return Status::OK();
+}
+
+Status Log::FlushBufferedAppends() {
+  CHECK(!FLAGS_raft_derived_log_mode);
   LOG_SLOW_EXECUTION(
       WARNING,
       50,
       Substitute("$0Append to log took a long time", LogPrefix())) {
     SCOPED_LATENCY_METRIC(metrics_, append_latency);
-    SCOPED_WATCH_STACK(0);
+    SCOPED_WATCH_STACK(FLAGS_log_append_watch_stack_ms);
 
-    RETURN_NOT_OK(active_segment_->WriteEntryBatch(entry_batch_data, codec_));
+    Status s = active_segment_->FlushBufferedEntryBatches();
+    if (PREDICT_FALSE(!s.ok())) {
+      // The buffered batches were dropped, so none of them may be indexed.
+      pending_index_entries_.clear();
+      return s;
+    }
+
+    // Only index the flushed entries now, so that nobody looks up an entry
+    // that can't be read back yet.
+    CHECK_OK(log_index_->AddEntries(pending_index_entries_));
+    pending_index_entries_.clear();
 
     // Update the reader on how far it can read the active segment.
     reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
@@ -801,14 +1388,6 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
       RETURN_NOT_OK_PREPEND(log_hooks_->PostAppend(), "PostAppend hook failed");
     }
   }
-
-  if (metrics_) {
-    metrics_->bytes_logged->IncrementBy(entry_batch_bytes);
-  }
-
-  CHECK_OK(UpdateIndexForBatch(*entry_batch, start_offset));
-  UpdateFooterForBatch(entry_batch);
-
   return Status::OK();
 }
 
@@ -819,13 +1398,20 @@ Status Log::UpdateIndexForBatch(
     return Status::OK();
   }
 
-  for (const LogEntryPB& entry_pb : batch.entry_batch_pb_->entry()) {
+  const auto& entries = batch.entry_batch_pb_->entry();
+  for (const LogEntryPB& entry_pb : entries) {
     LogIndexEntry index_entry;
 
     index_entry.op_id = entry_pb.replicate().id();
     index_entry.segment_sequence_number = active_segment_sequence_number_;
     index_entry.offset_in_segment = start_offset;
-    RETURN_NOT_OK(log_index_->AddEntry(index_entry));
+    pending_index_entries_.push_back(index_entry);
+  }
+  if (sparse_index_ && entries.size() > 0) {
+    sparse_index_->AddBatch(
+        entries.Get(0).replicate().id().index(),
+        entries.Get(entries.size() - 1).replicate().id().index(),
+        start_offset);
   }
   return Status::OK();
 }
@@ -841,10 +1427,19 @@ void Log::UpdateFooterForBatch(LogEntryBatch* batch) {
   // we roll over to a new segment, we set the first operation in the footer
   // immediately.
   if (batch->type_ == REPLICATE) {
-    // Update the index bounds for the current segment.
-    for (const LogEntryPB& entry_pb : batch->entry_batch_pb_->entry()) {
-      UpdateFooterForReplicateEntry(entry_pb, &footer_builder_);
+    // Update the index bounds for the current segment. Replicates within a
+    // batch are in increasing index order, so the first and last ones bound
+    // the whole batch.
+    const auto& entries = batch->entry_batch_pb_->entry();
+    if (entries.size() == 0) {
+      return;
     }
+    DCHECK_LE(
+        entries.Get(0).replicate().id().index(),
+        entries.Get(entries.size() - 1).replicate().id().index());
+    UpdateFooterForReplicateEntry(entries.Get(0), &footer_builder_);
+    UpdateFooterForReplicateEntry(
+        entries.Get(entries.size() - 1), &footer_builder_);
   }
 }
 
@@ -875,9 +1470,18 @@ Status Log::Sync() {
   }
 
   if (force_sync_all_ && !sync_disabled_) {
+    SCOPED_WATCH_STACK(FLAGS_log_sync_watch_stack_ms);
     LOG_SLOW_EXECUTION(
         WARNING, 50, Substitute("$0Fsync log took a long time", LogPrefix())) {
+      MonoTime sync_start = MonoTime::Now();
       RETURN_NOT_OK(active_segment_->Sync());
+      fs::DirHealthTracker* tracker = fs_manager_->dir_health_tracker();
+      if (tracker) {
+        // Tracked per WAL root, the parent of the tablet's WAL directory.
+        tracker->RecordLatency(
+            DirName(DirName(active_segment_->path())),
+            MonoTime::Now() - sync_start);
+      }
 
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(
@@ -941,8 +1545,10 @@ Status Log::Append(LogEntryPB* entry) {
   unique_ptr<LogEntryBatchPB> entry_batch_pb(new LogEntryBatchPB);
   entry_batch_pb->mutable_entry()->AddAllocated(entry);
   LogEntryBatch entry_batch(entry->type(), std::move(entry_batch_pb), 1);
-  entry_batch.Serialize();
   Status s = DoAppend(&entry_batch);
+  if (s.ok()) {
+    s = FlushBufferedAppends();
+  }
   if (s.ok()) {
     s = Sync();
   }
@@ -966,7 +1572,21 @@ Status Log::WaitUntilAllFlushed() {
       FLUSH_MARKER, std::move(entry_batch), &reserved_entry_batch));
   Synchronizer s;
   AsyncAppend(std::move(reserved_entry_batch), s.AsStatusCallback());
-  return s.Wait();
+  if (!options_.separate_commit_lane) {
+    return s.Wait();
+  }
+
+  // Send a second marker down the commit lane, behind the commits queued so
+  // far.
+  unique_ptr<LogEntryBatchPB> commit_marker_pb(new LogEntryBatchPB);
+  commit_marker_pb->add_entry()->set_type(log::FLUSH_MARKER);
+  unique_ptr<LogEntryBatch> commit_marker;
+  RETURN_NOT_OK(
+      CreateBatchFromPB(COMMIT, std::move(commit_marker_pb), &commit_marker));
+  Synchronizer commit_s;
+  AsyncAppend(std::move(commit_marker), commit_s.AsStatusCallback());
+  RETURN_NOT_OK(s.Wait());
+  return commit_s.Wait();
 }
 
 Status Log::TruncateOpsAfter(
@@ -981,6 +1601,7 @@ Status Log::TruncateOpsAfter(
 Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
   CHECK_GE(retention_indexes.for_durability, 0);
   CHECK(!FLAGS_raft_derived_log_mode);
+  ScopedIOClass io_class(IOClass::kMaintenance);
 
   VLOG_WITH_PREFIX(1) << "Running Log GC on " << log_dir_
                       << ": retaining "
@@ -1002,6 +1623,7 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
       if (segments_to_delete.empty()) {
         VLOG_WITH_PREFIX(1) << "No segments to delete.";
         *num_gced = 0;
+        ScheduleSegmentArchiving(retention_indexes);
         return Status::OK();
       }
       // Trim the prefix of segments from the reader so that they are no longer
@@ -1024,9 +1646,31 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
             segment->footer().min_replicate_index(),
             segment->footer().max_replicate_index());
       }
-      LOG_WITH_PREFIX(INFO)
-          << "Deleting log segment in path: " << segment->path() << ops_str;
-      RETURN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()));
+      // Recycling overwrites the file, so a segment someone else still reads,
+      // such as a catch-up read or a LogReader user, can't be recycled. One in
+      // the WAL archive would never be picked up again.
+      const bool can_recycle = segment->HasOneRef() &&
+          DirName(segment->path()) !=
+              fs_manager_->GetTabletWalArchiveDir(tablet_id_);
+      if (can_recycle && RecycleSegmentFile(segment->path())) {
+        LOG_WITH_PREFIX(INFO) << "Recycling log segment in path: "
+                              << segment->path() << ops_str;
+      } else if (
+          FLAGS_log_background_segment_deletion &&
+          !SegmentFileCacheEnabled(fs_manager_->env())) {
+        LOG_WITH_PREFIX(INFO) << "Deleting log segment in path "
+                              << segment->path() << ops_str
+                              << " in the background";
+        RETURN_NOT_OK(DeleteSegmentFileInBackground(
+            fs_manager_->env(),
+            segment->path(),
+            metrics_ ? metrics_->segment_pending_deletion_bytes : nullptr,
+            /*may_truncate=*/segment->HasOneRef()));
+      } else {
+        LOG_WITH_PREFIX(INFO)
+            << "Deleting log segment in path: " << segment->path() << ops_str;
+        RETURN_NOT_OK(DeleteSegmentFile(fs_manager_->env(), segment->path()));
+      }
       (*num_gced)++;
     }
 
@@ -1037,6 +1681,7 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
       log_index_->GC(min_remaining_op_idx);
     }
   }
+  ScheduleSegmentArchiving(retention_indexes);
   return Status::OK();
 }
 
@@ -1080,6 +1725,14 @@ void Log::GetReplaySizeMap(std::map<int64_t, int64_t>* replay_size) const {
   }
 }
 
+int Log::AppendQueueLoadPercent() const {
+  const size_t max_size = entry_batch_queue_.max_size();
+  if (max_size == 0) {
+    return 0;
+  }
+  return std::min<size_t>(100, entry_batch_queue_.size() * 100 / max_size);
+}
+
 int64_t Log::OnDiskSize() {
   CHECK(!FLAGS_raft_derived_log_mode);
   SegmentSequence segments;
@@ -1116,18 +1769,70 @@ Status Log::ReadReplicatesInRange(
     int64_t max_bytes_to_read,
     const consensus::ReadContext& /* context */,
     std::vector<consensus::ReplicateMsg*>* replicates) const {
+  ScopedIOClass io_class(IOClass::kCatchUp);
   return reader()->ReadReplicatesInRange(
       starting_at, up_to, max_bytes_to_read, replicates);
 }
 
+Status Log::ReadReplicatesInRangeOnArena(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    const consensus::ReadContext& /* context */,
+    google::protobuf::Arena* arena,
+    std::vector<consensus::ReplicateMsg*>* replicates) const {
+  ScopedIOClass io_class(IOClass::kCatchUp);
+  return reader()->ReadReplicatesInRange(
+      starting_at, up_to, max_bytes_to_read, arena, replicates);
+}
+
 Status Log::LookupOpId(int64_t op_index, OpId* op_id) const {
   return reader()->LookupOpId(op_index, op_id);
 }
 
+Status Log::ReadSegmentChunk(
+    int64_t seqno,
+    int64_t offset,
+    int64_t max_length,
+    faststring* data,
+    int64_t* segment_size) const {
+  ScopedIOClass io_class(IOClass::kCatchUp);
+  std::shared_ptr<LogReader> log_reader = reader();
+  if (!log_reader) {
+    return Status::IllegalState("log is closed");
+  }
+  scoped_refptr<ReadableLogSegment> segment =
+      log_reader->GetSegmentBySequenceNumber(seqno);
+  if (!segment) {
+    return Status::NotFound(Substitute("no segment $0 in the log", seqno));
+  }
+  if (!segment->HasFooter()) {
+    return Status::IllegalState(
+        Substitute("segment $0 is still being written", seqno));
+  }
+  const int64_t size = segment->file_size();
+  if (offset < 0 || offset > size || max_length < 0) {
+    return Status::InvalidArgument(Substitute(
+        "bad chunk of $0 bytes at offset $1 of segment $2 of $3 bytes",
+        max_length,
+        offset,
+        seqno,
+        size));
+  }
+  const int64_t length = std::min(max_length, size - offset);
+  data->resize(length);
+  RETURN_NOT_OK(segment->ReadRaw(offset, Slice(data->data(), length)));
+  *segment_size = size;
+  return Status::OK();
+}
+
 Status Log::Close() {
   CHECK(!FLAGS_raft_derived_log_mode);
   allocation_pool_->Shutdown();
   append_thread_->Shutdown();
+  if (archive_token_) {
+    archive_token_->Shutdown();
+  }
 
   std::lock_guard<percpu_rwlock> l(state_lock_);
   switch (log_state_) {
@@ -1135,6 +1840,7 @@ Status Log::Close() {
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(log_hooks_->PreClose(), "PreClose hook failed");
       }
+      RETURN_NOT_OK(FlushBufferedAppends());
       RETURN_NOT_OK(Sync());
       RETURN_NOT_OK(CloseCurrentSegment());
       RETURN_NOT_OK(ReplaceSegmentInReaderUnlocked());
@@ -1161,25 +1867,34 @@ Status Log::Close() {
 }
 
 bool Log::HasOnDiskData(FsManager* fs_manager, const string& tablet_id) {
-  string wal_dir = fs_manager->GetTabletWalDir(tablet_id);
-  return fs_manager->env()->FileExists(wal_dir);
+  for (const string& wal_dir : fs_manager->GetTabletWalStripeDirs(tablet_id)) {
+    if (fs_manager->env()->FileExists(wal_dir)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 Status Log::DeleteOnDiskData(FsManager* fs_manager, const string& tablet_id) {
   CHECK(!FLAGS_raft_derived_log_mode);
-  string wal_dir = fs_manager->GetTabletWalDir(tablet_id);
   Env* env = fs_manager->env();
-  if (!env->FileExists(wal_dir)) {
-    return Status::OK();
+  // Delete the extra stripes first, so that the primary WAL directory
+  // (which holds the index) is the last thing to go.
+  vector<string> wal_dirs = fs_manager->GetTabletWalStripeDirs(tablet_id);
+  for (auto it = wal_dirs.rbegin(); it != wal_dirs.rend(); ++it) {
+    const string& wal_dir = *it;
+    if (!env->FileExists(wal_dir)) {
+      continue;
+    }
+    LOG(INFO) << Substitute(
+        "T $0 P $1: Deleting WAL directory at $2",
+        tablet_id,
+        fs_manager->uuid(),
+        wal_dir);
+    RETURN_NOT_OK_PREPEND(
+        env->DeleteRecursively(wal_dir),
+        "Unable to recursively delete WAL dir for tablet " + tablet_id);
   }
-  LOG(INFO) << Substitute(
-      "T $0 P $1: Deleting WAL directory at $2",
-      tablet_id,
-      fs_manager->uuid(),
-      wal_dir);
-  RETURN_NOT_OK_PREPEND(
-      env->DeleteRecursively(wal_dir),
-      "Unable to recursively delete WAL dir for tablet " + tablet_id);
   return Status::OK();
 }
 
@@ -1228,9 +1943,39 @@ Status Log::RemoveRecoveryDirIfExists(
   return Status::OK();
 }
 
+// Overwrites bytes 'offset' through 'end' of 'file' with zeros and syncs
+// them.
+static Status WriteZeros(RWFile* file, uint64_t offset, uint64_t end) {
+  static const size_t kZeroChunkSize = 1024 * 1024;
+  const string zeros(kZeroChunkSize, '\0');
+  for (; offset < end; offset += kZeroChunkSize) {
+    size_t len = std::min<uint64_t>(kZeroChunkSize, end - offset);
+    RETURN_NOT_OK(file->Write(offset, Slice(zeros.data(), len)));
+  }
+  return file->Sync();
+}
+
+// Zero-fills bytes 'offset' through 'end' of the preallocated segment at
+// 'path', turning its unwritten extents into written ones. The segment's
+// writer keeps appending from its own offset, and truncates what it didn't
+// write when it's closed.
+static Status ZeroFillPreallocatedSpace(
+    Env* env,
+    const string& path,
+    uint64_t offset,
+    uint64_t end) {
+  RWFileOptions opts;
+  opts.mode = Env::OPEN_EXISTING;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK(env->NewRWFile(opts, path, &file));
+  RETURN_NOT_OK(WriteZeros(file.get(), offset, end));
+  return file->Close();
+}
+
 Status Log::PreAllocateNewSegment() {
   CHECK(!FLAGS_raft_derived_log_mode);
   TRACE_EVENT1("log", "PreAllocateNewSegment", "file", next_segment_path_);
+  SCOPED_WATCH_STACK(FLAGS_log_segment_allocation_watch_stack_ms);
   CHECK_EQ(allocation_state(), kAllocationInProgress);
 
   // We must mark allocation as finished when returning from this method.
@@ -1241,26 +1986,41 @@ Status Log::PreAllocateNewSegment() {
 
   WritableFileOptions opts;
   opts.sync_on_close = force_sync_all_;
-  RETURN_NOT_OK(
-      CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_));
+  opts.direct_io = options_.direct_io_writes;
+  bool reused = false;
+  uint64_t reused_bytes = 0;
+  RETURN_NOT_OK(OpenRecycledSegment(opts, &reused, &reused_bytes));
+  if (!reused) {
+    RETURN_NOT_OK(CreatePlaceholderSegment(
+        opts, &next_segment_path_, &next_segment_file_));
+  }
 
   MAYBE_RETURN_FAILURE(
       FLAGS_log_inject_io_error_on_preallocate_fraction,
       Status::IOError("Injected IOError in Log::PreAllocateNewSegment()"));
 
-  if (options_.preallocate_segments) {
+  if (options_.preallocate_segments && reused_bytes < next_segment_size_) {
+    uint64_t allocate_bytes = next_segment_size_ - reused_bytes;
     TRACE(
         "Preallocating $0 byte segment in $1",
-        max_segment_size_,
+        allocate_bytes,
         next_segment_path_);
     RETURN_NOT_OK(env_util::VerifySufficientDiskSpace(
         fs_manager_->env(),
         next_segment_path_,
-        max_segment_size_,
+        allocate_bytes,
         FLAGS_fs_wal_dir_reserved_bytes));
-    // TODO (perf) zero the new segments -- this could result in
-    // additional performance improvements.
-    RETURN_NOT_OK(next_segment_file_->PreAllocate(max_segment_size_));
+    RETURN_NOT_OK(next_segment_file_->PreAllocate(allocate_bytes));
+    if (options_.zero_preallocated_segments) {
+      TRACE("Zero-filling preallocated space of $0", next_segment_path_);
+      RETURN_NOT_OK_PREPEND(
+          ZeroFillPreallocatedSpace(
+              fs_manager_->env(),
+              next_segment_path_,
+              reused_bytes,
+              next_segment_size_),
+          "Unable to zero-fill preallocated log segment");
+    }
   }
 
   return Status::OK();
@@ -1279,7 +2039,7 @@ Status Log::SwitchToAllocatedSegment() {
   RETURN_NOT_OK(
       fs_manager_->env()->RenameFile(next_segment_path_, new_segment_path));
   if (force_sync_all_) {
-    RETURN_NOT_OK(fs_manager_->env()->SyncDir(log_dir_));
+    RETURN_NOT_OK(fs_manager_->env()->SyncDir(DirName(new_segment_path)));
   }
 
   // Create a new segment.
@@ -1293,6 +2053,9 @@ Status Log::SwitchToAllocatedSegment() {
 
   if (codec_) {
     header.set_compression_codec(codec_->type());
+    if (FLAGS_log_store_compressed_batches_raw) {
+      header.add_incompatible_features(LogSegmentHeaderPB::RAW_BATCHES);
+    }
   }
 
   // Set up the new footer. This will be maintained as the segment is written.
@@ -1318,10 +2081,15 @@ Status Log::SwitchToAllocatedSegment() {
       CHECK_OK(ReplaceSegmentInReaderUnlocked());
     }
   }
+  sparse_index_.reset(
+      FLAGS_log_segment_sparse_index_interval > 0
+          ? new SegmentSparseIndex(FLAGS_log_segment_sparse_index_interval)
+          : nullptr);
 
   // Open the segment we just created in readable form and add it to the reader.
-  // TODO(todd): consider using a global FileCache here? With short log segments
-  // and lots of tablets, this file descriptor usage may add up.
+  // The segment being written is opened directly, rather than through the
+  // shared segment file cache, so that its descriptor stays pinned; it moves
+  // to the cache once closed, see ReplaceSegmentInReaderUnlocked().
   unique_ptr<RandomAccessFile> readable_file;
 
   RandomAccessFileOptions opts;
@@ -1335,6 +2103,8 @@ Status Log::SwitchToAllocatedSegment() {
 
   // Now set 'active_segment_' to the new segment.
   active_segment_.reset(new_segment.release());
+  max_segment_size_ = next_segment_size_;
+  active_segment_open_time_ = MonoTime::Now();
 
   allocation_state_ = kAllocationNotStarted;
 
@@ -1346,7 +2116,7 @@ Status Log::ReplaceSegmentInReaderUnlocked() {
   // We should never switch to a new segment if we wrote nothing to the old one.
   CHECK(active_segment_->IsClosed());
   shared_ptr<RandomAccessFile> readable_file;
-  RETURN_NOT_OK(OpenFileForRandom(
+  RETURN_NOT_OK(OpenSegmentFileForRandom(
       fs_manager_->env(), active_segment_->path(), &readable_file));
   scoped_refptr<ReadableLogSegment> readable_segment(
       new ReadableLogSegment(active_segment_->path(), readable_file));
@@ -1356,10 +2126,215 @@ Status Log::ReplaceSegmentInReaderUnlocked() {
       active_segment_->header(),
       active_segment_->footer(),
       active_segment_->first_entry_offset()));
+  readable_segment->set_sparse_index(sparse_index_);
 
   return reader_->ReplaceLastSegment(readable_segment);
 }
 
+bool Log::RecycleSegmentFile(const string& path) {
+  if (options_.segment_recycle_pool_size <= 0) {
+    return false;
+  }
+  {
+    std::lock_guard<simple_spinlock> l(recycle_lock_);
+    if (recycled_segment_paths_.size() >=
+        static_cast<size_t>(options_.segment_recycle_pool_size)) {
+      return false;
+    }
+  }
+  // Recycled files carry the temporary infix so that they are never read as
+  // segments, and so that they are cleaned up if the server restarts.
+  string recycled_path = JoinPathSegments(
+      DirName(path),
+      Substitute("$0.recycled-$1", kTmpInfix, BaseName(path)));
+  Status s = fs_manager_->env()->RenameFile(path, recycled_path);
+  if (!s.ok()) {
+    WARN_NOT_OK(s, Substitute("Unable to recycle log segment $0", path));
+    return false;
+  }
+  std::lock_guard<simple_spinlock> l(recycle_lock_);
+  recycled_segment_paths_.emplace_back(std::move(recycled_path));
+  return true;
+}
+
+void Log::ScheduleSegmentArchiving(RetentionIndexes retention_indexes) {
+  if (!archive_token_) {
+    return;
+  }
+  const string archive_dir = fs_manager_->GetTabletWalArchiveDir(tablet_id_);
+  SegmentSequence segments;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    if (log_state_ != kLogWriting) {
+      return;
+    }
+    CHECK_OK(reader_->GetSegmentsSnapshot(&segments));
+  }
+  for (const auto& segment : segments) {
+    if (!segment->HasFooter() ||
+        !segment->footer().has_max_replicate_index()) {
+      continue;
+    }
+    if (segment->footer().max_replicate_index() >=
+        retention_indexes.for_durability) {
+      break;
+    }
+    if (DirName(segment->path()) == archive_dir) {
+      continue;
+    }
+    // A segment submitted twice is skipped by the second task, which runs
+    // after the first.
+    const int64_t seqno = segment->header().sequence_number();
+    Status s = archive_token_->SubmitFunc([this, seqno]() {
+      WARN_NOT_OK(
+          ArchiveSegment(seqno),
+          Substitute("$0Unable to archive log segment $1", LogPrefix(), seqno));
+    });
+    if (!s.ok()) {
+      // The log is closing.
+      return;
+    }
+  }
+}
+
+Status Log::ArchiveSegment(int64_t seqno) {
+  ScopedIOClass io_class(IOClass::kMaintenance);
+  Env* env = fs_manager_->env();
+  const string archive_dir = fs_manager_->GetTabletWalArchiveDir(tablet_id_);
+  scoped_refptr<ReadableLogSegment> segment;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    if (log_state_ != kLogWriting) {
+      return Status::OK();
+    }
+    segment = reader_->GetSegmentBySequenceNumber(seqno);
+  }
+  if (!segment || DirName(segment->path()) == archive_dir) {
+    return Status::OK();
+  }
+
+  // Copy the segment under a temporary name, so that a partial copy left by
+  // a crash is cleaned up rather than read.
+  const string& path = segment->path();
+  const string archive_path = JoinPathSegments(archive_dir, BaseName(path));
+  const string tmp_path = JoinPathSegments(
+      archive_dir, Substitute("$0.archiving-$1", kTmpInfix, BaseName(path)));
+  WritableFileOptions opts;
+  opts.sync_on_close = true;
+  RETURN_NOT_OK(env_util::CopyFile(env, path, tmp_path, opts));
+  RETURN_NOT_OK(env->RenameFile(tmp_path, archive_path));
+  RETURN_NOT_OK(env->SyncDir(archive_dir));
+
+  scoped_refptr<ReadableLogSegment> archived;
+  RETURN_NOT_OK(ReadableLogSegment::Open(env, archive_path, &archived));
+  archived->set_sparse_index(segment->sparse_index());
+  Status s;
+  {
+    std::lock_guard<percpu_rwlock> l(state_lock_);
+    s = log_state_ == kLogWriting
+        ? reader_->ReplaceSegment(archived)
+        : Status::NotFound("log is closed");
+  }
+  if (!s.ok()) {
+    // The segment was garbage-collected in the meantime.
+    DCHECK(s.IsNotFound()) << s.ToString();
+    return DeleteSegmentFile(env, archive_path);
+  }
+
+  LOG_WITH_PREFIX(INFO) << Substitute(
+      "Moved log segment $0 to $1", path, archive_path);
+  if (metrics_) {
+    metrics_->segments_archived->Increment();
+    metrics_->archived_bytes->IncrementBy(archived->file_size());
+  }
+  return DeleteSegmentFile(env, path);
+}
+
+// Overwrites all of the file at 'path' with zeros and syncs it, so that the
+// entries it used to hold can't be mistaken for entries of the segment that
+// reuses it when that segment's footer is rebuilt after a crash.
+static Status ZeroFillFile(Env* env, const string& path, uint64_t* size) {
+  RWFileOptions opts;
+  opts.mode = Env::OPEN_EXISTING;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK(env->NewRWFile(opts, path, &file));
+  RETURN_NOT_OK(file->Size(size));
+  RETURN_NOT_OK(WriteZeros(file.get(), 0, *size));
+  return file->Close();
+}
+
+Status Log::OpenRecycledSegment(
+    const WritableFileOptions& opts,
+    bool* reused,
+    uint64_t* reused_bytes) {
+  *reused = false;
+  *reused_bytes = 0;
+  if (options_.segment_recycle_pool_size <= 0) {
+    return Status::OK();
+  }
+
+  // Only a file in the next segment's own stripe can be renamed into place.
+  string dir = fs_manager_->GetTabletWalStripeDir(
+      tablet_id_, active_segment_sequence_number_ + 1);
+  string path;
+  {
+    std::lock_guard<simple_spinlock> l(recycle_lock_);
+    for (auto it = recycled_segment_paths_.begin();
+         it != recycled_segment_paths_.end();
+         ++it) {
+      if (DirName(*it) == dir) {
+        path = std::move(*it);
+        recycled_segment_paths_.erase(it);
+        break;
+      }
+    }
+  }
+  if (path.empty()) {
+    if (metrics_) {
+      metrics_->segment_recycle_pool_misses->Increment();
+    }
+    return Status::OK();
+  }
+
+  Env* env = fs_manager_->env();
+  WritableFileOptions reuse_opts = opts;
+  uint64_t size = 0;
+  Status s;
+  if (options_.zero_recycled_segments) {
+    s = ZeroFillFile(env, path, &size);
+    reuse_opts.mode = Env::OPEN_EXISTING;
+    reuse_opts.overwrite_existing = true;
+  }
+  // Without zero-filling, the default creation mode truncates the file,
+  // which still saves creating and unlinking it.
+  unique_ptr<WritableFile> file;
+  if (s.ok()) {
+    s = env->NewWritableFile(reuse_opts, path, &file);
+  }
+  if (!s.ok()) {
+    // Fall back to a brand new placeholder rather than failing allocation.
+    WARN_NOT_OK(
+        s, Substitute("Unable to reuse recycled log segment $0", path));
+    WARN_NOT_OK(
+        env->DeleteFile(path),
+        Substitute("Unable to delete recycled log segment $0", path));
+    if (metrics_) {
+      metrics_->segment_recycle_pool_misses->Increment();
+    }
+    return Status::OK();
+  }
+
+  VLOG_WITH_PREFIX(1) << "Reusing recycled log segment file " << path;
+  if (metrics_) {
+    metrics_->segment_recycle_pool_hits->Increment();
+  }
+  next_segment_path_ = std::move(path);
+  next_segment_file_.reset(file.release());
+  *reused = true;
+  *reused_bytes = options_.zero_recycled_segments ? size : 0;
+  return Status::OK();
+}
+
 Status Log::CreatePlaceholderSegment(
     const WritableFileOptions& opts,
     string* result_path,
@@ -1367,7 +2342,12 @@ Status Log::CreatePlaceholderSegment(
   CHECK(!FLAGS_raft_derived_log_mode);
   string tmp_suffix =
       strings::Substitute("$0$1", kTmpInfix, ".newsegmentXXXXXX");
-  string path_tmpl = JoinPathSegments(log_dir_, tmp_suffix);
+  // Create the placeholder in the directory the segment will be renamed
+  // into, so that the rename never crosses WAL stripes.
+  string path_tmpl = JoinPathSegments(
+      fs_manager_->GetTabletWalStripeDir(
+          tablet_id_, active_segment_sequence_number_ + 1),
+      tmp_suffix);
   VLOG_WITH_PREFIX(2)
       << "Creating temp. file for place holder segment, template: "
       << path_tmpl;
@@ -1386,6 +2366,9 @@ std::string Log::LogPrefix() const {
 
 Log::~Log() {
   // Close() of log is now called from simple_tablet_manager
+  if (archive_token_) {
+    archive_token_->Shutdown();
+  }
 }
 
 LogEntryBatch::LogEntryBatch(
@@ -1406,21 +2389,10 @@ LogEntryBatch::~LogEntryBatch() {
     for (LogEntryPB& entry : *entry_batch_pb_->mutable_entry()) {
       // ReplicateMsg elements are owned by and must be freed by the caller
       // (e.g. the LogCache).
-      std::ignore = entry.release_replicate();
+      std::ignore = entry.unsafe_arena_release_replicate();
     }
   }
 }
 
-void LogEntryBatch::Serialize() {
-  DCHECK_EQ(buffer_.size(), 0);
-  // FLUSH_MARKER LogEntries are markers and are not serialized.
-  if (PREDICT_FALSE(
-          count() == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER)) {
-    return;
-  }
-  buffer_.reserve(total_size_bytes_);
-  pb_util::AppendToString(*entry_batch_pb_, &buffer_);
-}
-
 } // namespace log
 } // namespace kudu
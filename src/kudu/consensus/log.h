@@ -26,6 +26,7 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <map>
 #include <memory>
@@ -41,6 +42,7 @@
 #endif
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
@@ -48,9 +50,10 @@
 #include "kudu/gutil/callback.h" // IWYU pragma: keep
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
-#include "kudu/util/blocking_queue.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mpsc_queue.h"
 #include "kudu/util/promise.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/slice.h"
@@ -59,17 +62,26 @@
 
 DECLARE_bool(raft_derived_log_mode);
 
+namespace google {
+namespace protobuf {
+class Arena;
+} // namespace protobuf
+} // namespace google
+
 namespace kudu {
 
 class CompressionCodec;
 class FsManager;
+class LockProfile;
 class MetricEntity;
 class ThreadPool;
+class ThreadPoolToken;
 class WritableFile;
 struct WritableFileOptions;
 
 namespace consensus {
 class OpId;
+class RaftResourceAccount;
 class ReplicateMsg;
 
 // After completing bootstrap, some of the results need to be plumbed through
@@ -118,7 +130,7 @@ class LogEntryBatch;
 class LogIndex;
 class LogReader;
 
-typedef BlockingQueue<LogEntryBatch*, LogEntryBatchLogicalSize>
+typedef MpscQueue<LogEntryBatch*, LogEntryBatchLogicalSize>
     LogEntryBatchQueue;
 
 // Log interface, inspired by Raft's (logcabin) Log. Provides durability to
@@ -191,13 +203,23 @@ class Log : public RefCountedThreadSafe<Log> {
 
   // Append the given commit message, asynchronously.
   //
+  // If LogOptions::separate_commit_lane is set, the commit is queued apart
+  // from replicates. It is then written behind the next group of replicates,
+  // or on its own after at most --log_commit_lane_max_delay_ms, and never
+  // forces a sync. A commit is always written after every replicate that was
+  // appended before it, but replicates appended after it may be written
+  // first. Its callback runs once it has been written, which only implies
+  // durability if its group was synced for the sake of its replicates.
+  //
   // Returns a bad status if the log is already shut down.
   Status AsyncAppendCommit(
       std::unique_ptr<consensus::CommitMsg> commit_msg,
       const StatusCallback& callback);
 
   // Blocks the current thread until all the entries in the log queue
-  // are flushed and fsynced (if fsync of log entries is enabled).
+  // are flushed and fsynced (if fsync of log entries is enabled). With a
+  // separate commit lane, also waits for the commits queued so far to be
+  // written.
   virtual Status WaitUntilAllFlushed();
 
   virtual Status TruncateOpsAfter(int64_t index) {
@@ -242,6 +264,7 @@ class Log : public RefCountedThreadSafe<Log> {
 
   void SetMaxSegmentSizeForTests(uint64_t max_segment_size) {
     max_segment_size_ = max_segment_size;
+    next_segment_size_ = max_segment_size;
   }
 
   void DisableAsyncAllocationForTests() {
@@ -272,6 +295,9 @@ class Log : public RefCountedThreadSafe<Log> {
   // 'min_op_idx' is the minimum operation index required to be retained.
   // If successful, num_gced is set to the number of deleted log segments.
   //
+  // With --fs_wal_archive_dir set, also starts moving the remaining closed
+  // segments that are only retained for peers to the WAL archive directory.
+  //
   // This method is thread-safe.
   Status GC(RetentionIndexes retention_indexes, int* num_gced);
 
@@ -307,6 +333,10 @@ class Log : public RefCountedThreadSafe<Log> {
   // Returns 0 if the log is shut down.
   int64_t OnDiskSize();
 
+  // Returns how full the queue of entries waiting to be appended is, as a
+  // percentage of --group_commit_queue_size_bytes.
+  int AppendQueueLoadPercent() const;
+
   // Returns the file system location of the currently active WAL segment.
   const std::string& ActiveSegmentPathForTests() const {
     return active_segment_->path();
@@ -342,8 +372,29 @@ class Log : public RefCountedThreadSafe<Log> {
       int64_t max_bytes_to_read,
       const consensus::ReadContext& context,
       std::vector<consensus::ReplicateMsg*>* replicates) const;
+  // Like ReadReplicatesInRange(), but the ReplicateMsgs are allocated on, and
+  // owned by, 'arena'.
+  virtual Status ReadReplicatesInRangeOnArena(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      const consensus::ReadContext& context,
+      google::protobuf::Arena* arena,
+      std::vector<consensus::ReplicateMsg*>* replicates) const;
   virtual Status LookupOpId(int64_t op_index, consensus::OpId* op_id) const;
 
+  // Reads up to 'max_length' bytes of the closed segment with sequence number
+  // 'seqno', starting at 'offset', into 'data', so that the segment can be
+  // copied to another server chunk by chunk. Sets 'segment_size' to the size
+  // of the whole segment. Returns NotFound if the segment was GCed, and
+  // IllegalState if it's still being written.
+  virtual Status ReadSegmentChunk(
+      int64_t seqno,
+      int64_t offset,
+      int64_t max_length,
+      faststring* data,
+      int64_t* segment_size) const;
+
  protected:
   friend class LogTest;
   friend class LogTestBase;
@@ -351,6 +402,11 @@ class Log : public RefCountedThreadSafe<Log> {
   FRIEND_TEST(LogTestOptionalCompression, TestMultipleEntriesInABatch);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTest, TestAdaptiveGroupCommit);
+  FRIEND_TEST(LogTest, TestAppendStageMetrics);
+  FRIEND_TEST(LogTest, TestSegmentRecycling);
+  FRIEND_TEST(LogTest, TestSegmentNotRecycledWhileRead);
+  FRIEND_TEST(LogTest, TestSeparateCommitLane);
 
   class AppendThread;
 
@@ -391,6 +447,32 @@ class Log : public RefCountedThreadSafe<Log> {
   // Writes the footer and closes the current segment.
   Status CloseCurrentSegment();
 
+  // Moves the garbage-collected segment file at 'path' into the recycle pool
+  // if the pool has room. Returns false if the file should be deleted instead.
+  bool RecycleSegmentFile(const std::string& path);
+
+  // Submits to 'archive_token_' the move of every closed segment outside the
+  // WAL archive directory whose ops are all below
+  // 'retention_indexes.for_durability'. Does nothing if WAL archiving is
+  // disabled.
+  void ScheduleSegmentArchiving(RetentionIndexes retention_indexes);
+
+  // Copies the segment with sequence number 'seqno' to the WAL archive
+  // directory, swaps the copy in for it in the reader and deletes the
+  // original. Does nothing if the segment was garbage-collected or archived
+  // in the meantime.
+  Status ArchiveSegment(int64_t seqno);
+
+  // Takes a recycled file from the pool that lies in the directory of the
+  // next segment, prepares it for reuse and makes it the next segment's
+  // placeholder. Sets 'reused' to false, leaving the placeholder untouched,
+  // if no suitable file was available. On success, 'reused_bytes' is set to
+  // the space already allocated to the file.
+  Status OpenRecycledSegment(
+      const WritableFileOptions& opts,
+      bool* reused,
+      uint64_t* reused_bytes);
+
   // Sets 'out' to a newly created temporary file (see
   // Env::NewTempWritableFile()) for a placeholder segment. Sets
   // 'result_path' to the fully qualified path to the unique filename
@@ -407,16 +489,32 @@ class Log : public RefCountedThreadSafe<Log> {
   // Preallocates the space for a new segment.
   Status PreAllocateNewSegment();
 
-  // Writes serialized contents of 'entry' to the log. Called inside
-  // AppenderThread.
+  // Returns the size of the next segment: 'max_segment_size_' unless
+  // LogOptions::segment_target_roll_interval_ms is set, in which case the
+  // smoothed append rate, updated with that of the active segment, over the
+  // target interval.
+  uint64_t NextSegmentSize();
+
+  // Whether the active segment holds entries and has been open for longer
+  // than LogOptions::segment_target_roll_interval_ms allows.
+  bool ActiveSegmentExpired() const;
+
+  // Serializes the contents of 'entry_batch' into the active segment's write
+  // buffer, rolling over to a new segment first if needed. Called inside
+  // AppenderThread. The batch is not written to the file until
+  // FlushBufferedAppends() is called.
   Status DoAppend(LogEntryBatch* entry_batch);
 
+  // Writes out all batches buffered by DoAppend() in a single write, and lets
+  // the reader see them.
+  Status FlushBufferedAppends();
+
   // Update footer_builder_ to reflect the log indexes seen in 'batch'.
   void UpdateFooterForBatch(LogEntryBatch* batch);
 
-  // Update the LogIndex to include entries for the replicate messages found in
-  // 'batch'. The index entry points to the offset 'start_offset' in the current
-  // log segment.
+  // Queue LogIndex entries for the replicate messages found in 'batch', to be
+  // added once the batch is flushed. The index entry points to the offset
+  // 'start_offset' in the current log segment.
   Status UpdateIndexForBatch(const LogEntryBatch& batch, int64_t start_offset);
 
   // Replaces the last "empty" segment in 'log_reader_', i.e. the one currently
@@ -435,6 +533,10 @@ class Log : public RefCountedThreadSafe<Log> {
     return &entry_batch_queue_;
   }
 
+  LogEntryBatchQueue* commit_queue() {
+    return &commit_batch_queue_;
+  }
+
   const SegmentAllocationState allocation_state() {
     shared_lock<RWMutex> l(allocation_lock_);
     return allocation_state_;
@@ -485,22 +587,50 @@ class Log : public RefCountedThreadSafe<Log> {
   // of the operation in the log.
   scoped_refptr<LogIndex> log_index_;
 
+  // Index entries for batches buffered in the active segment but not yet
+  // flushed. Only accessed by the append thread.
+  std::vector<LogIndexEntry> pending_index_entries_;
+
   // A footer being prepared for the current segment.
   // When the segment is closed, it will be written.
   LogSegmentFooterPB footer_builder_;
 
+  // A sparse index of the current segment, handed to its readable version
+  // when the segment is closed. NULL if --log_segment_sparse_index_interval
+  // is 0. Only accessed by the append thread.
+  std::shared_ptr<SegmentSparseIndex> sparse_index_;
+
   // The maximum segment size, in bytes.
   uint64_t max_segment_size_;
 
+  // The size of the segment being allocated, which becomes
+  // 'max_segment_size_' once it is switched to. Set before the allocation
+  // task runs.
+  uint64_t next_segment_size_;
+
+  // When the active segment was switched to, and the smoothed rate of
+  // appends to the previous segments, in bytes per second, or -1 if unknown.
+  // Only used with LogOptions::segment_target_roll_interval_ms.
+  MonoTime active_segment_open_time_;
+  int64_t append_bytes_per_sec_ = -1;
+
   // The queue used to communicate between the threads appending operations
   // and the thread which actually appends them to the log.
   LogEntryBatchQueue entry_batch_queue_;
 
+  // The queue of COMMIT entries, if LogOptions::separate_commit_lane is set.
+  // Drained by the same thread as 'entry_batch_queue_'.
+  LogEntryBatchQueue commit_batch_queue_;
+
   // Thread writing to the log
   std::unique_ptr<AppendThread> append_thread_;
 
   std::unique_ptr<ThreadPool> allocation_pool_;
 
+  // Runs ArchiveSegment() one segment at a time on a pool shared by all
+  // logs. Null unless WAL archiving is enabled.
+  std::unique_ptr<ThreadPoolToken> archive_token_;
+
   // If true, sync on all appends.
   bool force_sync_all_;
 
@@ -511,15 +641,28 @@ class Log : public RefCountedThreadSafe<Log> {
   // The status of the most recent log-allocation action.
   Promise<Status> allocation_status_;
 
+  // Set with --lock_profiling. Declared before 'allocation_lock_' to
+  // outlive it.
+  std::unique_ptr<LockProfile> allocation_lock_profile_;
+
   // Read-write lock to protect 'allocation_state_'.
   mutable RWMutex allocation_lock_;
   SegmentAllocationState allocation_state_;
 
+  // Protects 'recycled_segment_paths_'.
+  simple_spinlock recycle_lock_;
+
+  // Paths of garbage-collected segment files waiting to be reused as new
+  // segments, oldest first. Bounded by options_.segment_recycle_pool_size.
+  std::deque<std::string> recycled_segment_paths_;
+
   // The codec used to compress entries, or nullptr if not configured.
   std::shared_ptr<CompressionCodec> codec_;
 
   scoped_refptr<MetricEntity> metric_entity_;
   std::unique_ptr<LogMetrics> metrics_;
+  // Accounts the log's work to its ring; null without 'metric_entity_'.
+  std::unique_ptr<consensus::RaftResourceAccount> resource_account_;
 
   std::shared_ptr<LogFaultHooks> log_hooks_;
 
@@ -605,9 +748,6 @@ class LogEntryBatch {
       std::unique_ptr<LogEntryBatchPB> entry_batch_pb,
       size_t count);
 
-  // Serializes contents of the entry to an internal buffer.
-  void Serialize();
-
   // Sets the callback that will be invoked after the entry is
   // appended and synced to disk
   void set_callback(const StatusCallback& cb) {
@@ -620,12 +760,6 @@ class LogEntryBatch {
     return callback_;
   }
 
-  // Returns a Slice representing the serialized contents of the
-  // entry.
-  Slice data() const {
-    return Slice(buffer_);
-  }
-
   size_t count() const {
     return count_;
   }
@@ -671,9 +805,8 @@ class LogEntryBatch {
   // synced to disk.
   StatusCallback callback_;
 
-  // Buffer to which 'phys_entries_' are serialized by call to
-  // 'Serialize()'
-  faststring buffer_;
+  // When the batch was put on its queue. Used to measure queueing delay.
+  MonoTime enqueue_time_;
 
   DISALLOW_COPY_AND_ASSIGN(LogEntryBatch);
 };
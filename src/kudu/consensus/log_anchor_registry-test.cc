@@ -17,8 +17,11 @@
 
 #include "kudu/consensus/log_anchor_registry.h"
 
+#include <atomic>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -30,6 +33,8 @@
 #include "kudu/util/test_util.h"
 
 using std::string;
+using std::thread;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -122,5 +127,75 @@ TEST_F(LogAnchorRegistryTest, TestOrderedEarliestOpId) {
   ASSERT_TRUE(s.IsNotFound()) << s.ToString();
 }
 
+// Ensure that anchors churning concurrently never hide an anchor which stays
+// put from GetEarliestRegisteredLogIndex().
+TEST_F(LogAnchorRegistryTest, TestConcurrentChurn) {
+  scoped_refptr<LogAnchorRegistry> reg(new LogAnchorRegistry());
+  const int kNumThreads = 8;
+  const int kNumUpdates = 10000;
+  const string test_name = CURRENT_TEST_NAME();
+
+  LogAnchor pinned;
+  reg->Register(5, test_name, &pinned);
+
+  LogAnchor anchors[kNumThreads];
+  std::atomic<bool> done(false);
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i]() {
+      reg->Register(10, test_name, &anchors[i]);
+      for (int j = 0; j < kNumUpdates; j++) {
+        CHECK_OK(reg->UpdateRegistration(10 + j % 100, test_name, &anchors[i]));
+      }
+      CHECK_OK(reg->Unregister(&anchors[i]));
+    });
+  }
+  thread reader([&]() {
+    while (!done) {
+      int64_t anchor_idx = -1;
+      CHECK_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+      CHECK_EQ(5, anchor_idx);
+    }
+  });
+  for (thread& t : threads) {
+    t.join();
+  }
+  done = true;
+  reader.join();
+
+  ASSERT_EQ(1, reg->GetAnchorCountForTests());
+  ASSERT_OK(reg->Unregister(&pinned));
+  ASSERT_EQ(0, reg->GetAnchorCountForTests());
+}
+
+// Ensure that an index handed from one anchor to another, which may be in a
+// different shard, is never missed by GetEarliestRegisteredLogIndex().
+TEST_F(LogAnchorRegistryTest, TestConcurrentHandoff) {
+  scoped_refptr<LogAnchorRegistry> reg(new LogAnchorRegistry());
+  const int kNumAnchors = 16;
+  const int kNumHandoffs = 100000;
+  const string test_name = CURRENT_TEST_NAME();
+
+  LogAnchor anchors[kNumAnchors];
+  reg->Register(5, test_name, &anchors[0]);
+  std::atomic<bool> done(false);
+  thread reader([&]() {
+    while (!done) {
+      int64_t anchor_idx = -1;
+      CHECK_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+      CHECK_EQ(5, anchor_idx);
+    }
+  });
+  for (int i = 0; i < kNumHandoffs; i++) {
+    reg->Register(5, test_name, &anchors[(i + 1) % kNumAnchors]);
+    CHECK_OK(reg->Unregister(&anchors[i % kNumAnchors]));
+  }
+  done = true;
+  reader.join();
+
+  ASSERT_OK(reg->Unregister(&anchors[kNumHandoffs % kNumAnchors]));
+  ASSERT_EQ(0, reg->GetAnchorCountForTests());
+}
+
 } // namespace log
 } // namespace kudu
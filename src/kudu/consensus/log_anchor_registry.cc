@@ -17,6 +17,7 @@
 
 #include "kudu/consensus/log_anchor_registry.h"
 
+#include <algorithm>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -34,83 +35,128 @@ namespace log {
 using consensus::kInvalidOpIdIndex;
 using std::string;
 using strings::Substitute;
-using strings::SubstituteAndAppend;
 
 LogAnchorRegistry::LogAnchorRegistry() {}
 
 LogAnchorRegistry::~LogAnchorRegistry() {
-  CHECK(anchors_.empty());
+  for (const Shard& shard : shards_) {
+    CHECK(shard.anchors.empty());
+  }
+}
+
+LogAnchorRegistry::Shard* LogAnchorRegistry::ShardFor(const LogAnchor* anchor) {
+  // Anchors are usually members of larger objects, so the low bits of their
+  // addresses vary little.
+  const uint64_t h =
+      reinterpret_cast<uintptr_t>(anchor) * 0x9E3779B97F4A7C15ULL;
+  return &shards_[(h >> 32) % kNumShards];
 }
 
 void LogAnchorRegistry::Register(
     int64_t log_index,
     const string& owner,
     LogAnchor* anchor) {
-  std::lock_guard<simple_spinlock> l(lock_);
-  RegisterUnlocked(log_index, owner, anchor);
+  Shard* shard = ShardFor(anchor);
+  std::lock_guard<simple_spinlock> l(shard->lock);
+  RegisterUnlocked(shard, log_index, owner, anchor);
+  UpdateMinUnlocked(shard);
 }
 
 Status LogAnchorRegistry::UpdateRegistration(
     int64_t log_index,
     const std::string& owner,
     LogAnchor* anchor) {
-  std::lock_guard<simple_spinlock> l(lock_);
+  Shard* shard = ShardFor(anchor);
+  std::lock_guard<simple_spinlock> l(shard->lock);
   RETURN_NOT_OK_PREPEND(
-      UnregisterUnlocked(anchor),
+      UnregisterUnlocked(shard, anchor),
       "Unable to swap registration, anchor not registered")
-  RegisterUnlocked(log_index, owner, anchor);
+  RegisterUnlocked(shard, log_index, owner, anchor);
+  // Published once, so that readers never see the shard without the anchor.
+  UpdateMinUnlocked(shard);
   return Status::OK();
 }
 
 Status LogAnchorRegistry::Unregister(LogAnchor* anchor) {
-  std::lock_guard<simple_spinlock> l(lock_);
-  return UnregisterUnlocked(anchor);
+  Shard* shard = ShardFor(anchor);
+  std::lock_guard<simple_spinlock> l(shard->lock);
+  RETURN_NOT_OK(UnregisterUnlocked(shard, anchor));
+  UpdateMinUnlocked(shard);
+  return Status::OK();
 }
 
 Status LogAnchorRegistry::UnregisterIfAnchored(LogAnchor* anchor) {
-  std::lock_guard<simple_spinlock> l(lock_);
+  Shard* shard = ShardFor(anchor);
+  std::lock_guard<simple_spinlock> l(shard->lock);
   if (!anchor->is_registered)
     return Status::OK();
-  return UnregisterUnlocked(anchor);
+  RETURN_NOT_OK(UnregisterUnlocked(shard, anchor));
+  UpdateMinUnlocked(shard);
+  return Status::OK();
 }
 
 Status LogAnchorRegistry::GetEarliestRegisteredLogIndex(int64_t* log_index) {
-  std::lock_guard<simple_spinlock> l(lock_);
-  auto iter = anchors_.begin();
-  if (iter == anchors_.end()) {
+  int64_t earliest;
+  uint64_t version = version_.load(std::memory_order_acquire);
+  while (true) {
+    earliest = INT64_MAX;
+    for (const Shard& shard : shards_) {
+      earliest =
+          std::min(earliest, shard.min_index.load(std::memory_order_acquire));
+    }
+    // Keeps the loads above from moving past the check below.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t new_version = version_.load(std::memory_order_relaxed);
+    if (new_version == version) {
+      break;
+    }
+    version = new_version;
+  }
+  if (earliest == INT64_MAX) {
     return Status::NotFound("No anchors in registry");
   }
-
-  // Since this is a sorted map, the first element is the one we want.
-  *log_index = iter->first;
+  *log_index = earliest;
   return Status::OK();
 }
 
 size_t LogAnchorRegistry::GetAnchorCountForTests() const {
-  std::lock_guard<simple_spinlock> l(lock_);
-  return anchors_.size();
+  size_t count = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard.lock);
+    count += shard.anchors.size();
+  }
+  return count;
 }
 
 std::string LogAnchorRegistry::DumpAnchorInfo() const {
-  string buf;
-  std::lock_guard<simple_spinlock> l(lock_);
+  // Merged across the shards, in index order.
+  std::multimap<int64_t, string> entries;
   MonoTime now = MonoTime::Now();
-  for (const AnchorMultiMap::value_type& entry : anchors_) {
-    const LogAnchor* anchor = entry.second;
-    DCHECK(anchor->is_registered);
+  for (const Shard& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard.lock);
+    for (const AnchorMultiMap::value_type& entry : shard.anchors) {
+      const LogAnchor* anchor = entry.second;
+      DCHECK(anchor->is_registered);
+      entries.emplace(
+          anchor->log_index,
+          Substitute(
+              "LogAnchor[index=$0, age=$1s, owner=$2]",
+              anchor->log_index,
+              (now - anchor->when_registered).ToSeconds(),
+              anchor->owner));
+    }
+  }
+  string buf;
+  for (const auto& entry : entries) {
     if (!buf.empty())
       buf += ", ";
-    SubstituteAndAppend(
-        &buf,
-        "LogAnchor[index=$0, age=$1s, owner=$2]",
-        anchor->log_index,
-        (now - anchor->when_registered).ToSeconds(),
-        anchor->owner);
+    buf += entry.second;
   }
   return buf;
 }
 
 void LogAnchorRegistry::RegisterUnlocked(
+    Shard* shard,
     int64_t log_index,
     const std::string& owner,
     LogAnchor* anchor) {
@@ -122,18 +168,18 @@ void LogAnchorRegistry::RegisterUnlocked(
   anchor->is_registered = true;
   anchor->when_registered = MonoTime::Now();
   AnchorMultiMap::value_type value(log_index, anchor);
-  anchors_.insert(value);
+  shard->anchors.insert(value);
 }
 
-Status LogAnchorRegistry::UnregisterUnlocked(LogAnchor* anchor) {
+Status LogAnchorRegistry::UnregisterUnlocked(Shard* shard, LogAnchor* anchor) {
   DCHECK(anchor != nullptr);
   DCHECK(anchor->is_registered);
 
-  auto iter = anchors_.find(anchor->log_index);
-  while (iter != anchors_.end()) {
+  auto iter = shard->anchors.find(anchor->log_index);
+  while (iter != shard->anchors.end()) {
     if (iter->second == anchor) {
       anchor->is_registered = false;
-      anchors_.erase(iter);
+      shard->anchors.erase(iter);
       // No need for the iterator to remain valid since we return here.
       return Status::OK();
     }
@@ -145,6 +191,14 @@ Status LogAnchorRegistry::UnregisterUnlocked(LogAnchor* anchor) {
       anchor->owner));
 }
 
+void LogAnchorRegistry::UpdateMinUnlocked(Shard* shard) {
+  // Since this is a sorted map, the first element is the minimum.
+  shard->min_index.store(
+      shard->anchors.empty() ? INT64_MAX : shard->anchors.begin()->first,
+      std::memory_order_release);
+  version_.fetch_add(1, std::memory_order_release);
+}
+
 LogAnchor::LogAnchor() : is_registered(false), log_index(kInvalidOpIdIndex) {}
 
 LogAnchor::~LogAnchor() {
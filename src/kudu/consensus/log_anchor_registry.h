@@ -17,6 +17,7 @@
 #ifndef KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 #define KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <map>
@@ -25,6 +26,7 @@
 #include <gtest/gtest_prod.h>
 
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/monotime.h"
@@ -39,6 +41,13 @@ struct LogAnchor;
 // log index. The primary use case for this is to prevent the deletion of
 // segments of the WAL that reference as-yet unflushed in-memory operations.
 //
+// Anchors are spread over shards by their address, each with its own lock and
+// its own minimum, published atomically, so that anchors churning in one
+// shard don't contend with those in another or with the log GC, which only
+// reads the shard minimums. Each change to a shard minimum also bumps a
+// version shared by all shards, so that the GC can tell whether the minimums
+// it read were consistent.
+//
 // This class is thread-safe.
 class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
  public:
@@ -70,7 +79,11 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
   Status UnregisterIfAnchored(LogAnchor* anchor);
 
   // Query the registry to find the earliest anchored log index in the registry.
-  // Returns Status::NotFound if no anchors are currently active.
+  // Returns Status::NotFound if no anchors are currently active. Takes no
+  // locks, but reads the shards again if any minimum changed while they were
+  // read, so that an index handed from an anchor in one shard to one in
+  // another, by registering the new anchor before unregistering the old, is
+  // never missed.
   Status GetEarliestRegisteredLogIndex(int64_t* log_index);
 
   // Simply returns the number of active anchors for use in debugging / tests.
@@ -86,17 +99,36 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
 
   typedef std::multimap<int64_t, LogAnchor*> AnchorMultiMap;
 
-  // Register a new anchor after taking the lock. See Register().
-  void RegisterUnlocked(
+  static constexpr int kNumShards = 16;
+
+  struct Shard {
+    AnchorMultiMap anchors;
+    // The lowest index in 'anchors', or INT64_MAX if it is empty. Written
+    // under 'lock' and read without it.
+    std::atomic<int64_t> min_index{INT64_MAX};
+    mutable simple_spinlock lock;
+  } CACHELINE_ALIGNED;
+
+  // Returns the shard which holds 'anchor'.
+  Shard* ShardFor(const LogAnchor* anchor);
+
+  // Register a new anchor after taking the shard's lock. See Register().
+  static void RegisterUnlocked(
+      Shard* shard,
       int64_t log_index,
       const std::string& owner,
       LogAnchor* anchor);
 
-  // Unregister an anchor after taking the lock. See Unregister().
-  Status UnregisterUnlocked(LogAnchor* anchor);
+  // Unregister an anchor after taking the shard's lock. See Unregister().
+  static Status UnregisterUnlocked(Shard* shard, LogAnchor* anchor);
 
-  AnchorMultiMap anchors_;
-  mutable simple_spinlock lock_;
+  // Publishes the new minimum of 'shard' after a change.
+  void UpdateMinUnlocked(Shard* shard);
+
+  Shard shards_[kNumShards];
+
+  // Bumped after every change to a shard minimum.
+  std::atomic<uint64_t> version_{0};
 
   DISALLOW_COPY_AND_ASSIGN(LogAnchorRegistry);
 };
@@ -19,6 +19,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <thread>
@@ -26,6 +27,7 @@
 
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <gtest/gtest.h>
 
 #include "kudu/clock/clock.h"
@@ -40,11 +42,14 @@
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -55,13 +60,25 @@
 
 using std::atomic;
 using std::shared_ptr;
+using std::string;
 using std::thread;
 using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
 DECLARE_int32(log_cache_size_limit_mb);
+DECLARE_int32(log_cache_witness_size_limit_mb);
 DECLARE_int32(global_log_cache_size_limit_mb);
+DECLARE_int32(log_cache_disk_read_cache_mb);
+DECLARE_int32(log_cache_warmup_mb);
+DECLARE_bool(log_cache_keep_uncompressed_ops);
+DECLARE_int32(log_cache_readahead_batches);
+DECLARE_int32(log_cache_compression_threads);
+DECLARE_int64(log_cache_spill_capacity_mb);
+DECLARE_bool(log_cache_arbiter_enabled);
+DECLARE_int32(log_cache_arbiter_interval_ms);
+DECLARE_int32(log_cache_arbiter_min_budget_mb);
+DECLARE_bool(log_cache_read_arenas);
 
 // METRIC_DECLARE_entity(tablet);
 
@@ -102,9 +119,9 @@ class LogCacheTest : public KuduTest {
     log_->WaitUntilAllFlushed();
   }
 
-  void CloseAndReopenCache(const OpId& preceding_id) {
-    cache_.reset(
-        new LogCache(metric_entity_, log_.get(), kPeerUuid, kTestTablet));
+  void CloseAndReopenCache(const OpId& preceding_id, bool witness = false) {
+    cache_.reset(new LogCache(
+        metric_entity_, log_.get(), kPeerUuid, kTestTablet, witness));
     cache_->Init(preceding_id);
   }
 
@@ -181,6 +198,26 @@ TEST_F(LogCacheTest, TestAppendAndGetMessages) {
   EXPECT_EQ("3.21", OpIdToString(messages[0]->get()->id()));
 }
 
+// Callbacks waiting for an op run once it's appended, and no sooner.
+TEST_F(LogCacheTest, TestNotifyWhenAppended) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 2));
+
+  int notified_3 = 0;
+  int notified_5 = 0;
+  ASSERT_FALSE(cache_->NotifyWhenAppended(2, [] {}));
+  ASSERT_TRUE(cache_->NotifyWhenAppended(3, [&]() { notified_3++; }));
+  ASSERT_TRUE(cache_->NotifyWhenAppended(5, [&]() { notified_5++; }));
+
+  ASSERT_OK(AppendReplicateMessagesToCache(3, 1));
+  ASSERT_EQ(1, notified_3);
+  ASSERT_EQ(0, notified_5);
+
+  ASSERT_OK(AppendReplicateMessagesToCache(4, 2));
+  ASSERT_EQ(1, notified_3);
+  ASSERT_EQ(1, notified_5);
+  log_->WaitUntilAllFlushed();
+}
+
 // Ensure that the cache always yields at least one message,
 // even if that message is larger than the batch size. This ensures
 // that we don't get "stuck" in the case that a large message enters
@@ -296,6 +333,36 @@ TEST_F(LogCacheTest, TestMemoryLimit) {
   ASSERT_EQ(cache_->BytesUsed(), 0);
 }
 
+// A witness' cache has a limit of its own.
+TEST_F(LogCacheTest, TestWitnessMemoryLimit) {
+  FLAGS_log_cache_size_limit_mb = 16;
+  FLAGS_log_cache_witness_size_limit_mb = 1;
+  FLAGS_log_cache_readahead_batches = 4;
+  CloseAndReopenCache(MinimumOpId(), /*witness=*/true);
+
+  const int kPayloadSize = 400 * 1024;
+  for (int i = 1; i <= 3; i++) {
+    ASSERT_OK(AppendReplicateMessagesToCache(i, 1, kPayloadSize));
+    log_->WaitUntilAllFlushed();
+  }
+  ASSERT_EQ(2, cache_->num_cached_ops());
+  ASSERT_LT(cache_->BytesUsed(), 1024 * 1024);
+}
+
+TEST_F(LogCacheTest, TestLoadPercent) {
+  FLAGS_log_cache_size_limit_mb = 1;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_EQ(0, cache_->LoadPercent());
+
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 1, 400 * 1024));
+  log_->WaitUntilAllFlushed();
+  ASSERT_GE(cache_->LoadPercent(), 30);
+  ASSERT_LE(cache_->LoadPercent(), 50);
+
+  cache_->EvictThroughOp(1);
+  ASSERT_EQ(0, cache_->LoadPercent());
+}
+
 TEST_F(LogCacheTest, TestGlobalMemoryLimit) {
   // Need to force the global cache memtracker to be destroyed before calling
   // CloseAndreopenCache(), otherwise it'll just be reused instead of recreated
@@ -320,6 +387,33 @@ TEST_F(LogCacheTest, TestGlobalMemoryLimit) {
   ASSERT_LE(cache_->BytesUsed(), 1024 * 1024);
 }
 
+// Test that the arbiter gives a busy cache more of the global limit than an
+// idle one, and that lowering a cache's budget evicts ops.
+TEST_F(LogCacheTest, TestArbiter) {
+  cache_.reset();
+  FLAGS_log_cache_arbiter_enabled = true;
+  FLAGS_log_cache_arbiter_interval_ms = 0;
+  FLAGS_log_cache_arbiter_min_budget_mb = 1;
+  FLAGS_log_cache_size_limit_mb = 4;
+  FLAGS_global_log_cache_size_limit_mb = 6;
+  CloseAndReopenCache(MinimumOpId());
+  LogCache idle(metric_entity_, log_.get(), kPeerUuid, "idle-tablet");
+  idle.Init(MinimumOpId());
+
+  const int kPayloadSize = 128 * 1024;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 8, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  ASSERT_EQ(4 * 1024 * 1024, cache_->budget_bytes_.Load());
+  ASSERT_EQ(2 * 1024 * 1024, idle.budget_bytes_.Load());
+
+  // Squeezing the busy cache evicts down to the new budget.
+  cache_->ApplyBudget(kPayloadSize * 3);
+  ASSERT_LE(cache_->BytesUsed(), kPayloadSize * 3);
+  ASSERT_GT(
+      cache_->metrics_.log_cache_budget_evicted_bytes->value(),
+      kPayloadSize * 4);
+}
+
 // Test that the log cache properly replaces messages when an index
 // is reused. This is a regression test for a bug where the memtracker's
 // consumption wasn't properly managed when messages were replaced.
@@ -347,6 +441,408 @@ TEST_F(LogCacheTest, TestReplaceMessages) {
 
 // Test that the cache truncates any future messages when either explicitly
 // truncated or replacing any earlier message.
+// Test that evicted ops are served back from the spill tier.
+TEST_F(LogCacheTest, TestSpillTier) {
+  FLAGS_log_cache_spill_capacity_mb = 16;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 20;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+  cache_->spill_pool_->Wait();
+  ASSERT_EQ(kNumOps, cache_->metrics_.log_cache_spill_ops_written->value());
+
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages).status);
+  ASSERT_EQ(kNumOps, messages.size());
+  ASSERT_EQ(kNumOps, cache_->metrics_.log_cache_spill_hits->value());
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(i + 1, messages[i]->get()->id().index());
+    ASSERT_EQ(
+        100, messages[i]->get()->noop_request().payload_for_tests().size());
+  }
+}
+
+// Proxied reads are prepared differently, so they go to the log rather than
+// to the spill tier.
+TEST_F(LogCacheTest, TestSpillTierSkipsProxiedReads) {
+  FLAGS_log_cache_spill_capacity_mb = 16;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 10;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  cache_->spill_pool_->Wait();
+  ASSERT_EQ(kNumOps, cache_->metrics_.log_cache_spill_ops_written->value());
+
+  ReadContext context;
+  context.route_via_proxy = true;
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(cache_->ReadOps(0, 8 * 1024 * 1024, context, &messages).status);
+  ASSERT_EQ(kNumOps, messages.size());
+  ASSERT_EQ(0, cache_->metrics_.log_cache_spill_hits->value());
+}
+
+// The spill tier is shared by the server, so a cache erases its spilled ops
+// when it is destroyed.
+TEST_F(LogCacheTest, TestSpillTierErasedWithCache) {
+  FLAGS_log_cache_spill_capacity_mb = 16;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 10;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  cache_->spill_pool_->Wait();
+  vector<string> keys;
+  for (int i = 1; i <= kNumOps; i++) {
+    keys.push_back(cache_->SpillKey(i));
+    ASSERT_TRUE(LogCache::IsSpilledForTests(keys.back()));
+  }
+
+  CloseAndReopenCache(MinimumOpId());
+  for (const string& key : keys) {
+    ASSERT_FALSE(LogCache::IsSpilledForTests(key));
+  }
+}
+
+// Peers reading the same range from memory share a batch, until ops are
+// appended past it or truncated.
+TEST_F(LogCacheTest, TestSharedOps) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+
+  LogCache::SharedOps first;
+  LogCache::ReadOpsStatus s =
+      cache_->ReadSharedOps(4, 8 * 1024 * 1024, ReadContext(), &first);
+  ASSERT_OK(s.status);
+  ASSERT_EQ(6, first->size());
+  EXPECT_EQ("0.4", OpIdToString(s.preceding_op));
+  EXPECT_FALSE(s.stopped_early);
+
+  LogCache::SharedOps second;
+  s = cache_->ReadSharedOps(4, 8 * 1024 * 1024, ReadContext(), &second);
+  ASSERT_OK(s.status);
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_EQ("0.4", OpIdToString(s.preceding_op));
+
+  // A batch which reached the last op isn't reused once there are more.
+  ASSERT_OK(AppendReplicateMessagesToCache(11, 1));
+  log_->WaitUntilAllFlushed();
+  s = cache_->ReadSharedOps(4, 8 * 1024 * 1024, ReadContext(), &second);
+  ASSERT_OK(s.status);
+  EXPECT_NE(first.get(), second.get());
+  ASSERT_EQ(7, second->size());
+
+  // Nor is one which was truncated.
+  cache_->TruncateOpsAfter(8);
+  LogCache::SharedOps third;
+  s = cache_->ReadSharedOps(4, 8 * 1024 * 1024, ReadContext(), &third);
+  ASSERT_OK(s.status);
+  EXPECT_NE(second.get(), third.get());
+  ASSERT_EQ(4, third->size());
+  EXPECT_EQ(8, third->back()->get()->id().index());
+}
+
+// Test that ops read back from the log can be allocated on a shared arena
+// which outlives the cache.
+TEST_F(LogCacheTest, TestReadArenas) {
+  FLAGS_log_cache_read_arenas = true;
+
+  const int kNumOps = 10;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages).status);
+  ASSERT_EQ(kNumOps, messages.size());
+  google::protobuf::Arena* arena = messages[0]->get()->GetArena();
+  ASSERT_NE(nullptr, arena);
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(arena, messages[i]->get()->GetArena());
+  }
+
+  // The ops keep the arena alive after the cache is gone.
+  cache_.reset();
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(i + 1, messages[i]->get()->id().index());
+  }
+}
+
+// Test that two peers reading the same ops from the log share one read.
+TEST_F(LogCacheTest, TestDiskReadCache) {
+  FLAGS_log_cache_disk_read_cache_mb = 1;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 20;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+
+  vector<ReplicateRefPtr> first;
+  ASSERT_OK(
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &first).status);
+  ASSERT_EQ(kNumOps, first.size());
+  ASSERT_EQ(0, cache_->metrics_.log_cache_disk_read_cache_hits->value());
+
+  vector<ReplicateRefPtr> second;
+  ASSERT_OK(
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &second).status);
+  ASSERT_EQ(kNumOps, second.size());
+  ASSERT_EQ(kNumOps, cache_->metrics_.log_cache_disk_read_cache_hits->value());
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(first[i]->get(), second[i]->get());
+  }
+
+  // Truncated ops must not be served again.
+  int64_t consumption = cache_->disk_read_tracker_->consumption();
+  cache_->TruncateOpsAfter(kNumOps / 2);
+  ASSERT_LT(cache_->disk_read_tracker_->consumption(), consumption);
+  ASSERT_EQ(kNumOps / 2, cache_->disk_read_cache_.size());
+}
+
+// Test that warming up the cache reads the ops which aren't in memory into
+// the disk read cache, from which peers are then served.
+TEST_F(LogCacheTest, TestWarmUp) {
+  FLAGS_log_cache_disk_read_cache_mb = 1;
+  FLAGS_log_cache_warmup_mb = 1;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 20;
+  const int kNumEvicted = 10;
+  const int kWarmUpFrom = 5;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumEvicted);
+
+  // Only the evicted ops are read.
+  const int kNumWarmed = kNumEvicted - kWarmUpFrom + 1;
+  cache_->WarmUp(kWarmUpFrom);
+  AssertEventually([&]() {
+    ASSERT_EQ(
+        kNumWarmed, cache_->metrics_.log_cache_warmup_ops_read->value());
+  });
+
+  vector<ReplicateRefPtr> messages;
+  const int kMaxBytes = 8 * 1024 * 1024;
+  ASSERT_OK(
+      cache_->ReadOps(kWarmUpFrom - 1, kMaxBytes, ReadContext(), &messages)
+          .status);
+  ASSERT_EQ(kNumOps - kWarmUpFrom + 1, messages.size());
+  ASSERT_EQ(
+      kNumWarmed, cache_->metrics_.log_cache_disk_read_cache_hits->value());
+}
+
+// Test that a peer reading sequentially from the log gets ops read ahead of
+// it in the background, and that those are served in order.
+TEST_F(LogCacheTest, TestReadahead) {
+  FLAGS_log_cache_readahead_batches = 4;
+  CloseAndReopenCache(MinimumOpId());
+
+  const int kNumOps = 100;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps, 100));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+
+  const string kPeer = "peer";
+  ReadContext context;
+  context.for_peer_uuid = &kPeer;
+
+  // Each read returns a handful of ops; the second one is sequential and
+  // starts the read-ahead.
+  const int kBatchBytes = 1024;
+  int64_t index = 0;
+  for (int i = 0; i < 2; i++) {
+    vector<ReplicateRefPtr> messages;
+    ASSERT_OK(cache_->ReadOps(index, kBatchBytes, context, &messages).status);
+    ASSERT_FALSE(messages.empty());
+    index += messages.size();
+  }
+  AssertEventually([&]() {
+    ASSERT_GT(cache_->metrics_.log_cache_readahead_ops_read->value(), 0);
+  });
+
+  while (index < kNumOps) {
+    vector<ReplicateRefPtr> messages;
+    ASSERT_OK(cache_->ReadOps(index, kBatchBytes, context, &messages).status);
+    for (const ReplicateRefPtr& msg : messages) {
+      ASSERT_EQ(++index, msg->get()->id().index());
+    }
+  }
+  ASSERT_GT(cache_->metrics_.log_cache_readahead_ops_served->value(), 0);
+
+  // Truncation drops whatever was read ahead, and the state of every peer.
+  cache_->TruncateOpsAfter(kNumOps / 2);
+  AssertEventually([&]() {
+    ASSERT_EQ(0, cache_->readahead_tracker_->consumption());
+  });
+  {
+    std::lock_guard<simple_spinlock> l(cache_->readahead_lock_);
+    ASSERT_TRUE(cache_->readahead_.empty());
+  }
+
+  // So does untracking the peer.
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(cache_->ReadOps(0, kBatchBytes, context, &messages).status);
+  {
+    std::lock_guard<simple_spinlock> l(cache_->readahead_lock_);
+    ASSERT_EQ(1, cache_->readahead_.count(kPeer));
+  }
+  cache_->DropReadahead(kPeer);
+  {
+    std::lock_guard<simple_spinlock> l(cache_->readahead_lock_);
+    ASSERT_TRUE(cache_->readahead_.empty());
+  }
+  AssertEventually([&]() {
+    ASSERT_EQ(0, cache_->readahead_tracker_->consumption());
+  });
+}
+
+// Ops appended uncompressed are compressed in the background, and their
+// compressed form replaces them in the cache.
+TEST_F(LogCacheTest, TestBackgroundCompression) {
+  FLAGS_log_cache_compression_threads = 1;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_TRUE(cache_->compresses_in_background());
+  ASSERT_OK(cache_->codec_manager()->SetCurrentCodec(LZ4));
+
+  const int kNumOps = 10;
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  for (int i = 1; i <= kNumOps; i++) {
+    unique_ptr<ReplicateMsg> msg(new ReplicateMsg);
+    *msg->mutable_id() = MakeOpId(1, i);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(string(4096, 'a'));
+    msg_wrappers.emplace_back(
+        make_scoped_refptr_replicate(msg.release()),
+        cache_->codec_manager(),
+        /*should_compress=*/false);
+    ASSERT_OK(msg_wrappers.back().Init(nullptr));
+  }
+  ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  const int64_t uncompressed_size = kNumOps * 4096;
+
+  AssertEventually([&]() {
+    ASSERT_LT(cache_->metrics_.log_cache_size->value(), uncompressed_size);
+    ASSERT_GT(
+        cache_->metrics_.log_cache_compressed_payload_size->value(), 0);
+  });
+  ASSERT_EQ(
+      cache_->metrics_.log_cache_size->value(),
+      cache_->metrics_.log_cache_compressed_payload_size->value());
+
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(
+      0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(kNumOps, messages.size());
+  for (const ReplicateRefPtr& msg : messages) {
+    ASSERT_EQ(LZ4, msg->get()->write_payload().compression_codec());
+    ASSERT_EQ(4096, msg->get()->write_payload().uncompressed_size());
+  }
+  log_->WaitUntilAllFlushed();
+}
+
+// Ops kept as received, compressed, go to the log and back without being
+// uncompressed.
+TEST_F(LogCacheTest, TestOpaquePayloads) {
+  ASSERT_OK(cache_->codec_manager()->SetCurrentCodec(LZ4));
+
+  const int kNumOps = 10;
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  vector<string> payloads;
+  for (int i = 1; i <= kNumOps; i++) {
+    unique_ptr<ReplicateMsg> msg(new ReplicateMsg);
+    *msg->mutable_id() = MakeOpId(1, i);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(string(4096, 'a' + i));
+    ReplicateMsgWrapper leader_wrapper(
+        make_scoped_refptr_replicate(msg.release()), cache_->codec_manager());
+    ASSERT_OK(leader_wrapper.Init(nullptr));
+    ReplicateRefPtr compressed = leader_wrapper.GetCompressedMsg();
+    ASSERT_NE(nullptr, compressed.get());
+    ASSERT_TRUE(compressed->get()->write_payload().has_crc32());
+    payloads.push_back(compressed->get()->write_payload().payload());
+
+    msg_wrappers.emplace_back(compressed, cache_->codec_manager());
+    ASSERT_OK(msg_wrappers.back().InitOpaque());
+    ASSERT_EQ(nullptr, msg_wrappers.back().GetUncompressedMsg().get());
+  }
+  ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(kNumOps);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages).status);
+  ASSERT_EQ(kNumOps, messages.size());
+  for (int i = 0; i < kNumOps; i++) {
+    const WritePayloadPB& payload = messages[i]->get()->write_payload();
+    ASSERT_EQ(LZ4, payload.compression_codec());
+    ASSERT_EQ(payloads[i], payload.payload());
+    ASSERT_EQ(
+        msg_wrappers[i].GetOrigMsg()->get()->write_payload().crc32(),
+        payload.crc32());
+  }
+}
+
+// Test that both forms of a compressed op are cached and charged for, whether
+// the op was appended with both or uncompressed after being appended.
+TEST_F(LogCacheTest, TestKeepUncompressedOps) {
+  FLAGS_log_cache_keep_uncompressed_ops = true;
+  ASSERT_OK(cache_->codec_manager()->SetCurrentCodec(LZ4));
+
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  vector<ReplicateRefPtr> uncompressed;
+  for (int i = 1; i <= 2; i++) {
+    unique_ptr<ReplicateMsg> msg(new ReplicateMsg);
+    *msg->mutable_id() = MakeOpId(1, i);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(string(4096, 'a' + i));
+    ReplicateMsgWrapper leader_wrapper(
+        make_scoped_refptr_replicate(msg.release()), cache_->codec_manager());
+    ASSERT_OK(leader_wrapper.Init(nullptr));
+    uncompressed.push_back(leader_wrapper.GetUncompressedMsg());
+
+    // The first op arrives with both forms, the second one compressed only.
+    if (i == 1) {
+      msg_wrappers.push_back(leader_wrapper);
+    } else {
+      msg_wrappers.emplace_back(
+          leader_wrapper.GetCompressedMsg(), cache_->codec_manager());
+      ASSERT_OK(msg_wrappers.back().InitOpaque());
+    }
+  }
+  ASSERT_OK(cache_->AppendOperations(msg_wrappers, Bind(&FatalOnError)));
+  log_->WaitUntilAllFlushed();
+
+  const ReplicateRefPtr& first = msg_wrappers[0].GetCompressedMsg();
+  const ReplicateRefPtr& second = msg_wrappers[1].GetCompressedMsg();
+  ASSERT_EQ(uncompressed[0].get(), cache_->FindUncompressedMsg(first).get());
+  ASSERT_EQ(nullptr, cache_->FindUncompressedMsg(second).get());
+
+  const int64_t bytes_used = cache_->BytesUsed();
+  cache_->KeepUncompressedMsg(second, uncompressed[1]);
+  ASSERT_EQ(uncompressed[1].get(), cache_->FindUncompressedMsg(second).get());
+  ASSERT_GE(cache_->BytesUsed(), bytes_used + 4096);
+
+  // Evicting the ops releases the memory of both forms.
+  cache_->EvictThroughOp(2);
+  ASSERT_EQ(0, cache_->BytesUsed());
+}
+
 TEST_F(LogCacheTest, TestTruncation) {
   enum { TRUNCATE_BY_APPEND, TRUNCATE_EXPLICITLY };
 
@@ -383,6 +879,38 @@ TEST_F(LogCacheTest, TestTruncation) {
   }
 }
 
+// Test that evicting around an op which is still in flight to a peer leaves
+// a hole in the cache, and that reads fill the hole back in from the log.
+TEST_F(LogCacheTest, TestEvictionAroundInFlightOp) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+
+  // Hold a reference to op 3, as a peer would while sending it.
+  vector<ReplicateRefPtr> in_flight;
+  ASSERT_OK(cache_->ReadOps(2, 1, ReadContext(), &in_flight).status);
+  ASSERT_EQ(1, in_flight.size());
+  ASSERT_EQ(3, in_flight[0]->get()->id().index());
+
+  cache_->EvictThroughOp(6);
+  ASSERT_EQ(5, cache_->num_cached_ops());
+
+  vector<ReplicateRefPtr> messages;
+  LogCache::ReadOpsStatus s =
+      cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages);
+  ASSERT_OK(s.status);
+  ASSERT_EQ(10, messages.size());
+  for (int i = 0; i < messages.size(); i++) {
+    ASSERT_EQ(i + 1, messages[i]->get()->id().index());
+  }
+
+  // Truncating across the hole drops the remaining cached ops after it.
+  cache_->TruncateOpsAfter(4);
+  ASSERT_EQ(1, cache_->num_cached_ops());
+  ASSERT_FALSE(cache_->HasOpBeenWritten(5));
+  ASSERT_OK(AppendReplicateMessagesToCache(5, 2));
+  ASSERT_EQ(3, cache_->num_cached_ops());
+}
+
 TEST_F(LogCacheTest, TestMTReadAndWrite) {
   atomic<bool> stop{false};
   vector<thread> threads;
@@ -422,5 +950,53 @@ TEST_F(LogCacheTest, TestMTReadAndWrite) {
   SleepFor(MonoDelta::FromSeconds(AllowSlowTests() ? 10 : 2));
 }
 
+// Test that several peers can read cached ops concurrently with appends and
+// eviction, and always see a contiguous run of ops.
+TEST_F(LogCacheTest, TestMTConcurrentReaders) {
+  atomic<bool> stop{false};
+  atomic<int64_t> last_appended{0};
+  vector<thread> threads;
+  SCOPED_CLEANUP({
+    stop = true;
+    for (auto& t : threads) {
+      t.join();
+    }
+  });
+
+  threads.emplace_back([&] {
+    const int kBatch = 10;
+    int64_t index = 1;
+    while (!stop) {
+      CHECK_OK(AppendReplicateMessagesToCache(index, kBatch));
+      index += kBatch;
+      last_appended = index - 1;
+      if (index % 1000 == 1) {
+        log_->WaitUntilAllFlushed();
+        cache_->EvictThroughOp(index - 500);
+      }
+    }
+  });
+  const int kNumReaders = 4;
+  for (int i = 0; i < kNumReaders; i++) {
+    threads.emplace_back([&] {
+      int64_t index = 0;
+      while (!stop) {
+        if (index >= last_appended) {
+          continue;
+        }
+        vector<ReplicateRefPtr> messages;
+        LogCache::ReadOpsStatus s =
+            cache_->ReadOps(index, 64 * 1024, ReadContext(), &messages);
+        CHECK_OK(s.status);
+        for (const ReplicateRefPtr& msg : messages) {
+          CHECK_EQ(++index, msg->get()->id().index());
+        }
+      }
+    });
+  }
+
+  SleepFor(MonoDelta::FromSeconds(AllowSlowTests() ? 10 : 2));
+}
+
 } // namespace consensus
 } // namespace kudu
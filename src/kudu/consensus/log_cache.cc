@@ -17,7 +17,12 @@
 
 #include "kudu/consensus/log_cache.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -27,6 +32,7 @@
 #include <boost/optional/optional.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/consensus/consensus.pb.h"
@@ -38,20 +44,26 @@
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
-#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/mathlimits.h"
 #include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/cache.h"
+#include "kudu/util/coding-inl.h"
+#include "kudu/util/coding.h"
 #include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
 
 DEFINE_int32(
     log_cache_size_limit_mb,
@@ -62,6 +74,13 @@ DEFINE_int32(
     "this limit within an individual tablet, the oldest will be evicted.");
 TAG_FLAG(log_cache_size_limit_mb, advanced);
 
+DEFINE_int32(
+    log_cache_witness_size_limit_mb,
+    4,
+    "Version of 'log_cache_size_limit_mb' for witnesses, which only keep the "
+    "log (see --raft_lightweight_witness).");
+TAG_FLAG(log_cache_witness_size_limit_mb, experimental);
+
 DEFINE_int32(
     global_log_cache_size_limit_mb,
     1024,
@@ -69,14 +88,169 @@ DEFINE_int32(
     "caching log entries across all tablets is kept under this threshold.");
 TAG_FLAG(global_log_cache_size_limit_mb, advanced);
 
+DEFINE_int32(
+    log_cache_readahead_batches,
+    0,
+    "When a peer is catching up from the log sequentially, the number of "
+    "batches to read ahead of it in the background. 0 disables read-ahead.");
+TAG_FLAG(log_cache_readahead_batches, experimental);
+
+DEFINE_int32(
+    log_cache_readahead_threads,
+    2,
+    "Maximum number of threads per tablet used to read ahead of peers which "
+    "are catching up from the log.");
+TAG_FLAG(log_cache_readahead_threads, experimental);
+
+DEFINE_int32(
+    log_cache_readahead_size_limit_mb,
+    32,
+    "The total per-tablet size of ops which may be held in peer read-ahead "
+    "buffers.");
+TAG_FLAG(log_cache_readahead_size_limit_mb, experimental);
+
+DEFINE_int32(
+    log_cache_compression_threads,
+    0,
+    "Maximum number of threads per tablet used to compress ops appended by "
+    "the leader. If positive, the leader appends ops uncompressed and "
+    "compresses them in the background, so that the compression level does "
+    "not add to commit latency. 0 compresses ops inline before appending.");
+TAG_FLAG(log_cache_compression_threads, experimental);
+
+DEFINE_bool(
+    log_cache_keep_uncompressed_ops,
+    false,
+    "Whether the log cache keeps the uncompressed form of a compressed op "
+    "along with it, charging both to the cache, once the op has been "
+    "uncompressed or compressed on this server. Replicas which both apply "
+    "ops and forward them to proxied peers then uncompress and compress each "
+    "op at most once.");
+TAG_FLAG(log_cache_keep_uncompressed_ops, experimental);
+
+DEFINE_int32(
+    log_cache_disk_read_cache_mb,
+    0,
+    "The per-tablet size of the cache of ops recently read from the log on "
+    "behalf of lagging peers, which lets peers catching up over the same range "
+    "share a single read. 0 disables the cache.");
+TAG_FLAG(log_cache_disk_read_cache_mb, experimental);
+
+DEFINE_int32(
+    log_cache_warmup_mb,
+    0,
+    "How much of the log a replica reads back into its disk read cache, in "
+    "the background, when it becomes leader, starting at the lowest index "
+    "known to be replicated to all peers. Lagging peers then catch up from "
+    "memory rather than all reading the log at once. Limited by "
+    "--log_cache_disk_read_cache_mb. 0 disables the warm-up.");
+TAG_FLAG(log_cache_warmup_mb, experimental);
+
+DEFINE_int64(
+    log_cache_spill_capacity_mb,
+    0,
+    "Server-wide capacity of the second log cache tier, which keeps ops "
+    "evicted from the in-memory log cache in compressed form so that lagging "
+    "peers can be served without reading the WAL. 0 disables the tier.");
+TAG_FLAG(log_cache_spill_capacity_mb, experimental);
+
+DEFINE_string(
+    log_cache_spill_cache_type,
+    "DRAM",
+    "Which type of cache backs the second log cache tier: DRAM or NVM. NVM "
+    "requires --nvm_cache_path to point at a persistent memory mount.");
+TAG_FLAG(log_cache_spill_cache_type, experimental);
+
+DEFINE_bool(
+    log_cache_spill_scan_resistant,
+    false,
+    "Whether a DRAM second log cache tier uses segmented LRU eviction, so "
+    "that a peer catching up from far behind, which reads each op once, "
+    "doesn't evict the ops which peers closer to the leader read again.");
+TAG_FLAG(log_cache_spill_scan_resistant, experimental);
+
+DEFINE_string(
+    log_cache_spill_compression_codec,
+    "lz4",
+    "Compression codec used for ops in the second log cache tier.");
+TAG_FLAG(log_cache_spill_compression_codec, experimental);
+
+DEFINE_bool(
+    log_cache_arbiter_enabled,
+    false,
+    "Whether --global_log_cache_size_limit_mb is divided between the log "
+    "caches of all tablets according to how much each needs, rather than "
+    "each cache using up to --log_cache_size_limit_mb until the global limit "
+    "is hit. Caches serving lagging peers, or many peers, get more memory, "
+    "and idle caches are kept small.");
+TAG_FLAG(log_cache_arbiter_enabled, experimental);
+
+DEFINE_int32(
+    log_cache_arbiter_interval_ms,
+    1000,
+    "How often the log cache arbiter rebalances the budgets of the tablets' "
+    "log caches.");
+TAG_FLAG(log_cache_arbiter_interval_ms, experimental);
+
+DEFINE_int32(
+    log_cache_arbiter_min_budget_mb,
+    4,
+    "The smallest budget the log cache arbiter assigns to a tablet's log "
+    "cache, however idle it is.");
+TAG_FLAG(log_cache_arbiter_min_budget_mb, experimental);
+
+DEFINE_double(
+    log_cache_arbiter_lag_weight,
+    4.0,
+    "How much more each byte which had to be read from the log for a lagging "
+    "peer counts, compared to bytes appended or served from memory, when the "
+    "log cache arbiter weighs how much memory each cache needs.");
+TAG_FLAG(log_cache_arbiter_lag_weight, experimental);
+
+DEFINE_bool(
+    log_cache_read_arenas,
+    false,
+    "Whether ops read back from the log for peers are allocated on a "
+    "protobuf arena shared by each read, rather than one by one on the heap. "
+    "The arena is freed in one go once the last of its ops is dropped.");
+TAG_FLAG(log_cache_read_arenas, experimental);
+
+DEFINE_int32(
+    log_cache_read_arena_block_kb,
+    256,
+    "Size of the largest block allocated by the arenas of "
+    "--log_cache_read_arenas.");
+TAG_FLAG(log_cache_read_arena_block_kb, experimental);
+
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
 namespace kudu {
 namespace consensus {
 
+METRIC_DEFINE_histogram(
+    server,
+    log_cache_lock_wait_time,
+    "Log Cache Lock Wait Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent waiting to acquire the log cache lock. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_cache_lock_hold_time,
+    "Log Cache Lock Hold Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the log cache lock was held for. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
 METRIC_DEFINE_gauge_int64(
     server,
     log_cache_num_ops,
@@ -108,14 +282,220 @@ METRIC_DEFINE_counter(
     "Log Cache Payload Size",
     MetricUnit::kBytes,
     "Size of the msg payload that is written to the log");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_readahead_ops_read,
+    "Log Cache Read-Ahead Ops Read",
+    MetricUnit::kOperations,
+    "Number of ops read from the log ahead of peers catching up from disk");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_readahead_ops_served,
+    "Log Cache Read-Ahead Ops Served",
+    MetricUnit::kOperations,
+    "Number of read-ahead ops which were served to the peer they were read "
+    "for");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_disk_read_cache_hits,
+    "Log Cache Disk Read Cache Hits",
+    MetricUnit::kOperations,
+    "Number of ops served from the cache of recent log reads instead of being "
+    "read from the log again");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_warmup_ops_read,
+    "Log Cache Warm-Up Ops Read",
+    MetricUnit::kOperations,
+    "Number of ops read from the log into the cache of recent log reads "
+    "when warming it up");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_spill_ops_written,
+    "Log Cache Spill Ops Written",
+    MetricUnit::kOperations,
+    "Number of ops written to the second log cache tier on eviction");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_spill_hits,
+    "Log Cache Spill Hits",
+    MetricUnit::kOperations,
+    "Number of ops served from the second log cache tier instead of the log");
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_cache_budget,
+    "Log Cache Budget",
+    MetricUnit::kBytes,
+    "Memory budget assigned to the log cache by the server-wide log cache "
+    "arbiter.");
+METRIC_DEFINE_counter(
+    server,
+    log_cache_budget_evicted_bytes,
+    "Log Cache Budget Evicted Bytes",
+    MetricUnit::kBytes,
+    "Bytes of ops evicted from the log cache to stay within the budget "
+    "assigned by the log cache arbiter.");
 
 static const char kParentMemTrackerId[] = "log_cache";
 
+namespace {
+
+// The server-wide second tier of the log cache, shared by all tablets.
+Cache* SpillCache() {
+  static Cache* cache = [] {
+    const CacheType type =
+        FLAGS_log_cache_spill_cache_type == "NVM" ? NVM_CACHE : DRAM_CACHE;
+    return NewCache(
+        type,
+        type == DRAM_CACHE && FLAGS_log_cache_spill_scan_resistant
+            ? SLRU_EVICTION
+            : LRU_EVICTION,
+        FLAGS_log_cache_spill_capacity_mb * 1024L * 1024L,
+        "log_cache_spill");
+  }();
+  return cache;
+}
+
+// Distinguishes the spilled ops of successive LogCache instances for the
+// same tablet.
+std::atomic<int64_t> spill_instance_counter(0);
+
+} // anonymous namespace
+
+// Divides --global_log_cache_size_limit_mb between the log caches of all the
+// tablets on the server. Every cache gets --log_cache_arbiter_min_budget_mb,
+// and the rest is shared out in proportion to each cache's recent demand:
+// bytes appended plus bytes served to peers, with bytes which lagging peers
+// had to read from the log weighted by --log_cache_arbiter_lag_weight. The
+// demand decays by half at each rebalance so that a burst is not remembered
+// forever. No cache is granted more than --log_cache_size_limit_mb, the limit
+// of its MemTracker.
+//
+// Rebalancing is driven by appends rather than by a thread of its own: the
+// first append after --log_cache_arbiter_interval_ms has passed does it.
+class LogCacheArbiter {
+ public:
+  static LogCacheArbiter* Get() {
+    static LogCacheArbiter* arbiter = new LogCacheArbiter();
+    return arbiter;
+  }
+
+  void Register(LogCache* cache) {
+    std::lock_guard<Mutex> l(lock_);
+    rings_.push_back({cache, 0});
+    RebalanceUnlocked();
+  }
+
+  void Unregister(LogCache* cache) {
+    std::lock_guard<Mutex> l(lock_);
+    rings_.erase(
+        std::remove_if(
+            rings_.begin(),
+            rings_.end(),
+            [cache](const Ring& r) { return r.cache == cache; }),
+        rings_.end());
+    RebalanceUnlocked();
+  }
+
+  // Rebalances if the last rebalance was long enough ago. Must not be called
+  // with any LogCache's lock_ held.
+  void MaybeRebalance() {
+    std::unique_lock<Mutex> l(lock_, std::try_to_lock);
+    if (!l.owns_lock()) {
+      // Someone else is rebalancing.
+      return;
+    }
+    const MonoTime now = MonoTime::Now();
+    if (now - last_rebalance_ <
+        MonoDelta::FromMilliseconds(FLAGS_log_cache_arbiter_interval_ms)) {
+      return;
+    }
+    RebalanceUnlocked();
+  }
+
+ private:
+  struct Ring {
+    LogCache* cache;
+    double demand;
+  };
+
+  LogCacheArbiter() = default;
+
+  void RebalanceUnlocked() {
+    last_rebalance_ = MonoTime::Now();
+    if (rings_.empty()) {
+      return;
+    }
+    const int64_t global_limit =
+        FLAGS_global_log_cache_size_limit_mb * 1024L * 1024L;
+    const int64_t per_tablet_limit =
+        FLAGS_log_cache_size_limit_mb * 1024L * 1024L;
+    const int64_t min_budget = std::min(
+        per_tablet_limit, FLAGS_log_cache_arbiter_min_budget_mb * 1024L * 1024L);
+    const int64_t n = static_cast<int64_t>(rings_.size());
+
+    double total_demand = 0;
+    for (Ring& r : rings_) {
+      LogCache* c = r.cache;
+      r.demand = r.demand / 2 + c->appended_bytes_.Exchange(0) +
+          c->cache_read_bytes_.Exchange(0) +
+          FLAGS_log_cache_arbiter_lag_weight * c->disk_read_bytes_.Exchange(0);
+      total_demand += r.demand;
+    }
+
+    vector<int64_t> budgets(rings_.size(), min_budget);
+    int64_t spare = std::max<int64_t>(0, global_limit - n * min_budget);
+    // Share out what's spare in proportion to demand. Caches which hit the
+    // per-tablet limit give back the rest of their share, which is shared
+    // again among the others.
+    for (int pass = 0; pass < 3 && spare > 0; pass++) {
+      double uncapped_demand = 0;
+      int64_t num_uncapped = 0;
+      for (size_t i = 0; i < rings_.size(); i++) {
+        if (budgets[i] < per_tablet_limit) {
+          uncapped_demand += rings_[i].demand;
+          num_uncapped++;
+        }
+      }
+      if (num_uncapped == 0) {
+        break;
+      }
+      int64_t granted = 0;
+      for (size_t i = 0; i < rings_.size(); i++) {
+        if (budgets[i] >= per_tablet_limit) {
+          continue;
+        }
+        int64_t share = uncapped_demand > 0
+            ? static_cast<int64_t>(spare * (rings_[i].demand / uncapped_demand))
+            : spare / num_uncapped;
+        share = std::min(share, per_tablet_limit - budgets[i]);
+        budgets[i] += share;
+        granted += share;
+      }
+      spare -= granted;
+      if (granted == 0) {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < rings_.size(); i++) {
+      rings_[i].cache->ApplyBudget(budgets[i]);
+    }
+  }
+
+  Mutex lock_;
+  vector<Ring> rings_;
+  MonoTime last_rebalance_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogCacheArbiter);
+};
+
 LogCache::LogCache(
     const scoped_refptr<MetricEntity>& metric_entity,
     scoped_refptr<log::Log> log,
     string local_uuid,
-    string tablet_id)
+    string tablet_id,
+    bool witness)
     : log_(std::move(log)),
       local_uuid_(std::move(local_uuid)),
       tablet_id_(std::move(tablet_id)),
@@ -123,9 +503,34 @@ LogCache::LogCache(
       next_sequential_op_index_(0),
       min_pinned_op_index_(0),
       metrics_(metric_entity),
-      enable_compression_on_cache_miss_(false) {
-  const int64_t max_ops_size_bytes =
-      FLAGS_log_cache_size_limit_mb * 1024L * 1024L;
+      resource_account_(metric_entity->registry(), tablet_id_),
+      enable_compression_on_cache_miss_(false),
+      codec_manager_(new CompressionCodecManager()),
+      readahead_generation_(0),
+      disk_read_cond_(&disk_read_lock_),
+      disk_read_cache_bytes_(0),
+      disk_read_generation_(0),
+      spill_enabled_(false),
+      spill_first_index_(-1),
+      spill_last_index_(-1),
+      arbitrated_(false),
+      budget_bytes_(FLAGS_log_cache_size_limit_mb * 1024L * 1024L),
+      appended_bytes_(0),
+      cache_read_bytes_(0),
+      disk_read_bytes_(0),
+      shared_batch_generation_(0) {
+  if (LockProfilingEnabled()) {
+    lock_profile_.reset(new LockProfile(
+        Substitute("T $0 P $1: LogCache::lock_", tablet_id_, local_uuid_),
+        METRIC_log_cache_lock_wait_time.Instantiate(metric_entity),
+        METRIC_log_cache_lock_hold_time.Instantiate(metric_entity)));
+    lock_.set_profile(lock_profile_.get());
+  }
+
+  const int64_t max_ops_size_bytes = 1024L * 1024L *
+      (witness ? FLAGS_log_cache_witness_size_limit_mb
+               : FLAGS_log_cache_size_limit_mb);
+  budget_bytes_.Store(max_ops_size_bytes);
   const int64_t global_max_ops_size_bytes =
       FLAGS_global_log_cache_size_limit_mb * 1024L * 1024L;
 
@@ -144,13 +549,98 @@ LogCache::LogCache(
   // code paths elsewhere.
   auto zero_op = new ReplicateMsg();
   *zero_op->mutable_id() = MinimumOpId();
-  InsertOrDie(
-      &cache_,
-      0,
-      {make_scoped_refptr_replicate(zero_op), zero_op->SpaceUsed()});
+  cache_.Append(
+      0, {make_scoped_refptr_replicate(zero_op), zero_op->SpaceUsed()});
+
+  if (witness) {
+    metrics_.log_cache_budget->set_value(budget_bytes_.Load());
+    return;
+  }
+
+  if (FLAGS_log_cache_readahead_batches > 0) {
+    readahead_tracker_ = MemTracker::CreateTracker(
+        FLAGS_log_cache_readahead_size_limit_mb * 1024L * 1024L,
+        Substitute(
+            "$0:$1:$2:readahead", kParentMemTrackerId, local_uuid, tablet_id),
+        parent_tracker_);
+    CHECK_OK(ThreadPoolBuilder("log-cache-readahead")
+                 .set_min_threads(0)
+                 .set_max_threads(FLAGS_log_cache_readahead_threads)
+                 .Build(&readahead_pool_));
+  }
+
+  if (FLAGS_log_cache_compression_threads > 0) {
+    CHECK_OK(ThreadPoolBuilder("log-cache-compress")
+                 .set_min_threads(0)
+                 .set_max_threads(FLAGS_log_cache_compression_threads)
+                 .Build(&compression_pool_));
+  }
+
+  if (FLAGS_log_cache_disk_read_cache_mb > 0) {
+    disk_read_tracker_ = MemTracker::CreateTracker(
+        FLAGS_log_cache_disk_read_cache_mb * 1024L * 1024L,
+        Substitute(
+            "$0:$1:$2:disk_reads", kParentMemTrackerId, local_uuid, tablet_id),
+        parent_tracker_);
+    if (FLAGS_log_cache_warmup_mb > 0) {
+      CHECK_OK(ThreadPoolBuilder("log-cache-warmup")
+                   .set_min_threads(0)
+                   .set_max_threads(1)
+                   .Build(&warmup_pool_));
+    }
+  }
+
+  if (FLAGS_log_cache_spill_capacity_mb > 0) {
+    Status s = CompressionCodecManager::GetCodec(
+        FLAGS_log_cache_spill_compression_codec, &spill_codec_);
+    if (s.ok()) {
+      spill_enabled_ = true;
+      spill_key_prefix_ = Substitute(
+          "$0:$1:", tablet_id_, spill_instance_counter.fetch_add(1));
+      CHECK_OK(ThreadPoolBuilder("log-cache-spill")
+                   .set_min_threads(0)
+                   .set_max_threads(1)
+                   .Build(&spill_pool_));
+    } else {
+      LOG_WITH_PREFIX_UNLOCKED(WARNING)
+          << "Not enabling the log cache spill tier: " << s.ToString();
+    }
+  }
+
+  metrics_.log_cache_budget->set_value(budget_bytes_.Load());
+  if (FLAGS_log_cache_arbiter_enabled) {
+    arbitrated_ = true;
+    LogCacheArbiter::Get()->Register(this);
+  }
 }
 
 LogCache::~LogCache() {
+  if (arbitrated_) {
+    LogCacheArbiter::Get()->Unregister(this);
+  }
+  if (readahead_pool_) {
+    readahead_pool_->Shutdown();
+    ClearAllReadahead();
+  }
+  if (compression_pool_) {
+    compression_pool_->Shutdown();
+  }
+  if (warmup_pool_) {
+    warmup_pool_->Shutdown();
+  }
+  if (spill_pool_) {
+    spill_pool_->Shutdown();
+    // The spill tier is shared by the whole server, and no other instance
+    // reads this one's keys.
+    if (spill_first_index_ >= 0) {
+      for (int64_t i = spill_first_index_; i <= spill_last_index_; i++) {
+        SpillCache()->Erase(SpillKey(i));
+      }
+    }
+  }
+  if (disk_read_tracker_) {
+    disk_read_tracker_->Release(disk_read_cache_bytes_);
+  }
   tracker_->Release(tracker_->consumption());
   cache_.clear();
 }
@@ -158,8 +648,8 @@ LogCache::~LogCache() {
 void LogCache::Init(const OpId& preceding_op) {
   std::lock_guard<Mutex> l(lock_);
   CHECK_EQ(cache_.size(), 1) << "Cache should have only our special '0' op";
-  next_sequential_op_index_ = preceding_op.index() + 1;
-  min_pinned_op_index_ = next_sequential_op_index_;
+  next_sequential_op_index_.Store(preceding_op.index() + 1);
+  min_pinned_op_index_ = next_sequential_op_index_.Load();
 }
 
 Status LogCache::EnableCompressionOnCacheMiss(bool enable) {
@@ -197,17 +687,40 @@ void LogCache::TruncateOpsAfterUnlocked(int64_t index) {
   int64_t first_to_truncate = index + 1;
   // If the index is not consecutive then it must be lower than or equal
   // to the last index, i.e. we're overwriting.
-  CHECK_LE(first_to_truncate, next_sequential_op_index_);
+  CHECK_LE(first_to_truncate, next_sequential_op_index_.Load());
 
   // Now remove the overwritten operations.
-  for (int64_t i = first_to_truncate; i < next_sequential_op_index_; ++i) {
-    auto it = cache_.find(i);
-    if (it != cache_.end()) {
-      AccountForMessageRemovalUnlocked(it->second);
-      cache_.erase(it);
+  const int64_t old_next_sequential_op_index = next_sequential_op_index_.Load();
+  vector<CacheEntry> removed;
+  {
+    std::lock_guard<percpu_rwlock> cl(cache_lock_);
+    cache_.TruncateFrom(first_to_truncate, &removed);
+    next_sequential_op_index_.Store(index + 1);
+  }
+  for (const CacheEntry& entry : removed) {
+    AccountForMessageRemovalUnlocked(entry);
+  }
+
+  // Prefetched ops past the truncation point are no longer valid.
+  if (readahead_pool_) {
+    ClearAllReadahead();
+  }
+  if (disk_read_tracker_) {
+    TruncateDiskReadCache(first_to_truncate);
+  }
+  {
+    std::lock_guard<simple_spinlock> l(shared_batch_lock_);
+    shared_batch_ = SharedBatch();
+    shared_batch_generation_++;
+  }
+  if (spill_enabled_) {
+    // Lets the truncated ops still being spilled land first.
+    spill_pool_->Wait();
+    for (int64_t i = first_to_truncate; i < old_next_sequential_op_index;
+         i++) {
+      SpillCache()->Erase(SpillKey(i));
     }
   }
-  next_sequential_op_index_ = index + 1;
 }
 
 namespace {
@@ -245,10 +758,12 @@ Status LogCache::AppendOperations(
   std::unique_lock<Mutex> l(lock_);
   // If we're not appending a consecutive op we're likely overwriting and
   // need to replace operations in the cache.
-  if (first_idx_in_batch != next_sequential_op_index_) {
+  if (first_idx_in_batch != next_sequential_op_index_.Load()) {
     TruncateOpsAfterUnlocked(first_idx_in_batch - 1);
   }
 
+  EvictToBudgetUnlocked(mem_required);
+
   // Try to consume the memory. If it can't be consumed, we may need to evict.
   bool borrowed_memory = false;
   if (!tracker_->TryConsume(mem_required)) {
@@ -274,10 +789,13 @@ Status LogCache::AppendOperations(
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
-  for (auto& e : entries_to_insert) {
-    auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
-    next_sequential_op_index_ = index + 1;
+  {
+    std::lock_guard<percpu_rwlock> cl(cache_lock_);
+    for (auto& e : entries_to_insert) {
+      auto index = e.msg->get()->id().index();
+      cache_.Append(index, std::move(e));
+    }
+    next_sequential_op_index_.Store(last_idx_in_batch + 1);
   }
 
   // We drop the lock during the AsyncAppendReplicates call, since it may block
@@ -285,6 +803,11 @@ Status LogCache::AppendOperations(
   // our callback and blocked on this lock.
   l.unlock();
 
+  if (arbitrated_) {
+    appended_bytes_.IncrementBy(mem_required);
+    LogCacheArbiter::Get()->MaybeRebalance();
+  }
+
   metrics_.log_cache_size->IncrementBy(mem_required);
   metrics_.log_cache_msg_size->IncrementBy(mem_required);
   metrics_.log_cache_num_ops->IncrementBy(msgs.size());
@@ -310,6 +833,7 @@ Status LogCache::AppendOperations(
   // Now signal any threads that might be waiting for Ops to be appended to the
   // log
   next_index_cond_.Broadcast();
+  RunAppendWaiters();
   return Status::OK();
 }
 
@@ -326,10 +850,19 @@ Status LogCache::AppendOperations(
   int64_t uncompressed_size = 0;
   vector<CacheEntry> entries_to_insert;
   entries_to_insert.reserve(msg_wrappers.size());
+  // Ops to compress in the background. Their compressed size is accounted
+  // for once they are compressed.
+  vector<ReplicateRefPtr> to_compress;
+  const bool compress_in_background =
+      compression_pool_ && codec_manager_->GetCurrentCodec();
 
   for (const auto& msg_wrapper : msg_wrappers) {
-    auto msg = msg_wrapper.GetUncompressedMsg();
     auto compressed_msg = msg_wrapper.GetCompressedMsg();
+    // Replicas with opaque payloads only have the form the op came in.
+    auto msg = msg_wrapper.GetUncompressedMsg();
+    if (!msg) {
+      msg = compressed_msg;
+    }
 
     CacheEntry e;
     e.msg_size = ApproxMsgSize(msg);
@@ -342,19 +875,32 @@ Status LogCache::AppendOperations(
     if (compressed_msg) {
       e.mem_usage = ApproxMsgSize(compressed_msg);
       e.msg = compressed_msg;
+      if (FLAGS_log_cache_keep_uncompressed_ops &&
+          msg.get() != compressed_msg.get()) {
+        e.uncompressed_msg = msg;
+        e.mem_usage += e.msg_size;
+      }
     } else {
       e.mem_usage = e.msg_size;
       e.msg = msg;
     }
 
-    compressed_size +=
-        static_cast<int64_t>(e.msg->get()->write_payload().payload().size());
+    if (compress_in_background && !compressed_msg &&
+        msg->get()->op_type() == WRITE_OP_EXT) {
+      to_compress.push_back(msg);
+    } else {
+      compressed_size +=
+          static_cast<int64_t>(e.msg->get()->write_payload().payload().size());
+    }
 
-    // Update the crc32 checksum for the payload
-    uint32_t payload_crc32 = crc::Crc32c(
-        e.msg->get()->write_payload().payload().c_str(),
-        e.msg->get()->write_payload().payload().size());
-    e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    // Update the crc32 checksum for the payload, unless it came with one: ops
+    // compressed by ReplicateMsgWrapper and ops from the leader already have
+    // the checksum of their payload.
+    if (!e.msg->get()->write_payload().has_crc32()) {
+      const std::string& payload = e.msg->get()->write_payload().payload();
+      e.msg->get()->mutable_write_payload()->set_crc32(
+          crc::Crc32c(payload.c_str(), payload.size()));
+    }
 
     total_msg_size += e.msg_size;
     mem_required += e.mem_usage;
@@ -369,10 +915,12 @@ Status LogCache::AppendOperations(
   std::unique_lock<Mutex> l(lock_);
   // If we're not appending a consecutive op we're likely overwriting and
   // need to replace operations in the cache.
-  if (first_idx_in_batch != next_sequential_op_index_) {
+  if (first_idx_in_batch != next_sequential_op_index_.Load()) {
     TruncateOpsAfterUnlocked(first_idx_in_batch - 1);
   }
 
+  EvictToBudgetUnlocked(mem_required);
+
   // Try to consume the memory. If it can't be consumed, we may need to evict.
   bool borrowed_memory = false;
   if (!tracker_->TryConsume(mem_required)) {
@@ -398,10 +946,13 @@ Status LogCache::AppendOperations(
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
-  for (auto& e : entries_to_insert) {
-    auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
-    next_sequential_op_index_ = index + 1;
+  {
+    std::lock_guard<percpu_rwlock> cl(cache_lock_);
+    for (auto& e : entries_to_insert) {
+      auto index = e.msg->get()->id().index();
+      cache_.Append(index, std::move(e));
+    }
+    next_sequential_op_index_.Store(last_idx_in_batch + 1);
   }
 
   // We drop the lock during the AsyncAppendReplicates call, since it may block
@@ -409,6 +960,22 @@ Status LogCache::AppendOperations(
   // our callback and blocked on this lock.
   l.unlock();
 
+  // Compression runs concurrently with the append to the local log. Until it
+  // is done, peers are sent the uncompressed ops.
+  if (!to_compress.empty()) {
+    Status s = compression_pool_->SubmitFunc(std::bind(
+        &LogCache::CompressInBackground, this, std::move(to_compress)));
+    if (!s.ok()) {
+      VLOG_WITH_PREFIX_UNLOCKED(1)
+          << "Unable to schedule compression: " << s.ToString();
+    }
+  }
+
+  if (arbitrated_) {
+    appended_bytes_.IncrementBy(mem_required);
+    LogCacheArbiter::Get()->MaybeRebalance();
+  }
+
   metrics_.log_cache_size->IncrementBy(mem_required);
   metrics_.log_cache_msg_size->IncrementBy(total_msg_size);
   metrics_.log_cache_num_ops->IncrementBy(msg_wrappers.size());
@@ -425,7 +992,9 @@ Status LogCache::AppendOperations(
   uncompressed_msgs.reserve(msg_wrappers.size());
 
   for (const auto& msg_wrapper : msg_wrappers) {
-    uncompressed_msgs.push_back(msg_wrapper.GetUncompressedMsg());
+    uncompressed_msgs.push_back(
+        msg_wrapper.GetUncompressedMsg() ? msg_wrapper.GetUncompressedMsg()
+                                         : msg_wrapper.GetCompressedMsg());
   }
 
   log_status = log_->AsyncAppendReplicates(
@@ -447,6 +1016,7 @@ Status LogCache::AppendOperations(
   // Now signal any threads that might be waiting for Ops to be appended to the
   // log
   next_index_cond_.Broadcast();
+  RunAppendWaiters();
   return Status::OK();
 }
 
@@ -476,29 +1046,28 @@ void LogCache::LogCallback(
 }
 
 bool LogCache::HasOpBeenWritten(int64_t index) const {
-  std::lock_guard<Mutex> l(lock_);
-  return index < next_sequential_op_index_;
+  return index < next_sequential_op_index_.Load();
 }
 
 Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   // First check the log cache itself.
   {
-    std::lock_guard<Mutex> l(lock_);
-
     // We sometimes try to look up OpIds that have never been written
     // on the local node. In that case, don't try to read the op from
     // the log reader, since it might actually race against the writing
     // of the op.
-    if (op_index >= next_sequential_op_index_) {
+    int64_t next_sequential_op_index = next_sequential_op_index_.Load();
+    if (op_index >= next_sequential_op_index) {
       return Status::Incomplete(Substitute(
           "Op with index $0 is ahead of the local log "
           "(next sequential op: $1)",
           op_index,
-          next_sequential_op_index_));
+          next_sequential_op_index));
     }
-    auto iter = cache_.find(op_index);
-    if (iter != cache_.end()) {
-      *op_id = iter->second.msg->get()->id();
+    shared_lock<rw_spinlock> l(cache_lock_.get_lock());
+    const CacheEntry* entry = cache_.Find(op_index);
+    if (entry != nullptr) {
+      *op_id = entry->msg->get()->id();
       return Status::OK();
     }
   }
@@ -507,6 +1076,66 @@ Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   return log_->LookupOpId(op_index, op_id);
 }
 
+ReplicateRefPtr LogCache::FindUncompressedMsg(
+    const ReplicateRefPtr& msg) const {
+  shared_lock<rw_spinlock> l(cache_lock_.get_lock());
+  const CacheEntry* entry = cache_.Find(msg->get()->id().index());
+  if (entry == nullptr || entry->msg.get() != msg.get()) {
+    return nullptr;
+  }
+  return entry->uncompressed_msg;
+}
+
+void LogCache::KeepUncompressedMsg(
+    const ReplicateRefPtr& msg,
+    const ReplicateRefPtr& uncompressed) {
+  if (!FLAGS_log_cache_keep_uncompressed_ops ||
+      msg.get() == uncompressed.get()) {
+    return;
+  }
+  const int64_t size = ApproxMsgSize(uncompressed);
+  std::lock_guard<Mutex> l(lock_);
+  CacheEntry* entry = cache_.Find(msg->get()->id().index());
+  if (entry == nullptr || entry->msg.get() != msg.get() ||
+      entry->uncompressed_msg) {
+    return;
+  }
+  {
+    std::lock_guard<percpu_rwlock> cl(cache_lock_);
+    entry->uncompressed_msg = uncompressed;
+    entry->mem_usage += size;
+  }
+  tracker_->Consume(size);
+  metrics_.log_cache_size->IncrementBy(size);
+}
+
+bool LogCache::NotifyWhenAppended(
+    int64_t index,
+    std::function<void()> callback) {
+  std::lock_guard<Mutex> l(lock_);
+  if (index < next_sequential_op_index_.Load()) {
+    return false;
+  }
+  append_waiters_.emplace(index, std::move(callback));
+  return true;
+}
+
+void LogCache::RunAppendWaiters() {
+  vector<std::function<void()>> ready;
+  {
+    std::lock_guard<Mutex> l(lock_);
+    const int64_t next_index = next_sequential_op_index_.Load();
+    auto end = append_waiters_.lower_bound(next_index);
+    for (auto it = append_waiters_.begin(); it != end; ++it) {
+      ready.emplace_back(std::move(it->second));
+    }
+    append_waiters_.erase(append_waiters_.begin(), end);
+  }
+  for (const auto& callback : ready) {
+    callback();
+  }
+}
+
 Status LogCache::BlockingReadOps(
     int64_t after_op_index,
     int max_size_bytes,
@@ -521,21 +1150,21 @@ Status LogCache::BlockingReadOps(
   {
     std::lock_guard<Mutex> l(lock_);
 
-    while ((after_op_index + 1) >= next_sequential_op_index_) {
+    while ((after_op_index + 1) >= next_sequential_op_index_.Load()) {
       (void)next_index_cond_.WaitUntil(deadline);
 
       if (MonoTime::Now() > deadline)
         break;
     }
 
-    if ((after_op_index + 1) >= next_sequential_op_index_) {
+    if ((after_op_index + 1) >= next_sequential_op_index_.Load()) {
       // Waited for max_duration_ms, but 'after_op_index' is still not available
       // in the local log
       return Status::Incomplete(Substitute(
           "Op with index $0 is ahead of the local log "
           "(next sequential op: $1)",
           after_op_index,
-          next_sequential_op_index_));
+          next_sequential_op_index_.Load()));
     }
   }
 
@@ -555,6 +1184,315 @@ Status LogCache::BlockingReadOps(
   return std::move(s.status);
 }
 
+Status LogCache::ReadOpsFromLog(
+    int64_t from,
+    int64_t up_to,
+    int64_t max_bytes,
+    const ReadContext& context,
+    vector<ReplicateRefPtr>* msgs) {
+  if (spill_enabled_ && !context.route_via_proxy &&
+      ReadFromSpill(from, up_to, max_bytes, msgs)) {
+    return Status::OK();
+  }
+
+  // Proxied reads discard the payload, so they are prepared differently and
+  // aren't worth sharing.
+  if (!disk_read_tracker_ || context.route_via_proxy) {
+    return ReadAndPrepareOpsFromLog(from, up_to, max_bytes, context, msgs);
+  }
+
+  int64_t generation;
+  {
+    std::unique_lock<Mutex> l(disk_read_lock_);
+    while (true) {
+      if (TakeFromDiskReadCacheUnlocked(from, up_to, max_bytes, msgs)) {
+        return Status::OK();
+      }
+      if (std::find(
+              disk_reads_in_flight_.begin(),
+              disk_reads_in_flight_.end(),
+              from) == disk_reads_in_flight_.end()) {
+        break;
+      }
+      // Another peer is reading the same ops; wait for it to finish.
+      disk_read_cond_.Wait();
+    }
+    disk_reads_in_flight_.push_back(from);
+    generation = disk_read_generation_;
+  }
+
+  vector<ReplicateRefPtr> read;
+  Status s = ReadAndPrepareOpsFromLog(from, up_to, max_bytes, context, &read);
+
+  {
+    std::lock_guard<Mutex> l(disk_read_lock_);
+    disk_reads_in_flight_.erase(std::find(
+        disk_reads_in_flight_.begin(), disk_reads_in_flight_.end(), from));
+    if (s.ok() && generation == disk_read_generation_) {
+      InsertIntoDiskReadCacheUnlocked(read);
+    }
+  }
+  disk_read_cond_.Broadcast();
+
+  RETURN_NOT_OK(s);
+  msgs->insert(msgs->end(), read.begin(), read.end());
+  return Status::OK();
+}
+
+bool LogCache::TakeFromDiskReadCacheUnlocked(
+    int64_t from,
+    int64_t up_to,
+    int64_t max_bytes,
+    vector<ReplicateRefPtr>* msgs) {
+  int64_t bytes = 0;
+  int64_t taken = 0;
+  for (auto it = disk_read_cache_.find(from);
+       it != disk_read_cache_.end() && it->first == from + taken &&
+       it->first <= up_to;
+       ++it) {
+    bytes += ApproxMsgSize(it->second);
+    if (bytes > max_bytes && taken > 0) {
+      break;
+    }
+    msgs->push_back(it->second);
+    taken++;
+  }
+  metrics_.log_cache_disk_read_cache_hits->IncrementBy(taken);
+  return taken > 0;
+}
+
+void LogCache::InsertIntoDiskReadCacheUnlocked(
+    const vector<ReplicateRefPtr>& msgs) {
+  for (const ReplicateRefPtr& msg : msgs) {
+    int64_t size = ApproxMsgSize(msg);
+    while (!disk_read_tracker_->TryConsume(size)) {
+      if (disk_read_cache_.empty()) {
+        return;
+      }
+      // Lagging peers move forward, so the lowest index is the least useful.
+      auto oldest = disk_read_cache_.begin();
+      int64_t oldest_size = ApproxMsgSize(oldest->second);
+      disk_read_tracker_->Release(oldest_size);
+      disk_read_cache_bytes_ -= oldest_size;
+      disk_read_cache_.erase(oldest);
+    }
+    auto result = disk_read_cache_.emplace(msg->get()->id().index(), msg);
+    if (!result.second) {
+      // Already cached by another read.
+      disk_read_tracker_->Release(size);
+      continue;
+    }
+    disk_read_cache_bytes_ += size;
+  }
+}
+
+void LogCache::TruncateDiskReadCache(int64_t index) {
+  std::lock_guard<Mutex> l(disk_read_lock_);
+  disk_read_generation_++;
+  for (auto it = disk_read_cache_.lower_bound(index);
+       it != disk_read_cache_.end();) {
+    int64_t size = ApproxMsgSize(it->second);
+    disk_read_tracker_->Release(size);
+    disk_read_cache_bytes_ -= size;
+    it = disk_read_cache_.erase(it);
+  }
+}
+
+string LogCache::SpillKey(int64_t index) const {
+  string key = spill_key_prefix_;
+  key.append(reinterpret_cast<const char*>(&index), sizeof(index));
+  return key;
+}
+
+void LogCache::SpillUnlocked(const CacheEntry& entry) {
+  Status s = spill_pool_->SubmitFunc(
+      std::bind(&LogCache::SpillInBackground, this, entry.msg));
+  if (!s.ok()) {
+    VLOG_WITH_PREFIX_UNLOCKED(1)
+        << "Unable to schedule spilling: " << s.ToString();
+  }
+}
+
+void LogCache::SpillInBackground(const ReplicateRefPtr& ref) {
+  const ReplicateMsg* msg = ref->get();
+  spill_serialize_buf_.clear();
+  if (!msg->SerializeToString(&spill_serialize_buf_)) {
+    return;
+  }
+  Slice value(spill_serialize_buf_);
+  if (spill_codec_) {
+    // The value is prefixed with the uncompressed length.
+    spill_compress_buf_.resize(
+        sizeof(uint32_t) +
+        spill_codec_->MaxCompressedLength(spill_serialize_buf_.size()));
+    size_t compressed_len;
+    Status s = spill_codec_->Compress(
+        value, spill_compress_buf_.data() + sizeof(uint32_t), &compressed_len);
+    if (!s.ok()) {
+      VLOG_WITH_PREFIX_UNLOCKED(1)
+          << "Unable to compress op for the spill tier: " << s.ToString();
+      return;
+    }
+    InlineEncodeFixed32(
+        spill_compress_buf_.data(), spill_serialize_buf_.size());
+    value = Slice(
+        spill_compress_buf_.data(), sizeof(uint32_t) + compressed_len);
+  }
+
+  Cache* cache = SpillCache();
+  string key = SpillKey(msg->id().index());
+  Cache::PendingHandle* pending = cache->Allocate(key, value.size());
+  if (pending == nullptr) {
+    return;
+  }
+  memcpy(cache->MutableValue(pending), value.data(), value.size());
+  cache->Release(cache->Insert(pending, nullptr));
+  metrics_.log_cache_spill_ops_written->Increment();
+
+  const int64_t index = msg->id().index();
+  if (spill_first_index_ < 0 || index < spill_first_index_) {
+    spill_first_index_ = index;
+  }
+  spill_last_index_ = std::max(spill_last_index_, index);
+}
+
+bool LogCache::IsSpilledForTests(const string& key) {
+  Cache* cache = SpillCache();
+  Cache::UniqueHandle handle(
+      cache->Lookup(key, Cache::NO_EXPECT_IN_CACHE),
+      Cache::HandleDeleter(cache));
+  return handle != nullptr;
+}
+
+bool LogCache::ReadFromSpill(
+    int64_t from,
+    int64_t up_to,
+    int64_t max_bytes,
+    vector<ReplicateRefPtr>* msgs) {
+  Cache* cache = SpillCache();
+  faststring buf;
+  int64_t bytes = 0;
+  int64_t taken = 0;
+  for (int64_t index = from; index <= up_to; index++) {
+    Cache::UniqueHandle handle(
+        cache->Lookup(SpillKey(index), Cache::EXPECT_IN_CACHE),
+        Cache::HandleDeleter(cache));
+    if (!handle) {
+      break;
+    }
+    Slice value = cache->Value(handle.get());
+    if (spill_codec_) {
+      if (value.size() < sizeof(uint32_t)) {
+        break;
+      }
+      uint32_t uncompressed_len = DecodeFixed32(value.data());
+      buf.resize(uncompressed_len);
+      Slice compressed(
+          value.data() + sizeof(uint32_t), value.size() - sizeof(uint32_t));
+      if (!spill_codec_->Uncompress(compressed, buf.data(), uncompressed_len)
+               .ok()) {
+        break;
+      }
+      value = Slice(buf);
+    }
+    unique_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    if (!msg->ParseFromArray(value.data(), value.size()) ||
+        msg->id().index() != index) {
+      break;
+    }
+    ReplicateRefPtr ref = make_scoped_refptr_replicate(msg.release());
+    bytes += ApproxMsgSize(ref);
+    if (bytes > max_bytes && taken > 0) {
+      break;
+    }
+    msgs->push_back(std::move(ref));
+    taken++;
+  }
+  metrics_.log_cache_spill_hits->IncrementBy(taken);
+  return taken > 0;
+}
+
+Status LogCache::ReadAndPrepareOpsFromLog(
+    int64_t from,
+    int64_t up_to,
+    int64_t max_bytes,
+    const ReadContext& context,
+    vector<ReplicateRefPtr>* msgs) {
+  vector<ReplicateMsg*> raw_replicate_ptrs;
+  std::shared_ptr<google::protobuf::Arena> arena;
+  if (FLAGS_log_cache_read_arenas) {
+    google::protobuf::ArenaOptions options;
+    options.max_block_size = FLAGS_log_cache_read_arena_block_kb * 1024;
+    arena = std::make_shared<google::protobuf::Arena>(options);
+    RETURN_NOT_OK_PREPEND(
+        log_->ReadReplicatesInRangeOnArena(
+            from, up_to, max_bytes, context, arena.get(), &raw_replicate_ptrs),
+        Substitute("Failed to read ops $0..$1", from, up_to));
+  } else {
+    RETURN_NOT_OK_PREPEND(
+        log_->ReadReplicatesInRange(
+            from, up_to, max_bytes, context, &raw_replicate_ptrs),
+        Substitute("Failed to read ops $0..$1", from, up_to));
+  }
+
+  // Compress messages read from the log if:
+  // (1) the feature is enabled through
+  // enable_compression_on_cache_miss_ flag
+  // (2) the request is not for a proxy host (the payload is discarded for
+  // a proxy request and it is wasteful to compress it here)
+  const bool should_compress =
+      enable_compression_on_cache_miss_ && !context.route_via_proxy;
+
+  vector<ReplicateMsgWrapper> msg_wrappers;
+  faststring buffer;
+
+  for (const auto& replicate : raw_replicate_ptrs) {
+    ReplicateMsgWrapper msg_wrapper(
+        arena ? make_scoped_refptr_replicate(replicate, arena)
+              : make_scoped_refptr_replicate(replicate),
+        codec_manager_.get(),
+        should_compress);
+    // An op logged compressed, by a replica with opaque payloads, is sent as
+    // it is, so uncompressing it would be wasted.
+    RETURN_NOT_OK(
+        msg_wrapper.GetCompressedMsg() ? msg_wrapper.InitOpaque()
+                                       : msg_wrapper.Init(&buffer));
+    msg_wrappers.push_back(msg_wrapper);
+  }
+
+  VLOG_WITH_PREFIX_UNLOCKED(2)
+      << "Successfully read " << msg_wrappers.size() << " ops "
+      << "from disk (" << from << ".." << (from + msg_wrappers.size() - 1)
+      << ")";
+
+  if (!context.route_via_proxy) {
+    // Compute crc checksums for the payload that was read from the log
+    // Note that this is done _only_ for non-proxy requests because payload
+    // is discarded for proxy requests
+    for (const auto& msg_wrapper : msg_wrappers) {
+      // We use the compressed msg if available. The compressed msg might
+      // not be avaiblable if compression is disabled or the msg doesn't
+      // support compression e.g. non write op
+      ReplicateMsg* msg = msg_wrapper.GetCompressedMsg()
+          ? msg_wrapper.GetCompressedMsg()->get()
+          : msg_wrapper.GetUncompressedMsg()->get();
+      if (msg->write_payload().has_crc32()) {
+        continue;
+      }
+      const std::string& payload = msg->write_payload().payload();
+      uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
+      msg->mutable_write_payload()->set_crc32(payload_crc32);
+    }
+  }
+
+  for (const auto& msg_wrapper : msg_wrappers) {
+    msgs->push_back(
+        msg_wrapper.GetCompressedMsg() ? msg_wrapper.GetCompressedMsg()
+                                       : msg_wrapper.GetUncompressedMsg());
+  }
+  return Status::OK();
+}
+
 LogCache::ReadOpsStatus LogCache::ReadOps(
     int64_t after_op_index,
     int max_size_bytes,
@@ -586,116 +1524,512 @@ LogCache::ReadOpsStatus LogCache::ReadOps(
     return lookUpStatus;
   }
 
-  std::unique_lock<Mutex> l(lock_);
   int64_t next_index = after_op_index + 1;
 
   // Return as many operations as we can, up to the limit
   int64_t remaining_space = max_size_bytes;
-  while (remaining_space > 0 && next_index < next_sequential_op_index_) {
-    // If the messages the peer needs haven't been loaded into the queue yet,
-    // load them.
-    MessageCache::const_iterator iter = cache_.lower_bound(next_index);
-    if (iter == cache_.end() || iter->first != next_index) {
-      int64_t up_to;
-      if (iter == cache_.end()) {
-        // Read all the way to the current op
-        up_to = next_sequential_op_index_ - 1;
+  // What was served from memory and what had to come from the log, for the
+  // arbiter.
+  int64_t cache_read_bytes = 0;
+  int64_t disk_read_bytes = 0;
+  while (remaining_space > 0 && next_index < next_sequential_op_index_.Load()) {
+    bool cached;
+    int64_t up_to = 0;
+    {
+      // Cached ops are copied out under the shared lock only, so that peers
+      // can read concurrently with each other and with appends.
+      shared_lock<rw_spinlock> l(cache_lock_.get_lock());
+      cached = cache_.Find(next_index) != nullptr;
+      if (cached) {
+        // Pull contiguous messages from the cache until the size limit is
+        // achieved.
+        for (const CacheEntry* entry = cache_.Find(next_index);
+             entry != nullptr;
+             entry = cache_.Find(next_index)) {
+          const ReplicateRefPtr& msg = entry->msg;
+
+          // The full size of the msg is actually returned by SpaceUsedLong()
+          // but that's very expensive, the payload size should be very close
+          // to the full msg size
+          remaining_space -= static_cast<int64_t>(
+              msg->get()->write_payload().payload().size());
+          if (remaining_space < 0 && !messages->empty()) {
+            break;
+          }
+
+          messages->push_back(msg);
+          next_index++;
+          cache_read_bytes += msg->get()->write_payload().payload().size();
+        }
       } else {
-        // Read up to the next entry that's in the cache
-        up_to = iter->first - 1;
+        int64_t next_cached = cache_.NextCachedIndex(next_index);
+        if (next_cached == -1) {
+          // Read all the way to the current op
+          up_to = next_sequential_op_index_.Load() - 1;
+        } else {
+          // Read up to the next entry that's in the cache
+          up_to = next_cached - 1;
+        }
       }
+    }
+    if (cached) {
+      continue;
+    }
 
-      l.unlock();
+    // A peer catching up from the log may already have had ops read on its
+    // behalf.
+    const bool use_readahead =
+        readahead_pool_ && context.for_peer_uuid != nullptr;
+    const int64_t space_before_readahead = remaining_space;
+    if (use_readahead &&
+        TakeFromReadahead(context, &next_index, &remaining_space, messages) >
+            0) {
+      disk_read_bytes += space_before_readahead - remaining_space;
+      continue;
+    }
 
-      vector<ReplicateMsg*> raw_replicate_ptrs;
-      RETURN_NOT_OK_PREPEND(
-          log_->ReadReplicatesInRange(
-              next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
-          Substitute("Failed to read ops $0..$1", next_index, up_to));
-
-      // Compress messages read from the log if:
-      // (1) the feature is enabled through
-      // enable_compression_on_cache_miss_ flag
-      // (2) the request is not for a proxy host (the payload is discarded for
-      // a proxy request and it is wasteful to compress it here)
-      const bool should_compress =
-          enable_compression_on_cache_miss_ && !context.route_via_proxy;
-
-      vector<ReplicateMsgWrapper> msg_wrappers;
-      faststring buffer;
-
-      for (const auto& replicate : raw_replicate_ptrs) {
-        ReplicateMsgWrapper msg_wrapper(
-            make_scoped_refptr_replicate(replicate), should_compress);
-        RETURN_NOT_OK(msg_wrapper.Init(&buffer));
-        msg_wrappers.push_back(msg_wrapper);
+    // If the messages the peer needs haven't been loaded into the queue yet,
+    // load them.
+    const int64_t read_from = next_index;
+    vector<ReplicateRefPtr> msgs;
+    RETURN_NOT_OK(
+        ReadOpsFromLog(next_index, up_to, remaining_space, context, &msgs));
+
+    for (const auto& msg : msgs) {
+      CHECK_EQ(next_index, msg->get()->id().index());
+
+      remaining_space -= ApproxMsgSize(msg);
+      if (remaining_space > 0 || messages->empty()) {
+        messages->push_back(msg);
+        next_index++;
+        disk_read_bytes += ApproxMsgSize(msg);
       }
+    }
+    if (use_readahead && !msgs.empty()) {
+      NoteLogRead(context, read_from, next_index, max_size_bytes);
+    }
+  }
+  if (arbitrated_) {
+    cache_read_bytes_.IncrementBy(cache_read_bytes);
+    disk_read_bytes_.IncrementBy(disk_read_bytes);
+  }
+  return {
+      Status::OK(),
+      std::move(preceding_id),
+      next_index < next_sequential_op_index_.Load(),
+      max_size_bytes - remaining_space,
+      disk_read_bytes};
+}
 
-      VLOG_WITH_PREFIX_UNLOCKED(2)
-          << "Successfully read " << msg_wrappers.size() << " ops "
-          << "from disk (" << next_index << ".."
-          << (next_index + msg_wrappers.size() - 1) << ")";
-
-      if (!context.route_via_proxy) {
-        // Compute crc checksums for the payload that was read from the log
-        // Note that this is done _only_ for non-proxy requests because payload
-        // is discarded for proxy requests
-        for (const auto& msg_wrapper : msg_wrappers) {
-          // We use the compressed msg if available. The compressed msg might
-          // not be avaiblable if compression is disabled or the msg doesn't
-          // support compression e.g. non write op
-          ReplicateMsg* msg = msg_wrapper.GetCompressedMsg()
-              ? msg_wrapper.GetCompressedMsg()->get()
-              : msg_wrapper.GetUncompressedMsg()->get();
-          const std::string& payload = msg->write_payload().payload();
-          uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
-          msg->mutable_write_payload()->set_crc32(payload_crc32);
-        }
+LogCache::ReadOpsStatus LogCache::ReadSharedOps(
+    int64_t after_op_index,
+    int max_size_bytes,
+    const ReadContext& context,
+    SharedOps* ops) {
+  int64_t generation;
+  {
+    std::lock_guard<simple_spinlock> l(shared_batch_lock_);
+    const SharedBatch& batch = shared_batch_;
+    const int64_t next_sequential = next_sequential_op_index_.Load();
+    if (batch.ops && batch.after_op_index == after_op_index &&
+        batch.max_size_bytes == max_size_bytes &&
+        (batch.stopped_early || batch.next_index == next_sequential)) {
+      *ops = batch.ops;
+      if (arbitrated_) {
+        cache_read_bytes_.IncrementBy(batch.bytes_read);
       }
+      return {
+          Status::OK(),
+          batch.preceding_op,
+          batch.next_index < next_sequential,
+          batch.bytes_read,
+          0};
+    }
+    generation = shared_batch_generation_;
+  }
 
-      l.lock();
+  auto msgs = std::make_shared<vector<ReplicateRefPtr>>();
+  ReadOpsStatus s =
+      ReadOps(after_op_index, max_size_bytes, context, msgs.get());
+  if (!s.status.ok()) {
+    return s;
+  }
+  if (s.disk_bytes_read == 0 && !msgs->empty()) {
+    std::lock_guard<simple_spinlock> l(shared_batch_lock_);
+    if (generation == shared_batch_generation_) {
+      SharedBatch& batch = shared_batch_;
+      batch.after_op_index = after_op_index;
+      batch.max_size_bytes = max_size_bytes;
+      batch.preceding_op = s.preceding_op;
+      batch.next_index = msgs->back()->get()->id().index() + 1;
+      batch.stopped_early = s.stopped_early;
+      batch.bytes_read = s.bytes_read;
+      batch.ops = msgs;
+    }
+  }
+  *ops = std::move(msgs);
+  return s;
+}
 
-      for (const auto& msg_wrapper : msg_wrappers) {
-        const auto& msg = msg_wrapper.GetCompressedMsg()
-            ? msg_wrapper.GetCompressedMsg()
-            : msg_wrapper.GetUncompressedMsg();
-        CHECK_EQ(next_index, msg->get()->id().index());
+int64_t LogCache::TakeFromReadahead(
+    const ReadContext& context,
+    int64_t* next_index,
+    int64_t* remaining_space,
+    vector<ReplicateRefPtr>* messages) {
+  std::lock_guard<simple_spinlock> l(readahead_lock_);
+  auto it = readahead_.find(*context.for_peer_uuid);
+  if (it == readahead_.end()) {
+    return 0;
+  }
+  PeerReadahead* state = it->second.get();
+  if (state->route_via_proxy != context.route_via_proxy) {
+    // The ops were prepared for a different route.
+    ClearReadaheadUnlocked(state);
+    state->route_via_proxy = context.route_via_proxy;
+    return 0;
+  }
 
-        remaining_space -= ApproxMsgSize(msg);
-        if (remaining_space > 0 || messages->empty()) {
-          messages->push_back(msg);
-          next_index++;
-        }
+  // Skip anything the peer no longer needs.
+  while (!state->ops.empty() &&
+         state->ops.front()->get()->id().index() < *next_index) {
+    int64_t size = ApproxMsgSize(state->ops.front());
+    readahead_tracker_->Release(size);
+    state->bytes -= size;
+    state->ops.pop_front();
+  }
+  if (state->ops.empty() ||
+      state->ops.front()->get()->id().index() != *next_index) {
+    // The peer jumped elsewhere; start over from wherever it reads next.
+    ClearReadaheadUnlocked(state);
+    return 0;
+  }
+
+  int64_t taken = 0;
+  while (!state->ops.empty() && *remaining_space > 0) {
+    const ReplicateRefPtr& msg = state->ops.front();
+    int64_t size = ApproxMsgSize(msg);
+    *remaining_space -= size;
+    if (*remaining_space <= 0 && !messages->empty()) {
+      break;
+    }
+    messages->push_back(msg);
+    readahead_tracker_->Release(size);
+    state->bytes -= size;
+    state->ops.pop_front();
+    (*next_index)++;
+    taken++;
+  }
+  metrics_.log_cache_readahead_ops_served->IncrementBy(taken);
+
+  // The peer is consuming the read-ahead, so keep it going.
+  ScheduleReadaheadUnlocked(state);
+  return taken;
+}
+
+void LogCache::NoteLogRead(
+    const ReadContext& context,
+    int64_t from,
+    int64_t to,
+    int64_t batch_size_bytes) {
+  std::lock_guard<simple_spinlock> l(readahead_lock_);
+  std::unique_ptr<PeerReadahead>& state = readahead_[*context.for_peer_uuid];
+  if (!state) {
+    state.reset(new PeerReadahead());
+    state->peer_uuid = *context.for_peer_uuid;
+    state->generation = ++readahead_generation_;
+  }
+  if (context.for_peer_host != nullptr) {
+    state->peer_host = *context.for_peer_host;
+  }
+  state->peer_port = context.for_peer_port;
+  state->route_via_proxy = context.route_via_proxy;
+  state->batch_size_bytes = batch_size_bytes;
+
+  bool sequential = state->next_index == from;
+  if (state->in_flight) {
+    // Let the running task carry on from where the peer is now.
+    sequential = true;
+  }
+  ClearReadaheadUnlocked(state.get());
+  state->next_index = to;
+  if (sequential) {
+    ScheduleReadaheadUnlocked(state.get());
+  }
+}
+
+void LogCache::ScheduleReadaheadUnlocked(PeerReadahead* state) {
+  if (state->in_flight || state->batch_size_bytes <= 0) {
+    return;
+  }
+  state->in_flight = true;
+  Status s = readahead_pool_->SubmitFunc(std::bind(
+      &LogCache::DoReadahead, this, state->peer_uuid, state->generation));
+  if (!s.ok()) {
+    state->in_flight = false;
+    VLOG_WITH_PREFIX_UNLOCKED(1)
+        << "Unable to schedule read-ahead: " << s.ToString();
+  }
+}
+
+void LogCache::DoReadahead(const string& peer_uuid, int64_t generation) {
+  int batches_read = 0;
+  while (batches_read < FLAGS_log_cache_readahead_batches) {
+    ReadContext context;
+    string peer_host;
+    int64_t from;
+    int64_t batch_size_bytes;
+    {
+      std::lock_guard<simple_spinlock> l(readahead_lock_);
+      auto it = readahead_.find(peer_uuid);
+      if (it == readahead_.end() || it->second->generation != generation) {
+        break;
       }
-    } else {
-      // Pull contiguous messages from the cache until the size limit is
-      // achieved.
-      for (; iter != cache_.end(); ++iter) {
-        const ReplicateRefPtr& msg = iter->second.msg;
-        int64_t index = msg->get()->id().index();
-        if (index != next_index) {
-          continue;
-        }
+      const PeerReadahead& state = *it->second;
+      peer_host = state.peer_host;
+      context.for_peer_port = state.peer_port;
+      context.route_via_proxy = state.route_via_proxy;
+      // Errors are reported when the peer itself reads the op.
+      context.report_errors = false;
+      from = state.next_index;
+      batch_size_bytes = state.batch_size_bytes;
+    }
+    context.for_peer_uuid = &peer_uuid;
+    context.for_peer_host = &peer_host;
+
+    // Only read ops which are durable in the log and aren't in the cache.
+    int64_t up_to;
+    {
+      std::lock_guard<Mutex> l(lock_);
+      up_to = min_pinned_op_index_ - 1;
+    }
+    {
+      shared_lock<rw_spinlock> l(cache_lock_.get_lock());
+      int64_t next_cached = cache_.NextCachedIndex(from - 1);
+      if (next_cached != -1) {
+        up_to = std::min(up_to, next_cached - 1);
+      }
+    }
+    if (up_to < from) {
+      break;
+    }
 
-        // The full size of the msg is actually returned by SpaceUsedLong() but
-        // that's very expensive, the payload size should be very close to the
-        // full msg size
-        remaining_space -=
-            static_cast<int64_t>(msg->get()->write_payload().payload().size());
-        if (remaining_space < 0 && !messages->empty()) {
-          break;
-        }
+    vector<ReplicateRefPtr> msgs;
+    Status s = ReadOpsFromLog(from, up_to, batch_size_bytes, context, &msgs);
+    if (!s.ok() || msgs.empty()) {
+      VLOG_WITH_PREFIX_UNLOCKED(1)
+          << "Stopping read-ahead for peer " << peer_uuid << " at index "
+          << from << ": " << s.ToString();
+      break;
+    }
+    int64_t bytes = 0;
+    for (const auto& msg : msgs) {
+      bytes += ApproxMsgSize(msg);
+    }
+    if (!readahead_tracker_->TryConsume(bytes)) {
+      // The read-ahead buffers are full; the peer will pick this up itself.
+      break;
+    }
 
-        messages->push_back(msg);
-        next_index++;
+    std::lock_guard<simple_spinlock> l(readahead_lock_);
+    auto it = readahead_.find(peer_uuid);
+    if (it == readahead_.end() || it->second->generation != generation ||
+        it->second->next_index != from) {
+      // The peer moved on while we were reading; start over from there.
+      readahead_tracker_->Release(bytes);
+      batches_read++;
+      continue;
+    }
+    PeerReadahead* state = it->second.get();
+    for (auto& msg : msgs) {
+      state->ops.push_back(std::move(msg));
+    }
+    state->bytes += bytes;
+    state->next_index = from + msgs.size();
+    metrics_.log_cache_readahead_ops_read->IncrementBy(msgs.size());
+    batches_read++;
+  }
+
+  std::lock_guard<simple_spinlock> l(readahead_lock_);
+  auto it = readahead_.find(peer_uuid);
+  if (it != readahead_.end() && it->second->generation == generation) {
+    it->second->in_flight = false;
+  }
+}
+
+void LogCache::WarmUp(int64_t from_index) {
+  if (!warmup_pool_) {
+    return;
+  }
+  Status s = warmup_pool_->SubmitFunc(
+      std::bind(&LogCache::DoWarmUp, this, std::max<int64_t>(from_index, 1)));
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG_WITH_PREFIX_UNLOCKED(WARNING)
+        << "Unable to warm up the log cache: " << s.ToString();
+  }
+}
+
+void LogCache::DoWarmUp(int64_t from_index) {
+  const int64_t kBatchBytes = 1024 * 1024;
+  const int64_t budget_bytes =
+      std::min(FLAGS_log_cache_warmup_mb, FLAGS_log_cache_disk_read_cache_mb) *
+      1024L * 1024L;
+  ReadContext context;
+  context.report_errors = false;
+  int64_t generation;
+  {
+    std::lock_guard<Mutex> l(disk_read_lock_);
+    generation = disk_read_generation_;
+  }
+
+  int64_t from = from_index;
+  int64_t bytes_read = 0;
+  int64_t ops_read = 0;
+  while (bytes_read < budget_bytes) {
+    // Only read ops which are durable in the log and aren't in the cache.
+    int64_t up_to;
+    {
+      std::lock_guard<Mutex> l(lock_);
+      up_to = min_pinned_op_index_ - 1;
+    }
+    {
+      shared_lock<rw_spinlock> l(cache_lock_.get_lock());
+      int64_t next_cached = cache_.NextCachedIndex(from - 1);
+      if (next_cached != -1) {
+        up_to = std::min(up_to, next_cached - 1);
+      }
+    }
+
+    {
+      std::unique_lock<Mutex> l(disk_read_lock_);
+      // Give way to peers reading the log; they need their ops now.
+      while (!disk_reads_in_flight_.empty()) {
+        disk_read_cond_.Wait();
+      }
+      if (generation != disk_read_generation_) {
+        break;
+      }
+      // Skip what the peers have already read.
+      while (disk_read_cache_.count(from) != 0) {
+        from++;
       }
     }
+    if (up_to < from) {
+      break;
+    }
+
+    vector<ReplicateRefPtr> msgs;
+    Status s =
+        ReadAndPrepareOpsFromLog(from, up_to, kBatchBytes, context, &msgs);
+    if (!s.ok() || msgs.empty()) {
+      VLOG_WITH_PREFIX_UNLOCKED(1) << "Stopping log cache warm-up at index "
+                                   << from << ": " << s.ToString();
+      break;
+    }
+    {
+      std::lock_guard<Mutex> l(disk_read_lock_);
+      if (generation != disk_read_generation_) {
+        break;
+      }
+      InsertIntoDiskReadCacheUnlocked(msgs);
+    }
+    for (const auto& msg : msgs) {
+      bytes_read += ApproxMsgSize(msg);
+    }
+    ops_read += msgs.size();
+    metrics_.log_cache_warmup_ops_read->IncrementBy(msgs.size());
+    from += msgs.size();
   }
-  return {
-      Status::OK(),
-      std::move(preceding_id),
-      next_index < next_sequential_op_index_,
-      max_size_bytes - remaining_space};
+  VLOG_WITH_PREFIX_UNLOCKED(1)
+      << "Warmed up the log cache with " << ops_read << " ops ("
+      << HumanReadableNumBytes::ToString(bytes_read) << ") from index "
+      << from_index;
+}
+
+void LogCache::ClearReadaheadUnlocked(PeerReadahead* state) {
+  readahead_tracker_->Release(state->bytes);
+  state->bytes = 0;
+  state->ops.clear();
+}
+
+void LogCache::ClearAllReadahead() {
+  std::lock_guard<simple_spinlock> l(readahead_lock_);
+  // The peers' next reads from the log restart the read-ahead.
+  for (auto& entry : readahead_) {
+    ClearReadaheadUnlocked(entry.second.get());
+  }
+  readahead_.clear();
+}
+
+void LogCache::DropReadahead(const string& peer_uuid) {
+  if (!readahead_pool_) {
+    return;
+  }
+  std::lock_guard<simple_spinlock> l(readahead_lock_);
+  auto it = readahead_.find(peer_uuid);
+  if (it == readahead_.end()) {
+    return;
+  }
+  ClearReadaheadUnlocked(it->second.get());
+  readahead_.erase(it);
+}
+
+void LogCache::DropAllReadahead() {
+  if (readahead_pool_) {
+    ClearAllReadahead();
+  }
+}
+
+void LogCache::CompressInBackground(const vector<ReplicateRefPtr>& msgs) {
+  ScopedRaftResourceAccounting accounting(
+      &resource_account_, RaftActivity::kCompression);
+  faststring buffer;
+  int64_t compressed_size = 0;
+  for (const auto& msg : msgs) {
+    ReplicateMsgWrapper msg_wrapper(msg, codec_manager_.get());
+    Status s = msg_wrapper.Init(&buffer);
+    const ReplicateRefPtr& compressed_msg = msg_wrapper.GetCompressedMsg();
+    if (!s.ok()) {
+      KLOG_EVERY_N_SECS(WARNING, 10)
+          << LogPrefixUnlocked() << "Unable to compress OpId "
+          << msg->get()->id().ShortDebugString() << ": " << s.ToString();
+    }
+    if (!s.ok() || !compressed_msg) {
+      compressed_size += ApproxMsgSize(msg);
+      continue;
+    }
+    // ReplicateMsgWrapper checksummed the compressed payload.
+    DCHECK(compressed_msg->get()->write_payload().has_crc32());
+    const int64_t mem_usage = ApproxMsgSize(compressed_msg);
+
+    std::lock_guard<Mutex> l(lock_);
+    CacheEntry* entry = cache_.Find(msg->get()->id().index());
+    if (!entry || entry->msg.get() != msg.get() ||
+        mem_usage >= entry->mem_usage) {
+      compressed_size += ApproxMsgSize(msg);
+      continue;
+    }
+    // Keeping the uncompressed form too costs memory rather than saving it.
+    const bool keep_uncompressed = FLAGS_log_cache_keep_uncompressed_ops;
+    const int64_t new_mem_usage =
+        keep_uncompressed ? entry->mem_usage + mem_usage : mem_usage;
+    const int64_t bytes_saved = entry->mem_usage - new_mem_usage;
+    {
+      std::lock_guard<percpu_rwlock> cl(cache_lock_);
+      if (keep_uncompressed) {
+        entry->uncompressed_msg = entry->msg;
+      }
+      entry->msg = compressed_msg;
+      entry->mem_usage = new_mem_usage;
+    }
+    if (bytes_saved >= 0) {
+      tracker_->Release(bytes_saved);
+    } else {
+      tracker_->Consume(-bytes_saved);
+    }
+    metrics_.log_cache_size->DecrementBy(bytes_saved);
+    compressed_size += mem_usage;
+  }
+  metrics_.log_cache_compressed_payload_size->IncrementBy(compressed_size);
 }
 
 Status LogCache::Clear() {
@@ -704,17 +2038,19 @@ Status LogCache::Clear() {
   // cannot be cleared. To make sure that they are equal the caller will need to
   // make sure that this method is called when there is no ongoing appends to
   // the log.
-  if (next_sequential_op_index_ != min_pinned_op_index_) {
+  if (next_sequential_op_index_.Load() != min_pinned_op_index_) {
     std::string msg = strings::Substitute(
         "Log cache cannot be cleared because min "
         "pinned op index {} is not equal to next sequential log index {}",
         min_pinned_op_index_,
-        next_sequential_op_index_);
+        next_sequential_op_index_.Load());
     LOG(ERROR) << msg;
     return Status::RuntimeError(msg);
   }
   EvictSomeUnlocked(
-      next_sequential_op_index_, MathLimits<int64_t>::kMax, /*force =*/true);
+      next_sequential_op_index_.Load(),
+      MathLimits<int64_t>::kMax,
+      /*force =*/true);
   // Placeholder opid 0 will not be evicted from the cache
   return cache_.size() == 1 ? Status::OK()
                             : Status::RuntimeError("Log cache clearing failed");
@@ -726,6 +2062,30 @@ void LogCache::EvictThroughOp(int64_t index) {
   EvictSomeUnlocked(index, MathLimits<int64_t>::kMax);
 }
 
+void LogCache::ApplyBudget(int64_t budget) {
+  budget_bytes_.Store(budget);
+  metrics_.log_cache_budget->set_value(budget);
+  if (tracker_->consumption() > budget) {
+    std::lock_guard<Mutex> lock(lock_);
+    EvictToBudgetUnlocked(0);
+  }
+}
+
+void LogCache::EvictToBudgetUnlocked(int64_t mem_required) {
+  if (!arbitrated_) {
+    return;
+  }
+  const int64_t excess =
+      tracker_->consumption() + mem_required - budget_bytes_.Load();
+  if (excess <= 0) {
+    return;
+  }
+  const int64_t before = tracker_->consumption();
+  EvictSomeUnlocked(min_pinned_op_index_, excess);
+  metrics_.log_cache_budget_evicted_bytes->IncrementBy(
+      before - tracker_->consumption());
+}
+
 void LogCache::EvictSomeUnlocked(
     int64_t stop_after_index,
     int64_t bytes_to_evict,
@@ -735,22 +2095,22 @@ void LogCache::EvictSomeUnlocked(
       << HumanReadableNumBytes::ToString(bytes_to_evict)
       << ": before state: " << ToStringUnlocked();
 
+  // Our special '0' op lives outside of the ring and is always kept.
   int64_t bytes_evicted = 0;
-  for (auto iter = cache_.begin(); iter != cache_.end();) {
-    const CacheEntry& entry = (*iter).second;
-    const ReplicateRefPtr& msg = entry.msg;
-    VLOG_WITH_PREFIX_UNLOCKED(2)
-        << "considering for eviction: " << msg->get()->id();
-    int64_t msg_index = msg->get()->id().index();
-    if (msg_index == 0) {
-      // Always keep our special '0' op.
-      ++iter;
-      continue;
-    }
-
+  const int64_t end_index = cache_.end_index();
+  for (int64_t msg_index = cache_.first_index(); msg_index < end_index;
+       msg_index++) {
     if (msg_index > stop_after_index || msg_index >= min_pinned_op_index_) {
       break;
     }
+    const CacheEntry* found = cache_.Find(msg_index);
+    if (found == nullptr) {
+      continue;
+    }
+    const CacheEntry& entry = *found;
+    const ReplicateRefPtr& msg = entry.msg;
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "considering for eviction: " << msg->get()->id();
 
     // If a msg has more than one ref that means it is in flight to some peer.
     // We don't remove it so that memory accounting is accurate. If force is
@@ -759,15 +2119,20 @@ void LogCache::EvictSomeUnlocked(
       VLOG_WITH_PREFIX_UNLOCKED(2)
           << "Evicting cache: cannot remove " << msg->get()->id()
           << " because it is in-use by a peer.";
-      ++iter;
       continue;
     }
 
     VLOG_WITH_PREFIX_UNLOCKED(2)
         << "Evicting cache. Removing: " << msg->get()->id();
+    if (spill_enabled_) {
+      SpillUnlocked(entry);
+    }
     AccountForMessageRemovalUnlocked(entry);
     bytes_evicted += entry.mem_usage;
-    cache_.erase(iter++);
+    {
+      std::lock_guard<percpu_rwlock> cl(cache_lock_);
+      cache_.Erase(msg_index);
+    }
 
     if (bytes_evicted >= bytes_to_evict) {
       break;
@@ -789,6 +2154,17 @@ int64_t LogCache::BytesUsed() const {
   return tracker_->consumption();
 }
 
+int LogCache::LoadPercent() const {
+  int64_t percent = 0;
+  for (const MemTracker* tracker : {tracker_.get(), parent_tracker_.get()}) {
+    if (tracker->has_limit() && tracker->limit() > 0) {
+      percent =
+          std::max(percent, tracker->consumption() * 100 / tracker->limit());
+    }
+  }
+  return std::min<int64_t>(percent, 100);
+}
+
 string LogCache::StatsString() const {
   std::lock_guard<Mutex> lock(lock_);
   return StatsStringUnlocked();
@@ -828,8 +2204,11 @@ void LogCache::DumpToStrings(vector<string>* lines) const {
   int counter = 0;
   lines->push_back(ToStringUnlocked());
   lines->push_back("Messages:");
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  auto dump_entry = [&](const CacheEntry* entry) {
+    if (entry == nullptr) {
+      return;
+    }
+    const ReplicateMsg* msg = entry->msg->get();
     lines->push_back(Substitute(
         "Message[$0] $1.$2 : REPLICATE. Type: $3, Size: $4",
         counter++,
@@ -837,6 +2216,111 @@ void LogCache::DumpToStrings(vector<string>* lines) const {
         msg->id().index(),
         OperationType_Name(msg->op_type()),
         msg->ByteSize()));
+  };
+  dump_entry(cache_.Find(0));
+  for (int64_t index = cache_.first_index(); index < cache_.end_index();
+       index++) {
+    dump_entry(cache_.Find(index));
+  }
+}
+
+LogCache::MessageCache::MessageCache()
+    : first_index_(0), end_index_(0), num_entries_(0) {}
+
+const LogCache::CacheEntry* LogCache::MessageCache::Find(int64_t index) const {
+  if (index == 0) {
+    return zero_entry_.msg ? &zero_entry_ : nullptr;
+  }
+  if (index < first_index_ || index >= end_index_) {
+    return nullptr;
+  }
+  const CacheEntry& slot = Slot(index);
+  return slot.msg ? &slot : nullptr;
+}
+
+int64_t LogCache::MessageCache::NextCachedIndex(int64_t index) const {
+  for (int64_t i = std::max(index + 1, first_index_); i < end_index_; i++) {
+    if (Slot(i).msg) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void LogCache::MessageCache::Append(int64_t index, CacheEntry entry) {
+  DCHECK(entry.msg);
+  if (index == 0) {
+    CHECK(!zero_entry_.msg) << "Special '0' op already cached";
+    zero_entry_ = std::move(entry);
+    num_entries_++;
+    return;
+  }
+  if (first_index_ == end_index_) {
+    first_index_ = end_index_ = index;
+  }
+  CHECK_EQ(index, end_index_) << "Log cache appends must be sequential";
+  Reserve(end_index_ + 1 - first_index_);
+  Slot(index) = std::move(entry);
+  end_index_ = index + 1;
+  num_entries_++;
+}
+
+void LogCache::MessageCache::Erase(int64_t index) {
+  if (index < first_index_ || index >= end_index_) {
+    return;
+  }
+  CacheEntry& slot = Slot(index);
+  if (!slot.msg) {
+    return;
+  }
+  slot = CacheEntry();
+  num_entries_--;
+  if (index == first_index_) {
+    TrimFront();
+  }
+}
+
+void LogCache::MessageCache::TruncateFrom(
+    int64_t index,
+    vector<CacheEntry>* removed) {
+  DCHECK_GT(index, 0);
+  for (int64_t i = std::max(index, first_index_); i < end_index_; i++) {
+    CacheEntry& slot = Slot(i);
+    if (slot.msg) {
+      removed->emplace_back(std::move(slot));
+      slot = CacheEntry();
+      num_entries_--;
+    }
+  }
+  end_index_ = std::max(first_index_, std::min(end_index_, index));
+  TrimFront();
+}
+
+void LogCache::MessageCache::clear() {
+  zero_entry_ = CacheEntry();
+  slots_.clear();
+  first_index_ = end_index_ = 0;
+  num_entries_ = 0;
+}
+
+void LogCache::MessageCache::Reserve(int64_t span) {
+  if (span <= static_cast<int64_t>(slots_.size())) {
+    return;
+  }
+  size_t new_size = std::max<size_t>(slots_.size(), 64);
+  while (static_cast<int64_t>(new_size) < span) {
+    new_size *= 2;
+  }
+  vector<CacheEntry> new_slots(new_size);
+  for (int64_t i = first_index_; i < end_index_; i++) {
+    new_slots[i & (new_size - 1)] = std::move(Slot(i));
+  }
+  slots_.swap(new_slots);
+}
+
+void LogCache::MessageCache::TrimFront() {
+  while (first_index_ < end_index_ && !Slot(first_index_).msg) {
+    first_index_++;
   }
 }
 
@@ -849,6 +2333,21 @@ LogCache::Metrics::Metrics(const scoped_refptr<MetricEntity>& metric_entity)
       metric_entity->FindOrCreateCounter(&METRIC_log_cache_payload_size);
   log_cache_compressed_payload_size = metric_entity->FindOrCreateCounter(
       &METRIC_log_cache_compressed_payload_size);
+  log_cache_readahead_ops_read =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_readahead_ops_read);
+  log_cache_readahead_ops_served = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_readahead_ops_served);
+  log_cache_disk_read_cache_hits = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_disk_read_cache_hits);
+  log_cache_warmup_ops_read =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_warmup_ops_read);
+  log_cache_spill_ops_written =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_spill_ops_written);
+  log_cache_spill_hits =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_spill_hits);
+  log_cache_budget = METRIC_log_cache_budget.Instantiate(metric_entity, 0);
+  log_cache_budget_evicted_bytes = metric_entity->FindOrCreateCounter(
+      &METRIC_log_cache_budget_evicted_bytes);
 }
 #undef INSTANTIATE_METRIC
 
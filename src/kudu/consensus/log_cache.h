@@ -18,20 +18,26 @@
 #define KUDU_CONSENSUS_LOG_CACHE_H
 
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
 #include <gtest/gtest_prod.h>
 
+#include "kudu/consensus/raft_resource_accounting.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/atomic.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
@@ -39,8 +45,12 @@
 
 namespace kudu {
 
+class Cache;
 class CompressionCodec;
+class CompressionCodecManager;
+class LockProfile;
 class MemTracker;
+class ThreadPool;
 
 namespace log {
 class Log;
@@ -51,6 +61,7 @@ namespace consensus {
 class OpId;
 class ReplicateMsg;
 struct ReadContext;
+class LogCacheArbiter;
 class ReplicateMsgWrapper;
 
 // Write-through cache for the log.
@@ -61,11 +72,16 @@ class ReplicateMsgWrapper;
 // entries which are asynchronously fetched from the disk.
 class LogCache {
  public:
+  // The cache of a 'witness', a replica which only keeps the log (see
+  // --raft_lightweight_witness), is limited to
+  // --log_cache_witness_size_limit_mb, isn't arbitrated, and has no
+  // read-ahead, background compression, disk read cache or spill tier.
   LogCache(
       const scoped_refptr<MetricEntity>& metric_entity,
       scoped_refptr<log::Log> log,
       std::string local_uuid,
-      std::string tablet_id);
+      std::string tablet_id,
+      bool witness = false);
   ~LogCache();
 
   // Initialize the cache.
@@ -82,11 +98,17 @@ class LogCache {
   struct ReadOpsStatus {
     /* implicit */ ReadOpsStatus(Status s) : status(std::move(s)) {}
 
-    ReadOpsStatus(Status s, OpId opid, bool stopped, int64_t read)
+    ReadOpsStatus(
+        Status s,
+        OpId opid,
+        bool stopped,
+        int64_t read,
+        int64_t disk_read)
         : status(std::move(s)),
           preceding_op(std::move(opid)),
           stopped_early(stopped),
-          bytes_read(read) {}
+          bytes_read(read),
+          disk_bytes_read(disk_read) {}
 
     /**
      * Status of the read.
@@ -107,6 +129,11 @@ class LogCache {
      * The number of bytes we actually read.
      */
     int64_t bytes_read;
+    /**
+     * How many of those bytes were not in the cache and came from the log,
+     * directly or through readahead.
+     */
+    int64_t disk_bytes_read = 0;
   };
   // Read operations from the log, following 'after_op_index'.
   // If such an op exists in the log, an OK result will always include at least
@@ -129,6 +156,20 @@ class LogCache {
       const ReadContext& context,
       std::vector<ReplicateRefPtr>* messages);
 
+  // A batch of ops which may be held by several readers at once.
+  typedef std::shared_ptr<const std::vector<ReplicateRefPtr>> SharedOps;
+
+  // Like ReadOps(), but the ops come as a batch which is shared with other
+  // callers reading the same range with the same 'max_size_bytes', as peers
+  // in step with each other do. Holding the batch then costs one reference
+  // count instead of one per op. Only batches read entirely from memory are
+  // shared.
+  ReadOpsStatus ReadSharedOps(
+      int64_t after_op_index,
+      int max_size_bytes,
+      const ReadContext& context,
+      SharedOps* ops);
+
   // Similar to ReadOps(...), but blocks for 'max_duration_ms' if
   // 'after_op_index' is not available in the local log.
   //
@@ -166,6 +207,20 @@ class LogCache {
       const std::vector<ReplicateMsgWrapper>& msg_wrappers,
       const StatusCallback& callback);
 
+  // Arranges for 'callback' to run once the op with index 'index' has been
+  // appended, on the appending thread and without locks held, so it should
+  // hand off any real work. Returns false without registering 'callback' if
+  // the op has already been appended.
+  //
+  // A callback whose op never gets appended is dropped with the cache.
+  bool NotifyWhenAppended(int64_t index, std::function<void()> callback);
+
+  // With --log_cache_warmup_mb, reads ops from the log into the disk read
+  // cache in the background, starting at 'from_index' and stopping at the
+  // ops held in memory, so that peers catching up from there don't all miss
+  // at once. Does nothing otherwise.
+  void WarmUp(int64_t from_index);
+
   // Truncate any operations with index > 'index'.
   //
   // Following this, reads of truncated indexes using ReadOps(), LookupOpId(),
@@ -184,12 +239,24 @@ class LogCache {
   // Clear the cache
   Status Clear();
 
+  // Drops the read-ahead state of 'peer_uuid', e.g. because the peer is no
+  // longer tracked.
+  void DropReadahead(const std::string& peer_uuid);
+
+  // Drops the read-ahead state of all peers, e.g. because leadership was
+  // lost.
+  void DropAllReadahead();
+
   // Evict any operations with op index <= 'index'.
   void EvictThroughOp(int64_t index);
 
   // Return the number of bytes of memory currently in use by the cache.
   int64_t BytesUsed() const;
 
+  // Return how close the cache is to its per-tablet or server-wide memory
+  // limit, as a percentage of the closer one.
+  int LoadPercent() const;
+
   int64_t num_cached_ops() const {
     return metrics_.log_cache_num_ops->value();
   }
@@ -214,14 +281,46 @@ class LogCache {
   // error).
   Status LookupOpId(int64_t op_index, OpId* op_id) const;
 
+  // Returns the uncompressed form of the compressed 'msg' if it is cached
+  // along with 'msg', or NULL.
+  ReplicateRefPtr FindUncompressedMsg(const ReplicateRefPtr& msg) const;
+
+  // With --log_cache_keep_uncompressed_ops, caches 'uncompressed', the
+  // uncompressed form of 'msg', along with 'msg' if the latter is still
+  // cached, so that the op isn't uncompressed again. The memory of both forms
+  // is charged to the cache.
+  void KeepUncompressedMsg(
+      const ReplicateRefPtr& msg,
+      const ReplicateRefPtr& uncompressed);
+
   // Enable (or disable) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // The codec, dictionary and compression level of this ring.
+  CompressionCodecManager* codec_manager() const {
+    return codec_manager_.get();
+  }
+
+  // Whether ops appended uncompressed are compressed in the background, in
+  // which case callers should not compress them before appending.
+  bool compresses_in_background() const {
+    return compression_pool_ != nullptr;
+  }
+
  private:
   FRIEND_TEST(LogCacheTest, TestAppendAndGetMessages);
   FRIEND_TEST(LogCacheTest, TestGlobalMemoryLimit);
   FRIEND_TEST(LogCacheTest, TestReplaceMessages);
+  FRIEND_TEST(LogCacheTest, TestSpillTier);
+  FRIEND_TEST(LogCacheTest, TestSpillTierSkipsProxiedReads);
+  FRIEND_TEST(LogCacheTest, TestSpillTierErasedWithCache);
+  FRIEND_TEST(LogCacheTest, TestDiskReadCache);
+  FRIEND_TEST(LogCacheTest, TestWarmUp);
+  FRIEND_TEST(LogCacheTest, TestReadahead);
+  FRIEND_TEST(LogCacheTest, TestBackgroundCompression);
   FRIEND_TEST(LogCacheTest, TestTruncation);
+  FRIEND_TEST(LogCacheTest, TestArbiter);
+  friend class LogCacheArbiter;
   friend class LogCacheTest;
 
   // Uncompresses the payload of 'msg' based on its compression_codec and
@@ -236,8 +335,12 @@ class LogCache {
   // An entry in the cache.
   struct CacheEntry {
     ReplicateRefPtr msg;
-    // The cached value of msg->SpaceUsedLong(). This method is expensive
-    // to compute, so we compute it only once upon insertion.
+    // With --log_cache_keep_uncompressed_ops, the uncompressed form of a
+    // compressed 'msg', once some hop has produced it. NULL otherwise.
+    ReplicateRefPtr uncompressed_msg;
+    // The cached value of msg->SpaceUsedLong(), plus that of
+    // 'uncompressed_msg'. This method is expensive to compute, so we compute
+    // it only once upon insertion.
     int64_t mem_usage;
     // The uncompressed size of the msg. If msg is not compressed, then it is
     // same as mem_usage
@@ -261,6 +364,149 @@ class LogCache {
 
   void TruncateOpsAfterUnlocked(int64_t index);
 
+  // Reads the ops in [from, up_to] from the log, limited to 'max_bytes', and
+  // prepares them to be sent to a peer as described by 'context'.
+  //
+  // If the disk read cache is enabled, ops recently read on behalf of another
+  // peer are returned from it, and concurrent reads starting at the same
+  // index wait for a single read of the log. Fewer ops than requested may be
+  // returned, but at least one on success.
+  Status ReadOpsFromLog(
+      int64_t from,
+      int64_t up_to,
+      int64_t max_bytes,
+      const ReadContext& context,
+      std::vector<ReplicateRefPtr>* msgs);
+
+  // Does the actual work of ReadOpsFromLog(), bypassing the disk read cache.
+  Status ReadAndPrepareOpsFromLog(
+      int64_t from,
+      int64_t up_to,
+      int64_t max_bytes,
+      const ReadContext& context,
+      std::vector<ReplicateRefPtr>* msgs);
+
+  // Appends the contiguous run of ops in the disk read cache starting at
+  // 'from' (and not past 'up_to' or 'max_bytes') to 'msgs'. Returns false if
+  // 'from' isn't cached.
+  bool TakeFromDiskReadCacheUnlocked(
+      int64_t from,
+      int64_t up_to,
+      int64_t max_bytes,
+      std::vector<ReplicateRefPtr>* msgs);
+
+  // Inserts 'msgs' into the disk read cache, evicting the lowest indexes to
+  // stay within its memory limit.
+  void InsertIntoDiskReadCacheUnlocked(
+      const std::vector<ReplicateRefPtr>& msgs);
+
+  // Drops all ops with index >= 'index' from the disk read cache.
+  void TruncateDiskReadCache(int64_t index);
+
+  // Returns the key of op 'index' in the spill tier.
+  std::string SpillKey(int64_t index) const;
+
+  // Hands the (already durable) op in 'entry' to 'spill_pool_' as it is
+  // evicted from memory, so that it is serialized and compressed into the
+  // spill tier without holding lock_.
+  void SpillUnlocked(const CacheEntry& entry);
+
+  // Writes the op in 'ref' to the spill tier. Runs on 'spill_pool_'.
+  void SpillInBackground(const ReplicateRefPtr& ref);
+
+  // Returns whether the spill tier holds an op under 'key'.
+  static bool IsSpilledForTests(const std::string& key);
+
+  // Appends the contiguous run of ops in the spill tier starting at 'from'
+  // (and not past 'up_to' or 'max_bytes') to 'msgs'. Returns false if 'from'
+  // isn't in the spill tier. The ops are parsed as they were appended, so
+  // this doesn't serve proxied reads, which are prepared per read.
+  bool ReadFromSpill(
+      int64_t from,
+      int64_t up_to,
+      int64_t max_bytes,
+      std::vector<ReplicateRefPtr>* msgs);
+
+  // Per-peer read-ahead state, used to stream ops from the log ahead of a
+  // peer which is catching up from disk. Protected by readahead_lock_.
+  struct PeerReadahead {
+    // Copies of the ReadContext fields, for use by the read-ahead task.
+    std::string peer_uuid;
+    std::string peer_host;
+    uint32_t peer_port = 0;
+    bool route_via_proxy = false;
+
+    // Prefetched ops, contiguous and ending just before 'next_index'.
+    std::deque<ReplicateRefPtr> ops;
+    // The memory consumed by 'ops', as charged to readahead_tracker_.
+    int64_t bytes = 0;
+
+    // The index following the last op read from the log for this peer,
+    // either by the peer itself or by the read-ahead.
+    int64_t next_index = -1;
+
+    // The batch size the peer reads with, which the read-ahead matches.
+    int64_t batch_size_bytes = 0;
+
+    // Whether a read-ahead task is scheduled or running for this peer.
+    bool in_flight = false;
+
+    // Identifies this state to its read-ahead tasks, so that they leave alone
+    // a state created for the same peer after this one was dropped.
+    int64_t generation = 0;
+  };
+
+  // Moves prefetched ops starting at '*next_index' into 'messages', within
+  // the '*remaining_space' budget, advancing both. Returns the number of ops
+  // taken. ReadOps() uses this before going to the log itself.
+  int64_t TakeFromReadahead(
+      const ReadContext& context,
+      int64_t* next_index,
+      int64_t* remaining_space,
+      std::vector<ReplicateRefPtr>* messages);
+
+  // Records that the ops in [from, to) were read from the log on behalf of
+  // the peer in 'context'. If that read continued where the previous one for
+  // the same peer left off, the peer is catching up sequentially and
+  // read-ahead is started for it.
+  void NoteLogRead(
+      const ReadContext& context,
+      int64_t from,
+      int64_t to,
+      int64_t batch_size_bytes);
+
+  // Submits DoReadahead() for 'state' unless it is already in flight.
+  void ScheduleReadaheadUnlocked(PeerReadahead* state);
+
+  // Reads up to --log_cache_readahead_batches batches past the end of the
+  // read-ahead buffer of 'peer_uuid', as long as its state is the one of
+  // 'generation'. Runs on readahead_pool_.
+  void DoReadahead(const std::string& peer_uuid, int64_t generation);
+
+  // Drops the prefetched ops of 'state' and releases their memory.
+  void ClearReadaheadUnlocked(PeerReadahead* state);
+
+  // Drops the read-ahead state of all peers, e.g. because some of the
+  // prefetched ops may have been truncated.
+  void ClearAllReadahead();
+
+  // Does the work of WarmUp(). Runs on warmup_pool_, giving way to reads of
+  // the log on behalf of peers.
+  void DoWarmUp(int64_t from_index);
+
+  // Compresses 'msgs' and swaps the compressed forms into the cache, unless
+  // the ops were evicted or replaced in the meantime. Runs on
+  // compression_pool_.
+  void CompressInBackground(const std::vector<ReplicateRefPtr>& msgs);
+
+  // Sets the memory budget assigned by the LogCacheArbiter, evicting ops if
+  // the cache is now over it. Must be called without lock_ held.
+  void ApplyBudget(int64_t budget);
+
+  // If --log_cache_arbiter_enabled, evicts enough ops that 'mem_required'
+  // more bytes fit within the assigned budget.
+  void EvictToBudgetUnlocked(int64_t mem_required);
+
   // Return a string with stats
   std::string StatsStringUnlocked() const;
 
@@ -274,6 +520,9 @@ class LogCache {
       const StatusCallback& user_callback,
       const Status& log_status);
 
+  // Runs the callbacks from NotifyWhenAppended() whose ops have been appended.
+  void RunAppendWaiters();
+
   scoped_refptr<log::Log> const log_;
 
   // The UUID of the local peer.
@@ -282,17 +531,101 @@ class LogCache {
   // The id of the tablet.
   const std::string tablet_id_;
 
+  // Set with --lock_profiling. Declared before 'lock_' to outlive it.
+  std::unique_ptr<LockProfile> lock_profile_;
+
+  // Protects the log cache's state, other than the contents of cache_.
+  // Held by appends, truncation and eviction.
   mutable Mutex lock_;
   ConditionVariable next_index_cond_;
 
-  // An ordered map that serves as the buffer for the cached messages.
-  // Maps from log index -> ReplicateMsg
-  typedef std::map<uint64_t, CacheEntry> MessageCache;
+  // Callbacks from NotifyWhenAppended(), keyed by the index they wait for.
+  // Protected by lock_.
+  std::multimap<int64_t, std::function<void()>> append_waiters_;
+
+  // Protects the contents of cache_. Readers of cached ops (ReadOps(),
+  // LookupOpId()) only take this in shared mode, so that many peers can copy
+  // ops out of the cache concurrently with each other and with appends. Code
+  // which modifies cache_ must hold lock_ and take this in exclusive mode;
+  // code holding lock_ may read cache_ without it.
+  mutable percpu_rwlock cache_lock_;
+
+  // The buffer for the cached messages, addressed by log index.
+  //
+  // Log indexes are dense and sequential, so the entries are kept in a
+  // power-of-two sized ring of slots covering [first_index(), end_index()),
+  // where slot (index & mask) holds op 'index'. A slot is empty if its op was
+  // evicted out of order (e.g. an older op was still in flight to a peer).
+  // The special '0' op lives outside of the ring, since the first appended op
+  // usually has a much higher index. Not thread-safe; see cache_lock_.
+  class MessageCache {
+   public:
+    MessageCache();
+
+    // Returns the entry for 'index', or nullptr if it is not cached.
+    const CacheEntry* Find(int64_t index) const;
+    CacheEntry* Find(int64_t index) {
+      return const_cast<CacheEntry*>(
+          static_cast<const MessageCache*>(this)->Find(index));
+    }
+
+    // Returns the lowest index > 'index' which is cached, or -1 if there is
+    // none.
+    int64_t NextCachedIndex(int64_t index) const;
+
+    // Stores 'entry' for 'index'. 'index' must be 0 or immediately follow the
+    // last index in the ring, unless the ring is empty.
+    void Append(int64_t index, CacheEntry entry);
+
+    // Removes the entry for 'index' if it is cached.
+    void Erase(int64_t index);
+
+    // Removes all entries with index >= 'index', returning the removed
+    // entries in 'removed' so that the caller can account for them.
+    void TruncateFrom(int64_t index, std::vector<CacheEntry>* removed);
+
+    // The lowest and one-past-highest index covered by the ring. Equal if the
+    // ring is empty.
+    int64_t first_index() const {
+      return first_index_;
+    }
+    int64_t end_index() const {
+      return end_index_;
+    }
+
+    // The number of cached entries, including the special '0' op.
+    size_t size() const {
+      return num_entries_;
+    }
+
+    void clear();
+
+   private:
+    CacheEntry& Slot(int64_t index) {
+      return slots_[index & (slots_.size() - 1)];
+    }
+    const CacheEntry& Slot(int64_t index) const {
+      return slots_[index & (slots_.size() - 1)];
+    }
+
+    // Grows 'slots_' so that it can cover at least 'span' indexes.
+    void Reserve(int64_t span);
+
+    // Advances first_index_ past empty slots.
+    void TrimFront();
+
+    CacheEntry zero_entry_;
+    std::vector<CacheEntry> slots_;
+    int64_t first_index_;
+    int64_t end_index_;
+    size_t num_entries_;
+  };
   MessageCache cache_;
 
   // The next log index to append. Each append operation must either
   // start with this log index, or go backward (but never skip forward).
-  int64_t next_sequential_op_index_;
+  // Only modified under lock_, but may be read without it.
+  AtomicInt<int64_t> next_sequential_op_index_;
 
   // Any operation with an index >= min_pinned_op_ may not be
   // evicted from the cache. This is used to prevent ops from being evicted
@@ -332,9 +665,33 @@ class LogCache {
     // Payload size of the compressed msg payload that is sent over the wire
     // If compression is disabled, it is the same as log_cache_payload_size
     scoped_refptr<Counter> log_cache_compressed_payload_size;
+
+    // Number of ops read from the log by the per-peer read-ahead, and the
+    // number of those which were then served to their peer.
+    scoped_refptr<Counter> log_cache_readahead_ops_read;
+    scoped_refptr<Counter> log_cache_readahead_ops_served;
+
+    // Number of ops served from the disk read cache instead of the log.
+    scoped_refptr<Counter> log_cache_disk_read_cache_hits;
+
+    // Number of ops read into the disk read cache by WarmUp().
+    scoped_refptr<Counter> log_cache_warmup_ops_read;
+
+    // Number of ops written to the spill tier, and the number of ops served
+    // from it instead of the log.
+    scoped_refptr<Counter> log_cache_spill_ops_written;
+    scoped_refptr<Counter> log_cache_spill_hits;
+
+    // The memory budget assigned to the cache by the server-wide arbiter,
+    // and the bytes evicted to stay within it.
+    scoped_refptr<AtomicGauge<int64_t>> log_cache_budget;
+    scoped_refptr<Counter> log_cache_budget_evicted_bytes;
   };
   Metrics metrics_;
 
+  // Accounts the background compression to the ring.
+  RaftResourceAccount resource_account_;
+
   // Temporary buffer to use for compression. This is used during append
   // operation to compress and/or uncompress payloads. Note that the same buffer
   // gets reused multiple times - this assumens that AppendOperation is
@@ -344,6 +701,94 @@ class LogCache {
 
   std::atomic<bool> enable_compression_on_cache_miss_;
 
+  const std::unique_ptr<CompressionCodecManager> codec_manager_;
+
+  // Compresses appended ops off the append path. Only created if
+  // --log_cache_compression_threads is positive.
+  std::unique_ptr<ThreadPool> compression_pool_;
+
+  // Read-ahead for peers which are catching up from the log. The pool and
+  // tracker are only created if --log_cache_readahead_batches is positive.
+  // Lock ordering: lock_ and cache_lock_ may not be acquired while holding
+  // readahead_lock_.
+  simple_spinlock readahead_lock_;
+  std::unordered_map<std::string, std::unique_ptr<PeerReadahead>> readahead_;
+  // The generation of the last PeerReadahead created. Read-ahead tasks whose
+  // state was dropped meanwhile discard what they read.
+  int64_t readahead_generation_;
+  std::unique_ptr<ThreadPool> readahead_pool_;
+  std::shared_ptr<MemTracker> readahead_tracker_;
+
+  // A small cache of ops recently read from the log, so that several peers
+  // catching up over the same range share a single read and decode. Only
+  // used for non-proxied reads, and only if --log_cache_disk_read_cache_mb
+  // is positive.
+  Mutex disk_read_lock_;
+  ConditionVariable disk_read_cond_;
+  // Maps from log index -> prepared op. Protected by disk_read_lock_.
+  std::map<int64_t, ReplicateRefPtr> disk_read_cache_;
+  int64_t disk_read_cache_bytes_;
+  // Starting indexes of log reads in progress. Protected by disk_read_lock_.
+  std::vector<int64_t> disk_reads_in_flight_;
+  // Incremented on truncation, so that reads in flight at the time don't
+  // insert truncated ops. Protected by disk_read_lock_.
+  int64_t disk_read_generation_;
+  std::shared_ptr<MemTracker> disk_read_tracker_;
+  // Runs DoWarmUp(). Only created if both --log_cache_warmup_mb and
+  // --log_cache_disk_read_cache_mb are positive.
+  std::unique_ptr<ThreadPool> warmup_pool_;
+
+  // Optional second tier holding evicted ops in serialized, compressed form,
+  // in a server-wide Cache which may be backed by NVM. Keys are made of
+  // 'spill_key_prefix_', unique to this LogCache instance, and the op index.
+  // Only set up if --log_cache_spill_capacity_mb is positive.
+  bool spill_enabled_;
+  std::string spill_key_prefix_;
+  std::shared_ptr<CompressionCodec> spill_codec_;
+  // Runs SpillInBackground() on a single thread.
+  std::unique_ptr<ThreadPool> spill_pool_;
+  // Scratch buffers for spilling, and the lowest and highest indexes spilled
+  // so far, which the destructor erases from the spill tier. Only used by
+  // 'spill_pool_', or once it has been shut down.
+  std::string spill_serialize_buf_;
+  faststring spill_compress_buf_;
+  int64_t spill_first_index_;
+  int64_t spill_last_index_;
+
+  // Whether this cache is registered with the LogCacheArbiter, which sets
+  // 'budget_bytes_' to its share of the server-wide limit. Otherwise the
+  // budget stays at the per-tablet limit.
+  bool arbitrated_;
+  AtomicInt<int64_t> budget_bytes_;
+  // Activity since the arbiter last looked at this cache, which it uses to
+  // gauge how much memory the cache needs: bytes appended, bytes served to
+  // peers from memory, and bytes which had to be read from the log for
+  // lagging peers.
+  AtomicInt<int64_t> appended_bytes_;
+  AtomicInt<int64_t> cache_read_bytes_;
+  AtomicInt<int64_t> disk_read_bytes_;
+
+  // The last batch returned by ReadSharedOps() which was read entirely from
+  // memory, for the next peer asking for the same range.
+  struct SharedBatch {
+    int64_t after_op_index = -1;
+    int max_size_bytes = 0;
+    OpId preceding_op;
+    // The index following the last op in 'ops'.
+    int64_t next_index = 0;
+    // Whether 'ops' stopped short of the last appended op, so that later
+    // appends can't make a fresh read of the range any longer.
+    bool stopped_early = false;
+    int64_t bytes_read = 0;
+    SharedOps ops;
+  };
+  simple_spinlock shared_batch_lock_;
+  // Protected by shared_batch_lock_.
+  SharedBatch shared_batch_;
+  // Incremented on truncation, so that batches read at the time aren't
+  // shared. Protected by shared_batch_lock_.
+  int64_t shared_batch_generation_;
+
   DISALLOW_COPY_AND_ASSIGN(LogCache);
 };
 
@@ -0,0 +1,218 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_exporter.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/human_readable.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/threadpool.h"
+
+using kudu::consensus::OperationType_Name;
+using kudu::consensus::ReplicateMsg;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+// A segment decoded by a pool thread, waiting to be written out.
+struct DecodedSegment {
+  DecodedSegment() : done(1) {}
+
+  CountDownLatch done;
+  Status status;
+  faststring output;
+  int64_t bytes_read = 0;
+  int64_t entries = 0;
+  int64_t ops_exported = 0;
+};
+
+void DecodeSegment(
+    Env* env,
+    const string& path,
+    const WalExportFilter& filter,
+    WalExportFormat format,
+    DecodedSegment* result) {
+  scoped_refptr<ReadableLogSegment> segment;
+  Status s = ReadableLogSegment::Open(env, path, &segment);
+  if (s.IsUninitialized()) {
+    // Preallocated, but never written.
+    result->done.CountDown();
+    return;
+  }
+  if (!s.ok()) {
+    result->status = s.CloneAndPrepend("could not open " + path);
+    result->done.CountDown();
+    return;
+  }
+  // The segment is only read front to back, so it can use readahead.
+  segment->EnableReadahead();
+  LogEntryReader reader(segment.get());
+  string serialized;
+  while (true) {
+    unique_ptr<LogEntryBatchPB> batch;
+    int64_t batch_offset;
+    s = reader.ReadNextBatch(&batch, &batch_offset);
+    if (s.IsEndOfFile()) {
+      break;
+    }
+    if (!s.ok()) {
+      result->status = s.CloneAndPrepend("could not read " + path);
+      break;
+    }
+    for (const LogEntryPB& entry : batch->entry()) {
+      result->entries++;
+      if (entry.type() != REPLICATE || !entry.has_replicate() ||
+          !filter.Matches(entry.replicate())) {
+        continue;
+      }
+      const ReplicateMsg& msg = entry.replicate();
+      result->ops_exported++;
+      if (format == WalExportFormat::PB_DELIMITED) {
+        serialized.clear();
+        CHECK(msg.AppendToString(&serialized));
+        PutVarint32(&result->output, serialized.size());
+        result->output.append(serialized);
+      } else {
+        const string line = Substitute(
+            "$0,$1,$2,$3,$4\n",
+            msg.id().term(),
+            msg.id().index(),
+            msg.timestamp(),
+            OperationType_Name(msg.op_type()),
+            msg.ByteSizeLong());
+        result->output.append(line);
+      }
+    }
+  }
+  result->bytes_read = reader.offset();
+  result->done.CountDown();
+}
+
+} // anonymous namespace
+
+bool WalExportFilter::Matches(const ReplicateMsg& msg) const {
+  const int64_t index = msg.id().index();
+  const int64_t timestamp = msg.timestamp();
+  return (min_index < 0 || index >= min_index) &&
+      (max_index < 0 || index <= max_index) &&
+      (term < 0 || msg.id().term() == term) &&
+      (min_timestamp < 0 || timestamp >= min_timestamp) &&
+      (max_timestamp < 0 || timestamp <= max_timestamp) &&
+      (op_types.empty() || op_types.count(msg.op_type()) > 0);
+}
+
+string WalExportStats::ToString() const {
+  const double secs = elapsed.ToSeconds();
+  return Substitute(
+      "exported $0 of $1 entries from $2 segments, $3 in $4 s ($5/s)",
+      ops_exported,
+      entries,
+      segments,
+      HumanReadableNumBytes::ToString(bytes_read),
+      StringPrintf("%.1f", secs),
+      HumanReadableNumBytes::ToString(
+          secs > 0 ? static_cast<int64_t>(bytes_read / secs) : 0));
+}
+
+Status ExportWalSegments(
+    Env* env,
+    const vector<string>& segment_paths,
+    const WalExportFilter& filter,
+    WalExportFormat format,
+    int num_threads,
+    std::ostream* out,
+    WalExportStats* stats) {
+  const MonoTime start = MonoTime::Now();
+  *stats = WalExportStats();
+  num_threads = std::max(1, num_threads);
+  unique_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("wal-export")
+                    .set_min_threads(0)
+                    .set_max_threads(num_threads)
+                    .Build(&pool));
+
+  if (format == WalExportFormat::CSV) {
+    *out << "term,index,timestamp,op_type,bytes\n";
+  }
+
+  // Segments are decoded ahead of the one being written, up to a window, and
+  // written in order.
+  const int window = 2 * num_threads;
+  const int num_segments = segment_paths.size();
+  vector<unique_ptr<DecodedSegment>> decoded(num_segments);
+  int next_to_submit = 0;
+  Status ret;
+  for (int i = 0; i < num_segments; i++) {
+    for (; next_to_submit < num_segments && next_to_submit < i + window;
+         next_to_submit++) {
+      decoded[next_to_submit].reset(new DecodedSegment());
+      DecodedSegment* result = decoded[next_to_submit].get();
+      const string* path = &segment_paths[next_to_submit];
+      Status s = pool->SubmitFunc([env, path, &filter, format, result]() {
+        DecodeSegment(env, *path, filter, format, result);
+      });
+      if (!s.ok()) {
+        // Fall back to decoding the segment on the calling thread.
+        DecodeSegment(env, *path, filter, format, result);
+      }
+    }
+
+    DecodedSegment* result = decoded[i].get();
+    result->done.Wait();
+    if (!result->status.ok()) {
+      ret = result->status;
+      break;
+    }
+    out->write(
+        reinterpret_cast<const char*>(result->output.data()),
+        result->output.size());
+    stats->segments++;
+    stats->bytes_read += result->bytes_read;
+    stats->entries += result->entries;
+    stats->ops_exported += result->ops_exported;
+    decoded[i].reset();
+  }
+  // Waits for the segments decoded ahead before their results go away.
+  pool->Wait();
+  pool->Shutdown();
+  stats->elapsed = MonoTime::Now() - start;
+  RETURN_NOT_OK(ret);
+  if (!out->good()) {
+    return Status::IOError("could not write the exported ops");
+  }
+  return Status::OK();
+}
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Env;
+
+namespace log {
+
+// Which REPLICATE ops ExportWalSegments() writes. Bounds are inclusive, and
+// -1 leaves them open.
+struct WalExportFilter {
+  int64_t min_index = -1;
+  int64_t max_index = -1;
+  int64_t term = -1;
+  // Raw ReplicateMsg timestamps, as the clock assigned them.
+  int64_t min_timestamp = -1;
+  int64_t max_timestamp = -1;
+  // If empty, ops of any type.
+  std::set<consensus::OperationType> op_types;
+
+  bool Matches(const consensus::ReplicateMsg& msg) const;
+};
+
+enum class WalExportFormat {
+  // Each op as a ReplicateMsg, preceded by its varint32 length.
+  PB_DELIMITED,
+  // A line per op with its term, index, timestamp, type and size, and no
+  // payload, after a header line.
+  CSV,
+};
+
+// What ExportWalSegments() did.
+struct WalExportStats {
+  int64_t segments = 0;
+  int64_t bytes_read = 0;
+  int64_t entries = 0;
+  int64_t ops_exported = 0;
+  MonoDelta elapsed;
+
+  // E.g. "exported 1200 of 350000 entries from 96 segments, 5.9 GB in
+  // 10.2 s (580.4 MB/s)".
+  std::string ToString() const;
+};
+
+// Decodes the WAL segments at 'segment_paths', 'num_threads' at a time, and
+// writes the REPLICATE ops that match 'filter' to 'out' in 'format'. The ops
+// are written in the order of 'segment_paths', and in the order they are in
+// each segment. At most twice 'num_threads' decoded segments are buffered
+// at once.
+//
+// Stops at the first segment that can't be read, after writing the ops of
+// the segments before it.
+Status ExportWalSegments(
+    Env* env,
+    const std::vector<std::string>& segment_paths,
+    const WalExportFilter& filter,
+    WalExportFormat format,
+    int num_threads,
+    std::ostream* out,
+    WalExportStats* stats);
+
+} // namespace log
+} // namespace kudu
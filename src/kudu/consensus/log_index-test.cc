@@ -16,8 +16,11 @@
 // under the License.
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <gtest/gtest.h>
 
 #include "kudu/consensus/log_index.h"
@@ -25,15 +28,22 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+DECLARE_int32(log_index_chunk_precreate_fill_percent);
+
+METRIC_DECLARE_entity(server);
 
 namespace kudu {
 namespace log {
 
 using consensus::MakeOpId;
 using consensus::OpId;
+using std::vector;
 
 class LogIndexTest : public KuduTest {
  public:
@@ -117,6 +127,104 @@ TEST_F(LogIndexTest, TestMultiSegmentWithGC) {
   VerifyNotFound(2500000);
 }
 
+// Test that entries added in bulk, including runs that cross a chunk boundary
+// and gaps between runs, read back the same as entries added one at a time.
+TEST_F(LogIndexTest, TestAddEntries) {
+  vector<LogIndexEntry> entries;
+  for (int64_t index = 999990; index < 1000010; index++) {
+    LogIndexEntry entry;
+    entry.op_id = MakeOpId(2, index);
+    entry.segment_sequence_number = 3;
+    entry.offset_in_segment = index * 10;
+    entries.push_back(entry);
+  }
+  LogIndexEntry gap_entry;
+  gap_entry.op_id = MakeOpId(2, 1000100);
+  gap_entry.segment_sequence_number = 4;
+  gap_entry.offset_in_segment = 42;
+  entries.push_back(gap_entry);
+
+  ASSERT_OK(index_->AddEntries(entries));
+  for (const LogIndexEntry& entry : entries) {
+    VerifyEntry(
+        entry.op_id, entry.segment_sequence_number, entry.offset_in_segment);
+  }
+  VerifyNotFound(1000010);
+}
+
+// Test that once the mmap budget is reached, the least recently accessed
+// chunk is unmapped rather than the oldest one, and that the latest chunk
+// stays mapped.
+TEST_F(LogIndexTest, TestChunkLRU) {
+  const int64_t kEntriesPerChunk = 1024;
+  index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+  index_->SetNumMmapChunks(3);
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_server.Instantiate(&registry, "log-index-test");
+  index_->InitMetrics(entity);
+
+  // Write one entry to each of four chunks. The fourth evicts chunk 0.
+  for (int64_t chunk = 0; chunk < 4; chunk++) {
+    ASSERT_OK(
+        AddEntry(MakeOpId(1, chunk * kEntriesPerChunk + 1), 1, chunk + 1));
+  }
+  ASSERT_EQ(1, index_->chunk_evictions_->value());
+  ASSERT_EQ(3, index_->mmapped_chunks_->value());
+
+  // Chunk 1 is mapped. Touching it makes chunk 2 the LRU victim when chunk 0
+  // is mapped back in for a read, so chunk 1 stays mapped.
+  VerifyEntry(MakeOpId(1, kEntriesPerChunk + 1), 1, 2);
+  ASSERT_EQ(0, index_->mmap_for_reads_->value());
+  VerifyEntry(MakeOpId(1, 1), 1, 1);
+  ASSERT_EQ(1, index_->mmap_for_reads_->value());
+  VerifyEntry(MakeOpId(1, kEntriesPerChunk + 1), 1, 2);
+  ASSERT_EQ(1, index_->mmap_for_reads_->value());
+  VerifyEntry(MakeOpId(1, 2 * kEntriesPerChunk + 1), 1, 3);
+  ASSERT_EQ(2, index_->mmap_for_reads_->value());
+
+  // The latest chunk was never unmapped, and the budget was respected.
+  VerifyEntry(MakeOpId(1, 3 * kEntriesPerChunk + 1), 1, 4);
+  ASSERT_EQ(2, index_->mmap_for_reads_->value());
+  ASSERT_EQ(3, index_->chunk_evictions_->value());
+  ASSERT_EQ(3, index_->mmapped_chunks_->value());
+}
+
+// Test that once appends fill a chunk past the threshold, the next chunk is
+// created in the background, so that the append crossing into it doesn't
+// create it inline.
+TEST_F(LogIndexTest, TestChunkPrecreation) {
+  FLAGS_log_index_chunk_precreate_fill_percent = 50;
+  const int64_t kEntriesPerChunk = 1024;
+  index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity =
+      METRIC_ENTITY_server.Instantiate(&registry, "log-index-test");
+  index_->InitMetrics(entity);
+  std::unique_ptr<ThreadPool> pool;
+  ASSERT_OK(ThreadPoolBuilder("precreate").set_max_threads(1).Build(&pool));
+  index_->SetChunkPrecreationPool(pool.get());
+
+  // Below the threshold, nothing is pre-created.
+  ASSERT_OK(AddEntry(MakeOpId(1, 1), 1, 1));
+  ASSERT_OK(AddEntry(MakeOpId(1, kEntriesPerChunk / 2 - 1), 1, 2));
+  pool->Wait();
+  ASSERT_EQ(1, index_->inline_chunk_creations_->value());
+  ASSERT_EQ(1, index_->mmapped_chunks_->value());
+
+  // Past it, the next chunk is created and mapped once.
+  ASSERT_OK(AddEntry(MakeOpId(1, kEntriesPerChunk / 2), 1, 3));
+  ASSERT_OK(AddEntry(MakeOpId(1, kEntriesPerChunk / 2 + 1), 1, 4));
+  pool->Wait();
+  ASSERT_EQ(2, index_->mmapped_chunks_->value());
+
+  ASSERT_OK(AddEntry(MakeOpId(1, kEntriesPerChunk + 1), 1, 5));
+  ASSERT_EQ(1, index_->inline_chunk_creations_->value());
+  VerifyEntry(MakeOpId(1, kEntriesPerChunk / 2 + 1), 1, 4);
+  VerifyEntry(MakeOpId(1, kEntriesPerChunk + 1), 1, 5);
+  pool->Shutdown();
+}
+
 TEST(LogIndexEntry, Comparison) {
   LogIndexEntry a;
   LogIndexEntry b;
@@ -32,6 +32,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdint>
@@ -52,6 +53,10 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/kernel_stack_watchdog.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/threadpool.h"
 
 using std::string;
 using std::vector;
@@ -61,6 +66,38 @@ DEFINE_bool(
     uncache_unmapped_index,
     false,
     "Whether explicitly uncache log cache index file after the file is closed");
+DEFINE_int64(
+    log_index_mmap_chunk_budget,
+    3,
+    "Maximum number of log index chunks to keep mmapped at once. Chunks are "
+    "unmapped in least-recently-accessed order once the budget is reached. "
+    "Setting this to the number of peers which may lag far behind, plus one, "
+    "keeps them from remapping each other's chunks.");
+TAG_FLAG(log_index_mmap_chunk_budget, advanced);
+
+DEFINE_int32(
+    log_index_mmap_watch_stack_ms,
+    0,
+    "If positive, the kernel and user stacks of a thread which spends longer "
+    "than this many milliseconds mmapping a log index chunk are logged. 0 "
+    "disables the check.");
+TAG_FLAG(log_index_mmap_watch_stack_ms, experimental);
+TAG_FLAG(log_index_mmap_watch_stack_ms, runtime);
+DEFINE_int64(
+    log_index_read_willneed_bytes,
+    1024 * 1024,
+    "When reads of a mmapped log index chunk move forward, the next window of "
+    "this many bytes is madvise()d MADV_WILLNEED so it is paged in ahead of "
+    "the reader. 0 disables the hint.");
+TAG_FLAG(log_index_read_willneed_bytes, advanced);
+DEFINE_int32(
+    log_index_chunk_precreate_fill_percent,
+    0,
+    "Once appends fill a log index chunk past this percentage, the next "
+    "chunk is created and mmapped in the background, so that the append "
+    "which crosses into it doesn't stall doing so. 0 disables pre-creation.");
+TAG_FLAG(log_index_chunk_precreate_fill_percent, experimental);
+TAG_FLAG(log_index_chunk_precreate_fill_percent, runtime);
 METRIC_DEFINE_counter(
     server,
     log_index_chunk_mmap_for_read,
@@ -68,6 +105,34 @@ METRIC_DEFINE_counter(
     kudu::MetricUnit::kUnits,
     "Number of times an index chunk had to be mmapeed "
     "before a read operation.");
+METRIC_DEFINE_counter(
+    server,
+    log_index_chunk_evictions,
+    "Log Index Chunk Evictions",
+    kudu::MetricUnit::kUnits,
+    "Number of times an index chunk was unmapped to make room for mapping "
+    "another one.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_index_mmapped_chunks,
+    "Log Index Mmapped Chunks",
+    kudu::MetricUnit::kUnits,
+    "Number of log index chunks currently mmapped.");
+METRIC_DEFINE_histogram(
+    server,
+    log_index_chunk_mmap_for_read_latency,
+    "Log Index Chunk Mmap For Read Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Time spent mmapping an index chunk before a read operation.",
+    60000000LU,
+    2);
+METRIC_DEFINE_counter(
+    server,
+    log_index_chunk_inline_creations,
+    "Log Index Chunk Inline Creations",
+    kudu::MetricUnit::kUnits,
+    "Number of log index chunks created by the append which first needed "
+    "them, rather than ahead of time in the background.");
 
 namespace kudu {
 namespace log {
@@ -99,30 +164,52 @@ class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
   // Open the chunk file
   Status Open();
 
-  // Memory map the chunk file
+  // Memory map the chunk file. If 'for_read' is true, the mapping is
+  // advised MADV_SEQUENTIAL, since readers of an older chunk are catching up
+  // through it in index order.
   // This is not thread safe with GetEntry() and SetEntry(). The caller should
   // synchronize correctly
-  Status Mmap();
+  Status Mmap(bool for_read = false);
 
   // Unmap the chunk file from memory
   // This is not thread safe with GetEntry() and SetEntry(). The caller should
   // synchronize correctly
   void Munmap();
 
-  // Get an entry from the memory mapped cunk file for a given index
+  // Get an entry from the memory mapped cunk file for a given index. Reads
+  // which move forward into a new window advise the following window
+  // MADV_WILLNEED.
   void GetEntry(int entry_index, PhysicalEntry* ret);
 
   // Set an entry in the memory mapped chunk file for a given index
   void SetEntry(int entry_index, const PhysicalEntry& entry);
 
+  // Set 'num_entries' consecutive entries, starting at 'entry_index', with a
+  // single copy
+  void SetEntries(
+      int entry_index,
+      const PhysicalEntry* entries,
+      int num_entries);
+
   // Is this chunk file memory mapped?
   bool IsMmapped() const;
 
+  // Records an access at logical time 'tick', for LRU eviction.
+  void Touch(uint64_t tick) {
+    last_access_ = tick;
+  }
+  uint64_t last_access() const {
+    return last_access_;
+  }
+
  private:
   const string path_; // path of the underlying chunk file
   int fd_; // file descriptor
   uint8_t* mapping_; // mmapped memory location of the chunk
   int64_t size_; // configured size for the chunk file
+  uint64_t last_access_; // logical time of the last access
+  // Offset up to which the mapping has been advised MADV_WILLNEED
+  int64_t willneed_end_;
 };
 
 namespace {
@@ -136,7 +223,12 @@ Status CheckError(int rc, const char* operation) {
 } // anonymous namespace
 
 LogIndex::IndexChunk::IndexChunk(std::string path, int64_t size)
-    : path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size) {}
+    : path_(std::move(path)),
+      fd_(-1),
+      mapping_(nullptr),
+      size_(size),
+      last_access_(0),
+      willneed_end_(0) {}
 
 LogIndex::IndexChunk::~IndexChunk() {
   Munmap();
@@ -161,7 +253,7 @@ Status LogIndex::IndexChunk::Open() {
   return Status::OK();
 }
 
-Status LogIndex::IndexChunk::Mmap() {
+Status LogIndex::IndexChunk::Mmap(bool for_read) {
   if (fd_ == -1) {
     return Status::IOError("Chunk should be opened before mmapping");
   }
@@ -171,12 +263,20 @@ Status LogIndex::IndexChunk::Mmap() {
     return Status::OK();
   }
 
-  mapping_ = static_cast<uint8_t*>(
-      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0));
-  if (mapping_ == nullptr) {
+  SCOPED_WATCH_STACK(FLAGS_log_index_mmap_watch_stack_ms);
+
+  void* mapping =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapping == MAP_FAILED) {
     int err = errno;
     return Status::IOError("Unable to mmap()", ErrnoToString(err), err);
   }
+  mapping_ = static_cast<uint8_t*>(mapping);
+  willneed_end_ = 0;
+
+  if (for_read && madvise(mapping_, size_, MADV_SEQUENTIAL) != 0) {
+    PLOG(WARNING) << "madvise(MADV_SEQUENTIAL) failed for " << path_;
+  }
 
   return Status::OK();
 }
@@ -194,10 +294,23 @@ void LogIndex::IndexChunk::Munmap() {
 
 void LogIndex::IndexChunk::GetEntry(int entry_index, PhysicalEntry* ret) {
   DCHECK_GE(fd_, 0) << "Must Open() first";
-  memcpy(
-      ret,
-      mapping_ + sizeof(PhysicalEntry) * entry_index,
-      sizeof(PhysicalEntry));
+  const int64_t offset = sizeof(PhysicalEntry) * entry_index;
+  memcpy(ret, mapping_ + offset, sizeof(PhysicalEntry));
+
+  // Once a reader gets into the last advised window, advise the next one.
+  // 'willneed_end_' is always a multiple of the window size, and hence of the
+  // page size, as madvise() requires.
+  const int64_t window = FLAGS_log_index_read_willneed_bytes;
+  if (window > 0 && window % getpagesize() == 0 &&
+      offset + window > willneed_end_ && willneed_end_ < size_) {
+    const int64_t start = std::max(willneed_end_, offset / window * window);
+    const int64_t len = std::min(window, size_ - start);
+    if (madvise(mapping_ + start, len, MADV_WILLNEED) != 0) {
+      PLOG_EVERY_N(WARNING, 100) << "madvise(MADV_WILLNEED) failed for "
+                                 << path_;
+    }
+    willneed_end_ = start + len;
+  }
 }
 
 void LogIndex::IndexChunk::SetEntry(
@@ -210,6 +323,17 @@ void LogIndex::IndexChunk::SetEntry(
       sizeof(PhysicalEntry));
 }
 
+void LogIndex::IndexChunk::SetEntries(
+    int entry_index,
+    const PhysicalEntry* entries,
+    int num_entries) {
+  DCHECK_GE(fd_, 0) << "Must Open() first";
+  memcpy(
+      mapping_ + sizeof(PhysicalEntry) * entry_index,
+      entries,
+      sizeof(PhysicalEntry) * num_entries);
+}
+
 bool LogIndex::IndexChunk::IsMmapped() const {
   return (mapping_ != nullptr);
 }
@@ -219,7 +343,10 @@ bool LogIndex::IndexChunk::IsMmapped() const {
 ////////////////////////////////////////////////////////////
 
 LogIndex::LogIndex(std::string base_dir)
-    : base_dir_(std::move(base_dir)), mmap_for_reads_(nullptr) {}
+    : base_dir_(std::move(base_dir)),
+      kNumChunksToMmap(std::max<int64_t>(FLAGS_log_index_mmap_chunk_budget, 1)),
+      access_clock_(0),
+      mmap_for_reads_(nullptr) {}
 
 LogIndex::~LogIndex() {}
 
@@ -234,9 +361,9 @@ Status LogIndex::OpenAllChunksOnStartup(
   std::vector<std::string> children;
   RETURN_NOT_OK(env->GetChildren(base_dir_, &children));
 
-  // Initialize metric counter
-  mmap_for_reads_ =
-      metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_mmap_for_read);
+  if (metric_entity) {
+    InitMetrics(metric_entity);
+  }
 
   for (const auto& fname : children) {
     if (fname.find("index.") != 0) {
@@ -276,11 +403,31 @@ Status LogIndex::OpenAllChunksOnStartup(
 
     RETURN_NOT_OK(rit->second->Mmap());
     mmapped_chunks++;
+    if (mmapped_chunks_) {
+      mmapped_chunks_->Increment();
+    }
   }
 
   return Status::OK();
 }
 
+void LogIndex::InitMetrics(const scoped_refptr<MetricEntity>& metric_entity) {
+  mmap_for_reads_ =
+      metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_mmap_for_read);
+  chunk_evictions_ =
+      metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_evictions);
+  mmapped_chunks_ = METRIC_log_index_mmapped_chunks.Instantiate(
+      metric_entity, 0);
+  mmap_for_read_latency_ =
+      METRIC_log_index_chunk_mmap_for_read_latency.Instantiate(metric_entity);
+  inline_chunk_creations_ = metric_entity->FindOrCreateCounter(
+      &METRIC_log_index_chunk_inline_creations);
+}
+
+void LogIndex::SetChunkPrecreationPool(ThreadPool* pool) {
+  precreate_pool_ = pool;
+}
+
 void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
   if (num_chunks <= 0)
     return;
@@ -308,6 +455,9 @@ void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
     if (it->second->IsMmapped()) {
       it->second->Munmap();
       num_chunks_mmapped--;
+      if (mmapped_chunks_) {
+        mmapped_chunks_->Decrement();
+      }
     }
   }
 }
@@ -318,39 +468,55 @@ void LogIndex::SetNumEntriesPerChunkForTest(int64_t entries) {
   kEntriesPerIndexChunk = entries;
 }
 
-Status LogIndex::MmapChunk(scoped_refptr<IndexChunk>* chunk) {
-  if (open_chunks_.size() < kNumChunksToMmap) {
-    RETURN_NOT_OK((*chunk)->Mmap());
-    return Status::OK();
-  }
-
-  // The victim that needs to be unmapped is the oldest chunk (i.e the chunk
-  // with the oldest chunk_idx). See documentation in log_index.h for more
-  // details.
+Status LogIndex::MmapChunk(scoped_refptr<IndexChunk>* chunk, bool for_read) {
+  // Pick the least recently accessed mmapped chunk as the victim, skipping the
+  // latest chunk, the one appends go to, which differs once the next chunk
+  // has been pre-created, and any chunk with references beyond the one held
+  // by 'open_chunks_'. See documentation in log_index.h for more details.
   //
-  // Note that we have to reverse iterate through the open_chunks_ while the
-  // caller is holding onto the open_chunks_lock_. With 'open_chunks_' map
-  // having only a few hundred entries, this should be acceptable (to keep
-  // things simple)
+  // Note that we iterate through the open_chunks_ while the caller is holding
+  // onto the open_chunks_lock_. With 'open_chunks_' map having only a few
+  // hundred entries, this should be acceptable (to keep things simple)
   int64_t num_chunks_mmapped = 0;
-  auto rit = open_chunks_.rbegin();
-  for (; rit != open_chunks_.rend(); ++rit) {
-    if (rit->second->IsMmapped()) {
-      num_chunks_mmapped++;
+  IndexChunk* victim = nullptr;
+  const IndexChunk* latest =
+      open_chunks_.empty() ? nullptr : open_chunks_.rbegin()->second.get();
+  for (const auto& e : open_chunks_) {
+    IndexChunk* c = e.second.get();
+    if (!c->IsMmapped()) {
+      continue;
+    }
+    num_chunks_mmapped++;
+    if (c == latest || e.first == append_chunk_idx_ || !c->HasOneRef()) {
+      continue;
+    }
+    if (victim == nullptr || c->last_access() < victim->last_access()) {
+      victim = c;
     }
-
-    if (num_chunks_mmapped == kNumChunksToMmap)
-      break;
   }
 
   // If there are 'kNumChunksToMmap' chunks already mmapped, then unmap the
   // 'victim' chunk
-  if (num_chunks_mmapped == kNumChunksToMmap && rit != open_chunks_.rend()) {
-    rit->second->Munmap();
+  if (num_chunks_mmapped >= kNumChunksToMmap && victim != nullptr) {
+    victim->Munmap();
+    if (chunk_evictions_) {
+      chunk_evictions_->Increment();
+    }
+    if (mmapped_chunks_) {
+      mmapped_chunks_->Decrement();
+    }
   }
 
   // Now mmap the provided 'chunk'
-  RETURN_NOT_OK((*chunk)->Mmap());
+  MonoTime start = MonoTime::Now();
+  RETURN_NOT_OK((*chunk)->Mmap(for_read));
+  if (for_read && mmap_for_read_latency_) {
+    mmap_for_read_latency_->Increment(
+        (MonoTime::Now() - start).ToMicroseconds());
+  }
+  if (mmapped_chunks_) {
+    mmapped_chunks_->Increment();
+  }
 
   return Status::OK();
 }
@@ -383,9 +549,10 @@ Status LogIndex::OpenAndInsertChunk(
   }
 
   InsertOrDie(&open_chunks_, chunk_idx, *chunk);
+  (*chunk)->Touch(++access_clock_);
 
   if (should_mmap) {
-    RETURN_NOT_OK(MmapChunk(chunk));
+    RETURN_NOT_OK(MmapChunk(chunk, /*for_read=*/false));
   }
 
   return Status::OK();
@@ -409,14 +576,80 @@ Status LogIndex::GetChunkForIndex(
     return Status::NotFound("chunk not found");
   }
 
+  if (inline_chunk_creations_) {
+    inline_chunk_creations_->Increment();
+  }
   return OpenAndInsertChunk(chunk_idx, chunk, /*should_mmap=*/true);
 }
 
+void LogIndex::MaybePrecreateNextChunk(
+    int64_t chunk_idx,
+    int64_t index_in_chunk) {
+  const int32_t percent = FLAGS_log_index_chunk_precreate_fill_percent;
+  if (precreate_pool_ == nullptr || percent <= 0 ||
+      index_in_chunk * 100 < kEntriesPerIndexChunk * percent) {
+    return;
+  }
+  int64_t precreated = precreated_chunk_idx_.load(std::memory_order_relaxed);
+  if (precreated > chunk_idx ||
+      !precreated_chunk_idx_.compare_exchange_strong(
+          precreated, chunk_idx + 1, std::memory_order_relaxed)) {
+    return;
+  }
+  scoped_refptr<LogIndex> self(this);
+  Status s = precreate_pool_->SubmitFunc(
+      [self, chunk_idx]() { self->PrecreateChunk(chunk_idx + 1); });
+  if (PREDICT_FALSE(!s.ok())) {
+    // The append which needs the chunk creates it instead.
+    LOG(WARNING) << "Unable to submit pre-creation of log index chunk "
+                 << chunk_idx + 1 << ": " << s.ToString();
+  }
+}
+
+void LogIndex::PrecreateChunk(int64_t chunk_idx) {
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    if (ContainsKey(open_chunks_, chunk_idx)) {
+      return;
+    }
+  }
+  // Created and mapped before taking 'open_chunks_lock_', which appends
+  // need.
+  scoped_refptr<IndexChunk> chunk;
+  Status s = OpenChunk(chunk_idx, &chunk);
+  if (s.ok()) {
+    s = chunk->Mmap();
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG(WARNING) << "Unable to pre-create log index chunk " << chunk_idx
+                 << ": " << s.ToString();
+    return;
+  }
+
+  std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+  if (ContainsKey(open_chunks_, chunk_idx)) {
+    // An append got there first.
+    return;
+  }
+  // Accounts for the mapping, evicting another chunk if the budget requires
+  // it, before the chunk becomes the latest.
+  s = MmapChunk(&chunk, /*for_read=*/false);
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG(WARNING) << "Unable to pre-create log index chunk " << chunk_idx
+                 << ": " << s.ToString();
+    return;
+  }
+  InsertOrDie(&open_chunks_, chunk_idx, chunk);
+  chunk->Touch(++access_clock_);
+  VLOG(2) << "Pre-created log index chunk " << GetChunkPath(chunk_idx);
+}
+
 Status LogIndex::AddEntry(const LogIndexEntry& entry) {
   scoped_refptr<IndexChunk> chunk;
   RETURN_NOT_OK(GetChunkForIndex(
       entry.op_id.index(), true /* create if not found */, &chunk));
 
+  const int64_t chunk_idx = entry.op_id.index() / kEntriesPerIndexChunk;
   int index_in_chunk = entry.op_id.index() % kEntriesPerIndexChunk;
   DCHECK_LT(index_in_chunk, kEntriesPerIndexChunk);
 
@@ -429,13 +662,64 @@ Status LogIndex::AddEntry(const LogIndexEntry& entry) {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
     // unmapped
     std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    chunk->Touch(++access_clock_);
+    append_chunk_idx_ = chunk_idx;
     if (PREDICT_FALSE(!chunk->IsMmapped())) {
-      RETURN_NOT_OK(MmapChunk(&chunk));
+      RETURN_NOT_OK(MmapChunk(&chunk, /*for_read=*/false));
     }
     chunk->SetEntry(index_in_chunk, phys);
     VLOG(3) << "Added log index entry " << entry.ToString();
   }
 
+  MaybePrecreateNextChunk(chunk_idx, index_in_chunk);
+  return Status::OK();
+}
+
+Status LogIndex::AddEntries(const vector<LogIndexEntry>& entries) {
+  vector<PhysicalEntry> run;
+  size_t i = 0;
+  while (i < entries.size()) {
+    // Collect the run of consecutive indexes starting at 'i' which lands in
+    // the same chunk.
+    const int64_t first_index = entries[i].op_id.index();
+    const int64_t chunk_idx = first_index / kEntriesPerIndexChunk;
+    run.clear();
+    size_t j = i;
+    for (; j < entries.size(); j++) {
+      const LogIndexEntry& entry = entries[j];
+      int64_t index = entry.op_id.index();
+      if (index != first_index + static_cast<int64_t>(j - i) ||
+          index / kEntriesPerIndexChunk != chunk_idx) {
+        break;
+      }
+      PhysicalEntry phys;
+      phys.term = entry.op_id.term();
+      phys.segment_sequence_number = entry.segment_sequence_number;
+      phys.offset_in_segment = entry.offset_in_segment;
+      run.push_back(phys);
+    }
+
+    scoped_refptr<IndexChunk> chunk;
+    RETURN_NOT_OK(
+        GetChunkForIndex(first_index, true /* create if not found */, &chunk));
+    int index_in_chunk = first_index % kEntriesPerIndexChunk;
+    DCHECK_LE(index_in_chunk + run.size(), kEntriesPerIndexChunk);
+    {
+      // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
+      // unmapped
+      std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+      chunk->Touch(++access_clock_);
+      append_chunk_idx_ = chunk_idx;
+      if (PREDICT_FALSE(!chunk->IsMmapped())) {
+        RETURN_NOT_OK(MmapChunk(&chunk, /*for_read=*/false));
+      }
+      chunk->SetEntries(index_in_chunk, run.data(), run.size());
+    }
+    MaybePrecreateNextChunk(chunk_idx, index_in_chunk + run.size() - 1);
+    VLOG(3) << "Added " << run.size() << " log index entries starting at "
+            << entries[i].ToString();
+    i = j;
+  }
   return Status::OK();
 }
 
@@ -450,8 +734,9 @@ Status LogIndex::GetEntry(int64_t index, LogIndexEntry* entry) {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
     // unmapped
     std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    chunk->Touch(++access_clock_);
     if (PREDICT_FALSE(!chunk->IsMmapped())) {
-      RETURN_NOT_OK(MmapChunk(&chunk));
+      RETURN_NOT_OK(MmapChunk(&chunk, /*for_read=*/true));
 
       if (mmap_for_reads_) {
         mmap_for_reads_->Increment();
@@ -499,7 +784,13 @@ void LogIndex::GC(int64_t min_index_to_retain) {
     VLOG(2) << "Deleted log index segment " << path;
     {
       std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-      open_chunks_.erase(chunk_idx);
+      auto it = open_chunks_.find(chunk_idx);
+      if (it != open_chunks_.end()) {
+        if (it->second->IsMmapped() && mmapped_chunks_) {
+          mmapped_chunks_->Decrement();
+        }
+        open_chunks_.erase(it);
+      }
     }
   }
 }
@@ -17,9 +17,13 @@
 #ifndef KUDU_CONSENSUS_LOG_INDEX_H
 #define KUDU_CONSENSUS_LOG_INDEX_H
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
+
+#include <gtest/gtest_prod.h>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
@@ -30,6 +34,7 @@
 
 namespace kudu {
 class Env;
+class ThreadPool;
 namespace log {
 
 // An entry in the index.
@@ -70,6 +75,11 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Record an index entry in the index.
   Status AddEntry(const LogIndexEntry& entry);
 
+  // Record several index entries in the index. Runs of entries with
+  // consecutive indexes are written to their chunk with a single copy, so
+  // this is much cheaper than calling AddEntry() for each of them.
+  Status AddEntries(const std::vector<LogIndexEntry>& entries);
+
   // Retrieve an existing entry from the index.
   // Returns NotFound() if the given log entry was never written.
   Status GetEntry(int64_t index, LogIndexEntry* entry);
@@ -79,7 +89,8 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // _may_ choose to retain earlier entries.
   void GC(int64_t min_index_to_retain);
 
-  // Number of chunks to mmap. The default value is 3.
+  // Number of chunks to mmap. The default value is
+  // --log_index_mmap_chunk_budget.
   void SetNumMmapChunks(int64_t num_chunks);
 
   // Only to be used in tests. It is dangerous to change number of entries per
@@ -90,13 +101,25 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
 
   // Opens all chunks files found in the file system and inserts the chunk into
   // 'open_chunks_' map. Also mmaps 'kNumChunksToMmap' latest chunks. Also
-  // initializes the metric counter ''mmap_for_reads_'
+  // initializes the metric counter ''mmap_for_reads_', unless 'metric_entity'
+  // is NULL.
   Status OpenAllChunksOnStartup(
       Env* env,
       const scoped_refptr<MetricEntity>& metric_entity);
 
+  // Instantiates the index's metrics in 'metric_entity'.
+  void InitMetrics(const scoped_refptr<MetricEntity>& metric_entity);
+
+  // Lets the index create and mmap the next chunk on 'pool' once appends
+  // fill the current one past --log_index_chunk_precreate_fill_percent, so
+  // that appends don't have to when they cross into it. 'pool' must outlive
+  // the appends to the index.
+  void SetChunkPrecreationPool(ThreadPool* pool);
+
  private:
   friend class RefCountedThreadSafe<LogIndex>;
+  FRIEND_TEST(LogIndexTest, TestChunkLRU);
+  FRIEND_TEST(LogIndexTest, TestChunkPrecreation);
 
   ~LogIndex();
 
@@ -116,20 +139,18 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
 
   // mmaps the file corresponding to chunk. The caller should hold
   // 'open_chunks_lock_' and 'chunk' should have already been opened and
-  // inserted into 'open_chunks_' map.
+  // inserted into 'open_chunks_' map. 'for_read' is true if the chunk is
+  // mapped to serve a read, rather than an append.
   //
   // At any given time, the instance can only mmap a max of 'kChunksToMmap'
   // chunks. Hence, this method might have to 'evict' and unmap a chunk before
-  // it can mmap the provided 'chunk'. The victim is chosen to be the oldest
-  // chunk that is mmapped (i.e the chunk that has the lowest chunk_idx). The
-  // rationale is that writes only append an entry to the latest chunk and hence
-  // it should always be mmapped. A side effect of such an eviction policy is
-  // that the most lagging peer is always the victim which will delay that peer
-  // from catching up sooner. One way to void this is to configure
-  // 'kChunksToMMap' to be equal to the number of peers in the ring and each
-  // peer have its own slot for 'mmapping' an index chunk (but this strategy is
-  // not implemented yet). Check 'kChunksToMmap' for more details
-  Status MmapChunk(scoped_refptr<IndexChunk>* chunk);
+  // it can mmap the provided 'chunk'. The victim is the least recently
+  // accessed mmapped chunk, except that the latest chunk (which all appends
+  // go to) is never evicted, and neither is any chunk which another thread
+  // holds a reference to because it is about to access it. If every mapped
+  // chunk is in use, the budget is exceeded until one is released, rather
+  // than making the threads thrash each other's mappings.
+  Status MmapChunk(scoped_refptr<IndexChunk>* chunk, bool for_read);
 
   // Return the index chunk which contains the given log index.
   // If 'create' is true, creates it on-demand. If 'create' is false, and
@@ -143,6 +164,15 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Return the path of the given index chunk.
   std::string GetChunkPath(int64_t chunk_idx);
 
+  // Called after an append to entry 'index_in_chunk' of chunk 'chunk_idx'.
+  // Submits the pre-creation of the next chunk once the chunk is filled past
+  // the threshold, if that hasn't been done yet.
+  void MaybePrecreateNextChunk(int64_t chunk_idx, int64_t index_in_chunk);
+
+  // Creates and mmaps the chunk with the given index, unless it's already
+  // open. Runs on 'precreate_pool_'.
+  void PrecreateChunk(int64_t chunk_idx);
+
   // The base directory where index files are located.
   const std::string base_dir_;
 
@@ -154,7 +184,8 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   typedef std::map<int64_t, scoped_refptr<IndexChunk>> ChunkMap;
   ChunkMap open_chunks_;
 
-  // Number of index chunks to mmap for faster access. The default value is 3.
+  // Number of index chunks to mmap for faster access. The default value is
+  // --log_index_mmap_chunk_budget (3).
   //
   // The latest index chunks (ones with the highest chunk_idx) is always
   // mmapped. This is required for better write performance. A write
@@ -168,28 +199,47 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // operation. The victim chunk that gets unmapped is the oldest index chunk
   // (so that writes are not effected)
   //
-  // It might so happen that a set of lagging peers will thrash each other. For
-  // example, follower1 is trying to catchup OpId(1, 1), follower2 is trying to
-  // cathcup OpId(1, 1000001) and follower3 is trying to catchup (1, 2000001).
-  // In this case, each follower will thrash and end up mapping/unmapping chunks
-  // rapidly to read from the replication log. This is a very unlikely scenario
-  // (since there should be peers lagging across OpIds that are multiple million
-  // trxs away from each other).
+  // Lagging peers reading far-apart chunks share the budget in LRU order, so
+  // a peer which is actively catching up keeps its chunk mapped while an idle
+  // one loses it. Raising the budget to one chunk per lagging peer plus one
+  // for appends removes the remaining remapping.
   //
   // On followers, learners and any other nodes in the ring that are not
   // expected to serve read requests, this could be configured to value of 1 or
   // 2 (the premise being that writes only 'append' to the latest chunk)
-  int64_t kNumChunksToMmap = 3;
+  int64_t kNumChunksToMmap;
 
   // Number of entries per index chunk.
   // WARNING: this is made 'configurable' only for tests. This should never be
   // modified once a ring is created
   int64_t kEntriesPerIndexChunk = 1000000;
 
+  // Logical clock used to order chunk accesses for LRU eviction.
+  // Protected by open_chunks_lock_.
+  uint64_t access_clock_;
+
+  // The chunk the last append went to, which is never evicted, or -1.
+  // Protected by open_chunks_lock_.
+  int64_t append_chunk_idx_ = -1;
+
+  // Where the next chunk is pre-created, if set, and the highest chunk
+  // whose pre-creation has been submitted.
+  ThreadPool* precreate_pool_ = nullptr;
+  std::atomic<int64_t> precreated_chunk_idx_{-1};
+
   // Counter tracking number of times an index chunk had to be mmapped
   // dynamically for a read operation
   scoped_refptr<Counter> mmap_for_reads_;
 
+  // Number of chunks unmapped to make room for another one, the number of
+  // chunks currently mapped, and the time spent mapping chunks for reads.
+  scoped_refptr<Counter> chunk_evictions_;
+  scoped_refptr<AtomicGauge<int64_t>> mmapped_chunks_;
+  scoped_refptr<Histogram> mmap_for_read_latency_;
+
+  // Number of chunks an append had to create itself.
+  scoped_refptr<Counter> inline_chunk_creations_;
+
   DISALLOW_COPY_AND_ASSIGN(LogIndex);
 };
 
@@ -71,6 +71,136 @@ METRIC_DEFINE_histogram(
     1024,
     2);
 
+METRIC_DEFINE_histogram(
+    server,
+    log_group_queue_wait,
+    "Log Group Queue Wait",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the oldest entry batch of a group waited in the append "
+    "queue before the group was handled",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_group_serialize_latency,
+    "Log Group Serialization Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent serializing the entry batches of a group into the "
+    "segment's write buffer",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_group_callback_latency,
+    "Log Group Callback Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent running the callbacks of a group once it was synced",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_fsync_budget_used,
+    "Log Fsync Budget Used",
+    kudu::MetricUnit::kUnits,
+    "Percentage of wall-clock time the log spent in fsync over the most "
+    "recent measurement interval. Values approaching 100 mean the log is "
+    "bound by its device's sync throughput.");
+
+METRIC_DEFINE_histogram(
+    server,
+    log_group_commit_window,
+    "Log Group Commit Window",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the adaptive group commit window allowed a group to wait "
+    "for more entries before being synced",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_counter(
+    server,
+    log_groups_closed_no_wait,
+    "Log Groups Closed Without Waiting",
+    kudu::MetricUnit::kRequests,
+    "Number of group commit groups closed immediately because the adaptive "
+    "window was empty, i.e. the arrival rate was too low to make waiting "
+    "worthwhile");
+
+METRIC_DEFINE_counter(
+    server,
+    log_groups_closed_window_expired,
+    "Log Groups Closed On Window Expiry",
+    kudu::MetricUnit::kRequests,
+    "Number of group commit groups closed because the adaptive group commit "
+    "window expired");
+
+METRIC_DEFINE_counter(
+    server,
+    log_groups_closed_size_limit,
+    "Log Groups Closed On Size Limit",
+    kudu::MetricUnit::kRequests,
+    "Number of group commit groups closed because they reached "
+    "--group_commit_queue_size_bytes while waiting for more entries");
+
+METRIC_DEFINE_counter(
+    server,
+    log_segment_recycle_pool_hits,
+    "Log Segment Recycle Pool Hits",
+    kudu::MetricUnit::kUnits,
+    "Number of new log segments that reused a recycled segment file");
+
+METRIC_DEFINE_counter(
+    server,
+    log_segment_recycle_pool_misses,
+    "Log Segment Recycle Pool Misses",
+    kudu::MetricUnit::kUnits,
+    "Number of new log segments that had to create a new file because no "
+    "recycled segment file was available");
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    log_segment_pending_deletion_bytes,
+    "Log Segment Pending Deletion Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes of garbage-collected log segments waiting to be deleted in the "
+    "background, with --log_background_segment_deletion");
+
+METRIC_DEFINE_counter(
+    server,
+    log_segments_archived,
+    "Log Segments Archived",
+    kudu::MetricUnit::kUnits,
+    "Number of closed log segments moved to --fs_wal_archive_dir once they "
+    "were only retained for lagging peers");
+METRIC_DEFINE_counter(
+    server,
+    log_archived_bytes,
+    "Log Archived Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes of closed log segments moved to --fs_wal_archive_dir");
+
+METRIC_DEFINE_histogram(
+    server,
+    log_allocation_lock_wait_time,
+    "Log Allocation Lock Wait Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent waiting to acquire the log segment allocation lock. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    log_allocation_lock_hold_time,
+    "Log Allocation Lock Hold Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the log segment allocation lock was held for. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
 namespace kudu {
 namespace log {
 
@@ -81,7 +211,25 @@ LogMetrics::LogMetrics(const scoped_refptr<MetricEntity>& metric_entity)
       MINIT(append_latency),
       MINIT(group_commit_latency),
       MINIT(roll_latency),
-      MINIT(entry_batches_per_group) {}
+      MINIT(entry_batches_per_group),
+      MINIT(group_queue_wait),
+      MINIT(group_serialize_latency),
+      MINIT(group_callback_latency),
+      fsync_budget_used(
+          METRIC_log_fsync_budget_used.Instantiate(metric_entity, 0)),
+      MINIT(group_commit_window),
+      MINIT(groups_closed_no_wait),
+      MINIT(groups_closed_window_expired),
+      MINIT(groups_closed_size_limit),
+      MINIT(segment_recycle_pool_hits),
+      MINIT(segment_recycle_pool_misses),
+      segment_pending_deletion_bytes(
+          METRIC_log_segment_pending_deletion_bytes.Instantiate(
+              metric_entity, 0)),
+      MINIT(segments_archived),
+      MINIT(archived_bytes),
+      MINIT(allocation_lock_wait_time),
+      MINIT(allocation_lock_hold_time) {}
 #undef MINIT
 
 } // namespace log
@@ -35,6 +35,40 @@ struct LogMetrics {
   scoped_refptr<Histogram> group_commit_latency;
   scoped_refptr<Histogram> roll_latency;
   scoped_refptr<Histogram> entry_batches_per_group;
+
+  // Per-stage breakdown of a group's trip through the append path, one
+  // sample per group. append_latency and sync_latency above cover the write
+  // and sync stages.
+  scoped_refptr<Histogram> group_queue_wait;
+  scoped_refptr<Histogram> group_serialize_latency;
+  scoped_refptr<Histogram> group_callback_latency;
+
+  // Share of recent wall-clock time spent in fsync, in percent.
+  scoped_refptr<AtomicGauge<int64_t>> fsync_budget_used;
+
+  // Adaptive group commit stats: the window each group waited for, and why
+  // each group was closed.
+  scoped_refptr<Histogram> group_commit_window;
+  scoped_refptr<Counter> groups_closed_no_wait;
+  scoped_refptr<Counter> groups_closed_window_expired;
+  scoped_refptr<Counter> groups_closed_size_limit;
+
+  // Segment recycling stats: new segments that reused a recycled file, and
+  // those that had to create one.
+  scoped_refptr<Counter> segment_recycle_pool_hits;
+  scoped_refptr<Counter> segment_recycle_pool_misses;
+
+  // Bytes of garbage-collected segments waiting for background deletion.
+  scoped_refptr<AtomicGauge<int64_t>> segment_pending_deletion_bytes;
+
+  // Segments, and their bytes, moved to the WAL archive directory.
+  scoped_refptr<Counter> segments_archived;
+  scoped_refptr<Counter> archived_bytes;
+
+  // Wait and hold times of the segment allocation lock, with
+  // --lock_profiling.
+  scoped_refptr<Histogram> allocation_lock_wait_time;
+  scoped_refptr<Histogram> allocation_lock_hold_time;
 };
 
 } // namespace log
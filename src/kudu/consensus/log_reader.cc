@@ -21,23 +21,36 @@
 #include <memory>
 #include <mutex>
 #include <ostream>
+#include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_index.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(
+    log_reader_open_threads,
+    4,
+    "Number of threads used to open and validate WAL segments in parallel "
+    "when a log reader is initialized. A value of 1 opens segments serially.");
+TAG_FLAG(log_reader_open_threads, advanced);
 
 METRIC_DEFINE_counter(
     server,
@@ -62,9 +75,16 @@ METRIC_DEFINE_histogram(
     60000000LU,
     2);
 
+METRIC_DEFINE_counter(
+    server,
+    log_reader_batches_streamed,
+    "Log Batches Streamed",
+    kudu::MetricUnit::kUnits,
+    "Number of log entry batches read sequentially from closed segments, "
+    "located using their sparse index rather than the log index");
+
 using kudu::consensus::OpId;
 using kudu::consensus::ReplicateMsg;
-using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
 using std::shared_ptr;
 using std::string;
@@ -94,11 +114,27 @@ Status LogReader::Open(
     const string& tablet_id,
     const scoped_refptr<MetricEntity>& metric_entity,
     shared_ptr<LogReader>* reader) {
+  return LogReader::Open(
+      env,
+      vector<string>({tablet_wal_dir}),
+      index,
+      tablet_id,
+      metric_entity,
+      reader);
+}
+
+Status LogReader::Open(
+    Env* env,
+    const vector<string>& tablet_wal_dirs,
+    const scoped_refptr<LogIndex>& index,
+    const string& tablet_id,
+    const scoped_refptr<MetricEntity>& metric_entity,
+    shared_ptr<LogReader>* reader) {
   auto log_reader =
       LogReader::make_shared(env, index, tablet_id, metric_entity);
 
   RETURN_NOT_OK_PREPEND(
-      log_reader->Init(tablet_wal_dir), "Unable to initialize log reader")
+      log_reader->Init(tablet_wal_dirs), "Unable to initialize log reader")
   *reader = log_reader;
   return Status::OK();
 }
@@ -111,7 +147,7 @@ Status LogReader::Open(
     std::shared_ptr<LogReader>* reader) {
   return LogReader::Open(
       fs_manager->env(),
-      fs_manager->GetTabletWalDir(tablet_id),
+      fs_manager->GetTabletWalStripeDirs(tablet_id),
       index,
       tablet_id,
       metric_entity,
@@ -132,23 +168,44 @@ LogReader::LogReader(
     entries_read_ = METRIC_log_reader_entries_read.Instantiate(metric_entity);
     read_batch_latency_ =
         METRIC_log_reader_read_batch_latency.Instantiate(metric_entity);
+    batches_streamed_ =
+        METRIC_log_reader_batches_streamed.Instantiate(metric_entity);
   }
 }
 
 LogReader::~LogReader() {}
 
-Status LogReader::Init(const string& tablet_wal_path) {
-  {
-    std::lock_guard<simple_spinlock> lock(lock_);
-    CHECK_EQ(state_, kLogReaderInitialized)
-        << "bad state for Init(): " << state_;
-  }
-  VLOG(1) << "Reading wal from path:" << tablet_wal_path;
+namespace {
 
-  if (!env_->FileExists(tablet_wal_path)) {
-    return Status::IllegalState("Cannot find wal location at", tablet_wal_path);
+// Opens the segment at 'path', rebuilding its footer by scanning if the
+// segment was left in-progress. Segments whose footer is intact are trusted
+// and only have their header and footer read.
+Status OpenSegmentForRecovery(
+    Env* env,
+    const string& path,
+    scoped_refptr<ReadableLogSegment>* segment) {
+  Status s = ReadableLogSegment::Open(env, path, segment);
+  if (!s.ok()) {
+    return s;
+  }
+  DCHECK(*segment);
+  CHECK((*segment)->IsInitialized())
+      << "Uninitialized segment at: " << (*segment)->path();
+
+  if (!(*segment)->HasFooter()) {
+    VLOG(1)
+        << "Log segment " << path << " was likely left in-progress "
+        << "after a previous crash. Will try to rebuild footer by scanning data.";
+    RETURN_NOT_OK((*segment)->RebuildFooterByScanning());
   }
+  return Status::OK();
+}
+
+} // anonymous namespace
 
+Status LogReader::ReadSegmentsFromPath(
+    const string& tablet_wal_path,
+    SegmentSequence* read_segments) {
   VLOG(1) << "Parsing segments from path: " << tablet_wal_path;
   // list existing segment files
   vector<string> log_files;
@@ -157,42 +214,95 @@ Status LogReader::Init(const string& tablet_wal_path) {
       env_->GetChildren(tablet_wal_path, &log_files),
       "Unable to read children from path");
 
-  SegmentSequence read_segments;
-
-  // build a log segment from each file
+  vector<string> segment_paths;
   for (const string& log_file : log_files) {
     if (HasPrefixString(log_file, FsManager::kWalFileNamePrefix)) {
-      string fqp = JoinPathSegments(tablet_wal_path, log_file);
-      scoped_refptr<ReadableLogSegment> segment;
-      Status s = ReadableLogSegment::Open(env_, fqp, &segment);
-      if (s.IsUninitialized()) {
-        // This indicates that the segment was created but the writer
-        // crashed before the header was successfully written. In this
-        // case, we should skip it.
-        LOG(WARNING) << "Ignoring log segment " << log_file
-                     << " since it was uninitialized "
-                     << "(probably left after a prior tablet server crash)";
-        continue;
+      segment_paths.push_back(JoinPathSegments(tablet_wal_path, log_file));
+    }
+  }
+
+  // build a log segment from each file
+  vector<scoped_refptr<ReadableLogSegment>> segments(segment_paths.size());
+  vector<Status> statuses(segment_paths.size());
+  int num_threads = std::min<int>(
+      FLAGS_log_reader_open_threads, segment_paths.size());
+  if (num_threads > 1) {
+    unique_ptr<ThreadPool> pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("log-reader-open")
+                      .set_min_threads(0)
+                      .set_max_threads(num_threads)
+                      .Build(&pool));
+    for (int i = 0; i < segment_paths.size(); i++) {
+      Env* env = env_;
+      const string* path = &segment_paths[i];
+      scoped_refptr<ReadableLogSegment>* segment = &segments[i];
+      Status* status = &statuses[i];
+      Status s = pool->SubmitFunc([env, path, segment, status]() {
+        *status = OpenSegmentForRecovery(env, *path, segment);
+      });
+      if (!s.ok()) {
+        // Fall back to opening this segment on the calling thread.
+        statuses[i] =
+            OpenSegmentForRecovery(env_, segment_paths[i], &segments[i]);
       }
+    }
+    pool->Wait();
+    pool->Shutdown();
+  } else {
+    for (int i = 0; i < segment_paths.size(); i++) {
+      statuses[i] =
+          OpenSegmentForRecovery(env_, segment_paths[i], &segments[i]);
+    }
+  }
 
-      RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
-      DCHECK(segment);
-      CHECK(segment->IsInitialized())
-          << "Uninitialized segment at: " << segment->path();
+  for (int i = 0; i < segment_paths.size(); i++) {
+    const Status& s = statuses[i];
+    if (s.IsUninitialized()) {
+      // This indicates that the segment was created but the writer
+      // crashed before the header was successfully written. In this
+      // case, we should skip it.
+      LOG(WARNING) << "Ignoring log segment " << segment_paths[i]
+                   << " since it was uninitialized "
+                   << "(probably left after a prior tablet server crash)";
+      continue;
+    }
+    RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
+    read_segments->push_back(segments[i]);
+  }
+  return Status::OK();
+}
 
-      if (!segment->HasFooter()) {
-        VLOG(1)
-            << "Log segment " << fqp << " was likely left in-progress "
-            << "after a previous crash. Will try to rebuild footer by scanning data.";
-        RETURN_NOT_OK(segment->RebuildFooterByScanning());
-      }
+Status LogReader::Init(const string& tablet_wal_path) {
+  return Init(vector<string>({tablet_wal_path}));
+}
 
-      read_segments.push_back(segment);
+Status LogReader::Init(const vector<string>& tablet_wal_paths) {
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    CHECK_EQ(state_, kLogReaderInitialized)
+        << "bad state for Init(): " << state_;
+  }
+  DCHECK(!tablet_wal_paths.empty());
+  const string& tablet_wal_path = tablet_wal_paths[0];
+  VLOG(1) << "Reading wal from path:" << tablet_wal_path;
+
+  if (!env_->FileExists(tablet_wal_path)) {
+    return Status::IllegalState("Cannot find wal location at", tablet_wal_path);
+  }
+
+  SegmentSequence read_segments;
+  for (const string& path : tablet_wal_paths) {
+    // A stripe directory may be missing if the stripe was configured after
+    // the tablet's log was last opened.
+    if (path != tablet_wal_path && !env_->FileExists(path)) {
+      continue;
     }
+    RETURN_NOT_OK(ReadSegmentsFromPath(path, &read_segments));
   }
 
-  // Sort the segments by sequence number.
-  std::sort(
+  // Sort the segments by sequence number. With WAL striping enabled, the
+  // segments of each directory interleave with those of the others.
+  std::stable_sort(
       read_segments.begin(), read_segments.end(), LogSegmentSeqnoComparator());
 
   {
@@ -203,6 +313,16 @@ Status LogReader::Init(const string& tablet_wal_path) {
     for (const SegmentSequence::value_type& entry : read_segments) {
       VLOG(1) << " Log Reader Indexed: "
               << SecureShortDebugString(entry->footer());
+      // A crash while moving a segment to the WAL archive may leave a
+      // complete copy of it behind. The archive comes last in
+      // 'tablet_wal_paths', so the original is kept.
+      if (entry->header().sequence_number() == previous_seg_seqno) {
+        LOG(INFO) << Substitute(
+            "Ignoring segment $0, a copy of segment $1",
+            entry->path(),
+            previous_seg_path);
+        continue;
+      }
       // Check that the log segments are in sequence.
       if (previous_seg_seqno != -1 &&
           entry->header().sequence_number() != previous_seg_seqno + 1) {
@@ -267,10 +387,11 @@ scoped_refptr<ReadableLogSegment> LogReader::GetSegmentBySequenceNumber(
   return segments_[relative];
 }
 
-Status LogReader::ReadBatchUsingIndexEntry(
+Status LogReader::ReadBatchDataUsingIndexEntry(
     const LogIndexEntry& index_entry,
     faststring* tmp_buf,
-    unique_ptr<LogEntryBatchPB>* batch) const {
+    Slice* batch_data,
+    scoped_refptr<ReadableLogSegment>* read_segment) const {
   const int64_t index = index_entry.op_id.index();
 
   scoped_refptr<ReadableLogSegment> segment =
@@ -284,11 +405,8 @@ Status LogReader::ReadBatchUsingIndexEntry(
 
   CHECK_GT(index_entry.offset_in_segment, 0);
   int64_t offset = index_entry.offset_in_segment;
-  ScopedLatencyMetric scoped(read_batch_latency_.get());
-  EntryHeaderStatus unused_status_detail;
   RETURN_NOT_OK_PREPEND(
-      segment->ReadEntryHeaderAndBatch(
-          &offset, tmp_buf, batch, &unused_status_detail),
+      ReadBatchDataAtOffset(segment, &offset, tmp_buf, batch_data),
       Substitute(
           "Failed to read LogEntry for index $0 from log segment "
           "$1 offset $2",
@@ -296,90 +414,291 @@ Status LogReader::ReadBatchUsingIndexEntry(
           index_entry.segment_sequence_number,
           index_entry.offset_in_segment));
 
+  *read_segment = std::move(segment);
+  return Status::OK();
+}
+
+Status LogReader::ReadBatchDataAtOffset(
+    const scoped_refptr<ReadableLogSegment>& segment,
+    int64_t* offset,
+    faststring* tmp_buf,
+    Slice* batch_data) const {
+  ScopedLatencyMetric scoped(read_batch_latency_.get());
+  const int64_t start = *offset;
+  EntryHeaderStatus unused_status_detail;
+  RETURN_NOT_OK(segment->ReadEntryHeaderAndBatchData(
+      offset, tmp_buf, batch_data, &unused_status_detail));
+  if (segment->HasFooter()) {
+    segment->AdviseColdRead(start, *offset);
+  }
+
   if (bytes_read_) {
-    bytes_read_->IncrementBy(segment->entry_header_size() + tmp_buf->length());
-    entries_read_->IncrementBy((**batch).entry_size());
+    bytes_read_->IncrementBy(*offset - start);
   }
 
   return Status::OK();
 }
 
-Status LogReader::ReadReplicatesInRange(
-    int64_t starting_at,
+bool LogReader::FindStreamStart(
+    int64_t index,
     int64_t up_to,
-    int64_t max_bytes_to_read,
-    vector<ReplicateMsg*>* replicates) const {
-  DCHECK_GT(starting_at, 0);
-  DCHECK_GE(up_to, starting_at);
-  DCHECK(log_index_) << "Require an index to random-read logs";
+    scoped_refptr<ReadableLogSegment>* segment,
+    int64_t* offset,
+    int64_t* last_index) const {
+  scoped_refptr<ReadableLogSegment> candidate;
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+      const scoped_refptr<ReadableLogSegment>& seg = *it;
+      // The segment being written has no footer, so its first op is unknown;
+      // if it rewrote 'index', the LogIndex check below catches it.
+      if (!seg->HasFooter() || !seg->footer().has_min_replicate_index()) {
+        continue;
+      }
+      if (seg->footer().min_replicate_index() <= index) {
+        candidate = seg;
+        break;
+      }
+    }
+  }
+  if (!candidate || candidate->footer().max_replicate_index() < index) {
+    return false;
+  }
+  const auto& sparse_index = candidate->sparse_index();
+  if (!sparse_index || !sparse_index->sequential()) {
+    return false;
+  }
 
-  vector<ReplicateMsg*> replicates_tmp;
-  ElementDeleter d(&replicates_tmp);
-  LogIndexEntry prev_index_entry;
+  const int64_t last =
+      std::min(up_to, candidate->footer().max_replicate_index());
+  LogIndexEntry last_entry;
+  if (!log_index_->GetEntry(last, &last_entry).ok() ||
+      last_entry.segment_sequence_number !=
+          candidate->header().sequence_number()) {
+    return false;
+  }
+  if (!sparse_index->FindOffset(index, offset)) {
+    return false;
+  }
+  *segment = std::move(candidate);
+  *last_index = last;
+  return true;
+}
 
-  int64_t total_size = 0;
-  bool limit_exceeded = false;
-  faststring tmp_buf;
-  unique_ptr<LogEntryBatchPB> batch;
-  for (int64_t index = starting_at; index <= up_to && !limit_exceeded;
-       index++) {
+namespace {
+
+// Walks the serialized LogEntryBatchPB in 'batch_data' without decoding it,
+// and sets 'replicates' to the index and serialized form of each
+// ReplicateMsg it holds. Sets '*num_entries' to the number of entries in the
+// batch.
+//
+// Also sanity-checks the property that a batch should only have increasing
+// indexes.
+Status FindSerializedReplicates(
+    const Slice& batch_data,
+    const string& batch_location,
+    vector<std::pair<int64_t, Slice>>* replicates,
+    int* num_entries) {
+  replicates->clear();
+  vector<LogEntryHeaderView> entries;
+  RETURN_NOT_OK_PREPEND(
+      DecodeEntryBatchHeaders(batch_data, &entries),
+      Substitute("Could not parse log entry batch at $0", batch_location));
+  *num_entries = entries.size();
+  for (const LogEntryHeaderView& entry : entries) {
+    if (!entry.has_replicate) {
+      continue;
+    }
+    const int64_t index = entry.replicate.id.index();
+    CHECK(replicates->empty() || index > replicates->back().first)
+        << "Expected that an entry batch should only include increasing log "
+        << "indexes: " << batch_location;
+    replicates->emplace_back(index, entry.replicate_data);
+  }
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+LogReader::RangeIterator::RangeIterator(
+    const LogReader* reader,
+    int64_t from,
+    int64_t up_to)
+    : reader_(reader),
+      next_index_(from),
+      up_to_(up_to),
+      stream_offset_(0),
+      stream_last_index_(0) {}
+
+Status LogReader::RangeIterator::Next(RangeBatch* batch) {
+  if (next_index_ > up_to_) {
+    return Status::EndOfFile("Read all ops in the range");
+  }
+
+  while (true) {
+    if (stream_segment_ && next_index_ > stream_last_index_) {
+      stream_segment_ = nullptr;
+    }
+    if (!stream_segment_) {
+      reader_->FindStreamStart(
+          next_index_,
+          up_to_,
+          &stream_segment_,
+          &stream_offset_,
+          &stream_last_index_);
+    }
+
+    // The last op which may be taken from the batch.
+    int64_t last_index;
+    string batch_location;
     LogIndexEntry index_entry;
-    RETURN_NOT_OK_PREPEND(
-        log_index_->GetEntry(index, &index_entry),
-        Substitute("Failed to read log index for op $0", index));
-
-    // Since a given LogEntryBatchPB may contain multiple REPLICATE messages,
-    // it's likely that this index entry points to the same batch as the
-    // previous one. If that's the case, we've already read this REPLICATE and
-    // we can skip reading the batch again.
-    if (index == starting_at ||
-        index_entry.segment_sequence_number !=
-            prev_index_entry.segment_sequence_number ||
-        index_entry.offset_in_segment != prev_index_entry.offset_in_segment) {
-      RETURN_NOT_OK(ReadBatchUsingIndexEntry(index_entry, &tmp_buf, &batch));
-
-      // Sanity-check the property that a batch should only have increasing
-      // indexes.
-      int64_t prev_index = 0;
-      for (int i = 0; i < batch->entry_size(); ++i) {
-        LogEntryPB* entry = batch->mutable_entry(i);
-        if (!entry->has_replicate())
-          continue;
-        int64_t this_index = entry->replicate().id().index();
-        CHECK_GT(this_index, prev_index)
-            << "Expected that an entry batch should only include increasing log indexes: "
-            << index_entry.ToString()
-            << "\nBatch: " << SecureDebugString(*batch);
-        prev_index = this_index;
+    if (stream_segment_) {
+      const int64_t batch_offset = stream_offset_;
+      batch_location = Substitute(
+          "segment $0 offset $1",
+          stream_segment_->header().sequence_number(),
+          batch_offset);
+      RETURN_NOT_OK_PREPEND(
+          reader_->ReadBatchDataAtOffset(
+              stream_segment_, &stream_offset_, &buf_, &batch->data),
+          Substitute(
+              "Failed to stream LogEntry for index $0 from $1",
+              next_index_,
+              batch_location));
+      data_segment_ = stream_segment_;
+      if (reader_->batches_streamed_) {
+        reader_->batches_streamed_->Increment();
+      }
+      last_index = stream_last_index_;
+    } else {
+      RETURN_NOT_OK_PREPEND(
+          reader_->log_index_->GetEntry(next_index_, &index_entry),
+          Substitute("Failed to read log index for op $0", next_index_));
+      batch_location = index_entry.ToString();
+      RETURN_NOT_OK(reader_->ReadBatchDataUsingIndexEntry(
+          index_entry, &buf_, &batch->data, &data_segment_));
+      last_index = next_index_;
+    }
+
+    int num_entries;
+    RETURN_NOT_OK(FindSerializedReplicates(
+        batch->data, batch_location, &replicates_, &num_entries));
+    if (reader_->entries_read_) {
+      reader_->entries_read_->IncrementBy(num_entries);
+    }
+
+    if (!stream_segment_ && !replicates_.empty()) {
+      // The rest of the batch's ops can be taken too if the last of them
+      // which is needed is still indexed here: since all ops in the range are
+      // current, none of the ones before it can have been rewritten since.
+      const int64_t wanted = std::min(up_to_, replicates_.back().first);
+      LogIndexEntry last_entry;
+      if (wanted > next_index_ &&
+          reader_->log_index_->GetEntry(wanted, &last_entry).ok() &&
+          last_entry.segment_sequence_number ==
+              index_entry.segment_sequence_number &&
+          last_entry.offset_in_segment == index_entry.offset_in_segment) {
+        last_index = wanted;
       }
     }
+    last_index = std::min(last_index, up_to_);
 
-    bool found = false;
-    for (int i = 0; i < batch->entry_size(); ++i) {
-      LogEntryPB* entry = batch->mutable_entry(i);
-      if (!entry->has_replicate()) {
+    batch->replicates.clear();
+    for (const auto& replicate : replicates_) {
+      if (replicate.first < next_index_) {
         continue;
       }
+      if (replicate.first > last_index ||
+          replicate.first !=
+              next_index_ + static_cast<int64_t>(batch->replicates.size())) {
+        break;
+      }
+      batch->replicates.push_back(replicate.second);
+    }
 
-      if (entry->replicate().id().index() != index) {
+    if (batch->replicates.empty()) {
+      // While streaming, batches before the op we're after are skipped.
+      if (stream_segment_ &&
+          (replicates_.empty() || replicates_.back().first < next_index_)) {
         continue;
       }
+      LOG(FATAL) << "Incorrect index entry didn't yield expected log entry "
+                 << next_index_ << ": " << batch_location;
+    }
+
+    batch->first_index = next_index_;
+    batch->last_index = next_index_ + batch->replicates.size() - 1;
+    next_index_ = batch->last_index + 1;
+    return Status::OK();
+  }
+}
+
+unique_ptr<LogReader::RangeIterator> LogReader::NewRangeIterator(
+    int64_t starting_at,
+    int64_t up_to) const {
+  DCHECK_GT(starting_at, 0);
+  DCHECK_GE(up_to, starting_at);
+  DCHECK(log_index_) << "Require an index to random-read logs";
+  return unique_ptr<RangeIterator>(new RangeIterator(this, starting_at, up_to));
+}
+
+Status LogReader::ReadReplicatesInRange(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    vector<ReplicateMsg*>* replicates) const {
+  return ReadReplicatesInRange(
+      starting_at, up_to, max_bytes_to_read, nullptr, replicates);
+}
+
+Status LogReader::ReadReplicatesInRange(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    google::protobuf::Arena* arena,
+    vector<ReplicateMsg*>* replicates) const {
+  vector<ReplicateMsg*> replicates_tmp;
+  // Messages on the arena are freed with it.
+  ElementDeleter d(arena ? nullptr : &replicates_tmp);
+
+  int64_t total_size = 0;
+  unique_ptr<RangeIterator> iter = NewRangeIterator(starting_at, up_to);
+  RangeBatch batch;
+  bool limit_exceeded = false;
+  while (!limit_exceeded) {
+    Status s = iter->Next(&batch);
+    if (s.IsEndOfFile()) {
+      break;
+    }
+    RETURN_NOT_OK(s);
+
+    int64_t index = batch.first_index;
+    for (const Slice& data : batch.replicates) {
+      unique_ptr<ReplicateMsg> owned;
+      ReplicateMsg* replicate;
+      if (arena) {
+        replicate =
+            google::protobuf::Arena::CreateMessage<ReplicateMsg>(arena);
+      } else {
+        owned.reset(new ReplicateMsg);
+        replicate = owned.get();
+      }
+      RETURN_NOT_OK_PREPEND(
+          pb_util::ParseFromArray(replicate, data.data(), data.size()),
+          Substitute("Could not parse replicate $0", index));
+      index++;
 
-      int64_t space_required = entry->replicate().SpaceUsed();
+      int64_t space_required = replicate->SpaceUsed();
       if (replicates_tmp.empty() || max_bytes_to_read <= 0 ||
           total_size + space_required < max_bytes_to_read) {
         total_size += space_required;
-        replicates_tmp.push_back(entry->release_replicate());
+        replicates_tmp.push_back(replicate);
+        ignore_result(owned.release());
       } else {
         limit_exceeded = true;
+        break;
       }
-      found = true;
-      break;
     }
-    CHECK(found) << "Incorrect index entry didn't yield expected log entry: "
-                 << index_entry.ToString();
-
-    prev_index_entry = index_entry;
   }
 
   replicates->swap(replicates_tmp);
@@ -450,6 +769,25 @@ Status LogReader::ReplaceLastSegment(
   return Status::OK();
 }
 
+Status LogReader::ReplaceSegment(
+    const scoped_refptr<ReadableLogSegment>& segment) {
+  DCHECK(segment->HasFooter());
+  const int64_t seqno = segment->header().sequence_number();
+
+  std::lock_guard<simple_spinlock> lock(lock_);
+  CHECK_EQ(state_, kLogReaderReading);
+  if (segments_.empty()) {
+    return Status::NotFound(Substitute("segment $0 is not in the log", seqno));
+  }
+  int64_t relative = seqno - segments_[0]->header().sequence_number();
+  if (relative < 0 || relative >= segments_.size()) {
+    return Status::NotFound(Substitute("segment $0 is not in the log", seqno));
+  }
+  DCHECK_EQ(segments_[relative]->header().sequence_number(), seqno);
+  segments_[relative] = segment;
+  return Status::OK();
+}
+
 Status LogReader::AppendSegment(
     const scoped_refptr<ReadableLogSegment>& segment) {
   DCHECK(segment->IsInitialized());
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gtest/gtest_prod.h>
@@ -27,8 +28,10 @@
 #include "kudu/consensus/log_util.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/make_shared.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -40,6 +43,16 @@ class Histogram;
 class MetricEntity;
 class faststring;
 
+} // namespace kudu
+
+namespace google {
+namespace protobuf {
+class Arena;
+} // namespace protobuf
+} // namespace google
+
+namespace kudu {
+
 namespace consensus {
 class OpId;
 class ReplicateMsg;
@@ -70,7 +83,18 @@ class LogReader : public enable_make_shared<LogReader> {
       const scoped_refptr<MetricEntity>& metric_entity,
       std::shared_ptr<LogReader>* reader);
 
-  // Same as above, but will use `fs_manager` to determine the default WAL dir
+  // Same as above, but reads segments from all of 'tablet_wal_dirs', as
+  // used when the WAL is striped across several directories. The first
+  // directory must exist; the others are skipped if missing.
+  static Status Open(
+      Env* env,
+      const std::vector<std::string>& tablet_wal_dirs,
+      const scoped_refptr<LogIndex>& index,
+      const std::string& tablet_id,
+      const scoped_refptr<MetricEntity>& metric_entity,
+      std::shared_ptr<LogReader>* reader);
+
+  // Same as above, but will use `fs_manager` to determine the WAL dirs
   // for the tablet.
   static Status Open(
       FsManager* fs_manager,
@@ -94,6 +118,12 @@ class LogReader : public enable_make_shared<LogReader> {
 
   // Reads all ReplicateMsgs from 'starting_at' to 'up_to' both inclusive.
   // The caller takes ownership of the returned ReplicateMsg objects.
+  // 'starting_at' through 'up_to' must all be ops in the current log, i.e.
+  // none of them may have been truncated without being appended again.
+  //
+  // Runs of ops in closed segments that have a sparse index are streamed
+  // sequentially from the segment, starting from a nearby sampled batch;
+  // other ops are looked up one by one in the LogIndex.
   //
   // Will attempt to read no more than 'max_bytes_to_read', unless it is set to
   // LogReader::kNoSizeLimit. If the size limit would prevent reading any
@@ -105,8 +135,81 @@ class LogReader : public enable_make_shared<LogReader> {
       int64_t up_to,
       int64_t max_bytes_to_read,
       std::vector<consensus::ReplicateMsg*>* replicates) const;
+
+  // Like the above, but allocates the ReplicateMsgs on 'arena', which owns
+  // them. If 'arena' is null the caller owns them, as above.
+  Status ReadReplicatesInRange(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      google::protobuf::Arena* arena,
+      std::vector<consensus::ReplicateMsg*>* replicates) const;
   static const int64_t kNoSizeLimit;
 
+  // One entry batch read by a RangeIterator.
+  struct RangeBatch {
+    // The first and last ops of the iterated range held by the batch.
+    int64_t first_index;
+    int64_t last_index;
+
+    // The serialized LogEntryBatchPB, as stored in the log (after
+    // decompression). Points into the iterator's buffer, or into a segment
+    // mapping the iterator holds on to, so it's only valid until the next
+    // call to RangeIterator::Next().
+    Slice data;
+
+    // The serialized ReplicateMsgs 'first_index' through 'last_index',
+    // pointing into 'data'.
+    std::vector<Slice> replicates;
+  };
+
+  // Iterates over the REPLICATE messages in a range of ops one entry batch at
+  // a time. Messages are handed back still serialized, so that callers which
+  // only relay them don't have to decode each one. Not thread-safe.
+  class RangeIterator {
+   public:
+    // Reads the next batch holding ops of the range into 'batch'. Returns
+    // Status::EndOfFile() once the whole range has been read.
+    Status Next(RangeBatch* batch);
+
+    // Returns the first op that the next call to Next() will return.
+    int64_t next_index() const {
+      return next_index_;
+    }
+
+   private:
+    friend class LogReader;
+
+    RangeIterator(const LogReader* reader, int64_t from, int64_t up_to);
+
+    const LogReader* const reader_;
+    int64_t next_index_;
+    const int64_t up_to_;
+
+    // The closed segment being streamed, if any, the offset of its next
+    // batch, and the last op which may be read from it.
+    scoped_refptr<ReadableLogSegment> stream_segment_;
+    int64_t stream_offset_;
+    int64_t stream_last_index_;
+
+    // Holds the data of the last batch read, or the segment it was read
+    // from if the data points into the segment's mapping.
+    faststring buf_;
+    scoped_refptr<ReadableLogSegment> data_segment_;
+    std::vector<std::pair<int64_t, Slice>> replicates_;
+
+    DISALLOW_COPY_AND_ASSIGN(RangeIterator);
+  };
+
+  // Returns an iterator over ops 'starting_at' through 'up_to', both
+  // inclusive, which must satisfy the same requirements as for
+  // ReadReplicatesInRange(). The iterator must not outlive this reader.
+  //
+  // Requires that a LogIndex was passed into LogReader::Open().
+  std::unique_ptr<RangeIterator> NewRangeIterator(
+      int64_t starting_at,
+      int64_t up_to) const;
+
   // Look up the OpId for the given operation index.
   // Returns a bad Status if the log index fails to load (eg. due to an IO
   // error).
@@ -127,6 +230,7 @@ class LogReader : public enable_make_shared<LogReader> {
  private:
   FRIEND_TEST(LogTestOptionalCompression, TestLogReader);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
+  FRIEND_TEST(LogTest, TestReadReplicatesUsingSparseIndex);
   friend class Log;
   friend class LogTest;
   friend class LogTestOptionalCompression;
@@ -155,6 +259,11 @@ class LogReader : public enable_make_shared<LogReader> {
   // Expects 'segment' to be properly closed and to have footer.
   Status ReplaceLastSegment(const scoped_refptr<ReadableLogSegment>& segment);
 
+  // Replaces the segment in the reader that has the same sequence number as
+  // 'segment', a copy of it moved elsewhere. Returns NotFound if there is no
+  // such segment, e.g. because it was trimmed.
+  Status ReplaceSegment(const scoped_refptr<ReadableLogSegment>& segment);
+
   // Appends 'segment' to the segment sequence.
   // Assumes that the segment was scanned, if no footer was found.
   // To be used only internally, clients of this class with private access (i.e.
@@ -169,16 +278,55 @@ class LogReader : public enable_make_shared<LogReader> {
   // written to.
   void UpdateLastSegmentOffset(int64_t readable_to_offset);
 
-  // Read the LogEntryBatchPB pointed to by the provided index entry.
-  // 'tmp_buf' is used as scratch space to avoid extra allocation.
-  Status ReadBatchUsingIndexEntry(
+  // Read the serialized LogEntryBatchPB pointed to by the provided index
+  // entry into 'tmp_buf', and point '*batch_data' at it. '*read_segment' is
+  // set to the segment read, which must be kept alive as long as
+  // '*batch_data' is used, since it may point into the segment's mapping.
+  Status ReadBatchDataUsingIndexEntry(
       const LogIndexEntry& index_entry,
       faststring* tmp_buf,
-      std::unique_ptr<LogEntryBatchPB>* batch) const;
+      Slice* batch_data,
+      scoped_refptr<ReadableLogSegment>* read_segment) const;
+
+  // Looks for a closed segment from which ops starting at 'index', and no
+  // later than 'up_to', can be streamed. On success, sets '*segment',
+  // '*offset' to the offset of a batch at or before 'index' in it, and
+  // '*last_index' to the last op which may be streamed from it.
+  //
+  // The segment is the last one whose ops start at or before 'index'. It is
+  // used only if its sparse index shows no ops were rewritten within it, and
+  // if the LogIndex places '*last_index' in it: since 'index' through
+  // '*last_index' are current ops, none of them can have been rewritten in a
+  // later segment without '*last_index' being rewritten after them.
+  bool FindStreamStart(
+      int64_t index,
+      int64_t up_to,
+      scoped_refptr<ReadableLogSegment>* segment,
+      int64_t* offset,
+      int64_t* last_index) const;
+
+  // Reads the serialized batch at '*offset' in 'segment' into 'tmp_buf',
+  // points '*batch_data' at it and advances '*offset' past it. If 'segment'
+  // is mapped, '*batch_data' may point into the mapping instead.
+  Status ReadBatchDataAtOffset(
+      const scoped_refptr<ReadableLogSegment>& segment,
+      int64_t* offset,
+      faststring* tmp_buf,
+      Slice* batch_data) const;
 
   // Reads the headers of all segments in 'tablet_wal_path'.
   Status Init(const std::string& tablet_wal_path);
 
+  // Reads the headers of all segments in each of 'tablet_wal_paths' and
+  // orders them by sequence number.
+  Status Init(const std::vector<std::string>& tablet_wal_paths);
+
+  // Opens every segment file in 'tablet_wal_path' and appends it, unordered,
+  // to 'read_segments'.
+  Status ReadSegmentsFromPath(
+      const std::string& tablet_wal_path,
+      SegmentSequence* read_segments);
+
   // Initializes an 'empty' reader for tests, i.e. does not scan a path looking
   // for segments.
   Status InitEmptyReaderForTests();
@@ -191,6 +339,7 @@ class LogReader : public enable_make_shared<LogReader> {
   scoped_refptr<Counter> bytes_read_;
   scoped_refptr<Counter> entries_read_;
   scoped_refptr<Histogram> read_batch_latency_;
+  scoped_refptr<Counter> batches_streamed_;
 
   // The sequence of all current log segments in increasing sequence number
   // order.
@@ -17,13 +17,25 @@
 
 #include "kudu/consensus/log_util.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/opid_util.h"
@@ -41,10 +53,17 @@
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/fault_injection.h"
+#include "kudu/util/file_cache.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/io_scheduler.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/threadpool.h"
 
 DEFINE_int32(
     log_segment_size_mb,
@@ -70,13 +89,151 @@ DEFINE_bool(
     "Whether the WAL segments preallocation should happen asynchronously");
 TAG_FLAG(log_async_preallocate_segments, advanced);
 
+DEFINE_int32(
+    log_recovery_readahead_bytes,
+    8 * 1024 * 1024,
+    "Size of the sequential readahead buffer used when scanning an in-progress "
+    "WAL segment to rebuild its footer. 0 reads each entry directly.");
+TAG_FLAG(log_recovery_readahead_bytes, advanced);
+
+DEFINE_bool(
+    log_pipelined_append,
+    false,
+    "Whether the WAL append thread should hand each group off to a separate "
+    "sync stage, so that the next group is written while the previous one is "
+    "being fsynced");
+TAG_FLAG(log_pipelined_append, experimental);
+
+DEFINE_bool(
+    log_direct_io_writes,
+    false,
+    "Whether WAL segments should be written with O_DIRECT, bypassing the page "
+    "cache. Useful when WAL write-back evicts the application's own data from "
+    "the page cache.");
+TAG_FLAG(log_direct_io_writes, experimental);
+
+DEFINE_bool(
+    log_separate_commit_lane,
+    false,
+    "Whether COMMIT entries should be queued separately from REPLICATE "
+    "entries. COMMITs are then appended behind the next group of REPLICATEs "
+    "and never force a sync of their own, so they don't delay or add to the "
+    "replicates' fsyncs.");
+TAG_FLAG(log_separate_commit_lane, experimental);
+
+DEFINE_int32(
+    log_segment_recycle_pool_size,
+    0,
+    "Maximum number of garbage-collected WAL segment files kept per tablet "
+    "for reuse as new segments, instead of being deleted. Reusing a segment "
+    "file avoids creating, allocating and unlinking files around segment "
+    "roll-over. 0 disables recycling.");
+TAG_FLAG(log_segment_recycle_pool_size, experimental);
+
+DEFINE_bool(
+    log_zero_recycled_segments,
+    true,
+    "Whether recycled WAL segment files are overwritten with zeros before "
+    "reuse, keeping their blocks allocated and written. If false, recycled "
+    "files are truncated and preallocated again instead.");
+TAG_FLAG(log_zero_recycled_segments, experimental);
+
+DEFINE_bool(
+    log_zero_preallocated_segments,
+    false,
+    "Whether the space preallocated for new WAL segments is also overwritten "
+    "with zeros, and synced, while the segment is allocated. The extents are "
+    "then already written when entries are appended, so syncing them doesn't "
+    "also have to journal the conversion of unwritten extents. Only applies "
+    "with --log_preallocate_segments.");
+TAG_FLAG(log_zero_preallocated_segments, experimental);
+
+DEFINE_int32(
+    log_segment_target_roll_interval_ms,
+    0,
+    "If positive, each new WAL segment is sized from the tablet's recent "
+    "append rate so that it rolls over after about this many milliseconds, "
+    "within --log_min_segment_size_mb and --log_max_segment_size_mb, and a "
+    "segment open for twice as long is rolled over whatever its size. Busy "
+    "tablets then roll over no more often than quiet ones, while quiet "
+    "tablets keep small segments which GC can release promptly. 0 uses "
+    "--log_segment_size_mb for every segment.");
+TAG_FLAG(log_segment_target_roll_interval_ms, experimental);
+
+DEFINE_int32(
+    log_min_segment_size_mb,
+    1,
+    "The smallest WAL segment sized with "
+    "--log_segment_target_roll_interval_ms, in MB");
+TAG_FLAG(log_min_segment_size_mb, experimental);
+
+DEFINE_int32(
+    log_max_segment_size_mb,
+    64,
+    "The largest WAL segment sized with "
+    "--log_segment_target_roll_interval_ms, in MB");
+TAG_FLAG(log_max_segment_size_mb, experimental);
+
+DEFINE_int32(
+    log_segment_file_cache_capacity,
+    0,
+    "Maximum number of WAL segment files the logs of all the tablets keep "
+    "open for reading, shared through a file cache, so that the number of "
+    "open descriptors is bounded however many tablets a server hosts. "
+    "Segments being written are always kept open, outside the cache. "
+    "0 keeps every retained segment open.");
+TAG_FLAG(log_segment_file_cache_capacity, experimental);
+
+DEFINE_bool(
+    log_cold_reads_drop_cache,
+    false,
+    "Whether entries read from closed WAL segments for lagging peers are "
+    "dropped from the page cache once read, and the segments read ahead with "
+    "--log_cold_read_readahead_bytes, so that catching a peer up doesn't "
+    "evict the data of other processes on the host.");
+TAG_FLAG(log_cold_reads_drop_cache, experimental);
+TAG_FLAG(log_cold_reads_drop_cache, runtime);
+
+DEFINE_int32(
+    log_cold_read_readahead_bytes,
+    4 * 1024 * 1024,
+    "How far ahead of a lagging peer's reads a closed WAL segment is read "
+    "ahead when --log_cold_reads_drop_cache is on. 0 disables readahead.");
+TAG_FLAG(log_cold_read_readahead_bytes, experimental);
+TAG_FLAG(log_cold_read_readahead_bytes, runtime);
+
+DEFINE_bool(
+    log_mmap_closed_segments,
+    false,
+    "Whether closed WAL segments are read through a read-only memory mapping "
+    "rather than with pread, so that entry batches read for lagging peers "
+    "and tools are checked and parsed straight from the page cache. While "
+    "on, segments aren't recycled or truncated while they may still be "
+    "mapped.");
+TAG_FLAG(log_mmap_closed_segments, experimental);
+
+DEFINE_int64(
+    log_segment_deletion_truncate_bytes,
+    0,
+    "When deleting WAL segments in the background, truncate them by this "
+    "many bytes at a time before unlinking them, so that the file system "
+    "frees their extents in small pieces. 0 unlinks them at once.");
+TAG_FLAG(log_segment_deletion_truncate_bytes, experimental);
+TAG_FLAG(log_segment_deletion_truncate_bytes, runtime);
+
 DEFINE_double(
     fault_crash_before_write_log_segment_header,
     0.0,
     "Fraction of the time we will crash just before writing the log segment header");
 TAG_FLAG(fault_crash_before_write_log_segment_header, unsafe);
 
+using google::protobuf::internal::WireFormatLite;
+using google::protobuf::io::CodedInputStream;
+using kudu::consensus::OperationType;
+using kudu::consensus::OperationType_IsValid;
 using kudu::consensus::OpId;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::WritePayloadPB;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -107,14 +264,34 @@ const size_t kEntryHeaderSizeV1 = 12;
 // Later versions, which added support for compression, use a 16-byte header.
 const size_t kEntryHeaderSizeV2 = 16;
 
+// Set in the uncompressed length of an entry header if the batch following it
+// was stored without the segment's compression codec. Only used by segments
+// with the RAW_BATCHES feature.
+const uint32_t kRawBatchFlag = 1U << 31;
+
 // Maximum log segment header/footer size, in bytes (8 MB).
 const uint32_t kLogSegmentMaxHeaderOrFooterSize = 8 * 1024 * 1024;
 
+// Capacity above which a segment's write buffer is released after a flush,
+// rather than being kept around for the next group.
+const size_t kMaxRetainedWriteBufferCapacity = 16 * 1024 * 1024;
+
 LogOptions::LogOptions()
     : segment_size_mb(FLAGS_log_segment_size_mb),
       force_fsync_all(FLAGS_log_force_fsync_all),
       preallocate_segments(FLAGS_log_preallocate_segments),
-      async_preallocate_segments(FLAGS_log_async_preallocate_segments) {}
+      async_preallocate_segments(FLAGS_log_async_preallocate_segments),
+      pipelined_append(FLAGS_log_pipelined_append),
+      direct_io_writes(FLAGS_log_direct_io_writes),
+      separate_commit_lane(FLAGS_log_separate_commit_lane),
+      segment_recycle_pool_size(FLAGS_log_segment_recycle_pool_size),
+      zero_recycled_segments(FLAGS_log_zero_recycled_segments),
+      zero_preallocated_segments(FLAGS_log_zero_preallocated_segments),
+      segment_target_roll_interval_ms(
+          FLAGS_log_segment_target_roll_interval_ms),
+      min_segment_size_mb(FLAGS_log_min_segment_size_mb),
+      max_segment_size_mb(FLAGS_log_max_segment_size_mb),
+      startup_profile(nullptr) {}
 
 ////////////////////////////////////////////////////////////
 // LogEntryReader
@@ -143,56 +320,13 @@ LogEntryReader::~LogEntryReader() {}
 Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
   // Refill pending_entries_ if none are available.
   while (pending_entries_.empty()) {
-    // If we are done reading, check that we got the expected number of entries
-    // and return EOF.
-    if (offset_ >= read_up_to_) {
-      if (seg_->footer_.IsInitialized() &&
-          seg_->footer_.num_entries() != num_entries_read_) {
-        return Status::Corruption(Substitute(
-            "Read $0 log entries from $1, but expected $2 based on the footer",
-            num_entries_read_,
-            seg_->path_,
-            seg_->footer_.num_entries()));
-      }
-
-      return Status::EndOfFile("Reached end of log");
-    }
-
-    // We still expect to have more entries in the log.
     unique_ptr<LogEntryBatchPB> current_batch;
-
-    // Read and validate the entry header first.
-    Status s;
-    EntryHeaderStatus s_detail = EntryHeaderStatus::OTHER_ERROR;
-    if (offset_ + seg_->entry_header_size() < read_up_to_) {
-      s = seg_->ReadEntryHeaderAndBatch(
-          &offset_, &tmp_buf_, &current_batch, &s_detail);
-    } else {
-      s = Status::Corruption(
-          Substitute("Truncated log entry at offset $0", offset_));
-    }
-
-    if (PREDICT_FALSE(!s.ok())) {
-      return HandleReadError(s, s_detail);
-    }
+    int64_t unused_batch_offset;
+    RETURN_NOT_OK(ReadNextBatch(&current_batch, &unused_batch_offset));
 
     // Add the entries from this batch to our pending queue.
     for (int i = 0; i < current_batch->entry_size(); i++) {
-      auto entry = current_batch->mutable_entry(i);
-      pending_entries_.emplace_back(entry);
-      num_entries_read_++;
-
-      // Record it in the 'recent entries' deque.
-      OpId op_id;
-      if (entry->type() == log::REPLICATE && entry->has_replicate()) {
-        op_id = entry->replicate().id();
-      } else if (entry->has_commit() && entry->commit().has_commited_op_id()) {
-        op_id = entry->commit().commited_op_id();
-      }
-      if (recent_entries_.size() == kNumRecentEntries) {
-        recent_entries_.pop_front();
-      }
-      recent_entries_.push_back({offset_, entry->type(), op_id});
+      pending_entries_.emplace_back(current_batch->mutable_entry(i));
     }
 #if GOOGLE_PROTOBUF_VERSION >= 3017003
     current_batch->mutable_entry()->UnsafeArenaExtractSubrange(
@@ -208,6 +342,114 @@ Status LogEntryReader::ReadNextEntry(unique_ptr<LogEntryPB>* entry) {
   return Status::OK();
 }
 
+Status LogEntryReader::CheckForEndOfEntries() const {
+  // If we are done reading, check that we got the expected number of entries
+  // and return EOF.
+  if (offset_ >= read_up_to_) {
+    if (seg_->footer_.IsInitialized() &&
+        seg_->footer_.num_entries() != num_entries_read_) {
+      return Status::Corruption(Substitute(
+          "Read $0 log entries from $1, but expected $2 based on the footer",
+          num_entries_read_,
+          seg_->path_,
+          seg_->footer_.num_entries()));
+    }
+
+    return Status::EndOfFile("Reached end of log");
+  }
+  return Status::OK();
+}
+
+void LogEntryReader::RecordEntry(LogEntryTypePB type, const OpId& op_id) {
+  num_entries_read_++;
+  if (recent_entries_.size() == kNumRecentEntries) {
+    recent_entries_.pop_front();
+  }
+  recent_entries_.push_back({offset_, type, op_id});
+}
+
+Status LogEntryReader::ReadNextBatch(
+    unique_ptr<LogEntryBatchPB>* batch,
+    int64_t* batch_offset) {
+  DCHECK(pending_entries_.empty());
+  RETURN_NOT_OK(CheckForEndOfEntries());
+
+  // Read and validate the entry header first.
+  const int64_t start = offset_;
+  unique_ptr<LogEntryBatchPB> current_batch;
+  Status s;
+  EntryHeaderStatus s_detail = EntryHeaderStatus::OTHER_ERROR;
+  if (offset_ + seg_->entry_header_size() < read_up_to_) {
+    s = seg_->ReadEntryHeaderAndBatch(
+        &offset_, &tmp_buf_, &current_batch, &s_detail);
+  } else {
+    s = Status::Corruption(
+        Substitute("Truncated log entry at offset $0", offset_));
+  }
+
+  if (PREDICT_FALSE(!s.ok())) {
+    return HandleReadError(s, s_detail);
+  }
+
+  num_batches_read_++;
+  for (const LogEntryPB& entry : current_batch->entry()) {
+    // Record it in the 'recent entries' deque.
+    OpId op_id;
+    if (entry.type() == log::REPLICATE && entry.has_replicate()) {
+      op_id = entry.replicate().id();
+    } else if (entry.has_commit() && entry.commit().has_commited_op_id()) {
+      op_id = entry.commit().commited_op_id();
+    }
+    RecordEntry(entry.type(), op_id);
+  }
+  *batch = std::move(current_batch);
+  *batch_offset = start;
+  return Status::OK();
+}
+
+Status LogEntryReader::ReadNextBatchHeaders(
+    vector<LogEntryHeaderView>* entries,
+    int64_t* batch_offset) {
+  DCHECK(pending_entries_.empty());
+  RETURN_NOT_OK(CheckForEndOfEntries());
+
+  const int64_t start = offset_;
+  int64_t cur_offset = offset_;
+  Slice batch_data;
+  Status s;
+  EntryHeaderStatus s_detail = EntryHeaderStatus::OTHER_ERROR;
+  if (offset_ + seg_->entry_header_size() < read_up_to_) {
+    s = seg_->ReadEntryHeaderAndBatchData(
+        &cur_offset, &tmp_buf_, &batch_data, &s_detail);
+    if (s.ok()) {
+      s = DecodeEntryBatchHeaders(batch_data, entries);
+      if (PREDICT_FALSE(!s.ok())) {
+        s_detail = EntryHeaderStatus::OTHER_ERROR;
+      }
+    }
+  } else {
+    s = Status::Corruption(
+        Substitute("Truncated log entry at offset $0", offset_));
+  }
+
+  if (PREDICT_FALSE(!s.ok())) {
+    return HandleReadError(s, s_detail);
+  }
+  offset_ = cur_offset;
+
+  num_batches_read_++;
+  for (const LogEntryHeaderView& entry : *entries) {
+    // Commits aren't decoded, so they are recorded without their op.
+    RecordEntry(
+        entry.type,
+        entry.type == log::REPLICATE && entry.has_replicate
+            ? entry.replicate.id
+            : OpId());
+  }
+  *batch_offset = start;
+  return Status::OK();
+}
+
 Status LogEntryReader::HandleReadError(
     const Status& s,
     EntryHeaderStatus status_detail) const {
@@ -285,6 +527,77 @@ Status LogEntryReader::MakeCorruptionStatus(const Status& status) const {
   return status.CloneAndAppend(err);
 }
 
+////////////////////////////////////////////////////////////
+// SegmentSparseIndex
+////////////////////////////////////////////////////////////
+
+SegmentSparseIndex::SegmentSparseIndex(int interval)
+    : interval_(std::max(interval, 1)),
+      num_batches_(0),
+      last_index_(0),
+      sequential_(true) {}
+
+void SegmentSparseIndex::AddBatch(
+    int64_t first_index,
+    int64_t last_index,
+    int64_t offset) {
+  DCHECK_LE(first_index, last_index);
+  if (first_index <= last_index_) {
+    sequential_ = false;
+  }
+  last_index_ = last_index;
+  if (num_batches_++ % interval_ == 0) {
+    samples_.emplace_back(first_index, offset);
+  }
+}
+
+bool SegmentSparseIndex::FindOffset(int64_t index, int64_t* offset) const {
+  auto it = std::upper_bound(
+      samples_.begin(),
+      samples_.end(),
+      std::make_pair(index, std::numeric_limits<int64_t>::max()));
+  if (it == samples_.begin()) {
+    return false;
+  }
+  *offset = std::prev(it)->second;
+  return true;
+}
+
+void SegmentSparseIndex::ToFooter(LogSegmentFooterPB* footer) const {
+  footer->clear_batch_offsets();
+  if (!sequential_) {
+    return;
+  }
+  footer->mutable_batch_offsets()->Reserve(samples_.size());
+  for (const auto& sample : samples_) {
+    auto* batch_offset = footer->add_batch_offsets();
+    batch_offset->set_first_index(sample.first);
+    batch_offset->set_offset(sample.second);
+  }
+}
+
+shared_ptr<const SegmentSparseIndex> SegmentSparseIndex::FromFooter(
+    const LogSegmentFooterPB& footer) {
+  if (footer.batch_offsets_size() == 0) {
+    return nullptr;
+  }
+  // The interval doesn't matter once the index is built.
+  shared_ptr<SegmentSparseIndex> index(new SegmentSparseIndex(1));
+  index->samples_.reserve(footer.batch_offsets_size());
+  for (const auto& batch_offset : footer.batch_offsets()) {
+    // Don't trust a footer whose batches are out of order.
+    if (!index->samples_.empty() &&
+        batch_offset.first_index() <= index->samples_.back().first) {
+      return nullptr;
+    }
+    index->samples_.emplace_back(
+        batch_offset.first_index(), batch_offset.offset());
+  }
+  index->num_batches_ = footer.batch_offsets_size();
+  index->last_index_ = index->samples_.back().first;
+  return index;
+}
+
 ////////////////////////////////////////////////////////////
 // ReadableLogSegment
 ////////////////////////////////////////////////////////////
@@ -296,7 +609,7 @@ Status ReadableLogSegment::Open(
   VLOG(1) << "Parsing wal segment: " << path;
   shared_ptr<RandomAccessFile> readable_file;
   RETURN_NOT_OK_PREPEND(
-      env_util::OpenFileForRandom(env, path, &readable_file),
+      OpenSegmentFileForRandom(env, path, &readable_file),
       "Unable to open file for reading");
 
   segment->reset(new ReadableLogSegment(path, readable_file));
@@ -312,8 +625,59 @@ ReadableLogSegment::ReadableLogSegment(
       readable_to_offset_(0),
       readable_file_(std::move(readable_file)),
       codec_(nullptr),
+      raw_batches_(false),
       is_initialized_(false),
-      footer_was_rebuilt_(false) {}
+      footer_was_rebuilt_(false),
+      readahead_enabled_(false),
+      readahead_offset_(0),
+      cold_readahead_to_(0) {}
+
+ReadableLogSegment::~ReadableLogSegment() {
+  if (mapped_) {
+    munmap(const_cast<uint8_t*>(mapped_), mapped_size_);
+  }
+}
+
+const uint8_t* ReadableLogSegment::MappedData() {
+  if (!FLAGS_log_mmap_closed_segments || !HasFooter()) {
+    return nullptr;
+  }
+  std::call_once(map_once_, [this]() { MapFile(); });
+  return mapped_;
+}
+
+void ReadableLogSegment::MapFile() {
+  const int64_t size = file_size();
+  if (size == 0) {
+    return;
+  }
+  const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    KLOG_EVERY_N_SECS(WARNING, 60) << "Could not open " << path_
+                                   << " to map it: " << ErrnoToString(errno);
+    return;
+  }
+  SCOPED_CLEANUP({ close(fd); });
+  // The path may have been reused since the segment was opened, e.g. by a
+  // recycled segment: only map the file if it still looks like this one.
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != size) {
+    return;
+  }
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Could not map " << path_ << ": " << ErrnoToString(errno);
+    return;
+  }
+  // Reads of closed segments mostly scan them front to back.
+  if (madvise(addr, size, MADV_SEQUENTIAL) != 0) {
+    VLOG(1) << "Could not advise on the mapping of " << path_ << ": "
+            << ErrnoToString(errno);
+  }
+  mapped_ = static_cast<const uint8_t*>(addr);
+  mapped_size_ = size;
+}
 
 Status ReadableLogSegment::Init(
     const LogSegmentHeaderPB& header,
@@ -374,6 +738,8 @@ Status ReadableLogSegment::Init() {
                    << s.ToString();
       return s;
     }
+  } else {
+    sparse_index_ = SegmentSparseIndex::FromFooter(footer_);
   }
 
   is_initialized_ = true;
@@ -391,6 +757,11 @@ Status ReadableLogSegment::InitCompressionCodec() {
         CompressionCodecManager::GetCodec(header_.compression_codec(), &codec_),
         "could not init compression codec");
   }
+  for (int feature : header_.incompatible_features()) {
+    if (feature == LogSegmentHeaderPB::RAW_BATCHES) {
+      raw_batches_ = true;
+    }
+  }
   return Status::OK();
 }
 
@@ -403,28 +774,45 @@ void ReadableLogSegment::UpdateReadableToOffset(int64_t readable_to_offset) {
   file_size_.StoreMax(readable_to_offset);
 }
 
+void ReadableLogSegment::EnableReadahead() {
+  readahead_enabled_ = FLAGS_log_recovery_readahead_bytes > 0;
+}
+
 Status ReadableLogSegment::RebuildFooterByScanning() {
   TRACE_EVENT1(
       "log", "ReadableLogSegment::RebuildFooterByScanning", "path", path_);
 
   DCHECK(!footer_.IsInitialized());
 
+  // The scan reads the segment front to back, so serve the small per-entry
+  // reads from a large sequential readahead buffer rather than issuing two
+  // preads per entry.
+  readahead_enabled_ = FLAGS_log_recovery_readahead_bytes > 0;
+  auto disable_readahead = MakeScopedCleanup([this]() {
+    readahead_enabled_ = false;
+    readahead_buf_.clear();
+    readahead_buf_.shrink_to_fit();
+  });
+
   LogEntryReader reader(this);
 
+  // Only the ops' indexes are needed, so the entries aren't parsed.
   LogSegmentFooterPB new_footer;
   int num_entries = 0;
+  vector<LogEntryHeaderView> entries;
   while (true) {
-    unique_ptr<LogEntryPB> entry;
-    Status s = reader.ReadNextEntry(&entry);
+    int64_t unused_batch_offset;
+    Status s = reader.ReadNextBatchHeaders(&entries, &unused_batch_offset);
     if (s.IsEndOfFile())
       break;
     RETURN_NOT_OK(s);
 
-    DCHECK(entry);
-    if (entry->has_replicate()) {
-      UpdateFooterForReplicateEntry(*entry, &new_footer);
+    for (const LogEntryHeaderView& entry : entries) {
+      if (entry.has_replicate) {
+        UpdateFooterForReplicateIndex(entry.replicate.id.index(), &new_footer);
+      }
+      num_entries++;
     }
-    num_entries++;
   }
 
   new_footer.set_num_entries(num_entries);
@@ -438,6 +826,78 @@ Status ReadableLogSegment::RebuildFooterByScanning() {
   return Status::OK();
 }
 
+Status ReadableLogSegment::ReadAt(int64_t offset, Slice result) {
+  const uint8_t* mapped = MappedData();
+  if (mapped && offset >= 0 &&
+      offset + static_cast<int64_t>(result.size()) <= mapped_size_) {
+    memcpy(result.mutable_data(), mapped + offset, result.size());
+    return Status::OK();
+  }
+  if (!readahead_enabled_) {
+    return readable_file()->Read(offset, result);
+  }
+  const int64_t end = offset + result.size();
+  if (offset < readahead_offset_ ||
+      end > readahead_offset_ + static_cast<int64_t>(readahead_buf_.size())) {
+    int64_t len = std::min<int64_t>(
+        std::max<int64_t>(FLAGS_log_recovery_readahead_bytes, result.size()),
+        file_size() - offset);
+    if (len < static_cast<int64_t>(result.size())) {
+      // The read extends past the end of the file; let the file report it.
+      return readable_file()->Read(offset, result);
+    }
+    readahead_buf_.resize(len);
+    Slice window(readahead_buf_.data(), len);
+    Status s = readable_file()->Read(offset, window);
+    if (!s.ok()) {
+      readahead_buf_.clear();
+      return s;
+    }
+    readahead_offset_ = offset;
+  }
+  memcpy(
+      result.mutable_data(),
+      readahead_buf_.data() + (offset - readahead_offset_),
+      result.size());
+  return Status::OK();
+}
+
+void ReadableLogSegment::AdviseColdRead(int64_t start, int64_t end) {
+  if (!FLAGS_log_cold_reads_drop_cache) {
+    return;
+  }
+  DCHECK(HasFooter());
+  const int64_t window = FLAGS_log_cold_read_readahead_bytes;
+  if (window > 0) {
+    // Read the next window ahead once the reader is halfway through the
+    // last one, or has moved outside of it, e.g. when another peer reads.
+    const int64_t ahead_to = cold_readahead_to_.Load();
+    const bool behind = end + window < ahead_to;
+    if (behind || end + window / 2 > ahead_to) {
+      const int64_t from = behind ? end : std::max(end, ahead_to);
+      const int64_t to = std::min(end + window, file_size());
+      if (to > from && cold_readahead_to_.CompareAndSet(ahead_to, to)) {
+        Status s = readable_file()->Advise(
+            from, to - from, RandomAccessFile::WILL_NEED);
+        if (PREDICT_FALSE(!s.ok())) {
+          KLOG_EVERY_N_SECS(WARNING, 60)
+              << "Could not read ahead " << path_ << ": " << s.ToString();
+        }
+      }
+    }
+  }
+  // The kernel only drops whole pages, so start with the page 'start' is in,
+  // which entries read before this one ended in.
+  const int64_t page_start = start & ~static_cast<int64_t>(4095);
+  Status s = readable_file()->Advise(
+      page_start, end - page_start, RandomAccessFile::DONT_NEED);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << "Could not drop " << path_ << " from the page cache: "
+        << s.ToString();
+  }
+}
+
 Status ReadableLogSegment::ReadFileSize() {
   // Check the size of the file.
   // Env uses uint here, even though we generally prefer signed ints to avoid
@@ -478,10 +938,12 @@ Status ReadableLogSegment::ReadHeader() {
       pb_util::ParseFromArray(&header, header_slice.data(), header_size),
       "Unable to parse protobuf");
 
-  if (header.incompatible_features_size() > 0) {
-    return Status::NotSupported(
-        "log segment uses a feature not supported by this version "
-        "of Kudu");
+  for (int feature : header.incompatible_features()) {
+    if (feature != LogSegmentHeaderPB::RAW_BATCHES) {
+      return Status::NotSupported(
+          "log segment uses a feature not supported by this version "
+          "of Kudu");
+    }
   }
 
   header_.Swap(&header);
@@ -698,6 +1160,23 @@ Status ReadableLogSegment::ReadEntryHeaderAndBatch(
   return Status::OK();
 }
 
+Status ReadableLogSegment::ReadEntryHeaderAndBatchData(
+    int64_t* offset,
+    faststring* tmp_buf,
+    Slice* batch_data,
+    EntryHeaderStatus* status_detail) {
+  int64_t cur_offset = *offset;
+  EntryHeader header;
+  RETURN_NOT_OK(ReadEntryHeader(&cur_offset, &header, status_detail));
+  Status s = ReadEntryBatchData(&cur_offset, header, tmp_buf, batch_data);
+  if (PREDICT_FALSE(!s.ok())) {
+    *status_detail = EntryHeaderStatus::OTHER_ERROR;
+    return s;
+  }
+  *offset = cur_offset;
+  return Status::OK();
+}
+
 Status ReadableLogSegment::ReadEntryHeader(
     int64_t* offset,
     EntryHeader* header,
@@ -706,7 +1185,7 @@ Status ReadableLogSegment::ReadEntryHeader(
   uint8_t scratch[header_size];
   Slice slice(scratch, header_size);
   RETURN_NOT_OK_PREPEND(
-      readable_file()->Read(*offset, slice), "Could not read log entry header");
+      ReadAt(*offset, slice), "Could not read log entry header");
 
   *status_detail = DecodeEntryHeader(slice, header);
   switch (*status_detail) {
@@ -735,10 +1214,15 @@ EntryHeaderStatus ReadableLogSegment::DecodeEntryHeader(
     header->msg_crc = DecodeFixed32(&data[8]);
     header->header_crc = DecodeFixed32(&data[12]);
     computed_header_crc = crc::Crc32c(&data[0], 12);
+    header->raw = raw_batches_ && (header->msg_length & kRawBatchFlag);
+    if (header->raw) {
+      header->msg_length &= ~kRawBatchFlag;
+    }
   } else {
     DCHECK_EQ(kEntryHeaderSizeV1, data.size());
     header->msg_length = DecodeFixed32(&data[0]);
     header->msg_length_compressed = header->msg_length;
+    header->raw = false;
     header->msg_crc = DecodeFixed32(&data[4]);
     header->header_crc = DecodeFixed32(&data[8]);
     computed_header_crc = crc::Crc32c(&data[0], 8);
@@ -759,9 +1243,33 @@ Status ReadableLogSegment::ReadEntryBatch(
     const EntryHeader& header,
     faststring* tmp_buf,
     unique_ptr<LogEntryBatchPB>* entry_batch) {
+  int64_t cur_offset = *offset;
+  Slice entry_batch_slice;
+  RETURN_NOT_OK(
+      ReadEntryBatchData(&cur_offset, header, tmp_buf, &entry_batch_slice));
+
+  unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
+  Status s = pb_util::ParseFromArray(
+      read_entry_batch.get(), entry_batch_slice.data(), header.msg_length);
+
+  if (!s.ok()) {
+    return Status::Corruption(
+        Substitute("Could not parse PB. Cause: $0", s.ToString()));
+  }
+
+  *offset = cur_offset;
+  entry_batch->reset(read_entry_batch.release());
+  return Status::OK();
+}
+
+Status ReadableLogSegment::ReadEntryBatchData(
+    int64_t* offset,
+    const EntryHeader& header,
+    faststring* tmp_buf,
+    Slice* batch_data) {
   TRACE_EVENT2(
       "log",
-      "ReadableLogSegment::ReadEntryBatch",
+      "ReadableLogSegment::ReadEntryBatchData",
       "path",
       path_,
       "range",
@@ -783,18 +1291,29 @@ Status ReadableLogSegment::ReadEntryBatch(
   }
 
   tmp_buf->clear();
-  size_t buf_len = header.msg_length_compressed;
-  if (codec_) {
-    // Reserve some space for the decompressed copy as well.
-    buf_len += header.msg_length;
-  }
-  tmp_buf->resize(buf_len);
-  Slice entry_batch_slice(tmp_buf->data(), header.msg_length_compressed);
-  Status s = readable_file()->Read(*offset, entry_batch_slice);
+  const bool compressed = codec_ && !header.raw;
+  Slice entry_batch_slice;
+  const uint8_t* mapped = MappedData();
+  if (mapped && *offset + header.msg_length_compressed <= mapped_size_) {
+    // Closed segments don't change, so the batch is used where it's mapped.
+    entry_batch_slice = Slice(mapped + *offset, header.msg_length_compressed);
+    if (compressed) {
+      tmp_buf->resize(header.msg_length);
+    }
+  } else {
+    size_t buf_len = header.msg_length_compressed;
+    if (compressed) {
+      // Reserve some space for the decompressed copy as well.
+      buf_len += header.msg_length;
+    }
+    tmp_buf->resize(buf_len);
+    entry_batch_slice = Slice(tmp_buf->data(), header.msg_length_compressed);
+    Status s = ReadAt(*offset, entry_batch_slice);
 
-  if (!s.ok())
-    return Status::IOError(
-        Substitute("Could not read entry. Cause: $0", s.ToString()));
+    if (!s.ok())
+      return Status::IOError(
+          Substitute("Could not read entry. Cause: $0", s.ToString()));
+  }
 
   // Verify the CRC.
   uint32_t read_crc =
@@ -810,9 +1329,10 @@ Status ReadableLogSegment::ReadEntryBatch(
   }
 
   // If it was compressed, decompress it.
-  if (codec_) {
+  if (compressed) {
     // We pre-reserved space for the decompression up above.
-    uint8_t* uncompress_buf = &(*tmp_buf)[header.msg_length_compressed];
+    uint8_t* uncompress_buf =
+        tmp_buf->data() + tmp_buf->size() - header.msg_length;
     RETURN_NOT_OK_PREPEND(
         codec_->Uncompress(
             entry_batch_slice, uncompress_buf, header.msg_length),
@@ -820,20 +1340,31 @@ Status ReadableLogSegment::ReadEntryBatch(
     entry_batch_slice = Slice(uncompress_buf, header.msg_length);
   }
 
-  unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
-  s = pb_util::ParseFromArray(
-      read_entry_batch.get(), entry_batch_slice.data(), header.msg_length);
-
-  if (!s.ok()) {
-    return Status::Corruption(
-        Substitute("Could not parse PB. Cause: $0", s.ToString()));
-  }
-
   *offset += header.msg_length_compressed;
-  entry_batch->reset(read_entry_batch.release());
+  *batch_data = entry_batch_slice;
   return Status::OK();
 }
 
+namespace {
+
+// Returns true if every entry of 'batch' is a REPLICATE whose write payload
+// is compressed already, so that compressing the batch again gains little.
+bool HoldsOnlyCompressedPayloads(const LogEntryBatchPB& batch) {
+  if (batch.entry_size() == 0) {
+    return false;
+  }
+  for (const LogEntryPB& entry : batch.entry()) {
+    if (!entry.has_replicate() ||
+        entry.replicate().write_payload().compression_codec() ==
+            NO_COMPRESSION) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // anonymous namespace
+
 WritableLogSegment::WritableLogSegment(
     string path,
     shared_ptr<WritableFile> writable_file)
@@ -841,6 +1372,7 @@ WritableLogSegment::WritableLogSegment(
       writable_file_(std::move(writable_file)),
       is_header_written_(false),
       is_footer_written_(false),
+      raw_batches_(false),
       written_offset_(0) {}
 
 Status WritableLogSegment::WriteHeaderAndOpen(
@@ -861,6 +1393,11 @@ Status WritableLogSegment::WriteHeaderAndOpen(
   RETURN_NOT_OK(writable_file()->Append(Slice(buf)));
 
   header_.CopyFrom(new_header);
+  for (int feature : header_.incompatible_features()) {
+    if (feature == LogSegmentHeaderPB::RAW_BATCHES) {
+      raw_batches_ = true;
+    }
+  }
   first_entry_offset_ = buf.size();
   written_offset_ = first_entry_offset_;
   is_header_written_ = true;
@@ -875,6 +1412,8 @@ Status WritableLogSegment::WriteFooterAndClose(
   DCHECK(!IsFooterWritten());
   DCHECK(footer.IsInitialized()) << footer.InitializationErrorString();
 
+  RETURN_NOT_OK(FlushBufferedEntryBatches());
+
   faststring buf;
   pb_util::AppendToString(footer, &buf);
   buf.append(kLogSegmentFooterMagicString);
@@ -893,40 +1432,80 @@ Status WritableLogSegment::WriteFooterAndClose(
   return Status::OK();
 }
 
-Status WritableLogSegment::WriteEntryBatch(
-    const Slice& data,
+Status WritableLogSegment::BufferEntryBatch(
+    const LogEntryBatchPB& entry_batch_pb,
     const std::shared_ptr<CompressionCodec>& codec) {
   DCHECK(is_header_written_);
   DCHECK(!is_footer_written_);
-  uint8_t header_buf[kEntryHeaderSizeV2];
-
-  const uint32_t uncompressed_len = data.size();
 
-  // If necessary, compress the data.
-  Slice data_to_write;
-  if (codec) {
+  // Reserve room for the header; it is filled in once the length and CRC of
+  // the data following it are known.
+  const size_t header_offset = write_buf_.size();
+  write_buf_.resize(header_offset + kEntryHeaderSizeV2);
+  // On failure, drop the partial entry so that the next flush doesn't write
+  // it out.
+  auto drop_entry =
+      MakeScopedCleanup([&]() { write_buf_.resize(header_offset); });
+
+  uint32_t uncompressed_len;
+  uint32_t raw_flag = 0;
+  if (codec && raw_batches_ && HoldsOnlyCompressedPayloads(entry_batch_pb)) {
+    pb_util::AppendToString(entry_batch_pb, &write_buf_);
+    uncompressed_len = write_buf_.size() - header_offset - kEntryHeaderSizeV2;
+    DCHECK_EQ(uncompressed_len & kRawBatchFlag, 0);
+    raw_flag = kRawBatchFlag;
+  } else if (codec) {
     DCHECK_NE(header_.compression_codec(), NO_COMPRESSION);
-    compress_buf_.resize(codec->MaxCompressedLength(uncompressed_len));
+    serialize_buf_.clear();
+    pb_util::AppendToString(entry_batch_pb, &serialize_buf_);
+    uncompressed_len = serialize_buf_.size();
+    write_buf_.resize(
+        header_offset + kEntryHeaderSizeV2 +
+        codec->MaxCompressedLength(uncompressed_len));
     size_t compressed_len;
-    RETURN_NOT_OK(codec->Compress(data, &compress_buf_[0], &compressed_len));
-    compress_buf_.resize(compressed_len);
-    data_to_write = Slice(compress_buf_.data(), compress_buf_.size());
+    RETURN_NOT_OK(codec->Compress(
+        Slice(serialize_buf_),
+        &write_buf_[header_offset + kEntryHeaderSizeV2],
+        &compressed_len));
+    write_buf_.resize(header_offset + kEntryHeaderSizeV2 + compressed_len);
   } else {
-    data_to_write = data;
+    pb_util::AppendToString(entry_batch_pb, &write_buf_);
+    uncompressed_len = write_buf_.size() - header_offset - kEntryHeaderSizeV2;
   }
 
   // Fill in the header.
-  InlineEncodeFixed32(&header_buf[0], data_to_write.size());
-  InlineEncodeFixed32(&header_buf[4], uncompressed_len);
+  uint8_t* header_buf = &write_buf_[header_offset];
+  const uint8_t* data = header_buf + kEntryHeaderSizeV2;
+  const uint32_t data_len =
+      write_buf_.size() - header_offset - kEntryHeaderSizeV2;
+  InlineEncodeFixed32(&header_buf[0], data_len);
+  InlineEncodeFixed32(&header_buf[4], uncompressed_len | raw_flag);
+  InlineEncodeFixed32(&header_buf[8], crc::Crc32c(data, data_len));
   InlineEncodeFixed32(
-      &header_buf[8], crc::Crc32c(data_to_write.data(), data_to_write.size()));
-  InlineEncodeFixed32(
-      &header_buf[12], crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4));
+      &header_buf[12], crc::Crc32c(header_buf, kEntryHeaderSizeV2 - 4));
+  drop_entry.cancel();
+  return Status::OK();
+}
 
-  // Write the header to the file, followed by the batch data itself.
-  Slice slices[2] = {Slice(header_buf, arraysize(header_buf)), data_to_write};
-  RETURN_NOT_OK(writable_file_->AppendV(slices));
-  written_offset_ += arraysize(header_buf) + data_to_write.size();
+Status WritableLogSegment::FlushBufferedEntryBatches() {
+  if (write_buf_.size() == 0) {
+    return Status::OK();
+  }
+  Status s = writable_file_->Append(Slice(write_buf_));
+  if (PREDICT_FALSE(!s.ok())) {
+    // The batches are lost; their appends fail with 's'.
+    write_buf_.clear();
+    return s;
+  }
+  written_offset_ += write_buf_.size();
+  // Keep the buffer's capacity around for the next group, unless a very large
+  // group blew it up.
+  if (write_buf_.capacity() > kMaxRetainedWriteBufferCapacity) {
+    write_buf_.clear();
+    write_buf_.shrink_to_fit();
+  } else {
+    write_buf_.clear();
+  }
   return Status::OK();
 }
 
@@ -937,11 +1516,152 @@ unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
   for (const auto& msg : msgs) {
     LogEntryPB* entry_pb = entry_batch->add_entry();
     entry_pb->set_type(log::REPLICATE);
-    entry_pb->set_allocated_replicate(msg->get());
+    // The unsafe variant, because 'msg' may live on an arena (e.g. that of
+    // the request it arrived in), which set_allocated_replicate() would copy
+    // out of. ~LogEntryBatch() releases it again.
+    entry_pb->unsafe_arena_set_allocated_replicate(msg->get());
   }
   return entry_batch;
 }
 
+namespace {
+
+FileCache<RandomAccessFile>* SegmentFileCache(Env* env) {
+  // The cache opens files with the default env; segments of other envs
+  // (e.g. in-memory ones in tests) are opened directly.
+  if (FLAGS_log_segment_file_cache_capacity <= 0 || env != Env::Default()) {
+    return nullptr;
+  }
+  static FileCache<RandomAccessFile>* cache = []() {
+    auto* c = new FileCache<RandomAccessFile>(
+        "log-segments",
+        Env::Default(),
+        FLAGS_log_segment_file_cache_capacity,
+        /*entity=*/nullptr);
+    CHECK_OK(c->Init());
+    return c;
+  }();
+  return cache;
+}
+
+} // anonymous namespace
+
+Status OpenSegmentFileForRandom(
+    Env* env,
+    const string& path,
+    shared_ptr<RandomAccessFile>* file) {
+  FileCache<RandomAccessFile>* cache = SegmentFileCache(env);
+  if (cache) {
+    return cache->OpenExistingFile(path, file);
+  }
+  return env_util::OpenFileForRandom(env, path, file);
+}
+
+Status DeleteSegmentFile(Env* env, const string& path) {
+  FileCache<RandomAccessFile>* cache = SegmentFileCache(env);
+  if (cache) {
+    return cache->DeleteFile(path);
+  }
+  return env->DeleteFile(path);
+}
+
+bool SegmentFileCacheEnabled(Env* env) {
+  return SegmentFileCache(env) != nullptr;
+}
+
+namespace {
+
+// A single thread, so that deletions don't compete with each other either.
+ThreadPool* SegmentDeletionPool() {
+  static ThreadPool* pool = []() {
+    unique_ptr<ThreadPool> ret;
+    CHECK_OK(ThreadPoolBuilder("log-segment-deletion")
+                 .set_max_threads(1)
+                 .Build(&ret));
+    return ret.release();
+  }();
+  return pool;
+}
+
+// Lowers the I/O priority of the calling thread to the idle class, so that
+// its I/O is only served when the disk has nothing else to do.
+void SetIdleIOPriority() {
+#if defined(__linux__)
+  // From linux/ioprio.h, which glibc doesn't wrap. IOPRIO_WHO_PROCESS with a
+  // zero id is the calling thread.
+  constexpr int kIoprioWhoProcess = 1;
+  constexpr int kIoprioClassIdle = 3;
+  constexpr int kIoprioClassShift = 13;
+  if (syscall(
+          SYS_ioprio_set,
+          kIoprioWhoProcess,
+          0,
+          kIoprioClassIdle << kIoprioClassShift) != 0) {
+    KLOG_EVERY_N_SECS(WARNING, 600)
+        << "Could not lower the I/O priority of log segment deletion: "
+        << ErrnoToString(errno);
+  }
+#endif
+}
+
+Status TruncateAndDeleteFile(
+    Env* env,
+    const string& path,
+    int64_t size,
+    bool may_truncate) {
+  const int64_t piece = FLAGS_log_segment_deletion_truncate_bytes;
+  // Truncating a segment still mapped by a reader would fault the reader.
+  if (may_truncate && piece > 0 && size > piece &&
+      !FLAGS_log_mmap_closed_segments) {
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    unique_ptr<RWFile> file;
+    RETURN_NOT_OK(env->NewRWFile(opts, path, &file));
+    for (int64_t len = size - piece; len > 0; len -= piece) {
+      RETURN_NOT_OK(file->Truncate(len));
+    }
+    RETURN_NOT_OK(file->Close());
+  }
+  return env->DeleteFile(path);
+}
+
+} // anonymous namespace
+
+Status DeleteSegmentFileInBackground(
+    Env* env,
+    const string& path,
+    scoped_refptr<AtomicGauge<int64_t>> pending_bytes,
+    bool may_truncate) {
+  DCHECK(!SegmentFileCacheEnabled(env));
+  const string deleting_path = JoinPathSegments(
+      DirName(path), Substitute("$0.deleting-$1", kTmpInfix, BaseName(path)));
+  RETURN_NOT_OK(env->RenameFile(path, deleting_path));
+  uint64_t size = 0;
+  WARN_NOT_OK(
+      env->GetFileSize(deleting_path, &size),
+      "Unable to get the size of " + deleting_path);
+  if (pending_bytes) {
+    pending_bytes->IncrementBy(size);
+  }
+  auto task = [env, deleting_path, size, pending_bytes, may_truncate]() {
+    WARN_NOT_OK(
+        TruncateAndDeleteFile(env, deleting_path, size, may_truncate),
+        "Unable to delete log segment " + deleting_path);
+    if (pending_bytes) {
+      pending_bytes->IncrementBy(-static_cast<int64_t>(size));
+    }
+  };
+  Status s = SegmentDeletionPool()->SubmitFunc([task]() {
+    SetIdleIOPriority();
+    ScopedIOClass io_class(IOClass::kMaintenance);
+    task();
+  });
+  if (PREDICT_FALSE(!s.ok())) {
+    task();
+  }
+  return Status::OK();
+}
+
 bool IsLogFileName(const string& fname) {
   if (HasPrefixString(fname, ".")) {
     // Hidden file or ./..
@@ -958,11 +1678,168 @@ bool IsLogFileName(const string& fname) {
   return true;
 }
 
+namespace {
+
+// Reads the length-delimited field whose 'tag' was just read from 'in',
+// which is reading 'buf', and points '*field' at its contents within 'buf'.
+bool ReadLengthDelimitedField(
+    uint32_t tag,
+    const Slice& buf,
+    CodedInputStream* in,
+    Slice* field) {
+  uint32_t len;
+  if (WireFormatLite::GetTagWireType(tag) !=
+          WireFormatLite::WIRETYPE_LENGTH_DELIMITED ||
+      !in->ReadVarint32(&len)) {
+    return false;
+  }
+  const int pos = in->CurrentPosition();
+  if (!in->Skip(len)) {
+    return false;
+  }
+  *field = Slice(buf.data() + pos, len);
+  return true;
+}
+
+// Points '*payload' at the WritePayloadPB::payload of the serialized
+// WritePayloadPB in 'data', if it has one.
+bool FindPayload(const Slice& data, Slice* payload) {
+  CodedInputStream in(data.data(), data.size());
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    if (WireFormatLite::GetTagFieldNumber(tag) ==
+        WritePayloadPB::kPayloadFieldNumber) {
+      if (!ReadLengthDelimitedField(tag, data, &in, payload)) {
+        return false;
+      }
+    } else if (!WireFormatLite::SkipField(&in, tag)) {
+      return false;
+    }
+  }
+  return in.ConsumedEntireMessage();
+}
+
+} // anonymous namespace
+
+bool DecodeReplicateHeader(const Slice& data, ReplicateHeaderView* header) {
+  *header = ReplicateHeaderView();
+  bool found_id = false;
+  CodedInputStream in(data.data(), data.size());
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    Slice field;
+    switch (WireFormatLite::GetTagFieldNumber(tag)) {
+      case ReplicateMsg::kIdFieldNumber:
+        if (!ReadLengthDelimitedField(tag, data, &in, &field) ||
+            !header->id.ParseFromArray(field.data(), field.size())) {
+          return false;
+        }
+        found_id = true;
+        break;
+      case ReplicateMsg::kTimestampFieldNumber:
+        if (WireFormatLite::GetTagWireType(tag) !=
+                WireFormatLite::WIRETYPE_FIXED64 ||
+            !in.ReadLittleEndian64(&header->timestamp)) {
+          return false;
+        }
+        break;
+      case ReplicateMsg::kOpTypeFieldNumber: {
+        uint32_t op_type;
+        if (WireFormatLite::GetTagWireType(tag) !=
+                WireFormatLite::WIRETYPE_VARINT ||
+            !in.ReadVarint32(&op_type)) {
+          return false;
+        }
+        if (OperationType_IsValid(op_type)) {
+          header->op_type = static_cast<OperationType>(op_type);
+        }
+        break;
+      }
+      case ReplicateMsg::kWritePayloadFieldNumber:
+        if (!ReadLengthDelimitedField(tag, data, &in, &field) ||
+            !FindPayload(field, &header->payload)) {
+          return false;
+        }
+        break;
+      default:
+        if (!WireFormatLite::SkipField(&in, tag)) {
+          return false;
+        }
+    }
+  }
+  return in.ConsumedEntireMessage() && found_id;
+}
+
+Status DecodeEntryBatchHeaders(
+    const Slice& batch_data,
+    vector<LogEntryHeaderView>* entries) {
+  const Status corruption = Status::Corruption("Could not parse entry batch");
+  entries->clear();
+  CodedInputStream batch_in(batch_data.data(), batch_data.size());
+  uint32_t tag;
+  while ((tag = batch_in.ReadTag()) != 0) {
+    if (WireFormatLite::GetTagFieldNumber(tag) !=
+        LogEntryBatchPB::kEntryFieldNumber) {
+      if (!WireFormatLite::SkipField(&batch_in, tag)) {
+        return corruption;
+      }
+      continue;
+    }
+    Slice entry_data;
+    if (!ReadLengthDelimitedField(tag, batch_data, &batch_in, &entry_data)) {
+      return corruption;
+    }
+
+    entries->emplace_back();
+    LogEntryHeaderView* entry = &entries->back();
+    bool found_type = false;
+    CodedInputStream entry_in(entry_data.data(), entry_data.size());
+    while ((tag = entry_in.ReadTag()) != 0) {
+      switch (WireFormatLite::GetTagFieldNumber(tag)) {
+        case LogEntryPB::kTypeFieldNumber: {
+          uint32_t type;
+          if (WireFormatLite::GetTagWireType(tag) !=
+                  WireFormatLite::WIRETYPE_VARINT ||
+              !entry_in.ReadVarint32(&type) || !LogEntryTypePB_IsValid(type)) {
+            return corruption;
+          }
+          entry->type = static_cast<LogEntryTypePB>(type);
+          found_type = true;
+          break;
+        }
+        case LogEntryPB::kReplicateFieldNumber:
+          if (!ReadLengthDelimitedField(
+                  tag, entry_data, &entry_in, &entry->replicate_data) ||
+              !DecodeReplicateHeader(
+                  entry->replicate_data, &entry->replicate)) {
+            return corruption;
+          }
+          entry->has_replicate = true;
+          break;
+        default:
+          if (!WireFormatLite::SkipField(&entry_in, tag)) {
+            return corruption;
+          }
+      }
+    }
+    if (!entry_in.ConsumedEntireMessage() || !found_type) {
+      return corruption;
+    }
+  }
+  if (!batch_in.ConsumedEntireMessage()) {
+    return corruption;
+  }
+  return Status::OK();
+}
+
 void UpdateFooterForReplicateEntry(
     const LogEntryPB& entry_pb,
     LogSegmentFooterPB* footer) {
   DCHECK(entry_pb.has_replicate());
-  int64_t index = entry_pb.replicate().id().index();
+  UpdateFooterForReplicateIndex(entry_pb.replicate().id().index(), footer);
+}
+
+void UpdateFooterForReplicateIndex(int64_t index, LogSegmentFooterPB* footer) {
   if (!footer->has_min_replicate_index() ||
       index < footer->min_replicate_index()) {
     footer->set_min_replicate_index(index);
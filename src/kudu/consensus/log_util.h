@@ -21,13 +21,16 @@
 #include <cstdint>
 #include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest_prod.h>
 
+#include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/ref_counted_replicate.h"
@@ -44,8 +47,14 @@ DECLARE_bool(log_force_fsync_all);
 
 namespace kudu {
 
+template <typename T>
+class AtomicGauge;
 class CompressionCodec;
 
+namespace consensus {
+class StartupProfile;
+} // namespace consensus
+
 namespace log {
 
 class LogFactory;
@@ -58,6 +67,40 @@ class ReadableLogSegment;
 
 typedef std::vector<std::unique_ptr<LogEntryPB>> LogEntries;
 
+// The leading fields of a serialized ReplicateMsg, decoded without parsing the
+// rest of it, for reads which only need to know which ops a log holds.
+// 'payload' borrows the bytes of the op's WritePayloadPB::payload from the
+// serialized message, so it's only valid as long as those are.
+struct ReplicateHeaderView {
+  consensus::OpId id;
+  uint64_t timestamp = 0;
+  consensus::OperationType op_type = consensus::UNKNOWN_OP;
+  Slice payload;
+};
+
+// Decodes the header of the ReplicateMsg serialized in 'data' into 'header'.
+// Returns false if 'data' is malformed or has no id.
+bool DecodeReplicateHeader(const Slice& data, ReplicateHeaderView* header);
+
+// An entry of a serialized LogEntryBatchPB, as decoded by
+// DecodeEntryBatchHeaders().
+struct LogEntryHeaderView {
+  LogEntryTypePB type;
+  // Whether the entry holds a ReplicateMsg, serialized as 'replicate_data'
+  // and whose header is 'replicate'.
+  bool has_replicate = false;
+  Slice replicate_data;
+  ReplicateHeaderView replicate;
+};
+
+// Walks the serialized LogEntryBatchPB in 'batch_data' and sets 'entries' to
+// the header of each of its entries, which point into 'batch_data'. Only the
+// headers of the entries' ReplicateMsgs are decoded, so payloads are neither
+// parsed nor copied.
+Status DecodeEntryBatchHeaders(
+    const Slice& batch_data,
+    std::vector<LogEntryHeaderView>* entries);
+
 // Options for the State Machine/Write Ahead Log
 struct LogOptions {
   // The size of a Log segment
@@ -73,8 +116,44 @@ struct LogOptions {
   // Whether the allocation should happen asynchronously.
   bool async_preallocate_segments;
 
+  // Whether syncing a group and running its callbacks should happen on a
+  // separate stage, overlapped with writing the next group.
+  bool pipelined_append;
+
+  // Whether segments should be written with direct I/O, bypassing the page
+  // cache.
+  bool direct_io_writes;
+
+  // Whether COMMIT entries are queued in a lane of their own and written
+  // opportunistically behind REPLICATE groups. See Log::AsyncAppendCommit().
+  bool separate_commit_lane;
+
+  // The number of garbage-collected segment files to keep around for reuse
+  // as new segments. 0 disables recycling.
+  int segment_recycle_pool_size;
+
+  // Whether recycled segment files are zero-filled, rather than truncated
+  // and preallocated again, before they are reused.
+  bool zero_recycled_segments;
+
+  // Whether the space preallocated for new segments is also zero-filled, so
+  // that appends don't write to unwritten extents.
+  bool zero_preallocated_segments;
+
+  // If positive, each new segment is sized from the recent append rate to
+  // roll over after about this many milliseconds, within
+  // [min_segment_size_mb, max_segment_size_mb], and a segment still open
+  // after twice this long is rolled over regardless of its size.
+  // 'segment_size_mb' then only sizes the first segment.
+  int32_t segment_target_roll_interval_ms;
+  size_t min_segment_size_mb;
+  size_t max_segment_size_mb;
+
   std::shared_ptr<LogFactory> log_factory;
 
+  // If set, the time spent opening the log is recorded here. Not owned.
+  consensus::StartupProfile* startup_profile;
+
   LogOptions();
 };
 
@@ -112,6 +191,21 @@ class LogEntryReader {
   // When there are no more entries to read, returns Status::EndOfFile().
   Status ReadNextEntry(std::unique_ptr<LogEntryPB>* entry);
 
+  // Like ReadNextEntry(), but reads a whole batch at a time, setting
+  // '*batch_offset' to the offset of the batch in the file. Must not be
+  // called while entries read by ReadNextEntry() are pending.
+  Status ReadNextBatch(
+      std::unique_ptr<LogEntryBatchPB>* batch,
+      int64_t* batch_offset);
+
+  // Like ReadNextBatch(), but only decodes the header of each entry of the
+  // batch (see DecodeEntryBatchHeaders()). The entries point into a buffer of
+  // the reader or into the segment's mapping, so they are only valid until
+  // the next read.
+  Status ReadNextBatchHeaders(
+      std::vector<LogEntryHeaderView>* entries,
+      int64_t* batch_offset);
+
   // Return the offset of the next entry to be read from the file.
   int64_t offset() const {
     return offset_;
@@ -132,6 +226,14 @@ class LogEntryReader {
   // Format a nice error message to report on a corruption in a log file.
   Status MakeCorruptionStatus(const Status& status) const;
 
+  // Returns Status::EndOfFile() if there is no batch left to read, checking
+  // that the expected number of entries was read.
+  Status CheckForEndOfEntries() const;
+
+  // Records an entry of the batch just read at 'offset_' in
+  // 'recent_entries_'.
+  void RecordEntry(LogEntryTypePB type, const consensus::OpId& op_id);
+
   // The segment being read.
   ReadableLogSegment* seg_;
 
@@ -166,6 +268,52 @@ class LogEntryReader {
   DISALLOW_COPY_AND_ASSIGN(LogEntryReader);
 };
 
+// A sparse, in-memory index of the REPLICATE batches in a log segment. The Log
+// builds it as it writes the segment and attaches it to the segment's
+// readable version once the segment is closed, so that LogReader can seek
+// close to an op and stream the segment from there rather than looking each
+// op up in the LogIndex.
+class SegmentSparseIndex {
+ public:
+  // Samples every 'interval'th batch. The first batch is always sampled.
+  explicit SegmentSparseIndex(int interval);
+
+  // Records a batch holding replicates 'first_index' through 'last_index',
+  // written at 'offset' in the segment.
+  void AddBatch(int64_t first_index, int64_t last_index, int64_t offset);
+
+  // Returns false if an op in the segment was written with an index no
+  // greater than that of an op before it, i.e. ops were truncated and
+  // rewritten within the segment. Such a segment holds stale copies of ops
+  // and can't be streamed.
+  bool sequential() const {
+    return sequential_;
+  }
+
+  // Sets '*offset' to the offset of the last sampled batch which starts at or
+  // before 'index'. Returns false if there is no such batch.
+  bool FindOffset(int64_t index, int64_t* offset) const;
+
+  // Records the sampled batches in 'footer', if the segment is sequential.
+  void ToFooter(LogSegmentFooterPB* footer) const;
+
+  // Rebuilds the index of a closed segment from its footer. Returns NULL if
+  // the footer has no batch offsets.
+  static std::shared_ptr<const SegmentSparseIndex> FromFooter(
+      const LogSegmentFooterPB& footer);
+
+ private:
+  const int interval_;
+  int64_t num_batches_;
+  int64_t last_index_;
+  bool sequential_;
+
+  // (first replicate index, offset) of each sampled batch, in order.
+  std::vector<std::pair<int64_t, int64_t>> samples_;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentSparseIndex);
+};
+
 // A segment of the log can either be a ReadableLogSegment (for replay and
 // consensus catch-up) or a WritableLogSegment (where the Log actually stores
 // state). LogSegments have a maximum size defined in LogOptions (set from the
@@ -213,6 +361,18 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // vector.
   Status ReadEntries(LogEntries* entries);
 
+  // Serves the segment's reads from a sequential readahead buffer of
+  // --log_recovery_readahead_bytes, for reading the whole segment front to
+  // back. Not thread-safe: only for segments which aren't shared with other
+  // readers.
+  void EnableReadahead();
+
+  // Reads 'result.size()' bytes of the segment file, as is, at 'offset', e.g.
+  // to copy the segment to another server.
+  Status ReadRaw(int64_t offset, Slice result) {
+    return ReadAt(offset, result);
+  }
+
   // Rebuilds this segment's footer by scanning its entries.
   // This is an expensive operation as it reads and parses the whole segment
   // so it should be only used in the case of a crash, where the footer is
@@ -273,6 +433,18 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // Versions of Kudu older than 1.3 used a different log entry header format.
   size_t entry_header_size() const;
 
+  // Attaches a sparse index of this segment's batches. Must be called before
+  // the segment is shared with readers.
+  void set_sparse_index(std::shared_ptr<const SegmentSparseIndex> index) {
+    sparse_index_ = std::move(index);
+  }
+
+  // Returns the segment's sparse index, or NULL if it has none (e.g. if the
+  // segment was written before the server was restarted).
+  const std::shared_ptr<const SegmentSparseIndex>& sparse_index() const {
+    return sparse_index_;
+  }
+
  private:
   friend class RefCountedThreadSafe<ReadableLogSegment>;
   friend class LogEntryReader;
@@ -293,9 +465,21 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
 
     // The CRC32C of this EntryHeader.
     uint32_t header_crc;
+
+    // True if the batch was stored without the segment's compression codec.
+    bool raw;
   };
 
-  ~ReadableLogSegment() {}
+  ~ReadableLogSegment();
+
+  // Returns the whole file, mapped read-only, if --log_mmap_closed_segments
+  // is on and the segment is closed, mapping it on first use. Returns NULL if
+  // the segment isn't to be, or couldn't be, mapped: it's then read with
+  // pread as usual.
+  const uint8_t* MappedData();
+
+  // Maps the file into 'mapped_'. Failures leave 'mapped_' NULL.
+  void MapFile();
 
   // Helper functions called by Init().
 
@@ -351,6 +535,21 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
       std::unique_ptr<LogEntryBatchPB>* batch,
       EntryHeaderStatus* status_detail);
 
+  // Same as above, but doesn't decode the batch: '*batch_data' is set to the
+  // serialized (and, if need be, decompressed) LogEntryBatchPB, pointing into
+  // 'tmp_buf' or into the segment's mapping (see ReadEntryBatchData()).
+  Status ReadEntryHeaderAndBatchData(
+      int64_t* offset,
+      faststring* tmp_buf,
+      Slice* batch_data,
+      EntryHeaderStatus* status_detail);
+
+  // Called after the bytes in [start, end) of the closed segment were read
+  // for a lagging peer: reads the segment ahead of 'end', and drops what was
+  // read from the page cache. Does nothing unless --log_cold_reads_drop_cache
+  // is on.
+  void AdviseColdRead(int64_t start, int64_t end);
+
   // Reads a log entry header from the segment.
   //
   // Also increments the passed offset* by the length of the entry on successful
@@ -376,8 +575,22 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
       faststring* tmp_buf,
       std::unique_ptr<LogEntryBatchPB>* entry_batch);
 
+  // Reads and checks a log entry batch like ReadEntryBatch(), but sets
+  // '*batch_data' to its serialized form, pointing into 'tmp_buf', instead of
+  // decoding it. If the segment is mapped, '*batch_data' may instead point
+  // into the mapping, which stays valid for as long as the segment does.
+  Status ReadEntryBatchData(
+      int64_t* offset,
+      const EntryHeader& header,
+      faststring* tmp_buf,
+      Slice* batch_data);
+
   void UpdateReadableToOffset(int64_t readable_to_offset);
 
+  // Reads 'result.size()' bytes at 'offset' into 'result'. While the footer
+  // is being rebuilt, reads are served from 'readahead_buf_'.
+  Status ReadAt(int64_t offset, Slice result);
+
   const std::string path_;
 
   // The size of the readable file.
@@ -400,6 +613,10 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // Compression codec used to decompress entries in this file.
   std::shared_ptr<CompressionCodec> codec_;
 
+  // True if the segment has the RAW_BATCHES feature, i.e. if some of its
+  // batches may be stored without 'codec_'.
+  bool raw_batches_;
+
   bool is_initialized_;
 
   LogSegmentHeaderPB header_;
@@ -412,6 +629,23 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // the offset of the first entry in the log
   int64_t first_entry_offset_;
 
+  // Sequential readahead state, only used by RebuildFooterByScanning(),
+  // which runs before the segment is shared with other readers, and after
+  // EnableReadahead().
+  bool readahead_enabled_;
+  faststring readahead_buf_;
+  int64_t readahead_offset_;
+
+  // How far AdviseColdRead() asked the OS to read ahead.
+  AtomicInt<int64_t> cold_readahead_to_;
+
+  std::shared_ptr<const SegmentSparseIndex> sparse_index_;
+
+  // The read-only mapping of the closed segment, set up once by MappedData().
+  std::once_flag map_once_;
+  const uint8_t* mapped_ = nullptr;
+  int64_t mapped_size_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(ReadableLogSegment);
 };
 
@@ -437,14 +671,23 @@ class WritableLogSegment {
     return writable_file_->Size();
   }
 
-  // Appends the provided batch of data, including a header
-  // and checksum. If 'codec' is not NULL, compresses the batch.
-  // Makes sure that the log segment has not been closed.
-  // Write a compressed entry to the log.
-  Status WriteEntryBatch(
-      const Slice& data,
+  // Serializes 'entry_batch_pb' into the segment's write buffer, preceded by
+  // an entry header whose lengths and checksums are computed in place. If
+  // 'codec' is not NULL, the batch is compressed into the buffer, unless the
+  // segment has the RAW_BATCHES feature and the batch only holds payloads
+  // which are compressed already.
+  //
+  // Nothing is written to the file until FlushBufferedEntryBatches(), so a
+  // whole group of batches goes out in a single write. On failure, nothing
+  // of the batch is buffered.
+  Status BufferEntryBatch(
+      const LogEntryBatchPB& entry_batch_pb,
       const std::shared_ptr<CompressionCodec>& codec);
 
+  // Writes out any batches buffered by BufferEntryBatch(). The buffered
+  // batches are dropped, whether or not this succeeds.
+  Status FlushBufferedEntryBatches();
+
   // Makes sure the I/O buffers in the underlying writable file are flushed.
   Status Sync() {
     return writable_file_->Sync();
@@ -482,6 +725,12 @@ class WritableLogSegment {
     return written_offset_;
   }
 
+  // The offset at which the next buffered batch will start, i.e. the written
+  // offset plus the size of the batches buffered but not yet flushed.
+  int64_t buffered_offset() const {
+    return written_offset_ + write_buf_.size();
+  }
+
  private:
   const std::shared_ptr<WritableFile>& writable_file() const {
     return writable_file_;
@@ -501,14 +750,22 @@ class WritableLogSegment {
 
   LogSegmentFooterPB footer_;
 
+  // True if the segment has the RAW_BATCHES feature.
+  bool raw_batches_;
+
   // the offset of the first entry in the log
   int64_t first_entry_offset_;
 
   // The offset where the last written entry ends.
   int64_t written_offset_;
 
-  // Buffer used for output when compressing.
-  faststring compress_buf_;
+  // Buffer into which entry batches are serialized, together with their
+  // headers, until they are flushed to 'writable_file_'.
+  faststring write_buf_;
+
+  // Scratch buffer holding the uncompressed serialization of a batch when a
+  // compression codec is in use.
+  faststring serialize_buf_;
 
   DISALLOW_COPY_AND_ASSIGN(WritableLogSegment);
 };
@@ -521,11 +778,46 @@ std::unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
 // Checks if 'fname' is a correctly formatted name of log segment file.
 bool IsLogFileName(const std::string& fname);
 
+// Opens the log segment at 'path' for reading. If
+// --log_segment_file_cache_capacity is set, and 'env' is the default one, the
+// file is opened through a FileCache shared by all the logs of the process,
+// which bounds the number of descriptors they keep open.
+Status OpenSegmentFileForRandom(
+    Env* env,
+    const std::string& path,
+    std::shared_ptr<RandomAccessFile>* file);
+
+// Deletes the log segment at 'path'. If the segment was opened through the
+// shared FileCache and is still being read, the file is only deleted once
+// the last reader is done with it.
+Status DeleteSegmentFile(Env* env, const std::string& path);
+
+// Whether segments opened in 'env' go through the shared FileCache.
+bool SegmentFileCacheEnabled(Env* env);
+
+// Renames the garbage-collected segment at 'path' aside and deletes it on a
+// background thread with idle I/O priority, truncating it
+// --log_segment_deletion_truncate_bytes at a time first, so that freeing its
+// extents doesn't stall appends. A segment left behind by a restart is
+// cleaned up with the other temporary files. 'pending_bytes', if not null,
+// counts the size of the file until it's deleted. Unless 'may_truncate', the
+// file is only unlinked, since readers which still have it open would read
+// it short. Not for segments opened through the shared FileCache, which may
+// be reopened by path.
+Status DeleteSegmentFileInBackground(
+    Env* env,
+    const std::string& path,
+    scoped_refptr<AtomicGauge<int64_t>> pending_bytes,
+    bool may_truncate);
+
 // Update 'footer' to reflect the given REPLICATE message 'entry_pb'.
 // In particular, updates the min/max seen replicate OpID.
 void UpdateFooterForReplicateEntry(
     const LogEntryPB& entry_pb,
     LogSegmentFooterPB* footer);
 
+// Same as above, for a REPLICATE message with the given index.
+void UpdateFooterForReplicateIndex(int64_t index, LogSegmentFooterPB* footer);
+
 } // namespace log
 } // namespace kudu
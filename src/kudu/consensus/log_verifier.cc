@@ -0,0 +1,355 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_verifier.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/human_readable.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/threadpool.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+using strings::SubstituteAndAppend;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+// Where the latest copy of an op was read from.
+struct OpLocation {
+  int64_t term;
+  int64_t segment_sequence_number;
+  int64_t offset_in_segment;
+};
+
+// Reads every batch of 'segment', checking it against its footer, and
+// records where each REPLICATE was found in 'latest'.
+void VerifySegment(
+    const scoped_refptr<ReadableLogSegment>& segment,
+    std::map<int64_t, OpLocation>* latest,
+    TabletWalVerifyResult* result) {
+  const int64_t seqno = segment->header().sequence_number();
+  // The segment is only read here, so it can use the readahead buffer.
+  segment->EnableReadahead();
+  LogEntryReader reader(segment.get());
+  int64_t min_index = -1;
+  int64_t max_index = -1;
+  // Only the ops' ids are checked, so the entries aren't parsed.
+  vector<LogEntryHeaderView> entries;
+  while (true) {
+    int64_t batch_offset;
+    Status s = reader.ReadNextBatchHeaders(&entries, &batch_offset);
+    if (s.IsEndOfFile()) {
+      break;
+    }
+    if (!s.ok()) {
+      result->errors.emplace_back(s.ToString());
+      return;
+    }
+    for (const LogEntryHeaderView& entry : entries) {
+      result->entries++;
+      if (entry.type != REPLICATE || !entry.has_replicate) {
+        continue;
+      }
+      const int64_t index = entry.replicate.id.index();
+      result->replicates++;
+      (*latest)[index] = {entry.replicate.id.term(), seqno, batch_offset};
+      min_index = min_index < 0 ? index : std::min(min_index, index);
+      max_index = std::max(max_index, index);
+    }
+  }
+  result->segments++;
+  result->bytes += segment->file_size();
+
+  if (!segment->HasFooter()) {
+    return;
+  }
+  const LogSegmentFooterPB& footer = segment->footer();
+  const bool footer_has_ops = footer.has_min_replicate_index();
+  if (footer_has_ops != (min_index >= 0) ||
+      (footer_has_ops &&
+       (footer.min_replicate_index() != min_index ||
+        footer.max_replicate_index() != max_index))) {
+    result->errors.emplace_back(Substitute(
+        "footer of $0 has ops $1-$2, but ops $3-$4 were read",
+        segment->path(),
+        footer_has_ops ? footer.min_replicate_index() : -1,
+        footer_has_ops ? footer.max_replicate_index() : -1,
+        min_index,
+        max_index));
+  }
+}
+
+// Checks that the log index of 'tablet_id' points at the latest copy of each
+// op in 'latest'.
+void VerifyLogIndex(
+    FsManager* fs_manager,
+    const string& tablet_id,
+    const std::map<int64_t, OpLocation>& latest,
+    TabletWalVerifyResult* result) {
+  const string dir = fs_manager->GetTabletWalDir(tablet_id);
+  scoped_refptr<LogIndex> index(new LogIndex(dir));
+  Status s = index->OpenAllChunksOnStartup(fs_manager->env(), nullptr);
+  if (!s.ok()) {
+    result->errors.emplace_back(
+        s.CloneAndPrepend("could not open the log index in " + dir)
+            .ToString());
+    return;
+  }
+  // Report the first mismatch, and how many there were, rather than one
+  // error per op.
+  int64_t num_mismatches = 0;
+  string first_mismatch;
+  for (const auto& op : latest) {
+    LogIndexEntry entry;
+    s = index->GetEntry(op.first, &entry);
+    if (s.IsNotFound()) {
+      result->unindexed_ops++;
+      continue;
+    }
+    if (!s.ok()) {
+      const string msg = Substitute(
+          "could not read op $0 from the log index in $1", op.first, dir);
+      result->errors.emplace_back(s.CloneAndPrepend(msg).ToString());
+      return;
+    }
+    const OpLocation& loc = op.second;
+    if (entry.op_id.term() != loc.term ||
+        entry.segment_sequence_number != loc.segment_sequence_number ||
+        entry.offset_in_segment != loc.offset_in_segment) {
+      if (num_mismatches++ == 0) {
+        first_mismatch = Substitute(
+            "log index entry $0 doesn't match the latest copy of the op, in "
+            "term $1, in segment $2 at offset $3",
+            entry.ToString(),
+            loc.term,
+            loc.segment_sequence_number,
+            loc.offset_in_segment);
+      }
+    }
+  }
+  if (num_mismatches > 0) {
+    result->errors.emplace_back(Substitute(
+        "$0 (1 of $1 mismatched ops)", first_mismatch, num_mismatches));
+  }
+}
+
+void VerifyTabletWal(
+    FsManager* fs_manager,
+    const string& tablet_id,
+    TabletWalVerifyResult* result) {
+  Env* env = fs_manager->env();
+  result->tablet_id = tablet_id;
+
+  SegmentSequence segments;
+  for (const string& dir : fs_manager->GetTabletWalStripeDirs(tablet_id)) {
+    if (!env->FileExists(dir)) {
+      continue;
+    }
+    vector<string> children;
+    Status s = env->GetChildren(dir, &children);
+    if (!s.ok()) {
+      result->errors.emplace_back(
+          s.CloneAndPrepend("could not list " + dir).ToString());
+      continue;
+    }
+    for (const string& child : children) {
+      if (!HasPrefixString(child, FsManager::kWalFileNamePrefix)) {
+        continue;
+      }
+      const string path = JoinPathSegments(dir, child);
+      scoped_refptr<ReadableLogSegment> segment;
+      s = ReadableLogSegment::Open(env, path, &segment);
+      if (s.IsUninitialized()) {
+        // Preallocated, but never written.
+        continue;
+      }
+      if (!s.ok()) {
+        result->errors.emplace_back(
+            s.CloneAndPrepend("could not open " + path).ToString());
+        continue;
+      }
+      segments.emplace_back(std::move(segment));
+    }
+  }
+  if (segments.empty()) {
+    return;
+  }
+  std::stable_sort(
+      segments.begin(),
+      segments.end(),
+      [](const scoped_refptr<ReadableLogSegment>& a,
+         const scoped_refptr<ReadableLogSegment>& b) {
+        return a->header().sequence_number() < b->header().sequence_number();
+      });
+
+  std::map<int64_t, OpLocation> latest;
+  const int64_t last_seqno = segments.back()->header().sequence_number();
+  int64_t prev_seqno = -1;
+  for (const auto& segment : segments) {
+    const int64_t seqno = segment->header().sequence_number();
+    if (seqno == prev_seqno) {
+      // A segment being archived is briefly in two directories. Like
+      // LogReader, only read the first copy.
+      continue;
+    }
+    if (prev_seqno >= 0 && seqno != prev_seqno + 1) {
+      result->errors.emplace_back(Substitute(
+          "segments $0 through $1 are missing", prev_seqno + 1, seqno - 1));
+    }
+    prev_seqno = seqno;
+    if (!segment->HasFooter() && seqno != last_seqno) {
+      result->errors.emplace_back(Substitute(
+          "$0 has no footer, but isn't the last segment", segment->path()));
+    }
+    VerifySegment(segment, &latest, result);
+  }
+
+  if (!latest.empty()) {
+    VerifyLogIndex(fs_manager, tablet_id, latest, result);
+  }
+}
+
+// Lists the tablets with a directory in any of the WAL directories.
+Status ListWalTablets(FsManager* fs_manager, vector<string>* tablet_ids) {
+  Env* env = fs_manager->env();
+  std::set<string> ids;
+  for (const string& root : fs_manager->GetWalStripeRootDirs()) {
+    if (!env->FileExists(root)) {
+      continue;
+    }
+    vector<string> children;
+    RETURN_NOT_OK_PREPEND(
+        env->GetChildren(root, &children), "could not list " + root);
+    for (const string& child : children) {
+      // Skips "." and "..", recovery directories and temporary files.
+      if (child.find('.') != string::npos) {
+        continue;
+      }
+      bool is_dir;
+      RETURN_NOT_OK(env->IsDirectory(JoinPathSegments(root, child), &is_dir));
+      if (is_dir) {
+        ids.insert(child);
+      }
+    }
+  }
+  tablet_ids->assign(ids.begin(), ids.end());
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+int64_t WalVerifyReport::total_bytes() const {
+  int64_t bytes = 0;
+  for (const auto& tablet : tablets) {
+    bytes += tablet.bytes;
+  }
+  return bytes;
+}
+
+int64_t WalVerifyReport::total_errors() const {
+  int64_t errors = 0;
+  for (const auto& tablet : tablets) {
+    errors += tablet.errors.size();
+  }
+  return errors;
+}
+
+string WalVerifyReport::ToString() const {
+  string ret;
+  int64_t segments = 0;
+  int64_t unindexed_ops = 0;
+  for (const auto& tablet : tablets) {
+    segments += tablet.segments;
+    unindexed_ops += tablet.unindexed_ops;
+    for (const string& error : tablet.errors) {
+      SubstituteAndAppend(&ret, "$0: $1\n", tablet.tablet_id, error);
+    }
+  }
+  const double secs = elapsed.ToSeconds();
+  SubstituteAndAppend(
+      &ret,
+      "verified $0 tablets, $1 segments, $2 in $3 s ($4/s): $5 errors",
+      tablets.size(),
+      segments,
+      HumanReadableNumBytes::ToString(total_bytes()),
+      StringPrintf("%.1f", secs),
+      HumanReadableNumBytes::ToString(
+          secs > 0 ? static_cast<int64_t>(total_bytes() / secs) : 0),
+      total_errors());
+  if (unindexed_ops > 0) {
+    SubstituteAndAppend(&ret, ", $0 ops not in the log index", unindexed_ops);
+  }
+  return ret;
+}
+
+Status VerifyWals(
+    FsManager* fs_manager,
+    const vector<string>& tablet_ids,
+    int num_threads,
+    WalVerifyReport* report) {
+  const MonoTime start = MonoTime::Now();
+  vector<string> ids = tablet_ids;
+  if (ids.empty()) {
+    RETURN_NOT_OK(ListWalTablets(fs_manager, &ids));
+  }
+
+  report->tablets.clear();
+  report->tablets.resize(ids.size());
+  unique_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("wal-verify")
+                    .set_min_threads(0)
+                    .set_max_threads(std::max(1, num_threads))
+                    .Build(&pool));
+  for (int i = 0; i < ids.size(); i++) {
+    const string* id = &ids[i];
+    TabletWalVerifyResult* result = &report->tablets[i];
+    Status s = pool->SubmitFunc([fs_manager, id, result]() {
+      VerifyTabletWal(fs_manager, *id, result);
+    });
+    if (!s.ok()) {
+      // Fall back to verifying this tablet on the calling thread.
+      VerifyTabletWal(fs_manager, ids[i], result);
+    }
+  }
+  pool->Wait();
+  pool->Shutdown();
+  report->elapsed = MonoTime::Now() - start;
+  return Status::OK();
+}
+
+} // namespace log
+} // namespace kudu
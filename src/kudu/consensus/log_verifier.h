@@ -0,0 +1,82 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class FsManager;
+
+namespace log {
+
+// What verifying the WAL of one tablet found.
+struct TabletWalVerifyResult {
+  std::string tablet_id;
+
+  int64_t segments = 0;
+  int64_t bytes = 0;
+  int64_t entries = 0;
+  int64_t replicates = 0;
+
+  // Ops which the log index has no entry for. The index isn't durable, so
+  // these aren't errors.
+  int64_t unindexed_ops = 0;
+
+  // A description of each problem found.
+  std::vector<std::string> errors;
+};
+
+// What verifying the WALs of a server found.
+struct WalVerifyReport {
+  std::vector<TabletWalVerifyResult> tablets;
+  MonoDelta elapsed;
+
+  int64_t total_bytes() const;
+  int64_t total_errors() const;
+
+  // A line per tablet with errors, followed by the totals and the
+  // throughput, e.g. "verified 12 tablets, 96 segments, 5.9 GB in 10.2 s
+  // (580.4 MB/s): 0 errors".
+  std::string ToString() const;
+};
+
+// Checks every WAL segment of 'tablet_ids', or of every tablet if it's empty,
+// in all of 'fs_manager's WAL directories: the segment headers and footers,
+// the CRCs of every entry batch, that each closed segment holds the entries
+// and ops its footer says, that sequence numbers are contiguous, and that the
+// log index points at the latest copy of each op. Tablets are verified
+// concurrently on 'num_threads' threads, and each segment is read front to
+// back with large sequential reads.
+//
+// The WALs must not be written to while they're verified. Problems found in
+// the WALs go into 'report'; the returned status is only bad if the
+// verification itself couldn't run.
+Status VerifyWals(
+    FsManager* fs_manager,
+    const std::vector<std::string>& tablet_ids,
+    int num_threads,
+    WalVerifyReport* report);
+
+} // namespace log
+} // namespace kudu
@@ -0,0 +1,120 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/op_latency_tracker.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(raft_op_latency_sample_interval);
+DECLARE_int32(raft_op_latency_slowest_ops);
+
+METRIC_DECLARE_histogram(raft_op_latency_local_durable);
+METRIC_DECLARE_histogram(raft_op_latency_first_sent);
+
+namespace kudu {
+namespace consensus {
+
+class OpLatencyTrackerTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    entity_ = METRIC_ENTITY_server.Instantiate(&registry_, "op-latency-test");
+    tracker_.reset(new OpLatencyTracker(entity_));
+  }
+
+ protected:
+  // Records an op that took about 'sleep_ms' to become durable, and was
+  // never sent to a peer.
+  void RecordOp(int64_t index, int sleep_ms) {
+    OpLatencyTrace trace;
+    trace.Mark(OpStage::kQueueAppended);
+    SleepFor(MonoDelta::FromMilliseconds(sleep_ms));
+    trace.Mark(OpStage::kLocalDurable);
+    trace.Mark(OpStage::kCommitted);
+    trace.Mark(OpStage::kReplicated);
+    tracker_->Record(MakeOpId(1, index), trace);
+  }
+
+  MetricRegistry registry_;
+  scoped_refptr<MetricEntity> entity_;
+  std::unique_ptr<OpLatencyTracker> tracker_;
+};
+
+TEST_F(OpLatencyTrackerTest, TestSampling) {
+  FLAGS_raft_op_latency_sample_interval = 0;
+  ASSERT_FALSE(tracker_->ShouldSample());
+
+  FLAGS_raft_op_latency_sample_interval = 4;
+  int sampled = 0;
+  for (int i = 0; i < 40; i++) {
+    sampled += tracker_->ShouldSample();
+  }
+  ASSERT_EQ(10, sampled);
+}
+
+TEST_F(OpLatencyTrackerTest, TestMarkKeepsFirstTime) {
+  OpLatencyTrace trace;
+  ASSERT_EQ(-1, trace.ElapsedUs(OpStage::kFirstSent));
+  trace.Mark(OpStage::kFirstSent);
+  const int64_t first_sent_us = trace.ElapsedUs(OpStage::kFirstSent);
+  ASSERT_GE(first_sent_us, 0);
+  SleepFor(MonoDelta::FromMilliseconds(5));
+  trace.Mark(OpStage::kFirstSent);
+  ASSERT_EQ(first_sent_us, trace.ElapsedUs(OpStage::kFirstSent));
+}
+
+TEST_F(OpLatencyTrackerTest, TestRecordAndDumpSlowestOps) {
+  FLAGS_raft_op_latency_slowest_ops = 2;
+  RecordOp(1, 1);
+  RecordOp(2, 30);
+  RecordOp(3, 10);
+
+  // Stages the ops did not reach are not recorded.
+  ASSERT_EQ(
+      3,
+      METRIC_raft_op_latency_local_durable.Instantiate(entity_)->TotalCount());
+  ASSERT_EQ(
+      0, METRIC_raft_op_latency_first_sent.Instantiate(entity_)->TotalCount());
+
+  std::ostringstream out;
+  tracker_->DumpSlowestOps(&out);
+  const std::string dump = out.str();
+  // The two slowest ops, slowest first.
+  ASSERT_STR_NOT_CONTAINS(dump, "1.1 ");
+  ASSERT_STR_CONTAINS(dump, "first_sent_us=-1");
+  const size_t op2 = dump.find("1.2 ");
+  const size_t op3 = dump.find("1.3 ");
+  ASSERT_NE(std::string::npos, op2);
+  ASSERT_NE(std::string::npos, op3);
+  ASSERT_LT(op2, op3);
+}
+
+} // namespace consensus
+} // namespace kudu
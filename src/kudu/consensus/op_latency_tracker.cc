@@ -0,0 +1,262 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/op_latency_tracker.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/hash/city.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/debug/trace_event.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/metrics.h"
+
+DEFINE_int32(
+    raft_op_latency_sample_interval,
+    0,
+    "If positive, a leader traces one in every this many ops it replicates, "
+    "recording how long each takes to reach the stages from "
+    "RaftConsensus::Replicate() to its replicated callback. 0 disables "
+    "tracing. Read when the replica starts.");
+TAG_FLAG(raft_op_latency_sample_interval, experimental);
+
+DEFINE_int32(
+    raft_op_latency_slowest_ops,
+    10,
+    "Number of the slowest traced ops each replica keeps for debugging. See "
+    "--raft_op_latency_sample_interval.");
+TAG_FLAG(raft_op_latency_slowest_ops, experimental);
+TAG_FLAG(raft_op_latency_slowest_ops, runtime);
+
+static bool ValidateNonNegative(const char* flagname, int32_t v) {
+  if (v >= 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must not be negative, got " << v;
+  return false;
+}
+DEFINE_validator(raft_op_latency_sample_interval, &ValidateNonNegative);
+DEFINE_validator(raft_op_latency_slowest_ops, &ValidateNonNegative);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_op_latency_queue_appended,
+    "Raft Op Queue Append Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from RaftConsensus::Replicate() until a traced op was in "
+    "the log cache. Only recorded with --raft_op_latency_sample_interval.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_op_latency_local_durable,
+    "Raft Op Local Durable Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from RaftConsensus::Replicate() until a traced op was "
+    "appended to the local WAL. Only recorded with "
+    "--raft_op_latency_sample_interval.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_op_latency_first_sent,
+    "Raft Op First Send Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from RaftConsensus::Replicate() until a traced op was first "
+    "sent to a peer. Only recorded with --raft_op_latency_sample_interval.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_op_latency_committed,
+    "Raft Op Commit Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from RaftConsensus::Replicate() until a traced op was known "
+    "to be committed. Only recorded with --raft_op_latency_sample_interval.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_op_latency_replicated,
+    "Raft Op Replicated Callback Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds from RaftConsensus::Replicate() until the replicated "
+    "callback of a traced op returned. Only recorded with "
+    "--raft_op_latency_sample_interval.",
+    60000000LU,
+    2);
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+constexpr int kNumStages = static_cast<int>(OpStage::kNumStages);
+
+const char* const kStageNames[kNumStages] = {
+    "replicate",
+    "queue_appended",
+    "local_durable",
+    "first_sent",
+    "committed",
+    "replicated",
+};
+
+// Orders SlowOps so that std::push_heap() and friends keep the fastest on
+// top.
+struct SlowerThan {
+  template <class T>
+  bool operator()(const T& a, const T& b) const {
+    return a.elapsed_us[kNumStages - 1] > b.elapsed_us[kNumStages - 1];
+  }
+};
+
+} // anonymous namespace
+
+OpLatencyTrace::OpLatencyTrace() {
+  for (auto& us : stage_us_) {
+    us.store(0, std::memory_order_relaxed);
+  }
+  stage_us_[0].store(GetMonoTimeMicros(), std::memory_order_relaxed);
+}
+
+void OpLatencyTrace::Mark(OpStage stage) {
+  int64_t expected = 0;
+  stage_us_[static_cast<int>(stage)].compare_exchange_strong(
+      expected, GetMonoTimeMicros(), std::memory_order_relaxed);
+}
+
+int64_t OpLatencyTrace::ElapsedUs(OpStage stage) const {
+  const int64_t us =
+      stage_us_[static_cast<int>(stage)].load(std::memory_order_relaxed);
+  if (us == 0) {
+    return -1;
+  }
+  return std::max<int64_t>(
+      0, us - stage_us_[0].load(std::memory_order_relaxed));
+}
+
+OpLatencyTracker::OpLatencyTracker(
+    const scoped_refptr<MetricEntity>& metric_entity)
+    : num_ops_(0) {
+  histograms_[static_cast<int>(OpStage::kQueueAppended)] =
+      METRIC_raft_op_latency_queue_appended.Instantiate(metric_entity);
+  histograms_[static_cast<int>(OpStage::kLocalDurable)] =
+      METRIC_raft_op_latency_local_durable.Instantiate(metric_entity);
+  histograms_[static_cast<int>(OpStage::kFirstSent)] =
+      METRIC_raft_op_latency_first_sent.Instantiate(metric_entity);
+  histograms_[static_cast<int>(OpStage::kCommitted)] =
+      METRIC_raft_op_latency_committed.Instantiate(metric_entity);
+  histograms_[static_cast<int>(OpStage::kReplicated)] =
+      METRIC_raft_op_latency_replicated.Instantiate(metric_entity);
+}
+
+bool OpLatencyTracker::ShouldSample() {
+  const int32_t interval = FLAGS_raft_op_latency_sample_interval;
+  if (interval <= 0) {
+    return false;
+  }
+  return num_ops_.fetch_add(1, std::memory_order_relaxed) % interval == 0;
+}
+
+void OpLatencyTracker::Record(const OpId& id, const OpLatencyTrace& trace) {
+  SlowOp op;
+  op.term = id.term();
+  op.index = id.index();
+  for (int i = 0; i < kNumStages; i++) {
+    op.elapsed_us[i] = trace.ElapsedUs(static_cast<OpStage>(i));
+    // Stages an op skipped, e.g. kFirstSent in a single-replica ring, are
+    // not recorded.
+    if (i > 0 && op.elapsed_us[i] >= 0) {
+      histograms_[i]->Increment(op.elapsed_us[i]);
+    }
+  }
+
+  const size_t max_ops = FLAGS_raft_op_latency_slowest_ops;
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (slowest_ops_.size() < max_ops) {
+    slowest_ops_.push_back(op);
+    std::push_heap(slowest_ops_.begin(), slowest_ops_.end(), SlowerThan());
+    return;
+  }
+  // The flag may have been lowered since.
+  while (slowest_ops_.size() > max_ops) {
+    std::pop_heap(slowest_ops_.begin(), slowest_ops_.end(), SlowerThan());
+    slowest_ops_.pop_back();
+  }
+  if (slowest_ops_.empty() || !SlowerThan()(op, slowest_ops_.front())) {
+    return;
+  }
+  std::pop_heap(slowest_ops_.begin(), slowest_ops_.end(), SlowerThan());
+  slowest_ops_.back() = op;
+  std::push_heap(slowest_ops_.begin(), slowest_ops_.end(), SlowerThan());
+}
+
+void OpLatencyTracker::DumpSlowestOps(std::ostream* out) const {
+  std::vector<SlowOp> ops;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    ops = slowest_ops_;
+  }
+  std::sort(ops.begin(), ops.end(), SlowerThan());
+  for (const SlowOp& op : ops) {
+    *out << op.term << "." << op.index;
+    for (int i = 1; i < kNumStages; i++) {
+      *out << " " << kStageNames[i] << "_us=" << op.elapsed_us[i];
+    }
+    *out << "\n";
+  }
+}
+
+bool OpLatencyTracingEnabled() {
+  return FLAGS_raft_op_latency_sample_interval > 0;
+}
+
+uint64_t OpTraceFlowId(const std::string& tablet_id, const OpId& id) {
+  return util_hash::CityHash64WithSeeds(
+      tablet_id.data(), tablet_id.size(), id.term(), id.index());
+}
+
+void TraceOpFlowSteps(
+    const std::string& tablet_id,
+    const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+    const char* step) {
+  bool enabled;
+  TRACE_EVENT_CATEGORY_GROUP_ENABLED("consensus", &enabled);
+  if (PREDICT_TRUE(!enabled)) {
+    return;
+  }
+  for (const ReplicateMsg& op : ops) {
+    TRACE_EVENT_FLOW_STEP0(
+        "consensus", "Op", OpTraceFlowId(tablet_id, op.id()), step);
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
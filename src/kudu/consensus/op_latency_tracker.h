@@ -0,0 +1,146 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+
+namespace google {
+namespace protobuf {
+template <typename Element>
+class RepeatedPtrField;
+} // namespace protobuf
+} // namespace google
+
+namespace kudu {
+
+class Histogram;
+class MetricEntity;
+
+namespace consensus {
+
+class OpId;
+class ReplicateMsg;
+
+// The stages a leader op goes through, from RaftConsensus::Replicate() to the
+// round's replicated callback. After kReplicate the stages overlap: the op
+// is sent to the peers while it is still being appended to the local WAL.
+enum class OpStage {
+  // RaftConsensus started appending the op to the queue.
+  kReplicate = 0,
+  // The op is in the log cache and its local WAL append has been submitted.
+  kQueueAppended,
+  // The local WAL append, and fsync if any, finished.
+  kLocalDurable,
+  // The op was first put in a request to a peer.
+  kFirstSent,
+  // RaftConsensus learned that the op is committed.
+  kCommitted,
+  // The round's replicated callback returned.
+  kReplicated,
+  kNumStages
+};
+
+// When a sampled op reached each stage. Shared by the forms of the op
+// (compressed or not) held by the log cache, so any of them can mark it.
+class OpLatencyTrace {
+ public:
+  // Marks kReplicate.
+  OpLatencyTrace();
+
+  // Records that the op reached 'stage' now, unless it already had.
+  void Mark(OpStage stage);
+
+  // Microseconds from kReplicate to 'stage', or -1 if the op has not reached
+  // 'stage'.
+  int64_t ElapsedUs(OpStage stage) const;
+
+ private:
+  // Monotonic time of each stage in microseconds, 0 until reached.
+  std::atomic<int64_t> stage_us_[static_cast<int>(OpStage::kNumStages)];
+
+  DISALLOW_COPY_AND_ASSIGN(OpLatencyTrace);
+};
+
+// Samples one in every --raft_op_latency_sample_interval ops a leader
+// replicates and aggregates their traces: the time from kReplicate to each
+// later stage goes into a histogram of the replica's metric entity, and the
+// --raft_op_latency_slowest_ops slowest ops are kept for DumpSlowestOps().
+//
+// Comparing the stages tells where a slow commit spent its time: the queue
+// and log cache (kQueueAppended), the disk (kLocalDurable), waiting for a
+// peer send (kFirstSent), or the network, proxies and follower appends
+// (kFirstSent to kCommitted).
+class OpLatencyTracker {
+ public:
+  explicit OpLatencyTracker(const scoped_refptr<MetricEntity>& metric_entity);
+
+  // Returns true if the next op should be traced.
+  bool ShouldSample();
+
+  // Records the trace of the op 'id', once it has been replicated.
+  void Record(const OpId& id, const OpLatencyTrace& trace);
+
+  // Writes the slowest recorded ops to 'out', slowest first, one per line.
+  void DumpSlowestOps(std::ostream* out) const;
+
+ private:
+  struct SlowOp {
+    int64_t term;
+    int64_t index;
+    int64_t elapsed_us[static_cast<int>(OpStage::kNumStages)];
+  };
+
+  // Indexed by stage; there is none for kReplicate.
+  scoped_refptr<Histogram> histograms_[static_cast<int>(OpStage::kNumStages)];
+
+  std::atomic<int64_t> num_ops_;
+
+  mutable simple_spinlock lock_;
+  // A min-heap on the total time, so that the fastest of the slowest ops is
+  // the one replaced.
+  std::vector<SlowOp> slowest_ops_;
+
+  DISALLOW_COPY_AND_ASSIGN(OpLatencyTracker);
+};
+
+// Returns true if leaders should trace ops
+// (--raft_op_latency_sample_interval).
+bool OpLatencyTracingEnabled();
+
+// The id under which the TRACE_EVENT_FLOW_* events of op 'id' of tablet
+// 'tablet_id' are recorded. It is the same on every server, so that in
+// captures merged with 'kudu diagnose merge_traces' the op can be followed
+// from the leader through proxies to the followers.
+uint64_t OpTraceFlowId(const std::string& tablet_id, const OpId& id);
+
+// Records a flow step named 'step', which must be a string literal, for each
+// of 'ops', if the "consensus" trace category is being recorded.
+void TraceOpFlowSteps(
+    const std::string& tablet_id,
+    const google::protobuf::RepeatedPtrField<ReplicateMsg>& ops,
+    const char* step);
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/payload_fragments.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class PayloadFragmentsTest : public KuduTest {
+ protected:
+  static WritePayloadPB Fragment(
+      uint64_t payload_id,
+      uint32_t seq,
+      bool last) {
+    WritePayloadPB payload;
+    SetPayloadFragment(payload_id, seq, last, &payload);
+    return payload;
+  }
+
+  PayloadFragmentTracker tracker_;
+  bool completes_ = false;
+};
+
+// Interleaved payloads complete with their last fragments.
+TEST_F(PayloadFragmentsTest, TestInterleavedPayloads) {
+  ASSERT_OK(tracker_.Add(1, Fragment(7, 0, false), &completes_));
+  ASSERT_FALSE(completes_);
+  ASSERT_OK(tracker_.Add(1, Fragment(8, 0, false), &completes_));
+  ASSERT_OK(tracker_.Add(1, WritePayloadPB(), &completes_));
+  ASSERT_FALSE(completes_);
+  ASSERT_OK(tracker_.Add(1, Fragment(7, 1, true), &completes_));
+  ASSERT_TRUE(completes_);
+  ASSERT_EQ(1, tracker_.num_open_payloads());
+  ASSERT_OK(tracker_.Add(1, Fragment(8, 1, true), &completes_));
+  ASSERT_TRUE(completes_);
+  ASSERT_EQ(0, tracker_.num_open_payloads());
+}
+
+// Fragments can't be skipped or repeated, nor continue a payload which
+// isn't open, and rejected fragments leave the tracker as it was.
+TEST_F(PayloadFragmentsTest, TestOutOfOrderFragments) {
+  ASSERT_OK(tracker_.Add(1, Fragment(7, 0, false), &completes_));
+  ASSERT_TRUE(tracker_.Check(1, Fragment(7, 2, false)).IsInvalidArgument());
+  ASSERT_TRUE(
+      tracker_.Add(1, Fragment(7, 0, false), &completes_).IsInvalidArgument());
+  ASSERT_TRUE(tracker_.Check(1, Fragment(8, 1, true)).IsInvalidArgument());
+  ASSERT_OK(tracker_.Add(1, Fragment(7, 1, true), &completes_));
+  ASSERT_TRUE(completes_);
+}
+
+// A payload left open when the term changes is abandoned, and can't be
+// continued in the new term.
+TEST_F(PayloadFragmentsTest, TestAbandonedPayloads) {
+  ASSERT_OK(tracker_.Add(1, Fragment(7, 0, false), &completes_));
+  ASSERT_OK(tracker_.Add(1, Fragment(8, 0, false), &completes_));
+  ASSERT_OK(tracker_.Add(1, Fragment(8, 1, true), &completes_));
+
+  ASSERT_TRUE(tracker_.Check(2, Fragment(7, 1, true)).IsInvalidArgument());
+  vector<uint64_t> abandoned;
+  ASSERT_OK(tracker_.Add(2, WritePayloadPB(), &completes_, &abandoned));
+  ASSERT_EQ(vector<uint64_t>{7}, abandoned);
+  ASSERT_EQ(0, tracker_.num_open_payloads());
+
+  // The new leader may reuse the id.
+  ASSERT_OK(tracker_.Add(2, Fragment(7, 0, true), &completes_));
+  ASSERT_TRUE(completes_);
+}
+
+} // namespace consensus
+} // namespace kudu
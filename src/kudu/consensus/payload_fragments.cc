@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/payload_fragments.h"
+
+#include <string>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/strings/substitute.h"
+
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+void SetPayloadFragment(
+    uint64_t payload_id,
+    uint32_t seq,
+    bool last,
+    WritePayloadPB* payload) {
+  PayloadFragmentPB* fragment = payload->mutable_fragment();
+  fragment->set_payload_id(payload_id);
+  fragment->set_seq(seq);
+  fragment->set_last(last);
+}
+
+Status PayloadFragmentTracker::Check(
+    int64_t term,
+    const WritePayloadPB& payload) const {
+  if (!payload.has_fragment()) {
+    return Status::OK();
+  }
+  const PayloadFragmentPB& fragment = payload.fragment();
+  uint32_t expected_seq = 0;
+  if (term == term_) {
+    expected_seq = FindWithDefault(open_, fragment.payload_id(), 0);
+  }
+  if (fragment.seq() != expected_seq) {
+    return Status::InvalidArgument(Substitute(
+        "Fragment $0 of payload $1 in term $2, which expects fragment $3",
+        fragment.seq(),
+        fragment.payload_id(),
+        term,
+        expected_seq));
+  }
+  return Status::OK();
+}
+
+Status PayloadFragmentTracker::Add(
+    int64_t term,
+    const WritePayloadPB& payload,
+    bool* completes_payload,
+    vector<uint64_t>* abandoned) {
+  RETURN_NOT_OK(Check(term, payload));
+  *completes_payload = false;
+  if (term > term_) {
+    // The payloads still open were the previous leader's to finish.
+    if (abandoned != nullptr) {
+      for (const auto& entry : open_) {
+        abandoned->push_back(entry.first);
+      }
+    }
+    open_.clear();
+    term_ = term;
+  }
+  if (!payload.has_fragment()) {
+    return Status::OK();
+  }
+  const PayloadFragmentPB& fragment = payload.fragment();
+  if (fragment.last()) {
+    open_.erase(fragment.payload_id());
+    *completes_payload = true;
+  } else {
+    open_[fragment.payload_id()] = fragment.seq() + 1;
+  }
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Support for payloads replicated as fragments (see PayloadFragmentPB).
+//
+// A very large transaction need not become a single ReplicateMsg, which must
+// be held in memory, compressed and sent whole. Instead, the application on
+// the leader replicates it as a run of fragment ops as it produces them, each
+// an ordinary op as far as the log, the log cache and the peers are
+// concerned, and marks the last one. Followers apply the fragments of a
+// payload in order and only let the payload take effect with its last one.
+//
+// If the leader loses its term partway through a payload, the fragments
+// already replicated are never completed; the application drops them once
+// an op of a later term commits.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace consensus {
+
+class WritePayloadPB;
+
+// Marks 'payload' as fragment 'seq' of payload 'payload_id', the last one if
+// 'last'.
+void SetPayloadFragment(
+    uint64_t payload_id,
+    uint32_t seq,
+    bool last,
+    WritePayloadPB* payload);
+
+// Tracks the fragmented payloads in a sequence of ops, which must be added in
+// index order, checking that the fragments of each payload follow each other
+// within a term. The leader checks the ops it replicates with one; followers
+// can use one in their apply path to learn when a payload is complete, or
+// was abandoned by its leader. Not thread-safe.
+class PayloadFragmentTracker {
+ public:
+  PayloadFragmentTracker() = default;
+
+  // Returns InvalidArgument if 'payload', of an op in 'term', is a fragment
+  // which can't follow the ops added so far: it continues a payload which
+  // isn't open in 'term', or skips or repeats a fragment of one.
+  Status Check(int64_t term, const WritePayloadPB& payload) const;
+
+  // Adds the payload of an op in 'term', after checking it as Check() does.
+  // On success, 'completes_payload' is set to whether it is the last
+  // fragment of its payload, and 'abandoned', if set, gets the ids of the
+  // payloads of earlier terms which were left incomplete and are now
+  // forgotten.
+  Status Add(
+      int64_t term,
+      const WritePayloadPB& payload,
+      bool* completes_payload,
+      std::vector<uint64_t>* abandoned = nullptr);
+
+  // The number of payloads with fragments added but not the last one.
+  size_t num_open_payloads() const {
+    return open_.size();
+  }
+
+ private:
+  // The term of the last op added. Payloads of earlier terms can't be
+  // continued, so only those of this term are open.
+  int64_t term_ = -1;
+
+  // Maps from the id of each open payload -> the seq of its next fragment.
+  std::map<uint64_t, uint32_t> open_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadFragmentTracker);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,80 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_ids.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include <glog/logging.h>
+
+#include "kudu/util/locks.h"
+
+using std::string;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+struct PeerIdTable {
+  rw_spinlock lock;
+  std::unordered_map<string, PeerId> ids;
+  // Indexed by id. A deque, so that references to the UUIDs stay valid as
+  // it grows.
+  std::deque<string> uuids;
+};
+
+PeerIdTable* Table() {
+  static PeerIdTable* table = new PeerIdTable();
+  return table;
+}
+
+} // anonymous namespace
+
+PeerId InternPeerUuid(const string& uuid) {
+  PeerId id = FindPeerId(uuid);
+  if (id != kInvalidPeerId) {
+    return id;
+  }
+  PeerIdTable* table = Table();
+  std::lock_guard<rw_spinlock> l(table->lock);
+  auto inserted = table->ids.emplace(uuid, table->uuids.size());
+  if (inserted.second) {
+    CHECK_LT(table->uuids.size(), kInvalidPeerId);
+    table->uuids.push_back(uuid);
+  }
+  return inserted.first->second;
+}
+
+PeerId FindPeerId(const string& uuid) {
+  PeerIdTable* table = Table();
+  shared_lock<rw_spinlock> l(table->lock);
+  auto iter = table->ids.find(uuid);
+  return iter == table->ids.end() ? kInvalidPeerId : iter->second;
+}
+
+const string& PeerUuid(PeerId id) {
+  PeerIdTable* table = Table();
+  shared_lock<rw_spinlock> l(table->lock);
+  CHECK_LT(id, table->uuids.size());
+  return table->uuids[id];
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,53 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Dense ids for peer UUIDs, shared by all the rings of a server.
+//
+// Peers are identified by their UUID strings at the protobuf boundaries, but
+// hashing and comparing those on every request and response adds up. A peer's
+// UUID is interned once, e.g. when it starts being tracked, and the per-server
+// id is then used to find it. Ids are never reused: the table only grows with
+// the number of distinct peers the server has seen, which is small.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace kudu {
+namespace consensus {
+
+typedef uint32_t PeerId;
+
+// The id of no peer.
+constexpr PeerId kInvalidPeerId = UINT32_MAX;
+
+// Returns the id of 'uuid', assigning it the next one if it has none yet.
+// Thread-safe.
+PeerId InternPeerUuid(const std::string& uuid);
+
+// Returns the id of 'uuid', or kInvalidPeerId if it was never interned.
+// Thread-safe.
+PeerId FindPeerId(const std::string& uuid);
+
+// Returns the UUID with 'id', which must have been returned by
+// InternPeerUuid(). The reference stays valid for the life of the process.
+// Thread-safe.
+const std::string& PeerUuid(PeerId id);
+
+} // namespace consensus
+} // namespace kudu
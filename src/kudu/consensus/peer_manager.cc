@@ -112,6 +112,18 @@ void PeerManager::SignalRequest(
   }
 }
 
+Status PeerManager::SignalRequestToPeer(const std::string& uuid) {
+  std::shared_ptr<Peer> peer;
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    peer = FindPtrOrNull(peers_, uuid);
+  }
+  if (!peer) {
+    return Status::NotFound("unknown peer");
+  }
+  return peer->SignalRequest(/*even_if_queue_empty=*/true);
+}
+
 Status PeerManager::StartElection(
     const std::string& uuid,
     RunLeaderElectionResponsePB* resp,
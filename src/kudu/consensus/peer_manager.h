@@ -60,6 +60,10 @@ class PeerManager {
       bool force_if_queue_empty = false,
       bool is_leader_lease_revoke = false);
 
+  // Signals only the peer with UUID 'uuid', having it send a request even if
+  // there is nothing new for it.
+  Status SignalRequestToPeer(const std::string& uuid);
+
   // Start an election on the peer with UUID 'uuid'.
   Status StartElection(
       const std::string& uuid,
@@ -0,0 +1,108 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_replication_stats.h"
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(raft_peer_stats_window_ms);
+
+METRIC_DECLARE_entity(raft_peer);
+METRIC_DECLARE_gauge_int64(raft_peer_ops_per_sec);
+METRIC_DECLARE_gauge_int64(raft_peer_cache_miss_percent);
+
+namespace kudu {
+namespace consensus {
+
+class PeerReplicationStatsTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    FLAGS_raft_peer_stats_window_ms = 1000;
+    start_ = MonoTime::Now();
+  }
+
+ protected:
+  MonoTime At(int64_t ms) const {
+    return start_ + MonoDelta::FromMilliseconds(ms);
+  }
+
+  MetricRegistry registry_;
+  MonoTime start_;
+};
+
+TEST_F(PeerReplicationStatsTest, TestWindowRates) {
+  PeerReplicationStats stats(&registry_, "tablet", "peer", "region", start_);
+
+  stats.RecordRequest(At(100), 10, 1000, 0);
+  stats.RecordRequest(At(200), 30, 3000, 1000);
+  // Status-only requests do not count towards the batch size.
+  stats.RecordRequest(At(300), 0, 0, 0);
+  stats.RecordRoundTrip(MonoDelta::FromMicroseconds(100));
+  stats.RecordRoundTrip(MonoDelta::FromMicroseconds(300));
+  stats.RecordResponse(At(400));
+
+  // Nothing is reported until the first window is over.
+  PeerReplicationStats::Rates rates = stats.GetRates(At(900));
+  ASSERT_EQ(0, rates.ops_per_sec);
+  ASSERT_EQ(-1, rates.avg_rtt_us);
+
+  rates = stats.GetRates(At(1000));
+  ASSERT_EQ(40, rates.ops_per_sec);
+  ASSERT_EQ(4000, rates.bytes_per_sec);
+  ASSERT_EQ(200, rates.avg_rtt_us);
+  ASSERT_EQ(20, rates.avg_batch_ops);
+  ASSERT_EQ(25, rates.cache_miss_percent);
+
+  PeerReplicationStatsPB pb;
+  stats.ToPB(At(1500), &pb);
+  ASSERT_EQ(40, pb.ops_per_sec());
+  ASSERT_EQ(1100, pb.ms_since_last_response());
+  ASSERT_EQ("region", pb.region());
+
+  // An idle window reports nothing sent.
+  rates = stats.GetRates(At(2000));
+  ASSERT_EQ(0, rates.ops_per_sec);
+  ASSERT_EQ(-1, rates.avg_rtt_us);
+}
+
+TEST_F(PeerReplicationStatsTest, TestMetrics) {
+  scoped_refptr<MetricEntity> entity;
+  {
+    PeerReplicationStats stats(&registry_, "tablet", "peer", "region", start_);
+    stats.RecordRequest(At(100), 20, 1000, 1000);
+    stats.GetRates(At(2000));
+
+    entity = METRIC_ENTITY_raft_peer.Instantiate(&registry_, "tablet:peer");
+    ASSERT_EQ(10, METRIC_raft_peer_ops_per_sec.Instantiate(entity, 0)->value());
+    ASSERT_EQ(
+        100,
+        METRIC_raft_peer_cache_miss_percent.Instantiate(entity, 0)->value());
+  }
+  // The entity goes away with the peer.
+  ASSERT_FALSE(entity->published());
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,227 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_replication_stats.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+
+DEFINE_int32(
+    raft_peer_stats_window_ms,
+    0,
+    "If positive, a leader aggregates what it sends each peer, and how the "
+    "peer answers, over windows of this many milliseconds, and publishes the "
+    "rates of the last complete window as metrics of a 'raft_peer' entity "
+    "and in the peer's health report. 0 disables the statistics.");
+TAG_FLAG(raft_peer_stats_window_ms, experimental);
+TAG_FLAG(raft_peer_stats_window_ms, runtime);
+
+static bool ValidatePeerStatsWindow(const char* flagname, int32_t v) {
+  if (v >= 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must not be negative, got " << v;
+  return false;
+}
+DEFINE_validator(raft_peer_stats_window_ms, &ValidatePeerStatsWindow);
+
+METRIC_DEFINE_entity(raft_peer);
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_ops_per_sec,
+    "Ops Sent Per Second",
+    kudu::MetricUnit::kOperations,
+    "Ops per second the leader sent the peer over the last window of "
+    "--raft_peer_stats_window_ms.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_bytes_per_sec,
+    "Bytes Sent Per Second",
+    kudu::MetricUnit::kBytes,
+    "Op payload bytes per second the leader sent the peer over the last "
+    "window of --raft_peer_stats_window_ms.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_rtt_us,
+    "Average Round-Trip Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Average round-trip time of the direct requests to the peer that "
+    "succeeded over the last window of --raft_peer_stats_window_ms, or -1 if "
+    "there were none.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_batch_ops,
+    "Average Batch Size",
+    kudu::MetricUnit::kOperations,
+    "Average number of ops in the requests to the peer that carried any, "
+    "over the last window of --raft_peer_stats_window_ms.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_cache_miss_percent,
+    "Log Cache Miss Percentage",
+    kudu::MetricUnit::kUnits,
+    "Percentage of the bytes sent to the peer over the last window of "
+    "--raft_peer_stats_window_ms that were read from the log rather than the "
+    "log cache.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_peer,
+    raft_peer_time_since_last_response_ms,
+    "Time Since Last Successful Response",
+    kudu::MetricUnit::kMilliseconds,
+    "Milliseconds since the peer last answered successfully, as of the end "
+    "of the last window of --raft_peer_stats_window_ms.");
+
+namespace kudu {
+namespace consensus {
+
+bool PeerReplicationStatsEnabled() {
+  return FLAGS_raft_peer_stats_window_ms > 0;
+}
+
+PeerReplicationStats::PeerReplicationStats(
+    MetricRegistry* registry,
+    const std::string& tablet_id,
+    const std::string& peer_uuid,
+    const std::string& region,
+    MonoTime now)
+    : region_(region), window_start_(now), last_response_(now) {
+  if (registry == nullptr) {
+    return;
+  }
+  // A peer is in the config of every ring it replicates, so its id is
+  // qualified by the ring's tablet.
+  entity_ = METRIC_ENTITY_raft_peer.Instantiate(
+      registry,
+      strings::Substitute("$0:$1", tablet_id, peer_uuid),
+      {{"tablet_id", tablet_id},
+       {"peer_uuid", peer_uuid},
+       {"region", region}});
+  ops_per_sec_ = METRIC_raft_peer_ops_per_sec.Instantiate(entity_, 0);
+  bytes_per_sec_ = METRIC_raft_peer_bytes_per_sec.Instantiate(entity_, 0);
+  rtt_us_ = METRIC_raft_peer_rtt_us.Instantiate(entity_, -1);
+  batch_ops_ = METRIC_raft_peer_batch_ops.Instantiate(entity_, 0);
+  cache_miss_percent_ =
+      METRIC_raft_peer_cache_miss_percent.Instantiate(entity_, 0);
+  ms_since_last_response_ =
+      METRIC_raft_peer_time_since_last_response_ms.Instantiate(entity_, 0);
+}
+
+PeerReplicationStats::~PeerReplicationStats() {
+  if (entity_) {
+    entity_->Unpublish();
+  }
+}
+
+void PeerReplicationStats::RecordRequest(
+    MonoTime now,
+    int64_t ops,
+    int64_t bytes,
+    int64_t disk_bytes) {
+  MaybeRoll(now);
+  if (ops == 0) {
+    return;
+  }
+  requests_++;
+  ops_ += ops;
+  bytes_ += bytes;
+  disk_bytes_ += disk_bytes;
+}
+
+void PeerReplicationStats::RecordResponse(MonoTime now) {
+  MaybeRoll(now);
+  last_response_ = now;
+}
+
+void PeerReplicationStats::RecordRoundTrip(MonoDelta rtt) {
+  rtt_sum_us_ += rtt.ToMicroseconds();
+  round_trips_++;
+}
+
+PeerReplicationStats::Rates PeerReplicationStats::GetRates(MonoTime now) {
+  MaybeRoll(now);
+  return last_rates_;
+}
+
+void PeerReplicationStats::ToPB(MonoTime now, PeerReplicationStatsPB* pb) {
+  const Rates rates = GetRates(now);
+  pb->set_ops_per_sec(rates.ops_per_sec);
+  pb->set_bytes_per_sec(rates.bytes_per_sec);
+  pb->set_avg_rtt_us(rates.avg_rtt_us);
+  pb->set_avg_batch_ops(rates.avg_batch_ops);
+  pb->set_cache_miss_percent(rates.cache_miss_percent);
+  pb->set_ms_since_last_response(TimeSinceLastResponse(now).ToMilliseconds());
+  pb->set_region(region_);
+}
+
+void PeerReplicationStats::MaybeRoll(MonoTime now) {
+  const MonoDelta elapsed = now - window_start_;
+  const int64_t window_ms = FLAGS_raft_peer_stats_window_ms;
+  if (window_ms <= 0 || elapsed.ToMilliseconds() < window_ms) {
+    return;
+  }
+
+  // An idle stretch longer than a window counts as one long window, so the
+  // rates decay rather than stay at their last busy values.
+  const int64_t elapsed_us = std::max<int64_t>(1, elapsed.ToMicroseconds());
+  Rates rates;
+  rates.ops_per_sec = ops_ * 1000000 / elapsed_us;
+  rates.bytes_per_sec = bytes_ * 1000000 / elapsed_us;
+  if (round_trips_ > 0) {
+    rates.avg_rtt_us = rtt_sum_us_ / round_trips_;
+  }
+  if (requests_ > 0) {
+    rates.avg_batch_ops = ops_ / requests_;
+  }
+  if (bytes_ > 0) {
+    rates.cache_miss_percent =
+        std::min<int64_t>(100, disk_bytes_ * 100 / bytes_);
+  }
+  last_rates_ = rates;
+
+  window_start_ = now;
+  requests_ = 0;
+  ops_ = 0;
+  bytes_ = 0;
+  disk_bytes_ = 0;
+  rtt_sum_us_ = 0;
+  round_trips_ = 0;
+
+  if (entity_) {
+    ops_per_sec_->set_value(rates.ops_per_sec);
+    bytes_per_sec_->set_value(rates.bytes_per_sec);
+    rtt_us_->set_value(rates.avg_rtt_us);
+    batch_ops_->set_value(rates.avg_batch_ops);
+    cache_miss_percent_->set_value(rates.cache_miss_percent);
+    ms_since_last_response_->set_value(
+        TimeSinceLastResponse(now).ToMilliseconds());
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,117 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+class PeerReplicationStatsPB;
+
+// Returns true if leaders should keep PeerReplicationStats
+// (--raft_peer_stats_window_ms).
+bool PeerReplicationStatsEnabled();
+
+// What a leader sends one of its peers and how the peer answers, aggregated
+// over tumbling windows of --raft_peer_stats_window_ms. The rates of the last
+// complete window are published as gauges of a 'raft_peer' metric entity,
+// whose attributes name the tablet, the peer and its region, so that they can
+// be told apart in a scrape.
+//
+// Not thread-safe; PeerMessageQueue calls it under its lock.
+class PeerReplicationStats {
+ public:
+  struct Rates {
+    int64_t ops_per_sec = 0;
+    int64_t bytes_per_sec = 0;
+    // -1 if no round trip was recorded.
+    int64_t avg_rtt_us = -1;
+    // Over the requests that carried any ops.
+    int64_t avg_batch_ops = 0;
+    // Percentage of the bytes sent that were read from the log rather than
+    // found in the log cache.
+    int64_t cache_miss_percent = 0;
+  };
+
+  // 'registry' may be null, in which case nothing is published.
+  PeerReplicationStats(
+      MetricRegistry* registry,
+      const std::string& tablet_id,
+      const std::string& peer_uuid,
+      const std::string& region,
+      MonoTime now);
+  ~PeerReplicationStats();
+
+  // Records a request carrying 'ops' ops of 'bytes' bytes, 'disk_bytes' of
+  // which were read from the log.
+  void RecordRequest(
+      MonoTime now,
+      int64_t ops,
+      int64_t bytes,
+      int64_t disk_bytes);
+
+  // Records a successful response, and the round trip of its request if it
+  // was measured.
+  void RecordResponse(MonoTime now);
+  void RecordRoundTrip(MonoDelta rtt);
+
+  // Returns the rates of the last complete window as of 'now'.
+  Rates GetRates(MonoTime now);
+
+  MonoDelta TimeSinceLastResponse(MonoTime now) const {
+    return now - last_response_;
+  }
+
+  void ToPB(MonoTime now, PeerReplicationStatsPB* pb);
+
+ private:
+  // Closes the current window if it is over, computing 'last_rates_' and
+  // updating the gauges.
+  void MaybeRoll(MonoTime now);
+
+  const std::string region_;
+  scoped_refptr<MetricEntity> entity_;
+  scoped_refptr<AtomicGauge<int64_t>> ops_per_sec_;
+  scoped_refptr<AtomicGauge<int64_t>> bytes_per_sec_;
+  scoped_refptr<AtomicGauge<int64_t>> rtt_us_;
+  scoped_refptr<AtomicGauge<int64_t>> batch_ops_;
+  scoped_refptr<AtomicGauge<int64_t>> cache_miss_percent_;
+  scoped_refptr<AtomicGauge<int64_t>> ms_since_last_response_;
+
+  MonoTime window_start_;
+  int64_t requests_ = 0;
+  int64_t ops_ = 0;
+  int64_t bytes_ = 0;
+  int64_t disk_bytes_ = 0;
+  int64_t rtt_sum_us_ = 0;
+  int64_t round_trips_ = 0;
+
+  MonoTime last_response_;
+  Rates last_rates_;
+
+  DISALLOW_COPY_AND_ASSIGN(PeerReplicationStats);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,297 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/pending_rounds.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/consensus/time_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::map;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class PendingRoundsTest : public KuduTest {
+ public:
+  PendingRoundsTest()
+      : pending_("T test-tablet: ", "test-tablet", new TimeManagerDummy()) {}
+
+ protected:
+  // Adds a pending NO_OP with id 'term'.'index', recording the status it
+  // finishes with in 'finished_'.
+  void AddOp(int64_t term, int64_t index) {
+    ReplicateRefPtr msg = make_scoped_refptr_replicate(new ReplicateMsg);
+    msg->get()->mutable_id()->CopyFrom(MakeOpId(term, index));
+    msg->get()->set_timestamp(index);
+    msg->get()->set_op_type(NO_OP);
+    msg->get()->mutable_noop_request();
+    scoped_refptr<ConsensusRound> round(new ConsensusRound(nullptr, msg));
+    round->SetConsensusReplicatedCallback(
+        [this, index](const Status& s) { finished_.emplace(index, s); });
+    ASSERT_OK(pending_.AddPendingOperation(round));
+  }
+
+  // Asserts that exactly the ops with 'indexes' are pending.
+  void AssertPending(const vector<int64_t>& indexes, int64_t from, int64_t to) {
+    int num_pending = 0;
+    for (int64_t index = from; index <= to; index++) {
+      const bool expected =
+          std::find(indexes.begin(), indexes.end(), index) != indexes.end();
+      scoped_refptr<ConsensusRound> round =
+          pending_.GetPendingOpByIndexOrNull(index);
+      ASSERT_EQ(expected, round != nullptr) << "index " << index;
+      if (round) {
+        ASSERT_EQ(index, round->id().index());
+        num_pending++;
+      }
+    }
+    ASSERT_EQ(static_cast<int>(indexes.size()), num_pending);
+    ASSERT_EQ(num_pending, pending_.GetNumPendingTxns());
+    if (!indexes.empty()) {
+      ASSERT_EQ(
+          *std::max_element(indexes.begin(), indexes.end()),
+          pending_.GetLastPendingTransactionOpId().index());
+    }
+  }
+
+  // Asserts that GetPendingTermRun() agrees, for every index in ['from', 'to'],
+  // with a linear scan of the pending ops.
+  void AssertTermRunsMatchScan(int64_t from, int64_t to) {
+    for (int64_t index = from; index <= to; index++) {
+      scoped_refptr<ConsensusRound> round =
+          pending_.GetPendingOpByIndexOrNull(index);
+      int64_t term = -1;
+      int64_t run_last_index = -1;
+      const bool found =
+          pending_.GetPendingTermRun(index, &term, &run_last_index);
+      ASSERT_EQ(round != nullptr, found) << "index " << index;
+      if (!round) {
+        continue;
+      }
+      int64_t expected_last_index = index;
+      while (true) {
+        scoped_refptr<ConsensusRound> next =
+            pending_.GetPendingOpByIndexOrNull(expected_last_index + 1);
+        if (!next || next->id().term() != round->id().term()) {
+          break;
+        }
+        expected_last_index++;
+      }
+      ASSERT_EQ(round->id().term(), term) << "index " << index;
+      ASSERT_EQ(expected_last_index, run_last_index) << "index " << index;
+    }
+  }
+
+  PendingRounds pending_;
+
+  // The statuses the rounds finished with, by index.
+  map<int64_t, Status> finished_;
+};
+
+// Ops added out of order leave gaps, at either end, which later adds fill.
+TEST_F(PendingRoundsTest, TestOutOfOrderGaps) {
+  NO_FATALS(AddOp(1, 5));
+  NO_FATALS(AddOp(1, 7));
+  NO_FATALS(AssertPending({5, 7}, 1, 10));
+  NO_FATALS(AddOp(1, 3));
+  NO_FATALS(AssertPending({3, 5, 7}, 1, 10));
+
+  bool term_mismatch;
+  ASSERT_TRUE(pending_.IsOpCommittedOrPending(MakeOpId(1, 5), &term_mismatch));
+  ASSERT_FALSE(
+      pending_.IsOpCommittedOrPending(MakeOpId(1, 6), &term_mismatch));
+  ASSERT_FALSE(term_mismatch);
+  ASSERT_FALSE(
+      pending_.IsOpCommittedOrPending(MakeOpId(2, 5), &term_mismatch));
+  ASSERT_TRUE(term_mismatch);
+
+  NO_FATALS(AddOp(1, 4));
+  NO_FATALS(AddOp(1, 6));
+  NO_FATALS(AssertPending({3, 4, 5, 6, 7}, 1, 10));
+  ASSERT_TRUE(finished_.empty());
+}
+
+// Aborting ops drops them and the gaps before them, so that the last slot is
+// always filled.
+TEST_F(PendingRoundsTest, TestAbortTrimsGaps) {
+  ASSERT_OK(pending_.SetInitialCommittedOpId(MakeOpId(1, 1)));
+  NO_FATALS(AddOp(1, 2));
+  NO_FATALS(AddOp(1, 4));
+  NO_FATALS(AddOp(1, 6));
+  NO_FATALS(AddOp(1, 7));
+
+  pending_.AbortOpsAfter(4);
+  NO_FATALS(AssertPending({2, 4}, 1, 8));
+  ASSERT_EQ(2, finished_.size());
+  ASSERT_TRUE(finished_[6].IsAborted());
+  ASSERT_TRUE(finished_[7].IsAborted());
+
+  // Aborting after the committed index drops everything.
+  pending_.AbortOpsAfter(1);
+  NO_FATALS(AssertPending({}, 1, 8));
+  ASSERT_TRUE(finished_[2].IsAborted());
+  ASSERT_TRUE(finished_[4].IsAborted());
+
+  // The ops which replace the aborted ones start over.
+  finished_.clear();
+  NO_FATALS(AddOp(2, 2));
+  NO_FATALS(AddOp(2, 3));
+  NO_FATALS(AssertPending({2, 3}, 1, 8));
+  ASSERT_EQ(2, pending_.GetPendingOpByIndexOrNull(3)->id().term());
+  ASSERT_TRUE(finished_.empty());
+}
+
+// Committing ops moves them off the front along with the gap after them, if
+// any, and ops added into that gap later go in front.
+TEST_F(PendingRoundsTest, TestCommitTrimsGaps) {
+  ASSERT_OK(pending_.SetInitialCommittedOpId(MakeOpId(1, 1)));
+  NO_FATALS(AddOp(1, 2));
+  NO_FATALS(AddOp(1, 3));
+  NO_FATALS(AddOp(1, 5));
+  NO_FATALS(AddOp(1, 6));
+
+  ASSERT_OK(pending_.AdvanceCommittedIndex(3));
+  ASSERT_EQ(3, pending_.GetCommittedIndex());
+  NO_FATALS(AssertPending({5, 6}, 1, 8));
+  ASSERT_EQ(2, finished_.size());
+  ASSERT_OK(finished_[2]);
+  ASSERT_OK(finished_[3]);
+
+  bool term_mismatch;
+  ASSERT_TRUE(pending_.IsOpCommittedOrPending(MakeOpId(1, 3), &term_mismatch));
+  ASSERT_FALSE(
+      pending_.IsOpCommittedOrPending(MakeOpId(1, 4), &term_mismatch));
+
+  // Committing up to the gap commits nothing.
+  ASSERT_OK(pending_.AdvanceCommittedIndex(4));
+  NO_FATALS(AssertPending({5, 6}, 1, 8));
+  ASSERT_EQ(2, finished_.size());
+
+  NO_FATALS(AddOp(1, 4));
+  NO_FATALS(AssertPending({4, 5, 6}, 1, 8));
+  ASSERT_OK(pending_.AdvanceCommittedIndex(5));
+  ASSERT_EQ(5, pending_.GetCommittedIndex());
+  NO_FATALS(AssertPending({6}, 1, 8));
+  ASSERT_OK(finished_[4]);
+  ASSERT_OK(finished_[5]);
+
+  // Committing past the last op commits all of them.
+  ASSERT_OK(pending_.AdvanceCommittedIndex(10));
+  ASSERT_EQ(6, pending_.GetCommittedIndex());
+  NO_FATALS(AssertPending({}, 1, 8));
+  ASSERT_OK(finished_[6]);
+}
+
+// The term runs are cut back when ops are aborted, in the middle of a run or
+// at a term boundary.
+TEST_F(PendingRoundsTest, TestTermRunsAfterAborts) {
+  for (int64_t index = 1; index <= 8; index++) {
+    NO_FATALS(AddOp(index <= 3 ? 1 : (index <= 6 ? 2 : 3), index));
+  }
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  int64_t term;
+  int64_t run_last_index;
+  ASSERT_TRUE(pending_.GetPendingTermRun(4, &term, &run_last_index));
+  ASSERT_EQ(2, term);
+  ASSERT_EQ(6, run_last_index);
+
+  pending_.AbortOpsAfter(5);
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  ASSERT_TRUE(pending_.GetPendingTermRun(4, &term, &run_last_index));
+  ASSERT_EQ(5, run_last_index);
+
+  pending_.AbortOpsAfter(3);
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  ASSERT_FALSE(pending_.GetPendingTermRun(4, &term, &run_last_index));
+
+  // The ops of the new term start a new run, even where they follow on from
+  // the last one.
+  NO_FATALS(AddOp(4, 4));
+  NO_FATALS(AddOp(4, 5));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  ASSERT_TRUE(pending_.GetPendingTermRun(3, &term, &run_last_index));
+  ASSERT_EQ(1, term);
+  ASSERT_EQ(3, run_last_index);
+}
+
+// The term runs are rebuilt when ops fill gaps, which join the runs on either
+// side of them if they are of the same term, and stay correct as ops are then
+// committed and aborted.
+TEST_F(PendingRoundsTest, TestTermRunsAfterRebuilds) {
+  ASSERT_OK(pending_.SetInitialCommittedOpId(MakeOpId(1, 1)));
+  NO_FATALS(AddOp(1, 2));
+  NO_FATALS(AddOp(1, 3));
+  NO_FATALS(AddOp(2, 5));
+  NO_FATALS(AddOp(2, 6));
+  NO_FATALS(AddOp(3, 8));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+
+  // Filling the gap at the end of a term.
+  NO_FATALS(AddOp(1, 4));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  int64_t term;
+  int64_t run_last_index;
+  ASSERT_TRUE(pending_.GetPendingTermRun(2, &term, &run_last_index));
+  ASSERT_EQ(4, run_last_index);
+
+  // Filling the gap at the start of a term.
+  NO_FATALS(AddOp(3, 7));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  ASSERT_TRUE(pending_.GetPendingTermRun(7, &term, &run_last_index));
+  ASSERT_EQ(3, term);
+  ASSERT_EQ(8, run_last_index);
+
+  // Committing into the middle of a run.
+  ASSERT_OK(pending_.AdvanceCommittedIndex(5));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+  ASSERT_TRUE(pending_.GetPendingTermRun(6, &term, &run_last_index));
+  ASSERT_EQ(2, term);
+  ASSERT_EQ(6, run_last_index);
+
+  pending_.AbortOpsAfter(7);
+  NO_FATALS(AddOp(4, 8));
+  NO_FATALS(AddOp(4, 9));
+  NO_FATALS(AssertTermRunsMatchScan(0, 10));
+
+  // Filling a gap with an op of the same term as both neighbours joins them
+  // into one run.
+  NO_FATALS(AddOp(4, 11));
+  NO_FATALS(AddOp(4, 10));
+  NO_FATALS(AssertTermRunsMatchScan(0, 12));
+  ASSERT_TRUE(pending_.GetPendingTermRun(8, &term, &run_last_index));
+  ASSERT_EQ(11, run_last_index);
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -17,19 +17,23 @@
 
 #include "kudu/consensus/pending_rounds.h"
 
+#include <algorithm>
+#include <iterator>
 #include <ostream>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/op_latency_tracker.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/time_manager.h"
-#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/debug-util.h"
+#include "kudu/util/debug/trace_event.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
@@ -37,6 +41,7 @@
 
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -48,27 +53,68 @@ namespace consensus {
 
 PendingRounds::PendingRounds(
     string log_prefix,
+    string tablet_id,
     scoped_refptr<ITimeManager> time_manager)
     : log_prefix_(std::move(log_prefix)),
+      tablet_id_(std::move(tablet_id)),
+      first_pending_index_(0),
+      num_pending_txns_(0),
       last_committed_op_id_(MinimumOpId()),
       time_manager_(std::move(time_manager)) {}
 
 PendingRounds::~PendingRounds() {}
 
+scoped_refptr<ConsensusRound>* PendingRounds::SlotOrNull(int64_t index) {
+  if (index < first_pending_index_ ||
+      index - first_pending_index_ >=
+          static_cast<int64_t>(pending_txns_.size())) {
+    return nullptr;
+  }
+  return &pending_txns_[index - first_pending_index_];
+}
+
+void PendingRounds::TrimEmptySlots() {
+  while (!pending_txns_.empty() && !pending_txns_.front()) {
+    pending_txns_.pop_front();
+    first_pending_index_++;
+  }
+  while (!pending_txns_.empty() && !pending_txns_.back()) {
+    pending_txns_.pop_back();
+  }
+}
+
+void PendingRounds::RebuildTermRuns() {
+  term_runs_.clear();
+  int64_t index = first_pending_index_;
+  for (const auto& round : pending_txns_) {
+    if (round) {
+      const int64_t term = round->id().term();
+      if (!term_runs_.empty() && term_runs_.back().last_index == index - 1 &&
+          term_runs_.back().term == term) {
+        term_runs_.back().last_index = index;
+      } else {
+        term_runs_.push_back({index, index, term});
+      }
+    }
+    index++;
+  }
+}
+
 Status PendingRounds::CancelPendingTransactions() {
   ThreadRestrictions::AssertWaitAllowed();
   if (pending_txns_.empty()) {
     return Status::OK();
   }
 
-  LOG_WITH_PREFIX(INFO) << "Trying to abort " << pending_txns_.size()
+  LOG_WITH_PREFIX(INFO) << "Trying to abort " << num_pending_txns_
                         << " pending transactions.";
-  for (const auto& txn : pending_txns_) {
-    const scoped_refptr<ConsensusRound>& round = txn.second;
+  for (const auto& round : pending_txns_) {
+    if (!round) {
+      continue;
+    }
     // We cancel only transactions whose applies have not yet been triggered.
     LOG_WITH_PREFIX(INFO) << "Aborting transaction as it isn't in flight: "
-                          << SecureShortDebugString(
-                                 *txn.second->replicate_msg());
+                          << SecureShortDebugString(*round->replicate_msg());
     round->NotifyReplicationFinished(Status::Aborted("Transaction aborted"));
   }
   return Status::OK();
@@ -81,20 +127,38 @@ void PendingRounds::AbortOpsAfter(int64_t index) {
   DCHECK_GE(index, 0);
   OpId new_preceding;
 
-  auto iter = pending_txns_.lower_bound(index);
-
   // Either the new preceding id is in the pendings set or it must be equal to
   // the committed index since we can't truncate already committed operations.
-  if (iter != pending_txns_.end() && (*iter).first == index) {
-    new_preceding = (*iter).second->replicate_msg()->id();
-    ++iter;
+  scoped_refptr<ConsensusRound>* preceding = SlotOrNull(index);
+  if (preceding && *preceding) {
+    new_preceding = (*preceding)->replicate_msg()->id();
   } else {
     CHECK_EQ(index, last_committed_op_id_.index());
     new_preceding = last_committed_op_id_;
   }
 
-  for (; iter != pending_txns_.end();) {
-    const scoped_refptr<ConsensusRound>& round = (*iter).second;
+  // Truncate the aborted ops off the end at once, then abort them in order.
+  const int64_t first_kept = std::min<int64_t>(
+      std::max<int64_t>(index + 1 - first_pending_index_, 0),
+      pending_txns_.size());
+  auto first_aborted = pending_txns_.begin() + first_kept;
+  vector<scoped_refptr<ConsensusRound>> aborted(
+      std::make_move_iterator(first_aborted),
+      std::make_move_iterator(pending_txns_.end()));
+  pending_txns_.erase(first_aborted, pending_txns_.end());
+  TrimEmptySlots();
+  while (!term_runs_.empty() && term_runs_.back().first_index > index) {
+    term_runs_.pop_back();
+  }
+  if (!term_runs_.empty() && term_runs_.back().last_index > index) {
+    term_runs_.back().last_index = index;
+  }
+
+  for (const auto& round : aborted) {
+    if (!round) {
+      continue;
+    }
+    num_pending_txns_--;
     auto op_type = round->replicate_msg()->op_type();
     LOG_WITH_PREFIX(INFO) << "Aborting uncommitted "
                           << OperationType_Name(op_type)
@@ -103,20 +167,77 @@ void PendingRounds::AbortOpsAfter(int64_t index) {
 
     round->NotifyReplicationFinished(
         Status::Aborted("Transaction aborted by new leader"));
-    // Erase the entry from pendings.
-    pending_txns_.erase(iter++);
   }
 }
 
 Status PendingRounds::AddPendingOperation(
     const scoped_refptr<ConsensusRound>& round) {
-  InsertOrDie(&pending_txns_, round->replicate_msg()->id().index(), round);
+  const int64_t index = round->replicate_msg()->id().index();
+  const int64_t term = round->replicate_msg()->id().term();
+  // Ops are added in index order but for out-of-order adds into gaps, which
+  // are rare enough to recompute the runs for.
+  const bool in_order =
+      term_runs_.empty() || index > term_runs_.back().last_index;
+  if (pending_txns_.empty()) {
+    first_pending_index_ = index;
+  }
+  // Leave empty slots for any gap from the existing ops.
+  while (index < first_pending_index_) {
+    pending_txns_.emplace_front();
+    first_pending_index_--;
+  }
+  while (index - first_pending_index_ >=
+         static_cast<int64_t>(pending_txns_.size())) {
+    pending_txns_.emplace_back();
+  }
+  scoped_refptr<ConsensusRound>* slot = SlotOrNull(index);
+  CHECK(!*slot) << "Duplicate pending op with index " << index;
+  *slot = round;
+  num_pending_txns_++;
+
+  if (!in_order) {
+    RebuildTermRuns();
+  } else if (
+      !term_runs_.empty() && term_runs_.back().last_index == index - 1 &&
+      term_runs_.back().term == term) {
+    term_runs_.back().last_index = index;
+  } else {
+    term_runs_.push_back({index, index, term});
+  }
   return Status::OK();
 }
 
 scoped_refptr<ConsensusRound> PendingRounds::GetPendingOpByIndexOrNull(
     int64_t index) {
-  return FindPtrOrNull(pending_txns_, index);
+  scoped_refptr<ConsensusRound>* slot = SlotOrNull(index);
+  if (!slot) {
+    return nullptr;
+  }
+  return *slot;
+}
+
+bool PendingRounds::GetPendingTermRun(
+    int64_t index,
+    int64_t* term,
+    int64_t* run_last_index) const {
+  // Find the last run which starts at or before 'index'.
+  auto iter = std::upper_bound(
+      term_runs_.begin(),
+      term_runs_.end(),
+      index,
+      [](int64_t index, const TermRun& run) {
+        return index < run.first_index;
+      });
+  if (iter == term_runs_.begin()) {
+    return false;
+  }
+  --iter;
+  if (index > iter->last_index) {
+    return false;
+  }
+  *term = iter->term;
+  *run_last_index = iter->last_index;
+  return true;
 }
 
 bool PendingRounds::IsOpCommittedOrPending(
@@ -142,8 +263,7 @@ bool PendingRounds::IsOpCommittedOrPending(
 }
 
 OpId PendingRounds::GetLastPendingTransactionOpId() const {
-  return pending_txns_.empty() ? MinimumOpId()
-                               : (--pending_txns_.end())->second->id();
+  return pending_txns_.empty() ? MinimumOpId() : pending_txns_.back()->id();
 }
 
 Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
@@ -168,29 +288,58 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
     return Status::OK();
   }
 
-  // Start at the operation after the last committed one.
-  auto iter = pending_txns_.upper_bound(last_committed_op_id_.index());
-  // Stop at the operation after the last one we must commit.
-  auto end_iter = pending_txns_.upper_bound(committed_index);
-  CHECK(iter != pending_txns_.end());
+  // The ops after the last committed one and up to 'committed_index' are at
+  // the front: move them out at once, then commit them in order.
+  DCHECK_GT(first_pending_index_, last_committed_op_id_.index());
+  const int64_t num_committed = std::min<int64_t>(
+      std::max<int64_t>(committed_index - first_pending_index_ + 1, 0),
+      pending_txns_.size());
 
   VLOG_WITH_PREFIX(1) << "Last triggered apply was: " << last_committed_op_id_
-                      << " Starting to apply from log index: " << (*iter).first;
+                      << " Starting to apply from log index: "
+                      << first_pending_index_;
+
+  auto end_committed = pending_txns_.begin() + num_committed;
+  vector<scoped_refptr<ConsensusRound>> committed(
+      std::make_move_iterator(pending_txns_.begin()),
+      std::make_move_iterator(end_committed));
+  pending_txns_.erase(pending_txns_.begin(), end_committed);
+  first_pending_index_ += num_committed;
+  TrimEmptySlots();
+  while (!term_runs_.empty() &&
+         (pending_txns_.empty() ||
+          term_runs_.front().last_index < first_pending_index_)) {
+    term_runs_.pop_front();
+  }
+  if (!term_runs_.empty() &&
+      term_runs_.front().first_index < first_pending_index_) {
+    term_runs_.front().first_index = first_pending_index_;
+  }
 
-  while (iter != end_iter) {
-    scoped_refptr<ConsensusRound> round = (*iter).second; // Make a copy.
-    DCHECK(round);
+  // Drop the empty slots of any gaps, which the sequence check rejects.
+  committed.erase(
+      std::remove_if(
+          committed.begin(),
+          committed.end(),
+          [](const scoped_refptr<ConsensusRound>& round) { return !round; }),
+      committed.end());
+  for (const auto& round : committed) {
     const OpId& current_id = round->id();
 
     if (PREDICT_TRUE(!OpIdEquals(last_committed_op_id_, MinimumOpId()))) {
       CHECK_OK(CheckOpInSequence(last_committed_op_id_, current_id));
     }
 
-    pending_txns_.erase(iter++);
+    num_pending_txns_--;
     last_committed_op_id_ = round->id();
+    TRACE_EVENT_FLOW_END0(
+        "consensus", "Op", OpTraceFlowId(tablet_id_, current_id));
     time_manager_->AdvanceSafeTimeWithMessage(*round->replicate_msg());
     round->NotifyReplicationFinished(Status::OK());
   }
+  if (crcb_ && !committed.empty()) {
+    crcb_(committed);
+  }
 
   return Status::OK();
 }
@@ -198,7 +347,7 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
 Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
   CHECK_EQ(last_committed_op_id_.index(), 0);
   if (!pending_txns_.empty()) {
-    int64_t first_pending_index = pending_txns_.begin()->first;
+    int64_t first_pending_index = first_pending_index_;
     if (committed_op.index() < first_pending_index) {
       if (committed_op.index() != first_pending_index - 1) {
         return Status::Corruption(Substitute(
@@ -250,7 +399,7 @@ int64_t PendingRounds::GetTermWithLastCommittedOp() const {
 }
 
 int PendingRounds::GetNumPendingTxns() const {
-  return pending_txns_.size();
+  return num_pending_txns_;
 }
 
 } // namespace consensus
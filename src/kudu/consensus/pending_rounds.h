@@ -18,8 +18,11 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
+#include <deque>
+#include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
@@ -41,8 +44,13 @@ class ITimeManager;
 // "transaction". We should consolidate to "round".
 class PendingRounds {
  public:
+  typedef std::function<void(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds)>
+      CommittedRoundsCallback;
+
   PendingRounds(
       std::string log_prefix,
+      std::string tablet_id,
       scoped_refptr<ITimeManager> time_manager);
   ~PendingRounds();
 
@@ -62,11 +70,26 @@ class PendingRounds {
   // This is a no-op if the committed index has not changed.
   Status AdvanceCommittedIndex(int64_t committed_index);
 
+  // Sets a callback which AdvanceCommittedIndex() calls once with all the
+  // rounds it committed, in order, after their own replicated callbacks.
+  void SetCommittedRoundsCallback(CommittedRoundsCallback crcb) {
+    crcb_ = std::move(crcb);
+  }
+
   // Aborts pending operations after, but not including 'index'. The OpId with
   // 'index' will become our new last received id. If there are pending
   // operations with indexes higher than 'index' those operations are aborted.
   void AbortOpsAfter(int64_t index);
 
+  // Looks up the run of consecutive pending ops of one term which includes
+  // 'index', in O(log n) of the number of runs. If there is such a pending op,
+  // sets 'term' to the term of the run and 'run_last_index' to the index of
+  // its last op, and returns true. Otherwise returns false.
+  bool GetPendingTermRun(
+      int64_t index,
+      int64_t* term,
+      int64_t* run_last_index) const;
+
   // Returns true if an operation is in this replica's log, namely:
   // - If the op's index is lower than or equal to our committed index
   // - If the op id matches an inflight op.
@@ -104,11 +127,44 @@ class PendingRounds {
 
   const std::string log_prefix_;
 
-  // Index=>Round map that manages pending ops, i.e. operations for which we've
-  // received a replicate message from the leader but have yet to be committed.
-  // The key is the index of the replicate operation.
-  typedef std::map<int64_t, scoped_refptr<ConsensusRound>> IndexToRoundMap;
-  IndexToRoundMap pending_txns_;
+  // Identifies the ops in traces; see OpTraceFlowId().
+  const std::string tablet_id_;
+
+  // Returns the slot of the round with 'index' in 'pending_txns_', or NULL
+  // if 'index' is outside of it.
+  scoped_refptr<ConsensusRound>* SlotOrNull(int64_t index);
+
+  // Pops the empty slots off both ends of 'pending_txns_'.
+  void TrimEmptySlots();
+
+  // Recomputes 'term_runs_' from 'pending_txns_'.
+  void RebuildTermRuns();
+
+  // The pending ops, i.e. operations for which we've received a replicate
+  // message from the leader but have yet to be committed, indexed densely:
+  // the round with index i is at pending_txns_[i - first_pending_index_].
+  // Ops are added in index order, so the slots are filled but for the gaps
+  // left by out-of-order adds, if any; the first and last ones always are.
+  // Lookups are thus O(1), and aborting or committing a range of ops moves
+  // them out of one end at once.
+  std::deque<scoped_refptr<ConsensusRound>> pending_txns_;
+  int64_t first_pending_index_;
+
+  // The number of filled slots in 'pending_txns_'.
+  int num_pending_txns_;
+
+  // A run of consecutive pending ops of one term.
+  struct TermRun {
+    int64_t first_index;
+    int64_t last_index;
+    int64_t term;
+  };
+
+  // The maximal runs of consecutive pending ops of one term, in index order.
+  // Maintained as ops are added, aborted and committed, so that followers
+  // can check whether a batch of ops from the leader was already received a
+  // term run at a time; see GetPendingTermRun().
+  std::deque<TermRun> term_runs_;
 
   // The OpId of the round that was last committed. Initialized to
   // MinimumOpId().
@@ -116,6 +172,8 @@ class PendingRounds {
 
   scoped_refptr<ITimeManager> time_manager_;
 
+  CommittedRoundsCallback crcb_;
+
   DISALLOW_COPY_AND_ASSIGN(PendingRounds);
 };
 
@@ -22,6 +22,7 @@
 
 #include "kudu/consensus/persistent_vars.pb.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/fs/metadata_journal.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
@@ -101,13 +102,19 @@ Status PersistentVars::Flush(FlushMode flush_mode) {
 
   string persistent_vars_file_path =
       fs_manager_->GetPersistentVarsPath(tablet_id_);
+  // Overwrites may share their fsync with those of other rings.
+  fs::MetadataJournal* journal = fs_manager_->metadata_journal();
+  Status s = journal != nullptr && flush_mode == OVERWRITE
+      ? journal->Write(persistent_vars_file_path, pb_)
+      : pb_util::WritePBContainerToPath(
+            fs_manager_->env(),
+            persistent_vars_file_path,
+            pb_,
+            flush_mode == OVERWRITE ? pb_util::OVERWRITE
+                                    : pb_util::NO_OVERWRITE,
+            pb_util::SYNC);
   RETURN_NOT_OK_PREPEND(
-      pb_util::WritePBContainerToPath(
-          fs_manager_->env(),
-          persistent_vars_file_path,
-          pb_,
-          flush_mode == OVERWRITE ? pb_util::OVERWRITE : pb_util::NO_OVERWRITE,
-          pb_util::SYNC),
+      s,
       Substitute(
           "Unable to write persistent vars file for tablet $0 to path $1",
           tablet_id_,
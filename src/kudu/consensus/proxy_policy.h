@@ -39,6 +39,12 @@ enum class ProxyPolicy {
   // Routing topology needs to be explicilty supplied by external entities
   // Read DurableRoutingTable in routing.h/routing.cc for more details
   DURABLE_ROUTING_POLICY = 3,
+  // Like SIMPLE_REGION_ROUTING_POLICY, but the proxy peer of each region is
+  // the one with the lowest round-trip time from the leader, among those not
+  // lagging too far behind it. Routes are rebuilt from the leader's
+  // measurements at a capped rate, and a region's proxy is only replaced by
+  // a markedly faster one. Read LatencyAwareRoutingTable in routing.h.
+  LATENCY_AWARE_ROUTING_POLICY = 4,
 };
 } // namespace consensus
 } // namespace kudu
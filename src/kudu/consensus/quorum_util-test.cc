@@ -360,6 +360,37 @@ TEST(QuorumUtilTest, TestIsRaftConfigVoter) {
   ASSERT_FALSE(ReplicaTypesEqual(*peer_b, *peer_c));
 }
 
+TEST(QuorumUtilTest, TestRaftConfigSnapshot) {
+  RaftConfigPB config;
+  AddPeer(&config, "A", V);
+  AddPeer(&config, "B", V);
+  AddPeer(&config, "C", N);
+  config.mutable_peers(0)->mutable_attrs()->set_region("east");
+  config.mutable_peers(1)->mutable_attrs()->set_region("west");
+  config.mutable_peers(2)->mutable_attrs()->set_region("east");
+
+  auto snapshot = RaftConfigSnapshot::Create(config);
+  ASSERT_EQ(2, snapshot->num_voters());
+  ASSERT_TRUE(snapshot->IsVoter("A"));
+  ASSERT_FALSE(snapshot->IsVoter("C"));
+  ASSERT_FALSE(snapshot->IsVoter("D"));
+  ASSERT_EQ(nullptr, snapshot->FindPeer("D"));
+  const RaftPeerPB* peer_c = snapshot->FindPeer("C");
+  ASSERT_NE(nullptr, peer_c);
+  ASSERT_EQ("C.example.com", peer_c->last_known_addr().host());
+
+  ASSERT_EQ(2, snapshot->PeersInRegion("east").size());
+  ASSERT_EQ(1, snapshot->PeersInRegion("west").size());
+  ASSERT_TRUE(snapshot->PeersInRegion("north").empty());
+
+  // Without a commit rule there are no quorum ids.
+  ASSERT_EQ(0, snapshot->NumVotersInQuorum("east"));
+
+  // The snapshot owns its copy of the config.
+  config.clear_peers();
+  ASSERT_EQ(3, snapshot->config().peers_size());
+}
+
 // Tests paremeterized by the policy on the replica majority's health.
 class QuorumUtilHealthPolicyParamTest
     : public ::testing::Test,
@@ -18,6 +18,7 @@
 
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <ostream>
 #include <queue>
 #include <set>
@@ -1108,5 +1109,46 @@ bool PeerHasValidQuorumId(const RaftPeerPB& peer) {
       PeerHasNonEmptyQuorumId(peer);
 }
 
+std::shared_ptr<const RaftConfigSnapshot> RaftConfigSnapshot::Create(
+    RaftConfigPB config) {
+  return std::shared_ptr<const RaftConfigSnapshot>(
+      new RaftConfigSnapshot(std::move(config)));
+}
+
+RaftConfigSnapshot::RaftConfigSnapshot(RaftConfigPB config)
+    : config_(std::move(config)), num_voters_(0) {
+  for (const RaftPeerPB& peer : config_.peers()) {
+    peers_by_uuid_.emplace(peer.permanent_uuid(), &peer);
+    peers_by_region_[peer.attrs().region()].push_back(&peer);
+    if (peer.member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+    num_voters_++;
+    if (config_.has_commit_rule()) {
+      voters_by_quorum_id_[GetQuorumId(peer, config_.commit_rule())]++;
+    }
+  }
+}
+
+const RaftPeerPB* RaftConfigSnapshot::FindPeer(const string& uuid) const {
+  return FindWithDefault(peers_by_uuid_, uuid, nullptr);
+}
+
+bool RaftConfigSnapshot::IsVoter(const string& uuid) const {
+  const RaftPeerPB* peer = FindPeer(uuid);
+  return peer != nullptr && peer->member_type() == RaftPeerPB::VOTER;
+}
+
+const vector<const RaftPeerPB*>& RaftConfigSnapshot::PeersInRegion(
+    const string& region) const {
+  static const vector<const RaftPeerPB*> kNoPeers;
+  auto it = peers_by_region_.find(region);
+  return it == peers_by_region_.end() ? kNoPeers : it->second;
+}
+
+int RaftConfigSnapshot::NumVotersInQuorum(const string& quorum_id) const {
+  return FindWithDefault(voters_by_quorum_id_, quorum_id, 0);
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -17,8 +17,11 @@
 
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/util/status.h"
@@ -218,5 +221,47 @@ bool PeerHasNonEmptyQuorumId(const RaftPeerPB& peer);
 // Voter should have non-empty quorum id, non-voter should not have quorum-id
 bool PeerHasValidQuorumId(const RaftPeerPB& peer);
 
+// An immutable Raft config, with indexes derived from it once so that
+// lookups do not scan the peers. Snapshots are shared by pointer between
+// ConsensusMetadata and PeerMessageQueue rather than copied, and a new one
+// is made whenever the active config changes.
+class RaftConfigSnapshot {
+ public:
+  static std::shared_ptr<const RaftConfigSnapshot> Create(RaftConfigPB config);
+
+  const RaftConfigPB& config() const {
+    return config_;
+  }
+
+  // Returns the member with uuid 'uuid', or nullptr if there is none.
+  const RaftPeerPB* FindPeer(const std::string& uuid) const;
+
+  // Returns true if 'uuid' is a voter in the config.
+  bool IsVoter(const std::string& uuid) const;
+
+  // The members whose region is 'region'.
+  const std::vector<const RaftPeerPB*>& PeersInRegion(
+      const std::string& region) const;
+
+  // The number of voters in the config. Same as CountVoters(config()).
+  int num_voters() const {
+    return num_voters_;
+  }
+
+  // The number of voters whose GetQuorumId() under the config's commit rule
+  // is 'quorum_id'. Zero if the config has no commit rule.
+  int NumVotersInQuorum(const std::string& quorum_id) const;
+
+ private:
+  explicit RaftConfigSnapshot(RaftConfigPB config);
+
+  const RaftConfigPB config_;
+  std::unordered_map<std::string, const RaftPeerPB*> peers_by_uuid_;
+  std::unordered_map<std::string, std::vector<const RaftPeerPB*>>
+      peers_by_region_;
+  std::unordered_map<std::string, int> voters_by_quorum_id_;
+  int num_voters_;
+};
+
 } // namespace consensus
 } // namespace kudu
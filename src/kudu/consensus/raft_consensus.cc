@@ -52,7 +52,9 @@
 #include "kudu/consensus/consensus_meta_manager.h"
 #include "kudu/consensus/consensus_peers.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_reader.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/op_latency_tracker.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/peer_manager.h"
 #include "kudu/consensus/pending_rounds.h"
@@ -60,8 +62,10 @@
 #include "kudu/consensus/persistent_vars.pb.h"
 #include "kudu/consensus/persistent_vars_manager.h"
 #include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_resource_accounting.h"
 #include "kudu/consensus/replicate_msg_wrapper.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/consensus/startup_profile.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
@@ -73,21 +77,26 @@
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/rpc/messenger.h"
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/rpc_context.h"
+#include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/binary_log.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/kernel_stack_watchdog.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/process_memory.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
-#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread_restrictions.h"
 #include "kudu/util/threadpool.h"
@@ -119,6 +128,28 @@ DEFINE_int32(
     "increases exponentially, up to this value.");
 TAG_FLAG(leader_failure_exp_backoff_max_delta_ms, experimental);
 
+DEFINE_bool(
+    follower_opaque_payloads,
+    false,
+    "Whether a follower that is not backed by a database (see "
+    "RaftPeerAttrsPB::backing_db_present) stores write payloads exactly as "
+    "received, compressed and with the leader's checksum, in its log and log "
+    "cache, instead of uncompressing and checksumming them. Consumers of its "
+    "ops uncompress them on demand with RaftConsensus::UncompressReplicate().");
+TAG_FLAG(follower_opaque_payloads, experimental);
+
+DEFINE_bool(
+    raft_lightweight_witness,
+    false,
+    "Whether a replica that is not backed by a database (see "
+    "RaftPeerAttrsPB::backing_db_present) runs as a witness which only keeps "
+    "the log: it stores write payloads as received, as with "
+    "--follower_opaque_payloads, doesn't hand write ops to the round handler, "
+    "and keeps a log cache of --log_cache_witness_size_limit_mb without "
+    "read-ahead, compression or spill threads and tiers. Read when the "
+    "replica starts, for the log cache.");
+TAG_FLAG(raft_lightweight_witness, experimental);
+
 DEFINE_bool(
     enable_leader_failure_detection,
     true,
@@ -149,6 +180,43 @@ DEFINE_bool(
     "Warning! This is only intended for testing.");
 TAG_FLAG(follower_fail_all_prepare, unsafe);
 
+DEFINE_bool(
+    raft_follower_async_apply,
+    false,
+    "Whether a follower hands the ops it receives to the round handler "
+    "(ConsensusRoundHandler::StartFollowerTransaction()) on an ordered "
+    "pipeline of its own, instead of while handling the leader's update, so "
+    "that a slow round handler doesn't add to the replication latency. Read "
+    "when the replica starts.");
+TAG_FLAG(raft_follower_async_apply, experimental);
+
+DEFINE_int32(
+    raft_follower_apply_queue_max_ops,
+    10000,
+    "With --raft_follower_async_apply, the number of ops the follower apply "
+    "pipeline of a replica holds before the replica rejects further ops from "
+    "the leader, which then retries them.");
+TAG_FLAG(raft_follower_apply_queue_max_ops, experimental);
+TAG_FLAG(raft_follower_apply_queue_max_ops, runtime);
+
+DEFINE_int32(
+    raft_shutdown_handoff_timeout_ms,
+    0,
+    "How long a leader being shut down waits for leadership to be "
+    "transferred to the most caught up voter before shutting down anyway. "
+    "0 disables the handoff, leaving the followers to detect the leader's "
+    "failure.");
+TAG_FLAG(raft_shutdown_handoff_timeout_ms, experimental);
+TAG_FLAG(raft_shutdown_handoff_timeout_ms, runtime);
+
+DEFINE_int32(
+    raft_read_index_timeout_ms,
+    5000,
+    "How long a read index call waits for the leader to confirm its "
+    "leadership, or for a follower's RPC to the leader.");
+TAG_FLAG(raft_read_index_timeout_ms, advanced);
+TAG_FLAG(raft_read_index_timeout_ms, runtime);
+
 DEFINE_bool(
     raft_enable_pre_election,
     true,
@@ -157,6 +225,27 @@ DEFINE_bool(
 TAG_FLAG(raft_enable_pre_election, experimental);
 TAG_FLAG(raft_enable_pre_election, runtime);
 
+DEFINE_bool(
+    raft_enable_optimistic_election,
+    false,
+    "When enabled along with --raft_enable_pre_election, a candidate that "
+    "detects a leader failure runs the real election straight away, with "
+    "pre-vote checks, instead of a pre-election first. Once it loses an "
+    "election, it goes back to pre-elections until it sees a stable leader.");
+TAG_FLAG(raft_enable_optimistic_election, experimental);
+TAG_FLAG(raft_enable_optimistic_election, runtime);
+
+DEFINE_int32(
+    raft_leader_lease_max_clock_skew_ppm,
+    500,
+    "The most, in parts per million, that the monotonic clock of any server "
+    "may run fast or slow. Safe local reads on the leader stop this much "
+    "before the leader lease runs out, for both the leader's clock and a "
+    "grantor's. The default is the tolerance NTP assumes, which HybridClock "
+    "also accounts for through the skew its time service reports.");
+TAG_FLAG(raft_leader_lease_max_clock_skew_ppm, experimental);
+TAG_FLAG(raft_leader_lease_max_clock_skew_ppm, runtime);
+
 DEFINE_bool(
     raft_enable_tombstoned_voting,
     true,
@@ -185,6 +274,9 @@ TAG_FLAG(raft_log_cache_proxy_wait_time_ms, runtime);
 DECLARE_int32(memory_limit_warn_threshold_percentage);
 DECLARE_int32(consensus_max_batch_size_bytes); // defined in consensus_queue
                                                // (expose as method?)
+DECLARE_bool(raft_active_leadership_transfer);
+DECLARE_int32(raft_peer_health_evaluation_interval_ms);
+DECLARE_bool(raft_compact_heartbeats);
 DEFINE_bool(
     track_removed_peers,
     true,
@@ -200,11 +292,41 @@ DEFINE_int32(
     -1,
     "The threshold beyond which a VOTER will not give votes to CANDIDATE. -1 to turn it OFF");
 
+DEFINE_double(
+    raft_election_freshness_weight,
+    0,
+    "Share, between 0 and 1, of the randomized part of a follower's election "
+    "timeout which is ranked by how likely the follower is to win the "
+    "election rather than drawn at random: followers whose logs are closer "
+    "to the leader's, and in flexi-raft single region dynamic mode those in "
+    "the leader's quorum, time out first. 0 keeps the timeout random. At "
+    "most 0.75 is used, so that equally ranked followers still time out at "
+    "different times rather than split the vote.");
+TAG_FLAG(raft_election_freshness_weight, experimental);
+TAG_FLAG(raft_election_freshness_weight, runtime);
+
+DEFINE_int32(
+    raft_election_freshness_lag_ops,
+    1000,
+    "How many ops behind the leader's last appended op a follower's log must "
+    "be to rank last by --raft_election_freshness_weight.");
+TAG_FLAG(raft_election_freshness_lag_ops, experimental);
+TAG_FLAG(raft_election_freshness_lag_ops, runtime);
+
 DEFINE_bool(
     notify_commit_index_after_response,
     true,
     "Should we notify peers of commit index after every response?");
 
+DEFINE_int32(
+    raft_commit_notification_delay_ms,
+    0,
+    "With --notify_commit_index_after_response, how long the leader waits "
+    "for an advanced commit index to go out with the next batch or heartbeat "
+    "before sending it to the peers on its own. 0 sends it right away. "
+    "Can be overridden per tablet through ConsensusOptions.");
+TAG_FLAG(raft_commit_notification_delay_ms, experimental);
+
 DEFINE_int32(
     mock_elections_timeout_ms,
     5000,
@@ -241,8 +363,85 @@ DEFINE_bool(
     true,
     "Whether to enable reporting of proxy errors to error manager.");
 
+DEFINE_int32(
+    raft_adaptive_compression_interval_ms,
+    0,
+    "If positive, how often the leader of a ring picks the ring's compression "
+    "codec and level from the observed compression ratio and speed and from "
+    "whether any peer is in another region, overriding SetCompressionCodec() "
+    "and SetCompressionLevel(). 0 leaves both to the operator.");
+TAG_FLAG(raft_adaptive_compression_interval_ms, experimental);
+
+DEFINE_int32(
+    raft_compression_dict_training_interval_ms,
+    0,
+    "If positive, the leader of a ring samples the write payloads it "
+    "replicates and this often trains a new compression dictionary from the "
+    "recent samples, then sends it to the peers. Only rings using ZSTD_DICT "
+    "or LZ4_DICT, or letting --raft_adaptive_compression_interval_ms pick "
+    "their codec, train dictionaries. 0 disables training.");
+TAG_FLAG(raft_compression_dict_training_interval_ms, experimental);
+
+DEFINE_bool(
+    raft_follower_backpressure,
+    false,
+    "Whether followers report to the leader how full their log append queue "
+    "and log cache are, so that the leader shrinks the batches it sends them "
+    "in proportion rather than overflowing them and backing off.");
+TAG_FLAG(raft_follower_backpressure, experimental);
+TAG_FLAG(raft_follower_backpressure, runtime);
+
+DEFINE_int32(
+    raft_rpc_watch_stack_ms,
+    0,
+    "If positive, the kernel and user stacks of a thread which spends longer "
+    "than this many milliseconds handling an UpdateConsensus or RequestVote "
+    "RPC are logged. 0 disables the check.");
+TAG_FLAG(raft_rpc_watch_stack_ms, experimental);
+TAG_FLAG(raft_rpc_watch_stack_ms, runtime);
+
+DEFINE_int64(
+    raft_admission_max_uncommitted_bytes,
+    0,
+    "If positive, the leader rejects Replicate() with ServiceUnavailable, and "
+    "a hint of when to retry, while the payloads of the ops it replicated "
+    "which aren't committed yet add up to more than this many bytes. This "
+    "pushes back on the application before lagging peers make the log cache "
+    "evict ops they still need. An op is always admitted if none are "
+    "uncommitted. 0 disables the limit.");
+TAG_FLAG(raft_admission_max_uncommitted_bytes, experimental);
+TAG_FLAG(raft_admission_max_uncommitted_bytes, runtime);
+
+DEFINE_int64(
+    raft_admission_max_uncommitted_ops,
+    0,
+    "Like --raft_admission_max_uncommitted_bytes, for the number of ops the "
+    "commit quorum lags behind the leader. 0 disables the limit.");
+TAG_FLAG(raft_admission_max_uncommitted_ops, experimental);
+TAG_FLAG(raft_admission_max_uncommitted_ops, runtime);
+
 // Metrics
 // ---------
+METRIC_DEFINE_histogram(
+    server,
+    raft_consensus_lock_wait_time,
+    "Raft Consensus Lock Wait Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent waiting to acquire the Raft consensus state lock. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    server,
+    raft_consensus_lock_hold_time,
+    "Raft Consensus Lock Hold Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds the Raft consensus state lock was held for. "
+    "Only recorded with --lock_profiling.",
+    60000000LU,
+    2);
+
 METRIC_DEFINE_counter(
     server,
     raft_log_truncation_counter,
@@ -251,6 +450,15 @@ METRIC_DEFINE_counter(
     "Number of times ops written to raft log were truncated "
     "as a result of the new leader overwriting ops");
 
+METRIC_DEFINE_counter(
+    server,
+    leader_admission_rejections,
+    "Leader Admission Rejections",
+    kudu::MetricUnit::kRequests,
+    "Number of ops the leader refused to replicate because too many of the "
+    "ops it replicated were not committed yet. See "
+    "--raft_admission_max_uncommitted_bytes.");
+
 METRIC_DEFINE_counter(
     server,
     follower_memory_pressure_rejections,
@@ -281,6 +489,23 @@ METRIC_DEFINE_gauge_int64(
     "The time elapsed since the last heartbeat from the leader "
     "in milliseconds. This metric is identically zero on a leader replica.");
 
+METRIC_DEFINE_gauge_int64(
+    server,
+    follower_apply_queue_depth,
+    "Follower Apply Queue Depth",
+    kudu::MetricUnit::kOperations,
+    "Number of ops received by followers which are yet to be handed to the "
+    "round handler. Only used with --raft_follower_async_apply.");
+METRIC_DEFINE_histogram(
+    server,
+    follower_apply_queue_time,
+    "Follower Apply Queue Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds ops received by followers waited to be handed to the round "
+    "handler. Only used with --raft_follower_async_apply.",
+    60000000LU,
+    2);
+
 // Proxying metrics.
 METRIC_DEFINE_counter(
     server,
@@ -352,6 +577,7 @@ RaftConsensus::RaftConsensus(
     ThreadPool* raft_pool)
     : options_(std::move(options)),
       local_peer_pb_(std::move(local_peer_pb)),
+      binary_log_prefix_(std::make_shared<const string>(LogPrefixThreadSafe())),
       cmeta_manager_(std::move(cmeta_manager)),
       persistent_vars_manager_(std::move(persistent_vars_manager)),
       raft_pool_(raft_pool),
@@ -380,10 +606,20 @@ RaftConsensus::RaftConsensus(
 
 Status RaftConsensus::Init() {
   DCHECK_EQ(kNew, state_) << State_Name(state_);
-  RETURN_NOT_OK(cmeta_manager_->LoadCMeta(options_.tablet_id, &cmeta_));
+  {
+    ScopedStartupPhase phase(
+        options_.startup_profile, StartupPhase::kCmetaLoad, options_.tablet_id);
+    RETURN_NOT_OK(cmeta_manager_->LoadCMeta(options_.tablet_id, &cmeta_));
+  }
 
-  RETURN_NOT_OK(persistent_vars_manager_->LoadPersistentVars(
-      options_.tablet_id, &persistent_vars_));
+  {
+    ScopedStartupPhase phase(
+        options_.startup_profile,
+        StartupPhase::kPersistentVarsLoad,
+        options_.tablet_id);
+    RETURN_NOT_OK(persistent_vars_manager_->LoadPersistentVars(
+        options_.tablet_id, &persistent_vars_));
+  }
 
   if (!persistent_vars_->raft_rpc_token()) {
     persistent_vars_->set_raft_rpc_token(options_.initial_raft_rpc_token);
@@ -410,8 +646,12 @@ Status RaftConsensus::Init() {
   // Durable routing table is persisted - hence better to manage it through
   // consensus_meta_manager.
   std::shared_ptr<DurableRoutingTable> drt;
-  RETURN_NOT_OK(cmeta_manager_->LoadDRT(
-      options_.tablet_id, cmeta_->ActiveConfig(), &drt));
+  {
+    ScopedStartupPhase phase(
+        options_.startup_profile, StartupPhase::kDrtLoad, options_.tablet_id);
+    RETURN_NOT_OK(cmeta_manager_->LoadDRT(
+        options_.tablet_id, cmeta_->ActiveConfig(), &drt));
+  }
 
   // Build the container which holds all available routing tables
   routing_table_container_ = std::make_shared<RoutingTableContainer>(
@@ -466,6 +706,17 @@ Status RaftConsensus::Start(
   DCHECK(log_ != NULL);
   DCHECK(time_manager_ != NULL);
 
+  if (LockProfilingEnabled() && !lock_profile_) {
+    lock_profile_.reset(new LockProfile(
+        LogPrefixThreadSafe() + "RaftConsensus::lock_",
+        METRIC_raft_consensus_lock_wait_time.Instantiate(metric_entity),
+        METRIC_raft_consensus_lock_hold_time.Instantiate(metric_entity)));
+    lock_.set_profile(lock_profile_.get());
+  }
+  if (OpLatencyTracingEnabled() && !op_latency_tracker_) {
+    op_latency_tracker_.reset(new OpLatencyTracker(metric_entity));
+  }
+
   raft_log_truncation_counter_ =
       metric_entity->FindOrCreateCounter(&METRIC_raft_log_truncation_counter);
 
@@ -473,6 +724,8 @@ Status RaftConsensus::Start(
       metric_entity->FindOrCreateGauge(&METRIC_raft_term, CurrentTerm());
   follower_memory_pressure_rejections_ = metric_entity->FindOrCreateCounter(
       &METRIC_follower_memory_pressure_rejections);
+  leader_admission_rejections_ = metric_entity->FindOrCreateCounter(
+      &METRIC_leader_admission_rejections);
 
   num_failed_elections_metric_ = metric_entity->FindOrCreateGauge(
       &METRIC_failed_elections_since_stable_leader,
@@ -505,6 +758,18 @@ Status RaftConsensus::Start(
   // for destroying the token.
   raft_pool_token_ =
       raft_pool_->NewToken(ThreadPool::ExecutionMode::CONCURRENT);
+  if (FLAGS_raft_follower_async_apply && !follower_apply_token_) {
+    follower_apply_token_ =
+        raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+    follower_apply_queue_depth_ = metric_entity->FindOrCreateGauge(
+        &METRIC_follower_apply_queue_depth, static_cast<int64_t>(0));
+    follower_apply_queue_time_ =
+        METRIC_follower_apply_queue_time.Instantiate(metric_entity);
+  }
+  if (options_.peer_send_pool) {
+    peer_send_pool_token_ = options_.peer_send_pool->NewToken(
+        ThreadPool::ExecutionMode::CONCURRENT);
+  }
 
   // The message queue that keeps track of which operations need to be
   // replicated where.
@@ -539,10 +804,21 @@ Status RaftConsensus::Start(
       peer_uuid(),
       peer_proxy_factory_.get(),
       queue.get(),
-      raft_pool_token_.get()));
+      peer_send_pool_token_ ? peer_send_pool_token_.get()
+                            : raft_pool_token_.get()));
 
   unique_ptr<PendingRounds> pending(
-      new PendingRounds(LogPrefixThreadSafe(), time_manager_));
+      new PendingRounds(
+          LogPrefixThreadSafe(), options_.tablet_id, time_manager_));
+  if (crcb_) {
+    // Rounds the round handler hasn't seen yet could be reported committed.
+    if (follower_apply_token_) {
+      return Status::NotSupported(
+          "a committed rounds callback can't be used with "
+          "--raft_follower_async_apply");
+    }
+    pending->SetCommittedRoundsCallback(crcb_);
+  }
 
   // Capture a weak_ptr reference into the functor so it can safely handle
   // outliving the consensus instance.
@@ -568,6 +844,69 @@ Status RaftConsensus::Start(
       MinimumElectionTimeout(),
       opts);
 
+  CreateCommitNotificationTimer(std::max(CommitNotificationDelayMs(), 1));
+
+  if (FLAGS_raft_adaptive_compression_interval_ms > 0) {
+    compression_policy_timer_ = PeriodicTimer::Create(
+        peer_proxy_factory_->messenger(),
+        [w]() {
+          if (auto consensus = w.lock()) {
+            // Building a codec may be expensive, so do it off the reactor.
+            WARN_NOT_OK(
+                consensus->raft_pool_token_->SubmitFunc(
+                    [w]() {
+                      if (auto self = w.lock()) {
+                        self->AdaptCompression();
+                      }
+                    }),
+                "Unable to schedule compression policy");
+          }
+        },
+        MonoDelta::FromMilliseconds(
+            FLAGS_raft_adaptive_compression_interval_ms));
+  }
+
+  if (FLAGS_raft_compression_dict_training_interval_ms > 0) {
+    dict_trainer_.reset(new CompressionDictTrainer());
+    dict_training_timer_ = PeriodicTimer::Create(
+        peer_proxy_factory_->messenger(),
+        [w]() {
+          if (auto consensus = w.lock()) {
+            // Training takes seconds, so do it off the reactor.
+            WARN_NOT_OK(
+                consensus->raft_pool_token_->SubmitFunc(
+                    [w]() {
+                      if (auto self = w.lock()) {
+                        self->TrainCompressionDict();
+                      }
+                    }),
+                "Unable to schedule compression dictionary training");
+          }
+        },
+        MonoDelta::FromMilliseconds(
+            FLAGS_raft_compression_dict_training_interval_ms));
+  }
+
+  if (PeerMessageQueue::PeerHealthEvaluatedInBackground()) {
+    peer_health_timer_ = PeriodicTimer::Create(
+        peer_proxy_factory_->messenger(),
+        [w]() {
+          if (auto consensus = w.lock()) {
+            // Keep the reactor off the queue lock.
+            WARN_NOT_OK(
+                consensus->raft_pool_token_->SubmitFunc(
+                    [w]() {
+                      if (auto self = w.lock()) {
+                        self->queue_->EvaluatePeerHealth();
+                      }
+                    }),
+                "Unable to schedule peer health evaluation");
+          }
+        },
+        MonoDelta::FromMilliseconds(
+            FLAGS_raft_peer_health_evaluation_interval_ms));
+  }
+
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -650,6 +989,16 @@ Status RaftConsensus::Start(
         {INITIAL_SINGLE_NODE_ELECTION, std::chrono::system_clock::now()}));
   }
 
+  if (compression_policy_timer_) {
+    compression_policy_timer_->Start();
+  }
+  if (dict_training_timer_) {
+    dict_training_timer_->Start();
+  }
+  if (peer_health_timer_) {
+    peer_health_timer_->Start();
+  }
+
   // Report become visible to the Master.
   MarkDirty("RaftConsensus started");
 
@@ -721,7 +1070,7 @@ Status RaftConsensus::StartElection(
     ElectionMode mode,
     ElectionContext context,
     std::function<void(const ElectionResult&)> callback) {
-  const char* const mode_str = ModeString(mode);
+  const char* mode_str = ModeString(mode);
 
   TRACE_EVENT2(
       "consensus",
@@ -736,6 +1085,18 @@ Status RaftConsensus::StartElection(
     LockGuard l(lock_);
     RETURN_NOT_OK(CheckRunningUnlocked());
 
+    // Skip the pre-election's round trip, unless the last election was lost:
+    // the pre-vote checks keep voters from advancing their terms for a
+    // candidate that can't win, but the candidate's own term still advances.
+    bool pre_vote = false;
+    if (mode == PRE_ELECTION && FLAGS_raft_enable_optimistic_election &&
+        context.reason_ == ElectionReason::ELECTION_TIMEOUT_EXPIRED &&
+        failed_elections_since_stable_leader_ == 0) {
+      mode = NORMAL_ELECTION;
+      mode_str = "leader election with pre-vote checks";
+      pre_vote = true;
+    }
+
     if (!persistent_vars_->is_start_election_allowed()) {
       std::string msg = Substitute(
           "allow_start_election is set to false, not starting $0", mode_str);
@@ -865,6 +1226,9 @@ Status RaftConsensus::StartElection(
     }
 
     request.set_mode(mode);
+    if (pre_vote) {
+      request.set_pre_vote(true);
+    }
 
     // Since there will be older versions that still use the is_pre_election and
     // ignore_live_leader fields, defensively, we will set these fields
@@ -1121,6 +1485,274 @@ MonoTime RaftConsensus::GetLeaderLeaseUntil() {
   return queue_->GetLeaderLeaseUntil();
 }
 
+MonoTime RaftConsensus::GetSafeLocalReadUntil() {
+  if (!FLAGS_enable_raft_leader_lease) {
+    return MonoTime::Min();
+  }
+  MonoTime lease_until;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    // On a follower, the queue holds the lease it granted its leader, which
+    // isn't one it may serve reads under. A new term's leader starts with no
+    // lease, and stepping down takes 'lock_', so the lease read here is one
+    // this leader earned in its current term.
+    if (cmeta_->active_role() != RaftPeerPB::LEADER) {
+      return MonoTime::Min();
+    }
+    lease_until = queue_->GetLeaderLeaseUntil();
+  }
+  if (lease_until == MonoTime::Min()) {
+    return lease_until;
+  }
+  // Followers time the lease on their own clocks, so one running slow
+  // against ours stops withholding its vote early by up to the skew of both.
+  const int64_t max_drift_us =
+      PeerMessageQueue::LeaderLeaseTimeout().ToMicroseconds() * 2 *
+      FLAGS_raft_leader_lease_max_clock_skew_ppm / 1000000;
+  return lease_until - MonoDelta::FromMicroseconds(max_drift_us);
+}
+
+// The state of a read index RPC to the leader.
+struct RaftConsensus::ForwardedReadIndexCall {
+  ReadIndexRequestPB request;
+  ReadIndexResponsePB response;
+  rpc::RpcController controller;
+  shared_ptr<PeerProxy> proxy;
+  vector<ReadIndexCallback> batch;
+};
+
+void RaftConsensus::LeaderReadIndexAsync(ReadIndexCallback done) {
+  Status s;
+  int64_t read_index = 0;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok()) {
+      s = CheckActiveLeaderUnlocked();
+    }
+    // Until an op of its own term is committed, a new leader doesn't know
+    // everything committed by earlier leaders.
+    if (s.ok() && !queue_->IsCommittedIndexInCurrentTerm()) {
+      s = Status::ServiceUnavailable(
+          "the leader hasn't committed an op in its term yet");
+    }
+    read_index = queue_->GetCommittedIndex();
+  }
+  if (!s.ok()) {
+    done(s, 0);
+    return;
+  }
+  if (GetSafeLocalReadUntil() > MonoTime::Now()) {
+    done(Status::OK(), read_index);
+    return;
+  }
+  bool start_round;
+  {
+    std::lock_guard<simple_spinlock> l(read_index_lock_);
+    read_index_batch_.emplace_back(read_index, std::move(done));
+    start_round = !read_index_round_in_flight_;
+    read_index_round_in_flight_ = true;
+  }
+  if (start_round) {
+    StartReadIndexRound();
+  }
+}
+
+void RaftConsensus::StartReadIndexRound() {
+  auto batch =
+      std::make_shared<vector<std::pair<int64_t, ReadIndexCallback>>>();
+  {
+    std::lock_guard<simple_spinlock> l(read_index_lock_);
+    batch->swap(read_index_batch_);
+  }
+  // Every call in the batch chose its read index before 'since'.
+  const MonoTime since = MonoTime::Now();
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  queue_->ConfirmLeadershipAsync(
+      since,
+      since + MonoDelta::FromMilliseconds(FLAGS_raft_read_index_timeout_ms),
+      [w, batch](const Status& s) {
+        for (auto& entry : *batch) {
+          entry.second(s, s.ok() ? entry.first : 0);
+        }
+        if (auto self = w.lock()) {
+          bool more;
+          {
+            std::lock_guard<simple_spinlock> l(self->read_index_lock_);
+            more = !self->read_index_batch_.empty();
+            self->read_index_round_in_flight_ = more;
+          }
+          if (more) {
+            self->StartReadIndexRound();
+          }
+        }
+      });
+  // Don't wait for the next heartbeat.
+  peer_manager_->SignalRequest(true);
+}
+
+void RaftConsensus::ReadIndexAsync(ReadIndexCallback done) {
+  bool is_leader;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    is_leader = cmeta_->active_role() == RaftPeerPB::LEADER;
+  }
+  if (is_leader) {
+    LeaderReadIndexAsync(std::move(done));
+    return;
+  }
+  bool start_round;
+  {
+    std::lock_guard<simple_spinlock> l(read_index_lock_);
+    forwarded_read_index_batch_.emplace_back(std::move(done));
+    start_round = !forwarded_read_index_in_flight_;
+    forwarded_read_index_in_flight_ = true;
+  }
+  if (start_round) {
+    StartForwardedReadIndexRound();
+  }
+}
+
+void RaftConsensus::StartForwardedReadIndexRound() {
+  auto call = std::make_shared<ForwardedReadIndexCall>();
+  {
+    std::lock_guard<simple_spinlock> l(read_index_lock_);
+    call->batch.swap(forwarded_read_index_batch_);
+  }
+  RaftPeerPB leader_pb;
+  Status s;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok() && cmeta_->leader_uuid().empty()) {
+      s = Status::ServiceUnavailable("no known leader");
+    }
+    if (s.ok()) {
+      s = cmeta_->GetConfigMemberCopy(cmeta_->leader_uuid(), &leader_pb);
+    }
+  }
+  if (s.ok()) {
+    s = peer_proxy_factory_->NewProxy(leader_pb, &call->proxy);
+  }
+  if (!s.ok()) {
+    for (const auto& done : call->batch) {
+      done(s, 0);
+    }
+    CompleteForwardedReadIndexRound(call);
+    return;
+  }
+  call->request.set_dest_uuid(leader_pb.permanent_uuid());
+  call->request.set_tablet_id(options_.tablet_id);
+  call->request.set_caller_uuid(peer_uuid());
+  call->controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_raft_read_index_timeout_ms));
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  call->proxy->ReadIndexAsync(
+      &call->request, &call->response, &call->controller, [w, call]() {
+        // Runs on a reactor thread, which mustn't take 'lock_'.
+        Status s = Status::Aborted("replica was shut down");
+        auto self = w.lock();
+        if (self) {
+          s = self->raft_pool_token_->SubmitFunc(
+              [self, call]() { self->CompleteForwardedReadIndexRound(call); });
+        }
+        if (s.ok()) {
+          return;
+        }
+        if (self) {
+          // Fail the calls batched meanwhile too, rather than leave them
+          // waiting for a round that won't start.
+          std::lock_guard<simple_spinlock> l(self->read_index_lock_);
+          for (auto& done : self->forwarded_read_index_batch_) {
+            call->batch.emplace_back(std::move(done));
+          }
+          self->forwarded_read_index_batch_.clear();
+          self->forwarded_read_index_in_flight_ = false;
+        }
+        for (const auto& done : call->batch) {
+          done(s, 0);
+        }
+      });
+}
+
+void RaftConsensus::CompleteForwardedReadIndexRound(
+    const shared_ptr<ForwardedReadIndexCall>& call) {
+  bool more;
+  {
+    std::lock_guard<simple_spinlock> l(read_index_lock_);
+    more = !forwarded_read_index_batch_.empty();
+    forwarded_read_index_in_flight_ = more;
+  }
+  if (more) {
+    StartForwardedReadIndexRound();
+  }
+  if (!call->proxy) {
+    // Failed before it was sent.
+    return;
+  }
+  Status s = call->controller.status();
+  if (s.ok() && call->response.has_error()) {
+    s = StatusFromPB(call->response.error().status());
+  }
+  if (!s.ok()) {
+    for (const auto& done : call->batch) {
+      done(s, 0);
+    }
+    return;
+  }
+  for (auto& done : call->batch) {
+    WaitForCommittedIndex(call->response.read_index(), std::move(done));
+  }
+}
+
+void RaftConsensus::WaitForCommittedIndex(
+    int64_t read_index,
+    ReadIndexCallback done) {
+  Status s;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok() && pending_->GetCommittedIndex() < read_index) {
+      read_index_waiters_.emplace(read_index, std::move(done));
+      return;
+    }
+  }
+  done(s, s.ok() ? read_index : 0);
+}
+
+void RaftConsensus::NotifyReadIndexWaitersUnlocked() {
+  DCHECK(lock_.is_locked());
+  if (read_index_waiters_.empty()) {
+    return;
+  }
+  const int64_t committed_index = pending_->GetCommittedIndex();
+  auto end = read_index_waiters_.upper_bound(committed_index);
+  if (end == read_index_waiters_.begin()) {
+    return;
+  }
+  auto ready =
+      std::make_shared<vector<std::pair<int64_t, ReadIndexCallback>>>();
+  for (auto it = read_index_waiters_.begin(); it != end; ++it) {
+    ready->emplace_back(it->first, std::move(it->second));
+  }
+  read_index_waiters_.erase(read_index_waiters_.begin(), end);
+  Status s = raft_pool_token_->SubmitFunc([ready]() {
+    for (auto& entry : *ready) {
+      entry.second(Status::OK(), entry.first);
+    }
+  });
+  if (!s.ok()) {
+    for (auto& entry : *ready) {
+      entry.second(s, 0);
+    }
+  }
+}
+
 MonoTime RaftConsensus::GetBoundedDataLossWindowUntil() {
   return queue_->GetBoundedDataLossWindowUntil();
 }
@@ -1141,6 +1773,14 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
 
   transfer_period_timer_->Start();
 
+  if (successor_uuid && FLAGS_raft_active_leadership_transfer) {
+    // Rather than wait for the next heartbeat to learn how far behind the
+    // successor is, start pushing it the rest of the log now.
+    WARN_NOT_OK(
+        peer_manager_->SignalRequestToPeer(*successor_uuid),
+        LogPrefixUnlocked() + "Unable to signal leadership transfer successor");
+  }
+
   if (FLAGS_enable_raft_leader_lease) {
     // Revoke for Leader lease here
     peer_manager_->SignalRequest(
@@ -1163,6 +1803,15 @@ scoped_refptr<ConsensusRound> RaftConsensus::NewRound(
       this, std::move(replicate_msg), std::move(replicated_cb)));
 }
 
+scoped_refptr<ConsensusRound> RaftConsensus::NewRound(
+    unique_ptr<ReplicateMsg> replicate_msg,
+    string payload,
+    ConsensusReplicatedCallback replicated_cb) {
+  DCHECK(!replicate_msg->write_payload().has_payload());
+  replicate_msg->mutable_write_payload()->set_payload(std::move(payload));
+  return NewRound(std::move(replicate_msg), std::move(replicated_cb));
+}
+
 scoped_refptr<ConsensusRound> RaftConsensus::NewRound(
     unique_ptr<ReplicateMsg> replicate_msg) {
   ReplicateRefPtr r(new RefCountedReplicate(replicate_msg.release()));
@@ -1215,6 +1864,7 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
 
   // Disable FD while we are leader.
   DisableFailureDetector();
+  DisarmHeartbeatFastPathUnlocked();
 
   // Don't vote for anyone if we're a leader.
   withhold_votes_until_ = MonoTime::Max();
@@ -1222,6 +1872,12 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
   // Leadership never starts in a transfer period.
   EndLeaderTransferPeriod();
 
+  // Only ops of this term count towards admission control.
+  uncommitted_ops_.clear();
+  uncommitted_bytes_ = 0;
+  commit_bytes_per_sec_ = -1;
+  last_uncommitted_trim_ = MonoTime();
+
   queue_->RegisterObserver(this);
   RETURN_NOT_OK(RefreshConsensusQueueAndPeersUnlocked());
 
@@ -1279,8 +1935,9 @@ Status RaftConsensus::BecomeReplicaUnlocked(
   // Deregister ourselves from the queue. We no longer need to track what gets
   // replicated since we're stepping down.
   queue_->UnRegisterObserver(this);
-  queue_->SetNonLeaderMode(cmeta_->ActiveConfig());
+  queue_->SetNonLeaderMode(cmeta_->ActiveConfigSnapshot());
   peer_manager_->Close();
+  commit_notification_timer_->Stop();
 
   return Status::OK();
 }
@@ -1292,13 +1949,49 @@ Status RaftConsensus::Replicate(const scoped_refptr<ConsensusRound>& round) {
     LockGuard l(lock_);
     RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*round->replicate_msg()));
     RETURN_NOT_OK(round->CheckBoundTerm(CurrentTermUnlocked()));
+    const WritePayloadPB& payload = round->replicate_msg()->write_payload();
+    if (PREDICT_FALSE(payload.has_fragment())) {
+      // The fragments of a payload go out in order, all in this term.
+      RETURN_NOT_OK(payload_fragments_.Check(CurrentTermUnlocked(), payload));
+    }
+    const bool admission_control =
+        FLAGS_raft_admission_max_uncommitted_bytes > 0 ||
+        FLAGS_raft_admission_max_uncommitted_ops > 0;
+    const int64_t payload_bytes = payload.payload().size();
+    if (PREDICT_FALSE(admission_control)) {
+      RETURN_NOT_OK(CheckAdmissionUnlocked(payload_bytes));
+    }
     RETURN_NOT_OK(AppendNewRoundToQueueUnlocked(round));
+    if (PREDICT_FALSE(payload.has_fragment())) {
+      bool completes_payload;
+      CHECK_OK(payload_fragments_.Add(
+          CurrentTermUnlocked(), payload, &completes_payload));
+    }
+    if (PREDICT_FALSE(admission_control)) {
+      uncommitted_ops_.emplace_back(
+          round->replicate_msg()->id().index(), payload_bytes);
+      uncommitted_bytes_ += payload_bytes;
+    }
   }
 
   peer_manager_->SignalRequest();
   return Status::OK();
 }
 
+void RaftConsensus::RecordOpLatency(
+    const OpId& id,
+    const OpLatencyTrace& trace) {
+  if (op_latency_tracker_) {
+    op_latency_tracker_->Record(id, trace);
+  }
+}
+
+void RaftConsensus::DumpSlowestOps(std::ostream* out) const {
+  if (op_latency_tracker_) {
+    op_latency_tracker_->DumpSlowestOps(out);
+  }
+}
+
 Status RaftConsensus::TruncateCallbackWithRaftLock(
     int64_t* index_if_truncated) {
   DCHECK(FLAGS_raft_derived_log_mode);
@@ -1318,6 +2011,74 @@ Status RaftConsensus::TruncateCallbackWithRaftLock(
   return Status::OK();
 }
 
+Status RaftConsensus::CheckAdmissionUnlocked(int64_t bytes) {
+  DCHECK(lock_.is_locked());
+  // Forget the ops which have committed since, measuring how fast they did.
+  const int64_t committed_index = queue_->GetCommittedIndex();
+  int64_t committed_bytes = 0;
+  while (!uncommitted_ops_.empty() &&
+         uncommitted_ops_.front().first <= committed_index) {
+    committed_bytes += uncommitted_ops_.front().second;
+    uncommitted_ops_.pop_front();
+  }
+  uncommitted_bytes_ -= committed_bytes;
+  const MonoTime now = MonoTime::Now();
+  if (committed_bytes > 0) {
+    if (last_uncommitted_trim_.Initialized()) {
+      const int64_t elapsed_us =
+          std::max<int64_t>((now - last_uncommitted_trim_).ToMicroseconds(), 1);
+      const int64_t sample =
+          committed_bytes * MonoTime::kMicrosecondsPerSecond / elapsed_us;
+      commit_bytes_per_sec_ = commit_bytes_per_sec_ < 0
+          ? sample
+          : (3 * commit_bytes_per_sec_ + sample) / 4;
+    }
+    last_uncommitted_trim_ = now;
+  } else if (uncommitted_ops_.empty()) {
+    last_uncommitted_trim_ = now;
+  }
+  if (uncommitted_ops_.empty()) {
+    return Status::OK();
+  }
+
+  // How many bytes have to commit before the op fits.
+  const int64_t num_ops = uncommitted_ops_.size();
+  int64_t excess_bytes = 0;
+  const int64_t max_bytes = FLAGS_raft_admission_max_uncommitted_bytes;
+  if (max_bytes > 0 && uncommitted_bytes_ + bytes > max_bytes) {
+    excess_bytes = uncommitted_bytes_ + bytes - max_bytes;
+  }
+  const int64_t max_ops = FLAGS_raft_admission_max_uncommitted_ops;
+  if (max_ops > 0 && num_ops >= max_ops) {
+    excess_bytes = std::max(
+        excess_bytes,
+        std::max<int64_t>(uncommitted_bytes_ / num_ops, 1) *
+            (num_ops - max_ops + 1));
+  }
+  if (excess_bytes == 0) {
+    return Status::OK();
+  }
+
+  int64_t retry_ms = FLAGS_raft_heartbeat_interval_ms;
+  if (commit_bytes_per_sec_ > 0) {
+    retry_ms = std::min<int64_t>(
+        std::max<int64_t>(excess_bytes * 1000 / commit_bytes_per_sec_, 1),
+        retry_ms);
+  }
+  if (leader_admission_rejections_) {
+    leader_admission_rejections_->Increment();
+  }
+  string msg = Substitute(
+      "$0 ops of $1 bytes are not committed yet, retry in $2 ms",
+      num_ops,
+      uncommitted_bytes_,
+      retry_ms);
+  KLOG_EVERY_N_SECS(INFO, 1) << LogPrefixUnlocked()
+                             << "Rejecting op [EVERY 1 second]: " << msg
+                             << THROTTLE_MSG;
+  return Status::ServiceUnavailable(msg);
+}
+
 Status RaftConsensus::CheckLeadershipAndBindTerm(
     const scoped_refptr<ConsensusRound>& round) {
   ThreadRestrictions::AssertWaitAllowed();
@@ -1348,16 +2109,46 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(
   } else {
     *round->replicate_msg()->mutable_id() = queue_->GetNextOpId();
   }
+  TRACE_EVENT_FLOW_BEGIN2(
+      "consensus",
+      "Op",
+      OpTraceFlowId(options_.tablet_id, round->replicate_msg()->id()),
+      "tablet",
+      options_.tablet_id,
+      "op",
+      OpIdToString(round->replicate_msg()->id()));
+  if (op_latency_tracker_ && op_latency_tracker_->ShouldSample()) {
+    round->replicate_scoped_refptr()->set_latency_trace(
+        std::make_shared<OpLatencyTrace>());
+  }
   RETURN_NOT_OK(AddPendingOperationUnlocked(round));
 
-  ReplicateMsgWrapper msg_wrapper(round->replicate_scoped_refptr());
-  RETURN_NOT_OK(msg_wrapper.Init(&compression_buffer_));
+  if (dict_trainer_ && round->replicate_msg()->op_type() == WRITE_OP_EXT) {
+    const std::string& payload =
+        round->replicate_msg()->write_payload().payload();
+    dict_trainer_->AddSample(Slice(payload.data(), payload.size()));
+  }
+
+  // The log cache may compress the op off this path instead.
+  ReplicateMsgWrapper msg_wrapper(
+      round->replicate_scoped_refptr(),
+      queue_->codec_manager(),
+      !queue_->log_cache()->compresses_in_background());
+  {
+    ScopedRaftResourceAccounting accounting(
+        queue_->resource_account(), RaftActivity::kCompression);
+    RETURN_NOT_OK(msg_wrapper.Init(&compression_buffer_));
+  }
 
   // The only reasons for a bad status would be if the log itself were shut
   // down, or if we had an actual IO error, which we currently don't handle.
   CHECK_OK_PREPEND(
       queue_->AppendOperation(msg_wrapper),
       Substitute("$0: could not append to queue", LogPrefixUnlocked()));
+  if (PREDICT_FALSE(round->replicate_scoped_refptr()->latency_trace())) {
+    round->replicate_scoped_refptr()->latency_trace()->Mark(
+        OpStage::kQueueAppended);
+  }
   if (round->replicate_msg()->op_type() == NO_OP) {
     HandleNewTermAppendedUnlocked(round->replicate_msg()->id().term());
   }
@@ -1443,10 +2234,21 @@ void RaftConsensus::NotifyCommitIndex(int64_t commit_index, bool need_lock) {
         << "Replica not in running state: " << State_Name(state_);
   } else {
     pending_->AdvanceCommittedIndex(commit_index);
+    NotifyReadIndexWaitersUnlocked();
 
     if (FLAGS_notify_commit_index_after_response &&
         cmeta_->active_role() == RaftPeerPB::LEADER) {
-      peer_manager_->SignalRequest(false);
+      const int32_t delay_ms = CommitNotificationDelayMs();
+      if (delay_ms > 0) {
+        if (delay_ms != commit_notification_timer_delay_ms_) {
+          commit_notification_timer_->Stop();
+          CreateCommitNotificationTimer(delay_ms);
+        }
+        // Does nothing if a notification is already scheduled.
+        commit_notification_timer_->Start();
+      } else {
+        peer_manager_->SignalRequest(false);
+      }
     }
   }
 
@@ -1557,6 +2359,24 @@ void RaftConsensus::NotifyPeerHealthChange() {
   MarkDirty("Peer health change");
 }
 
+void RaftConsensus::NotifyPeerNeedsSnapshot(
+    const string& peer_uuid,
+    int64_t next_index) {
+  if (!sccb_) {
+    return;
+  }
+  std::shared_ptr<log::LogReader> reader = log_->reader();
+  const int64_t first_available_index =
+      reader ? reader->GetMinReplicateIndex() : -1;
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << Substitute(
+      "Peer $0 needs a snapshot to catch up from index $1, the first index in "
+      "the log is $2",
+      peer_uuid,
+      next_index,
+      first_available_index);
+  sccb_(peer_uuid, next_index, first_available_index);
+}
+
 void RaftConsensus::HandleNewTermAppendedUnlocked(int64_t new_term) {
   DCHECK(lock_.is_locked());
   if (FLAGS_update_lkl_after_new_term_append) {
@@ -1706,8 +2526,35 @@ void RaftConsensus::TryStartElectionOnPeerTask(
 
 Status RaftConsensus::Update(
     const ConsensusRequestPB* request,
-    ConsensusResponsePB* response) {
+    ConsensusResponsePB* response,
+    std::shared_ptr<google::protobuf::Arena> request_arena) {
+  return DoUpdate(request, response, std::move(request_arena), nullptr);
+}
+
+void RaftConsensus::UpdateAsync(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    std::shared_ptr<google::protobuf::Arena> request_arena,
+    StdStatusCallback done) {
+  DCHECK(done);
+  Status s = DoUpdate(request, response, std::move(request_arena), &done);
+  if (done) {
+    // Nothing was appended, so there's nothing to wait for.
+    done(s);
+  }
+}
+
+Status RaftConsensus::DoUpdate(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    std::shared_ptr<google::protobuf::Arena> request_arena,
+    StdStatusCallback* durable_cb) {
+  SCOPED_WATCH_STACK(FLAGS_raft_rpc_watch_stack_ms);
+  ScopedRaftResourceAccounting accounting(
+      queue_->resource_account(), RaftActivity::kUpdate);
   update_calls_for_tests_.Increment();
+  // The ops taken out of the request would otherwise be deleted.
+  DCHECK(request->GetArena() == request_arena.get());
 
   if (PREDICT_FALSE(
           FLAGS_follower_reject_update_consensus_requests ||
@@ -1724,7 +2571,12 @@ Status RaftConsensus::Update(
 
   // see var declaration
   std::lock_guard<simple_mutexlock> lock(update_lock_);
-  Status s = UpdateReplica(request, response);
+  Status s = UpdateReplica(
+      request, response, std::move(request_arena), durable_cb);
+  if (durable_cb && !*durable_cb) {
+    // Handed off: 'request' and 'response' may already be gone.
+    return s;
+  }
   if (PREDICT_FALSE(VLOG_IS_ON(1))) {
     if (request->ops().empty()) {
       VLOG_WITH_PREFIX(1) << "Replica replied to status only request. Replica: "
@@ -1742,19 +2594,65 @@ static bool IsConsensusOnlyOperation(OperationType op_type) {
 
 Status RaftConsensus::StartFollowerTransactionUnlocked(
     const ReplicateMsgWrapper& msg_wrapper) {
+  if (OpaquePayloadsUnlocked()) {
+    // The payload is checked by whoever reads it.
+    return StartFollowerTransactionUnlocked(
+        msg_wrapper.GetOrigMsg(), /*verify_payload=*/false);
+  }
   if (!msg_wrapper.GetUncompressedMsg()) {
     return Status::IllegalState("Rejected: Msg wrapper is null");
   }
   return StartFollowerTransactionUnlocked(msg_wrapper.GetUncompressedMsg());
 }
 
+bool RaftConsensus::OpaquePayloadsUnlocked() const {
+  DCHECK(lock_.is_locked());
+  return (FLAGS_follower_opaque_payloads || FLAGS_raft_lightweight_witness) &&
+      !local_peer_pb_.attrs().backing_db_present();
+}
+
+bool RaftConsensus::IsLightweightWitnessUnlocked() const {
+  DCHECK(lock_.is_locked());
+  return FLAGS_raft_lightweight_witness &&
+      !local_peer_pb_.attrs().backing_db_present();
+}
+
+Status RaftConsensus::UncompressReplicate(
+    const ReplicateRefPtr& msg,
+    ReplicateRefPtr* uncompressed) {
+  if (msg->get()->write_payload().compression_codec() == NO_COMPRESSION) {
+    *uncompressed = msg;
+    return Status::OK();
+  }
+  // Another consumer may have uncompressed it already.
+  *uncompressed = queue_->log_cache()->FindUncompressedMsg(msg);
+  if (*uncompressed) {
+    return Status::OK();
+  }
+  const uint32_t payload_crc32 = msg->get()->write_payload().crc32();
+  if (payload_crc32 != 0) {
+    const std::string& payload = msg->get()->write_payload().payload();
+    if (payload_crc32 != crc::Crc32c(payload.c_str(), payload.size())) {
+      return Status::Corruption(Substitute(
+          "Payload corruption for $0", OpIdToString(msg->get()->id())));
+    }
+  }
+  ReplicateMsgWrapper msg_wrapper(msg, queue_->codec_manager());
+  faststring buffer;
+  RETURN_NOT_OK(msg_wrapper.Init(&buffer));
+  *uncompressed = msg_wrapper.GetUncompressedMsg();
+  queue_->log_cache()->KeepUncompressedMsg(msg, *uncompressed);
+  return Status::OK();
+}
+
 Status RaftConsensus::StartFollowerTransactionUnlocked(
-    const ReplicateRefPtr& msg) {
+    const ReplicateRefPtr& msg,
+    bool verify_payload) {
   DCHECK(lock_.is_locked());
 
   // Validate crc32 checksum
   uint32_t payload_crc32 = msg->get()->write_payload().crc32();
-  if (payload_crc32 != 0) {
+  if (verify_payload && payload_crc32 != 0) {
     const std::string& payload = msg->get()->write_payload().payload();
     uint32_t computed_crc32 = crc::Crc32c(payload.c_str(), payload.size());
     if (payload_crc32 != computed_crc32) {
@@ -1778,11 +2676,95 @@ Status RaftConsensus::StartFollowerTransactionUnlocked(
   VLOG_WITH_PREFIX_UNLOCKED(1)
       << "Starting transaction: " << SecureShortDebugString(msg->get()->id());
   scoped_refptr<ConsensusRound> round(new ConsensusRound(this, msg));
+  if (IsLightweightWitnessUnlocked()) {
+    // There is nothing to apply the op to; the round is only tracked until
+    // it's committed.
+    return AddPendingOperationUnlocked(round);
+  }
+  if (follower_apply_token_) {
+    return StartFollowerTransactionAsyncUnlocked(std::move(round));
+  }
   ConsensusRound* round_ptr = round.get();
   RETURN_NOT_OK(round_handler_->StartFollowerTransaction(round));
   return AddPendingOperationUnlocked(round_ptr);
 }
 
+Status RaftConsensus::StartFollowerTransactionAsyncUnlocked(
+    scoped_refptr<ConsensusRound> round) {
+  DCHECK(lock_.is_locked());
+  {
+    std::lock_guard<simple_spinlock> l(follower_apply_lock_);
+    if (PREDICT_FALSE(
+            follower_apply_queue_.size() >=
+            FLAGS_raft_follower_apply_queue_max_ops)) {
+      return Status::ServiceUnavailable(Substitute(
+          "Rejected: $0 ops are waiting to be applied",
+          follower_apply_queue_.size()));
+    }
+  }
+  round->MarkStartDeferred();
+  RETURN_NOT_OK(AddPendingOperationUnlocked(round));
+
+  // Ops are queued under 'lock_', so they're handed to the round handler in
+  // the order they were received in.
+  bool submit;
+  {
+    std::lock_guard<simple_spinlock> l(follower_apply_lock_);
+    submit = follower_apply_queue_.empty();
+    follower_apply_queue_.push_back({std::move(round), MonoTime::Now()});
+  }
+  follower_apply_queue_depth_->Increment();
+  if (submit) {
+    WARN_NOT_OK(
+        follower_apply_token_->SubmitFunc(
+            std::bind(&RaftConsensus::DrainFollowerApplyQueue, this)),
+        LogPrefixUnlocked() + "Unable to start the follower apply pipeline");
+  }
+  return Status::OK();
+}
+
+void RaftConsensus::DrainFollowerApplyQueue() {
+  int backoff_ms = 1;
+  while (!follower_apply_stopped_.load(std::memory_order_acquire)) {
+    FollowerApplyEntry entry;
+    {
+      std::lock_guard<simple_spinlock> l(follower_apply_lock_);
+      DCHECK(!follower_apply_queue_.empty());
+      entry = follower_apply_queue_.front();
+    }
+    Status s = round_handler_->StartFollowerTransaction(entry.round);
+    if (PREDICT_FALSE(!s.ok())) {
+      // The op is already in the log and acknowledged, so it can't be
+      // rejected anymore; the round handler must take it eventually. Ops
+      // behind it wait, and once the queue is full, the leader's updates are
+      // rejected.
+      if (follower_apply_stopped_.load(std::memory_order_acquire)) {
+        return;
+      }
+      KLOG_EVERY_N_SECS(WARNING, 10) << LogPrefixThreadSafe()
+                                     << Substitute(
+                                            "Could not start transaction for "
+                                            "op $0, retrying: $1",
+                                            OpIdToString(entry.round->id()),
+                                            s.ToString());
+      SleepFor(MonoDelta::FromMilliseconds(backoff_ms));
+      backoff_ms = std::min(backoff_ms * 2, 100);
+      continue;
+    }
+    backoff_ms = 1;
+    follower_apply_queue_time_->Increment(
+        (MonoTime::Now() - entry.enqueue_time).ToMicroseconds());
+    entry.round->DeferredStartFinished();
+
+    follower_apply_queue_depth_->Decrement();
+    std::lock_guard<simple_spinlock> l(follower_apply_lock_);
+    follower_apply_queue_.pop_front();
+    if (follower_apply_queue_.empty()) {
+      return;
+    }
+  }
+}
+
 bool RaftConsensus::IsSingleVoterConfig() const {
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
@@ -1824,6 +2806,12 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(
 
   deduplicated_req->first_message_idx = -1;
 
+  // The term of the run of pending ops which the last op looked up in the
+  // pendings set belongs to, and the index of the last op of that run. Ops
+  // from the leader are consecutive, so a run covers a whole stretch of them.
+  int64_t run_term = -1;
+  int64_t run_last_index = -1;
+
   // In this loop we discard duplicates and advance the leader's preceding id
   // accordingly.
   for (int i = 0; i < rpc_req->ops_size(); i++) {
@@ -1839,16 +2827,22 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(
     if (leader_msg->id().index() <= dedup_up_to_index) {
       // If the index is uncommitted and below our match index, then it must be
       // in the pendings set.
-      scoped_refptr<ConsensusRound> round =
-          pending_->GetPendingOpByIndexOrNull(leader_msg->id().index());
-      DCHECK(round) << "Could not find op with index "
-                    << leader_msg->id().index()
-                    << " in pending set. committed= " << last_committed_index
-                    << " dedup=" << dedup_up_to_index;
+      if (leader_msg->id().index() > run_last_index) {
+        bool found = pending_->GetPendingTermRun(
+            leader_msg->id().index(), &run_term, &run_last_index);
+        DCHECK(found) << "Could not find op with index "
+                      << leader_msg->id().index()
+                      << " in pending set. committed= " << last_committed_index
+                      << " dedup=" << dedup_up_to_index;
+        if (PREDICT_FALSE(!found)) {
+          run_term = -1;
+          run_last_index = leader_msg->id().index();
+        }
+      }
 
       // If the OpIds match, i.e. if they have the same term and id, then this
       // is just duplicate, we skip...
-      if (OpIdEquals(round->replicate_msg()->id(), leader_msg->id())) {
+      if (run_term == leader_msg->id().term()) {
         VLOG_WITH_PREFIX_UNLOCKED(2)
             << "Skipping op id " << leader_msg->id() << " (already replicated)";
         deduplicated_req->preceding_opid = &leader_msg->id();
@@ -1864,7 +2858,9 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(
       deduplicated_req->first_message_idx = i;
     }
     deduplicated_req->messages.push_back(
-        make_scoped_refptr_replicate(leader_msg));
+        deduplicated_req->arena
+            ? make_scoped_refptr_replicate(leader_msg, deduplicated_req->arena)
+            : make_scoped_refptr_replicate(leader_msg));
   }
 
   if (deduplicated_req->messages.size() != rpc_req->ops_size()) {
@@ -1891,7 +2887,7 @@ Status RaftConsensus::HandleLeaderRequestTermUnlocked(
           request->caller_term(),
           CurrentTermUnlocked(),
           OpsRangeString(*request));
-      LOG_WITH_PREFIX_UNLOCKED(INFO) << msg;
+      KLOG_BINARY_WITH_PREFIX(INFO, "$0", msg);
       FillConsensusResponseError(
           response, ConsensusErrorPB::INVALID_TERM, Status::IllegalState(msg));
       return Status::OK();
@@ -1923,8 +2919,11 @@ Status RaftConsensus::EnforceLogMatchingPropertyMatchesUnlocked(
       ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH,
       Status::IllegalState(error_msg));
 
-  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Refusing update from remote peer "
-                                 << req.leader_uuid << ": " << error_msg;
+  KLOG_BINARY_WITH_PREFIX(
+      INFO,
+      "Refusing update from remote peer $0: $1",
+      req.leader_uuid,
+      error_msg);
 
   // If the terms mismatch we abort down to the index before the leader's
   // preceding, since we know that is the last opid that has a chance of not
@@ -2049,9 +3048,37 @@ Status RaftConsensus::CheckLeaderRequestUnlocked(
   return Status::OK();
 }
 
+struct RaftConsensus::AsyncUpdateState {
+  explicit AsyncUpdateState(StdStatusCallback cb) : durable_cb(std::move(cb)) {}
+
+  // Calls 'durable_cb' with the append status on the last of the append
+  // finishing and the response being filled.
+  void Release() {
+    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      durable_cb(append_status);
+    }
+  }
+
+  StdStatusCallback durable_cb;
+  Status append_status;
+  std::atomic<int> pending{2};
+};
+
+void RaftConsensus::AsyncUpdateAppendFinished(
+    const shared_ptr<AsyncUpdateState>& state,
+    const Status& status) {
+  // Like the synchronous path does while it waits, don't let our own log
+  // append trigger an election.
+  SnoozeFailureDetector();
+  state->append_status = status;
+  state->Release();
+}
+
 Status RaftConsensus::UpdateReplica(
     const ConsensusRequestPB* request,
-    ConsensusResponsePB* response) {
+    ConsensusResponsePB* response,
+    std::shared_ptr<google::protobuf::Arena> request_arena,
+    StdStatusCallback* durable_cb) {
   TRACE_EVENT2(
       "consensus",
       "RaftConsensus::UpdateReplica",
@@ -2059,6 +3086,7 @@ Status RaftConsensus::UpdateReplica(
       peer_uuid(),
       "tablet",
       options_.tablet_id);
+  TraceOpFlowSteps(options_.tablet_id, request->ops(), "received");
   Synchronizer log_synchronizer;
   StatusCallback sync_status_cb = log_synchronizer.AsStatusCallback();
 
@@ -2157,13 +3185,19 @@ Status RaftConsensus::UpdateReplica(
   //        This will be done in a follow up patch.
   TRACE("Updating replica for $0 ops", request->ops_size());
 
+  // Set if the caller is called back once the ops are durable, instead of
+  // waiting for them here.
+  shared_ptr<AsyncUpdateState> async_state;
+
   // The deduplicated request.
   LeaderRequest deduped_req;
+  deduped_req.arena = std::move(request_arena);
   auto& messages = deduped_req.messages;
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
     RETURN_NOT_OK(CheckRunningUnlocked());
+    DisarmHeartbeatFastPathUnlocked();
     if (!cmeta_->IsMemberInConfig(peer_uuid(), ACTIVE_CONFIG)) {
       LOG_WITH_PREFIX_UNLOCKED(INFO)
           << "Allowing update even though not a member of the config";
@@ -2183,10 +3217,22 @@ Status RaftConsensus::UpdateReplica(
     // sanity check.
     // If this particular instance is banned from cluster manager,
     // then we snooze for longer to give other instances an opportunity to win
-    // the election
-    SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+    // the election. A quiescent leader may stay silent for longer still.
+    const MonoDelta quiescent_interval = MonoDelta::FromMilliseconds(
+        request->quiescent_heartbeat_interval_ms());
+    SnoozeFailureDetector(
+        boost::none,
+        MonoDelta::FromNanoseconds(
+            FollowerElectionTimeoutUnlocked(
+                request->last_idx_appended_to_leader(),
+                queue_->GetLastOpIdInLog().index())
+                .ToNanoseconds() +
+            quiescent_interval.ToNanoseconds()));
 
     last_leader_communication_time_micros_ = GetMonoTimeMicros();
+    leader_quiescent_until_micros_ =
+        last_leader_communication_time_micros_ +
+        quiescent_interval.ToMicroseconds();
 
     // Reset the 'failed_elections_since_stable_leader' metric now that we've
     // accepted an update from the established leader. This is done in addition
@@ -2210,7 +3256,8 @@ Status RaftConsensus::UpdateReplica(
     // will try to keep ring stable for next MinElectionTimeout.
     // However it will allow itself to solicit votes only after a Random
     // interval from 1x -> 2X of election timeout.
-    withhold_votes_until_ = MonoTime::Now() + MinimumElectionTimeout();
+    withhold_votes_until_ =
+        MonoTime::Now() + MinimumElectionTimeout() + quiescent_interval;
 
     if (FLAGS_enable_raft_leader_lease) {
       // Renew the Leader Lease
@@ -2256,6 +3303,7 @@ Status RaftConsensus::UpdateReplica(
         << ", requested index: " << request->committed_index();
     TRACE("Early marking committed up to index $0", early_apply_up_to);
     CHECK_OK(pending_->AdvanceCommittedIndex(early_apply_up_to));
+    NotifyReadIndexWaitersUnlocked();
 
     // 2 - Enqueue the prepares
 
@@ -2293,15 +3341,17 @@ Status RaftConsensus::UpdateReplica(
       KLOG_EVERY_N_SECS(INFO, 180)
           << "[EVERY 3 mins] Received compression dictionary from leader";
       const std::string& compression_dict = request->compression_dictionary();
-      RETURN_NOT_OK(CompressionCodecManager::SetDictionary(compression_dict));
+      RETURN_NOT_OK(queue_->codec_manager()->SetDictionary(compression_dict));
       persistent_vars_->set_compression_dictionary(compression_dict);
       RETURN_NOT_OK(persistent_vars_->Flush());
     }
+    const bool opaque_payloads = OpaquePayloadsUnlocked();
     while (iter != messages.end()) {
       // Create a ReplicateMsgWrapper which handles compression, here we'll be
       // decompressing the msg
-      ReplicateMsgWrapper msg_wrapper(*iter);
-      prepare_status = msg_wrapper.Init(&compression_buffer_);
+      ReplicateMsgWrapper msg_wrapper(*iter, queue_->codec_manager());
+      prepare_status = opaque_payloads ? msg_wrapper.InitOpaque()
+                                       : msg_wrapper.Init(&compression_buffer_);
 
       if (prepare_status.ok()) {
         prepare_status = StartFollowerTransactionUnlocked(msg_wrapper);
@@ -2387,6 +3437,15 @@ Status RaftConsensus::UpdateReplica(
       //
       // Since we've prepared, we need to be able to append (or we risk trying
       // to apply later something that wasn't logged). We crash if we can't.
+      if (durable_cb) {
+        async_state =
+            std::make_shared<AsyncUpdateState>(std::move(*durable_cb));
+        *durable_cb = nullptr;
+        sync_status_cb = Bind(
+            &RaftConsensus::AsyncUpdateAppendFinished,
+            shared_from_this(),
+            async_state);
+      }
       CHECK_OK(queue_->AppendOperations(msg_wrappers, sync_status_cb));
       if (cmeta_->last_known_leader().uuid().empty() ||
           last_from_leader.term() != preceding_term) {
@@ -2419,6 +3478,7 @@ Status RaftConsensus::UpdateReplica(
     VLOG_WITH_PREFIX_UNLOCKED(1) << "Marking committed up to " << apply_up_to;
     TRACE("Marking committed up to $0", apply_up_to);
     CHECK_OK(pending_->AdvanceCommittedIndex(apply_up_to));
+    NotifyReadIndexWaitersUnlocked();
     queue_->UpdateFollowerWatermarks(
         apply_up_to,
         request->all_replicated_index(),
@@ -2436,10 +3496,25 @@ Status RaftConsensus::UpdateReplica(
     if (!have_queued_ldcb_or_norcb_) {
       ScheduleLeaderDetectedCallback(CurrentTermUnlocked());
     }
+    // Only once the leader has nothing new to send, which also means that
+    // the ops the fast path would report as received are durable.
+    if (FLAGS_raft_compact_heartbeats && messages.empty() &&
+        apply_up_to == request->committed_index()) {
+      ArmHeartbeatFastPathUnlocked(*request, *response);
+    }
   }
   // Release the lock while we wait for the log append to finish so that commits
   // can go through. We'll re-acquire it before we update the state again.
 
+  if (async_state) {
+    // The response is filled, so it can go out as soon as the ops are
+    // durable. As in the wait below, the leader only has one request
+    // outstanding to us, and the log appends in order.
+    TRACE("Replying once the replicates finish logging");
+    async_state->Release();
+    return Status::OK();
+  }
+
   // Update the last replicated op id
   if (!messages.empty()) {
     // 5 - We wait for the writes to be durable.
@@ -2490,6 +3565,10 @@ void RaftConsensus::FillConsensusResponseOKUnlocked(
       last_received_cur_leader_);
   response->mutable_status()->set_last_committed_idx(
       queue_->GetCommittedIndex());
+  if (FLAGS_raft_follower_backpressure) {
+    response->set_load_percent(std::max(
+        log_->AppendQueueLoadPercent(), queue_->log_cache()->LoadPercent()));
+  }
 }
 
 void RaftConsensus::FillConsensusResponseError(
@@ -2501,6 +3580,132 @@ void RaftConsensus::FillConsensusResponseError(
   StatusToPB(status, error->mutable_status());
 }
 
+void RaftConsensus::ArmHeartbeatFastPathUnlocked(
+    const ConsensusRequestPB& request,
+    const ConsensusResponsePB& response) {
+  DCHECK(lock_.is_locked());
+  HeartbeatFastPath hb;
+  hb.armed = true;
+  hb.term = request.caller_term();
+  hb.preceding_id = request.preceding_id();
+  hb.committed_index = request.committed_index();
+  hb.all_replicated_index = request.all_replicated_index();
+  hb.region_durable_index = request.region_durable_index();
+  hb.last_idx_appended_to_leader = request.last_idx_appended_to_leader();
+  hb.lease_term = leader_lease_term_;
+  // Drawn once per armed update: the randomization only needs to differ
+  // between replicas.
+  hb.snooze = FollowerElectionTimeoutUnlocked(
+      request.last_idx_appended_to_leader(),
+      response.status().last_received().index());
+  hb.last_received = response.status().last_received();
+  hb.last_received_current_leader =
+      response.status().last_received_current_leader();
+  hb.last_committed_idx = response.status().last_committed_idx();
+  std::lock_guard<simple_spinlock> l(heartbeat_lock_);
+  heartbeat_fast_path_ = std::move(hb);
+}
+
+void RaftConsensus::DisarmHeartbeatFastPathUnlocked() {
+  DCHECK(lock_.is_locked());
+  {
+    std::lock_guard<simple_spinlock> l(heartbeat_lock_);
+    heartbeat_fast_path_.armed = false;
+    // What Heartbeat() withheld votes for is now up to
+    // 'withhold_votes_until_', which whoever disarmed sets as it sees fit.
+    withhold_votes_until_ = std::max<MonoTime>(
+        withhold_votes_until_, heartbeat_fast_path_.withhold_votes_until);
+    heartbeat_fast_path_.withhold_votes_until = MonoTime::Min();
+  }
+  // Let the heartbeats already past the checks finish, so that none of them
+  // grants a lease or advances the safe time after this returns.
+  while (heartbeats_applying_.load(std::memory_order_acquire) > 0) {
+    std::this_thread::yield();
+  }
+}
+
+MonoTime RaftConsensus::WithholdVotesUntilUnlocked() const {
+  DCHECK(lock_.is_locked());
+  std::lock_guard<simple_spinlock> l(heartbeat_lock_);
+  return std::max<MonoTime>(
+      withhold_votes_until_, heartbeat_fast_path_.withhold_votes_until);
+}
+
+void RaftConsensus::Heartbeat(
+    const HeartbeatRequestPB* request,
+    HeartbeatResponsePB* response) {
+  response->set_responder_uuid(peer_uuid());
+  response->set_handled(false);
+  if (PREDICT_FALSE(
+          FLAGS_follower_reject_update_consensus_requests ||
+          reject_append_entries_)) {
+    return;
+  }
+  const bool lease = FLAGS_enable_raft_leader_lease;
+  std::unique_lock<simple_spinlock> l(heartbeat_lock_);
+  HeartbeatFastPath& hb = heartbeat_fast_path_;
+  if (!hb.armed || request->caller_term() != hb.term ||
+      request->preceding_term() != hb.preceding_id.term() ||
+      request->preceding_index() != hb.preceding_id.index() ||
+      request->committed_index() != hb.committed_index ||
+      request->all_replicated_index() != hb.all_replicated_index ||
+      request->region_durable_index() != hb.region_durable_index ||
+      request->last_idx_appended_to_leader() !=
+          hb.last_idx_appended_to_leader) {
+    return;
+  }
+  // Granting a new lease, or revoking one, is left to Update().
+  if (lease &&
+      (hb.lease_term != request->caller_term() ||
+       request->requested_lease_duration() <= 0)) {
+    return;
+  }
+
+  // As UpdateReplica() does for a request without ops.
+  const MonoTime now = MonoTime::Now();
+  const MonoDelta quiescent_interval = MonoDelta::FromMilliseconds(
+      request->quiescent_heartbeat_interval_ms());
+  SnoozeFailureDetector(
+      boost::none,
+      MonoDelta::FromNanoseconds(
+          hb.snooze.ToNanoseconds() + quiescent_interval.ToNanoseconds()));
+  last_leader_communication_time_micros_ = GetMonoTimeMicros();
+  leader_quiescent_until_micros_ = last_leader_communication_time_micros_ +
+      quiescent_interval.ToMicroseconds();
+  hb.withhold_votes_until = now + MinimumElectionTimeout() + quiescent_interval;
+
+  response->set_responder_term(hb.term);
+  response->set_last_received_term(hb.last_received.term());
+  response->set_last_received_index(hb.last_received.index());
+  response->set_last_received_current_leader_term(
+      hb.last_received_current_leader.term());
+  response->set_last_received_current_leader_index(
+      hb.last_received_current_leader.index());
+  response->set_last_committed_idx(hb.last_committed_idx);
+
+  // The queue and the TimeManager take locks of their own, so call them off
+  // the spinlock. Disarming waits for this, so this replica still hasn't
+  // become leader meanwhile.
+  heartbeats_applying_.fetch_add(1, std::memory_order_relaxed);
+  l.unlock();
+  if (lease) {
+    queue_->SetLeaderLeaseUntil(
+        now +
+        MonoDelta::FromMilliseconds(request->requested_lease_duration()));
+    response->set_lease_granted(true);
+  }
+  if (request->has_safe_timestamp()) {
+    time_manager_->AdvanceSafeTime(Timestamp(request->safe_timestamp()));
+  }
+  heartbeats_applying_.fetch_sub(1, std::memory_order_release);
+
+  if (FLAGS_raft_follower_backpressure) {
+    response->set_load_percent(std::max(
+        log_->AppendQueueLoadPercent(), queue_->log_cache()->LoadPercent()));
+  }
+  response->set_handled(true);
+}
+
 Status RaftConsensus::RequestVote(
     const VoteRequestPB* request,
     TabletVotingState tablet_voting_state,
@@ -2512,6 +3717,7 @@ Status RaftConsensus::RequestVote(
       peer_uuid(),
       "tablet",
       options_.tablet_id);
+  SCOPED_WATCH_STACK(FLAGS_raft_rpc_watch_stack_ms);
   response->set_responder_uuid(peer_uuid());
 
   // We must acquire the update lock in order to ensure that this vote action
@@ -2674,8 +3880,8 @@ Status RaftConsensus::RequestVote(
       (FLAGS_enable_raft_leader_lease
            ? MonoTime::Now() <
                std::max<MonoTime>(
-                   withhold_votes_until_, queue_->GetLeaderLeaseUntil())
-           : MonoTime::Now() < withhold_votes_until_)) {
+                   WithholdVotesUntilUnlocked(), queue_->GetLeaderLeaseUntil())
+           : MonoTime::Now() < WithholdVotesUntilUnlocked())) {
     return RequestVoteRespondLeaderIsAlive(request, hostname_port, response);
   }
 
@@ -2756,8 +3962,11 @@ Status RaftConsensus::RequestVote(
   // pre or mock elections because it's possible that the node who called the
   // pre or mock election has actually now successfully become leader of the
   // prior term, in which case bumping our term here would disrupt it.
+  // Nor do we when denying a request with pre-vote checks, which stands in
+  // for a pre-election.
   if (request->mode() != ElectionMode::PRE_ELECTION &&
       request->mode() != ElectionMode::MOCK_ELECTION &&
+      (vote_yes || !request->pre_vote()) &&
       request->candidate_term() > CurrentTermUnlocked()) {
     // If we are going to vote for this peer, then we will flush the consensus
     // metadata to disk below when we record the vote, and we can skip flushing
@@ -3365,11 +4574,13 @@ void RaftConsensus::Stop() {
   if (queue_)
     queue_->Close();
 
+  std::multimap<int64_t, ReadIndexCallback> read_index_waiters;
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
     if (pending_)
       CHECK_OK(pending_->CancelPendingTransactions());
+    read_index_waiters.swap(read_index_waiters_);
     SetStateUnlocked(kStopped);
 
     // Clear leader status on Stop(), in case this replica was the leader. If
@@ -3386,12 +4597,67 @@ void RaftConsensus::Stop() {
 
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Raft consensus is shut down!";
   }
+  for (const auto& waiter : read_index_waiters) {
+    waiter.second(Status::Aborted("replica was shut down"), 0);
+  }
 
   // Shut down things that might acquire locks during destruction.
   if (raft_pool_token_)
     raft_pool_token_->Shutdown();
+  if (peer_send_pool_token_)
+    peer_send_pool_token_->Shutdown();
+  if (follower_apply_token_) {
+    // Ops the round handler was never told about were cancelled above, and
+    // are dropped.
+    follower_apply_stopped_.store(true, std::memory_order_release);
+    follower_apply_token_->Shutdown();
+    std::lock_guard<simple_spinlock> l(follower_apply_lock_);
+    follower_apply_queue_depth_->IncrementBy(
+        -static_cast<int64_t>(follower_apply_queue_.size()));
+    follower_apply_queue_.clear();
+  }
   if (failure_detector_)
     DisableFailureDetector();
+  if (compression_policy_timer_)
+    compression_policy_timer_->Stop();
+  if (dict_training_timer_)
+    dict_training_timer_->Stop();
+  if (peer_health_timer_)
+    peer_health_timer_->Stop();
+}
+
+Status RaftConsensus::HandOffLeadershipForShutdown() {
+  if (FLAGS_raft_shutdown_handoff_timeout_ms <= 0 ||
+      role() != RaftPeerPB::LEADER) {
+    return Status::OK();
+  }
+  const MonoTime start = MonoTime::Now();
+  const MonoTime deadline = start +
+      MonoDelta::FromMilliseconds(FLAGS_raft_shutdown_handoff_timeout_ms);
+  const boost::optional<string> successor = queue_->GetMostCaughtUpSuccessor();
+  LOG_WITH_PREFIX(INFO) << "Handing off leadership before shutting down"
+                        << (successor ? " to " + *successor : "");
+  LeaderStepDownResponsePB resp;
+  RETURN_NOT_OK(TransferLeadership(
+      successor,
+      nullptr,
+      ElectionContext(EXTERNAL_REQUEST, std::chrono::system_clock::now()),
+      &resp));
+
+  // Writes are rejected for as long as the transfer is in progress.
+  while (role() == RaftPeerPB::LEADER) {
+    if (!leader_transfer_in_progress_.Load()) {
+      return Status::Aborted("no successor caught up in time");
+    }
+    if (MonoTime::Now() >= deadline) {
+      return Status::TimedOut("leadership wasn't handed off in time");
+    }
+    SleepFor(MonoDelta::FromMilliseconds(1));
+  }
+  RETURN_NOT_OK(log_->WaitUntilAllFlushed());
+  LOG_WITH_PREFIX(INFO) << "Handed off leadership in "
+                        << (MonoTime::Now() - start).ToString();
+  return Status::OK();
 }
 
 void RaftConsensus::Shutdown() {
@@ -3724,24 +4990,19 @@ std::string RaftConsensus::GetCandidateContextString(
 }
 
 RaftPeerPB::Role RaftConsensus::role() const {
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  return cmeta_->active_role();
+  return cmeta_->snapshot()->active_role;
 }
 
 int64_t RaftConsensus::CurrentTerm() const {
-  LockGuard l(lock_);
-  return CurrentTermUnlocked();
+  return cmeta_->snapshot()->cstate.current_term();
 }
 
 string RaftConsensus::GetLeaderUuid() const {
-  LockGuard l(lock_);
-  return GetLeaderUuidUnlocked();
+  return cmeta_->snapshot()->cstate.leader_uuid();
 }
 
 std::pair<string, unsigned int> RaftConsensus::GetLeaderHostPort() const {
-  LockGuard l(lock_);
-  return cmeta_->leader_hostport();
+  return cmeta_->snapshot()->leader_hostport;
 }
 
 void RaftConsensus::SetStateUnlocked(State new_state) {
@@ -3846,7 +5107,8 @@ Status RaftConsensus::CreateReplicateMsgFromConfigsUnlocked(
 Status RaftConsensus::RefreshConsensusQueueAndPeersUnlocked() {
   DCHECK(lock_.is_locked());
   DCHECK_EQ(RaftPeerPB::LEADER, cmeta_->active_role());
-  const RaftConfigPB& active_config = cmeta_->ActiveConfig();
+  const std::shared_ptr<const RaftConfigSnapshot>& active_config =
+      cmeta_->ActiveConfigSnapshot();
 
   // Change the peers so that we're able to replicate messages remotely and
   // locally. The peer manager must be closed before updating the active config
@@ -3857,7 +5119,7 @@ Status RaftConsensus::RefreshConsensusQueueAndPeersUnlocked() {
   // we need to pass it in at all?
   queue_->SetLeaderMode(
       pending_->GetCommittedIndex(), CurrentTermUnlocked(), active_config);
-  RETURN_NOT_OK(peer_manager_->UpdateRaftConfig(active_config));
+  RETURN_NOT_OK(peer_manager_->UpdateRaftConfig(active_config->config()));
   return Status::OK();
 }
 
@@ -3878,8 +5140,14 @@ std::string RaftConsensus::peer_region() const {
 
 std::string RaftConsensus::peer_quorum_id(bool need_lock) const {
   if (need_lock) {
-    LockGuard l(lock_);
+    // Callers that do not hold 'lock_' read the published snapshot instead.
+    auto snapshot = cmeta_->snapshot();
+    const RaftConfigPB& config = snapshot->active_config();
+    return config.has_commit_rule()
+        ? GetQuorumId(local_peer_pb_, config.commit_rule())
+        : "";
   }
+  DCHECK(lock_.is_locked());
   return cmeta_->ActiveConfig().has_commit_rule()
       ? GetQuorumId(local_peer_pb_, cmeta_->ActiveConfig().commit_rule())
       : "";
@@ -3901,6 +5169,16 @@ const string& RaftConsensus::tablet_id() const {
 Status RaftConsensus::ConsensusState(
     ConsensusStatePB* cstate,
     IncludeHealthReport report_health) const {
+  if (report_health == EXCLUDE_HEALTH_REPORT) {
+    // Everything needed is in the published snapshot, so monitoring polls
+    // do not contend with replication for 'lock_'.
+    if (shutdown_.Load(kMemOrderAcquire)) {
+      return Status::IllegalState("Tablet replica is shutdown");
+    }
+    *cstate = cmeta_->snapshot()->cstate;
+    return Status::OK();
+  }
+
   ThreadRestrictions::AssertWaitAllowed();
   UniqueLock l(lock_);
   if (state_ == kShutdown) {
@@ -3934,9 +5212,7 @@ Status RaftConsensus::ConsensusState(
 }
 
 RaftConfigPB RaftConsensus::CommittedConfig() const {
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-  return cmeta_->CommittedConfig();
+  return cmeta_->snapshot()->cstate.committed_config();
 }
 
 Status RaftConsensus::PendingConfig(RaftConfigPB* pendingConfig) const {
@@ -4356,6 +5632,40 @@ void RaftConsensus::DisableFailureDetector() {
   failure_detector_->Stop();
 }
 
+bool RaftConsensus::ExpediteFailureDetection(
+    const string& server_uuid,
+    const MonoDelta& delay) {
+  if (PREDICT_FALSE(!FLAGS_enable_leader_failure_detection)) {
+    return false;
+  }
+  // A delay past the election timeout would postpone the failure detector
+  // rather than bring it forward.
+  if (delay >= MinimumElectionTimeout()) {
+    return false;
+  }
+  LockGuard l(lock_);
+  if (!CheckRunningUnlocked().ok() || server_uuid == peer_uuid() ||
+      cmeta_->leader_uuid() != server_uuid ||
+      !cmeta_->IsVoterInConfig(peer_uuid(), ACTIVE_CONFIG)) {
+    return false;
+  }
+  // A quiescent leader announced it would stay silent for a while, so its
+  // server going quiet is no sign of failure until then.
+  if (GetMonoTimeMicros() < leader_quiescent_until_micros_) {
+    return false;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << Substitute(
+             "Leader's server $0 is unresponsive, reporting leader failure "
+             "in $1",
+             server_uuid,
+             delay.ToString());
+  // Restarting the timer, unlike snoozing it, lets it fire before its
+  // current callback is due.
+  EnableFailureDetector(delay);
+  return true;
+}
+
 void RaftConsensus::SetWithholdVotesForTests(bool withhold_votes) {
   withhold_votes_ = withhold_votes;
 }
@@ -4435,6 +5745,57 @@ MonoDelta RaftConsensus::MinimumElectionTimeoutWithBan() {
   return MonoDelta::FromMilliseconds(failure_timeout);
 }
 
+MonoDelta RaftConsensus::FollowerElectionTimeoutUnlocked(
+    int64_t leader_last_index,
+    int64_t last_index) {
+  DCHECK(lock_.is_locked());
+  // Followers of the same rank, e.g. all those fully caught up, would time
+  // out together and split the vote without a random part to their timeout.
+  constexpr double kMaxWeight = 0.75;
+  const double weight = std::min(
+      kMaxWeight, std::max(0.0, FLAGS_raft_election_freshness_weight));
+  // A ban stretches the timeout on purpose, so it isn't ranked.
+  if (weight == 0 || fabs(FLAGS_snooze_for_leader_ban_ratio - 1.0) >= 0.001) {
+    return MinimumElectionTimeoutWithBan();
+  }
+
+  // From 0, for the followers most likely to win an election, to 1.
+  double rank = 0;
+  if (leader_last_index > 0) {
+    const int64_t lag = std::max<int64_t>(0, leader_last_index - last_index);
+    rank = std::min(
+        1.0,
+        static_cast<double>(lag) /
+            std::max(1, FLAGS_raft_election_freshness_lag_ops));
+  }
+  if (FLAGS_enable_flexi_raft) {
+    // In single region dynamic mode, a candidate outside of the last leader's
+    // quorum also needs the votes of that quorum, so those inside go first.
+    const RaftConfigPB& config = cmeta_->ActiveConfig();
+    if (config.has_commit_rule() &&
+        config.commit_rule().mode() == QuorumMode::SINGLE_REGION_DYNAMIC) {
+      const string& local_quorum_id =
+          GetQuorumId(local_peer_pb_, config.commit_rule());
+      for (const RaftPeerPB& peer : config.peers()) {
+        if (peer.permanent_uuid() == cmeta_->leader_uuid() &&
+            GetQuorumId(peer, config.commit_rule()) != local_quorum_id) {
+          rank = (1 + rank) / 2;
+        }
+      }
+    }
+  }
+
+  // The window of MinimumElectionTimeoutWithBan(), with the ranked share of
+  // it ahead of the random one.
+  const double min_timeout = MinimumElectionTimeout().ToMilliseconds();
+  const double max_timeout = std::min<double>(
+      min_timeout * 1.5, FLAGS_leader_failure_exp_backoff_max_delta_ms);
+  const double fraction =
+      weight * rank + (1 - weight) * rng_.NextDoubleFraction();
+  return MonoDelta::FromMilliseconds(
+      min_timeout + std::max(0.0, max_timeout - min_timeout) * fraction);
+}
+
 MonoDelta RaftConsensus::LeaderElectionExpBackoffNotInConfig() {
   DCHECK(lock_.is_locked());
   // Compute a backoff factor based on how many leader elections have
@@ -4453,6 +5814,32 @@ MonoDelta RaftConsensus::LeaderElectionExpBackoffDeltaUnlocked() {
   return TimeoutBackoffHelper(backoff_factor);
 }
 
+int32_t RaftConsensus::CommitNotificationDelayMs() const {
+  return options_.commit_notification_delay_ms.value_or(
+      FLAGS_raft_commit_notification_delay_ms);
+}
+
+void RaftConsensus::CreateCommitNotificationTimer(int32_t delay_ms) {
+  // A timer's callback runs every period until the task is due, so the
+  // period is the delay itself rather than a short polling interval. Peers
+  // that received the latest committed index with some other request by the
+  // time this fires are not sent another.
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  PeriodicTimer::Options opts;
+  opts.one_shot = true;
+  opts.jitter_pct = 0;
+  commit_notification_timer_ = PeriodicTimer::Create(
+      peer_proxy_factory_->messenger(),
+      [w]() {
+        if (auto consensus = w.lock()) {
+          consensus->peer_manager_->SignalRequest(false);
+        }
+      },
+      MonoDelta::FromMilliseconds(delay_ms),
+      opts);
+  commit_notification_timer_delay_ms_ = delay_ms;
+}
+
 MonoDelta RaftConsensus::TimeoutBackoffHelper(double backoff_factor) {
   double min_timeout = MinimumElectionTimeout().ToMilliseconds();
   double max_timeout = std::min<double>(
@@ -4584,45 +5971,11 @@ Status RaftConsensus::SetPendingConfigUnlocked(const RaftConfigPB& new_config) {
 Status RaftConsensus::ChangeVoterDistribution(
     const TopologyConfigPB& topology_config,
     bool force) {
-  TRACE_EVENT2(
-      "consensus",
-      "RaftConsensus::ChangeTopologyConfig",
-      "peer",
-      peer_uuid(),
-      "tablet",
-      options_.tablet_id);
-  ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
-
-  // When force is true we're most likely running an unsafe config change
-  // operation to regain availability so we have to live with pending config
-  // changes and force apply a voter distribution to run an election
-  if (!force) {
-    // Do not allow any voter distribution changes on a unsquelched ring.
-    Status s = CheckNoConfigChangePendingUnlocked();
-    RETURN_NOT_OK(s);
-  }
-
-  RaftConfigPB config = cmeta_->ActiveConfig();
-  config.clear_voter_distribution();
-  config.mutable_voter_distribution()->insert(
+  TopologyDelta delta;
+  delta.voter_distribution.emplace(
       topology_config.voter_distribution().begin(),
       topology_config.voter_distribution().end());
-
-  cmeta_->set_active_config(config);
-  CHECK_OK(cmeta_->Flush());
-  // NB: Not calling the Proxy routing table update as the
-  // proxy routing table does not deal with Voter Distribution.
-  // If this changes, please make sure this call is uncommented.
-  // RETURN_NOT_OK(routing_table_container_->UpdateRaftConfig(
-  // cmeta_->ActiveConfig()));
-
-  // Since voter distribution has changed, we need to refresh
-  // consensus queue to make sure watermark calculation changes.
-  if (cmeta_->active_role() == RaftPeerPB::LEADER) {
-    RETURN_NOT_OK(RefreshConsensusQueueAndPeersUnlocked());
-  }
-  return Status::OK();
+  return ApplyTopologyDelta(delta, force);
 }
 
 Status RaftConsensus::GetVoterDistribution(
@@ -4694,9 +6047,17 @@ QuorumType RaftConsensus::GetQuorumType() const {
 Status RaftConsensus::SetPeerQuorumIds(
     std::map<std::string, std::string> uuid2quorum_ids,
     bool force) {
+  TopologyDelta delta;
+  delta.quorum_ids = std::move(uuid2quorum_ids);
+  return ApplyTopologyDelta(delta, force);
+}
+
+Status RaftConsensus::ApplyTopologyDelta(
+    const TopologyDelta& delta,
+    bool force) {
   TRACE_EVENT2(
       "consensus",
-      "RaftConsensus::SetPeerQuorumIds",
+      "RaftConsensus::ApplyTopologyDelta",
       "peer",
       peer_uuid(),
       "tablet",
@@ -4704,7 +6065,9 @@ Status RaftConsensus::SetPeerQuorumIds(
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
 
-  if (!force && cmeta_->ActiveConfig().has_commit_rule() &&
+  const bool changes_config = delta.quorum_ids || delta.voter_distribution;
+  if (delta.quorum_ids && !force &&
+      cmeta_->ActiveConfig().has_commit_rule() &&
       cmeta_->ActiveConfig().commit_rule().has_quorum_type() &&
       cmeta_->ActiveConfig().commit_rule().quorum_type() ==
           QuorumType::QUORUM_ID) {
@@ -4713,19 +6076,24 @@ Status RaftConsensus::SetPeerQuorumIds(
         "To force a change: set force to true.");
   }
 
-  if (!force) {
+  // When force is true we're most likely running an unsafe config change
+  // operation to regain availability so we have to live with pending config
+  // changes and force apply a voter distribution to run an election
+  if (changes_config && !force) {
     Status s = CheckNoConfigChangePendingUnlocked();
     RETURN_NOT_OK(s);
   }
 
-  // Step 1: Update peers quorum_id in active config
+  // Build the whole new config before anything is written.
   RaftConfigPB config = cmeta_->ActiveConfig();
-  google::protobuf::RepeatedPtrField<RaftPeerPB> modified_peers;
-  for (auto peer : config.peers()) {
-    if (peer.has_member_type() && peer.member_type() == RaftPeerPB::VOTER) {
+  if (delta.quorum_ids) {
+    for (RaftPeerPB& peer : *config.mutable_peers()) {
       // We only update quorum_id on voters
-      auto it = uuid2quorum_ids.find(peer.permanent_uuid());
-      if (it == uuid2quorum_ids.end()) {
+      if (!peer.has_member_type() || peer.member_type() != RaftPeerPB::VOTER) {
+        continue;
+      }
+      auto it = delta.quorum_ids->find(peer.permanent_uuid());
+      if (it == delta.quorum_ids->end()) {
         // for force = false, we do not allow a voter without quorum_id assigned
         if (!force) {
           return Status::ConfigurationError(Substitute(
@@ -4734,37 +6102,54 @@ Status RaftConsensus::SetPeerQuorumIds(
               peer.permanent_uuid()));
         }
       } else {
-        // If uuid is found, we set corresponding quorun_id
         peer.mutable_attrs()->set_quorum_id(it->second);
       }
     }
-
-    // We must add every peer, so we do not remove any peer by accident
-    *modified_peers.Add() = std::move(peer);
+  }
+  if (delta.voter_distribution) {
+    config.clear_voter_distribution();
+    config.mutable_voter_distribution()->insert(
+        delta.voter_distribution->begin(), delta.voter_distribution->end());
   }
 
-  config.mutable_peers()->Swap(&modified_peers);
+  // The proxy topology is validated against the new config, and goes first
+  // so that a rejected one leaves the config untouched.
+  if (delta.proxy_topology) {
+    RETURN_NOT_OK(routing_table_container_->UpdateProxyTopology(
+        *delta.proxy_topology, config, cmeta_->leader_uuid()));
+  }
 
+  if (!changes_config) {
+    return Status::OK();
+  }
   cmeta_->set_active_config(std::move(config));
   CHECK_OK(cmeta_->Flush());
-
-  // Step 2: Update this peer's own quorum_id
-  if (local_peer_pb_.has_member_type() &&
-      local_peer_pb_.member_type() == RaftPeerPB::VOTER) {
-    auto it = uuid2quorum_ids.find(local_peer_pb_.permanent_uuid());
-    if (it != uuid2quorum_ids.end()) {
-      local_peer_pb_.mutable_attrs()->set_quorum_id(it->second);
+  // NB: Not calling the Proxy routing table update for the new config, as
+  // the proxy routing table does not deal with voter distribution or quorum
+  // ids. If this changes, please make sure it is updated here.
+
+  if (delta.quorum_ids) {
+    // Update this peer's own quorum_id
+    if (local_peer_pb_.has_member_type() &&
+        local_peer_pb_.member_type() == RaftPeerPB::VOTER) {
+      auto it = delta.quorum_ids->find(local_peer_pb_.permanent_uuid());
+      if (it != delta.quorum_ids->end()) {
+        local_peer_pb_.mutable_attrs()->set_quorum_id(it->second);
+      }
     }
+    // Update peer quorum_id in consensus queue
+    queue_->UpdatePeerQuorumIdUnlocked(*delta.quorum_ids);
   }
 
-  // Step 3: Update peer quorum_id in consensus queue
-  queue_->UpdatePeerQuorumIdUnlocked(uuid2quorum_ids);
+  // Since quorum ids or the voter distribution have changed, we need to
+  // refresh consensus queue to make sure watermark calculation changes.
   if (cmeta_->active_role() == RaftPeerPB::LEADER) {
     RETURN_NOT_OK(RefreshConsensusQueueAndPeersUnlocked());
   }
 
-  LOG(INFO) << "Successfully changed quorum_id. New active config: "
-            << SecureShortDebugString(cmeta_->ActiveConfig());
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Applied topology delta. New active config: "
+      << SecureShortDebugString(cmeta_->ActiveConfig());
   return Status::OK();
 }
 
@@ -4954,6 +6339,7 @@ bool RaftConsensus::HasLeaderUnlocked() const {
 
 void RaftConsensus::ClearLeaderUnlocked() {
   DCHECK(lock_.is_locked());
+  DisarmHeartbeatFastPathUnlocked();
   cmeta_->set_leader_uuid("");
 }
 
@@ -5027,6 +6413,18 @@ int64_t RaftConsensus::MetadataOnDiskSize() const {
   return cmeta_->on_disk_size();
 }
 
+Status RaftConsensus::ReadLogSegmentChunk(
+    int64_t seqno,
+    int64_t offset,
+    int64_t max_length,
+    faststring* data,
+    int64_t* segment_size) const {
+  if (!log_) {
+    return Status::IllegalState("the log isn't open");
+  }
+  return log_->ReadSegmentChunk(seqno, offset, max_length, data, segment_size);
+}
+
 ConsensusMetadata* RaftConsensus::consensus_metadata_for_tests() const {
   return cmeta_.get();
 }
@@ -5057,6 +6455,16 @@ void RaftConsensus::SetLeaderDetectedCallback(LeaderDetectedCallback ldcb) {
   ldcb_ = std::move(ldcb);
 }
 
+void RaftConsensus::SetSnapshotCatchupCallback(SnapshotCatchupCallback sccb) {
+  CHECK(sccb);
+  sccb_ = std::move(sccb);
+}
+
+void RaftConsensus::SetCommittedRoundsCallback(CommittedRoundsCallback crcb) {
+  CHECK(crcb);
+  crcb_ = std::move(crcb);
+}
+
 void RaftConsensus::SetVoteLogger(
     std::shared_ptr<VoteLoggerInterface> vote_logger) {
   vote_logger_ = std::move(vote_logger);
@@ -5068,53 +6476,114 @@ bool RaftConsensus::IsProxyRequest(const ConsensusRequestPB* request) const {
   return !request->proxy_dest_uuid().empty();
 }
 
-// Set an error and respond.
+bool RaftConsensus::IsSupersededRequest(const ConsensusRequestPB& request) {
+  if (!request.has_request_generation()) {
+    return false;
+  }
+  const std::pair<int64_t, int64_t> generation(
+      request.caller_term(), request.request_generation());
+  std::lock_guard<simple_spinlock> l(request_generation_lock_);
+  auto& latest = latest_request_generation_[request.caller_uuid()];
+  if (generation < latest) {
+    return true;
+  }
+  latest = generation;
+  return false;
+}
+
+// Set an error and complete the proxied request.
 // Stolen (mostly) from tablet_service.cc
-static void SetupErrorAndRespond(
+static void SetupErrorAndFinish(
     const Status& s,
     ServerErrorPB::Code code,
     ConsensusResponsePB* response,
-    rpc::RpcContext* context) {
+    const RaftConsensus::ProxyDoneCallback& done) {
   // Generic "service unavailable" errors will cause the client to retry later.
   if ((code == ServerErrorPB::UNKNOWN_ERROR /*||
        code == TabletServerErrorPB::THROTTLED */) && s.IsServiceUnavailable()) {
-    context->RespondRpcFailure(rpc::ErrorStatusPB::ERROR_SERVER_TOO_BUSY, s);
+    done(s);
     return;
   }
 
   StatusToPB(s, response->mutable_error()->mutable_status());
   response->mutable_error()->set_code(code);
-  context->RespondNoCache();
+  done(Status::OK());
 }
 
 // Respond with an error and return if 's' is not OK.
-#define RET_RESPOND_ERROR_NOT_OK(s)                             \
-  do {                                                          \
-    const kudu::Status& _s = (s);                               \
-    if (PREDICT_FALSE(!_s.ok())) {                              \
-      SetupErrorAndRespond(                                     \
-          _s, ServerErrorPB::UNKNOWN_ERROR, response, context); \
-      return;                                                   \
-    }                                                           \
+#define RET_RESPOND_ERROR_NOT_OK(s)                          \
+  do {                                                       \
+    const kudu::Status& _s = (s);                            \
+    if (PREDICT_FALSE(!_s.ok())) {                           \
+      SetupErrorAndFinish(                                   \
+          _s, ServerErrorPB::UNKNOWN_ERROR, response, done); \
+      return;                                                \
+    }                                                        \
   } while (0)
 
+struct RaftConsensus::ProxyCall {
+  ~ProxyCall();
+
+  // The upstream call, which outlives this until it's responded to.
+  const ConsensusRequestPB* request = nullptr;
+  ConsensusResponsePB* response = nullptr;
+  rpc::RpcContext* context = nullptr;
+  ProxyDoneCallback done;
+
+  RaftPeerPB next_peer_pb;
+  int64_t first_op_index = -1;
+  MonoTime wal_wait_deadline;
+  std::atomic<bool> resumed{false};
+
+  // The ops reconstituted from the local log. If 'ops_borrowed' is set,
+  // 'downstream_request' points at them rather than owning its ops.
+  std::vector<ReplicateRefPtr> messages;
+  bool ops_borrowed = false;
+  std::optional<ServerErrorPB::Code> proxy_error;
+
+  // The encoded ops from the upstream call's ops sidecar, to be relayed in
+  // the downstream request's.
+  Slice relayed_ops;
+
+  ConsensusRequestPB downstream_request;
+  ConsensusResponsePB downstream_response;
+  rpc::RpcController controller;
+  shared_ptr<PeerProxy> next_proxy;
+};
+
 void RaftConsensus::HandleProxyRequest(
     const ConsensusRequestPB* request,
     ConsensusResponsePB* response,
     rpc::RpcContext* context) {
+  HandleProxyRequest(request, response, context, [context](const Status& s) {
+    if (s.ok()) {
+      context->RespondSuccess();
+    } else if (s.IsServiceUnavailable()) {
+      context->RespondRpcFailure(rpc::ErrorStatusPB::ERROR_SERVER_TOO_BUSY, s);
+    } else {
+      context->RespondFailure(s);
+    }
+  });
+}
+
+void RaftConsensus::HandleProxyRequest(
+    const ConsensusRequestPB* request,
+    ConsensusResponsePB* response,
+    rpc::RpcContext* context,
+    ProxyDoneCallback done) {
   MonoDelta wal_wait_timeout =
       MonoDelta::FromMilliseconds(FLAGS_raft_log_cache_proxy_wait_time_ms);
   MonoTime wal_wait_deadline = MonoTime::Now() + wal_wait_timeout;
 
   // TODO(mpercy): Remove this config lookup when refactoring DRT to return a
   // RaftPeerPB, which will prevent a validation race.
-  RaftConfigPB active_config;
+  std::shared_ptr<const RaftConfigSnapshot> active_config;
   {
     // Snapshot the active Raft config so we know how to route proxied messages.
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
     RET_RESPOND_ERROR_NOT_OK(CheckRunningUnlocked());
-    active_config = cmeta_->ActiveConfig();
+    active_config = cmeta_->ActiveConfigSnapshot();
   }
 
   raft_proxy_num_requests_received_->Increment();
@@ -5140,16 +6609,14 @@ void RaftConsensus::HandleProxyRequest(
     LOG_WITH_PREFIX(WARNING)
         << s.ToString() << ": from " << context->requestor_string() << ": "
         << SecureShortDebugString(*request);
-    SetupErrorAndRespond(
-        s, ServerErrorPB::WRONG_SERVER_UUID, response, context);
+    SetupErrorAndFinish(s, ServerErrorPB::WRONG_SERVER_UUID, response, done);
     return;
   }
   if (request->dest_uuid() == peer_uuid()) {
     LOG_WITH_PREFIX(WARNING)
         << "dest_uuid and proxy_dest_uuid are the same: "
         << request->proxy_dest_uuid() << ": " << request->ShortDebugString();
-    context->RespondFailure(
-        Status::InvalidArgument("proxy and desination must be different"));
+    done(Status::InvalidArgument("proxy and desination must be different"));
     return;
   }
 
@@ -5159,28 +6626,19 @@ void RaftConsensus::HandleProxyRequest(
         << "in request to peer " << request->proxy_dest_uuid() << ": "
         << request->ShortDebugString();
     raft_proxy_num_requests_hops_remaining_exhausted_->Increment();
-    context->RespondFailure(Status::Incomplete(
+    done(Status::Incomplete(
         "proxy hops remaining exhausted", "possible routing loop"));
     return;
   }
 
   // Construct the downstream request; copy the relevant fields from the
   // proxied request.
-  ConsensusRequestPB downstream_request;
-  auto prevent_ops_deletion = MakeScopedCleanup([&]() {
-  // Prevent double-deletion of these requests.
-#if GOOGLE_PROTOBUF_VERSION >= 3017003
-    downstream_request.mutable_ops()->UnsafeArenaExtractSubrange(
-        /*start=*/0,
-        /*num=*/downstream_request.ops_size(),
-        /*elements=*/nullptr);
-#else
-    downstream_request.mutable_ops()->ExtractSubrange(
-        /*start=*/0,
-        /*num=*/downstream_request.ops_size(),
-        /*elements=*/nullptr);
-#endif
-  });
+  auto call = std::make_shared<ProxyCall>();
+  call->request = request;
+  call->response = response;
+  call->context = context;
+  call->done = std::move(done);
+  ConsensusRequestPB& downstream_request = call->downstream_request;
 
   downstream_request.set_dest_uuid(request->dest_uuid());
   downstream_request.set_tablet_id(request->tablet_id());
@@ -5232,166 +6690,272 @@ void RaftConsensus::HandleProxyRequest(
   }
 
   // Find the address of the remote given our local config.
-  RaftPeerPB* next_peer_pb;
-  Status s = GetRaftConfigMember(&active_config, next_uuid, &next_peer_pb);
-  if (PREDICT_FALSE(!s.ok())) {
-    RET_RESPOND_ERROR_NOT_OK(s.CloneAndPrepend(Substitute(
+  const RaftPeerPB* next_peer_pb = active_config->FindPeer(next_uuid);
+  if (PREDICT_FALSE(next_peer_pb == nullptr)) {
+    RET_RESPOND_ERROR_NOT_OK(Status::NotFound(Substitute(
         "unable to proxy to peer {} because it is not in the active config: {}",
         next_uuid,
-        SecureShortDebugString(active_config))));
+        SecureShortDebugString(active_config->config()))));
   }
   if (!next_peer_pb->has_last_known_addr()) {
-    s = Status::IllegalState("no known address for peer", next_uuid);
+    Status s = Status::IllegalState("no known address for peer", next_uuid);
     LOG_WITH_PREFIX(ERROR) << s.ToString();
     RET_RESPOND_ERROR_NOT_OK(s);
   }
+  call->next_peer_pb = *next_peer_pb;
 
-  std::optional<ServerErrorPB::Code> proxy_error = {};
-
-  vector<ReplicateRefPtr> messages;
-  messages.clear();
-
-  if (request->dest_uuid() != next_uuid) {
-    // Multi-hop proxy request.
-    downstream_request.set_proxy_dest_uuid(next_uuid);
-    // Forward the existing PROXY_OP ops.
+  // The leader sends full ops, rather than PROXY_OP placeholders, for us to
+  // relay (see --raft_proxy_relay_ops).
+  const bool relay_ops = request->has_ops_sidecar_idx() ||
+      (request->ops_size() > 0 && request->ops(0).op_type() != PROXY_OP);
+  if (request->dest_uuid() != next_uuid || relay_ops) {
+    if (request->dest_uuid() != next_uuid) {
+      // Multi-hop proxy request.
+      downstream_request.set_proxy_dest_uuid(next_uuid);
+    }
+    // Forward the ops as they are: the encoded ones in the sidecar without
+    // decoding them, and the existing PROXY_OP ops or full ops otherwise.
+    if (request->has_ops_sidecar_idx()) {
+      RET_RESPOND_ERROR_NOT_OK(context->GetInboundSidecar(
+          request->ops_sidecar_idx(), &call->relayed_ops));
+      if (request->has_ops_sidecar_compression()) {
+        downstream_request.set_ops_sidecar_compression(
+            request->ops_sidecar_compression());
+        downstream_request.set_ops_sidecar_uncompressed_size(
+            request->ops_sidecar_uncompressed_size());
+      }
+      if (request->has_ops_sidecar_encoding()) {
+        downstream_request.set_ops_sidecar_encoding(
+            request->ops_sidecar_encoding());
+      }
+    }
     for (int i = 0; i < request->ops_size(); i++) {
       *downstream_request.add_ops() = request->ops(i);
     }
-    prevent_ops_deletion.cancel(); // The ops we copy here are not pre-allocated
-  } else {
-    ReadContext read_context;
-    read_context.for_peer_uuid = &request->dest_uuid();
-    read_context.for_peer_host = &next_peer_pb->last_known_addr().host();
-    read_context.for_peer_port = next_peer_pb->last_known_addr().port();
-
-    // When we are proxying, we can skip reporting I/O errors (ie. missing log
-    // entries) to avoid remediations from replacing the proxy instance because
-    // these instances will eventually catch up. Proxy instances automatically
-    // disable proxying when there are I/O errors and eventually resume
-    // proxying when they're caught up.
-    read_context.report_errors = FLAGS_report_proxy_errors;
-
-    int64_t first_op_index = -1;
-    int64_t max_batch_size =
-        FLAGS_consensus_max_batch_size_bytes - request->ByteSizeLong();
-
-    // Reconstitute proxied events from the local cache.
-    // If the cache does not have all events, we retry up until the specified
-    // retry timeout.
-    // TODO(mpercy): Switch this from polling to event-triggered.
+    ForwardProxyCall(std::move(call));
+    return;
+  }
 
-    for (int i = 0; i < request->ops_size(); i++) {
-      auto& msg = request->ops(i);
-      if (PREDICT_FALSE(msg.op_type() != PROXY_OP)) {
+  for (int i = 0; i < request->ops_size(); i++) {
+    auto& msg = request->ops(i);
+    if (PREDICT_FALSE(msg.op_type() != PROXY_OP)) {
+      RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
+          "proxy expected PROXY_OP but received opid {} of type {}",
+          OpIdToString(msg.id()),
+          OperationType_Name(msg.op_type()))));
+    }
+    if (i == 0) {
+      call->first_op_index = msg.id().index();
+    } else {
+      // TODO(mpercy): It would be nice not to require consecutive indexes in
+      // the batch. We should see if we can support it without a big perf
+      // penalty in IOPS.
+      if (PREDICT_FALSE(msg.id().index() != call->first_op_index + i)) {
         RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
-            "proxy expected PROXY_OP but received opid {} of type {}",
+            "proxy requires consecutive indexes in batch, but received {} after index {}",
             OpIdToString(msg.id()),
-            OperationType_Name(msg.op_type()))));
-      }
-      if (i == 0) {
-        first_op_index = msg.id().index();
-      } else {
-        // TODO(mpercy): It would be nice not to require consecutive indexes in
-        // the batch. We should see if we can support it without a big perf
-        // penalty in IOPS.
-        if (PREDICT_FALSE(msg.id().index() != first_op_index + i)) {
-          RET_RESPOND_ERROR_NOT_OK(Status::InvalidArgument(Substitute(
-              "proxy requires consecutive indexes in batch, but received {} after index {}",
-              OpIdToString(msg.id()),
-              first_op_index + i - 1)));
-        }
+            call->first_op_index + i - 1)));
       }
     }
+  }
 
-    // Now we know that all ops we are reconstituting are consecutive.
-    //
-    // Block until the required op is available in local log. This might timeout
-    // based on FLAGS_raft_log_cache_proxy_wait_time_ms in which case we return
-    // an error
-    OpId preceding_id;
-    if (request->ops_size() > 0) {
-      queue_->log_cache()->BlockingReadOps(
-          first_op_index - 1,
-          max_batch_size,
-          read_context,
-          FLAGS_raft_log_cache_proxy_wait_time_ms,
-          request->ops_size(),
-          &messages,
-          &preceding_id);
-    }
+  // Now we know that all ops we are reconstituting are consecutive. If the
+  // first of them isn't in the local log yet, free this thread and carry on
+  // once it's appended, or once FLAGS_raft_log_cache_proxy_wait_time_ms has
+  // passed, whichever comes first.
+  call->wal_wait_deadline = wal_wait_deadline;
+  if (request->ops_size() == 0) {
+    ReadAndForwardProxyCall(std::move(call));
+    return;
+  }
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  if (!queue_->log_cache()->NotifyWhenAppended(
+          call->first_op_index,
+          [w, call]() { ResumeProxyCall(w, call); })) {
+    ReadAndForwardProxyCall(std::move(call));
+    return;
+  }
+  peer_proxy_factory_->messenger()->ScheduleOnReactor(
+      [w, call](const Status& /* status */) { ResumeProxyCall(w, call); },
+      std::max(wal_wait_deadline - MonoTime::Now(), MonoDelta::FromSeconds(0)));
+}
 
-    if (request->ops_size() > 0 && messages.size() == 0) {
-      // We timed out and got nothing from the log cache. Send a heartbeat to
-      // the destination to prevent it from starting (pre) election
-      raft_proxy_num_requests_log_read_timeout_->Increment();
-      proxy_error = ServerErrorPB::PROXY_MISSING_LOG_ENTRIES;
-    }
+RaftConsensus::ProxyCall::~ProxyCall() {
+  // The reconstituted ops belong to 'messages'; don't delete them.
+  if (ops_borrowed) {
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    downstream_request.mutable_ops()->UnsafeArenaExtractSubrange(
+        /*start=*/0,
+        /*num=*/downstream_request.ops_size(),
+        /*elements=*/nullptr);
+#else
+    downstream_request.mutable_ops()->ExtractSubrange(
+        /*start=*/0,
+        /*num=*/downstream_request.ops_size(),
+        /*elements=*/nullptr);
+#endif
+  }
+}
 
-    // Reconstitute the proxied ops. We silently tolerate proxying a subset of
-    // the requested batch.
-    for (int i = 0; i < request->ops_size() && i < messages.size(); i++) {
-      // Ensure that the OpIds match. We don't expect a mismatch to ever
-      // happen, so we log an error locally before reponding to the caller.
-      if (!OpIdEquals(request->ops(i).id(), messages[i]->get()->id())) {
-        string extra_info;
-        if (i > 0) {
-          extra_info = Substitute(
-              " (previously received OpId: $0)",
-              OpIdToString(messages[i - 1]->get()->id()));
-        }
-        Status s = Status::IllegalState(Substitute(
-            "log cache returned non-consecutive OpId index for message $0 in request: "
-            "requested $1, received $2$3",
-            i,
-            OpIdToString(request->ops(i).id()),
-            OpIdToString(messages[i]->get()->id()),
-            extra_info));
-        LOG_WITH_PREFIX(ERROR) << s.ToString();
-        RET_RESPOND_ERROR_NOT_OK(s);
+void RaftConsensus::ResumeProxyCall(
+    const weak_ptr<RaftConsensus>& w,
+    const shared_ptr<ProxyCall>& call) {
+  // Both the log cache and the wait timeout try to resume the call; only the
+  // first gets to.
+  if (call->resumed.exchange(true)) {
+    return;
+  }
+  ConsensusResponsePB* response = call->response;
+  const ProxyDoneCallback& done = call->done;
+  shared_ptr<RaftConsensus> consensus = w.lock();
+  if (PREDICT_FALSE(!consensus)) {
+    RET_RESPOND_ERROR_NOT_OK(Status::ServiceUnavailable(
+        "replica shut down while proxying request"));
+  }
+  // Log reads don't belong on the appending thread or on a reactor.
+  RET_RESPOND_ERROR_NOT_OK(consensus->raft_pool_token_->SubmitFunc(
+      [consensus, call]() { consensus->ReadAndForwardProxyCall(call); }));
+}
+
+void RaftConsensus::ReadAndForwardProxyCall(shared_ptr<ProxyCall> call) {
+  const ConsensusRequestPB* request = call->request;
+  ConsensusResponsePB* response = call->response;
+  const ProxyDoneCallback& done = call->done;
+  ConsensusRequestPB& downstream_request = call->downstream_request;
+  vector<ReplicateRefPtr>& messages = call->messages;
+
+  ReadContext read_context;
+  read_context.for_peer_uuid = &request->dest_uuid();
+  read_context.for_peer_host = &call->next_peer_pb.last_known_addr().host();
+  read_context.for_peer_port = call->next_peer_pb.last_known_addr().port();
+
+  // When we are proxying, we can skip reporting I/O errors (ie. missing log
+  // entries) to avoid remediations from replacing the proxy instance because
+  // these instances will eventually catch up. Proxy instances automatically
+  // disable proxying when there are I/O errors and eventually resume
+  // proxying when they're caught up.
+  read_context.report_errors = FLAGS_report_proxy_errors;
+
+  int64_t max_batch_size =
+      FLAGS_consensus_max_batch_size_bytes - request->ByteSizeLong();
+
+  // By now the first op is either in the local log or won't be in time, so
+  // this doesn't wait for it; the remaining time only bounds how long we
+  // keep reading to fill the batch.
+  OpId preceding_id;
+  if (request->ops_size() > 0) {
+    queue_->log_cache()->BlockingReadOps(
+        call->first_op_index - 1,
+        max_batch_size,
+        read_context,
+        std::max<int64_t>(
+            (call->wal_wait_deadline - MonoTime::Now()).ToMilliseconds(), 0),
+        request->ops_size(),
+        &messages,
+        &preceding_id);
+  }
+
+  if (request->ops_size() > 0 && messages.size() == 0) {
+    // We timed out and got nothing from the log cache. Send a heartbeat to
+    // the destination to prevent it from starting (pre) election
+    raft_proxy_num_requests_log_read_timeout_->Increment();
+    call->proxy_error = ServerErrorPB::PROXY_MISSING_LOG_ENTRIES;
+  }
+
+  // Reconstitute the proxied ops. We silently tolerate proxying a subset of
+  // the requested batch.
+  call->ops_borrowed = true;
+  for (int i = 0; i < request->ops_size() && i < messages.size(); i++) {
+    // Ensure that the OpIds match. We don't expect a mismatch to ever
+    // happen, so we log an error locally before reponding to the caller.
+    if (!OpIdEquals(request->ops(i).id(), messages[i]->get()->id())) {
+      string extra_info;
+      if (i > 0) {
+        extra_info = Substitute(
+            " (previously received OpId: $0)",
+            OpIdToString(messages[i - 1]->get()->id()));
       }
-      downstream_request.mutable_ops()->AddAllocated(messages[i]->get());
+      Status s = Status::IllegalState(Substitute(
+          "log cache returned non-consecutive OpId index for message $0 in request: "
+          "requested $1, received $2$3",
+          i,
+          OpIdToString(request->ops(i).id()),
+          OpIdToString(messages[i]->get()->id()),
+          extra_info));
+      LOG_WITH_PREFIX(ERROR) << s.ToString();
+      RET_RESPOND_ERROR_NOT_OK(s);
     }
+    // Ops read from the log may live on an arena (see
+    // --log_cache_read_arenas), which AddAllocated() would copy out of, and
+    // ~ProxyCall() only extracts what it added.
+    downstream_request.mutable_ops()->UnsafeArenaAddAllocated(
+        messages[i]->get());
   }
 
-  VLOG_WITH_PREFIX(3) << "Downstream proxy request: "
-                      << SecureShortDebugString(downstream_request);
+  ForwardProxyCall(std::move(call));
+}
 
-  // Asynchronously:
-  // Send the request to the remote.
+void RaftConsensus::ForwardProxyCall(shared_ptr<ProxyCall> call) {
+  TRACE_EVENT2(
+      "consensus",
+      "RaftConsensus::ForwardProxyCall",
+      "tablet",
+      options_.tablet_id,
+      "dest",
+      call->next_peer_pb.permanent_uuid());
+  TraceOpFlowSteps(
+      options_.tablet_id, call->downstream_request.ops(), "proxied");
+  ConsensusResponsePB* response = call->response;
+  const ProxyDoneCallback& done = call->done;
+
+  VLOG_WITH_PREFIX(3) << "Downstream proxy request: "
+                      << SecureShortDebugString(call->downstream_request);
 
   // TODO(mpercy): Cache this proxy object (although they are lightweight).
   // We can use a PeerProxyPool, like we do when sending from the leader.
-  shared_ptr<PeerProxy> next_proxy;
   RET_RESPOND_ERROR_NOT_OK(
-      peer_proxy_factory_->NewProxy(*next_peer_pb, &next_proxy));
+      peer_proxy_factory_->NewProxy(call->next_peer_pb, &call->next_proxy));
 
-  ConsensusResponsePB downstream_response;
-  rpc::RpcController controller;
-  controller.set_timeout(
+  call->controller.set_timeout(
       MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  if (!call->relayed_ops.empty()) {
+    // The slice stays valid until the upstream call is responded to.
+    int idx;
+    RET_RESPOND_ERROR_NOT_OK(call->controller.AddOutboundSidecar(
+        rpc::RpcSidecar::FromSlice(call->relayed_ops), &idx));
+    call->downstream_request.set_ops_sidecar_idx(idx);
+  }
+
+  // Send the request to the remote, and respond to the caller from the
+  // callback, so that no thread waits for the remote in between.
+  shared_ptr<RaftConsensus> s_this = shared_from_this();
+  call->next_proxy->UpdateAsync(
+      &call->downstream_request,
+      &call->downstream_response,
+      &call->controller,
+      [s_this, call]() { s_this->CompleteProxyCall(*call); });
+}
+
+void RaftConsensus::CompleteProxyCall(const ProxyCall& call) {
+  ConsensusResponsePB* response = call.response;
+  const ProxyDoneCallback& done = call.done;
+  const ConsensusResponsePB& downstream_response = call.downstream_response;
+
+  if (PREDICT_FALSE(!call.controller.status().ok())) {
+    RET_RESPOND_ERROR_NOT_OK(call.controller.status().CloneAndPrepend(
+        Substitute(
+            "Error proxying request from $0 to $1",
+            "local peer " + local_peer_pb_.permanent_uuid(),
+            SecureShortDebugString(call.next_peer_pb))));
+  }
 
-  // Here, we turn an async API into a blocking one with a CountdownLatch.
-  // TODO(mpercy): Use an async approach instead.
-  CountDownLatch latch(/*count=*/1);
-  rpc::ResponseCallback callback = [&latch] { latch.CountDown(); };
-  next_proxy->UpdateAsync(
-      &downstream_request, &downstream_response, &controller, callback);
-  latch.Wait();
-  if (PREDICT_FALSE(!controller.status().ok())) {
-    RET_RESPOND_ERROR_NOT_OK(controller.status().CloneAndPrepend(Substitute(
-        "Error proxying request from $0 to $1",
-        "local peer " + local_peer_pb_.permanent_uuid(),
-        SecureShortDebugString(*next_peer_pb))));
-  }
-
-  if (proxy_error) {
-    SetupErrorAndRespond(
+  if (call.proxy_error) {
+    SetupErrorAndFinish(
         Status::Incomplete(
             "Unable to proxy request. Degraded request to heartbeat."),
-        proxy_error.value(),
+        call.proxy_error.value(),
         response,
-        context);
+        done);
     return;
   }
 
@@ -5410,17 +6974,15 @@ void RaftConsensus::HandleProxyRequest(
   }
 
   raft_proxy_num_requests_success_->Increment();
-  context->RespondSuccess();
+  done(Status::OK());
 }
 
 Status RaftConsensus::SetCompressionCodec(const std::string& codec) {
-  LockGuard l(lock_);
-  return CompressionCodecManager::SetCurrentCodec(codec);
+  return queue_->codec_manager()->SetCurrentCodec(codec);
 }
 
 Status RaftConsensus::SetCompressionLevel(int level) {
-  LockGuard l(lock_);
-  return CompressionCodecManager::SetCurrentCompressionLevel(level);
+  return queue_->codec_manager()->SetCurrentCompressionLevel(level);
 }
 
 Status RaftConsensus::EnableCompressionOnCacheMiss(bool enable) {
@@ -5469,9 +7031,112 @@ Status RaftConsensus::LoadCompressionDict(const std::string& filename) {
   return Status::OK();
 }
 
-std::string RaftConsensus::GetCompressionStats() const {
+void RaftConsensus::AdaptCompression() {
+  bool cross_region = false;
+  {
+    LockGuard l(lock_);
+    if (state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER) {
+      return;
+    }
+    const std::string& local_region = local_peer_pb_.attrs().region();
+    for (const RaftPeerPB& peer : cmeta_->ActiveConfig().peers()) {
+      const std::string& region = peer.attrs().region();
+      if (!local_region.empty() && !region.empty() && region != local_region) {
+        cross_region = true;
+        break;
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> policy_lock(compression_policy_lock_);
+  CompressionCodecManager* codec_manager = queue_->codec_manager();
+  const AdaptiveCompressionPolicy::Choice choice =
+      compression_policy_.Evaluate(
+          codec_manager->GetCurrentCodec(),
+          cross_region,
+          codec_manager->HasDictionary());
+
+  AdaptiveCompressionPolicy::Choice current;
+  if (auto codec = codec_manager->GetCurrentCodec()) {
+    current.type = codec->type();
+    current.level = codec->CompressionLevel();
+  }
+  if (choice == current) {
+    return;
+  }
+  Status s = codec_manager->SetCurrentCodec(choice.type);
+  if (s.ok() && choice.type != NO_COMPRESSION) {
+    s = codec_manager->SetCurrentCompressionLevel(choice.level);
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING)
+        << "Unable to switch compression to "
+        << CompressionCodecManager::GetCodecName(choice.type) << " level "
+        << choice.level << ": " << s.ToString();
+    return;
+  }
+  LOG_WITH_PREFIX(INFO) << "Switched compression to "
+                        << CompressionCodecManager::GetCodecName(choice.type)
+                        << " level " << choice.level
+                        << (cross_region ? " for a cross-region ring"
+                                         : " for a single-region ring");
+}
+
+void RaftConsensus::TrainCompressionDict() {
+  {
+    LockGuard l(lock_);
+    if (state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER) {
+      return;
+    }
+  }
+  CompressionCodecManager* codec_manager = queue_->codec_manager();
+  auto codec = codec_manager->GetCurrentCodec();
+  const bool uses_dictionary =
+      codec && (codec->type() == ZSTD_DICT || codec->type() == LZ4_DICT);
+  if (!uses_dictionary && FLAGS_raft_adaptive_compression_interval_ms <= 0) {
+    return;
+  }
+
+  std::string dict;
+  Status s = dict_trainer_->Train(&dict);
+  if (s.IsIncomplete()) {
+    VLOG_WITH_PREFIX(1) << s.ToString();
+    return;
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING) << s.ToString();
+    return;
+  }
+  if (CompressionCodecManager::GetDictionaryID(dict) ==
+      codec_manager->GetCurrentDictionaryID()) {
+    return;
+  }
+
+  // Peers get the new dictionary with their next request, the same way as one
+  // loaded by LoadCompressionDict(), and keep the previous few to read ops
+  // compressed before the rotation.
   LockGuard l(lock_);
-  auto codec = CompressionCodecManager::GetCurrentCodec();
+  if (state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER) {
+    return;
+  }
+  s = queue_->SetCompressionDictionary(dict);
+  if (s.ok()) {
+    persistent_vars_->set_compression_dictionary(dict);
+    s = persistent_vars_->Flush();
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX_UNLOCKED(WARNING)
+        << "Unable to rotate compression dictionary: " << s.ToString();
+    return;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Rotated compression dictionary to id "
+      << CompressionCodecManager::GetDictionaryID(dict) << " ("
+      << dict.size() << " bytes)";
+}
+
+std::string RaftConsensus::GetCompressionStats() const {
+  auto codec = queue_->codec_manager()->GetCurrentCodec();
   return codec ? codec->Stats() : "";
 }
 
@@ -5495,6 +7160,9 @@ void RaftConsensus::GetProxyPolicy(std::string* proxy_policy) {
     case ProxyPolicy::DURABLE_ROUTING_POLICY:
       *proxy_policy = "DURABLE_ROUTING_POLICY";
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      *proxy_policy = "LATENCY_AWARE_ROUTING_POLICY";
+      break;
     default:
       *proxy_policy = "UNKNOWN";
       break;
@@ -5574,10 +7242,43 @@ ConsensusRound::ConsensusRound(
   DCHECK(replicate_msg_);
 }
 
+void ConsensusRound::MarkStartDeferred() {
+  std::lock_guard<simple_spinlock> l(start_lock_);
+  start_deferred_ = true;
+}
+
+void ConsensusRound::DeferredStartFinished() {
+  boost::optional<Status> status;
+  {
+    std::lock_guard<simple_spinlock> l(start_lock_);
+    start_deferred_ = false;
+    status.swap(deferred_replication_status_);
+  }
+  if (status) {
+    NotifyReplicationFinished(*status);
+  }
+}
+
 void ConsensusRound::NotifyReplicationFinished(const Status& status) {
-  if (PREDICT_FALSE(!replicated_cb_))
-    return;
-  replicated_cb_(status);
+  {
+    std::lock_guard<simple_spinlock> l(start_lock_);
+    if (PREDICT_FALSE(start_deferred_)) {
+      deferred_replication_status_ = status;
+      return;
+    }
+  }
+  OpLatencyTrace* trace = status.ok() ? replicate_msg_->latency_trace()
+                                      : nullptr;
+  if (PREDICT_FALSE(trace != nullptr)) {
+    trace->Mark(OpStage::kCommitted);
+  }
+  if (PREDICT_TRUE(replicated_cb_)) {
+    replicated_cb_(status);
+  }
+  if (PREDICT_FALSE(trace != nullptr)) {
+    trace->Mark(OpStage::kReplicated);
+    consensus_->RecordOpLatency(id(), *trace);
+  }
 }
 
 Status ConsensusRound::CheckBoundTerm(int64_t current_term) const {
@@ -25,7 +25,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <deque>
 #include <iosfwd>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -43,6 +45,8 @@
 #include "kudu/consensus/log.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/payload_fragments.h"
+#include "kudu/consensus/pending_rounds.h"
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars.pb.h"
 #include "kudu/consensus/proxy_policy.h"
@@ -60,6 +64,8 @@
 
 #include "kudu/consensus/flags_layering.h"
 #include "kudu/util/atomic.h"
+#include "kudu/util/compression/compression_dict_trainer.h"
+#include "kudu/util/compression/compression_policy.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/make_shared.h"
@@ -82,6 +88,7 @@ namespace kudu {
 using Lock = std::lock_guard<simple_mutexlock>;
 using ScopedLock = std::unique_ptr<Lock>;
 
+class LockProfile;
 class Status;
 class ThreadPool;
 class ThreadPoolToken;
@@ -104,16 +111,27 @@ namespace consensus {
 class ConsensusMetadataManager;
 class ConsensusRound;
 class ConsensusRoundHandler;
+class OpLatencyTrace;
+class OpLatencyTracker;
 class PeerManager;
 class PeerProxyFactory;
 class PersistentVarsManager;
 class PendingRounds;
+class StartupProfile;
 struct ConsensusBootstrapInfo;
 
 struct ConsensusOptions {
   std::string tablet_id;
   ProxyPolicy proxy_policy;
   boost::optional<std::string> initial_raft_rpc_token;
+  // If set, the work of replicating to remote peers runs here rather than on
+  // the raft pool. Not owned.
+  ThreadPool* peer_send_pool = nullptr;
+  // If set, overrides --raft_commit_notification_delay_ms for this tablet.
+  boost::optional<int32_t> commit_notification_delay_ms;
+  // If set, the time spent loading the ring's metadata is recorded here. Not
+  // owned.
+  StartupProfile* startup_profile = nullptr;
 };
 
 struct TabletVotingState {
@@ -135,6 +153,17 @@ struct TabletVotingState {
   }
 };
 
+// Local topology changes for RaftConsensus::ApplyTopologyDelta(). Only the
+// parts that are set are changed.
+struct TopologyDelta {
+  // Quorum ids of voters by uuid, with the semantics of SetPeerQuorumIds().
+  boost::optional<std::map<std::string, std::string>> quorum_ids;
+  // Replaces the voter distribution, as ChangeVoterDistribution() does.
+  boost::optional<std::map<std::string, int32_t>> voter_distribution;
+  // Replaces the proxy topology, as ChangeProxyTopology() does.
+  boost::optional<ProxyTopologyPB> proxy_topology;
+};
+
 typedef StdStatusCallback ConsensusReplicatedCallback;
 
 // Reasons for StartElection().
@@ -221,6 +250,20 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   typedef std::function<void(int64_t, const RaftPeerPB&)>
       LeaderDetectedCallback;
   typedef std::function<void(void)> CheckQuorumFailureCallback;
+  // Called on the leader with the uuid of a peer which needs ops from
+  // 'next_index' on, and the first index still in the log, which is past it.
+  typedef std::function<void(
+      const std::string& peer_uuid,
+      int64_t next_index,
+      int64_t first_available_index)>
+      SnapshotCatchupCallback;
+  // Called, under the consensus lock, with each contiguous range of rounds
+  // that became committed, in order. Lets the application handle commits a
+  // batch at a time instead of setting a replicated callback on every round.
+  typedef PendingRounds::CommittedRoundsCallback CommittedRoundsCallback;
+  // Called with the read index, or with why one couldn't be had.
+  typedef std::function<void(const Status& s, int64_t read_index)>
+      ReadIndexCallback;
 
   ~RaftConsensus();
 
@@ -290,6 +333,18 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // If the failure detector is already disabled, has no effect.
   void DisableFailureDetector();
 
+  // Called when the server with uuid 'server_uuid' has been found
+  // unresponsive by the liveness tracker shared by all of the rings on this
+  // server. If it hosts the leader of this ring, leader failure is reported
+  // after 'delay' rather than a full election timeout after the last
+  // heartbeat. Not done while the leader's last update announced a quiescent
+  // interval which hasn't elapsed yet, during which the leader's server may
+  // rightly be silent. Returns true if the failure detector was brought
+  // forward.
+  bool ExpediteFailureDetection(
+      const std::string& server_uuid,
+      const MonoDelta& delay);
+
   // Pauses outgoing votes from this server during elections, if set to true.
   void SetWithholdVotesForTests(bool withhold_votes);
 
@@ -427,6 +482,17 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       std::unique_ptr<ReplicateMsg> replicate_msg,
       ConsensusReplicatedCallback replicated_cb);
 
+  // Like the above, with 'payload' moved into the write payload of
+  // 'replicate_msg', which must not have one yet, instead of copied into it.
+  // Past this point the payload isn't copied before it's serialized: the log
+  // cache and the peers' requests share the ReplicateMsg, and large payloads
+  // go to the peers as sidecars pointing into it (see
+  // --raft_payload_sidecar_min_bytes).
+  scoped_refptr<ConsensusRound> NewRound(
+      std::unique_ptr<ReplicateMsg> replicate_msg,
+      std::string payload,
+      ConsensusReplicatedCallback replicated_cb);
+
   // Creates a new ConsensusRound, the entity that owns all the data
   // structures required for a consensus round, such as the ReplicateMsg
   scoped_refptr<ConsensusRound> NewRound(
@@ -474,6 +540,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // verify that the term has not changed in the meantime.
   Status CheckLeadershipAndBindTerm(const scoped_refptr<ConsensusRound>& round);
 
+  // Records the latency trace of the op 'id' once its round is replicated.
+  // A no-op unless the replica was started with
+  // --raft_op_latency_sample_interval.
+  void RecordOpLatency(const OpId& id, const OpLatencyTrace& trace);
+
+  // Writes the slowest traced ops to 'out', one per line, with the time each
+  // took to reach every stage. See OpLatencyTracker.
+  void DumpSlowestOps(std::ostream* out) const;
+
   // Messages sent from LEADER to FOLLOWERS and LEARNERS to update their
   // state machines. This is equivalent to "AppendEntries()" in Raft
   // terminology.
@@ -498,9 +573,34 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // error response could not be formed, which will result in the service
   // returning an UNKNOWN_ERROR RPC error code to the caller and including the
   // stringified Status message.
+  //
+  // If 'request' was allocated on 'request_arena', the ops taken from it keep
+  // the arena alive until they are no longer referenced.
   Status Update(
       const ConsensusRequestPB* request,
-      ConsensusResponsePB* response);
+      ConsensusResponsePB* response,
+      std::shared_ptr<google::protobuf::Arena> request_arena = nullptr);
+
+  // Like Update(), but doesn't wait for the ops in 'request' to be durable in
+  // the local log: 'done' is called with what Update() would have returned
+  // once they are, on the log's append thread, or on the calling thread if
+  // nothing was appended. 'response' is filled before 'done' is called, and
+  // 'request' and 'response' must stay alive until it is.
+  void UpdateAsync(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      std::shared_ptr<google::protobuf::Arena> request_arena,
+      StdStatusCallback done);
+
+  // Applies a heartbeat from the leader, if nothing has changed since the
+  // last Update() from it that carried no new ops: the heartbeat then only
+  // renews the leader's liveness, lease and the safe time, which it does
+  // without taking 'lock_'. Otherwise changes nothing and leaves
+  // 'response->handled()' false, for the leader to send an Update() instead.
+  // Doesn't block, so may run on a reactor thread.
+  void Heartbeat(
+      const HeartbeatRequestPB* request,
+      HeartbeatResponsePB* response);
 
   // Messages sent from CANDIDATEs to voting peers to request their vote
   // in leader election.
@@ -589,6 +689,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
       std::map<std::string, std::string> uuid2quorum_ids,
       bool force = false);
 
+  // Applies all of the changes in 'delta' to this replica at once, with a
+  // single consensus metadata flush and a single proxy topology flush, or
+  // applies none of them if any is rejected. Like the methods it stands in
+  // for, this changes only the local replica. Membership changes, along with
+  // the attributes of the peers they add or modify, go through a single
+  // BulkChangeConfig() instead. 'force' is as for SetPeerQuorumIds() and
+  // ChangeVoterDistribution().
+  Status ApplyTopologyDelta(const TopologyDelta& delta, bool force = false);
+
   // Only relevant for abstracted logs.
   // Callback the log abstraction's TruncateOpsAfter function
   // while holding Raft Consensus lock. This is to serialize
@@ -605,6 +714,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   boost::optional<OpId> GetNextOpId() const;
 
+  // The accessors below, up to GetLeaderHostPort(), read the state published
+  // by ConsensusMetadata::snapshot() and do not take 'lock_'.
+
   // Returns the current Raft role of this instance.
   RaftPeerPB::Role role() const;
 
@@ -627,7 +739,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // relevant for Flexi-Raft
   std::string peer_region() const;
 
-  // It is own peer region or quorum_id
+  // It is own peer region or quorum_id. With 'need_lock' false the caller
+  // must hold 'lock_'; otherwise the published snapshot is read.
   std::string peer_quorum_id(bool need_lock = true) const;
 
   // Returns the id of the tablet whose updates this consensus instance helps
@@ -651,11 +764,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // health report about each active peer in the committed config.
   // If RaftConsensus has been shut down, returns Status::IllegalState.
   // Does not modify the out-param 'cstate' unless an OK status is returned.
+  // Without a health report, does not take 'lock_'.
   Status ConsensusState(
       ConsensusStatePB* cstate,
       IncludeHealthReport report_health = EXCLUDE_HEALTH_REPORT) const;
 
-  // Returns a copy of the current committed Raft configuration.
+  // Returns a copy of the current committed Raft configuration. Does not take
+  // 'lock_'.
   RaftConfigPB CommittedConfig() const;
 
   // Returns a copy of the current pending Raft configuration.
@@ -671,6 +786,16 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // It is legal to call this method while in any lifecycle state.
   void Shutdown();
 
+  // Before a planned shutdown, with --raft_shutdown_handoff_timeout_ms, hands
+  // leadership off so that the ring doesn't wait for failure detection to
+  // elect a new leader. If this replica is the leader, it stops accepting
+  // writes and transfers leadership to the most caught up voter, which runs
+  // its election once it has every op the leader has, in-flight ones
+  // included. Then waits for the log to be flushed. Returns TimedOut, or
+  // the reason, if leadership couldn't be handed off; the caller should shut
+  // down regardless.
+  Status HandOffLeadershipForShutdown();
+
   // Makes this peer advance it's term (and step down if leader), for tests.
   Status AdvanceTermForTests(int64_t new_term);
 
@@ -704,6 +829,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   void NotifyPeerHealthChange() override;
 
+  void NotifyPeerNeedsSnapshot(const std::string& peer_uuid, int64_t next_index)
+      override;
+
   // Return the log indexes which the consensus implementation would like to
   // retain.
   //
@@ -716,18 +844,49 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Return the on-disk size of the consensus metadata, in bytes.
   int64_t MetadataOnDiskSize() const;
 
+  // Reads a chunk of a closed segment of the local log, as in
+  // Log::ReadSegmentChunk(). Any replica can serve these, not only the
+  // leader, so a replica being rebuilt can copy from whichever is nearest.
+  Status ReadLogSegmentChunk(
+      int64_t seqno,
+      int64_t offset,
+      int64_t max_length,
+      faststring* data,
+      int64_t* segment_size) const;
+
   int64_t GetMillisSinceLastLeaderHeartbeat() const;
 
   // Returns true if the request is intended to be proxied.
   bool IsProxyRequest(const ConsensusRequestPB* request) const;
 
+  // Returns true if a request with a higher 'request_generation' from the
+  // same leader and term has already been seen, in which case the leader
+  // gave up on 'request' and it shouldn't be handled. Otherwise records the
+  // request's generation.
+  bool IsSupersededRequest(const ConsensusRequestPB& request);
+
   // Handle proxy RPC request.
-  // This method is intended to be executed on an RPC worker thread.
+  // This method is intended to be executed on an RPC worker thread. It
+  // returns without waiting for the proxied ops to reach the local log or
+  // for the downstream peer to respond; 'context' is responded to once the
+  // downstream request completes.
   void HandleProxyRequest(
       const ConsensusRequestPB* request,
       ConsensusResponsePB* response,
       rpc::RpcContext* context);
 
+  // Called once a proxied request completes: with OK once its response is
+  // filled in, or with the error to fail its call with otherwise.
+  typedef std::function<void(const Status&)> ProxyDoneCallback;
+
+  // Like the above, for a request that is one of several in 'context' (see
+  // MultiUpdateConsensus), which is then only used for its sidecars.
+  void HandleProxyRequest(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      rpc::RpcContext* context,
+      ProxyDoneCallback done);
+
   // Trigger that a non-Transaction ConsensusRound has finished replication.
   // If the replication was successful, an status will be OK. Otherwise, it
   // may be Aborted or some other error status.
@@ -760,6 +919,31 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Gets the Leader Lease timestamp
   MonoTime GetLeaderLeaseUntil();
 
+  // Returns the time, on the local monotonic clock, until which this leader
+  // may serve linearizable reads from its local state without a round trip
+  // to the quorum. This is the leader lease, less the most the clocks of the
+  // leader and of its lease grantors may have drifted apart over the lease
+  // interval, per --raft_leader_lease_max_clock_skew_ppm. Reads must still
+  // wait for everything committed so far to be applied. Returns
+  // MonoTime::Min() if leader leases are disabled, this peer isn't the leader
+  // or it holds no lease.
+  MonoTime GetSafeLocalReadUntil();
+
+  // Gets a read index for a linearizable read on this replica: once the
+  // application has applied every op up to the index, its local state
+  // reflects every op committed before this call. The leader confirms it is
+  // still the leader with a round of heartbeats, unless it holds a leader
+  // lease; followers ask the leader, then call 'done' once they have
+  // committed up to the index. Concurrent calls share the same round or RPC.
+  //
+  // 'done' may be called on this thread or on a raft or reactor thread, and
+  // must not block.
+  void ReadIndexAsync(ReadIndexCallback done);
+
+  // As ReadIndexAsync(), but fails with IllegalState unless this replica is
+  // the leader. Serves the ReadIndex RPC.
+  void LeaderReadIndexAsync(ReadIndexCallback done);
+
   // Get the bounded data loss window expiry timestamp
   MonoTime GetBoundedDataLossWindowUntil();
 
@@ -771,6 +955,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   std::string GetCompressionStats() const;
 
+  // Returns in 'uncompressed' 'msg' with its payload checked and
+  // uncompressed. For consumers of the ops of a replica that keeps payloads
+  // as received (see --follower_opaque_payloads).
+  Status UncompressReplicate(
+      const ReplicateRefPtr& msg,
+      ReplicateRefPtr* uncompressed);
+
   // Clear the 'removed_peers_' list managed by consensus_meta
   void ClearRemovedPeersList();
 
@@ -819,7 +1010,44 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   FRIEND_TEST(
       RaftConsensusQuorumTest,
       TestReplicasEnforceTheLogMatchingProperty);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestProxyForwardsOpsReadOnArena);
   FRIEND_TEST(RaftConsensusQuorumTest, TestRequestVote);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestFollowerHasNoSafeLocalReads);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestRankedElectionTimeoutsSpread);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestQuiescentLeaderNotExpedited);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestDelayedCommitNotification);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestAdmissionControl);
+
+  // The state of a request being proxied by HandleProxyRequest().
+  struct ProxyCall;
+
+  // If this replica is the leader, lets compression_policy_ pick the codec
+  // and level of the ring. Runs periodically if
+  // --raft_adaptive_compression_interval_ms is positive.
+  void AdaptCompression();
+
+  // If this replica is the leader, trains a compression dictionary from the
+  // payloads sampled by dict_trainer_ and makes it the ring's dictionary.
+  // Called periodically if --raft_compression_dict_training_interval_ms is
+  // positive.
+  void TrainCompressionDict();
+
+  // Resumes 'call' on the raft pool once its ops are in the local log or it
+  // has waited long enough. Only the first of several calls for the same
+  // 'call' does anything.
+  static void ResumeProxyCall(
+      const std::weak_ptr<RaftConsensus>& w,
+      const std::shared_ptr<ProxyCall>& call);
+
+  // Reconstitutes the proxied ops of 'call' from the local log, then
+  // forwards it.
+  void ReadAndForwardProxyCall(std::shared_ptr<ProxyCall> call);
+
+  // Sends the downstream request of 'call' to the next hop.
+  void ForwardProxyCall(std::shared_ptr<ProxyCall> call);
+
+  // Responds to the caller of 'call' once the downstream request is done.
+  void CompleteProxyCall(const ProxyCall& call);
 
   // RaftConsensus lifecycle states.
   //
@@ -872,6 +1100,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
     // The positional index of the first message selected to be appended, in the
     // original leader's request message sequence.
     int64_t first_message_idx;
+    // The arena the leader's request was allocated on, if any.
+    std::shared_ptr<google::protobuf::Arena> arena;
 
     std::string OpsRangeString() const;
   };
@@ -941,9 +1171,31 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // until all operations have been stored in the log and all Prepares() have
   // been completed, and a replica cannot accept any more Update() requests
   // until this is done.
+  //
+  // If 'durable_cb' is set and ops were appended, this returns without waiting
+  // for them, and 'durable_cb' is taken over and called once they are durable
+  // and the response is filled; 'request' and 'response' mustn't be touched
+  // after it returns. Otherwise 'durable_cb' is left for the caller to call.
   Status UpdateReplica(
       const ConsensusRequestPB* request,
-      ConsensusResponsePB* response);
+      ConsensusResponsePB* response,
+      std::shared_ptr<google::protobuf::Arena> request_arena,
+      StdStatusCallback* durable_cb = nullptr);
+
+  // Shared by Update() and UpdateAsync(); 'durable_cb' as in UpdateReplica().
+  Status DoUpdate(
+      const ConsensusRequestPB* request,
+      ConsensusResponsePB* response,
+      std::shared_ptr<google::protobuf::Arena> request_arena,
+      StdStatusCallback* durable_cb);
+
+  // The callback of an asynchronous update, and the ops it appended.
+  struct AsyncUpdateState;
+
+  // The log append callback of an asynchronous update.
+  void AsyncUpdateAppendFinished(
+      const std::shared_ptr<AsyncUpdateState>& state,
+      const Status& status);
 
   // Deduplicates an RPC request making sure that we get only messages that we
   // haven't appended to our log yet.
@@ -990,13 +1242,53 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   // Begin a replica transaction. If the type of message in 'msg' is not a type
   // that uses transactions, delegates to StartConsensusOnlyRoundUnlocked().
-  Status StartFollowerTransactionUnlocked(const ReplicateRefPtr& msg);
+  // The payload checksum is verified if 'verify_payload' is set.
+  Status StartFollowerTransactionUnlocked(
+      const ReplicateRefPtr& msg,
+      bool verify_payload = true);
 
   // Just like StartFollowerTransactionUnlocked() above but with msg wrapper as
-  // input
+  // input. With opaque payloads, starts it with the msg as received.
   Status StartFollowerTransactionUnlocked(
       const ReplicateMsgWrapper& msg_wrapper);
 
+  // With --raft_follower_async_apply, adds 'round' to the pending ops and
+  // queues it to be handed to the round handler, or returns
+  // ServiceUnavailable if the queue is full.
+  Status StartFollowerTransactionAsyncUnlocked(
+      scoped_refptr<ConsensusRound> round);
+
+  // Hands the queued ops to the round handler, in order, until the queue is
+  // empty. Runs on 'follower_apply_token_'.
+  void DrainFollowerApplyQueue();
+
+  // Confirms leadership for the read index calls batched so far, then for
+  // those batched meanwhile, until there are none.
+  void StartReadIndexRound();
+
+  // Asks the leader for a read index for the forwarded calls batched so far.
+  void StartForwardedReadIndexRound();
+
+  struct ForwardedReadIndexCall;
+  void CompleteForwardedReadIndexRound(
+      const std::shared_ptr<ForwardedReadIndexCall>& call);
+
+  // Calls 'done' once the committed index reaches 'read_index'.
+  void WaitForCommittedIndex(int64_t read_index, ReadIndexCallback done);
+
+  // Calls the WaitForCommittedIndex() callbacks whose index is now
+  // committed, on 'raft_pool_token_'. 'lock_' must be held.
+  void NotifyReadIndexWaitersUnlocked();
+
+  // Returns true if this replica keeps write payloads as received (see
+  // --follower_opaque_payloads). 'lock_' must be held.
+  bool OpaquePayloadsUnlocked() const;
+
+  // Returns true if this replica only keeps the log, and doesn't hand write
+  // ops to the round handler (see --raft_lightweight_witness). 'lock_' must
+  // be held.
+  bool IsLightweightWitnessUnlocked() const;
+
   // Returns true if this node is the only voter in the Raft configuration.
   bool IsSingleVoterConfig() const;
 
@@ -1015,6 +1307,20 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Fills the response with the current status, if an update was successful.
   void FillConsensusResponseOKUnlocked(ConsensusResponsePB* response);
 
+  // Lets Heartbeat() apply heartbeats which match 'request', an update from
+  // the leader without new ops that was answered with 'response'.
+  void ArmHeartbeatFastPathUnlocked(
+      const ConsensusRequestPB& request,
+      const ConsensusResponsePB& response);
+
+  // Stops Heartbeat() from applying heartbeats, before anything it depends
+  // on changes.
+  void DisarmHeartbeatFastPathUnlocked();
+
+  // The time until which RequestVote() refuses votes because the leader is
+  // alive.
+  MonoTime WithholdVotesUntilUnlocked() const;
+
   // Fills the response with an error code and error message.
   void FillConsensusResponseError(
       ConsensusResponsePB* response,
@@ -1146,6 +1452,24 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   MonoDelta TimeoutBackoffHelper(double backoff_factor);
 
+  // The delay before the committed index is sent to the peers on its own, or
+  // 0 to send it right away. See --raft_commit_notification_delay_ms.
+  int32_t CommitNotificationDelayMs() const;
+
+  // (Re)creates 'commit_notification_timer_' with 'delay_ms' as its period,
+  // so that its callback runs only once the delay is up.
+  void CreateCommitNotificationTimer(int32_t delay_ms);
+
+  // The election timeout a follower snoozes its failure detector for when it
+  // hears from the leader, whose last appended op has 'leader_last_index',
+  // while its own last received op has 'last_index'. Like
+  // MinimumElectionTimeoutWithBan(), except that with
+  // --raft_election_freshness_weight, the followers likeliest to win an
+  // election, i.e. the most caught up, time out first.
+  MonoDelta FollowerElectionTimeoutUnlocked(
+      int64_t leader_last_index,
+      int64_t last_index);
+
   // Handle when the term has advanced beyond the current term.
   //
   // 'flush' may be used to control whether the term change is flushed to disk.
@@ -1221,6 +1545,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   Status AddPendingOperationUnlocked(
       const scoped_refptr<ConsensusRound>& round);
 
+  // With --raft_admission_max_uncommitted_bytes or
+  // --raft_admission_max_uncommitted_ops, returns ServiceUnavailable, with a
+  // hint of when to retry, if an op with a payload of 'bytes' would take the
+  // ops replicated in this term which aren't committed yet over the limit.
+  Status CheckAdmissionUnlocked(int64_t bytes);
+
   // Checks that the replica is in the appropriate state and role to replicate
   // the provided operation and that the replicate message does not yet have an
   // OpId assigned.
@@ -1301,6 +1631,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // information, but does not require the lock.
   std::string LogPrefixThreadSafe() const;
 
+  // The prefix for KLOG_BINARY_WITH_PREFIX(): LogPrefixThreadSafe(), built
+  // once.
+  const std::shared_ptr<const std::string>& BinaryLogPrefix() const {
+    return binary_log_prefix_;
+  }
+
   std::string ToString() const;
   std::string ToStringUnlocked() const;
 
@@ -1310,6 +1646,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   void SetTermAdvancementCallback(TermAdvancementCallback tacb);
   void SetNoOpReceivedCallback(NoOpReceivedCallback norcb);
   void SetLeaderDetectedCallback(LeaderDetectedCallback ldcb);
+  void SetSnapshotCatchupCallback(SnapshotCatchupCallback sccb);
+  // Must be called before Start().
+  void SetCommittedRoundsCallback(CommittedRoundsCallback crcb);
   void SetVoteLogger(std::shared_ptr<VoteLoggerInterface> vote_logger);
 
   Status ValidateTransferLeadership(
@@ -1331,6 +1670,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Information about the local peer, including the local UUID.
   RaftPeerPB local_peer_pb_;
 
+  const std::shared_ptr<const std::string> binary_log_prefix_;
+
   // Consensus metadata service.
   const scoped_refptr<ConsensusMetadataManager> cmeta_manager_;
 
@@ -1346,9 +1687,29 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // 'update_lock_' lock must be taken first.
   mutable simple_mutexlock update_lock_;
 
+  // Set with --lock_profiling. Declared before 'lock_' to outlive it.
+  std::unique_ptr<LockProfile> lock_profile_;
+
+  // Set with --raft_op_latency_sample_interval.
+  std::unique_ptr<OpLatencyTracker> op_latency_tracker_;
+
   // Coarse-grained lock that protects all mutable data members.
   mutable simple_mutexlock lock_;
 
+  // Checks that the fragments of each payload this leader replicates go out
+  // in order. Protected by lock_.
+  PayloadFragmentTracker payload_fragments_;
+
+  // For admission control, the index and payload size of each op replicated
+  // in this term which wasn't committed when last checked, oldest first, and
+  // the sum of the sizes. Protected by lock_.
+  std::deque<std::pair<int64_t, int64_t>> uncommitted_ops_;
+  int64_t uncommitted_bytes_ = 0;
+  // The smoothed rate at which those ops commit, in bytes per second, or -1
+  // if unknown, and when ops were last found committed. Protected by lock_.
+  int64_t commit_bytes_per_sec_ = -1;
+  MonoTime last_uncommitted_trim_;
+
   State state_;
 
   // Consensus metadata persistence object.
@@ -1368,6 +1729,37 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // callbacks, etc.
   std::unique_ptr<ThreadPoolToken> raft_pool_token_;
 
+  // Takes over the peer work of 'raft_pool_token_' when
+  // ConsensusOptions::peer_send_pool is set.
+  std::unique_ptr<ThreadPoolToken> peer_send_pool_token_;
+
+  // The follower apply pipeline, with --raft_follower_async_apply: the ops
+  // received from the leader which are yet to be handed to the round handler,
+  // in order, and the serial token which hands them over.
+  struct FollowerApplyEntry {
+    scoped_refptr<ConsensusRound> round;
+    MonoTime enqueue_time;
+  };
+  std::unique_ptr<ThreadPoolToken> follower_apply_token_;
+  simple_spinlock follower_apply_lock_;
+  std::deque<FollowerApplyEntry> follower_apply_queue_;
+  std::atomic<bool> follower_apply_stopped_{false};
+  scoped_refptr<AtomicGauge<int64_t>> follower_apply_queue_depth_;
+  scoped_refptr<Histogram> follower_apply_queue_time_;
+
+  // ReadIndexAsync() calls waiting for the next leadership confirmation
+  // round, with their read index, or for the next RPC to the leader, and
+  // whether a round or RPC is in flight. Protected by 'read_index_lock_'.
+  simple_spinlock read_index_lock_;
+  std::vector<std::pair<int64_t, ReadIndexCallback>> read_index_batch_;
+  bool read_index_round_in_flight_ = false;
+  std::vector<ReadIndexCallback> forwarded_read_index_batch_;
+  bool forwarded_read_index_in_flight_ = false;
+
+  // Followers' read index calls waiting for their index to be committed,
+  // by index. Protected by 'lock_'.
+  std::multimap<int64_t, ReadIndexCallback> read_index_waiters_;
+
   scoped_refptr<log::Log> log_;
   scoped_refptr<ITimeManager> time_manager_;
   std::unique_ptr<PeerProxyFactory> peer_proxy_factory_;
@@ -1396,6 +1788,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   boost::optional<std::string> designated_successor_uuid_;
   std::shared_ptr<rpc::PeriodicTimer> transfer_period_timer_;
 
+  // One-shot timer that sends peers the committed index, when that's delayed
+  // by --raft_commit_notification_delay_ms, and the delay it was created
+  // with. Replaced under lock_ if the delay changes.
+  std::shared_ptr<rpc::PeriodicTimer> commit_notification_timer_;
+  int32_t commit_notification_timer_delay_ms_ = 0;
+
   // Lock held while starting a failure-triggered election.
   //
   // After reporting a failure and asynchronously starting an election, the
@@ -1454,6 +1852,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   TermAdvancementCallback tacb_;
   NoOpReceivedCallback norcb_;
   LeaderDetectedCallback ldcb_;
+  SnapshotCatchupCallback sccb_;
+  CommittedRoundsCallback crcb_;
 
   // this is not expected to change after a create of Raft.
   bool disable_noop_;
@@ -1473,8 +1873,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   FunctionGaugeDetacher metric_detacher_;
 
   std::atomic<int64_t> last_leader_communication_time_micros_;
+  // Until when the leader's last update said it may send no heartbeats, on
+  // the clock of GetMonoTimeMicros().
+  std::atomic<int64_t> leader_quiescent_until_micros_{0};
 
   scoped_refptr<Counter> follower_memory_pressure_rejections_;
+  scoped_refptr<Counter> leader_admission_rejections_;
   scoped_refptr<AtomicGauge<int64_t>> term_metric_;
   scoped_refptr<AtomicGauge<int64_t>> num_failed_elections_metric_;
 
@@ -1494,11 +1898,59 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   faststring compression_buffer_;
 
+  std::shared_ptr<rpc::PeriodicTimer> compression_policy_timer_;
+  // Serializes runs of AdaptCompression().
+  std::mutex compression_policy_lock_;
+  AdaptiveCompressionPolicy compression_policy_;
+
+  // Both set only if --raft_compression_dict_training_interval_ms is positive.
+  std::unique_ptr<CompressionDictTrainer> dict_trainer_;
+  std::shared_ptr<rpc::PeriodicTimer> dict_training_timer_;
+
+  // Set only if --raft_peer_health_evaluation_interval_ms is positive.
+  std::shared_ptr<rpc::PeriodicTimer> peer_health_timer_;
+
+  // What Heartbeat() needs to apply a heartbeat without 'lock_': the values
+  // the last armed update carried and was answered with. Armed and disarmed
+  // under both 'lock_' and 'heartbeat_lock_'; Heartbeat() only takes the
+  // latter.
+  struct HeartbeatFastPath {
+    bool armed = false;
+    int64_t term = -1;
+    OpId preceding_id;
+    int64_t committed_index = -1;
+    int64_t all_replicated_index = -1;
+    int64_t region_durable_index = -1;
+    int64_t last_idx_appended_to_leader = -1;
+    // The term of the leader lease this replica granted, or -1.
+    int64_t lease_term = -1;
+    // How long to snooze the failure detector for, before adding the
+    // leader's quiescent interval.
+    MonoDelta snooze;
+    OpId last_received;
+    OpId last_received_current_leader;
+    int64_t last_committed_idx = -1;
+    // Extended by every heartbeat Heartbeat() applies, in place of
+    // 'withhold_votes_until_'.
+    MonoTime withhold_votes_until = MonoTime::Min();
+  };
+  mutable simple_spinlock heartbeat_lock_;
+  HeartbeatFastPath heartbeat_fast_path_;
+  // The number of Heartbeat() calls which passed the checks under
+  // 'heartbeat_lock_' and are still granting a lease or advancing the safe
+  // time off it. Only incremented while armed.
+  std::atomic<int> heartbeats_applying_{0};
+
   CheckQuorumFailureCallback check_quorum_failure_callback_;
   int32_t check_quorum_interval_heartbeats_;
   std::mutex check_quorum_running_;
   std::shared_ptr<kudu::rpc::PeriodicTimer> check_quorum_timer_;
 
+  // The highest (term, request_generation) seen from each leader, by UUID.
+  // Protected by 'request_generation_lock_'.
+  simple_spinlock request_generation_lock_;
+  std::map<std::string, std::pair<int64_t, int64_t>> latest_request_generation_;
+
   DISALLOW_COPY_AND_ASSIGN(RaftConsensus);
 };
 
@@ -1587,6 +2039,13 @@ class ConsensusRound : public RefCountedThreadSafe<ConsensusRound> {
   // If a continuation was set, notifies it that the round has been replicated.
   void NotifyReplicationFinished(const Status& status);
 
+  // Marks that the round handler is told about this follower round only after
+  // it was added to the pending ops (see --raft_follower_async_apply). Until
+  // DeferredStartFinished() is called, NotifyReplicationFinished() only keeps
+  // the status, so that it isn't lost before the handler sets its callback.
+  void MarkStartDeferred();
+  void DeferredStartFinished();
+
   // Binds this round such that it may not be eventually executed in any term
   // other than 'term'.
   // See CheckBoundTerm().
@@ -1630,6 +2089,11 @@ class ConsensusRound : public RefCountedThreadSafe<ConsensusRound> {
   //
   // Set to -1 if no term has been bound.
   int64_t bound_term_;
+
+  // See MarkStartDeferred().
+  simple_spinlock start_lock_;
+  bool start_deferred_ = false;
+  boost::optional<Status> deferred_replication_status_;
 };
 
 } // namespace consensus
@@ -22,17 +22,22 @@
 // ********************************************************************
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <limits>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
-#include <gflags/gflags_declare.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -69,15 +74,22 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/strcat.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/rpc/periodic.h"
 //#include "kudu/tablet/metadata.pb.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 // METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/scoped_cleanup.h"
+#include "kudu/util/semaphore.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
 #include "kudu/util/test_macros.h"
@@ -86,6 +98,76 @@
 
 DECLARE_int32(raft_heartbeat_interval_ms);
 DECLARE_bool(enable_leader_failure_detection);
+DECLARE_bool(raft_follower_async_apply);
+DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(log_cache_read_arenas);
+DECLARE_bool(enable_raft_leader_lease);
+DECLARE_double(raft_election_freshness_weight);
+DECLARE_int32(raft_commit_notification_delay_ms);
+DECLARE_int64(raft_admission_max_uncommitted_bytes);
+DECLARE_int64(raft_admission_max_uncommitted_ops);
+
+DEFINE_int32(
+    raft_bench_num_peers,
+    3,
+    "Number of voters in the ring of the simulated network benchmarks.");
+DEFINE_int32(
+    raft_bench_num_regions,
+    3,
+    "Number of regions the voters of the simulated network benchmarks are "
+    "spread over, round robin.");
+DEFINE_int32(
+    raft_bench_local_latency_ms,
+    1,
+    "One-way latency between voters in the same region.");
+DEFINE_int32(
+    raft_bench_remote_latency_ms,
+    10,
+    "One-way latency between voters in different regions.");
+DEFINE_int64(
+    raft_bench_link_bytes_per_sec,
+    0,
+    "Bandwidth of each link between voters. 0 is unlimited.");
+DEFINE_double(
+    raft_bench_loss,
+    0,
+    "Probability that an update, or its response, is lost.");
+DEFINE_int32(
+    raft_bench_num_ops,
+    500,
+    "Number of ops replicated by each simulated network benchmark.");
+DEFINE_int32(
+    raft_bench_max_inflight,
+    32,
+    "Maximum number of ops replicating at once.");
+DEFINE_int32(raft_bench_payload_bytes, 1024, "Size of the payload of each op.");
+DEFINE_string(
+    raft_chaos_faults,
+    "leader_transfer,partition,slow_disk,proxy_failure",
+    "Comma-separated faults injected, in order, by the chaos benchmark: "
+    "leader_transfer elects another voter, partition cuts the leader off "
+    "from the other voters, slow_disk slows down the leader's log appends and "
+    "proxy_failure fails the responses to the leader's requests.");
+DEFINE_int32(
+    raft_chaos_fault_ms,
+    2000,
+    "How long each partition, slow disk or proxy failure of the chaos "
+    "benchmark lasts.");
+DEFINE_int32(
+    raft_chaos_settle_ms,
+    1000,
+    "How long the chaos benchmark runs its steady load before each fault, "
+    "and after the last one.");
+DEFINE_int32(
+    raft_chaos_slow_disk_ms,
+    50,
+    "Latency added to each log append of the leader during a slow_disk "
+    "fault.");
+DEFINE_int32(
+    raft_chaos_recovery_timeout_ms,
+    30000,
+    "How long the chaos benchmark waits for commits to resume after a fault "
+    "before it fails.");
 
 // METRIC_DECLARE_entity(tablet);
 
@@ -120,6 +202,21 @@ Status WaitUntilLeaderForTests(RaftConsensus* raft) {
   return Status::TimedOut("Timed out waiting to become leader");
 }
 
+// Slows down the appends of a log while 'delay_ms' is set, like a disk which
+// has to synchronously flush a full buffer.
+class SlowDiskHooks : public Log::LogFaultHooks {
+ public:
+  Status PostAppend() override {
+    const int delay_ms = this->delay_ms;
+    if (delay_ms > 0) {
+      SleepFor(MonoDelta::FromMilliseconds(delay_ms));
+    }
+    return Status::OK();
+  }
+
+  std::atomic<int> delay_ms{0};
+};
+
 // Test suite for tests that focus on multiple peer interaction, but
 // without integrating with other components, such as transactions.
 class RaftConsensusQuorumTest : public KuduTest {
@@ -238,8 +335,8 @@ class RaftConsensusQuorumTest : public KuduTest {
       shared_ptr<RaftConsensus> peer;
       RETURN_NOT_OK(peers_->GetPeerByIdx(i, &peer));
 
-      unique_ptr<PeerProxyFactory> proxy_factory(
-          new LocalTestPeerProxyFactory(peers_.get()));
+      unique_ptr<PeerProxyFactory> proxy_factory(new LocalTestPeerProxyFactory(
+          peers_.get(), network_.get(), config_.peers(i).permanent_uuid()));
       scoped_refptr<TimeManager> time_manager(
           new TimeManager(clock_, Timestamp::kMin));
       auto txn_factory = new TestTransactionFactory(logs_[i].get());
@@ -277,6 +374,393 @@ class RaftConsensusQuorumTest : public KuduTest {
     return Status::OK();
   }
 
+  // The link from voter 'i' to voter 'j' of a ring started by
+  // StartRingOverSimulatedNetwork().
+  SimulatedLink RingLink(int i, int j) const {
+    const int num_regions = FLAGS_raft_bench_num_regions;
+    SimulatedLink link;
+    link.latency = MonoDelta::FromMilliseconds(
+        i % num_regions == j % num_regions
+            ? FLAGS_raft_bench_local_latency_ms
+            : FLAGS_raft_bench_remote_latency_ms);
+    link.bytes_per_sec = FLAGS_raft_bench_link_bytes_per_sec;
+    link.loss = FLAGS_raft_bench_loss;
+    return link;
+  }
+
+  // Starts a ring of --raft_bench_num_peers voters whose updates cross a
+  // simulated network, and elects the last one leader. With 'flexi_raft', the
+  // ring commits in the leader's region only.
+  void StartRingOverSimulatedNetwork(bool flexi_raft) {
+    const int num_peers = FLAGS_raft_bench_num_peers;
+    const int num_regions = FLAGS_raft_bench_num_regions;
+    ASSERT_OK(BuildFsManagersAndLogs(num_peers));
+    for (int i = 0; i < num_peers; i++) {
+      // Idle unless a test slows the disk down.
+      disk_hooks_.push_back(std::make_shared<SlowDiskHooks>());
+      logs_[i]->SetLogFaultHooksForTests(disk_hooks_[i]);
+    }
+    config_ = BuildRaftConfigPB(num_peers);
+    config_.set_opid_index(kInvalidOpIdIndex);
+    for (int i = 0; i < num_peers; i++) {
+      config_.mutable_peers(i)->mutable_attrs()->set_region(
+          Substitute("region-$0", i % num_regions));
+    }
+    if (flexi_raft) {
+      FLAGS_enable_flexi_raft = true;
+      CommitRulePB* commit_rule = config_.mutable_commit_rule();
+      commit_rule->set_mode(QuorumMode::SINGLE_REGION_DYNAMIC);
+      commit_rule->set_quorum_type(QuorumType::REGION);
+    }
+    peers_.reset(new TestPeerMapManager(config_));
+
+    network_.reset(new SimulatedNetwork());
+    for (int i = 0; i < num_peers; i++) {
+      for (int j = 0; j < num_peers; j++) {
+        network_->SetLink(
+            config_.peers(i).permanent_uuid(),
+            config_.peers(j).permanent_uuid(),
+            RingLink(i, j));
+      }
+    }
+    ASSERT_OK(BuildPeers());
+    ASSERT_OK(StartPeers());
+    shared_ptr<RaftConsensus> leader;
+    ASSERT_OK(peers_->GetPeerByIdx(num_peers - 1, &leader));
+    ASSERT_OK(leader->EmulateElection());
+    ASSERT_OK(WaitUntilLeaderForTests(leader.get()));
+  }
+
+  // Replicates --raft_bench_num_ops ops through a ring started by
+  // StartRingOverSimulatedNetwork(), and logs the throughput and the commit
+  // latencies.
+  void RunNetworkBenchmark(bool flexi_raft) {
+    const int num_peers = FLAGS_raft_bench_num_peers;
+    const int num_regions = FLAGS_raft_bench_num_regions;
+    NO_FATALS(StartRingOverSimulatedNetwork(flexi_raft));
+    shared_ptr<RaftConsensus> leader;
+    ASSERT_OK(peers_->GetPeerByIdx(num_peers - 1, &leader));
+
+    const string payload(FLAGS_raft_bench_payload_bytes, 'x');
+    HdrHistogram latencies_us(60000000LU, 2);
+    Semaphore inflight(FLAGS_raft_bench_max_inflight);
+    CountDownLatch done(FLAGS_raft_bench_num_ops);
+    const MonoTime start = MonoTime::Now();
+    for (int i = 0; i < FLAGS_raft_bench_num_ops; i++) {
+      unique_ptr<ReplicateMsg> msg(new ReplicateMsg());
+      msg->set_op_type(NO_OP);
+      msg->mutable_noop_request()->set_payload_for_tests(payload);
+      msg->set_timestamp(clock_->Now().ToUint64());
+      inflight.Acquire();
+      const MonoTime op_start = MonoTime::Now();
+      scoped_refptr<ConsensusRound> round = leader->NewRound(
+          std::move(msg), [&, op_start](const Status& s) {
+            CHECK_OK(s);
+            latencies_us.Increment(
+                (MonoTime::Now() - op_start).ToMicroseconds());
+            inflight.Release();
+            done.CountDown();
+          });
+      ASSERT_OK(leader->Replicate(round.get()));
+    }
+    done.Wait();
+    const double secs = (MonoTime::Now() - start).ToSeconds();
+
+    LOG(INFO) << Substitute(
+        "$0 over $1 voters in $2 regions: $3 ops/s, commit latency p50 $4 us, "
+        "p99 $5 us, max $6 us",
+        flexi_raft ? "FlexiRaft" : "Raft",
+        num_peers,
+        num_regions,
+        static_cast<int64_t>(FLAGS_raft_bench_num_ops / secs),
+        latencies_us.ValueAtPercentile(50),
+        latencies_us.ValueAtPercentile(99),
+        latencies_us.MaxValue());
+    const string key = Substitute(
+        "raft_consensus_quorum-test[$0 voters=$1 regions=$2]",
+        flexi_raft ? "flexi-raft" : "raft",
+        num_peers,
+        num_regions);
+    RecordPerfResult(key + ".ops_per_sec", FLAGS_raft_bench_num_ops / secs);
+    RecordPerfResult(
+        key + ".commit_p50_us", latencies_us.ValueAtPercentile(50));
+    RecordPerfResult(
+        key + ".commit_p99_us", latencies_us.ValueAtPercentile(99));
+  }
+
+  // The index of the leader with the highest term, or -1 if there is none.
+  int FindLeaderIdx() {
+    int leader_idx = -1;
+    int64_t leader_term = -1;
+    for (int i = 0; i < config_.peers_size(); i++) {
+      shared_ptr<RaftConsensus> peer;
+      CHECK_OK(peers_->GetPeerByIdx(i, &peer));
+      const int64_t term = peer->CurrentTerm();
+      if (peer->role() == RaftPeerPB::LEADER && term > leader_term) {
+        leader_idx = i;
+        leader_term = term;
+      }
+    }
+    return leader_idx;
+  }
+
+  // Loses every message to and from voter 'idx' of a ring started by
+  // StartRingOverSimulatedNetwork(), or restores its links.
+  void SetIsolated(int idx, bool isolated) {
+    for (int j = 0; j < config_.peers_size(); j++) {
+      if (j == idx) {
+        continue;
+      }
+      for (const auto& ends :
+           {std::make_pair(idx, j), std::make_pair(j, idx)}) {
+        SimulatedLink link = RingLink(ends.first, ends.second);
+        if (isolated) {
+          link.loss = 1;
+        }
+        network_->SetLink(
+            config_.peers(ends.first).permanent_uuid(),
+            config_.peers(ends.second).permanent_uuid(),
+            link);
+      }
+    }
+  }
+
+  // Keeps a ring started by StartRingOverSimulatedNetwork() replicating ops
+  // to whichever voter leads, while it injects each of --raft_chaos_faults,
+  // with --raft_chaos_settle_ms of steady load before each. Leaders fail
+  // over on their own. Logs, for each fault:
+  // - how long it took commits to resume once the fault was healed: the
+  //   time until the first op submitted after it committed,
+  // - the longest time without a commit from the fault to then,
+  // - the commit latencies of the ops submitted from the fault to then,
+  //   and how many failed.
+  // Fails if commits don't resume within --raft_chaos_recovery_timeout_ms.
+  void RunChaosBenchmark() {
+    static const vector<string> kFaults = {
+        "leader_transfer", "partition", "slow_disk", "proxy_failure"};
+    const vector<string> faults =
+        strings::Split(FLAGS_raft_chaos_faults, ",", strings::SkipEmpty());
+    for (const string& fault : faults) {
+      ASSERT_TRUE(
+          std::find(kFaults.begin(), kFaults.end(), fault) != kFaults.end())
+          << "Unknown fault: " << fault;
+    }
+    FLAGS_enable_leader_failure_detection = true;
+    if (gflags::GetCommandLineFlagInfoOrDie("raft_heartbeat_interval_ms")
+            .is_default) {
+      // Fail over in a fraction of a second rather than seconds.
+      FLAGS_raft_heartbeat_interval_ms = 100;
+    }
+    NO_FATALS(StartRingOverSimulatedNetwork(false));
+    const int num_peers = config_.peers_size();
+
+    // Shared with the ops' callbacks, which may outlive this function.
+    struct Load {
+      explicit Load(int max_inflight)
+          : latest_committed_start(MonoTime::Min()), inflight(max_inflight) {}
+
+      struct Op {
+        MonoTime start;
+        MonoTime end;
+        bool ok;
+      };
+
+      simple_spinlock lock;
+      vector<Op> ops; // Protected by 'lock'.
+      // The latest start of a committed op. Protected by 'lock'.
+      MonoTime latest_committed_start;
+      Semaphore inflight;
+    };
+    auto load = std::make_shared<Load>(FLAGS_raft_bench_max_inflight);
+    auto finish_op = [load](MonoTime start, bool ok) {
+      std::lock_guard<simple_spinlock> l(load->lock);
+      load->ops.push_back({start, MonoTime::Now(), ok});
+      if (ok && start > load->latest_committed_start) {
+        load->latest_committed_start = start;
+      }
+    };
+
+    const string payload(FLAGS_raft_bench_payload_bytes, 'x');
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+      while (!stop) {
+        const int leader_idx = FindLeaderIdx();
+        if (leader_idx < 0) {
+          SleepFor(MonoDelta::FromMilliseconds(1));
+          continue;
+        }
+        shared_ptr<RaftConsensus> leader;
+        CHECK_OK(peers_->GetPeerByIdx(leader_idx, &leader));
+        unique_ptr<ReplicateMsg> msg(new ReplicateMsg());
+        msg->set_op_type(NO_OP);
+        msg->mutable_noop_request()->set_payload_for_tests(payload);
+        msg->set_timestamp(clock_->Now().ToUint64());
+        load->inflight.Acquire();
+        const MonoTime op_start = MonoTime::Now();
+        // Whichever of the callback and a failed Replicate() comes first
+        // finishes the op.
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        scoped_refptr<ConsensusRound> round = leader->NewRound(
+            std::move(msg), [load, finish_op, finished, op_start](
+                                const Status& s) {
+              if (!finished->exchange(true)) {
+                finish_op(op_start, s.ok());
+                load->inflight.Release();
+              }
+            });
+        if (!leader->Replicate(round.get()).ok()) {
+          // No longer the leader.
+          if (!finished->exchange(true)) {
+            finish_op(op_start, false);
+            load->inflight.Release();
+          }
+          SleepFor(MonoDelta::FromMilliseconds(1));
+        }
+      }
+    });
+    auto stop_writer = [&]() {
+      if (writer.joinable()) {
+        stop = true;
+        writer.join();
+      }
+    };
+    SCOPED_CLEANUP({ stop_writer(); });
+
+    struct Fault {
+      string name;
+      MonoTime start;
+      MonoTime healed;
+    };
+    vector<Fault> injected;
+    const MonoTime load_start = MonoTime::Now();
+    for (const string& name : faults) {
+      SleepFor(MonoDelta::FromMilliseconds(FLAGS_raft_chaos_settle_ms));
+      const int leader_idx = FindLeaderIdx();
+      ASSERT_GE(leader_idx, 0) << "No leader before " << name;
+      Fault fault;
+      fault.name = name;
+      fault.start = MonoTime::Now();
+      const MonoTime fault_end =
+          fault.start + MonoDelta::FromMilliseconds(FLAGS_raft_chaos_fault_ms);
+      LOG(INFO) << "Injecting " << name << " at leader " << leader_idx;
+      if (name == "leader_transfer") {
+        shared_ptr<RaftConsensus> target;
+        ASSERT_OK(peers_->GetPeerByIdx((leader_idx + 1) % num_peers, &target));
+        ASSERT_OK(target->StartElection(
+            ElectionMode::ELECT_EVEN_IF_LEADER_IS_ALIVE,
+            {ElectionReason::EXTERNAL_REQUEST,
+             std::chrono::system_clock::now()}));
+      } else if (name == "partition") {
+        SetIsolated(leader_idx, true);
+        SleepFor(fault_end - MonoTime::Now());
+        SetIsolated(leader_idx, false);
+      } else if (name == "slow_disk") {
+        disk_hooks_[leader_idx]->delay_ms = FLAGS_raft_chaos_slow_disk_ms;
+        SleepFor(fault_end - MonoTime::Now());
+        disk_hooks_[leader_idx]->delay_ms = 0;
+      } else if (name == "proxy_failure") {
+        // A fault fails a single response, so keep injecting them.
+        while (MonoTime::Now() < fault_end) {
+          for (int i = 0; i < num_peers; i++) {
+            if (i != leader_idx) {
+              GetLeaderProxyToPeer(i, leader_idx)->InjectCommFaultLeaderSide();
+            }
+          }
+          SleepFor(MonoDelta::FromMilliseconds(1));
+        }
+      }
+      fault.healed = MonoTime::Now();
+      injected.push_back(fault);
+
+      const MonoTime deadline = fault.healed +
+          MonoDelta::FromMilliseconds(FLAGS_raft_chaos_recovery_timeout_ms);
+      while (true) {
+        {
+          std::lock_guard<simple_spinlock> l(load->lock);
+          if (load->latest_committed_start >= fault.healed) {
+            break;
+          }
+        }
+        ASSERT_LT(MonoTime::Now(), deadline)
+            << "Commits did not resume after " << name;
+        SleepFor(MonoDelta::FromMilliseconds(1));
+      }
+    }
+    SleepFor(MonoDelta::FromMilliseconds(FLAGS_raft_chaos_settle_ms));
+    stop_writer();
+
+    vector<Load::Op> ops;
+    {
+      std::lock_guard<simple_spinlock> l(load->lock);
+      ops = load->ops;
+    }
+    std::sort(ops.begin(), ops.end(), [](const Load::Op& a, const Load::Op& b) {
+      return a.end < b.end;
+    });
+
+    HdrHistogram steady_us(60000000LU, 2);
+    const MonoTime first_fault =
+        injected.empty() ? MonoTime::Max() : injected[0].start;
+    for (const auto& op : ops) {
+      if (op.ok && op.start >= load_start && op.start < first_fault) {
+        steady_us.Increment((op.end - op.start).ToMicroseconds());
+      }
+    }
+    LOG(INFO) << Substitute(
+        "Chaos over $0 voters: steady commit latency p50 $1 us, p99 $2 us",
+        num_peers,
+        steady_us.ValueAtPercentile(50),
+        steady_us.ValueAtPercentile(99));
+
+    for (const Fault& fault : injected) {
+      // Commits resumed when the first op submitted after the fault healed
+      // committed.
+      MonoTime recovered = MonoTime::Max();
+      for (const auto& op : ops) {
+        if (op.ok && op.start >= fault.healed && op.end < recovered) {
+          recovered = op.end;
+        }
+      }
+      ASSERT_TRUE(recovered < MonoTime::Max());
+      HdrHistogram latency_us(60000000LU, 2);
+      int64_t num_failed = 0;
+      MonoTime last_commit = fault.start;
+      MonoDelta unavailable = MonoDelta::FromMicroseconds(0);
+      for (const auto& op : ops) {
+        if (op.start >= fault.start && op.start <= recovered) {
+          if (op.ok) {
+            latency_us.Increment((op.end - op.start).ToMicroseconds());
+          } else {
+            num_failed++;
+          }
+        }
+        if (op.ok && op.end >= fault.start && op.end <= recovered) {
+          unavailable = std::max(unavailable, op.end - last_commit);
+          last_commit = op.end;
+        }
+      }
+      const int64_t recovery_us = (recovered - fault.healed).ToMicroseconds();
+      LOG(INFO) << Substitute(
+          "$0: unavailable for $1 us, commits resumed $2 us after it healed, "
+          "commit latency p50 $3 us, p99 $4 us, max $5 us, $6 ops failed",
+          fault.name,
+          unavailable.ToMicroseconds(),
+          recovery_us,
+          latency_us.ValueAtPercentile(50),
+          latency_us.ValueAtPercentile(99),
+          latency_us.MaxValue(),
+          num_failed);
+      const string key = Substitute(
+          "raft_consensus_quorum-test[chaos $0 voters=$1]",
+          fault.name,
+          num_peers);
+      RecordPerfResult(key + ".unavailable_us", unavailable.ToMicroseconds());
+      RecordPerfResult(key + ".recovery_us", recovery_us);
+      RecordPerfResult(
+          key + ".commit_p99_us", latency_us.ValueAtPercentile(99));
+    }
+  }
+
   LocalTestPeerProxy* GetLeaderProxyToPeer(int peer_idx, int leader_idx) {
     shared_ptr<RaftConsensus> follower;
     CHECK_OK(peers_->GetPeerByIdx(peer_idx, &follower));
@@ -649,6 +1133,10 @@ class RaftConsensusQuorumTest : public KuduTest {
   unique_ptr<ThreadPool> raft_pool_;
   vector<scoped_refptr<ConsensusMetadataManager>> cmeta_managers_;
   vector<scoped_refptr<PersistentVarsManager>> persistent_vars_managers_;
+  // If set, the network the peers' updates cross. Outlives the peers.
+  unique_ptr<SimulatedNetwork> network_;
+  // The fault hooks of 'logs_', if set by StartRingOverSimulatedNetwork().
+  vector<shared_ptr<SlowDiskHooks>> disk_hooks_;
   unique_ptr<TestPeerMapManager> peers_;
   vector<TestTransactionFactory*> txn_factories_;
   scoped_refptr<clock::Clock> clock_;
@@ -836,6 +1324,52 @@ TEST_F(RaftConsensusQuorumTest, TestConsensusStopsIfAMajorityFallsBehind) {
 
 // If some communication error happens the leader will resend the request to the
 // peers. This tests that the peers handle repeated requests.
+// The leader rejects ops while too many are waiting to be committed, and
+// admits them again once those commit.
+TEST_F(RaftConsensusQuorumTest, TestAdmissionControl) {
+  FLAGS_raft_admission_max_uncommitted_bytes = 1024 * 1024;
+  FLAGS_raft_admission_max_uncommitted_ops = 3;
+  const int kLeaderIdx = 2;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  const int64_t rejections_before =
+      leader->leader_admission_rejections_->value();
+
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  {
+    // Keep the followers from acknowledging anything.
+    shared_ptr<RaftConsensus> follower0;
+    CHECK_OK(peers_->GetPeerByIdx(0, &follower0));
+    RaftConsensus::LockGuard l_0(follower0->lock_);
+    shared_ptr<RaftConsensus> follower1;
+    CHECK_OK(peers_->GetPeerByIdx(1, &follower1));
+    RaftConsensus::LockGuard l_1(follower1->lock_);
+
+    for (int i = 0; i < 3; i++) {
+      scoped_refptr<ConsensusRound> round;
+      ASSERT_OK(AppendDummyMessage(kLeaderIdx, &round));
+      rounds.push_back(round);
+    }
+    scoped_refptr<ConsensusRound> rejected;
+    Status s = AppendDummyMessage(kLeaderIdx, &rejected);
+    ASSERT_TRUE(s.IsServiceUnavailable()) << s.ToString();
+    ASSERT_EQ(
+        rejections_before + 1, leader->leader_admission_rejections_->value());
+  }
+
+  for (const scoped_refptr<ConsensusRound>& round : rounds) {
+    ASSERT_OK(WaitForReplicate(round.get()));
+    CommitDummyMessage(kLeaderIdx, round.get());
+  }
+  scoped_refptr<ConsensusRound> admitted;
+  ASSERT_OK(AppendDummyMessage(kLeaderIdx, &admitted));
+  ASSERT_OK(WaitForReplicate(admitted.get()));
+  CommitDummyMessage(kLeaderIdx, admitted.get());
+  ASSERT_EQ(
+      rejections_before + 1, leader->leader_admission_rejections_->value());
+}
+
 TEST_F(RaftConsensusQuorumTest, TestReplicasHandleCommunicationErrors) {
   // Constants with the indexes of peers with certain roles,
   // since peers don't change roles in this test.
@@ -1116,6 +1650,322 @@ TEST_F(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty) {
       "Log matching property violated");
 }
 
+// An asynchronous update responds once its ops are durable, and one without
+// ops responds right away.
+TEST_F(RaftConsensusQuorumTest, TestAsyncUpdate) {
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  shared_ptr<Synchronizer> last_commit_sync;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &last_commit_sync));
+  ASSERT_OK(last_commit_sync->Wait());
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+
+  ConsensusRequestPB req;
+  req.set_caller_uuid(leader->peer_uuid());
+  req.set_caller_term(last_op_id.term());
+  req.mutable_preceding_id()->CopyFrom(last_op_id);
+  req.set_committed_index(last_op_id.index());
+  req.set_all_replicated_index(0);
+  ReplicateMsg* replicate = req.add_ops();
+  replicate->set_timestamp(clock_->Now().ToUint64());
+  OpId* id = replicate->mutable_id();
+  id->set_term(last_op_id.term());
+  id->set_index(last_op_id.index() + 1);
+  replicate->set_op_type(NO_OP);
+  req.set_last_idx_appended_to_leader(id->index());
+
+  ConsensusResponsePB resp;
+  Synchronizer sync;
+  follower->UpdateAsync(&req, &resp, nullptr, sync.AsStdStatusCallback());
+  ASSERT_OK(sync.Wait());
+  ASSERT_TRUE(OpIdEquals(resp.status().last_received(), *id));
+  ASSERT_FALSE(resp.status().has_error());
+
+  // A heartbeat has nothing to wait for.
+  ConsensusRequestPB heartbeat;
+  heartbeat.set_caller_uuid(leader->peer_uuid());
+  heartbeat.set_caller_term(last_op_id.term());
+  heartbeat.mutable_preceding_id()->CopyFrom(*id);
+  heartbeat.set_committed_index(last_op_id.index());
+  heartbeat.set_all_replicated_index(0);
+  resp.Clear();
+  Synchronizer heartbeat_sync;
+  follower->UpdateAsync(
+      &heartbeat, &resp, nullptr, heartbeat_sync.AsStdStatusCallback());
+  ASSERT_OK(heartbeat_sync.WaitFor(MonoDelta::FromSeconds(0)));
+  ASSERT_TRUE(OpIdEquals(resp.status().last_received(), *id));
+}
+
+// With the follower apply pipeline, followers still hand every op to the
+// round handler, and commit it, in order.
+TEST_F(RaftConsensusQuorumTest, TestFollowerAsyncApply) {
+  FLAGS_raft_follower_async_apply = true;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      100,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 1, 2);
+  VerifyLogs(2, 0, 1);
+}
+
+TEST_F(RaftConsensusQuorumTest, TestReadIndex) {
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+
+  // The leader confirms its leadership with the followers, then returns its
+  // committed index.
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  Synchronizer sync;
+  int64_t read_index = 0;
+  leader->ReadIndexAsync([&](const Status& s, int64_t index) {
+    read_index = index;
+    sync.StatusCB(s);
+  });
+  ASSERT_OK(sync.Wait());
+  ASSERT_GE(read_index, last_op_id.index());
+
+  // Only the leader serves read index RPCs.
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+  Synchronizer follower_sync;
+  follower->LeaderReadIndexAsync(
+      [&](const Status& s, int64_t) { follower_sync.StatusCB(s); });
+  ASSERT_TRUE(follower_sync.Wait().IsIllegalState());
+}
+
+// A follower's queue holds the lease it granted its leader, which must not
+// let it serve local reads.
+TEST_F(RaftConsensusQuorumTest, TestFollowerHasNoSafeLocalReads) {
+  FLAGS_enable_raft_leader_lease = true;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+  follower->queue_->SetLeaderLeaseUntil(
+      MonoTime::Now() + MonoDelta::FromSeconds(60));
+  ASSERT_EQ(MonoTime::Min(), follower->GetSafeLocalReadUntil());
+}
+
+// Even fully weighted by freshness, the election timeouts of equally fresh
+// followers are spread out, and staler followers still time out later.
+TEST_F(RaftConsensusQuorumTest, TestRankedElectionTimeoutsSpread) {
+  FLAGS_raft_election_freshness_weight = 1;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+
+  const int64_t min_timeout_ms =
+      follower->MinimumElectionTimeout().ToMilliseconds();
+  int64_t fresh_min_ms = std::numeric_limits<int64_t>::max();
+  int64_t fresh_max_ms = 0;
+  int64_t stale_min_ms = std::numeric_limits<int64_t>::max();
+  {
+    RaftConsensus::LockGuard l(follower->lock_);
+    for (int i = 0; i < 100; i++) {
+      const int64_t fresh_ms =
+          follower->FollowerElectionTimeoutUnlocked(100, 100).ToMilliseconds();
+      fresh_min_ms = std::min(fresh_min_ms, fresh_ms);
+      fresh_max_ms = std::max(fresh_max_ms, fresh_ms);
+      stale_min_ms = std::min(
+          stale_min_ms,
+          follower->FollowerElectionTimeoutUnlocked(1000000, 0)
+              .ToMilliseconds());
+    }
+  }
+  ASSERT_GE(fresh_min_ms, min_timeout_ms);
+  ASSERT_GT(fresh_max_ms - fresh_min_ms, min_timeout_ms / 20);
+  ASSERT_GT(stale_min_ms, fresh_min_ms);
+}
+
+// A follower doesn't report the leader failed early while the leader said it
+// would be quiescent, since its server may then be silent.
+TEST_F(RaftConsensusQuorumTest, TestQuiescentLeaderNotExpedited) {
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+  FLAGS_enable_leader_failure_detection = true;
+  SCOPED_CLEANUP({
+    follower->DisableFailureDetector();
+    FLAGS_enable_leader_failure_detection = false;
+  });
+  const MonoDelta delay = MonoDelta::FromMilliseconds(
+      follower->MinimumElectionTimeout().ToMilliseconds() / 2);
+
+  follower->leader_quiescent_until_micros_ =
+      GetMonoTimeMicros() + 60 * MonoTime::kMicrosecondsPerSecond;
+  ASSERT_FALSE(follower->ExpediteFailureDetection(leader->peer_uuid(), delay));
+  follower->leader_quiescent_until_micros_ = 0;
+  ASSERT_TRUE(follower->ExpediteFailureDetection(leader->peer_uuid(), delay));
+}
+
+// With a commit notification delay, the committed index reaches the
+// followers in a single notification once the delay is up, rather than after
+// each op, even with no heartbeats to carry it.
+TEST_F(RaftConsensusQuorumTest, TestDelayedCommitNotification) {
+  FLAGS_raft_commit_notification_delay_ms = 200;
+  FLAGS_raft_heartbeat_interval_ms = 60 * 1000;
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+  ASSERT_EQ(200, leader->commit_notification_timer_delay_ms_);
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+  const int update_calls = follower->update_calls_for_tests();
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+  ASSERT_LE(follower->update_calls_for_tests() - update_calls, 2);
+  ASSERT_FALSE(leader->commit_notification_timer_->started());
+}
+
+// A proxy reconstitutes PROXY_OP placeholders from ops it reads back from its
+// log on an arena, and forwards them to the destination.
+TEST_F(RaftConsensusQuorumTest, TestProxyForwardsOpsReadOnArena) {
+  FLAGS_log_cache_read_arenas = true;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  shared_ptr<Synchronizer> commit_sync;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10,
+      2,
+      WAIT_FOR_ALL_REPLICAS,
+      COMMIT_ONE_BY_ONE,
+      &last_op_id,
+      &rounds,
+      &commit_sync));
+  ASSERT_OK(commit_sync->Wait());
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> proxy;
+  CHECK_OK(peers_->GetPeerByIdx(0, &proxy));
+  shared_ptr<RaftConsensus> dest;
+  CHECK_OK(peers_->GetPeerByIdx(1, &dest));
+  // Make the proxy read the ops back from its log.
+  proxy->queue_->log_cache()->EvictThroughOp(last_op_id.index());
+
+  ConsensusRequestPB req;
+  req.set_tablet_id(kTestTablet);
+  req.set_caller_uuid(leader->peer_uuid());
+  req.set_caller_term(last_op_id.term());
+  req.set_dest_uuid(dest->peer_uuid());
+  req.set_proxy_dest_uuid(proxy->peer_uuid());
+  req.set_proxy_hops_remaining(1);
+  req.mutable_preceding_id()->CopyFrom(rounds[4]->id());
+  req.set_committed_index(last_op_id.index());
+  req.set_all_replicated_index(0);
+  req.set_last_idx_appended_to_leader(last_op_id.index());
+  for (int i = 5; i < rounds.size(); i++) {
+    ReplicateMsg* op = req.add_ops();
+    op->mutable_id()->CopyFrom(rounds[i]->id());
+    op->set_timestamp(rounds[i]->replicate_msg()->timestamp());
+    op->set_op_type(PROXY_OP);
+  }
+
+  ConsensusResponsePB resp;
+  Synchronizer sync;
+  proxy->HandleProxyRequest(
+      &req, &resp, nullptr, [&](const Status& s) { sync.StatusCB(s); });
+  ASSERT_OK(sync.Wait());
+  ASSERT_FALSE(resp.has_error()) << SecureShortDebugString(resp);
+  ASSERT_FALSE(resp.status().has_error()) << SecureShortDebugString(resp);
+  ASSERT_TRUE(OpIdEquals(resp.status().last_received(), last_op_id));
+}
+
+// Benchmarks replication over a simulated WAN, committing in a majority of
+// all the voters, or, with FlexiRaft, in a majority of the leader's region.
+// The --raft_bench_* flags set the shape of the ring and of the network.
+TEST_F(RaftConsensusQuorumTest, BenchmarkRaftOverSimulatedNetwork) {
+  NO_FATALS(RunNetworkBenchmark(false));
+}
+
+TEST_F(RaftConsensusQuorumTest, BenchmarkFlexiRaftOverSimulatedNetwork) {
+  NO_FATALS(RunNetworkBenchmark(true));
+}
+
+TEST_F(RaftConsensusQuorumTest, BenchmarkRaftUnderChaos) {
+  NO_FATALS(RunChaosBenchmark());
+}
+
 // Test that RequestVote performs according to "spec".
 TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   ASSERT_OK(BuildAndStartConfig(3));
@@ -1278,6 +2128,25 @@ TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   // Ensure replicas vote no for an old op index.
   //
 
+  // With pre-vote checks, a rejected candidate doesn't advance the term.
+  flush_count_before = flush_count();
+  request.set_candidate_term(last_op_id.term() + 3);
+  request.set_pre_vote(true);
+  request.mutable_candidate_status()->mutable_last_received()->CopyFrom(
+      MinimumOpId());
+  response.Clear();
+  ASSERT_OK(peer->RequestVote(
+      &request,
+      TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+      &response));
+  ASSERT_FALSE(response.vote_granted());
+  ASSERT_EQ(
+      ConsensusErrorPB::LAST_OPID_TOO_OLD, response.consensus_error().code());
+  ASSERT_EQ(last_op_id.term() + 2, response.responder_term());
+  ASSERT_EQ(0, flush_count() - flush_count_before)
+      << "Rejected votes with pre-vote checks should not flush";
+  request.clear_pre_vote();
+
   flush_count_before = flush_count();
   request.set_candidate_uuid(fs_managers_[0]->uuid());
   request.set_candidate_term(last_op_id.term() + 3);
@@ -1313,5 +2182,69 @@ TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
             << SecureShortDebugString(res);
 }
 
+// Requests with a lower generation than one already seen from the same leader
+// and term are superseded; a newer term starts over.
+TEST_F(RaftConsensusQuorumTest, TestSupersededRequests) {
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  shared_ptr<RaftConsensus> peer;
+  CHECK_OK(peers_->GetPeerByIdx(1, &peer));
+  ConsensusRequestPB req;
+  req.set_tablet_id(kTestTablet);
+  req.set_caller_uuid(fs_managers_[0]->uuid());
+  req.set_caller_term(1);
+  ASSERT_FALSE(peer->IsSupersededRequest(req));
+
+  req.set_request_generation(10);
+  ASSERT_FALSE(peer->IsSupersededRequest(req));
+  req.set_request_generation(9);
+  ASSERT_TRUE(peer->IsSupersededRequest(req));
+  req.set_request_generation(11);
+  ASSERT_FALSE(peer->IsSupersededRequest(req));
+
+  req.set_caller_term(2);
+  req.set_request_generation(0);
+  ASSERT_FALSE(peer->IsSupersededRequest(req));
+
+  // Other leaders are tracked separately.
+  req.set_caller_uuid(fs_managers_[2]->uuid());
+  req.set_caller_term(1);
+  ASSERT_FALSE(peer->IsSupersededRequest(req));
+}
+
+// All the parts of a topology delta land with a single metadata flush, and a
+// delta with any rejected part changes nothing.
+TEST_F(RaftConsensusQuorumTest, TestApplyTopologyDelta) {
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  shared_ptr<RaftConsensus> peer;
+  CHECK_OK(peers_->GetPeerByIdx(1, &peer));
+  ConsensusMetadata* cmeta = peer->consensus_metadata_for_tests();
+  const int flush_count_before = cmeta->flush_count_for_tests();
+
+  std::map<string, string> quorum_ids;
+  for (const RaftPeerPB& config_peer : cmeta->ActiveConfig().peers()) {
+    quorum_ids[config_peer.permanent_uuid()] = "quorum-a";
+  }
+  TopologyDelta delta;
+  delta.quorum_ids = quorum_ids;
+  delta.voter_distribution = std::map<string, int32_t>{{"quorum-a", 3}};
+  ASSERT_OK(peer->ApplyTopologyDelta(delta));
+  ASSERT_EQ(flush_count_before + 1, cmeta->flush_count_for_tests());
+  for (const RaftPeerPB& config_peer : cmeta->ActiveConfig().peers()) {
+    ASSERT_EQ("quorum-a", config_peer.attrs().quorum_id());
+  }
+  ASSERT_EQ(3, cmeta->ActiveConfig().voter_distribution().at("quorum-a"));
+
+  // A voter left without a quorum id rejects the voter distribution too.
+  quorum_ids.erase(quorum_ids.begin());
+  delta.quorum_ids = quorum_ids;
+  delta.voter_distribution = std::map<string, int32_t>{{"quorum-a", 5}};
+  Status s = peer->ApplyTopologyDelta(delta);
+  ASSERT_TRUE(s.IsConfigurationError()) << s.ToString();
+  ASSERT_EQ(flush_count_before + 1, cmeta->flush_count_for_tests());
+  ASSERT_EQ(3, cmeta->ActiveConfig().voter_distribution().at("quorum-a"));
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/raft_resource_accounting.h"
+
+#include <cstdint>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(raft_resource_accounting);
+
+METRIC_DECLARE_entity(raft_ring);
+METRIC_DECLARE_counter(raft_ring_send_cpu_time_us);
+METRIC_DECLARE_counter(raft_ring_compression_cpu_time_us);
+METRIC_DECLARE_counter(raft_ring_bytes_sent);
+
+namespace kudu {
+namespace consensus {
+
+class RaftResourceAccountingTest : public KuduTest {
+ protected:
+  // Spins for 'ms' milliseconds of wall time, which is mostly CPU time.
+  static void Spin(int64_t ms) {
+    const MonoTime deadline = MonoTime::Now() + MonoDelta::FromMilliseconds(ms);
+    while (MonoTime::Now() < deadline) {
+    }
+  }
+
+  scoped_refptr<Counter> GetCounter(CounterPrototype* prototype) {
+    scoped_refptr<MetricEntity> entity =
+        METRIC_ENTITY_raft_ring.Instantiate(&registry_, "raft_ring:tablet");
+    return prototype->Instantiate(entity);
+  }
+
+  MetricRegistry registry_;
+};
+
+TEST_F(RaftResourceAccountingTest, TestDisabled) {
+  FLAGS_raft_resource_accounting = false;
+  RaftResourceAccount account(&registry_, "tablet");
+  {
+    ScopedRaftResourceAccounting accounting(&account, RaftActivity::kSend);
+    Spin(10);
+  }
+  account.AddBytesSent(100);
+  // The entity is only created once something is accounted.
+  ASSERT_EQ(0, registry_.num_entities());
+}
+
+TEST_F(RaftResourceAccountingTest, TestNestedScopes) {
+  FLAGS_raft_resource_accounting = true;
+  RaftResourceAccount account(&registry_, "tablet");
+  {
+    ScopedRaftResourceAccounting send(&account, RaftActivity::kSend);
+    Spin(50);
+    {
+      ScopedRaftResourceAccounting compression(
+          &account, RaftActivity::kCompression);
+      Spin(200);
+    }
+  }
+  account.AddBytesSent(100);
+
+  // The inner scope's time isn't accounted to the outer one. Allow for the
+  // coarse granularity of the CPU clocks of some kernels.
+  const int64_t send_us =
+      GetCounter(&METRIC_raft_ring_send_cpu_time_us)->value();
+  const int64_t compression_us =
+      GetCounter(&METRIC_raft_ring_compression_cpu_time_us)->value();
+  ASSERT_GE(compression_us, 150000);
+  ASSERT_LT(send_us, 150000);
+  ASSERT_EQ(100, GetCounter(&METRIC_raft_ring_bytes_sent)->value());
+}
+
+} // namespace consensus
+} // namespace kudu
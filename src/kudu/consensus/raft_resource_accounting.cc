@@ -0,0 +1,205 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/raft_resource_accounting.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+
+DEFINE_bool(
+    raft_resource_accounting,
+    false,
+    "Whether the CPU time and context switches of the consensus work of each "
+    "ring, and the bytes it sends and writes to the log, are counted by the "
+    "metrics of a 'raft_ring' entity. Each accounted unit of work costs a "
+    "couple of getrusage() calls.");
+TAG_FLAG(raft_resource_accounting, experimental);
+TAG_FLAG(raft_resource_accounting, runtime);
+
+METRIC_DEFINE_entity(raft_ring);
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_send_cpu_time_us,
+    "Send CPU Time",
+    kudu::MetricUnit::kMicroseconds,
+    "CPU time the leader spent building requests for the ring's peers and "
+    "handling their responses.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_update_cpu_time_us,
+    "Update CPU Time",
+    kudu::MetricUnit::kMicroseconds,
+    "CPU time spent handling UpdateConsensus requests of the ring, not "
+    "counting any log append or compression they did inline.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_wal_append_cpu_time_us,
+    "WAL Append CPU Time",
+    kudu::MetricUnit::kMicroseconds,
+    "CPU time spent writing and syncing groups of log entries of the ring and "
+    "running their callbacks.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_compression_cpu_time_us,
+    "Compression CPU Time",
+    kudu::MetricUnit::kMicroseconds,
+    "CPU time spent compressing ops of the ring.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_context_switches,
+    "Context Switches",
+    kudu::MetricUnit::kUnits,
+    "Voluntary and involuntary context switches of the threads doing the "
+    "accounted consensus work of the ring. Voluntary switches mostly stand "
+    "for blocking system calls.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_bytes_sent,
+    "Bytes Sent",
+    kudu::MetricUnit::kBytes,
+    "Op payload bytes the leader sent to the ring's peers.");
+
+METRIC_DEFINE_counter(
+    raft_ring,
+    raft_ring_wal_bytes_written,
+    "WAL Bytes Written",
+    kudu::MetricUnit::kBytes,
+    "Bytes of log entries of the ring written to the log.");
+
+namespace kudu {
+namespace consensus {
+
+bool RaftResourceAccountingEnabled() {
+  return FLAGS_raft_resource_accounting;
+}
+
+RaftResourceAccount::RaftResourceAccount(
+    MetricRegistry* registry,
+    std::string tablet_id)
+    : registry_(registry), tablet_id_(std::move(tablet_id)) {}
+
+bool RaftResourceAccount::InitMetrics() {
+  if (registry_ == nullptr || !FLAGS_raft_resource_accounting) {
+    return false;
+  }
+  std::call_once(init_once_, [this]() {
+    // One per ring, which the startup profile's ring gauges share; prefixed
+    // so as not to clash with the ring's other entities.
+    entity_ = METRIC_ENTITY_raft_ring.Instantiate(
+        registry_,
+        strings::Substitute("raft_ring:$0", tablet_id_),
+        {{"tablet_id", tablet_id_}});
+    send_cpu_time_us_ = METRIC_raft_ring_send_cpu_time_us.Instantiate(entity_);
+    update_cpu_time_us_ =
+        METRIC_raft_ring_update_cpu_time_us.Instantiate(entity_);
+    wal_append_cpu_time_us_ =
+        METRIC_raft_ring_wal_append_cpu_time_us.Instantiate(entity_);
+    compression_cpu_time_us_ =
+        METRIC_raft_ring_compression_cpu_time_us.Instantiate(entity_);
+    context_switches_ = METRIC_raft_ring_context_switches.Instantiate(entity_);
+    bytes_sent_ = METRIC_raft_ring_bytes_sent.Instantiate(entity_);
+    wal_bytes_written_ =
+        METRIC_raft_ring_wal_bytes_written.Instantiate(entity_);
+  });
+  return true;
+}
+
+void RaftResourceAccount::AddCpu(
+    RaftActivity activity,
+    int64_t cpu_us,
+    int64_t context_switches) {
+  if (!InitMetrics()) {
+    return;
+  }
+  switch (activity) {
+    case RaftActivity::kSend:
+      send_cpu_time_us_->IncrementBy(cpu_us);
+      break;
+    case RaftActivity::kUpdate:
+      update_cpu_time_us_->IncrementBy(cpu_us);
+      break;
+    case RaftActivity::kWalAppend:
+      wal_append_cpu_time_us_->IncrementBy(cpu_us);
+      break;
+    case RaftActivity::kCompression:
+      compression_cpu_time_us_->IncrementBy(cpu_us);
+      break;
+  }
+  context_switches_->IncrementBy(context_switches);
+}
+
+void RaftResourceAccount::AddBytesSent(int64_t bytes) {
+  if (InitMetrics()) {
+    bytes_sent_->IncrementBy(bytes);
+  }
+}
+
+void RaftResourceAccount::AddWalBytesWritten(int64_t bytes) {
+  if (InitMetrics()) {
+    wal_bytes_written_->IncrementBy(bytes);
+  }
+}
+
+__thread ScopedRaftResourceAccounting* ScopedRaftResourceAccounting::current_;
+
+ScopedRaftResourceAccounting::ScopedRaftResourceAccounting(
+    RaftResourceAccount* account,
+    RaftActivity activity)
+    : activity_(activity), stopwatch_(Stopwatch::THIS_THREAD) {
+  if (account == nullptr || !FLAGS_raft_resource_accounting) {
+    return;
+  }
+  account_ = account;
+  parent_ = current_;
+  current_ = this;
+  stopwatch_.start();
+}
+
+ScopedRaftResourceAccounting::~ScopedRaftResourceAccounting() {
+  if (account_ == nullptr) {
+    return;
+  }
+  stopwatch_.stop();
+  const CpuTimes times = stopwatch_.elapsed();
+  const int64_t cpu_us = (times.user + times.system) / 1000;
+  account_->AddCpu(
+      activity_,
+      std::max<int64_t>(0, cpu_us - inner_cpu_us_),
+      std::max<int64_t>(0, times.context_switches - inner_context_switches_));
+
+  DCHECK_EQ(this, current_);
+  current_ = parent_;
+  if (parent_ != nullptr) {
+    parent_->inner_cpu_us_ += cpu_us;
+    parent_->inner_context_switches_ += times.context_switches;
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,121 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/stopwatch.h"
+
+namespace kudu {
+namespace consensus {
+
+// Returns true if consensus work is accounted to its ring
+// (--raft_resource_accounting).
+bool RaftResourceAccountingEnabled();
+
+// The units of consensus work whose CPU time is accounted.
+enum class RaftActivity {
+  // Building requests for a peer and handling its responses, on the leader.
+  kSend,
+  // Handling an UpdateConsensus request, on a follower.
+  kUpdate,
+  // Writing and syncing groups of log entries, and running their callbacks.
+  kWalAppend,
+  // Compressing ops, for the log cache and for sending.
+  kCompression,
+};
+
+// The resources spent on the consensus work of one ring (tablet), counted by
+// the counters of a 'raft_ring' metric entity, so that the load of the rings
+// sharing a server can be told apart.
+//
+// Nothing is accounted while --raft_resource_accounting is off, and the entity
+// is only created once something is. Thread-safe. Every
+// account of a ring in a registry shares the same counters, so the components
+// of a ring each keep their own.
+class RaftResourceAccount {
+ public:
+  // 'registry' may be null, in which case nothing is accounted.
+  RaftResourceAccount(MetricRegistry* registry, std::string tablet_id);
+
+  // Accounts the CPU time, in microseconds, and the context switches spent
+  // on 'activity'.
+  void AddCpu(RaftActivity activity, int64_t cpu_us, int64_t context_switches);
+
+  // Accounts the op payload bytes sent to peers.
+  void AddBytesSent(int64_t bytes);
+
+  // Accounts the bytes of log entries written.
+  void AddWalBytesWritten(int64_t bytes);
+
+ private:
+  // Returns false if nothing is to be accounted.
+  bool InitMetrics();
+
+  MetricRegistry* const registry_;
+  const std::string tablet_id_;
+
+  std::once_flag init_once_;
+  scoped_refptr<MetricEntity> entity_;
+  scoped_refptr<Counter> send_cpu_time_us_;
+  scoped_refptr<Counter> update_cpu_time_us_;
+  scoped_refptr<Counter> wal_append_cpu_time_us_;
+  scoped_refptr<Counter> compression_cpu_time_us_;
+  scoped_refptr<Counter> context_switches_;
+  scoped_refptr<Counter> bytes_sent_;
+  scoped_refptr<Counter> wal_bytes_written_;
+
+  DISALLOW_COPY_AND_ASSIGN(RaftResourceAccount);
+};
+
+// Accounts the CPU time the current thread spends in the scope, and its
+// context switches, to 'activity' of 'account'. Does nothing if 'account' is
+// null or --raft_resource_accounting is off.
+//
+// Scopes may nest: the time spent in an inner scope is only accounted to the
+// inner scope's activity.
+class ScopedRaftResourceAccounting {
+ public:
+  ScopedRaftResourceAccounting(
+      RaftResourceAccount* account,
+      RaftActivity activity);
+  ~ScopedRaftResourceAccounting();
+
+ private:
+  // The innermost scope of the current thread that is accounting.
+  static __thread ScopedRaftResourceAccounting* current_;
+
+  // Null if the scope is not accounting.
+  RaftResourceAccount* account_ = nullptr;
+  const RaftActivity activity_;
+  ScopedRaftResourceAccounting* parent_ = nullptr;
+  Stopwatch stopwatch_;
+  // What the inner scopes accounted.
+  int64_t inner_cpu_us_ = 0;
+  int64_t inner_context_switches_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedRaftResourceAccounting);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -17,7 +17,14 @@
 
 #pragma once
 
+#include <memory>
+#include <utility>
+
+#include <google/protobuf/arena.h>
+
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/op_latency_tracker.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/ref_counted.h"
 
 namespace kudu {
@@ -28,12 +35,40 @@ class RefCountedReplicate : public RefCountedThreadSafe<RefCountedReplicate> {
  public:
   explicit RefCountedReplicate(ReplicateMsg* msg) : msg_(msg) {}
 
+  // Wraps 'msg', which was allocated on 'arena'. The arena is shared by all
+  // the messages allocated on it, and freed with the last of them.
+  RefCountedReplicate(
+      ReplicateMsg* msg,
+      std::shared_ptr<google::protobuf::Arena> arena)
+      : msg_(msg), arena_(std::move(arena)) {}
+
+  ~RefCountedReplicate() {
+    if (arena_) {
+      // Owned by the arena.
+      ignore_result(msg_.release());
+    }
+  }
+
   ReplicateMsg* get() {
     return msg_.get();
   }
 
+  // The latency trace of a sampled op, or nullptr. See OpLatencyTracker.
+  // Set before the op is appended to the queue, and then read-only.
+  OpLatencyTrace* latency_trace() const {
+    return latency_trace_.get();
+  }
+  const std::shared_ptr<OpLatencyTrace>& shared_latency_trace() const {
+    return latency_trace_;
+  }
+  void set_latency_trace(std::shared_ptr<OpLatencyTrace> trace) {
+    latency_trace_ = std::move(trace);
+  }
+
  private:
   std::unique_ptr<ReplicateMsg> msg_;
+  std::shared_ptr<google::protobuf::Arena> arena_;
+  std::shared_ptr<OpLatencyTrace> latency_trace_;
 };
 
 typedef scoped_refptr<RefCountedReplicate> ReplicateRefPtr;
@@ -42,5 +77,12 @@ inline ReplicateRefPtr make_scoped_refptr_replicate(ReplicateMsg* replicate) {
   return ReplicateRefPtr(new RefCountedReplicate(replicate));
 }
 
+inline ReplicateRefPtr make_scoped_refptr_replicate(
+    ReplicateMsg* replicate,
+    std::shared_ptr<google::protobuf::Arena> arena) {
+  return ReplicateRefPtr(
+      new RefCountedReplicate(replicate, std::move(arena)));
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -4,23 +4,41 @@
 #include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/pb_util.h"
 
 namespace kudu {
 namespace consensus {
 
+/**
+ * Copies every field of 'src' to 'dst' but the payload of its write payload,
+ * without copying the payload, so that the copy keeps any fields added to
+ * ReplicateMsg or WritePayloadPB later.
+ */
+inline void CopyReplicateMsgWithoutPayload(
+    const ReplicateMsg& src,
+    ReplicateMsg* dst) {
+  static const google::protobuf::FieldDescriptor* const kPayloadField =
+      WritePayloadPB::descriptor()->FindFieldByNumber(
+          WritePayloadPB::kPayloadFieldNumber);
+  pb_util::MergeFieldsExcept(src, kPayloadField, dst);
+}
+
 /**
  * Thin wrapper to handle compression/decompression of replicate msg
  *
  * Pass any msg (compressed or uncompressed) to the constructor and then call
- * Init() to populate both the compressed and uncompressed msgs.
+ * Init() to populate both the compressed and uncompressed msgs. The codec is
+ * taken from 'codec_manager', the manager of the ring the msg belongs to.
  */
 class ReplicateMsgWrapper {
  public:
-  explicit ReplicateMsgWrapper(
+  ReplicateMsgWrapper(
       const ReplicateRefPtr& msg,
+      CompressionCodecManager* codec_manager,
       const bool should_compress = true) {
+    DCHECK(codec_manager);
     orig_msg_ = msg;
-    auto codec_hint = CompressionCodecManager::GetCurrentCodec();
+    auto codec_hint = codec_manager->GetCurrentCodec();
     const CompressionType msg_codec_type =
         orig_msg_->get()->write_payload().compression_codec();
     if (msg_codec_type == NO_COMPRESSION) {
@@ -30,8 +48,9 @@ class ReplicateMsgWrapper {
           msg_->get()->op_type() == WRITE_OP_EXT && codec_ != nullptr;
     } else {
       compressed_msg_ = orig_msg_;
-      CHECK_OK(CompressionCodecManager::SetCurrentCodec(msg_codec_type));
-      codec_ = CompressionCodecManager::GetCurrentCodec();
+      const std::string& payload = orig_msg_->get()->write_payload().payload();
+      CHECK_OK(codec_manager->GetCodecForMessage(
+          msg_codec_type, Slice(payload.data(), payload.size()), &codec_));
     }
     DCHECK(msg_ || compressed_msg_);
   }
@@ -65,6 +84,20 @@ class ReplicateMsgWrapper {
     return Status::OK();
   }
 
+  /**
+   * Like Init(), but keeps the msg passed to the ctor as it is: a compressed
+   * msg is not uncompressed and an uncompressed one is not compressed, so
+   * only one of the two gets populated. For replicas that never read the
+   * payload, and for msgs that will only be sent as they are.
+   */
+  Status InitOpaque() {
+    if (!msg_ && !compressed_msg_) {
+      return Status::IllegalState(
+          "Both compressed and uncompressed msg are not populated!");
+    }
+    return Status::OK();
+  }
+
   /** Returns the msg that was originally passed to the ctor **/
   ReplicateRefPtr GetOrigMsg() const {
     return orig_msg_;
@@ -127,16 +160,19 @@ class ReplicateMsgWrapper {
             uncompressed_size));
 
     // Now create a new ReplicateMsg and copy over the contents from the
-    // original msg and the uncompressed payload
+    // original msg and the uncompressed payload. The checksum is that of the
+    // compressed payload, so it doesn't carry over.
     std::unique_ptr<ReplicateMsg> rep_msg(new ReplicateMsg);
-    *(rep_msg->mutable_id()) = compressed_msg_->get()->id();
-    rep_msg->set_timestamp(compressed_msg_->get()->timestamp());
-    rep_msg->set_op_type(compressed_msg_->get()->op_type());
+    CopyReplicateMsgWithoutPayload(*compressed_msg_->get(), rep_msg.get());
 
     WritePayloadPB* write_payload = rep_msg->mutable_write_payload();
-    write_payload->set_payload(buffer->ToString());
+    write_payload->set_payload(buffer->data(), buffer->size());
+    write_payload->clear_compression_codec();
+    write_payload->clear_uncompressed_size();
+    write_payload->clear_crc32();
 
     msg_ = make_scoped_refptr_replicate(rep_msg.release());
+    msg_->set_latency_trace(compressed_msg_->shared_latency_trace());
     return Status::OK();
   }
 
@@ -183,16 +219,20 @@ class ReplicateMsgWrapper {
     // Now create a new replicate message and copy contents from original
     // message and compressed payload
     std::unique_ptr<ReplicateMsg> rep_msg(new ReplicateMsg);
-    *(rep_msg->mutable_id()) = msg_->get()->id();
-    rep_msg->set_timestamp(msg_->get()->timestamp());
-    rep_msg->set_op_type(msg_->get()->op_type());
+    CopyReplicateMsgWithoutPayload(*msg_->get(), rep_msg.get());
 
+    // Checksum the compressed payload as it is copied out of 'buffer', while
+    // it is still in cache, rather than in a later pass of its own.
     WritePayloadPB* write_payload = rep_msg->mutable_write_payload();
-    write_payload->set_payload(buffer->ToString());
+    std::string* compressed_payload = write_payload->mutable_payload();
+    compressed_payload->resize(compressed_len);
+    write_payload->set_crc32(crc::Crc32cCopy(
+        &(*compressed_payload)[0], buffer->data(), compressed_len));
     write_payload->set_compression_codec(codec_->type());
     write_payload->set_uncompressed_size(payload_str.size());
 
     compressed_msg_ = make_scoped_refptr_replicate(rep_msg.release());
+    compressed_msg_->set_latency_trace(msg_->shared_latency_trace());
     return Status::OK();
   }
 
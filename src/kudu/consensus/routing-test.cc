@@ -21,11 +21,15 @@
 #include <string>
 #include <unordered_map>
 
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 
 #include "kudu/consensus/consensus-test-util.h"
 #include "kudu/util/test_macros.h"
 
+DECLARE_int32(raft_latency_routing_min_rebuild_interval_ms);
+DECLARE_int64(raft_latency_routing_max_proxy_lag_ops);
+
 using std::string;
 using std::unique_ptr;
 using std::unordered_map;
@@ -106,5 +110,104 @@ TEST(RoutingTest, TestStaleRouter) {
   ASSERT_EQ("peer-2", next_hop); // Direct routing fallback.
 }
 
+// peer-0 is the leader, alone in region-a. peer-1 and peer-2 may proxy for
+// peer-3 in region-b.
+static RaftConfigPB BuildTwoRegionConfig() {
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(/*num_voters=*/4);
+  raft_config.set_opid_index(1);
+  for (int i = 0; i < raft_config.peers_size(); i++) {
+    RaftPeerPB* peer = raft_config.mutable_peers(i);
+    peer->mutable_attrs()->set_region(i == 0 ? "region-a" : "region-b");
+    peer->mutable_attrs()->set_backing_db_present(i < 3);
+  }
+  return raft_config;
+}
+
+// The latency-aware policy picks the fastest proxy of a region, sticks with
+// it while it's not markedly slower than another, and routes directly when
+// no peer of the region may proxy.
+TEST(RoutingTest, TestLatencyAwareRoutingTable) {
+  google::FlagSaver saver;
+  FLAGS_raft_latency_routing_min_rebuild_interval_ms = 0;
+  FLAGS_raft_latency_routing_max_proxy_lag_ops = 100;
+
+  RaftConfigPB raft_config = BuildTwoRegionConfig();
+  std::shared_ptr<LatencyAwareRoutingTable> lrt;
+  ASSERT_OK(LatencyAwareRoutingTable::Create(
+      raft_config, raft_config.peers(0), &lrt));
+  lrt->UpdateLeader("peer-0");
+
+  auto stats = [](int64_t rtt_1, int64_t rtt_2, int64_t lag_1) {
+    unordered_map<string, PeerRouteStats> s;
+    s["peer-1"].rtt_us = rtt_1;
+    s["peer-1"].lag_ops = lag_1;
+    s["peer-2"].rtt_us = rtt_2;
+    return s;
+  };
+  string next_hop;
+  lrt->UpdatePeerStats(stats(1000, 2000, 0));
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-1", next_hop);
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-2", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+
+  // Slightly faster isn't enough to switch.
+  lrt->UpdatePeerStats(stats(1000, 900, 0));
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-1", next_hop);
+
+  // Markedly faster is.
+  lrt->UpdatePeerStats(stats(1000, 500, 0));
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+
+  // A lagging proxy is routed around, however fast.
+  lrt->UpdatePeerStats(stats(100, 5000, 0));
+  lrt->UpdatePeerStats(stats(100, 5000, 1000));
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+
+  // Without any peer that may proxy, route directly.
+  unordered_map<string, PeerRouteStats> unreachable = stats(100, 100, 0);
+  unreachable["peer-1"].reachable = false;
+  unreachable["peer-2"].reachable = false;
+  lrt->UpdatePeerStats(std::move(unreachable));
+  ASSERT_OK(lrt->NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-3", next_hop);
+}
+
+// The container's compiled routes follow every update.
+TEST(RoutingTest, TestRoutingTableContainerCompiledRoutes) {
+  google::FlagSaver saver;
+  FLAGS_raft_latency_routing_min_rebuild_interval_ms = 0;
+
+  RaftConfigPB raft_config = BuildTwoRegionConfig();
+  RoutingTableContainer container(
+      ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY,
+      raft_config.peers(0),
+      raft_config,
+      /*drt=*/nullptr);
+  container.UpdateLeader("peer-0");
+
+  unordered_map<string, PeerRouteStats> stats;
+  stats["peer-1"].rtt_us = 5000;
+  stats["peer-2"].rtt_us = 1000;
+  container.UpdatePeerStats(stats);
+  string next_hop;
+  ASSERT_OK(container.NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-2", next_hop);
+
+  stats["peer-2"].reachable = false;
+  container.UpdatePeerStats(stats);
+  ASSERT_OK(container.NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-1", next_hop);
+
+  // Members that are gone from the config aren't compiled.
+  raft_config.mutable_peers()->RemoveLast();
+  ASSERT_OK(container.UpdateRaftConfig(raft_config));
+  ASSERT_OK(container.NextHop("peer-0", "peer-3", &next_hop));
+  ASSERT_EQ("peer-3", next_hop);
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -17,18 +17,22 @@
 
 #include "kudu/consensus/routing.h"
 
+#include <mutex>
 #include <unordered_set>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/util/message_differencer.h>
 
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/quorum_util.h"
+#include "kudu/fs/metadata_journal.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
@@ -44,6 +48,41 @@ using std::unordered_set;
 using std::vector;
 using strings::Substitute;
 
+DEFINE_int32(
+    raft_latency_routing_min_rebuild_interval_ms,
+    5000,
+    "With the LATENCY_AWARE_ROUTING_POLICY proxy policy, the least time "
+    "between rebuilds of the routes from the leader's measurements. Config "
+    "changes rebuild them regardless.");
+TAG_FLAG(raft_latency_routing_min_rebuild_interval_ms, experimental);
+TAG_FLAG(raft_latency_routing_min_rebuild_interval_ms, runtime);
+
+DEFINE_int32(
+    raft_latency_routing_hysteresis_pct,
+    20,
+    "With the LATENCY_AWARE_ROUTING_POLICY proxy policy, how much faster, in "
+    "percent of its round-trip time, another peer must be than a region's "
+    "current proxy peer to replace it.");
+TAG_FLAG(raft_latency_routing_hysteresis_pct, experimental);
+TAG_FLAG(raft_latency_routing_hysteresis_pct, runtime);
+
+DEFINE_int64(
+    raft_latency_routing_max_proxy_lag_ops,
+    1000,
+    "With the LATENCY_AWARE_ROUTING_POLICY proxy policy, peers lagging the "
+    "leader by more than this many ops don't proxy.");
+TAG_FLAG(raft_latency_routing_max_proxy_lag_ops, experimental);
+TAG_FLAG(raft_latency_routing_max_proxy_lag_ops, runtime);
+
+DEFINE_int32(
+    raft_latency_routing_max_proxy_rtt_ms,
+    0,
+    "With the LATENCY_AWARE_ROUTING_POLICY proxy policy, peers whose "
+    "round-trip time from the leader is longer than this don't proxy. "
+    "0 for no limit.");
+TAG_FLAG(raft_latency_routing_max_proxy_rtt_ms, experimental);
+TAG_FLAG(raft_latency_routing_max_proxy_rtt_ms, runtime);
+
 namespace kudu {
 namespace consensus {
 
@@ -286,7 +325,8 @@ Status DurableRoutingTable::Create(
       std::move(tablet_id),
       std::move(proxy_topology),
       std::move(raft_config)));
-  RETURN_NOT_OK(tmp_drt->Flush()); // no lock needed as object is unpublished
+  // No lock needed as the object is unpublished.
+  RETURN_NOT_OK(tmp_drt->Flush(tmp_drt->proxy_topology_));
   *drt = std::move(tmp_drt);
   return Status::OK();
 }
@@ -350,7 +390,7 @@ Status DurableRoutingTable::UpdateProxyTopology(
   // Only flush the proxy graph protobuf to disk when it changes.
   if (!MessageDifferencer::Equals(proxy_topology, proxy_topology_)) {
     VLOG_WITH_PREFIX(3) << "proxy routes updated, flushing to disk...";
-    RETURN_NOT_OK(Flush());
+    RETURN_NOT_OK(Flush(proxy_topology));
   }
 
   // Upgrade to an exclusive commit lock and make atomic changes here.
@@ -500,7 +540,8 @@ DurableRoutingTable::DurableRoutingTable(
   // TODO(mpercy): Do we have any validation to perform here?
 }
 
-Status DurableRoutingTable::Flush() const {
+Status DurableRoutingTable::Flush(
+    const ProxyTopologyPB& proxy_topology) const {
   // TODO(mpercy): This entire method is copy / pasted from
   // ConsensusMetadata::Flush(). Factor out?
 
@@ -519,13 +560,18 @@ Status DurableRoutingTable::Flush() const {
   }
 
   string path = fs_manager_->GetProxyMetadataPath(tablet_id_);
+  // May share its fsync with the updates of other rings.
+  fs::MetadataJournal* journal = fs_manager_->metadata_journal();
+  Status s = journal != nullptr
+      ? journal->Write(path, proxy_topology)
+      : pb_util::WritePBContainerToPath(
+            fs_manager_->env(),
+            path,
+            proxy_topology,
+            pb_util::OVERWRITE,
+            pb_util::SYNC);
   RETURN_NOT_OK_PREPEND(
-      pb_util::WritePBContainerToPath(
-          fs_manager_->env(),
-          path,
-          proxy_topology_,
-          pb_util::OVERWRITE,
-          pb_util::SYNC),
+      s,
       Substitute(
           "Unable to write proxy metadata file for tablet $0 to path $1",
           tablet_id_,
@@ -698,9 +744,198 @@ ProxyPolicy SimpleRegionRoutingTable::GetProxyPolicy() const {
   return ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// LatencyAwareRoutingTable
+////////////////////////////////////////////////////////////////////////////////
+Status LatencyAwareRoutingTable::Create(
+    RaftConfigPB raft_config,
+    RaftPeerPB local_peer_pb,
+    std::shared_ptr<LatencyAwareRoutingTable>* lrt) {
+  auto latency_routing_table = std::make_shared<LatencyAwareRoutingTable>();
+  latency_routing_table->SetLocalPeerPB(std::move(local_peer_pb));
+  latency_routing_table->UpdateRaftConfig(std::move(raft_config));
+  *lrt = std::move(latency_routing_table);
+
+  return Status::OK();
+}
+
+int64_t LatencyAwareRoutingTable::RttUnlocked(const string& uuid) const {
+  const PeerRouteStats* stats = FindOrNull(peer_stats_, uuid);
+  return stats ? stats->rtt_us : -1;
+}
+
+bool LatencyAwareRoutingTable::MayProxyUnlocked(const RaftPeerPB& peer) const {
+  if (!peer.attrs().backing_db_present()) {
+    return false;
+  }
+  const PeerRouteStats* stats = FindOrNull(peer_stats_, peer.permanent_uuid());
+  if (stats == nullptr) {
+    // Nothing is known about the peer yet; route as the simple policy would.
+    return true;
+  }
+  if (!stats->reachable ||
+      stats->lag_ops > FLAGS_raft_latency_routing_max_proxy_lag_ops) {
+    return false;
+  }
+  return FLAGS_raft_latency_routing_max_proxy_rtt_ms <= 0 ||
+      stats->rtt_us <
+      static_cast<int64_t>(FLAGS_raft_latency_routing_max_proxy_rtt_ms) * 1000;
+}
+
+void LatencyAwareRoutingTable::RebuildRoutesUnlocked() {
+  const string& local_peer_region = local_peer_pb_.attrs().region();
+
+  // 1. Choose the proxy peer of each region: the current one if it may still
+  // proxy and nobody is markedly faster, or else the fastest that may proxy.
+  // Peers without a measured round-trip time come last, in config order.
+  auto faster = [&](const string& a, const string& b, int pct) {
+    int64_t rtt_a = RttUnlocked(a);
+    int64_t rtt_b = RttUnlocked(b);
+    if (rtt_a < 0 || rtt_b < 0) {
+      return rtt_a >= 0 && rtt_b < 0;
+    }
+    return rtt_a * (100 + pct) < rtt_b * 100;
+  };
+  unordered_map<string, string> best_proxy_map;
+  for (const RaftPeerPB& peer : raft_config_.peers()) {
+    const string& region = peer.attrs().region();
+    if (region == local_peer_region || !MayProxyUnlocked(peer)) {
+      continue;
+    }
+    auto it = best_proxy_map.find(region);
+    if (it == best_proxy_map.end()) {
+      best_proxy_map.emplace(region, peer.permanent_uuid());
+    } else if (faster(peer.permanent_uuid(), it->second, 0)) {
+      it->second = peer.permanent_uuid();
+    }
+  }
+
+  unordered_map<string, string> region_proxy_map;
+  for (const auto& entry : best_proxy_map) {
+    const string& region = entry.first;
+    const string* current = FindOrNull(region_proxy_map_, region);
+    const RaftPeerPB* current_peer = nullptr;
+    if (current != nullptr) {
+      for (const RaftPeerPB& peer : raft_config_.peers()) {
+        if (peer.permanent_uuid() == *current) {
+          current_peer = &peer;
+          break;
+        }
+      }
+    }
+    const int hysteresis_pct = FLAGS_raft_latency_routing_hysteresis_pct;
+    if (current_peer != nullptr && MayProxyUnlocked(*current_peer) &&
+        !faster(entry.second, *current, hysteresis_pct)) {
+      region_proxy_map.emplace(region, *current);
+    } else {
+      if (current != nullptr && *current != entry.second) {
+        LOG(INFO) << "Proxy peer for region " << region << " changed from "
+                  << *current << " to " << entry.second;
+      }
+      region_proxy_map.emplace(region, entry.second);
+    }
+  }
+
+  // 2. Proxy every peer without a backing database through the proxy peer of
+  // its region, as SimpleRegionRoutingTable does.
+  ProxyTopologyPB proxy_topology;
+  unordered_map<string, string> dst_to_proxy_map;
+  for (const RaftPeerPB& dest_peer : raft_config_.peers()) {
+    if (dest_peer.attrs().backing_db_present()) {
+      continue;
+    }
+    const string* proxy_uuid =
+        FindOrNull(region_proxy_map, dest_peer.attrs().region());
+    if (proxy_uuid == nullptr) {
+      continue;
+    }
+    ProxyEdgePB* proxy_edge = proxy_topology.add_proxy_edges();
+    proxy_edge->set_peer_uuid(dest_peer.permanent_uuid());
+    proxy_edge->set_proxy_from_uuid(*proxy_uuid);
+    dst_to_proxy_map.emplace(dest_peer.permanent_uuid(), *proxy_uuid);
+  }
+
+  proxy_topology_ = std::move(proxy_topology);
+  region_proxy_map_ = std::move(region_proxy_map);
+  dst_to_proxy_map_ = std::move(dst_to_proxy_map);
+  last_rebuild_ = MonoTime::Now();
+}
+
+Status LatencyAwareRoutingTable::NextHop(
+    const std::string& /* src_uuid */,
+    const std::string& dest_uuid,
+    std::string* next_hop) const {
+  shared_lock<RWMutex> l(lock_);
+  const string* proxy_uuid = FindOrNull(dst_to_proxy_map_, dest_uuid);
+  // Route directly to destinations that aren't proxied.
+  *next_hop = proxy_uuid ? *proxy_uuid : dest_uuid;
+  return Status::OK();
+}
+
+Status LatencyAwareRoutingTable::UpdateProxyTopology(
+    ProxyTopologyPB /* proxy_topology */) {
+  // The topology is built from the config and the measurements.
+  return Status::OK();
+}
+
+ProxyTopologyPB LatencyAwareRoutingTable::GetProxyTopology() const {
+  shared_lock<RWMutex> l(lock_);
+  return proxy_topology_;
+}
+
+Status LatencyAwareRoutingTable::UpdateRaftConfig(RaftConfigPB raft_config) {
+  std::lock_guard<RWMutex> l(lock_);
+  raft_config_ = std::move(raft_config);
+  RebuildRoutesUnlocked();
+  return Status::OK();
+}
+
+void LatencyAwareRoutingTable::UpdateLeader(string leader_uuid) {
+  std::lock_guard<RWMutex> l(lock_);
+  if (leader_uuid_ && *leader_uuid_ == leader_uuid) {
+    return;
+  }
+  // The measurements were the previous leader's.
+  leader_uuid_ = std::move(leader_uuid);
+  peer_stats_.clear();
+  RebuildRoutesUnlocked();
+}
+
+void LatencyAwareRoutingTable::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
+  std::lock_guard<RWMutex> l(lock_);
+  local_peer_pb_ = std::move(local_peer_pb);
+}
+
+ProxyPolicy LatencyAwareRoutingTable::GetProxyPolicy() const {
+  return ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY;
+}
+
+void LatencyAwareRoutingTable::UpdatePeerStats(
+    unordered_map<string, PeerRouteStats> stats) {
+  std::lock_guard<RWMutex> l(lock_);
+  peer_stats_ = std::move(stats);
+  if (MonoTime::Now() - last_rebuild_ <
+      MonoDelta::FromMilliseconds(
+          FLAGS_raft_latency_routing_min_rebuild_interval_ms)) {
+    return;
+  }
+  RebuildRoutesUnlocked();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RoutingTableContainer implementation
 ////////////////////////////////////////////////////////////////////////////////
+namespace {
+vector<string> ConfigUuids(const RaftConfigPB& raft_config) {
+  vector<string> uuids;
+  uuids.reserve(raft_config.peers_size());
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    uuids.push_back(peer.permanent_uuid());
+  }
+  return uuids;
+}
+} // anonymous namespace
+
 RoutingTableContainer::RoutingTableContainer(
     const ProxyPolicy& proxy_policy,
     const RaftPeerPB& local_peer_pb,
@@ -712,12 +947,53 @@ RoutingTableContainer::RoutingTableContainer(
   std::shared_ptr<SimpleRegionRoutingTable> srt;
   SimpleRegionRoutingTable::Create(raft_config, local_peer_pb, &srt);
   srt_ = std::move(srt);
+
+  std::shared_ptr<LatencyAwareRoutingTable> lrt;
+  LatencyAwareRoutingTable::Create(raft_config, local_peer_pb, &lrt);
+  lrt_ = std::move(lrt);
+
+  std::lock_guard<std::mutex> l(update_lock_);
+  local_uuid_ = local_peer_pb.permanent_uuid();
+  config_uuids_ = ConfigUuids(raft_config);
+  CompileRoutesUnlocked();
+}
+
+void RoutingTableContainer::CompileRoutesUnlocked() {
+  auto routes = std::make_shared<CompiledRoutes>();
+  routes->src_uuid = local_uuid_;
+  for (const string& dest_uuid : config_uuids_) {
+    string next_hop;
+    // Failed lookups aren't compiled, so that NextHop() reports them.
+    if (ComputeNextHop(local_uuid_, dest_uuid, &next_hop).ok()) {
+      routes->next_hops.emplace(dest_uuid, std::move(next_hop));
+    }
+  }
+  std::atomic_store_explicit(
+      &compiled_routes_,
+      std::shared_ptr<const CompiledRoutes>(std::move(routes)),
+      std::memory_order_release);
 }
 
 Status RoutingTableContainer::NextHop(
     const std::string& src_uuid,
     const std::string& dest_uuid,
     std::string* next_hop) const {
+  std::shared_ptr<const CompiledRoutes> routes =
+      std::atomic_load_explicit(&compiled_routes_, std::memory_order_acquire);
+  if (routes && routes->src_uuid == src_uuid) {
+    const string* compiled = FindOrNull(routes->next_hops, dest_uuid);
+    if (compiled != nullptr) {
+      *next_hop = *compiled;
+      return Status::OK();
+    }
+  }
+  return ComputeNextHop(src_uuid, dest_uuid, next_hop);
+}
+
+Status RoutingTableContainer::ComputeNextHop(
+    const std::string& src_uuid,
+    const std::string& dest_uuid,
+    std::string* next_hop) const {
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -725,6 +1001,8 @@ Status RoutingTableContainer::NextHop(
       return drt_->NextHop(src_uuid, dest_uuid, next_hop);
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->NextHop(src_uuid, dest_uuid, next_hop);
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lrt_->NextHop(src_uuid, dest_uuid, next_hop);
     case ProxyPolicy::DISABLE_PROXY:
       *next_hop = dest_uuid;
       return Status::OK();
@@ -739,6 +1017,10 @@ Status RoutingTableContainer::UpdateProxyTopology(
     ProxyTopologyPB proxy_topology,
     RaftConfigPB raft_config,
     const std::string& leader_uuid) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  config_uuids_ = ConfigUuids(raft_config);
+  SCOPED_CLEANUP({ CompileRoutesUnlocked(); });
+
   // Explicit routing topology can only be used by durable routing table
   // Update the leader uuid before updating proxy_topology
   drt_->UpdateLeader(leader_uuid);
@@ -756,6 +1038,8 @@ ProxyTopologyPB RoutingTableContainer::GetProxyTopology() const {
       return drt_->GetProxyTopology();
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->GetProxyTopology();
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lrt_->GetProxyTopology();
     default:
       break; // placate the compiler
   }
@@ -764,6 +1048,10 @@ ProxyTopologyPB RoutingTableContainer::GetProxyTopology() const {
 }
 
 Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  config_uuids_ = ConfigUuids(raft_config);
+  SCOPED_CLEANUP({ CompileRoutesUnlocked(); });
+
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -771,6 +1059,8 @@ Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
       return drt_->UpdateRaftConfig(std::move(raft_config));
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       return srt_->UpdateRaftConfig(std::move(raft_config));
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      return lrt_->UpdateRaftConfig(std::move(raft_config));
     default:
       break; // placate the compiler
   }
@@ -779,6 +1069,9 @@ Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
 }
 
 void RoutingTableContainer::UpdateLeader(string leader_uuid) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ CompileRoutesUnlocked(); });
+
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -788,12 +1081,19 @@ void RoutingTableContainer::UpdateLeader(string leader_uuid) {
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       srt_->UpdateLeader(std::move(leader_uuid));
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      lrt_->UpdateLeader(std::move(leader_uuid));
+      break;
     default:
       break; // placate the compiler
   }
 }
 
 void RoutingTableContainer::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  local_uuid_ = local_peer_pb.permanent_uuid();
+  SCOPED_CLEANUP({ CompileRoutesUnlocked(); });
+
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -802,6 +1102,9 @@ void RoutingTableContainer::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
     case ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY:
       srt_->SetLocalPeerPB(std::move(local_peer_pb));
       break;
+    case ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY:
+      lrt_->SetLocalPeerPB(std::move(local_peer_pb));
+      break;
     default:
       break; // placate the compiler
   }
@@ -811,15 +1114,30 @@ ProxyPolicy RoutingTableContainer::GetProxyPolicy() const {
   return proxy_policy_.load();
 }
 
+void RoutingTableContainer::UpdatePeerStats(
+    unordered_map<string, PeerRouteStats> stats) {
+  if (proxy_policy_.load() == ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY) {
+    std::lock_guard<std::mutex> l(update_lock_);
+    lrt_->UpdatePeerStats(std::move(stats));
+    CompileRoutesUnlocked();
+  }
+}
+
 Status RoutingTableContainer::SetProxyPolicy(
     const ProxyPolicy& proxy_policy,
     const std::string& leader_uuid,
     RaftConfigPB raft_config) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  config_uuids_ = ConfigUuids(raft_config);
+  SCOPED_CLEANUP({ CompileRoutesUnlocked(); });
+
   drt_->UpdateLeader(leader_uuid);
   srt_->UpdateLeader(leader_uuid);
+  lrt_->UpdateLeader(leader_uuid);
 
   RETURN_NOT_OK(drt_->UpdateRaftConfig(raft_config));
   RETURN_NOT_OK(srt_->UpdateRaftConfig(raft_config));
+  RETURN_NOT_OK(lrt_->UpdateRaftConfig(raft_config));
 
   proxy_policy_ = proxy_policy;
 
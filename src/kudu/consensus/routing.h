@@ -17,15 +17,19 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/rwc_lock.h"
 
@@ -262,7 +266,7 @@ class DurableRoutingTable : public IRoutingTable {
   // We flush a new ProxyTopologyPB to disk before committing the updated
   // version to memory. This method is not thread-safe and must be synchronized
   // by taking the lock or similar.
-  Status Flush() const;
+  Status Flush(const ProxyTopologyPB& proxy_topology) const;
 
   // Thread-safe log prefix helper.
   std::string LogPrefix() const;
@@ -316,6 +320,80 @@ class SimpleRegionRoutingTable : public IRoutingTable {
   std::unordered_map<std::string, std::string> dst_to_proxy_map_;
 };
 
+// The leader's measurements of a peer, that LatencyAwareRoutingTable picks
+// proxy peers by.
+struct PeerRouteStats {
+  // Smoothed round-trip time of direct requests to the peer, or -1 if there
+  // is none yet.
+  int64_t rtt_us = -1;
+
+  // How many ops the peer is behind the leader's log.
+  int64_t lag_ops = 0;
+
+  // Whether the leader had a successful exchange with the peer recently.
+  bool reachable = true;
+};
+
+// A region based routing table like SimpleRegionRoutingTable, but choosing
+// each region's proxy peer from live measurements. Check proxy_policy.h for
+// more information. This table is intantiated when proxy policy is set to
+// ProxyPolicy::LATENCY_AWARE_ROUTING_POLICY.
+//
+// A peer may proxy if it's backed by a database, reachable, not lagging more
+// than --raft_latency_routing_max_proxy_lag_ops, and, if
+// --raft_latency_routing_max_proxy_rtt_ms is set, not slower than that. The
+// current proxy of a region is kept while it may proxy, unless another is
+// faster by more than --raft_latency_routing_hysteresis_pct. Regions without
+// any peer that may proxy are routed to directly.
+class LatencyAwareRoutingTable : public IRoutingTable {
+ public:
+  ~LatencyAwareRoutingTable() override {}
+
+  Status NextHop(
+      const std::string& src_uuid,
+      const std::string& dest_uuid,
+      std::string* next_hop) const override;
+
+  Status UpdateRaftConfig(RaftConfigPB raft_config) override;
+  void UpdateLeader(std::string leader_uuid) override;
+  ProxyTopologyPB GetProxyTopology() const override;
+  Status UpdateProxyTopology(ProxyTopologyPB proxy_topology) override;
+  void SetLocalPeerPB(RaftPeerPB local_peer_pb);
+  ProxyPolicy GetProxyPolicy() const override;
+
+  // Records the latest measurements of the peers, keyed by uuid, and
+  // rebuilds the routes from them unless they were rebuilt less than
+  // --raft_latency_routing_min_rebuild_interval_ms ago.
+  void UpdatePeerStats(std::unordered_map<std::string, PeerRouteStats> stats);
+
+  static Status Create(
+      RaftConfigPB raft_config,
+      RaftPeerPB local_peer_pb,
+      std::shared_ptr<LatencyAwareRoutingTable>* lrt);
+
+ private:
+  // Rebuilds the routes from 'raft_config_' and 'peer_stats_'. Requires
+  // 'lock_' to be held for writing.
+  void RebuildRoutesUnlocked();
+
+  // Whether 'peer' may proxy for its region, given 'peer_stats_'.
+  bool MayProxyUnlocked(const RaftPeerPB& peer) const;
+
+  // The round-trip time to 'uuid', or -1 if unknown.
+  int64_t RttUnlocked(const std::string& uuid) const;
+
+  // Lock protecting below fields
+  mutable RWMutex lock_;
+  ProxyTopologyPB proxy_topology_;
+  RaftConfigPB raft_config_;
+  RaftPeerPB local_peer_pb_;
+  boost::optional<std::string> leader_uuid_;
+  std::unordered_map<std::string, PeerRouteStats> peer_stats_;
+  std::unordered_map<std::string, std::string> region_proxy_map_;
+  std::unordered_map<std::string, std::string> dst_to_proxy_map_;
+  MonoTime last_rebuild_;
+};
+
 // A container to hols all available routing tables (implemented based on
 // routing policy). All routing tables are created during bootstrap. The table
 // that gets used for routing is based on 'proxy_policy_'.
@@ -330,6 +408,10 @@ class RoutingTableContainer {
   // Returns the uuid of the next 'proxy_peer' in 'next_hop'.
   // 'src_uuid' is the uuid of the peer who is sending the message. 'dest_uuid'
   // is the uuid of the peer to which message is intended.
+  //
+  // Routes from the local peer to members of the config are looked up in a
+  // table compiled after every update, without taking the routing tables'
+  // locks.
   Status NextHop(
       const std::string& src_uuid,
       const std::string& dest_uuid,
@@ -358,6 +440,10 @@ class RoutingTableContainer {
   // returns the current proxy_policy_
   ProxyPolicy GetProxyPolicy() const;
 
+  // Passes the leader's latest measurements of the peers on to the routing
+  // tables that route by them. A no-op in other routing policies.
+  void UpdatePeerStats(std::unordered_map<std::string, PeerRouteStats> stats);
+
   // Sets the proxy policy in use to 'proxy_policy'
   // Also updates the leader_uuid and raft_config on all managed routing tables.
   // This allows individual routing tables to update rebild their topology and
@@ -368,9 +454,34 @@ class RoutingTableContainer {
       RaftConfigPB raft_config);
 
  private:
+  // The next hop from 'src_uuid' to each member of the config.
+  struct CompiledRoutes {
+    std::string src_uuid;
+    std::unordered_map<std::string, std::string> next_hops;
+  };
+
+  // NextHop() as the routing table of the current policy computes it.
+  Status ComputeNextHop(
+      const std::string& src_uuid,
+      const std::string& dest_uuid,
+      std::string* next_hop) const;
+
+  // Compiles the routes from the local peer and publishes them to NextHop().
+  // Requires 'update_lock_' to be held.
+  void CompileRoutesUnlocked();
+
   std::atomic<ProxyPolicy> proxy_policy_;
   std::shared_ptr<SimpleRegionRoutingTable> srt_;
+  std::shared_ptr<LatencyAwareRoutingTable> lrt_;
   std::shared_ptr<DurableRoutingTable> drt_;
+
+  // Serializes updates, so that the routes are compiled in their order.
+  std::mutex update_lock_;
+  std::string local_uuid_;
+  std::vector<std::string> config_uuids_;
+
+  // Swapped atomically whenever it's recompiled.
+  std::shared_ptr<const CompiledRoutes> compiled_routes_;
 };
 
 // Verify that a ProxyTopologyPB is well-formed.
@@ -0,0 +1,92 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/startup_profile.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_entity(raft_ring);
+METRIC_DECLARE_gauge_int64(startup_fs_open_ms);
+METRIC_DECLARE_gauge_int64(startup_log_open_ms);
+METRIC_DECLARE_gauge_int64(startup_log_segment_scan_ms);
+METRIC_DECLARE_gauge_int64(raft_ring_startup_log_open_ms);
+
+namespace kudu {
+namespace consensus {
+
+class StartupProfileTest : public KuduTest {
+ protected:
+  int64_t GetGauge(
+      const scoped_refptr<MetricEntity>& entity,
+      GaugePrototype<int64_t>* prototype) {
+    return prototype->Instantiate(entity, -1)->value();
+  }
+
+  MetricRegistry registry_;
+};
+
+TEST_F(StartupProfileTest, TestPhases) {
+  StartupProfile profile;
+  profile.Record(
+      StartupPhase::kFsOpen, "", MonoDelta::FromMilliseconds(20));
+  {
+    ScopedStartupPhase open(&profile, StartupPhase::kLogOpen, "a");
+    SleepFor(MonoDelta::FromMilliseconds(50));
+    {
+      ScopedStartupPhase scan(&profile, StartupPhase::kLogSegmentScan, "a");
+      SleepFor(MonoDelta::FromMilliseconds(200));
+    }
+  }
+  profile.Record(
+      StartupPhase::kLogOpen, "b", MonoDelta::FromMilliseconds(100));
+  // A null profile records nothing.
+  { ScopedStartupPhase ignored(nullptr, StartupPhase::kRaftStart, "a"); }
+
+  scoped_refptr<MetricEntity> server =
+      METRIC_ENTITY_server.Instantiate(&registry_, "server");
+  profile.Finish(server, &registry_);
+
+  ASSERT_EQ(20, GetGauge(server, &METRIC_startup_fs_open_ms));
+  // The segment scan isn't counted in the log open it is nested in.
+  const int64_t scan_ms =
+      GetGauge(server, &METRIC_startup_log_segment_scan_ms);
+  const int64_t open_ms = GetGauge(server, &METRIC_startup_log_open_ms);
+  ASSERT_GE(scan_ms, 200);
+  ASSERT_GE(open_ms, 150);
+  ASSERT_LT(open_ms, 300);
+
+  scoped_refptr<MetricEntity> ring_b =
+      METRIC_ENTITY_raft_ring.Instantiate(&registry_, "raft_ring:b");
+  ASSERT_EQ(100, GetGauge(ring_b, &METRIC_raft_ring_startup_log_open_ms));
+
+  const std::string summary = profile.ToString();
+  ASSERT_STR_CONTAINS(summary, "fs_open 20 ms");
+  ASSERT_STR_CONTAINS(summary, "ring b: log_open 100 ms");
+  ASSERT_STR_NOT_CONTAINS(summary, "raft_start");
+}
+
+} // namespace consensus
+} // namespace kudu
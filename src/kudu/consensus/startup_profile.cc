@@ -0,0 +1,321 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/startup_profile.h"
+
+#include <mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/metrics.h"
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_entity(raft_ring);
+
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_total_ms,
+    "Startup Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Wall time the last startup of the server took.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_fs_open_ms,
+    "Startup FS Open Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent opening the file system layout.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_cmeta_load_ms,
+    "Startup Consensus Metadata Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading consensus metadata, over all rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_persistent_vars_load_ms,
+    "Startup Persistent Vars Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading persistent vars, over all rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_drt_load_ms,
+    "Startup Routing Table Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading durable routing tables, over all "
+    "rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_log_open_ms,
+    "Startup Log Open Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent opening and bootstrapping logs, not counting "
+    "the scan of their segments, over all rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_log_segment_scan_ms,
+    "Startup Log Segment Scan Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent scanning existing log segments, over all "
+    "rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_raft_start_ms,
+    "Startup Raft Start Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent starting Raft, over all rings.");
+METRIC_DEFINE_gauge_int64(
+    server,
+    startup_wait_running_ms,
+    "Startup Wait Running Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent waiting for Raft to run, over all rings.");
+
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_cmeta_load_ms,
+    "Startup Consensus Metadata Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading the ring's consensus metadata.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_persistent_vars_load_ms,
+    "Startup Persistent Vars Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading the ring's persistent vars.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_drt_load_ms,
+    "Startup Routing Table Load Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent loading the ring's durable routing table.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_log_open_ms,
+    "Startup Log Open Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent opening and bootstrapping the ring's log, "
+    "not counting the scan of its segments.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_log_segment_scan_ms,
+    "Startup Log Segment Scan Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent scanning the ring's existing log segments.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_raft_start_ms,
+    "Startup Raft Start Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent starting the ring's Raft.");
+METRIC_DEFINE_gauge_int64(
+    raft_ring,
+    raft_ring_startup_wait_running_ms,
+    "Startup Wait Running Time",
+    kudu::MetricUnit::kMilliseconds,
+    "Time the last startup spent waiting for the ring's Raft to run.");
+
+using std::string;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// Indexed by StartupPhase. Null where a phase isn't recorded at that level.
+GaugePrototype<int64_t>* const kServerGauges[] = {
+    &METRIC_startup_fs_open_ms,
+    &METRIC_startup_cmeta_load_ms,
+    &METRIC_startup_persistent_vars_load_ms,
+    &METRIC_startup_drt_load_ms,
+    &METRIC_startup_log_open_ms,
+    &METRIC_startup_log_segment_scan_ms,
+    &METRIC_startup_raft_start_ms,
+    &METRIC_startup_wait_running_ms,
+};
+GaugePrototype<int64_t>* const kRingGauges[] = {
+    nullptr,
+    &METRIC_raft_ring_startup_cmeta_load_ms,
+    &METRIC_raft_ring_startup_persistent_vars_load_ms,
+    &METRIC_raft_ring_startup_drt_load_ms,
+    &METRIC_raft_ring_startup_log_open_ms,
+    &METRIC_raft_ring_startup_log_segment_scan_ms,
+    &METRIC_raft_ring_startup_raft_start_ms,
+    &METRIC_raft_ring_startup_wait_running_ms,
+};
+
+void SetGauge(
+    GaugePrototype<int64_t>* prototype,
+    const scoped_refptr<MetricEntity>& entity,
+    int64_t value) {
+  scoped_refptr<AtomicGauge<int64_t>> gauge =
+      prototype->Instantiate(entity, value);
+  gauge->set_value(value);
+  entity->NeverRetire(gauge);
+}
+
+} // anonymous namespace
+
+StartupProfile::StartupProfile() : start_(MonoTime::Now()) {
+  total_us_.fill(0);
+}
+
+const char* StartupProfile::PhaseName(StartupPhase phase) {
+  switch (phase) {
+    case StartupPhase::kFsOpen:
+      return "fs_open";
+    case StartupPhase::kCmetaLoad:
+      return "cmeta_load";
+    case StartupPhase::kPersistentVarsLoad:
+      return "persistent_vars_load";
+    case StartupPhase::kDrtLoad:
+      return "drt_load";
+    case StartupPhase::kLogOpen:
+      return "log_open";
+    case StartupPhase::kLogSegmentScan:
+      return "log_segment_scan";
+    case StartupPhase::kRaftStart:
+      return "raft_start";
+    case StartupPhase::kWaitRunning:
+      return "wait_running";
+  }
+  LOG(FATAL) << "unknown startup phase";
+  return nullptr;
+}
+
+void StartupProfile::Record(
+    StartupPhase phase,
+    const string& tablet_id,
+    MonoDelta elapsed) {
+  const int i = static_cast<int>(phase);
+  const int64_t us = elapsed.ToMicroseconds();
+  std::lock_guard<simple_spinlock> l(lock_);
+  total_us_[i] += us;
+  if (!tablet_id.empty()) {
+    auto it = ring_us_.find(tablet_id);
+    if (it == ring_us_.end()) {
+      PhaseTimes times;
+      times.fill(0);
+      it = ring_us_.emplace(tablet_id, times).first;
+    }
+    it->second[i] += us;
+  }
+}
+
+void StartupProfile::Finish(
+    const scoped_refptr<MetricEntity>& entity,
+    MetricRegistry* registry) {
+  PhaseTimes total_us;
+  std::map<string, PhaseTimes> ring_us;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    elapsed_ = MonoTime::Now() - start_;
+    total_us = total_us_;
+    ring_us = ring_us_;
+  }
+
+  if (entity) {
+    SetGauge(&METRIC_startup_total_ms, entity, elapsed_.ToMilliseconds());
+    for (int i = 0; i < kNumPhases; i++) {
+      SetGauge(kServerGauges[i], entity, total_us[i] / 1000);
+    }
+  }
+  if (registry) {
+    for (const auto& ring : ring_us) {
+      // The same entity as the ring's RaftResourceAccount.
+      scoped_refptr<MetricEntity> ring_entity =
+          METRIC_ENTITY_raft_ring.Instantiate(
+              registry,
+              Substitute("raft_ring:$0", ring.first),
+              {{"tablet_id", ring.first}});
+      for (int i = 0; i < kNumPhases; i++) {
+        if (kRingGauges[i]) {
+          SetGauge(kRingGauges[i], ring_entity, ring.second[i] / 1000);
+        }
+      }
+    }
+  }
+  LOG(INFO) << ToString();
+}
+
+string StartupProfile::PhaseTimesToString(const PhaseTimes& times) {
+  string ret;
+  for (int i = 0; i < kNumPhases; i++) {
+    if (times[i] == 0) {
+      continue;
+    }
+    if (!ret.empty()) {
+      ret += ", ";
+    }
+    ret += Substitute(
+        "$0 $1 ms",
+        PhaseName(static_cast<StartupPhase>(i)),
+        times[i] / 1000);
+  }
+  return ret;
+}
+
+string StartupProfile::ToString() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  string ret = Substitute(
+      "startup took $0 ms: $1",
+      elapsed_.Initialized() ? elapsed_.ToMilliseconds()
+                             : (MonoTime::Now() - start_).ToMilliseconds(),
+      PhaseTimesToString(total_us_));
+  for (const auto& ring : ring_us_) {
+    ret += Substitute(
+        "\nring $0: $1", ring.first, PhaseTimesToString(ring.second));
+  }
+  return ret;
+}
+
+__thread ScopedStartupPhase* ScopedStartupPhase::current_;
+
+ScopedStartupPhase::ScopedStartupPhase(
+    StartupProfile* profile,
+    StartupPhase phase,
+    string tablet_id)
+    : profile_(profile),
+      phase_(phase),
+      tablet_id_(std::move(tablet_id)),
+      start_(MonoTime::Now()) {
+  if (profile_ == nullptr) {
+    return;
+  }
+  parent_ = current_;
+  current_ = this;
+}
+
+ScopedStartupPhase::~ScopedStartupPhase() {
+  if (profile_ == nullptr) {
+    return;
+  }
+  const int64_t elapsed_us = (MonoTime::Now() - start_).ToMicroseconds();
+  profile_->Record(
+      phase_, tablet_id_, MonoDelta::FromMicroseconds(elapsed_us - inner_us_));
+
+  DCHECK_EQ(this, current_);
+  current_ = parent_;
+  if (parent_ != nullptr) {
+    parent_->inner_us_ += elapsed_us;
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
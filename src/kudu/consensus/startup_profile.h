@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+
+class MetricEntity;
+class MetricRegistry;
+
+namespace consensus {
+
+// The phases of starting a server and its rings. Phases of a ring are
+// recorded against its tablet id; the others against the server.
+enum class StartupPhase {
+  // Opening, or creating, the FsManager.
+  kFsOpen,
+  // Loading the ConsensusMetadata of a ring.
+  kCmetaLoad,
+  // Loading the PersistentVars of a ring.
+  kPersistentVarsLoad,
+  // Loading the DurableRoutingTable of a ring.
+  kDrtLoad,
+  // Opening the log of a ring, including its bootstrap, but not the scan of
+  // its existing segments.
+  kLogOpen,
+  // Reading the headers and footers of the existing log segments of a ring.
+  kLogSegmentScan,
+  // RaftConsensus::Start() of a ring.
+  kRaftStart,
+  // Waiting for the RaftConsensus of a ring to run.
+  kWaitRunning,
+};
+
+// The time spent in each phase of starting a tablet server, per ring and
+// in total, so that restarts can be told apart by what made them slow.
+//
+// Finish() exports the phase timings as gauges, on the server entity and on
+// the 'raft_ring' entity of each ring, and logs a summary. Thread-safe.
+class StartupProfile {
+ public:
+  StartupProfile();
+
+  // Adds 'elapsed' to 'phase' of 'tablet_id', or of the server if
+  // 'tablet_id' is empty.
+  void Record(
+      StartupPhase phase,
+      const std::string& tablet_id,
+      MonoDelta elapsed);
+
+  // Marks the end of startup: exports the timings as metrics of 'entity' and
+  // 'registry', either of which may be null, and logs a summary.
+  void Finish(
+      const scoped_refptr<MetricEntity>& entity,
+      MetricRegistry* registry);
+
+  // One line per ring, after the server-wide totals, e.g.
+  // "startup took 812 ms: fs_open 20 ms, cmeta_load 3 ms, ...".
+  std::string ToString() const;
+
+  static const char* PhaseName(StartupPhase phase);
+
+ private:
+  static constexpr int kNumPhases =
+      static_cast<int>(StartupPhase::kWaitRunning) + 1;
+  typedef std::array<int64_t, kNumPhases> PhaseTimes;
+
+  static std::string PhaseTimesToString(const PhaseTimes& times);
+
+  const MonoTime start_;
+
+  mutable simple_spinlock lock_;
+  // The server-wide phases, and the sum of those of every ring.
+  PhaseTimes total_us_;
+  std::map<std::string, PhaseTimes> ring_us_;
+  MonoDelta elapsed_;
+
+  DISALLOW_COPY_AND_ASSIGN(StartupProfile);
+};
+
+// Records the time spent in the scope to 'phase' of 'tablet_id' in
+// 'profile'. Does nothing if 'profile' is null.
+//
+// Scopes may nest: the time spent in an inner scope is only recorded to the
+// inner scope's phase.
+class ScopedStartupPhase {
+ public:
+  ScopedStartupPhase(
+      StartupProfile* profile,
+      StartupPhase phase,
+      std::string tablet_id);
+  ~ScopedStartupPhase();
+
+ private:
+  // The innermost scope of the current thread that is recording.
+  static __thread ScopedStartupPhase* current_;
+
+  StartupProfile* const profile_;
+  const StartupPhase phase_;
+  const std::string tablet_id_;
+  ScopedStartupPhase* parent_ = nullptr;
+  const MonoTime start_;
+  // What the inner scopes recorded.
+  int64_t inner_us_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedStartupPhase);
+};
+
+} // namespace consensus
+} // namespace kudu
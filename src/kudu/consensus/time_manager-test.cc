@@ -148,6 +148,41 @@ TEST_F(TimeManagerTest, TestTimeManagerNonLeaderMode) {
   ASSERT_GE(time_manager_->GetSafeTime(), after);
 }
 
+// Tests that advancing safe time wakes up exactly the waiters it made safe,
+// in any order of registration.
+TEST_F(TimeManagerTest, TestWakesUpOnlySafeWaiters) {
+  const int kNumWaiters = 20;
+  const Timestamp init = clock_->Now();
+  InitTimeManager(init);
+  std::vector<CountDownLatch*> latches(kNumWaiters);
+  // Registered out of timestamp order.
+  for (int i = kNumWaiters - 1; i >= 0; i -= 2) {
+    latches[i] = WaitForSafeTimeAsync(Timestamp(init.value() + 1 + i));
+  }
+  for (int i = kNumWaiters - 2; i >= 0; i -= 2) {
+    latches[i] = WaitForSafeTimeAsync(Timestamp(init.value() + 1 + i));
+  }
+  // A waiter which times out must leave the others registered.
+  ASSERT_TRUE(time_manager_
+                  ->WaitUntilSafe(
+                      Timestamp(init.value() + kNumWaiters / 2),
+                      MonoTime::Now() + MonoDelta::FromMilliseconds(10))
+                  .IsTimedOut());
+
+  time_manager_->AdvanceSafeTime(Timestamp(init.value() + kNumWaiters / 2));
+  for (int i = 0; i < kNumWaiters / 2; i++) {
+    latches[i]->Wait();
+  }
+  for (int i = kNumWaiters / 2; i < kNumWaiters; i++) {
+    ASSERT_EQ(1, latches[i]->count());
+  }
+
+  time_manager_->AdvanceSafeTime(Timestamp(init.value() + kNumWaiters));
+  for (int i = kNumWaiters / 2; i < kNumWaiters; i++) {
+    latches[i]->Wait();
+  }
+}
+
 // Tests the TimeManager's functionality in leader mode and the transition to
 // non-leader mode.
 TEST_F(TimeManagerTest, TestTimeManagerLeaderMode) {
@@ -25,6 +25,7 @@
 #include <cstdint>
 #include <mutex>
 #include <ostream>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
@@ -73,6 +74,7 @@ DECLARE_int32(scanner_max_wait_ms);
 
 using kudu::clock::Clock;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -104,9 +106,13 @@ TimeManager::TimeManager(
       clock_(std::move(clock)) {}
 
 void TimeManager::SetLeaderMode() {
-  Lock l(lock_);
-  mode_ = LEADER;
-  AdvanceSafeTimeAndWakeUpWaitersUnlocked(clock_->Now());
+  vector<CountDownLatch*> to_wake;
+  {
+    Lock l(lock_);
+    mode_ = LEADER;
+    AdvanceSafeTimeUnlocked(clock_->Now(), &to_wake);
+  }
+  WakeUpWaiters(to_wake);
 }
 
 void TimeManager::SetNonLeaderMode() {
@@ -174,18 +180,26 @@ Status TimeManager::MessageReceivedFromLeader(const ReplicateMsg& message) {
 }
 
 void TimeManager::AdvanceSafeTimeWithMessage(const ReplicateMsg& message) {
-  Lock l(lock_);
-  if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
-    AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp(message.timestamp()));
+  if (GetMessageConsistencyMode(message) != CLIENT_PROPAGATED) {
+    return;
   }
+  vector<CountDownLatch*> to_wake;
+  {
+    Lock l(lock_);
+    AdvanceSafeTimeUnlocked(Timestamp(message.timestamp()), &to_wake);
+  }
+  WakeUpWaiters(to_wake);
 }
 
 void TimeManager::AdvanceSafeTime(Timestamp safe_time) {
-  Lock l(lock_);
-  CHECK_EQ(mode_, NON_LEADER)
-      << "Cannot advance safe time by timestamp in leader mode.";
-  ;
-  AdvanceSafeTimeAndWakeUpWaitersUnlocked(safe_time);
+  vector<CountDownLatch*> to_wake;
+  {
+    Lock l(lock_);
+    CHECK_EQ(mode_, NON_LEADER)
+        << "Cannot advance safe time by timestamp in leader mode.";
+    AdvanceSafeTimeUnlocked(safe_time, &to_wake);
+  }
+  WakeUpWaiters(to_wake);
 }
 
 bool TimeManager::HasAdvancedSafeTimeRecentlyUnlocked(string* error_message) {
@@ -293,7 +307,7 @@ Status TimeManager::WaitUntilSafe(
     Lock l(lock_);
     if (IsTimestampSafeUnlocked(timestamp))
       return Status::OK();
-    waiters_.push_back(&waiter);
+    waiter.pos = waiters_.emplace(timestamp, &waiter);
   }
 
   // Wait until we get notified or 'deadline' elapses.
@@ -306,15 +320,22 @@ Status TimeManager::WaitUntilSafe(
     // Address the case where we were notified after the timeout.
     if (waiter.latch->count() == 0)
       return Status::OK();
-
-    waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &waiter));
-
-    MakeWaiterTimeoutMessageUnlocked(waiter.timestamp, &error_message);
-    return Status::TimedOut(error_message);
+    if (!waiter.popped) {
+      waiters_.erase(waiter.pos);
+      MakeWaiterTimeoutMessageUnlocked(waiter.timestamp, &error_message);
+      return Status::TimedOut(error_message);
+    }
   }
+  // Otherwise we're about to be notified, outside the lock, so the latch must
+  // outlive that. Wait for it off the lock, so that callers which advance the
+  // safe time don't spin meanwhile.
+  waiter.latch->Wait();
+  return Status::OK();
 }
 
-void TimeManager::AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time) {
+void TimeManager::AdvanceSafeTimeUnlocked(
+    Timestamp safe_time,
+    vector<CountDownLatch*>* to_wake) {
   DCHECK(lock_.is_locked());
 
   if (safe_time <= last_safe_ts_) {
@@ -324,19 +345,25 @@ void TimeManager::AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time) {
   last_advanced_safe_time_ = MonoTime::Now();
 
   if (PREDICT_FALSE(!waiters_.empty())) {
+    // The waiters are ordered by timestamp, so only those now safe are
+    // visited.
+    const Timestamp now_safe = GetSafeTimeUnlocked();
     auto iter = waiters_.begin();
-    while (iter != waiters_.end()) {
-      WaitingState* waiter = *iter;
-      if (IsTimestampSafeUnlocked(waiter->timestamp)) {
-        iter = waiters_.erase(iter);
-        waiter->latch->CountDown();
-        continue;
-      }
-      iter++;
+    while (iter != waiters_.end() && iter->first <= now_safe) {
+      WaitingState* waiter = iter->second;
+      waiter->popped = true;
+      to_wake->push_back(waiter->latch);
+      iter = waiters_.erase(iter);
     }
   }
 }
 
+void TimeManager::WakeUpWaiters(const vector<CountDownLatch*>& to_wake) {
+  for (CountDownLatch* latch : to_wake) {
+    latch->CountDown();
+  }
+}
+
 bool TimeManager::IsTimestampSafe(Timestamp timestamp) {
   Lock l(lock_);
   return IsTimestampSafeUnlocked(timestamp);
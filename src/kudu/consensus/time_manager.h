@@ -16,6 +16,7 @@
 // under the License.
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -246,6 +247,11 @@ class TimeManager : public ITimeManager {
     // Latch that will be count down once 'timestamp' if safe, unblocking the
     // waiter.
     CountDownLatch* latch;
+    // The waiter's entry in 'waiters_', while it is registered.
+    std::multimap<Timestamp, WaitingState*>::iterator pos;
+    // Set once the waiter is removed from 'waiters_' to be woken up. Its
+    // latch is counted down after the lock is released.
+    bool popped = false;
   };
 
   // Returns whether 'timestamp' is safe.
@@ -255,8 +261,14 @@ class TimeManager : public ITimeManager {
   // Internal, unlocked implementation of IsTimestampSafe().
   bool IsTimestampSafeUnlocked(Timestamp timestamp);
 
-  // Advances safe time and wakes up any waiters.
-  void AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time);
+  // Advances safe time, and removes the waiters it made safe from 'waiters_'.
+  // Their latches are appended to 'to_wake', for WakeUpWaiters() to count
+  // down once the lock is released.
+  void AdvanceSafeTimeUnlocked(
+      Timestamp safe_time,
+      std::vector<CountDownLatch*>* to_wake);
+
+  static void WakeUpWaiters(const std::vector<CountDownLatch*>& to_wake);
 
   // Internal, unlocked implementation of GetSerialTimestamp().
   Timestamp GetSerialTimestampUnlocked();
@@ -272,8 +284,9 @@ class TimeManager : public ITimeManager {
   // Lock to protect the non-const fields below.
   mutable simple_spinlock lock_;
 
-  // Vector of waiters to be notified when the safe time advances.
-  mutable std::vector<WaitingState*> waiters_;
+  // Waiters to be notified when the safe time advances, by the timestamp
+  // they wait for, so that advancing safe time only visits those it wakes.
+  mutable std::multimap<Timestamp, WaitingState*> waiters_;
 
   // The last serial timestamp that was assigned.
   Timestamp last_serial_ts_assigned_;
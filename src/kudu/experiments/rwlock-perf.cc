@@ -15,209 +15,364 @@
 // specific language governing permissions and limitations
 // under the License.
 
-#include <sched.h>
+// Compares the lock primitives used by the consensus hot paths under a mix
+// of reads and writes: each thread does --ops_per_thread ops on one shared
+// lock, each a read with probability --read_fractions, holding the lock for
+// --work_iters of work and doing --think_iters of work between ops.
+//
+// Reads take the lock shared where the primitive allows it. The mixes
+// resemble the hot locks: Log::state_lock_ (a percpu_rwlock) is almost only
+// read, PeerMessageQueue's lock is about as often written as read. The ops
+// of each thread are drawn from --seed, so runs are repeatable.
+//
+// The Debouncer, which guards PeerMessageBuffer fills, is not a reader-writer
+// lock: there each op is a fill attempt, which either runs or is coalesced
+// into the one running or waiting. Its rows report the fraction that ran.
+//
+// Example:
+//   rwlock-perf --thread_counts=1,4,16 --read_fractions=0.99,0.5 \
+//       --primitives=percpu_rwlock,rw_spinlock,std::mutex
 
-#include <cinttypes>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <mutex>
+#include <set>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
-#include <boost/smart_ptr/detail/spinlock.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
-#include "kudu/gutil/macros.h"
-#include "kudu/gutil/port.h"
-#include "kudu/gutil/sysinfo.h"
-#include "kudu/gutil/walltime.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/debouncer.h"
 #include "kudu/util/flags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
 #include "kudu/util/rw_mutex.h"
-
-DEFINE_int32(num_threads, 8, "Number of threads to test");
-
+#include "kudu/util/rw_semaphore.h"
+#include "kudu/util/rwc_lock.h"
+
+DEFINE_string(
+    thread_counts,
+    "1,2,4,8,16",
+    "Comma-separated numbers of threads to run with.");
+DEFINE_string(
+    read_fractions,
+    "1.0,0.99,0.9,0.5",
+    "Comma-separated fractions of the ops which are reads.");
+DEFINE_string(
+    primitives,
+    "",
+    "Comma-separated primitives to run. If empty, all of them: std::mutex, "
+    "simple_spinlock, rw_spinlock, percpu_rwlock, RWMutex, rw_semaphore, "
+    "RWCLock and MutexDebouncer.");
+DEFINE_int32(ops_per_thread, 1000000, "Number of ops each thread does.");
+DEFINE_int32(
+    work_iters,
+    1,
+    "Iterations of work done while holding the lock.");
+DEFINE_int32(
+    think_iters,
+    0,
+    "Iterations of work done between ops, without holding the lock.");
+DEFINE_int32(seed, 1, "Seed of the ops of the threads.");
+
+using std::atomic;
+using std::function;
+using std::map;
+using std::pair;
+using std::string;
 using std::thread;
 using std::vector;
 
-class my_spinlock : public boost::detail::spinlock {
+namespace kudu {
+
+namespace {
+
+// Some trivial work, which depends on 'result' so that it isn't optimized
+// out.
+float Work(float result, int iters) {
+  for (int i = 0; i < iters; i++) {
+    result += 1;
+    result *= 2.1;
+  }
+  return result;
+}
+
+// Add a dependency on the result - this will never be true, but prevents
+// compiler optimizations from killing off the work.
+void DependOn(float val) {
+  if (val == 12345.0) {
+    printf("hello world");
+  }
+}
+
+// A primitive which only locks exclusively.
+template <class Lock>
+class ExclusiveAdapter {
  public:
-  my_spinlock() {
-    v_ = 0;
+  template <class F>
+  bool Read(const F& f) {
+    std::lock_guard<Lock> l(lock_);
+    f();
+    return true;
+  }
+  template <class F>
+  bool Write(const F& f) {
+    return Read(f);
   }
 
  private:
-  DISALLOW_COPY_AND_ASSIGN(my_spinlock);
+  Lock lock_;
 };
 
-struct PerCpuLock {
-  struct PaddedLock {
-    my_spinlock lock;
-    char padding[CACHELINE_SIZE - sizeof(my_spinlock)];
-  };
-
-  PerCpuLock() {
-    n_cpus_ = base::NumCPUs();
-    CHECK_GT(n_cpus_, 0);
-    locks_ = new PaddedLock[n_cpus_];
+// A primitive with lock_shared() for reads and lock() for writes.
+template <class Lock>
+class SharedAdapter {
+ public:
+  template <class F>
+  bool Read(const F& f) {
+    lock_.lock_shared();
+    f();
+    lock_.unlock_shared();
+    return true;
   }
-
-  ~PerCpuLock() {
-    delete[] locks_;
+  template <class F>
+  bool Write(const F& f) {
+    std::lock_guard<Lock> l(lock_);
+    f();
+    return true;
   }
 
-  my_spinlock* get_lock() {
-    int cpu = sched_getcpu();
-    CHECK_LT(cpu, n_cpus_);
-    return &locks_[cpu].lock;
+ private:
+  Lock lock_;
+};
+
+class PercpuAdapter {
+ public:
+  template <class F>
+  bool Read(const F& f) {
+    // The thread may move to another CPU before it unlocks.
+    rw_spinlock& l = lock_.get_lock();
+    l.lock_shared();
+    f();
+    l.unlock_shared();
+    return true;
+  }
+  template <class F>
+  bool Write(const F& f) {
+    std::lock_guard<percpu_rwlock> l(lock_);
+    f();
+    return true;
   }
 
-  int n_cpus_;
-  PaddedLock* locks_;
+ private:
+  percpu_rwlock lock_;
 };
 
-struct SharedData {
-  kudu::rw_spinlock rw_spinlock;
-  kudu::RWMutex rwlock;
-  std::mutex lock;
-  kudu::percpu_rwlock per_cpu;
+// Every op is an attempt to run, which fails if another is already waiting.
+class DebouncerAdapter {
+ public:
+  template <class F>
+  bool Read(const F& f) {
+    if (!debouncer_.try_lock()) {
+      return false;
+    }
+    f();
+    debouncer_.unlock();
+    return true;
+  }
+  template <class F>
+  bool Write(const F& f) {
+    return Read(f);
+  }
+
+ private:
+  MutexDebouncer debouncer_;
 };
 
-class NoopLock {
- public:
-  void lock() {}
-  void unlock() {}
+struct Result {
+  double ops_per_sec = 0;
+  // Of the ops, the fraction which ran; less than 1 only for the Debouncer.
+  double ran_fraction = 1;
 };
 
-// Some trivial workload to be done while
-// holding the lock.
-static float workload(float result) {
-  for (int i = 0; i < 1; i++) {
-    result += 1;
-    result *= 2.1;
+template <class Adapter>
+Result RunMix(int num_threads, double read_fraction) {
+  Adapter adapter;
+  // Drawn ahead of time, so that the random generator isn't measured.
+  vector<vector<bool>> is_read(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    Random rng(FLAGS_seed + i);
+    is_read[i].resize(FLAGS_ops_per_thread);
+    for (int j = 0; j < FLAGS_ops_per_thread; j++) {
+      is_read[i][j] = rng.NextDoubleFraction() < read_fraction;
+    }
   }
-  return result;
-}
 
-// Add a dependency on result - this will never
-// be true, but prevents compiler optimizations
-// from killing off the workload call
-static void depend_on(float val) {
-  if (val == 12345.0) {
-    printf("hello world");
+  CountDownLatch go(1);
+  atomic<int64_t> ran(0);
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&, i]() {
+      const vector<bool>& reads = is_read[i];
+      float result = 1;
+      int64_t my_ran = 0;
+      auto critical = [&]() { result = Work(result, FLAGS_work_iters); };
+      go.Wait();
+      for (int j = 0; j < FLAGS_ops_per_thread; j++) {
+        const bool done =
+            reads[j] ? adapter.Read(critical) : adapter.Write(critical);
+        my_ran += done;
+        result = Work(result, FLAGS_think_iters);
+      }
+      ran += my_ran;
+      DependOn(result);
+    });
   }
-}
-
-void shared_rwlock_entry(SharedData* shared) {
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    shared->rwlock.lock_shared();
-    result += workload(result);
-    shared->rwlock.unlock_shared();
+  const MonoTime start = MonoTime::Now();
+  go.CountDown();
+  for (thread& t : threads) {
+    t.join();
   }
-  depend_on(result);
+  const double secs = (MonoTime::Now() - start).ToSeconds();
+  const int64_t total =
+      static_cast<int64_t>(num_threads) * FLAGS_ops_per_thread;
+  Result r;
+  r.ops_per_sec = total / secs;
+  r.ran_fraction = static_cast<double>(ran) / total;
+  return r;
 }
 
-void shared_rw_spinlock_entry(SharedData* shared) {
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    shared->rw_spinlock.lock_shared();
-    result += workload(result);
-    shared->rw_spinlock.unlock_shared();
-  }
-  depend_on(result);
+// The primitives, in the order they are reported.
+const vector<pair<string, function<Result(int, double)>>>& Primitives() {
+  static const auto* primitives =
+      new vector<pair<string, function<Result(int, double)>>>{
+          {"std::mutex", RunMix<ExclusiveAdapter<std::mutex>>},
+          {"simple_spinlock", RunMix<ExclusiveAdapter<simple_spinlock>>},
+          {"rw_spinlock", RunMix<SharedAdapter<rw_spinlock>>},
+          {"percpu_rwlock", RunMix<PercpuAdapter>},
+          {"RWMutex", RunMix<SharedAdapter<RWMutex>>},
+          {"rw_semaphore", RunMix<SharedAdapter<rw_semaphore>>},
+          {"RWCLock", RunMix<SharedAdapter<RWCLock>>},
+          {"MutexDebouncer", RunMix<DebouncerAdapter>},
+      };
+  return *primitives;
 }
 
-void shared_mutex_entry(SharedData* shared) {
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    shared->lock.lock();
-    result += workload(result);
-    shared->lock.unlock();
+bool ParseInts(const string& flag, const string& value, vector<int>* out) {
+  const vector<string> values =
+      strings::Split(value, ",", strings::SkipEmpty());
+  for (const string& v : values) {
+    int32_t n;
+    if (!safe_strto32(v, &n) || n <= 0) {
+      std::cerr << "bad value of --" << flag << ": " << v << std::endl;
+      return false;
+    }
+    out->push_back(n);
   }
-  depend_on(result);
+  return true;
 }
 
-template <class LockType>
-void own_mutex_entry() {
-  LockType mylock;
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    mylock.lock();
-    result += workload(result);
-    mylock.unlock();
+bool ParseFractions(
+    const string& flag,
+    const string& value,
+    vector<double>* out) {
+  const vector<string> values =
+      strings::Split(value, ",", strings::SkipEmpty());
+  for (const string& v : values) {
+    double d;
+    if (!safe_strtod(v, &d) || d < 0 || d > 1) {
+      std::cerr << "bad value of --" << flag << ": " << v << std::endl;
+      return false;
+    }
+    out->push_back(d);
   }
-
-  depend_on(result);
+  return true;
 }
 
-void percpu_rwlock_entry(SharedData* shared) {
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    kudu::rw_spinlock& l = shared->per_cpu.get_lock();
-    l.lock_shared();
-    result += workload(result);
-    l.unlock_shared();
+int RunBench() {
+  vector<int> thread_counts;
+  vector<double> read_fractions;
+  if (!ParseInts("thread_counts", FLAGS_thread_counts, &thread_counts) ||
+      !ParseFractions(
+          "read_fractions", FLAGS_read_fractions, &read_fractions)) {
+    return 1;
   }
-
-  depend_on(result);
-}
-
-enum TestMethod {
-  SHARED_RWLOCK,
-  SHARED_MUTEX,
-  OWN_MUTEX,
-  OWN_SPINLOCK,
-  PERCPU_RWLOCK,
-  NO_LOCK,
-  RW_SPINLOCK
-};
-
-void test_shared_lock(int num_threads, TestMethod method, const char* name) {
-  vector<thread> threads;
-  SharedData shared;
-
-  for (int i = 0; i < num_threads; i++) {
-    switch (method) {
-      case SHARED_RWLOCK:
-        threads.emplace_back(shared_rwlock_entry, &shared);
-        break;
-      case SHARED_MUTEX:
-        threads.emplace_back(shared_mutex_entry, &shared);
-        break;
-      case OWN_MUTEX:
-        threads.emplace_back(own_mutex_entry<std::mutex>);
-        break;
-      case OWN_SPINLOCK:
-        threads.emplace_back(own_mutex_entry<my_spinlock>);
-        break;
-      case NO_LOCK:
-        threads.emplace_back(own_mutex_entry<NoopLock>);
-        break;
-      case PERCPU_RWLOCK:
-        threads.emplace_back(percpu_rwlock_entry, &shared);
-        break;
-      case RW_SPINLOCK:
-        threads.emplace_back(shared_rw_spinlock_entry, &shared);
-        break;
-      default:
-        CHECK(0) << "bad method: " << method;
+  std::set<string> selected;
+  const vector<string> names =
+      strings::Split(FLAGS_primitives, ",", strings::SkipEmpty());
+  for (const string& name : names) {
+    bool known = false;
+    for (const auto& p : Primitives()) {
+      known |= p.first == name;
+    }
+    if (!known) {
+      std::cerr << "unknown primitive: " << name << std::endl;
+      return 1;
     }
+    selected.insert(name);
   }
 
-  int64_t start = kudu::CycleClock::Now();
-  for (thread& thr : threads) {
-    thr.join();
+  printf(
+      "%-16s %7s %6s %12s %8s %6s\n",
+      "Primitive",
+      "Threads",
+      "Reads",
+      "Ops/s",
+      "ns/op",
+      "Ran");
+  printf("----------------------------------------------------------------\n");
+  // For each mix, the fastest of the primitives which run every op.
+  map<pair<int, double>, pair<string, double>> fastest;
+  for (int num_threads : thread_counts) {
+    for (double read_fraction : read_fractions) {
+      for (const auto& p : Primitives()) {
+        if (!selected.empty() && selected.count(p.first) == 0) {
+          continue;
+        }
+        const Result r = p.second(num_threads, read_fraction);
+        printf(
+            "%-16s %7d %5.1f%% %12.0f %8.1f %5.1f%%\n",
+            p.first.c_str(),
+            num_threads,
+            read_fraction * 100,
+            r.ops_per_sec,
+            num_threads * 1e9 / r.ops_per_sec,
+            r.ran_fraction * 100);
+        auto& best = fastest[{num_threads, read_fraction}];
+        if (r.ran_fraction == 1 && r.ops_per_sec > best.second) {
+          best = {p.first, r.ops_per_sec};
+        }
+      }
+    }
   }
-  int64_t end = kudu::CycleClock::Now();
 
-  printf(
-      "%13s  % 7d  %" PRId64 "M\n", name, num_threads, (end - start) / 1000000);
+  printf("\nFastest primitive for each mix:\n");
+  for (const auto& e : fastest) {
+    printf(
+        "  %2d threads, %5.1f%% reads: %s\n",
+        e.first.first,
+        e.first.second * 100,
+        e.second.first.c_str());
+  }
+  return 0;
 }
 
+} // anonymous namespace
+
+} // namespace kudu
+
 int main(int argc, char** argv) {
   kudu::ParseCommandLineFlags(&argc, &argv, true);
   if (argc != 1) {
@@ -225,17 +380,5 @@ int main(int argc, char** argv) {
     return 1;
   }
   kudu::InitGoogleLoggingSafe(argv[0]);
-
-  printf("        Test   Threads  Cycles\n");
-  printf("------------------------------\n");
-
-  for (int num_threads = 1; num_threads <= FLAGS_num_threads; num_threads++) {
-    test_shared_lock(num_threads, SHARED_RWLOCK, "shared_rwlock");
-    test_shared_lock(num_threads, SHARED_MUTEX, "shared_mutex");
-    test_shared_lock(num_threads, OWN_MUTEX, "own_mutex");
-    test_shared_lock(num_threads, OWN_SPINLOCK, "own_spinlock");
-    test_shared_lock(num_threads, NO_LOCK, "no_lock");
-    test_shared_lock(num_threads, PERCPU_RWLOCK, "percpu_rwlock");
-    test_shared_lock(num_threads, RW_SPINLOCK, "rw_spinlock");
-  }
+  return kudu::RunBench();
 }
@@ -0,0 +1,111 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/dir_health.h"
+
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "kudu/fs/error_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/util/atomic.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(fs_dir_degraded_p99_latency_ms);
+DECLARE_int32(fs_dir_health_window_ms);
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace fs {
+
+static void RecordNotification(
+    AtomicInt<int>* count,
+    string* last_dir,
+    const string& dir) {
+  *last_dir = dir;
+  count->Increment();
+}
+
+class DirHealthTrackerTest : public KuduTest {
+ protected:
+  DirHealthTrackerTest() : tracker_(&registry_, &error_manager_) {}
+
+  // Records 'count' samples of 'latency_ms' in 'dir', and closes the window.
+  void RecordWindow(const string& dir, int count, int latency_ms) {
+    for (int i = 0; i < count; i++) {
+      tracker_.RecordLatency(
+          dir, MonoDelta::FromMilliseconds(latency_ms), now_);
+    }
+    now_ += MonoDelta::FromMilliseconds(FLAGS_fs_dir_health_window_ms);
+    // Closes the window with a sample for the next one.
+    tracker_.RecordLatency(dir, MonoDelta::FromMilliseconds(0), now_);
+  }
+
+  MetricRegistry registry_;
+  FsErrorManager error_manager_;
+  DirHealthTracker tracker_;
+  MonoTime now_ = MonoTime::Now();
+};
+
+TEST_F(DirHealthTrackerTest, TestDegradedDir) {
+  FLAGS_fs_dir_degraded_p99_latency_ms = 100;
+  AtomicInt<int> notifications(0);
+  string notified_dir;
+  error_manager_.SetErrorNotificationCb(
+      ErrorHandlerType::DEGRADED_DIR,
+      Bind(&RecordNotification, &notifications, &notified_dir));
+
+  // Healthy windows, and windows too small to judge, don't mark the
+  // directory degraded.
+  RecordWindow("/fast", 100, 1);
+  RecordWindow("/slow", 100, 1);
+  RecordWindow("/slow", 5, 500);
+  ASSERT_FALSE(tracker_.IsDegraded("/slow"));
+
+  RecordWindow("/slow", 100, 500);
+  ASSERT_TRUE(tracker_.IsDegraded("/slow"));
+  ASSERT_FALSE(tracker_.IsDegraded("/fast"));
+  ASSERT_EQ(vector<string>({"/slow"}), tracker_.DegradedDirs());
+  ASSERT_EVENTUALLY([&]() { ASSERT_EQ(1, notifications.Load()); });
+  error_manager_.UnsetErrorNotificationCb(ErrorHandlerType::DEGRADED_DIR);
+  ASSERT_EQ("/slow", notified_dir);
+
+  // Staying degraded doesn't notify again, and a healthy window clears it.
+  RecordWindow("/slow", 100, 500);
+  ASSERT_TRUE(tracker_.IsDegraded("/slow"));
+  RecordWindow("/slow", 100, 1);
+  ASSERT_FALSE(tracker_.IsDegraded("/slow"));
+  ASSERT_TRUE(tracker_.DegradedDirs().empty());
+  ASSERT_EQ(1, notifications.Load());
+}
+
+TEST_F(DirHealthTrackerTest, TestDisabledCheck) {
+  FLAGS_fs_dir_degraded_p99_latency_ms = 0;
+  RecordWindow("/slow", 100, 500);
+  ASSERT_FALSE(tracker_.IsDegraded("/slow"));
+}
+
+} // namespace fs
+} // namespace kudu
@@ -0,0 +1,256 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/dir_health.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/fs/error_manager.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(
+    fs_dir_degraded_p99_latency_ms,
+    0,
+    "A directory whose p99 I/O latency over a window of "
+    "--fs_dir_health_window_ms exceeds this is marked degraded, e.g. so that "
+    "leadership of the rings whose WAL lives there can be moved away. 0 "
+    "disables the check; latencies are still published.");
+TAG_FLAG(fs_dir_degraded_p99_latency_ms, experimental);
+TAG_FLAG(fs_dir_degraded_p99_latency_ms, runtime);
+
+DEFINE_int32(
+    fs_dir_health_window_ms,
+    10000,
+    "Length of the windows over which the I/O latency of each directory is "
+    "aggregated to decide whether it is degraded.");
+TAG_FLAG(fs_dir_health_window_ms, experimental);
+TAG_FLAG(fs_dir_health_window_ms, runtime);
+
+static bool ValidateDirHealthWindow(const char* flagname, int32_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(fs_dir_health_window_ms, &ValidateDirHealthWindow);
+
+METRIC_DEFINE_entity(fs_dir);
+
+METRIC_DEFINE_histogram(
+    fs_dir,
+    fs_dir_io_latency,
+    "Directory I/O Latency",
+    kudu::MetricUnit::kMicroseconds,
+    "Microseconds spent in the I/O tracked for the directory, e.g. syncs of "
+    "the WAL segments in it.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_gauge_int64(
+    fs_dir,
+    fs_dir_io_latency_p99_us,
+    "Directory I/O Latency p99",
+    kudu::MetricUnit::kMicroseconds,
+    "p99 I/O latency of the directory over the last complete window of "
+    "--fs_dir_health_window_ms.");
+
+METRIC_DEFINE_gauge_int64(
+    fs_dir,
+    fs_dir_degraded,
+    "Directory Degraded",
+    kudu::MetricUnit::kState,
+    "1 if the p99 I/O latency of the directory over the last complete "
+    "window exceeded --fs_dir_degraded_p99_latency_ms, else 0.");
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+namespace {
+
+// Windows with fewer samples than this say too little about the tail to
+// change whether a directory is degraded.
+constexpr int kMinSamplesPerWindow = 20;
+
+} // anonymous namespace
+
+struct DirHealthTracker::DirState {
+  explicit DirState(MonoTime now)
+      : window(60000000LU, 2), window_start(now) {}
+
+  simple_spinlock lock;
+  HdrHistogram window;
+  MonoTime window_start;
+  bool degraded = false;
+
+  scoped_refptr<MetricEntity> entity;
+  scoped_refptr<Histogram> latency;
+  scoped_refptr<AtomicGauge<int64_t>> p99_us;
+  scoped_refptr<AtomicGauge<int64_t>> degraded_gauge;
+};
+
+DirHealthTracker::DirHealthTracker(
+    MetricRegistry* registry,
+    FsErrorManager* error_manager)
+    : registry_(registry), error_manager_(DCHECK_NOTNULL(error_manager)) {
+  CHECK_OK(ThreadPoolBuilder("dir-health")
+               .set_max_threads(1)
+               .Build(&notify_pool_));
+}
+
+DirHealthTracker::~DirHealthTracker() {
+  notify_pool_->Shutdown();
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& entry : dirs_) {
+    if (entry.second->entity) {
+      entry.second->entity->Unpublish();
+    }
+  }
+}
+
+DirHealthTracker::DirState* DirHealthTracker::GetOrCreateState(
+    const string& dir,
+    MonoTime now) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto it = dirs_.find(dir);
+  if (it != dirs_.end()) {
+    return it->second.get();
+  }
+  unique_ptr<DirState> state(new DirState(now));
+  if (registry_) {
+    // One per directory, so its path identifies it.
+    state->entity = METRIC_ENTITY_fs_dir.Instantiate(
+        registry_, Substitute("fs_dir:$0", dir), {{"path", dir}});
+    state->latency = METRIC_fs_dir_io_latency.Instantiate(state->entity);
+    state->p99_us =
+        METRIC_fs_dir_io_latency_p99_us.Instantiate(state->entity, 0);
+    state->degraded_gauge =
+        METRIC_fs_dir_degraded.Instantiate(state->entity, 0);
+  }
+  DirState* ret = state.get();
+  dirs_.emplace(dir, std::move(state));
+  return ret;
+}
+
+void DirHealthTracker::RecordLatency(
+    const string& dir,
+    MonoDelta latency,
+    MonoTime now) {
+  DirState* state = GetOrCreateState(dir, now);
+  const int64_t latency_us = std::max<int64_t>(0, latency.ToMicroseconds());
+  if (state->latency) {
+    state->latency->Increment(latency_us);
+  }
+  bool became_degraded;
+  {
+    std::lock_guard<simple_spinlock> l(state->lock);
+    became_degraded = MaybeRollUnlocked(dir, state, now);
+    state->window.Increment(
+        std::min<int64_t>(latency_us, state->window.highest_trackable_value()));
+  }
+  if (became_degraded) {
+    Status s = notify_pool_->SubmitFunc([this, dir]() {
+      error_manager_->RunErrorNotificationCb(
+          ErrorHandlerType::DEGRADED_DIR, dir);
+    });
+    WARN_NOT_OK(s, "Could not notify of degraded directory " + dir);
+  }
+}
+
+bool DirHealthTracker::MaybeRollUnlocked(
+    const string& dir,
+    DirState* state,
+    MonoTime now) {
+  if ((now - state->window_start).ToMilliseconds() <
+      FLAGS_fs_dir_health_window_ms) {
+    return false;
+  }
+  const int64_t samples = state->window.TotalCount();
+  const int64_t p99_us = samples > 0 ? state->window.ValueAtPercentile(99) : 0;
+  state->window.ResetHistogram();
+  state->window_start = now;
+  if (state->p99_us) {
+    state->p99_us->set_value(p99_us);
+  }
+  if (samples < kMinSamplesPerWindow) {
+    return false;
+  }
+
+  const int64_t threshold_ms = FLAGS_fs_dir_degraded_p99_latency_ms;
+  const bool degraded = threshold_ms > 0 && p99_us > threshold_ms * 1000;
+  const bool was_degraded = state->degraded;
+  state->degraded = degraded;
+  if (state->degraded_gauge) {
+    state->degraded_gauge->set_value(degraded ? 1 : 0);
+  }
+  if (degraded && !was_degraded) {
+    LOG(WARNING) << Substitute(
+        "Directory $0 is degraded: p99 I/O latency of $1 us over the last "
+        "$2 samples",
+        dir,
+        p99_us,
+        samples);
+  } else if (!degraded && was_degraded) {
+    LOG(INFO) << Substitute(
+        "Directory $0 is no longer degraded: p99 I/O latency of $1 us",
+        dir,
+        p99_us);
+  }
+  return degraded && !was_degraded;
+}
+
+bool DirHealthTracker::IsDegraded(const string& dir) const {
+  DirState* state;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end()) {
+      return false;
+    }
+    state = it->second.get();
+  }
+  std::lock_guard<simple_spinlock> l(state->lock);
+  return state->degraded;
+}
+
+vector<string> DirHealthTracker::DegradedDirs() const {
+  vector<string> ret;
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& entry : dirs_) {
+    std::lock_guard<simple_spinlock> state_lock(entry.second->lock);
+    if (entry.second->degraded) {
+      ret.emplace_back(entry.first);
+    }
+  }
+  return ret;
+}
+
+} // namespace fs
+} // namespace kudu
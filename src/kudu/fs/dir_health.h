@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+
+class HdrHistogram;
+class ThreadPool;
+
+namespace fs {
+
+class FsErrorManager;
+
+// The latency health of the directories I/O is done in, e.g. the WAL
+// directories, so that a disk that is slow, but hasn't failed, can be told
+// apart from the others.
+//
+// The latencies of each directory are aggregated over tumbling windows of
+// --fs_dir_health_window_ms. A directory whose p99 latency over a window
+// exceeds --fs_dir_degraded_p99_latency_ms is marked degraded until a later
+// window is back under it. The DEGRADED_DIR error notification callback runs,
+// on a thread of the tracker's own, with the directory's path when the
+// directory becomes degraded. The latencies, and whether the directory is
+// degraded, are published on an 'fs_dir' metric entity per directory.
+//
+// Thread-safe.
+class DirHealthTracker {
+ public:
+  // 'registry' may be null, in which case nothing is published.
+  // 'error_manager' must outlive the tracker.
+  DirHealthTracker(MetricRegistry* registry, FsErrorManager* error_manager);
+  ~DirHealthTracker();
+
+  // Records that I/O in 'dir' took 'latency', as of 'now'.
+  void RecordLatency(
+      const std::string& dir,
+      MonoDelta latency,
+      MonoTime now = MonoTime::Now());
+
+  // Whether the last complete window of 'dir' was degraded.
+  bool IsDegraded(const std::string& dir) const;
+
+  // The directories whose last complete window was degraded.
+  std::vector<std::string> DegradedDirs() const;
+
+ private:
+  struct DirState;
+
+  // Returns the state of 'dir', creating it with a window starting at 'now'
+  // if needed.
+  DirState* GetOrCreateState(const std::string& dir, MonoTime now);
+
+  // Closes the current window of 'dir' if it is over. Returns true if that
+  // made the directory degraded. 'state->lock' must be held.
+  bool MaybeRollUnlocked(
+      const std::string& dir,
+      DirState* state,
+      MonoTime now);
+
+  MetricRegistry* const registry_;
+  FsErrorManager* const error_manager_;
+
+  // Runs the error notification callbacks.
+  std::unique_ptr<ThreadPool> notify_pool_;
+
+  // Protects 'dirs_' itself; each state has its own lock.
+  mutable simple_spinlock lock_;
+  std::unordered_map<std::string, std::unique_ptr<DirState>> dirs_;
+
+  DISALLOW_COPY_AND_ASSIGN(DirHealthTracker);
+};
+
+} // namespace fs
+} // namespace kudu
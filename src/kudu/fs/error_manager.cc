@@ -45,6 +45,10 @@ FsErrorManager::FsErrorManager() {
       &callbacks_,
       ErrorHandlerType::CFILE_CORRUPTION,
       Bind(DoNothingErrorNotification));
+  InsertOrDie(
+      &callbacks_,
+      ErrorHandlerType::DEGRADED_DIR,
+      Bind(DoNothingErrorNotification));
 }
 
 void FsErrorManager::SetErrorNotificationCb(
@@ -120,6 +120,11 @@ enum ErrorHandlerType {
 
   // For CFile corruptions.
   CFILE_CORRUPTION,
+
+  // For directories whose I/O latency is degraded, though they haven't
+  // failed. The callback takes the path of the directory rather than a UUID.
+  // See DirHealthTracker.
+  DEGRADED_DIR,
 };
 
 // When certain operations fail, the side effects of the error can span multiple
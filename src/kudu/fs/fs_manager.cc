@@ -31,11 +31,13 @@
 #include "kudu/fs/block_id.h"
 #include "kudu/fs/block_manager.h"
 #include "kudu/fs/data_dirs.h"
+#include "kudu/fs/dir_health.h"
 #include "kudu/fs/error_manager.h"
 #include "kudu/fs/file_block_manager.h"
 #include "kudu/fs/fs.pb.h"
 #include "kudu/fs/fs_report.h"
 #include "kudu/fs/log_block_manager.h"
+#include "kudu/fs/metadata_journal.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/map-util.h"
@@ -66,6 +68,15 @@ DEFINE_bool(
     "Disabling this flag may cause data loss in the event of a system crash.");
 TAG_FLAG(enable_data_block_fsync, unsafe);
 
+DEFINE_bool(
+    metadata_journal,
+    false,
+    "Whether consensus metadata, persistent vars and routing table updates are "
+    "made durable through a shared journal, so that concurrent updates of "
+    "many rings share fsyncs, instead of by syncing each file. A journal left "
+    "behind is replayed at startup either way.");
+TAG_FLAG(metadata_journal, experimental);
+
 #if defined(__linux__)
 DEFINE_string(
     block_manager,
@@ -115,6 +126,25 @@ DEFINE_string(
     "metadata directory if any exists. If none exists, fs_wal_dir "
     "will be used as the metadata directory.");
 TAG_FLAG(fs_metadata_dir, stable);
+DEFINE_string(
+    fs_wal_stripe_dirs,
+    "",
+    "Comma-separated list of additional directories across which write-ahead "
+    "log segments are striped, round-robin by segment sequence number, "
+    "together with fs_wal_dir. Each directory should live on a separate "
+    "device. Directories may be added to the list later, but must not be "
+    "removed while any tablet still has segments in them. If empty, all "
+    "segments are written to fs_wal_dir.");
+TAG_FLAG(fs_wal_stripe_dirs, experimental);
+DEFINE_string(
+    fs_wal_archive_dir,
+    "",
+    "Directory, typically on a larger and cheaper device than fs_wal_dir, "
+    "to which closed write-ahead log segments are moved once they are only "
+    "retained for lagging peers. Segments in it are still read as part of "
+    "the log. If empty, segments stay where they were written until they "
+    "are garbage-collected.");
+TAG_FLAG(fs_wal_archive_dir, experimental);
 
 using kudu::fs::BlockManagerOptions;
 using kudu::fs::ConsistencyCheckBehavior;
@@ -151,6 +181,7 @@ const char* FsManager::kDataDirName = "data";
 const char* FsManager::kCorruptedSuffix = ".corrupted";
 const char* FsManager::kInstanceMetadataFileName = "instance";
 const char* FsManager::kConsensusMetadataDirName = "consensus-meta";
+const char* FsManager::kMetadataJournalFileName = "consensus-meta-journal";
 
 FsManagerOpts::FsManagerOpts()
     : wal_root(FLAGS_fs_wal_dir),
@@ -159,6 +190,9 @@ FsManagerOpts::FsManagerOpts()
       read_only(false),
       consistency_check(ConsistencyCheckBehavior::ENFORCE_CONSISTENCY) {
   data_roots = strings::Split(FLAGS_fs_data_dirs, ",", strings::SkipEmpty());
+  wal_stripe_roots =
+      strings::Split(FLAGS_fs_wal_stripe_dirs, ",", strings::SkipEmpty());
+  wal_archive_root = FLAGS_fs_wal_archive_dir;
 }
 
 FsManagerOpts::FsManagerOpts(const string& root)
@@ -210,6 +244,11 @@ Status FsManager::Init() {
   // Deduplicate all of the roots.
   unordered_set<string> all_roots = {opts_.wal_root};
   all_roots.insert(opts_.data_roots.begin(), opts_.data_roots.end());
+  all_roots.insert(
+      opts_.wal_stripe_roots.begin(), opts_.wal_stripe_roots.end());
+  if (!opts_.wal_archive_root.empty()) {
+    all_roots.insert(opts_.wal_archive_root);
+  }
 
   // If the metadata root not set, Kudu will either use the wal root or the
   // first data root, in which case we needn't canonicalize additional roots.
@@ -274,6 +313,38 @@ Status FsManager::Init() {
     canonicalized_all_fs_roots_.emplace_back(canonicalized_wal_fs_root_);
   }
 
+  // WAL stripe roots hold nothing but WAL segments, so they are tracked
+  // separately from the instance-bearing roots above. The primary WAL root is
+  // always stripe 0.
+  unordered_set<string> unique_stripe_roots = {canonicalized_wal_fs_root_.path};
+  for (const string& stripe_root : opts_.wal_stripe_roots) {
+    const auto& root = FindOrDie(canonicalized_roots, stripe_root);
+    RETURN_NOT_OK_PREPEND(
+        root.status,
+        Substitute(
+            "Write-ahead log stripe directory $0 failed to canonicalize",
+            root.path));
+    if (InsertIfNotPresent(&unique_stripe_roots, root.path)) {
+      canonicalized_wal_stripe_roots_.emplace_back(root);
+    }
+  }
+  if (!opts_.wal_archive_root.empty()) {
+    canonicalized_wal_archive_root_ =
+        FindOrDie(canonicalized_roots, opts_.wal_archive_root);
+    RETURN_NOT_OK_PREPEND(
+        canonicalized_wal_archive_root_.status,
+        Substitute(
+            "Write-ahead log archive directory $0 failed to canonicalize",
+            canonicalized_wal_archive_root_.path));
+    const string& archive_root = canonicalized_wal_archive_root_.path;
+    if (ContainsKey(unique_stripe_roots, archive_root)) {
+      return Status::InvalidArgument(Substitute(
+          "Write-ahead log archive directory $0 is also a write-ahead log "
+          "directory",
+          archive_root));
+    }
+  }
+
   // Decide on a metadata root to use.
   if (opts_.metadata_root.empty()) {
     // Check the first data root for metadata.
@@ -314,6 +385,11 @@ Status FsManager::Init() {
 
   if (VLOG_IS_ON(1)) {
     VLOG(1) << "WAL root: " << canonicalized_wal_fs_root_.path;
+    VLOG(1) << "WAL stripe roots: "
+            << JoinStrings(
+                   DataDirManager::GetRootNames(canonicalized_wal_stripe_roots_),
+                   ",");
+    VLOG(1) << "WAL archive root: " << canonicalized_wal_archive_root_.path;
     VLOG(1) << "Metadata root: " << canonicalized_metadata_fs_root_.path;
     VLOG(1) << "Data roots: "
             << JoinStrings(
@@ -422,6 +498,28 @@ Status FsManager::Open(FsReport* report) {
         "unable to create missing filesystem roots");
   }
 
+  // WAL stripe roots, and the WAL archive root, may have been added since
+  // the filesystem was created; they hold no instance metadata, so just make
+  // sure their WAL directories exist.
+  if (!opts_.read_only) {
+    CanonicalizedRootsList wal_roots = canonicalized_wal_stripe_roots_;
+    if (!canonicalized_wal_archive_root_.path.empty()) {
+      wal_roots.emplace_back(canonicalized_wal_archive_root_);
+    }
+    for (const auto& root : wal_roots) {
+      for (const string& dir :
+           {root.path, JoinPathSegments(root.path, kWalDirName)}) {
+        bool created;
+        RETURN_NOT_OK_PREPEND(
+            env_util::CreateDirIfMissing(env_, dir, &created),
+            Substitute("Unable to create directory $0", dir));
+        if (created) {
+          created_dirs.emplace_back(dir);
+        }
+      }
+    }
+  }
+
   // Open the directory manager if it has not been opened already.
   if (!dd_manager_) {
     DataDirManagerOptions dm_opts;
@@ -444,8 +542,22 @@ Status FsManager::Open(FsReport* report) {
   if (!opts_.read_only) {
     CleanTmpFiles();
     CheckAndFixPermissions();
+
+    // Replay a journal left behind even if it's off now, before anything
+    // reads the files it covers.
+    if (FLAGS_metadata_journal) {
+      RETURN_NOT_OK(fs::MetadataJournal::Open(
+          env_, GetMetadataJournalPath(), &metadata_journal_));
+    } else {
+      RETURN_NOT_OK(
+          fs::MetadataJournal::Replay(env_, GetMetadataJournalPath()));
+    }
   }
 
+  dir_health_tracker_.reset(new fs::DirHealthTracker(
+      opts_.metric_entity ? opts_.metric_entity->registry() : nullptr,
+      error_manager_.get()));
+
   // Set an initial error handler to mark data directories as failed.
   error_manager_->SetErrorNotificationCb(
       ErrorHandlerType::DISK_ERROR,
@@ -529,6 +641,15 @@ Status FsManager::CreateInitialFileSystemLayout(boost::optional<string> uuid) {
   // Create ancillary directories.
   vector<string> ancillary_dirs = {
       GetWalsRootDir(), GetTabletMetadataDir(), GetConsensusMetadataDir()};
+  for (const auto& root : canonicalized_wal_stripe_roots_) {
+    ancillary_dirs.emplace_back(root.path);
+    ancillary_dirs.emplace_back(JoinPathSegments(root.path, kWalDirName));
+  }
+  if (!canonicalized_wal_archive_root_.path.empty()) {
+    const string& root = canonicalized_wal_archive_root_.path;
+    ancillary_dirs.emplace_back(root);
+    ancillary_dirs.emplace_back(JoinPathSegments(root, kWalDirName));
+  }
   for (const string& dir : ancillary_dirs) {
     bool created;
     RETURN_NOT_OK_PREPEND(
@@ -734,11 +855,60 @@ string FsManager::GetTabletWalRecoveryDir(const string& tablet_id) const {
   return path;
 }
 
+vector<string> FsManager::GetWalStripeRootDirs() const {
+  DCHECK(initted_);
+  vector<string> dirs = {GetWalsRootDir()};
+  for (const auto& root : canonicalized_wal_stripe_roots_) {
+    dirs.emplace_back(JoinPathSegments(root.path, kWalDirName));
+  }
+  if (!canonicalized_wal_archive_root_.path.empty()) {
+    dirs.emplace_back(
+        JoinPathSegments(canonicalized_wal_archive_root_.path, kWalDirName));
+  }
+  return dirs;
+}
+
+vector<string> FsManager::GetTabletWalStripeDirs(
+    const string& tablet_id) const {
+  vector<string> dirs = GetWalStripeRootDirs();
+  for (auto& dir : dirs) {
+    dir = JoinPathSegments(dir, tablet_id);
+  }
+  return dirs;
+}
+
+string FsManager::GetTabletWalArchiveDir(const string& tablet_id) const {
+  DCHECK(initted_);
+  if (canonicalized_wal_archive_root_.path.empty()) {
+    return "";
+  }
+  return JoinPathSegments(
+      JoinPathSegments(canonicalized_wal_archive_root_.path, kWalDirName),
+      tablet_id);
+}
+
+string FsManager::GetTabletWalStripeDir(
+    const string& tablet_id,
+    uint64_t sequence_number) const {
+  if (canonicalized_wal_stripe_roots_.empty()) {
+    return GetTabletWalDir(tablet_id);
+  }
+  size_t num_stripes = canonicalized_wal_stripe_roots_.size() + 1;
+  size_t stripe = sequence_number % num_stripes;
+  if (stripe == 0) {
+    return GetTabletWalDir(tablet_id);
+  }
+  return JoinPathSegments(
+      JoinPathSegments(
+          canonicalized_wal_stripe_roots_[stripe - 1].path, kWalDirName),
+      tablet_id);
+}
+
 string FsManager::GetWalSegmentFileName(
     const string& tablet_id,
     uint64_t sequence_number) const {
   return JoinPathSegments(
-      GetTabletWalDir(tablet_id),
+      GetTabletWalStripeDir(tablet_id, sequence_number),
       strings::Substitute(
           "$0-$1",
           kWalFileNamePrefix,
@@ -749,8 +919,10 @@ void FsManager::CleanTmpFiles() {
   DCHECK(!opts_.read_only);
   // Temporary files in the Block Manager directories are cleaned during
   // Block Manager startup.
-  for (const auto& s :
-       {GetWalsRootDir(), GetTabletMetadataDir(), GetConsensusMetadataDir()}) {
+  vector<string> dirs = GetWalStripeRootDirs();
+  dirs.emplace_back(GetTabletMetadataDir());
+  dirs.emplace_back(GetConsensusMetadataDir());
+  for (const auto& s : dirs) {
     WARN_NOT_OK(
         env_util::DeleteTmpFilesRecursively(env_, s),
         Substitute("Error deleting tmp files in $0", s));
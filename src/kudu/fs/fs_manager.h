@@ -49,6 +49,8 @@ class MemTracker;
 namespace fs {
 
 class BlockManager;
+class DirHealthTracker;
+class MetadataJournal;
 class ReadableBlock;
 class WritableBlock;
 struct CreateBlockOptions;
@@ -114,6 +116,18 @@ struct FsManagerOpts {
   // Defaults to ENFORCE_CONSISTENCY.
   fs::ConsistencyCheckBehavior consistency_check;
 
+  // Additional directory roots across which WAL segments are striped, in
+  // addition to 'wal_root'. If empty, all segments live under 'wal_root'.
+  //
+  // Defaults to the value of FLAGS_fs_wal_stripe_dirs.
+  std::vector<std::string> wal_stripe_roots;
+
+  // The root to which closed WAL segments that are only retained for lagging
+  // peers are moved. If empty, segments are never moved.
+  //
+  // Defaults to the value of FLAGS_fs_wal_archive_dir.
+  std::string wal_archive_root;
+
   // Allow non empty root directory; default is false
   bool allow_non_empty_root = false;
 };
@@ -213,6 +227,27 @@ class FsManager {
     return JoinPathSegments(GetWalsRootDir(), tablet_id);
   }
 
+  // Return the WAL directories of every stripe, starting with
+  // GetWalsRootDir(), followed by the WAL archive directory, if any. Has
+  // exactly one entry unless WAL striping or archiving is enabled.
+  std::vector<std::string> GetWalStripeRootDirs() const;
+
+  // Return the tablet's WAL directory in every stripe, starting with
+  // GetTabletWalDir(), and in the WAL archive. The log index always lives in
+  // the first one.
+  std::vector<std::string> GetTabletWalStripeDirs(
+      const std::string& tablet_id) const;
+
+  // Return the tablet's WAL directory in the WAL archive, or an empty string
+  // if WAL archiving is disabled.
+  std::string GetTabletWalArchiveDir(const std::string& tablet_id) const;
+
+  // Return the tablet's WAL directory of the stripe that holds the segment
+  // with sequence number 'sequence_number'.
+  std::string GetTabletWalStripeDir(
+      const std::string& tablet_id,
+      uint64_t sequence_number) const;
+
   std::string GetTabletWalRecoveryDir(const std::string& tablet_id) const;
 
   std::string GetWalSegmentFileName(
@@ -254,6 +289,26 @@ class FsManager {
         GetConsensusMetadataDir(), tablet_id + ".persistent_vars");
   }
 
+  // Return the path of the journal that metadata files in the consensus
+  // metadata directory may be written through.
+  std::string GetMetadataJournalPath() const {
+    DCHECK(initted_);
+    return JoinPathSegments(
+        canonicalized_metadata_fs_root_.path, kMetadataJournalFileName);
+  }
+
+  // The journal to write consensus metadata files through, or null if
+  // --metadata_journal is off or the FsManager is read-only.
+  fs::MetadataJournal* metadata_journal() const {
+    return metadata_journal_.get();
+  }
+
+  // Tracks the I/O latency of the WAL directories. Null until the FsManager
+  // is opened.
+  fs::DirHealthTracker* dir_health_tracker() const {
+    return dir_health_tracker_.get();
+  }
+
   Env* env() {
     return env_;
   }
@@ -353,6 +408,7 @@ class FsManager {
   static const char* kInstanceMetadataMagicNumber;
   static const char* kTabletSuperBlockMagicNumber;
   static const char* kConsensusMetadataDirName;
+  static const char* kMetadataJournalFileName;
 
   // The environment to be used for all filesystem operations.
   Env* env_;
@@ -366,6 +422,9 @@ class FsManager {
   // - The first data root is used as the metadata root.
   // - Common roots in the collections have been deduplicated.
   CanonicalizedRootAndStatus canonicalized_wal_fs_root_;
+  CanonicalizedRootsList canonicalized_wal_stripe_roots_;
+  // Has an empty path if WAL archiving is disabled.
+  CanonicalizedRootAndStatus canonicalized_wal_archive_root_;
   CanonicalizedRootAndStatus canonicalized_metadata_fs_root_;
   CanonicalizedRootsList canonicalized_data_fs_roots_;
   CanonicalizedRootsList canonicalized_all_fs_roots_;
@@ -375,6 +434,8 @@ class FsManager {
   std::unique_ptr<fs::FsErrorManager> error_manager_;
   std::unique_ptr<fs::DataDirManager> dd_manager_;
   std::unique_ptr<fs::BlockManager> block_manager_;
+  std::unique_ptr<fs::MetadataJournal> metadata_journal_;
+  std::unique_ptr<fs::DirHealthTracker> dir_health_tracker_;
 
   ObjectIdGenerator oid_generator_;
 
@@ -0,0 +1,139 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/metadata_journal.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "kudu/fs/fs.pb.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/env.h"
+#include "kudu/util/pb_util.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int64(metadata_journal_checkpoint_bytes);
+
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+class MetadataJournalTest : public KuduTest {
+ protected:
+  string JournalPath() {
+    return GetTestPath("journal");
+  }
+
+  string FilePath(int i) {
+    return GetTestPath(Substitute("file-$0", i));
+  }
+
+  // Any message will do as file contents.
+  static MetadataJournalRecordPB Contents(const string& value) {
+    MetadataJournalRecordPB pb;
+    pb.set_path(value);
+    pb.set_type_name(value);
+    pb.set_contents(value);
+    return pb;
+  }
+
+  void CheckContents(const string& path, const string& value) {
+    MetadataJournalRecordPB pb;
+    ASSERT_OK(pb_util::ReadPBContainerFromPath(env_, path, &pb));
+    ASSERT_EQ(value, pb.contents());
+  }
+};
+
+TEST_F(MetadataJournalTest, TestConcurrentWritesShareSyncs) {
+  constexpr int kThreads = 8;
+  constexpr int kWritesPerThread = 20;
+  unique_ptr<MetadataJournal> journal;
+  ASSERT_OK(MetadataJournal::Open(env_, JournalPath(), &journal));
+
+  vector<thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kWritesPerThread; i++) {
+        CHECK_OK(journal->Write(
+            FilePath(t), Contents(Substitute("$0-$1", t, i))));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (int t = 0; t < kThreads; t++) {
+    NO_FATALS(CheckContents(
+        FilePath(t), Substitute("$0-$1", t, kWritesPerThread - 1)));
+  }
+  ASSERT_GT(journal->num_syncs(), 0);
+  ASSERT_LE(journal->num_syncs(), kThreads * kWritesPerThread);
+  LOG(INFO) << journal->num_syncs() << " syncs for "
+            << kThreads * kWritesPerThread << " writes";
+}
+
+TEST_F(MetadataJournalTest, TestReplay) {
+  unique_ptr<MetadataJournal> journal;
+  ASSERT_OK(MetadataJournal::Open(env_, JournalPath(), &journal));
+  ASSERT_OK(journal->Write(FilePath(0), Contents("a")));
+  ASSERT_OK(journal->Write(FilePath(1), Contents("b")));
+  ASSERT_OK(journal->Write(FilePath(0), Contents("c")));
+  journal.reset();
+
+  // Lose the files, as a crash could, since they weren't synced.
+  ASSERT_OK(env_->DeleteFile(FilePath(0)));
+  ASSERT_OK(env_->DeleteFile(FilePath(1)));
+
+  ASSERT_OK(MetadataJournal::Replay(env_, JournalPath()));
+  NO_FATALS(CheckContents(FilePath(0), "c"));
+  NO_FATALS(CheckContents(FilePath(1), "b"));
+  ASSERT_FALSE(env_->FileExists(JournalPath()));
+
+  // Nothing to replay.
+  ASSERT_OK(MetadataJournal::Replay(env_, JournalPath()));
+}
+
+TEST_F(MetadataJournalTest, TestCheckpoint) {
+  FLAGS_metadata_journal_checkpoint_bytes = 1;
+  unique_ptr<MetadataJournal> journal;
+  ASSERT_OK(MetadataJournal::Open(env_, JournalPath(), &journal));
+  ASSERT_OK(journal->Write(FilePath(0), Contents("a")));
+  // Checkpoints the first write before journaling this one.
+  ASSERT_OK(journal->Write(FilePath(1), Contents("b")));
+  journal.reset();
+
+  ASSERT_OK(env_->DeleteFile(FilePath(0)));
+  ASSERT_OK(env_->DeleteFile(FilePath(1)));
+  ASSERT_OK(MetadataJournal::Replay(env_, JournalPath()));
+  ASSERT_FALSE(env_->FileExists(FilePath(0)));
+  NO_FATALS(CheckContents(FilePath(1), "b"));
+}
+
+} // namespace fs
+} // namespace kudu
@@ -0,0 +1,242 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/fs/metadata_journal.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/env.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/pb_util.h"
+
+DEFINE_int64(
+    metadata_journal_checkpoint_bytes,
+    4 * 1024 * 1024,
+    "Size the metadata journal grows to before the files written through it "
+    "are synced on their own and it starts over. Bounds the work of replaying "
+    "it at startup.");
+TAG_FLAG(metadata_journal_checkpoint_bytes, experimental);
+TAG_FLAG(metadata_journal_checkpoint_bytes, runtime);
+
+using google::protobuf::Descriptor;
+using google::protobuf::DescriptorPool;
+using google::protobuf::Message;
+using google::protobuf::MessageFactory;
+using std::string;
+using std::unique_ptr;
+using strings::Substitute;
+
+namespace kudu {
+namespace fs {
+
+using pb_util::ReadablePBContainerFile;
+using pb_util::WritablePBContainerFile;
+
+namespace {
+
+// Writes the contents of the file in 'record' to its path.
+Status WriteRecord(
+    Env* env,
+    const MetadataJournalRecordPB& record,
+    pb_util::SyncMode sync) {
+  const Descriptor* descriptor =
+      DescriptorPool::generated_pool()->FindMessageTypeByName(
+          record.type_name());
+  if (descriptor == nullptr) {
+    return Status::Corruption(Substitute(
+        "unknown message type $0 for $1", record.type_name(), record.path()));
+  }
+  unique_ptr<Message> msg(
+      MessageFactory::generated_factory()->GetPrototype(descriptor)->New());
+  if (!msg->ParseFromString(record.contents())) {
+    return Status::Corruption(Substitute(
+        "could not parse $0 for $1", record.type_name(), record.path()));
+  }
+  return pb_util::WritePBContainerToPath(
+      env, record.path(), *msg, pb_util::OVERWRITE, sync);
+}
+
+} // anonymous namespace
+
+Status MetadataJournal::Open(
+    Env* env,
+    string path,
+    unique_ptr<MetadataJournal>* journal) {
+  RETURN_NOT_OK(Replay(env, path));
+  unique_ptr<MetadataJournal> ret(new MetadataJournal(env, std::move(path)));
+  RETURN_NOT_OK(ret->CreateJournal());
+  *journal = std::move(ret);
+  return Status::OK();
+}
+
+Status MetadataJournal::Replay(Env* env, const string& path) {
+  if (!env->FileExists(path)) {
+    return Status::OK();
+  }
+
+  // The latest record of each file.
+  std::map<string, MetadataJournalRecordPB> latest;
+  unique_ptr<RandomAccessFile> file;
+  RETURN_NOT_OK(env->NewRandomAccessFile(path, &file));
+  ReadablePBContainerFile reader(std::move(file));
+  Status s = reader.Open();
+  while (s.ok()) {
+    MetadataJournalRecordPB record;
+    s = reader.ReadNextPB(&record);
+    if (s.ok()) {
+      string record_path = record.path();
+      latest[record_path] = std::move(record);
+    }
+  }
+  // A record cut short, or torn, by a crash was never synced, so its writer
+  // never returned: replay up to it.
+  if (!s.IsEndOfFile()) {
+    if (!s.IsIncomplete() && !s.IsCorruption()) {
+      return s.CloneAndPrepend("Failed to read metadata journal " + path);
+    }
+    LOG(WARNING) << "Ignoring the tail of metadata journal " << path << ": "
+                 << s.ToString();
+  }
+  WARN_NOT_OK(reader.Close(), "Could not close metadata journal " + path);
+
+  for (const auto& entry : latest) {
+    RETURN_NOT_OK_PREPEND(
+        WriteRecord(env, entry.second, pb_util::SYNC),
+        "Failed to replay metadata journal " + path);
+  }
+  LOG(INFO) << Substitute(
+      "Replayed $0 files from metadata journal $1", latest.size(), path);
+  RETURN_NOT_OK(env->DeleteFile(path));
+  return env->SyncDir(DirName(path));
+}
+
+MetadataJournal::MetadataJournal(Env* env, string path)
+    : env_(env), path_(std::move(path)), cond_(&lock_) {}
+
+MetadataJournal::~MetadataJournal() {
+  if (file_) {
+    WARN_NOT_OK(file_->Close(), "Could not close metadata journal " + path_);
+  }
+}
+
+Status MetadataJournal::CreateJournal() {
+  if (file_) {
+    RETURN_NOT_OK(file_->Close());
+    file_.reset();
+  }
+  RWFileOptions opts;
+  opts.mode = Env::CREATE_IF_NON_EXISTING_TRUNCATE;
+  unique_ptr<RWFile> file;
+  RETURN_NOT_OK(env_->NewRWFile(opts, path_, &file));
+  std::shared_ptr<WritablePBContainerFile> container(
+      new WritablePBContainerFile(std::move(file)));
+  RETURN_NOT_OK(container->CreateNew(MetadataJournalRecordPB()));
+  RETURN_NOT_OK(container->Sync());
+  RETURN_NOT_OK(env_->SyncDir(DirName(path_)));
+  file_ = std::move(container);
+  return Status::OK();
+}
+
+Status MetadataJournal::Write(const string& path, const Message& msg) {
+  MetadataJournalRecordPB record;
+  record.set_path(path);
+  record.set_type_name(msg.GetDescriptor()->full_name());
+  if (!msg.SerializeToString(record.mutable_contents())) {
+    return Status::InvalidArgument(
+        "could not serialize " + msg.GetTypeName() + " for " + path);
+  }
+
+  MutexLock l(lock_);
+  if (journal_bytes_ >= FLAGS_metadata_journal_checkpoint_bytes) {
+    RETURN_NOT_OK_PREPEND(
+        CheckpointUnlocked(), "Failed to checkpoint metadata journal");
+  }
+  RETURN_NOT_OK_PREPEND(
+      file_->Append(record), "Failed to append to metadata journal");
+  journal_bytes_ += record.ByteSizeLong();
+  const int64_t seq = ++appended_seq_;
+  pending_[path] = std::move(record);
+
+  // Group commit: one writer syncs every record appended so far, while the
+  // others wait for it.
+  while (synced_seq_ < seq) {
+    if (syncing_) {
+      cond_.Wait();
+      continue;
+    }
+    syncing_ = true;
+    const int64_t target = appended_seq_;
+    std::shared_ptr<WritablePBContainerFile> file = file_;
+    l.Unlock();
+    Status s = file->Sync();
+    l.Lock();
+    syncing_ = false;
+    cond_.Broadcast();
+    RETURN_NOT_OK_PREPEND(s, "Failed to sync metadata journal");
+    num_syncs_++;
+    synced_seq_ = std::max(synced_seq_, target);
+  }
+  if (seq <= checkpointed_seq_) {
+    // A checkpoint already wrote, and synced, the file.
+    return Status::OK();
+  }
+
+  writes_in_flight_++;
+  l.Unlock();
+  Status s = pb_util::WritePBContainerToPath(
+      env_, path, msg, pb_util::OVERWRITE, pb_util::NO_SYNC);
+  l.Lock();
+  if (--writes_in_flight_ == 0) {
+    cond_.Broadcast();
+  }
+  return s;
+}
+
+Status MetadataJournal::CheckpointUnlocked() {
+  lock_.AssertAcquired();
+  while (syncing_ || writes_in_flight_ > 0) {
+    cond_.Wait();
+  }
+  for (const auto& entry : pending_) {
+    RETURN_NOT_OK(WriteRecord(env_, entry.second, pb_util::SYNC));
+  }
+  RETURN_NOT_OK(CreateJournal());
+  VLOG(1) << Substitute(
+      "Checkpointed $0 files of metadata journal $1", pending_.size(), path_);
+  pending_.clear();
+  journal_bytes_ = 0;
+  synced_seq_ = appended_seq_;
+  checkpointed_seq_ = appended_seq_;
+  return Status::OK();
+}
+
+int64_t MetadataJournal::num_syncs() const {
+  MutexLock l(lock_);
+  return num_syncs_;
+}
+
+} // namespace fs
+} // namespace kudu
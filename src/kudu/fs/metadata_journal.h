@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "kudu/fs/fs.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace google {
+namespace protobuf {
+class Message;
+} // namespace protobuf
+} // namespace google
+
+namespace kudu {
+
+class Env;
+
+namespace pb_util {
+class WritablePBContainerFile;
+} // namespace pb_util
+
+namespace fs {
+
+// A journal of the contents of small metadata files, e.g. the consensus
+// metadata of each ring, through which writers of many files share fsyncs.
+//
+// Write() makes the new contents of a file durable by appending them to the
+// journal and syncing the journal once for all the writers waiting on it,
+// and then writes the file itself without syncing it. Once the journal grows
+// past --metadata_journal_checkpoint_bytes, the files written since the last
+// checkpoint are rewritten and synced, and the journal starts over. After a
+// crash, Replay() writes out the latest contents the journal holds for each
+// file.
+//
+// Thread-safe. Writes of the same file must not be concurrent.
+class MetadataJournal {
+ public:
+  // Replays the journal at 'path', if any, and starts a new one there.
+  static Status Open(
+      Env* env,
+      std::string path,
+      std::unique_ptr<MetadataJournal>* journal);
+
+  // Writes, and syncs, the latest contents the journal at 'path' holds for
+  // each file, then deletes the journal. Does nothing if there is no journal.
+  static Status Replay(Env* env, const std::string& path);
+
+  ~MetadataJournal();
+
+  // Durably replaces the contents of the file at 'path' with 'msg', as
+  // pb_util::WritePBContainerToPath() with OVERWRITE and SYNC would.
+  Status Write(const std::string& path, const google::protobuf::Message& msg);
+
+  // The number of times the journal was synced.
+  int64_t num_syncs() const;
+
+ private:
+  MetadataJournal(Env* env, std::string path);
+
+  // Creates an empty journal at 'path_'.
+  Status CreateJournal();
+
+  // Makes every file in 'pending_' durable on its own, and starts a new
+  // journal. Waits for writes in flight to finish first, so that none
+  // renames an unsynced file over a checkpointed one. 'lock_' must be held.
+  Status CheckpointUnlocked();
+
+  Env* const env_;
+  const std::string path_;
+
+  mutable Mutex lock_;
+  // Broadcast whenever 'syncing_' or 'writes_in_flight_' drops.
+  ConditionVariable cond_;
+  std::shared_ptr<pb_util::WritablePBContainerFile> file_;
+  // The number of records appended to, and synced in, the journal, over all
+  // checkpoints.
+  int64_t appended_seq_ = 0;
+  int64_t synced_seq_ = 0;
+  // Records up to this one were made durable by a checkpoint.
+  int64_t checkpointed_seq_ = 0;
+  int64_t journal_bytes_ = 0;
+  bool syncing_ = false;
+  // Writes whose record is synced but whose file isn't written yet.
+  int writes_in_flight_ = 0;
+  int64_t num_syncs_ = 0;
+  // The latest record of each file written since the last checkpoint.
+  std::unordered_map<std::string, MetadataJournalRecordPB> pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(MetadataJournal);
+};
+
+} // namespace fs
+} // namespace kudu
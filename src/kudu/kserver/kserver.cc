@@ -37,6 +37,7 @@
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/status.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/threadpool.h"
 
 DEFINE_int32(
@@ -59,6 +60,28 @@ DEFINE_int32(
     raft_thread_pool_min_size,
     0,
     "Min threads in the raft thread pool");
+DEFINE_int32(
+    raft_peer_send_pool_size,
+    0,
+    "If positive, requests to remote peers are built and sent, and their "
+    "responses handled, on a dedicated pool of this many threads instead of "
+    "the raft thread pool. This keeps replication from queueing behind "
+    "elections, config changes and observer notifications.");
+TAG_FLAG(raft_peer_send_pool_size, experimental);
+DEFINE_string(
+    raft_thread_pool_cpus,
+    "",
+    "CPUs to bind the threads of the raft and raft peer send pools to, e.g. "
+    "\"0-7\". Empty leaves the threads unbound.");
+TAG_FLAG(raft_thread_pool_cpus, experimental);
+DEFINE_validator(raft_thread_pool_cpus, &kudu::ValidateCpuListFlag);
+DEFINE_bool(
+    raft_thread_pool_work_stealing,
+    false,
+    "Whether the raft thread pool gives each thread its own task queue and "
+    "lets idle threads steal from the others, instead of funneling every "
+    "task through one lock. Its threads then never time out.");
+TAG_FLAG(raft_thread_pool_work_stealing, experimental);
 
 static bool ValidateThreadPoolThreadLimit(
     const char* /*flagname*/,
@@ -74,6 +97,7 @@ DEFINE_validator(
     &ValidateThreadPoolThreadLimit);
 
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -189,17 +213,30 @@ Status KuduServer::Init() {
                     .set_max_threads(server_wide_pool_limit)
                     .Build(&tablet_prepare_pool_));
 #endif
+  vector<int> raft_cpus;
+  RETURN_NOT_OK(ParseCpuList(FLAGS_raft_thread_pool_cpus, &raft_cpus));
   RETURN_NOT_OK(
       ThreadPoolBuilder("raft")
           .set_trace_metric_prefix("raft")
+          .set_cpus(raft_cpus)
           .set_min_threads(FLAGS_raft_thread_pool_min_size)
           .set_max_threads(
               FLAGS_raft_thread_pool_max_size ? FLAGS_raft_thread_pool_max_size
                                               : server_wide_pool_limit)
           .set_idle_timeout(MonoDelta::FromSeconds(
               static_cast<double>(FLAGS_raft_thread_pool_idle_timeout_second)))
+          .set_work_stealing(FLAGS_raft_thread_pool_work_stealing)
           .Build(&raft_pool_));
 
+  if (FLAGS_raft_peer_send_pool_size > 0) {
+    RETURN_NOT_OK(ThreadPoolBuilder("raft-peer-send")
+                      .set_trace_metric_prefix("raft_peer_send")
+                      .set_min_threads(FLAGS_raft_peer_send_pool_size)
+                      .set_max_threads(FLAGS_raft_peer_send_pool_size)
+                      .set_cpus(raft_cpus)
+                      .Build(&raft_peer_send_pool_));
+  }
+
   return Status::OK();
 }
 
@@ -227,6 +264,9 @@ void KuduServer::Shutdown() {
   if (raft_pool_) {
     raft_pool_->Shutdown();
   }
+  if (raft_peer_send_pool_) {
+    raft_peer_send_pool_->Shutdown();
+  }
 #ifdef FB_DO_NOT_REMOVE
   if (tablet_apply_pool_) {
     tablet_apply_pool_->Shutdown();
@@ -71,6 +71,11 @@ class KuduServer : public server::ServerBase {
     return raft_pool_.get();
   }
 
+  // Null unless --raft_peer_send_pool_size is positive.
+  ThreadPool* raft_peer_send_pool() const {
+    return raft_peer_send_pool_.get();
+  }
+
  private:
 #ifdef FB_DO_NOT_REMOVE
   // Thread pool for preparing transactions, shared between all tablets.
@@ -83,6 +88,9 @@ class KuduServer : public server::ServerBase {
   // Thread pool for Raft-related operations, shared between all tablets.
   std::unique_ptr<ThreadPool> raft_pool_;
 
+  // Thread pool for talking to remote peers, shared between all tablets.
+  std::unique_ptr<ThreadPool> raft_peer_send_pool_;
+
   DISALLOW_COPY_AND_ASSIGN(KuduServer);
 };
 
@@ -28,6 +28,7 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/reactor.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
@@ -100,6 +101,49 @@ Status AcceptorPool::Start(int num_threads) {
   return Status::OK();
 }
 
+Status AcceptorPool::StartInReactors() {
+  if (!messenger_->reuseport_) {
+    return Status::IllegalState(
+        "accepting in reactors requires SO_REUSEPORT on listening sockets");
+  }
+  Sockaddr bound_addr;
+  RETURN_NOT_OK(socket_.GetSocketAddress(&bound_addr));
+
+  // The first reactor listens on the pool's own socket, and the others on new
+  // sockets bound to the same address, which may have had port 0.
+  const std::vector<Reactor*>& reactors = messenger_->reactors_;
+  for (size_t i = 0; i < reactors.size(); i++) {
+    Socket* sock = &socket_;
+    if (i > 0) {
+      std::unique_ptr<Socket> new_sock(new Socket());
+      RETURN_NOT_OK(new_sock->Init(0));
+      RETURN_NOT_OK(new_sock->SetReuseAddr(true));
+      RETURN_NOT_OK(new_sock->SetReusePort(true));
+      RETURN_NOT_OK(new_sock->Bind(bound_addr));
+      sock = new_sock.get();
+      reactor_sockets_.emplace_back(std::move(new_sock));
+    }
+    if (reactors[i]->cpu() >= 0) {
+      WARN_NOT_OK(
+          sock->SetIncomingCpu(reactors[i]->cpu()),
+          "could not prefer connections on the reactor's CPU");
+    }
+    RETURN_NOT_OK(sock->Listen(FLAGS_rpc_acceptor_listen_backlog));
+  }
+  for (size_t i = 0; i < reactors.size(); i++) {
+    Socket* sock = i == 0 ? &socket_ : reactor_sockets_[i - 1].get();
+    Status s =
+        reactors[i]->StartListening(sock, rpc_connections_accepted_);
+    if (!s.ok()) {
+      Shutdown();
+      return s;
+    }
+    listening_reactors_.push_back(reactors[i]);
+    listening_sockets_.push_back(sock);
+  }
+  return Status::OK();
+}
+
 void AcceptorPool::Shutdown() {
   if (Acquire_CompareAndSwap(&closing_, false, true) != false) {
     VLOG(2) << "Acceptor Pool on " << bind_address_.ToString()
@@ -107,6 +151,20 @@ void AcceptorPool::Shutdown() {
     return;
   }
 
+  // Stop the reactors accepting before their sockets are closed. This fails
+  // if a reactor has shut down, which stops it accepting anyway.
+  for (size_t i = 0; i < listening_reactors_.size(); i++) {
+    WARN_NOT_OK(
+        listening_reactors_[i]->StopListening(listening_sockets_[i]),
+        "could not stop reactor accepting connections");
+  }
+  listening_reactors_.clear();
+  listening_sockets_.clear();
+  for (const auto& sock : reactor_sockets_) {
+    ignore_result(sock->Close());
+  }
+  reactor_sockets_.clear();
+
 #if defined(__linux__)
   // Closing the socket will break us out of accept() if we're in it, and
   // prevent future accepts.
@@ -19,6 +19,7 @@
 #define KUDU_RPC_ACCEPTOR_POOL_H
 
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
 #include "kudu/gutil/atomicops.h"
@@ -36,6 +37,7 @@ class Thread;
 namespace rpc {
 
 class Messenger;
+class Reactor;
 
 // A pool of threads calling accept() to create new connections.
 // Acceptor pool threads terminate when they notice that the messenger has been
@@ -50,6 +52,15 @@ class AcceptorPool {
 
   // Start listening and accepting connections.
   Status Start(int num_threads);
+
+  // Start listening, and accepting connections in the messenger's reactor
+  // threads instead of acceptor threads. Each reactor listens on a socket of
+  // its own bound to the same address, and the kernel spreads connections
+  // between them. A reactor bound to a CPU prefers connections whose traffic
+  // arrives on that CPU.
+  //
+  // Requires the messenger to set SO_REUSEPORT on its listening sockets.
+  Status StartInReactors();
   void Shutdown();
 
   // Return the address that the pool is bound to. If the port is specified as
@@ -72,6 +83,12 @@ class AcceptorPool {
   Sockaddr bind_address_;
   std::vector<scoped_refptr<kudu::Thread>> threads_;
 
+  // When accepting in reactors, the reactors which listen, and the sockets
+  // they listen on besides 'socket_'.
+  std::vector<Reactor*> listening_reactors_;
+  std::vector<Socket*> listening_sockets_;
+  std::vector<std::unique_ptr<Socket>> reactor_sockets_;
+
   scoped_refptr<Counter> rpc_connections_accepted_;
 
   Atomic32 closing_;
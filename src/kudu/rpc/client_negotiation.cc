@@ -207,7 +207,7 @@ Status ClientNegotiation::Negotiate(unique_ptr<ErrorStatusPB>* rpc_error) {
   if (encryption_ != RpcEncryption::DISABLED &&
       ContainsKey(server_features_, TLS)) {
     RETURN_NOT_OK(tls_context_->InitiateHandshake(
-        security::TlsHandshakeType::CLIENT, &tls_handshake_));
+        security::TlsHandshakeType::CLIENT, &tls_handshake_, TlsSessionKey()));
 
     if (negotiated_authn_ == AuthenticationType::SASL) {
       // When using SASL authentication, verifying the server's certificate is
@@ -273,7 +273,7 @@ Status ClientNegotiation::HandleTLS() {
   RETURN_NOT_OK(
       ((security::TlsContext*)tls_context_)->SetSupportedAlpns(kAlpns, false));
 
-  RETURN_NOT_OK(tls_context_->CreateSSL(&tls_handshake_));
+  RETURN_NOT_OK(tls_context_->CreateSSL(&tls_handshake_, TlsSessionKey()));
 
   RETURN_NOT_OK(tls_handshake_.SSLHandshake(&socket_, false));
 
@@ -593,6 +593,9 @@ Status ClientNegotiation::HandleTlsHandshake(const NegotiatePB& response) {
   RETURN_NOT_OK(s);
 
   // TLS handshake is finished.
+  if (tls_handshake_.session_reused()) {
+    TRACE("Resumed TLS session");
+  }
   if (ContainsKey(server_features_, TLS_AUTHENTICATION_ONLY) &&
       ContainsKey(client_features_, TLS_AUTHENTICATION_ONLY)) {
     TRACE(
@@ -609,6 +612,18 @@ Status ClientNegotiation::HandleTlsHandshake(const NegotiatePB& response) {
   return tls_handshake_.Finish(&socket_);
 }
 
+string ClientNegotiation::TlsSessionKey() const {
+  Sockaddr addr;
+  if (!socket_->GetPeerAddress(&addr).ok()) {
+    // Don't resume sessions then.
+    return "";
+  }
+  return Substitute(
+      "$0/$1",
+      addr.ToString(),
+      AuthenticationTypeToString(negotiated_authn_));
+}
+
 Status ClientNegotiation::AuthenticateBySasl(
     faststring* recv_buf,
     unique_ptr<ErrorStatusPB>* rpc_error) {
@@ -194,6 +194,10 @@ class ClientNegotiation {
   // Handle a TLS_HANDSHAKE response message from the server.
   Status HandleTlsHandshake(const NegotiatePB& response) WARN_UNUSED_RESULT;
 
+  // The key under which TLS sessions with the server are cached for
+  // resumption. Sessions authenticated differently are kept apart.
+  std::string TlsSessionKey() const;
+
   // Authenticate to the server using SASL.
   // 'recv_buf' allows a receive buffer to be reused.
   Status AuthenticateBySasl(
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <iostream>
 #include <memory>
 #include <set>
@@ -28,6 +29,7 @@
 #include <boost/intrusive/detail/list_iterator.hpp>
 #include <boost/intrusive/list.hpp>
 #include <ev.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
@@ -41,6 +43,8 @@
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/security/tls_socket.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
@@ -53,6 +57,16 @@ using std::shared_ptr;
 using std::unique_ptr;
 using strings::Substitute;
 
+DEFINE_int32(
+    rpc_max_coalesced_transfers,
+    1,
+    "The maximum number of queued outbound transfers which are sent to a "
+    "connection with a single writev() call. Transfers over TLS are always "
+    "sent one at a time. 1 disables coalescing.");
+TAG_FLAG(rpc_max_coalesced_transfers, advanced);
+TAG_FLAG(rpc_max_coalesced_transfers, experimental);
+TAG_FLAG(rpc_max_coalesced_transfers, runtime);
+
 namespace kudu {
 namespace rpc {
 
@@ -77,7 +91,8 @@ Connection::Connection(
       credentials_policy_(policy),
       negotiation_complete_(false),
       is_confidential_(false),
-      scheduled_for_shutdown_(false) {}
+      scheduled_for_shutdown_(false),
+      coalesce_writes_(false) {}
 
 Status Connection::SetNonBlocking(bool enabled) {
   return socket_->SetNonBlocking(enabled);
@@ -192,6 +207,13 @@ void Connection::Shutdown(
   }
 }
 
+void Connection::MarkActive() {
+  last_activity_time_ = reactor_thread_->cur_time();
+  if (idle_hook_.is_linked()) {
+    reactor_thread_->MarkConnectionActive(this);
+  }
+}
+
 void Connection::QueueOutbound(unique_ptr<OutboundTransfer> transfer) {
   DCHECK(reactor_thread_->IsCurrentThread());
 
@@ -494,6 +516,23 @@ void Connection::set_confidential(bool is_confidential) {
   is_confidential_ = is_confidential;
 }
 
+bool Connection::GetCachedAuthorization(uint32_t roles, bool* allowed) const {
+  DCHECK_EQ(direction_, ConnectionDirection::SERVER);
+  const uint64_t cached = authz_cache_.load(std::memory_order_relaxed);
+  if ((cached & 2) == 0 || (cached >> 2) != roles) {
+    return false;
+  }
+  *allowed = cached & 1;
+  return true;
+}
+
+void Connection::CacheAuthorization(uint32_t roles, bool allowed) {
+  DCHECK_EQ(direction_, ConnectionDirection::SERVER);
+  authz_cache_.store(
+      (static_cast<uint64_t>(roles) << 2) | 2 | (allowed ? 1 : 0),
+      std::memory_order_relaxed);
+}
+
 bool Connection::SatisfiesCredentialsPolicy(CredentialsPolicy policy) const {
   DCHECK_EQ(direction_, ConnectionDirection::CLIENT);
   return (policy == CredentialsPolicy::ANY_CREDENTIALS) ||
@@ -515,11 +554,12 @@ void Connection::ReadHandler(ev::io& /* watcher */, int revents) {
             ToString() + ": ReadHandler encountered an error"));
     return;
   }
-  last_activity_time_ = reactor_thread_->cur_time();
+  MarkActive();
 
   while (true) {
     if (!inbound_) {
-      inbound_.reset(new InboundTransfer());
+      inbound_.reset(
+          new InboundTransfer(reactor_thread_->inbound_buffer_pool()));
     }
     Status status = inbound_->ReceiveBuffer(*socket_);
     if (PREDICT_FALSE(!status.ok())) {
@@ -609,6 +649,10 @@ void Connection::HandleCallResponse(unique_ptr<InboundTransfer> transfer) {
     return;
   }
 
+  const ServerTimingPB* timing = resp->server_timing();
+  if (timing && car->call->sent_time().Initialized()) {
+    RecordPeerLatency(*car->call, *timing);
+  }
   car->call->SetResponse(std::move(resp));
 
   // Test cancellation when 'car->call' is in 'FINISHED_SUCCESS' or
@@ -616,6 +660,24 @@ void Connection::HandleCallResponse(unique_ptr<InboundTransfer> transfer) {
   MaybeInjectCancellation(car->call);
 }
 
+void Connection::RecordPeerLatency(
+    const OutboundCall& call,
+    const ServerTimingPB& timing) {
+  if (!peer_latency_) {
+    peer_latency_ =
+        reactor_thread_->reactor()->messenger()->peer_latency_metrics(remote_);
+    if (!peer_latency_) {
+      return;
+    }
+  }
+  int64_t total_us = (MonoTime::Now() - call.sent_time()).ToMicroseconds();
+  int64_t server_us = timing.queue_time_us() + timing.handler_time_us();
+  peer_latency_->network_time->Increment(
+      std::max<int64_t>(0, total_us - server_us));
+  peer_latency_->server_queue_time->Increment(timing.queue_time_us());
+  peer_latency_->server_handler_time->Increment(timing.handler_time_us());
+}
+
 void Connection::WriteHandler(ev::io& /* watcher */, int revents) {
   DCHECK(reactor_thread_->IsCurrentThread());
 
@@ -640,60 +702,93 @@ void Connection::WriteHandler(ev::io& /* watcher */, int revents) {
   }
 }
 
+bool Connection::StartOutboundTransfer(OutboundTransfer* transfer) {
+  DCHECK(!transfer->TransferStarted());
+  if (!transfer->is_for_outbound_call()) {
+    return true;
+  }
+  CallAwaitingResponse* car =
+      FindOrDie(awaiting_response_, transfer->call_id());
+  if (!car->call) {
+    // If the call has already timed out or has already been cancelled,
+    // the 'call' field would be set to NULL. In that case, don't bother
+    // sending it.
+    outbound_transfers_.erase(outbound_transfers_.iterator_to(*transfer));
+    transfer->Abort(Status::Aborted("already timed out or cancelled"));
+    delete transfer;
+    return false;
+  }
+
+  // If this is the start of the transfer, then check if the server has
+  // the required RPC flags. We have to wait until just before the
+  // transfer in order to ensure that the negotiation has taken place, so
+  // that the flags are available.
+  const set<RpcFeatureFlag>& required_features =
+      car->call->required_rpc_features();
+  if (!includes(
+          remote_features_.begin(),
+          remote_features_.end(),
+          required_features.begin(),
+          required_features.end())) {
+    outbound_transfers_.erase(outbound_transfers_.iterator_to(*transfer));
+    Status s = Status::NotSupported(
+        "server does not support the required RPC features");
+    transfer->Abort(s);
+    Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL
+                                        : Phase::CONNECTION_NEGOTIATION;
+    car->call->SetFailed(std::move(s), phase);
+    // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
+    MaybeInjectCancellation(car->call);
+    car->call.reset();
+    delete transfer;
+    return false;
+  }
+
+  car->call->SetSending();
+
+  // Test cancellation when 'call_' is in 'SENDING' state.
+  MaybeInjectCancellation(car->call);
+  return true;
+}
+
+Status Connection::SendCoalescedTransfers() {
+  // The front transfer may be partway through, the ones after it are
+  // started here, and all of them go out with a single writev().
+  coalesced_transfers_.clear();
+  auto iter = outbound_transfers_.begin();
+  int n_iovecs = iter->num_remaining_slices();
+  coalesced_transfers_.push_back(&*iter++);
+  while (iter != outbound_transfers_.end() &&
+         coalesced_transfers_.size() <
+             static_cast<size_t>(FLAGS_rpc_max_coalesced_transfers)) {
+    OutboundTransfer* transfer = &*iter++;
+    if (n_iovecs + transfer->num_remaining_slices() > IOV_MAX) {
+      break;
+    }
+    if (!StartOutboundTransfer(transfer)) {
+      continue;
+    }
+    n_iovecs += transfer->num_remaining_slices();
+    coalesced_transfers_.push_back(transfer);
+  }
+  return OutboundTransfer::SendBatch(*socket_, coalesced_transfers_);
+}
+
 Connection::ProcessOutboundTransfersResult
 Connection::ProcessOutboundTransfers() {
   while (!outbound_transfers_.empty()) {
     OutboundTransfer* transfer = &(outbound_transfers_.front());
-    transfer = &(outbound_transfers_.front());
-
-    if (!transfer->TransferStarted()) {
-      if (transfer->is_for_outbound_call()) {
-        CallAwaitingResponse* car =
-            FindOrDie(awaiting_response_, transfer->call_id());
-        if (!car->call) {
-          // If the call has already timed out or has already been cancelled,
-          // the 'call' field would be set to NULL. In that case, don't bother
-          // sending it.
-          outbound_transfers_.pop_front();
-          transfer->Abort(Status::Aborted("already timed out or cancelled"));
-          delete transfer;
-          continue;
-        }
-
-        // If this is the start of the transfer, then check if the server has
-        // the required RPC flags. We have to wait until just before the
-        // transfer in order to ensure that the negotiation has taken place, so
-        // that the flags are available.
-        const set<RpcFeatureFlag>& required_features =
-            car->call->required_rpc_features();
-        if (!includes(
-                remote_features_.begin(),
-                remote_features_.end(),
-                required_features.begin(),
-                required_features.end())) {
-          outbound_transfers_.pop_front();
-          Status s = Status::NotSupported(
-              "server does not support the required RPC features");
-          transfer->Abort(s);
-          Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL
-                                              : Phase::CONNECTION_NEGOTIATION;
-          car->call->SetFailed(std::move(s), phase);
-          // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
-          MaybeInjectCancellation(car->call);
-          car->call.reset();
-          delete transfer;
-          continue;
-        }
-
-        car->call->SetSending();
-
-        // Test cancellation when 'call_' is in 'SENDING' state.
-        MaybeInjectCancellation(car->call);
-      }
+    if (!transfer->TransferStarted() && !StartOutboundTransfer(transfer)) {
+      continue;
     }
 
-    last_activity_time_ = reactor_thread_->cur_time();
-    Status status = transfer->SendBuffer(*socket_);
+    MarkActive();
+    Status status;
+    if (coalesce_writes_ && FLAGS_rpc_max_coalesced_transfers > 1) {
+      status = SendCoalescedTransfers();
+    } else {
+      status = transfer->SendBuffer(*socket_);
+    }
     if (PREDICT_FALSE(!status.ok())) {
       KLOG_EVERY_N_SECS(WARNING, 300)
           << ToString()
@@ -702,13 +797,17 @@ Connection::ProcessOutboundTransfers() {
       return kConnectionDestroyed;
     }
 
-    if (!transfer->TransferFinished()) {
+    while (!outbound_transfers_.empty() &&
+           outbound_transfers_.front().TransferFinished()) {
+      transfer = &(outbound_transfers_.front());
+      outbound_transfers_.pop_front();
+      delete transfer;
+    }
+    if (!outbound_transfers_.empty() &&
+        outbound_transfers_.front().TransferStarted()) {
       DVLOG(3) << ToString() << ": writeHandler: xfer not finished.";
       return kMoreToSend;
     }
-
-    outbound_transfers_.pop_front();
-    delete transfer;
   }
   return kNoMoreToSend;
 }
@@ -766,6 +865,10 @@ void Connection::CompleteNegotiation(
 void Connection::MarkNegotiationComplete() {
   DCHECK(reactor_thread_->IsCurrentThread());
   negotiation_complete_ = true;
+  // User-space TLS must retry SSL_write() with the same buffer (KUDU-2334);
+  // with kernel TLS, writes behave like those of a plain socket.
+  auto* tls_socket = dynamic_cast<security::TlsSocket*>(socket_.get());
+  coalesce_writes_ = tls_socket == nullptr || tls_socket->kernel_tls_send();
 }
 
 Status Connection::DumpPB(
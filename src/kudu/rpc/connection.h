@@ -18,6 +18,7 @@
 #ifndef KUDU_RPC_CONNECTION_H
 #define KUDU_RPC_CONNECTION_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <limits>
@@ -26,6 +27,7 @@
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/optional/optional.hpp>
@@ -56,6 +58,8 @@ class OutboundCall;
 class RpcConnectionPB;
 class ReactorThread;
 class RpczStore;
+class ServerTimingPB;
+struct PeerLatencyMetrics;
 enum class CredentialsPolicy;
 
 //
@@ -199,6 +203,16 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // NOTE: This may invoke DestroyConnection() on 'this'.
   ProcessOutboundTransfersResult ProcessOutboundTransfers();
 
+  // Prepares 'transfer', which has not been started, to be sent. Returns
+  // false if the transfer was aborted instead, in which case it has been
+  // removed from outbound_transfers_ and deleted.
+  bool StartOutboundTransfer(OutboundTransfer* transfer);
+
+  // Sends the front of outbound_transfers_ together with up to
+  // --rpc_max_coalesced_transfers - 1 transfers queued behind it, with a
+  // single writev() call.
+  Status SendCoalescedTransfers();
+
   // Safe to be called from other threads.
   std::string ToString() const;
 
@@ -248,6 +262,16 @@ class Connection : public RefCountedThreadSafe<Connection> {
     return remote_user_;
   }
 
+  // Returns whether the decision to authorize remote_user() for 'roles' is
+  // cached, setting 'allowed' to it if so. Only one decision is cached.
+  // Thread-safe.
+  bool GetCachedAuthorization(uint32_t roles, bool* allowed) const;
+
+  // Caches the decision to authorize remote_user() for 'roles'. The caller
+  // must only cache decisions which stay valid for the connection's life.
+  // Thread-safe.
+  void CacheAuthorization(uint32_t roles, bool allowed);
+
   // Whether the connection is scheduled for shutdown.
   bool scheduled_for_shutdown() const {
     DCHECK_EQ(direction_, ConnectionDirection::CLIENT);
@@ -268,6 +292,7 @@ class Connection : public RefCountedThreadSafe<Connection> {
  private:
   friend struct CallAwaitingResponse;
   friend class QueueTransferTask;
+  friend class ReactorThread;
   friend struct CallTransferCallbacks;
   friend struct ResponseTransferCallbacks;
 
@@ -323,10 +348,19 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // This must be called from the reactor thread.
   void QueueOutbound(std::unique_ptr<OutboundTransfer> transfer);
 
+  // Records that the socket was just read from or written to.
+  void MarkActive();
+
   // Internal test function for injecting cancellation request when 'call'
   // reaches state specified in 'FLAGS_rpc_inject_cancellation_state'.
   void MaybeInjectCancellation(const std::shared_ptr<OutboundCall>& call);
 
+  // Records the latency of 'call', whose response reported 'timing', in the
+  // messenger's histograms for the remote server.
+  void RecordPeerLatency(
+      const OutboundCall& call,
+      const ServerTimingPB& timing);
+
   // The reactor thread that created this connection.
   ReactorThread* const reactor_thread_;
 
@@ -336,6 +370,9 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // The socket we're communicating on.
   std::unique_ptr<Socket> socket_;
 
+  // Owned by the messenger. Looked up by the first RecordPeerLatency().
+  const PeerLatencyMetrics* peer_latency_ = nullptr;
+
   // The ConnectionId that serves as a key into the client connection map
   // within this reactor. Only set in the case of outbound connections.
   boost::optional<ConnectionId> outbound_connection_id_;
@@ -344,12 +381,24 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // server).
   RemoteUser remote_user_;
 
+  // The cached authorization decision: the roles shifted left by two, the
+  // bit 2 if a decision is cached, and the decision in the bit 1.
+  std::atomic<uint64_t> authz_cache_{0};
+
   // whether we are client or server
   ConnectionDirection direction_;
 
   // The last time we read or wrote from the socket.
   MonoTime last_activity_time_;
 
+  // Links a server connection into its reactor thread's list of connections
+  // ordered by 'idle_check_time_', if the reactor keeps one.
+  boost::intrusive::list_member_hook<> idle_hook_;
+
+  // When the reactor thread next checks whether the connection has been idle
+  // for the keepalive time, if it's linked by 'idle_hook_'.
+  MonoTime idle_check_time_;
+
   // the inbound transfer, if any
   std::unique_ptr<InboundTransfer> inbound_;
 
@@ -413,6 +462,13 @@ class Connection : public RefCountedThreadSafe<Connection> {
 
   // Whether the connection is scheduled for shutdown.
   bool scheduled_for_shutdown_;
+
+  // Whether queued transfers may be sent together, which is the case once
+  // negotiation is complete unless the socket encrypts in user space.
+  bool coalesce_writes_;
+
+  // Scratch space for SendCoalescedTransfers().
+  std::vector<OutboundTransfer*> coalesced_transfers_;
 };
 
 } // namespace rpc
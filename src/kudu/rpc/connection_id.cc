@@ -30,6 +30,19 @@ using std::string;
 namespace kudu {
 namespace rpc {
 
+const char* ConnectionClassToString(ConnectionClass connection_class) {
+  switch (connection_class) {
+    case ConnectionClass::CONTROL:
+      return "control";
+    case ConnectionClass::REPLICATION:
+      return "replication";
+    case ConnectionClass::BULK:
+      return "bulk";
+  }
+  LOG(FATAL) << "unknown connection class";
+  return "";
+}
+
 ConnectionId::ConnectionId() {}
 
 ConnectionId::ConnectionId(
@@ -42,6 +55,14 @@ ConnectionId::ConnectionId(
   CHECK(!hostname_.empty());
 }
 
+void ConnectionId::set_connection_class(
+    ConnectionClass connection_class,
+    int stripe) {
+  DCHECK_GE(stripe, 0);
+  connection_class_ = connection_class;
+  stripe_ = stripe;
+}
+
 void ConnectionId::set_user_credentials(UserCredentials user_credentials) {
   DCHECK(user_credentials.has_real_user());
   user_credentials_ = std::move(user_credentials);
@@ -55,8 +76,18 @@ string ConnectionId::ToString() const {
     remote = remote_.ToString();
   }
 
-  return strings::Substitute(
-      "{remote=$0, user_credentials=$1}", remote, user_credentials_.ToString());
+  string ret = strings::Substitute(
+      "{remote=$0, user_credentials=$1", remote, user_credentials_.ToString());
+  // The default class is left out, as most connections use it.
+  if (connection_class_ != ConnectionClass::CONTROL) {
+    strings::SubstituteAndAppend(
+        &ret,
+        ", class=$0, stripe=$1",
+        ConnectionClassToString(connection_class_),
+        stripe_);
+  }
+  ret += "}";
+  return ret;
 }
 
 size_t ConnectionId::HashCode() const {
@@ -64,12 +95,15 @@ size_t ConnectionId::HashCode() const {
   boost::hash_combine(seed, remote_.HashCode());
   boost::hash_combine(seed, hostname_);
   boost::hash_combine(seed, user_credentials_.HashCode());
+  boost::hash_combine(seed, static_cast<int>(connection_class_));
+  boost::hash_combine(seed, stripe_);
   return seed;
 }
 
 bool ConnectionId::Equals(const ConnectionId& other) const {
   return remote() == other.remote() && hostname_ == other.hostname_ &&
-      user_credentials().Equals(other.user_credentials());
+      user_credentials().Equals(other.user_credentials()) &&
+      connection_class_ == other.connection_class_ && stripe_ == other.stripe_;
 }
 
 size_t ConnectionIdHash::operator()(const ConnectionId& conn_id) const {
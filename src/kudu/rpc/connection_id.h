@@ -25,6 +25,23 @@
 namespace kudu {
 namespace rpc {
 
+// The class of traffic an outbound connection carries. Calls of different
+// classes to the same remote use separate TCP connections, so that latency
+// sensitive calls don't queue behind bulk transfers on the socket, and bulk
+// transfers may be striped over several connections.
+enum class ConnectionClass {
+  // Heartbeats, elections and any call which doesn't specify a class.
+  CONTROL,
+
+  // Steady-state replication of new operations.
+  REPLICATION,
+
+  // Bulk transfers, such as catching up a peer which has fallen behind.
+  BULK,
+};
+
+const char* ConnectionClassToString(ConnectionClass connection_class);
+
 // Used to key on Connection information.
 // For use as a key in an unordered STL collection, use ConnectionIdHash and
 // ConnectionIdEqual. This class is copyable for STL compatibility, but not
@@ -58,6 +75,18 @@ class ConnectionId {
     return user_credentials_;
   }
 
+  // Sets the class of the connection, and which of the connections of that
+  // class to use when the class is striped over several.
+  void set_connection_class(ConnectionClass connection_class, int stripe = 0);
+
+  ConnectionClass connection_class() const {
+    return connection_class_;
+  }
+
+  int stripe() const {
+    return stripe_;
+  }
+
   // Copy state from another object to this one.
   void CopyFrom(const ConnectionId& other);
 
@@ -78,6 +107,9 @@ class ConnectionId {
   std::string hostname_;
 
   UserCredentials user_credentials_;
+
+  ConnectionClass connection_class_ = ConnectionClass::CONTROL;
+  int stripe_ = 0;
 };
 
 class ConnectionIdHash {
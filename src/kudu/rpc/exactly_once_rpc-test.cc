@@ -32,6 +32,7 @@
 
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/request_tracker.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/result_tracker.h"
@@ -55,6 +56,7 @@
 DECLARE_int64(remember_clients_ttl_ms);
 DECLARE_int64(remember_responses_ttl_ms);
 DECLARE_int64(result_tracker_gc_interval_ms);
+DECLARE_int32(result_tracker_num_shards);
 
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
@@ -62,6 +64,7 @@ using std::atomic_int;
 using std::shared_ptr;
 using std::unique_ptr;
 using std::vector;
+using strings::Substitute;
 
 namespace kudu {
 namespace rpc {
@@ -677,5 +680,37 @@ TEST_F(
   NO_PENDING_FATALS();
 }
 
+// Tracks and completes requests from many clients on a sharded result tracker
+// and makes sure that retries see the completed responses and that GC
+// releases all the memory.
+TEST_F(ExactlyOnceRpcTest, TestShardedResultTracker) {
+  FLAGS_result_tracker_num_shards = 8;
+  const int kNumClients = 100;
+  shared_ptr<MemTracker> mem_tracker =
+      MemTracker::CreateTracker(-1, "sharded_result_tracker");
+  scoped_refptr<ResultTracker> tracker(new ResultTracker(mem_tracker));
+
+  ExactlyOnceResponsePB resp;
+  resp.set_current_val(1);
+  for (int i = 0; i < kNumClients; i++) {
+    RequestIdPB request_id;
+    request_id.set_client_id(Substitute("client-$0", i));
+    request_id.set_seq_no(0);
+    request_id.set_first_incomplete_seq_no(0);
+    request_id.set_attempt_no(0);
+    ASSERT_EQ(ResultTracker::NEW, tracker->TrackRpcOrChangeDriver(request_id));
+    tracker->RecordCompletionAndRespond(request_id, &resp);
+    request_id.set_attempt_no(1);
+    ASSERT_EQ(
+        ResultTracker::COMPLETED, tracker->TrackRpcOrChangeDriver(request_id));
+  }
+  ASSERT_GT(mem_tracker->consumption(), 0);
+
+  FLAGS_remember_clients_ttl_ms = 0;
+  SleepFor(MonoDelta::FromMilliseconds(1));
+  tracker->GCResults();
+  ASSERT_EQ(0, mem_tracker->consumption());
+}
+
 } // namespace rpc
 } // namespace kudu
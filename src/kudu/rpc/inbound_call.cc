@@ -20,7 +20,9 @@
 #include <cstdint>
 #include <memory>
 #include <ostream>
+#include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/message.h>
 #include <google/protobuf/message_lite.h>
@@ -35,6 +37,7 @@
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/transfer.h"
 #include "kudu/util/debug/trace_event.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/trace.h"
@@ -52,12 +55,39 @@ using std::unique_ptr;
 using std::vector;
 using strings::Substitute;
 
+DEFINE_int32(
+    rpc_trace_sample_every_n_calls,
+    1,
+    "Keep a trace of one in this many inbound RPC calls received by each "
+    "reactor thread. Untraced calls skip allocating and formatting trace "
+    "messages, so they aren't sampled in /rpcz and slow ones are logged "
+    "without a trace.");
+TAG_FLAG(rpc_trace_sample_every_n_calls, advanced);
+TAG_FLAG(rpc_trace_sample_every_n_calls, runtime);
+DEFINE_validator(
+    rpc_trace_sample_every_n_calls,
+    [](const char* /*flagname*/, int32_t value) { return value >= 1; });
+
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+// Whether to trace a call, decided once when it is received.
+bool ShouldTraceCall() {
+  const int32_t every_n = FLAGS_rpc_trace_sample_every_n_calls;
+  if (PREDICT_TRUE(every_n <= 1)) {
+    return true;
+  }
+  static thread_local uint32_t num_calls = 0;
+  return num_calls++ % every_n == 0;
+}
+
+} // anonymous namespace
+
 InboundCall::InboundCall(Connection* conn)
     : conn_(conn),
-      trace_(new Trace),
+      trace_(ShouldTraceCall() ? new Trace : nullptr),
       method_info_(nullptr),
       deadline_(MonoTime::Max()) {
   RecordCallReceived();
@@ -195,6 +225,13 @@ void InboundCall::SerializeResponseBuffer(
   ResponseHeader resp_hdr;
   resp_hdr.set_call_id(header_.call_id());
   resp_hdr.set_is_error(!is_success);
+  if (header_.request_timing() && timing_.time_handled.Initialized()) {
+    ServerTimingPB* timing = resp_hdr.mutable_timing();
+    timing->set_queue_time_us(
+        (timing_.time_handled - timing_.time_received).ToMicroseconds());
+    timing->set_handler_time_us(
+        (MonoTime::Now() - timing_.time_handled).ToMicroseconds());
+  }
   int32_t sidecar_byte_size = 0;
   for (const unique_ptr<RpcSidecar>& car : outbound_sidecars_) {
     resp_hdr.add_sidecar_offsets(sidecar_byte_size + protobuf_msg_size);
@@ -231,7 +268,7 @@ Status InboundCall::AddOutboundSidecar(unique_ptr<RpcSidecar> car, int* idx) {
   // Check that the number of sidecars does not exceed the number of payload
   // slices that are free (two are used up by the header and main message
   // protobufs).
-  if (outbound_sidecars_.size() > TransferLimits::kMaxSidecars) {
+  if (outbound_sidecars_.size() >= FLAGS_rpc_max_outbound_sidecars) {
     return Status::ServiceUnavailable("All available sidecars already used");
   }
   int64_t sidecar_bytes = car->AsSlice().size();
@@ -334,8 +371,19 @@ void InboundCall::RecordHandlingCompleted() {
   }
 
   if (method_info_) {
-    method_info_->handler_latency_histogram->Increment(
-        (timing_.time_completed - timing_.time_handled).ToMicroseconds());
+    Histogram* hist = method_info_->handler_latency_histogram.get();
+    const int64_t latency_us =
+        (timing_.time_completed - timing_.time_handled).ToMicroseconds();
+    if (hist->WantsExemplar(latency_us)) {
+      Histogram::ExemplarLabels labels = {
+          {"call_id", std::to_string(header_.call_id())},
+          {"remote", remote_address().ToString()}};
+      labels.insert(
+          labels.end(), exemplar_labels_.begin(), exemplar_labels_.end());
+      is_exemplar_ = hist->IncrementWithExemplar(latency_us, std::move(labels));
+    } else {
+      hist->Increment(latency_us);
+    }
   }
 }
 
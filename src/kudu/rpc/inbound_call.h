@@ -149,8 +149,23 @@ class InboundCall {
 
   const scoped_refptr<Connection>& connection() const;
 
+  // The call's trace, or null if the call isn't traced. See
+  // --rpc_trace_sample_every_n_calls.
   Trace* trace();
 
+  // Adds a label to the exemplar the call may become in the handler latency
+  // histogram of its method (see --histogram_exemplars). The call id and the
+  // remote address are always added.
+  void AddExemplarLabel(std::string key, std::string value) {
+    exemplar_labels_.emplace_back(std::move(key), std::move(value));
+  }
+
+  // Whether the call was kept as an exemplar of the handler latency histogram
+  // of its method. Only known once the call has been responded to.
+  bool is_exemplar() const {
+    return is_exemplar_;
+  }
+
   const InboundCallTiming& timing() const {
     return timing_;
   }
@@ -266,7 +281,7 @@ class InboundCall {
   // There are as many slices as header_.sidecar_offsets_size().
   Slice inbound_sidecar_slices_[TransferLimits::kMaxSidecars];
 
-  // The trace buffer.
+  // The trace buffer. Null if the call isn't traced.
   scoped_refptr<Trace> trace_;
 
   // Timing information related to this RPC call.
@@ -285,6 +300,10 @@ class InboundCall {
   // client did not pass a timeout.
   MonoTime deadline_;
 
+  // Labels of the exemplar the call may become. See AddExemplarLabel().
+  std::vector<std::pair<std::string, std::string>> exemplar_labels_;
+  bool is_exemplar_ = false;
+
   DISALLOW_COPY_AND_ASSIGN(InboundCall);
 };
 
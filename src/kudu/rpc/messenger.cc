@@ -30,6 +30,7 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/sysinfo.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/acceptor_pool.h"
 #include "kudu/rpc/connection_direction.h"
@@ -50,9 +51,11 @@
 #include "kudu/util/flags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/net/dns_resolver.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/thread_restrictions.h"
 #include "kudu/util/threadpool.h"
 
@@ -60,10 +63,44 @@ using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
 constexpr int kMinSockBuf = 1024;
 
+METRIC_DEFINE_entity(rpc_peer);
+
+METRIC_DEFINE_histogram(
+    rpc_peer,
+    rpc_peer_network_time,
+    "RPC Network Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Time from RPC calls to this server being sent to their responses being "
+    "received, minus the time the server reports having queued and handled "
+    "them.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    rpc_peer,
+    rpc_peer_server_queue_time,
+    "RPC Server Queue Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Time RPC calls to this server waited to be handled, as reported by the "
+    "server.",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    rpc_peer,
+    rpc_peer_server_handler_time,
+    "RPC Server Handler Time",
+    kudu::MetricUnit::kMicroseconds,
+    "Time RPC calls to this server took to be handled, as reported by the "
+    "server.",
+    60000000LU,
+    2);
+
 namespace boost {
 template <typename Signature>
 class function;
@@ -79,6 +116,7 @@ MessengerBuilder::MessengerBuilder(std::string name)
       min_negotiation_threads_(0),
       max_negotiation_threads_(4),
       coarse_timer_granularity_(MonoDelta::FromMilliseconds(100)),
+      metric_registry_(nullptr),
       rpc_negotiation_timeout_ms_(3000),
       sasl_proto_name_("kudu"),
       rpc_authentication_("optional"),
@@ -87,7 +125,10 @@ MessengerBuilder::MessengerBuilder(std::string name)
       rpc_tls_min_protocol_(
           kudu::security::SecurityDefaults::kDefaultTlsMinVersion),
       enable_inbound_tls_(false),
-      reuseport_(false) {}
+      reuseport_(false),
+      reactor_spin_us_(0),
+      socket_busy_poll_us_(0),
+      idle_connection_lru_(false) {}
 
 MessengerBuilder& MessengerBuilder::set_connection_keepalive_time(
     const MonoDelta& keepalive) {
@@ -124,6 +165,12 @@ MessengerBuilder& MessengerBuilder::set_metric_entity(
   return *this;
 }
 
+MessengerBuilder& MessengerBuilder::set_metric_registry(
+    MetricRegistry* metric_registry) {
+  metric_registry_ = metric_registry;
+  return *this;
+}
+
 MessengerBuilder& MessengerBuilder::set_connection_keep_alive_time(
     int32_t time_in_ms) {
   connection_keepalive_time_ = MonoDelta::FromMilliseconds(time_in_ms);
@@ -202,6 +249,33 @@ MessengerBuilder& MessengerBuilder::set_reuseport() {
   return *this;
 }
 
+MessengerBuilder& MessengerBuilder::set_reactor_cpus(vector<int> cpus) {
+  reactor_cpus_ = std::move(cpus);
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_reactor_spin_us(int us) {
+  reactor_spin_us_ = us;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_socket_busy_poll_us(int us) {
+  socket_busy_poll_us_ = us;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_timer_wheel_tick(
+    const MonoDelta& tick) {
+  CHECK(tick.Initialized() && tick.ToNanoseconds() > 0);
+  timer_wheel_tick_ = tick;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_idle_connection_lru() {
+  idle_connection_lru_ = true;
+  return *this;
+}
+
 Status MessengerBuilder::Build(shared_ptr<Messenger>* msgr) {
   // Initialize SASL library before we start making requests
   RETURN_NOT_OK(SaslInit(!keytab_file_.empty()));
@@ -386,7 +460,7 @@ Status Messenger::UnregisterService(const string& service_name) {
 }
 
 void Messenger::QueueOutboundCall(const shared_ptr<OutboundCall>& call) {
-  Reactor* reactor = RemoteToReactor(call->conn_id().remote());
+  Reactor* reactor = ConnectionIdToReactor(call->conn_id());
   reactor->QueueOutboundCall(call);
 }
 
@@ -413,14 +487,14 @@ void Messenger::QueueInboundCall(unique_ptr<InboundCall> call) {
 }
 
 void Messenger::QueueCancellation(const shared_ptr<OutboundCall>& call) {
-  Reactor* reactor = RemoteToReactor(call->conn_id().remote());
+  Reactor* reactor = ConnectionIdToReactor(call->conn_id());
   reactor->QueueCancellation(call);
 }
 
 void Messenger::RegisterInboundSocket(
     Socket* new_socket,
     const Sockaddr& remote) {
-  Reactor* reactor = RemoteToReactor(remote);
+  Reactor* reactor = InboundSocketToReactor(new_socket, remote);
   reactor->RegisterInboundSocket(new_socket, remote);
 }
 
@@ -434,6 +508,8 @@ Messenger::Messenger(const MessengerBuilder& bld)
           bld.rpc_tls_min_protocol_)),
       token_verifier_(new security::TokenVerifier()),
       rpcz_store_(new RpczStore()),
+      dns_resolver_(new DnsResolver()),
+      metric_registry_(bld.metric_registry_),
       metric_entity_(bld.metric_entity_),
       rpc_negotiation_timeout_ms_(bld.rpc_negotiation_timeout_ms_),
       sasl_proto_name_(bld.sasl_proto_name_),
@@ -443,6 +519,32 @@ Messenger::Messenger(const MessengerBuilder& bld)
   for (int i = 0; i < bld.num_reactors_; i++) {
     reactors_.push_back(new Reactor(retain_self_, i, bld));
   }
+  if (!bld.reactor_cpus_.empty()) {
+    // Prefer the reactor bound to the CPU itself, then the reactors on the
+    // CPU's NUMA node, taken in turn.
+    int num_cpus = base::MaxCPUIndex() + 1;
+    vector<int> reactor_nodes;
+    for (const Reactor* r : reactors_) {
+      reactor_nodes.push_back(NumaNodeOfCpu(r->cpu()));
+    }
+    cpu_to_reactor_.assign(num_cpus, -1);
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+      vector<int> same_node;
+      int node = NumaNodeOfCpu(cpu);
+      for (int i = 0; i < static_cast<int>(reactors_.size()); i++) {
+        if (reactors_[i]->cpu() == cpu) {
+          cpu_to_reactor_[cpu] = i;
+          break;
+        }
+        if (node >= 0 && reactor_nodes[i] == node) {
+          same_node.push_back(i);
+        }
+      }
+      if (cpu_to_reactor_[cpu] < 0 && !same_node.empty()) {
+        cpu_to_reactor_[cpu] = same_node[cpu % same_node.size()];
+      }
+    }
+  }
   CHECK_OK(ThreadPoolBuilder("client-negotiator")
                .set_min_threads(bld.min_negotiation_threads_)
                .set_max_threads(bld.max_negotiation_threads_)
@@ -467,6 +569,29 @@ Reactor* Messenger::RemoteToReactor(const Sockaddr& remote) {
   return reactors_[reactor_idx];
 }
 
+Reactor* Messenger::ConnectionIdToReactor(const ConnectionId& conn_id) {
+  // Spread the connections of each class and stripe to a remote over the
+  // reactors, so that bulk transfers don't hold up the reactor which serves
+  // control traffic.
+  uint32_t hashCode = conn_id.remote().HashCode() +
+      static_cast<uint32_t>(conn_id.connection_class()) + conn_id.stripe();
+  return reactors_[hashCode % reactors_.size()];
+}
+
+Reactor* Messenger::InboundSocketToReactor(
+    Socket* socket,
+    const Sockaddr& remote) {
+  // Only outbound connections are looked up by remote address, so inbound
+  // ones may go to any reactor.
+  int cpu;
+  if (!cpu_to_reactor_.empty() && socket->GetIncomingCpu(&cpu).ok() &&
+      cpu >= 0 && cpu < static_cast<int>(cpu_to_reactor_.size()) &&
+      cpu_to_reactor_[cpu] >= 0) {
+    return reactors_[cpu_to_reactor_[cpu]];
+  }
+  return RemoteToReactor(remote);
+}
+
 Status Messenger::Init() {
   RETURN_NOT_OK(tls_context_->Init());
   for (Reactor* r : reactors_) {
@@ -476,6 +601,27 @@ Status Messenger::Init() {
   return Status::OK();
 }
 
+const PeerLatencyMetrics* Messenger::peer_latency_metrics(
+    const Sockaddr& remote) {
+  if (!metric_registry_) {
+    return nullptr;
+  }
+  const string id = remote.ToString();
+  std::lock_guard<simple_spinlock> l(peer_latency_lock_);
+  unique_ptr<PeerLatencyMetrics>& metrics = peer_latency_[id];
+  if (!metrics) {
+    scoped_refptr<MetricEntity> entity =
+        METRIC_ENTITY_rpc_peer.Instantiate(metric_registry_, id);
+    metrics.reset(new PeerLatencyMetrics);
+    metrics->network_time = METRIC_rpc_peer_network_time.Instantiate(entity);
+    metrics->server_queue_time =
+        METRIC_rpc_peer_server_queue_time.Instantiate(entity);
+    metrics->server_handler_time =
+        METRIC_rpc_peer_server_handler_time.Instantiate(entity);
+  }
+  return metrics.get();
+}
+
 Status Messenger::DumpRunningRpcs(
     const DumpRunningRpcsRequestPB& req,
     DumpRunningRpcsResponsePB* resp) {
@@ -45,6 +45,7 @@ class function;
 
 namespace kudu {
 
+class DnsResolver;
 class Socket;
 class ThreadPool;
 
@@ -59,6 +60,7 @@ using security::RpcAuthentication;
 using security::RpcEncryption;
 
 class AcceptorPool;
+class ConnectionId;
 class DumpRunningRpcsRequestPB;
 class DumpRunningRpcsResponsePB;
 class InboundCall;
@@ -81,6 +83,17 @@ struct AcceptorPoolInfo {
   Sockaddr bind_address_;
 };
 
+// Histograms of the latency of calls to a single server, see
+// --rpc_collect_peer_latency.
+struct PeerLatencyMetrics {
+  // From the call being sent to its response being received, minus the time
+  // the server reports having spent on it.
+  scoped_refptr<Histogram> network_time;
+  // As reported by the server.
+  scoped_refptr<Histogram> server_queue_time;
+  scoped_refptr<Histogram> server_handler_time;
+};
+
 // Used to construct a Messenger.
 class MessengerBuilder {
  public:
@@ -112,6 +125,11 @@ class MessengerBuilder {
   MessengerBuilder& set_metric_entity(
       const scoped_refptr<MetricEntity>& metric_entity);
 
+  // Set the registry in which to keep an entity for each server that calls
+  // are sent to, holding the latency of those calls when
+  // --rpc_collect_peer_latency is set.
+  MessengerBuilder& set_metric_registry(MetricRegistry* metric_registry);
+
   // Set the time in milliseconds after which an idle connection from a client
   // will be disconnected by the server.
   MessengerBuilder& set_connection_keep_alive_time(int32_t time_in_ms);
@@ -175,6 +193,32 @@ class MessengerBuilder {
   // Configure the messenger to set the SO_REUSEPORT socket option.
   MessengerBuilder& set_reuseport();
 
+  // Bind the reactor threads to 'cpus', one CPU per reactor, going round the
+  // list if there are more reactors than CPUs. An inbound connection is then
+  // handled by the reactor bound to the CPU its traffic arrives on
+  // (SO_INCOMING_CPU), or else by one on the same NUMA node.
+  MessengerBuilder& set_reactor_cpus(std::vector<int> cpus);
+
+  // Have each reactor thread keep polling without blocking for 'us'
+  // microseconds after handling network activity, trading CPU for the latency
+  // of sleeping and being woken when more activity follows soon.
+  MessengerBuilder& set_reactor_spin_us(int us);
+
+  // Set SO_BUSY_POLL to 'us' on the sockets of new connections.
+  MessengerBuilder& set_socket_busy_poll_us(int us);
+
+  // Keep the delayed tasks of each reactor, such as those scheduled by
+  // ScheduleOnReactor(), in a hierarchical timer wheel advanced every 'tick',
+  // rather than arming a libev timer for each. A task then runs on the first
+  // tick at or after its deadline.
+  MessengerBuilder& set_timer_wheel_tick(const MonoDelta& tick);
+
+  // Keep the server connections of each reactor in a list ordered by when
+  // they may next have been idle for the keepalive time, moved to its back
+  // on activity, so that each tick of the coarse timer only visits those
+  // which may have, rather than scanning every server connection.
+  MessengerBuilder& set_idle_connection_lru();
+
   Status Build(std::shared_ptr<Messenger>* msgr);
 
  private:
@@ -185,6 +229,7 @@ class MessengerBuilder {
   int max_negotiation_threads_;
   MonoDelta coarse_timer_granularity_;
   scoped_refptr<MetricEntity> metric_entity_;
+  MetricRegistry* metric_registry_;
   int64_t rpc_negotiation_timeout_ms_;
   std::string sasl_proto_name_;
   std::string rpc_authentication_;
@@ -198,6 +243,12 @@ class MessengerBuilder {
   std::string keytab_file_;
   bool enable_inbound_tls_;
   bool reuseport_;
+  std::vector<int> reactor_cpus_;
+  int reactor_spin_us_;
+  int socket_busy_poll_us_;
+  // Uninitialized unless the timer wheel is enabled.
+  MonoDelta timer_wheel_tick_;
+  bool idle_connection_lru_;
 };
 
 // A Messenger is a container for the reactor threads which run event loops
@@ -212,6 +263,7 @@ class MessengerBuilder {
 // See rpc-test.cc and rpc-bench.cc for example usages.
 class Messenger {
  public:
+  friend class AcceptorPool;
   friend class MessengerBuilder;
   friend class Proxy;
   friend class Reactor;
@@ -332,6 +384,15 @@ class Messenger {
     return rpcz_store_.get();
   }
 
+  // Resolves the addresses of peers, see DnsResolver.
+  DnsResolver* dns_resolver() {
+    return dns_resolver_.get();
+  }
+
+  // Returns the histograms of the latency of calls to 'remote', creating them
+  // on first use, or null if the messenger has no metric registry.
+  const PeerLatencyMetrics* peer_latency_metrics(const Sockaddr& remote);
+
   int num_reactors() const {
     return reactors_.size();
   }
@@ -369,6 +430,8 @@ class Messenger {
   FRIEND_TEST(TestRpc, TestConnectionAlwaysKeepalive);
   FRIEND_TEST(TestRpc, TestClientConnectionsMetrics);
   FRIEND_TEST(TestRpc, TestCredentialsPolicy);
+  FRIEND_TEST(TestRpc, TestConnectionClasses);
+  FRIEND_TEST(TestRpc, TestAcceptInReactors);
   FRIEND_TEST(TestRpc, TestReopenOutboundConnections);
   FRIEND_TEST(TestRpc, TestCallWithNormalTLSOnServerOnly);
   FRIEND_TEST(TestRpc, TestCallWithNormalTLSOnBothClientAndServer);
@@ -376,6 +439,12 @@ class Messenger {
   explicit Messenger(const MessengerBuilder& bld);
 
   Reactor* RemoteToReactor(const Sockaddr& remote);
+
+  // Returns the reactor which owns outbound connections for 'conn_id'.
+  Reactor* ConnectionIdToReactor(const ConnectionId& conn_id);
+
+  // Returns the reactor to handle a new inbound connection on 'socket'.
+  Reactor* InboundSocketToReactor(Socket* socket, const Sockaddr& remote);
   Status Init();
   void RunTimeoutThread();
   void UpdateCurTime();
@@ -418,6 +487,11 @@ class Messenger {
 
   std::vector<Reactor*> reactors_;
 
+  // For each CPU, the index of the reactor which handles inbound connections
+  // whose traffic arrives on it, or -1 to place them by remote address. Empty
+  // if the reactors are not bound to CPUs.
+  std::vector<int> cpu_to_reactor_;
+
   // Separate client and server negotiation pools to avoid possibility of
   // distributed deadlock. See KUDU-2041.
   std::unique_ptr<ThreadPool> client_negotiation_pool_;
@@ -434,6 +508,15 @@ class Messenger {
 
   std::unique_ptr<RpczStore> rpcz_store_;
 
+  std::unique_ptr<DnsResolver> dns_resolver_;
+
+  MetricRegistry* const metric_registry_;
+
+  // Keyed by the address of the server. Protected by 'peer_latency_lock_'.
+  simple_spinlock peer_latency_lock_;
+  std::unordered_map<std::string, std::unique_ptr<PeerLatencyMetrics>>
+      peer_latency_;
+
   scoped_refptr<MetricEntity> metric_entity_;
 
   // Timeout in milliseconds after which an incomplete connection negotiation
@@ -64,6 +64,16 @@ DEFINE_int32(
     "will be injected. Should use values in OutboundCall::State only");
 TAG_FLAG(rpc_inject_cancellation_state, unsafe);
 
+DEFINE_bool(
+    rpc_collect_peer_latency,
+    false,
+    "Whether to have servers report how long they queued and handled each "
+    "outbound RPC call, and to keep histograms of that time and of the time "
+    "spent on the network for each server calls are sent to. Only kept if "
+    "the messenger was given a metric registry.");
+TAG_FLAG(rpc_collect_peer_latency, experimental);
+TAG_FLAG(rpc_collect_peer_latency, runtime);
+
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -110,6 +120,9 @@ OutboundCall::OutboundCall(
   if (controller_->request_id_) {
     header_.set_allocated_request_id(controller_->request_id_.release());
   }
+  if (FLAGS_rpc_collect_peer_latency) {
+    header_.set_request_timing(true);
+  }
 }
 
 OutboundCall::~OutboundCall() {
@@ -343,6 +356,7 @@ void OutboundCall::SetSending() {
 
 void OutboundCall::SetSent() {
   set_state(SENT);
+  sent_time_ = MonoTime::Now();
 
   // This method is called in the reactor thread, so free the header buf,
   // which was also allocated from this thread. tcmalloc's thread caching
@@ -166,6 +166,11 @@ class OutboundCall {
   const ConnectionId& conn_id() const {
     return conn_id_;
   }
+
+  // Time when the call was fully sent, uninitialized until then.
+  MonoTime sent_time() const {
+    return sent_time_;
+  }
   const RemoteMethod& remote_method() const {
     return remote_method_;
   }
@@ -203,6 +208,8 @@ class OutboundCall {
   }
 
  private:
+  friend class Reactor;
+  friend class ReactorThread;
   friend class RpcController;
   FRIEND_TEST(TestRpc, TestCancellation);
 
@@ -241,6 +248,9 @@ class OutboundCall {
   // Time when the call was first initiatied.
   MonoTime start_time_;
 
+  // Set by SetSent().
+  MonoTime sent_time_;
+
   // Return the error protobuf, if a remote error occurred.
   // This will only be non-NULL if status().IsRemoteError().
   const ErrorStatusPB* error_pb() const;
@@ -295,6 +305,11 @@ class OutboundCall {
   // True if cancellation was requested on this call.
   bool cancellation_requested_;
 
+  // While the call waits in Reactor::pending_calls_, the next call queued
+  // there, and a reference keeping this call alive until it is assigned.
+  OutboundCall* next_queued_ = nullptr;
+  std::shared_ptr<OutboundCall> queued_self_;
+
   DISALLOW_COPY_AND_ASSIGN(OutboundCall);
 };
 
@@ -326,6 +341,13 @@ class CallResponse {
     return header_.call_id();
   }
 
+  // Return how long the server queued and handled the call, or null if it
+  // didn't report it.
+  const ServerTimingPB* server_timing() const {
+    DCHECK(parsed_);
+    return header_.has_timing() ? &header_.timing() : nullptr;
+  }
+
   // Return the serialized response data. This is just the response "body" --
   // either a serialized ErrorStatusPB, or the serialized user response
   // protobuf.
@@ -202,6 +202,17 @@ class MethodSubstitutions : public Substituter {
     bool track_result =
         static_cast<bool>(method_->options().GetExtension(track_rpc_result));
     (*map)["track_result"] = track_result ? " true" : "false";
+    bool run_inline_method =
+        static_cast<bool>(method_->options().GetExtension(run_inline));
+    (*map)["run_inline"] = run_inline_method ? "true" : "false";
+    bool high_priority_method =
+        static_cast<bool>(method_->options().GetExtension(high_priority));
+    (*map)["high_priority"] = high_priority_method ? "true" : "false";
+    (*map)["high_priority_max_call_size"] = SimpleItoa(
+        method_->options().GetExtension(high_priority_max_call_size));
+    bool parse_into_arena_method =
+        static_cast<bool>(method_->options().GetExtension(parse_into_arena));
+    (*map)["parse_into_arena"] = parse_into_arena_method ? "true" : "false";
     (*map)["authz_method"] =
         GetAuthzMethod(*method_).get_value_or("AuthorizeAllowAll");
   }
@@ -528,6 +539,10 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
             "                           ctx);\n"
             "    };\n"
             "    mi->track_result = $track_result$;\n"
+            "    mi->run_inline = $run_inline$;\n"
+            "    mi->high_priority = $high_priority$;\n"
+            "    mi->high_priority_max_call_size = $high_priority_max_call_size$;\n"
+            "    mi->parse_into_arena = $parse_into_arena$;\n"
             "    mi->handler_latency_histogram =\n"
             "        METRIC_handler_latency_$rpc_full_name_plainchars$.Instantiate(entity);\n"
             "    mi->func = [this](const Message* req, Message* resp, RpcContext* ctx) {\n"
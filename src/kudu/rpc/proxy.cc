@@ -23,6 +23,7 @@
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/core/ref.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/strings/substitute.h"
@@ -33,10 +34,33 @@
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/user_credentials.h"
 #include "kudu/util/countdown_latch.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/status.h"
 #include "kudu/util/user.h"
 
+DEFINE_int32(
+    rpc_bulk_connection_stripes,
+    1,
+    "Number of connections to each remote which calls of the bulk connection "
+    "class are spread over, round-robin. Striping lets bulk transfers over "
+    "high-latency links use more than one TCP congestion window.");
+TAG_FLAG(rpc_bulk_connection_stripes, advanced);
+TAG_FLAG(rpc_bulk_connection_stripes, experimental);
+TAG_FLAG(rpc_bulk_connection_stripes, runtime);
+
+static bool ValidateBulkConnectionStripes(
+    const char* flagname,
+    int32_t value) {
+  if (value < 1) {
+    LOG(ERROR) << "Invalid value for --" << flagname << ": " << value
+               << ", must be at least 1";
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(rpc_bulk_connection_stripes, &ValidateBulkConnectionStripes);
+
 using std::string;
 
 namespace kudu {
@@ -49,7 +73,8 @@ Proxy::Proxy(
     string service_name)
     : service_name_(std::move(service_name)),
       messenger_(std::move(messenger)),
-      is_started_(false) {
+      is_started_(false),
+      next_bulk_stripe_(0) {
   CHECK(messenger_ != nullptr);
   DCHECK(!service_name_.empty()) << "Proxy service name must not be blank";
 
@@ -79,8 +104,19 @@ void Proxy::AsyncRequest(
   CHECK(!controller->call_) << "Controller should be reset";
   base::subtle::NoBarrier_Store(&is_started_, true);
   RemoteMethod remote_method(service_name_, method);
-  controller->call_.reset(new OutboundCall(
-      conn_id_, remote_method, response, controller, callback));
+  ConnectionId conn_id = conn_id_;
+  if (controller->connection_class() != ConnectionClass::CONTROL) {
+    int stripe = 0;
+    if (controller->connection_class() == ConnectionClass::BULK) {
+      auto n = static_cast<uint32_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_bulk_stripe_, 1));
+      stripe = n % FLAGS_rpc_bulk_connection_stripes;
+    }
+    conn_id.set_connection_class(controller->connection_class(), stripe);
+  }
+  // One allocation for both the call and its reference count.
+  controller->call_ = std::make_shared<OutboundCall>(
+      conn_id, remote_method, response, controller, callback);
   controller->SetRequestParam(req);
   controller->SetMessenger(messenger_.get());
 
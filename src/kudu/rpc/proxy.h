@@ -123,6 +123,9 @@ class Proxy {
   ConnectionId conn_id_;
   mutable Atomic32 is_started_;
 
+  // Picks the connection for the next call of the bulk connection class.
+  mutable Atomic32 next_bulk_stripe_;
+
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
 
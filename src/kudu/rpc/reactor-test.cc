@@ -16,12 +16,15 @@
 // under the License.
 
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/function.hpp>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "kudu/gutil/macros.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/util/countdown_latch.h"
@@ -31,6 +34,8 @@
 #include "kudu/util/thread.h"
 
 using std::shared_ptr;
+using std::thread;
+using std::vector;
 
 namespace kudu {
 namespace rpc {
@@ -112,5 +117,60 @@ TEST_F(ReactorTest, TestReschedulesOnSameReactorThread) {
   latch_.Wait();
 }
 
+// Tasks kept in a timer wheel run no earlier than their delay, whichever
+// level of the wheel they start in, and are aborted on shutdown.
+TEST_F(ReactorTest, TestTimerWheel) {
+  timer_wheel_tick_ = MonoDelta::FromMilliseconds(1);
+  shared_ptr<Messenger> messenger;
+  ASSERT_OK(CreateMessenger("wheel_messenger", &messenger, 2));
+
+  const int kDelaysMs[] = {0, 5, 63, 64, 100, 300};
+  latch_.Reset(arraysize(kDelaysMs));
+  MonoTime before = MonoTime::Now();
+  for (int delay_ms : kDelaysMs) {
+    messenger->ScheduleOnReactor(
+        [this, before, delay_ms](const Status& s) {
+          CHECK_OK(s);
+          CHECK_GE((MonoTime::Now() - before).ToMilliseconds(), delay_ms);
+          latch_.CountDown();
+        },
+        MonoDelta::FromMilliseconds(delay_ms));
+  }
+  latch_.Wait();
+
+  latch_.Reset(1);
+  messenger->ScheduleOnReactor(
+      boost::bind(
+          &ReactorTest::ScheduledTask,
+          this,
+          _1,
+          Status::Aborted("doesn't matter")),
+      MonoDelta::FromSeconds(60));
+  messenger->Shutdown();
+  latch_.Wait();
+}
+
+// Many threads queueing tasks at once must not lose any of them.
+TEST_F(ReactorTest, TestConcurrentlyScheduledTasksAllRun) {
+  constexpr int kNumThreads = 8;
+  constexpr int kTasksPerThread = 1000;
+  latch_.Reset(kNumThreads * kTasksPerThread);
+
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this]() {
+      for (int j = 0; j < kTasksPerThread; j++) {
+        messenger_->ScheduleOnReactor(
+            boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+            MonoDelta::FromSeconds(0));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  latch_.Wait();
+}
+
 } // namespace rpc
 } // namespace kudu
@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/reactor.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <memory>
 #include <mutex>
@@ -35,6 +36,8 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/rpc/client_negotiation.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/messenger.h"
@@ -42,9 +45,12 @@
 #include "kudu/rpc/outbound_call.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/server_negotiation.h"
+#include "kudu/rpc/transfer.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/debug/sanitizer_scopes.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -95,6 +101,17 @@ METRIC_DEFINE_histogram(
     100,
     2);
 
+METRIC_DEFINE_histogram(
+    server,
+    reactor_spin_percent,
+    "Reactor Thread Spin Percentage",
+    kudu::MetricUnit::kUnits,
+    "The percentage of time that the reactor spends polling for network "
+    "activity without blocking, when it is configured to spin after activity. "
+    "This time is not counted as load in reactor_load_percent.",
+    100,
+    2);
+
 METRIC_DEFINE_histogram(
     server,
     reactor_active_latency_us,
@@ -134,22 +151,42 @@ void DoInitLibEv() {
 
 } // anonymous namespace
 
-ReactorThread::ReactorThread(Reactor* reactor, const MessengerBuilder& bld)
+ReactorThread::ReactorThread(
+    Reactor* reactor,
+    int index,
+    const MessengerBuilder& bld)
     : loop_(kDefaultLibEvFlags),
       cur_time_(MonoTime::Now()),
       last_unused_tcp_scan_(cur_time_),
       reactor_(reactor),
       connection_keepalive_time_(bld.connection_keepalive_time_),
+      track_idle_conns_(
+          bld.idle_connection_lru_ &&
+          bld.connection_keepalive_time_ >= MonoDelta::FromMilliseconds(0)),
       coarse_timer_granularity_(bld.coarse_timer_granularity_),
       total_client_conns_cnt_(0),
       total_server_conns_cnt_(0),
       total_client_normal_tls_conns_cnt_(0),
-      total_server_normal_tls_conns_cnt_(0) {
+      total_server_normal_tls_conns_cnt_(0),
+      inbound_buffer_pool_(std::make_shared<InboundBufferPool>(
+          MemTracker::FindOrCreateGlobalTracker(-1, "rpc_inbound_buffers"))),
+      cpu_(
+          bld.reactor_cpus_.empty()
+              ? -1
+              : bld.reactor_cpus_[index % bld.reactor_cpus_.size()]),
+      spin_cycles_(static_cast<int64_t>(
+          bld.reactor_spin_us_ * base::CyclesPerSecond() / 1000000)),
+      socket_busy_poll_us_(bld.socket_busy_poll_us_) {
+  if (bld.timer_wheel_tick_.Initialized()) {
+    timer_wheel_.reset(new TimerWheel(bld.timer_wheel_tick_));
+  }
   if (bld.metric_entity_) {
     invoke_us_histogram_ =
         METRIC_reactor_active_latency_us.Instantiate(bld.metric_entity_);
     load_percent_histogram_ =
         METRIC_reactor_load_percent.Instantiate(bld.metric_entity_);
+    spin_percent_histogram_ =
+        METRIC_reactor_spin_percent.Instantiate(bld.metric_entity_);
   }
 }
 
@@ -170,6 +207,13 @@ Status ReactorThread::Init() {
       coarse_timer_granularity_.ToSeconds(),
       coarse_timer_granularity_.ToSeconds());
 
+  // The timer wheel's ticks only start once it holds a task.
+  if (timer_wheel_) {
+    timer_wheel_timer_.set(loop_);
+    timer_wheel_timer_.set<ReactorThread, &ReactorThread::TimerWheelHandler>(
+        this); // NOLINT(*)
+  }
+
   // Register our callbacks. ev++ doesn't provide handy wrappers for these.
   ev_set_userdata(loop_, this);
   ev_set_loop_release_cb(
@@ -186,11 +230,15 @@ void ReactorThread::InvokePendingCb(struct ev_loop* loop) {
   // This is called quite frequently so we use CycleClock rather than MonoTime
   // since it's a bit faster.
   int64_t start = kudu::CycleClock::Now();
+  ReactorThread* thr = static_cast<ReactorThread*>(ev_userdata(loop));
+  if (ev_pending_count(loop) > 0) {
+    thr->last_active_cycles_ = start;
+    thr->num_active_iterations_++;
+  }
   ev_invoke_pending(loop);
   int64_t dur_cycles = kudu::CycleClock::Now() - start;
 
   // Contribute this to our histogram.
-  ReactorThread* thr = static_cast<ReactorThread*>(ev_userdata(loop));
   if (thr->invoke_us_histogram_) {
     thr->invoke_us_histogram_->Increment(
         dur_cycles * 1000000 / base::CyclesPerSecond());
@@ -235,6 +283,11 @@ void ReactorThread::Shutdown(Messenger::ShutdownMode mode) {
 void ReactorThread::ShutdownInternal() {
   DCHECK(IsCurrentThread());
 
+  for (const auto& listener : listeners_) {
+    listener->io.stop();
+  }
+  listeners_.clear();
+
   // Tear down any outbound TCP connections.
   Status service_unavailable = ShutdownError(false);
   VLOG(1) << name() << ": tearing down outbound TCP connections...";
@@ -251,6 +304,7 @@ void ReactorThread::ShutdownInternal() {
     VLOG(1) << name() << ": shutting down " << conn->ToString();
     conn->Shutdown(service_unavailable);
   }
+  idle_conns_.clear();
   server_conns_.clear();
 
   // Abort any scheduled tasks.
@@ -263,6 +317,15 @@ void ReactorThread::ShutdownInternal() {
     scheduled_tasks_.pop_front();
     t->Abort(aborted); // should also free the task.
   }
+  if (timer_wheel_) {
+    boost::intrusive::list<DelayedTask> wheel_tasks;
+    timer_wheel_->Clear(&wheel_tasks);
+    while (!wheel_tasks.empty()) {
+      DelayedTask* t = &wheel_tasks.front();
+      wheel_tasks.pop_front();
+      t->Abort(aborted);
+    }
+  }
 
   // Remove the OpenSSL thread state.
   //
@@ -331,16 +394,25 @@ void ReactorThread::AsyncHandler(ev::async& /*watcher*/, int /*revents*/) {
   if (PREDICT_FALSE(reactor_->closing())) {
     ShutdownInternal();
     loop_.break_loop(); // break the epoll loop and terminate the thread
+    loop_broken_ = true;
     return;
   }
 
-  boost::intrusive::list<ReactorTask> tasks;
-  reactor_->DrainTaskQueue(&tasks);
+  // Tasks go first, so that a cancellation queued along with its call finds
+  // the call before it is assigned to a connection.
+  ReactorTask* task = reactor_->pending_tasks_.PopAll();
+  while (task) {
+    // Running the task may delete it.
+    ReactorTask* next = task->next_pending_;
+    task->Run(this);
+    task = next;
+  }
 
-  while (!tasks.empty()) {
-    ReactorTask& task = tasks.front();
-    tasks.pop_front();
-    task.Run(this);
+  OutboundCall* call = reactor_->pending_calls_.PopAll();
+  while (call) {
+    OutboundCall* next = call->next_queued_;
+    AssignOutboundCall(std::move(call->queued_self_));
+    call = next;
   }
 }
 
@@ -354,15 +426,106 @@ void ReactorThread::RegisterConnection(scoped_refptr<Connection> conn) {
     return;
   }
   ++total_server_conns_cnt_;
+  if (track_idle_conns_) {
+    conn->idle_check_time_ = cur_time_ + connection_keepalive_time_;
+    idle_conns_.push_back(*conn.get());
+  }
   server_conns_.emplace_back(std::move(conn));
 }
 
+void ReactorThread::MarkConnectionActive(Connection* conn) {
+  DCHECK(IsCurrentThread());
+  const MonoTime check_time = cur_time_ + connection_keepalive_time_;
+  // cur_time_ only moves on each tick of the coarse timer, so most activity
+  // finds the connection already at the back.
+  if (conn->idle_check_time_ == check_time) {
+    return;
+  }
+  conn->idle_check_time_ = check_time;
+  idle_conns_.erase(idle_conns_.iterator_to(*conn));
+  idle_conns_.push_back(*conn);
+}
+
+Status ReactorThread::StartListening(
+    Socket* socket,
+    scoped_refptr<Counter> accepted) {
+  DCHECK(IsCurrentThread());
+  RETURN_NOT_OK(socket->SetNonBlocking(true));
+  unique_ptr<Listener> listener(new Listener);
+  listener->socket = socket;
+  listener->accepted = std::move(accepted);
+  listener->io.set(loop_);
+  listener->io.set<ReactorThread, &ReactorThread::AcceptHandler>(
+      this); // NOLINT(*)
+  listener->io.start(socket->GetFd(), ev::READ);
+  listeners_.emplace_back(std::move(listener));
+  return Status::OK();
+}
+
+Status ReactorThread::StopListening(Socket* socket) {
+  DCHECK(IsCurrentThread());
+  for (auto it = listeners_.begin(); it != listeners_.end(); ++it) {
+    if ((*it)->socket == socket) {
+      (*it)->io.stop();
+      listeners_.erase(it);
+      return Status::OK();
+    }
+  }
+  return Status::NotFound("not listening on socket");
+}
+
+void ReactorThread::AcceptHandler(ev::io& watcher, int revents) {
+  DCHECK(IsCurrentThread());
+  Listener* listener = nullptr;
+  for (const auto& l : listeners_) {
+    if (l->socket->GetFd() == watcher.fd) {
+      listener = l.get();
+      break;
+    }
+  }
+  DCHECK(listener);
+  if (PREDICT_FALSE(EV_ERROR & revents)) {
+    LOG(WARNING) << name() << ": got an error in the accept handler";
+    return;
+  }
+
+  // Take a bounded batch, so that a flood of connections doesn't starve the
+  // existing ones. Those left over are taken on the next loop iteration.
+  constexpr int kMaxAcceptsPerEvent = 32;
+  for (int i = 0; i < kMaxAcceptsPerEvent; i++) {
+    Socket new_sock;
+    Sockaddr remote;
+    Status s = listener->socket->Accept(
+        &new_sock, &remote, Socket::FLAG_NONBLOCKING);
+    if (!s.ok()) {
+      if (!Socket::IsTemporarySocketError(s.posix_code())) {
+        KLOG_EVERY_N_SECS(WARNING, 1)
+            << name() << ": accept failed: " << s.ToString() << THROTTLE_MSG;
+      }
+      return;
+    }
+    s = new_sock.SetNoDelay(true);
+    if (!s.ok()) {
+      KLOG_EVERY_N_SECS(WARNING, 1)
+          << name() << ": failed to set TCP_NODELAY on a socket accepted from "
+          << remote.ToString() << ": " << s.ToString() << THROTTLE_MSG;
+      continue;
+    }
+    listener->accepted->Increment();
+    VLOG(3) << name() << ": new inbound connection to " << remote.ToString();
+    unique_ptr<Socket> conn_socket(new Socket(new_sock.Release()));
+    RegisterConnection(new Connection(
+        this, remote, std::move(conn_socket), ConnectionDirection::SERVER));
+  }
+}
+
 void ReactorThread::ResetAllConnections() {
   DCHECK(IsCurrentThread());
   for (const scoped_refptr<Connection>& conn : server_conns_) {
     conn->Shutdown(
         Status::Aborted("Shutting down server connection by request"));
   }
+  idle_conns_.clear();
   server_conns_.clear();
 
   for (const auto& conn_entry : client_conns_) {
@@ -430,20 +593,58 @@ void ReactorThread::TimerHandler(ev::timer& /*watcher*/, int revents) {
     int64_t cycles_delta = (now_cycles - last_load_measurement_.time_cycles);
     int64_t poll_cycles_delta =
         total_poll_cycles_ - last_load_measurement_.poll_cycles;
+    int64_t spin_cycles_delta =
+        total_spin_cycles_ - last_load_measurement_.spin_cycles;
     double poll_fraction =
         static_cast<double>(poll_cycles_delta) / cycles_delta;
-    double active_fraction = 1 - poll_fraction;
+    double spin_fraction =
+        static_cast<double>(spin_cycles_delta) / cycles_delta;
+    double active_fraction = 1 - poll_fraction - spin_fraction;
     if (load_percent_histogram_) {
       load_percent_histogram_->Increment(
           static_cast<int>(active_fraction * 100));
     }
+    if (spin_cycles_ > 0 && spin_percent_histogram_) {
+      spin_percent_histogram_->Increment(
+          static_cast<int>(spin_fraction * 100));
+    }
   }
   last_load_measurement_.time_cycles = now_cycles;
   last_load_measurement_.poll_cycles = total_poll_cycles_;
+  last_load_measurement_.spin_cycles = total_spin_cycles_;
 
   ScanIdleConnections();
 }
 
+void ReactorThread::TimerWheelHandler(ev::timer& /*watcher*/, int revents) {
+  DCHECK(IsCurrentThread());
+  if (EV_ERROR & revents) {
+    LOG(WARNING) << "Reactor " << name()
+                 << " got an error in the timer wheel handler.";
+    return;
+  }
+  boost::intrusive::list<DelayedTask> due;
+  timer_wheel_->Advance(&due);
+  if (timer_wheel_->empty()) {
+    timer_wheel_timer_.stop();
+  }
+  while (!due.empty()) {
+    DelayedTask* t = &due.front();
+    due.pop_front();
+    t->Fire();
+  }
+}
+
+void ReactorThread::ScheduleOnTimerWheel(DelayedTask* task) {
+  DCHECK(IsCurrentThread());
+  bool was_empty = timer_wheel_->empty();
+  timer_wheel_->Insert(task);
+  if (was_empty) {
+    const double tick = timer_wheel_->tick().ToSeconds();
+    timer_wheel_timer_.start(tick, tick);
+  }
+}
+
 void ReactorThread::RegisterTimeout(ev::timer* watcher) {
   watcher->set(loop_);
 }
@@ -454,7 +655,9 @@ void ReactorThread::ScanIdleConnections() {
   const auto server_conns_end = server_conns_.end();
   uint64_t timed_out = 0;
   // Scan for idle server connections if it's enabled.
-  if (connection_keepalive_time_ >= MonoDelta::FromMilliseconds(0)) {
+  if (track_idle_conns_) {
+    timed_out = ExpireIdleConnections();
+  } else if (connection_keepalive_time_ >= MonoDelta::FromMilliseconds(0)) {
     for (auto it = server_conns_.begin(); it != server_conns_end;) {
       Connection* conn = it->get();
       if (!conn->Idle()) {
@@ -500,6 +703,41 @@ void ReactorThread::ScanIdleConnections() {
                            << " TCP connections.";
 }
 
+uint64_t ReactorThread::ExpireIdleConnections() {
+  DCHECK(IsCurrentThread());
+  uint64_t timed_out = 0;
+  while (!idle_conns_.empty()) {
+    Connection* conn = &idle_conns_.front();
+    if (conn->idle_check_time_ >= cur_time_) {
+      break;
+    }
+    idle_conns_.pop_front();
+    const MonoDelta connection_delta(cur_time_ - conn->last_activity_time());
+    if (!conn->Idle() || connection_delta <= connection_keepalive_time_) {
+      // Not idle, e.g. handling a long call: check again after the keepalive
+      // time, as the activity which ends the call moves it back anyway.
+      VLOG(10) << "Connection " << conn->ToString() << " not idle";
+      conn->idle_check_time_ = cur_time_ + connection_keepalive_time_;
+      idle_conns_.push_back(*conn);
+      continue;
+    }
+
+    conn->Shutdown(Status::NetworkError(Substitute(
+        "connection timed out after $0",
+        connection_keepalive_time_.ToString())));
+    VLOG(1) << "Timing out connection " << conn->ToString()
+            << " - it has been idle for " << connection_delta.ToString();
+    ++timed_out;
+  }
+  if (timed_out > 0) {
+    // The timed out connections are the only unlinked ones.
+    server_conns_.remove_if([](const scoped_refptr<Connection>& conn) {
+      return !conn->idle_hook_.is_linked();
+    });
+  }
+  return timed_out;
+}
+
 const std::string& ReactorThread::name() const {
   return reactor_->name();
 }
@@ -519,8 +757,18 @@ bool ReactorThread::IsCurrentThread() const {
 void ReactorThread::RunThread() {
   ThreadRestrictions::SetWaitAllowed(false);
   ThreadRestrictions::SetIOAllowed(false);
+  if (cpu_ >= 0) {
+    Status s = BindCurrentThreadToCpus({cpu_});
+    if (!s.ok()) {
+      LOG(WARNING) << name() << ": " << s.ToString();
+    }
+  }
   DVLOG(6) << "Calling ReactorThread::RunThread()...";
-  loop_.run(0);
+  if (spin_cycles_ > 0) {
+    RunSpinning();
+  } else {
+    loop_.run(0);
+  }
   VLOG(1) << name() << " thread exiting.";
 
   // No longer need the messenger. This causes the messenger to
@@ -528,6 +776,25 @@ void ReactorThread::RunThread() {
   reactor_->messenger_.reset();
 }
 
+void ReactorThread::RunSpinning() {
+  while (!loop_broken_) {
+    int64_t start = kudu::CycleClock::Now();
+    if (start - last_active_cycles_ >= spin_cycles_) {
+      loop_.run(ev::ONCE);
+      continue;
+    }
+    // Recently active: poll without blocking, so that events arriving soon
+    // are picked up without the cost of sleeping and being woken.
+    int64_t active_iterations = num_active_iterations_;
+    int64_t poll_cycles = total_poll_cycles_;
+    loop_.run(ev::NOWAIT);
+    if (num_active_iterations_ == active_iterations) {
+      total_spin_cycles_ += kudu::CycleClock::Now() - start -
+          (total_poll_cycles_ - poll_cycles);
+    }
+  }
+}
+
 bool ReactorThread::FindConnection(
     const ConnectionId& conn_id,
     CredentialsPolicy cred_policy,
@@ -670,6 +937,14 @@ void ReactorThread::CompleteConnectionNegotiation(
     return;
   }
 
+  if (socket_busy_poll_us_ > 0) {
+    s = conn->socket()->SetBusyPoll(socket_busy_poll_us_);
+    if (PREDICT_FALSE(!s.ok())) {
+      KLOG_EVERY_N_SECS(WARNING, 300)
+          << conn->ToString() << ": " << s.ToString() << THROTTLE_MSG;
+    }
+  }
+
   conn->MarkNegotiationComplete();
   conn->EpollRegister(loop_);
 }
@@ -728,6 +1003,9 @@ void ReactorThread::DestroyConnection(
       ++it;
     }
   } else if (conn->direction() == ConnectionDirection::SERVER) {
+    if (conn->idle_hook_.is_linked()) {
+      idle_conns_.erase(idle_conns_.iterator_to(*conn));
+    }
     auto it = server_conns_.begin();
     while (it != server_conns_.end()) {
       if ((*it).get() == conn) {
@@ -747,10 +1025,14 @@ DelayedTask::DelayedTask(
 void DelayedTask::Run(ReactorThread* thread) {
   DCHECK(thread_ == nullptr) << "Task has already been scheduled";
   DCHECK(thread->IsCurrentThread());
-  DCHECK(!is_linked()) << "Should not be linked on pending_tasks_ anymore";
+  DCHECK(!is_linked()) << "Should not be linked on scheduled_tasks_ yet";
 
   // Schedule the task to run later.
   thread_ = thread;
+  if (thread->timer_wheel_) {
+    thread->ScheduleOnTimerWheel(this);
+    return;
+  }
   timer_.set(thread->loop_);
   timer_.set<DelayedTask, &DelayedTask::TimerHandler>(this); // NOLINT(*)
   timer_.start(
@@ -774,9 +1056,104 @@ void DelayedTask::TimerHandler(ev::timer& /*watcher*/, int revents) {
     LOG(WARNING) << msg;
     Abort(Status::Aborted(msg)); // Will delete 'this'.
   } else {
-    func_(Status::OK());
-    delete this;
+    Fire();
+  }
+}
+
+void DelayedTask::Fire() {
+  func_(Status::OK());
+  delete this;
+}
+
+TimerWheel::TimerWheel(MonoDelta tick)
+    : tick_(tick), start_(MonoTime::Now()), now_tick_(0), size_(0) {
+  DCHECK_GT(tick_.ToNanoseconds(), 0);
+}
+
+int64_t TimerWheel::TicksSinceStart(MonoTime t) const {
+  return (t - start_).ToNanoseconds() / tick_.ToNanoseconds();
+}
+
+void TimerWheel::Insert(DelayedTask* task) {
+  DCHECK(!task->is_linked());
+  MonoTime now = MonoTime::Now();
+  if (size_ == 0) {
+    // The wheel doesn't tick while empty, so catch up without visiting every
+    // tick since.
+    now_tick_ = std::max(now_tick_, TicksSinceStart(now));
+  }
+  // Round up, so that the task never fires early, and fire no sooner than the
+  // next tick.
+  const int64_t tick_ns = tick_.ToNanoseconds();
+  const int64_t deadline_ns = (now + task->when_ - start_).ToNanoseconds();
+  task->deadline_tick_ =
+      std::max(now_tick_ + 1, (deadline_ns + tick_ns - 1) / tick_ns);
+  Place(task);
+  size_++;
+}
+
+void TimerWheel::Place(DelayedTask* task) {
+  const int64_t deadline = task->deadline_tick_;
+  DCHECK_GT(deadline, now_tick_);
+  for (int level = 0; level < kLevels; level++) {
+    const int above = kSlotBits * (level + 1);
+    if ((deadline >> above) == (now_tick_ >> above)) {
+      slots_[level][(deadline >> (kSlotBits * level)) & (kSlots - 1)]
+          .push_back(*task);
+      return;
+    }
+  }
+  overflow_.push_back(*task);
+}
+
+void TimerWheel::Advance(TaskList* due) {
+  const int64_t target = TicksSinceStart(MonoTime::Now());
+  while (now_tick_ < target) {
+    if (size_ == 0) {
+      now_tick_ = target;
+      break;
+    }
+    now_tick_++;
+
+    // Whenever the levels below come round to their first slot, move the
+    // tasks in the level's current slot down.
+    for (int level = 1; level <= kLevels; level++) {
+      const int64_t below = int64_t{1} << (kSlotBits * level);
+      if (now_tick_ & (below - 1)) {
+        break;
+      }
+      TaskList moved;
+      moved.swap(level == kLevels
+                     ? overflow_
+                     : slots_[level]
+                             [(now_tick_ >> (kSlotBits * level)) &
+                              (kSlots - 1)]);
+      while (!moved.empty()) {
+        DelayedTask* task = &moved.front();
+        moved.pop_front();
+        if (task->deadline_tick_ == now_tick_) {
+          due->push_back(*task);
+          size_--;
+        } else {
+          Place(task);
+        }
+      }
+    }
+
+    TaskList& slot = slots_[0][now_tick_ & (kSlots - 1)];
+    size_ -= slot.size();
+    due->splice(due->end(), slot);
+  }
+}
+
+void TimerWheel::Clear(TaskList* tasks) {
+  for (auto& level : slots_) {
+    for (auto& slot : level) {
+      tasks->splice(tasks->end(), slot);
+    }
   }
+  tasks->splice(tasks->end(), overflow_);
+  size_ = 0;
 }
 
 Reactor::Reactor(
@@ -786,7 +1163,7 @@ Reactor::Reactor(
     : messenger_(std::move(messenger)),
       name_(StringPrintf("%s_R%03d", messenger_->name().c_str(), index)),
       closing_(false),
-      thread_(this, bld) {
+      thread_(this, index, bld) {
   static std::once_flag libev_once;
   std::call_once(libev_once, DoInitLibEv);
 }
@@ -805,15 +1182,26 @@ void Reactor::Shutdown(Messenger::ShutdownMode mode) {
     closing_ = true;
   }
 
+  // No new tasks or calls can get queued once the queues are closed.
+  ReactorTask* task = pending_tasks_.Close();
+  OutboundCall* call = pending_calls_.Close();
+
   thread_.Shutdown(mode);
 
-  // Abort all pending tasks. No new tasks can get scheduled after this
-  // because ScheduleReactorTask() tests the closing_ flag set above.
+  // Abort everything left pending.
   Status aborted = ShutdownError(true);
-  while (!pending_tasks_.empty()) {
-    ReactorTask& task = pending_tasks_.front();
-    pending_tasks_.pop_front();
-    task.Abort(aborted);
+  while (task) {
+    ReactorTask* next = task->next_pending_;
+    task->Abort(aborted);
+    task = next;
+  }
+  while (call) {
+    OutboundCall* next = call->next_queued_;
+    shared_ptr<OutboundCall> self = std::move(call->queued_self_);
+    // It doesn't matter what is the actual phase of the OutboundCall: just set
+    // it to Phase::REMOTE_CALL to finalize the state of the call.
+    self->SetFailed(aborted, OutboundCall::Phase::REMOTE_CALL);
+    call = next;
   }
 }
 
@@ -905,28 +1293,17 @@ void Reactor::RegisterInboundSocket(Socket* socket, const Sockaddr& remote) {
   ScheduleReactorTask(task);
 }
 
-// Task which runs in the reactor thread to assign an outbound call
-// to a connection.
-class AssignOutboundCallTask : public ReactorTask {
- public:
-  explicit AssignOutboundCallTask(shared_ptr<OutboundCall> call)
-      : call_(std::move(call)) {}
-
-  void Run(ReactorThread* reactor) override {
-    reactor->AssignOutboundCall(std::move(call_));
-    delete this;
-  }
-
-  void Abort(const Status& status) override {
-    // It doesn't matter what is the actual phase of the OutboundCall: just set
-    // it to Phase::REMOTE_CALL to finalize the state of the call.
-    call_->SetFailed(status, OutboundCall::Phase::REMOTE_CALL);
-    delete this;
-  }
+Status Reactor::StartListening(
+    Socket* socket,
+    scoped_refptr<Counter> accepted) {
+  return RunOnReactorThread(boost::bind(
+      &ReactorThread::StartListening, &thread_, socket, std::move(accepted)));
+}
 
- private:
-  shared_ptr<OutboundCall> call_;
-};
+Status Reactor::StopListening(Socket* socket) {
+  return RunOnReactorThread(
+      boost::bind(&ReactorThread::StopListening, &thread_, socket));
+}
 
 void Reactor::QueueOutboundCall(const shared_ptr<OutboundCall>& call) {
   DVLOG(3) << name_ << ": queueing outbound call " << call->ToString()
@@ -935,7 +1312,19 @@ void Reactor::QueueOutboundCall(const shared_ptr<OutboundCall>& call) {
   if (PREDICT_FALSE(call->ShouldInjectCancellation())) {
     QueueCancellation(call);
   }
-  ScheduleReactorTask(new AssignOutboundCallTask(call));
+  // The call is queued through itself, so the hot path allocates no task.
+  // The reactor thread assigns it to a connection.
+  DCHECK(!call->queued_self_);
+  call->queued_self_ = call;
+  bool was_empty;
+  if (PREDICT_FALSE(!pending_calls_.Push(call.get(), &was_empty))) {
+    call->queued_self_.reset();
+    call->SetFailed(ShutdownError(false), OutboundCall::Phase::REMOTE_CALL);
+    return;
+  }
+  if (was_empty) {
+    thread_.WakeThread();
+  }
 }
 
 class CancellationTask : public ReactorTask {
@@ -979,27 +1368,16 @@ void Reactor::QueueResetConnections() {
 }
 
 void Reactor::ScheduleReactorTask(ReactorTask* task) {
-  {
-    std::unique_lock<LockType> l(lock_);
-    if (closing_) {
-      // We guarantee the reactor lock is not taken when calling Abort().
-      l.unlock();
-      task->Abort(ShutdownError(false));
-      return;
-    }
-    pending_tasks_.push_back(*task);
+  bool was_empty;
+  if (PREDICT_FALSE(!pending_tasks_.Push(task, &was_empty))) {
+    // The reactor lock is not taken when calling Abort().
+    task->Abort(ShutdownError(false));
+    return;
   }
-  thread_.WakeThread();
-}
-
-bool Reactor::DrainTaskQueue(
-    boost::intrusive::list<ReactorTask>* tasks) { // NOLINT(*)
-  std::lock_guard<LockType> l(lock_);
-  if (closing_) {
-    return false;
+  // Whoever queued the first pending task has woken the thread already.
+  if (was_empty) {
+    thread_.WakeThread();
   }
-  tasks->swap(pending_tasks_);
-  return true;
 }
 
 } // namespace rpc
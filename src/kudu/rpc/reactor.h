@@ -17,11 +17,13 @@
 #ifndef KUDU_RPC_REACTOR_H
 #define KUDU_RPC_REACTOR_H
 
+#include <atomic>
 #include <cstdint>
 #include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/function.hpp> // IWYU pragma: keep
 #include <boost/intrusive/list.hpp>
@@ -29,10 +31,12 @@
 #include <ev++.h>
 
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/connection_id.h"
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/outbound_call.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
@@ -77,6 +81,71 @@ struct ReactorMetrics {
   uint64_t total_server_normal_tls_connections_;
 };
 
+// An intrusive queue which any thread may push to, and from which a single
+// thread takes all the entries at once, without locking. Entries are linked
+// through their 'Next' member. Once closed, pushes fail.
+template <typename T, T* T::*Next>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(nullptr) {}
+
+  // Pushes 'entry' unless the queue is closed. Sets 'was_empty' if the queue
+  // had no entries before, in which case the consumer needs waking: otherwise
+  // whoever pushed the first entry wakes it.
+  bool Push(T* entry, bool* was_empty) {
+    T* head = head_.load(std::memory_order_relaxed);
+    do {
+      if (PREDICT_FALSE(head == Closed())) {
+        return false;
+      }
+      entry->*Next = head;
+    } while (!head_.compare_exchange_weak(
+        head, entry, std::memory_order_release, std::memory_order_relaxed));
+    *was_empty = head == nullptr;
+    return true;
+  }
+
+  // Takes all the entries, returning the oldest, which links to the rest in
+  // the order they were pushed.
+  T* PopAll() {
+    T* head = head_.load(std::memory_order_relaxed);
+    do {
+      if (head == nullptr || head == Closed()) {
+        return nullptr;
+      }
+    } while (!head_.compare_exchange_weak(
+        head, nullptr, std::memory_order_acquire, std::memory_order_relaxed));
+    return Reverse(head);
+  }
+
+  // Closes the queue, returning what's left in it like PopAll().
+  T* Close() {
+    T* head = head_.exchange(Closed(), std::memory_order_acquire);
+    return head == Closed() ? nullptr : Reverse(head);
+  }
+
+ private:
+  static T* Closed() {
+    return reinterpret_cast<T*>(uintptr_t{1});
+  }
+
+  static T* Reverse(T* head) {
+    T* reversed = nullptr;
+    while (head) {
+      T* next = head->*Next;
+      head->*Next = reversed;
+      reversed = head;
+      head = next;
+    }
+    return reversed;
+  }
+
+  // The most recently pushed entry.
+  std::atomic<T*> head_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
 // A task which can be enqueued to run on the reactor thread.
 class ReactorTask : public boost::intrusive::list_base_hook<> {
  public:
@@ -96,6 +165,12 @@ class ReactorTask : public boost::intrusive::list_base_hook<> {
   virtual ~ReactorTask();
 
  private:
+  friend class Reactor;
+  friend class ReactorThread;
+
+  // The next task in Reactor::pending_tasks_.
+  ReactorTask* next_pending_ = nullptr;
+
   DISALLOW_COPY_AND_ASSIGN(ReactorTask);
 };
 
@@ -117,9 +192,15 @@ class DelayedTask : public ReactorTask {
   void Abort(const Status& abort_status) override;
 
  private:
+  friend class ReactorThread;
+  friend class TimerWheel;
+
   // libev callback for when the registered timer fires.
   void TimerHandler(ev::timer& watcher, int revents);
 
+  // Runs the user function and frees the task, once its delay has passed.
+  void Fire();
+
   // User function to invoke when timer fires or when task is aborted.
   const boost::function<void(const Status&)> func_;
 
@@ -129,8 +210,71 @@ class DelayedTask : public ReactorTask {
   // Link back to registering reactor thread.
   ReactorThread* thread_;
 
-  // libev timer. Set when Run() is invoked.
+  // libev timer. Set when Run() is invoked, unless the reactor thread keeps
+  // its delayed tasks in a timer wheel.
   ev::timer timer_;
+
+  // The timer wheel tick on which the task fires, if it is in a timer wheel.
+  int64_t deadline_tick_ = 0;
+};
+
+// A hierarchical timer wheel of delayed tasks, advanced in ticks of a fixed
+// duration. Each level has 64 slots, a slot of each level spanning a whole
+// rotation of the level below. A task goes in the lowest level whose rotation
+// includes both now and its deadline, and is moved down a level each time its
+// slot comes round, so inserting a task and firing it are O(1).
+//
+// Only used from the reactor thread.
+class TimerWheel {
+ public:
+  explicit TimerWheel(MonoDelta tick);
+
+  // Adds 'task' to fire once its delay has passed.
+  void Insert(DelayedTask* task);
+
+  // Advances the wheel to the current time, moving the tasks which are due
+  // into 'due'.
+  void Advance(boost::intrusive::list<DelayedTask>* due);
+
+  // Removes all the tasks into 'tasks'.
+  void Clear(boost::intrusive::list<DelayedTask>* tasks);
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  const MonoDelta& tick() const {
+    return tick_;
+  }
+
+ private:
+  typedef boost::intrusive::list<DelayedTask> TaskList;
+
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr int kLevels = 4;
+
+  // The number of whole ticks between the wheel's start and 't'.
+  int64_t TicksSinceStart(MonoTime t) const;
+
+  // Puts 'task' in the slot for its deadline, relative to now_tick_.
+  void Place(DelayedTask* task);
+
+  const MonoDelta tick_;
+  const MonoTime start_;
+
+  // The last tick the wheel was advanced to.
+  int64_t now_tick_;
+
+  // The number of tasks in the wheel.
+  size_t size_;
+
+  TaskList slots_[kLevels][kSlots];
+
+  // Tasks due beyond the rotation of the top level.
+  TaskList overflow_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
 };
 
 // A ReactorThread is a libev event handler thread which manages I/O
@@ -152,7 +296,7 @@ class ReactorThread {
       ConnectionIdEqual>
       conn_multimap_t;
 
-  ReactorThread(Reactor* reactor, const MessengerBuilder& bld);
+  ReactorThread(Reactor* reactor, int index, const MessengerBuilder& bld);
 
   // This may be called from another thread.
   Status Init();
@@ -173,16 +317,37 @@ class ReactorThread {
   // This method is thread-safe.
   void WakeThread();
 
+  // The pool which large messages received by this thread's connections are
+  // read into.
+  const std::shared_ptr<InboundBufferPool>& inbound_buffer_pool() const {
+    return inbound_buffer_pool_;
+  }
+
+  // The CPU this thread is bound to, or -1 if it is not bound.
+  int cpu() const {
+    return cpu_;
+  }
+
   // libev callback for handling async notifications in our epoll thread.
   void AsyncHandler(ev::async& watcher, int revents);
 
   // libev callback for handling timer events in our epoll thread.
   void TimerHandler(ev::timer& watcher, int revents);
 
+  // libev callback for each tick of the timer wheel.
+  void TimerWheelHandler(ev::timer& watcher, int revents);
+
+  // Adds 'task' to the timer wheel, starting its ticks if it was empty.
+  void ScheduleOnTimerWheel(DelayedTask* task);
+
   // Register an epoll timer watcher with our event loop.
   // Does not set a timeout or start it.
   void RegisterTimeout(ev::timer* watcher);
 
+  // Moves 'conn', a server connection linked into 'idle_conns_', to the back
+  // of it, as it was just active.
+  void MarkConnectionActive(Connection* conn);
+
   // This may be called from another thread.
   const std::string& name() const;
 
@@ -211,7 +376,6 @@ class ReactorThread {
   Status GetMetrics(ReactorMetrics* metrics);
 
  private:
-  friend class AssignOutboundCallTask;
   friend class CancellationTask;
   friend class ResetConnectionsTask;
   friend class RegisterConnectionTask;
@@ -234,6 +398,10 @@ class ReactorThread {
   static void AboutToPollCb(struct ev_loop* loop) noexcept;
   static void PollCompleteCb(struct ev_loop* loop) noexcept;
 
+  // Runs the event loop, polling without blocking for spin_cycles_ after
+  // each burst of activity before blocking in epoll_wait() again.
+  void RunSpinning();
+
   // Find a connection to the given remote and returns it in 'conn'.
   // Returns true if a connection is found. Returns false otherwise.
   bool FindConnection(
@@ -266,6 +434,11 @@ class ReactorThread {
   // is skipped.
   void ScanIdleConnections();
 
+  // Like ScanIdleConnections() for server connections, but only visits those
+  // at the front of 'idle_conns_' whose check time has passed. Returns the
+  // number of connections timed out.
+  uint64_t ExpireIdleConnections();
+
   // Create a new client socket (non-blocking, NODELAY)
   static Status CreateClientSocket(Socket* sock);
 
@@ -286,6 +459,17 @@ class ReactorThread {
   // Register a new connection.
   void RegisterConnection(scoped_refptr<Connection> conn);
 
+  // Starts accepting connections from 'socket', which must be listening, in
+  // this thread's event loop. They are registered on this thread and counted
+  // in 'accepted'.
+  Status StartListening(Socket* socket, scoped_refptr<Counter> accepted);
+
+  // Stops accepting connections from 'socket'.
+  Status StopListening(Socket* socket);
+
+  // libev callback for when a listening socket has connections to accept.
+  void AcceptHandler(ev::io& watcher, int revents);
+
   // Manually destroy all connections so they can be recreated.
   void ResetAllConnections();
 
@@ -293,6 +477,13 @@ class ReactorThread {
   // etc. This is called from within the thread.
   void ShutdownInternal();
 
+  // A listening socket this thread accepts connections from.
+  struct Listener {
+    Socket* socket;
+    scoped_refptr<Counter> accepted;
+    ev::io io;
+  };
+
   scoped_refptr<kudu::Thread> thread_;
 
   // our epoll object (or kqueue, etc).
@@ -310,6 +501,16 @@ class ReactorThread {
   // Abort members, provided it was allocated on the heap.
   boost::intrusive::list<DelayedTask> scheduled_tasks_;
 
+  // If set, holds the scheduled delayed tasks instead, which then don't arm
+  // timers of their own.
+  std::unique_ptr<TimerWheel> timer_wheel_;
+
+  // Ticks the timer wheel while it holds any tasks.
+  ev::timer timer_wheel_timer_;
+
+  // The listening sockets this thread accepts connections from, if any.
+  std::vector<std::unique_ptr<Listener>> listeners_;
+
   // The current monotonic time.  Updated every coarse_timer_granularity_secs_.
   MonoTime cur_time_;
 
@@ -322,17 +523,35 @@ class ReactorThread {
   // List of current connections coming into the server.
   conn_list_t server_conns_;
 
+  typedef boost::intrusive::list<
+      Connection,
+      boost::intrusive::member_hook<
+          Connection,
+          boost::intrusive::list_member_hook<>,
+          &Connection::idle_hook_>>
+      idle_conn_list_t;
+
+  // If 'track_idle_conns_', the connections of 'server_conns_' ordered by
+  // when they are next checked for having been idle too long, which is the
+  // keepalive time after their last activity, or after the last check if they
+  // weren't idle then. Removed once they are expired or destroyed.
+  idle_conn_list_t idle_conns_;
+
   Reactor* reactor_;
 
   // If a connection has been idle for this much time, it is torn down.
   const MonoDelta connection_keepalive_time_;
 
+  // Whether server connections are expired through 'idle_conns_'.
+  const bool track_idle_conns_;
+
   // Scan for idle connections on this granularity.
   const MonoDelta coarse_timer_granularity_;
 
   // Metrics.
   scoped_refptr<Histogram> invoke_us_histogram_;
   scoped_refptr<Histogram> load_percent_histogram_;
+  scoped_refptr<Histogram> spin_percent_histogram_;
 
   // Total number of client connections opened during Reactor's lifetime.
   uint64_t total_client_conns_cnt_;
@@ -348,6 +567,12 @@ class ReactorThread {
   // lifetime.
   uint64_t total_server_normal_tls_conns_cnt_;
 
+  // Shared with the transfers received into it, which may outlive the thread.
+  const std::shared_ptr<InboundBufferPool> inbound_buffer_pool_;
+
+  // The CPU this thread is bound to, or -1.
+  const int cpu_;
+
   // Set prior to calling epoll and then reset back to -1 after each invocation
   // completes. Used for accounting total_poll_cycles_.
   int64_t cycle_clock_before_poll_ = -1;
@@ -356,12 +581,33 @@ class ReactorThread {
   // started.
   int64_t total_poll_cycles_ = 0;
 
+  // How long to spin after activity before blocking, or 0 to never spin.
+  const int64_t spin_cycles_;
+
+  // When the loop last had events to handle.
+  int64_t last_active_cycles_ = 0;
+
+  // The number of times the loop had events to handle.
+  int64_t num_active_iterations_ = 0;
+
+  // The total number of cycles spent spinning without finding any events,
+  // outside of epoll_wait().
+  int64_t total_spin_cycles_ = 0;
+
+  // Set once the loop has been broken for shutdown.
+  bool loop_broken_ = false;
+
+  // SO_BUSY_POLL to set on the sockets of new connections, or 0 to leave it.
+  const int socket_busy_poll_us_;
+
   // Accounting for determining load average in each cycle of TimerHandler.
   struct {
     // The cycle-time at which the load average was last calculated.
     int64_t time_cycles = -1;
     // The value of total_poll_cycles_ at the last-recorded time.
     int64_t poll_cycles = -1;
+    // The value of total_spin_cycles_ at the last-recorded time.
+    int64_t spin_cycles = -1;
   } last_load_measurement_;
 };
 
@@ -382,6 +628,11 @@ class Reactor {
 
   const std::string& name() const;
 
+  // The CPU the reactor thread is bound to, or -1 if it is not bound.
+  int cpu() const {
+    return thread_.cpu();
+  }
+
   // Collect metrics about the reactor.
   Status GetMetrics(ReactorMetrics* metrics);
 
@@ -395,6 +646,14 @@ class Reactor {
   // If the reactor is already shut down, takes care of closing the socket.
   void RegisterInboundSocket(Socket* socket, const Sockaddr& remote);
 
+  // Has the reactor thread accept connections from 'socket', a listening
+  // socket, and register them on itself, counting them in 'accepted'. The
+  // socket must stay open until StopListening() returns.
+  Status StartListening(Socket* socket, scoped_refptr<Counter> accepted);
+
+  // Stops the reactor thread accepting connections from 'socket'.
+  Status StopListening(Socket* socket);
+
   // Queue a new call to be sent. If the reactor is already shut down, marks
   // the call as failed.
   void QueueOutboundCall(const std::shared_ptr<OutboundCall>& call);
@@ -415,10 +674,6 @@ class Reactor {
 
   Status RunOnReactorThread(const boost::function<Status()>& f);
 
-  // If the Reactor is closing, returns false.
-  // Otherwise, drains the pending_tasks_ queue into the provided list.
-  bool DrainTaskQueue(boost::intrusive::list<ReactorTask>* tasks);
-
   Messenger* messenger() const {
     return messenger_.get();
   }
@@ -447,10 +702,12 @@ class Reactor {
   // Guarded by lock_.
   bool closing_;
 
-  // Tasks to be run within the reactor thread.
-  // Guarded by lock_.
-  boost::intrusive::list<ReactorTask>
-      pending_tasks_; // NOLINT(build/include_what_you_use)
+  // Tasks to be run within the reactor thread. Closed on shutdown.
+  MpscQueue<ReactorTask, &ReactorTask::next_pending_> pending_tasks_;
+
+  // Outbound calls to be assigned to connections. These are queued through
+  // the calls themselves, rather than in a task allocated for each.
+  MpscQueue<OutboundCall, &OutboundCall::next_queued_> pending_calls_;
 
   ReactorThread thread_;
 
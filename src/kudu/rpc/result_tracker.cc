@@ -18,6 +18,7 @@
 #include "kudu/rpc/result_tracker.h"
 
 #include <algorithm>
+#include <functional>
 #include <mutex>
 #include <ostream>
 
@@ -63,6 +64,17 @@ DEFINE_int64(
     "Interval at which the result tracker will look for entries to GC.");
 TAG_FLAG(result_tracker_gc_interval_ms, hidden);
 
+DEFINE_int32(
+    result_tracker_num_shards,
+    1,
+    "Number of shards the result tracker splits its clients into, by client "
+    "id. Each shard has its own lock and is garbage collected on its own, so "
+    "that requests from many clients don't contend on a single lock.");
+TAG_FLAG(result_tracker_num_shards, experimental);
+DEFINE_validator(
+    result_tracker_num_shards,
+    [](const char* /*flagname*/, int32_t value) { return value >= 1; });
+
 namespace kudu {
 namespace rpc {
 
@@ -108,11 +120,13 @@ struct ScopedMemTrackerUpdater {
 };
 
 ResultTracker::ResultTracker(shared_ptr<MemTracker> mem_tracker)
-    : mem_tracker_(std::move(mem_tracker)),
-      clients_(
-          ClientStateMap::key_compare(),
-          ClientStateMapAllocator(mem_tracker_)),
-      gc_thread_stop_latch_(1) {}
+    : mem_tracker_(std::move(mem_tracker)), gc_thread_stop_latch_(1) {
+  const int num_shards = FLAGS_result_tracker_num_shards;
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard(mem_tracker_));
+  }
+}
 
 ResultTracker::~ResultTracker() {
   if (gc_thread_) {
@@ -120,29 +134,41 @@ ResultTracker::~ResultTracker() {
     gc_thread_->Join();
   }
 
-  lock_guard<simple_spinlock> l(lock_);
   // Release all the memory for the stuff we'll delete on destruction.
-  for (auto& client_state : clients_) {
-    client_state.second->GCCompletionRecords(
-        mem_tracker_, [](SequenceNumber, CompletionRecord*) { return true; });
-    mem_tracker_->Release(client_state.second->memory_footprint());
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    for (auto& client_state : shard->clients) {
+      client_state.second->GCCompletionRecords(
+          mem_tracker_,
+          [](SequenceNumber, CompletionRecord*) { return true; });
+      mem_tracker_->Release(client_state.second->memory_footprint());
+    }
   }
 }
 
+ResultTracker::Shard* ResultTracker::ShardFor(const string& client_id) {
+  if (shards_.size() == 1) {
+    return shards_[0].get();
+  }
+  return shards_[std::hash<string>()(client_id) % shards_.size()].get();
+}
+
 ResultTracker::RpcState ResultTracker::TrackRpc(
     const RequestIdPB& request_id,
     Message* response,
     RpcContext* context) {
-  lock_guard<simple_spinlock> l(lock_);
-  return TrackRpcUnlocked(request_id, response, context);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  return TrackRpcUnlocked(shard, request_id, response, context);
 }
 
 ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(
+    Shard* shard,
     const RequestIdPB& request_id,
     Message* response,
     RpcContext* context) {
   ClientState* client_state =
-      ComputeIfAbsent(&clients_, request_id.client_id(), [&] {
+      ComputeIfAbsent(&shard->clients, request_id.client_id(), [&] {
         unique_ptr<ClientState> client_state(new ClientState(mem_tracker_));
         mem_tracker_->Consume(client_state->memory_footprint());
         client_state->stale_before_seq_no =
@@ -228,14 +254,15 @@ ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(
 
 ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(
     const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
-  RpcState state = TrackRpcUnlocked(request_id, nullptr, nullptr);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  RpcState state = TrackRpcUnlocked(shard, request_id, nullptr, nullptr);
 
   if (state != RpcState::IN_PROGRESS)
     return state;
 
   CompletionRecord* completion_record =
-      FindCompletionRecordOrDieUnlocked(request_id);
+      FindCompletionRecordOrDieUnlocked(*shard, request_id);
   ScopedMemTrackerUpdater<CompletionRecord> updater(
       mem_tracker_.get(), completion_record);
 
@@ -250,9 +277,10 @@ ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(
 }
 
 bool ResultTracker::IsCurrentDriver(const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
+  Shard* shard = ShardFor(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
   CompletionRecord* completion_record =
-      FindCompletionRecordOrNullUnlocked(request_id);
+      FindCompletionRecordOrNullUnlocked(*shard, request_id);
 
   // If we couldn't find the CompletionRecord, someone might have called
   // FailAndRespond() so just return false.
@@ -280,7 +308,7 @@ void ResultTracker::LogAndTraceAndRespondSuccess(
       "response",
       pb_util::PbTracer::TracePb(msg),
       "trace",
-      context->trace()->DumpToString());
+      context->DumpTraceToString());
   call->RespondSuccess(msg);
   delete context;
 }
@@ -300,7 +328,7 @@ void ResultTracker::LogAndTraceFailure(
       "response",
       pb_util::PbTracer::TracePb(msg),
       "trace",
-      context->trace()->DumpToString());
+      context->DumpTraceToString());
 }
 
 void ResultTracker::LogAndTraceFailure(
@@ -319,23 +347,25 @@ void ResultTracker::LogAndTraceFailure(
       "status",
       status.ToString(),
       "trace",
-      context->trace()->DumpToString());
+      context->DumpTraceToString());
 }
 
 ResultTracker::CompletionRecord*
 ResultTracker::FindCompletionRecordOrDieUnlocked(
+    const Shard& shard,
     const RequestIdPB& request_id) {
   ClientState* client_state =
-      DCHECK_NOTNULL(FindPointeeOrNull(clients_, request_id.client_id()));
+      DCHECK_NOTNULL(FindPointeeOrNull(shard.clients, request_id.client_id()));
   return DCHECK_NOTNULL(
       FindPointeeOrNull(client_state->completion_records, request_id.seq_no()));
 }
 
 pair<ResultTracker::ClientState*, ResultTracker::CompletionRecord*>
 ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(
+    const Shard& shard,
     const RequestIdPB& request_id) {
   ClientState* client_state =
-      FindPointeeOrNull(clients_, request_id.client_id());
+      FindPointeeOrNull(shard.clients, request_id.client_id());
   CompletionRecord* completion_record = nullptr;
   if (client_state != nullptr) {
     completion_record = FindPointeeOrNull(
@@ -346,8 +376,10 @@ ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(
 
 ResultTracker::CompletionRecord*
 ResultTracker::FindCompletionRecordOrNullUnlocked(
+    const Shard& shard,
     const RequestIdPB& request_id) {
-  return FindClientStateAndCompletionRecordOrNullUnlocked(request_id).second;
+  return FindClientStateAndCompletionRecordOrNullUnlocked(shard, request_id)
+      .second;
 }
 
 void ResultTracker::RecordCompletionAndRespond(
@@ -355,10 +387,11 @@ void ResultTracker::RecordCompletionAndRespond(
     const Message* response) {
   vector<OnGoingRpcInfo> to_respond;
   {
-    lock_guard<simple_spinlock> l(lock_);
+    Shard* shard = ShardFor(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
 
     CompletionRecord* completion_record =
-        FindCompletionRecordOrDieUnlocked(request_id);
+        FindCompletionRecordOrDieUnlocked(*shard, request_id);
     ScopedMemTrackerUpdater<CompletionRecord> updater(
         mem_tracker_.get(), completion_record);
 
@@ -366,7 +399,7 @@ void ResultTracker::RecordCompletionAndRespond(
         << "Called RecordCompletionAndRespond() from an executor identified with an "
         << "attempt number that was not marked as the driver for the RPC. RequestId: "
         << SecureShortDebugString(request_id) << "\nTracker state:\n "
-        << ToStringUnlocked();
+        << ToStringUnlocked(*shard);
     DCHECK_EQ(completion_record->state, RpcState::IN_PROGRESS);
     completion_record->response.reset(DCHECK_NOTNULL(response)->New());
     completion_record->response->CopyFrom(*response);
@@ -410,13 +443,14 @@ void ResultTracker::FailAndRespondInternal(
     const HandleOngoingRpcFunc& func) {
   vector<OnGoingRpcInfo> to_handle;
   {
-    lock_guard<simple_spinlock> l(lock_);
+    Shard* shard = ShardFor(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
     auto state_and_record =
-        FindClientStateAndCompletionRecordOrNullUnlocked(request_id);
+        FindClientStateAndCompletionRecordOrNullUnlocked(*shard, request_id);
     if (PREDICT_FALSE(state_and_record.first == nullptr)) {
       LOG(FATAL) << "Couldn't find ClientState for request: "
                  << SecureShortDebugString(request_id) << ". \nTracker state:\n"
-                 << ToStringUnlocked();
+                 << ToStringUnlocked(*shard);
     }
 
     CompletionRecord* completion_record = state_and_record.second;
@@ -530,7 +564,6 @@ void ResultTracker::RunGCThread() {
 }
 
 void ResultTracker::GCResults() {
-  lock_guard<simple_spinlock> l(lock_);
   MonoTime now = MonoTime::Now();
   // Calculate the instants before which we'll start GCing ClientStates and
   // CompletionRecords.
@@ -541,11 +574,21 @@ void ResultTracker::GCResults() {
   time_to_gc_responses_from.AddDelta(
       MonoDelta::FromMilliseconds(-FLAGS_remember_responses_ttl_ms));
 
+  for (auto& shard : shards_) {
+    GCShard(shard.get(), time_to_gc_clients_from, time_to_gc_responses_from);
+  }
+}
+
+void ResultTracker::GCShard(
+    Shard* shard,
+    MonoTime time_to_gc_clients_from,
+    MonoTime time_to_gc_responses_from) {
+  lock_guard<simple_spinlock> l(shard->lock);
   // Now go through the ClientStates. If we haven't heard from a client in a
   // while GC it and all its completion records (making sure there isn't
   // actually one in progress first). If we've heard from a client recently, but
   // some of its responses are old, GC those responses.
-  for (auto iter = clients_.begin(); iter != clients_.end();) {
+  for (auto iter = shard->clients.begin(); iter != shard->clients.end();) {
     auto& client_state = iter->second;
     if (client_state->last_heard_from < time_to_gc_clients_from) {
       // Client should be GCed.
@@ -566,7 +609,7 @@ void ResultTracker::GCResults() {
         continue;
       }
       mem_tracker_->Release(client_state->memory_footprint());
-      iter = clients_.erase(iter);
+      iter = shard->clients.erase(iter);
     } else {
       // Client can't be GCed, but its calls might be GCable.
       iter->second->GCCompletionRecords(
@@ -581,16 +624,20 @@ void ResultTracker::GCResults() {
 }
 
 string ResultTracker::ToString() {
-  lock_guard<simple_spinlock> l(lock_);
-  return ToStringUnlocked();
+  string result;
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    result.append(ToStringUnlocked(*shard));
+  }
+  return result;
 }
 
-string ResultTracker::ToStringUnlocked() const {
+string ResultTracker::ToStringUnlocked(const Shard& shard) const {
   string result = Substitute(
       "ResultTracker[this: $0, Num. Client States: $1, Client States:\n",
       this,
-      clients_.size());
-  for (auto& cs : clients_) {
+      shard.clients.size());
+  for (auto& cs : shard.clients) {
     SubstituteAndAppend(
         &result,
         Substitute("\n\tClient: $0, $1", cs.first, cs.second->ToString()));
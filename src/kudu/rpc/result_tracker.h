@@ -261,8 +261,9 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
   void StartGCThread();
 
   // Runs time-based garbage collection on the results this result tracker is
-  // caching. When garbage collection runs, it goes through all ClientStates
-  // and:
+  // caching. Shards are collected one at a time, so that GC only blocks the
+  // requests of the clients in the shard being collected. When garbage
+  // collection runs, it goes through all ClientStates and:
   // - If a ClientState is older than the 'remember_clients_ttl_ms' flag and no
   //   requests are in progress, GCs the ClientState and all its
   //   CompletionRecords.
@@ -374,7 +375,35 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
     }
   };
 
+  typedef MemTrackerAllocator<
+      std::pair<const std::string, std::unique_ptr<ClientState>>>
+      ClientStateMapAllocator;
+  typedef std::map<
+      std::string,
+      std::unique_ptr<ClientState>,
+      std::less<std::string>,
+      ClientStateMapAllocator>
+      ClientStateMap;
+
+  // A subset of the clients, picked by hashing the client id, with its own
+  // lock so that requests from different clients don't contend.
+  struct Shard {
+    explicit Shard(const std::shared_ptr<MemTracker>& mem_tracker)
+        : clients(
+              ClientStateMap::key_compare(),
+              ClientStateMapAllocator(mem_tracker)) {}
+
+    // Protects 'clients' and the state contained in each ClientState.
+    simple_spinlock lock;
+
+    ClientStateMap clients;
+  };
+
+  // Returns the shard that holds the state of 'client_id'.
+  Shard* ShardFor(const std::string& client_id);
+
   RpcState TrackRpcUnlocked(
+      Shard* shard,
       const RequestIdPB& request_id,
       google::protobuf::Message* response,
       RpcContext* context);
@@ -388,11 +417,14 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
       const HandleOngoingRpcFunc& func);
 
   CompletionRecord* FindCompletionRecordOrNullUnlocked(
+      const Shard& shard,
       const RequestIdPB& request_id);
   CompletionRecord* FindCompletionRecordOrDieUnlocked(
+      const Shard& shard,
       const RequestIdPB& request_id);
   std::pair<ClientState*, CompletionRecord*>
   FindClientStateAndCompletionRecordOrNullUnlocked(
+      const Shard& shard,
       const RequestIdPB& request_id);
 
   // A handler must handle an RPC attempt if:
@@ -423,29 +455,23 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
       ErrorStatusPB_RpcErrorCodePB err,
       const Status& status);
 
-  std::string ToStringUnlocked() const;
+  // Returns the state of the clients in 'shard'.
+  std::string ToStringUnlocked(const Shard& shard) const;
+
+  // Runs GCResults() on a single shard.
+  void GCShard(
+      Shard* shard,
+      MonoTime time_to_gc_clients_from,
+      MonoTime time_to_gc_responses_from);
 
   void RunGCThread();
 
   // The memory tracker that tracks this ResultTracker's memory consumption.
   std::shared_ptr<kudu::MemTracker> mem_tracker_;
 
-  // Lock that protects access to 'clients_' and to the state contained in each
-  // ClientState.
-  // TODO consider a per-ClientState lock if we find this too coarse grained.
-  simple_spinlock lock_;
-
-  typedef MemTrackerAllocator<
-      std::pair<const std::string, std::unique_ptr<ClientState>>>
-      ClientStateMapAllocator;
-  typedef std::map<
-      std::string,
-      std::unique_ptr<ClientState>,
-      std::less<std::string>,
-      ClientStateMapAllocator>
-      ClientStateMap;
-
-  ClientStateMap clients_;
+  // The clients, sharded by client id. All shards account their memory to
+  // 'mem_tracker_'. Fixed at construction.
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   // The thread which runs GC, and a latch to stop it.
   scoped_refptr<Thread> gc_thread_;
@@ -31,9 +31,11 @@
 
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/rpc/rtest.pb.h"
 #include "kudu/rpc/rtest.proxy.h"
 #include "kudu/util/countdown_latch.h"
@@ -41,6 +43,7 @@
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
@@ -52,6 +55,7 @@ using std::string;
 using std::thread;
 using std::unique_ptr;
 using std::vector;
+using strings::Substitute;
 
 DEFINE_int32(
     client_threads,
@@ -73,6 +77,36 @@ DEFINE_int32(server_reactors, 4, "Number of server reactor threads");
 
 DEFINE_int32(run_seconds, 1, "Seconds to run the test");
 
+DEFINE_string(
+    workload_profile,
+    "mixed",
+    "Traffic shape for BenchmarkWorkloadProfile. 'small' sends only small "
+    "heartbeat-like calls, 'large' sends only calls carrying a large sidecar "
+    "with a small response, as a batch of replicated ops does, and 'mixed' "
+    "sends one large call in every --mixed_large_call_every calls.");
+
+DEFINE_int32(
+    small_payload_bytes,
+    64,
+    "Size of the echoed payload of small calls in BenchmarkWorkloadProfile");
+
+DEFINE_int32(
+    large_payload_bytes,
+    1024 * 1024,
+    "Size of the request sidecar of large calls in "
+    "BenchmarkWorkloadProfile");
+
+DEFINE_int32(
+    mixed_large_call_every,
+    16,
+    "For the 'mixed' profile, one in this many calls is large");
+
+DEFINE_bool(
+    share_client_connection,
+    false,
+    "Whether all client threads of BenchmarkWorkloadProfile share one "
+    "messenger, and so one connection, as heartbeats to a peer do");
+
 DECLARE_bool(rpc_encrypt_loopback_connections);
 DEFINE_bool(
     enable_encryption,
@@ -115,11 +149,11 @@ class RpcBench : public RpcTestBase {
     HdrHistogram reactor_load(
         *METRIC_reactor_load_percent
              .Instantiate(server_messenger_->metric_entity())
-             ->histogram());
+             ->Snapshot());
     HdrHistogram reactor_latency(
         *METRIC_reactor_active_latency_us
              .Instantiate(server_messenger_->metric_entity())
-             ->histogram());
+             ->Snapshot());
 
     LOG(INFO) << "Mode:            " << (sync ? "Sync" : "Async");
     if (sync) {
@@ -145,11 +179,19 @@ class RpcBench : public RpcTestBase {
               << reactor_latency.MeanValue() << "us";
     LOG(INFO) << "Server Reactor Latency (95p):   "
               << reactor_latency.ValueAtPercentile(95) << "us";
+
+    const string key = Substitute(
+        "rpc-bench[$0]",
+        testing::UnitTest::GetInstance()->current_test_info()->name());
+    RecordPerfResult(key + ".reqs_per_sec", reqs_per_second);
+    RecordPerfResult(key + ".user_cpu_per_req_us", user_cpu_micros_per_req);
+    RecordPerfResult(key + ".sys_cpu_per_req_us", sys_cpu_micros_per_req);
   }
 
  protected:
   friend class ClientThread;
   friend class ClientAsyncWorkload;
+  friend class ProfileClientThread;
 
   Sockaddr server_addr_;
   Atomic32 should_run_;
@@ -300,5 +342,131 @@ TEST_F(RpcBench, BenchmarkCallsAsync) {
   SummarizePerf(sw.elapsed(), total_reqs, false);
 }
 
+// Issues calls shaped after --workload_profile, recording the latency of
+// each in the shared histogram.
+class ProfileClientThread {
+ public:
+  ProfileClientThread(
+      RpcBench* bench,
+      shared_ptr<Messenger> messenger,
+      HdrHistogram* latency_us)
+      : bench_(bench),
+        messenger_(std::move(messenger)),
+        latency_us_(latency_us) {}
+
+  void Start() {
+    thread_.reset(new thread(&ProfileClientThread::Run, this));
+  }
+
+  void Join() {
+    thread_->join();
+  }
+
+  bool IsLargeCall() const {
+    if (FLAGS_workload_profile == "large") {
+      return true;
+    }
+    if (FLAGS_workload_profile == "mixed") {
+      return request_count_ % FLAGS_mixed_large_call_every == 0;
+    }
+    return false;
+  }
+
+  void Run() {
+    shared_ptr<Messenger> messenger = messenger_;
+    if (!messenger) {
+      CHECK_OK(bench_->CreateMessenger("Client", &messenger));
+    }
+    CalculatorServiceProxy p(messenger, bench_->server_addr_, "localhost");
+
+    const string small_data(FLAGS_small_payload_bytes, 'x');
+    const string large_data(FLAGS_large_payload_bytes, 'y');
+    EchoRequestPB req;
+    EchoResponsePB resp;
+    while (Acquire_Load(&bench_->should_run_)) {
+      RpcController controller;
+      controller.set_timeout(MonoDelta::FromSeconds(10));
+      req.set_data(small_data);
+      if (IsLargeCall()) {
+        int idx;
+        CHECK_OK(controller.AddOutboundSidecar(
+            RpcSidecar::FromSlice(Slice(large_data)), &idx));
+        bytes_sent_ += large_data.size();
+      }
+      bytes_sent_ += small_data.size();
+
+      MonoTime start = MonoTime::Now();
+      CHECK_OK(p.Echo(req, &resp, &controller));
+      latency_us_->Increment((MonoTime::Now() - start).ToMicroseconds());
+      CHECK_EQ(small_data.size(), resp.data().size());
+      request_count_++;
+    }
+  }
+
+  unique_ptr<thread> thread_;
+  RpcBench* bench_;
+  shared_ptr<Messenger> messenger_;
+  HdrHistogram* latency_us_;
+  int request_count_ = 0;
+  int64_t bytes_sent_ = 0;
+};
+
+// Test RPC calls shaped after consensus traffic. Run with
+// --enable_encryption to cover TLS.
+TEST_F(RpcBench, BenchmarkWorkloadProfile) {
+  ASSERT_TRUE(
+      FLAGS_workload_profile == "small" || FLAGS_workload_profile == "large" ||
+      FLAGS_workload_profile == "mixed")
+      << "unknown profile: " << FLAGS_workload_profile;
+
+  shared_ptr<Messenger> shared_messenger;
+  if (FLAGS_share_client_connection) {
+    ASSERT_OK(CreateMessenger("Client", &shared_messenger));
+  }
+  // Up to 60 seconds, with 3 significant digits.
+  HdrHistogram latency_us(60 * 1000 * 1000, 3);
+
+  Stopwatch sw(Stopwatch::ALL_THREADS);
+  sw.start();
+
+  vector<unique_ptr<ProfileClientThread>> threads;
+  for (int i = 0; i < FLAGS_client_threads; i++) {
+    threads.emplace_back(
+        new ProfileClientThread(this, shared_messenger, &latency_us));
+    threads.back()->Start();
+  }
+
+  SleepFor(MonoDelta::FromSeconds(FLAGS_run_seconds));
+  Release_Store(&should_run_, false);
+
+  int total_reqs = 0;
+  int64_t total_bytes = 0;
+  for (auto& thr : threads) {
+    thr->Join();
+    total_reqs += thr->request_count_;
+    total_bytes += thr->bytes_sent_;
+  }
+  sw.stop();
+
+  SummarizePerf(sw.elapsed(), total_reqs, true);
+
+  CpuTimes elapsed = sw.elapsed();
+  double mb_per_second =
+      total_bytes / 1024.0 / 1024.0 / elapsed.wall_seconds();
+  double cpu_nanos_per_kb = total_bytes == 0
+      ? 0
+      : (elapsed.user + elapsed.system) / (total_bytes / 1024.0);
+  LOG(INFO) << "Profile:          " << FLAGS_workload_profile;
+  LOG(INFO) << "Shared connection: " << FLAGS_share_client_connection;
+  LOG(INFO) << "MB/sec sent:      " << mb_per_second;
+  LOG(INFO) << "CPU per KB sent:  " << cpu_nanos_per_kb << "ns";
+  LOG(INFO) << "Latency (p50):    " << latency_us.ValueAtPercentile(50)
+            << "us";
+  LOG(INFO) << "Latency (p99):    " << latency_us.ValueAtPercentile(99)
+            << "us";
+  LOG(INFO) << "Latency (p99.9):  " << latency_us.ValueAtPercentile(99.9)
+            << "us";
+}
+
 } // namespace rpc
 } // namespace kudu
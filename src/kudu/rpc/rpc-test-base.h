@@ -261,6 +261,9 @@ class GenericCalculatorService : public ServiceIf {
 
 class CalculatorService : public CalculatorServiceIf {
  public:
+  // The number of Echo calls whose messages were allocated on an arena.
+  static inline std::atomic<int> num_arena_echo_calls{0};
+
   explicit CalculatorService(
       const scoped_refptr<MetricEntity>& entity,
       const scoped_refptr<ResultTracker> result_tracker)
@@ -319,6 +322,11 @@ class CalculatorService : public CalculatorServiceIf {
 
   void Echo(const EchoRequestPB* req, EchoResponsePB* resp, RpcContext* context)
       override {
+    CHECK_EQ(req->GetArena(), context->arena().get());
+    CHECK_EQ(resp->GetArena(), context->arena().get());
+    if (context->arena()) {
+      num_arena_echo_calls++;
+    }
     resp->set_data(req->data());
     context->RespondSuccess();
   }
@@ -459,6 +467,7 @@ class RpcTestBase : public KuduTest {
         service_queue_length_(100),
         n_server_reactor_threads_(3),
         keepalive_time_ms_(1000),
+        reactor_spin_us_(0),
         metric_entity_(METRIC_ENTITY_server.Instantiate(
             &metric_registry_,
             "test.rpc_test")) {}
@@ -505,6 +514,16 @@ class RpcTestBase : public KuduTest {
       bld.set_coarse_timer_granularity(
           MonoDelta::FromMilliseconds(std::min(keepalive_time_ms_ / 5, 100)));
     }
+    bld.set_reactor_spin_us(reactor_spin_us_);
+    if (timer_wheel_tick_.Initialized()) {
+      bld.set_timer_wheel_tick(timer_wheel_tick_);
+    }
+    if (accept_in_reactors_) {
+      bld.set_reuseport();
+    }
+    if (idle_connection_lru_) {
+      bld.set_idle_connection_lru();
+    }
     bld.set_metric_entity(metric_entity_);
     return bld.Build(messenger);
   }
@@ -705,7 +724,11 @@ class RpcTestBase : public KuduTest {
     }
     std::shared_ptr<AcceptorPool> pool;
     RETURN_NOT_OK(server_messenger_->AddAcceptorPool(Sockaddr(), &pool));
-    RETURN_NOT_OK(pool->Start(2));
+    if (accept_in_reactors_) {
+      RETURN_NOT_OK(pool->StartInReactors());
+    } else {
+      RETURN_NOT_OK(pool->Start(2));
+    }
     *server_addr = pool->bind_address();
     mem_tracker_ = MemTracker::CreateTracker(-1, "result_tracker");
     result_tracker_.reset(new ResultTracker(mem_tracker_));
@@ -733,6 +756,10 @@ class RpcTestBase : public KuduTest {
   int service_queue_length_;
   int n_server_reactor_threads_;
   int keepalive_time_ms_;
+  int reactor_spin_us_;
+  MonoDelta timer_wheel_tick_;
+  bool accept_in_reactors_ = false;
+  bool idle_connection_lru_ = false;
 
   MetricRegistry metric_registry_;
   scoped_refptr<MetricEntity> metric_entity_;
@@ -59,6 +59,7 @@
 #include "kudu/security/tls_context.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -72,6 +73,7 @@
 #include "kudu/util/thread.h"
 
 METRIC_DECLARE_histogram(handler_latency_kudu_rpc_test_CalculatorService_Sleep);
+METRIC_DECLARE_histogram(reactor_spin_percent);
 METRIC_DECLARE_histogram(rpc_incoming_queue_time);
 
 DECLARE_bool(rpc_reopen_outbound_connections);
@@ -79,6 +81,12 @@ DECLARE_int32(rpc_negotiation_inject_delay_ms);
 DECLARE_bool(authenticate_via_CN);
 DECLARE_string(trusted_CNs);
 DECLARE_bool(use_normal_tls);
+DECLARE_int32(rpc_inbound_buffer_pool_mb);
+DECLARE_int32(rpc_max_coalesced_transfers);
+DECLARE_int32(rpc_max_outbound_sidecars);
+DECLARE_int32(rpc_bulk_connection_stripes);
+DECLARE_bool(rpc_parse_requests_into_arena);
+DECLARE_bool(rpc_collect_peer_latency);
 
 using std::shared_ptr;
 using std::string;
@@ -673,6 +681,80 @@ TEST_P(TestRpc, TestClientConnectionMetrics) {
   }
 }
 
+// Test that calls complete with reactors which spin after activity, and that
+// the spinning shows up in the reactor metrics.
+TEST_P(TestRpc, TestSpinningReactors) {
+  reactor_spin_us_ = 1000;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+
+  // The load is sampled every coarse timer tick; wait for a few of those.
+  scoped_refptr<Histogram> spin_percent =
+      METRIC_reactor_spin_percent.Instantiate(metric_entity_);
+  ASSERT_EVENTUALLY([&]() { ASSERT_GT(spin_percent->TotalCount(), 0); });
+
+  // Shutting down must break out of a spinning loop.
+  client_messenger->Shutdown();
+}
+
+// Test that calls queued behind one another, and sent together with a single
+// writev(), each get the right response.
+TEST_P(TestRpc, TestCoalescedTransfers) {
+  FLAGS_rpc_max_coalesced_transfers = 16;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+  // Open the connection first, so that the calls below queue up on it.
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+
+  // Block the client's only reactor thread while the calls are queued.
+  client_messenger->ScheduleOnReactor(
+      boost::bind(sleep, 1), MonoDelta::FromSeconds(0));
+
+  const int n_calls = 200;
+  vector<AddRequestPB> reqs(n_calls);
+  vector<AddResponsePB> resps(n_calls);
+  vector<unique_ptr<RpcController>> controllers;
+  CountDownLatch latch(n_calls);
+  for (int i = 0; i < n_calls; i++) {
+    reqs[i].set_x(i);
+    reqs[i].set_y(i * 2);
+    controllers.emplace_back(new RpcController());
+    p.AsyncRequest(
+        GenericCalculatorService::kAddMethodName,
+        reqs[i],
+        &resps[i],
+        controllers.back().get(),
+        boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  latch.Wait();
+
+  for (int i = 0; i < n_calls; i++) {
+    ASSERT_OK(controllers[i]->status());
+    ASSERT_EQ(i * 3, resps[i].result());
+  }
+}
+
 // Test that outbound connections to the same server are reopen upon every RPC
 // call when the 'rpc_reopen_outbound_connections' flag is set.
 TEST_P(TestRpc, TestReopenOutboundConnections) {
@@ -799,6 +881,100 @@ TEST_P(TestRpc, TestCredentialsPolicy) {
   EXPECT_EQ(1, metrics.num_client_connections_);
 }
 
+// Test that calls of different connection classes use connections of their
+// own, and that bulk calls are striped over several.
+TEST_P(TestRpc, TestConnectionClasses) {
+  FLAGS_rpc_bulk_connection_stripes = 3;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  const auto do_call = [&](ConnectionClass connection_class) {
+    AddRequestPB req;
+    req.set_x(1);
+    req.set_y(2);
+    AddResponsePB resp;
+    RpcController controller;
+    controller.set_timeout(MonoDelta::FromMilliseconds(10000));
+    controller.set_connection_class(connection_class);
+    RETURN_NOT_OK(p.SyncRequest(
+        GenericCalculatorService::kAddMethodName, req, &resp, &controller));
+    CHECK_EQ(3, resp.result());
+    return Status::OK();
+  };
+  for (int i = 0; i < 6; i++) {
+    ASSERT_OK(do_call(ConnectionClass::CONTROL));
+    ASSERT_OK(do_call(ConnectionClass::REPLICATION));
+    ASSERT_OK(do_call(ConnectionClass::BULK));
+  }
+
+  ReactorMetrics metrics;
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  EXPECT_EQ(5, metrics.total_client_connections_);
+  EXPECT_EQ(5, metrics.num_client_connections_);
+}
+
+// Test that connections are accepted when each server reactor listens on a
+// socket of its own.
+TEST_P(TestRpc, TestAcceptInReactors) {
+  accept_in_reactors_ = true;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  constexpr int kNumClients = 8;
+  for (int i = 0; i < kNumClients; i++) {
+    shared_ptr<Messenger> client_messenger;
+    ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+    Proxy p(
+        client_messenger,
+        server_addr,
+        server_addr.host(),
+        GenericCalculatorService::static_service_name());
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+
+  int64_t total_server_connections = 0;
+  for (Reactor* reactor : server_messenger_->reactors_) {
+    ReactorMetrics metrics;
+    ASSERT_OK(reactor->GetMetrics(&metrics));
+    total_server_connections += metrics.total_server_connections_;
+  }
+  EXPECT_EQ(kNumClients, total_server_connections);
+}
+
+// Test that methods with the 'parse_into_arena' option allocate their
+// requests and responses on an arena when enabled.
+TEST_P(TestRpc, TestParseIntoArena) {
+  FLAGS_rpc_parse_requests_into_arena = true;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServerWithGeneratedCode(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  CalculatorServiceProxy p(
+      client_messenger, server_addr, server_addr.host());
+
+  const int initial_arena_calls = CalculatorService::num_arena_echo_calls;
+  for (int size : {0, 100, 1024 * 1024}) {
+    EchoRequestPB req;
+    req.set_data(string(size, 'x'));
+    EchoResponsePB resp;
+    RpcController controller;
+    ASSERT_OK(p.Echo(req, &resp, &controller));
+    ASSERT_EQ(req.data(), resp.data());
+  }
+  ASSERT_EQ(3, CalculatorService::num_arena_echo_calls - initial_arena_calls);
+}
+
 // Test that a call which takes longer than the keepalive time
 // succeeds -- i.e that we don't consider a connection to be "idle" on the
 // server if there is a call outstanding on it.
@@ -830,6 +1006,74 @@ TEST_P(TestRpc, TestCallLongerThanKeepalive) {
       GenericCalculatorService::kSleepMethodName, req, &resp, &controller));
 }
 
+// Test that with the idle connection list, a connection is kept open during a
+// call longer than the keepalive time and closed once idle for that long.
+TEST_P(TestRpc, TestIdleConnectionLru) {
+  n_server_reactor_threads_ = 1;
+  keepalive_time_ms_ = 500;
+  idle_connection_lru_ = true;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  RpcController controller;
+  SleepRequestPB req;
+  req.set_sleep_micros(4 * keepalive_time_ms_ * 1000);
+  req.set_deferred(true);
+  SleepResponsePB resp;
+  ASSERT_OK(p.SyncRequest(
+      GenericCalculatorService::kSleepMethodName, req, &resp, &controller));
+  ReactorMetrics metrics;
+  ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(1, metrics.num_server_connections_);
+
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_EQ(0, metrics.num_server_connections_);
+  });
+}
+
+// Test that a client messenger with a metric registry keeps the latency of
+// calls to each server, as reported by the server.
+TEST_P(TestRpc, TestPeerLatencyMetrics) {
+  FLAGS_rpc_collect_peer_latency = true;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  MessengerBuilder mb("Client");
+  mb.set_metric_entity(metric_entity_).set_metric_registry(&metric_registry_);
+  if (enable_ssl) {
+    mb.enable_inbound_tls();
+  }
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(mb.Build(&client_messenger));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  const int kNumCalls = 5;
+  for (int i = 0; i < kNumCalls; i++) {
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+  const PeerLatencyMetrics* metrics =
+      client_messenger->peer_latency_metrics(server_addr);
+  ASSERT_NE(nullptr, metrics);
+  ASSERT_EQ(kNumCalls, metrics->network_time->TotalCount());
+  ASSERT_EQ(kNumCalls, metrics->server_queue_time->TotalCount());
+  ASSERT_EQ(kNumCalls, metrics->server_handler_time->TotalCount());
+}
+
 // Test that the RpcSidecar transfers the expected messages.
 TEST_P(TestRpc, TestRpcSidecar) {
   // Set up server.
@@ -861,13 +1105,44 @@ TEST_P(TestRpc, TestRpcSidecar) {
   DoTestOutgoingSidecarExpectOK(p, 3000 * 1024, 2000 * 1024);
 }
 
+// Test that large messages are received into buffers which are reused.
+TEST_P(TestRpc, TestInboundBufferPool) {
+  FLAGS_rpc_inbound_buffer_pool_mb = 64;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(
+      client_messenger,
+      server_addr,
+      server_addr.host(),
+      GenericCalculatorService::static_service_name());
+
+  shared_ptr<MemTracker> tracker =
+      MemTracker::FindOrCreateGlobalTracker(-1, "rpc_inbound_buffers");
+  int64_t initial_consumption = tracker->consumption();
+
+  // The response is received into a buffer which goes back to the pool once
+  // the call is done, and the next response reuses it.
+  DoTestSidecar(p, 3000 * 1024, 2000 * 1024);
+  int64_t consumption = tracker->consumption();
+  ASSERT_GE(consumption - initial_consumption, 5000 * 1024);
+  DoTestSidecar(p, 3000 * 1024, 2000 * 1024);
+  ASSERT_EQ(consumption, tracker->consumption());
+
+  // Large requests are received into pooled buffers too.
+  DoTestOutgoingSidecarExpectOK(p, 3000 * 1024, 2000 * 1024);
+}
+
 TEST_P(TestRpc, TestRpcSidecarLimits) {
   {
     // Test that the limits on the number of sidecars is respected.
     RpcController controller;
     string s = "foo";
     int idx;
-    for (int i = 0; i < TransferLimits::kMaxSidecars; ++i) {
+    for (int i = 0; i < FLAGS_rpc_max_outbound_sidecars; ++i) {
       ASSERT_OK(
           controller.AddOutboundSidecar(RpcSidecar::FromSlice(Slice(s)), &idx));
     }
@@ -877,6 +1152,39 @@ TEST_P(TestRpc, TestRpcSidecarLimits) {
             .IsRuntimeError());
   }
 
+  {
+    // Test that a receiver accepts as many sidecars as senders may be
+    // configured to attach.
+    FLAGS_rpc_max_outbound_sidecars = TransferLimits::kMaxSidecars;
+    Sockaddr server_addr;
+    ASSERT_OK(StartTestServer(&server_addr, GetParam()));
+    shared_ptr<Messenger> client_messenger;
+    ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, GetParam()));
+    Proxy p(
+        client_messenger,
+        server_addr,
+        server_addr.host(),
+        GenericCalculatorService::static_service_name());
+
+    RpcController controller;
+    string s = "foo";
+    int idx;
+    for (int i = 0; i < TransferLimits::kMaxSidecars; ++i) {
+      ASSERT_OK(
+          controller.AddOutboundSidecar(RpcSidecar::FromSlice(Slice(s)), &idx));
+    }
+    PushTwoStringsRequestPB request;
+    request.set_sidecar1_idx(0);
+    request.set_sidecar2_idx(TransferLimits::kMaxSidecars - 1);
+    PushTwoStringsResponsePB resp;
+    ASSERT_OK(p.SyncRequest(
+        GenericCalculatorService::kPushTwoStringsMethodName,
+        request,
+        &resp,
+        &controller));
+    ASSERT_EQ(s, resp.data2());
+  }
+
   // Construct a string to use as a maximal payload in following tests
   string max_string(TransferLimits::kMaxTotalSidecarBytes, 'a');
 
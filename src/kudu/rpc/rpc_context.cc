@@ -22,8 +22,10 @@
 #include <utility>
 
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/message.h>
 
+#include "kudu/gutil/basictypes.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/inbound_call.h"
 #include "kudu/rpc/remote_method.h"
@@ -49,8 +51,10 @@ namespace rpc {
 RpcContext::RpcContext(
     InboundCall* call,
     const google::protobuf::Message* request_pb,
-    google::protobuf::Message* response_pb)
+    google::protobuf::Message* response_pb,
+    std::shared_ptr<google::protobuf::Arena> arena)
     : call_(CHECK_NOTNULL(call)),
+      arena_(std::move(arena)),
       request_pb_(request_pb),
       response_pb_(response_pb) {
   VLOG(4) << call_->remote_method().service_name()
@@ -67,7 +71,12 @@ RpcContext::RpcContext(
       pb_util::PbTracer::TracePb(*request_pb_));
 }
 
-RpcContext::~RpcContext() {}
+RpcContext::~RpcContext() {
+  if (arena_) {
+    ignore_result(request_pb_.release());
+    ignore_result(response_pb_.release());
+  }
+}
 
 void RpcContext::SetResultTracker(scoped_refptr<ResultTracker> result_tracker) {
   DCHECK(!result_tracker_);
@@ -90,7 +99,7 @@ void RpcContext::RespondSuccess() {
         "response",
         pb_util::PbTracer::TracePb(*response_pb_),
         "trace",
-        trace()->DumpToString());
+        DumpTraceToString());
     call_->RespondSuccess(*response_pb_);
     delete this;
   }
@@ -111,7 +120,7 @@ void RpcContext::RespondNoCache() {
         "response",
         pb_util::PbTracer::TracePb(*response_pb_),
         "trace",
-        trace()->DumpToString());
+        DumpTraceToString());
     // This is a bit counter intuitive, but when we get the failure but set the
     // error on the call's response we call RespondSuccess() instead of
     // RespondFailure().
@@ -140,7 +149,7 @@ void RpcContext::RespondRpcFailure(
         "status",
         status.ToString(),
         "trace",
-        trace()->DumpToString());
+        DumpTraceToString());
     call_->RespondFailure(err, status);
     delete this;
   }
@@ -170,7 +179,7 @@ void RpcContext::RespondApplicationError(
         "response",
         pb_util::PbTracer::TracePb(app_error_pb),
         "trace",
-        trace()->DumpToString());
+        DumpTraceToString());
     call_->RespondApplicationError(error_ext_id, message, app_error_pb);
     delete this;
   }
@@ -201,6 +210,14 @@ bool RpcContext::is_confidential() const {
   return call_->connection()->is_confidential();
 }
 
+bool RpcContext::GetCachedAuthorization(uint32_t roles, bool* allowed) const {
+  return call_->connection()->GetCachedAuthorization(roles, allowed);
+}
+
+void RpcContext::CacheAuthorization(uint32_t roles, bool allowed) {
+  call_->connection()->CacheAuthorization(roles, allowed);
+}
+
 void RpcContext::DiscardTransfer() {
   call_->DiscardTransfer();
 }
@@ -234,6 +251,15 @@ Trace* RpcContext::trace() {
   return call_->trace();
 }
 
+void RpcContext::AddExemplarLabel(string key, string value) {
+  call_->AddExemplarLabel(std::move(key), std::move(value));
+}
+
+string RpcContext::DumpTraceToString() {
+  Trace* t = trace();
+  return t ? t->DumpToString() : "";
+}
+
 void RpcContext::Panic(
     const char* filepath,
     int line_number,
@@ -18,6 +18,7 @@
 #define KUDU_RPC_RPC_CONTEXT_H
 
 #include <stddef.h>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -30,6 +31,7 @@
 
 namespace google {
 namespace protobuf {
+class Arena;
 class Message;
 } // namespace protobuf
 } // namespace google
@@ -66,10 +68,13 @@ class RpcContext {
  public:
   // Create an RpcContext. This is called only from generated code
   // and is not a public API.
+  //
+  // If 'arena' is set, 'request_pb' and 'response_pb' were allocated on it.
   RpcContext(
       InboundCall* call,
       const google::protobuf::Message* request_pb,
-      google::protobuf::Message* response_pb);
+      google::protobuf::Message* response_pb,
+      std::shared_ptr<google::protobuf::Arena> arena = nullptr);
 
   ~RpcContext();
 
@@ -80,9 +85,17 @@ class RpcContext {
   // authorization).
   void SetResultTracker(scoped_refptr<ResultTracker> result_tracker);
 
-  // Return the trace buffer for this call.
+  // Return the trace buffer for this call, or null if the call isn't traced.
   Trace* trace();
 
+  // Return the trace of this call as a string, empty if the call isn't
+  // traced.
+  std::string DumpTraceToString();
+
+  // Adds a label to the exemplar the call may become in the handler latency
+  // histogram of its method. See InboundCall::AddExemplarLabel().
+  void AddExemplarLabel(std::string key, std::string value);
+
   // Send a response to the call. The service may call this method
   // before or after returning from the original handler method,
   // and it may call this method from a different thread.
@@ -184,6 +197,11 @@ class RpcContext {
   // encrypted connection.
   bool is_confidential() const;
 
+  // Like Connection::GetCachedAuthorization() and CacheAuthorization(), for
+  // the connection the call arrived on.
+  bool GetCachedAuthorization(uint32_t roles, bool* allowed) const;
+  void CacheAuthorization(uint32_t roles, bool allowed);
+
   // Discards the memory associated with the inbound call's payload. All
   // previously obtained sidecar slices will be invalidated by this call. It is
   // an error to call GetInboundSidecar() after this method. request_pb()
@@ -212,6 +230,13 @@ class RpcContext {
     return response_pb_.get();
   }
 
+  // The arena the request and response were allocated on, or null if they
+  // are on the heap (see the 'parse_into_arena' method option). Messages
+  // taken out of the request must hold a reference to it to outlive the call.
+  const std::shared_ptr<google::protobuf::Arena>& arena() const {
+    return arena_;
+  }
+
   // Return an upper bound on the client timeout deadline. This does not
   // account for transmission delays between the client and the server.
   // If the client did not specify a deadline, returns MonoTime::Max().
@@ -251,8 +276,10 @@ class RpcContext {
  private:
   friend class ResultTracker;
   InboundCall* const call_;
-  const std::unique_ptr<const google::protobuf::Message> request_pb_;
-  const std::unique_ptr<google::protobuf::Message> response_pb_;
+  const std::shared_ptr<google::protobuf::Arena> arena_;
+  // Not deleted if allocated on 'arena_'.
+  std::unique_ptr<const google::protobuf::Message> request_pb_;
+  std::unique_ptr<google::protobuf::Message> response_pb_;
   scoped_refptr<ResultTracker> result_tracker_;
 };
 
@@ -40,6 +40,7 @@ namespace rpc {
 
 RpcController::RpcController()
     : credentials_policy_(CredentialsPolicy::ANY_CREDENTIALS),
+      connection_class_(ConnectionClass::CONTROL),
       messenger_(nullptr) {
   DVLOG(4) << "RpcController " << this << " constructed";
 }
@@ -62,6 +63,7 @@ void RpcController::Swap(RpcController* other) {
       outbound_sidecars_total_bytes_, other->outbound_sidecars_total_bytes_);
   std::swap(timeout_, other->timeout_);
   std::swap(credentials_policy_, other->credentials_policy_);
+  std::swap(connection_class_, other->connection_class_);
   std::swap(call_, other->call_);
 }
 
@@ -73,6 +75,7 @@ void RpcController::Reset() {
   call_.reset();
   required_server_features_.clear();
   credentials_policy_ = CredentialsPolicy::ANY_CREDENTIALS;
+  connection_class_ = ConnectionClass::CONTROL;
   messenger_ = nullptr;
   outbound_sidecars_total_bytes_ = 0;
 }
@@ -144,7 +147,7 @@ MonoDelta RpcController::timeout() const {
 }
 
 Status RpcController::AddOutboundSidecar(unique_ptr<RpcSidecar> car, int* idx) {
-  if (outbound_sidecars_.size() >= TransferLimits::kMaxSidecars) {
+  if (outbound_sidecars_.size() >= FLAGS_rpc_max_outbound_sidecars) {
     return Status::RuntimeError("All available sidecars already used");
   }
   int64_t sidecar_bytes = car->AsSlice().size();
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "kudu/gutil/macros.h"
+#include "kudu/rpc/connection_id.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
@@ -212,6 +213,16 @@ class RpcController {
     credentials_policy_ = policy;
   }
 
+  ConnectionClass connection_class() const {
+    return connection_class_;
+  }
+
+  // Sets the class of connection the call is sent on. By default, calls use
+  // ConnectionClass::CONTROL.
+  void set_connection_class(ConnectionClass connection_class) {
+    connection_class_ = connection_class;
+  }
+
   // Fills the 'sidecar' parameter with the slice pointing to the i-th
   // sidecar upon success.
   //
@@ -222,7 +233,7 @@ class RpcController {
   Status GetInboundSidecar(int idx, Slice* sidecar) const;
 
   // Adds a sidecar to the outbound request. The index of the sidecar is written
-  // to 'idx'. Returns an error if TransferLimits::kMaxSidecars have already
+  // to 'idx'. Returns an error if --rpc_max_outbound_sidecars have already
   // been added to this request. Also returns an error if the total size of all
   // sidecars would exceed TransferLimits::kMaxTotalSidecarBytes.
   Status AddOutboundSidecar(std::unique_ptr<RpcSidecar> car, int* idx);
@@ -261,6 +272,8 @@ class RpcController {
   // RPC authentication policy for outbound calls.
   CredentialsPolicy credentials_policy_;
 
+  ConnectionClass connection_class_;
+
   mutable simple_spinlock lock_;
 
   // The id of this request.
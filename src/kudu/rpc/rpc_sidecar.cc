@@ -19,6 +19,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include <google/protobuf/repeated_field.h>
@@ -59,6 +60,19 @@ class FaststringSidecar : public RpcSidecar {
   const unique_ptr<faststring> data_;
 };
 
+// Sidecar that shares ownership of a string with its other users.
+class SharedStringSidecar : public RpcSidecar {
+ public:
+  explicit SharedStringSidecar(std::shared_ptr<const std::string> data)
+      : data_(std::move(data)) {}
+  Slice AsSlice() const override {
+    return Slice(*data_);
+  }
+
+ private:
+  const std::shared_ptr<const std::string> data_;
+};
+
 unique_ptr<RpcSidecar> RpcSidecar::FromFaststring(unique_ptr<faststring> data) {
   return unique_ptr<RpcSidecar>(new FaststringSidecar(std::move(data)));
 }
@@ -67,6 +81,11 @@ unique_ptr<RpcSidecar> RpcSidecar::FromSlice(Slice slice) {
   return unique_ptr<RpcSidecar>(new SliceSidecar(slice));
 }
 
+unique_ptr<RpcSidecar> RpcSidecar::FromSharedString(
+    std::shared_ptr<const std::string> data) {
+  return unique_ptr<RpcSidecar>(new SharedStringSidecar(std::move(data)));
+}
+
 Status RpcSidecar::ParseSidecars(
     const ::google::protobuf::RepeatedField<::google::protobuf::uint32>&
         offsets,
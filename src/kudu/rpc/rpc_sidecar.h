@@ -18,6 +18,7 @@
 #define KUDU_RPC_RPC_SIDECAR_H
 
 #include <memory>
+#include <string>
 
 #include <google/protobuf/repeated_field.h> // IWYU pragma: keep
 #include <google/protobuf/stubs/port.h>
@@ -57,6 +58,10 @@ class RpcSidecar {
   static std::unique_ptr<RpcSidecar> FromFaststring(
       std::unique_ptr<faststring> data);
   static std::unique_ptr<RpcSidecar> FromSlice(Slice slice);
+  // Shares ownership of 'data', so that the same bytes may be attached to
+  // several outbound calls.
+  static std::unique_ptr<RpcSidecar> FromSharedString(
+      std::shared_ptr<const std::string> data);
 
   // Utility method to parse a series of sidecar slices into 'sidecars' from
   // 'buffer' and a set of offsets. 'sidecars' must have length >=
@@ -66,8 +66,12 @@
 #include "kudu/util/user.h"
 
 DEFINE_bool(is_panic_test_child, false, "Used by TestRpcPanic");
+DECLARE_bool(rpc_inline_handlers);
+DECLARE_int32(rpc_inline_handler_max_us);
 DECLARE_bool(socket_inject_short_recvs);
 
+METRIC_DECLARE_counter(rpcs_handled_inline);
+
 using base::subtle::NoBarrier_Load;
 using kudu::pb_util::SecureDebugString;
 using std::shared_ptr;
@@ -111,6 +115,29 @@ TEST_F(RpcStubTest, TestSimpleCall) {
   SendSimpleCall();
 }
 
+// Test that calls of a method marked run_inline are handled on the reactor
+// thread, until one of them takes too long.
+TEST_F(RpcStubTest, TestInlineHandlers) {
+  scoped_refptr<Counter> handled_inline =
+      METRIC_rpcs_handled_inline.Instantiate(
+          server_messenger_->metric_entity());
+  NO_FATALS(SendSimpleCall());
+  ASSERT_EQ(0, handled_inline->value());
+
+  FLAGS_rpc_inline_handlers = true;
+  for (int i = 0; i < 10; i++) {
+    NO_FATALS(SendSimpleCall());
+  }
+  ASSERT_EQ(10, handled_inline->value());
+
+  // Every call now takes too long: the first one demotes the method.
+  FLAGS_rpc_inline_handler_max_us = -1;
+  for (int i = 0; i < 10; i++) {
+    NO_FATALS(SendSimpleCall());
+  }
+  ASSERT_EQ(11, handled_inline->value());
+}
+
 // Regression test for a bug in which we would not properly parse a call
 // response when recv() returned a 'short read'. This injects such short
 // reads and then makes a number of calls.
@@ -482,6 +509,42 @@ struct AsyncSleep {
   CountDownLatch latch;
 };
 
+// Test that calls of a high priority method are handled while all the
+// regular service threads are busy.
+TEST_F(RpcStubTest, TestHighPriorityCallsBypassBusyWorkers) {
+  CalculatorServiceProxy p(
+      client_messenger_, server_addr_, server_addr_.host());
+  vector<AsyncSleep*> sleeps;
+  ElementDeleter d(&sleeps);
+
+  // Occupy the worker threads, and queue some more calls behind them.
+  for (int i = 0; i < n_worker_threads_ * 2; i++) {
+    unique_ptr<AsyncSleep> sleep(new AsyncSleep);
+    sleep->req.set_sleep_micros(2 * 1000 * 1000); // 2sec
+    p.SleepAsync(
+        sleep->req,
+        &sleep->resp,
+        &sleep->rpc,
+        boost::bind(&CountDownLatch::CountDown, &sleep->latch));
+    sleeps.push_back(sleep.release());
+  }
+  const Histogram* queue_time_metric =
+      service_pool_->IncomingQueueTimeMetricForTests();
+  while (queue_time_metric->TotalCount() < n_worker_threads_) {
+    SleepFor(MonoDelta::FromMilliseconds(1));
+  }
+
+  RpcController controller;
+  controller.set_timeout(MonoDelta::FromMilliseconds(500));
+  WhoAmIRequestPB req;
+  WhoAmIResponsePB resp;
+  ASSERT_OK(p.WhoAmI(req, &resp, &controller));
+
+  for (AsyncSleep* s : sleeps) {
+    s->latch.Wait();
+  }
+}
+
 TEST_F(RpcStubTest, TestDontHandleTimedOutCalls) {
   CalculatorServiceProxy p(
       client_messenger_, server_addr_, server_addr_.host());
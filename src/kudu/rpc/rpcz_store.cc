@@ -105,6 +105,7 @@ class MethodSampler {
     RequestHeader header;
     scoped_refptr<Trace> trace;
     int duration_ms;
+    bool exemplar;
   };
 
   // A sample, including the particular time at which it was
@@ -148,6 +149,10 @@ MethodSampler* RpczStore::SamplerForCall(InboundCall* call) {
 }
 
 void MethodSampler::SampleCall(InboundCall* call) {
+  if (!call->trace()) {
+    return;
+  }
+
   // First determine which sample bucket to put this in.
   int duration_ms = call->timing().TotalDuration().ToMilliseconds();
 
@@ -161,8 +166,11 @@ void MethodSampler::SampleCall(InboundCall* call) {
 
   kudu::MicrosecondsInt64 now = GetMonoTimeMicros();
   int64_t us_since_trace = now - bucket->last_sample_time.Load();
-  if (us_since_trace > kSampleIntervalMs * 1000) {
-    Sample new_sample = {call->header(), call->trace(), duration_ms};
+  // Exemplars of the handler latency histogram are always sampled, so that
+  // the trace of the call an exemplar points at can be looked up.
+  if (us_since_trace > kSampleIntervalMs * 1000 || call->is_exemplar()) {
+    Sample new_sample = {
+        call->header(), call->trace(), duration_ms, call->is_exemplar()};
     {
       std::unique_lock<simple_spinlock> lock(
           bucket->sample_lock, std::try_to_lock);
@@ -214,6 +222,9 @@ void MethodSampler::GetSamplePBs(RpczMethodPB* method_pb) {
 
     GetTraceMetrics(*bucket.sample.trace.get(), "", sample_pb);
     sample_pb->set_duration_ms(bucket.sample.duration_ms);
+    if (bucket.sample.exemplar) {
+      sample_pb->set_exemplar(true);
+    }
   }
 }
 
@@ -271,7 +282,7 @@ void RpczStore::LogTrace(InboundCall* call) {
                    << "("
                    << HumanReadableElapsedTime::ToShortString(timeout_ms * .001)
                    << ")";
-      string s = call->trace()->DumpToString();
+      string s = call->trace() ? call->trace()->DumpToString() : "";
       if (!s.empty()) {
         LOG(WARNING) << "Trace:\n" << s;
       }
@@ -279,7 +290,11 @@ void RpczStore::LogTrace(InboundCall* call) {
     }
   }
 
-  if (PREDICT_FALSE(FLAGS_rpc_dump_all_traces)) {
+  if (!call->trace()) {
+    if (duration_ms > FLAGS_rpc_duration_too_long_ms) {
+      LOG(INFO) << call->ToString() << " took " << duration_ms << "ms.";
+    }
+  } else if (PREDICT_FALSE(FLAGS_rpc_dump_all_traces)) {
     LOG(INFO) << call->ToString() << " took " << duration_ms << "ms. Trace:";
     call->trace()->Dump(&LOG(INFO), true);
   } else if (duration_ms > FLAGS_rpc_duration_too_long_ms) {
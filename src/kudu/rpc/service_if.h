@@ -17,6 +17,7 @@
 #ifndef KUDU_RPC_SERVICE_IF_H
 #define KUDU_RPC_SERVICE_IF_H
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -52,6 +53,19 @@ struct RpcMethodInfo : public RefCountedThreadSafe<RpcMethodInfo> {
   // Whether we should track this method's result, using ResultTracker.
   bool track_result;
 
+  // Whether calls of this method may be handled on the reactor thread. Reset
+  // by ServicePool if a call turns out to take too long.
+  std::atomic<bool> run_inline{false};
+
+  // Whether calls of this method are high priority, or those no larger than
+  // 'high_priority_max_call_size' bytes if it is positive.
+  bool high_priority = false;
+  uint32_t high_priority_max_call_size = 0;
+
+  // Whether requests and responses of this method may be allocated on an arena
+  // owned by the call. See --rpc_parse_requests_into_arena.
+  bool parse_into_arena = false;
+
   // The authorization function for this RPC. If this function
   // returns false, the RPC has already been handled (i.e. rejected)
   // by the authorization function.
@@ -89,6 +103,11 @@ class ServiceIf {
     return nullptr;
   }
 
+  // Whether any method of the service has high priority calls.
+  virtual bool HasHighPriorityMethods() const {
+    return false;
+  }
+
   // Default authorization method, which just allows all RPCs.
   //
   // See docs/design-docs/rpc.md for details on how to add custom
@@ -118,6 +137,8 @@ class GeneratedServiceIf : public ServiceIf {
 
   RpcMethodInfo* LookupMethod(const RemoteMethod& method) override;
 
+  bool HasHighPriorityMethods() const override;
+
   // Returns the mapping from method names to method infos.
   typedef std::unordered_map<std::string, scoped_refptr<RpcMethodInfo>>
       MethodInfoMap;
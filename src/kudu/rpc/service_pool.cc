@@ -26,6 +26,7 @@
 #include <vector>
 
 #include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/basictypes.h"
@@ -37,13 +38,57 @@
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_queue.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
 #include "kudu/util/trace.h"
 
+DEFINE_bool(
+    rpc_inline_handlers,
+    false,
+    "Whether calls of RPC methods marked with the run_inline option are "
+    "handled on the reactor thread which read them, saving the hand-off to "
+    "a service thread. Only for methods whose handlers are bounded and never "
+    "block.");
+TAG_FLAG(rpc_inline_handlers, experimental);
+TAG_FLAG(rpc_inline_handlers, runtime);
+
+DEFINE_int32(
+    rpc_inline_handler_max_us,
+    1000,
+    "A method whose handler takes longer than this to handle a call on a "
+    "reactor thread stops being handled inline until the server restarts.");
+TAG_FLAG(rpc_inline_handler_max_us, experimental);
+TAG_FLAG(rpc_inline_handler_max_us, runtime);
+
+DEFINE_int32(
+    rpc_num_priority_service_threads,
+    2,
+    "Number of service threads reserved, per service with high priority "
+    "methods, for the calls of those methods, e.g. leader election RPCs. "
+    "0 queues them with all other calls.");
+TAG_FLAG(rpc_num_priority_service_threads, advanced);
+
+DEFINE_int32(
+    rpc_priority_service_queue_length,
+    50,
+    "Length of the queue of high priority calls of a service.");
+TAG_FLAG(rpc_priority_service_queue_length, advanced);
+
+DEFINE_string(
+    rpc_service_thread_cpus,
+    "",
+    "CPUs to bind the service threads to, e.g. \"0-7,16-23\". Setting these "
+    "to the CPUs of the NUMA node the reactors are bound to keeps calls on "
+    "that node. Empty leaves the threads unbound.");
+TAG_FLAG(rpc_service_thread_cpus, advanced);
+TAG_FLAG(rpc_service_thread_cpus, experimental);
+DEFINE_validator(rpc_service_thread_cpus, &kudu::ValidateCpuListFlag);
+
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -74,6 +119,14 @@ METRIC_DEFINE_counter(
     "Number of RPCs dropped because the service queue "
     "was full.");
 
+METRIC_DEFINE_counter(
+    server,
+    rpcs_handled_inline,
+    "RPCs Handled Inline",
+    kudu::MetricUnit::kRequests,
+    "Number of RPCs handled on the reactor thread which read them, rather "
+    "than queued for a service thread.");
+
 namespace kudu {
 namespace rpc {
 
@@ -83,10 +136,13 @@ ServicePool::ServicePool(
     size_t service_queue_length)
     : service_(std::move(service)),
       service_queue_(service_queue_length),
+      priority_queue_(FLAGS_rpc_priority_service_queue_length),
+      has_priority_threads_(false),
       incoming_queue_time_(METRIC_rpc_incoming_queue_time.Instantiate(entity)),
       rpcs_timed_out_in_queue_(
           METRIC_rpcs_timed_out_in_queue.Instantiate(entity)),
       rpcs_queue_overflow_(METRIC_rpcs_queue_overflow.Instantiate(entity)),
+      rpcs_handled_inline_(METRIC_rpcs_handled_inline.Instantiate(entity)),
       closing_(false),
       logged_busy_(false) {}
 
@@ -102,14 +158,33 @@ Status ServicePool::Init(int num_threads) {
         "rpc_worker",
         &ServicePool::RunThread,
         this,
+        &service_queue_,
         &new_thread));
     threads_.push_back(new_thread);
   }
+  // A thread serves a single queue, so high priority calls get threads of
+  // their own.
+  if (FLAGS_rpc_num_priority_service_threads > 0 &&
+      service_->HasHighPriorityMethods()) {
+    for (int i = 0; i < FLAGS_rpc_num_priority_service_threads; i++) {
+      scoped_refptr<kudu::Thread> new_thread;
+      CHECK_OK(kudu::Thread::Create(
+          "service pool",
+          "rpc_priority_worker",
+          &ServicePool::RunThread,
+          this,
+          &priority_queue_,
+          &new_thread));
+      threads_.push_back(new_thread);
+    }
+    has_priority_threads_ = true;
+  }
   return Status::OK();
 }
 
 void ServicePool::Shutdown() {
   service_queue_.Shutdown();
+  priority_queue_.Shutdown();
 
   MutexLock lock(shutdown_lock_);
   if (closing_)
@@ -120,25 +195,31 @@ void ServicePool::Shutdown() {
     CHECK_OK(ThreadJoiner(thread.get()).Join());
   }
 
-  // Now we must drain the service queue.
+  // Now we must drain the service queues.
   Status status = Status::ServiceUnavailable("Service is shutting down");
   std::unique_ptr<InboundCall> incoming;
   while (service_queue_.BlockingGet(&incoming)) {
     incoming.release()->RespondFailure(
         ErrorStatusPB::FATAL_SERVER_SHUTTING_DOWN, status);
   }
+  while (priority_queue_.BlockingGet(&incoming)) {
+    incoming.release()->RespondFailure(
+        ErrorStatusPB::FATAL_SERVER_SHUTTING_DOWN, status);
+  }
 
   service_->Shutdown();
 }
 
-void ServicePool::RejectTooBusy(InboundCall* c) {
+void ServicePool::RejectTooBusy(
+    InboundCall* c,
+    const LifoServiceQueue& queue) {
   string err_msg = Substitute(
       "$0 request on $1 from $2 dropped due to backpressure. "
       "The service queue is full; it has $3 items.",
       c->remote_method().method_name(),
       service_->service_name(),
       c->remote_address().ToString(),
-      service_queue_.max_size());
+      queue.max_size());
   rpcs_queue_overflow_->Increment();
   KLOG_EVERY_N_SECS(WARNING, 300) << err_msg;
   c->RespondFailure(
@@ -150,7 +231,7 @@ void ServicePool::RejectTooBusy(InboundCall* c) {
     // pool is always at edge of queue.
     KLOG_EVERY_N_SECS(WARNING, 600)
         << err_msg << " Contents of service queue:\n"
-        << service_queue_.ToString();
+        << queue.ToString();
     logged_busy_ = true;
   }
 
@@ -187,18 +268,27 @@ Status ServicePool::QueueInboundCall(unique_ptr<InboundCall> call) {
             ", "));
   }
 
+  RpcMethodInfo* method_info = c->method_info();
+  if (FLAGS_rpc_inline_handlers && method_info &&
+      method_info->run_inline.load(std::memory_order_relaxed)) {
+    HandleInline(c);
+    return Status::OK();
+  }
+
   TRACE_TO(c->trace(), "Inserting onto call queue");
 
   // Queue message on service queue
+  LifoServiceQueue* queue =
+      IsHighPriority(c) ? &priority_queue_ : &service_queue_;
   boost::optional<InboundCall*> evicted;
-  auto queue_status = service_queue_.Put(c, &evicted);
+  auto queue_status = queue->Put(c, &evicted);
   if (queue_status == QUEUE_FULL) {
-    RejectTooBusy(c);
+    RejectTooBusy(c, *queue);
     return Status::OK();
   }
 
   if (PREDICT_FALSE(evicted != boost::none)) {
-    RejectTooBusy(*evicted);
+    RejectTooBusy(*evicted, *queue);
   }
 
   // success in enqueu. Clear the printed state for busy
@@ -223,10 +313,30 @@ Status ServicePool::QueueInboundCall(unique_ptr<InboundCall> call) {
   return status;
 }
 
-void ServicePool::RunThread() {
+bool ServicePool::IsHighPriority(InboundCall* call) const {
+  if (!has_priority_threads_) {
+    return false;
+  }
+  const RpcMethodInfo* method_info = call->method_info();
+  if (!method_info) {
+    return false;
+  }
+  return method_info->high_priority ||
+      (method_info->high_priority_max_call_size > 0 &&
+       call->GetTransferSize() <= method_info->high_priority_max_call_size);
+}
+
+void ServicePool::RunThread(LifoServiceQueue* queue) {
+  vector<int> cpus;
+  CHECK_OK(ParseCpuList(FLAGS_rpc_service_thread_cpus, &cpus));
+  Status s = BindCurrentThreadToCpus(cpus);
+  if (!s.ok()) {
+    LOG(WARNING) << service_name() << " service thread: " << s.ToString();
+  }
+
   while (true) {
     std::unique_ptr<InboundCall> incoming;
-    if (!service_queue_.BlockingGet(&incoming)) {
+    if (!queue->BlockingGet(&incoming)) {
       VLOG(1) << "ServicePool: messenger shutting down.";
       return;
     }
@@ -259,6 +369,31 @@ void ServicePool::RunThread() {
   }
 }
 
+void ServicePool::HandleInline(InboundCall* call) {
+  RpcMethodInfo* method_info = call->method_info();
+  // The call may be responded to, and deleted, by the handler.
+  const string method_name = call->remote_method().method_name();
+
+  call->RecordHandlingStarted(incoming_queue_time_.get());
+  ADOPT_TRACE(call->trace());
+  TRACE_TO(call->trace(), "Handling call inline");
+  rpcs_handled_inline_->Increment();
+
+  const MonoTime start = MonoTime::Now();
+  service_->Handle(call);
+  const int64_t elapsed_us = (MonoTime::Now() - start).ToMicroseconds();
+
+  if (PREDICT_FALSE(elapsed_us > FLAGS_rpc_inline_handler_max_us) &&
+      method_info->run_inline.exchange(false)) {
+    LOG(WARNING) << Substitute(
+        "$0 call on $1 took $2us on a reactor thread; its calls will be "
+        "queued for service threads from now on",
+        method_name,
+        service_->service_name(),
+        elapsed_us);
+  }
+}
+
 const string ServicePool::service_name() const {
   return service_->service_name();
 }
@@ -99,15 +99,29 @@ class ServicePool : public RpcService {
   std::string RpcServiceQueueToString() const;
 
  private:
-  void RunThread();
-  void RejectTooBusy(InboundCall* c);
+  void RunThread(LifoServiceQueue* queue);
+  void RejectTooBusy(InboundCall* c, const LifoServiceQueue& queue);
+
+  // Whether 'call' goes to 'priority_queue_'.
+  bool IsHighPriority(InboundCall* call) const;
+
+  // Handles 'call', whose method may run inline, on the calling reactor
+  // thread. Stops running its method inline if the handler takes longer than
+  // --rpc_inline_handler_max_us.
+  void HandleInline(InboundCall* call);
 
   std::unique_ptr<ServiceIf> service_;
   std::vector<scoped_refptr<kudu::Thread>> threads_;
   LifoServiceQueue service_queue_;
+  // Calls of high priority methods, served by threads of their own so that
+  // they don't wait behind, or get evicted by, calls in 'service_queue_'.
+  // Only used if 'has_priority_threads_'.
+  LifoServiceQueue priority_queue_;
+  bool has_priority_threads_;
   scoped_refptr<Histogram> incoming_queue_time_;
   scoped_refptr<Counter> rpcs_timed_out_in_queue_;
   scoped_refptr<Counter> rpcs_queue_overflow_;
+  scoped_refptr<Counter> rpcs_handled_inline_;
 
   mutable Mutex shutdown_lock_;
   bool closing_;
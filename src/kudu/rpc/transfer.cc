@@ -17,23 +17,31 @@
 
 #include "kudu/rpc/transfer.h"
 
+#include <sys/mman.h>
 #include <sys/uio.h>
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <set>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "kudu/gutil/basictypes.h"
+#include "kudu/gutil/bits.h"
 #include "kudu/gutil/endian.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/constants.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
 #include "kudu/util/net/socket.h"
 
 DEFINE_int64(
@@ -44,6 +52,35 @@ DEFINE_int64(
 TAG_FLAG(rpc_max_message_size, advanced);
 TAG_FLAG(rpc_max_message_size, runtime);
 
+DEFINE_int32(
+    rpc_max_outbound_sidecars,
+    10,
+    "The maximum number of sidecars attached to an outgoing RPC request or "
+    "response, up to 32. Only raise it past 10 once every peer accepts 32 "
+    "sidecars, as older versions reject calls with more than 10.");
+TAG_FLAG(rpc_max_outbound_sidecars, advanced);
+TAG_FLAG(rpc_max_outbound_sidecars, runtime);
+
+static bool ValidateMaxOutboundSidecars(const char* flagname, int32_t value) {
+  if (value < 1 || value > kudu::rpc::TransferLimits::kMaxSidecars) {
+    LOG(ERROR) << flagname << " must be between 1 and "
+               << kudu::rpc::TransferLimits::kMaxSidecars;
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(rpc_max_outbound_sidecars, &ValidateMaxOutboundSidecars);
+
+DEFINE_int32(
+    rpc_inbound_buffer_pool_mb,
+    0,
+    "The most memory, in MB, each reactor thread keeps in free buffers to "
+    "receive large RPC messages into, saving an allocation and the page "
+    "faults of a fresh buffer per message. 0 disables the pool.");
+TAG_FLAG(rpc_inbound_buffer_pool_mb, advanced);
+TAG_FLAG(rpc_inbound_buffer_pool_mb, experimental);
+TAG_FLAG(rpc_inbound_buffer_pool_mb, runtime);
+
 static bool ValidateMaxMessageSize(const char* flagname, int64_t value) {
   if (value < 1 * 1024 * 1024) {
     LOG(ERROR) << flagname << " must be at least 1MB.";
@@ -63,9 +100,14 @@ static bool dummy = gflags::RegisterFlagValidator(
 namespace kudu {
 namespace rpc {
 
+using std::shared_ptr;
 using std::string;
 using strings::Substitute;
 
+namespace {
+const size_t kHugePageSize = 2 * 1024 * 1024;
+} // anonymous namespace
+
 #define RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status)          \
   do {                                                       \
     Status _s = (status);                                    \
@@ -79,11 +121,90 @@ using strings::Substitute;
 
 TransferCallbacks::~TransferCallbacks() {}
 
-InboundTransfer::InboundTransfer()
-    : total_length_(kMsgLengthPrefixLength), cur_offset_(0) {
+const size_t InboundBufferPool::kMinBufferSize;
+const int InboundBufferPool::kMinSizeClassBits;
+const int InboundBufferPool::kNumSizeClasses;
+
+InboundBufferPool::InboundBufferPool(shared_ptr<MemTracker> mem_tracker)
+    : mem_tracker_(std::move(mem_tracker)) {}
+
+InboundBufferPool::~InboundBufferPool() {
+  for (int i = 0; i < kNumSizeClasses; i++) {
+    for (uint8_t* buf : free_bufs_[i]) {
+      Free(buf, 1UL << (i + kMinSizeClassBits));
+    }
+  }
+}
+
+uint8_t* InboundBufferPool::Borrow(size_t size, size_t* capacity) {
+  int size_class = std::max(Bits::Log2Ceiling64(size), kMinSizeClassBits) -
+      kMinSizeClassBits;
+  DCHECK_LT(size_class, kNumSizeClasses);
+  *capacity = 1UL << (size_class + kMinSizeClassBits);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    std::vector<uint8_t*>& bufs = free_bufs_[size_class];
+    if (!bufs.empty()) {
+      uint8_t* buf = bufs.back();
+      bufs.pop_back();
+      free_bytes_ -= *capacity;
+      return buf;
+    }
+  }
+  return Allocate(*capacity);
+}
+
+void InboundBufferPool::Return(uint8_t* buf, size_t capacity) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    size_t max_free_bytes =
+        static_cast<size_t>(FLAGS_rpc_inbound_buffer_pool_mb) * 1024 * 1024;
+    if (free_bytes_ + capacity <= max_free_bytes) {
+      int size_class = Bits::Log2Floor64(capacity) - kMinSizeClassBits;
+      free_bufs_[size_class].push_back(buf);
+      free_bytes_ += capacity;
+      return;
+    }
+  }
+  Free(buf, capacity);
+}
+
+uint8_t* InboundBufferPool::Allocate(size_t capacity) {
+  void* buf;
+  if (capacity >= kHugePageSize) {
+    CHECK_EQ(0, posix_memalign(&buf, kHugePageSize, capacity));
+#ifdef MADV_HUGEPAGE
+    // Only a hint: this fails harmlessly where transparent huge pages are off.
+    ignore_result(madvise(buf, capacity, MADV_HUGEPAGE));
+#endif
+  } else {
+    buf = malloc(capacity);
+    CHECK(buf);
+  }
+  mem_tracker_->Consume(capacity);
+  return static_cast<uint8_t*>(buf);
+}
+
+void InboundBufferPool::Free(uint8_t* buf, size_t capacity) {
+  free(buf);
+  mem_tracker_->Release(capacity);
+}
+
+InboundTransfer::InboundTransfer(shared_ptr<InboundBufferPool> pool)
+    : pool_(std::move(pool)),
+      pooled_buf_(nullptr),
+      pooled_capacity_(0),
+      total_length_(kMsgLengthPrefixLength),
+      cur_offset_(0) {
   buf_.resize(kMsgLengthPrefixLength);
 }
 
+InboundTransfer::~InboundTransfer() {
+  if (pooled_buf_) {
+    pool_->Return(pooled_buf_, pooled_capacity_);
+  }
+}
+
 Status InboundTransfer::ReceiveBuffer(Socket& socket) {
   if (cur_offset_ < kMsgLengthPrefixLength) {
     // receive uint32 length prefix
@@ -119,7 +240,13 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
       return Status::NetworkError(
           Substitute("RPC frame had invalid length of $0", total_length_));
     }
-    buf_.resize(total_length_);
+    if (pool_ && FLAGS_rpc_inbound_buffer_pool_mb > 0 &&
+        total_length_ >= InboundBufferPool::kMinBufferSize) {
+      pooled_buf_ = pool_->Borrow(total_length_, &pooled_capacity_);
+      memcpy(pooled_buf_, buf_.data(), kMsgLengthPrefixLength);
+    } else {
+      buf_.resize(total_length_);
+    }
 
     // Fall through to receive the message body, which is likely to be already
     // available on the socket.
@@ -135,7 +262,8 @@ Status InboundTransfer::ReceiveBuffer(Socket& socket) {
   int32_t rem = std::min(
       total_length_ - cur_offset_,
       static_cast<uint32_t>(std::numeric_limits<int32_t>::max()));
-  Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+  uint8_t* buf = pooled_buf_ ? pooled_buf_ : buf_.data();
+  Status status = socket.Recv(buf + cur_offset_, rem, &nread);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
   cur_offset_ += nread;
 
@@ -206,37 +334,76 @@ Status OutboundTransfer::SendBuffer(Socket& socket) {
   CHECK_LT(cur_slice_idx_, n_payload_slices_);
 
   started_ = true;
-  int n_iovecs = n_payload_slices_ - cur_slice_idx_;
+  int n_iovecs = num_remaining_slices();
   struct iovec iovec[n_iovecs];
-  {
-    int offset_in_slice = cur_offset_in_slice_;
-    for (int i = 0; i < n_iovecs; i++) {
-      Slice& slice = payload_slices_[cur_slice_idx_ + i];
-      iovec[i].iov_base = slice.mutable_data() + offset_in_slice;
-      iovec[i].iov_len = slice.size() - offset_in_slice;
+  FillIovecs(iovec);
 
-      offset_in_slice = 0;
-    }
+  int64_t written;
+  Status status = socket.Writev(iovec, n_iovecs, &written);
+  RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
+
+  AdvanceWritten(&written);
+  DCHECK_EQ(0, written);
+  return Status::OK();
+}
+
+Status OutboundTransfer::SendBatch(
+    Socket& socket,
+    const std::vector<OutboundTransfer*>& transfers) {
+  int n_iovecs = 0;
+  for (const OutboundTransfer* transfer : transfers) {
+    CHECK_LT(transfer->cur_slice_idx_, transfer->n_payload_slices_);
+    n_iovecs += transfer->num_remaining_slices();
+  }
+  DCHECK_LE(n_iovecs, IOV_MAX);
+
+  struct iovec iovec[n_iovecs];
+  int filled = 0;
+  for (OutboundTransfer* transfer : transfers) {
+    DCHECK(transfer == transfers.front() || !transfer->started_);
+    transfer->started_ = true;
+    transfer->FillIovecs(&iovec[filled]);
+    filled += transfer->num_remaining_slices();
   }
 
   int64_t written;
   Status status = socket.Writev(iovec, n_iovecs, &written);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
 
+  for (OutboundTransfer* transfer : transfers) {
+    transfer->AdvanceWritten(&written);
+  }
+  DCHECK_EQ(0, written);
+  return Status::OK();
+}
+
+void OutboundTransfer::FillIovecs(struct iovec* iov) const {
+  int offset_in_slice = cur_offset_in_slice_;
+  for (int i = 0; i < num_remaining_slices(); i++) {
+    const Slice& slice = payload_slices_[cur_slice_idx_ + i];
+    iov[i].iov_base = const_cast<uint8_t*>(slice.data()) + offset_in_slice;
+    iov[i].iov_len = slice.size() - offset_in_slice;
+
+    offset_in_slice = 0;
+  }
+}
+
+void OutboundTransfer::AdvanceWritten(int64_t* written) {
   // Adjust our accounting of current writer position.
   for (int i = cur_slice_idx_; i < n_payload_slices_; i++) {
     Slice& slice = payload_slices_[i];
     int rem_in_slice = slice.size() - cur_offset_in_slice_;
     DCHECK_GE(rem_in_slice, 0);
 
-    if (written >= rem_in_slice) {
+    if (*written >= rem_in_slice) {
       // Used up this entire slice, advance to the next slice.
       cur_slice_idx_++;
       cur_offset_in_slice_ = 0;
-      written -= rem_in_slice;
+      *written -= rem_in_slice;
     } else {
       // Partially used up this slice, just advance the offset within it.
-      cur_offset_in_slice_ += written;
+      cur_offset_in_slice_ += *written;
+      *written = 0;
       break;
     }
   }
@@ -248,8 +415,6 @@ Status OutboundTransfer::SendBuffer(Socket& socket) {
     DCHECK_LT(cur_slice_idx_, n_payload_slices_);
     DCHECK_LT(cur_offset_in_slice_, payload_slices_[cur_slice_idx_].size());
   }
-
-  return Status::OK();
 }
 
 bool OutboundTransfer::TransferStarted() const {
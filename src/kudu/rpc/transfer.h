@@ -22,7 +22,9 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/intrusive/list_hook.hpp>
 #include <gflags/gflags_declare.h>
@@ -31,13 +33,18 @@
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/constants.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 DECLARE_int64(rpc_max_message_size);
+DECLARE_int32(rpc_max_outbound_sidecars);
+
+struct iovec;
 
 namespace kudu {
 
+class MemTracker;
 class Socket;
 
 namespace rpc {
@@ -46,8 +53,11 @@ struct TransferCallbacks;
 
 class TransferLimits {
  public:
+  // kMaxSidecars is the most sidecars a receiver accepts. Senders attach at
+  // most --rpc_max_outbound_sidecars, which defaults to 10 so that peers
+  // running older versions, which accept no more than 10, keep working.
   enum {
-    kMaxSidecars = 10,
+    kMaxSidecars = 32,
     kMaxPayloadSlices = kMaxSidecars + 2, // (header + msg)
     kMaxTotalSidecarBytes = INT_MAX
   };
@@ -57,6 +67,47 @@ class TransferLimits {
 
 typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 
+// A pool of buffers to receive large inbound transfers into, in power of two
+// size classes from 64KB up. Each reactor thread has one. A buffer goes back
+// to the pool when the call or response which received it is destroyed, which
+// may happen on any thread, so the pool is thread safe.
+//
+// Up to --rpc_inbound_buffer_pool_mb of free buffers are kept. All of the
+// buffers the pool allocated, free or not, are tracked by 'mem_tracker'.
+// Buffers of 2MB and up are aligned to 2MB and backed by transparent huge
+// pages where the kernel allows it.
+class InboundBufferPool {
+ public:
+  // Transfers smaller than this are received into ordinary heap buffers.
+  static const size_t kMinBufferSize = 64 * 1024;
+
+  explicit InboundBufferPool(std::shared_ptr<MemTracker> mem_tracker);
+  ~InboundBufferPool();
+
+  // Returns a buffer of at least 'size' bytes, whose capacity is written to
+  // 'capacity'.
+  uint8_t* Borrow(size_t size, size_t* capacity);
+
+  // Returns 'buf', which Borrow() returned with 'capacity', to the pool.
+  void Return(uint8_t* buf, size_t capacity);
+
+ private:
+  static const int kMinSizeClassBits = 16;
+  static const int kNumSizeClasses = 33 - kMinSizeClassBits;
+
+  uint8_t* Allocate(size_t capacity);
+  void Free(uint8_t* buf, size_t capacity);
+
+  const std::shared_ptr<MemTracker> mem_tracker_;
+
+  simple_spinlock lock_;
+  // Free buffers, by size class.
+  std::vector<uint8_t*> free_bufs_[kNumSizeClasses];
+  size_t free_bytes_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(InboundBufferPool);
+};
+
 // This class is used internally by the RPC layer to represent an inbound
 // transfer in progress.
 //
@@ -65,7 +116,12 @@ typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 // and the InboundTransfer object itself is handed off.
 class InboundTransfer {
  public:
-  InboundTransfer();
+  // Large transfers are received into buffers from 'pool', if one is given
+  // and --rpc_inbound_buffer_pool_mb is set.
+  explicit InboundTransfer(
+      std::shared_ptr<InboundBufferPool> pool =
+          std::shared_ptr<InboundBufferPool>());
+  ~InboundTransfer();
 
   // read from the socket into our buffer
   Status ReceiveBuffer(Socket& socket);
@@ -77,6 +133,9 @@ class InboundTransfer {
   bool TransferFinished() const;
 
   Slice data() const {
+    if (pooled_buf_) {
+      return Slice(pooled_buf_, total_length_);
+    }
     return Slice(buf_);
   }
 
@@ -89,6 +148,12 @@ class InboundTransfer {
 
   faststring buf_;
 
+  // Set instead of 'buf_' holding the message once its length is known, if
+  // the message was large enough to come from 'pool_'.
+  const std::shared_ptr<InboundBufferPool> pool_;
+  uint8_t* pooled_buf_;
+  size_t pooled_capacity_;
+
   uint32_t total_length_;
   uint32_t cur_offset_;
 
@@ -141,6 +206,20 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // send from our buffers into the sock
   Status SendBuffer(Socket& socket);
 
+  // Sends the rest of each of 'transfers', in order, with a single writev()
+  // call. Every transfer but the first must not have been started. Must not
+  // be used on TLS sockets that encrypt in user space, as SSL_write() must be
+  // retried with the same buffers (see KUDU-2334), which a different batch
+  // would not be.
+  static Status SendBatch(
+      Socket& socket,
+      const std::vector<OutboundTransfer*>& transfers);
+
+  // Return the number of slices which are yet to be sent.
+  int num_remaining_slices() const {
+    return n_payload_slices_ - cur_slice_idx_;
+  }
+
   // Return true if any bytes have yet been sent.
   bool TransferStarted() const;
 
@@ -170,6 +249,13 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
       size_t n_payload_slices,
       TransferCallbacks* callbacks);
 
+  // Fills 'iov' with the num_remaining_slices() slices yet to be sent.
+  void FillIovecs(struct iovec* iov) const;
+
+  // Accounts for up to '*written' bytes sent from this transfer, subtracting
+  // them from '*written', and notifies the callbacks if the transfer is done.
+  void AdvanceWritten(int64_t* written);
+
   // Slices to send. Uses an array here instead of a vector to avoid an
   // expensive vector construction (improved performance a couple percent).
   TransferPayload payload_slices_;
@@ -33,6 +33,7 @@
 
 #include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/security/ca/cert_management.h"
 #include "kudu/security/cert.h"
@@ -98,6 +99,37 @@ DEFINE_bool(
     false,
     "Whether to perform normal TLS handshake.");
 
+DEFINE_bool(
+    rpc_tls_kernel_offload,
+    false,
+    "Whether to hand the symmetric keys of TLS connections to the kernel "
+    "(kTLS) once the handshake completes, so that encrypted data is sent with "
+    "plain writes. Only takes effect with --enable_normal_tls, when built "
+    "against OpenSSL 3.0 or later, and when the kernel has the tls module "
+    "loaded; other connections keep encrypting in user space.");
+TAG_FLAG(rpc_tls_kernel_offload, experimental);
+
+DEFINE_bool(
+    rpc_tls_session_resumption,
+    false,
+    "Whether TLS sessions may be resumed, so that a client reconnecting to a "
+    "server it recently completed a handshake with skips the key exchange "
+    "and certificate exchange. Clients remember the last session with each "
+    "server, and servers accept resumption for "
+    "--rpc_tls_session_timeout_secs.");
+TAG_FLAG(rpc_tls_session_resumption, experimental);
+
+DEFINE_int32(
+    rpc_tls_session_timeout_secs,
+    300,
+    "How long, in seconds, a TLS session may be resumed for after the full "
+    "handshake which established it. Only takes effect with "
+    "--rpc_tls_session_resumption.");
+TAG_FLAG(rpc_tls_session_timeout_secs, experimental);
+DEFINE_validator(
+    rpc_tls_session_timeout_secs,
+    [](const char* /*flagname*/, int32_t value) { return value > 0; });
+
 namespace kudu {
 namespace security {
 
@@ -108,6 +140,10 @@ struct SslTypeTraits<SSL> {
   static constexpr auto kFreeFunc = &SSL_free;
 };
 template <>
+struct SslTypeTraits<SSL_SESSION> {
+  static constexpr auto kFreeFunc = &SSL_SESSION_free;
+};
+template <>
 struct SslTypeTraits<X509_STORE_CTX> {
   static constexpr auto kFreeFunc = &X509_STORE_CTX_free;
 };
@@ -216,8 +252,30 @@ Status TlsContext::Init() {
   // confuses our RPC negotiation protocol. See KUDU-2871.
   options |= SSL_OP_NO_TLSv1_3;
 
+  if (FLAGS_rpc_tls_kernel_offload) {
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#else
+    LOG(WARNING) << "--rpc_tls_kernel_offload is set, but this build of "
+                 << "OpenSSL does not support kernel TLS; ignoring";
+#endif
+  }
+
   SSL_CTX_set_options(ctx_.get(), options);
 
+  if (FLAGS_rpc_tls_session_resumption) {
+    // Servers resume sessions from their cache or from session tickets, which
+    // OpenSSL issues by default. A session ID context is required to resume
+    // sessions in which the peer's certificate was verified.
+    static const unsigned char kSessionIdContext[] = "kudu-rpc";
+    SSL_CTX_set_session_cache_mode(ctx_.get(), SSL_SESS_CACHE_SERVER);
+    OPENSSL_RET_NOT_OK(
+        SSL_CTX_set_session_id_context(
+            ctx_.get(), kSessionIdContext, sizeof(kSessionIdContext) - 1),
+        "failed to set TLS session ID context");
+    SSL_CTX_set_timeout(ctx_.get(), FLAGS_rpc_tls_session_timeout_secs);
+  }
+
   OPENSSL_RET_NOT_OK(
       SSL_CTX_set_cipher_list(ctx_.get(), tls_ciphers_.c_str()),
       "failed to set TLS ciphers");
@@ -715,7 +773,9 @@ int TlsContext::AlpnSelectCallback(
   return SSL_TLSEXT_ERR_OK;
 }
 
-Status TlsContext::CreateSSL(TlsHandshake* handshake) const {
+Status TlsContext::CreateSSL(
+    TlsHandshake* handshake,
+    const string& session_key) const {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   CHECK(ctx_);
   CHECK(!handshake->ssl_);
@@ -728,14 +788,44 @@ Status TlsContext::CreateSSL(TlsHandshake* handshake) const {
         "failed to create SSL handle", GetOpenSSLErrors());
   }
 
+  if (FLAGS_rpc_tls_session_resumption && !session_key.empty()) {
+    handshake->set_session_cache(this, session_key);
+    std::lock_guard<simple_spinlock> l(client_sessions_lock_);
+    const auto* session = FindOrNull(client_sessions_, session_key);
+    if (session) {
+      // Takes its own reference to the session.
+      OPENSSL_RET_NOT_OK(
+          SSL_set_session(handshake->ssl(), session->get()),
+          "failed to set TLS session to resume");
+    }
+  }
+
   return Status::OK();
 }
 
+void TlsContext::CacheClientSession(const string& session_key, SSL* ssl)
+    const {
+  c_unique_ptr<SSL_SESSION> session = ssl_make_unique(SSL_get1_session(ssl));
+  if (!session) {
+    return;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  // TLSv1.3 sessions only become resumable once the server sends a ticket,
+  // after the handshake.
+  if (!SSL_SESSION_is_resumable(session.get())) {
+    return;
+  }
+#endif
+  std::lock_guard<simple_spinlock> l(client_sessions_lock_);
+  client_sessions_[session_key] = std::move(session);
+}
+
 Status TlsContext::InitiateHandshake(
     TlsHandshakeType handshake_type,
-    TlsHandshake* handshake) const {
+    TlsHandshake* handshake,
+    const string& session_key) const {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
-  RETURN_NOT_OK(CreateSSL(handshake));
+  RETURN_NOT_OK(CreateSSL(handshake, session_key));
 
   SSL_set_bio(handshake->ssl(), BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
 
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -226,12 +227,25 @@ class TlsContext {
       void* data);
 
   // Create openssl handle
-  Status CreateSSL(TlsHandshake* handshake) const WARN_UNUSED_RESULT;
-
-  // Initiates a new TlsHandshake instance.
+  //
+  // With --rpc_tls_session_resumption, a client handshake given a
+  // 'session_key', which identifies the server and how it's verified, offers
+  // the last session cached under that key, and caches its own session once
+  // it completes.
+  Status CreateSSL(
+      TlsHandshake* handshake,
+      const std::string& session_key = "") const WARN_UNUSED_RESULT;
+
+  // Initiates a new TlsHandshake instance. 'session_key' is as for
+  // CreateSSL().
   Status InitiateHandshake(
       TlsHandshakeType handshake_type,
-      TlsHandshake* handshake) const WARN_UNUSED_RESULT;
+      TlsHandshake* handshake,
+      const std::string& session_key = "") const WARN_UNUSED_RESULT;
+
+  // Caches the session of 'ssl', a completed client handshake, to be resumed
+  // by later handshakes with the same 'session_key'.
+  void CacheClientSession(const std::string& session_key, SSL* ssl) const;
 
   // Return the number of certs that have been marked as trusted.
   // Used by tests.
@@ -273,6 +287,11 @@ class TlsContext {
   // alpn protocols in wire format
   std::vector<unsigned char> server_alpns_;
   bool client_alpns_are_set_{false};
+
+  // The last session of client handshakes, by session key.
+  mutable simple_spinlock client_sessions_lock_;
+  mutable std::unordered_map<std::string, c_unique_ptr<SSL_SESSION>>
+      client_sessions_;
 };
 
 } // namespace security
@@ -34,6 +34,7 @@
 #include "kudu/security/security-test-util.h"
 #include "kudu/security/tls_context.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/net/socket.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
@@ -43,6 +44,7 @@
 using std::string;
 using std::vector;
 
+DECLARE_bool(rpc_tls_session_resumption);
 DECLARE_int32(ipki_server_key_size);
 
 namespace kudu {
@@ -309,6 +311,63 @@ TEST_F(TestTlsHandshake, TestTlsContextCertTransition) {
       TlsVerificationMode::VERIFY_NONE));
 }
 
+// Tests that a client handshake resumes the last session cached under the
+// same session key, and only that.
+TEST_F(TestTlsHandshake, TestSessionResumption) {
+  FLAGS_rpc_tls_session_resumption = true;
+  TlsContext client_tls;
+  TlsContext server_tls;
+  ASSERT_OK(client_tls.Init());
+  ASSERT_OK(server_tls.Init());
+
+  PrivateKey ca_key;
+  Cert ca_cert;
+  ASSERT_OK(GenerateSelfSignedCAForTests(&ca_key, &ca_cert));
+  ASSERT_OK(
+      ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &client_tls));
+  ASSERT_OK(
+      ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &server_tls));
+
+  const auto handshake = [&](const string& session_key, bool* reused)
+      -> Status {
+    TlsHandshake client;
+    TlsHandshake server;
+    RETURN_NOT_OK(client_tls.InitiateHandshake(
+        TlsHandshakeType::CLIENT, &client, session_key));
+    RETURN_NOT_OK(
+        server_tls.InitiateHandshake(TlsHandshakeType::SERVER, &server));
+    string to_client;
+    string to_server;
+    Status s;
+    while ((s = client.Continue(to_client, &to_server)).IsIncomplete()) {
+      Status server_s = server.Continue(to_server, &to_client);
+      if (!server_s.ok() && !server_s.IsIncomplete()) {
+        return server_s;
+      }
+    }
+    RETURN_NOT_OK(s);
+    if (!to_server.empty()) {
+      RETURN_NOT_OK(server.Continue(to_server, &to_client));
+    }
+    *reused = client.session_reused();
+    // Verification caches the session.
+    RETURN_NOT_OK(client.FinishNoWrap(Socket()));
+    return server.FinishNoWrap(Socket());
+  };
+
+  bool reused;
+  ASSERT_OK(handshake("a", &reused));
+  ASSERT_FALSE(reused);
+  ASSERT_OK(handshake("a", &reused));
+  ASSERT_TRUE(reused);
+  ASSERT_OK(handshake("b", &reused));
+  ASSERT_FALSE(reused);
+
+  // Without a session key, nothing is resumed.
+  ASSERT_OK(handshake("", &reused));
+  ASSERT_FALSE(reused);
+}
+
 TEST_P(TestTlsHandshake, TestHandshake) {
   Case test_case = GetParam();
 
@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 
+#include <glog/logging.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -27,6 +28,7 @@
 #include "kudu/gutil/strings/strip.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/security/cert.h"
+#include "kudu/security/tls_context.h"
 #include "kudu/security/tls_socket.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/status.h"
@@ -114,6 +116,7 @@ Status TlsHandshake::SSLHandshake(
 
   RETURN_NOT_OK(GetCerts());
   RETURN_NOT_OK(Verify(**socket));
+  CacheSession();
 
   // Get selected ALPN
   const unsigned char* data{nullptr};
@@ -123,8 +126,18 @@ Status TlsHandshake::SSLHandshake(
     selected_alpn_ = std::string((const char*)data, (size_t)len);
   }
 
+  // If the kernel took over the record layer for sends (see
+  // --rpc_tls_kernel_offload), the socket can write application data directly.
+  bool kernel_tls_send = false;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  kernel_tls_send = BIO_get_ktls_send(SSL_get_wbio(ssl_.get())) == 1;
+  VLOG(2) << "kernel TLS offload: send="
+          << kernel_tls_send << " recv="
+          << (BIO_get_ktls_recv(SSL_get_rbio(ssl_.get())) == 1);
+#endif
+
   // Transfer the SSL instance to the socket.
-  socket->reset(new TlsSocket(fd, std::move(ssl_)));
+  socket->reset(new TlsSocket(fd, std::move(ssl_), kernel_tls_send));
 
   return Status::OK();
 }
@@ -265,6 +278,7 @@ Status TlsHandshake::Finish(unique_ptr<Socket>* socket) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(GetCerts());
   RETURN_NOT_OK(Verify(**socket));
+  CacheSession();
 
   int fd = (*socket)->Release();
 
@@ -284,7 +298,20 @@ Status TlsHandshake::Finish(unique_ptr<Socket>* socket) {
 Status TlsHandshake::FinishNoWrap(const Socket& socket) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(GetCerts());
-  return Verify(socket);
+  RETURN_NOT_OK(Verify(socket));
+  CacheSession();
+  return Status::OK();
+}
+
+void TlsHandshake::CacheSession() {
+  if (session_cache_) {
+    session_cache_->CacheClientSession(session_key_, ssl_.get());
+  }
+}
+
+bool TlsHandshake::session_reused() const {
+  CHECK(ssl_);
+  return SSL_session_reused(ssl_.get()) == 1;
 }
 
 Status TlsHandshake::GetLocalCert(Cert* cert) const {
@@ -34,6 +34,8 @@ class Socket;
 
 namespace security {
 
+class TlsContext;
+
 enum class TlsHandshakeType {
   // The local endpoint is the TLS client (initiator).
   CLIENT,
@@ -146,6 +148,11 @@ class TlsHandshake {
   // Only valid to call after the handshake is complete and before 'Finish()'.
   std::string GetCipherDescription() const;
 
+  // Whether the handshake resumed an earlier session rather than performing a
+  // full key exchange. Only valid to call after the handshake is complete and
+  // before 'Finish()'.
+  bool session_reused() const;
+
  private:
   friend class TlsContext;
 
@@ -167,6 +174,19 @@ class TlsHandshake {
     return ssl_.get();
   }
 
+  // Have the session cached in 'tls_context' under 'session_key' once the
+  // handshake is verified. Called by TlsContext::CreateSSL for client
+  // handshakes which may resume sessions.
+  void set_session_cache(
+      const TlsContext* tls_context,
+      std::string session_key) {
+    session_cache_ = tls_context;
+    session_key_ = std::move(session_key);
+  }
+
+  // Caches the session as set by set_session_cache(), if any.
+  void CacheSession();
+
   // Populates local_cert_ and remote_cert_.
   Status GetCerts() WARN_UNUSED_RESULT;
 
@@ -179,6 +199,11 @@ class TlsHandshake {
   Cert local_cert_;
   Cert remote_cert_;
   std::string selected_alpn_;
+
+  // Where to cache the session, and under which key. Unset unless sessions
+  // may be resumed.
+  const TlsContext* session_cache_ = nullptr;
+  std::string session_key_;
 };
 
 } // namespace security
@@ -33,11 +33,14 @@
 #include <thread>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "kudu/gutil/casts.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/security/tls_context.h"
+#include "kudu/security/tls_socket.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -50,6 +53,8 @@
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_bool(rpc_tls_kernel_offload);
+
 using std::string;
 using std::thread;
 using std::unique_ptr;
@@ -372,5 +377,80 @@ TEST_F(TlsSocketTest, TestNonBlockingWritev) {
   ASSERT_OK(client_sock->Close());
 }
 
+// Sockets set up with --rpc_tls_kernel_offload must carry data the same way
+// whether or not the kernel and OpenSSL in use can take over the encryption.
+TEST_F(TlsSocketTest, TestKernelTlsOffload) {
+  FLAGS_rpc_tls_kernel_offload = true;
+  TlsContext client_tls;
+  TlsContext server_tls;
+  ASSERT_OK(client_tls.Init());
+  ASSERT_OK(server_tls.Init());
+  ASSERT_OK(server_tls.GenerateSelfSignedCertAndKey());
+
+  Socket listener;
+  Sockaddr addr;
+  ASSERT_OK(addr.ParseString("127.0.0.1", 0));
+  ASSERT_OK(listener.Init(0));
+  ASSERT_OK(listener.BindAndListen(addr, /*listen_queue_size=*/1));
+  ASSERT_OK(listener.GetSocketAddress(&addr));
+
+  unique_ptr<Socket> server_sock(new Socket());
+  thread server_thread([&] {
+    Sockaddr remote;
+    CHECK_OK(listener.Accept(server_sock.get(), &remote, /*flags=*/0));
+    TlsHandshake server;
+    CHECK_OK(server_tls.InitiateHandshake(TlsHandshakeType::SERVER, &server));
+    server.set_verification_mode(TlsVerificationMode::VERIFY_NONE);
+    CHECK_OK(server.SSLHandshake(&server_sock, /*is_server=*/true));
+  });
+  auto join = MakeScopedCleanup([&] { server_thread.join(); });
+
+  unique_ptr<Socket> client_sock(new Socket());
+  ASSERT_OK(client_sock->Init(0));
+  ASSERT_OK(client_sock->Connect(addr));
+  TlsHandshake client;
+  ASSERT_OK(client_tls.InitiateHandshake(TlsHandshakeType::CLIENT, &client));
+  client.set_verification_mode(TlsVerificationMode::VERIFY_NONE);
+  ASSERT_OK(client.SSLHandshake(&client_sock, /*is_server=*/false));
+  join.cancel();
+  server_thread.join();
+
+  LOG(INFO) << "kernel TLS send: "
+            << down_cast<TlsSocket*>(client_sock.get())->kernel_tls_send();
+
+  Random rng(GetRandomSeed32());
+  const size_t kSize = 1024 * 1024;
+  unique_ptr<uint8_t[]> buf(new uint8_t[kSize]);
+  unique_ptr<uint8_t[]> rbuf(new uint8_t[kSize]);
+  RandomString(buf.get(), kSize, &rng);
+  vector<struct iovec> iov = ChunkIOVec(&rng, buf.get(), kSize, 64 * 1024);
+
+  thread reader([&] {
+    size_t n;
+    CHECK_OK(server_sock->BlockingRecv(
+        rbuf.get(), kSize, &n, MonoTime::Now() + kTimeout));
+  });
+  int64_t rem = kSize;
+  while (rem > 0) {
+    int64_t n;
+    ASSERT_OK(client_sock->Writev(&iov[0], iov.size(), &n));
+    rem -= n;
+    while (n > 0) {
+      if (n < iov[0].iov_len) {
+        iov[0].iov_len -= n;
+        iov[0].iov_base = reinterpret_cast<uint8_t*>(iov[0].iov_base) + n;
+        n = 0;
+      } else {
+        n -= iov[0].iov_len;
+        iov.erase(iov.begin());
+      }
+    }
+  }
+  reader.join();
+  ASSERT_EQ(0, memcmp(buf.get(), rbuf.get(), kSize));
+  ASSERT_OK(client_sock->Close());
+  ASSERT_OK(server_sock->Close());
+}
+
 } // namespace security
 } // namespace kudu
@@ -37,8 +37,8 @@
 namespace kudu {
 namespace security {
 
-TlsSocket::TlsSocket(int fd, c_unique_ptr<SSL> ssl)
-    : Socket(fd), ssl_(std::move(ssl)) {}
+TlsSocket::TlsSocket(int fd, c_unique_ptr<SSL> ssl, bool kernel_tls_send)
+    : Socket(fd), ssl_(std::move(ssl)), kernel_tls_send_(kernel_tls_send) {}
 
 TlsSocket::~TlsSocket() {
   ignore_result(Close());
@@ -48,6 +48,10 @@ Status TlsSocket::Write(const uint8_t* buf, int32_t amt, int32_t* nwritten) {
   CHECK(ssl_);
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
 
+  if (kernel_tls_send_) {
+    return Socket::Write(buf, amt, nwritten);
+  }
+
   *nwritten = 0;
   if (PREDICT_FALSE(amt == 0)) {
     // Writing an empty buffer is a no-op. This happens occasionally, eg in the
@@ -81,6 +85,12 @@ TlsSocket::Writev(const struct ::iovec* iov, int iov_len, int64_t* nwritten) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   CHECK(ssl_);
 
+  // With kernel TLS the kernel frames and encrypts the records, so the whole
+  // iovec goes out in one writev().
+  if (kernel_tls_send_) {
+    return Socket::Writev(iov, iov_len, nwritten);
+  }
+
   // Since OpenSSL doesn't support any kind of writev() call itself, this
   // function sets TCP_CORK and then calls Write() for each of the buffers in
   // the iovec, then unsets TCP_CORK. This causes the Linux kernel to buffer up
@@ -47,14 +47,22 @@ class TlsSocket : public Socket {
 
   Status Close() override WARN_UNUSED_RESULT;
 
+  // Whether the kernel encrypts what is written to this socket (kTLS). If so,
+  // writes bypass OpenSSL and may be split or retried like plain socket writes.
+  bool kernel_tls_send() const {
+    return kernel_tls_send_;
+  }
+
  private:
   friend class TlsHandshake;
 
-  TlsSocket(int fd, c_unique_ptr<SSL> ssl);
+  TlsSocket(int fd, c_unique_ptr<SSL> ssl, bool kernel_tls_send = false);
 
   // Owned SSL handle.
   c_unique_ptr<SSL> ssl_;
 
+  const bool kernel_tls_send_;
+
   // Socket-local buffer used by Writev().
   faststring buf_;
 };
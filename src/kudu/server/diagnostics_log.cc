@@ -22,7 +22,9 @@
 #include <memory>
 #include <ostream>
 #include <queue>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -35,6 +37,7 @@
 #include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/util/array_view.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/debug-util.h"
 #include "kudu/util/env.h"
@@ -83,9 +86,65 @@ DEFINE_int32(
 TAG_FLAG(diagnostics_log_stack_traces_interval_ms, runtime);
 TAG_FLAG(diagnostics_log_stack_traces_interval_ms, experimental);
 
+DEFINE_int32(
+    diagnostics_log_profile_hz,
+    0,
+    "If positive, the server samples the stacks of all of its threads this "
+    "many times a second, whether they are running or not, and periodically "
+    "writes the number of samples of each distinct stack to the diagnostics "
+    "log as a wall-clock profile. 'kudu diagnose parse_profiles' turns the "
+    "profiles into folded stacks for flame graphs. 0 disables profiling.");
+TAG_FLAG(diagnostics_log_profile_hz, runtime);
+TAG_FLAG(diagnostics_log_profile_hz, experimental);
+
+DEFINE_int32(
+    diagnostics_log_profile_interval_ms,
+    60000,
+    "The interval at which the samples taken for --diagnostics_log_profile_hz "
+    "are written to the diagnostics log.");
+TAG_FLAG(diagnostics_log_profile_interval_ms, runtime);
+TAG_FLAG(diagnostics_log_profile_interval_ms, experimental);
+
+DEFINE_bool(
+    diagnostics_log_raw_histograms,
+    false,
+    "Whether the histograms in the metrics records of the diagnostics log "
+    "include their bucket counts, so that 'kudu diagnose analyze_metrics' "
+    "can compute their percentiles between records. Makes the records "
+    "larger.");
+TAG_FLAG(diagnostics_log_raw_histograms, runtime);
+TAG_FLAG(diagnostics_log_raw_histograms, experimental);
+
+static bool ValidateProfileHz(const char* flagname, int32_t v) {
+  if (v >= 0 && v <= 1000) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be between 0 and 1000, got " << v;
+  return false;
+}
+DEFINE_validator(diagnostics_log_profile_hz, &ValidateProfileHz);
+
+static bool ValidateProfileInterval(const char* flagname, int32_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(diagnostics_log_profile_interval_ms, &ValidateProfileInterval);
+
 namespace kudu {
 namespace server {
 
+namespace {
+
+// The most stalls queued for logging at once. A burst of stalls beyond this,
+// e.g. every handler thread stuck behind the same slow disk, is likely to
+// show the same stacks over and over.
+constexpr int kMaxPendingStalls = 16;
+
+} // anonymous namespace
+
 // Track which symbols have been emitted to the log already.
 class DiagnosticsLog::SymbolSet {
  public:
@@ -113,12 +172,94 @@ class DiagnosticsLog::SymbolSet {
   google::dense_hash_set<void*> set_;
 };
 
+// The stack samples taken since the last profile was logged, counted by
+// stack.
+class DiagnosticsLog::Profile {
+ public:
+  // Adds the stack of each thread in 'snap' as one sample.
+  void AddSamples(StackTraceSnapshot* snap) {
+    if (num_samples_ == 0) {
+      start_ = MonoTime::Now();
+    }
+    num_samples_++;
+    snap->VisitGroups([&](ArrayView<StackTraceSnapshot::ThreadInfo> group) {
+      // Threads whose stacks could not be collected are grouped together
+      // with empty stacks; they tell nothing about where time goes.
+      if (group[0].stack.HasCollected()) {
+        counts_[group[0].stack] += group.size();
+      }
+    });
+  }
+
+  void Reset() {
+    num_samples_ = 0;
+    counts_.clear();
+  }
+
+  int64_t num_samples() const {
+    return num_samples_;
+  }
+
+  // The time since the first sample.
+  MonoDelta duration() const {
+    return MonoTime::Now() - start_;
+  }
+
+  template <class Visitor>
+  void VisitStacks(const Visitor& visitor) const {
+    for (const auto& e : counts_) {
+      visitor(e.first, e.second);
+    }
+  }
+
+ private:
+  struct StackHash {
+    size_t operator()(const StackTrace& stack) const {
+      return stack.HashCode();
+    }
+  };
+  struct StackEquals {
+    bool operator()(const StackTrace& a, const StackTrace& b) const {
+      return a.Equals(b);
+    }
+  };
+
+  int64_t num_samples_ = 0;
+  MonoTime start_;
+  std::unordered_map<StackTrace, int64_t, StackHash, StackEquals> counts_;
+};
+
+namespace {
+
+// Appends a 'symbols' record for 'new_symbols' to 'buf', unless there are
+// none.
+void AppendSymbolsRecord(
+    MicrosecondsInt64 now,
+    const vector<pair<void*, string>>& new_symbols,
+    std::ostringstream* buf) {
+  if (new_symbols.empty()) {
+    return;
+  }
+  *buf << "I" << FormatTimestampForLog(now) << " symbols " << now << " ";
+  JsonWriter jw(buf, JsonWriter::COMPACT);
+  jw.StartObject();
+  for (auto& p : new_symbols) {
+    jw.String(StringPrintf("%p", p.first));
+    jw.String(p.second);
+  }
+  jw.EndObject();
+  *buf << "\n";
+}
+
+} // anonymous namespace
+
 DiagnosticsLog::DiagnosticsLog(string log_dir, MetricRegistry* metric_registry)
     : log_dir_(std::move(log_dir)),
       metric_registry_(metric_registry),
       wake_(&lock_),
       metrics_log_interval_(MonoDelta::FromSeconds(60)),
-      symbols_(new SymbolSet()) {}
+      symbols_(new SymbolSet()),
+      profile_(new Profile()) {}
 
 DiagnosticsLog::~DiagnosticsLog() {
   Stop();
@@ -155,14 +296,28 @@ Status DiagnosticsLog::Start() {
   if (!s.ok()) {
     // Don't leave the log open if we failed to start our thread.
     log_.reset();
+    return s;
   }
-  return s;
+
+  // Threads found stuck in sections watched by SCOPED_WATCH_STACK() get their
+  // stacks logged here too, next to the metrics of the time.
+  stall_callback_id_ = KernelStackWatchdog::GetInstance()->AddStallCallback(
+      [this](const KernelStackWatchdog::Stall& stall) {
+        MutexLock l(lock_);
+        if (pending_stalls_.size() < kMaxPendingStalls) {
+          pending_stalls_.push_back(stall);
+          wake_.Signal();
+        }
+      });
+  return Status::OK();
 }
 
 void DiagnosticsLog::Stop() {
   if (!thread_)
     return;
 
+  KernelStackWatchdog::GetInstance()->RemoveStallCallback(stall_callback_id_);
+  stall_callback_id_ = -1;
   {
     MutexLock l(lock_);
     stop_ = true;
@@ -171,6 +326,7 @@ void DiagnosticsLog::Stop() {
   thread_->Join();
   thread_.reset();
   stop_ = false;
+  pending_stalls_.clear();
   WARN_NOT_OK(log_->Close(), "Unable to close diagnostics log");
 }
 
@@ -199,6 +355,14 @@ MonoTime DiagnosticsLog::ComputeNextWakeup(
       break;
     case WakeupType::METRICS:
       return MonoTime::Now() + metrics_log_interval_;
+    case WakeupType::PROFILE: {
+      // Like with stacks, wake up periodically while profiling is disabled
+      // to notice the flag changing.
+      const int32_t hz = FLAGS_diagnostics_log_profile_hz;
+      return MonoTime::Now() +
+          (hz > 0 ? MonoDelta::FromNanoseconds(1000000000 / hz)
+                  : MonoDelta::FromSeconds(5));
+    }
   }
   __builtin_unreachable();
 }
@@ -210,6 +374,7 @@ void DiagnosticsLog::RunThread() {
   typedef pair<MonoTime, WakeupType> QueueElem;
   priority_queue<QueueElem, vector<QueueElem>, std::greater<QueueElem>> wakeups;
   wakeups.emplace(ComputeNextWakeup(WakeupType::METRICS), WakeupType::METRICS);
+  wakeups.emplace(ComputeNextWakeup(WakeupType::PROFILE), WakeupType::PROFILE);
 #ifdef FB_DO_NOT_REMOVE
   wakeups.emplace(ComputeNextWakeup(WakeupType::STACKS), WakeupType::STACKS);
 #endif
@@ -218,6 +383,16 @@ void DiagnosticsLog::RunThread() {
     MonoTime next_log = wakeups.top().first;
     wake_.WaitUntil(next_log);
 
+    if (!pending_stalls_.empty()) {
+      vector<KernelStackWatchdog::Stall> stalls;
+      stalls.swap(pending_stalls_);
+      l.Unlock();
+      for (const auto& stall : stalls) {
+        WARN_NOT_OK(LogStall(stall), "Unable to log stall to diagnostics log");
+      }
+      l.Lock();
+    }
+
     string reason;
     WakeupType what;
 
@@ -248,6 +423,16 @@ void DiagnosticsLog::RunThread() {
       WARN_NOT_OK(LogMetrics(), "Unable to collect metrics to diagnostics log");
     }
 
+    if (what == WakeupType::PROFILE) {
+      // Sampling runs many times a second, so don't log every failure.
+      s = SampleProfile();
+      if (PREDICT_FALSE(!s.ok())) {
+        KLOG_EVERY_N_SECS(WARNING, 60)
+            << "Unable to profile stacks to diagnostics log: " << s.ToString()
+            << THROTTLE_MSG;
+      }
+    }
+
 #ifdef FB_DO_NOT_REMOVE
     if (what == WakeupType::STACKS &&
         FLAGS_diagnostics_log_stack_traces_interval_ms >= 0) {
@@ -277,34 +462,9 @@ Status DiagnosticsLog::LogStacks(const string& reason) {
   symbols_->ResetIfLogRolled(log_->roll_count());
   vector<std::pair<void*, string>> new_symbols;
   snap.VisitGroups([&](ArrayView<StackTraceSnapshot::ThreadInfo> group) {
-    const StackTrace& stack = group[0].stack;
-    for (int i = 0; i < stack.num_frames(); i++) {
-      void* addr = stack.frame(i);
-      if (symbols_->Add(addr)) {
-        char buf[1024];
-        // Subtract 1 from the address before symbolizing, because the
-        // address on the stack is actually the return address of the function
-        // call rather than the address of the call instruction itself.
-        if (google::Symbolize(static_cast<char*>(addr) - 1, buf, sizeof(buf))) {
-          new_symbols.emplace_back(addr, buf);
-        }
-        // If symbolization fails, don't bother adding it. Readers of the log
-        // will just see that it's missing from the symbol map and should handle
-        // that as an unknown symbol.
-      }
-    }
+    CollectNewSymbols(group[0].stack, &new_symbols);
   });
-  if (!new_symbols.empty()) {
-    buf << "I" << FormatTimestampForLog(now) << " symbols " << now << " ";
-    JsonWriter jw(&buf, JsonWriter::COMPACT);
-    jw.StartObject();
-    for (auto& p : new_symbols) {
-      jw.String(StringPrintf("%p", p.first));
-      jw.String(p.second);
-    }
-    jw.EndObject();
-    buf << "\n";
-  }
+  AppendSymbolsRecord(now, new_symbols, &buf);
 
   buf << "I" << FormatTimestampForLog(now) << " stacks " << now << " ";
   JsonWriter jw(&buf, JsonWriter::COMPACT);
@@ -348,9 +508,111 @@ Status DiagnosticsLog::LogStacks(const string& reason) {
 }
 #endif
 
+void DiagnosticsLog::CollectNewSymbols(
+    const StackTrace& stack,
+    vector<pair<void*, string>>* new_symbols) {
+  for (int i = 0; i < stack.num_frames(); i++) {
+    void* addr = stack.frame(i);
+    if (symbols_->Add(addr)) {
+      char buf[1024];
+      // Subtract 1 from the address before symbolizing, because the
+      // address on the stack is actually the return address of the function
+      // call rather than the address of the call instruction itself.
+      if (google::Symbolize(static_cast<char*>(addr) - 1, buf, sizeof(buf))) {
+        new_symbols->emplace_back(addr, buf);
+      }
+      // If symbolization fails, don't bother adding it. Readers of the log
+      // will just see that it's missing from the symbol map and should handle
+      // that as an unknown symbol.
+    }
+  }
+}
+
+Status DiagnosticsLog::SampleProfile() {
+  if (FLAGS_diagnostics_log_profile_hz <= 0) {
+    // Profiling was disabled at runtime; drop what was sampled so far.
+    profile_->Reset();
+    return Status::OK();
+  }
+  StackTraceSnapshot snap;
+  snap.set_capture_thread_names(false);
+  RETURN_NOT_OK(snap.SnapshotAllStacks());
+  profile_->AddSamples(&snap);
+  if (profile_->duration() <
+      MonoDelta::FromMilliseconds(FLAGS_diagnostics_log_profile_interval_ms)) {
+    return Status::OK();
+  }
+  Status s = LogProfile();
+  profile_->Reset();
+  return s;
+}
+
+Status DiagnosticsLog::LogProfile() {
+  std::ostringstream buf;
+  kudu::MicrosecondsInt64 now = GetCurrentTimeMicros();
+
+  // Symbols are dictionary-encoded as in LogStacks().
+  symbols_->ResetIfLogRolled(log_->roll_count());
+  vector<pair<void*, string>> new_symbols;
+  profile_->VisitStacks([&](const StackTrace& stack, int64_t /*count*/) {
+    CollectNewSymbols(stack, &new_symbols);
+  });
+  AppendSymbolsRecord(now, new_symbols, &buf);
+
+  buf << "I" << FormatTimestampForLog(now) << " profile " << now << " ";
+  JsonWriter jw(&buf, JsonWriter::COMPACT);
+  jw.StartObject();
+  jw.String("samples");
+  jw.Int64(profile_->num_samples());
+  jw.String("duration_ms");
+  jw.Int64(profile_->duration().ToMilliseconds());
+  jw.String("stacks");
+  jw.StartArray();
+  profile_->VisitStacks([&](const StackTrace& stack, int64_t count) {
+    jw.StartObject();
+    jw.String("count");
+    jw.Int64(count);
+    jw.String("stack");
+    jw.StartArray();
+    for (int i = 0; i < stack.num_frames(); i++) {
+      jw.String(StringPrintf("%p", stack.frame(i)));
+    }
+    jw.EndArray();
+    jw.EndObject();
+  });
+  jw.EndArray();
+  jw.EndObject();
+  buf << "\n";
+
+  return log_->Append(buf.str());
+}
+
+Status DiagnosticsLog::LogStall(const KernelStackWatchdog::Stall& stall) {
+  std::ostringstream buf;
+  kudu::MicrosecondsInt64 now = GetCurrentTimeMicros();
+  // The watchdog hands over symbolized stacks, so unlike LogStacks() there is
+  // no symbol table to maintain.
+  buf << "I" << FormatTimestampForLog(now) << " stall " << now << " ";
+  JsonWriter jw(&buf, JsonWriter::COMPACT);
+  jw.StartObject();
+  jw.String("tid");
+  jw.Int64(stall.tid);
+  jw.String("label");
+  jw.String(stall.label);
+  jw.String("paused_ms");
+  jw.Int64(stall.paused_ms);
+  jw.String("kernel_stack");
+  jw.String(stall.kernel_stack);
+  jw.String("user_stack");
+  jw.String(stall.user_stack);
+  jw.EndObject();
+  buf << "\n";
+  return log_->Append(buf.str());
+}
+
 Status DiagnosticsLog::LogMetrics() {
   MetricJsonOptions opts;
-  opts.include_raw_histograms = false;
+  opts.include_raw_histograms = FLAGS_diagnostics_log_raw_histograms;
 
   opts.only_modified_in_or_after_epoch = 0;
 
@@ -19,12 +19,15 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
+#include "kudu/util/kernel_stack_watchdog.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 
@@ -32,6 +35,7 @@ namespace kudu {
 
 class MetricRegistry;
 class RollingLog;
+class StackTrace;
 class Thread;
 class Status;
 
@@ -58,8 +62,9 @@ class DiagnosticsLog {
 
  private:
   class SymbolSet;
+  class Profile;
 
-  enum class WakeupType { METRICS, STACKS };
+  enum class WakeupType { METRICS, STACKS, PROFILE };
 
   void RunThread();
   Status LogMetrics();
@@ -67,6 +72,21 @@ class DiagnosticsLog {
   Status LogStacks(const std::string& reason);
 #endif
 
+  // Takes one sample of the stacks of all threads for the profile, and logs
+  // the profile once it spans --diagnostics_log_profile_interval_ms.
+  Status SampleProfile();
+  Status LogProfile();
+
+  // Logs the kernel and user stacks of a thread found stuck by the kernel
+  // stack watchdog.
+  Status LogStall(const KernelStackWatchdog::Stall& stall);
+
+  // Adds the symbols of the frames of 'stack' which were not yet written to
+  // the current log file to 'new_symbols'.
+  void CollectNewSymbols(
+      const StackTrace& stack,
+      std::vector<std::pair<void*, std::string>>* new_symbols);
+
   MonoTime ComputeNextWakeup(DiagnosticsLog::WakeupType type) const;
 
   const std::string log_dir_;
@@ -86,12 +106,21 @@ class DiagnosticsLog {
   boost::optional<std::string> dump_stacks_now_reason_;
 #endif
 
+  // Stalls passed on by the kernel stack watchdog which are yet to be logged.
+  // Protected by 'lock_'.
+  std::vector<KernelStackWatchdog::Stall> pending_stalls_;
+
+  // The id of our callback with the kernel stack watchdog while running, or
+  // -1.
+  int stall_callback_id_ = -1;
+
   MonoDelta metrics_log_interval_;
 
   int64_t metrics_epoch_ = 0;
 
   // Out-of-line this internal data to keep the header smaller.
   std::unique_ptr<SymbolSet> symbols_;
+  std::unique_ptr<Profile> profile_;
 
   DISALLOW_COPY_AND_ASSIGN(DiagnosticsLog);
 };
@@ -97,6 +97,16 @@ DEFINE_bool(
     "Whether to set the SO_REUSEPORT option on listening RPC sockets.");
 TAG_FLAG(rpc_reuseport, experimental);
 
+DEFINE_bool(
+    rpc_accept_in_reactors,
+    false,
+    "Whether each reactor thread accepts RPC connections from a listening "
+    "socket of its own, sharing the address through SO_REUSEPORT, instead of "
+    "acceptor threads handing connections to reactors. The kernel then "
+    "spreads new connections across reactors. Implies --rpc_reuseport, and "
+    "--rpc_num_acceptors_per_address is ignored.");
+TAG_FLAG(rpc_accept_in_reactors, experimental);
+
 namespace kudu {
 
 RpcServerOptions::RpcServerOptions()
@@ -106,7 +116,8 @@ RpcServerOptions::RpcServerOptions()
       num_service_threads(FLAGS_rpc_num_service_threads),
       default_port(0),
       service_queue_length(FLAGS_rpc_service_queue_length),
-      rpc_reuseport(FLAGS_rpc_reuseport) {}
+      rpc_reuseport(FLAGS_rpc_reuseport),
+      rpc_accept_in_reactors(FLAGS_rpc_accept_in_reactors) {}
 
 RpcServer::RpcServer(RpcServerOptions opts)
     : server_state_(UNINITIALIZED), options_(std::move(opts)) {}
@@ -206,7 +217,11 @@ Status RpcServer::Start() {
   server_state_ = STARTED;
 
   for (const shared_ptr<AcceptorPool>& pool : acceptor_pools_) {
-    RETURN_NOT_OK(pool->Start(options_.num_acceptors_per_address));
+    if (options_.rpc_accept_in_reactors) {
+      RETURN_NOT_OK(pool->StartInReactors());
+    } else {
+      RETURN_NOT_OK(pool->Start(options_.num_acceptors_per_address));
+    }
   }
 
   vector<Sockaddr> bound_addrs;
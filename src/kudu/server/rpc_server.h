@@ -53,6 +53,9 @@ struct RpcServerOptions {
   uint16_t default_port;
   size_t service_queue_length;
   bool rpc_reuseport;
+  // Accept connections in the messenger's reactor threads, each listening on
+  // its own SO_REUSEPORT socket, rather than in acceptor threads.
+  bool rpc_accept_in_reactors;
   uint32_t num_reactor_threads;
 };
 
@@ -77,6 +77,7 @@
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/flag_validators.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_scheduler.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/mem_tracker.h"
@@ -98,6 +99,54 @@ DEFINE_int32(
     "Number of libev reactor threads to start.");
 TAG_FLAG(num_reactor_threads, advanced);
 
+DEFINE_string(
+    rpc_reactor_cpus,
+    "",
+    "CPUs to bind the reactor threads to, one CPU per reactor, e.g. "
+    "\"0-3\". Inbound connections are then handled by the reactor on the "
+    "CPU, or else the NUMA node, their traffic arrives on. Empty leaves the "
+    "reactors unbound.");
+TAG_FLAG(rpc_reactor_cpus, advanced);
+TAG_FLAG(rpc_reactor_cpus, experimental);
+DEFINE_validator(rpc_reactor_cpus, &kudu::ValidateCpuListFlag);
+
+DEFINE_int32(
+    rpc_reactor_spin_us,
+    0,
+    "How long, in microseconds, each reactor thread keeps polling for network "
+    "activity without blocking after handling some. This lowers the latency "
+    "of bursts of RPCs at the cost of CPU. 0 disables spinning.");
+TAG_FLAG(rpc_reactor_spin_us, advanced);
+TAG_FLAG(rpc_reactor_spin_us, experimental);
+
+DEFINE_int32(
+    rpc_socket_busy_poll_us,
+    0,
+    "If positive, SO_BUSY_POLL is set to this many microseconds on RPC "
+    "sockets, so that polls spin on the network device queue. Raising it "
+    "above net.core.busy_read requires CAP_NET_ADMIN.");
+TAG_FLAG(rpc_socket_busy_poll_us, advanced);
+TAG_FLAG(rpc_socket_busy_poll_us, experimental);
+
+DEFINE_int32(
+    rpc_reactor_timer_wheel_tick_ms,
+    0,
+    "If positive, delayed tasks scheduled on each reactor, such as those of "
+    "periodic timers, are kept in a timer wheel advanced every this many "
+    "milliseconds rather than each arming a timer of its own. Tasks then run "
+    "up to one tick late. 0 disables the timer wheel.");
+TAG_FLAG(rpc_reactor_timer_wheel_tick_ms, advanced);
+TAG_FLAG(rpc_reactor_timer_wheel_tick_ms, experimental);
+
+DEFINE_bool(
+    rpc_idle_connection_lru,
+    false,
+    "Whether each reactor keeps its inbound connections ordered by when they "
+    "may next have been idle for the keepalive time, so that expiring idle "
+    "connections only visits those rather than every inbound connection.");
+TAG_FLAG(rpc_idle_connection_lru, advanced);
+TAG_FLAG(rpc_idle_connection_lru, experimental);
+
 DEFINE_int32(
     min_negotiation_threads,
     0,
@@ -485,6 +534,7 @@ Status ServerBase::Init() {
   tcmalloc::RegisterMetrics(metric_entity_);
 #endif
   RegisterSpinLockContentionMetrics(metric_entity_);
+  RegisterIOSchedulerMetrics(metric_entity_);
 
   InitSpinLockContentionProfiling();
 
@@ -497,6 +547,7 @@ Status ServerBase::Init() {
       security::InitKerberosForServer(FLAGS_principal, FLAGS_keytab_file));
 
   fs::FsReport report;
+  const MonoTime fs_open_start = MonoTime::Now();
   Status s = fs_manager_->Open(&report);
   if (s.IsNotFound()) {
     LOG(INFO) << "Could not load existing FS layout: " << s.ToString();
@@ -520,6 +571,7 @@ Status ServerBase::Init() {
   }
   RETURN_NOT_OK_PREPEND(s, "Failed to load FS layout");
   RETURN_NOT_OK(report.LogAndCheckForFatalErrors());
+  fs_open_time_ = MonoTime::Now() - fs_open_start;
 
   RETURN_NOT_OK(InitAcls());
 
@@ -530,6 +582,7 @@ Status ServerBase::Init() {
       .set_min_negotiation_threads(FLAGS_min_negotiation_threads)
       .set_max_negotiation_threads(FLAGS_max_negotiation_threads)
       .set_metric_entity(metric_entity())
+      .set_metric_registry(metric_registry())
       .set_connection_keep_alive_time(FLAGS_rpc_default_keepalive_time_ms)
       .set_rpc_negotiation_timeout_ms(FLAGS_rpc_negotiation_timeout_ms)
       .set_rpc_authentication(FLAGS_rpc_authentication)
@@ -543,10 +596,24 @@ Status ServerBase::Init() {
       .set_keytab_file(FLAGS_keytab_file)
       .enable_inbound_tls();
 
-  if (options_.rpc_opts.rpc_reuseport) {
+  if (options_.rpc_opts.rpc_reuseport ||
+      options_.rpc_opts.rpc_accept_in_reactors) {
     builder.set_reuseport();
   }
 
+  vector<int> reactor_cpus;
+  RETURN_NOT_OK(ParseCpuList(FLAGS_rpc_reactor_cpus, &reactor_cpus));
+  builder.set_reactor_cpus(std::move(reactor_cpus))
+      .set_reactor_spin_us(FLAGS_rpc_reactor_spin_us)
+      .set_socket_busy_poll_us(FLAGS_rpc_socket_busy_poll_us);
+  if (FLAGS_rpc_reactor_timer_wheel_tick_ms > 0) {
+    builder.set_timer_wheel_tick(
+        MonoDelta::FromMilliseconds(FLAGS_rpc_reactor_timer_wheel_tick_ms));
+  }
+  if (FLAGS_rpc_idle_connection_lru) {
+    builder.set_idle_connection_lru();
+  }
+
   // If rpc_opts explicitly specify the number of reactor threads, then use it
   // to override FLAGS_num_reactor_threads
   if (options_.rpc_opts.num_reactor_threads != 0) {
@@ -660,18 +727,18 @@ void ServerBase::LogUnauthorizedAccess(rpc::RpcContext* rpc) const {
 }
 
 bool ServerBase::Authorize(rpc::RpcContext* rpc, uint32_t allowed_roles) {
-  if ((allowed_roles & SUPER_USER) &&
-      superuser_acl_.UserAllowed(rpc->remote_user().username())) {
-    return true;
-  }
-
-  if ((allowed_roles & USER) &&
-      user_acl_.UserAllowed(rpc->remote_user().username())) {
-    return true;
-  }
-
-  if ((allowed_roles & SERVICE_USER) &&
-      service_acl_.UserAllowed(rpc->remote_user().username())) {
+  // The ACLs are set once at startup and a connection's remote user once at
+  // negotiation, so the decision holds for the connection's life.
+  bool allowed;
+  if (!rpc->GetCachedAuthorization(allowed_roles, &allowed)) {
+    const string& username = rpc->remote_user().username();
+    allowed = ((allowed_roles & SUPER_USER) &&
+               superuser_acl_.UserAllowed(username)) ||
+        ((allowed_roles & USER) && user_acl_.UserAllowed(username)) ||
+        ((allowed_roles & SERVICE_USER) && service_acl_.UserAllowed(username));
+    rpc->CacheAuthorization(allowed_roles, allowed);
+  }
+  if (allowed) {
     return true;
   }
 
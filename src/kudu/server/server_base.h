@@ -26,6 +26,7 @@
 #include "kudu/security/simple_acl.h"
 #include "kudu/server/server_base_options.h"
 #include "kudu/util/countdown_latch.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -204,6 +205,8 @@ class ServerBase {
   std::shared_ptr<rpc::Messenger> messenger_;
   scoped_refptr<rpc::ResultTracker> result_tracker_;
   bool is_first_run_;
+  // How long opening, or creating, the FsManager took in Init().
+  MonoDelta fs_open_time_;
 
   scoped_refptr<clock::Clock> clock_;
 
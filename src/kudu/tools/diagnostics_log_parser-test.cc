@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -71,8 +72,8 @@ TEST(DiagLogParserTest, TestParseLine) {
   }
 
   {
-    // The line parser recognizes "stacks" and "symbols" categories.
-    // "metrics" isn't recognized yet.
+    // The line parser recognizes "stacks", "symbols" and "metrics"
+    // categories.
     ParsedLine pl;
     string line =
         "I0220 17:38:09.950546 stacks 1519177089950546 {\"foo\" : \"bar\"}";
@@ -85,7 +86,8 @@ TEST(DiagLogParserTest, TestParseLine) {
 
     line = "I0220 17:38:09.950546 metrics 1519177089950546 {\"foo\" : \"bar\"}";
     ASSERT_OK(pl.Parse(line));
-    ASSERT_EQ(RecordType::kUnknown, pl.type());
+    ASSERT_EQ(RecordType::kMetrics, pl.type());
+    ASSERT_EQ(1519177089950546, pl.time_us());
 
     line = "I0220 17:38:09.950546 foo 1519177089950546 {\"foo\" : \"bar\"}";
     ASSERT_OK(pl.Parse(line));
@@ -252,5 +254,126 @@ TEST(DiagLogParserTest, TestParseStacks) {
   ASSERT_OK(lp.ParseLine(line));
 }
 
+TEST(DiagLogParserTest, TestParseProfile) {
+  FoldedStacksLogVisitor lv;
+  LogParser lp(&lv);
+
+  string line = "I0220 17:38:09.950546 profile 1519177089950546 {}";
+  Status s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "expected profile to have samples");
+
+  line =
+      "I0220 17:38:09.950546 profile 1519177089950546 "
+      "{\"samples\" : 1, \"stacks\" : [{\"count\" : 1}]}";
+  s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "objects with count and stack");
+
+  // Frames are folded outermost first, and counts are summed across records.
+  // A frame without a symbol keeps its address.
+  ASSERT_OK(lp.ParseLine(
+      "I0220 17:38:09.950546 symbols 1519177089950546 "
+      "{\"0x1\" : \"leaf()\", \"0x2\" : \"main\"}"));
+  line =
+      "I0220 17:38:09.950546 profile 1519177089950546 "
+      "{\"samples\" : 2, \"duration_ms\" : 20, \"stacks\" : ["
+      "{\"count\" : 3, \"stack\" : [\"0x1\", \"0x2\"]}, "
+      "{\"count\" : 1, \"stack\" : [\"0x3\", \"0x2\"]}]}";
+  ASSERT_OK(lp.ParseLine(line));
+  ASSERT_OK(lp.ParseLine(line));
+  std::ostringstream out;
+  lv.DumpFoldedStacks(&out);
+  ASSERT_EQ("main;0x3 2\nmain;leaf() 6\n", out.str());
+}
+
+TEST(DiagLogParserTest, TestParseMetrics) {
+  NoopLogVisitor lv;
+  LogParser lp(&lv);
+
+  string line = "I0220 17:38:09.950546 metrics 1519177089950546 {}";
+  Status s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "expected metrics data to be a JSON array");
+
+  line =
+      "I0220 17:38:09.950546 metrics 1519177089950546 "
+      "[{\"type\" : \"tablet\", \"id\" : \"t\"}]";
+  s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "objects with type, id and metrics");
+
+  line =
+      "I0220 17:38:09.950546 metrics 1519177089950546 "
+      "[{\"type\" : \"tablet\", \"id\" : \"t\", \"metrics\" : [{\"name\" : "
+      "\"h\", \"total_count\" : 1, \"values\" : [1], \"counts\" : []}]}]";
+  s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "arrays of the same size");
+
+  // String gauges are skipped.
+  line =
+      "I0220 17:38:09.950546 metrics 1519177089950546 "
+      "[{\"type\" : \"server\", \"id\" : \"s\", \"metrics\" : ["
+      "{\"name\" : \"state\", \"value\" : \"RUNNING\"}, "
+      "{\"name\" : \"c\", \"value\" : 5}]}]";
+  ASSERT_OK(lp.ParseLine(line));
+}
+
+TEST(DiagLogParserTest, TestCollectMetrics) {
+  MetricsCollectingLogVisitor lv({"tablet.*"});
+  LogParser lp(&lv);
+
+  // Each record has the metrics of both tablets, other than the second,
+  // which only has the first tablet's; the second tablet's are carried
+  // over from the first record.
+  ASSERT_OK(lp.ParseLine(
+      "I0220 17:38:00.000000 metrics 1000000 ["
+      "{\"type\" : \"tablet\", \"id\" : \"a\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 10}, "
+      "{\"name\" : \"lat\", \"total_count\" : 2, \"total_sum\" : 20, "
+      "\"values\" : [10], \"counts\" : [2]}]}, "
+      "{\"type\" : \"tablet\", \"id\" : \"b\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 5}]}, "
+      "{\"type\" : \"server\", \"id\" : \"s\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 1000}]}]"));
+  ASSERT_OK(lp.ParseLine(
+      "I0220 17:38:01.000000 metrics 2000000 ["
+      "{\"type\" : \"tablet\", \"id\" : \"a\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 20}, "
+      "{\"name\" : \"lat\", \"total_count\" : 4, \"total_sum\" : 220, "
+      "\"values\" : [10, 100], \"counts\" : [2, 2]}]}]"));
+  ASSERT_OK(lp.ParseLine(
+      "I0220 17:38:03.000000 metrics 4000000 ["
+      "{\"type\" : \"tablet\", \"id\" : \"a\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 20}, "
+      "{\"name\" : \"lat\", \"total_count\" : 14, \"total_sum\" : 320, "
+      "\"values\" : [10, 100], \"counts\" : [12, 2]}]}, "
+      "{\"type\" : \"tablet\", \"id\" : \"b\", \"metrics\" : ["
+      "{\"name\" : \"rows\", \"value\" : 95}]}]"));
+
+  std::ostringstream out;
+  lv.DumpTimeSeries(&out);
+  ASSERT_EQ(
+      "time_us,metric,value,rate_per_sec,mean,p50,p99,max\n"
+      "1000000,tablet.rows,15,,,,,\n"
+      "2000000,tablet.rows,25,10,,,,\n"
+      "4000000,tablet.rows,115,45,,,,\n"
+      "1000000,tablet.lat,2,,10,10,10,10\n"
+      "2000000,tablet.lat,2,2,100,100,100,100\n"
+      "4000000,tablet.lat,10,5,10,10,10,10\n",
+      out.str());
+
+  // Between the first and second records, and the second and third.
+  out.str("");
+  lv.DumpWindowDiff(1000000, 2000000, 2000000, 4000000, 3, &out);
+  ASSERT_EQ(
+      "metric,stat,window_a,window_b,change_pct\n"
+      "tablet.rows,rate,10,45,350\n"
+      "tablet.lat,rate,2,5,150\n"
+      "tablet.lat,mean,100,10,-90\n",
+      out.str());
+}
+
 } // namespace tools
 } // namespace kudu
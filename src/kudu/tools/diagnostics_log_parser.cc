@@ -17,12 +17,18 @@
 
 #include "kudu/tools/diagnostics_log_parser.h"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 #include <glog/logging.h>
@@ -35,6 +41,7 @@
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
 #include "kudu/util/jsonreader.h"
 #include "kudu/util/status.h"
 
@@ -42,6 +49,7 @@ using std::array;
 using std::cout;
 using std::endl;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -55,6 +63,12 @@ const char* RecordTypeToString(RecordType r) {
     case RecordType::kSymbols:
       return "symbols";
       break;
+    case RecordType::kProfile:
+      return "profile";
+      break;
+    case RecordType::kMetrics:
+      return "metrics";
+      break;
     case RecordType::kUnknown:
       return "<unknown>";
       break;
@@ -93,6 +107,309 @@ void StackDumpingLogVisitor::VisitStacksRecord(const StacksRecord& sr) {
   }
 }
 
+void FoldedStacksLogVisitor::VisitSymbol(
+    const string& addr,
+    const string& symbol) {
+  InsertIfNotPresent(&symbols_, addr, symbol);
+}
+
+void FoldedStacksLogVisitor::VisitProfileRecord(const ProfileRecord& pr) {
+  for (const auto& stack : pr.stacks) {
+    string folded;
+    for (auto addr = stack.frame_addrs.rbegin();
+         addr != stack.frame_addrs.rend();
+         ++addr) {
+      if (!folded.empty()) {
+        folded.push_back(';');
+      }
+      // Frames without a symbol keep their address, so that they still
+      // differ from each other. ';' and ' ' would break the format.
+      string sym = FindWithDefault(symbols_, *addr, *addr);
+      std::replace(sym.begin(), sym.end(), ';', ':');
+      std::replace(sym.begin(), sym.end(), ' ', '_');
+      folded.append(sym);
+    }
+    folded_stacks_[folded] += stack.count;
+  }
+}
+
+void FoldedStacksLogVisitor::DumpFoldedStacks(std::ostream* out) const {
+  for (const auto& e : folded_stacks_) {
+    *out << e.first << " " << e.second << "\n";
+  }
+}
+
+namespace {
+
+typedef MetricsRecord::Histogram Histogram;
+
+// The values 'later' recorded since 'earlier', or all of 'later' if the
+// histogram was reset in between.
+Histogram Subtract(const Histogram& later, const Histogram& earlier) {
+  if (later.total_count < earlier.total_count) {
+    return later;
+  }
+  Histogram diff;
+  diff.total_count = later.total_count - earlier.total_count;
+  diff.total_sum = later.total_sum - earlier.total_sum;
+  for (const auto& bucket : later.buckets) {
+    const int64_t count =
+        bucket.second - FindWithDefault(earlier.buckets, bucket.first, 0);
+    if (count < 0) {
+      return later;
+    }
+    if (count > 0) {
+      diff.buckets.emplace(bucket.first, count);
+    }
+  }
+  return diff;
+}
+
+// The value of the bucket at or below which 'percentile' percent of the
+// values in 'hist' are. 'hist' must have buckets.
+int64_t ValueAtPercentile(const Histogram& hist, double percentile) {
+  DCHECK(!hist.buckets.empty());
+  int64_t total = 0;
+  for (const auto& bucket : hist.buckets) {
+    total += bucket.second;
+  }
+  const double target = total * percentile / 100;
+  int64_t seen = 0;
+  for (const auto& bucket : hist.buckets) {
+    seen += bucket.second;
+    if (seen >= target) {
+      return bucket.first;
+    }
+  }
+  return hist.buckets.rbegin()->first;
+}
+
+double Mean(const Histogram& hist) {
+  return hist.total_count > 0
+      ? static_cast<double>(hist.total_sum) / hist.total_count
+      : 0;
+}
+
+// The latest of 'points' at or before 'time_us', or else the earliest, or
+// null if there are none.
+template <class T>
+const std::pair<int64_t, T>* PointAt(
+    const vector<std::pair<int64_t, T>>& points,
+    int64_t time_us) {
+  if (points.empty()) {
+    return nullptr;
+  }
+  auto it = std::upper_bound(
+      points.begin(),
+      points.end(),
+      time_us,
+      [](int64_t t, const std::pair<int64_t, T>& p) { return t < p.first; });
+  return it == points.begin() ? &*it : &*std::prev(it);
+}
+
+// Sets 'start' and 'end' to the points of 'points' at the start and end of
+// a window. Returns false if they aren't two distinct points.
+template <class T>
+bool WindowPoints(
+    const vector<std::pair<int64_t, T>>& points,
+    int64_t start_us,
+    int64_t end_us,
+    const std::pair<int64_t, T>** start,
+    const std::pair<int64_t, T>** end) {
+  *start = PointAt(points, start_us);
+  *end = PointAt(points, end_us);
+  return *start && *end && (*end)->first > (*start)->first;
+}
+
+// A statistic of a metric in each window of DumpWindowDiff().
+struct WindowStat {
+  string metric;
+  string stat;
+  double a;
+  double b;
+
+  // How much the statistic changed, relative to window a.
+  double RelativeChange() const {
+    if (a == 0) {
+      return b == 0 ? 0 : std::numeric_limits<double>::infinity();
+    }
+    return std::abs(b - a) / std::abs(a);
+  }
+};
+
+} // anonymous namespace
+
+MetricsCollectingLogVisitor::MetricsCollectingLogVisitor(
+    vector<string> patterns)
+    : patterns_(std::move(patterns)) {}
+
+bool MetricsCollectingLogVisitor::Matches(const string& name) {
+  if (patterns_.empty()) {
+    return true;
+  }
+  auto it = matches_.find(name);
+  if (it == matches_.end()) {
+    const bool match = std::any_of(
+        patterns_.begin(), patterns_.end(), [&](const string& pattern) {
+          return MatchPattern(name, pattern);
+        });
+    it = matches_.emplace(name, match).first;
+  }
+  return it->second;
+}
+
+void MetricsCollectingLogVisitor::VisitMetricsRecord(const MetricsRecord& mr) {
+  std::set<string> changed_values;
+  std::set<string> changed_histograms;
+  for (const auto& entity : mr.entities) {
+    for (const auto& value : entity.values) {
+      string name = Substitute("$0.$1", entity.type, value.first);
+      if (Matches(name)) {
+        latest_values_[name][entity.id] = value.second;
+        changed_values.emplace(std::move(name));
+      }
+    }
+    for (const auto& hist : entity.histograms) {
+      string name = Substitute("$0.$1", entity.type, hist.first);
+      if (Matches(name)) {
+        latest_histograms_[name][entity.id] = hist.second;
+        changed_histograms.emplace(std::move(name));
+      }
+    }
+  }
+
+  // Entities not in this record keep their latest values.
+  for (const string& name : changed_values) {
+    double sum = 0;
+    for (const auto& e : latest_values_[name]) {
+      sum += e.second;
+    }
+    values_[name].emplace_back(mr.time_us, sum);
+  }
+  for (const string& name : changed_histograms) {
+    Histogram sum;
+    for (const auto& e : latest_histograms_[name]) {
+      sum.total_count += e.second.total_count;
+      sum.total_sum += e.second.total_sum;
+      for (const auto& bucket : e.second.buckets) {
+        sum.buckets[bucket.first] += bucket.second;
+      }
+    }
+    histograms_[name].emplace_back(mr.time_us, std::move(sum));
+  }
+}
+
+void MetricsCollectingLogVisitor::DumpTimeSeries(std::ostream* out) const {
+  *out << "time_us,metric,value,rate_per_sec,mean,p50,p99,max\n";
+  for (const auto& metric : values_) {
+    const auto& points = metric.second;
+    for (int i = 0; i < points.size(); i++) {
+      *out << points[i].first << "," << metric.first << ","
+           << points[i].second << ",";
+      if (i > 0) {
+        const double secs = (points[i].first - points[i - 1].first) / 1e6;
+        *out << (points[i].second - points[i - 1].second) / secs;
+      }
+      *out << ",,,,\n";
+    }
+  }
+  for (const auto& metric : histograms_) {
+    const auto& points = metric.second;
+    for (int i = 0; i < points.size(); i++) {
+      const Histogram diff = i > 0
+          ? Subtract(points[i].second, points[i - 1].second)
+          : points[i].second;
+      *out << points[i].first << "," << metric.first << ","
+           << diff.total_count << ",";
+      if (i > 0) {
+        const double secs = (points[i].first - points[i - 1].first) / 1e6;
+        *out << diff.total_count / secs;
+      }
+      *out << "," << Mean(diff) << ",";
+      if (!diff.buckets.empty()) {
+        *out << ValueAtPercentile(diff, 50) << ","
+             << ValueAtPercentile(diff, 99) << ","
+             << diff.buckets.rbegin()->first;
+      } else {
+        *out << ",,";
+      }
+      *out << "\n";
+    }
+  }
+}
+
+void MetricsCollectingLogVisitor::DumpWindowDiff(
+    int64_t a_start_us,
+    int64_t a_end_us,
+    int64_t b_start_us,
+    int64_t b_end_us,
+    int top_n,
+    std::ostream* out) const {
+  vector<WindowStat> stats;
+  for (const auto& metric : values_) {
+    const std::pair<int64_t, double>* a_start;
+    const std::pair<int64_t, double>* a_end;
+    const std::pair<int64_t, double>* b_start;
+    const std::pair<int64_t, double>* b_end;
+    if (!WindowPoints(metric.second, a_start_us, a_end_us, &a_start, &a_end) ||
+        !WindowPoints(metric.second, b_start_us, b_end_us, &b_start, &b_end)) {
+      continue;
+    }
+    stats.push_back(
+        {metric.first,
+         "rate",
+         (a_end->second - a_start->second) /
+             ((a_end->first - a_start->first) / 1e6),
+         (b_end->second - b_start->second) /
+             ((b_end->first - b_start->first) / 1e6)});
+  }
+  for (const auto& metric : histograms_) {
+    const std::pair<int64_t, Histogram>* a_start;
+    const std::pair<int64_t, Histogram>* a_end;
+    const std::pair<int64_t, Histogram>* b_start;
+    const std::pair<int64_t, Histogram>* b_end;
+    if (!WindowPoints(metric.second, a_start_us, a_end_us, &a_start, &a_end) ||
+        !WindowPoints(metric.second, b_start_us, b_end_us, &b_start, &b_end)) {
+      continue;
+    }
+    const Histogram a = Subtract(a_end->second, a_start->second);
+    const Histogram b = Subtract(b_end->second, b_start->second);
+    stats.push_back(
+        {metric.first,
+         "rate",
+         a.total_count / ((a_end->first - a_start->first) / 1e6),
+         b.total_count / ((b_end->first - b_start->first) / 1e6)});
+    stats.push_back({metric.first, "mean", Mean(a), Mean(b)});
+    if (!a.buckets.empty() && !b.buckets.empty()) {
+      stats.push_back(
+          {metric.first,
+           "p99",
+           static_cast<double>(ValueAtPercentile(a, 99)),
+           static_cast<double>(ValueAtPercentile(b, 99))});
+    }
+  }
+
+  std::stable_sort(
+      stats.begin(), stats.end(), [](const WindowStat& x, const WindowStat& y) {
+        return x.RelativeChange() > y.RelativeChange();
+      });
+  *out << "metric,stat,window_a,window_b,change_pct\n";
+  for (int i = 0; i < stats.size() && i < top_n; i++) {
+    const WindowStat& stat = stats[i];
+    if (stat.RelativeChange() == 0) {
+      break;
+    }
+    *out << stat.metric << "," << stat.stat << "," << stat.a << "," << stat.b
+         << ",";
+    if (stat.a == 0) {
+      *out << "inf";
+    } else {
+      *out << (stat.b - stat.a) / std::abs(stat.a) * 100;
+    }
+    *out << "\n";
+  }
+}
+
 Status ParsedLine::Parse(string line) {
   // Take ownership of the line to avoid copying substrings.
   line_ = std::move(line);
@@ -108,8 +425,6 @@ Status ParsedLine::Parse(string line) {
   array<StringPiece, 5> fields =
       strings::Split(line_, strings::delimiter::Limit(" ", 4));
   fields[0].remove_prefix(1); // Remove the 'I'.
-  // Sanity check the microsecond timestamp.
-  // Eventually, it should be used when processing metrics records.
   int64_t time_us;
   if (!safe_strto64(fields[3].data(), fields[3].size(), &time_us)) {
     return Status::InvalidArgument("invalid timestamp", fields[3]);
@@ -124,10 +439,15 @@ Status ParsedLine::Parse(string line) {
   }
   date_ = fields[0];
   time_ = fields[1];
+  time_us_ = time_us;
   if (fields[2] == "symbols") {
     type_ = RecordType::kSymbols;
   } else if (fields[2] == "stacks") {
     type_ = RecordType::kStacks;
+  } else if (fields[2] == "profile") {
+    type_ = RecordType::kProfile;
+  } else if (fields[2] == "metrics") {
+    type_ = RecordType::kMetrics;
   } else {
     type_ = RecordType::kUnknown;
   }
@@ -151,6 +471,12 @@ Status LogParser::ParseLine(string line) {
       RETURN_NOT_OK(ParseStacks(pl));
       break;
     }
+    case RecordType::kProfile:
+      RETURN_NOT_OK(ParseProfile(pl));
+      break;
+    case RecordType::kMetrics:
+      RETURN_NOT_OK(ParseMetrics(pl));
+      break;
     default:
       break;
   }
@@ -249,5 +575,144 @@ Status LogParser::ParseStacks(const ParsedLine& pl) {
   return Status::OK();
 }
 
+Status LogParser::ParseProfile(const ParsedLine& pl) {
+  ProfileRecord pr;
+  pr.date_time = pl.date_time();
+
+  const rapidjson::Value& json = *pl.json();
+  if (!json.IsObject()) {
+    return Status::InvalidArgument("expected profile data to be a JSON object");
+  }
+  if (PREDICT_FALSE(!json.HasMember("samples") || !json.HasMember("stacks"))) {
+    return Status::InvalidArgument(
+        "expected profile to have samples and stacks");
+  }
+  if (PREDICT_FALSE(!json["samples"].IsInt64())) {
+    return Status::InvalidArgument("expected 'samples' to be an integer");
+  }
+  pr.num_samples = json["samples"].GetInt64();
+
+  const auto& stacks = json["stacks"];
+  if (PREDICT_FALSE(!stacks.IsArray())) {
+    return Status::InvalidArgument("expected 'stacks' to be an array");
+  }
+  for (const auto* stack = stacks.Begin(); stack != stacks.End(); ++stack) {
+    if (PREDICT_FALSE(
+            !stack->IsObject() || !stack->HasMember("count") ||
+            !stack->HasMember("stack"))) {
+      return Status::InvalidArgument(
+          "expected profile stacks to be objects with count and stack");
+    }
+    ProfileRecord::Stack s;
+    if (PREDICT_FALSE(!(*stack)["count"].IsInt64())) {
+      return Status::InvalidArgument("expected 'count' to be an integer");
+    }
+    s.count = (*stack)["count"].GetInt64();
+    const auto& frames = (*stack)["stack"];
+    if (PREDICT_FALSE(!frames.IsArray())) {
+      return Status::InvalidArgument("expected 'stack' to be an array");
+    }
+    for (const auto* frame = frames.Begin(); frame != frames.End(); ++frame) {
+      if (PREDICT_FALSE(!frame->IsString())) {
+        return Status::InvalidArgument(
+            "expected 'stack' elements to be strings");
+      }
+      s.frame_addrs.emplace_back(frame->GetString());
+    }
+    pr.stacks.emplace_back(std::move(s));
+  }
+  visitor_->VisitProfileRecord(pr);
+  return Status::OK();
+}
+
+
+namespace {
+
+Status ParseHistogram(const rapidjson::Value& json, Histogram* hist) {
+  if (PREDICT_FALSE(!json["total_count"].IsInt64())) {
+    return Status::InvalidArgument("expected 'total_count' to be an integer");
+  }
+  hist->total_count = json["total_count"].GetInt64();
+  if (json.HasMember("total_sum")) {
+    if (PREDICT_FALSE(!json["total_sum"].IsInt64())) {
+      return Status::InvalidArgument("expected 'total_sum' to be an integer");
+    }
+    hist->total_sum = json["total_sum"].GetInt64();
+  }
+  if (!json.HasMember("values") && !json.HasMember("counts")) {
+    return Status::OK();
+  }
+  if (PREDICT_FALSE(
+          !json.HasMember("values") || !json.HasMember("counts") ||
+          !json["values"].IsArray() || !json["counts"].IsArray() ||
+          json["values"].Size() != json["counts"].Size())) {
+    return Status::InvalidArgument(
+        "expected 'values' and 'counts' to be arrays of the same size");
+  }
+  const auto& values = json["values"];
+  const auto& counts = json["counts"];
+  for (int i = 0; i < values.Size(); i++) {
+    if (PREDICT_FALSE(!values[i].IsInt64() || !counts[i].IsInt64())) {
+      return Status::InvalidArgument(
+          "expected 'values' and 'counts' elements to be integers");
+    }
+    hist->buckets[values[i].GetInt64()] += counts[i].GetInt64();
+  }
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+Status LogParser::ParseMetrics(const ParsedLine& pl) {
+  MetricsRecord mr;
+  mr.time_us = pl.time_us();
+
+  const rapidjson::Value& json = *pl.json();
+  if (!json.IsArray()) {
+    return Status::InvalidArgument("expected metrics data to be a JSON array");
+  }
+  for (const auto* entity = json.Begin(); entity != json.End(); ++entity) {
+    if (PREDICT_FALSE(
+            !entity->IsObject() || !entity->HasMember("type") ||
+            !entity->HasMember("id") || !entity->HasMember("metrics"))) {
+      return Status::InvalidArgument(
+          "expected metrics entities to be objects with type, id and metrics");
+    }
+    if (PREDICT_FALSE(
+            !(*entity)["type"].IsString() || !(*entity)["id"].IsString())) {
+      return Status::InvalidArgument(
+          "expected entity 'type' and 'id' to be strings");
+    }
+    const auto& metrics = (*entity)["metrics"];
+    if (PREDICT_FALSE(!metrics.IsArray())) {
+      return Status::InvalidArgument("expected 'metrics' to be an array");
+    }
+    MetricsRecord::Entity e;
+    e.type = (*entity)["type"].GetString();
+    e.id = (*entity)["id"].GetString();
+    for (const auto* metric = metrics.Begin(); metric != metrics.End();
+         ++metric) {
+      if (PREDICT_FALSE(
+              !metric->IsObject() || !metric->HasMember("name") ||
+              !(*metric)["name"].IsString())) {
+        return Status::InvalidArgument(
+            "expected metrics to be objects with a name");
+      }
+      const string name = (*metric)["name"].GetString();
+      if (metric->HasMember("total_count")) {
+        RETURN_NOT_OK_PREPEND(
+            ParseHistogram(*metric, &e.histograms[name]),
+            Substitute("invalid histogram $0", name));
+      } else if (metric->HasMember("value") && (*metric)["value"].IsNumber()) {
+        e.values[name] = (*metric)["value"].GetDouble();
+      }
+      // Other metrics, e.g. string gauges, aren't collected.
+    }
+    mr.entities.emplace_back(std::move(e));
+  }
+  visitor_->VisitMetricsRecord(mr);
+  return Status::OK();
+}
+
 } // namespace tools
 } // namespace kudu
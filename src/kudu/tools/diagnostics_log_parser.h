@@ -17,9 +17,12 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
+#include <map>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -34,8 +37,7 @@ namespace kudu {
 namespace tools {
 
 // One of the record types from the log.
-// TODO(KUDU-2353) support metrics records.
-enum class RecordType { kSymbols, kStacks, kUnknown };
+enum class RecordType { kSymbols, kStacks, kProfile, kMetrics, kUnknown };
 
 const char* RecordTypeToString(RecordType r);
 
@@ -61,6 +63,53 @@ struct StacksRecord {
   std::vector<Group> groups;
 };
 
+// A wall-clock profile from the log: the number of times each distinct stack
+// was seen while sampling the stacks of all threads.
+struct ProfileRecord {
+  struct Stack {
+    // The number of samples of a thread with this stack.
+    int64_t count;
+    // The non-symbolized addresses forming the stack trace, innermost first.
+    std::vector<std::string> frame_addrs;
+  };
+
+  // The time the profile was written.
+  std::string date_time;
+
+  // The number of times the stacks of all threads were sampled.
+  int64_t num_samples = 0;
+
+  std::vector<Stack> stacks;
+};
+
+// A metrics record from the log: the metrics of each entity as they were
+// when the record was written. Counters and histograms count from when the
+// server started, unless --diag_thread_stats reset the histograms after the
+// previous record.
+struct MetricsRecord {
+  struct Histogram {
+    int64_t total_count = 0;
+    int64_t total_sum = 0;
+    // The number of values recorded in each bucket, by the bucket's value.
+    // Only logged with --diagnostics_log_raw_histograms.
+    std::map<int64_t, int64_t> buckets;
+  };
+
+  struct Entity {
+    std::string type;
+    std::string id;
+    // The counters and gauges with a numeric value, by name.
+    std::unordered_map<std::string, double> values;
+    // The histograms, by name.
+    std::unordered_map<std::string, Histogram> histograms;
+  };
+
+  // The time the record was written, in microseconds since the epoch.
+  int64_t time_us = 0;
+
+  std::vector<Entity> entities;
+};
+
 // Interface for consuming the parsed records from a diagnostics log.
 class LogVisitor {
  public:
@@ -69,6 +118,8 @@ class LogVisitor {
       const std::string& addr,
       const std::string& symbol) = 0;
   virtual void VisitStacksRecord(const StacksRecord& sr) = 0;
+  virtual void VisitProfileRecord(const ProfileRecord& /*pr*/) {}
+  virtual void VisitMetricsRecord(const MetricsRecord& /*mr*/) {}
 };
 
 // LogVisitor implementation which dumps the parsed stack records to cout.
@@ -87,6 +138,89 @@ class StackDumpingLogVisitor : public LogVisitor {
   const std::string kUnknownSymbol = "<unknown>";
 };
 
+// LogVisitor implementation which sums up the parsed profiles as folded
+// stacks: one line per distinct stack, with the symbols of its frames from
+// the outermost in, separated by ';', then a space and the number of
+// samples. This is the input format of flame graph tools such as
+// flamegraph.pl.
+class FoldedStacksLogVisitor : public LogVisitor {
+ public:
+  void VisitSymbol(const std::string& addr, const std::string& symbol) override;
+
+  void VisitStacksRecord(const StacksRecord& /*sr*/) override {}
+
+  void VisitProfileRecord(const ProfileRecord& pr) override;
+
+  // Writes the folded stacks of all the profiles visited so far to 'out'.
+  void DumpFoldedStacks(std::ostream* out) const;
+
+ private:
+  // Map from symbols to name.
+  std::unordered_map<std::string, std::string> symbols_;
+  // Map from folded stack to number of samples; ordered so that the output
+  // is stable.
+  std::map<std::string, int64_t> folded_stacks_;
+};
+
+// LogVisitor implementation which turns the metrics records into a time
+// series per metric, summed over the entities of each type and named
+// "<entity type>.<metric name>", e.g. "tablet.rows_inserted". The records
+// must be visited in the order they were written.
+class MetricsCollectingLogVisitor : public LogVisitor {
+ public:
+  // Only collects the metrics whose names match one of the glob patterns in
+  // 'patterns', or all of them if it's empty.
+  explicit MetricsCollectingLogVisitor(std::vector<std::string> patterns);
+
+  void VisitSymbol(
+      const std::string& /*addr*/,
+      const std::string& /*symbol*/) override {}
+
+  void VisitStacksRecord(const StacksRecord& /*sr*/) override {}
+
+  void VisitMetricsRecord(const MetricsRecord& mr) override;
+
+  // Writes, as CSV, a line per metric per record it was in: the time, the
+  // metric, its value and its change per second since the previous record.
+  // For histograms, the value is the number of values recorded since the
+  // previous record, followed by their mean and, if the log has raw
+  // histograms, their 50th and 99th percentiles and max.
+  void DumpTimeSeries(std::ostream* out) const;
+
+  // Writes, as CSV, the 'top_n' statistics which changed the most,
+  // relatively, between the window [a_start_us, a_end_us] and the window
+  // [b_start_us, b_end_us]: the rate of each metric, and the mean and 99th
+  // percentile of the values each histogram recorded in the window.
+  void DumpWindowDiff(
+      int64_t a_start_us,
+      int64_t a_end_us,
+      int64_t b_start_us,
+      int64_t b_end_us,
+      int top_n,
+      std::ostream* out) const;
+
+ private:
+  typedef MetricsRecord::Histogram Histogram;
+
+  // Whether 'name' matches 'patterns_'.
+  bool Matches(const std::string& name);
+
+  const std::vector<std::string> patterns_;
+  std::unordered_map<std::string, bool> matches_;
+
+  // The latest value of each metric, by name and then by entity id.
+  std::unordered_map<std::string, std::unordered_map<std::string, double>>
+      latest_values_;
+  std::unordered_map<std::string, std::unordered_map<std::string, Histogram>>
+      latest_histograms_;
+
+  // The sum of each metric over its entities, with the time, after each
+  // record it was in. Ordered so that the output is stable.
+  std::map<std::string, std::vector<std::pair<int64_t, double>>> values_;
+  std::map<std::string, std::vector<std::pair<int64_t, Histogram>>>
+      histograms_;
+};
+
 // A parsed line from the diagnostics log.
 //
 // Each line contains a timestamp, a record type, and some JSON data.
@@ -106,9 +240,15 @@ class ParsedLine {
 
   std::string date_time() const;
 
+  // The time the line was written, in microseconds since the epoch.
+  int64_t time_us() const {
+    return time_us_;
+  }
+
  private:
   std::string line_;
   RecordType type_;
+  int64_t time_us_;
 
   // date_ and time_ point to substrings of line_.
   StringPiece date_;
@@ -142,6 +282,10 @@ class LogParser {
 
   Status ParseStacks(const ParsedLine& lf);
 
+  Status ParseProfile(const ParsedLine& pl);
+
+  Status ParseMetrics(const ParsedLine& pl);
+
   LogVisitor* visitor_;
 };
 
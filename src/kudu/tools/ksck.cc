@@ -164,57 +164,72 @@ Ksck::Ksck(shared_ptr<KsckCluster> cluster, ostream* out)
     : cluster_(std::move(cluster)), out_(out == nullptr ? &std::cout : out) {}
 
 Status Ksck::CheckMasterHealth() {
-  int bad_masters = 0;
-  int unauthorized_masters = 0;
-  vector<KsckServerHealthSummary> master_summaries;
-  // There shouldn't be more than 5 masters, so we'll keep it simple and gather
-  // info in sequence instead of spreading it across a threadpool.
-  for (const auto& master : cluster_->masters()) {
-    KsckServerHealthSummary sh;
-    Status s = master->FetchInfo().AndThen(
-        [&]() { return master->FetchConsensusState(); });
-    sh.uuid = master->uuid();
-    sh.address = master->address();
-    sh.version = master->version();
-    sh.status = s;
-    if (!s.ok()) {
-      if (IsNotAuthorizedMethodAccess(s)) {
-        sh.health = KsckServerHealth::UNAUTHORIZED;
-        unauthorized_masters++;
-      } else {
-        sh.health = KsckServerHealth::UNAVAILABLE;
+  const auto& masters = cluster_->masters();
+  const int num_masters = masters.size();
+  // Masters are few, but one that doesn't answer costs a whole RPC timeout,
+  // so don't make the others wait behind it.
+  std::unique_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("ksck-fetch-masters")
+                    .set_max_threads(std::max(num_masters, 1))
+                    .Build(&pool));
+
+  AtomicInt<int32_t> bad_masters(0);
+  AtomicInt<int32_t> unauthorized_masters(0);
+  // Indexed like 'masters', so that the summaries keep their order.
+  vector<KsckServerHealthSummary> master_summaries(masters.size());
+  vector<Status> flag_statuses(masters.size());
+  for (int i = 0; i < num_masters; i++) {
+    CHECK_OK(pool->SubmitFunc([&, i]() {
+      const auto& master = masters[i];
+      KsckServerHealthSummary& sh = master_summaries[i];
+      Status s = master->FetchInfo().AndThen(
+          [&]() { return master->FetchConsensusState(); });
+      sh.uuid = master->uuid();
+      sh.address = master->address();
+      sh.version = master->version();
+      sh.status = s;
+      if (!s.ok()) {
+        if (IsNotAuthorizedMethodAccess(s)) {
+          sh.health = KsckServerHealth::UNAUTHORIZED;
+          unauthorized_masters.Increment();
+        } else {
+          sh.health = KsckServerHealth::UNAVAILABLE;
+        }
+        bad_masters.Increment();
       }
-      bad_masters++;
-    }
-    master_summaries.push_back(std::move(sh));
 
-    // Fetch the flags information.
-    // Failing to gather flags is only a warning.
-    s = master->FetchUnusualFlags();
+      // Fetch the flags information.
+      // Failing to gather flags is only a warning.
+      s = master->FetchUnusualFlags();
+      if (!s.ok()) {
+        flag_statuses[i] = s.CloneAndPrepend(Substitute(
+            "unable to get flag information for master $0 ($1)",
+            master->uuid(),
+            master->address()));
+      }
+    }));
+  }
+  pool->Wait();
+  for (auto& s : flag_statuses) {
     if (!s.ok()) {
-      results_.warning_messages.push_back(s.CloneAndPrepend(Substitute(
-          "unable to get flag information for master $0 ($1)",
-          master->uuid(),
-          master->address())));
+      results_.warning_messages.push_back(std::move(s));
     }
   }
   results_.master_summaries.swap(master_summaries);
 
-  int num_masters = cluster_->masters().size();
-
   // Return a NotAuthorized status if any master has auth errors, since this
   // indicates ksck may not be able to gather full and accurate info.
-  if (unauthorized_masters > 0) {
+  if (unauthorized_masters.Load() > 0) {
     return Status::NotAuthorized(Substitute(
         "failed to gather info from $0 of $1 "
         "masters due to lack of admin privileges",
-        unauthorized_masters,
+        unauthorized_masters.Load(),
         num_masters));
   }
-  if (bad_masters > 0) {
+  if (bad_masters.Load() > 0) {
     return Status::NetworkError(Substitute(
         "failed to gather info from all masters: $0 of $1 had errors",
-        bad_masters,
+        bad_masters.Load(),
         num_masters));
   }
   return Status::OK();
@@ -335,6 +350,10 @@ Status Ksck::FetchInfoFromTabletServers() {
   VLOG(1) << "Fetching info from all " << servers_count << " tablet servers";
 
   vector<KsckServerHealthSummary> tablet_server_summaries;
+  // Warnings about the flags of the servers, collected apart from
+  // 'results_' since the fetches run concurrently.
+  vector<Status> flag_warnings;
+  // Protects 'tablet_server_summaries' and 'flag_warnings'.
   simple_spinlock tablet_server_summaries_lock;
 
   for (const auto& entry : cluster_->tablet_servers()) {
@@ -371,7 +390,8 @@ Status Ksck::FetchInfoFromTabletServers() {
       // Failing to gather flags is only a warning.
       s = ts->FetchUnusualFlags();
       if (!s.ok()) {
-        results_.warning_messages.push_back(s.CloneAndPrepend(Substitute(
+        std::lock_guard<simple_spinlock> lock(tablet_server_summaries_lock);
+        flag_warnings.push_back(s.CloneAndPrepend(Substitute(
             "unable to get flag information for tablet server $0 ($1)",
             ts->uuid(),
             ts->address())));
@@ -379,6 +399,10 @@ Status Ksck::FetchInfoFromTabletServers() {
     }));
   }
   pool->Wait();
+  std::move(
+      flag_warnings.begin(),
+      flag_warnings.end(),
+      std::back_inserter(results_.warning_messages));
 
   results_.tserver_summaries.swap(tablet_server_summaries);
 
@@ -68,6 +68,13 @@ DEFINE_bool(
     checksum_cache_blocks,
     false,
     "Should the checksum scanners cache the read blocks");
+DEFINE_int64(
+    ksck_server_timeout_ms,
+    0,
+    "Timeout in milliseconds of each RPC which fetches status, consensus "
+    "state or flags from a master or tablet server. If 0, --timeout_ms is "
+    "used. A lower value keeps unresponsive servers from holding up checks "
+    "of the rest of the cluster.");
 
 namespace kudu {
 namespace tools {
@@ -95,13 +102,20 @@ MonoDelta GetDefaultTimeout() {
   return MonoDelta::FromMilliseconds(FLAGS_timeout_ms);
 }
 
+MonoDelta GetServerFetchTimeout() {
+  if (FLAGS_ksck_server_timeout_ms > 0) {
+    return MonoDelta::FromMilliseconds(FLAGS_ksck_server_timeout_ms);
+  }
+  return GetDefaultTimeout();
+}
+
 // Common flag-fetching routine for masters and tablet servers.
 Status FetchUnusualFlagsCommon(
     const shared_ptr<server::GenericServiceProxy>& proxy,
     server::GetFlagsResponsePB* resp) {
   server::GetFlagsRequestPB req;
   RpcController rpc;
-  rpc.set_timeout(GetDefaultTimeout());
+  rpc.set_timeout(GetServerFetchTimeout());
   for (const string& tag : {"experimental", "hidden", "unsafe"}) {
     req.add_tags(tag);
   }
@@ -128,7 +142,7 @@ Status RemoteKsckMaster::FetchInfo() {
   server::GetStatusRequestPB req;
   server::GetStatusResponsePB resp;
   RpcController rpc;
-  rpc.set_timeout(GetDefaultTimeout());
+  rpc.set_timeout(GetServerFetchTimeout());
   RETURN_NOT_OK(generic_proxy_->GetStatus(req, &resp, &rpc));
   uuid_ = resp.status().node_instance().permanent_uuid();
   version_ = resp.status().version_info().version_string();
@@ -141,7 +155,7 @@ Status RemoteKsckMaster::FetchConsensusState() {
   consensus::GetConsensusStateRequestPB req;
   consensus::GetConsensusStateResponsePB resp;
   RpcController rpc;
-  rpc.set_timeout(GetDefaultTimeout());
+  rpc.set_timeout(GetServerFetchTimeout());
   req.set_dest_uuid(uuid_);
   RETURN_NOT_OK_PREPEND(
       consensus_proxy_->GetConsensusState(req, &resp, &rpc),
@@ -195,7 +209,7 @@ Status RemoteKsckTabletServer::FetchInfo(KsckServerHealth* health) {
     server::GetStatusRequestPB req;
     server::GetStatusResponsePB resp;
     RpcController rpc;
-    rpc.set_timeout(GetDefaultTimeout());
+    rpc.set_timeout(GetServerFetchTimeout());
     RETURN_NOT_OK_PREPEND(
         generic_proxy_->GetStatus(req, &resp, &rpc),
         "could not get status from server");
@@ -215,7 +229,7 @@ Status RemoteKsckTabletServer::FetchInfo(KsckServerHealth* health) {
     tserver::ListTabletsRequestPB req;
     tserver::ListTabletsResponsePB resp;
     RpcController rpc;
-    rpc.set_timeout(GetDefaultTimeout());
+    rpc.set_timeout(GetServerFetchTimeout());
     req.set_need_schema_info(false);
     RETURN_NOT_OK_PREPEND(
         ts_proxy_->ListTablets(req, &resp, &rpc), "could not list tablets");
@@ -249,7 +263,7 @@ void RemoteKsckTabletServer::ServerClockResponseCallback::Run() {
 void RemoteKsckTabletServer::FetchCurrentTimestampAsync() {
   // 'cb' deletes itself when complete.
   auto* cb = new ServerClockResponseCallback(shared_from_this());
-  cb->rpc.set_timeout(GetDefaultTimeout());
+  cb->rpc.set_timeout(GetServerFetchTimeout());
   generic_proxy_->ServerClockAsync(
       cb->req,
       &cb->resp,
@@ -261,7 +275,7 @@ Status RemoteKsckTabletServer::FetchCurrentTimestamp() {
   server::ServerClockRequestPB req;
   server::ServerClockResponsePB resp;
   RpcController rpc;
-  rpc.set_timeout(GetDefaultTimeout());
+  rpc.set_timeout(GetServerFetchTimeout());
   RETURN_NOT_OK(generic_proxy_->ServerClock(req, &resp, &rpc));
   timestamp_ = resp.timestamp();
   return Status::OK();
@@ -274,7 +288,7 @@ Status RemoteKsckTabletServer::FetchConsensusState(KsckServerHealth* health) {
   consensus::GetConsensusStateRequestPB req;
   consensus::GetConsensusStateResponsePB resp;
   RpcController rpc;
-  rpc.set_timeout(GetDefaultTimeout());
+  rpc.set_timeout(GetServerFetchTimeout());
   req.set_dest_uuid(uuid_);
   RETURN_NOT_OK_PREPEND(
       consensus_proxy_->GetConsensusState(req, &resp, &rpc),
@@ -81,14 +81,16 @@ Rebalancer::Config::Config(
     size_t max_staleness_interval_sec,
     int64_t max_run_time_sec,
     bool move_rf1_replicas,
-    bool output_replica_distribution_details)
+    bool output_replica_distribution_details,
+    bool replan_while_moving)
     : master_addresses(std::move(master_addresses)),
       table_filters(std::move(table_filters)),
       max_moves_per_server(max_moves_per_server),
       max_staleness_interval_sec(max_staleness_interval_sec),
       max_run_time_sec(max_run_time_sec),
       move_rf1_replicas(move_rf1_replicas),
-      output_replica_distribution_details(output_replica_distribution_details) {
+      output_replica_distribution_details(output_replica_distribution_details),
+      replan_while_moving(replan_while_moving) {
   DCHECK_GE(max_moves_per_server, 0);
 }
 
@@ -228,6 +230,10 @@ Status Rebalancer::Run(RunStatus* result_status, size_t* moves_count) {
   MonoTime staleness_start = MonoTime::Now();
   bool is_timed_out = false;
   bool resync_state = false;
+  // The number of completed moves when the loaded batch was planned.
+  uint32_t moves_count_at_plan = 0;
+  // Whether the loaded batch has any moves.
+  bool planned_moves = false;
   while (!is_timed_out) {
     if (resync_state) {
       resync_state = false;
@@ -254,6 +260,8 @@ Status Rebalancer::Run(RunStatus* result_status, size_t* moves_count) {
 
       // Filter out moves for tablets which already have operations in progress.
       FilterMoves(runner.scheduled_moves(), &replica_moves);
+      planned_moves = !replica_moves.empty();
+      moves_count_at_plan = runner.moves_count();
       runner.LoadMoves(std::move(replica_moves));
     }
 
@@ -294,6 +302,14 @@ Status Rebalancer::Run(RunStatus* result_status, size_t* moves_count) {
         // of planned moves.
         break;
       }
+      if (config_.replan_while_moving && planned_moves &&
+          !runner.has_moves_to_schedule() &&
+          runner.moves_count() > moves_count_at_plan) {
+        // Some servers have free slots again: plan the next batch for them
+        // instead of waiting for the rest of this one. Once a plan comes out
+        // empty, the remaining moves are waited for as usual.
+        break;
+      }
 
       // Sleep a bit before going next cycle of status polling.
       SleepFor(MonoDelta::FromMilliseconds(200));
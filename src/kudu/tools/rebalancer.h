@@ -58,7 +58,8 @@ class Rebalancer {
         size_t max_staleness_interval_sec = 300,
         int64_t max_run_time_sec = 0,
         bool move_rf1_replicas = false,
-        bool output_replica_distribution_details = false);
+        bool output_replica_distribution_details = false,
+        bool replan_while_moving = false);
 
     // Kudu masters' RPC endpoints.
     std::vector<std::string> master_addresses;
@@ -89,6 +90,13 @@ class Rebalancer {
     // Whether Rebalancer::PrintStats() should output per-table and per-server
     // replica distribution details.
     bool output_replica_distribution_details;
+
+    // Whether to plan the next batch of moves as soon as every move of the
+    // current batch is scheduled and some have completed, rather than once
+    // all of them have completed. The moves still in progress are counted
+    // as done by the planning, so servers whose moves finish early get new
+    // ones while the slowest moves of the batch are still running.
+    bool replan_while_moving;
   };
 
   // Represents a concrete move of a replica from one tablet server to another.
@@ -160,6 +168,11 @@ class Rebalancer {
       return moves_count_;
     }
 
+    // Whether any of the loaded moves is yet to be scheduled.
+    bool has_moves_to_schedule() const {
+      return !src_op_indices_.empty();
+    }
+
     const MovesInProgress& scheduled_moves() const {
       return scheduled_moves_;
     }
@@ -89,6 +89,14 @@ DEFINE_uint32(
     "cluster or when some unexpected concurrent activity is "
     "present (such as automatic recovery of failed replicas, etc.)");
 
+DEFINE_bool(
+    replan_while_moving,
+    false,
+    "Whether to plan the next batch of replica moves as soon as some moves "
+    "of the current batch complete, rather than once all of them complete. "
+    "Keeps tablet servers busy while the slowest moves of a batch run, at "
+    "the cost of collecting the cluster's state more often.");
+
 DEFINE_int64(
     max_run_time_sec,
     0,
@@ -284,7 +292,8 @@ Status RunRebalance(const RunnerContext& context) {
       FLAGS_max_staleness_interval_sec,
       FLAGS_max_run_time_sec,
       move_single_replicas,
-      FLAGS_output_replica_distribution_details));
+      FLAGS_output_replica_distribution_details,
+      FLAGS_replan_while_moving));
 
   // Print info on pre-rebalance distribution of replicas.
   RETURN_NOT_OK(rebalancer.PrintStats(cout));
@@ -383,6 +392,7 @@ unique_ptr<Mode> BuildClusterMode() {
             .AddOptionalParameter("max_staleness_interval_sec")
             .AddOptionalParameter("move_single_replicas")
             .AddOptionalParameter("output_replica_distribution_details")
+            .AddOptionalParameter("replan_while_moving")
             .AddOptionalParameter("report_only")
             .AddOptionalParameter("tables")
             .Build();
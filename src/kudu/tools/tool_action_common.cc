@@ -42,7 +42,10 @@
 #include "kudu/consensus/consensus.proxy.h" // IWYU pragma: keep
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_util.h"
+#include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/endian.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
@@ -59,6 +62,9 @@
 #include "kudu/server/server_base.proxy.h"
 #include "kudu/tools/tool.pb.h" // IWYU pragma: keep
 #include "kudu/tools/tool_action.h"
+#include "kudu/tserver/simple_tablet_manager.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/tserver/tablet_server_options.h"
 #include "kudu/tserver/tserver_admin.proxy.h" // IWYU pragma: keep
 #include "kudu/util/faststring.h"
 #include "kudu/util/jsonwriter.h"
@@ -66,6 +72,7 @@
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 
@@ -305,6 +312,45 @@ bool MatchesAnyPattern(const vector<string>& patterns, const string& str) {
   return false;
 }
 
+Status StartLocalRing(
+    int num_replicas,
+    int base_port,
+    const string& root,
+    vector<unique_ptr<tserver::TabletServer>>* servers,
+    shared_ptr<consensus::RaftConsensus>* leader) {
+  vector<HostPort> addrs;
+  for (int i = 0; i < num_replicas; i++) {
+    addrs.emplace_back("127.0.0.1", base_port + i);
+  }
+  for (int i = 0; i < addrs.size(); i++) {
+    tserver::TabletServerOptions opts;
+    opts.fs_opts =
+        FsManagerOpts(JoinPathSegments(root, Substitute("ts-$0", i)));
+    opts.rpc_opts.rpc_bind_addresses = addrs[i].ToString();
+    opts.tserver_addresses = addrs;
+    unique_ptr<tserver::TabletServer> server(new tserver::TabletServer(opts));
+    RETURN_NOT_OK_PREPEND(
+        server->Init(), Substitute("could not initialize replica $0", i));
+    servers->emplace_back(std::move(server));
+  }
+  for (const auto& server : *servers) {
+    RETURN_NOT_OK(server->Start());
+  }
+
+  const MonoTime deadline = MonoTime::Now() + MonoDelta::FromSeconds(60);
+  while (MonoTime::Now() < deadline) {
+    for (const auto& server : *servers) {
+      auto consensus = server->tablet_manager()->shared_consensus();
+      if (consensus && consensus->role() == consensus::RaftPeerPB::LEADER) {
+        *leader = std::move(consensus);
+        return Status::OK();
+      }
+    }
+    SleepFor(MonoDelta::FromMilliseconds(100));
+  }
+  return Status::TimedOut("no leader was elected");
+}
+
 /*
 Status PrintServerStatus(const string& address, uint16_t default_port) {
   ServerStatusPB status;
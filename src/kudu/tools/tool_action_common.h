@@ -42,6 +42,10 @@ namespace rpc {
 class RpcController;
 } // namespace rpc
 
+namespace consensus {
+class RaftConsensus;
+} // namespace consensus
+
 namespace log {
 class ReadableLogSegment;
 } // namespace log
@@ -51,6 +55,10 @@ class GetFlagsResponsePB_Flag;
 class ServerStatusPB;
 } // namespace server
 
+namespace tserver {
+class TabletServer;
+} // namespace tserver
+
 namespace tools {
 
 struct RunnerContext;
@@ -134,6 +142,19 @@ bool MatchesAnyPattern(
     const std::vector<std::string>& patterns,
     const std::string& str);
 
+// Starts a ring of 'num_replicas' tablet servers in this process, listening
+// on 127.0.0.1 at consecutive ports from 'base_port', each with its data
+// under 'root'. Waits for one of them to be elected leader and returns its
+// consensus in 'leader'.
+//
+// The caller must shut down the servers in 'servers', even on failure.
+Status StartLocalRing(
+    int num_replicas,
+    int base_port,
+    const std::string& root,
+    std::vector<std::unique_ptr<tserver::TabletServer>>* servers,
+    std::shared_ptr<consensus::RaftConsensus>* leader);
+
 // A table of data to present to the user.
 //
 // Supports formatting based on the --format flag.
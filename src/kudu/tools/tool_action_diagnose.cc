@@ -19,16 +19,45 @@
 #include <array>
 #include <cerrno>
 #include <fstream> // IWYU pragma: keep
+#include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/tools/diagnostics_log_parser.h"
 #include "kudu/tools/tool_action.h"
+#include "kudu/tools/trace_merger.h"
 #include "kudu/util/errno.h"
 #include "kudu/util/status.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_string(
+    metric_patterns,
+    "",
+    "Comma-separated glob patterns of the metrics to analyze, named "
+    "'<entity type>.<metric name>', e.g. 'tablet.rows_*'. Empty for all.");
+DEFINE_int32(
+    parse_threads,
+    8,
+    "Number of diagnostics log files parsed concurrently.");
+DEFINE_string(
+    diff_windows,
+    "",
+    "If set, compares two time windows rather than printing time series: "
+    "'<a start>,<a end>,<b start>,<b end>', in microseconds since the "
+    "epoch, as in the fourth field of each diagnostics log line.");
+DEFINE_int32(
+    diff_top_n,
+    20,
+    "Number of statistics which changed the most that --diff_windows "
+    "prints.");
 
 namespace kudu {
 namespace tools {
@@ -42,17 +71,17 @@ using std::vector;
 using strings::Substitute;
 
 const char* kLogPathArg = "path";
+const char* kTracePathArg = "path";
 
 namespace {
 
-Status ParseStacksFromPath(const string& path) {
+Status ParseFromPath(const string& path, LogVisitor* visitor) {
   errno = 0;
   ifstream in(path);
   if (!in.is_open()) {
     return Status::IOError(ErrnoToString(errno));
   }
-  StackDumpingLogVisitor dlv;
-  LogParser lp(&dlv);
+  LogParser lp(visitor);
   string line;
   int line_number = 0;
   while (std::getline(in, line)) {
@@ -64,19 +93,143 @@ Status ParseStacksFromPath(const string& path) {
   return Status::OK();
 }
 
+// Keeps the metrics records of a log, to be collected in order with those
+// of the other logs once they're all parsed.
+class MetricsBufferingLogVisitor : public LogVisitor {
+ public:
+  void VisitSymbol(const string& /*addr*/, const string& /*symbol*/) override {
+  }
+
+  void VisitStacksRecord(const StacksRecord& /*sr*/) override {}
+
+  void VisitMetricsRecord(const MetricsRecord& mr) override {
+    records.push_back(mr);
+  }
+
+  vector<MetricsRecord> records;
+};
+
 Status ParseStacks(const RunnerContext& context) {
   vector<string> paths = context.variadic_args;
   // The file names are such that lexicographic sorting reflects
   // timestamp-based sorting.
   std::sort(paths.begin(), paths.end());
   for (const auto& path : paths) {
+    StackDumpingLogVisitor dlv;
     RETURN_NOT_OK_PREPEND(
-        ParseStacksFromPath(path),
+        ParseFromPath(path, &dlv),
         Substitute("failed to parse stacks from $0", path));
   }
   return Status::OK();
 }
 
+Status ParseProfiles(const RunnerContext& context) {
+  vector<string> paths = context.variadic_args;
+  std::sort(paths.begin(), paths.end());
+  // The profiles of all the files are summed up. A file only has the
+  // symbols not already written to it, ahead of the profiles using them.
+  FoldedStacksLogVisitor flv;
+  for (const auto& path : paths) {
+    RETURN_NOT_OK_PREPEND(
+        ParseFromPath(path, &flv),
+        Substitute("failed to parse profiles from $0", path));
+  }
+  flv.DumpFoldedStacks(&std::cout);
+  return Status::OK();
+}
+
+Status AnalyzeMetrics(const RunnerContext& context) {
+  vector<int64_t> windows;
+  if (!FLAGS_diff_windows.empty()) {
+    const vector<string> bounds = strings::Split(FLAGS_diff_windows, ",");
+    for (const string& bound : bounds) {
+      int64_t us;
+      if (!safe_strto64(bound, &us)) {
+        return Status::InvalidArgument("bad --diff_windows", bound);
+      }
+      windows.push_back(us);
+    }
+    if (windows.size() != 4 || windows[0] > windows[1] ||
+        windows[2] > windows[3]) {
+      return Status::InvalidArgument(
+          "--diff_windows must be two windows, each start before its end",
+          FLAGS_diff_windows);
+    }
+  }
+
+  vector<string> paths = context.variadic_args;
+  std::sort(paths.begin(), paths.end());
+  // Parsing the JSON is most of the work, so the files are parsed
+  // concurrently, and their records collected in order afterwards.
+  vector<MetricsBufferingLogVisitor> visitors(paths.size());
+  vector<Status> statuses(paths.size());
+  unique_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("parse-metrics")
+                    .set_min_threads(0)
+                    .set_max_threads(std::max(1, FLAGS_parse_threads))
+                    .Build(&pool));
+  for (int i = 0; i < paths.size(); i++) {
+    auto parse = [&, i]() {
+      statuses[i] = ParseFromPath(paths[i], &visitors[i]).CloneAndPrepend(
+          Substitute("failed to parse metrics from $0", paths[i]));
+    };
+    if (!pool->SubmitFunc(parse).ok()) {
+      parse();
+    }
+  }
+  pool->Wait();
+  pool->Shutdown();
+
+  const vector<string> patterns =
+      strings::Split(FLAGS_metric_patterns, ",", strings::SkipEmpty());
+  MetricsCollectingLogVisitor mlv(patterns);
+  for (int i = 0; i < paths.size(); i++) {
+    RETURN_NOT_OK(statuses[i]);
+    for (const auto& record : visitors[i].records) {
+      mlv.VisitMetricsRecord(record);
+    }
+    visitors[i].records.clear();
+  }
+  if (windows.empty()) {
+    mlv.DumpTimeSeries(&std::cout);
+  } else {
+    mlv.DumpWindowDiff(
+        windows[0],
+        windows[1],
+        windows[2],
+        windows[3],
+        FLAGS_diff_top_n,
+        &std::cout);
+  }
+  return Status::OK();
+}
+
+Status MergeTraceCaptures(const RunnerContext& context) {
+  vector<TraceCapture> captures;
+  for (const auto& arg : context.variadic_args) {
+    TraceCapture capture;
+    capture.name = arg;
+    const size_t at = arg.rfind('@');
+    if (at != string::npos) {
+      capture.name = arg.substr(0, at);
+      if (!safe_strto64(arg.substr(at + 1), &capture.skew_us)) {
+        return Status::InvalidArgument(
+            Substitute("bad clock skew in $0", arg));
+      }
+    }
+    errno = 0;
+    ifstream in(capture.name);
+    if (!in.is_open()) {
+      return Status::IOError(capture.name, ErrnoToString(errno));
+    }
+    std::ostringstream json;
+    json << in.rdbuf();
+    capture.json = json.str();
+    captures.push_back(std::move(capture));
+  }
+  return MergeTraces(captures, &std::cout);
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildDiagnoseMode() {
@@ -87,9 +240,52 @@ unique_ptr<Mode> BuildDiagnoseMode() {
               {kLogPathArg, "path to log file(s) to parse"})
           .Build();
 
+  unique_ptr<Action> parse_profiles =
+      ActionBuilder("parse_profiles", &ParseProfiles)
+          .Description(
+              "Sum up the wall-clock profiles in a diagnostics log as folded "
+              "stacks, the input format of flame graph tools")
+          .AddRequiredVariadicParameter(
+              {kLogPathArg, "path to log file(s) to parse"})
+          .Build();
+
+  unique_ptr<Action> analyze_metrics =
+      ActionBuilder("analyze_metrics", &AnalyzeMetrics)
+          .Description(
+              "Turn the metrics in a diagnostics log into a time series of "
+              "each metric's rate, or find which changed the most between "
+              "two time windows")
+          .ExtraDescription(
+              "Each metric is summed over the entities of its type. For "
+              "histograms, the mean and percentiles are of the values "
+              "recorded between records; the percentiles need logs "
+              "written with --diagnostics_log_raw_histograms. The files "
+              "are parsed concurrently. Output is CSV.")
+          .AddRequiredVariadicParameter(
+              {kLogPathArg, "path to log file(s) to parse"})
+          .AddOptionalParameter("diff_top_n")
+          .AddOptionalParameter("diff_windows")
+          .AddOptionalParameter("metric_patterns")
+          .AddOptionalParameter("parse_threads")
+          .Build();
+
+  unique_ptr<Action> merge_traces =
+      ActionBuilder("merge_traces", &MergeTraceCaptures)
+          .Description(
+              "Merge chrome://tracing captures from several servers into one, "
+              "lined up on the wall clock")
+          .AddRequiredVariadicParameter(
+              {kTracePathArg,
+               "path to a capture, optionally followed by @<microseconds> by "
+               "which that server's clock is behind"})
+          .Build();
+
   return ModeBuilder("diagnose")
       .Description("Diagnostic tools for Kudu servers and clusters")
       .AddAction(std::move(parse_stacks))
+      .AddAction(std::move(parse_profiles))
+      .AddAction(std::move(analyze_metrics))
+      .AddAction(std::move(merge_traces))
       .Build();
 }
 
@@ -166,6 +166,8 @@
 //      v  +---------+         v
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <iomanip>
@@ -193,18 +195,32 @@
 #include "kudu/common/partial_row.h"
 #include "kudu/common/schema.h"
 #include "kudu/common/types.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/strcat.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/tools/tool_action.h"
 #include "kudu/tools/tool_action_common.h"
+#include "kudu/tserver/simple_tablet_manager.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/tserver/tablet_server_options.h"
 #include "kudu/util/decimal_util.h"
 #include "kudu/util/flag_validators.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/int128.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/net_util.h"
 #include "kudu/util/oid_generator.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 
@@ -328,6 +344,44 @@ DEFINE_string(
     "integration is enabled in the cluster. If empty, no database is "
     "used.");
 DECLARE_string(table_name);
+
+DEFINE_int32(
+    raft_loadgen_replicas,
+    3,
+    "Number of replicas in the ring 'perf raft_loadgen' starts.");
+DEFINE_int32(
+    raft_loadgen_base_port,
+    17100,
+    "The replicas started by 'perf raft_loadgen' listen on 127.0.0.1, on "
+    "consecutive ports starting at this one.");
+DEFINE_string(
+    raft_loadgen_root,
+    "/tmp/raft_loadgen",
+    "Directory under which 'perf raft_loadgen' puts the WALs and metadata "
+    "of each replica. Point it at the disks to measure.");
+DEFINE_int32(
+    raft_loadgen_payload_bytes,
+    1024,
+    "Size of the payload of each op replicated by 'perf raft_loadgen'.");
+DEFINE_double(
+    raft_loadgen_compressibility,
+    0.0,
+    "Fraction, from 0 to 1, of each payload which is a repeated byte rather "
+    "than random, so that compression has something to work with.");
+DEFINE_double(
+    raft_loadgen_ops_per_sec,
+    0,
+    "Target rate of ops over all threads of 'perf raft_loadgen'. 0 means as "
+    "fast as the ring takes them.");
+DEFINE_int32(
+    raft_loadgen_max_inflight,
+    32,
+    "Most ops each thread of 'perf raft_loadgen' has replicating at a time.");
+DEFINE_int32(
+    raft_loadgen_duration_sec,
+    30,
+    "How long 'perf raft_loadgen' generates load for.");
+DECLARE_int32(raft_op_latency_sample_interval);
 DEFINE_int32(
     table_num_hash_partitions,
     8,
@@ -798,6 +852,170 @@ Status TestLoadGenerator(const RunnerContext& context) {
   return Status::OK();
 }
 
+// Payloads of --raft_loadgen_payload_bytes, of which the last
+// --raft_loadgen_compressibility is a repeated byte.
+vector<string> MakeLoadgenPayloads() {
+  const size_t size = FLAGS_raft_loadgen_payload_bytes;
+  const double compressibility =
+      std::min(1.0, std::max(0.0, FLAGS_raft_loadgen_compressibility));
+  const size_t random_size = static_cast<size_t>(size * (1 - compressibility));
+  Random rng(GetRandomSeed32());
+  vector<string> payloads;
+  for (int i = 0; i < 64; i++) {
+    string payload = RandomString(random_size, &rng);
+    payload.append(size - random_size, 'x');
+    payloads.emplace_back(std::move(payload));
+  }
+  return payloads;
+}
+
+struct LoadgenStats {
+  LoadgenStats() : latency_us(60000000LU, 3) {}
+
+  HdrHistogram latency_us;
+  std::atomic<int64_t> committed{0};
+  std::atomic<int64_t> failed{0};
+
+  std::mutex lock;
+  Status first_error;
+};
+
+// Replicates ops on 'leader', at most --raft_loadgen_max_inflight at a time,
+// until 'deadline'.
+void RunLoadgenThread(
+    consensus::RaftConsensus* leader,
+    const vector<string>& payloads,
+    MonoTime deadline,
+    int thread_idx,
+    LoadgenStats* stats) {
+  mutex inflight_lock;
+  std::condition_variable inflight_cond;
+  int inflight = 0;
+  auto finish_op = [&](const Status& s) {
+    if (!s.ok()) {
+      stats->failed++;
+      lock_guard<mutex> l(stats->lock);
+      if (stats->first_error.ok()) {
+        stats->first_error = s;
+      }
+    }
+    lock_guard<mutex> l(inflight_lock);
+    inflight--;
+    inflight_cond.notify_all();
+  };
+
+  const double ops_per_sec =
+      FLAGS_raft_loadgen_ops_per_sec / FLAGS_num_threads;
+  const MonoDelta interval = ops_per_sec > 0
+      ? MonoDelta::FromSeconds(1 / ops_per_sec)
+      : MonoDelta::FromNanoseconds(0);
+  MonoTime next = MonoTime::Now();
+  Random rng(thread_idx);
+  while (MonoTime::Now() < deadline) {
+    if (ops_per_sec > 0) {
+      const MonoTime now = MonoTime::Now();
+      if (next > now) {
+        SleepFor(next - now);
+      }
+      next += interval;
+    }
+    {
+      std::unique_lock<mutex> l(inflight_lock);
+      inflight_cond.wait(
+          l, [&]() { return inflight < FLAGS_raft_loadgen_max_inflight; });
+      inflight++;
+    }
+    unique_ptr<consensus::ReplicateMsg> msg(new consensus::ReplicateMsg());
+    msg->set_op_type(consensus::WRITE_OP_EXT);
+    msg->set_timestamp(GetCurrentTimeMicros());
+    msg->mutable_write_payload()->set_payload(
+        payloads[rng.Uniform(payloads.size())]);
+    const MonoTime start = MonoTime::Now();
+    scoped_refptr<consensus::ConsensusRound> round = leader->NewRound(
+        std::move(msg), [&, start](const Status& s) {
+          if (s.ok()) {
+            stats->latency_us.Increment(
+                (MonoTime::Now() - start).ToMicroseconds());
+            stats->committed++;
+          }
+          finish_op(s);
+        });
+    Status s = leader->Replicate(round);
+    if (!s.ok()) {
+      finish_op(s);
+      if (s.IsIllegalState()) {
+        // No longer the leader.
+        break;
+      }
+    }
+  }
+  std::unique_lock<mutex> l(inflight_lock);
+  inflight_cond.wait(l, [&]() { return inflight == 0; });
+}
+
+Status RaftLoadGenerator(const RunnerContext& /*context*/) {
+  vector<unique_ptr<tserver::TabletServer>> servers;
+  std::shared_ptr<consensus::RaftConsensus> leader;
+  SCOPED_CLEANUP({
+    for (const auto& server : servers) {
+      server->Shutdown();
+    }
+  });
+  RETURN_NOT_OK(StartLocalRing(
+      FLAGS_raft_loadgen_replicas,
+      FLAGS_raft_loadgen_base_port,
+      FLAGS_raft_loadgen_root,
+      &servers,
+      &leader));
+
+  const vector<string> payloads = MakeLoadgenPayloads();
+  LoadgenStats stats;
+  const MonoTime start = MonoTime::Now();
+  const MonoTime deadline =
+      start + MonoDelta::FromSeconds(FLAGS_raft_loadgen_duration_sec);
+  vector<thread> threads;
+  for (int i = 0; i < FLAGS_num_threads; i++) {
+    threads.emplace_back(
+        &RunLoadgenThread,
+        leader.get(),
+        std::cref(payloads),
+        deadline,
+        i,
+        &stats);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const double secs = (MonoTime::Now() - start).ToSeconds();
+
+  const int64_t committed = stats.committed;
+  cout << Substitute(
+              "Committed $0 ops of $1 bytes in $2 s: $3 ops/s, $4 MB/s",
+              committed,
+              FLAGS_raft_loadgen_payload_bytes,
+              secs,
+              static_cast<int64_t>(committed / secs),
+              committed * FLAGS_raft_loadgen_payload_bytes / secs / 1e6)
+       << endl;
+  cout << Substitute(
+              "Commit latency (us): p50 $0, p95 $1, p99 $2, p99.9 $3, max $4",
+              stats.latency_us.ValueAtPercentile(50),
+              stats.latency_us.ValueAtPercentile(95),
+              stats.latency_us.ValueAtPercentile(99),
+              stats.latency_us.ValueAtPercentile(99.9),
+              stats.latency_us.MaxValue())
+       << endl;
+  if (FLAGS_raft_op_latency_sample_interval > 0) {
+    cout << "Slowest sampled ops, by stage:" << endl;
+    leader->DumpSlowestOps(&cout);
+  }
+  if (stats.failed > 0) {
+    return stats.first_error.CloneAndPrepend(
+        Substitute("$0 ops failed", stats.failed.load()));
+  }
+  return Status::OK();
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildPerfMode() {
@@ -849,9 +1067,33 @@ unique_ptr<Mode> BuildPerfMode() {
           .AddOptionalParameter("use_random")
           .Build();
 
+  unique_ptr<Action> raft_loadgen =
+      ActionBuilder("raft_loadgen", &RaftLoadGenerator)
+          .Description("Measure the commit throughput and latency of a ring")
+          .ExtraDescription(
+              "Starts a ring of replicas in this process, with their WALs "
+              "under --raft_loadgen_root, and replicates ops of the given "
+              "size and compressibility through the leader from "
+              "--num_threads threads. Reports the commit throughput and "
+              "latency percentiles, and with "
+              "--raft_op_latency_sample_interval, the time the slowest ops "
+              "took to reach each stage.")
+          .AddOptionalParameter("num_threads")
+          .AddOptionalParameter("raft_loadgen_base_port")
+          .AddOptionalParameter("raft_loadgen_compressibility")
+          .AddOptionalParameter("raft_loadgen_duration_sec")
+          .AddOptionalParameter("raft_loadgen_max_inflight")
+          .AddOptionalParameter("raft_loadgen_ops_per_sec")
+          .AddOptionalParameter("raft_loadgen_payload_bytes")
+          .AddOptionalParameter("raft_loadgen_replicas")
+          .AddOptionalParameter("raft_loadgen_root")
+          .AddOptionalParameter("raft_op_latency_sample_interval")
+          .Build();
+
   return ModeBuilder("perf")
       .Description("Measure the performance of a Kudu cluster")
       .AddAction(std::move(insert))
+      .AddAction(std::move(raft_loadgen))
       .Build();
 }
 
@@ -17,24 +17,120 @@
 
 #include "kudu/tools/tool_action.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags.h>
+
+#include "kudu/clock/hybrid_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_exporter.h"
 #include "kudu/consensus/log_util.h"
+#include "kudu/consensus/log_verifier.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/human_readable.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/tools/tool_action_common.h"
+#include "kudu/tserver/tablet_server.h"
 #include "kudu/util/env.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 
+DECLARE_int32(raft_loadgen_base_port);
+DECLARE_int32(raft_loadgen_replicas);
+DECLARE_string(raft_loadgen_root);
+DECLARE_string(tablet_id);
+
+DEFINE_int32(
+    wal_verify_threads,
+    8,
+    "Number of tablets whose WALs are verified concurrently.");
+
+DEFINE_string(
+    wal_export_format,
+    "csv",
+    "Format of the ops exported: 'csv', a line per op with its term, index, "
+    "timestamp, type and size, or 'pb', each ReplicateMsg preceded by its "
+    "varint32 length.");
+DEFINE_string(
+    wal_export_output,
+    "",
+    "File to export the ops to. Defaults to stdout.");
+DEFINE_int32(
+    wal_export_threads,
+    8,
+    "Number of WAL segments decoded concurrently.");
+DEFINE_int64(
+    wal_export_min_index,
+    -1,
+    "Only export ops with at least this index. -1 for no bound.");
+DEFINE_int64(
+    wal_export_max_index,
+    -1,
+    "Only export ops with at most this index. -1 for no bound.");
+DEFINE_int64(wal_export_term, -1, "Only export ops of this term. -1 for any.");
+DEFINE_int64(
+    wal_export_min_timestamp,
+    -1,
+    "Only export ops with at least this raw timestamp. -1 for no bound.");
+DEFINE_int64(
+    wal_export_max_timestamp,
+    -1,
+    "Only export ops with at most this raw timestamp. -1 for no bound.");
+DEFINE_string(
+    wal_export_op_types,
+    "",
+    "Comma-separated types of the ops to export, e.g. "
+    "'WRITE_OP_EXT,CHANGE_CONFIG_OP'. Empty for all.");
+
+DEFINE_double(
+    wal_replay_speed,
+    1.0,
+    "Multiple of the captured rate at which 'wal replay' replicates the ops, "
+    "e.g. 2 for twice as fast. 0 replicates them as fast as the ring takes "
+    "them.");
+DEFINE_int32(
+    wal_replay_max_inflight,
+    64,
+    "Most ops 'wal replay' has replicating at a time. Ops due while this "
+    "many are in flight are replicated late.");
+
 namespace kudu {
 namespace tools {
 
+using log::LogEntryBatchPB;
+using log::LogEntryPB;
+using log::LogEntryReader;
 using log::ReadableLogSegment;
+using log::WalVerifyReport;
+using std::cout;
+using std::endl;
+using std::mutex;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
 
 namespace {
 
@@ -50,6 +146,308 @@ Status Dump(const RunnerContext& context) {
   return Status::OK();
 }
 
+// Sets 'segment_paths' to 'path' if it's a file, or else to the WAL segments
+// in the directory 'path', in order.
+Status ListSegments(const string& path, vector<string>* segment_paths) {
+  Env* env = Env::Default();
+  bool is_dir;
+  RETURN_NOT_OK(env->IsDirectory(path, &is_dir));
+  if (!is_dir) {
+    segment_paths->push_back(path);
+    return Status::OK();
+  }
+  vector<string> children;
+  RETURN_NOT_OK_PREPEND(
+      env->GetChildren(path, &children), "could not list " + path);
+  for (const string& child : children) {
+    if (log::IsLogFileName(child)) {
+      segment_paths->push_back(JoinPathSegments(path, child));
+    }
+  }
+  // Segment file names are zero-padded sequence numbers.
+  std::sort(segment_paths->begin(), segment_paths->end());
+  return Status::OK();
+}
+
+Status Export(const RunnerContext& context) {
+  const string& path = FindOrDie(context.required_args, kPathArg);
+
+  log::WalExportFormat format;
+  if (FLAGS_wal_export_format == "csv") {
+    format = log::WalExportFormat::CSV;
+  } else if (FLAGS_wal_export_format == "pb") {
+    format = log::WalExportFormat::PB_DELIMITED;
+  } else {
+    return Status::InvalidArgument(
+        "unknown --wal_export_format", FLAGS_wal_export_format);
+  }
+  log::WalExportFilter filter;
+  filter.min_index = FLAGS_wal_export_min_index;
+  filter.max_index = FLAGS_wal_export_max_index;
+  filter.term = FLAGS_wal_export_term;
+  filter.min_timestamp = FLAGS_wal_export_min_timestamp;
+  filter.max_timestamp = FLAGS_wal_export_max_timestamp;
+  const vector<string> op_types = strings::Split(
+      FLAGS_wal_export_op_types, ",", strings::SkipEmpty());
+  for (const string& name : op_types) {
+    consensus::OperationType type;
+    if (!consensus::OperationType_Parse(name, &type)) {
+      return Status::InvalidArgument("unknown op type", name);
+    }
+    filter.op_types.insert(type);
+  }
+
+  vector<string> segment_paths;
+  RETURN_NOT_OK(ListSegments(path, &segment_paths));
+  std::ofstream file;
+  std::ostream* out = &cout;
+  if (!FLAGS_wal_export_output.empty()) {
+    file.open(FLAGS_wal_export_output, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+      return Status::IOError(
+          "could not open --wal_export_output", FLAGS_wal_export_output);
+    }
+    out = &file;
+  }
+  log::WalExportStats stats;
+  Status s = log::ExportWalSegments(
+      Env::Default(),
+      segment_paths,
+      filter,
+      format,
+      FLAGS_wal_export_threads,
+      out,
+      &stats);
+  out->flush();
+  // Stdout may be the export itself.
+  std::cerr << stats.ToString() << endl;
+  return s;
+}
+
+// What 'wal replay' did.
+struct ReplayStats {
+  ReplayStats() : latency_us(60000000LU, 3) {}
+
+  HdrHistogram latency_us;
+  std::atomic<int64_t> committed{0};
+  std::atomic<int64_t> failed{0};
+  int64_t submitted = 0;
+  int64_t bytes = 0;
+  int64_t skipped = 0;
+  // The span of the captured ops' timestamps.
+  int64_t captured_span_us = 0;
+  // How far behind its schedule the latest op was replicated.
+  int64_t max_lag_us = 0;
+
+  mutex lock;
+  Status first_error;
+};
+
+// Replicates the WRITE_OP_EXT ops of the segments at 'segment_paths' on
+// 'leader', in order, each when as much time has passed since the first as
+// separated their timestamps, divided by --wal_replay_speed. Returns once
+// every op replicated has committed or failed.
+//
+// The segments are read front to back rather than through a LogReader,
+// since captured WALs may lack the log index.
+Status ReplayOps(
+    consensus::RaftConsensus* leader,
+    const vector<string>& segment_paths,
+    ReplayStats* stats) {
+  mutex inflight_lock;
+  std::condition_variable inflight_cond;
+  int inflight = 0;
+  auto finish_op = [&](const Status& s) {
+    if (!s.ok()) {
+      stats->failed++;
+      std::lock_guard<mutex> l(stats->lock);
+      if (stats->first_error.ok()) {
+        stats->first_error = s;
+      }
+    }
+    std::lock_guard<mutex> l(inflight_lock);
+    inflight--;
+    inflight_cond.notify_all();
+  };
+  // The callbacks of the ops in flight refer to the above.
+  SCOPED_CLEANUP({
+    std::unique_lock<mutex> l(inflight_lock);
+    inflight_cond.wait(l, [&]() { return inflight == 0; });
+  });
+
+  const MonoTime start = MonoTime::Now();
+  int64_t first_ts_us = -1;
+  for (const string& path : segment_paths) {
+    scoped_refptr<ReadableLogSegment> segment;
+    Status s = ReadableLogSegment::Open(Env::Default(), path, &segment);
+    if (s.IsUninitialized()) {
+      // Preallocated, but never written.
+      continue;
+    }
+    RETURN_NOT_OK_PREPEND(s, "could not open " + path);
+    segment->EnableReadahead();
+    LogEntryReader reader(segment.get());
+    while (true) {
+      unique_ptr<LogEntryBatchPB> batch;
+      int64_t batch_offset;
+      s = reader.ReadNextBatch(&batch, &batch_offset);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      RETURN_NOT_OK_PREPEND(s, "could not read " + path);
+      for (LogEntryPB& entry : *batch->mutable_entry()) {
+        if (entry.type() != log::REPLICATE || !entry.has_replicate()) {
+          continue;
+        }
+        consensus::ReplicateMsg* captured = entry.mutable_replicate();
+        if (captured->op_type() != consensus::WRITE_OP_EXT) {
+          stats->skipped++;
+          continue;
+        }
+
+        const int64_t ts_us = clock::HybridClock::GetPhysicalValueMicros(
+            Timestamp(captured->timestamp()));
+        if (first_ts_us < 0) {
+          first_ts_us = ts_us;
+        }
+        // Ops of a later term may have earlier timestamps than the ops they
+        // replaced.
+        const int64_t offset_us = std::max<int64_t>(0, ts_us - first_ts_us);
+        stats->captured_span_us =
+            std::max(stats->captured_span_us, offset_us);
+        MonoTime due = start;
+        if (FLAGS_wal_replay_speed > 0) {
+          due = start +
+              MonoDelta::FromMicroseconds(static_cast<int64_t>(
+                  offset_us / FLAGS_wal_replay_speed));
+          const MonoTime now = MonoTime::Now();
+          if (due > now) {
+            SleepFor(due - now);
+          }
+        }
+        {
+          std::unique_lock<mutex> l(inflight_lock);
+          inflight_cond.wait(
+              l, [&]() { return inflight < FLAGS_wal_replay_max_inflight; });
+          inflight++;
+        }
+        if (FLAGS_wal_replay_speed > 0) {
+          stats->max_lag_us = std::max(
+              stats->max_lag_us, (MonoTime::Now() - due).ToMicroseconds());
+        }
+
+        unique_ptr<consensus::ReplicateMsg> msg(new consensus::ReplicateMsg());
+        msg->set_op_type(consensus::WRITE_OP_EXT);
+        msg->set_timestamp(GetCurrentTimeMicros());
+        msg->mutable_write_payload()->Swap(captured->mutable_write_payload());
+        stats->bytes += msg->write_payload().payload().size();
+        stats->submitted++;
+        const MonoTime op_start = MonoTime::Now();
+        scoped_refptr<consensus::ConsensusRound> round = leader->NewRound(
+            std::move(msg), [&, op_start](const Status& s) {
+              if (s.ok()) {
+                stats->latency_us.Increment(
+                    (MonoTime::Now() - op_start).ToMicroseconds());
+                stats->committed++;
+              }
+              finish_op(s);
+            });
+        s = leader->Replicate(round);
+        if (!s.ok()) {
+          finish_op(s);
+          if (s.IsIllegalState()) {
+            // No longer the leader.
+            return s.CloneAndPrepend("could not replay the ops");
+          }
+        }
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status Replay(const RunnerContext& context) {
+  const string& path = FindOrDie(context.required_args, kPathArg);
+  if (FLAGS_wal_replay_speed < 0) {
+    return Status::InvalidArgument("--wal_replay_speed must not be negative");
+  }
+  vector<string> segment_paths;
+  RETURN_NOT_OK(ListSegments(path, &segment_paths));
+
+  vector<unique_ptr<tserver::TabletServer>> servers;
+  shared_ptr<consensus::RaftConsensus> leader;
+  SCOPED_CLEANUP({
+    for (const auto& server : servers) {
+      server->Shutdown();
+    }
+  });
+  RETURN_NOT_OK(StartLocalRing(
+      FLAGS_raft_loadgen_replicas,
+      FLAGS_raft_loadgen_base_port,
+      FLAGS_raft_loadgen_root,
+      &servers,
+      &leader));
+
+  ReplayStats stats;
+  const MonoTime start = MonoTime::Now();
+  RETURN_NOT_OK(ReplayOps(leader.get(), segment_paths, &stats));
+  const double secs = (MonoTime::Now() - start).ToSeconds();
+
+  const int64_t committed = stats.committed;
+  cout << Substitute(
+              "Committed $0 of $1 ops, $2, in $3 s: $4 ops/s, $5 MB/s "
+              "($6 ops of other types skipped)",
+              committed,
+              stats.submitted,
+              HumanReadableNumBytes::ToString(stats.bytes),
+              secs,
+              static_cast<int64_t>(committed / secs),
+              stats.bytes / secs / 1e6,
+              stats.skipped)
+       << endl;
+  cout << Substitute(
+              "Captured over $0 s, replayed at $1x; at most $2 ms behind "
+              "schedule",
+              stats.captured_span_us / 1e6,
+              FLAGS_wal_replay_speed,
+              stats.max_lag_us / 1000)
+       << endl;
+  cout << Substitute(
+              "Commit latency (us): p50 $0, p95 $1, p99 $2, p99.9 $3, max $4",
+              stats.latency_us.ValueAtPercentile(50),
+              stats.latency_us.ValueAtPercentile(95),
+              stats.latency_us.ValueAtPercentile(99),
+              stats.latency_us.ValueAtPercentile(99.9),
+              stats.latency_us.MaxValue())
+       << endl;
+  if (stats.failed > 0) {
+    return stats.first_error.CloneAndPrepend(
+        Substitute("$0 ops failed", stats.failed.load()));
+  }
+  return Status::OK();
+}
+
+Status Verify(const RunnerContext& /*context*/) {
+  FsManagerOpts fs_opts;
+  fs_opts.read_only = true;
+  FsManager fs_manager(Env::Default(), std::move(fs_opts));
+  RETURN_NOT_OK(fs_manager.Open());
+
+  vector<string> tablet_ids;
+  if (!FLAGS_tablet_id.empty()) {
+    tablet_ids.push_back(FLAGS_tablet_id);
+  }
+  WalVerifyReport report;
+  RETURN_NOT_OK(log::VerifyWals(
+      &fs_manager, tablet_ids, FLAGS_wal_verify_threads, &report));
+  cout << report.ToString() << endl;
+  if (report.total_errors() > 0) {
+    return Status::Corruption(Substitute(
+        "found $0 errors in the WALs", report.total_errors()));
+  }
+  return Status::OK();
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildWalMode() {
@@ -62,9 +460,69 @@ unique_ptr<Mode> BuildWalMode() {
           .AddOptionalParameter("truncate_data")
           .Build();
 
+  unique_ptr<Action> export_action =
+      ActionBuilder("export", &Export)
+          .Description(
+              "Export the ops of WAL (write-ahead log) files in bulk, "
+              "filtered, as CSV or length-delimited protobuf")
+          .ExtraDescription(
+              "'path' is a WAL file, or a directory whose WAL files are "
+              "exported in order. Files are decoded concurrently, and a "
+              "summary with the throughput is printed to stderr.")
+          .AddRequiredParameter({kPathArg, "path to a WAL file or directory"})
+          .AddOptionalParameter("wal_export_format")
+          .AddOptionalParameter("wal_export_output")
+          .AddOptionalParameter("wal_export_threads")
+          .AddOptionalParameter("wal_export_min_index")
+          .AddOptionalParameter("wal_export_max_index")
+          .AddOptionalParameter("wal_export_term")
+          .AddOptionalParameter("wal_export_min_timestamp")
+          .AddOptionalParameter("wal_export_max_timestamp")
+          .AddOptionalParameter("wal_export_op_types")
+          .Build();
+
+  unique_ptr<Action> replay =
+      ActionBuilder("replay", &Replay)
+          .Description(
+              "Replay the write ops of WAL (write-ahead log) files into a "
+              "ring started in this process")
+          .ExtraDescription(
+              "'path' is a WAL file, or a directory whose WAL files are "
+              "replayed in order. Starts a ring of replicas as 'perf "
+              "raft_loadgen' does, and replicates the WRITE_OP_EXT ops "
+              "through its leader with the spacing of their timestamps, "
+              "scaled by --wal_replay_speed. Reports the commit throughput "
+              "and latency percentiles, and how far behind the captured "
+              "schedule the replay fell.")
+          .AddRequiredParameter({kPathArg, "path to a WAL file or directory"})
+          .AddOptionalParameter("raft_loadgen_base_port")
+          .AddOptionalParameter("raft_loadgen_replicas")
+          .AddOptionalParameter("raft_loadgen_root")
+          .AddOptionalParameter("wal_replay_max_inflight")
+          .AddOptionalParameter("wal_replay_speed")
+          .Build();
+
+  unique_ptr<Action> verify =
+      ActionBuilder("verify", &Verify)
+          .Description(
+              "Verify the WALs of a tablet server: segment headers and "
+              "footers, entry checksums and the log index")
+          .ExtraDescription(
+              "The WALs of different tablets are verified concurrently. The "
+              "tablet server must not be running.")
+          .AddOptionalParameter("fs_wal_dir")
+          .AddOptionalParameter("fs_data_dirs")
+          .AddOptionalParameter("fs_metadata_dir")
+          .AddOptionalParameter("tablet_id")
+          .AddOptionalParameter("wal_verify_threads")
+          .Build();
+
   return ModeBuilder("wal")
       .Description("Operate on WAL (write-ahead log) files")
       .AddAction(std::move(dump))
+      .AddAction(std::move(export_action))
+      .AddAction(std::move(replay))
+      .AddAction(std::move(verify))
       .Build();
 }
 
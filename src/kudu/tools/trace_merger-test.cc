@@ -0,0 +1,103 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/tools/trace_merger.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <rapidjson/document.h>
+
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+
+namespace kudu {
+namespace tools {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+TraceCapture MakeCapture(
+    const string& name,
+    int64_t wall_clock_offset_us,
+    const string& events) {
+  TraceCapture capture;
+  capture.name = name;
+  capture.json = "{\"traceEvents\": [\n" + events +
+      "],\n\"metadata\": {\"wall_clock_offset_us\": " +
+      std::to_string(wall_clock_offset_us) + "}}\n";
+  return capture;
+}
+
+} // anonymous namespace
+
+TEST(TraceMergerTest, TestMergeOnWallClock) {
+  vector<TraceCapture> captures;
+  captures.push_back(MakeCapture(
+      "leader",
+      1000000,
+      "{\"pid\":7,\"ph\":\"s\",\"ts\":100,\"name\":\"Op\",\"id\":\"0x2a\"},\n"
+      "{\"pid\":7,\"ph\":\"M\",\"name\":\"process_name\","
+      "\"args\":{\"name\":\"kudu\"}}"));
+  captures.push_back(MakeCapture(
+      "follower",
+      500000,
+      "{\"pid\":7,\"ph\":\"f\",\"ts\":500200,\"name\":\"Op\","
+      "\"id\":\"0x2a\"}"));
+  // The follower's clock is 50us behind.
+  captures.back().skew_us = 50;
+
+  std::ostringstream out;
+  ASSERT_OK(MergeTraces(captures, &out));
+  rapidjson::Document doc;
+  doc.Parse<0>(out.str().c_str());
+  ASSERT_FALSE(doc.HasParseError()) << out.str();
+  // Each capture's own process name is replaced.
+  ASSERT_EQ(4, doc["traceEvents"].Size());
+  const rapidjson::Value* events = doc["traceEvents"].Begin();
+
+  ASSERT_STREQ("process_name", events[0]["name"].GetString());
+  ASSERT_STREQ("leader", events[0]["args"]["name"].GetString());
+  ASSERT_EQ(1, events[0]["pid"].GetInt());
+
+  // The follower's clock started earliest, at 500050us.
+  ASSERT_STREQ("s", events[1]["ph"].GetString());
+  ASSERT_EQ(1, events[1]["pid"].GetInt());
+  ASSERT_EQ(100 + 499950, events[1]["ts"].GetInt64());
+
+  ASSERT_STREQ("follower", events[2]["args"]["name"].GetString());
+  ASSERT_STREQ("f", events[3]["ph"].GetString());
+  ASSERT_EQ(2, events[3]["pid"].GetInt());
+  ASSERT_EQ(500200, events[3]["ts"].GetInt64());
+  ASSERT_STREQ("0x2a", events[3]["id"].GetString());
+}
+
+TEST(TraceMergerTest, TestMissingOffset) {
+  TraceCapture capture;
+  capture.name = "old";
+  capture.json = "{\"traceEvents\": []}";
+  std::ostringstream out;
+  Status s = MergeTraces({capture}, &out);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+}
+
+} // namespace tools
+} // namespace kudu
@@ -0,0 +1,146 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/tools/trace_merger.h"
+
+#include <algorithm>
+#include <limits>
+#include <ostream>
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "kudu/gutil/strings/substitute.h"
+
+namespace kudu {
+namespace tools {
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace {
+
+// Parses 'capture' and returns in '*offset_us' what to add to its timestamps
+// to put them on the reference wall clock.
+Status ParseCapture(
+    const TraceCapture& capture,
+    rapidjson::Document* doc,
+    int64_t* offset_us) {
+  doc->Parse<0>(capture.json.c_str());
+  if (doc->HasParseError()) {
+    return Status::Corruption(
+        Substitute("$0: not valid JSON", capture.name), doc->GetParseError());
+  }
+  if (!doc->IsObject() || !doc->HasMember("traceEvents") ||
+      !(*doc)["traceEvents"].IsArray()) {
+    return Status::Corruption(
+        Substitute("$0: no traceEvents array", capture.name));
+  }
+  // Monotonic clocks are unrelated across servers, so without the offset
+  // there is nothing to line the capture up with.
+  if (!doc->HasMember("metadata") || !(*doc)["metadata"].IsObject() ||
+      !(*doc)["metadata"].HasMember("wall_clock_offset_us") ||
+      !(*doc)["metadata"]["wall_clock_offset_us"].IsInt64()) {
+    return Status::InvalidArgument(Substitute(
+        "$0: no wall_clock_offset_us; was it captured by an older server?",
+        capture.name));
+  }
+  *offset_us =
+      (*doc)["metadata"]["wall_clock_offset_us"].GetInt64() + capture.skew_us;
+  return Status::OK();
+}
+
+bool IsProcessNameEvent(const rapidjson::Value& event) {
+  return event.HasMember("ph") && event["ph"].IsString() &&
+      string(event["ph"].GetString()) == "M" && event.HasMember("name") &&
+      event["name"].IsString() &&
+      string(event["name"].GetString()) == "process_name";
+}
+
+} // anonymous namespace
+
+Status MergeTraces(const vector<TraceCapture>& captures, std::ostream* out) {
+  vector<rapidjson::Document> docs(captures.size());
+  vector<int64_t> offsets_us(captures.size());
+  for (int i = 0; i < captures.size(); i++) {
+    RETURN_NOT_OK(ParseCapture(captures[i], &docs[i], &offsets_us[i]));
+  }
+  // Keep the timestamps small, relative to the earliest capture start.
+  int64_t base_us = std::numeric_limits<int64_t>::max();
+  for (int64_t offset_us : offsets_us) {
+    base_us = std::min(base_us, offset_us);
+  }
+
+  // The events are rewritten in place and written out one by one, since
+  // rapidjson can't copy values between documents.
+  rapidjson::StringBuffer buf;
+  bool first = true;
+  auto write_event = [&](const rapidjson::Value& event) {
+    buf.Clear();
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+    event.Accept(writer);
+    *out << (first ? "" : ",\n") << buf.GetString();
+    first = false;
+  };
+
+  *out << "{\"traceEvents\": [\n";
+  for (int i = 0; i < captures.size(); i++) {
+    rapidjson::Document::AllocatorType& alloc = docs[i].GetAllocator();
+    // Servers may well share pids, so each capture gets its own.
+    const int pid = i + 1;
+    const int64_t shift_us = offsets_us[i] - base_us;
+
+    rapidjson::Value args(rapidjson::kObjectType);
+    rapidjson::Value name(captures[i].name.c_str(), alloc);
+    args.AddMember("name", name, alloc);
+    rapidjson::Value name_event(rapidjson::kObjectType);
+    name_event.AddMember("ph", "M", alloc);
+    name_event.AddMember("name", "process_name", alloc);
+    name_event.AddMember("pid", pid, alloc);
+    name_event.AddMember("args", args, alloc);
+    write_event(name_event);
+
+    rapidjson::Value& events = docs[i]["traceEvents"];
+    for (rapidjson::Value* event = events.Begin(); event != events.End();
+         event++) {
+      if (!event->IsObject() || IsProcessNameEvent(*event)) {
+        continue;
+      }
+      if (event->HasMember("pid")) {
+        (*event)["pid"].SetInt(pid);
+      } else {
+        event->AddMember("pid", pid, alloc);
+      }
+      if (event->HasMember("ts")) {
+        rapidjson::Value& ts = (*event)["ts"];
+        if (ts.IsInt64()) {
+          ts.SetInt64(ts.GetInt64() + shift_us);
+        } else if (ts.IsNumber()) {
+          ts.SetDouble(ts.GetDouble() + shift_us);
+        }
+      }
+      write_event(*event);
+    }
+  }
+  *out << "\n]}" << std::endl;
+  return Status::OK();
+}
+
+} // namespace tools
+} // namespace kudu
@@ -0,0 +1,53 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace tools {
+
+// A chrome://tracing capture from one server, as written by
+// TraceResultBuffer::FlushTraceLogToString().
+struct TraceCapture {
+  // Names the server's process in the merged trace.
+  std::string name;
+  std::string json;
+  // Microseconds by which the server's wall clock is behind the reference
+  // clock, if known.
+  int64_t skew_us = 0;
+};
+
+// Merges 'captures' into one trace in the same format, written to 'out'.
+//
+// The timestamps of each capture are moved onto the wall clock, using the
+// "wall_clock_offset_us" it records plus its 'skew_us', so that the events of
+// all the servers line up. Each capture becomes a process of its own. Flow ids
+// are kept as they are, so the TRACE_EVENT_FLOW_* events of an op (see
+// consensus::OpTraceFlowId()) link up across the servers it went through.
+Status MergeTraces(
+    const std::vector<TraceCapture>& captures,
+    std::ostream* out);
+
+} // namespace tools
+} // namespace kudu
@@ -17,6 +17,7 @@
 
 #include "kudu/tserver/consensus_server.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -59,9 +60,13 @@
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/rpc/periodic.h"
 #include "kudu/rpc/result_tracker.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_pool.h"
@@ -70,13 +75,16 @@
 #include "kudu/tserver/tablet_server.h"
 #include "kudu/tserver/tablet_server_options.h"
 #include "kudu/util/debug/trace_event.h"
+#include "kudu/util/env.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/random_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
@@ -84,9 +92,48 @@
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
+DEFINE_int32(
+    raft_server_liveness_timeout_ms,
+    0,
+    "If positive, a remote server that has sent no consensus RPC to any of "
+    "the rings on this server for this long is deemed unresponsive, and the "
+    "rings it leads report leader failure without waiting out their own "
+    "election timeouts. Should be well below the election timeout, and above "
+    "the heartbeat interval. 0 disables server liveness tracking.");
+TAG_FLAG(raft_server_liveness_timeout_ms, experimental);
+
+DEFINE_int32(
+    raft_server_failure_election_stagger_ms,
+    50,
+    "Interval between the elections started for successive rings whose "
+    "leader's server was found unresponsive through "
+    "--raft_server_liveness_timeout_ms. Each election is also jittered by up "
+    "to this much.");
+TAG_FLAG(raft_server_failure_election_stagger_ms, experimental);
+TAG_FLAG(raft_server_failure_election_stagger_ms, runtime);
+
+DEFINE_int32(
+    raft_bootstrap_threads,
+    1,
+    "Number of rings that are initialized, i.e. have their consensus metadata "
+    "and log opened, and then started, concurrently at startup. Rings that "
+    "were last led by this server, then rings with the most WAL, go first, "
+    "and each ring serves as soon as it's started.");
+TAG_FLAG(raft_bootstrap_threads, experimental);
+
+static bool ValidateBootstrapThreads(const char* flagname, int32_t v) {
+  if (v >= 1) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be at least 1, got " << v;
+  return false;
+}
+DEFINE_validator(raft_bootstrap_threads, &ValidateBootstrapThreads);
+
 DECLARE_bool(enable_flexi_raft);
 
 using kudu::rpc::ServiceIf;
+using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::string;
@@ -352,8 +399,12 @@ void RaftConsensusInstance::Shutdown() {
     }
   }
 
-  if (consensus_)
+  if (consensus_) {
+    WARN_NOT_OK(
+        consensus_->HandOffLeadershipForShutdown(),
+        "Could not hand off leadership before shutting down");
     consensus_->Shutdown();
+  }
 
   state_ = MANAGER_SHUTDOWN;
 }
@@ -541,6 +592,7 @@ Status RaftConsensusInstance::SetupRaft() {
   ConsensusOptions options;
   options.tablet_id = id_;
   options.proxy_policy = opts.proxy_policy;
+  options.peer_send_pool = server_->raft_peer_send_pool();
   if (opts.topology_config.has_initial_raft_rpc_token()) {
     options.initial_raft_rpc_token =
         opts.topology_config.initial_raft_rpc_token();
@@ -569,6 +621,12 @@ Status RaftConsensusInstance::SetupRaft() {
   if (opts.ldcb) {
     consensus_->SetLeaderDetectedCallback(opts.ldcb);
   }
+  if (opts.sccb) {
+    consensus_->SetSnapshotCatchupCallback(opts.sccb);
+  }
+  if (opts.crcb) {
+    consensus_->SetCommittedRoundsCallback(opts.crcb);
+  }
   if (opts.disable_noop) {
     consensus_->DisableNoOpEntries();
   }
@@ -686,12 +744,52 @@ Status RaftConsensusInstance::WaitUntilRunning() {
   return Status::OK();
 }
 
+void ServerLivenessTracker::RecordContact(const string& server_uuid) {
+  const int64_t now_micros = GetMonoTimeMicros();
+  {
+    const folly::SharedMutexReadPriority::ReadHolder lock(lock_);
+    auto itr = servers_.find(server_uuid);
+    if (itr != servers_.end()) {
+      itr->second->last_contact_micros.store(
+          now_micros, std::memory_order_relaxed);
+      if (itr->second->reported_failed.load(std::memory_order_relaxed)) {
+        itr->second->reported_failed.store(false, std::memory_order_relaxed);
+      }
+      return;
+    }
+  }
+  const folly::SharedMutexReadPriority::WriteHolder lock(lock_);
+  std::unique_ptr<Entry>& entry = servers_[server_uuid];
+  if (!entry) {
+    entry.reset(new Entry());
+  }
+  entry->last_contact_micros.store(now_micros, std::memory_order_relaxed);
+  entry->reported_failed.store(false, std::memory_order_relaxed);
+}
+
+vector<string> ServerLivenessTracker::CollectNewlyFailed(
+    const MonoDelta& timeout) {
+  const int64_t deadline_micros =
+      GetMonoTimeMicros() - timeout.ToMicroseconds();
+  vector<string> failed;
+  const folly::SharedMutexReadPriority::ReadHolder lock(lock_);
+  for (const auto& entry : servers_) {
+    if (entry.second->last_contact_micros.load(std::memory_order_relaxed) <
+            deadline_micros &&
+        !entry.second->reported_failed.exchange(true)) {
+      failed.push_back(entry.first);
+    }
+  }
+  return failed;
+}
+
 RaftConsensusManager::RaftConsensusManager(RaftConsensusServer* server)
     : fs_manager_(server->fs_manager()),
       cmeta_manager_(new ConsensusMetadataManager(fs_manager_)),
       persistent_vars_manager_(new PersistentVarsManager(fs_manager_)),
       server_(server),
-      state_(MANAGER_INITIALIZING) {
+      state_(MANAGER_INITIALIZING),
+      rng_(GetRandomSeed32()) {
   const folly::SharedMutexReadPriority::WriteHolder lock(map_lock_);
   std::vector<std::string> ids;
   server_->opts_.GetIds(ids);
@@ -717,24 +815,182 @@ RaftConsensusManager::shared_consensus(const std::string& id) const {
   return itr->second->shared_consensus();
 }
 
-Status RaftConsensusManager::Init(bool is_first_run) {
-  LOG(INFO) << "Initializing RaftConsensusManager";
-  const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
+int64_t RaftConsensusManager::WalBytes(const string& id) const {
+  Env* env = fs_manager_->env();
+  int64_t bytes = 0;
+  for (const string& dir : fs_manager_->GetTabletWalStripeDirs(id)) {
+    vector<string> children;
+    if (!env->GetChildren(dir, &children).ok()) {
+      continue;
+    }
+    for (const string& child : children) {
+      uint64_t size;
+      if (HasPrefixString(child, FsManager::kWalFileNamePrefix) &&
+          env->GetFileSize(JoinPathSegments(dir, child), &size).ok()) {
+        bytes += size;
+      }
+    }
+  }
+  return bytes;
+}
+
+void RaftConsensusManager::ComputeBootstrapOrder(bool is_first_run) {
+  struct Ring {
+    string id;
+    bool was_leader;
+    int64_t wal_bytes;
+  };
+  vector<Ring> rings;
   for (const auto& entry : map_) {
-    RETURN_NOT_OK(entry.second->Init(is_first_run));
+    Ring ring{entry.first, false, 0};
+    if (!is_first_run && FLAGS_raft_bootstrap_threads > 1) {
+      scoped_refptr<ConsensusMetadata> cmeta;
+      if (cmeta_manager_->LoadCMeta(entry.first, &cmeta).ok()) {
+        ring.was_leader =
+            cmeta->last_known_leader().uuid() == fs_manager_->uuid();
+      }
+      ring.wal_bytes = WalBytes(entry.first);
+    }
+    rings.emplace_back(std::move(ring));
+  }
+  std::sort(rings.begin(), rings.end(), [](const Ring& a, const Ring& b) {
+    if (a.was_leader != b.was_leader) {
+      return a.was_leader;
+    }
+    if (a.wal_bytes != b.wal_bytes) {
+      return a.wal_bytes > b.wal_bytes;
+    }
+    return a.id < b.id;
+  });
+  bootstrap_order_.clear();
+  for (const Ring& ring : rings) {
+    bootstrap_order_.emplace_back(ring.id);
+  }
+}
+
+Status RaftConsensusManager::ForEachRingInBootstrapOrder(
+    const string& phase,
+    const std::function<Status(RaftConsensusInstance*)>& fn) {
+  vector<RaftConsensusInstance*> instances;
+  for (const string& id : bootstrap_order_) {
+    instances.emplace_back(FindOrDie(map_, id).get());
+  }
+  if (FLAGS_raft_bootstrap_threads <= 1 || instances.size() <= 1) {
+    for (RaftConsensusInstance* instance : instances) {
+      RETURN_NOT_OK(fn(instance));
+    }
+    return Status::OK();
+  }
+
+  const MonoTime start = MonoTime::Now();
+  std::unique_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("raft-bootstrap")
+                    .set_min_threads(0)
+                    .set_max_threads(FLAGS_raft_bootstrap_threads)
+                    .Build(&pool));
+  vector<Status> statuses(instances.size());
+  for (int i = 0; i < instances.size(); i++) {
+    RaftConsensusInstance* instance = instances[i];
+    Status* status = &statuses[i];
+    Status s = pool->SubmitFunc(
+        [&fn, instance, status]() { *status = fn(instance); });
+    if (!s.ok()) {
+      // Fall back to this ring on the calling thread.
+      *status = fn(instance);
+    }
   }
+  pool->Wait();
+  pool->Shutdown();
+  for (const Status& s : statuses) {
+    RETURN_NOT_OK(s);
+  }
+  LOG(INFO) << Substitute(
+      "$0 $1 rings on $2 threads in $3",
+      phase,
+      instances.size(),
+      FLAGS_raft_bootstrap_threads,
+      (MonoTime::Now() - start).ToString());
   return Status::OK();
 }
 
+Status RaftConsensusManager::Init(bool is_first_run) {
+  LOG(INFO) << "Initializing RaftConsensusManager";
+  const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
+  ComputeBootstrapOrder(is_first_run);
+  return ForEachRingInBootstrapOrder(
+      "Initialized", [is_first_run](RaftConsensusInstance* instance) {
+        return instance->Init(is_first_run);
+      });
+}
+
 Status RaftConsensusManager::Start(bool is_first_run) {
   LOG(INFO) << "Starting RaftConsensusManager";
   const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
-  for (const auto& entry : map_) {
-    RETURN_NOT_OK(entry.second->Start(is_first_run));
+  RETURN_NOT_OK(ForEachRingInBootstrapOrder(
+      "Started", [is_first_run](RaftConsensusInstance* instance) {
+        return instance->Start(is_first_run);
+      }));
+  if (FLAGS_raft_server_liveness_timeout_ms > 0) {
+    liveness_timer_ = rpc::PeriodicTimer::Create(
+        server_->messenger(),
+        [this]() { CheckServerLiveness(); },
+        MonoDelta::FromMilliseconds(
+            std::max(FLAGS_raft_server_liveness_timeout_ms / 4, 1)));
+    liveness_timer_->Start();
   }
   return Status::OK();
 }
 
+void RaftConsensusManager::RecordServerContact(const string& server_uuid) {
+  if (FLAGS_raft_server_liveness_timeout_ms > 0) {
+    liveness_tracker_.RecordContact(server_uuid);
+  }
+}
+
+void RaftConsensusManager::CheckServerLiveness() {
+  const MonoDelta timeout =
+      MonoDelta::FromMilliseconds(FLAGS_raft_server_liveness_timeout_ms);
+  const vector<string> failed = liveness_tracker_.CollectNewlyFailed(timeout);
+  if (failed.empty()) {
+    return;
+  }
+
+  vector<pair<int64_t, shared_ptr<RaftConsensus>>> rings;
+  {
+    const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
+    for (const auto& entry : map_) {
+      shared_ptr<RaftConsensus> consensus = entry.second->shared_consensus();
+      if (consensus) {
+        rings.emplace_back(
+            consensus->GetMillisSinceLastLeaderHeartbeat(),
+            std::move(consensus));
+      }
+    }
+  }
+  std::sort(rings.begin(), rings.end(), [](const auto& a, const auto& b) {
+    return a.first > b.first;
+  });
+
+  const int32_t stagger_ms =
+      std::max(FLAGS_raft_server_failure_election_stagger_ms, 1);
+  for (const string& server_uuid : failed) {
+    int num_expedited = 0;
+    for (const auto& ring : rings) {
+      const MonoDelta delay = MonoDelta::FromMilliseconds(
+          num_expedited * stagger_ms + 1 + rng_.Uniform(stagger_ms));
+      if (ring.second->ExpediteFailureDetection(server_uuid, delay)) {
+        num_expedited++;
+      }
+    }
+    LOG(INFO) << Substitute(
+        "Server $0 has been unresponsive for over $1, reported leader "
+        "failure early for $2 rings",
+        server_uuid,
+        timeout.ToString(),
+        num_expedited);
+  }
+}
+
 bool RaftConsensusManager::IsInitialized() const {
   const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
   for (const auto& entry : map_) {
@@ -747,6 +1003,9 @@ bool RaftConsensusManager::IsInitialized() const {
 
 void RaftConsensusManager::Shutdown() {
   LOG(INFO) << "Shutting down RaftConsensusManager";
+  if (liveness_timer_) {
+    liveness_timer_->Stop();
+  }
   const folly::SharedMutexReadPriority::ReadHolder lock(map_lock_);
   for (const auto& entry : map_) {
     entry.second->Shutdown();
@@ -17,9 +17,12 @@
 #ifndef KUDU_CONSENSUS_SERVER_H
 #define KUDU_CONSENSUS_SERVER_H
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <folly/SharedMutex.h>
@@ -29,13 +32,19 @@
 #include "kudu/tserver/simple_tablet_manager.h"
 #include "kudu/tserver/tablet_server.h"
 #include "kudu/tserver/tablet_server_options.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/promise.h"
+#include "kudu/util/random.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
 
 class ThreadPool;
 
+namespace rpc {
+class PeriodicTimer;
+} // namespace rpc
+
 namespace tserver {
 
 class TabletManagerIf;
@@ -206,6 +215,35 @@ class RaftConsensusInstance {
   DISALLOW_COPY_AND_ASSIGN(RaftConsensusInstance);
 };
 
+/**
+ * Tracks when each remote server was last heard from, whichever of the rings
+ * on this server the RPC was for. A server hosting the leaders of many rings
+ * keeps itself alive here through the heartbeats of any one of them.
+ */
+class ServerLivenessTracker {
+ public:
+  ServerLivenessTracker() = default;
+
+  // Notes that an RPC was just received from 'server_uuid'.
+  void RecordContact(const std::string& server_uuid);
+
+  // Returns the servers that were heard from before but have been silent for
+  // longer than 'timeout'. A server is returned once, and then not again
+  // until it has been heard from in between.
+  std::vector<std::string> CollectNewlyFailed(const MonoDelta& timeout);
+
+ private:
+  struct Entry {
+    std::atomic<int64_t> last_contact_micros{0};
+    std::atomic<bool> reported_failed{false};
+  };
+
+  std::unordered_map<std::string, std::unique_ptr<Entry>> servers_;
+  mutable folly::SharedMutexReadPriority lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(ServerLivenessTracker);
+};
+
 /**
  * Manager used by RaftConsensusServer to manage consensus rings
  */
@@ -226,12 +264,38 @@ class RaftConsensusManager : public TabletManagerIf {
   std::shared_ptr<consensus::RaftConsensus> shared_consensus(
       const std::string& id) const override;
 
+  void RecordServerContact(const std::string& server_uuid) override;
+
  private:
+  // Orders the rings for Init() and Start(): the rings last led by this
+  // server first, then the rings with the most WAL to replay. 'map_lock_'
+  // must be held.
+  void ComputeBootstrapOrder(bool is_first_run);
+
+  // The total size of the WAL segments of ring 'id'.
+  int64_t WalBytes(const std::string& id) const;
+
+  // Calls 'fn' on every ring in bootstrap order, on up to
+  // --raft_bootstrap_threads threads, and returns the first error. 'phase'
+  // is logged. 'map_lock_' must be held.
+  Status ForEachRingInBootstrapOrder(
+      const std::string& phase,
+      const std::function<Status(RaftConsensusInstance*)>& fn);
+
+  // Run periodically when --raft_server_liveness_timeout_ms is set. For each
+  // server newly found unresponsive, the rings it leads have their leader
+  // failure reported early, one after another, rings that have gone longest
+  // without a heartbeat first.
+  void CheckServerLiveness();
+
   // TODO (abhinavsharma): Consider making the map const and getting rid of
   // map_lock_
   std::unordered_map<std::string, std::shared_ptr<RaftConsensusInstance>> map_;
   mutable folly::SharedMutexReadPriority map_lock_;
 
+  // The ids of the rings, in the order they're initialized and started in.
+  std::vector<std::string> bootstrap_order_;
+
   FsManager* const fs_manager_;
 
   scoped_refptr<consensus::ConsensusMetadataManager> cmeta_manager_;
@@ -242,6 +306,14 @@ class RaftConsensusManager : public TabletManagerIf {
 
   TSTabletManagerStatePB state_;
 
+  ServerLivenessTracker liveness_tracker_;
+
+  std::shared_ptr<rpc::PeriodicTimer> liveness_timer_;
+
+  // Jitters the staggered elections, so that the followers of a ring on
+  // different servers don't all stand at once.
+  ThreadSafeRandom rng_;
+
   DISALLOW_COPY_AND_ASSIGN(RaftConsensusManager);
 };
 
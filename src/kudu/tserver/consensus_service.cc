@@ -18,6 +18,7 @@
 #include "kudu/tserver/consensus_service.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <functional>
@@ -34,13 +35,17 @@
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 
 #include "kudu/clock/clock.h"
 #include "kudu/common/timestamp.h"
 #include "kudu/common/wire_protocol.h"
 #include "kudu/common/wire_protocol.pb.h"
+#include "kudu/consensus/compact_ops.h"
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus_peers.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/replica_management.pb.h"
 #include "kudu/consensus/time_manager.h"
@@ -58,6 +63,9 @@
 #include "kudu/tserver/tablet_server.h"
 #include "kudu/tserver/tserver_admin.pb.h"
 #include "kudu/util/auto_release_pool.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
@@ -69,10 +77,38 @@
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
+#include "kudu/util/throttler.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/trace_metrics.h"
 
 DECLARE_int32(memory_limit_warn_threshold_percentage);
+DECLARE_int64(rpc_max_message_size);
+
+DEFINE_bool(
+    raft_async_follower_update,
+    false,
+    "Whether UpdateConsensus returns its service thread once the ops in the "
+    "request are queued for the local log, and responds from the log's append "
+    "thread once they are durable, instead of holding the service thread for "
+    "the append and sync.");
+TAG_FLAG(raft_async_follower_update, experimental);
+TAG_FLAG(raft_async_follower_update, runtime);
+
+DEFINE_int64(
+    log_segment_copy_bytes_per_sec,
+    0,
+    "The most bytes per second of WAL segments this server serves, over all "
+    "of its rings, to replicas being rebuilt, so that the copies don't crowd "
+    "out replication. 0 means unlimited.");
+TAG_FLAG(log_segment_copy_bytes_per_sec, experimental);
+
+DEFINE_int64(
+    log_segment_copy_max_chunk_bytes,
+    4 * 1024 * 1024,
+    "The most bytes of a WAL segment served in one FetchLogSegmentChunk "
+    "response.");
+TAG_FLAG(log_segment_copy_max_chunk_bytes, experimental);
+TAG_FLAG(log_segment_copy_max_chunk_bytes, runtime);
 
 using kudu::consensus::BulkChangeConfigRequestPB;
 using kudu::consensus::ChangeConfigRequestPB;
@@ -81,11 +117,16 @@ using kudu::consensus::ConsensusRequestPB;
 using kudu::consensus::ConsensusResponsePB;
 using kudu::consensus::GetNodeInstanceRequestPB;
 using kudu::consensus::GetNodeInstanceResponsePB;
+using kudu::consensus::HeartbeatRequestPB;
+using kudu::consensus::HeartbeatResponsePB;
 using kudu::consensus::LeaderElectionContextPB;
 using kudu::consensus::LeaderStepDownRequestPB;
 using kudu::consensus::LeaderStepDownResponsePB;
+using kudu::consensus::MultiConsensusRequestPB;
+using kudu::consensus::MultiConsensusResponsePB;
 using kudu::consensus::OpId;
 using kudu::consensus::RaftConsensus;
+using kudu::consensus::ReplicateMsg;
 using kudu::consensus::RunLeaderElectionRequestPB;
 using kudu::consensus::RunLeaderElectionResponsePB;
 using kudu::consensus::ServerErrorPB;
@@ -93,12 +134,14 @@ using kudu::consensus::UnsafeChangeConfigRequestPB;
 using kudu::consensus::UnsafeChangeConfigResponsePB;
 using kudu::consensus::VoteRequestPB;
 using kudu::consensus::VoteResponsePB;
+using kudu::consensus::WritePayloadPB;
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
 using kudu::rpc::RpcContext;
 using kudu::server::ServerBase;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using strings::Substitute;
 
 METRIC_DEFINE_counter(
@@ -232,15 +275,17 @@ bool GetConsensusOrRespond(
   return true;
 }
 
-template <class ReqType, class RespType>
-bool CheckRaftRpcTokenOrRespond(
+// Returns false, with the reason in 'error', if 'req' must be rejected
+// because its Raft RPC token doesn't match 'ownToken', the local one, which
+// callers fetch once per call from consensus.GetRaftRpcToken().
+template <class ReqType>
+bool RaftRpcTokenAllowed(
     const std::string& method_name,
     const ReqType* req,
-    RespType resp,
-    rpc::RpcContext* context,
     const consensus::RaftConsensus& consensus,
-    const scoped_refptr<Counter>& mismatch_counter) {
-  const auto& ownToken = consensus.GetRaftRpcToken();
+    const std::shared_ptr<const std::string>& ownToken,
+    const scoped_refptr<Counter>& mismatch_counter,
+    Status* error) {
   if (!ownToken && !req->has_raft_rpc_token()) {
     // Empty on both, nothing to enforce
     return true;
@@ -269,9 +314,27 @@ bool CheckRaftRpcTokenOrRespond(
 
   KLOG_EVERY_N_SECS(ERROR, 60)
       << method_name << ": Rejecting incoming RPC: " << error_message;
+  *error = Status::NotAuthorized(std::move(error_message));
+  return false;
+}
+
+template <class ReqType, class RespType>
+bool CheckRaftRpcTokenOrRespond(
+    const std::string& method_name,
+    const ReqType* req,
+    RespType resp,
+    rpc::RpcContext* context,
+    const consensus::RaftConsensus& consensus,
+    const std::shared_ptr<const std::string>& ownToken,
+    const scoped_refptr<Counter>& mismatch_counter) {
+  Status error;
+  if (RaftRpcTokenAllowed(
+          method_name, req, consensus, ownToken, mismatch_counter, &error)) {
+    return true;
+  }
   SetupErrorAndRespond(
       resp->mutable_error(),
-      Status::NotAuthorized(std::move(error_message)),
+      error,
       ServerErrorPB::RING_TOKEN_MISMATCH,
       context);
   return false;
@@ -308,6 +371,86 @@ BindHandleResponse(const ReqType* req, RespType* resp, RpcContext* context) {
       std::placeholders::_1);
 }
 
+// Moves whatever the leader sent in sidecars back into 'req': the ops, if
+// ConsensusRequestPB::ops_sidecar_idx is set, uncompressing them first if
+// the leader compressed the batch and decoding them if it encoded them
+// compactly, and the write payloads with a
+// WritePayloadPB::payload_sidecar_idx. The request is owned by the RPC
+// context and not yet shared, so it is safe to modify in place.
+Status UncompressOpsSidecar(
+    const ConsensusRequestPB& req,
+    const Slice& compressed,
+    faststring* uncompressed) {
+  if (PREDICT_FALSE(
+          req.ops_sidecar_uncompressed_size() < 0 ||
+          req.ops_sidecar_uncompressed_size() >
+              FLAGS_rpc_max_message_size)) {
+    return Status::Corruption(Substitute(
+        "Bad uncompressed size: $0", req.ops_sidecar_uncompressed_size()));
+  }
+  std::shared_ptr<CompressionCodec> codec;
+  RETURN_NOT_OK(
+      CompressionCodecManager::GetCodec(req.ops_sidecar_compression(), &codec));
+  if (PREDICT_FALSE(!codec)) {
+    return Status::NotSupported("Unknown codec");
+  }
+  uncompressed->resize(req.ops_sidecar_uncompressed_size());
+  return codec->Uncompress(
+      compressed, uncompressed->data(), uncompressed->size());
+}
+
+// Parses 'ops', encoded as the 'ops' fields of a ConsensusRequestPB, into
+// the ops of 'req'.
+Status ParseOpsSidecar(const Slice& ops, ConsensusRequestPB* req) {
+  // Parse onto the request's arena, if any, so that the swap below doesn't
+  // copy the ops.
+  google::protobuf::Arena* arena = req->GetArena();
+  ConsensusRequestPB* parsed =
+      google::protobuf::Arena::CreateMessage<ConsensusRequestPB>(arena);
+  unique_ptr<ConsensusRequestPB> heap_parsed(arena ? nullptr : parsed);
+  if (PREDICT_FALSE(!parsed->ParsePartialFromArray(ops.data(), ops.size()))) {
+    return Status::Corruption("Unable to parse ops sidecar");
+  }
+  req->mutable_ops()->Swap(parsed->mutable_ops());
+  return Status::OK();
+}
+
+Status MergeSidecarsIntoRequest(
+    const ConsensusRequestPB* req,
+    RpcContext* context) {
+  ConsensusRequestPB* mutable_req = const_cast<ConsensusRequestPB*>(req);
+  if (req->has_ops_sidecar_idx()) {
+    Slice ops;
+    RETURN_NOT_OK_PREPEND(
+        context->GetInboundSidecar(req->ops_sidecar_idx(), &ops),
+        "Unable to read ops sidecar");
+    faststring uncompressed;
+    if (req->ops_sidecar_compression() != NO_COMPRESSION) {
+      RETURN_NOT_OK_PREPEND(
+          UncompressOpsSidecar(*req, ops, &uncompressed),
+          "Unable to uncompress ops sidecar");
+      ops = Slice(uncompressed);
+    }
+    if (req->ops_sidecar_encoding() == ConsensusRequestPB::COMPACT_OPS) {
+      // Decodes onto the request's arena, if any.
+      RETURN_NOT_OK_PREPEND(
+          consensus::DecodeCompactOps(ops, mutable_req->mutable_ops()),
+          "Unable to decode ops sidecar");
+    } else {
+      RETURN_NOT_OK(ParseOpsSidecar(ops, mutable_req));
+    }
+    mutable_req->clear_ops_sidecar_idx();
+    mutable_req->clear_ops_sidecar_compression();
+    mutable_req->clear_ops_sidecar_uncompressed_size();
+    mutable_req->clear_ops_sidecar_encoding();
+  }
+
+  return consensus::MergePayloadSidecars(
+      mutable_req, [context](int idx, Slice* data) {
+        return context->GetInboundSidecar(idx, data);
+      });
+}
+
 } // namespace
 
 template <class ReqType, class RespType>
@@ -333,7 +476,19 @@ ConsensusServiceImpl::ConsensusServiceImpl(
       tablet_manager_(tablet_manager),
       request_rpc_token_mismatches_(
           server->metric_entity()->FindOrCreateCounter(
-              &METRIC_raft_rpc_token_num_request_mismatches)) {}
+              &METRIC_raft_rpc_token_num_request_mismatches)) {
+  if (FLAGS_log_segment_copy_bytes_per_sec > 0) {
+    // Allow a burst of one full chunk, or no chunk would ever pass.
+    const double refill_bytes =
+        static_cast<double>(FLAGS_log_segment_copy_bytes_per_sec) *
+        Throttler::kRefillPeriodMicros / MonoTime::kMicrosecondsPerSecond;
+    const double burst = std::max(
+        1.0,
+        FLAGS_log_segment_copy_max_chunk_bytes / std::max(refill_bytes, 1.0));
+    segment_copy_throttler_.reset(new Throttler(
+        MonoTime::Now(), 0, FLAGS_log_segment_copy_bytes_per_sec, burst));
+  }
+}
 
 ConsensusServiceImpl::~ConsensusServiceImpl() {}
 
@@ -354,16 +509,22 @@ void ConsensusServiceImpl::UpdateConsensus(
           tablet_manager_, "UpdateConsensus", req, resp, context)) {
     return;
   }
+  tablet_manager_.RecordServerContact(req->caller_uuid());
+  if (Histogram::ExemplarsEnabled()) {
+    context->AddExemplarLabel("tablet_id", req->tablet_id());
+    context->AddExemplarLabel("peer", req->caller_uuid());
+  }
 
   // Submit the update directly to the TabletReplica's RaftConsensus instance.
   shared_ptr<RaftConsensus> consensus;
   if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
     return;
 
-  if (auto ownToken = consensus->GetRaftRpcToken()) {
+  const auto ownToken = consensus->GetRaftRpcToken();
+  if (ownToken) {
     // Stamp response token regardless of whether if it matches request so
     // sender can log and debug
-    resp->set_raft_rpc_token(*std::move(ownToken));
+    resp->set_raft_rpc_token(*ownToken);
   }
 
   if (!CheckRaftRpcTokenOrRespond(
@@ -372,17 +533,51 @@ void ConsensusServiceImpl::UpdateConsensus(
           resp,
           context,
           *consensus,
+          ownToken,
           request_rpc_token_mismatches_)) {
     return;
   }
 
-  // Fast path for proxy requests.
+  // Fast path for proxy requests, which relay any ops sidecar as it is.
   if (consensus->IsProxyRequest(req)) {
     consensus->HandleProxyRequest(req, resp, context);
     return;
   }
 
-  Status s = consensus->Update(req, resp);
+  if (PREDICT_FALSE(consensus->IsSupersededRequest(*req))) {
+    // The leader has already moved on to a newer request, so it won't look at
+    // the response.
+    HandleUnknownError(
+        Status::Aborted("superseded by a newer request from the leader"),
+        resp,
+        context);
+    return;
+  }
+
+  Status merge_status = MergeSidecarsIntoRequest(req, context);
+  if (PREDICT_FALSE(!merge_status.ok())) {
+    HandleUnknownError(merge_status, resp, context);
+    return;
+  }
+
+  if (FLAGS_raft_async_follower_update) {
+    consensus->UpdateAsync(
+        req, resp, context->arena(), [resp, context](const Status& s) {
+          if (PREDICT_FALSE(!s.ok())) {
+            resp->Clear();
+            SetupErrorAndRespond(
+                resp->mutable_error(),
+                s,
+                ServerErrorPB::UNKNOWN_ERROR,
+                context);
+            return;
+          }
+          context->RespondSuccess();
+        });
+    return;
+  }
+
+  Status s = consensus->Update(req, resp, context->arena());
   if (PREDICT_FALSE(!s.ok())) {
     // Clear the response first, since a partially-filled response could
     // result in confusing a caller, or in having missing required fields
@@ -396,6 +591,136 @@ void ConsensusServiceImpl::UpdateConsensus(
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::MultiUpdateConsensus(
+    const MultiConsensusRequestPB* req,
+    MultiConsensusResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received Multi Consensus Update RPC with "
+           << req->requests_size() << " requests";
+  const string& local_uuid = tablet_manager_.NodeInstance().permanent_uuid();
+  for (int i = 0; i < req->requests_size(); i++) {
+    resp->add_responses();
+  }
+
+  // Proxied requests complete asynchronously, so the call is responded to
+  // once the last of them has.
+  auto pending = std::make_shared<std::atomic<int>>(1);
+  auto finish_one = [pending, context]() {
+    if (pending->fetch_sub(1) == 1) {
+      context->RespondSuccess();
+    }
+  };
+  for (int i = 0; i < req->requests_size(); i++) {
+    const ConsensusRequestPB& sub_req = req->requests(i);
+    ConsensusResponsePB* sub_resp = resp->mutable_responses(i);
+    if (i == 0 || sub_req.caller_uuid() != req->requests(i - 1).caller_uuid()) {
+      tablet_manager_.RecordServerContact(sub_req.caller_uuid());
+    }
+    const bool proxied = sub_req.has_proxy_dest_uuid();
+    // The checks of UpdateConsensus(), reporting into 'sub_resp' instead of
+    // responding.
+    Status s;
+    ServerErrorPB::Code code = ServerErrorPB::UNKNOWN_ERROR;
+    shared_ptr<RaftConsensus> consensus;
+    const string& want_uuid =
+        proxied ? sub_req.proxy_dest_uuid() : sub_req.dest_uuid();
+    if (PREDICT_FALSE(
+            (proxied || sub_req.has_dest_uuid()) && want_uuid != local_uuid)) {
+      s = Status::InvalidArgument(Substitute(
+          "MultiUpdateConsensus: Wrong $0 UUID requested. "
+          "Local UUID: $1. Requested UUID: $2",
+          proxied ? "proxy" : "destination",
+          local_uuid,
+          want_uuid));
+      code = ServerErrorPB::WRONG_SERVER_UUID;
+    } else if (PREDICT_FALSE(!proxied && sub_req.has_ops_sidecar_idx())) {
+      // Proxied requests relay their ops sidecar as it is; anything else
+      // sends its sidecars in an UpdateConsensus of its own.
+      s = Status::InvalidArgument(
+          "Only proxied requests with sidecars can be batched");
+    } else if (!(consensus =
+                     tablet_manager_.shared_consensus(sub_req.tablet_id()))) {
+      s = Status::ServiceUnavailable(
+          "Raft Consensus unavailable", "Tablet replica not initialized");
+      code = ServerErrorPB::CONSENSUS_NOT_RUNNING;
+    } else {
+      const auto ownToken = consensus->GetRaftRpcToken();
+      if (ownToken) {
+        sub_resp->set_raft_rpc_token(*ownToken);
+      }
+      if (!RaftRpcTokenAllowed(
+              "MultiUpdateConsensus",
+              &sub_req,
+              *consensus,
+              ownToken,
+              request_rpc_token_mismatches_,
+              &s)) {
+        code = ServerErrorPB::RING_TOKEN_MISMATCH;
+      } else if (proxied) {
+        // Fan out: the sidecar indexes of 'sub_req' refer to those of
+        // 'context', which the proxied requests may share.
+        pending->fetch_add(1);
+        auto done = [sub_resp, finish_one](const Status& proxy_status) {
+          if (PREDICT_FALSE(!proxy_status.ok())) {
+            sub_resp->Clear();
+            StatusToPB(
+                proxy_status, sub_resp->mutable_error()->mutable_status());
+            sub_resp->mutable_error()->set_code(ServerErrorPB::UNKNOWN_ERROR);
+          }
+          finish_one();
+        };
+        consensus->HandleProxyRequest(
+            &sub_req, sub_resp, context, std::move(done));
+        continue;
+      } else {
+        s = consensus->Update(&sub_req, sub_resp);
+      }
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      sub_resp->Clear();
+      StatusToPB(s, sub_resp->mutable_error()->mutable_status());
+      sub_resp->mutable_error()->set_code(code);
+    }
+  }
+  finish_one();
+}
+
+void ConsensusServiceImpl::Heartbeat(
+    const HeartbeatRequestPB* req,
+    HeartbeatResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received Heartbeat RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "Heartbeat", req, resp, context)) {
+    return;
+  }
+  tablet_manager_.RecordServerContact(req->caller_uuid());
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+
+  const auto ownToken = consensus->GetRaftRpcToken();
+  if (ownToken) {
+    resp->set_raft_rpc_token(*ownToken);
+  }
+  if (!CheckRaftRpcTokenOrRespond(
+          "Heartbeat",
+          req,
+          resp,
+          context,
+          *consensus,
+          ownToken,
+          request_rpc_token_mismatches_)) {
+    return;
+  }
+
+  // Runs on the reactor thread: if the heartbeat can't be applied without
+  // blocking, the leader resends it as an UpdateConsensus.
+  consensus->Heartbeat(req, resp);
+  context->RespondSuccess();
+}
+
 void ConsensusServiceImpl::RequestConsensusVote(
     const VoteRequestPB* req,
     VoteResponsePB* resp,
@@ -406,6 +731,7 @@ void ConsensusServiceImpl::RequestConsensusVote(
           tablet_manager_, "RequestConsensusVote", req, resp, context)) {
     return;
   }
+  tablet_manager_.RecordServerContact(req->candidate_uuid());
 
   // For backwards compatibility, it is possible that an older instance without
   // mode field, make a call to an instance with the latest version. In these
@@ -427,10 +753,11 @@ void ConsensusServiceImpl::RequestConsensusVote(
   if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
     return;
 
-  if (auto ownToken = consensus->GetRaftRpcToken()) {
+  const auto ownToken = consensus->GetRaftRpcToken();
+  if (ownToken) {
     // Stamp response token regardless of whether if it matches request so
     // sender can log and debug
-    resp->set_raft_rpc_token(*std::move(ownToken));
+    resp->set_raft_rpc_token(*ownToken);
   }
 
   if (!CheckRaftRpcTokenOrRespond(
@@ -439,6 +766,7 @@ void ConsensusServiceImpl::RequestConsensusVote(
           resp,
           context,
           *consensus,
+          ownToken,
           request_rpc_token_mismatches_)) {
     return;
   }
@@ -577,6 +905,7 @@ void ConsensusServiceImpl::RunLeaderElection(
           resp,
           context,
           *consensus,
+          consensus->GetRaftRpcToken(),
           request_rpc_token_mismatches_)) {
     return;
   }
@@ -695,6 +1024,89 @@ void ConsensusServiceImpl::GetLastOpId(
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::FetchLogSegmentChunk(
+    const consensus::FetchLogSegmentChunkRequestPB* req,
+    consensus::FetchLogSegmentChunkResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received FetchLogSegmentChunk RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "FetchLogSegmentChunk", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+
+  int64_t max_length = FLAGS_log_segment_copy_max_chunk_bytes;
+  if (req->has_max_length()) {
+    max_length = std::min(max_length, req->max_length());
+  }
+  if (segment_copy_throttler_ &&
+      !segment_copy_throttler_->Take(MonoTime::Now(), 0, max_length)) {
+    SetupErrorAndRespond(
+        resp->mutable_error(),
+        Status::ServiceUnavailable("WAL segment copies are throttled"),
+        ServerErrorPB::SERVICE_UNAVAILABLE,
+        context);
+    return;
+  }
+
+  unique_ptr<faststring> data(new faststring());
+  int64_t segment_size;
+  Status s = consensus->ReadLogSegmentChunk(
+      req->segment_seqno(),
+      req->offset(),
+      max_length,
+      data.get(),
+      &segment_size);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  resp->set_segment_size(segment_size);
+  resp->set_data_crc32c(crc::Crc32c(data->data(), data->size()));
+  int idx;
+  s = context->AddOutboundSidecar(
+      rpc::RpcSidecar::FromFaststring(std::move(data)), &idx);
+  if (PREDICT_FALSE(!s.ok())) {
+    HandleUnknownError(s, resp, context);
+    return;
+  }
+  resp->set_data_sidecar_idx(idx);
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::ReadIndex(
+    const consensus::ReadIndexRequestPB* req,
+    consensus::ReadIndexResponsePB* resp,
+    rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadIndex RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(
+          tablet_manager_, "ReadIndex", req, resp, context)) {
+    return;
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req, resp, context, &consensus))
+    return;
+
+  // Only served by the leader, so that followers never forward to each other.
+  consensus->LeaderReadIndexAsync(
+      [resp, context](const Status& s, int64_t read_index) {
+        if (!s.ok()) {
+          ServerErrorPB::Code code = ServerErrorPB::UNKNOWN_ERROR;
+          if (s.IsIllegalState()) {
+            code = ServerErrorPB::NOT_THE_LEADER;
+          } else if (s.IsServiceUnavailable()) {
+            code = ServerErrorPB::SERVICE_UNAVAILABLE;
+          }
+          SetupErrorAndRespond(resp->mutable_error(), s, code, context);
+          return;
+        }
+        resp->set_read_index(read_index);
+        context->RespondSuccess();
+      });
+}
+
 void ConsensusServiceImpl::GetConsensusState(
     const consensus::GetConsensusStateRequestPB* /* req */,
     consensus::GetConsensusStateResponsePB* /* resp */,
@@ -18,6 +18,7 @@
 #define KUDU_TSERVER_TABLET_SERVICE_H
 
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include "kudu/consensus/consensus.service.h"
@@ -33,6 +34,7 @@ class Message;
 namespace kudu {
 
 class Status;
+class Throttler;
 
 namespace server {
 class ServerBase;
@@ -44,14 +46,20 @@ class ChangeConfigRequestPB;
 class ChangeConfigResponsePB;
 class ConsensusRequestPB;
 class ConsensusResponsePB;
+class FetchLogSegmentChunkRequestPB;
+class FetchLogSegmentChunkResponsePB;
 class GetConsensusStateRequestPB;
 class GetConsensusStateResponsePB;
 class GetLastOpIdRequestPB;
 class GetLastOpIdResponsePB;
 class GetNodeInstanceRequestPB;
 class GetNodeInstanceResponsePB;
+class HeartbeatRequestPB;
+class HeartbeatResponsePB;
 class LeaderStepDownRequestPB;
 class LeaderStepDownResponsePB;
+class ReadIndexRequestPB;
+class ReadIndexResponsePB;
 class RunLeaderElectionRequestPB;
 class RunLeaderElectionResponsePB;
 class StartTabletCopyRequestPB;
@@ -89,6 +97,16 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
       consensus::ConsensusResponsePB* resp,
       rpc::RpcContext* context) override;
 
+  virtual void MultiUpdateConsensus(
+      const consensus::MultiConsensusRequestPB* req,
+      consensus::MultiConsensusResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void Heartbeat(
+      const consensus::HeartbeatRequestPB* req,
+      consensus::HeartbeatResponsePB* resp,
+      rpc::RpcContext* context) override;
+
   virtual void RequestConsensusVote(
       const consensus::VoteRequestPB* req,
       consensus::VoteResponsePB* resp,
@@ -139,11 +157,25 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
       consensus::GetConsensusStateResponsePB* resp,
       rpc::RpcContext* context) override;
 
+  virtual void FetchLogSegmentChunk(
+      const consensus::FetchLogSegmentChunkRequestPB* req,
+      consensus::FetchLogSegmentChunkResponsePB* resp,
+      rpc::RpcContext* context) override;
+
+  virtual void ReadIndex(
+      const consensus::ReadIndexRequestPB* req,
+      consensus::ReadIndexResponsePB* resp,
+      rpc::RpcContext* context) override;
+
  private:
   server::ServerBase* server_;
   TabletManagerIf& tablet_manager_;
 
   scoped_refptr<Counter> request_rpc_token_mismatches_;
+
+  // Limits the bytes of WAL segments served to replicas being rebuilt, over
+  // all of the rings on this server. Null if unlimited.
+  std::unique_ptr<Throttler> segment_copy_throttler_;
 };
 
 } // namespace tserver
@@ -17,6 +17,7 @@
 
 #include "kudu/tserver/simple_tablet_manager.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -50,6 +51,7 @@
 #include "kudu/consensus/persistent_vars_manager.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/startup_profile.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/fs/data_dirs.h"
 #include "kudu/fs/fs_manager.h"
@@ -74,6 +76,15 @@
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
+DEFINE_bool(
+    step_down_on_degraded_wal_dir,
+    false,
+    "Whether the leader steps down when a WAL directory of the server is "
+    "marked degraded by --fs_dir_degraded_p99_latency_ms, so that leadership "
+    "moves to a peer whose disk isn't slowing down the ring.");
+TAG_FLAG(step_down_on_degraded_wal_dir, experimental);
+TAG_FLAG(step_down_on_degraded_wal_dir, runtime);
+
 DECLARE_bool(enable_flexi_raft);
 
 using std::set;
@@ -90,6 +101,7 @@ using consensus::ConsensusMetadataManager;
 using consensus::ConsensusOptions;
 using consensus::ConsensusRound;
 using consensus::ConsensusStatePB;
+using consensus::LeaderStepDownResponsePB;
 using consensus::ITimeManager;
 using consensus::PeerProxyFactory;
 using consensus::PersistentVars;
@@ -98,6 +110,8 @@ using consensus::RaftConfigPB;
 using consensus::RaftConsensus;
 using consensus::RaftPeerPB;
 using consensus::RpcPeerProxyFactory;
+using consensus::ScopedStartupPhase;
+using consensus::StartupPhase;
 using consensus::TimeManager;
 using consensus::TimeManagerDummy;
 using log::Log;
@@ -400,12 +414,22 @@ Status TSTabletManager::Start(bool is_first_run) {
   // set_state(INITIALIZED);
   // SetStatusMessage("Initialized. Waiting to start...");
 
+  consensus::StartupProfile* profile = server_->startup_profile();
   scoped_refptr<ConsensusMetadata> cmeta;
-  Status s = cmeta_manager_->LoadCMeta(kSysCatalogTabletId, &cmeta);
+  Status s;
+  {
+    ScopedStartupPhase phase(
+        profile, StartupPhase::kCmetaLoad, kSysCatalogTabletId);
+    s = cmeta_manager_->LoadCMeta(kSysCatalogTabletId, &cmeta);
+  }
 
   scoped_refptr<PersistentVars> persistent_vars;
-  s = persistent_vars_manager_->LoadPersistentVars(
-      kSysCatalogTabletId, &persistent_vars);
+  {
+    ScopedStartupPhase phase(
+        profile, StartupPhase::kPersistentVarsLoad, kSysCatalogTabletId);
+    s = persistent_vars_manager_->LoadPersistentVars(
+        kSysCatalogTabletId, &persistent_vars);
+  }
 
   // We have already captured the ConsensusBootstrapInfo in SetupRaft
   // and saved it locally.
@@ -446,24 +470,59 @@ Status TSTabletManager::Start(bool is_first_run) {
   // before unlocking.
   std::shared_ptr<consensus::ConsensusBootstrapInfo> bootstrap_info =
       log_->GetRecoveryInfo();
-  RETURN_NOT_OK(consensus_->Start(
-      bootstrap_info,
-      std::move(peer_proxy_factory),
-      log_,
-      std::move(time_manager),
-      round_handler,
-      server_->metric_entity(),
-      mark_dirty_clbk_));
+  {
+    ScopedStartupPhase phase(
+        profile, StartupPhase::kRaftStart, kSysCatalogTabletId);
+    RETURN_NOT_OK(consensus_->Start(
+        bootstrap_info,
+        std::move(peer_proxy_factory),
+        log_,
+        std::move(time_manager),
+        round_handler,
+        server_->metric_entity(),
+        mark_dirty_clbk_));
+  }
 
   log_->ClearOrphanedReplicates();
 
-  RETURN_NOT_OK_PREPEND(
-      WaitUntilRunning(), "Failed waiting for the raft to run");
+  {
+    ScopedStartupPhase phase(
+        profile, StartupPhase::kWaitRunning, kSysCatalogTabletId);
+    RETURN_NOT_OK_PREPEND(
+        WaitUntilRunning(), "Failed waiting for the raft to run");
+  }
+
+  fs_manager_->SetErrorNotificationCb(
+      fs::ErrorHandlerType::DEGRADED_DIR,
+      Bind(&TSTabletManager::HandleDegradedDir, Unretained(this)));
 
   set_state(MANAGER_RUNNING);
   return Status::OK();
 }
 
+void TSTabletManager::HandleDegradedDir(const string& dir) {
+  if (!FLAGS_step_down_on_degraded_wal_dir) {
+    return;
+  }
+  const vector<string> wal_dirs = fs_manager_->GetWalStripeRootDirs();
+  if (std::find(wal_dirs.begin(), wal_dirs.end(), dir) == wal_dirs.end()) {
+    return;
+  }
+  std::shared_ptr<RaftConsensus> consensus =
+      shared_consensus(kSysCatalogTabletId);
+  if (!consensus || consensus->role() != RaftPeerPB::LEADER) {
+    return;
+  }
+  LOG_WITH_PREFIX(WARNING) << Substitute(
+      "Stepping down: WAL directory $0 is degraded", dir);
+  LeaderStepDownResponsePB resp;
+  Status s = consensus->StepDown(&resp);
+  if (s.ok() && resp.has_error()) {
+    s = StatusFromPB(resp.error().status());
+  }
+  WARN_NOT_OK(s, LogPrefix() + "Could not step down");
+}
+
 Status TSTabletManager::SetupRaft() {
   CHECK_EQ(state(), MANAGER_INITIALIZING);
 
@@ -483,6 +542,8 @@ Status TSTabletManager::SetupRaft() {
   ConsensusOptions options;
   options.tablet_id = kSysCatalogTabletId;
   options.proxy_policy = server_->opts().proxy_policy;
+  options.peer_send_pool = server_->raft_peer_send_pool();
+  options.startup_profile = server_->startup_profile();
   if (server_->opts().topology_config.has_initial_raft_rpc_token()) {
     options.initial_raft_rpc_token =
         server_->opts().topology_config.initial_raft_rpc_token();
@@ -512,6 +573,12 @@ Status TSTabletManager::SetupRaft() {
   if (server_->opts().ldcb) {
     consensus_->SetLeaderDetectedCallback(server_->opts().ldcb);
   }
+  if (server_->opts().sccb) {
+    consensus_->SetSnapshotCatchupCallback(server_->opts().sccb);
+  }
+  if (server_->opts().crcb) {
+    consensus_->SetCommittedRoundsCallback(server_->opts().crcb);
+  }
   if (server_->opts().disable_noop) {
     consensus_->DisableNoOpEntries();
   }
@@ -530,12 +597,20 @@ Status TSTabletManager::SetupRaft() {
   // Factory could be empty.
   LogOptions log_options;
   log_options.log_factory = server_->opts().log_factory;
-  Status s1 = Log::Open(
-      log_options,
-      fs_manager_,
-      kSysCatalogTabletId,
-      server_->metric_entity(),
-      &log_);
+  log_options.startup_profile = server_->startup_profile();
+  Status s1;
+  {
+    ScopedStartupPhase phase(
+        server_->startup_profile(),
+        StartupPhase::kLogOpen,
+        kSysCatalogTabletId);
+    s1 = Log::Open(
+        log_options,
+        fs_manager_,
+        kSysCatalogTabletId,
+        server_->metric_entity(),
+        &log_);
+  }
 
   // Abstracted logs will do their own log recovery
   // during Log::Open->Log::Init (virtual call). bootstrap_info
@@ -597,8 +672,13 @@ void TSTabletManager::Shutdown() {
     }
   }
 
-  if (consensus_)
+  fs_manager_->UnsetErrorNotificationCb(fs::ErrorHandlerType::DEGRADED_DIR);
+  if (consensus_) {
+    WARN_NOT_OK(
+        consensus_->HandOffLeadershipForShutdown(),
+        "Could not hand off leadership before shutting down");
     consensus_->Shutdown();
+  }
 
   state_ = MANAGER_SHUTDOWN;
 }
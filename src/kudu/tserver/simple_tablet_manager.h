@@ -80,6 +80,10 @@ class TabletManagerIf {
   virtual Status Start(bool is_first_run) = 0;
   virtual bool IsInitialized() const = 0;
   virtual void Shutdown() = 0;
+  // Notes that an RPC was just received from the server 'server_uuid'.
+  // Managers hosting many rings use this to detect the failure of a remote
+  // server once for all of the rings it takes part in.
+  virtual void RecordServerContact(const std::string& /*server_uuid*/) {}
   static Status CreateConfigFromTserverAddresses(
       const TabletServerOptions& options,
       KC::RaftConfigPB* new_config);
@@ -90,6 +94,9 @@ class TabletManagerIf {
 
 // Keeps track of the tablets hosted on the tablet server side.
 //
+// Hosts a single ring, kSysCatalogTabletId. RaftConsensusManager hosts many
+// rings in one process, sharing its reactors, pools and log cache budget.
+//
 // TODO(todd): will also be responsible for keeping the local metadata about
 // which tablets are hosted on this server persistent on disk, as well as
 // re-opening all the tablets at startup, etc.
@@ -137,8 +144,13 @@ class TSTabletManager : public TabletManagerIf,
   virtual Status StartConsensusOnlyRound(
       const scoped_refptr<consensus::ConsensusRound>& round) override;
 
+  // Returns null for any ring but ours, so that requests meant for another
+  // ring aren't applied to it. An empty 'id' means ours.
   std::shared_ptr<consensus::RaftConsensus> shared_consensus(
-      const std::string& /*id*/) const override {
+      const std::string& id) const override {
+    if (!id.empty() && id != kSysCatalogTabletId) {
+      return nullptr;
+    }
     shared_lock<RWMutex> l(lock_);
     return consensus_;
   }
@@ -192,6 +204,11 @@ class TSTabletManager : public TabletManagerIf,
   // running state.
   void InitLocalRaftPeerPB();
 
+  // Steps down if 'dir' is a WAL directory and this peer is the leader, with
+  // --step_down_on_degraded_wal_dir. Registered as the DEGRADED_DIR error
+  // notification callback.
+  void HandleDegradedDir(const std::string& dir);
+
   // Use the master options to generate a new consensus configuration.
   // In addition, resolve all UUIDs of this consensus configuration.
   Status CreateDistributedConfig(
@@ -156,6 +156,7 @@ Status TabletServer::Init() {
 
   // Initialize FS, rpc_server, rpc messenger and Raft pool
   RETURN_NOT_OK(KuduServer::Init());
+  startup_profile_.Record(consensus::StartupPhase::kFsOpen, "", fs_open_time_);
 
 #ifdef FB_DO_NOT_REMOVE
   if (web_server_) {
@@ -231,6 +232,7 @@ Status TabletServer::Start() {
   RETURN_NOT_OK_PREPEND(
       tablet_manager_->Start(is_first_run_),
       "Unable to start raft in tablet manager");
+  startup_profile_.Finish(metric_entity(), metric_registry());
   google::FlushLogFiles(google::INFO); // Flush the startup messages.
   return Status::OK();
 }
@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include "kudu/consensus/startup_profile.h"
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/kserver/kserver.h"
@@ -123,6 +124,11 @@ class TabletServer : public RaftConsensusServerIf {
     return opts_;
   }
 
+  // The time spent in each phase of startup. Finished by Start().
+  consensus::StartupProfile* startup_profile() {
+    return &startup_profile_;
+  }
+
 #ifdef FB_DO_NOT_REMOVE
   ScannerManager* scanner_manager() {
     return scanner_manager_.get();
@@ -167,6 +173,8 @@ class TabletServer : public RaftConsensusServerIf {
   // The options passed at construction time.
   const TabletServerOptions opts_;
 
+  consensus::StartupProfile startup_profile_;
+
   // Manager for tablets which are available on this server.
   std::unique_ptr<TabletManagerIf> tablet_manager_;
 
@@ -17,12 +17,15 @@
 #ifndef KUDU_TSERVER_TABLET_SERVER_OPTIONS_H
 #define KUDU_TSERVER_TABLET_SERVER_OPTIONS_H
 
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "kudu/consensus/leader_election.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/proxy_policy.h"
+#include "kudu/gutil/ref_counted.h"
 #include "kudu/server/server_base_options.h"
 #include "kudu/util/net/net_util.h"
 
@@ -31,6 +34,7 @@ namespace log {
 class LogFactory;
 }
 namespace consensus {
+class ConsensusRound;
 class ConsensusRoundHandler;
 class OpId;
 struct ElectionResult;
@@ -83,6 +87,14 @@ struct TabletServerOptions : public kudu::server::ServerBaseOptions {
   // Leader Detected Callback. This should eventually be reconciled
   // with NORCB.
   std::function<void(int64_t, const kudu::consensus::RaftPeerPB&)> ldcb;
+
+  // Snapshot Catch-up Callback, see RaftConsensus::SnapshotCatchupCallback.
+  std::function<void(const std::string&, int64_t, int64_t)> sccb;
+
+  // Committed Rounds Callback, see RaftConsensus::CommittedRoundsCallback.
+  std::function<void(
+      const std::vector<scoped_refptr<kudu::consensus::ConsensusRound>>&)>
+      crcb;
   bool disable_noop = false;
 
   // This is to enable a fresh instance join the ring with logs from
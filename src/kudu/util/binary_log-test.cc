@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/binary_log.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/logging_test_util.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(binary_log);
+DECLARE_int32(binary_log_ring_records);
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+
+class BinaryLogTest : public KuduTest {
+ protected:
+  // Logs 'count' events numbered from 'first'.
+  void LogEvents(int first, int count) {
+    for (int i = first; i < first + count; i++) {
+      KLOG_BINARY_WITH_PREFIX(INFO, "event $0 from $1", i, "test");
+    }
+  }
+
+  // Used by KLOG_BINARY_WITH_PREFIX() when --binary_log is off.
+  string LogPrefixUnlocked() const {
+    return "unlocked: ";
+  }
+
+  const std::shared_ptr<const string>& BinaryLogPrefix() const {
+    return prefix_;
+  }
+
+  const std::shared_ptr<const string> prefix_ =
+      std::make_shared<const string>("binary: ");
+};
+
+TEST_F(BinaryLogTest, TestDisabledLogsImmediately) {
+  StringVectorSink sink;
+  ScopedRegisterSink reg(&sink);
+  FLAGS_binary_log = false;
+  LogEvents(0, 1);
+  ASSERT_EQ(1, sink.logged_msgs().size());
+  ASSERT_STR_CONTAINS(sink.logged_msgs()[0], "unlocked: event 0 from test");
+}
+
+TEST_F(BinaryLogTest, TestRecordsAreWrittenOnFlush) {
+  FLAGS_binary_log = true;
+  StringVectorSink sink;
+  ScopedRegisterSink reg(&sink);
+  const int kThreads = 4;
+  const int kEventsPerThread = 10;
+  vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back(
+        [&, t]() { LogEvents(t * kEventsPerThread, kEventsPerThread); });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // The threads have exited; their records are still written.
+  BinaryLog::Flush();
+
+  ASSERT_EQ(kThreads * kEventsPerThread, sink.logged_msgs().size());
+  for (int i = 0; i < kThreads * kEventsPerThread; i++) {
+    const string expected =
+        "binary: event " + std::to_string(i) + " from test";
+    bool found = false;
+    for (const string& msg : sink.logged_msgs()) {
+      found |= msg.find(expected) != string::npos;
+    }
+    ASSERT_TRUE(found) << expected;
+  }
+}
+
+TEST_F(BinaryLogTest, TestFullRingDrops) {
+  FLAGS_binary_log = true;
+  FLAGS_binary_log_ring_records = 8;
+  StringVectorSink sink;
+  ScopedRegisterSink reg(&sink);
+  const int64_t dropped_before = BinaryLog::dropped_count();
+  // A new thread, so that its ring is sized by the flag above. The writer
+  // thread may drain part of the ring while this runs, so only some of the
+  // overflow is certain to be dropped.
+  std::thread t([&]() { LogEvents(0, 1000); });
+  t.join();
+  BinaryLog::Flush();
+  ASSERT_GT(BinaryLog::dropped_count(), dropped_before);
+  ASSERT_LT(sink.logged_msgs().size(), 1000);
+}
+
+} // namespace kudu
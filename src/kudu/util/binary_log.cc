@@ -0,0 +1,285 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/binary_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+
+DEFINE_bool(
+    binary_log,
+    false,
+    "Whether hot-path consensus log messages are recorded in per-thread "
+    "buffers and formatted and written by a background thread, instead of "
+    "being formatted and written by the thread that logs them.");
+TAG_FLAG(binary_log, experimental);
+TAG_FLAG(binary_log, runtime);
+
+DEFINE_int32(
+    binary_log_ring_records,
+    1024,
+    "Number of records each thread can buffer for --binary_log, rounded up "
+    "to a power of two. Records logged while the buffer is full are dropped. "
+    "Read when a thread first logs.");
+TAG_FLAG(binary_log_ring_records, experimental);
+
+DEFINE_int32(
+    binary_log_flush_interval_ms,
+    100,
+    "How often the --binary_log buffers are written out.");
+TAG_FLAG(binary_log_flush_interval_ms, experimental);
+TAG_FLAG(binary_log_flush_interval_ms, runtime);
+
+static bool ValidatePositive(const char* flagname, int32_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(binary_log_ring_records, &ValidatePositive);
+DEFINE_validator(binary_log_flush_interval_ms, &ValidatePositive);
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace kudu {
+
+namespace {
+
+struct Record {
+  const BinaryLogSite* site;
+  shared_ptr<const string> prefix;
+  int num_args;
+  bool is_string[BinaryLog::kMaxArgs];
+  int64_t ints[BinaryLog::kMaxArgs];
+  // Slots are reused, so after warm-up assigning a string argument does not
+  // allocate.
+  string strings[BinaryLog::kMaxArgs];
+};
+
+// A single-producer, single-consumer ring of records. The owning thread
+// appends; Drain() is called with g_drain_lock held.
+class Ring {
+ public:
+  explicit Ring(size_t capacity)
+      : records_(capacity), mask_(capacity - 1), head_(0), tail_(0) {}
+
+  // Returns false if the ring is full.
+  bool Append(
+      const BinaryLogSite* site,
+      const shared_ptr<const string>& prefix,
+      std::initializer_list<BinaryLogArg> args) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == records_.size()) {
+      return false;
+    }
+    Record* r = &records_[tail & mask_];
+    r->site = site;
+    r->prefix = prefix;
+    r->num_args = 0;
+    for (const BinaryLogArg& arg : args) {
+      DCHECK_LT(r->num_args, BinaryLog::kMaxArgs);
+      const int i = r->num_args++;
+      r->is_string[i] = arg.is_string();
+      if (arg.is_string()) {
+        arg.string_value().CopyToString(&r->strings[i]);
+      } else {
+        r->ints[i] = arg.int_value();
+      }
+    }
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Formats and writes every record appended so far.
+  void Drain() {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      Record* r = &records_[head & mask_];
+      Write(r);
+      r->prefix.reset();
+      head_.store(head + 1, std::memory_order_release);
+    }
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+        tail_.load(std::memory_order_acquire);
+  }
+
+  // Set when the owning thread exits; the ring is freed once drained.
+  std::atomic<bool> orphaned{false};
+
+ private:
+  static void Write(Record* r) {
+    for (int i = 0; i < r->num_args; i++) {
+      if (!r->is_string[i]) {
+        r->strings[i] = SimpleItoa(r->ints[i]);
+      }
+    }
+    const string* a = r->strings;
+    string message;
+    switch (r->num_args) {
+      case 0:
+        message = strings::Substitute(r->site->format);
+        break;
+      case 1:
+        message = strings::Substitute(r->site->format, a[0]);
+        break;
+      case 2:
+        message = strings::Substitute(r->site->format, a[0], a[1]);
+        break;
+      case 3:
+        message = strings::Substitute(r->site->format, a[0], a[1], a[2]);
+        break;
+      case 4:
+        message =
+            strings::Substitute(r->site->format, a[0], a[1], a[2], a[3]);
+        break;
+      case 5:
+        message = strings::Substitute(
+            r->site->format, a[0], a[1], a[2], a[3], a[4]);
+        break;
+      default:
+        message = strings::Substitute(
+            r->site->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+    }
+    google::LogMessage(r->site->file, r->site->line, r->site->severity)
+            .stream()
+        << *r->prefix << message;
+  }
+
+  vector<Record> records_;
+  const uint64_t mask_;
+  // Read position, advanced by the drainer.
+  std::atomic<uint64_t> head_;
+  // Write position, advanced by the owning thread.
+  std::atomic<uint64_t> tail_;
+};
+
+// Leaked, so that threads exiting during static destruction and the writer
+// thread never see them destroyed.
+std::mutex* g_rings_lock = new std::mutex();
+vector<shared_ptr<Ring>>* g_rings = new vector<shared_ptr<Ring>>();
+std::mutex* g_drain_lock = new std::mutex();
+std::once_flag g_writer_started;
+std::atomic<int64_t> g_dropped{0};
+
+// Owned by each logging thread; orphans its ring when the thread exits.
+struct ThreadRing {
+  shared_ptr<Ring> ring;
+
+  ~ThreadRing() {
+    if (ring) {
+      ring->orphaned.store(true, std::memory_order_release);
+    }
+  }
+};
+thread_local ThreadRing t_ring;
+
+void DrainAll() {
+  std::lock_guard<std::mutex> drain(*g_drain_lock);
+  vector<shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> l(*g_rings_lock);
+    rings = *g_rings;
+  }
+  bool any_orphaned = false;
+  for (const auto& ring : rings) {
+    ring->Drain();
+    any_orphaned |= ring->orphaned.load(std::memory_order_acquire);
+  }
+  if (any_orphaned) {
+    std::lock_guard<std::mutex> l(*g_rings_lock);
+    for (auto it = g_rings->begin(); it != g_rings->end();) {
+      // An orphaned ring gets no more records, so once empty it is done.
+      if ((*it)->orphaned.load(std::memory_order_acquire) && (*it)->empty()) {
+        it = g_rings->erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  static int64_t reported_dropped = 0;
+  const int64_t dropped = g_dropped.load(std::memory_order_relaxed);
+  if (dropped != reported_dropped) {
+    LOG(WARNING) << "Binary log dropped " << dropped - reported_dropped
+                 << " records because a thread's buffer was full; consider "
+                 << "raising --binary_log_ring_records";
+    reported_dropped = dropped;
+  }
+}
+
+void RunWriterThread() {
+  while (true) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_binary_log_flush_interval_ms));
+    DrainAll();
+  }
+}
+
+} // anonymous namespace
+
+bool BinaryLog::Enabled() {
+  return FLAGS_binary_log;
+}
+
+void BinaryLog::Append(
+    const BinaryLogSite* site,
+    const shared_ptr<const string>& prefix,
+    std::initializer_list<BinaryLogArg> args) {
+  DCHECK_LT(site->severity, google::GLOG_FATAL);
+  DCHECK_LE(args.size(), static_cast<size_t>(kMaxArgs));
+  if (PREDICT_FALSE(!t_ring.ring)) {
+    std::call_once(g_writer_started, []() {
+      std::thread(&RunWriterThread).detach();
+    });
+    const size_t capacity = static_cast<size_t>(1)
+        << Bits::Log2Ceiling(FLAGS_binary_log_ring_records);
+    t_ring.ring = std::make_shared<Ring>(capacity);
+    std::lock_guard<std::mutex> l(*g_rings_lock);
+    g_rings->push_back(t_ring.ring);
+  }
+  if (PREDICT_FALSE(!t_ring.ring->Append(site, prefix, args))) {
+    g_dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void BinaryLog::Flush() {
+  DrainAll();
+}
+
+int64_t BinaryLog::dropped_count() {
+  return g_dropped.load(std::memory_order_relaxed);
+}
+
+} // namespace kudu
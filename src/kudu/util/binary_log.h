@@ -0,0 +1,135 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_BINARY_LOG_H
+#define KUDU_UTIL_BINARY_LOG_H
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/stringpiece.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/logging.h"
+
+namespace kudu {
+
+// A call site of KLOG_BINARY_WITH_PREFIX().
+struct BinaryLogSite {
+  google::LogSeverity severity;
+  const char* file;
+  int line;
+  // A strings::Substitute() format with at most BinaryLog::kMaxArgs
+  // arguments.
+  const char* format;
+};
+
+// An argument to a binary log record: an integer or a string. Strings are
+// copied into the record, so the argument need only live for the call.
+class BinaryLogArg {
+ public:
+  template <
+      typename T,
+      typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  BinaryLogArg(T value) // NOLINT(runtime/explicit)
+      : is_string_(false), int_value_(static_cast<int64_t>(value)) {}
+
+  BinaryLogArg(const std::string& value) // NOLINT(runtime/explicit)
+      : is_string_(true), int_value_(0), string_value_(value) {}
+
+  BinaryLogArg(const char* value) // NOLINT(runtime/explicit)
+      : is_string_(true), int_value_(0), string_value_(value) {}
+
+  bool is_string() const {
+    return is_string_;
+  }
+  int64_t int_value() const {
+    return int_value_;
+  }
+  StringPiece string_value() const {
+    return string_value_;
+  }
+
+ private:
+  bool is_string_;
+  int64_t int_value_;
+  StringPiece string_value_;
+};
+
+// Structured, asynchronous logging for hot paths (the consensus request and
+// response paths), enabled by --binary_log.
+//
+// A record is the call site, a shared log prefix and up to kMaxArgs integer
+// or string arguments, copied into a fixed-size ring owned by the calling
+// thread. No formatting happens on the calling thread. A background thread
+// drains the rings every --binary_log_flush_interval_ms, formats each record
+// and writes it through glog, and from there through the AsyncLogger if
+// --log_async is set. If a thread's ring is full the record is dropped and
+// counted, rather than making the thread wait; the drops are reported in the
+// log.
+//
+// Since records are written after the fact, the glog timestamp of a record
+// is up to one flush interval later than the event, and records from
+// different threads may be interleaved out of order.
+class BinaryLog {
+ public:
+  static constexpr int kMaxArgs = 6;
+
+  // Returns true if --binary_log is set.
+  static bool Enabled();
+
+  // Appends a record to the calling thread's ring. 'site' must have static
+  // storage duration. 'prefix' is written before the formatted message.
+  static void Append(
+      const BinaryLogSite* site,
+      const std::shared_ptr<const std::string>& prefix,
+      std::initializer_list<BinaryLogArg> args);
+
+  // Formats and writes every record appended so far, on the calling thread.
+  static void Flush();
+
+  // Returns the number of records dropped because a ring was full.
+  static int64_t dropped_count();
+};
+
+} // namespace kudu
+
+// Like LOG_WITH_PREFIX_UNLOCKED(severity) << strings::Substitute(format,
+// ...), except that when --binary_log is set the message is recorded by
+// BinaryLog and formatted later on a background thread, prefixed with
+// BinaryLogPrefix() instead of LogPrefixUnlocked(). BinaryLogPrefix() must
+// be available in the current scope and return a
+// std::shared_ptr<const std::string>, built once by its owner. Not for
+// FATAL messages.
+#define KLOG_BINARY_WITH_PREFIX(severity, format, ...)                    \
+  do {                                                                    \
+    if (::kudu::BinaryLog::Enabled()) {                                   \
+      static const ::kudu::BinaryLogSite binary_log_site = {              \
+          google::GLOG_##severity, __FILE__, __LINE__, format};           \
+      ::kudu::BinaryLog::Append(                                          \
+          &binary_log_site, BinaryLogPrefix(), {__VA_ARGS__});            \
+    } else {                                                              \
+      LOG_WITH_PREFIX_UNLOCKED(severity)                                  \
+          << strings::Substitute(format, ##__VA_ARGS__);                  \
+    }                                                                     \
+  } while (0)
+
+#endif
@@ -210,6 +210,12 @@ class BlockingQueue {
     return list_.empty();
   }
 
+  // Returns the total logical size of the elements in the queue.
+  size_t size() const {
+    MutexLock l(lock_);
+    return size_;
+  }
+
   size_t max_size() const {
     return max_size_;
   }
@@ -68,7 +68,11 @@ struct BenchSetup {
     // vast majority of lookups.
     ZIPFIAN,
     // Every item is equally likely to be looked up.
-    UNIFORM
+    UNIFORM,
+    // Zipfian, except that every fourth lookup is of the next item of a
+    // sequential scan of items outside of the Zipfian ones, as a peer
+    // catching up from far behind does.
+    ZIPFIAN_SCAN
   };
   Pattern pattern;
 
@@ -78,6 +82,8 @@ struct BenchSetup {
   // in the cache.
   double dataset_cache_ratio;
 
+  CacheEvictionPolicy policy;
+
   string ToString() const {
     string ret;
     switch (pattern) {
@@ -87,7 +93,11 @@ struct BenchSetup {
       case Pattern::UNIFORM:
         ret += "UNIFORM";
         break;
+      case Pattern::ZIPFIAN_SCAN:
+        ret += "ZIPFIAN_SCAN";
+        break;
     }
+    ret += policy == SLRU_EVICTION ? " SLRU" : " LRU";
     ret += StringPrintf(
         " ratio=%.2fx n_unique=%d", dataset_cache_ratio, max_key());
     return ret;
@@ -106,7 +116,8 @@ class CacheBench : public KuduTest,
   void SetUp() override {
     KuduTest::SetUp();
 
-    cache_.reset(NewLRUCache(DRAM_CACHE, kCacheCapacity, "test-cache"));
+    cache_.reset(NewCache(
+        DRAM_CACHE, GetParam().policy, kCacheCapacity, "test-cache"));
   }
 
   // Run queries against the cache until '*done' becomes true.
@@ -116,9 +127,14 @@ class CacheBench : public KuduTest,
     Random r(GetRandomSeed32());
     int64_t lookups = 0;
     int64_t hits = 0;
+    // Each thread scans from a random key past the Zipfian ones.
+    uint32_t scan_key = setup.max_key() + r.Uniform(1 << 30);
     while (!*done) {
       uint32_t int_key;
-      if (setup.pattern == BenchSetup::Pattern::ZIPFIAN) {
+      if (setup.pattern == BenchSetup::Pattern::ZIPFIAN_SCAN &&
+          lookups % 4 == 3) {
+        int_key = scan_key++;
+      } else if (setup.pattern != BenchSetup::Pattern::UNIFORM) {
         int_key = r.Skewed(Bits::Log2Floor(setup.max_key()));
       } else {
         int_key = r.Uniform(setup.max_key());
@@ -168,15 +184,19 @@ class CacheBench : public KuduTest,
 };
 
 // Test both distributions, and for each, test both the case where the data
-// fits in the cache and where it is a bit larger.
+// fits in the cache and where it is a bit larger. Compare the eviction
+// policies on a scan mixed into a Zipfian working set.
 INSTANTIATE_TEST_CASE_P(
     Patterns,
     CacheBench,
     testing::ValuesIn(std::vector<BenchSetup>{
-        {BenchSetup::Pattern::ZIPFIAN, 1.0},
-        {BenchSetup::Pattern::ZIPFIAN, 3.0},
-        {BenchSetup::Pattern::UNIFORM, 1.0},
-        {BenchSetup::Pattern::UNIFORM, 3.0}}));
+        {BenchSetup::Pattern::ZIPFIAN, 1.0, LRU_EVICTION},
+        {BenchSetup::Pattern::ZIPFIAN, 3.0, LRU_EVICTION},
+        {BenchSetup::Pattern::UNIFORM, 1.0, LRU_EVICTION},
+        {BenchSetup::Pattern::UNIFORM, 3.0, LRU_EVICTION},
+        {BenchSetup::Pattern::ZIPFIAN, 3.0, SLRU_EVICTION},
+        {BenchSetup::Pattern::ZIPFIAN_SCAN, 0.5, LRU_EVICTION},
+        {BenchSetup::Pattern::ZIPFIAN_SCAN, 0.5, SLRU_EVICTION}}));
 
 TEST_P(CacheBench, RunBench) {
   const BenchSetup& setup = GetParam();
@@ -29,6 +29,7 @@
 DECLARE_string(nvm_cache_path);
 #endif // defined(__linux__)
 
+DECLARE_bool(cache_force_single_shard);
 DECLARE_double(cache_memtracker_approximation_ratio);
 
 namespace kudu {
@@ -218,6 +219,38 @@ TEST_P(CacheTest, EvictionPolicy) {
   ASSERT_EQ(-1, Lookup(200));
 }
 
+// Test that with segmented LRU eviction, a scan of entries which are never
+// looked up again doesn't evict the entries which are.
+TEST_P(CacheTest, ScanResistantEviction) {
+  if (GetParam() != DRAM_CACHE) {
+    LOG(INFO) << "Skipping test: only the DRAM cache supports SLRU eviction";
+    return;
+  }
+  // So that the hot entries aren't skewed towards some shard.
+  FLAGS_cache_force_single_shard = true;
+  cache_.reset(NewCache(DRAM_CACHE, SLRU_EVICTION, kCacheSize, "cache_test"));
+
+  const int kNumElems = 1000;
+  const int kSizePerElem = kCacheSize / kNumElems;
+  const int kNumHot = kNumElems / 10;
+  for (int i = 0; i < kNumHot; i++) {
+    Insert(i, 1000 + i, kSizePerElem);
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+
+  // Scan three times the capacity.
+  for (int i = 0; i < 3 * kNumElems; i++) {
+    Insert(kNumHot + i, kNumHot + i, kSizePerElem);
+  }
+  for (int i = 0; i < kNumHot; i++) {
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+  // The scan still cycles through the rest of the cache.
+  const int last = kNumHot + 3 * kNumElems - 1;
+  ASSERT_EQ(last, Lookup(last));
+  ASSERT_EQ(-1, Lookup(kNumHot));
+}
+
 TEST_P(CacheTest, HeavyEntries) {
   // Add a bunch of light and heavy entries and then count the combined
   // size of items still in the cache, which must be approximately the
@@ -68,6 +68,10 @@ typedef simple_spinlock MutexType;
 
 // LRU cache implementation
 
+// The share of the capacity of a segmented LRU cache which the protected
+// segment may take.
+constexpr double kProtectedSegmentRatio = 0.8;
+
 // An entry is a variable length heap-allocated structure.  Entries
 // are kept in a circular doubly linked list ordered by access time.
 struct LRUHandle {
@@ -80,6 +84,8 @@ struct LRUHandle {
   uint32_t val_length;
   std::atomic<int32_t> refs;
   uint32_t hash; // Hash of key(); used for fast sharding and comparisons
+  // Whether the entry is in the protected segment of a segmented LRU cache.
+  bool in_protected;
 
   // The storage for the key/value pair itself. The data is stored as:
   //   [key bytes ...] [padding up to 8-byte boundary] [value bytes ...]
@@ -195,12 +201,13 @@ class HandleTable {
 // A single shard of sharded cache.
 class LRUCache {
  public:
-  explicit LRUCache(MemTracker* tracker);
+  LRUCache(MemTracker* tracker, CacheEvictionPolicy policy);
   ~LRUCache();
 
   // Separate from constructor so caller can easily make an array of LRUCache
   void SetCapacity(size_t capacity) {
     capacity_ = capacity;
+    protected_capacity_ = capacity * kProtectedSegmentRatio;
     max_deferred_consumption_ =
         capacity * FLAGS_cache_memtracker_approximation_ratio;
   }
@@ -220,6 +227,9 @@ class LRUCache {
  private:
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* e);
+  // Make "e" the newest entry of the protected segment, demoting the oldest
+  // protected entries to the probationary segment while it is over capacity.
+  void LRU_Protect(LRUHandle* e);
   // Just reduce the reference count by 1.
   // Return true if last reference
   bool Unref(LRUHandle* e);
@@ -249,17 +259,27 @@ class LRUCache {
   // Positive delta indicates an increased memory consumption.
   void UpdateMemTracker(int64_t delta);
 
+  // Whether looked up entries are protected.
+  const bool segmented_;
+
   // Initialized before use.
   size_t capacity_;
+  size_t protected_capacity_;
 
   // mutex_ protects the following state.
   MutexType mutex_;
   size_t usage_;
+  // The part of 'usage_' in the protected segment.
+  size_t protected_usage_;
 
-  // Dummy head of LRU list.
+  // Dummy head of LRU list, the probationary segment if 'segmented_'.
   // lru.prev is newest entry, lru.next is oldest entry.
   LRUHandle lru_;
 
+  // Dummy head of the protected segment, ordered like 'lru_'. Empty unless
+  // 'segmented_'.
+  LRUHandle protected_;
+
   HandleTable table_;
 
   MemTracker* mem_tracker_;
@@ -272,22 +292,30 @@ class LRUCache {
   CacheMetrics* metrics_;
 };
 
-LRUCache::LRUCache(MemTracker* tracker)
-    : usage_(0), mem_tracker_(tracker), metrics_(nullptr) {
-  // Make empty circular linked list
+LRUCache::LRUCache(MemTracker* tracker, CacheEvictionPolicy policy)
+    : segmented_(policy == SLRU_EVICTION),
+      usage_(0),
+      protected_usage_(0),
+      mem_tracker_(tracker),
+      metrics_(nullptr) {
+  // Make empty circular linked lists
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  protected_.next = &protected_;
+  protected_.prev = &protected_;
 }
 
 LRUCache::~LRUCache() {
-  for (LRUHandle* e = lru_.next; e != &lru_;) {
-    LRUHandle* next = e->next;
-    DCHECK_EQ(e->refs.load(std::memory_order_relaxed), 1)
-        << "caller has an unreleased handle";
-    if (Unref(e)) {
-      FreeEntry(e);
+  for (LRUHandle* head : {&lru_, &protected_}) {
+    for (LRUHandle* e = head->next; e != head;) {
+      LRUHandle* next = e->next;
+      DCHECK_EQ(e->refs.load(std::memory_order_relaxed), 1)
+          << "caller has an unreleased handle";
+      if (Unref(e)) {
+        FreeEntry(e);
+      }
+      e = next;
     }
-    e = next;
   }
   mem_tracker_->Consume(deferred_consumption_);
 }
@@ -326,6 +354,9 @@ void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
   usage_ -= e->charge;
+  if (e->in_protected) {
+    protected_usage_ -= e->charge;
+  }
 }
 
 void LRUCache::LRU_Append(LRUHandle* e) {
@@ -334,9 +365,25 @@ void LRUCache::LRU_Append(LRUHandle* e) {
   e->prev = lru_.prev;
   e->prev->next = e;
   e->next->prev = e;
+  e->in_protected = false;
   usage_ += e->charge;
 }
 
+void LRUCache::LRU_Protect(LRUHandle* e) {
+  e->next = &protected_;
+  e->prev = protected_.prev;
+  e->prev->next = e;
+  e->next->prev = e;
+  e->in_protected = true;
+  usage_ += e->charge;
+  protected_usage_ += e->charge;
+  while (protected_usage_ > protected_capacity_ && protected_.next != e) {
+    LRUHandle* old = protected_.next;
+    LRU_Remove(old);
+    LRU_Append(old);
+  }
+}
+
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash, bool caching) {
   LRUHandle* e;
   {
@@ -345,7 +392,11 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash, bool caching) {
     if (e != nullptr) {
       e->refs.fetch_add(1, std::memory_order_relaxed);
       LRU_Remove(e);
-      LRU_Append(e);
+      if (segmented_) {
+        LRU_Protect(e);
+      } else {
+        LRU_Append(e);
+      }
     }
   }
 
@@ -408,8 +459,10 @@ Cache::Handle* LRUCache::Insert(
       }
     }
 
-    while (usage_ > capacity_ && lru_.next != &lru_) {
-      LRUHandle* old = lru_.next;
+    // The probationary entries go first.
+    while (usage_ > capacity_ &&
+           (lru_.next != &lru_ || protected_.next != &protected_)) {
+      LRUHandle* old = lru_.next != &lru_ ? lru_.next : protected_.next;
       LRU_Remove(old);
       table_.Remove(old->key(), old->hash);
       if (Unref(old)) {
@@ -483,7 +536,10 @@ class ShardedLRUCache : public Cache {
   }
 
  public:
-  explicit ShardedLRUCache(size_t capacity, const string& id)
+  ShardedLRUCache(
+      CacheEvictionPolicy policy,
+      size_t capacity,
+      const string& id)
       : shard_bits_(DetermineShardBits()) {
     // A cache is often a singleton, so:
     // 1. We reuse its MemTracker if one already exists, and
@@ -494,7 +550,7 @@ class ShardedLRUCache : public Cache {
     int num_shards = 1 << shard_bits_;
     const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
     for (int s = 0; s < num_shards; s++) {
-      unique_ptr<LRUCache> shard(new LRUCache(mem_tracker_.get()));
+      unique_ptr<LRUCache> shard(new LRUCache(mem_tracker_.get(), policy));
       shard->SetCapacity(per_shard);
       shards_.push_back(shard.release());
     }
@@ -575,11 +631,20 @@ class ShardedLRUCache : public Cache {
 } // end anonymous namespace
 
 Cache* NewLRUCache(CacheType type, size_t capacity, const string& id) {
+  return NewCache(type, LRU_EVICTION, capacity, id);
+}
+
+Cache* NewCache(
+    CacheType type,
+    CacheEvictionPolicy policy,
+    size_t capacity,
+    const string& id) {
   switch (type) {
     case DRAM_CACHE:
-      return new ShardedLRUCache(capacity, id);
+      return new ShardedLRUCache(policy, capacity, id);
 #if defined(HAVE_LIB_VMEM)
     case NVM_CACHE:
+      CHECK_EQ(LRU_EVICTION, policy) << "NVM cache only supports LRU eviction";
       return NewLRUNvmCache(capacity, id);
 #endif
     default:
@@ -33,10 +33,28 @@ class MetricEntity;
 
 enum CacheType { DRAM_CACHE, NVM_CACHE };
 
+enum CacheEvictionPolicy {
+  // Evict the least recently used entry.
+  LRU_EVICTION,
+  // Segmented LRU: entries are inserted into a probationary segment and only
+  // move to a protected segment, of most of the capacity, when looked up
+  // again. The least recently used probationary entry is evicted first, so a
+  // scan which looks each entry up once only displaces other probationary
+  // entries, not the working set. Only supported by DRAM_CACHE.
+  SLRU_EVICTION,
+};
+
 // Create a new cache with a fixed size capacity.  This implementation
 // of Cache uses a least-recently-used eviction policy.
 Cache* NewLRUCache(CacheType type, size_t capacity, const std::string& id);
 
+// Like NewLRUCache(), with the given eviction policy.
+Cache* NewCache(
+    CacheType type,
+    CacheEvictionPolicy policy,
+    size_t capacity,
+    const std::string& id);
+
 class Cache {
  public:
   // Callback interface which is called when an entry is evicted from the
@@ -3,6 +3,11 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "kudu/util/coding.h"
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
 #include "kudu/util/coding-inl.h"
 #include "kudu/util/faststring.h"
 
@@ -119,6 +124,128 @@ bool GetVarint64(Slice* input, uint64_t* value) {
   }
 }
 
+#ifdef __SSE4_1__
+namespace {
+
+// The number of one-byte varints at the start of the 16 'bytes'.
+int OneByteVarintRun(__m128i bytes) {
+  return __builtin_ctz(_mm_movemask_epi8(bytes) | 0x10000);
+}
+
+} // anonymous namespace
+#endif
+
+const uint8_t* GetVarint32Batch(
+    const uint8_t* p,
+    const uint8_t* limit,
+    uint32_t* values,
+    size_t n) {
+  size_t i = 0;
+  while (i < n) {
+#ifdef __SSE4_1__
+    if (n - i >= 16 && limit - p >= 16) {
+      const __m128i bytes =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const int run = OneByteVarintRun(bytes);
+      if (run > 0) {
+        // Widen all 16 bytes; those past the run are overwritten later.
+        __m128i* dst = reinterpret_cast<__m128i*>(values + i);
+        _mm_storeu_si128(dst, _mm_cvtepu8_epi32(bytes));
+        _mm_storeu_si128(dst + 1, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)));
+        _mm_storeu_si128(dst + 2, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+        _mm_storeu_si128(
+            dst + 3, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12)));
+        i += run;
+        p += run;
+        continue;
+      }
+    }
+#endif
+    p = GetVarint32Ptr(p, limit, &values[i]);
+    if (p == nullptr) {
+      return nullptr;
+    }
+    i++;
+  }
+  return p;
+}
+
+const uint8_t* GetVarint64Batch(
+    const uint8_t* p,
+    const uint8_t* limit,
+    uint64_t* values,
+    size_t n) {
+  size_t i = 0;
+  while (i < n) {
+#ifdef __SSE4_1__
+    if (n - i >= 16 && limit - p >= 16) {
+      const __m128i bytes =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const int run = OneByteVarintRun(bytes);
+      if (run > 0) {
+        // Widen all 16 bytes; those past the run are overwritten later.
+        __m128i* dst = reinterpret_cast<__m128i*>(values + i);
+        _mm_storeu_si128(dst, _mm_cvtepu8_epi64(bytes));
+        _mm_storeu_si128(dst + 1, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 2)));
+        _mm_storeu_si128(dst + 2, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 4)));
+        _mm_storeu_si128(dst + 3, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 6)));
+        _mm_storeu_si128(dst + 4, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 8)));
+        _mm_storeu_si128(
+            dst + 5, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 10)));
+        _mm_storeu_si128(
+            dst + 6, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 12)));
+        _mm_storeu_si128(
+            dst + 7, _mm_cvtepu8_epi64(_mm_srli_si128(bytes, 14)));
+        i += run;
+        p += run;
+        continue;
+      }
+    }
+#endif
+    p = GetVarint64Ptr(p, limit, &values[i]);
+    if (p == nullptr) {
+      return nullptr;
+    }
+    i++;
+  }
+  return p;
+}
+
+void PutVarint32Batch(faststring* dst, const uint32_t* values, size_t n) {
+  const size_t old_size = dst->size();
+  dst->resize(old_size + n * 5);
+  uint8_t* ptr = dst->data() + old_size;
+  size_t i = 0;
+#ifdef __SSE4_1__
+  const __m128i high_bits = _mm_set1_epi32(~0x7f);
+  while (n - i >= 16) {
+    const __m128i* src = reinterpret_cast<const __m128i*>(values + i);
+    const __m128i v0 = _mm_loadu_si128(src);
+    const __m128i v1 = _mm_loadu_si128(src + 1);
+    const __m128i v2 = _mm_loadu_si128(src + 2);
+    const __m128i v3 = _mm_loadu_si128(src + 3);
+    const __m128i all =
+        _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3));
+    if (_mm_testz_si128(all, high_bits)) {
+      // All 16 values fit in a byte: narrow them.
+      const __m128i bytes = _mm_packus_epi16(
+          _mm_packus_epi32(v0, v1), _mm_packus_epi32(v2, v3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), bytes);
+      ptr += 16;
+      i += 16;
+      continue;
+    }
+    for (const size_t end = i + 16; i < end; i++) {
+      ptr = InlineEncodeVarint32(ptr, values[i]);
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    ptr = InlineEncodeVarint32(ptr, values[i]);
+  }
+  dst->resize(ptr - dst->data());
+}
+
 const uint8_t*
 GetLengthPrefixedSlice(const uint8_t* p, const uint8_t* limit, Slice* result) {
   uint32_t len = 0;
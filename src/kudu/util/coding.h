@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
@@ -48,6 +49,27 @@ GetVarint32Ptr(const uint8_t* p, const uint8_t* limit, uint32_t* v);
 extern const uint8_t*
 GetVarint64Ptr(const uint8_t* p, const uint8_t* limit, uint64_t* v);
 
+// Batch variants of GetVarint32Ptr() and GetVarint64Ptr(), which decode 'n'
+// consecutive varints into 'values'. Return a pointer just past the last
+// parsed value, or NULL on error. Runs of one-byte varints, as for small
+// counts, deltas and enums, are decoded 16 at a time with SIMD where the
+// CPU supports it.
+extern const uint8_t* GetVarint32Batch(
+    const uint8_t* p,
+    const uint8_t* limit,
+    uint32_t* values,
+    size_t n);
+extern const uint8_t* GetVarint64Batch(
+    const uint8_t* p,
+    const uint8_t* limit,
+    uint64_t* values,
+    size_t n);
+
+// Batch variant of PutVarint32(), which appends the varints of the 'n'
+// 'values' with a single resize of 'dst'. Like GetVarint32Batch(), it
+// encodes runs of values below 128 16 at a time with SIMD.
+extern void PutVarint32Batch(faststring* dst, const uint32_t* values, size_t n);
+
 // Returns the length of the varint32 or varint64 encoding of "v"
 extern int VarintLength(uint64_t v);
 
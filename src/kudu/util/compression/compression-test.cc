@@ -18,12 +18,19 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/compression/compression_dict_trainer.h"
+#include "kudu/util/compression/compression_policy.h"
+#include "kudu/util/random.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -90,4 +97,197 @@ TEST_F(TestCompression, TestZlibCompressionCodec) {
   TestCompressionCodec(ZLIB);
 }
 
+// Codecs handed out by a manager are never reconfigured, and managers share
+// no state.
+TEST_F(TestCompression, TestCodecManagerPublishesNewCodecs) {
+  CompressionCodecManager manager;
+  CompressionCodecManager other;
+  ASSERT_EQ(nullptr, manager.GetCurrentCodec());
+
+  ASSERT_OK(manager.SetCurrentCodec(ZSTD));
+  auto zstd = manager.GetCurrentCodec();
+  ASSERT_EQ(ZSTD, zstd->type());
+  ASSERT_EQ(nullptr, other.GetCurrentCodec());
+
+  ASSERT_OK(manager.SetCurrentCompressionLevel(3));
+  ASSERT_NE(zstd, manager.GetCurrentCodec());
+  ASSERT_EQ(3, manager.GetCurrentCodec()->CompressionLevel());
+  ASSERT_EQ(0, zstd->CompressionLevel());
+
+  // Decoding a message switches the ring to the codec of the message.
+  std::shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(manager.GetCodecForMessage(LZ4, Slice(), &codec));
+  ASSERT_EQ(LZ4, codec->type());
+  ASSERT_EQ(codec, manager.GetCurrentCodec());
+  ASSERT_EQ(3, codec->CompressionLevel());
+}
+
+// Builds a payload shaped like a small binlog row event.
+static std::string MakeRowPayload(Random* rng, int row) {
+  return strings::Substitute(
+      "{\"table\":\"users\",\"op\":\"update\",\"id\":$0,"
+      "\"name\":\"user_$1\",\"email\":\"user_$1@example.com\","
+      "\"score\":$2}",
+      row,
+      rng->Uniform(100000),
+      rng->Uniform(1000));
+}
+
+// Payloads compressed with a previous dictionary stay readable after the
+// dictionary is rotated.
+TEST_F(TestCompression, TestTrainedDictionaryRotation) {
+  CompressionDictTrainer::Options opts;
+  opts.sample_every = 1;
+  opts.min_samples = 500;
+  opts.dict_size = 4 * 1024;
+  CompressionDictTrainer trainer(opts);
+  Random rng(SeedRandom());
+
+  std::string dict;
+  ASSERT_TRUE(trainer.Train(&dict).IsIncomplete());
+  for (int i = 0; i < 2000; i++) {
+    trainer.AddSample(Slice(MakeRowPayload(&rng, i)));
+  }
+  ASSERT_OK(trainer.Train(&dict));
+  ASSERT_NE(0, CompressionCodecManager::GetDictionaryID(dict));
+
+  CompressionCodecManager manager;
+  ASSERT_OK(manager.SetCurrentCodec(ZSTD_DICT));
+  ASSERT_OK(manager.SetDictionary(dict));
+  auto old_codec = manager.GetCurrentCodec();
+
+  const std::string payload = MakeRowPayload(&rng, 1);
+  std::string compressed;
+  compressed.resize(old_codec->MaxCompressedLength(payload.size()));
+  size_t compressed_len;
+  ASSERT_OK(old_codec->Compress(
+      Slice(payload),
+      reinterpret_cast<uint8_t*>(&compressed[0]),
+      &compressed_len));
+  compressed.resize(compressed_len);
+
+  // Rotate to a dictionary trained on other payloads.
+  for (int i = 0; i < 2000; i++) {
+    trainer.AddSample(Slice(strings::Substitute(
+        "{\"table\":\"orders\",\"order_id\":$0,\"amount\":$1}",
+        i,
+        rng.Uniform(10000))));
+  }
+  std::string new_dict;
+  ASSERT_OK(trainer.Train(&new_dict));
+  ASSERT_NE(
+      CompressionCodecManager::GetDictionaryID(dict),
+      CompressionCodecManager::GetDictionaryID(new_dict));
+  ASSERT_OK(manager.SetDictionary(new_dict));
+  ASSERT_NE(old_codec, manager.GetCurrentCodec());
+
+  std::shared_ptr<CompressionCodec> codec;
+  ASSERT_OK(manager.GetCodecForMessage(ZSTD_DICT, Slice(compressed), &codec));
+  ASSERT_EQ(old_codec->DictionaryID(), codec->DictionaryID());
+  std::string uncompressed(payload.size(), '\0');
+  ASSERT_OK(codec->Uncompress(
+      Slice(compressed),
+      reinterpret_cast<uint8_t*>(&uncompressed[0]),
+      uncompressed.size()));
+  ASSERT_EQ(payload, uncompressed);
+
+  // The current dictionary alone cannot read it.
+  ASSERT_TRUE(manager.GetCurrentCodec()
+                  ->Uncompress(
+                      Slice(compressed),
+                      reinterpret_cast<uint8_t*>(&uncompressed[0]),
+                      uncompressed.size())
+                  .IsCompressionDictMismatch());
+}
+
+static void CompressWithCodec(
+    const std::shared_ptr<CompressionCodec>& codec,
+    const std::string& data) {
+  std::unique_ptr<uint8_t[]> cbuffer(
+      new uint8_t[codec->MaxCompressedLength(data.size())]);
+  size_t compressed;
+  ASSERT_OK(codec->CompressWithStats(Slice(data), cbuffer.get(), &compressed));
+}
+
+TEST_F(TestCompression, TestAdaptiveCompressionPolicy) {
+  AdaptiveCompressionPolicy::Options opts;
+  opts.min_sample_bytes = 64 * 1024;
+  opts.probe_after_evaluations = 2;
+  AdaptiveCompressionPolicy policy(opts);
+  const std::string compressible(128 * 1024, 'a');
+  std::string incompressible(128 * 1024, '\0');
+  Random rng(1);
+  for (char& c : incompressible) {
+    c = static_cast<char>(rng.Next());
+  }
+
+  // A ring within one region favors speed.
+  std::shared_ptr<CompressionCodec> zstd;
+  ASSERT_OK(CompressionCodecManager::GetCodec(ZSTD, &zstd));
+  NO_FATALS(CompressWithCodec(zstd, compressible));
+  auto choice = policy.Evaluate(
+      zstd, /*cross_region=*/false, /*has_dictionary=*/false);
+  ASSERT_EQ(LZ4, choice.type);
+
+  // Nothing new was compressed, so there is no reason to change.
+  choice = policy.Evaluate(zstd, /*cross_region=*/true, false);
+  ASSERT_EQ(ZSTD, choice.type);
+  ASSERT_EQ(zstd->CompressionLevel(), choice.level);
+
+  // A ring across regions favors ratio, with the dictionary if it has one.
+  std::shared_ptr<CompressionCodec> lz4;
+  ASSERT_OK(CompressionCodecManager::GetCodec(LZ4, &lz4));
+  NO_FATALS(CompressWithCodec(lz4, compressible));
+  choice = policy.Evaluate(lz4, /*cross_region=*/true, false);
+  ASSERT_EQ(ZSTD, choice.type);
+  ASSERT_EQ(opts.min_zstd_level, choice.level);
+  NO_FATALS(CompressWithCodec(lz4, compressible));
+  choice = policy.Evaluate(lz4, /*cross_region=*/true, true);
+  ASSERT_EQ(ZSTD_DICT, choice.type);
+
+  // Incompressible payloads turn compression off, until it is retried.
+  NO_FATALS(CompressWithCodec(lz4, incompressible));
+  choice = policy.Evaluate(lz4, /*cross_region=*/true, false);
+  ASSERT_EQ(NO_COMPRESSION, choice.type);
+  choice = policy.Evaluate(nullptr, /*cross_region=*/true, false);
+  ASSERT_EQ(NO_COMPRESSION, choice.type);
+  choice = policy.Evaluate(nullptr, /*cross_region=*/true, false);
+  ASSERT_EQ(ZSTD, choice.type);
+}
+
+// One codec can be used by several threads at once.
+TEST_F(TestCompression, TestConcurrentUseOfCodec) {
+  const int kInputSize = 4096;
+  const int kNumThreads = 8;
+  const int kIterations = 100;
+
+  for (CompressionType type : {LZ4_DICT, ZSTD}) {
+    SCOPED_TRACE(CompressionType_Name(type));
+    CompressionCodecManager manager;
+    ASSERT_OK(manager.SetCurrentCodec(type));
+    std::shared_ptr<CompressionCodec> codec = manager.GetCurrentCodec();
+
+    vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; t++) {
+      threads.emplace_back([&, t]() {
+        vector<uint8_t> input(kInputSize, 'a' + t);
+        vector<uint8_t> output(kInputSize);
+        std::unique_ptr<uint8_t[]> cbuffer(
+            new uint8_t[codec->MaxCompressedLength(kInputSize)]);
+        for (int i = 0; i < kIterations; i++) {
+          size_t compressed;
+          CHECK_OK(codec->CompressWithStats(
+              Slice(input.data(), kInputSize), cbuffer.get(), &compressed));
+          CHECK_OK(codec->UncompressWithStats(
+              Slice(cbuffer.get(), compressed), output.data(), kInputSize));
+          CHECK(input == output);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+}
+
 } // namespace kudu
@@ -22,6 +22,7 @@
 #include "kudu/util/compression/compression_codec.h"
 
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -52,6 +53,11 @@ CompressionCodec::CompressionCodec() {}
 
 CompressionCodec::~CompressionCodec() {}
 
+namespace {
+// The number of previous dictionaries kept by CompressionCodecManager.
+constexpr size_t kMaxRetiredDictCodecs = 4;
+} // anonymous namespace
+
 std::string CompressionCodec::Stats() const {
   try {
     std::ostringstream s;
@@ -68,28 +74,31 @@ std::string CompressionCodec::Stats() const {
     jw.Int(compression_level_);
 
     jw.String("total_bytes_before_compression");
-    jw.Int64(total_bytes_before_compression_);
+    jw.Int64(total_bytes_before_compression_.load());
 
     jw.String("total_bytes_after_compression");
-    jw.Int64(total_bytes_after_compression_);
+    jw.Int64(total_bytes_after_compression_.load());
 
     jw.String("total_compressions");
-    jw.Int64(total_compressions_);
+    jw.Int64(total_compressions_.load());
+
+    jw.String("total_compression_micros");
+    jw.Int64(total_compression_micros_.load());
 
     jw.String("total_bytes_before_decompression");
-    jw.Int64(total_bytes_before_decompression_);
+    jw.Int64(total_bytes_before_decompression_.load());
 
     jw.String("total_bytes_after_decompression");
-    jw.Int64(total_bytes_after_decompression_);
+    jw.Int64(total_bytes_after_decompression_.load());
 
     jw.String("total_decompressions");
-    jw.Int64(total_decompressions_);
+    jw.Int64(total_decompressions_.load());
 
     jw.String("total_compression_errors");
-    jw.Int64(total_compression_errors_);
+    jw.Int64(total_compression_errors_.load());
 
     jw.String("total_decompression_errors");
-    jw.Int64(total_decompression_errors_);
+    jw.Int64(total_decompression_errors_.load());
 
     jw.EndObject();
     return s.str();
@@ -275,6 +284,67 @@ class Lz4Codec : public CompressionCodec {
   }
 };
 
+/**
+ * Process wide pool of LZ4F contexts, the LZ4 counterpart of the folly pools
+ * used for ZSTD contexts. Each call borrows a context for its duration, so
+ * concurrent calls never share one and contexts are reused across codecs.
+ */
+template <typename Ctx>
+class Lz4fContextPool {
+ public:
+  typedef LZ4F_errorCode_t (*CreateFn)(Ctx**, unsigned);
+  typedef LZ4F_errorCode_t (*FreeFn)(Ctx*);
+
+  Lz4fContextPool(CreateFn create_fn, FreeFn free_fn)
+      : create_fn_(create_fn), free_fn_(free_fn) {}
+
+  ~Lz4fContextPool() {
+    for (Ctx* ctx : free_ctxs_) {
+      free_fn_(ctx);
+    }
+  }
+
+  // Returns nullptr if a new context could not be created.
+  Ctx* Borrow() {
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      if (!free_ctxs_.empty()) {
+        Ctx* ctx = free_ctxs_.back();
+        free_ctxs_.pop_back();
+        return ctx;
+      }
+    }
+    Ctx* ctx = nullptr;
+    if (LZ4F_isError(create_fn_(&ctx, LZ4F_VERSION))) {
+      return nullptr;
+    }
+    return ctx;
+  }
+
+  void Return(Ctx* ctx) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    free_ctxs_.push_back(ctx);
+  }
+
+ private:
+  const CreateFn create_fn_;
+  const FreeFn free_fn_;
+  simple_spinlock lock_;
+  std::vector<Ctx*> free_ctxs_;
+};
+
+Lz4fContextPool<LZ4F_cctx>* Lz4fCCtxPool() {
+  static auto* pool = new Lz4fContextPool<LZ4F_cctx>(
+      LZ4F_createCompressionContext, LZ4F_freeCompressionContext);
+  return pool;
+}
+
+Lz4fContextPool<LZ4F_dctx>* Lz4fDCtxPool() {
+  static auto* pool = new Lz4fContextPool<LZ4F_dctx>(
+      LZ4F_createDecompressionContext, LZ4F_freeDecompressionContext);
+  return pool;
+}
+
 class Lz4DictCodec : public CompressionCodec {
  public:
   Lz4DictCodec() {
@@ -282,8 +352,6 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
   ~Lz4DictCodec() {
-    LZ4F_freeCompressionContext(compression_ctx_);
-    LZ4F_freeDecompressionContext(decompression_ctx_);
     LZ4F_freeCDict(dict_ctx_);
   }
 
@@ -291,20 +359,21 @@ class Lz4DictCodec : public CompressionCodec {
       const Slice& input,
       uint8_t* compressed,
       size_t* compressed_length) override {
-    if (!compression_ctx_ &&
-        LZ4F_createCompressionContext(&compression_ctx_, LZ4F_VERSION)) {
+    LZ4F_cctx* const compression_ctx = Lz4fCCtxPool()->Borrow();
+    if (!compression_ctx) {
       return Status::RuntimeError("Could not create LZ4 compression context");
     }
+    SCOPED_CLEANUP({ Lz4fCCtxPool()->Return(compression_ctx); });
 
     const size_t max_comp_size = MaxCompressedLength(input.size());
 
     LZ4F_preferences_t prefs{};
     prefs.compressionLevel = compression_level_;
-    prefs.frameInfo.dictID = CompressionCodecManager::GetDictionaryID(dict_);
+    prefs.frameInfo.dictID = dict_id_;
     prefs.frameInfo.contentSize = input.size();
 
     size_t ret = LZ4F_compressFrame_usingCDict(
-        compression_ctx_,
+        compression_ctx,
         compressed,
         max_comp_size,
         input.data(),
@@ -340,27 +409,25 @@ class Lz4DictCodec : public CompressionCodec {
       const Slice& compressed,
       uint8_t* uncompressed,
       size_t uncompressed_length) override {
-    if (!decompression_ctx_ &&
-        LZ4F_createDecompressionContext(&decompression_ctx_, LZ4F_VERSION)) {
+    LZ4F_dctx* const decompression_ctx = Lz4fDCtxPool()->Borrow();
+    if (!decompression_ctx) {
       return Status::RuntimeError("Could not create LZ4 decompression context");
     }
+    SCOPED_CLEANUP({ Lz4fDCtxPool()->Return(decompression_ctx); });
 
     size_t frame_info_size = compressed.size();
 
     LZ4F_frameInfo_t frame_info;
     size_t ret = LZ4F_getFrameInfo(
-        decompression_ctx_, &frame_info, compressed.data(), &frame_info_size);
+        decompression_ctx, &frame_info, compressed.data(), &frame_info_size);
     if (LZ4F_isError(ret)) {
-      LZ4F_resetDecompressionContext(decompression_ctx_);
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::Corruption(strings::Substitute(
           "Could not extract LZ4 frame info: $0", LZ4F_getErrorName(ret)));
     }
 
-    const unsigned actual_dict_id = frame_info.dictID;
-    const unsigned expected_dict_id =
-        CompressionCodecManager::GetDictionaryID(dict_);
-
-    if (expected_dict_id != actual_dict_id) {
+    if (frame_info.dictID != dict_id_) {
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::CompressionDictMismatch("Dictionary ID mismatch");
     }
 
@@ -372,7 +439,7 @@ class Lz4DictCodec : public CompressionCodec {
     const uint8_t* compressed_buf = compressed.data() + frame_info_size;
 
     ret = LZ4F_decompress_usingDict(
-        decompression_ctx_,
+        decompression_ctx,
         uncompressed,
         &uncompressed_length,
         compressed_buf,
@@ -381,7 +448,7 @@ class Lz4DictCodec : public CompressionCodec {
         dict_.size(),
         &opts);
     if (LZ4F_isError(ret)) {
-      LZ4F_resetDecompressionContext(decompression_ctx_);
+      LZ4F_resetDecompressionContext(decompression_ctx);
       return Status::Corruption(strings::Substitute(
           "Unable to decompress the buffer: $0", LZ4F_getErrorName(ret)));
     }
@@ -394,7 +461,9 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
   Status SetDictionary(const std::string& dict) override {
+    LZ4F_freeCDict(dict_ctx_);
     dict_ = dict;
+    dict_id_ = CompressionCodecManager::GetDictionaryID(dict_);
     dict_ctx_ = LZ4F_createCDict(dict_.data(), dict_.size());
     return Status::OK();
   }
@@ -403,6 +472,26 @@ class Lz4DictCodec : public CompressionCodec {
     return dict_;
   }
 
+  unsigned int DictionaryID() const override {
+    return dict_id_;
+  }
+
+  unsigned int FrameDictionaryID(const Slice& compressed) const override {
+    LZ4F_dctx* const decompression_ctx = Lz4fDCtxPool()->Borrow();
+    if (!decompression_ctx) {
+      return 0;
+    }
+    SCOPED_CLEANUP({
+      LZ4F_resetDecompressionContext(decompression_ctx);
+      Lz4fDCtxPool()->Return(decompression_ctx);
+    });
+    size_t frame_info_size = compressed.size();
+    LZ4F_frameInfo_t frame_info;
+    size_t ret = LZ4F_getFrameInfo(
+        decompression_ctx, &frame_info, compressed.data(), &frame_info_size);
+    return LZ4F_isError(ret) ? 0 : frame_info.dictID;
+  }
+
   Status SetCompressionLevel(int level) override {
     if (level < 0) {
       const std::string& msg = strings::Substitute(
@@ -419,11 +508,9 @@ class Lz4DictCodec : public CompressionCodec {
   }
 
  private:
-  LZ4F_cctx* compression_ctx_ = nullptr;
-  LZ4F_dctx* decompression_ctx_ = nullptr;
-
   LZ4F_CDict* dict_ctx_ = nullptr;
   std::string dict_;
+  unsigned int dict_id_ = 0;
 };
 
 /**
@@ -630,12 +717,7 @@ class ZstdDictCodec : public CompressionCodec {
       return Status::CompressionDictMismatch("Compression dictionary is empty");
     }
 
-    const unsigned expected_dict_id =
-        CompressionCodecManager::GetDictionaryID(dict_);
-    const unsigned actual_dict_id =
-        ZSTD_getDictID_fromFrame(compressed.data(), compressed.size());
-
-    if (expected_dict_id != actual_dict_id) {
+    if (FrameDictionaryID(compressed) != dict_id_) {
       return Status::CompressionDictMismatch("Dictionary ID mismatch");
     }
 
@@ -666,6 +748,7 @@ class ZstdDictCodec : public CompressionCodec {
     ZSTD_freeDDict(decompression_dict_);
 
     dict_.clear();
+    dict_id_ = 0;
     compression_dict_ = nullptr;
     decompression_dict_ = nullptr;
 
@@ -678,6 +761,7 @@ class ZstdDictCodec : public CompressionCodec {
     }
 
     dict_ = dict;
+    dict_id_ = CompressionCodecManager::GetDictionaryID(dict_);
     return Status::OK();
   }
 
@@ -685,6 +769,14 @@ class ZstdDictCodec : public CompressionCodec {
     return dict_;
   }
 
+  unsigned int DictionaryID() const override {
+    return dict_id_;
+  }
+
+  unsigned int FrameDictionaryID(const Slice& compressed) const override {
+    return ZSTD_getDictID_fromFrame(compressed.data(), compressed.size());
+  }
+
   Status SetCompressionLevel(int level) override {
     if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) {
       const std::string& msg = strings::Substitute(
@@ -703,15 +795,12 @@ class ZstdDictCodec : public CompressionCodec {
 
  private:
   std::string dict_;
+  unsigned int dict_id_ = 0;
 
   ZSTD_CDict* compression_dict_ = nullptr;
   ZSTD_DDict* decompression_dict_ = nullptr;
 };
 
-std::string CompressionCodecManager::dictionary_;
-std::shared_ptr<CompressionCodec> CompressionCodecManager::codec_;
-int CompressionCodecManager::level_;
-
 Status CompressionCodecManager::GetCodec(
     CompressionType type,
     std::shared_ptr<CompressionCodec>* codec) {
@@ -743,41 +832,114 @@ Status CompressionCodecManager::GetCodec(
   return Status::OK();
 }
 
+Status CompressionCodecManager::BuildCodec(
+    CompressionType type,
+    const std::string& dict,
+    int level,
+    std::shared_ptr<CompressionCodec>* codec) {
+  RETURN_NOT_OK(GetCodec(type, codec));
+  if (*codec) {
+    RETURN_NOT_OK((*codec)->SetDictionary(dict));
+    RETURN_NOT_OK((*codec)->SetCompressionLevel(level));
+  }
+  return Status::OK();
+}
+
 Status CompressionCodecManager::SetCurrentCodec(CompressionType type) {
-  if (codec_ && type == codec_->type()) {
-    return Status::OK();
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  return SetCurrentCodecUnlocked(type);
+}
+
+Status CompressionCodecManager::SetCurrentCodecUnlocked(CompressionType type) {
+  std::string dict;
+  int level;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (codec_ && type == codec_->type()) {
+      return Status::OK();
+    }
+    dict = dictionary_;
+    level = level_;
   }
   std::shared_ptr<CompressionCodec> codec = nullptr;
   // codec can be nullptr if type = NO_COMPRESSION
   RETURN_NOT_OK(GetCodec(type, &codec));
   if (codec) {
-    RETURN_NOT_OK(codec->SetDictionary(dictionary_));
-    if (!codec->SetCompressionLevel(level_).ok()) {
+    RETURN_NOT_OK(codec->SetDictionary(dict));
+    if (!codec->SetCompressionLevel(level).ok()) {
       int codec_level = codec->CompressionLevel();
-      LOG(WARNING) << "Could not set compression level to " << level_ << ". "
+      LOG(WARNING) << "Could not set compression level to " << level << ". "
                    << "Using the default compression level " << codec_level
                    << " instead";
-      level_ = codec_level;
+      level = codec_level;
     }
   }
-  codec_ = codec;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    codec_ = codec;
+    level_ = level;
+  }
   LOG(INFO) << "Set compression codec to: "
-            << GetCodecName(codec_ ? codec_->type() : NO_COMPRESSION);
+            << GetCodecName(codec ? codec->type() : NO_COMPRESSION);
+  return Status::OK();
+}
+
+Status CompressionCodecManager::GetCodecForMessage(
+    CompressionType type,
+    const Slice& payload,
+    std::shared_ptr<CompressionCodec>* codec) {
+  std::shared_ptr<CompressionCodec> current = GetCurrentCodec();
+  if (current && type == current->type()) {
+    const unsigned int dict_id = current->FrameDictionaryID(payload);
+    if (dict_id != current->DictionaryID()) {
+      std::lock_guard<simple_spinlock> l(lock_);
+      for (const auto& retired : retired_dict_codecs_) {
+        if (retired->type() == type && retired->DictionaryID() == dict_id) {
+          *codec = retired;
+          return Status::OK();
+        }
+      }
+    }
+    // A payload compressed with an unknown dictionary fails to uncompress
+    // with a dictionary mismatch, which gets the leader to resend its
+    // dictionary.
+    *codec = std::move(current);
+    return Status::OK();
+  }
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  RETURN_NOT_OK(SetCurrentCodecUnlocked(type));
+  *codec = GetCurrentCodec();
   return Status::OK();
 }
 
 Status CompressionCodecManager::SetDictionary(const std::string& dict) {
-  if (!codec_) {
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  std::shared_ptr<CompressionCodec> current = GetCurrentCodec();
+  std::shared_ptr<CompressionCodec> codec;
+  if (current) {
+    RETURN_NOT_OK(
+        BuildCodec(current->type(), dict, current->CompressionLevel(), &codec));
+  }
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (current && current->DictionaryID() != 0 &&
+        current->DictionaryID() != GetDictionaryID(dict)) {
+      retired_dict_codecs_.push_back(current);
+      if (retired_dict_codecs_.size() > kMaxRetiredDictCodecs) {
+        retired_dict_codecs_.pop_front();
+      }
+    }
+    codec_ = codec;
     dictionary_ = dict;
-    return Status::OK();
   }
-  RETURN_NOT_OK(codec_->SetDictionary(dict));
-  dictionary_ = dict;
-  LOG(INFO) << "Updating compression dict to id " << GetCurrentDictionaryID();
+  if (codec) {
+    LOG(INFO) << "Updating compression dict to id " << GetDictionaryID(dict);
+  }
   return Status::OK();
 }
 
-unsigned int CompressionCodecManager::GetCurrentDictionaryID() {
+unsigned int CompressionCodecManager::GetCurrentDictionaryID() const {
+  std::lock_guard<simple_spinlock> l(lock_);
   return GetDictionaryID(dictionary_);
 }
 
@@ -787,11 +949,14 @@ unsigned int CompressionCodecManager::GetDictionaryID(const std::string& dict) {
 }
 
 Status CompressionCodecManager::SetCurrentCompressionLevel(int level) {
-  if (!codec_) {
-    level_ = level;
-    return Status::OK();
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  std::shared_ptr<CompressionCodec> current = GetCurrentCodec();
+  std::shared_ptr<CompressionCodec> codec;
+  if (current) {
+    RETURN_NOT_OK(BuildCodec(current->type(), GetDictionary(), level, &codec));
   }
-  RETURN_NOT_OK(codec_->SetCompressionLevel(level));
+  std::lock_guard<simple_spinlock> l(lock_);
+  codec_ = codec;
   level_ = level;
   return Status::OK();
 }
@@ -17,8 +17,12 @@
 #ifndef KUDU_CFILE_COMPRESSION_CODEC_H
 #define KUDU_CFILE_COMPRESSION_CODEC_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -28,6 +32,8 @@
 
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
@@ -42,9 +48,11 @@ class CompressionCodec {
       const Slice& input,
       uint8_t* compressed,
       size_t* compressed_length) {
+    const MonoTime start = MonoTime::Now();
     Status ret = Compress(input, compressed, compressed_length);
     ++total_compressions_;
     if (ret.ok()) {
+      total_compression_micros_ += (MonoTime::Now() - start).ToMicroseconds();
       total_bytes_before_compression_ += input.size();
       total_bytes_after_compression_ += *compressed_length;
     } else {
@@ -101,6 +109,17 @@ class CompressionCodec {
   // Returns a JSON which contains stats
   virtual std::string Stats() const;
 
+  // Totals over the successful calls to CompressWithStats().
+  uint64_t total_bytes_before_compression() const {
+    return total_bytes_before_compression_.load(std::memory_order_relaxed);
+  }
+  uint64_t total_bytes_after_compression() const {
+    return total_bytes_after_compression_.load(std::memory_order_relaxed);
+  }
+  uint64_t total_compression_micros() const {
+    return total_compression_micros_.load(std::memory_order_relaxed);
+  }
+
   // Sets a compression dictionary
   virtual Status SetDictionary(const std::string& /*dict*/) {
     LOG(WARNING) << "Dictionary compression is not supported by "
@@ -113,6 +132,17 @@ class CompressionCodec {
     return {};
   }
 
+  // Returns the ID of the dictionary, 0 if there is none.
+  virtual unsigned int DictionaryID() const {
+    return 0;
+  }
+
+  // Returns the ID of the dictionary that 'compressed', the output of this
+  // type of codec, was compressed with. 0 if there is none.
+  virtual unsigned int FrameDictionaryID(const Slice& /*compressed*/) const {
+    return 0;
+  }
+
   // Sets compression level
   virtual Status SetCompressionLevel(int level) {
     compression_level_ = level;
@@ -130,29 +160,32 @@ class CompressionCodec {
   int compression_level_ = 0;
 
  private:
-  // Stats
-  uint64_t total_bytes_before_compression_ = 0;
-  uint64_t total_bytes_after_compression_ = 0;
-  uint64_t total_compressions_ = 0;
-  uint64_t total_bytes_before_decompression_ = 0;
-  uint64_t total_bytes_after_decompression_ = 0;
-  uint64_t total_decompressions_ = 0;
-  uint64_t total_compression_errors_ = 0;
-  uint64_t total_decompression_errors_ = 0;
+  // Stats. Atomic since a codec may be used by several threads at once.
+  std::atomic<uint64_t> total_bytes_before_compression_{0};
+  std::atomic<uint64_t> total_bytes_after_compression_{0};
+  std::atomic<uint64_t> total_compressions_{0};
+  std::atomic<uint64_t> total_compression_micros_{0};
+  std::atomic<uint64_t> total_bytes_before_decompression_{0};
+  std::atomic<uint64_t> total_bytes_after_decompression_{0};
+  std::atomic<uint64_t> total_decompressions_{0};
+  std::atomic<uint64_t> total_compression_errors_{0};
+  std::atomic<uint64_t> total_decompression_errors_{0};
 
   DISALLOW_COPY_AND_ASSIGN(CompressionCodec);
 };
 
 /**
- * Manages global compression codec, dictionary and compression level
+ * Manages the compression codec, dictionary and compression level of a ring
  *
- * This class is NOT thread safe. In the commit path we rely on taking
- * RaftConsensus::lock_ and PeerConsensusQueue::queue_lock_ while updating
- * codec, dict, level etc. and also compression and decompression using the
- * codec
+ * This class is thread safe. A codec is never reconfigured once it has been
+ * handed out: changing the codec, dictionary or level publishes a new codec
+ * instead. The Compress and Uncompress methods of all codecs are safe to call
+ * concurrently, so a caller holding a codec may use it without any lock.
  */
 class CompressionCodecManager {
  public:
+  CompressionCodecManager() {}
+
   static Status GetCodec(
       CompressionType type,
       std::shared_ptr<CompressionCodec>* codec);
@@ -163,27 +196,43 @@ class CompressionCodecManager {
     return GetCodec(GetCodecType(type), codec);
   }
 
-  static std::shared_ptr<CompressionCodec> GetCurrentCodec() {
+  std::shared_ptr<CompressionCodec> GetCurrentCodec() const {
+    std::lock_guard<simple_spinlock> l(lock_);
     return codec_;
   }
 
-  static Status SetCurrentCodec(CompressionType type);
+  Status SetCurrentCodec(CompressionType type);
 
-  static Status SetCurrentCodec(const std::string& type) {
+  Status SetCurrentCodec(const std::string& type) {
     return SetCurrentCodec(GetCodecType(type));
   }
 
-  static const std::string& GetDictionary() {
+  // Returns in 'codec' the codec to uncompress 'payload', a message payload
+  // compressed with 'type'. Replicas follow the codec of the leader, so
+  // 'type' also becomes the current codec. A payload compressed with one of
+  // the last few dictionaries gets a codec using that dictionary.
+  Status GetCodecForMessage(
+      CompressionType type,
+      const Slice& payload,
+      std::shared_ptr<CompressionCodec>* codec);
+
+  std::string GetDictionary() const {
+    std::lock_guard<simple_spinlock> l(lock_);
     return dictionary_;
   }
 
-  static Status SetDictionary(const std::string& dict);
+  bool HasDictionary() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return !dictionary_.empty();
+  }
+
+  Status SetDictionary(const std::string& dict);
 
-  static unsigned int GetCurrentDictionaryID();
+  unsigned int GetCurrentDictionaryID() const;
 
   static unsigned int GetDictionaryID(const std::string& dict);
 
-  static Status SetCurrentCompressionLevel(int level);
+  Status SetCurrentCompressionLevel(int level);
 
   static CompressionType GetCodecType(const std::string& name) {
     CompressionType type;
@@ -200,11 +249,27 @@ class CompressionCodecManager {
   }
 
  private:
-  CompressionCodecManager() {}
+  // Creates in 'codec' a codec of 'type' using 'dict' at 'level'.
+  static Status BuildCodec(
+      CompressionType type,
+      const std::string& dict,
+      int level,
+      std::shared_ptr<CompressionCodec>* codec);
+
+  // Caller must hold 'update_lock_'.
+  Status SetCurrentCodecUnlocked(CompressionType type);
+
+  // Serializes updates, which build the new codec without holding 'lock_'.
+  std::mutex update_lock_;
 
-  static std::shared_ptr<CompressionCodec> codec_;
-  static std::string dictionary_;
-  static int level_;
+  // Protects the fields below.
+  mutable simple_spinlock lock_;
+  std::shared_ptr<CompressionCodec> codec_;
+  std::string dictionary_;
+  int level_ = 0;
+  // Dictionary codecs replaced by SetDictionary(), oldest first, so that
+  // payloads compressed before a dictionary rotation stay readable.
+  std::deque<std::shared_ptr<CompressionCodec>> retired_dict_codecs_;
 
   DISALLOW_COPY_AND_ASSIGN(CompressionCodecManager);
 };
@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/compression/compression_dict_trainer.h"
+
+#include <utility>
+#include <vector>
+
+#include <zdict.h>
+
+#include "kudu/gutil/strings/substitute.h"
+
+namespace kudu {
+
+void CompressionDictTrainer::AddSample(const Slice& payload) {
+  if (payload.empty() || payload.size() > options_.max_payload_size) {
+    return;
+  }
+  if (num_payloads_.fetch_add(1, std::memory_order_relaxed) %
+          options_.sample_every !=
+      0) {
+    return;
+  }
+  std::string sample = payload.ToString();
+  std::lock_guard<simple_spinlock> l(lock_);
+  sample_bytes_ += sample.size();
+  samples_.push_back(std::move(sample));
+  while (sample_bytes_ > options_.max_sample_bytes) {
+    sample_bytes_ -= samples_.front().size();
+    samples_.pop_front();
+  }
+}
+
+Status CompressionDictTrainer::Train(std::string* dict) const {
+  // ZDICT wants the samples back to back.
+  std::string buffer;
+  std::vector<size_t> sample_sizes;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (samples_.size() < options_.min_samples) {
+      return Status::Incomplete(strings::Substitute(
+          "Only $0 of the $1 samples needed to train a dictionary",
+          samples_.size(),
+          options_.min_samples));
+    }
+    buffer.reserve(sample_bytes_);
+    sample_sizes.reserve(samples_.size());
+    for (const std::string& sample : samples_) {
+      buffer.append(sample);
+      sample_sizes.push_back(sample.size());
+    }
+  }
+
+  dict->resize(options_.dict_size);
+  const size_t ret = ZDICT_trainFromBuffer(
+      &(*dict)[0],
+      dict->size(),
+      buffer.data(),
+      sample_sizes.data(),
+      static_cast<unsigned int>(sample_sizes.size()));
+  if (ZDICT_isError(ret)) {
+    dict->clear();
+    return Status::RuntimeError(strings::Substitute(
+        "Could not train compression dictionary: $0",
+        ZDICT_getErrorName(ret)));
+  }
+  dict->resize(ret);
+  return Status::OK();
+}
+
+} // namespace kudu
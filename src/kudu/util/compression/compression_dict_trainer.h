@@ -0,0 +1,88 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_COMPRESSION_DICT_TRAINER_H
+#define KUDU_UTIL_COMPRESSION_DICT_TRAINER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+/**
+ * Trains compression dictionaries from a sample of recent payloads
+ *
+ * One in 'sample_every' payloads passed to AddSample() is kept, and the
+ * oldest samples are dropped past 'max_sample_bytes', so that the dictionary
+ * follows the payloads as they drift. Train() builds a ZSTD dictionary, which
+ * both ZSTD_DICT and LZ4_DICT use.
+ *
+ * This class is thread safe.
+ */
+class CompressionDictTrainer {
+ public:
+  struct Options {
+    // Keep one in this many payloads.
+    uint32_t sample_every = 16;
+    // Larger payloads compress well without a dictionary and are not kept.
+    size_t max_payload_size = 16 * 1024;
+    size_t max_sample_bytes = 8 * 1024 * 1024;
+    // Train() fails with fewer samples than this.
+    size_t min_samples = 1000;
+    size_t dict_size = 64 * 1024;
+  };
+
+  CompressionDictTrainer() {}
+  explicit CompressionDictTrainer(const Options& options)
+      : options_(options) {}
+
+  // Samples 'payload', an uncompressed message payload.
+  void AddSample(const Slice& payload);
+
+  // Trains in 'dict' a dictionary from the samples kept so far. Returns
+  // Incomplete if there are too few samples.
+  Status Train(std::string* dict) const;
+
+  size_t num_samples() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return samples_.size();
+  }
+
+ private:
+  const Options options_;
+
+  std::atomic<uint64_t> num_payloads_{0};
+
+  // Protects the fields below.
+  mutable simple_spinlock lock_;
+  // Oldest first.
+  std::deque<std::string> samples_;
+  size_t sample_bytes_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressionDictTrainer);
+};
+
+} // namespace kudu
+#endif
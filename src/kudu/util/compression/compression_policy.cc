@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/compression/compression_policy.h"
+
+#include <algorithm>
+
+#include "kudu/util/compression/compression_codec.h"
+
+namespace kudu {
+
+namespace {
+// LZ4 is only picked for speed, so it always runs at its fastest level.
+constexpr int kLz4Level = 1;
+} // anonymous namespace
+
+AdaptiveCompressionPolicy::Choice AdaptiveCompressionPolicy::Evaluate(
+    const std::shared_ptr<CompressionCodec>& codec,
+    bool cross_region,
+    bool has_dictionary) {
+  const CompressionType fast_type = has_dictionary ? LZ4_DICT : LZ4;
+  const CompressionType strong_type = has_dictionary ? ZSTD_DICT : ZSTD;
+
+  Choice current;
+  if (!codec) {
+    last_codec_ = nullptr;
+    if (++evaluations_off_ < options_.probe_after_evaluations) {
+      return current;
+    }
+    evaluations_off_ = 0;
+    return cross_region ? Choice{strong_type, options_.min_zstd_level}
+                        : Choice{fast_type, kLz4Level};
+  }
+  evaluations_off_ = 0;
+  current.type = codec->type();
+  current.level = codec->CompressionLevel();
+
+  // The totals of a new codec start from zero.
+  if (codec != last_codec_) {
+    last_codec_ = codec;
+    last_bytes_before_ = 0;
+    last_bytes_after_ = 0;
+    last_micros_ = 0;
+  }
+  const uint64_t total_before = codec->total_bytes_before_compression();
+  const uint64_t total_after = codec->total_bytes_after_compression();
+  const uint64_t total_micros = codec->total_compression_micros();
+  const uint64_t bytes_before = total_before - last_bytes_before_;
+  const uint64_t bytes_after = total_after - last_bytes_after_;
+  const uint64_t micros = total_micros - last_micros_;
+  if (bytes_before < options_.min_sample_bytes) {
+    // Let the sample grow until the next call.
+    return current;
+  }
+  last_bytes_before_ = total_before;
+  last_bytes_after_ = total_after;
+  last_micros_ = total_micros;
+
+  if (bytes_after > options_.max_useful_ratio * bytes_before) {
+    return Choice{NO_COMPRESSION, 0};
+  }
+  if (!cross_region) {
+    return current.type == fast_type ? current : Choice{fast_type, kLz4Level};
+  }
+  if (current.type != strong_type) {
+    return Choice{strong_type, options_.min_zstd_level};
+  }
+
+  Choice next = current;
+  next.level = std::min(
+      std::max(next.level, options_.min_zstd_level), options_.max_zstd_level);
+  // Bytes per microsecond are MB per second.
+  const double mb_per_sec =
+      static_cast<double>(bytes_before) / std::max<uint64_t>(micros, 1);
+  if (mb_per_sec > options_.raise_level_above_mb_per_sec &&
+      next.level < options_.max_zstd_level) {
+    next.level++;
+  } else if (
+      mb_per_sec < options_.lower_level_below_mb_per_sec &&
+      next.level > options_.min_zstd_level) {
+    next.level--;
+  }
+  return next;
+}
+
+} // namespace kudu
@@ -0,0 +1,102 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_COMPRESSION_POLICY_H
+#define KUDU_UTIL_COMPRESSION_POLICY_H
+
+#include <cstdint>
+#include <memory>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/compression/compression.pb.h"
+
+namespace kudu {
+
+class CompressionCodec;
+
+/**
+ * Picks the codec and compression level of a ring from what compressing its
+ * recent payloads saved and cost, and from whether its payloads cross
+ * regions.
+ *
+ * - Payloads that barely compress are sent uncompressed. Compression is
+ *   retried every 'probe_after_evaluations' evaluations, in case the payloads
+ *   have changed.
+ * - If every peer is in the local region, bandwidth is cheap and LZ4 is used.
+ * - Otherwise ZSTD is used, and its level is raised while compression keeps
+ *   up with 'raise_level_above_mb_per_sec' and lowered when it falls below
+ *   'lower_level_below_mb_per_sec'.
+ *
+ * The dictionary variant of a codec is used if the ring has a dictionary.
+ * This class is NOT thread safe.
+ */
+class AdaptiveCompressionPolicy {
+ public:
+  struct Options {
+    // Evaluations covering fewer compressed bytes keep the current choice.
+    uint64_t min_sample_bytes = 1024 * 1024;
+    // Payloads compressing to more than this fraction of their size are
+    // treated as incompressible.
+    double max_useful_ratio = 0.9;
+    double raise_level_above_mb_per_sec = 200;
+    double lower_level_below_mb_per_sec = 50;
+    int min_zstd_level = 1;
+    int max_zstd_level = 9;
+    int probe_after_evaluations = 6;
+  };
+
+  struct Choice {
+    CompressionType type = NO_COMPRESSION;
+    int level = 0;
+
+    bool operator==(const Choice& other) const {
+      return type == other.type &&
+          (type == NO_COMPRESSION || level == other.level);
+    }
+    bool operator!=(const Choice& other) const {
+      return !(*this == other);
+    }
+  };
+
+  AdaptiveCompressionPolicy() {}
+  explicit AdaptiveCompressionPolicy(const Options& options)
+      : options_(options) {}
+
+  // Evaluates the compressions done by 'codec', the current codec of the
+  // ring, since the previous call. Returns the choice for the ring, which is
+  // the current one if there is no reason to change.
+  Choice Evaluate(
+      const std::shared_ptr<CompressionCodec>& codec,
+      bool cross_region,
+      bool has_dictionary);
+
+ private:
+  const Options options_;
+
+  // The codec seen by the previous call, and its totals at that point.
+  std::shared_ptr<CompressionCodec> last_codec_;
+  uint64_t last_bytes_before_ = 0;
+  uint64_t last_bytes_after_ = 0;
+  uint64_t last_micros_ = 0;
+
+  // Consecutive evaluations so far with compression off.
+  int evaluations_off_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(AdaptiveCompressionPolicy);
+};
+
+} // namespace kudu
+#endif
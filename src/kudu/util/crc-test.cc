@@ -79,6 +79,31 @@ TEST_F(CrcTest, TestCRC32C) {
   ASSERT_EQ(kExpectedCrc, data_crc3);
 }
 
+// Copying with a CRC and combining CRCs agree with computing the CRC directly.
+TEST_F(CrcTest, TestCRC32CCopyAndCombine) {
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data.append(Substitute("$0,", i));
+  }
+  const uint32_t expected = Crc32c(data.data(), data.size());
+
+  std::string copy(data.size(), '\0');
+  ASSERT_EQ(expected, Crc32cCopy(&copy[0], data.data(), data.size()));
+  ASSERT_EQ(data, copy);
+
+  // Copying in pieces, extending the CRC.
+  const size_t split = data.size() / 3;
+  uint32_t crc = Crc32cCopy(&copy[0], data.data(), split);
+  crc = Crc32cCopy(
+      &copy[split], data.data() + split, data.size() - split, crc);
+  ASSERT_EQ(expected, crc);
+
+  const uint32_t crc_a = Crc32c(data.data(), split);
+  const uint32_t crc_b = Crc32c(data.data() + split, data.size() - split);
+  ASSERT_EQ(expected, Crc32cCombine(crc_a, crc_b, data.size() - split));
+  ASSERT_EQ(crc_a, Crc32cCombine(crc_a, Crc32c(data.data(), 0), 0));
+}
+
 // Simple benchmark of CRC32C throughput.
 // We should expect about 8 bytes per cycle in throughput on a single core.
 TEST_F(CrcTest, BenchmarkCRC32C) {
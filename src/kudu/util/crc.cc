@@ -16,6 +16,9 @@
 // under the License.
 #include "kudu/util/crc.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <crcutil/interface.h>
 
 #include "kudu/gutil/once.h"
@@ -26,6 +29,9 @@ namespace crc {
 
 using debug::ScopedLeakCheckDisabler;
 
+// Small enough for a chunk to still be in L1 when its CRC is computed.
+static const size_t kCopyChunkSize = 16 * 1024;
+
 static GoogleOnceType crc32c_once = GOOGLE_ONCE_INIT;
 static Crc* crc32c_instance = nullptr;
 
@@ -52,5 +58,32 @@ uint32_t Crc32c(const void* data, size_t length, uint32_t prev_crc32) {
   return static_cast<uint32_t>(crc_tmp); // Only uses lower 32 bits.
 }
 
+uint32_t Crc32cCopy(
+    void* dst,
+    const void* src,
+    size_t length,
+    uint32_t prev_crc32) {
+  Crc* crc32c = GetCrc32cInstance();
+  uint64_t crc_tmp = static_cast<uint64_t>(prev_crc32);
+  auto* out = static_cast<uint8_t*>(dst);
+  const auto* in = static_cast<const uint8_t*>(src);
+  while (length > 0) {
+    const size_t chunk = std::min(length, kCopyChunkSize);
+    memcpy(out, in, chunk);
+    crc32c->Compute(out, chunk, &crc_tmp);
+    out += chunk;
+    in += chunk;
+    length -= chunk;
+  }
+  return static_cast<uint32_t>(crc_tmp); // Only uses lower 32 bits.
+}
+
+uint32_t Crc32cCombine(uint32_t crc_a, uint32_t crc_b, size_t length_b) {
+  uint64_t crc_tmp = static_cast<uint64_t>(crc_a);
+  GetCrc32cInstance()->Concatenate(
+      static_cast<uint64_t>(crc_b), 0, length_b, &crc_tmp);
+  return static_cast<uint32_t>(crc_tmp); // Only uses lower 32 bits.
+}
+
 } // namespace crc
 } // namespace kudu
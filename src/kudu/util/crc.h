@@ -37,5 +37,18 @@ uint32_t Crc32c(const void* data, size_t length);
 // extends it to new chunk and returns the result.
 uint32_t Crc32c(const void* data, size_t length, uint32_t prev_crc32);
 
+// Copies 'length' bytes from 'src' to 'dst' and returns their CRC32C,
+// extending 'prev_crc32'. The CRC is computed over cache-sized chunks as they
+// are copied, so the data is only read from memory once.
+uint32_t Crc32cCopy(
+    void* dst,
+    const void* src,
+    size_t length,
+    uint32_t prev_crc32 = 0);
+
+// Given the CRC32C of a chunk A and the CRC32C of a chunk B of 'length_b'
+// bytes, returns the CRC32C of A followed by B without reading either.
+uint32_t Crc32cCombine(uint32_t crc_a, uint32_t crc_b, size_t length_b);
+
 } // namespace crc
 } // namespace kudu
@@ -0,0 +1,81 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+
+#include "kudu/util/debouncer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace kudu {
+
+TEST(LatestValueDebouncerTest, TestCoalescesPendingValues) {
+  LatestValueDebouncer debouncer;
+  ASSERT_EQ(LatestValueDebouncer::kNone, debouncer.Take());
+
+  // Only the first post schedules; the pending delivery takes the latest.
+  ASSERT_TRUE(debouncer.Post(1));
+  ASSERT_FALSE(debouncer.Post(3));
+  ASSERT_FALSE(debouncer.Post(2));
+  ASSERT_EQ(3, debouncer.Take());
+
+  // Once taken, the next post schedules again.
+  ASSERT_TRUE(debouncer.Post(4));
+  ASSERT_EQ(4, debouncer.Take());
+  ASSERT_EQ(LatestValueDebouncer::kNone, debouncer.Take());
+}
+
+// Producers race a consumer that runs a delivery whenever one is scheduled.
+// The highest value posted must always be delivered.
+TEST(LatestValueDebouncerTest, TestConcurrentPosts) {
+  const int kNumThreads = 4;
+  const int64_t kPostsPerThread = 10000;
+  LatestValueDebouncer debouncer;
+  std::atomic<int64_t> scheduled{0};
+  std::atomic<int64_t> delivered{LatestValueDebouncer::kNone};
+  std::atomic<bool> done{false};
+
+  std::thread consumer([&]() {
+    int64_t taken = 0;
+    while (true) {
+      bool finished = done.load();
+      while (taken < scheduled.load()) {
+        taken++;
+        int64_t value = debouncer.Take();
+        // Producers race each other, so a delivery may carry a lower value
+        // than the one before it.
+        if (value > delivered.load()) {
+          delivered.store(value);
+        }
+      }
+      if (finished) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  });
+
+  std::atomic<int64_t> next_value{0};
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kNumThreads; i++) {
+    producers.emplace_back([&]() {
+      for (int64_t j = 0; j < kPostsPerThread; j++) {
+        if (debouncer.Post(next_value.fetch_add(1))) {
+          scheduled.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  done.store(true);
+  consumer.join();
+
+  ASSERT_EQ(kNumThreads * kPostsPerThread - 1, delivered.load());
+  ASSERT_LE(scheduled.load(), kNumThreads * kPostsPerThread);
+}
+
+} // namespace kudu
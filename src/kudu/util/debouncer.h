@@ -3,6 +3,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 
@@ -100,4 +101,72 @@ class Debouncer {
  */
 using MutexDebouncer = Debouncer<std::mutex>;
 
+/**
+ * Coalesces a stream of non-negative, non-decreasing values (a commit index,
+ * a term) into deliveries of the latest one.
+ *
+ * This is the same idea as Debouncer applied to asynchronous work: rather
+ * than scheduling one task per value, a producer schedules a task only when
+ * none is pending, and the pending task delivers whatever value is latest
+ * when it runs. Values posted while a task is pending are folded into it.
+ *
+ * Usage:
+ *
+ *   if (debouncer.Post(value)) {
+ *     pool->Submit([&] {
+ *       int64_t latest = debouncer.Take();
+ *       if (latest != LatestValueDebouncer::kNone) Deliver(latest);
+ *     });
+ *   }
+ *
+ * Every posted value is delivered or superseded by a later delivery. A task
+ * may find nothing to deliver if an earlier task already took its value.
+ */
+class LatestValueDebouncer {
+ public:
+  static constexpr int64_t kNone = -1;
+
+  LatestValueDebouncer() {}
+
+  // Uncopyable type
+  LatestValueDebouncer(const LatestValueDebouncer&) = delete;
+  LatestValueDebouncer& operator=(const LatestValueDebouncer&) = delete;
+
+  /**
+   * Records 'value' as the latest value.
+   *
+   * @return true if no delivery is pending and the caller must schedule one
+   */
+  bool Post(int64_t value) {
+    int64_t current = pending_value_.load();
+    while (value > current &&
+           !pending_value_.compare_exchange_weak(current, value)) {
+    }
+    return !scheduled_.exchange(true);
+  }
+
+  /**
+   * Called by the scheduled delivery. Values posted from here on schedule a
+   * new delivery.
+   *
+   * @return the latest posted value, or kNone if it was already taken
+   */
+  int64_t Take() {
+    // Clearing the flag before taking the value means a concurrent Post()
+    // either lands its value before the exchange below, or schedules anew.
+    scheduled_.store(false);
+    return pending_value_.exchange(kNone);
+  }
+
+ private:
+  /**
+   * The latest value not yet taken, or kNone.
+   */
+  std::atomic<int64_t> pending_value_{kNone};
+  /**
+   * Whether a delivery is scheduled and has not yet called Take().
+   */
+  std::atomic_bool scheduled_ = false;
+};
+
 } // namespace kudu
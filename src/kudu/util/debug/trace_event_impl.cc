@@ -906,7 +906,10 @@ string TraceResultBuffer::DoFlush(bool leave_intact) {
   } else {
     tl->Flush(Bind(&TraceResultBuffer::Collect, Unretained(&buf)));
   }
-  buf.json_.append("]}\n");
+  // Read by 'kudu diagnose merge_traces'.
+  buf.json_.append(strings::Substitute(
+      "],\n\"metadata\": {\"wall_clock_offset_us\": $0}}\n",
+      tl->WallClockOffset()));
   return buf.json_;
 }
 
@@ -2331,6 +2334,10 @@ void TraceLog::SetTimeOffset(kudu::MicrosecondsInt64 offset) {
   time_offset_ = offset;
 }
 
+kudu::MicrosecondsInt64 TraceLog::WallClockOffset() const {
+  return GetCurrentTimeMicros() - OffsetNow();
+}
+
 size_t TraceLog::GetObserverCountForTest() const {
   return enabled_state_observer_list_.size();
 }
@@ -603,6 +603,11 @@ class BASE_EXPORT TraceLog {
   // time that should be reported.
   void SetTimeOffset(kudu::MicrosecondsInt64 offset);
 
+  // Returns what to add to a reported timestamp to get the wall-clock time in
+  // microseconds since the epoch, so that traces from different servers can
+  // be lined up.
+  kudu::MicrosecondsInt64 WallClockOffset() const;
+
   size_t GetObserverCountForTest() const;
 
  private:
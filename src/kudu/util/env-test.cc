@@ -513,6 +513,42 @@ TEST_F(TestEnv, TestReadFully) {
   ASSERT_STR_CONTAINS(status.ToString(), "EOF");
 }
 
+TEST_F(TestEnv, TestAsyncIO) {
+  const string kTestPath = GetTestPath("test");
+  shared_ptr<WritableFile> writer;
+  ASSERT_OK(env_util::OpenFileForWrite(env_, kTestPath, &writer));
+
+  // Appends and syncs of a file are submitted one at a time.
+  ASSERT_OK(env_->AppendAsync(writer, "hello ")->Wait());
+  ASSERT_OK(env_->AppendAsync(writer, "world")->Wait());
+  int num_callbacks = 0;
+  shared_ptr<IOCompletion> sync = env_->SyncAsync(
+      writer, [&](const Status& s) {
+        CHECK_OK(s);
+        num_callbacks++;
+      });
+  ASSERT_OK(sync->Wait());
+  ASSERT_TRUE(sync->IsDone());
+  ASSERT_EQ(1, num_callbacks);
+  ASSERT_OK(writer->Close());
+
+  shared_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_util::OpenFileForRandom(env_, kTestPath, &reader));
+  uint8_t scratch[2][5];
+  shared_ptr<IOCompletion> first =
+      env_->ReadAsync(reader, 0, Slice(scratch[0], 5));
+  shared_ptr<IOCompletion> second =
+      env_->ReadAsync(reader, 6, Slice(scratch[1], 5));
+  ASSERT_OK(second->Wait());
+  ASSERT_OK(first->Wait());
+  ASSERT_EQ("hello", Slice(scratch[0], 5).ToString());
+  ASSERT_EQ("world", Slice(scratch[1], 5).ToString());
+
+  // Errors are reported through the completion.
+  Status s = env_->ReadAsync(reader, 8, Slice(scratch[0], 5))->Wait();
+  ASSERT_TRUE(s.IsEndOfFile()) << s.ToString();
+}
+
 TEST_F(TestEnv, TestReadVFully) {
   // Create the file.
   unique_ptr<RWFile> file;
@@ -595,6 +631,78 @@ TEST_F(TestEnv, TestAppendV) {
   }
 }
 
+// Test that appends of arbitrary sizes through a direct I/O writable file,
+// including ones that straddle block and staging buffer boundaries and a
+// reopen of a file with a partially filled last block, read back intact.
+TEST_F(TestEnv, TestDirectIOAppend) {
+  string test_path = GetTestPath("test_env_direct_wf");
+  WritableFileOptions opts;
+  opts.direct_io = true;
+
+  Random rng(SeedRandom());
+  string expected;
+  shared_ptr<WritableFile> writer;
+  ASSERT_OK(env_util::OpenFileForWrite(opts, env_, test_path, &writer));
+  if (fallocate_supported_) {
+    ASSERT_OK(writer->PreAllocate(1024 * 1024));
+  }
+  for (int i = 0; i < 100; i++) {
+    string data = RandomString(rng.Uniform(64 * 1024) + 1, &rng);
+    ASSERT_OK(writer->Append(data));
+    expected += data;
+    ASSERT_EQ(expected.size(), writer->Size());
+  }
+  ASSERT_OK(writer->Sync());
+  ASSERT_OK(writer->Close());
+
+  opts.mode = Env::OPEN_EXISTING;
+  ASSERT_OK(env_util::OpenFileForWrite(opts, env_, test_path, &writer));
+  ASSERT_EQ(expected.size(), writer->Size());
+  string tail = RandomString(3 * 1024 * 1024 + 17, &rng);
+  ASSERT_OK(writer->Append(tail));
+  expected += tail;
+  ASSERT_OK(writer->Close());
+
+  shared_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_util::OpenFileForRandom(env_, test_path, &reader));
+  uint64_t size;
+  ASSERT_OK(reader->Size(&size));
+  ASSERT_EQ(expected.size(), size);
+  unique_ptr<uint8_t[]> scratch(new uint8_t[size]);
+  Slice s(scratch.get(), size);
+  ASSERT_OK(reader->Read(0, s));
+  ASSERT_TRUE(s == Slice(expected));
+}
+
+// Test that once an append through a direct I/O writable file fails, further
+// appends are rejected and closing the file drops what the failed one wrote.
+TEST_F(TestEnv, TestDirectIOFailedAppend) {
+  FLAGS_crash_on_eio = false;
+  string test_path = GetTestPath("test_env_direct_failed_wf");
+  WritableFileOptions opts;
+  opts.direct_io = true;
+
+  Random rng(SeedRandom());
+  shared_ptr<WritableFile> writer;
+  ASSERT_OK(env_util::OpenFileForWrite(opts, env_, test_path, &writer));
+  string expected = RandomString(6000, &rng);
+  ASSERT_OK(writer->Append(expected));
+
+  FLAGS_env_inject_eio = 1.0;
+  Status s = writer->Append(RandomString(2 * 1024 * 1024, &rng));
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  FLAGS_env_inject_eio = 0;
+  s = writer->Append("more");
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  ASSERT_STR_CONTAINS(s.ToString(), "previous append failed");
+  ASSERT_EQ(expected.size(), writer->Size());
+  ASSERT_OK(writer->Close());
+
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, test_path, &contents));
+  ASSERT_EQ(expected, contents.ToString());
+}
+
 TEST_F(TestEnv, TestGetExecutablePath) {
   string p;
   ASSERT_OK(Env::Default()->GetExecutablePath(&p));
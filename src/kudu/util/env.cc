@@ -5,18 +5,116 @@
 #include "kudu/util/env.h"
 
 #include <memory>
+#include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(
+    env_async_io_threads,
+    4,
+    "Number of threads running the asynchronous I/O operations submitted "
+    "through Env::ReadAsync(), AppendAsync() and SyncAsync().");
+TAG_FLAG(env_async_io_threads, experimental);
+
+static bool ValidateAsyncIOThreads(const char* flagname, int32_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(env_async_io_threads, &ValidateAsyncIOThreads);
 
+using std::function;
+using std::shared_ptr;
 using std::unique_ptr;
 
 namespace kudu {
 
+namespace {
+
+// Created on first use, and never destroyed, like Env::Default().
+ThreadPool* AsyncIOPool() {
+  static ThreadPool* pool = []() {
+    unique_ptr<ThreadPool> ret;
+    CHECK_OK(ThreadPoolBuilder("async-io")
+                 .set_max_threads(FLAGS_env_async_io_threads)
+                 .Build(&ret));
+    return ret.release();
+  }();
+  return pool;
+}
+
+shared_ptr<IOCompletion> SubmitAsync(
+    function<Status()> op,
+    function<void(const Status&)> cb) {
+  auto completion = std::make_shared<IOCompletion>(std::move(cb));
+  Status s = AsyncIOPool()->SubmitFunc(
+      [op, completion]() { completion->Complete(op()); });
+  if (PREDICT_FALSE(!s.ok())) {
+    completion->Complete(s);
+  }
+  return completion;
+}
+
+} // anonymous namespace
+
+IOCompletion::IOCompletion(function<void(const Status&)> cb)
+    : cb_(std::move(cb)), latch_(new CountDownLatch(1)) {}
+
+IOCompletion::~IOCompletion() {}
+
+Status IOCompletion::Wait() const {
+  latch_->Wait();
+  return status_;
+}
+
+bool IOCompletion::IsDone() const {
+  return latch_->count() == 0;
+}
+
+void IOCompletion::Complete(const Status& s) {
+  DCHECK(!IsDone());
+  status_ = s;
+  if (cb_) {
+    cb_(s);
+  }
+  latch_->CountDown();
+}
+
 Env::~Env() {}
 
+shared_ptr<IOCompletion> Env::ReadAsync(
+    shared_ptr<RandomAccessFile> file,
+    uint64_t offset,
+    Slice result,
+    function<void(const Status&)> cb) {
+  return SubmitAsync(
+      [file, offset, result]() { return file->Read(offset, result); },
+      std::move(cb));
+}
+
+shared_ptr<IOCompletion> Env::AppendAsync(
+    shared_ptr<WritableFile> file,
+    Slice data,
+    function<void(const Status&)> cb) {
+  return SubmitAsync(
+      [file, data]() { return file->Append(data); }, std::move(cb));
+}
+
+shared_ptr<IOCompletion> Env::SyncAsync(
+    shared_ptr<WritableFile> file,
+    function<void(const Status&)> cb) {
+  return SubmitAsync([file]() { return file->Sync(); }, std::move(cb));
+}
+
 SequentialFile::~SequentialFile() {}
 
 RandomAccessFile::~RandomAccessFile() {}
@@ -14,6 +14,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <memory>
@@ -26,6 +27,7 @@
 
 namespace kudu {
 
+class CountDownLatch;
 class faststring;
 class FileLock;
 class RandomAccessFile;
@@ -47,6 +49,31 @@ struct SpaceInfo {
   int64_t free_bytes; // Bytes available to non-privileged processes.
 };
 
+// The completion of an asynchronous I/O operation submitted through Env,
+// shared by the submitter and the thread completing the operation.
+class IOCompletion {
+ public:
+  explicit IOCompletion(std::function<void(const Status&)> cb);
+  ~IOCompletion();
+
+  // Blocks until the operation completed, and returns its result.
+  Status Wait() const;
+
+  // Returns true if the operation completed.
+  bool IsDone() const;
+
+  // Records the result of the operation, runs the callback, if any, and
+  // wakes up the waiters. Called once, by whatever completes the operation.
+  void Complete(const Status& s);
+
+ private:
+  const std::function<void(const Status&)> cb_;
+  Status status_;
+  const std::unique_ptr<CountDownLatch> latch_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOCompletion);
+};
+
 class Env {
  public:
   // Governs if/how the file is created.
@@ -383,6 +410,31 @@ class Env {
   // On success, 'result' contains the answer. On failure, 'result' is unset.
   virtual Status IsFileWorldReadable(const std::string& path, bool* result) = 0;
 
+  // Asynchronous I/O: each of these submits an operation on 'file' and
+  // returns its completion without waiting for it. 'cb', if set, runs once
+  // the operation completes, on the thread that completed it, before the
+  // waiters of the completion wake up. The memory 'result' or 'data' points
+  // to must stay valid until then.
+  //
+  // Reads may be outstanding concurrently. Like their synchronous
+  // counterparts, at most one append or sync of a WritableFile may be
+  // outstanding at a time.
+  //
+  // By default, the operations run on a pool of --env_async_io_threads
+  // threads shared by the process.
+  virtual std::shared_ptr<IOCompletion> ReadAsync(
+      std::shared_ptr<RandomAccessFile> file,
+      uint64_t offset,
+      Slice result,
+      std::function<void(const Status&)> cb = nullptr);
+  virtual std::shared_ptr<IOCompletion> AppendAsync(
+      std::shared_ptr<WritableFile> file,
+      Slice data,
+      std::function<void(const Status&)> cb = nullptr);
+  virtual std::shared_ptr<IOCompletion> SyncAsync(
+      std::shared_ptr<WritableFile> file,
+      std::function<void(const Status&)> cb = nullptr);
+
   // Special string injected into file-growing operations' random failures
   // (if enabled).
   //
@@ -462,6 +514,23 @@ class RandomAccessFile {
   // Returns the size of the file
   virtual Status Size(uint64_t* size) const = 0;
 
+  // How a range of the file is about to be, or has been, read.
+  enum AccessAdvice {
+    // The range will be read soon: start reading it ahead.
+    WILL_NEED,
+    // The range won't be read again soon: drop it from the page cache.
+    DONT_NEED,
+  };
+
+  // Advises the OS of how the 'length' bytes at 'offset' will be read. Only
+  // a hint: does nothing where it isn't supported.
+  virtual Status Advise(
+      uint64_t /*offset*/,
+      uint64_t /*length*/,
+      AccessAdvice /*advice*/) const {
+    return Status::OK();
+  }
+
   // Returns the filename provided when the RandomAccessFile was constructed.
   virtual const std::string& filename() const = 0;
 
@@ -478,8 +547,22 @@ struct WritableFileOptions {
   // See CreateMode for details.
   Env::CreateMode mode;
 
+  // Open the file with O_DIRECT, bypassing the page cache. Appends are staged
+  // through an aligned buffer. Falls back to buffered writes if the platform
+  // or filesystem doesn't support direct I/O.
+  bool direct_io;
+
+  // Only meaningful with OPEN_EXISTING: rather than appending after the
+  // existing contents, write the file again from offset 0, treating its
+  // current length as preallocated space. The file is truncated to the
+  // amount actually written when it is closed.
+  bool overwrite_existing;
+
   WritableFileOptions()
-      : sync_on_close(false), mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE) {}
+      : sync_on_close(false),
+        mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE),
+        direct_io(false),
+        overwrite_existing(false) {}
 };
 
 // Options specified when a file is opened for random access.
@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
@@ -46,6 +47,7 @@
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/util/alignment.h"
 #include "kudu/util/array_view.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env.h"
@@ -53,6 +55,7 @@
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_scheduler.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/malloc.h"
 #include "kudu/util/monotime.h"
@@ -351,6 +354,7 @@ Status DoSync(int fd, const string& filename) {
   ThreadRestrictions::AssertIOAllowed();
   if (FLAGS_never_fsync)
     return Status::OK();
+  ScopedScheduledIO scheduled(0);
   if (FLAGS_env_use_fsync) {
     TRACE_COUNTER_SCOPE_LATENCY_US("fsync_us");
     TRACE_COUNTER_INCREMENT("fsync", 1);
@@ -410,6 +414,7 @@ Status DoReadV(
     bytes_req += result.size();
     iov[i] = {result.mutable_data(), result.size()};
   }
+  ScopedScheduledIO scheduled(bytes_req);
 
   uint64_t cur_offset = offset;
   size_t completed_iov = 0;
@@ -482,6 +487,7 @@ Status DoWriteV(
     bytes_req += result.size();
     iov[i] = {const_cast<uint8_t*>(result.data()), result.size()};
   }
+  ScopedScheduledIO scheduled(bytes_req);
 
   uint64_t cur_offset = offset;
   size_t completed_iov = 0;
@@ -675,6 +681,25 @@ class PosixRandomAccessFile : public RandomAccessFile {
     return Status::OK();
   }
 
+  virtual Status Advise(
+      uint64_t offset,
+      uint64_t length,
+      AccessAdvice advice) const override {
+#if defined(__linux__)
+    TRACE_EVENT1("io", "PosixRandomAccessFile::Advise", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    int err = posix_fadvise(
+        fd_,
+        offset,
+        length,
+        advice == WILL_NEED ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+    if (err != 0) {
+      return IOError(filename_, err);
+    }
+#endif
+    return Status::OK();
+  }
+
   virtual const string& filename() const override {
     return filename_;
   }
@@ -694,12 +719,13 @@ class PosixWritableFile : public WritableFile {
       string fname,
       int fd,
       uint64_t file_size,
-      bool sync_on_close)
+      bool sync_on_close,
+      uint64_t pre_allocated_size = 0)
       : filename_(std::move(fname)),
         fd_(fd),
         sync_on_close_(sync_on_close),
         filesize_(file_size),
-        pre_allocated_size_(0),
+        pre_allocated_size_(pre_allocated_size),
         pending_sync_(false),
         closed_(false) {}
 
@@ -730,6 +756,7 @@ class PosixWritableFile : public WritableFile {
 
     TRACE_EVENT1("io", "PosixWritableFile::PreAllocate", "path", filename_);
     ThreadRestrictions::AssertIOAllowed();
+    ScopedScheduledIO scheduled(0);
     uint64_t offset = std::max(filesize_, pre_allocated_size_);
     int ret;
     RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, size));
@@ -817,8 +844,204 @@ class PosixWritableFile : public WritableFile {
     ThreadRestrictions::AssertIOAllowed();
     LOG_SLOW_EXECUTION(
         WARNING, 1000, Substitute("sync call for $0", filename_)) {
-      if (pending_sync_) {
-        pending_sync_ = false;
+      if (pending_sync_.exchange(false)) {
+        RETURN_NOT_OK(DoSync(fd_, filename_));
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual uint64_t Size() const override {
+    return filesize_;
+  }
+
+  virtual const string& filename() const override {
+    return filename_;
+  }
+
+ private:
+  const string filename_;
+  const int fd_;
+  const bool sync_on_close_;
+
+  uint64_t filesize_;
+  uint64_t pre_allocated_size_;
+  // Atomic since the WAL may sync a file while it is being appended to by
+  // another thread.
+  std::atomic<bool> pending_sync_;
+  bool closed_;
+};
+
+// All direct I/O writes must be aligned to this size, in memory, in length
+// and in file offset.
+const size_t kDirectIOAlignment = 4096;
+
+// Size of the aligned buffer used to stage direct I/O writes. Must be a
+// multiple of kDirectIOAlignment.
+const size_t kDirectIOWriteBufferSize = 1024 * 1024;
+
+// Writes to a file opened with O_DIRECT, bypassing the page cache.
+//
+// O_DIRECT requires each write to be aligned in memory, length and file
+// offset. Appended data is therefore staged in an aligned buffer which always
+// starts at a block-aligned file offset. Each AppendV() writes out every block
+// it touched, zero-padding the last one, and then keeps the partially filled
+// last block in the buffer so that the next append rewrites it in place. The
+// logical size of the file is tracked separately, and the padding past it is
+// truncated away in Close().
+class PosixDirectWritableFile : public WritableFile {
+ public:
+  PosixDirectWritableFile(
+      string fname,
+      int fd,
+      uint64_t file_size,
+      bool sync_on_close,
+      uint64_t pre_allocated_size = 0)
+      : filename_(std::move(fname)),
+        fd_(fd),
+        sync_on_close_(sync_on_close),
+        filesize_(file_size),
+        pre_allocated_size_(pre_allocated_size),
+        buf_(nullptr),
+        buf_offset_(KUDU_ALIGN_DOWN(file_size, kDirectIOAlignment)),
+        buf_len_(file_size - buf_offset_),
+        pending_sync_(false),
+        closed_(false) {}
+
+  ~PosixDirectWritableFile() {
+    WARN_NOT_OK(Close(), "Failed to close " + filename_);
+    free(buf_);
+  }
+
+  // Allocates the staging buffer and, if the file is being reopened with a
+  // partially filled last block, reads that block back into it.
+  Status Init() {
+    void* buf;
+    int err = posix_memalign(&buf, kDirectIOAlignment, kDirectIOWriteBufferSize);
+    if (err != 0) {
+      return IOError(filename_, err);
+    }
+    buf_ = static_cast<uint8_t*>(buf);
+    memset(buf_, 0, kDirectIOWriteBufferSize);
+    if (buf_len_ > 0) {
+      ThreadRestrictions::AssertIOAllowed();
+      ssize_t r;
+      RETRY_ON_EINTR(r, pread(fd_, buf_, kDirectIOAlignment, buf_offset_));
+      if (r < 0) {
+        return IOError(filename_, errno);
+      }
+      if (static_cast<size_t>(r) < buf_len_) {
+        return Status::Corruption(Substitute(
+            "$0: expected to read $1 bytes of the last block, got $2",
+            filename_,
+            buf_len_,
+            r));
+      }
+      memset(buf_ + buf_len_, 0, kDirectIOAlignment - buf_len_);
+    }
+    return Status::OK();
+  }
+
+  virtual Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+
+  virtual Status AppendV(ArrayView<const Slice> data) override {
+    ThreadRestrictions::AssertIOAllowed();
+    RETURN_NOT_OK(append_status_);
+    Status s = StageAndWrite(data);
+    if (PREDICT_FALSE(!s.ok())) {
+      // Some blocks may have been written, and moved out of the buffer, so
+      // the buffer no longer matches the file. Fail any further appends;
+      // Close() truncates away what this one wrote.
+      append_status_ = s.CloneAndPrepend("previous append failed");
+      return s;
+    }
+    return Status::OK();
+  }
+
+  virtual Status PreAllocate(uint64_t size) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+
+    TRACE_EVENT1(
+        "io", "PosixDirectWritableFile::PreAllocate", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    ScopedScheduledIO scheduled(0);
+    uint64_t offset = std::max(filesize_, pre_allocated_size_);
+    int ret;
+    RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, size));
+    if (ret != 0) {
+      if (errno == EOPNOTSUPP) {
+        KLOG_FIRST_N(WARNING, 1)
+            << "The filesystem does not support fallocate().";
+      } else if (errno == ENOSYS) {
+        KLOG_FIRST_N(WARNING, 1)
+            << "The kernel does not implement fallocate().";
+      } else {
+        return IOError(filename_, errno);
+      }
+    }
+    pre_allocated_size_ = offset + size;
+    return Status::OK();
+  }
+
+  virtual Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    TRACE_EVENT1("io", "PosixDirectWritableFile::Close", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    Status s;
+
+    // Preallocation, the padding of the last block and a failed append may
+    // all have left the file larger than the data written to it.
+    if (filesize_ < pre_allocated_size_ ||
+        filesize_ % kDirectIOAlignment != 0 || !append_status_.ok()) {
+      int ret;
+      RETRY_ON_EINTR(ret, ftruncate(fd_, filesize_));
+      if (ret != 0) {
+        s = IOError(filename_, errno);
+      }
+      pending_sync_ = true;
+    }
+
+    if (sync_on_close_) {
+      Status sync_status = Sync();
+      if (!sync_status.ok()) {
+        LOG(ERROR) << "Unable to Sync " << filename_ << ": "
+                   << sync_status.ToString();
+        if (s.ok()) {
+          s = sync_status;
+        }
+      }
+    }
+
+    int ret;
+    RETRY_ON_EINTR(ret, close(fd_));
+    if (ret < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+
+    closed_ = true;
+    return s;
+  }
+
+  // Data written with O_DIRECT never sits dirty in the page cache, so there is
+  // nothing to flush; durability still requires Sync().
+  virtual Status Flush(FlushMode /* mode */) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    return Status::OK();
+  }
+
+  virtual Status Sync() override {
+    TRACE_EVENT1("io", "PosixDirectWritableFile::Sync", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    LOG_SLOW_EXECUTION(
+        WARNING, 1000, Substitute("sync call for $0", filename_)) {
+      if (pending_sync_.exchange(false)) {
         RETURN_NOT_OK(DoSync(fd_, filename_));
       }
     }
@@ -834,13 +1057,72 @@ class PosixWritableFile : public WritableFile {
   }
 
  private:
+  // Stages 'data' in the buffer and writes it out.
+  Status StageAndWrite(ArrayView<const Slice> data) {
+    size_t bytes_appended = 0;
+    for (const Slice& slice : data) {
+      const uint8_t* src = slice.data();
+      size_t rem = slice.size();
+      while (rem > 0) {
+        size_t n = std::min(rem, kDirectIOWriteBufferSize - buf_len_);
+        memcpy(buf_ + buf_len_, src, n);
+        buf_len_ += n;
+        src += n;
+        rem -= n;
+        if (buf_len_ == kDirectIOWriteBufferSize) {
+          RETURN_NOT_OK(WriteBuffer());
+        }
+      }
+      bytes_appended += slice.size();
+    }
+    if (buf_len_ > 0) {
+      RETURN_NOT_OK(WriteBuffer());
+    }
+    filesize_ += bytes_appended;
+    DCHECK_EQ(filesize_, buf_offset_ + buf_len_);
+    pending_sync_ = true;
+    return Status::OK();
+  }
+
+  // Writes the staged data, padded to a whole number of blocks, at
+  // 'buf_offset_', and then moves the partially filled last block (if any) to
+  // the start of the buffer.
+  Status WriteBuffer() {
+    size_t write_len = KUDU_ALIGN_UP(buf_len_, kDirectIOAlignment);
+    memset(buf_ + buf_len_, 0, write_len - buf_len_);
+    Slice slice(buf_, write_len);
+    RETURN_NOT_OK(DoWriteV(
+        fd_, filename_, buf_offset_, ArrayView<const Slice>(&slice, 1)));
+
+    size_t full_blocks_len = KUDU_ALIGN_DOWN(buf_len_, kDirectIOAlignment);
+    if (full_blocks_len > 0) {
+      size_t tail_len = buf_len_ - full_blocks_len;
+      memmove(buf_, buf_ + full_blocks_len, tail_len);
+      memset(buf_ + tail_len, 0, full_blocks_len);
+      buf_offset_ += full_blocks_len;
+      buf_len_ = tail_len;
+    }
+    return Status::OK();
+  }
+
   const string filename_;
   const int fd_;
   const bool sync_on_close_;
 
   uint64_t filesize_;
   uint64_t pre_allocated_size_;
-  bool pending_sync_;
+
+  // Aligned staging buffer of kDirectIOWriteBufferSize bytes, holding the
+  // 'buf_len_' bytes of the file which start at 'buf_offset_'.
+  uint8_t* buf_;
+  uint64_t buf_offset_;
+  size_t buf_len_;
+
+  // The error of the append which failed, if one did.
+  Status append_status_;
+
+  // See PosixWritableFile::pending_sync_.
+  std::atomic<bool> pending_sync_;
   bool closed_;
 };
 
@@ -1270,6 +1552,7 @@ class PosixEnv : public Env {
     TRACE_EVENT1("io", "PosixEnv::DeleteFile", "path", fname);
     MAYBE_RETURN_EIO(fname, IOError(Env::kInjectedFailureStatusMsg, EIO));
     ThreadRestrictions::AssertIOAllowed();
+    ScopedScheduledIO scheduled(0);
     Status result;
     if (unlink(fname.c_str()) != 0) {
       result = IOError(fname, errno);
@@ -1906,11 +2189,42 @@ class PosixEnv : public Env {
       const WritableFileOptions& opts,
       unique_ptr<WritableFile>* result) {
     uint64_t file_size = 0;
+    uint64_t pre_allocated_size = 0;
     if (opts.mode == OPEN_EXISTING) {
       RETURN_NOT_OK(GetFileSize(fname, &file_size));
+      if (opts.overwrite_existing) {
+        pre_allocated_size = file_size;
+        file_size = 0;
+      }
+    }
+    if (opts.direct_io) {
+#if defined(__linux__)
+      int flags = fcntl(fd, F_GETFL);
+      if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0) {
+        unique_ptr<PosixDirectWritableFile> direct_file(
+            new PosixDirectWritableFile(
+                fname,
+                fd,
+                file_size,
+                opts.sync_on_close,
+                pre_allocated_size));
+        RETURN_NOT_OK(direct_file->Init());
+        result->reset(direct_file.release());
+        return Status::OK();
+      }
+      int err = errno;
+      KLOG_EVERY_N_SECS(WARNING, 60)
+          << "Unable to open " << fname
+          << " with O_DIRECT, falling back to buffered writes: "
+          << ErrnoToString(err);
+#else
+      KLOG_FIRST_N(WARNING, 1)
+          << "Direct I/O is not supported on this platform, "
+          << "falling back to buffered writes";
+#endif
     }
-    result->reset(
-        new PosixWritableFile(fname, fd, file_size, opts.sync_on_close));
+    result->reset(new PosixWritableFile(
+        fname, fd, file_size, opts.sync_on_close, pre_allocated_size));
     return Status::OK();
   }
 
@@ -251,7 +251,7 @@ Status CopyFile(
     RETURN_NOT_OK(dest->Append(data));
     bytes_read += data.size();
   }
-  return Status::OK();
+  return dest->Close();
 }
 
 Status
@@ -82,8 +82,10 @@ Status CreateDirsRecursively(Env* env, const std::string& path);
 
 // Copy the contents of file source_path to file dest_path.
 // This is not atomic, and if there is an error while reading or writing,
-// a partial copy may be left in 'dest_path'. Does not fsync the parent
-// directory of dest_path -- if you need durability then do that yourself.
+// a partial copy may be left in 'dest_path'. 'dest_path' is closed, and so
+// synced if 'opts.sync_on_close' is set, before returning. Does not fsync the
+// parent directory of dest_path -- if you need durability then do that
+// yourself.
 Status CopyFile(
     Env* env,
     const std::string& source_path,
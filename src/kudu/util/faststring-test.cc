@@ -19,13 +19,19 @@
 #include <cstring>
 #include <memory>
 
+#include <gflags/gflags_declare.h>
 #include <gtest/gtest.h>
 
 #include "kudu/util/faststring.h"
+#include "kudu/util/memory/huge_page_allocator.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_string(huge_page_mode);
+DECLARE_int64(huge_page_min_allocation_bytes);
+DECLARE_int64(huge_page_region_mb);
+
 namespace kudu {
 class FaststringTest : public KuduTest {};
 
@@ -63,4 +69,45 @@ TEST_F(FaststringTest, TestShrinkToFit_Random) {
   }
 }
 
+TEST_F(FaststringTest, TestHugePageBacked) {
+  FLAGS_huge_page_mode = "transparent";
+  FLAGS_huge_page_region_mb = 16;
+  FLAGS_huge_page_min_allocation_bytes = 64 * 1024;
+  const int kSize = 3 * 1024 * 1024;
+  const int kMB = 1024 * 1024;
+
+  Random r(GetRandomSeed32());
+  std::unique_ptr<char[]> random_bytes(new char[kSize]);
+  RandomString(random_bytes.get(), kSize, &r);
+
+  faststring s;
+  s.append(random_bytes.get(), 1024);
+  ASSERT_FALSE(HugePageAllocator::Owns(s.data()));
+  s.append(random_bytes.get() + 1024, kSize - 1024);
+  ASSERT_TRUE(HugePageAllocator::Owns(s.data()));
+  ASSERT_EQ(0, memcmp(s.data(), random_bytes.get(), kSize));
+
+  s.shrink_to_fit();
+  ASSERT_EQ(0, memcmp(s.data(), random_bytes.get(), kSize));
+
+  // Callers delete[] the released array, so it must come from the heap.
+  std::unique_ptr<uint8_t[]> released(s.release());
+  ASSERT_FALSE(HugePageAllocator::Owns(released.get()));
+  ASSERT_EQ(0, memcmp(released.get(), random_bytes.get(), kSize));
+
+  // Freed ranges are coalesced, so the whole region can be taken again.
+  {
+    faststring a(4 * kMB);
+    faststring b(4 * kMB);
+    ASSERT_TRUE(HugePageAllocator::Owns(a.data()));
+    ASSERT_TRUE(HugePageAllocator::Owns(b.data()));
+  }
+  faststring whole(16 * kMB);
+  ASSERT_TRUE(HugePageAllocator::Owns(whole.data()));
+
+  // Once the region is exhausted, buffers come from the heap.
+  faststring overflow(kMB);
+  ASSERT_FALSE(HugePageAllocator::Owns(overflow.data()));
+}
+
 } // namespace kudu
@@ -20,6 +20,8 @@
 #include <glog/logging.h>
 #include <memory>
 
+#include "kudu/util/memory/huge_page_allocator.h"
+
 namespace kudu {
 
 void faststring::GrowByAtLeast(size_t count) {
@@ -37,18 +39,18 @@ void faststring::GrowByAtLeast(size_t count) {
 
 void faststring::GrowArray(size_t newcapacity) {
   DCHECK_GE(newcapacity, capacity_);
-  std::unique_ptr<uint8_t[]> newdata(new uint8_t[newcapacity]);
+  uint8_t* newdata = AllocateArray(newcapacity);
   if (len_ > 0) {
     memcpy(&newdata[0], &data_[0], len_);
   }
-  capacity_ = newcapacity;
   if (data_ != initial_data_) {
-    delete[] data_;
+    FreeArray(data_, capacity_);
   } else {
     KUDU_ASAN_POISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
   }
+  capacity_ = newcapacity;
 
-  data_ = newdata.release();
+  data_ = newdata;
   KUDU_ASAN_POISON_MEMORY_REGION(data_ + len_, capacity_ - len_);
 }
 
@@ -57,16 +59,38 @@ void faststring::ShrinkToFitInternal() {
   if (len_ <= kInitialCapacity) {
     KUDU_ASAN_UNPOISON_MEMORY_REGION(initial_data_, len_);
     memcpy(initial_data_, &data_[0], len_);
-    delete[] data_;
+    FreeArray(data_, capacity_);
     data_ = initial_data_;
     capacity_ = kInitialCapacity;
   } else {
-    std::unique_ptr<uint8_t[]> newdata(new uint8_t[len_]);
+    uint8_t* newdata = AllocateArray(len_);
     memcpy(&newdata[0], &data_[0], len_);
-    delete[] data_;
-    data_ = newdata.release();
+    FreeArray(data_, capacity_);
+    data_ = newdata;
     capacity_ = len_;
   }
 }
 
+uint8_t* faststring::AllocateArray(size_t capacity) {
+  if (PREDICT_FALSE(HugePageAllocator::ShouldUse(capacity))) {
+    void* data = HugePageAllocator::Get()->Allocate(capacity);
+    if (data != nullptr) {
+      return static_cast<uint8_t*>(data);
+    }
+  }
+  return new uint8_t[capacity];
+}
+
+void faststring::FreeArray(uint8_t* data, size_t capacity) {
+  if (PREDICT_FALSE(HugePageAllocator::Owns(data))) {
+    HugePageAllocator::Get()->Free(data, capacity);
+  } else {
+    delete[] data;
+  }
+}
+
+bool faststring::IsHugePageBacked() const {
+  return HugePageAllocator::Owns(data_);
+}
+
 } // namespace kudu
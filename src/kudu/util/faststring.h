@@ -41,7 +41,7 @@ class faststring {
   explicit faststring(size_t capacity)
       : data_(initial_data_), len_(0), capacity_(kInitialCapacity) {
     if (capacity > capacity_) {
-      data_ = new uint8_t[capacity];
+      data_ = AllocateArray(capacity);
       capacity_ = capacity;
     }
     KUDU_ASAN_POISON_MEMORY_REGION(data_, capacity_);
@@ -50,7 +50,7 @@ class faststring {
   ~faststring() {
     KUDU_ASAN_UNPOISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
     if (data_ != initial_data_) {
-      delete[] data_;
+      FreeArray(data_, capacity_);
     }
   }
 
@@ -83,9 +83,12 @@ class faststring {
   // NOTE: the data pointer returned by release() is not necessarily the pointer
   uint8_t* release() WARN_UNUSED_RESULT {
     uint8_t* ret = data_;
-    if (ret == initial_data_) {
+    if (ret == initial_data_ || IsHugePageBacked()) {
       ret = new uint8_t[len_];
       memcpy(ret, data_, len_);
+      if (data_ != initial_data_) {
+        FreeArray(data_, capacity_);
+      }
     }
     len_ = 0;
     capacity_ = kInitialCapacity;
@@ -244,6 +247,16 @@ class faststring {
 
   void ShrinkToFitInternal();
 
+  // Allocates an array of 'capacity' bytes, from the huge page region if it
+  // is large enough and huge pages are enabled (see HugePageAllocator), and
+  // from the heap otherwise.
+  static uint8_t* AllocateArray(size_t capacity);
+
+  // Frees an array returned by AllocateArray().
+  static void FreeArray(uint8_t* data, size_t capacity);
+
+  bool IsHugePageBacked() const;
+
   uint8_t* data_;
   uint8_t initial_data_[kInitialCapacity];
   size_t len_;
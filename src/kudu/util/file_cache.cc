@@ -387,6 +387,15 @@ class Descriptor<RandomAccessFile> : public RandomAccessFile {
     return opened.file()->Size(size);
   }
 
+  Status Advise(
+      uint64_t offset,
+      uint64_t length,
+      AccessAdvice advice) const override {
+    ScopedOpenedDescriptor<RandomAccessFile> opened(&base_);
+    RETURN_NOT_OK(ReopenFileIfNecessary(&opened));
+    return opened.file()->Advise(offset, length, advice);
+  }
+
   const string& filename() const override {
     return base_.filename();
   }
@@ -19,12 +19,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
-#ifdef NDEBUG
 #include <vector>
-#endif
 
 #include <gtest/gtest.h>
 
+#include "kudu/util/coding.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/group_varint-inl.h"
 #ifdef NDEBUG
@@ -118,6 +117,42 @@ TEST(TestGroupVarInt, TestRoundTrip) {
   }
 }
 
+// The batch varint functions match the one-at-a-time ones, across runs of
+// one-byte varints which take the SIMD paths and the values which break them.
+TEST(TestGroupVarInt, TestVarintBatch) {
+  for (int iter = 0; iter < 1000; iter++) {
+    const size_t n = random() % 100;
+    std::vector<uint32_t> values(n);
+    for (uint32_t& v : values) {
+      v = random() % 8 == 0 ? random() : random() % 128;
+    }
+    faststring expected;
+    for (uint32_t v : values) {
+      PutVarint32(&expected, v);
+    }
+    faststring buf;
+    PutVarint32Batch(&buf, values.data(), n);
+    ASSERT_EQ(expected.ToString(), buf.ToString());
+
+    const uint8_t* limit = buf.data() + buf.size();
+    std::vector<uint32_t> decoded32(n);
+    ASSERT_EQ(limit, GetVarint32Batch(buf.data(), limit, decoded32.data(), n));
+    ASSERT_EQ(values, decoded32);
+    std::vector<uint64_t> decoded64(n);
+    ASSERT_EQ(limit, GetVarint64Batch(buf.data(), limit, decoded64.data(), n));
+    ASSERT_EQ(std::vector<uint64_t>(values.begin(), values.end()), decoded64);
+
+    if (n > 0) {
+      ASSERT_EQ(
+          nullptr,
+          GetVarint32Batch(buf.data(), limit - 1, decoded32.data(), n));
+      ASSERT_EQ(
+          nullptr,
+          GetVarint64Batch(buf.data(), limit - 1, decoded64.data(), n));
+    }
+  }
+}
+
 #ifdef NDEBUG
 TEST(TestGroupVarInt, EncodingBenchmark) {
   int n_ints = 1000000;
@@ -116,4 +116,25 @@ TEST_F(HdrHistogramTest, PercentileAndCopyTest) {
   ASSERT_EQ(hist.TotalSum(), copy.TotalSum());
 }
 
+TEST_F(HdrHistogramTest, MergeTest) {
+  uint64_t specified_max = 10000;
+  HdrHistogram low(specified_max, kSigDigits);
+  HdrHistogram high(specified_max, kSigDigits);
+  for (int i = 1; i <= 50; i++) {
+    low.Increment(i);
+    high.Increment(i + 50);
+  }
+
+  HdrHistogram merged(specified_max, kSigDigits);
+  merged.MergeFrom(low);
+  merged.MergeFrom(high);
+  // Merging an empty histogram changes nothing.
+  merged.MergeFrom(HdrHistogram(specified_max, kSigDigits));
+  ASSERT_EQ(100, merged.TotalCount());
+  ASSERT_EQ(low.TotalSum() + high.TotalSum(), merged.TotalSum());
+  ASSERT_EQ(1, merged.MinValue());
+  ASSERT_EQ(100, merged.MaxValue());
+  ASSERT_EQ(50, merged.ValueAtPercentile(50));
+}
+
 } // namespace kudu
@@ -207,6 +207,39 @@ void HdrHistogram::IncrementWithExpectedInterval(
   }
 }
 
+void HdrHistogram::MergeFrom(const HdrHistogram& other) {
+  CHECK_EQ(highest_trackable_value_, other.highest_trackable_value_);
+  CHECK_EQ(num_significant_digits_, other.num_significant_digits_);
+  shared_lock<rw_spinlock> lock(histogram_mutex_);
+
+  uint64_t total_merged_count = 0;
+  for (int i = 0; i < counts_array_length_; i++) {
+    uint64_t count = NoBarrier_Load(&other.counts_[i]);
+    if (count != 0) {
+      NoBarrier_AtomicIncrement(&counts_[i], count);
+      total_merged_count += count;
+    }
+  }
+  // As in the copy constructor, keep the total consistent with the counts.
+  NoBarrier_AtomicIncrement(&total_count_, total_merged_count);
+  NoBarrier_AtomicIncrement(&total_sum_, NoBarrier_Load(&other.total_sum_));
+
+  Atomic64 other_min = NoBarrier_Load(&other.min_value_);
+  Atomic64 min_val;
+  while (other_min < (min_val = NoBarrier_Load(&min_value_))) {
+    if (NoBarrier_CompareAndSwap(&min_value_, min_val, other_min) == min_val) {
+      break;
+    }
+  }
+  Atomic64 other_max = NoBarrier_Load(&other.max_value_);
+  Atomic64 max_val;
+  while (other_max > (max_val = NoBarrier_Load(&max_value_))) {
+    if (NoBarrier_CompareAndSwap(&max_value_, max_val, other_max) == max_val) {
+      break;
+    }
+  }
+}
+
 ////////////////////////////////////
 
 int HdrHistogram::BucketIndex(uint64_t value) const {
@@ -98,6 +98,11 @@ class HdrHistogram {
       int64_t value,
       int64_t expected_interval_between_samples);
 
+  // Add the values recorded in 'other', which must have the same highest
+  // trackable value and number of significant digits, to this histogram.
+  // Like the copy constructor, this is not a consistent snapshot of 'other'.
+  void MergeFrom(const HdrHistogram& other);
+
   // Fetch configuration params.
   uint64_t highest_trackable_value() const {
     return highest_trackable_value_;
@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_scheduler.h"
+
+#include <thread>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(env_io_background_max_wait_ms);
+DECLARE_int64(env_io_maintenance_bytes_per_sec);
+
+namespace kudu {
+
+class IOSchedulerTest : public KuduTest {
+ protected:
+  IOScheduler scheduler_;
+};
+
+TEST_F(IOSchedulerTest, TestScopedIOClass) {
+  ASSERT_EQ(IOClass::kDefault, CurrentIOClass());
+  {
+    ScopedIOClass wal(IOClass::kWalCommit);
+    ASSERT_EQ(IOClass::kWalCommit, CurrentIOClass());
+    {
+      ScopedIOClass maintenance(IOClass::kMaintenance);
+      ASSERT_EQ(IOClass::kMaintenance, CurrentIOClass());
+    }
+    ASSERT_EQ(IOClass::kWalCommit, CurrentIOClass());
+  }
+  ASSERT_EQ(IOClass::kDefault, CurrentIOClass());
+}
+
+// Background I/O pays for the bytes it takes beyond its class's bucket by
+// waiting, while commit-path I/O is never delayed.
+TEST_F(IOSchedulerTest, TestBackgroundRateLimit) {
+  FLAGS_env_io_maintenance_bytes_per_sec = 100 * 1024;
+  ASSERT_LT(
+      scheduler_.Admit(IOClass::kMaintenance, 100 * 1024).ToMilliseconds(),
+      50);
+  scheduler_.Done(IOClass::kMaintenance);
+  MonoDelta delay = scheduler_.Admit(IOClass::kMaintenance, 10 * 1024);
+  scheduler_.Done(IOClass::kMaintenance);
+  ASSERT_GE(delay.ToMilliseconds(), 80);
+  ASSERT_EQ(110 * 1024, scheduler_.bytes(IOClass::kMaintenance));
+  ASSERT_GE(scheduler_.delay_micros(IOClass::kMaintenance), 80 * 1000);
+
+  ASSERT_EQ(
+      0, scheduler_.Admit(IOClass::kWalCommit, 1024 * 1024).ToMicroseconds());
+  scheduler_.Done(IOClass::kWalCommit);
+}
+
+// Background I/O waits for the commit-path I/O in flight, but only for so
+// long.
+TEST_F(IOSchedulerTest, TestBackgroundWaitsForCommitPath) {
+  FLAGS_env_io_background_max_wait_ms = 10000;
+  scheduler_.Admit(IOClass::kWalCommit, 4096);
+  std::thread done([&]() {
+    SleepFor(MonoDelta::FromMilliseconds(100));
+    scheduler_.Done(IOClass::kWalCommit);
+  });
+  MonoDelta delay = scheduler_.Admit(IOClass::kCatchUp, 4096);
+  scheduler_.Done(IOClass::kCatchUp);
+  done.join();
+  ASSERT_GE(delay.ToMilliseconds(), 80);
+  ASSERT_LT(delay.ToMilliseconds(), 10000);
+
+  FLAGS_env_io_background_max_wait_ms = 50;
+  scheduler_.Admit(IOClass::kMetadata, 512);
+  delay = scheduler_.Admit(IOClass::kCatchUp, 4096);
+  scheduler_.Done(IOClass::kCatchUp);
+  scheduler_.Done(IOClass::kMetadata);
+  ASSERT_GE(delay.ToMilliseconds(), 40);
+}
+
+} // namespace kudu
@@ -0,0 +1,301 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_scheduler.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/metrics.h"
+
+DEFINE_bool(
+    env_io_scheduling,
+    false,
+    "Whether disk I/O is scheduled by class. I/O tagged as catch-up reads or "
+    "maintenance, such as segment preallocation and GC, then waits for the "
+    "WAL's writes and syncs, and consensus metadata flushes, in flight to "
+    "finish, for up to --env_io_background_max_wait_ms, and is limited to "
+    "--env_io_catch_up_bytes_per_sec and --env_io_maintenance_bytes_per_sec.");
+TAG_FLAG(env_io_scheduling, experimental);
+TAG_FLAG(env_io_scheduling, runtime);
+
+DEFINE_int32(
+    env_io_background_max_wait_ms,
+    20,
+    "The longest a background I/O waits for commit-path I/O to finish, with "
+    "--env_io_scheduling, so that it still makes progress while the WAL is "
+    "busy.");
+TAG_FLAG(env_io_background_max_wait_ms, experimental);
+TAG_FLAG(env_io_background_max_wait_ms, runtime);
+
+DEFINE_int64(
+    env_io_catch_up_bytes_per_sec,
+    0,
+    "With --env_io_scheduling, the rate at which ops are read from disk for "
+    "lagging peers, and segments for rebuilding replicas. 0 means no limit.");
+TAG_FLAG(env_io_catch_up_bytes_per_sec, experimental);
+TAG_FLAG(env_io_catch_up_bytes_per_sec, runtime);
+
+DEFINE_int64(
+    env_io_maintenance_bytes_per_sec,
+    0,
+    "With --env_io_scheduling, the rate of WAL maintenance I/O such as "
+    "segment preallocation, GC and archiving. 0 means no limit.");
+TAG_FLAG(env_io_maintenance_bytes_per_sec, experimental);
+TAG_FLAG(env_io_maintenance_bytes_per_sec, runtime);
+
+DEFINE_bool(
+    env_io_set_ioprio,
+    false,
+    "Whether threads doing catch-up or maintenance I/O lower their kernel "
+    "I/O priority to the lowest levels of the best-effort class while doing "
+    "so. Only has an effect with I/O schedulers which honor priorities, such "
+    "as BFQ.");
+TAG_FLAG(env_io_set_ioprio, experimental);
+TAG_FLAG(env_io_set_ioprio, runtime);
+
+METRIC_DEFINE_gauge_uint64(
+    server,
+    wal_commit_io_bytes,
+    "WAL Commit I/O Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes read and written by the WAL append thread since the server "
+    "started, with --env_io_scheduling.");
+METRIC_DEFINE_gauge_uint64(
+    server,
+    metadata_io_bytes,
+    "Metadata I/O Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes read and written by consensus metadata flushes since the server "
+    "started, with --env_io_scheduling.");
+METRIC_DEFINE_gauge_uint64(
+    server,
+    catch_up_io_bytes,
+    "Catch-up I/O Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes read for lagging peers and rebuilding replicas since the server "
+    "started, with --env_io_scheduling.");
+METRIC_DEFINE_gauge_uint64(
+    server,
+    maintenance_io_bytes,
+    "Maintenance I/O Bytes",
+    kudu::MetricUnit::kBytes,
+    "Bytes read and written by WAL maintenance since the server started, "
+    "with --env_io_scheduling.");
+METRIC_DEFINE_gauge_uint64(
+    server,
+    catch_up_io_delay,
+    "Catch-up I/O Delay",
+    kudu::MetricUnit::kMicroseconds,
+    "Total time catch-up I/O was delayed behind commit-path I/O or by "
+    "--env_io_catch_up_bytes_per_sec since the server started.");
+METRIC_DEFINE_gauge_uint64(
+    server,
+    maintenance_io_delay,
+    "Maintenance I/O Delay",
+    kudu::MetricUnit::kMicroseconds,
+    "Total time maintenance I/O was delayed behind commit-path I/O or by "
+    "--env_io_maintenance_bytes_per_sec since the server started.");
+
+namespace kudu {
+
+namespace {
+
+__thread IOClass tls_io_class = IOClass::kDefault;
+
+#if defined(__linux__)
+// From linux/ioprio.h, which glibc doesn't wrap. IOPRIO_WHO_PROCESS with a
+// zero id is the calling thread.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioClassBestEffort = 2;
+
+// Returns the I/O priority of the calling thread, or -1 on error.
+int GetThreadIoprio() {
+  return syscall(SYS_ioprio_get, kIoprioWhoProcess, 0);
+}
+
+bool SetThreadIoprio(int ioprio) {
+  return syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, ioprio) == 0;
+}
+#endif
+
+uint64_t GetIOBytes(IOClass io_class) {
+  return IOScheduler::Get()->bytes(io_class);
+}
+
+uint64_t GetIODelayMicros(IOClass io_class) {
+  return IOScheduler::Get()->delay_micros(io_class);
+}
+
+void RegisterGauge(
+    const scoped_refptr<MetricEntity>& entity,
+    const GaugePrototype<uint64_t>& prototype,
+    uint64_t (*getter)(IOClass),
+    IOClass io_class) {
+  entity->NeverRetire(
+      prototype.InstantiateFunctionGauge(entity, Bind(getter, io_class)));
+}
+
+} // anonymous namespace
+
+IOClass CurrentIOClass() {
+  return tls_io_class;
+}
+
+ScopedIOClass::ScopedIOClass(IOClass io_class)
+    : prev_class_(tls_io_class), prev_ioprio_(-1) {
+  tls_io_class = io_class;
+#if defined(__linux__)
+  if (FLAGS_env_io_set_ioprio && IsBackgroundIOClass(io_class)) {
+    const int ioprio = GetThreadIoprio();
+    const int level = io_class == IOClass::kCatchUp ? 6 : 7;
+    if (ioprio >= 0 &&
+        SetThreadIoprio(kIoprioClassBestEffort << kIoprioClassShift | level)) {
+      prev_ioprio_ = ioprio;
+    }
+  }
+#endif
+}
+
+ScopedIOClass::~ScopedIOClass() {
+#if defined(__linux__)
+  if (prev_ioprio_ >= 0) {
+    SetThreadIoprio(prev_ioprio_);
+  }
+#endif
+  tls_io_class = prev_class_;
+}
+
+IOScheduler* IOScheduler::Get() {
+  static IOScheduler* scheduler = new IOScheduler();
+  return scheduler;
+}
+
+MonoDelta IOScheduler::Admit(IOClass io_class, uint64_t bytes) {
+  ClassState& state = classes_[static_cast<int>(io_class)];
+  state.bytes += bytes;
+  if (!IsBackgroundIOClass(io_class)) {
+    if (io_class != IOClass::kDefault) {
+      foreground_inflight_++;
+    }
+    return MonoDelta::FromMicroseconds(0);
+  }
+
+  const MonoTime start = MonoTime::Now();
+  MonoDelta debt;
+  {
+    MutexLock l(lock_);
+    const MonoTime deadline = start +
+        MonoDelta::FromMilliseconds(FLAGS_env_io_background_max_wait_ms);
+    while (foreground_inflight_ > 0) {
+      if (!foreground_done_.WaitUntil(deadline)) {
+        break;
+      }
+    }
+
+    const int64_t rate = io_class == IOClass::kCatchUp
+        ? FLAGS_env_io_catch_up_bytes_per_sec
+        : FLAGS_env_io_maintenance_bytes_per_sec;
+    if (rate > 0) {
+      // Refill the bucket, which holds up to a second's worth of bytes, and
+      // take this I/O's bytes from it. If that leaves it short, the I/O pays
+      // off the shortfall by waiting.
+      const MonoTime now = MonoTime::Now();
+      if (state.last_refill.Initialized()) {
+        const int64_t elapsed_us = std::min(
+            (now - state.last_refill).ToMicroseconds(),
+            MonoTime::kMicrosecondsPerSecond);
+        state.tokens = std::min(
+            state.tokens +
+                rate * elapsed_us / MonoTime::kMicrosecondsPerSecond,
+            rate);
+      } else {
+        state.tokens = rate;
+      }
+      state.last_refill = now;
+      state.tokens -= bytes;
+      if (state.tokens < 0) {
+        debt = MonoDelta::FromMicroseconds(
+            -state.tokens * MonoTime::kMicrosecondsPerSecond / rate);
+      }
+    }
+  }
+  if (debt.Initialized()) {
+    SleepFor(debt);
+  }
+  const MonoDelta delay = MonoTime::Now() - start;
+  state.delay_micros += delay.ToMicroseconds();
+  return delay;
+}
+
+void IOScheduler::Done(IOClass io_class) {
+  if (IsBackgroundIOClass(io_class) || io_class == IOClass::kDefault) {
+    return;
+  }
+  if (--foreground_inflight_ == 0) {
+    MutexLock l(lock_);
+    foreground_done_.Broadcast();
+  }
+}
+
+ScopedScheduledIO::ScopedScheduledIO(uint64_t bytes)
+    : io_class_(tls_io_class) {
+  if (PREDICT_FALSE(FLAGS_env_io_scheduling)) {
+    IOScheduler::Get()->Admit(io_class_, bytes);
+    admitted_ = true;
+  }
+}
+
+ScopedScheduledIO::~ScopedScheduledIO() {
+  if (admitted_) {
+    IOScheduler::Get()->Done(io_class_);
+  }
+}
+
+void RegisterIOSchedulerMetrics(const scoped_refptr<MetricEntity>& entity) {
+  RegisterGauge(
+      entity, METRIC_wal_commit_io_bytes, &GetIOBytes, IOClass::kWalCommit);
+  RegisterGauge(
+      entity, METRIC_metadata_io_bytes, &GetIOBytes, IOClass::kMetadata);
+  RegisterGauge(
+      entity, METRIC_catch_up_io_bytes, &GetIOBytes, IOClass::kCatchUp);
+  RegisterGauge(
+      entity,
+      METRIC_maintenance_io_bytes,
+      &GetIOBytes,
+      IOClass::kMaintenance);
+  RegisterGauge(
+      entity, METRIC_catch_up_io_delay, &GetIODelayMicros, IOClass::kCatchUp);
+  RegisterGauge(
+      entity,
+      METRIC_maintenance_io_delay,
+      &GetIODelayMicros,
+      IOClass::kMaintenance);
+}
+
+} // namespace kudu
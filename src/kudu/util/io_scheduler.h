@@ -0,0 +1,145 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Scheduling of disk I/O by class.
+//
+// Code on the commit path, and code doing background I/O, tags its thread
+// with a ScopedIOClass. With --env_io_scheduling, the posix Env then admits
+// each read, write and sync through the process-wide IOScheduler: I/O of the
+// commit-path classes goes straight through, while I/O of the background
+// classes first waits, for a bounded time, for the commit-path I/O in flight
+// to finish, and then for its class's token bucket. Background I/O keeps
+// making progress at its configured rate, but no longer queues up in front
+// of the WAL's writes and syncs.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+
+namespace kudu {
+
+class MetricEntity;
+
+enum class IOClass : uint8_t {
+  // I/O which was not tagged.
+  kDefault,
+  // The WAL append thread's writes and syncs.
+  kWalCommit,
+  // Flushes of consensus metadata, which votes and config changes wait for.
+  kMetadata,
+  // Reads of ops for lagging peers and of segments for rebuilding replicas.
+  kCatchUp,
+  // Segment preallocation, GC and archiving.
+  kMaintenance,
+};
+constexpr int kNumIOClasses = 5;
+
+// Whether I/O of 'io_class' waits for the commit-path I/O in flight.
+inline bool IsBackgroundIOClass(IOClass io_class) {
+  return io_class == IOClass::kCatchUp || io_class == IOClass::kMaintenance;
+}
+
+// The I/O class of the calling thread.
+IOClass CurrentIOClass();
+
+// Tags the I/O of the calling thread with 'io_class' for the lifetime of
+// the object, restoring the previous class when destroyed. With
+// --env_io_set_ioprio, also lowers the kernel I/O priority of the thread for
+// background classes.
+class ScopedIOClass {
+ public:
+  explicit ScopedIOClass(IOClass io_class);
+  ~ScopedIOClass();
+
+ private:
+  const IOClass prev_class_;
+  // The thread's I/O priority to restore, or -1 if it wasn't changed.
+  int prev_ioprio_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedIOClass);
+};
+
+class IOScheduler {
+ public:
+  IOScheduler() : foreground_done_(&lock_) {}
+
+  // The scheduler the posix Env admits I/O through.
+  static IOScheduler* Get();
+
+  // Admits an I/O of 'bytes' in 'io_class', first delaying it if the class
+  // is a background one. Returns how long it was delayed. Each call must be
+  // followed by Done() once the I/O completes.
+  MonoDelta Admit(IOClass io_class, uint64_t bytes);
+  void Done(IOClass io_class);
+
+  // The bytes admitted, and the total time I/O was delayed, in 'io_class'.
+  uint64_t bytes(IOClass io_class) const {
+    return classes_[static_cast<int>(io_class)].bytes;
+  }
+  uint64_t delay_micros(IOClass io_class) const {
+    return classes_[static_cast<int>(io_class)].delay_micros;
+  }
+
+ private:
+  struct ClassState {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> delay_micros{0};
+    // Token bucket of the class, in bytes, and when it was last refilled.
+    // May go negative, by the bytes the I/O waiting for it owes. Protected by
+    // 'lock_'.
+    int64_t tokens = 0;
+    MonoTime last_refill;
+  };
+
+  // The number of commit-path I/Os in flight.
+  std::atomic<int> foreground_inflight_{0};
+
+  Mutex lock_;
+  // Signalled when 'foreground_inflight_' drops to 0.
+  ConditionVariable foreground_done_;
+
+  ClassState classes_[kNumIOClasses];
+
+  DISALLOW_COPY_AND_ASSIGN(IOScheduler);
+};
+
+// Admits an I/O of the calling thread's class through IOScheduler::Get() for
+// the lifetime of the object, if --env_io_scheduling is set.
+class ScopedScheduledIO {
+ public:
+  explicit ScopedScheduledIO(uint64_t bytes);
+  ~ScopedScheduledIO();
+
+ private:
+  const IOClass io_class_;
+  bool admitted_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedScheduledIO);
+};
+
+// Register metrics in the given server entity which measure the I/O of each
+// class, and how long background I/O was delayed.
+void RegisterIOSchedulerMetrics(const scoped_refptr<MetricEntity>& entity);
+
+} // namespace kudu
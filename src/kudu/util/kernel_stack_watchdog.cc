@@ -99,6 +99,18 @@ std::vector<string> KernelStackWatchdog::LoggedMessagesForTests() const {
   return *log_collector_;
 }
 
+int KernelStackWatchdog::AddStallCallback(StallCallback cb) {
+  MutexLock l(stall_callbacks_lock_);
+  int id = next_stall_callback_id_++;
+  InsertOrDie(&stall_callbacks_, id, std::move(cb));
+  return id;
+}
+
+void KernelStackWatchdog::RemoveStallCallback(int id) {
+  MutexLock l(stall_callbacks_lock_);
+  CHECK(stall_callbacks_.erase(id));
+}
+
 void KernelStackWatchdog::Register(TLS* tls) {
   int64_t tid = Thread::CurrentThreadId();
   lock_guard<simple_spinlock> l(tls_lock_);
@@ -203,18 +215,45 @@ void KernelStackWatchdog::RunThread() {
             break;
           }
 
-          lock_guard<simple_spinlock> l(log_lock_);
-          LOG_STRING(WARNING, log_collector_.get())
-              << "Thread " << p << " stuck at " << frame->status_ << " for "
-              << paused_ms << "ms"
-              << ":\n"
-              << "Kernel stack:\n"
-              << kernel_stack << "\n"
-              << "User stack:\n"
-              << user_stack;
+          {
+            lock_guard<simple_spinlock> l(log_lock_);
+            LOG_STRING(WARNING, log_collector_.get())
+                << "Thread " << p << " stuck at " << frame->status_ << " for "
+                << paused_ms << "ms"
+                << ":\n"
+                << "Kernel stack:\n"
+                << kernel_stack << "\n"
+                << "User stack:\n"
+                << user_stack;
+          }
+
+          // Nested frames start later than the frames around them, so this
+          // only lets through the frames that weren't reported yet.
+          kudu::MicrosecondsInt64* reported = &reported_stalls_[p];
+          if (frame->start_time_ > *reported) {
+            *reported = frame->start_time_;
+            Stall stall{p,
+                        frame->status_,
+                        paused_ms,
+                        std::move(kernel_stack),
+                        std::move(user_stack)};
+            MutexLock l(stall_callbacks_lock_);
+            for (const auto& entry : stall_callbacks_) {
+              entry.second(stall);
+            }
+          }
         }
       }
     }
+
+    // Forget the threads which have exited.
+    for (auto it = reported_stalls_.begin(); it != reported_stalls_.end();) {
+      if (ContainsKey(tls_map_copy, it->first)) {
+        ++it;
+      } else {
+        it = reported_stalls_.erase(it);
+      }
+    }
   }
 }
 
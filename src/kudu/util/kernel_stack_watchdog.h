@@ -57,6 +57,8 @@
 
 #include <ctime>
 #include <memory>
+#include <functional>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -100,6 +102,29 @@ class KernelStackWatchdog {
   // SaveLogsForTests(true).
   std::vector<std::string> LoggedMessagesForTests() const;
 
+  // A thread which stayed in a watched scope longer than its threshold.
+  struct Stall {
+    pid_t tid;
+    // The label of the watched scope.
+    std::string label;
+    int paused_ms;
+    std::string kernel_stack;
+    std::string user_stack;
+  };
+  typedef std::function<void(const Stall&)> StallCallback;
+
+  // Registers 'cb' to be called on the watchdog thread with each stall it
+  // finds, besides the warning it logs. While a thread stays stuck in the
+  // same scope, the warning repeats on every check, but 'cb' only hears of
+  // the stall once. 'cb' should return quickly, as it holds up the checks.
+  //
+  // Returns an id to pass to RemoveStallCallback().
+  int AddStallCallback(StallCallback cb);
+
+  // Unregisters the callback with the given id. Once this returns, the
+  // callback is not running and won't be called again.
+  void RemoveStallCallback(int id);
+
  private:
   friend class Singleton<KernelStackWatchdog>;
   friend class ScopedWatchKernelStack;
@@ -232,6 +257,18 @@ class KernelStackWatchdog {
   // this lock must be acquired first.
   Mutex unregister_lock_;
 
+  // Callbacks from AddStallCallback(), by id.
+  std::map<int, StallCallback> stall_callbacks_;
+  int next_stall_callback_id_ = 0;
+
+  // Lock protecting stall_callbacks_ and next_stall_callback_id_. It is held
+  // while the callbacks run, after 'unregister_lock_'.
+  Mutex stall_callbacks_lock_;
+
+  // For each thread, the start time of the watched frame whose stall was last
+  // passed to the callbacks. Only accessed by the watchdog thread.
+  std::unordered_map<pid_t, kudu::MicrosecondsInt64> reported_stalls_;
+
   // The watchdog thread itself.
   scoped_refptr<Thread> thread_;
 
@@ -281,10 +318,13 @@ class ScopedWatchKernelStack {
     // "Release" the sequence lock. This resets the lock value to be even, so
     // readers will proceed.
     base::subtle::Release_Store(&tls_data->seq_lock_, tls_data->seq_lock_ + 1);
+    watching_ = true;
   }
 
   ~ScopedWatchKernelStack() {
-    if (!KernelStackWatchdog::tls_)
+    // An unwatched scope didn't push a frame, though an enclosing scope may
+    // have created the TLS.
+    if (!watching_)
       return;
 
     KernelStackWatchdog::TLS::Data* tls = &KernelStackWatchdog::tls_->data_;
@@ -299,6 +339,8 @@ class ScopedWatchKernelStack {
   }
 
  private:
+  bool watching_ = false;
+
   DISALLOW_COPY_AND_ASSIGN(ScopedWatchKernelStack);
 };
 
@@ -0,0 +1,157 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profiling.h"
+
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/rw_mutex.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+
+METRIC_DEFINE_entity(lock_profiling_test_entity);
+
+METRIC_DEFINE_histogram(
+    lock_profiling_test_entity,
+    test_lock_wait_time,
+    "Test Lock Wait Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds spent waiting for the test lock",
+    60000000LU,
+    2);
+
+METRIC_DEFINE_histogram(
+    lock_profiling_test_entity,
+    test_lock_hold_time,
+    "Test Lock Hold Time",
+    MetricUnit::kMicroseconds,
+    "Microseconds the test lock was held",
+    60000000LU,
+    2);
+
+class LockProfilingTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    entity_ = METRIC_ENTITY_lock_profiling_test_entity.Instantiate(
+        &registry_, "lock-profiling-test");
+    wait_time_ = METRIC_test_lock_wait_time.Instantiate(entity_);
+    hold_time_ = METRIC_test_lock_hold_time.Instantiate(entity_);
+    profile_.reset(new LockProfile("test_lock", wait_time_, hold_time_));
+  }
+
+ protected:
+  // Holds 'lock' for 50ms in another thread while this thread waits for
+  // it, then checks what the profile recorded.
+  template <class LockType>
+  void CheckContendedLock(LockType* lock) {
+    const MonoDelta kHold = MonoDelta::FromMilliseconds(50);
+    CountDownLatch held(1);
+    std::thread holder([&]() {
+      std::lock_guard<LockType> l(*lock);
+      held.CountDown();
+      SleepFor(kHold);
+    });
+    held.Wait();
+    { std::lock_guard<LockType> l(*lock); }
+    holder.join();
+
+    ASSERT_EQ(2, wait_time_->TotalCount());
+    ASSERT_EQ(2, hold_time_->TotalCount());
+    // The waiter saw most of the holder's critical section.
+    ASSERT_GE(wait_time_->Snapshot()->MaxValue(), kHold.ToMicroseconds() / 2);
+    ASSERT_GE(hold_time_->Snapshot()->MaxValue(), kHold.ToMicroseconds());
+  }
+
+  MetricRegistry registry_;
+  scoped_refptr<MetricEntity> entity_;
+  scoped_refptr<Histogram> wait_time_;
+  scoped_refptr<Histogram> hold_time_;
+  std::unique_ptr<LockProfile> profile_;
+};
+
+TEST_F(LockProfilingTest, TestSimpleMutexLock) {
+  simple_mutexlock lock;
+  lock.set_profile(profile_.get());
+  NO_FATALS(CheckContendedLock(&lock));
+}
+
+TEST_F(LockProfilingTest, TestMutex) {
+  Mutex lock;
+  lock.set_profile(profile_.get());
+  NO_FATALS(CheckContendedLock(&lock));
+}
+
+TEST_F(LockProfilingTest, TestRWMutex) {
+  RWMutex lock;
+  lock.set_profile(profile_.get());
+  NO_FATALS(CheckContendedLock(&lock));
+
+  // Shared acquisitions record a wait but no hold time.
+  lock.ReadLock();
+  lock.ReadUnlock();
+  ASSERT_EQ(3, wait_time_->TotalCount());
+  ASSERT_EQ(2, hold_time_->TotalCount());
+}
+
+// A profile attached while the lock is held does not record a hold time for
+// that acquisition.
+TEST_F(LockProfilingTest, TestAttachWhileHeld) {
+  simple_mutexlock lock;
+  lock.lock();
+  lock.set_profile(profile_.get());
+  lock.unlock();
+  ASSERT_EQ(0, hold_time_->TotalCount());
+
+  lock.lock();
+  lock.unlock();
+  ASSERT_EQ(1, wait_time_->TotalCount());
+  ASSERT_EQ(1, hold_time_->TotalCount());
+}
+
+TEST_F(LockProfilingTest, TestDump) {
+  simple_mutexlock lock;
+  lock.set_profile(profile_.get());
+  lock.lock();
+  lock.unlock();
+
+  std::ostringstream out;
+  DumpLockProfiles(&out);
+  ASSERT_STR_CONTAINS(out.str(), "test_lock: acquisitions=1");
+
+  profile_.reset();
+  std::ostringstream after;
+  DumpLockProfiles(&after);
+  ASSERT_STR_NOT_CONTAINS(after.str(), "test_lock");
+}
+
+} // namespace kudu
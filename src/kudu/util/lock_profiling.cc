@@ -0,0 +1,136 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profiling.h"
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/debug-util.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
+
+DEFINE_bool(
+    lock_profiling,
+    false,
+    "Whether the consensus and log locks record their wait and hold times "
+    "into histograms. Read when the owner of each lock is created.");
+TAG_FLAG(lock_profiling, experimental);
+
+DEFINE_int64(
+    lock_profiling_stack_threshold_us,
+    0,
+    "If lock profiling is enabled and a thread waits at least this long for "
+    "a profiled lock, its stack is logged, at most once a second. 0 disables "
+    "the stack logging.");
+TAG_FLAG(lock_profiling_stack_threshold_us, experimental);
+TAG_FLAG(lock_profiling_stack_threshold_us, runtime);
+
+namespace kudu {
+
+namespace {
+
+// Live profiles, for DumpLockProfiles().
+simple_spinlock g_profiles_lock;
+std::set<const LockProfile*>* g_profiles = nullptr;
+
+} // anonymous namespace
+
+LockProfile::LockProfile(
+    std::string name,
+    scoped_refptr<Histogram> wait_time,
+    scoped_refptr<Histogram> hold_time)
+    : name_(std::move(name)),
+      wait_time_(std::move(wait_time)),
+      hold_time_(std::move(hold_time)),
+      acquired_at_us_(0) {
+  std::lock_guard<simple_spinlock> l(g_profiles_lock);
+  if (g_profiles == nullptr) {
+    g_profiles = new std::set<const LockProfile*>();
+  }
+  g_profiles->insert(this);
+}
+
+LockProfile::~LockProfile() {
+  std::lock_guard<simple_spinlock> l(g_profiles_lock);
+  g_profiles->erase(this);
+}
+
+void LockProfile::Acquired(int64_t wait_us) {
+  RecordWait(wait_us);
+  acquired_at_us_ = GetMonoTimeMicros();
+}
+
+void LockProfile::Released() {
+  // Zero if the lock was acquired before this profile was attached.
+  if (PREDICT_FALSE(acquired_at_us_ == 0)) {
+    return;
+  }
+  hold_time_->Increment(GetMonoTimeMicros() - acquired_at_us_);
+  acquired_at_us_ = 0;
+}
+
+void LockProfile::AcquiredShared(int64_t wait_us) {
+  RecordWait(wait_us);
+}
+
+void LockProfile::RecordWait(int64_t wait_us) {
+  wait_time_->Increment(wait_us);
+  const int64_t threshold = FLAGS_lock_profiling_stack_threshold_us;
+  if (PREDICT_FALSE(threshold > 0 && wait_us >= threshold)) {
+    KLOG_EVERY_N_SECS(WARNING, 1)
+        << "Waited " << wait_us << "us for " << name_ << " at\n"
+        << GetStackTrace() << THROTTLE_MSG;
+  }
+}
+
+void LockProfile::Dump(std::ostream* out) const {
+  std::unique_ptr<HdrHistogram> wait = wait_time_->Snapshot();
+  std::unique_ptr<HdrHistogram> hold = hold_time_->Snapshot();
+  *out << name_ << ": acquisitions=" << wait->TotalCount()
+       << " wait_us(p50/p99/max)=" << wait->ValueAtPercentile(50) << "/"
+       << wait->ValueAtPercentile(99) << "/" << wait->MaxValue()
+       << " hold_us(p50/p99/max)=" << hold->ValueAtPercentile(50) << "/"
+       << hold->ValueAtPercentile(99) << "/" << hold->MaxValue() << "\n";
+}
+
+bool LockProfilingEnabled() {
+  return FLAGS_lock_profiling;
+}
+
+void DumpLockProfiles(std::ostream* out) {
+  std::lock_guard<simple_spinlock> l(g_profiles_lock);
+  if (g_profiles == nullptr) {
+    return;
+  }
+  for (const LockProfile* profile : *g_profiles) {
+    profile->Dump(out);
+  }
+}
+
+} // namespace kudu
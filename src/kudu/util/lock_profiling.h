@@ -0,0 +1,92 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_LOCK_PROFILING_H
+#define KUDU_UTIL_LOCK_PROFILING_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+
+namespace kudu {
+
+class Histogram;
+
+// Records how long threads wait for one lock and how long they hold it,
+// into a pair of histograms. spinlock_profiling.h covers gutil spinlocks;
+// this covers the blocking locks (simple_mutexlock, Mutex and RWMutex),
+// which opt in with set_profile().
+//
+// Each acquisition costs a try-lock and one clock read more than usual, plus
+// one more when the lock was contended. A lock waited on for at least
+// --lock_profiling_stack_threshold_us logs the waiter's stack, at most once
+// a second per process.
+//
+// A profile belongs to a single lock and must outlive it. For a lock held
+// across ConditionVariable::Wait(), the hold time includes the wait.
+class LockProfile {
+ public:
+  // 'name' identifies the lock site in logs and in DumpLockProfiles().
+  LockProfile(
+      std::string name,
+      scoped_refptr<Histogram> wait_time,
+      scoped_refptr<Histogram> hold_time);
+  ~LockProfile();
+
+  // Called by the lock once it is held exclusively, after waiting 'wait_us'
+  // (0 if uncontended).
+  void Acquired(int64_t wait_us);
+
+  // Called by the lock just before it is released from exclusive use.
+  void Released();
+
+  // Called by the lock once it is held shared, after waiting 'wait_us'.
+  // Shared hold times are not recorded.
+  void AcquiredShared(int64_t wait_us);
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  // Appends a one-line summary of the wait and hold times to 'out'.
+  void Dump(std::ostream* out) const;
+
+ private:
+  void RecordWait(int64_t wait_us);
+
+  const std::string name_;
+  const scoped_refptr<Histogram> wait_time_;
+  const scoped_refptr<Histogram> hold_time_;
+
+  // When the exclusive holder acquired the lock, or 0 if the lock was
+  // acquired before it had a profile. Only accessed by the holder.
+  int64_t acquired_at_us_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockProfile);
+};
+
+// Returns true if owners of profiled locks should attach a LockProfile
+// (--lock_profiling).
+bool LockProfilingEnabled();
+
+// Writes a summary of every live LockProfile to 'out', one line each.
+void DumpLockProfiles(std::ostream* out);
+
+} // namespace kudu
+#endif
@@ -18,6 +18,8 @@
 #include "kudu/util/locks.h"
 
 #include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/malloc.h"
 
 namespace kudu {
@@ -40,4 +42,22 @@ size_t percpu_rwlock::memory_footprint_including_this() const {
   return kudu_malloc_usable_size(this) + memory_footprint_excluding_this();
 }
 
+void simple_mutexlock::ProfiledLock() {
+  int64_t wait_us = 0;
+  if (!m_.try_lock()) {
+    MicrosecondsInt64 start_time = GetMonoTimeMicros();
+    m_.lock();
+    wait_us = GetMonoTimeMicros() - start_time;
+  }
+  ProfiledAcquired(wait_us);
+}
+
+void simple_mutexlock::ProfiledAcquired(int64_t wait_us) {
+  profile_.load(std::memory_order_relaxed)->Acquired(wait_us);
+}
+
+void simple_mutexlock::ProfiledRelease() {
+  profile_.load(std::memory_order_relaxed)->Released();
+}
+
 } // namespace kudu
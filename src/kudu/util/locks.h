@@ -22,6 +22,7 @@
 #include <algorithm> // IWYU pragma: keep
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
 
 #include <glog/logging.h>
@@ -35,6 +36,8 @@
 
 namespace kudu {
 
+class LockProfile;
+
 // Wrapper around the Google SpinLock class to adapt it to the method names
 // expected by Boost.
 class simple_spinlock {
@@ -295,17 +298,30 @@ class simple_mutexlock {
   simple_mutexlock() {}
 
   void lock() {
-    m_.lock();
+    if (PREDICT_FALSE(profile_.load(std::memory_order_relaxed) != nullptr)) {
+      ProfiledLock();
+    } else {
+      m_.lock();
+    }
     is_locked_ = true;
   }
 
   void unlock() {
     is_locked_ = false;
+    if (PREDICT_FALSE(profile_.load(std::memory_order_relaxed) != nullptr)) {
+      ProfiledRelease();
+    }
     m_.unlock();
   }
 
   bool try_lock() {
-    return m_.try_lock();
+    if (!m_.try_lock()) {
+      return false;
+    }
+    if (PREDICT_FALSE(profile_.load(std::memory_order_relaxed) != nullptr)) {
+      ProfiledAcquired(0);
+    }
+    return true;
   }
 
   // Return whether the lock is currently held.
@@ -319,11 +335,23 @@ class simple_mutexlock {
     return is_locked_;
   }
 
+  // Starts recording wait and hold times into 'profile', which must outlive
+  // this lock. See lock_profiling.h.
+  void set_profile(LockProfile* profile) {
+    profile_.store(profile, std::memory_order_relaxed);
+  }
+
  private:
+  void ProfiledLock();
+  void ProfiledAcquired(int64_t wait_us);
+  void ProfiledRelease();
+
   std::mutex m_;
 
   std::atomic<bool> is_locked_{false};
 
+  std::atomic<LockProfile*> profile_{nullptr};
+
   DISALLOW_COPY_AND_ASSIGN(simple_mutexlock);
 };
 
@@ -27,13 +27,17 @@
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_int64(mem_tracker_propagation_batch_bytes);
+
 namespace kudu {
 
 using std::equal_to;
@@ -207,6 +211,43 @@ TEST(MemTrackerTest, ScopedTrackedConsumption) {
   ASSERT_EQ(0, m->consumption());
 }
 
+TEST(MemTrackerTest, BatchedPropagation) {
+  FLAGS_mem_tracker_propagation_batch_bytes = 100;
+  SCOPED_CLEANUP({ FLAGS_mem_tracker_propagation_batch_bytes = 0; });
+  shared_ptr<MemTracker> p = MemTracker::CreateTracker(1000, "parent");
+  shared_ptr<MemTracker> c = MemTracker::CreateTracker(-1, "child", p);
+
+  // The parent only sees the child's consumption in batches.
+  c->Consume(60);
+  EXPECT_EQ(60, c->consumption());
+  EXPECT_EQ(0, p->consumption());
+  c->Consume(60);
+  EXPECT_EQ(120, c->consumption());
+  EXPECT_EQ(120, p->consumption());
+  c->Release(30);
+  EXPECT_EQ(90, c->consumption());
+  EXPECT_EQ(120, p->consumption());
+  c->FlushPendingConsumption();
+  EXPECT_EQ(90, p->consumption());
+
+  // Far from the parent's limit, TryConsume() is batched too.
+  ASSERT_TRUE(c->TryConsume(50));
+  EXPECT_EQ(140, c->consumption());
+  EXPECT_EQ(90, p->consumption());
+  ASSERT_TRUE(c->TryConsume(700));
+  EXPECT_EQ(840, p->consumption());
+
+  // Near it, TryConsume() is exact.
+  ASSERT_FALSE(c->TryConsume(200));
+  EXPECT_EQ(840, c->consumption());
+  ASSERT_TRUE(c->TryConsume(150));
+  EXPECT_EQ(990, c->consumption());
+  EXPECT_EQ(990, p->consumption());
+
+  c->Release(990);
+  EXPECT_EQ(0, p->consumption());
+}
+
 TEST(MemTrackerTest, CollisionDetection) {
   shared_ptr<MemTracker> p = MemTracker::CreateTracker(-1, "parent");
   shared_ptr<MemTracker> c = MemTracker::CreateTracker(-1, "child", p);
@@ -19,18 +19,33 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdlib>
 #include <deque>
 #include <limits>
 #include <list>
 #include <memory>
 #include <ostream>
 
+#include <gflags/gflags.h>
+
 #include "kudu/gutil/once.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/process_memory.h"
 
+DEFINE_int64(
+    mem_tracker_propagation_batch_bytes,
+    0,
+    "If positive, each memory tracker updates its own consumption right away "
+    "but only applies it to its ancestors once this many bytes have been "
+    "consumed or released, so that trackers shared by many children, like "
+    "the root, are written to less often. Ancestors are then behind by up to "
+    "this many bytes per descendant, and TryConsume() is only exact near a "
+    "limit.");
+TAG_FLAG(mem_tracker_propagation_batch_bytes, experimental);
+
 namespace kudu {
 
 // NOTE: this class has been adapted from Impala, so the code style varies
@@ -45,6 +60,11 @@ using std::weak_ptr;
 
 using strings::Substitute;
 
+// With batched propagation, TryConsume() flushes the pending consumption and
+// checks the limits exactly once it would take a tracker past this percentage
+// of its limit.
+static constexpr int64_t kExactLimitCheckPercent = 90;
+
 // The ancestor for all trackers. Every tracker is visible from the root down.
 static shared_ptr<MemTracker> root_tracker;
 static GoogleOnceType root_tracker_once = GOOGLE_ONCE_INIT;
@@ -79,7 +99,8 @@ MemTracker::MemTracker(
       id_(id),
       descr_(Substitute("memory consumption for $0", id)),
       parent_(std::move(parent)),
-      consumption_(0) {
+      consumption_(0),
+      pending_consumption_(0) {
   VLOG(1) << "Creating tracker " << ToString();
 }
 
@@ -89,6 +110,7 @@ MemTracker::~MemTracker() {
     DCHECK(consumption() == 0)
         << "Memory tracker " << ToString() << " has unreleased consumption "
         << consumption();
+    FlushPendingConsumption();
     parent_->Release(consumption());
 
     MutexLock l(parent_->child_trackers_lock_);
@@ -205,6 +227,10 @@ void MemTracker::Consume(int64_t bytes) {
   if (bytes == 0) {
     return;
   }
+  if (FLAGS_mem_tracker_propagation_batch_bytes > 0) {
+    UpdateConsumptionBatched(bytes);
+    return;
+  }
   for (auto& tracker : all_trackers_) {
     tracker->consumption_.IncrementBy(bytes);
   }
@@ -216,6 +242,23 @@ bool MemTracker::TryConsume(int64_t bytes) {
     return true;
   }
 
+  if (FLAGS_mem_tracker_propagation_batch_bytes > 0) {
+    // Far from every limit, the batched ancestors are close enough.
+    bool near_limit = false;
+    for (const auto& tracker : limit_trackers_) {
+      if ((tracker->consumption() + bytes) * 100 >
+          tracker->limit_ * kExactLimitCheckPercent) {
+        near_limit = true;
+        break;
+      }
+    }
+    if (!near_limit) {
+      UpdateConsumptionBatched(bytes);
+      return true;
+    }
+    FlushPendingConsumption();
+  }
+
   int i = 0;
   // Walk the tracker tree top-down, consuming memory from each in turn.
   for (i = all_trackers_.size() - 1; i >= 0; --i) {
@@ -254,12 +297,54 @@ void MemTracker::Release(int64_t bytes) {
     return;
   }
 
-  for (auto& tracker : all_trackers_) {
-    tracker->consumption_.IncrementBy(-bytes);
+  if (FLAGS_mem_tracker_propagation_batch_bytes > 0) {
+    UpdateConsumptionBatched(-bytes);
+  } else {
+    for (auto& tracker : all_trackers_) {
+      tracker->consumption_.IncrementBy(-bytes);
+    }
   }
   process_memory::MaybeGCAfterRelease(bytes);
 }
 
+void MemTracker::UpdateConsumptionBatched(int64_t delta) {
+  // Each tracker owes its parent its pending consumption, which the parent in
+  // turn owes its own parent once applied.
+  MemTracker* tracker = this;
+  while (true) {
+    tracker->consumption_.IncrementBy(delta);
+    MemTracker* parent = tracker->parent_.get();
+    if (!parent) {
+      return;
+    }
+    int64_t pending = tracker->pending_consumption_.fetch_add(delta) + delta;
+    if (std::llabs(pending) < FLAGS_mem_tracker_propagation_batch_bytes) {
+      return;
+    }
+    delta = tracker->pending_consumption_.exchange(0);
+    if (delta == 0) {
+      return;
+    }
+    tracker = parent;
+  }
+}
+
+void MemTracker::FlushPendingConsumption() {
+  for (MemTracker* tracker = this; tracker->parent_;
+       tracker = tracker->parent_.get()) {
+    int64_t delta = tracker->pending_consumption_.exchange(0);
+    if (delta == 0) {
+      continue;
+    }
+    // Applying it to every ancestor directly leaves what they owe their own
+    // parents unchanged.
+    for (MemTracker* ancestor = tracker->parent_.get(); ancestor;
+         ancestor = ancestor->parent_.get()) {
+      ancestor->consumption_.IncrementBy(delta);
+    }
+  }
+}
+
 bool MemTracker::AnyLimitExceeded() {
   for (const auto& tracker : limit_trackers_) {
     if (tracker->LimitExceeded()) {
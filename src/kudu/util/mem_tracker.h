@@ -17,6 +17,7 @@
 #ifndef KUDU_UTIL_MEM_TRACKER_H
 #define KUDU_UTIL_MEM_TRACKER_H
 
+#include <atomic>
 #include <cstdint>
 #include <list>
 #include <memory>
@@ -117,6 +118,10 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
   // "ReleaseMemory" to ensure that memory is released to the OS.
   void Release(int64_t bytes);
 
+  // Applies to the ancestors the consumption of this tracker and its
+  // ancestors that was batched up by --mem_tracker_propagation_batch_bytes.
+  void FlushPendingConsumption();
+
   // Returns true if a valid limit of this tracker or one of its ancestors is
   // exceeded.
   bool AnyLimitExceeded();
@@ -185,6 +190,11 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
   // Creates the root tracker.
   static void CreateRootTracker();
 
+  // Adds 'delta' to the consumption of this tracker, and to that of its
+  // ancestors once the consumption not yet propagated to them reaches
+  // --mem_tracker_propagation_batch_bytes.
+  void UpdateConsumptionBatched(int64_t delta);
+
   int64_t limit_;
   const std::string id_;
   const std::string descr_;
@@ -192,6 +202,10 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
 
   HighWaterMark consumption_;
 
+  // Consumption of this tracker not yet applied to its ancestors. Always zero
+  // unless --mem_tracker_propagation_batch_bytes is set.
+  std::atomic<int64_t> pending_consumption_;
+
   // this tracker plus all of its ancestors
   std::vector<MemTracker*> all_trackers_;
   // all_trackers_ with valid limits
@@ -0,0 +1,292 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/memory/huge_page_allocator.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/mem_tracker.h"
+
+DEFINE_string(
+    huge_page_mode,
+    "none",
+    "Whether large buffers (WAL batches, RPC receive buffers, arenas) are "
+    "backed by 2 MB huge pages. One of 'none', 'transparent' (madvise the "
+    "region for transparent huge pages) or 'explicit' (map the region from "
+    "the hugetlbfs pool, falling back to 'transparent' if the pool is too "
+    "small). Read once, when the first large buffer is allocated.");
+TAG_FLAG(huge_page_mode, experimental);
+
+DEFINE_int64(
+    huge_page_region_mb,
+    1024,
+    "Size of the region reserved for huge-page-backed buffers. Buffers that "
+    "do not fit in the region come from the heap.");
+TAG_FLAG(huge_page_region_mb, experimental);
+
+DEFINE_int64(
+    huge_page_min_allocation_bytes,
+    1024 * 1024,
+    "Buffers of at least this many bytes are taken from the huge page "
+    "region when --huge_page_mode is not 'none'. Each buffer takes a whole "
+    "number of huge pages.");
+TAG_FLAG(huge_page_min_allocation_bytes, experimental);
+TAG_FLAG(huge_page_min_allocation_bytes, runtime);
+
+static bool ValidateHugePageMode(const char* flagname, const std::string& v) {
+  if (v == "none" || v == "transparent" || v == "explicit") {
+    return true;
+  }
+  LOG(ERROR) << "Invalid value for --" << flagname << ": " << v
+             << ", must be one of 'none', 'transparent' or 'explicit'";
+  return false;
+}
+DEFINE_validator(huge_page_mode, &ValidateHugePageMode);
+
+static bool ValidatePositive(const char* flagname, int64_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(huge_page_region_mb, &ValidatePositive);
+DEFINE_validator(huge_page_min_allocation_bytes, &ValidatePositive);
+
+using std::min;
+
+namespace kudu {
+
+std::atomic<uint8_t*> HugePageAllocator::region_begin_{nullptr};
+std::atomic<uint8_t*> HugePageAllocator::region_end_{nullptr};
+
+HugePageAllocator::HugePageAllocator()
+    : mem_tracker_(MemTracker::CreateTracker(-1, "huge_pages")),
+      reserve_attempted_(false) {}
+
+bool HugePageAllocator::ShouldUse(size_t size) {
+  return static_cast<int64_t>(size) >= FLAGS_huge_page_min_allocation_bytes &&
+      FLAGS_huge_page_mode != "none";
+}
+
+void HugePageAllocator::ReserveRegion() {
+  const size_t size = RoundUp(FLAGS_huge_page_region_mb * 1024 * 1024);
+  void* region = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if (FLAGS_huge_page_mode == "explicit") {
+    // hugetlbfs mappings are huge page aligned, and fail up front if the
+    // pool cannot back the whole region.
+    region = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+    if (region == MAP_FAILED) {
+      int err = errno;
+      LOG(WARNING) << "Could not map " << size << " bytes of explicit huge "
+                   << "pages: " << ErrnoToString(err)
+                   << "; falling back to transparent huge pages";
+    }
+  }
+#endif
+
+  if (region == MAP_FAILED) {
+    // Over-reserve by a huge page so the region can be aligned to one, then
+    // unmap the slack on both sides.
+    const size_t mapped_size = size + kHugePageSize;
+    void* mapped = mmap(
+        nullptr,
+        mapped_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0);
+    if (mapped == MAP_FAILED) {
+      int err = errno;
+      LOG(WARNING) << "Could not reserve " << size << " bytes for huge "
+                   << "pages: " << ErrnoToString(err);
+      return;
+    }
+    uint8_t* start = static_cast<uint8_t*>(mapped);
+    uint8_t* aligned = reinterpret_cast<uint8_t*>(
+        RoundUp(reinterpret_cast<uintptr_t>(start)));
+    if (aligned != start) {
+      munmap(start, aligned - start);
+    }
+    size_t tail = (start + mapped_size) - (aligned + size);
+    if (tail > 0) {
+      munmap(aligned + size, tail);
+    }
+    region = aligned;
+#ifdef MADV_HUGEPAGE
+    if (madvise(region, size, MADV_HUGEPAGE) != 0) {
+      int err = errno;
+      LOG(WARNING) << "Could not enable transparent huge pages on the "
+                   << "huge page region: " << ErrnoToString(err);
+    }
+#endif
+  }
+
+  uint8_t* begin = static_cast<uint8_t*>(region);
+  free_ranges_.emplace(begin, size);
+  region_end_.store(begin + size, std::memory_order_relaxed);
+  region_begin_.store(begin, std::memory_order_release);
+  LOG(INFO) << "Reserved " << size << " bytes for huge-page-backed buffers";
+}
+
+void* HugePageAllocator::Allocate(size_t size) {
+  const size_t rounded = RoundUp(size);
+  uint8_t* data = nullptr;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (PREDICT_FALSE(!reserve_attempted_)) {
+      reserve_attempted_ = true;
+      ReserveRegion();
+    }
+    // First fit: the ranges are few, since large buffers are few.
+    for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+      if (it->second < rounded) {
+        continue;
+      }
+      data = it->first;
+      size_t remaining = it->second - rounded;
+      free_ranges_.erase(it);
+      if (remaining > 0) {
+        free_ranges_.emplace(data + rounded, remaining);
+      }
+      break;
+    }
+  }
+  if (data != nullptr) {
+    mem_tracker_->Consume(rounded);
+  }
+  return data;
+}
+
+void HugePageAllocator::Free(void* data, size_t size) {
+  DCHECK(Owns(data));
+  uint8_t* start = static_cast<uint8_t*>(data);
+  size_t rounded = RoundUp(size);
+  mem_tracker_->Release(rounded);
+
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto next = free_ranges_.lower_bound(start);
+  DCHECK(next == free_ranges_.end() || next->first >= start + rounded);
+  if (next != free_ranges_.end() && next->first == start + rounded) {
+    rounded += next->second;
+    next = free_ranges_.erase(next);
+  }
+  if (next != free_ranges_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == start) {
+      prev->second += rounded;
+      return;
+    }
+  }
+  free_ranges_.emplace_hint(next, start, rounded);
+}
+
+Buffer* HugePageBufferAllocator::AllocateInternal(
+    const size_t requested,
+    const size_t minimal,
+    BufferAllocator* const originator) {
+  DCHECK_LE(minimal, requested);
+  if (HugePageAllocator::ShouldUse(requested)) {
+    void* data = HugePageAllocator::Get()->Allocate(requested);
+    if (data != nullptr) {
+      return CreateBuffer(data, requested, originator);
+    }
+  }
+  return DelegateAllocate(
+      HeapBufferAllocator::Get(), requested, minimal, originator);
+}
+
+bool HugePageBufferAllocator::ReallocateInternal(
+    const size_t requested,
+    const size_t minimal,
+    Buffer* const buffer,
+    BufferAllocator* const originator) {
+  DCHECK_LE(minimal, requested);
+  HugePageAllocator* huge_pages = HugePageAllocator::Get();
+  const bool was_huge = HugePageAllocator::Owns(buffer->data());
+  if (was_huge &&
+      HugePageAllocator::RoundUp(requested) ==
+          HugePageAllocator::RoundUp(buffer->size())) {
+    UpdateBuffer(buffer->data(), requested, buffer);
+    return true;
+  }
+
+  if (HugePageAllocator::ShouldUse(requested)) {
+    void* data = huge_pages->Allocate(requested);
+    if (data != nullptr) {
+      memcpy(data, buffer->data(), min(requested, buffer->size()));
+      if (was_huge) {
+        huge_pages->Free(buffer->data(), buffer->size());
+      } else {
+        DelegateFree(HeapBufferAllocator::Get(), buffer);
+      }
+      UpdateBuffer(data, requested, buffer);
+      return true;
+    }
+  }
+
+  if (!was_huge) {
+    return DelegateReallocate(
+        HeapBufferAllocator::Get(), requested, minimal, buffer, originator);
+  }
+  // Moving from the huge page region to the heap. The temporary buffer has
+  // no allocator, so deleting it once emptied frees nothing.
+  Buffer* heap_buffer = DelegateAllocate(
+      HeapBufferAllocator::Get(), requested, minimal, nullptr);
+  if (heap_buffer == nullptr) {
+    return false;
+  }
+  memcpy(
+      heap_buffer->data(),
+      buffer->data(),
+      min(heap_buffer->size(), buffer->size()));
+  huge_pages->Free(buffer->data(), buffer->size());
+  UpdateBuffer(heap_buffer->data(), heap_buffer->size(), buffer);
+  UpdateBuffer(nullptr, 0, heap_buffer);
+  delete heap_buffer;
+  return true;
+}
+
+void HugePageBufferAllocator::FreeInternal(Buffer* buffer) {
+  if (HugePageAllocator::Owns(buffer->data())) {
+    HugePageAllocator::Get()->Free(buffer->data(), buffer->size());
+  } else {
+    DelegateFree(HeapBufferAllocator::Get(), buffer);
+  }
+}
+
+} // namespace kudu
@@ -0,0 +1,141 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_MEMORY_HUGE_PAGE_ALLOCATOR_H
+#define KUDU_UTIL_MEMORY_HUGE_PAGE_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/singleton.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/memory/memory.h"
+
+namespace kudu {
+
+class MemTracker;
+
+// Hands out large buffers carved from a region backed by 2 MB huge pages,
+// to cut TLB misses and page faults on the bulk data paths (WAL batches,
+// RPC receive buffers, cached log entries).
+//
+// The region is reserved on first use, sized by --huge_page_region_mb, and
+// backed by transparent or explicit (hugetlbfs) huge pages according to
+// --huge_page_mode. Freed ranges stay resident and are reused, so a buffer
+// that grows and shrinks with the load does not fault its pages in again.
+// Bytes handed out are tracked by the "huge_pages" MemTracker.
+//
+// This class is thread safe.
+class HugePageAllocator {
+ public:
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  static HugePageAllocator* Get() {
+    return Singleton<HugePageAllocator>::get();
+  }
+
+  // Returns true if an allocation of 'size' bytes should come from huge
+  // pages: --huge_page_mode is not "none" and 'size' is at least
+  // --huge_page_min_allocation_bytes.
+  static bool ShouldUse(size_t size);
+
+  // Returns true if 'data' was returned by Allocate(). Cheap, and safe to
+  // call before the region is reserved.
+  static bool Owns(const void* data) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* begin = region_begin_.load(std::memory_order_acquire);
+    return begin != nullptr && p >= begin &&
+        p < region_end_.load(std::memory_order_relaxed);
+  }
+
+  // Allocates 'size' bytes, taking a range rounded up to a multiple of the
+  // huge page size. Returns nullptr if the region could not be reserved or
+  // has no free range large enough; the caller is expected to fall back to
+  // the heap.
+  void* Allocate(size_t size);
+
+  // Returns a range obtained from Allocate(). 'size' must round up to the
+  // same number of huge pages as the size passed to Allocate().
+  void Free(void* data, size_t size);
+
+  // Returns 'size' rounded up to a multiple of the huge page size.
+  static size_t RoundUp(size_t size) {
+    return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  }
+
+ private:
+  friend class Singleton<HugePageAllocator>;
+
+  HugePageAllocator();
+
+  // Reserves the region. Called once, on the first Allocate().
+  void ReserveRegion();
+
+  // Set when the region is reserved, never changed after.
+  static std::atomic<uint8_t*> region_begin_;
+  static std::atomic<uint8_t*> region_end_;
+
+  std::shared_ptr<MemTracker> mem_tracker_;
+
+  // Protects the fields below.
+  simple_spinlock lock_;
+  bool reserve_attempted_;
+  // Free ranges keyed by start address. Adjacent ranges are coalesced.
+  std::map<uint8_t*, size_t> free_ranges_;
+
+  DISALLOW_COPY_AND_ASSIGN(HugePageAllocator);
+};
+
+// BufferAllocator that takes buffers of at least
+// --huge_page_min_allocation_bytes from the HugePageAllocator, and smaller
+// ones (or all of them if huge pages are disabled or exhausted) from the
+// heap. Use with Arena for huge-page-backed arenas. The huge page part is
+// already tracked; only wrap this in a MemoryTrackingBufferAllocator whose
+// tracker is not an ancestor of "huge_pages".
+class HugePageBufferAllocator : public BufferAllocator {
+ public:
+  static HugePageBufferAllocator* Get() {
+    return Singleton<HugePageBufferAllocator>::get();
+  }
+
+ private:
+  friend class Singleton<HugePageBufferAllocator>;
+
+  HugePageBufferAllocator() {}
+
+  virtual Buffer* AllocateInternal(
+      size_t requested,
+      size_t minimal,
+      BufferAllocator* originator) override;
+
+  virtual bool ReallocateInternal(
+      size_t requested,
+      size_t minimal,
+      Buffer* buffer,
+      BufferAllocator* originator) override;
+
+  virtual void FreeInternal(Buffer* buffer) override;
+
+  DISALLOW_COPY_AND_ASSIGN(HugePageBufferAllocator);
+};
+
+} // namespace kudu
+
+#endif
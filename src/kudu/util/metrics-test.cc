@@ -17,7 +17,9 @@
 
 #include <cstdint>
 #include <ostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -31,6 +33,7 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/hdr_histogram.h"
+#include "kudu/util/histogram.pb.h"
 #include "kudu/util/jsonreader.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/metrics.h"
@@ -43,6 +46,8 @@ using std::string;
 using std::unordered_set;
 using std::vector;
 
+DECLARE_int32(histogram_exemplars);
+DECLARE_int32(histogram_stripes);
 DECLARE_int32(metrics_retirement_age_ms);
 
 namespace kudu {
@@ -190,14 +195,73 @@ TEST_F(MetricsTest, SimpleHistogramTest) {
   scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
   hist->Increment(2);
   hist->IncrementBy(4, 1);
-  ASSERT_EQ(2, hist->histogram_->MinValue());
-  ASSERT_EQ(3, hist->histogram_->MeanValue());
-  ASSERT_EQ(4, hist->histogram_->MaxValue());
-  ASSERT_EQ(2, hist->histogram_->TotalCount());
-  ASSERT_EQ(6, hist->histogram_->TotalSum());
+  std::unique_ptr<HdrHistogram> snapshot = hist->Snapshot();
+  ASSERT_EQ(2, snapshot->MinValue());
+  ASSERT_EQ(3, snapshot->MeanValue());
+  ASSERT_EQ(4, snapshot->MaxValue());
+  ASSERT_EQ(2, snapshot->TotalCount());
+  ASSERT_EQ(6, snapshot->TotalSum());
   // TODO: Test coverage needs to be improved a lot.
 }
 
+TEST_F(MetricsTest, StripedHistogramTest) {
+  FLAGS_histogram_stripes = 4;
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  const int kThreads = 8;
+  const int kValuesPerThread = 1000;
+  vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 1; i <= kValuesPerThread; i++) {
+        hist->Increment(t * kValuesPerThread + i);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // Whichever stripes the threads recorded into, readers see them all.
+  const int kTotal = kThreads * kValuesPerThread;
+  ASSERT_EQ(kTotal, hist->TotalCount());
+  std::unique_ptr<HdrHistogram> snapshot = hist->Snapshot();
+  ASSERT_EQ(kTotal, snapshot->TotalCount());
+  ASSERT_EQ(
+      static_cast<int64_t>(kTotal) * (kTotal + 1) / 2, snapshot->TotalSum());
+  ASSERT_EQ(1, snapshot->MinValue());
+  ASSERT_EQ(kTotal, snapshot->MaxValue());
+}
+
+TEST_F(MetricsTest, HistogramExemplarsTest) {
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  // Nothing is kept while exemplars are disabled.
+  ASSERT_FALSE(hist->WantsExemplar(100));
+  ASSERT_FALSE(hist->IncrementWithExemplar(100, {}));
+  ASSERT_EQ(1, hist->TotalCount());
+
+  FLAGS_histogram_exemplars = 2;
+  ASSERT_TRUE(hist->IncrementWithExemplar(10, {{"call_id", "1"}}));
+  ASSERT_TRUE(hist->IncrementWithExemplar(30, {{"call_id", "2"}}));
+  // Once full, only values larger than the smallest exemplar are kept.
+  ASSERT_FALSE(hist->WantsExemplar(5));
+  ASSERT_FALSE(hist->IncrementWithExemplar(5, {{"call_id", "3"}}));
+  ASSERT_TRUE(hist->WantsExemplar(20));
+  ASSERT_TRUE(hist->IncrementWithExemplar(20, {{"call_id", "4"}}));
+  ASSERT_EQ(5, hist->TotalCount());
+
+  vector<HistogramExemplar> exemplars = hist->Exemplars();
+  ASSERT_EQ(2, exemplars.size());
+  ASSERT_EQ(30, exemplars[0].value);
+  ASSERT_EQ("2", exemplars[0].labels[0].second);
+  ASSERT_EQ(20, exemplars[1].value);
+  ASSERT_EQ("4", exemplars[1].labels[0].second);
+
+  HistogramSnapshotPB snapshot_pb;
+  ASSERT_OK(hist->GetHistogramSnapshotPB(&snapshot_pb, MetricJsonOptions()));
+  ASSERT_EQ(2, snapshot_pb.exemplars_size());
+  ASSERT_EQ(30, snapshot_pb.exemplars(0).value());
+  ASSERT_EQ("call_id", snapshot_pb.exemplars(0).labels(0).key());
+}
+
 TEST_F(MetricsTest, JsonPrintTest) {
   scoped_refptr<Counter> test_counter =
       METRIC_test_counter.Instantiate(entity_);
@@ -388,6 +452,45 @@ TEST_F(MetricsTest, TestDumpOnlyChanged) {
       GetJson(new_epoch), "{\"name\":\"test_counter\",\"value\":2}");
 }
 
+// Test that 'include_unmodified_entities=false' skips the entities whose
+// metrics were all left alone since the given epoch.
+TEST_F(MetricsTest, TestDumpOnlyChangedEntities) {
+  scoped_refptr<MetricEntity> idle_entity =
+      METRIC_ENTITY_test_entity.Instantiate(&registry_, "my-idle-test");
+  scoped_refptr<Counter> counter = METRIC_test_counter.Instantiate(entity_);
+  scoped_refptr<Counter> idle_counter =
+      METRIC_test_counter.Instantiate(idle_entity);
+
+  Metric::IncrementEpoch();
+  const int64_t epoch = Metric::current_epoch();
+  ASSERT_FALSE(entity_->ModifiedInOrAfterEpoch(epoch));
+  counter->Increment();
+  ASSERT_TRUE(entity_->ModifiedInOrAfterEpoch(epoch));
+  ASSERT_FALSE(idle_entity->ModifiedInOrAfterEpoch(epoch));
+
+  auto GetJson = [&](bool include_unmodified_entities) {
+    MetricJsonOptions opts;
+    opts.only_modified_in_or_after_epoch = epoch;
+    opts.include_unmodified_entities = include_unmodified_entities;
+    std::ostringstream out;
+    JsonWriter writer(&out, JsonWriter::COMPACT);
+    CHECK_OK(registry_.WriteAsJson(&writer, {"*"}, opts));
+    return out.str();
+  };
+  ASSERT_STR_CONTAINS(GetJson(true), "my-idle-test");
+  const string json = GetJson(false);
+  ASSERT_STR_CONTAINS(json, "{\"name\":\"test_counter\",\"value\":1}");
+  ASSERT_STR_NOT_CONTAINS(json, "my-idle-test");
+
+  // A function gauge is always considered modified, and so is its entity.
+  int metric_val = 1000;
+  scoped_refptr<FunctionGauge<int64_t>> gauge =
+      METRIC_test_func_gauge.InstantiateFunctionGauge(
+          idle_entity, Bind(&MyFunction, Unretained(&metric_val)));
+  Metric::IncrementEpoch();
+  ASSERT_TRUE(idle_entity->ModifiedInOrAfterEpoch(Metric::current_epoch()));
+}
+
 // Test that 'include_untouched_metrics=false' prevents dumping counters and
 // histograms which have never been incremented.
 TEST_F(MetricsTest, TestDontDumpUntouched) {
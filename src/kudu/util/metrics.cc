@@ -16,6 +16,9 @@
 // under the License.
 #include "kudu/util/metrics.h"
 
+#include <sched.h>
+
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <utility>
@@ -23,9 +26,12 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "kudu/gutil/bits.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/singleton.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/gutil/walltime.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/hdr_histogram.h"
 #include "kudu/util/histogram.pb.h"
@@ -40,6 +46,53 @@ DEFINE_int32(
 TAG_FLAG(metrics_retirement_age_ms, runtime);
 TAG_FLAG(metrics_retirement_age_ms, advanced);
 
+DEFINE_int32(
+    histogram_stripes,
+    1,
+    "Number of stripes each histogram metric records into, capped at the "
+    "number of CPUs and rounded up to a power of two. Threads on different "
+    "CPUs record into different stripes, which makes hot histograms cheaper "
+    "to record into from many threads at once, at the cost of one copy of "
+    "the histogram's counts per stripe. Read when a histogram is created.");
+TAG_FLAG(histogram_stripes, experimental);
+
+static bool ValidateHistogramStripes(const char* flagname, int32_t v) {
+  if (v > 0) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be positive, got " << v;
+  return false;
+}
+DEFINE_validator(histogram_stripes, &ValidateHistogramStripes);
+
+DEFINE_int32(
+    histogram_exemplars,
+    0,
+    "Number of the largest recent samples that histogram metrics recorded "
+    "with exemplars, such as the RPC handler latencies and the log group "
+    "commit latency, keep along with labels telling where each came from, "
+    "e.g. the RPC call id, tablet or peer. They are written with the rest of "
+    "the histogram. 0 disables exemplars.");
+TAG_FLAG(histogram_exemplars, experimental);
+TAG_FLAG(histogram_exemplars, runtime);
+
+DEFINE_int32(
+    histogram_exemplar_max_age_ms,
+    60000,
+    "How long a histogram keeps an exemplar, so that the exemplars show the "
+    "largest recent samples rather than the largest ever.");
+TAG_FLAG(histogram_exemplar_max_age_ms, experimental);
+TAG_FLAG(histogram_exemplar_max_age_ms, runtime);
+
+static bool ValidateHistogramExemplars(const char* flagname, int32_t v) {
+  if (v >= 0 && v <= 100) {
+    return true;
+  }
+  LOG(ERROR) << "--" << flagname << " must be between 0 and 100, got " << v;
+  return false;
+}
+DEFINE_validator(histogram_exemplars, &ValidateHistogramExemplars);
+
 // Process/server-wide metrics should go into the 'server' entity.
 // More complex applications will define other entities.
 METRIC_DEFINE_entity(server);
@@ -162,11 +215,15 @@ scoped_refptr<MetricEntity> MetricEntityPrototype::Instantiate(
 //
 
 MetricEntity::MetricEntity(
+    MetricRegistry* registry,
     const MetricEntityPrototype* prototype,
     std::string id,
     AttributeMap attributes)
-    : prototype_(prototype),
+    : registry_(registry),
+      prototype_(prototype),
       id_(std::move(id)),
+      modification_epoch_(
+          std::make_shared<std::atomic<int64_t>>(Metric::current_epoch())),
       attributes_(std::move(attributes)),
       published_(true) {}
 
@@ -179,6 +236,17 @@ void MetricEntity::CheckInstantiation(const MetricPrototype* proto) const {
       << " (expected: " << proto->entity_type() << ")";
 }
 
+void MetricEntity::AddMetricUnlocked(
+    const MetricPrototype* proto,
+    const scoped_refptr<Metric>& metric) {
+  DCHECK(lock_.is_locked());
+  InsertOrDie(&metric_map_, proto, metric);
+  metric->entity_epoch_ = modification_epoch_;
+  // A new metric counts as a modification, and a function gauge is always
+  // modified.
+  Metric::AdvanceEpoch(modification_epoch_.get(), metric->m_epoch_);
+}
+
 scoped_refptr<Metric> MetricEntity::FindOrNull(
     const MetricPrototype& prototype) const {
   std::lock_guard<simple_spinlock> l(lock_);
@@ -213,6 +281,10 @@ Status MetricEntity::WriteAsJson(
     JsonWriter* writer,
     const vector<string>& requested_metrics,
     const MetricJsonOptions& opts) const {
+  if (!opts.include_unmodified_entities &&
+      !ModifiedInOrAfterEpoch(opts.only_modified_in_or_after_epoch)) {
+    return Status::OK();
+  }
   bool select_all = MatchMetricInList(id(), requested_metrics);
 
   // We want the keys to be in alphabetical order when printing, so we use an
@@ -220,6 +292,7 @@ Status MetricEntity::WriteAsJson(
   typedef std::map<const char*, scoped_refptr<Metric>> OrderedMetricMap;
   OrderedMetricMap metrics;
   AttributeMap attrs;
+  bool matched_any = false;
   {
     // Snapshot the metrics in this registry (not guaranteed to be a consistent
     // snapshot)
@@ -231,14 +304,19 @@ Status MetricEntity::WriteAsJson(
 
       if (select_all ||
           MatchMetricInList(prototype->name(), requested_metrics)) {
-        InsertOrDie(&metrics, prototype->name(), metric);
+        matched_any = true;
+        // Unmodified metrics are not written, so don't take refs to them.
+        if (metric->ModifiedInOrAfterEpoch(
+                opts.only_modified_in_or_after_epoch)) {
+          InsertOrDie(&metrics, prototype->name(), metric);
+        }
       }
     }
   }
 
   // If we had a filter, and we didn't either match this entity or any metrics
   // inside it, don't print the entity at all.
-  if (!requested_metrics.empty() && !select_all && metrics.empty()) {
+  if (!requested_metrics.empty() && !select_all && !matched_any) {
     return Status::OK();
   }
 
@@ -264,14 +342,12 @@ Status MetricEntity::WriteAsJson(
   writer->StartArray();
   for (OrderedMetricMap::value_type& val : metrics) {
     const auto& m = val.second;
-    if (m->ModifiedInOrAfterEpoch(opts.only_modified_in_or_after_epoch)) {
-      if (!opts.include_untouched_metrics && m->IsUntouched()) {
-        continue;
-      }
-      WARN_NOT_OK(
-          m->WriteAsJson(writer, opts),
-          strings::Substitute("Failed to write $0 as JSON", val.first));
+    if (!opts.include_untouched_metrics && m->IsUntouched()) {
+      continue;
     }
+    WARN_NOT_OK(
+        m->WriteAsJson(writer, opts),
+        strings::Substitute("Failed to write $0 as JSON", val.first));
   }
   writer->EndArray();
 
@@ -501,10 +577,10 @@ scoped_refptr<MetricEntity> MetricRegistry::FindOrCreateEntity(
   std::lock_guard<simple_spinlock> l(lock_);
   scoped_refptr<MetricEntity> e = FindPtrOrNull(entities_, id);
   if (!e) {
-    e = new MetricEntity(prototype, id, initial_attributes);
+    e = new MetricEntity(this, prototype, id, initial_attributes);
     InsertOrDie(&entities_, id, e);
   } else if (!e->published()) {
-    e = new MetricEntity(prototype, id, initial_attributes);
+    e = new MetricEntity(this, prototype, id, initial_attributes);
     entities_[id] = e;
   } else {
     e->SetAttributes(initial_attributes);
@@ -528,14 +604,20 @@ void Metric::IncrementEpoch() {
 }
 
 void Metric::UpdateModificationEpochSlowPath() {
-  int64_t new_epoch, old_epoch;
-  // CAS loop to ensure that we never transition a metric's epoch backwards
-  // even if multiple threads race to update it.
-  do {
-    old_epoch = m_epoch_;
-    new_epoch = g_epoch_;
-  } while (old_epoch < new_epoch &&
-           !m_epoch_.compare_exchange_weak(old_epoch, new_epoch));
+  const int64_t new_epoch = g_epoch_;
+  AdvanceEpoch(&m_epoch_, new_epoch);
+  if (entity_epoch_) {
+    AdvanceEpoch(entity_epoch_.get(), new_epoch);
+  }
+}
+
+void Metric::AdvanceEpoch(std::atomic<int64_t>* epoch, int64_t new_epoch) {
+  // CAS loop to ensure that we never transition an epoch backwards even if
+  // multiple threads race to update it.
+  int64_t old_epoch = *epoch;
+  while (old_epoch < new_epoch &&
+         !epoch->compare_exchange_weak(old_epoch, new_epoch)) {
+  }
 }
 
 //
@@ -651,20 +733,118 @@ scoped_refptr<Histogram> HistogramPrototype::Instantiate(
 // Histogram
 /////////////////////////////////////////////////
 
-Histogram::Histogram(const HistogramPrototype* proto)
-    : Metric(proto),
-      histogram_(new HdrHistogram(
-          proto->max_trackable_value(),
-          proto->num_sig_digits())) {}
+Histogram::Histogram(const HistogramPrototype* proto) : Metric(proto) {
+  const int num_stripes = 1
+      << Bits::Log2Ceiling(std::min(FLAGS_histogram_stripes, base::NumCPUs()));
+  for (int i = 0; i < num_stripes; i++) {
+    stripes_.emplace_back(new HdrHistogram(
+        proto->max_trackable_value(), proto->num_sig_digits()));
+  }
+}
+
+HdrHistogram* Histogram::stripe() {
+  if (stripes_.size() == 1) {
+    return stripes_[0].get();
+  }
+#if defined(__APPLE__)
+  int cpu = 0;
+#else
+  // On error this is -1, which still picks a valid stripe.
+  int cpu = sched_getcpu();
+#endif // defined(__APPLE__)
+  return stripes_[cpu & (stripes_.size() - 1)].get();
+}
 
 void Histogram::Increment(int64_t value) {
   UpdateModificationEpoch();
-  histogram_->Increment(value);
+  stripe()->Increment(value);
 }
 
 void Histogram::IncrementBy(int64_t value, int64_t amount) {
   UpdateModificationEpoch();
-  histogram_->IncrementBy(value, amount);
+  stripe()->IncrementBy(value, amount);
+}
+
+bool Histogram::ExemplarsEnabled() {
+  return FLAGS_histogram_exemplars > 0;
+}
+
+bool Histogram::WantsExemplar(int64_t value) const {
+  if (!ExemplarsEnabled()) {
+    return false;
+  }
+  return value > exemplar_min_value_.load(std::memory_order_relaxed) ||
+      GetMonoTimeMicros() >=
+      exemplar_min_expiry_us_.load(std::memory_order_relaxed);
+}
+
+bool Histogram::IncrementWithExemplar(int64_t value, ExemplarLabels labels) {
+  Increment(value);
+  const size_t max_exemplars = std::max(FLAGS_histogram_exemplars, 0);
+  const int64_t now_us = GetMonoTimeMicros();
+  std::lock_guard<simple_spinlock> l(exemplars_lock_);
+  // Drop the exemplars which aged out, and those which no longer fit if the
+  // flag was lowered. 'exemplars_' is kept sorted, largest first.
+  exemplars_.erase(
+      std::remove_if(
+          exemplars_.begin(),
+          exemplars_.end(),
+          [&](const Exemplar& e) { return e.expiry_us <= now_us; }),
+      exemplars_.end());
+  if (exemplars_.size() > max_exemplars) {
+    exemplars_.resize(max_exemplars);
+  }
+
+  bool kept = false;
+  if (max_exemplars > 0 &&
+      (exemplars_.size() < max_exemplars ||
+       value > exemplars_.back().exemplar.value)) {
+    if (exemplars_.size() == max_exemplars) {
+      exemplars_.pop_back();
+    }
+    Exemplar e;
+    e.exemplar.value = value;
+    e.exemplar.wall_time_us = GetCurrentTimeMicros();
+    e.exemplar.labels = std::move(labels);
+    e.expiry_us = now_us + FLAGS_histogram_exemplar_max_age_ms * 1000L;
+    auto it = std::upper_bound(
+        exemplars_.begin(),
+        exemplars_.end(),
+        value,
+        [](int64_t v, const Exemplar& x) { return v > x.exemplar.value; });
+    exemplars_.insert(it, std::move(e));
+    kept = true;
+  }
+
+  int64_t min_expiry_us = std::numeric_limits<int64_t>::max();
+  for (const auto& e : exemplars_) {
+    min_expiry_us = std::min(min_expiry_us, e.expiry_us);
+  }
+  exemplar_min_expiry_us_.store(min_expiry_us, std::memory_order_relaxed);
+  exemplar_min_value_.store(
+      exemplars_.size() == max_exemplars && max_exemplars > 0
+          ? exemplars_.back().exemplar.value
+          : -1,
+      std::memory_order_relaxed);
+  return kept;
+}
+
+vector<HistogramExemplar> Histogram::Exemplars() const {
+  std::lock_guard<simple_spinlock> l(exemplars_lock_);
+  vector<HistogramExemplar> ret;
+  ret.reserve(exemplars_.size());
+  for (const auto& e : exemplars_) {
+    ret.push_back(e.exemplar);
+  }
+  return ret;
+}
+
+std::unique_ptr<HdrHistogram> Histogram::Snapshot() const {
+  std::unique_ptr<HdrHistogram> snapshot(new HdrHistogram(*stripes_[0]));
+  for (size_t i = 1; i < stripes_.size(); i++) {
+    snapshot->MergeFrom(*stripes_[i]);
+  }
+  return snapshot;
 }
 
 Status Histogram::WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
@@ -672,8 +852,11 @@ Status Histogram::WriteAsJson(JsonWriter* writer, const MetricJsonOptions& opts)
   HistogramSnapshotPB snapshot;
   RETURN_NOT_OK(GetHistogramSnapshotPB(&snapshot, opts));
   writer->Protobuf(snapshot);
-  if (opts.refresh_histogram_metrics)
-    histogram_->ResetHistogram();
+  if (opts.refresh_histogram_metrics) {
+    for (const auto& stripe : stripes_) {
+      stripe->ResetHistogram();
+    }
+  }
   return Status::OK();
 }
 
@@ -686,14 +869,15 @@ Status Histogram::GetHistogramSnapshotPB(
     snapshot_pb->set_label(prototype_->label());
     snapshot_pb->set_unit(MetricUnit::Name(prototype_->unit()));
     snapshot_pb->set_description(prototype_->description());
-    snapshot_pb->set_max_trackable_value(histogram_->highest_trackable_value());
+    snapshot_pb->set_max_trackable_value(
+        stripes_[0]->highest_trackable_value());
     snapshot_pb->set_num_significant_digits(
-        histogram_->num_significant_digits());
+        stripes_[0]->num_significant_digits());
   }
   // Fast-path for a reasonably common case of an empty histogram. This occurs
   // when a histogram is tracking some information about a feature not in
   // use, for example.
-  if (histogram_->TotalCount() == 0) {
+  if (TotalCount() == 0) {
     snapshot_pb->set_total_count(0);
     snapshot_pb->set_total_sum(0);
     snapshot_pb->set_min(0);
@@ -705,20 +889,30 @@ Status Histogram::GetHistogramSnapshotPB(
     snapshot_pb->set_percentile_99_99(0);
     snapshot_pb->set_max(0);
   } else {
-    HdrHistogram snapshot(*histogram_);
-    snapshot_pb->set_total_count(snapshot.TotalCount());
-    snapshot_pb->set_total_sum(snapshot.TotalSum());
-    snapshot_pb->set_min(snapshot.MinValue());
-    snapshot_pb->set_mean(snapshot.MeanValue());
-    snapshot_pb->set_percentile_75(snapshot.ValueAtPercentile(75));
-    snapshot_pb->set_percentile_95(snapshot.ValueAtPercentile(95));
-    snapshot_pb->set_percentile_99(snapshot.ValueAtPercentile(99));
-    snapshot_pb->set_percentile_99_9(snapshot.ValueAtPercentile(99.9));
-    snapshot_pb->set_percentile_99_99(snapshot.ValueAtPercentile(99.99));
-    snapshot_pb->set_max(snapshot.MaxValue());
-
+    std::unique_ptr<HdrHistogram> snapshot = Snapshot();
+    snapshot_pb->set_total_count(snapshot->TotalCount());
+    snapshot_pb->set_total_sum(snapshot->TotalSum());
+    snapshot_pb->set_min(snapshot->MinValue());
+    snapshot_pb->set_mean(snapshot->MeanValue());
+    snapshot_pb->set_percentile_75(snapshot->ValueAtPercentile(75));
+    snapshot_pb->set_percentile_95(snapshot->ValueAtPercentile(95));
+    snapshot_pb->set_percentile_99(snapshot->ValueAtPercentile(99));
+    snapshot_pb->set_percentile_99_9(snapshot->ValueAtPercentile(99.9));
+    snapshot_pb->set_percentile_99_99(snapshot->ValueAtPercentile(99.99));
+    snapshot_pb->set_max(snapshot->MaxValue());
+
+    for (const HistogramExemplar& e : Exemplars()) {
+      HistogramExemplarPB* e_pb = snapshot_pb->add_exemplars();
+      e_pb->set_value(e.value);
+      e_pb->set_wall_time_us(e.wall_time_us);
+      for (const auto& label : e.labels) {
+        HistogramExemplarPB::LabelPB* label_pb = e_pb->add_labels();
+        label_pb->set_key(label.first);
+        label_pb->set_value(label.second);
+      }
+    }
     if (opts.include_raw_histograms) {
-      RecordedValuesIterator iter(&snapshot);
+      RecordedValuesIterator iter(snapshot.get());
       while (iter.HasNext()) {
         HistogramIterationValue value;
         RETURN_NOT_OK(iter.Next(&value));
@@ -731,22 +925,30 @@ Status Histogram::GetHistogramSnapshotPB(
 }
 
 uint64_t Histogram::CountInBucketForValueForTests(uint64_t value) const {
-  return histogram_->CountInBucketForValue(value);
+  uint64_t count = 0;
+  for (const auto& stripe : stripes_) {
+    count += stripe->CountInBucketForValue(value);
+  }
+  return count;
 }
 
 uint64_t Histogram::TotalCount() const {
-  return histogram_->TotalCount();
+  uint64_t count = 0;
+  for (const auto& stripe : stripes_) {
+    count += stripe->TotalCount();
+  }
+  return count;
 }
 
 uint64_t Histogram::MinValueForTests() const {
-  return histogram_->MinValue();
+  return Snapshot()->MinValue();
 }
 
 uint64_t Histogram::MaxValueForTests() const {
-  return histogram_->MaxValue();
+  return Snapshot()->MaxValue();
 }
 double Histogram::MeanValueForTests() const {
-  return histogram_->MeanValue();
+  return Snapshot()->MeanValue();
 }
 
 ScopedLatencyMetric::ScopedLatencyMetric(Histogram* latency_hist)
@@ -246,9 +246,11 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <gtest/gtest_prod.h>
@@ -468,6 +470,12 @@ struct MetricJsonOptions {
   // Whether to include the attributes of each entity.
   bool include_entity_attributes = true;
 
+  // Whether to include entities none of whose metrics were modified in or
+  // after 'only_modified_in_or_after_epoch', with an empty list of metrics.
+  // If false, such entities are skipped without looking at their metrics,
+  // so that a scrape of mostly idle entities costs little.
+  bool include_unmodified_entities = true;
+
   // controls wether we should refresh metrics after retrieval.
   bool refresh_histogram_metrics = false;
 };
@@ -531,6 +539,18 @@ class MetricEntity : public RefCountedThreadSafe<MetricEntity> {
     return id_;
   }
 
+  // The registry holding this entity, in which entities related to it can
+  // be instantiated.
+  MetricRegistry* registry() const {
+    return registry_;
+  }
+
+  // Return true if any of the metrics of this entity changed in or after the
+  // given metrics epoch, or the entity gained a metric then.
+  bool ModifiedInOrAfterEpoch(int64_t epoch) const {
+    return *modification_epoch_ >= epoch;
+  }
+
   // See MetricRegistry::WriteAsJson()
   Status WriteAsJson(
       JsonWriter* writer,
@@ -583,6 +603,7 @@ class MetricEntity : public RefCountedThreadSafe<MetricEntity> {
   friend class RefCountedThreadSafe<MetricEntity>;
 
   MetricEntity(
+      MetricRegistry* registry,
       const MetricEntityPrototype* prototype,
       std::string id,
       AttributeMap attributes);
@@ -593,9 +614,20 @@ class MetricEntity : public RefCountedThreadSafe<MetricEntity> {
   // type defined within the metric prototype.
   void CheckInstantiation(const MetricPrototype* proto) const;
 
+  // Adds 'metric' to 'metric_map_', and makes it advance
+  // 'modification_epoch_' when it is modified.
+  void AddMetricUnlocked(
+      const MetricPrototype* proto,
+      const scoped_refptr<Metric>& metric);
+
+  MetricRegistry* const registry_;
   const MetricEntityPrototype* const prototype_;
   const std::string id_;
 
+  // The latest modification epoch of the metrics. Shared with them, since
+  // a metric may outlive its entity.
+  const std::shared_ptr<std::atomic<int64_t>> modification_epoch_;
+
   mutable simple_spinlock lock_;
 
   // Map from metric name to Metric object. Protected by lock_.
@@ -670,6 +702,9 @@ class Metric : public RefCountedThreadSafe<Metric> {
  private:
   void UpdateModificationEpochSlowPath();
 
+  // Advances 'epoch' to 'new_epoch', unless it is already later.
+  static void AdvanceEpoch(std::atomic<int64_t>* epoch, int64_t new_epoch);
+
   friend class MetricEntity;
   friend class RefCountedThreadSafe<Metric>;
 
@@ -678,6 +713,10 @@ class Metric : public RefCountedThreadSafe<Metric> {
   // this member is uninitialized.
   MonoTime retire_time_;
 
+  // The modification epoch of the entity holding this metric, advanced along
+  // with 'm_epoch_'. Set when the metric is added to the entity.
+  std::shared_ptr<std::atomic<int64_t>> entity_epoch_;
+
   // See 'current_epoch()'.
   static std::atomic<int64_t> g_epoch_;
 
@@ -1149,12 +1188,42 @@ class HistogramPrototype : public MetricPrototype {
   DISALLOW_COPY_AND_ASSIGN(HistogramPrototype);
 };
 
+// One of the slowest recent samples of a histogram, with labels telling where
+// it came from, e.g. the RPC call or the tablet.
+struct HistogramExemplar {
+  int64_t value;
+  // When the sample was recorded, in microseconds since the epoch.
+  int64_t wall_time_us;
+  std::vector<std::pair<std::string, std::string>> labels;
+};
+
 class Histogram : public Metric {
  public:
+  typedef std::vector<std::pair<std::string, std::string>> ExemplarLabels;
+
   // Increment the histogram for the given value.
   // 'value' must be non-negative.
   void Increment(int64_t value);
 
+  // Whether histograms keep exemplars (--histogram_exemplars).
+  static bool ExemplarsEnabled();
+
+  // Returns true if IncrementWithExemplar() would probably keep 'value' as an
+  // exemplar: if it is among the --histogram_exemplars largest values
+  // recorded over the last --histogram_exemplar_max_age_ms. Cheap enough to
+  // call on every sample, so that callers only put together the labels of
+  // samples worth keeping.
+  bool WantsExemplar(int64_t value) const;
+
+  // Like Increment(), also keeping the sample, labeled with 'labels', as an
+  // exemplar if it is among the largest recent ones. Returns true if it was
+  // kept.
+  bool IncrementWithExemplar(int64_t value, ExemplarLabels labels);
+
+  // Returns the exemplars kept, largest first. They are also written, with
+  // the rest of the histogram, by WriteAsJson().
+  std::vector<HistogramExemplar> Exemplars() const;
+
   // Increment the histogram for the given value by the given amount.
   // 'value' and 'amount' must be non-negative.
   void IncrementBy(int64_t value, int64_t amount);
@@ -1172,11 +1241,9 @@ class Histogram : public Metric {
       HistogramSnapshotPB* snapshot_pb,
       const MetricJsonOptions& opts) const;
 
-  // Returns a pointer to the underlying histogram. The implementation of
-  // HdrHistogram is thread safe.
-  const HdrHistogram* histogram() const {
-    return histogram_.get();
-  }
+  // Returns a (non-consistent) snapshot of the values recorded so far, with
+  // the values of all stripes merged.
+  std::unique_ptr<HdrHistogram> Snapshot() const;
 
   uint64_t CountInBucketForValueForTests(uint64_t value) const;
   uint64_t MinValueForTests() const;
@@ -1192,7 +1259,30 @@ class Histogram : public Metric {
   friend class MetricEntity;
   explicit Histogram(const HistogramPrototype* proto);
 
-  const std::unique_ptr<HdrHistogram> histogram_;
+  // Returns the stripe the calling thread records into.
+  HdrHistogram* stripe();
+
+  // One histogram per stripe, --histogram_stripes of them rounded up to a
+  // power of two. Threads record into the stripe of the CPU they run on, so
+  // that concurrent recordings on different CPUs don't share cache lines;
+  // readers merge the stripes.
+  std::vector<std::unique_ptr<HdrHistogram>> stripes_;
+
+  struct Exemplar {
+    HistogramExemplar exemplar;
+    // When the exemplar ages out, in monotonic microseconds.
+    int64_t expiry_us;
+  };
+
+  mutable simple_spinlock exemplars_lock_;
+  std::vector<Exemplar> exemplars_;
+  // Hints for WantsExemplar(), read without the lock: the smallest value kept
+  // if there is no room for more exemplars, or -1 if there is, and when the
+  // earliest exemplar ages out.
+  std::atomic<int64_t> exemplar_min_value_{-1};
+  std::atomic<int64_t> exemplar_min_expiry_us_{
+      std::numeric_limits<int64_t>::max()};
+
   DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
@@ -1225,7 +1315,7 @@ inline scoped_refptr<Counter> MetricEntity::FindOrCreateCounter(
       down_cast<Counter*>(FindPtrOrNull(metric_map_, proto).get());
   if (!m) {
     m = new Counter(proto);
-    InsertOrDie(&metric_map_, proto, m);
+    AddMetricUnlocked(proto, m);
   }
   return m;
 }
@@ -1238,7 +1328,7 @@ inline scoped_refptr<Histogram> MetricEntity::FindOrCreateHistogram(
       down_cast<Histogram*>(FindPtrOrNull(metric_map_, proto).get());
   if (!m) {
     m = new Histogram(proto);
-    InsertOrDie(&metric_map_, proto, m);
+    AddMetricUnlocked(proto, m);
   }
   return m;
 }
@@ -1253,7 +1343,7 @@ inline scoped_refptr<AtomicGauge<T>> MetricEntity::FindOrCreateGauge(
       down_cast<AtomicGauge<T>*>(FindPtrOrNull(metric_map_, proto).get());
   if (!m) {
     m = new AtomicGauge<T>(proto, initial_value);
-    InsertOrDie(&metric_map_, proto, m);
+    AddMetricUnlocked(proto, m);
   }
   return m;
 }
@@ -1268,7 +1358,7 @@ inline scoped_refptr<FunctionGauge<T>> MetricEntity::FindOrCreateFunctionGauge(
       down_cast<FunctionGauge<T>*>(FindPtrOrNull(metric_map_, proto).get());
   if (!m) {
     m = new FunctionGauge<T>(proto, function);
-    InsertOrDie(&metric_map_, proto, m);
+    AddMetricUnlocked(proto, m);
   }
   return m;
 }
@@ -0,0 +1,114 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/mpsc_queue.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+
+using std::thread;
+using std::vector;
+
+namespace kudu {
+
+TEST(MpscQueueTest, TestBlockingDrainTo) {
+  MpscQueue<int32_t> test_queue(3);
+  ASSERT_TRUE(test_queue.BlockingPut(1));
+  ASSERT_TRUE(test_queue.BlockingPut(2));
+  ASSERT_TRUE(test_queue.BlockingPut(3));
+  ASSERT_EQ(3, test_queue.size());
+  vector<int32_t> out;
+  ASSERT_OK(test_queue.BlockingDrainTo(
+      &out, MonoTime::Now() + MonoDelta::FromSeconds(30)));
+  ASSERT_EQ((vector<int32_t>{1, 2, 3}), out);
+  ASSERT_TRUE(test_queue.empty());
+  ASSERT_EQ(0, test_queue.size());
+
+  // Set a deadline in the past and ensure we time out.
+  Status s = test_queue.BlockingDrainTo(
+      &out, MonoTime::Now() - MonoDelta::FromSeconds(1));
+  ASSERT_TRUE(s.IsTimedOut());
+
+  // Elements left at shutdown are still drained, then we get Aborted.
+  ASSERT_TRUE(test_queue.BlockingPut(4));
+  test_queue.Shutdown();
+  ASSERT_FALSE(test_queue.BlockingPut(5));
+  out.clear();
+  ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  ASSERT_EQ(vector<int32_t>{4}, out);
+  s = test_queue.BlockingDrainTo(&out);
+  ASSERT_TRUE(s.IsAborted());
+}
+
+// Producers block while the queue is full, and every element is drained
+// once, in the order each producer put them.
+TEST(MpscQueueTest, TestMultipleProducers) {
+  const int kNumProducers = 4;
+  const int kNumPuts = 10000;
+  MpscQueue<int32_t> test_queue(16);
+
+  vector<thread> producers;
+  for (int p = 0; p < kNumProducers; p++) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < kNumPuts; i++) {
+        CHECK(test_queue.BlockingPut(p * kNumPuts + i));
+      }
+    });
+  }
+
+  vector<int32_t> last(kNumProducers, -1);
+  int num_drained = 0;
+  while (num_drained < kNumProducers * kNumPuts) {
+    vector<int32_t> out;
+    ASSERT_OK(test_queue.BlockingDrainTo(&out));
+    // Each put is allowed while the queue is below its maximum size.
+    ASSERT_LE(out.size(), 16 + kNumProducers - 1);
+    for (int32_t v : out) {
+      int p = v / kNumPuts;
+      ASSERT_GT(v, last[p]);
+      last[p] = v;
+    }
+    num_drained += out.size();
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  ASSERT_TRUE(test_queue.empty());
+}
+
+// Producers blocked on a full queue give up when it shuts down.
+TEST(MpscQueueTest, TestShutdownWakesProducers) {
+  MpscQueue<int32_t> test_queue(1);
+  ASSERT_TRUE(test_queue.BlockingPut(1));
+  thread producer([&]() { CHECK(!test_queue.BlockingPut(2)); });
+  SleepFor(MonoDelta::FromMilliseconds(10));
+  test_queue.Shutdown();
+  producer.join();
+
+  vector<int32_t> out;
+  ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  ASSERT_EQ(vector<int32_t>{1}, out);
+}
+
+} // namespace kudu
@@ -0,0 +1,271 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_MPSC_QUEUE_H
+#define KUDU_UTIL_MPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/blocking_queue.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+// Multi-producer, single-consumer queue with the BlockingPut() and
+// BlockingDrainTo() interface of BlockingQueue.
+//
+// Producers push elements to a lock-free stack, which the consumer takes
+// whole and reverses. The lock is only taken to put a producer to sleep
+// while the queue is full, or to wake the consumer while it is asleep; a
+// busy consumer is never signaled.
+//
+// As with BlockingQueue, an element may be put as long as the total logical
+// size of the queued elements is below 'max_size'.
+template <typename T, class LOGICAL_SIZE = DefaultLogicalSize>
+class MpscQueue {
+ public:
+  explicit MpscQueue(size_t max_size)
+      : max_size_(max_size),
+        head_(nullptr),
+        size_(0),
+        producers_in_put_(0),
+        producers_waiting_(0),
+        consumer_sleeping_(false),
+        shutdown_(false),
+        closed_(false),
+        not_empty_(&lock_),
+        not_full_(&lock_) {}
+
+  // If the queue holds a bare pointer, it must be empty on destruction, since
+  // it may have ownership of the pointer.
+  ~MpscQueue() {
+    DCHECK(head_ == nullptr || !std::is_pointer<T>::value)
+        << "MpscQueue holds bare pointers at destruction time";
+    Node* n = head_;
+    while (n) {
+      Node* next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+
+  // Puts 'val' in the queue; if the queue is full, blocks until space
+  // becomes available. Returns false if the queue was shut down prior to
+  // enqueueing the element.
+  bool BlockingPut(const T& val) {
+    // Shutdown() waits for the producers it didn't stop here, so that no
+    // element is pushed after the consumer was told the queue is closed.
+    producers_in_put_++;
+    if (PREDICT_FALSE(shutdown_)) {
+      producers_in_put_--;
+      return false;
+    }
+    size_t logical_size = LOGICAL_SIZE::logical_size(val);
+    if (PREDICT_FALSE(!TryReserve(logical_size))) {
+      if (!WaitAndReserve(logical_size)) {
+        producers_in_put_--;
+        return false;
+      }
+    }
+
+    Node* node = new Node{val, head_.load(std::memory_order_relaxed)};
+    while (!head_.compare_exchange_weak(node->next, node)) {
+    }
+    producers_in_put_--;
+
+    // Pairs with the store in BlockingDrainTo(): either the consumer sees
+    // the node, or we see it asleep.
+    if (consumer_sleeping_) {
+      MutexLock l(lock_);
+      not_empty_.Signal();
+    }
+    return true;
+  }
+
+  // Gets all elements from the queue and appends them to 'out', oldest
+  // first.
+  //
+  // If 'deadline' passes and no elements have been returned from the
+  // queue, returns Status::TimedOut(). If 'deadline' is uninitialized,
+  // no deadline is used.
+  //
+  // If the queue has been shut down, but there are still elements waiting,
+  // then it returns those elements as if the queue were not yet shut down.
+  //
+  // Returns:
+  // - OK if successful
+  // - TimedOut if the deadline passed
+  // - Aborted if the queue shut down
+  //
+  // May only be called by one thread at a time.
+  Status BlockingDrainTo(std::vector<T>* out, MonoTime deadline = MonoTime()) {
+    while (true) {
+      // Read before taking the elements, so that any element pushed before
+      // the queue closed is taken.
+      bool closed = closed_;
+      if (TakeAll(out)) {
+        return Status::OK();
+      }
+      if (PREDICT_FALSE(closed)) {
+        return Status::Aborted("");
+      }
+
+      MutexLock l(lock_);
+      consumer_sleeping_ = true;
+      if (head_ != nullptr || closed_) {
+        consumer_sleeping_ = false;
+        continue;
+      }
+      bool timed_out = false;
+      if (!deadline.Initialized()) {
+        not_empty_.Wait();
+      } else {
+        timed_out = !not_empty_.WaitUntil(deadline);
+      }
+      consumer_sleeping_ = false;
+      if (PREDICT_FALSE(timed_out) && head_ == nullptr && !closed_) {
+        return Status::TimedOut("");
+      }
+    }
+  }
+
+  // Shuts down the queue. BlockingPut() then returns false, and once the
+  // queued elements are drained, BlockingDrainTo() returns Aborted.
+  void Shutdown() {
+    shutdown_ = true;
+    {
+      MutexLock l(lock_);
+      not_full_.Broadcast();
+    }
+    while (producers_in_put_ > 0) {
+      std::this_thread::yield();
+    }
+    MutexLock l(lock_);
+    closed_ = true;
+    not_empty_.Broadcast();
+  }
+
+  bool empty() const {
+    return head_ == nullptr;
+  }
+
+  // Returns the total logical size of the elements in the queue.
+  size_t size() const {
+    return size_;
+  }
+
+  size_t max_size() const {
+    return max_size_;
+  }
+
+ private:
+  struct Node {
+    T val;
+    Node* next;
+  };
+
+  // Reserves room for an element of 'logical_size' if the queue isn't full.
+  bool TryReserve(size_t logical_size) {
+    size_t s = size_;
+    while (s < max_size_) {
+      if (size_.compare_exchange_weak(s, s + logical_size)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Blocks until room for an element of 'logical_size' is reserved. Returns
+  // false if the queue was shut down first.
+  bool WaitAndReserve(size_t logical_size) {
+    MutexLock l(lock_);
+    producers_waiting_++;
+    bool reserved;
+    while (!(reserved = TryReserve(logical_size)) && !shutdown_) {
+      not_full_.Wait();
+    }
+    producers_waiting_--;
+    return reserved;
+  }
+
+  // Appends the queued elements to 'out', oldest first. Returns false if
+  // there were none.
+  bool TakeAll(std::vector<T>* out) {
+    Node* n = head_.exchange(nullptr);
+    if (n == nullptr) {
+      return false;
+    }
+    size_t first = out->size();
+    size_t taken_size = 0;
+    while (n) {
+      out->push_back(n->val);
+      taken_size += LOGICAL_SIZE::logical_size(n->val);
+      Node* next = n->next;
+      delete n;
+      n = next;
+    }
+    std::reverse(out->begin() + first, out->end());
+
+    // Pairs with the increment in WaitAndReserve(): either the producer sees
+    // the room, or we see it waiting.
+    size_ -= taken_size;
+    if (producers_waiting_ > 0) {
+      MutexLock l(lock_);
+      not_full_.Broadcast();
+    }
+    return true;
+  }
+
+  const size_t max_size_;
+
+  // Most recently pushed element.
+  std::atomic<Node*> head_;
+
+  // Total logical size of the queued elements, including the ones being
+  // pushed.
+  std::atomic<size_t> size_;
+
+  std::atomic<int> producers_in_put_;
+  std::atomic<int> producers_waiting_;
+  std::atomic<bool> consumer_sleeping_;
+
+  // Set when Shutdown() starts, and once no producer can push anymore.
+  std::atomic<bool> shutdown_;
+  std::atomic<bool> closed_;
+
+  // Only taken to sleep and to wake sleepers.
+  Mutex lock_;
+  ConditionVariable not_empty_;
+  ConditionVariable not_full_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+} // namespace kudu
+
+#endif
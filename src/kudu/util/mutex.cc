@@ -20,12 +20,13 @@
 
 #include <glog/logging.h>
 
+#include "kudu/util/lock_profiling.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/trace.h"
 
 namespace kudu {
 
-Mutex::Mutex() {
+Mutex::Mutex() : profile_(nullptr) {
   // In release, go with the default lock attributes.
   pthread_mutex_init(&native_handle_, NULL);
 }
@@ -37,7 +38,14 @@ Mutex::~Mutex() {
 
 bool Mutex::TryAcquire() {
   int rv = pthread_mutex_trylock(&native_handle_);
-  return rv == 0;
+  if (rv != 0) {
+    return false;
+  }
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    profile->Acquired(0);
+  }
+  return true;
 }
 
 void Mutex::Acquire() {
@@ -62,9 +70,17 @@ void Mutex::Acquire() {
   if (wait_time > 0) {
     TRACE_COUNTER_INCREMENT("mutex_wait_us", wait_time);
   }
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    profile->Acquired(wait_time);
+  }
 }
 
 void Mutex::Release() {
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    profile->Released();
+  }
   int rv = pthread_mutex_unlock(&native_handle_);
   DCHECK_EQ(0, rv) << ". " << strerror(rv);
 }
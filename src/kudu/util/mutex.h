@@ -17,12 +17,15 @@
 #ifndef KUDU_UTIL_MUTEX_H
 #define KUDU_UTIL_MUTEX_H
 
+#include <atomic>
+
 #include <glog/logging.h>
 
 #include "kudu/gutil/macros.h"
 
 namespace kudu {
 
+class LockProfile;
 class StackTrace;
 
 // A lock built around pthread_mutex_t. Does not allow recursion.
@@ -52,11 +55,19 @@ class Mutex {
 
   void AssertAcquired() const {}
 
+  // Starts recording wait and hold times into 'profile', which must outlive
+  // this mutex. See lock_profiling.h.
+  void set_profile(LockProfile* profile) {
+    profile_.store(profile, std::memory_order_relaxed);
+  }
+
  private:
   friend class ConditionVariable;
 
   pthread_mutex_t native_handle_;
 
+  std::atomic<LockProfile*> profile_;
+
   DISALLOW_COPY_AND_ASSIGN(Mutex);
 };
 
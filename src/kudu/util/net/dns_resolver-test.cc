@@ -21,11 +21,13 @@
 #include <string>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/test_macros.h"
@@ -33,6 +35,8 @@
 
 using std::vector;
 
+DECLARE_int32(dns_cache_ttl_ms);
+
 namespace kudu {
 
 class DnsResolverTest : public KuduTest {
@@ -56,4 +60,26 @@ TEST_F(DnsResolverTest, TestResolution) {
   }
 }
 
+TEST_F(DnsResolverTest, TestCachedResolution) {
+  FLAGS_dns_cache_ttl_ms = 1;
+  HostPort hp("localhost", 12345);
+  vector<Sockaddr> addrs;
+  ASSERT_OK(resolver_.ResolveAddressesCached(hp, &addrs));
+  ASSERT_FALSE(addrs.empty());
+
+  // Once expired, the cached addresses are still returned while they are
+  // refreshed in the background.
+  SleepFor(MonoDelta::FromMilliseconds(10));
+  for (int i = 0; i < 3; i++) {
+    vector<Sockaddr> cached_addrs;
+    ASSERT_OK(resolver_.ResolveAddressesCached(hp, &cached_addrs));
+    ASSERT_EQ(addrs.size(), cached_addrs.size());
+  }
+
+  // Failures are cached too.
+  HostPort bad_hp("nonexistent.invalid", 12345);
+  ASSERT_FALSE(resolver_.ResolveAddressesCached(bad_hp, nullptr).ok());
+  ASSERT_FALSE(resolver_.ResolveAddressesCached(bad_hp, nullptr).ok());
+}
+
 } // namespace kudu
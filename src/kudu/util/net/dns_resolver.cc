@@ -17,6 +17,7 @@
 
 #include "kudu/util/net/dns_resolver.h"
 
+#include <mutex>
 #include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
@@ -24,6 +25,7 @@
 #include <glog/logging.h>
 
 #include "kudu/gutil/callback.h"
+#include "kudu/gutil/map-util.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
@@ -35,6 +37,23 @@ DEFINE_int32(
     "The number of threads to use for DNS resolution");
 TAG_FLAG(dns_num_resolver_threads, advanced);
 
+DEFINE_int32(
+    dns_cache_ttl_ms,
+    0,
+    "How long, in milliseconds, a successful DNS resolution is cached before "
+    "it is refreshed in the background. Expired results keep being used "
+    "until the refresh completes. If 0, DNS resolutions aren't cached.");
+TAG_FLAG(dns_cache_ttl_ms, experimental);
+
+DEFINE_int32(
+    dns_cache_negative_ttl_ms,
+    1000,
+    "How long, in milliseconds, a failed DNS resolution is cached before it "
+    "is retried in the background. Only used if --dns_cache_ttl_ms is "
+    "positive.");
+TAG_FLAG(dns_cache_negative_ttl_ms, experimental);
+
+using std::string;
 using std::vector;
 
 namespace kudu {
@@ -49,24 +68,85 @@ DnsResolver::~DnsResolver() {
   pool_->Shutdown();
 }
 
-namespace {
-void DoResolution(
+void DnsResolver::DoResolution(
     const HostPort& hostport,
     vector<Sockaddr>* addresses,
     const StatusCallback& cb) {
-  cb.Run(hostport.ResolveAddresses(addresses));
+  cb.Run(ResolveAddressesCached(hostport, addresses));
 }
-} // anonymous namespace
 
 void DnsResolver::ResolveAddresses(
     const HostPort& hostport,
     vector<Sockaddr>* addresses,
     const StatusCallback& cb) {
-  Status s =
-      pool_->SubmitFunc(boost::bind(&DoResolution, hostport, addresses, cb));
+  Status s = pool_->SubmitFunc(boost::bind(
+      &DnsResolver::DoResolution, this, hostport, addresses, cb));
   if (!s.ok()) {
     cb.Run(s);
   }
 }
 
+Status DnsResolver::ResolveAddressesCached(
+    const HostPort& hostport,
+    vector<Sockaddr>* addresses) {
+  if (FLAGS_dns_cache_ttl_ms <= 0) {
+    return hostport.ResolveAddresses(addresses);
+  }
+
+  const string key = hostport.ToString();
+  Status s;
+  bool cached = false;
+  bool refresh = false;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    CacheEntry* entry = FindOrNull(cache_, key);
+    if (entry != nullptr) {
+      cached = true;
+      s = entry->status;
+      if (addresses) {
+        *addresses = entry->addresses;
+      }
+      if (!entry->refreshing && entry->expires < MonoTime::Now()) {
+        entry->refreshing = refresh = true;
+      }
+    }
+  }
+  if (!cached) {
+    return ResolveAndCache(hostport, addresses);
+  }
+
+  if (refresh) {
+    Status submitted = pool_->SubmitFunc([this, hostport]() {
+      WARN_NOT_OK(
+          ResolveAndCache(hostport, nullptr),
+          "Unable to refresh DNS resolution");
+    });
+    if (!submitted.ok()) {
+      std::lock_guard<simple_spinlock> l(lock_);
+      FindOrDie(cache_, key).refreshing = false;
+    }
+  }
+  return s;
+}
+
+Status DnsResolver::ResolveAndCache(
+    const HostPort& hostport,
+    vector<Sockaddr>* addresses) {
+  vector<Sockaddr> resolved;
+  Status s = hostport.ResolveAddresses(&resolved);
+  MonoDelta ttl = MonoDelta::FromMilliseconds(
+      s.ok() ? FLAGS_dns_cache_ttl_ms : FLAGS_dns_cache_negative_ttl_ms);
+
+  std::lock_guard<simple_spinlock> l(lock_);
+  CacheEntry& entry = cache_[hostport.ToString()];
+  entry.status = s;
+  entry.addresses = resolved;
+  entry.expires = MonoTime::Now() + ttl;
+  entry.refreshing = false;
+  if (addresses) {
+    *addresses = std::move(resolved);
+  }
+  return s;
+}
+
 } // namespace kudu
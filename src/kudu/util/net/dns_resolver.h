@@ -18,18 +18,26 @@
 #define KUDU_UTIL_NET_DNS_RESOLVER_H
 
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
 
 class HostPort;
-class Sockaddr;
 class ThreadPool;
 
 // DNS Resolver which supports async address resolution.
+//
+// When --dns_cache_ttl_ms is positive, resolutions go through a cache of
+// recent results, failures included, which is refreshed in the background.
 class DnsResolver {
  public:
   DnsResolver();
@@ -53,9 +61,48 @@ class DnsResolver {
       std::vector<Sockaddr>* addresses,
       const StatusCallback& cb);
 
+  // Like ResolveAddresses(), but synchronous.
+  //
+  // If the cache is enabled and holds a result for 'hostport', that result is
+  // returned without blocking, even once it has expired: an expired result is
+  // refreshed on the resolver's thread so that a slow DNS server doesn't delay
+  // the caller. Only hosts which aren't cached yet are resolved on the
+  // caller's thread.
+  Status ResolveAddressesCached(
+      const HostPort& hostport,
+      std::vector<Sockaddr>* addresses);
+
  private:
+  struct CacheEntry {
+    // The result of the last resolution.
+    Status status;
+    std::vector<Sockaddr> addresses;
+
+    // When the result should be refreshed.
+    MonoTime expires;
+
+    // Whether a refresh is queued or running.
+    bool refreshing = false;
+  };
+
+  void DoResolution(
+      const HostPort& hostport,
+      std::vector<Sockaddr>* addresses,
+      const StatusCallback& cb);
+
+  // Resolves 'hostport' on the calling thread and caches the result.
+  Status ResolveAndCache(
+      const HostPort& hostport,
+      std::vector<Sockaddr>* addresses);
+
   std::unique_ptr<ThreadPool> pool_;
 
+  // Protects 'cache_'.
+  simple_spinlock lock_;
+
+  // Keyed by HostPort::ToString().
+  std::unordered_map<std::string, CacheEntry> cache_;
+
   DISALLOW_COPY_AND_ASSIGN(DnsResolver);
 };
 
@@ -173,6 +173,16 @@ Status Socket::SetNoDelay(bool enabled) {
   return Status::OK();
 }
 
+Status Socket::SetBusyPoll(int us) {
+#if defined(SO_BUSY_POLL)
+  RETURN_NOT_OK_PREPEND(
+      SetSockOpt(SOL_SOCKET, SO_BUSY_POLL, us), "failed to set SO_BUSY_POLL");
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_BUSY_POLL");
+#endif
+}
+
 Status Socket::SetTcpCork(bool enabled) {
 #if defined(__linux__)
   int flag = enabled ? 1 : 0;
@@ -310,6 +320,32 @@ Status Socket::GetPeerAddress(Sockaddr* cur_addr) const {
   return Status::OK();
 }
 
+Status Socket::GetIncomingCpu(int* cpu) const {
+#if defined(SO_INCOMING_CPU)
+  DCHECK_GE(fd_, 0);
+  socklen_t len = sizeof(*cpu);
+  if (::getsockopt(fd_, SOL_SOCKET, SO_INCOMING_CPU, cpu, &len) == -1) {
+    int err = errno;
+    return Status::NetworkError(
+        "getsockopt(SO_INCOMING_CPU) error", ErrnoToString(err), err);
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_INCOMING_CPU");
+#endif
+}
+
+Status Socket::SetIncomingCpu(int cpu) {
+#if defined(SO_INCOMING_CPU)
+  RETURN_NOT_OK_PREPEND(
+      SetSockOpt(SOL_SOCKET, SO_INCOMING_CPU, cpu),
+      "failed to set SO_INCOMING_CPU");
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_INCOMING_CPU");
+#endif
+}
+
 bool Socket::IsLoopbackConnection() const {
   Sockaddr local, remote;
   if (!GetSocketAddress(&local).ok())
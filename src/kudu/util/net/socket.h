@@ -69,6 +69,10 @@ class Socket {
   // Set or clear TCP_NODELAY
   Status SetNoDelay(bool enabled);
 
+  // Set SO_BUSY_POLL, so that blocking receives and polls of this socket spin
+  // on the device queue for up to 'us' microseconds before sleeping.
+  Status SetBusyPoll(int us);
+
   // Set or clear TCP_CORK
   Status SetTcpCork(bool enabled);
 
@@ -107,6 +111,16 @@ class Socket {
   // It is virtual so that tests can override.
   virtual Status GetPeerAddress(Sockaddr* cur_addr) const;
 
+  // Get the CPU which handled the most recent packets received on this
+  // socket, as reported by SO_INCOMING_CPU. This is the CPU serving the NIC
+  // queue the connection's traffic arrives on.
+  Status GetIncomingCpu(int* cpu) const;
+
+  // Sets SO_INCOMING_CPU to 'cpu' on a listening socket, so that among
+  // sockets sharing a port through SO_REUSEPORT, connections whose traffic
+  // arrives on 'cpu' prefer this one.
+  Status SetIncomingCpu(int cpu);
+
   // Return true if this socket is determined to be a loopback connection
   // (i.e. the local and remote peer share an IP address).
   //
@@ -42,6 +42,8 @@
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_int32(pb_container_whole_file_max_bytes);
+
 namespace kudu {
 namespace pb_util {
 
@@ -481,6 +483,47 @@ TEST_P(TestPBContainerVersions, TestSingleMessage) {
   ASSERT_EQ(kTestKeyvalValue, test_pb.value());
 }
 
+// Files written and read whole are the same as files written and read a
+// header and record at a time.
+TEST_P(TestPBContainerVersions, TestWholeFile) {
+  ASSERT_OK(CreateKnownGoodContainerFileWithVersion(version_));
+  faststring expected;
+  ASSERT_OK(ReadFileToString(env_, path_, &expected));
+
+  ProtoContainerTestPB test_pb;
+  test_pb.set_name(kTestKeyvalName);
+  test_pb.set_value(kTestKeyvalValue);
+  {
+    unique_ptr<WritablePBContainerFile> pb_writer;
+    ASSERT_OK(NewPBCWriter(version_, RWFileOptions(), &pb_writer));
+    ASSERT_OK(pb_writer->CreateNewAndAppend(test_pb));
+    ASSERT_OK(pb_writer->Close());
+  }
+  faststring whole;
+  ASSERT_OK(ReadFileToString(env_, path_, &whole));
+  ASSERT_EQ(expected.ToString(), whole.ToString());
+
+  FLAGS_pb_container_whole_file_max_bytes = 4096;
+  ProtoContainerTestPB read_pb;
+  ASSERT_OK(ReadPBContainerFromPath(env_, path_, &read_pb));
+  ASSERT_EQ(kTestKeyvalName, read_pb.name());
+  ASSERT_EQ(kTestKeyvalValue, read_pb.value());
+
+  // Corruption is detected as well.
+  ASSERT_OK(BitFlipFileByteRange(path_, whole.size() - 4, 2));
+  Status s = ReadPBContainerFromPath(env_, path_, &read_pb);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  ASSERT_STR_CONTAINS(s.ToString(), "Incorrect checksum");
+
+  // So is truncation.
+  ASSERT_OK(CreateKnownGoodContainerFile());
+  ASSERT_OK(ReadPBContainerFromPath(env_, path_, &read_pb));
+  ASSERT_OK(TruncateFile(path_, whole.size() - 2));
+  s = ReadPBContainerFromPath(env_, path_, &read_pb);
+  ASSERT_FALSE(s.ok());
+  ASSERT_STR_CONTAINS(s.ToString(), "File size not large enough to be valid");
+}
+
 TEST_P(TestPBContainerVersions, TestMultipleMessages) {
   ProtoContainerTestPB pb;
   pb.set_name("foo");
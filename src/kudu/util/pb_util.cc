@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <deque>
 #include <initializer_list>
 #include <memory>
@@ -32,9 +33,11 @@
 #include <ostream>
 #include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/descriptor.pb.h>
@@ -55,6 +58,7 @@
 #include "kudu/gutil/strings/escaping.h"
 #include "kudu/gutil/strings/fastmem.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/array_view.h"
 #include "kudu/util/coding-inl.h"
 #include "kudu/util/coding.h"
 #include "kudu/util/crc.h"
@@ -63,6 +67,7 @@
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/path_util.h"
@@ -72,6 +77,17 @@
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
+DEFINE_int32(
+    pb_container_whole_file_max_bytes,
+    0,
+    "Protobuf container files of up to this many bytes which hold a single "
+    "message, such as consensus metadata, are read with a single read and "
+    "written with a single write, rather than a read or write per header and "
+    "record. If 0, they are read and written like other container files.");
+TAG_FLAG(pb_container_whole_file_max_bytes, advanced);
+TAG_FLAG(pb_container_whole_file_max_bytes, experimental);
+TAG_FLAG(pb_container_whole_file_max_bytes, runtime);
+
 using google::protobuf::Descriptor;
 using google::protobuf::DescriptorPool;
 using google::protobuf::DynamicMessageFactory;
@@ -683,6 +699,74 @@ void TruncateFields(Message* message, int max_len) {
   }
 }
 
+void MergeFieldsExcept(
+    const Message& from,
+    const FieldDescriptor* skip,
+    Message* to) {
+  DCHECK_EQ(from.GetDescriptor(), to->GetDescriptor());
+  const Reflection* from_reflection = from.GetReflection();
+  const Reflection* to_reflection = to->GetReflection();
+  vector<const FieldDescriptor*> fields;
+  from_reflection->ListFields(from, &fields);
+  for (const FieldDescriptor* field : fields) {
+    if (field == skip) {
+      continue;
+    }
+    if (field->is_repeated()) {
+      const int size = from_reflection->FieldSize(from, field);
+      for (int i = 0; i < size; i++) {
+        switch (field->cpp_type()) {
+#define COPY_REPEATED(CPPTYPE, METHOD)                                  \
+  case FieldDescriptor::CPPTYPE_##CPPTYPE:                              \
+    to_reflection->Add##METHOD(                                         \
+        to, field, from_reflection->GetRepeated##METHOD(from, field, i)); \
+    break;
+          COPY_REPEATED(INT32, Int32)
+          COPY_REPEATED(INT64, Int64)
+          COPY_REPEATED(UINT32, UInt32)
+          COPY_REPEATED(UINT64, UInt64)
+          COPY_REPEATED(DOUBLE, Double)
+          COPY_REPEATED(FLOAT, Float)
+          COPY_REPEATED(BOOL, Bool)
+          COPY_REPEATED(ENUM, Enum)
+          COPY_REPEATED(STRING, String)
+#undef COPY_REPEATED
+          case FieldDescriptor::CPPTYPE_MESSAGE:
+            MergeFieldsExcept(
+                from_reflection->GetRepeatedMessage(from, field, i),
+                skip,
+                to_reflection->AddMessage(to, field));
+            break;
+        }
+      }
+      continue;
+    }
+    switch (field->cpp_type()) {
+#define COPY_SINGULAR(CPPTYPE, METHOD)                                 \
+  case FieldDescriptor::CPPTYPE_##CPPTYPE:                             \
+    to_reflection->Set##METHOD(                                        \
+        to, field, from_reflection->Get##METHOD(from, field));         \
+    break;
+      COPY_SINGULAR(INT32, Int32)
+      COPY_SINGULAR(INT64, Int64)
+      COPY_SINGULAR(UINT32, UInt32)
+      COPY_SINGULAR(UINT64, UInt64)
+      COPY_SINGULAR(DOUBLE, Double)
+      COPY_SINGULAR(FLOAT, Float)
+      COPY_SINGULAR(BOOL, Bool)
+      COPY_SINGULAR(ENUM, Enum)
+      COPY_SINGULAR(STRING, String)
+#undef COPY_SINGULAR
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+        MergeFieldsExcept(
+            from_reflection->GetMessage(from, field),
+            skip,
+            to_reflection->MutableMessage(to, field));
+        break;
+    }
+  }
+}
+
 namespace {
 class SecureFieldPrinter : public TextFormat::FieldValuePrinter {
  public:
@@ -763,43 +847,75 @@ Status WritablePBContainerFile::SetVersionForTests(int version) {
 Status WritablePBContainerFile::CreateNew(const Message& msg) {
   DCHECK_EQ(FileState::NOT_INITIALIZED, state_);
 
+  faststring buf;
+  RETURN_NOT_OK(AppendHeaderToBuffer(msg, 0, &buf));
+
+  // Write the serialized buffer to the file.
+  RETURN_NOT_OK_PREPEND(AppendBytes(buf), "Failed to append header to file");
+  state_ = FileState::OPEN;
+  return Status::OK();
+}
+
+Status WritablePBContainerFile::CreateNewAndAppend(const Message& msg) {
+  DCHECK_EQ(FileState::NOT_INITIALIZED, state_);
+
+  faststring buf;
+  RETURN_NOT_OK(AppendHeaderToBuffer(msg, msg.ByteSizeLong(), &buf));
+  RETURN_NOT_OK_PREPEND(
+      AppendMsgToBuffer(msg, &buf), "Failed to prepare buffer for writing");
+
+  // Write the header and the record with a single write.
+  RETURN_NOT_OK_PREPEND(
+      AppendBytes(buf), "Failed to append header and data to file");
+  state_ = FileState::OPEN;
+  return Status::OK();
+}
+
+Status WritablePBContainerFile::AppendHeaderToBuffer(
+    const Message& msg,
+    size_t data_len,
+    faststring* buf) {
   const uint64_t kHeaderLen = (version_ == 1)
       ? kPBContainerV1HeaderLen
       : kPBContainerV1HeaderLen + kPBContainerChecksumLen;
 
-  faststring buf;
-  buf.resize(kHeaderLen);
+  ContainerSupHeaderPB sup_header;
+  PopulateDescriptorSet(
+      msg.GetDescriptor()->file(), sup_header.mutable_protos());
+  sup_header.set_pb_type(msg.GetTypeName());
+
+  // Each record adds at most a length and two checksums.
+  const size_t kRecordOverhead = 3 * sizeof(uint32_t);
+  buf->reserve(
+      buf->size() + kHeaderLen + sup_header.ByteSizeLong() + kRecordOverhead +
+      (data_len > 0 ? data_len + kRecordOverhead : 0));
+
+  const size_t header_offset = buf->size();
+  buf->resize(header_offset + kHeaderLen);
+  uint8_t* dst = buf->data() + header_offset;
 
   // Serialize the magic.
-  strings::memcpy_inlined(buf.data(), kPBContainerMagic, kPBContainerMagicLen);
+  strings::memcpy_inlined(dst, kPBContainerMagic, kPBContainerMagicLen);
   uint64_t offset = kPBContainerMagicLen;
 
   // Serialize the version.
-  InlineEncodeFixed32(buf.data() + offset, version_);
+  InlineEncodeFixed32(dst + offset, version_);
   offset += sizeof(uint32_t);
   DCHECK_EQ(kPBContainerV1HeaderLen, offset)
       << "Serialized unexpected number of total bytes";
 
   // Versions >= 2: Checksum the magic and version.
   if (version_ >= 2) {
-    uint32_t header_checksum = crc::Crc32c(buf.data(), offset);
-    InlineEncodeFixed32(buf.data() + offset, header_checksum);
+    uint32_t header_checksum = crc::Crc32c(dst, offset);
+    InlineEncodeFixed32(dst + offset, header_checksum);
     offset += sizeof(uint32_t);
   }
   DCHECK_EQ(offset, kHeaderLen);
 
   // Serialize the supplemental header.
-  ContainerSupHeaderPB sup_header;
-  PopulateDescriptorSet(
-      msg.GetDescriptor()->file(), sup_header.mutable_protos());
-  sup_header.set_pb_type(msg.GetTypeName());
   RETURN_NOT_OK_PREPEND(
-      AppendMsgToBuffer(sup_header, &buf),
+      AppendMsgToBuffer(sup_header, buf),
       "Failed to prepare supplemental header for writing");
-
-  // Write the serialized buffer to the file.
-  RETURN_NOT_OK_PREPEND(AppendBytes(buf), "Failed to append header to file");
-  state_ = FileState::OPEN;
   return Status::OK();
 }
 
@@ -1126,11 +1242,75 @@ uint64_t ReadablePBContainerFile::offset() const {
   return offset_;
 }
 
+namespace {
+
+// A read-only file whose contents were read into memory at once, so that
+// parsing a small container from it doesn't issue a read per field.
+class InMemoryRandomAccessFile : public RandomAccessFile {
+ public:
+  InMemoryRandomAccessFile(string filename, string contents)
+      : filename_(std::move(filename)), contents_(std::move(contents)) {}
+
+  Status Read(uint64_t offset, Slice result) const override {
+    if (PREDICT_FALSE(
+            offset > contents_.size() ||
+            result.size() > contents_.size() - offset)) {
+      return Status::IOError(Substitute(
+          "Cannot read $0 bytes at offset $1 of $2: file is $3 bytes",
+          result.size(),
+          offset,
+          filename_,
+          contents_.size()));
+    }
+    memcpy(result.mutable_data(), contents_.data() + offset, result.size());
+    return Status::OK();
+  }
+
+  Status ReadV(uint64_t offset, ArrayView<Slice> results) const override {
+    for (const Slice& result : results) {
+      RETURN_NOT_OK(Read(offset, result));
+      offset += result.size();
+    }
+    return Status::OK();
+  }
+
+  Status Size(uint64_t* size) const override {
+    *size = contents_.size();
+    return Status::OK();
+  }
+
+  const string& filename() const override {
+    return filename_;
+  }
+
+  size_t memory_footprint() const override {
+    return sizeof(*this) + filename_.capacity() + contents_.capacity();
+  }
+
+ private:
+  const string filename_;
+  const string contents_;
+};
+
+} // anonymous namespace
+
 Status
 ReadPBContainerFromPath(Env* env, const std::string& path, Message* msg) {
   unique_ptr<RandomAccessFile> file;
   RETURN_NOT_OK(env->NewRandomAccessFile(path, &file));
 
+  const int32_t whole_file_max_bytes = FLAGS_pb_container_whole_file_max_bytes;
+  if (whole_file_max_bytes > 0) {
+    uint64_t size;
+    RETURN_NOT_OK(file->Size(&size));
+    if (size <= static_cast<uint64_t>(whole_file_max_bytes)) {
+      string contents(size, '\0');
+      RETURN_NOT_OK(file->Read(
+          0, Slice(reinterpret_cast<uint8_t*>(&contents[0]), size)));
+      file.reset(new InMemoryRandomAccessFile(path, std::move(contents)));
+    }
+  }
+
   ReadablePBContainerFile pb_file(std::move(file));
   RETURN_NOT_OK(pb_file.Open());
   RETURN_NOT_OK(pb_file.ReadNextPB(msg));
@@ -1166,8 +1346,14 @@ Status WritePBContainerToPath(
   });
 
   WritablePBContainerFile pb_file(std::move(file));
-  RETURN_NOT_OK(pb_file.CreateNew(msg));
-  RETURN_NOT_OK(pb_file.Append(msg));
+  const int32_t whole_file_max_bytes = FLAGS_pb_container_whole_file_max_bytes;
+  if (whole_file_max_bytes > 0 &&
+      msg.ByteSizeLong() <= static_cast<size_t>(whole_file_max_bytes)) {
+    RETURN_NOT_OK(pb_file.CreateNewAndAppend(msg));
+  } else {
+    RETURN_NOT_OK(pb_file.CreateNew(msg));
+    RETURN_NOT_OK(pb_file.Append(msg));
+  }
   if (sync == pb_util::SYNC) {
     RETURN_NOT_OK(pb_file.Sync());
   }
@@ -21,6 +21,7 @@
 #ifndef KUDU_UTIL_PB_UTIL_H
 #define KUDU_UTIL_PB_UTIL_H
 
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 #include <memory>
@@ -111,6 +112,15 @@ Status WritePBToPath(
 // The text "<truncated>" is appended to any such truncated fields.
 void TruncateFields(google::protobuf::Message* message, int max_len);
 
+// Merges every field set in 'from' into 'to', which must be of the same type,
+// except 'skip' in 'from' or in any message nested in it. Unlike merging the
+// whole message and clearing 'skip' afterwards, a large field is never
+// copied.
+void MergeFieldsExcept(
+    const google::protobuf::Message& from,
+    const google::protobuf::FieldDescriptor* skip,
+    google::protobuf::Message* to);
+
 // Redaction-sensitive variant of Message::DebugString.
 //
 // For most protobufs, this has identical output to Message::DebugString.
@@ -293,6 +303,13 @@ class WritablePBContainerFile {
   // Not thread-safe.
   Status CreateNew(const google::protobuf::Message& msg);
 
+  // Like CreateNew(msg) followed by Append(msg), but serializes the file
+  // header and 'msg' into one pre-sized buffer and writes it with a single
+  // write. The resulting file is byte for byte the same.
+  //
+  // Not thread-safe.
+  Status CreateNewAndAppend(const google::protobuf::Message& msg);
+
   // Opens an existing protobuf container file for append. The file must
   // already have a valid file header. To initialize a new blank file for
   // writing, use CreateNew() instead.
@@ -349,6 +366,14 @@ class WritablePBContainerFile {
       const google::protobuf::FileDescriptor* desc,
       google::protobuf::FileDescriptorSet* output);
 
+  // Serialize the file header and the supplemental header for messages of the
+  // type of 'msg' into 'buf', reserving room for 'data_len' more bytes of
+  // records after them.
+  Status AppendHeaderToBuffer(
+      const google::protobuf::Message& msg,
+      size_t data_len,
+      faststring* buf);
+
   // Serialize the contents of 'msg' into 'buf' along with additional metadata
   // to aid in deserialization.
   Status AppendMsgToBuffer(
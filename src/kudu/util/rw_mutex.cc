@@ -24,6 +24,10 @@
 
 #include <glog/logging.h>
 
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/lock_profiling.h"
+
 namespace {
 
 void unlock_rwlock(pthread_rwlock_t* rwlock) {
@@ -79,8 +83,13 @@ RWMutex::~RWMutex() {
 
 void RWMutex::ReadLock() {
   CheckLockState(LockState::NEITHER);
-  int rv = pthread_rwlock_rdlock(&native_handle_);
-  DCHECK_EQ(0, rv) << strerror(rv);
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    ProfiledLock(profile, false);
+  } else {
+    int rv = pthread_rwlock_rdlock(&native_handle_);
+    DCHECK_EQ(0, rv) << strerror(rv);
+  }
   MarkForReading();
 }
 
@@ -103,14 +112,23 @@ bool RWMutex::TryReadLock() {
 
 void RWMutex::WriteLock() {
   CheckLockState(LockState::NEITHER);
-  int rv = pthread_rwlock_wrlock(&native_handle_);
-  DCHECK_EQ(0, rv) << strerror(rv);
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    ProfiledLock(profile, true);
+  } else {
+    int rv = pthread_rwlock_wrlock(&native_handle_);
+    DCHECK_EQ(0, rv) << strerror(rv);
+  }
   MarkForWriting();
 }
 
 void RWMutex::WriteUnlock() {
   CheckLockState(LockState::WRITER);
   UnmarkForWriting();
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    profile->Released();
+  }
   unlock_rwlock(&native_handle_);
 }
 
@@ -122,7 +140,29 @@ bool RWMutex::TryWriteLock() {
   }
   DCHECK_EQ(0, rv) << strerror(rv);
   MarkForWriting();
+  LockProfile* profile = profile_.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(profile != nullptr)) {
+    profile->Acquired(0);
+  }
   return true;
 }
 
+void RWMutex::ProfiledLock(LockProfile* profile, bool write) {
+  int rv = write ? pthread_rwlock_trywrlock(&native_handle_)
+                 : pthread_rwlock_tryrdlock(&native_handle_);
+  int64_t wait_us = 0;
+  if (rv == EBUSY) {
+    MicrosecondsInt64 start_time = GetMonoTimeMicros();
+    rv = write ? pthread_rwlock_wrlock(&native_handle_)
+               : pthread_rwlock_rdlock(&native_handle_);
+    wait_us = GetMonoTimeMicros() - start_time;
+  }
+  DCHECK_EQ(0, rv) << strerror(rv);
+  if (write) {
+    profile->Acquired(wait_us);
+  } else {
+    profile->AcquiredShared(wait_us);
+  }
+}
+
 } // namespace kudu
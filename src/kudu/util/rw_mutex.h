@@ -20,6 +20,8 @@
 #include <pthread.h>
 #include <sys/types.h>
 
+#include <atomic>
+#include <cstdint>
 #include <unordered_set>
 
 #include "kudu/gutil/macros.h"
@@ -27,6 +29,8 @@
 
 namespace kudu {
 
+class LockProfile;
+
 // Read/write mutex. Implemented as a thin wrapper around pthread_rwlock_t.
 //
 // Although pthread_rwlock_t allows recursive acquisition, this wrapper does
@@ -87,9 +91,19 @@ class RWMutex {
     return TryReadLock();
   }
 
+  // Starts recording wait times, and hold times of the write lock, into
+  // 'profile', which must outlive this mutex. See lock_profiling.h.
+  void set_profile(LockProfile* profile) {
+    profile_.store(profile, std::memory_order_relaxed);
+  }
+
  private:
   void Init(Priority prio);
 
+  // Acquires the lock for reading ('write' false) or writing, recording the
+  // wait time into 'profile'.
+  void ProfiledLock(LockProfile* profile, bool write);
+
   enum class LockState {
     NEITHER,
     READER,
@@ -104,6 +118,8 @@ class RWMutex {
 
   pthread_rwlock_t native_handle_;
 
+  std::atomic<LockProfile*> profile_{nullptr};
+
   DISALLOW_COPY_AND_ASSIGN(RWMutex);
 };
 
@@ -17,6 +17,7 @@
 
 #include "kudu/util/kernel_stack_watchdog.h"
 
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <thread>
@@ -107,6 +108,41 @@ TEST_F(StackWatchdogTest, TestNestedScopes) {
   ASSERT_STR_CONTAINS(s, Substitute("stack_watchdog-test.cc:$0", line2));
 }
 
+// Test that stall callbacks hear of each stuck scope once, and that unwatched
+// scopes inside watched ones leave the watched frames alone.
+TEST_F(StackWatchdogTest, TestStallCallback) {
+  KernelStackWatchdog* watchdog = KernelStackWatchdog::GetInstance();
+  std::mutex lock;
+  vector<KernelStackWatchdog::Stall> stalls;
+  int id = watchdog->AddStallCallback(
+      [&](const KernelStackWatchdog::Stall& stall) {
+        std::lock_guard<std::mutex> l(lock);
+        stalls.push_back(stall);
+      });
+  int line;
+  {
+    SCOPED_WATCH_STACK(20);
+    line = __LINE__;
+    {
+      ScopedWatchKernelStack unwatched("unwatched", 0);
+    }
+    for (int i = 0; i < 50; i++) {
+      SleepFor(MonoDelta::FromMilliseconds(100));
+      // Wait for several checks while stuck.
+      if (watchdog->LoggedMessagesForTests().size() > 3) {
+        break;
+      }
+    }
+  }
+  watchdog->RemoveStallCallback(id);
+
+  std::lock_guard<std::mutex> l(lock);
+  ASSERT_EQ(1, stalls.size());
+  ASSERT_EQ(Substitute("$0:$1", __FILE__, line), stalls[0].label);
+  ASSERT_GE(stalls[0].paused_ms, 20);
+  ASSERT_FALSE(stalls[0].user_stack.empty());
+}
+
 TEST_F(StackWatchdogTest, TestPerformance) {
   // Reset the check interval to be reasonable. Otherwise the benchmark
   // wastes a lot of CPU running the watchdog thread too often.
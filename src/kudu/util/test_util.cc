@@ -23,10 +23,12 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <limits>
 #include <map>
 #include <memory>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -49,6 +51,7 @@
 #include "kudu/gutil/walltime.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/jsonwriter.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
@@ -73,6 +76,7 @@ namespace kudu {
 
 const char* kInvalidPath = "/dev/invalid-path-for-kudu-tests";
 static const char* const kSlowTestsEnvVariable = "KUDU_ALLOW_SLOW_TESTS";
+static const char* const kPerfResultsEnvVariable = "KUDU_PERF_RESULTS";
 
 static const uint64_t kTestBeganAtMicros = Env::Default()->NowMicros();
 
@@ -201,6 +205,24 @@ void OverrideFlagForSlowTests(
       flag_name.c_str(), new_value.c_str(), gflags::SET_FLAG_IF_DEFAULT);
 }
 
+void RecordPerfResult(const string& name, double value) {
+  const char* path = getenv(kPerfResultsEnvVariable);
+  if (path == nullptr || strlen(path) == 0) {
+    return;
+  }
+  std::ostringstream buf;
+  JsonWriter jw(&buf, JsonWriter::COMPACT);
+  jw.StartObject();
+  jw.String("name");
+  jw.String(name);
+  jw.String("value");
+  jw.Double(value);
+  jw.EndObject();
+  std::ofstream out(path, std::ios::out | std::ios::app);
+  out << buf.str() << "\n";
+  CHECK(out.good()) << "could not write to " << path;
+}
+
 int SeedRandom() {
   int seed;
   // Initialize random seed
@@ -94,6 +94,14 @@ void OverrideFlagForSlowTests(
     const std::string& flag_name,
     const std::string& new_value);
 
+// Records a result of a benchmark for the perf regression suite, which
+// build-support/run_perf_suite.py runs over the tests labeled 'perf' and
+// compares against build-support/perf_baselines.json. Appends the result as
+// a line of JSON to the file named by $KUDU_PERF_RESULTS, or does nothing if
+// it isn't set. Names are the benchmark and its setup, then the result,
+// ending in its unit, e.g. "rpc-bench[BenchmarkCalls].reqs_per_sec".
+void RecordPerfResult(const std::string& name, double value);
+
 // Call srand() with a random seed based on the current time, reporting
 // that seed to the logs. The time-based seed may be overridden by passing
 // --test_random_seed= from the CLI in order to reproduce a failed randomized
@@ -17,6 +17,7 @@
 
 #include "kudu/util/thread.h"
 
+#include <sched.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -38,6 +39,7 @@
 #include "kudu/util/thread_restrictions.h"
 
 using std::string;
+using std::vector;
 
 namespace kudu {
 
@@ -158,4 +160,33 @@ TEST_F(ThreadTest, TestThreadRestrictions_Waiting) {
 }
 #endif // NDEBUG
 
+TEST_F(ThreadTest, TestParseCpuList) {
+  vector<int> cpus;
+  ASSERT_OK(ParseCpuList("", &cpus));
+  ASSERT_TRUE(cpus.empty());
+  ASSERT_OK(ParseCpuList("0-3,8,10-11", &cpus));
+  ASSERT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+
+  ASSERT_TRUE(ParseCpuList("3-1", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("1-2-3", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("a", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("-1", &cpus).IsInvalidArgument());
+}
+
+#if defined(__linux__)
+TEST_F(ThreadTest, TestBindCurrentThreadToCpus) {
+  scoped_refptr<Thread> thread;
+  Status bind_status;
+  ASSERT_OK(Thread::Create(
+      "test",
+      "bind",
+      [&bind_status]() {
+        bind_status = BindCurrentThreadToCpus({sched_getcpu()});
+      },
+      &thread));
+  thread->Join();
+  ASSERT_OK(bind_status);
+}
+#endif // defined(__linux__)
+
 } // namespace kudu
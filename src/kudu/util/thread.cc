@@ -20,6 +20,7 @@
 #include "kudu/util/thread.h"
 
 #if defined(__linux__)
+#include <sched.h>
 #include <sys/capability.h>
 #include <sys/prctl.h>
 #endif // defined(__linux__)
@@ -48,7 +49,12 @@
 #include "kudu/gutil/mathlimits.h"
 #include "kudu/gutil/once.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
+#include "kudu/util/env.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/kernel_stack_watchdog.h"
 #include "kudu/util/logging.h"
@@ -755,4 +761,75 @@ Status GlobalChangeThreadPriority(string category, int priority) {
   return thread_manager->ChangeThreadPriority(category, priority);
 }
 
+Status ParseCpuList(const string& str, vector<int>* cpus) {
+  cpus->clear();
+  vector<string> ranges = strings::Split(str, ",", strings::SkipEmpty());
+  for (const string& range : ranges) {
+    vector<string> bounds = strings::Split(range, "-");
+    int first;
+    int last;
+    if (bounds.size() > 2 || !safe_strto32(bounds[0], &first) ||
+        !safe_strto32(bounds.back(), &last) || first < 0 || last < first) {
+      return Status::InvalidArgument("invalid CPU list", str);
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK();
+}
+
+bool ValidateCpuListFlag(const char* flagname, const string& value) {
+  vector<int> cpus;
+  Status s = ParseCpuList(value, &cpus);
+  if (!s.ok()) {
+    LOG(ERROR) << flagname << ": " << s.ToString();
+    return false;
+  }
+  return true;
+}
+
+Status BindCurrentThreadToCpus(const vector<int>& cpus) {
+  if (cpus.empty()) {
+    return Status::OK();
+  }
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      return Status::InvalidArgument(Substitute("no such CPU: $0", cpu));
+    }
+    CPU_SET(cpu, &set);
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    int err = errno;
+    return Status::RuntimeError(
+        "could not bind thread to CPUs", ErrnoToString(err), err);
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("binding threads to CPUs");
+#endif // defined(__linux__)
+}
+
+int NumaNodeOfCpu(int cpu) {
+  // The CPU's sysfs directory has a "node<N>" link to its NUMA node.
+  vector<string> children;
+  if (!Env::Default()
+           ->GetChildren(Substitute("/sys/devices/system/cpu/cpu$0", cpu),
+                         &children)
+           .ok()) {
+    return -1;
+  }
+  for (const string& child : children) {
+    int node;
+    if (HasPrefixString(child, "node") &&
+        safe_strto32(child.substr(4), &node)) {
+      return node;
+    }
+  }
+  return -1;
+}
+
 } // namespace kudu
@@ -31,6 +31,7 @@
 #include <cstdint>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/function.hpp> // IWYU pragma: keep
@@ -498,6 +499,20 @@ Status GlobalShowThreadStatus(std::vector<ThreadDescriptor>* threads);
 // @param priority thread priority based on nice. Should be -20 to 19
 // @return Status:OK if succeed
 Status GlobalChangeThreadPriority(std::string category, int priority);
+
+// Parses a list of CPUs in the format of /sys/devices/system/cpu/online, e.g.
+// "0-3,8,10-11", into 'cpus'. An empty string gives an empty list.
+Status ParseCpuList(const std::string& str, std::vector<int>* cpus);
+
+// Flag validator for flags holding a list of CPUs for ParseCpuList().
+bool ValidateCpuListFlag(const char* flagname, const std::string& value);
+
+// Binds the calling thread to the CPUs in 'cpus'. Does nothing if 'cpus' is
+// empty.
+Status BindCurrentThreadToCpus(const std::vector<int>& cpus);
+
+// Returns the NUMA node which 'cpu' belongs to, or -1 if it is not known.
+int NumaNodeOfCpu(int cpu);
 } // namespace kudu
 
 #endif /* KUDU_UTIL_THREAD_H */
@@ -959,4 +959,91 @@ TEST_F(ThreadPoolTest, TestLIFOThreadWakeUps) {
   NO_PENDING_FATALS();
 }
 
+TEST_F(ThreadPoolTest, TestWorkStealingSerialTokens) {
+  const int kNumTokens = 16;
+  const int kNumSubmissions = 200;
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                       .set_max_threads(4)
+                                       .set_work_stealing(true)));
+
+  vector<unique_ptr<ThreadPoolToken>> tokens;
+  vector<vector<int>> results(kNumTokens);
+  vector<unique_ptr<atomic<bool>>> running;
+  atomic<int> overlaps(0);
+  for (int i = 0; i < kNumTokens; i++) {
+    tokens.emplace_back(pool_->NewToken(ThreadPool::ExecutionMode::SERIAL));
+    running.emplace_back(new atomic<bool>(false));
+  }
+
+  // Submit from several threads at once, and from the tasks themselves.
+  vector<thread> threads;
+  for (int t = 0; t < kNumTokens; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kNumSubmissions; i++) {
+        CHECK_OK(tokens[t]->SubmitFunc([&, t, i]() {
+          if (running[t]->exchange(true)) {
+            overlaps++;
+          }
+          results[t].push_back(i);
+          CHECK_OK(pool_->SubmitFunc([]() {}));
+          running[t]->store(false);
+        }));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  pool_->Wait();
+
+  ASSERT_EQ(0, overlaps);
+  for (const auto& r : results) {
+    ASSERT_EQ(kNumSubmissions, static_cast<int>(r.size()));
+    for (int i = 0; i < kNumSubmissions; i++) {
+      ASSERT_EQ(i, r[i]);
+    }
+  }
+}
+
+TEST_P(ThreadPoolTestTokenTypes, TestWorkStealingTokenShutdown) {
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                       .set_max_threads(4)
+                                       .set_work_stealing(true)));
+
+  unique_ptr<ThreadPoolToken> t1(pool_->NewToken(GetParam()));
+  unique_ptr<ThreadPoolToken> t2(pool_->NewToken(GetParam()));
+  CountDownLatch l1(1);
+  CountDownLatch l2(1);
+  atomic<int> t1_runs(0);
+
+  alarm(60);
+  SCOPED_CLEANUP({
+    alarm(0); // Disable alarm on test exit.
+  });
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(t1->SubmitFunc([&]() {
+      l1.Wait();
+      t1_runs++;
+    }));
+  }
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(t2->SubmitFunc([&]() { l2.Wait(); }));
+  }
+
+  // If this waited for t2's tasks, it would deadlock.
+  l1.CountDown();
+  t1->Shutdown();
+  ASSERT_LE(t1_runs, 3);
+  ASSERT_TRUE(t1->SubmitFunc([]() {}).IsServiceUnavailable());
+  ASSERT_OK(t2->SubmitFunc([]() {}));
+
+  l2.CountDown();
+  pool_->Wait();
+  pool_->Shutdown();
+  Status s = pool_->SubmitFunc([]() {});
+  ASSERT_EQ("Service unavailable: The pool has been shut down.", s.ToString());
+  ASSERT_TRUE(t2->SubmitFunc([]() {}).IsServiceUnavailable());
+}
+
 } // namespace kudu
@@ -17,12 +17,14 @@
 
 #include "kudu/util/threadpool.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <limits>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include <glog/logging.h>
@@ -33,6 +35,7 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/sysinfo.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/thread.h"
@@ -44,8 +47,17 @@ namespace kudu {
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
+namespace {
+
+// The work stealing pool and worker index of the current thread, if any.
+__thread ThreadPool* tls_work_stealing_pool = nullptr;
+__thread int tls_work_stealing_worker = -1;
+
+} // anonymous namespace
+
 ////////////////////////////////////////////////////////
 // FunctionRunnable
 ////////////////////////////////////////////////////////
@@ -88,7 +100,8 @@ ThreadPoolBuilder::ThreadPoolBuilder(string name)
       min_threads_(0),
       max_threads_(base::NumCPUs()),
       max_queue_size_(std::numeric_limits<int>::max()),
-      idle_timeout_(MonoDelta::FromMilliseconds(500)) {}
+      idle_timeout_(MonoDelta::FromMilliseconds(500)),
+      work_stealing_(false) {}
 
 ThreadPoolBuilder& ThreadPoolBuilder::set_trace_metric_prefix(
     const string& prefix) {
@@ -124,6 +137,16 @@ ThreadPoolBuilder& ThreadPoolBuilder::set_metrics(ThreadPoolMetrics metrics) {
   return *this;
 }
 
+ThreadPoolBuilder& ThreadPoolBuilder::set_cpus(vector<int> cpus) {
+  cpus_ = std::move(cpus);
+  return *this;
+}
+
+ThreadPoolBuilder& ThreadPoolBuilder::set_work_stealing(bool work_stealing) {
+  work_stealing_ = work_stealing;
+  return *this;
+}
+
 Status ThreadPoolBuilder::Build(unique_ptr<ThreadPool>* pool) const {
   pool->reset(new ThreadPool(*this));
   RETURN_NOT_OK((*pool)->Init());
@@ -163,6 +186,10 @@ Status ThreadPoolToken::Submit(shared_ptr<Runnable> r) {
 }
 
 void ThreadPoolToken::Shutdown() {
+  if (pool_->work_stealing_) {
+    pool_->WorkStealingTokenShutdown(this);
+    return;
+  }
   MutexLock unique_lock(pool_->lock_);
   pool_->CheckNotPoolThreadUnlocked();
 
@@ -321,6 +348,7 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       max_threads_(builder.max_threads_),
       max_queue_size_(builder.max_queue_size_),
       idle_timeout_(builder.idle_timeout_),
+      cpus_(builder.cpus_),
       pool_status_(Status::Uninitialized("The pool was not initialized.")),
       idle_cond_(&lock_),
       no_threads_cond_(&lock_),
@@ -328,6 +356,12 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       num_threads_pending_start_(0),
       active_threads_(0),
       total_queued_tasks_(0),
+      work_stealing_(builder.work_stealing_),
+      num_workers_(0),
+      num_idle_workers_(0),
+      next_worker_(0),
+      outstanding_tasks_(0),
+      shutting_down_(false),
       tokenless_(NewToken(ExecutionMode::CONCURRENT)),
       metrics_(builder.metrics_) {
   string prefix = !builder.trace_metric_prefix_.empty()
@@ -338,6 +372,13 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
       TraceMetrics::InternName(prefix + ".queue_time_us");
   run_wall_time_trace_metric_name_ =
       TraceMetrics::InternName(prefix + ".run_wall_time_us");
+
+  if (work_stealing_) {
+    workers_.reserve(max_threads_);
+    for (int i = 0; i < max_threads_; i++) {
+      workers_.emplace_back(new Worker());
+    }
+  }
 }
 
 ThreadPool::~ThreadPool() {
@@ -355,8 +396,12 @@ Status ThreadPool::Init() {
   }
   pool_status_ = Status::OK();
   num_threads_pending_start_ = min_threads_;
+  if (work_stealing_) {
+    num_workers_ = min_threads_;
+  }
   for (int i = 0; i < min_threads_; i++) {
-    Status status = CreateThread();
+    Status status =
+        work_stealing_ ? CreateWorkStealingThread(i) : CreateThread();
     if (!status.ok()) {
       Shutdown();
       return status;
@@ -366,6 +411,10 @@ Status ThreadPool::Init() {
 }
 
 void ThreadPool::Shutdown() {
+  if (work_stealing_) {
+    WorkStealingShutdown();
+    return;
+  }
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
 
@@ -471,6 +520,9 @@ Status ThreadPool::Submit(shared_ptr<Runnable> r) {
 Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
   DCHECK(token);
   MonoTime submit_time = MonoTime::Now();
+  if (work_stealing_) {
+    return WorkStealingSubmit(std::move(r), token, submit_time);
+  }
 
   MutexLock guard(lock_);
   if (PREDICT_FALSE(!pool_status_.ok())) {
@@ -590,7 +642,8 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
 void ThreadPool::Wait() {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (total_queued_tasks_ > 0 || active_threads_ > 0 ||
+         outstanding_tasks_ > 0) {
     idle_cond_.Wait();
   }
 }
@@ -598,7 +651,8 @@ void ThreadPool::Wait() {
 bool ThreadPool::WaitUntil(const MonoTime& until) {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (total_queued_tasks_ > 0 || active_threads_ > 0 ||
+         outstanding_tasks_ > 0) {
     if (!idle_cond_.WaitUntil(until)) {
       return false;
     }
@@ -611,6 +665,12 @@ bool ThreadPool::WaitFor(const MonoDelta& delta) {
 }
 
 void ThreadPool::DispatchThread() {
+  Status s = BindCurrentThreadToCpus(cpus_);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << name_ << ": " << s.ToString() << THROTTLE_MSG;
+  }
+
   MutexLock unique_lock(lock_);
   InsertOrDie(&threads_, Thread::current_thread());
   DCHECK_GT(num_threads_pending_start_, 0);
@@ -679,46 +739,7 @@ void ThreadPool::DispatchThread() {
 
     unique_lock.Unlock();
 
-    // Release the reference which was held by the queued item.
-    ADOPT_TRACE(task.trace);
-    if (task.trace) {
-      task.trace->Release();
-    }
-
-    // Update metrics
-    MonoTime now(MonoTime::Now());
-    int64_t queue_time_us = (now - task.submit_time).ToMicroseconds();
-    TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
-    if (metrics_.queue_time_us_histogram) {
-      metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-    if (token->metrics_.queue_time_us_histogram) {
-      token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-
-    // Execute the task
-    {
-      kudu::MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
-
-      task.runnable->Run();
-
-      int64_t wall_us = GetMonoTimeMicros() - start_wall_us;
-
-      if (metrics_.run_time_us_histogram) {
-        metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      if (token->metrics_.run_time_us_histogram) {
-        token->metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
-    }
-    // Destruct the task while we do not hold the lock.
-    //
-    // The task's destructor may be expensive if it has a lot of bound
-    // objects, and we don't want to block submission of the threadpool.
-    // In the worst case, the destructor might even try to do something
-    // with this threadpool, and produce a deadlock.
-    task.runnable.reset();
+    RunTask(&task, token);
     unique_lock.Lock();
 
     // Possible states:
@@ -761,6 +782,468 @@ void ThreadPool::DispatchThread() {
   }
 }
 
+void ThreadPool::RunTask(Task* task, ThreadPoolToken* token) {
+  // Release the reference which was held by the queued item.
+  ADOPT_TRACE(task->trace);
+  if (task->trace) {
+    task->trace->Release();
+  }
+
+  // Update metrics
+  MonoTime now(MonoTime::Now());
+  int64_t queue_time_us = (now - task->submit_time).ToMicroseconds();
+  TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
+  if (metrics_.queue_time_us_histogram) {
+    metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+  if (token->metrics_.queue_time_us_histogram) {
+    token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+
+  // Execute the task
+  {
+    kudu::MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
+
+    task->runnable->Run();
+
+    int64_t wall_us = GetMonoTimeMicros() - start_wall_us;
+
+    if (metrics_.run_time_us_histogram) {
+      metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    if (token->metrics_.run_time_us_histogram) {
+      token->metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
+  }
+  // Destruct the task while we do not hold the lock.
+  //
+  // The task's destructor may be expensive if it has a lot of bound
+  // objects, and we don't want to block submission of the threadpool.
+  // In the worst case, the destructor might even try to do something
+  // with this threadpool, and produce a deadlock.
+  task->runnable.reset();
+}
+
+void ThreadPool::ReleaseTask(Task* task) {
+  if (task->trace) {
+    task->trace->Release();
+    task->trace = nullptr;
+  }
+  task->runnable.reset();
+}
+
+Status ThreadPool::WorkStealingSubmit(
+    shared_ptr<Runnable> r,
+    ThreadPoolToken* token,
+    MonoTime submit_time) {
+  // Count the task before checking for shutdown, so that the shutdown, which
+  // waits for the counts to drop to zero, either refuses it or drops it.
+  int64_t length_at_submit = outstanding_tasks_++;
+  token->ws_outstanding_tasks_++;
+  if (PREDICT_FALSE(shutting_down_)) {
+    FinishTasks(token, 1, 0);
+    return Status::ServiceUnavailable("The pool has been shut down.");
+  }
+  if (PREDICT_FALSE(token->ws_shut_down_)) {
+    FinishTasks(token, 1, 0);
+    return Status::ServiceUnavailable("Thread pool token was shut down");
+  }
+  if (length_at_submit >=
+      static_cast<int64_t>(max_threads_) + max_queue_size_) {
+    FinishTasks(token, 1, 0);
+    return Status::ServiceUnavailable(Substitute(
+        "Thread pool is at capacity ($0 tasks outstanding, $1 threads, $2 "
+        "queue size)",
+        length_at_submit,
+        max_threads_,
+        max_queue_size_));
+  }
+
+  // Start another thread if none is idle. As in DoSubmit(), the thread is
+  // created outside the lock; the lock is only taken to grow the pool.
+  int new_worker = -1;
+  if (num_idle_workers_ == 0 && num_workers_ < max_threads_) {
+    MutexLock guard(lock_);
+    int n = num_workers_;
+    if (pool_status_.ok() && n < max_threads_) {
+      new_worker = n;
+      num_workers_ = n + 1;
+      num_threads_pending_start_++;
+    }
+  }
+
+  Task task;
+  task.runnable = std::move(r);
+  task.trace = Trace::CurrentTrace();
+  // Need to AddRef, since the thread which submitted the task may go away,
+  // and we don't want the trace to be destructed while waiting in the queue.
+  if (task.trace) {
+    task.trace->AddRef();
+  }
+  task.submit_time = submit_time;
+
+  WorkItem item;
+  item.token = token;
+  if (token->mode() == ExecutionMode::SERIAL) {
+    // The token is scheduled at most once at a time, and its tasks queue up
+    // behind it, so that they run one at a time and in order.
+    bool schedule;
+    {
+      std::lock_guard<simple_spinlock> l(token->ws_lock_);
+      token->entries_.emplace_back(std::move(task));
+      schedule = !token->ws_scheduled_;
+      if (schedule) {
+        token->ws_scheduled_ = true;
+        token->ws_outstanding_tasks_++;
+      }
+    }
+    if (schedule) {
+      PushWorkItem(std::move(item));
+    }
+  } else {
+    item.task = std::move(task);
+    PushWorkItem(std::move(item));
+  }
+
+  if (metrics_.queue_length_histogram) {
+    metrics_.queue_length_histogram->Increment(length_at_submit);
+  }
+  if (token->metrics_.queue_length_histogram) {
+    token->metrics_.queue_length_histogram->Increment(length_at_submit);
+  }
+
+  if (new_worker >= 0) {
+    Status status = CreateWorkStealingThread(new_worker);
+    if (!status.ok()) {
+      // The items queued to the worker are stolen by the others.
+      MutexLock guard(lock_);
+      num_threads_pending_start_--;
+      if (num_threads_ + num_threads_pending_start_ == 0) {
+        return status;
+      }
+      LOG(ERROR) << "Thread pool failed to create thread: "
+                 << status.ToString();
+    }
+  }
+  return Status::OK();
+}
+
+void ThreadPool::PushWorkItem(WorkItem item) {
+  int index;
+  if (tls_work_stealing_pool == this) {
+    index = tls_work_stealing_worker;
+  } else {
+    index = next_worker_++ % std::max(1, num_workers_.load());
+  }
+  Worker* w = workers_[index].get();
+  {
+    std::lock_guard<simple_spinlock> l(w->lock);
+    w->items.emplace_back(std::move(item));
+  }
+
+  // Pairs with the fence in WorkStealingDispatchThread(): either the worker
+  // going idle sees the item, or we see the idle worker.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_idle_workers_ == 0) {
+    return;
+  }
+  // Wake the most recently idle worker, as DoSubmit() does.
+  int idle = -1;
+  {
+    std::lock_guard<simple_spinlock> l(idle_workers_lock_);
+    if (!idle_workers_.empty()) {
+      idle = idle_workers_.back();
+      idle_workers_.pop_back();
+      num_idle_workers_--;
+    }
+  }
+  if (idle >= 0) {
+    workers_[idle]->wakeup.Release();
+  }
+}
+
+bool ThreadPool::PopWorkItem(int index, WorkItem* item) {
+  int n = num_workers_;
+  for (int i = 0; i < std::max(1, n); i++) {
+    Worker* w = workers_[(index + i) % std::max(1, n)].get();
+    std::lock_guard<simple_spinlock> l(w->lock);
+    if (!w->items.empty()) {
+      *item = std::move(w->items.front());
+      w->items.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::RunWorkItem(WorkItem* item, int index) {
+  ThreadPoolToken* token = item->token;
+  if (token->mode() == ExecutionMode::CONCURRENT) {
+    if (PREDICT_FALSE(token->ws_shut_down_)) {
+      ReleaseTask(&item->task);
+    } else {
+      RunTask(&item->task, token);
+    }
+    FinishTasks(token, 1, 0);
+    return;
+  }
+
+  Task task;
+  std::deque<Task> to_release;
+  bool drop = false;
+  {
+    std::lock_guard<simple_spinlock> l(token->ws_lock_);
+    // The entries may have been taken by WorkStealingTokenShutdown().
+    if (PREDICT_FALSE(token->ws_shut_down_ || token->entries_.empty())) {
+      to_release = std::move(token->entries_);
+      token->entries_.clear();
+      token->ws_scheduled_ = false;
+      drop = true;
+    } else {
+      task = std::move(token->entries_.front());
+      token->entries_.pop_front();
+    }
+  }
+  if (drop) {
+    for (auto& t : to_release) {
+      ReleaseTask(&t);
+    }
+    FinishTasks(token, to_release.size(), 1);
+    return;
+  }
+
+  RunTask(&task, token);
+
+  // Possible outcomes, as in DispatchThread():
+  // 1. The token was shut down while we ran its task. Drop the rest.
+  // 2. The token has no more queued tasks. Unschedule it.
+  // 3. The token has more tasks. Requeue it behind the other items.
+  bool requeue = false;
+  {
+    std::lock_guard<simple_spinlock> l(token->ws_lock_);
+    if (PREDICT_FALSE(token->ws_shut_down_)) {
+      to_release = std::move(token->entries_);
+      token->entries_.clear();
+      token->ws_scheduled_ = false;
+    } else if (token->entries_.empty()) {
+      token->ws_scheduled_ = false;
+    } else {
+      requeue = true;
+    }
+  }
+  if (requeue) {
+    PushWorkItem(std::move(*item));
+  }
+  for (auto& t : to_release) {
+    ReleaseTask(&t);
+  }
+  FinishTasks(token, 1 + to_release.size(), requeue ? 0 : 1);
+}
+
+void ThreadPool::FinishTasks(
+    ThreadPoolToken* token,
+    int64_t num_tasks,
+    int num_items) {
+  if (num_tasks + num_items > 0) {
+    DecrementOutstanding(
+        &token->ws_outstanding_tasks_,
+        num_tasks + num_items,
+        &token->not_running_cond_);
+  }
+  if (num_tasks > 0) {
+    DecrementOutstanding(&outstanding_tasks_, num_tasks, &idle_cond_);
+  }
+}
+
+void ThreadPool::DecrementOutstanding(
+    std::atomic<int64_t>* count,
+    int64_t n,
+    ConditionVariable* cond) {
+  int64_t v = count->load();
+  while (true) {
+    if (v == n) {
+      // Besides waking the waiters, holding the lock keeps a token from being
+      // destroyed under us once its count is zero.
+      MutexLock guard(lock_);
+      if (count->fetch_sub(n) == n) {
+        cond->Broadcast();
+      }
+      return;
+    }
+    DCHECK_GT(v, n);
+    if (count->compare_exchange_weak(v, v - n)) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::WorkStealingDispatchThread(int index) {
+  Status s = BindCurrentThreadToCpus(cpus_);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60)
+        << name_ << ": " << s.ToString() << THROTTLE_MSG;
+  }
+
+  {
+    MutexLock guard(lock_);
+    InsertOrDie(&threads_, Thread::current_thread());
+    DCHECK_GT(num_threads_pending_start_, 0);
+    num_threads_++;
+    num_threads_pending_start_--;
+  }
+  tls_work_stealing_pool = this;
+  tls_work_stealing_worker = index;
+
+  Worker* me = workers_[index].get();
+  while (!shutting_down_) {
+    WorkItem item;
+    if (PopWorkItem(index, &item)) {
+      RunWorkItem(&item, index);
+      continue;
+    }
+
+    // There's no work to do, let's go idle. Check the queues again after
+    // showing up as idle, see PushWorkItem().
+    {
+      std::lock_guard<simple_spinlock> l(idle_workers_lock_);
+      idle_workers_.push_back(index);
+      num_idle_workers_++;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool popped = !shutting_down_ && PopWorkItem(index, &item);
+    if (popped || shutting_down_) {
+      bool woken;
+      {
+        std::lock_guard<simple_spinlock> l(idle_workers_lock_);
+        auto it = std::find(idle_workers_.begin(), idle_workers_.end(), index);
+        woken = it == idle_workers_.end();
+        if (!woken) {
+          idle_workers_.erase(it);
+          num_idle_workers_--;
+        }
+      }
+      if (woken) {
+        // Consume the wakeup that was meant for us.
+        me->wakeup.Acquire();
+      }
+      if (popped) {
+        RunWorkItem(&item, index);
+      }
+      continue;
+    }
+    me->wakeup.Acquire();
+  }
+
+  tls_work_stealing_pool = nullptr;
+  tls_work_stealing_worker = -1;
+  MutexLock guard(lock_);
+  CHECK_EQ(threads_.erase(Thread::current_thread()), 1);
+  num_threads_--;
+  if (num_threads_ + num_threads_pending_start_ == 0) {
+    no_threads_cond_.Broadcast();
+  }
+}
+
+void ThreadPool::WorkStealingShutdown() {
+  MutexLock unique_lock(lock_);
+  CheckNotPoolThreadUnlocked();
+  pool_status_ = Status::ServiceUnavailable("The pool has been shut down.");
+  shutting_down_ = true;
+  for (auto* t : tokens_) {
+    t->ws_shut_down_ = true;
+  }
+  unique_lock.Unlock();
+
+  // Wake the idle workers and wait for all of them to exit. The others exit
+  // after they finish their current item.
+  vector<int> idle;
+  {
+    std::lock_guard<simple_spinlock> l(idle_workers_lock_);
+    idle.swap(idle_workers_);
+    num_idle_workers_ = 0;
+  }
+  for (int i : idle) {
+    workers_[i]->wakeup.Release();
+  }
+  unique_lock.Lock();
+  while (num_threads_ + num_threads_pending_start_ > 0) {
+    no_threads_cond_.Wait();
+  }
+  unique_lock.Unlock();
+
+  // Drop the queued items, outside the lock. Submissions racing with the
+  // shutdown are counted before being refused or queued, so wait for them
+  // too.
+  while (outstanding_tasks_ > 0) {
+    WorkItem item;
+    while (PopWorkItem(0, &item)) {
+      RunWorkItem(&item, 0);
+    }
+    std::this_thread::yield();
+  }
+
+  unique_lock.Lock();
+  for (auto* t : tokens_) {
+    if (t->state() != ThreadPoolToken::State::QUIESCED &&
+        !t->IsActive()) {
+      t->Transition(ThreadPoolToken::State::QUIESCED);
+    }
+  }
+}
+
+void ThreadPool::WorkStealingTokenShutdown(ThreadPoolToken* token) {
+  MutexLock unique_lock(lock_);
+  CheckNotPoolThreadUnlocked();
+  unique_lock.Unlock();
+
+  // Remove the token's queued items and tasks, and release them outside the
+  // locks. Items already popped by a worker are dropped by it. This is an
+  // O(n) operation, but it's expected to be infrequent.
+  token->ws_shut_down_ = true;
+  std::deque<Task> to_release;
+  int num_items = 0;
+  for (int i = 0; i < num_workers_; i++) {
+    Worker* w = workers_[i].get();
+    std::lock_guard<simple_spinlock> l(w->lock);
+    for (auto it = w->items.begin(); it != w->items.end();) {
+      if (it->token != token) {
+        ++it;
+        continue;
+      }
+      if (token->mode() == ExecutionMode::SERIAL) {
+        num_items++;
+      } else {
+        to_release.emplace_back(std::move(it->task));
+      }
+      it = w->items.erase(it);
+    }
+  }
+  if (token->mode() == ExecutionMode::SERIAL) {
+    std::lock_guard<simple_spinlock> l(token->ws_lock_);
+    for (auto& t : token->entries_) {
+      to_release.emplace_back(std::move(t));
+    }
+    token->entries_.clear();
+    if (num_items > 0) {
+      token->ws_scheduled_ = false;
+    }
+  }
+  for (auto& t : to_release) {
+    ReleaseTask(&t);
+  }
+  FinishTasks(token, to_release.size(), num_items);
+
+  // Wait for the running tasks.
+  unique_lock.Lock();
+  while (token->IsActive()) {
+    token->not_running_cond_.Wait();
+  }
+  if (token->state() != ThreadPoolToken::State::QUIESCED) {
+    token->Transition(ThreadPoolToken::State::QUIESCED);
+  }
+}
+
 Status ThreadPool::CreateThread() {
   return kudu::Thread::Create(
       "thread pool",
@@ -770,6 +1253,16 @@ Status ThreadPool::CreateThread() {
       nullptr);
 }
 
+Status ThreadPool::CreateWorkStealingThread(int index) {
+  return kudu::Thread::Create(
+      "thread pool",
+      strings::Substitute("$0_[worker]", name_),
+      &ThreadPool::WorkStealingDispatchThread,
+      this,
+      index,
+      nullptr);
+}
+
 void ThreadPool::CheckNotPoolThreadUnlocked() {
   Thread* current = Thread::current_thread();
   if (ContainsKey(threads_, current)) {
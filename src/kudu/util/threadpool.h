@@ -17,11 +17,14 @@
 #ifndef KUDU_UTIL_THREAD_POOL_H
 #define KUDU_UTIL_THREAD_POOL_H
 
+#include <atomic>
+#include <cstdint>
 #include <deque>
 #include <iosfwd>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/list_hook.hpp>
@@ -32,9 +35,11 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
+#include "kudu/util/semaphore.h"
 #include "kudu/util/status.h"
 
 namespace boost {
@@ -113,6 +118,15 @@ struct ThreadPoolMetrics {
 // metrics: Histograms, counters, etc. to update on various threadpool events.
 //    Default: not set.
 //
+// cpus: CPUs to bind the pool's threads to.
+//    Default: empty, meaning the threads are not bound.
+//
+// work_stealing: Whether each worker thread has its own queue of tasks and
+//    steals from the others' when its own is empty, rather than all of them
+//    sharing one queue under one lock. Threads are still started on demand
+//    up to max_threads, but they never time out.
+//    Default: false.
+//
 class ThreadPoolBuilder {
  public:
   explicit ThreadPoolBuilder(std::string name);
@@ -125,6 +139,8 @@ class ThreadPoolBuilder {
   ThreadPoolBuilder& set_max_queue_size(int max_queue_size);
   ThreadPoolBuilder& set_idle_timeout(const MonoDelta& idle_timeout);
   ThreadPoolBuilder& set_metrics(ThreadPoolMetrics metrics);
+  ThreadPoolBuilder& set_cpus(std::vector<int> cpus);
+  ThreadPoolBuilder& set_work_stealing(bool work_stealing);
 
   // Instantiate a new ThreadPool with the existing builder arguments.
   Status Build(std::unique_ptr<ThreadPool>* pool) const;
@@ -138,6 +154,8 @@ class ThreadPoolBuilder {
   int max_queue_size_;
   MonoDelta idle_timeout_;
   ThreadPoolMetrics metrics_;
+  std::vector<int> cpus_;
+  bool work_stealing_;
 
   DISALLOW_COPY_AND_ASSIGN(ThreadPoolBuilder);
 };
@@ -163,6 +181,9 @@ class ThreadPoolBuilder {
 // from starving one another. However, tokenless (and CONCURRENT token-based)
 // tasks can starve SERIAL token-based tasks.
 //
+// A work stealing pool (see ThreadPoolBuilder) keeps the same guarantees for
+// SERIAL tokens, but otherwise runs tasks in roughly FIFO order only.
+//
 // Usage Example:
 //    static void Func(int n) { ... }
 //    class Task : public Runnable { ... }
@@ -252,6 +273,23 @@ class ThreadPool {
     MonoTime submit_time;
   };
 
+  // Entry of a work stealing worker's queue: either a task of a CONCURRENT
+  // token, or a SERIAL token whose next task should be run.
+  struct WorkItem {
+    ThreadPoolToken* token;
+    // Unset for SERIAL tokens.
+    Task task;
+  };
+
+  // A work stealing worker thread. Its queue is popped from the front, by its
+  // thread or by the others stealing from it.
+  struct Worker {
+    simple_spinlock lock;
+    std::deque<WorkItem> items;
+    // Released to wake the thread while it is idle.
+    Semaphore wakeup{0};
+  };
+
   // Creates a new thread pool using a builder.
   explicit ThreadPool(const ThreadPoolBuilder& builder);
 
@@ -267,6 +305,9 @@ class ThreadPool {
   // call. NOTE: For performance reasons, lock_ should not be held.
   Status CreateThread();
 
+  // Like CreateThread(), for the thread of work stealing worker 'index'.
+  Status CreateWorkStealingThread(int index);
+
   // Aborts if the current thread is a member of this thread pool.
   void CheckNotPoolThreadUnlocked();
 
@@ -276,11 +317,49 @@ class ThreadPool {
   // Releases token 't' and invalidates it.
   void ReleaseToken(ThreadPoolToken* t);
 
+  // Runs 'task', belonging to 'token', and updates the metrics.
+  void RunTask(Task* task, ThreadPoolToken* token);
+
+  // Releases the trace of 'task' without running it.
+  static void ReleaseTask(Task* task);
+
+  // Work stealing counterparts of the functions above.
+  Status WorkStealingSubmit(
+      std::shared_ptr<Runnable> r,
+      ThreadPoolToken* token,
+      MonoTime submit_time);
+  void WorkStealingDispatchThread(int index);
+  void WorkStealingShutdown();
+  void WorkStealingTokenShutdown(ThreadPoolToken* token);
+
+  // Pushes 'item' to the queue of the calling worker, or of some worker if
+  // the caller isn't one, and wakes an idle worker.
+  void PushWorkItem(WorkItem item);
+
+  // Pops in 'item' the next item from the queue of worker 'index', or steals
+  // one from another worker. Returns false if all queues are empty.
+  bool PopWorkItem(int index, WorkItem* item);
+
+  // Runs or, if its token was shut down, drops 'item'.
+  void RunWorkItem(WorkItem* item, int index);
+
+  // Counts 'num_tasks' tasks and 'num_items' SERIAL work items of 'token'
+  // as done, dropped or refused. 'token' may be destroyed once this returns.
+  void FinishTasks(ThreadPoolToken* token, int64_t num_tasks, int num_items);
+
+  // Subtracts 'n' from 'count', taking lock_ and broadcasting 'cond' if it
+  // drops to zero so that waiters checking 'count' under lock_ can't miss it.
+  void DecrementOutstanding(
+      std::atomic<int64_t>* count,
+      int64_t n,
+      ConditionVariable* cond);
+
   const std::string name_;
   const int min_threads_;
   const int max_threads_;
   const int max_queue_size_;
   const MonoDelta idle_timeout_;
+  const std::vector<int> cpus_;
 
   // Overall status of the pool. Set to an error when the pool is shut down.
   //
@@ -360,6 +439,32 @@ class ThreadPool {
   boost::intrusive::list<IdleThread>
       idle_threads_; // NOLINT(build/include_what_you_use)
 
+  // The fields below are only used by work stealing pools, in place of
+  // queue_, idle_threads_, total_queued_tasks_, active_threads_ and the
+  // tokens' state machines, so that submitting and running tasks does not
+  // take lock_. They are declared before tokenless_, whose destructor uses
+  // them.
+  const bool work_stealing_;
+
+  // One per potential thread; the first 'num_workers_' have a thread.
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<int> num_workers_;
+
+  // Indexes of the workers waiting for work, the most recently idle last.
+  simple_spinlock idle_workers_lock_;
+  std::vector<int> idle_workers_;
+  std::atomic<int> num_idle_workers_;
+
+  // Round-robin counter picking the queue of submissions from outside the
+  // pool.
+  std::atomic<uint32_t> next_worker_;
+
+  // Tasks submitted and not yet run or dropped. Drops to zero under lock_.
+  std::atomic<int64_t> outstanding_tasks_;
+
+  // Set when the pool starts shutting down.
+  std::atomic<bool> shutting_down_;
+
   // ExecutionMode::CONCURRENT token used by the pool for tokenless submission.
   std::unique_ptr<ThreadPoolToken> tokenless_;
 
@@ -463,6 +568,9 @@ class ThreadPoolToken {
   // Returns true if this token has a task queued and ready to run, or if a
   // task belonging to this token is already running.
   bool IsActive() const {
+    if (pool_->work_stealing_) {
+      return ws_outstanding_tasks_ > 0;
+    }
     return state_ == State::RUNNING || state_ == State::QUIESCING;
   }
 
@@ -501,6 +609,23 @@ class ThreadPoolToken {
   // token.
   int active_threads_;
 
+  // The fields below are only used in work stealing pools. There, state_
+  // stays IDLE until the token is shut down, and only SERIAL tokens queue
+  // tasks in entries_, protected by ws_lock_ rather than by the pool's lock.
+  simple_spinlock ws_lock_;
+
+  // Whether a work item of this SERIAL token is queued or running.
+  //
+  // Protected by ws_lock_.
+  bool ws_scheduled_ = false;
+
+  // Tasks submitted via this token and not yet run or dropped, plus one if
+  // ws_scheduled_. Drops to zero under the pool's lock.
+  std::atomic<int64_t> ws_outstanding_tasks_{0};
+
+  // Set when the token or the pool is shut down.
+  std::atomic<bool> ws_shut_down_{false};
+
   DISALLOW_COPY_AND_ASSIGN(ThreadPoolToken);
 };
 
@@ -54,9 +54,16 @@ class Trace;
     }                                                     \
   } while (0);
 
-// Like the above, but takes the trace pointer as an explicit argument.
-#define TRACE_TO(trace, format, substitutions...) \
-  (trace)->SubstituteAndTrace(__FILE__, __LINE__, (format), ##substitutions)
+// Like the above, but takes the trace pointer as an explicit argument, and
+// does nothing if it is null.
+#define TRACE_TO(trace, format, substitutions...)          \
+  do {                                                     \
+    kudu::Trace* _trace_to = (trace);                      \
+    if (_trace_to) {                                       \
+      _trace_to->SubstituteAndTrace(                       \
+          __FILE__, __LINE__, (format), ##substitutions);  \
+    }                                                      \
+  } while (0)
 
 // Increment a counter associated with the current trace.
 //